@@ -5,6 +5,12 @@
 # To run:
 #   ./run-sim.sh
 #
+# To benchmark the pipeline (compare with BENCH_BASELINE=bench-baseline.json):
+#   ./run-sim.sh bench
+#
+# To measure thread scaling (after bench, SCALING_THREADS="1 2 4 8"):
+#   ./run-sim.sh scaling
+#
 # To clear up:
 #   ./run-sim.sh clean
 #
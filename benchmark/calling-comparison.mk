@@ -23,6 +23,10 @@ NTHREADS=2
 NCONTIGS=10000
 # How many samples to load at once
 NUMCOLS=25
+# Pipeline benchmark: baseline summary to compare against and allowed slowdown
+# BENCH_BASELINE=bench-baseline.json
+BENCH_TOLERANCE=0.1
+BENCH_LINK_CLEAN=2
 
 SHELL := /bin/bash
 
@@ -147,6 +151,13 @@ pe_list=$(shell for i in `seq 1 $(NUM_INDIVS)`; do \
 	done; \
 done)
 
+build_list=$(shell for i in `seq 1 $(NUM_INDIVS)`; do \
+	echo -n " --sample Sample$$i"; \
+	for k in `seq $$(($$i * $(PLOIDY) - $(PLOIDY) + 1)) $$(($$i * $(PLOIDY)))`; do \
+		echo -n " --seq2 reads/reads$$k.1.fa.gz reads/reads$$k.2.fa.gz"; \
+	done; \
+done)
+
 # sepe_list=$(shell for i in `seq 1 $(NUM_INDIVS)`; do \
 # 	j=$$(($$i-1)); echo -n " --col $$j"; \
 # 	for k in `seq $$(($$j * $(PLOIDY) + 1)) $$(($$i * $(PLOIDY)))`; do \
@@ -235,6 +246,101 @@ traverse: $(PATHS) k$(KMER)/graphs/pop.ref.ctx
 	@echo == ref copy number ==
 	$(CTX_PATH)/bin/ctx31 view --kmers ref/ref.k$(KMER).ctx | awk '{n[$$2]++} END {for (i in n) print i,n[i]}' | sort -n
 
+#
+# Pipeline benchmark
+# Runs build -> clean -> inferedges -> thread -> links -> contigs/bubbles,
+# recording wall time, peak RSS and counters per stage with --stats-json.
+# Compares to $(BENCH_BASELINE) if set. `make bench-baseline` saves a baseline.
+#
+BENCHDIR=k$(KMER)/bench
+BENCHSTATS=$(BENCHDIR)/stats
+BENCHREPORT=$(CTX_PATH)/scripts/python/pipeline-report.py
+BENCHSTAGES=$(shell echo $(BENCHSTATS)/{build,clean,inferedges,thread,links,contigs,bubbles}.json)
+
+bench: $(BENCHDIR)/summary.json
+
+$(BENCHDIR)/summary.json: $(BENCHSTAGES)
+	python $(BENCHREPORT) --tolerance $(BENCH_TOLERANCE) --out $@ $(BENCHSTATS) $(BENCH_BASELINE)
+
+bench-baseline: $(BENCHDIR)/summary.json
+	cp $< bench-baseline.json
+
+$(BENCHSTATS)/build.json: $(READS)
+	mkdir -p $(BENCHSTATS)
+	$(BUILDCTX) --stats-json $@ -f -t $(NTHREADS) -k $(KMER) $(build_list) $(BENCHDIR)/raw.ctx
+
+$(BENCHSTATS)/clean.json: $(BENCHSTATS)/build.json
+	$(CLEANCTX) --stats-json $@ -f -t $(NTHREADS) -o $(BENCHDIR)/clean.ctx $(BENCHDIR)/raw.ctx
+
+$(BENCHSTATS)/inferedges.json: $(BENCHSTATS)/clean.json
+	$(CTX) inferedges --stats-json $@ -f -m $(MEM) -t $(NTHREADS) -o $(BENCHDIR)/pop.ctx $(BENCHDIR)/clean.ctx
+
+$(BENCHSTATS)/thread.json: $(BENCHSTATS)/inferedges.json
+	$(THREADCTX) --stats-json $@ -f $(pe_list) -o $(BENCHDIR)/pe.ctp.gz $(BENCHDIR)/pop.ctx
+
+$(BENCHSTATS)/links.json: $(BENCHSTATS)/thread.json
+	$(CTX) links --stats-json $@ -f --clean $(BENCH_LINK_CLEAN) -o $(BENCHDIR)/pe.clean.ctp.gz $(BENCHDIR)/pe.ctp.gz
+
+$(BENCHSTATS)/contigs.json: $(BENCHSTATS)/links.json
+	$(CTXCONTIGS) --stats-json $@ -f -t $(NTHREADS) -p $(BENCHDIR)/pe.clean.ctp.gz -o $(BENCHDIR)/contigs.fa $(BENCHDIR)/pop.ctx
+
+$(BENCHSTATS)/bubbles.json: $(BENCHSTATS)/links.json
+	$(BUBBLESCTX) --stats-json $@ -f -t $(NTHREADS) -p $(BENCHDIR)/pe.clean.ctp.gz -o $(BENCHDIR)/bubbles.txt.gz $(BENCHDIR)/pop.ctx
+
+#
+# Thread scaling benchmark
+# Runs build, clean, thread, contigs, bubbles and vcfcov at each thread count in
+# $(SCALING_THREADS) on the inputs and outputs of `make bench`, recording each
+# run with --stats-json. Strong scaling gives every run the same input. Weak
+# scaling gives build and thread the reads once per thread.
+# Writes $(SCALINGDIR)/scaling.csv, scaling.phases.csv and plots (matplotlib).
+# Run without -j so runs do not compete for cores.
+#
+SCALING_THREADS=1 2 4 8
+SCALINGDIR=k$(KMER)/scaling
+SCALINGREPORT=$(CTX_PATH)/scripts/python/scaling-report.py
+SCALINGVCF=k$(KMER)/vcfs/truth.noref.decomp.vcf
+SCALINGRUNS=$(foreach t,$(SCALING_THREADS),$(SCALINGDIR)/strong/t$(t)/done $(SCALINGDIR)/weak/t$(t)/done)
+
+# $(call scaling_build_list,N) and $(call scaling_pe_list,N): build_list and
+# pe_list with each sample's reads given N times
+scaling_build_list=$(shell for i in `seq 1 $(NUM_INDIVS)`; do \
+	echo -n " --sample Sample$$i"; \
+	for r in `seq 1 $(1)`; do \
+	for k in `seq $$(($$i * $(PLOIDY) - $(PLOIDY) + 1)) $$(($$i * $(PLOIDY)))`; do \
+		echo -n " --seq2 reads/reads$$k.1.fa.gz reads/reads$$k.2.fa.gz"; \
+	done; done; \
+done)
+
+scaling_pe_list=$(shell for i in `seq 1 $(NUM_INDIVS)`; do \
+	j=$$(($$i-1)); echo -n " --col $$j"; \
+	for r in `seq 1 $(1)`; do \
+	for k in `seq $$(($$j * $(PLOIDY) + 1)) $$(($$i * $(PLOIDY)))`; do \
+		echo -n " --seq2 reads/reads$$k.1.fa.gz reads/reads$$k.2.fa.gz"; \
+	done; done; \
+done)
+
+scaling: $(SCALINGDIR)/scaling.csv
+
+$(SCALINGDIR)/scaling.csv: $(SCALINGRUNS)
+	python $(SCALINGREPORT) --out $@ --plot $(SCALINGDIR)/scaling $(SCALINGDIR)
+
+$(SCALINGDIR)/strong/t%/done: $(BENCHSTATS)/links.json $(SCALINGVCF) ref/ref.fa
+	mkdir -p $(@D)
+	$(BUILDCTX) --stats-json $(@D)/build.json -f -t $* -k $(KMER) $(build_list) $(@D)/raw.ctx
+	$(CLEANCTX) --stats-json $(@D)/clean.json -f -t $* -o $(@D)/clean.ctx $(BENCHDIR)/raw.ctx
+	$(CTX) thread -m $(THREADMEM) --stats-json $(@D)/thread.json -f -t $* $(pe_list) -o $(@D)/pe.ctp.gz $(BENCHDIR)/pop.ctx
+	$(CTXCONTIGS) --stats-json $(@D)/contigs.json -f -t $* -p $(BENCHDIR)/pe.clean.ctp.gz -o $(@D)/contigs.fa $(BENCHDIR)/pop.ctx
+	$(BUBBLESCTX) --stats-json $(@D)/bubbles.json -f -t $* -p $(BENCHDIR)/pe.clean.ctp.gz -o $(@D)/bubbles.txt.gz $(BENCHDIR)/pop.ctx
+	$(CTX) vcfcov -m $(MEM) --stats-json $(@D)/vcfcov.json -f -t $* -r ref/ref.fa -o $(@D)/vcfcov.vcf $(SCALINGVCF) $(BENCHDIR)/raw.ctx
+	touch $@
+
+$(SCALINGDIR)/weak/t%/done: $(BENCHSTATS)/links.json
+	mkdir -p $(@D)
+	$(BUILDCTX) --stats-json $(@D)/build.json -f -t $* -k $(KMER) $(call scaling_build_list,$*) $(@D)/raw.ctx
+	$(CTX) thread -m $(THREADMEM) --stats-json $(@D)/thread.json -f -t $* $(call scaling_pe_list,$*) -o $(@D)/pe.ctp.gz $(BENCHDIR)/pop.ctx
+	touch $@
+
 clean:
 	rm -rf ref genomes reads k$(KMER) runcalls gap_sizes.*.csv mp_sizes.*.csv stampy.sh
 
@@ -435,5 +541,5 @@ k$(KMER)/vcfs/samples.%.norm.vcf: k$(KMER)/vcfs/samples.%.pass.vcf
 
 .PHONY: all clean test repo checkcmds
 .PHONY: compare-bubbles compare-normvcf $(NORMCMPRULES)
-.PHONY: traverse
+.PHONY: traverse bench bench-baseline scaling
 .FORCE: repo
@@ -6,6 +6,14 @@
 #   cd dir/this/is/in
 #   ./run-sim.sh
 #
+# To benchmark the pipeline (compare with BENCH_BASELINE=bench-baseline.json):
+#   cd dir/this/is/in
+#   ./run-sim.sh bench
+#
+# To measure thread scaling (after bench, SCALING_THREADS="1 2 4 8"):
+#   cd dir/this/is/in
+#   ./run-sim.sh scaling
+#
 # To clear up:
 #   cd dir/this/is/in
 #   ./run-sim.sh clean
@@ -0,0 +1,106 @@
+#include "global.h"
+#include "hash_table.h"
+#include "binary_kmer.h"
+
+#include <getopt.h>
+#include <sys/time.h>
+
+/*
+  Measure single thread insert throughput of hash_table_find_or_insert_mt()
+  compared with hash_table_find_or_insert_batch_mt() at different prefetch
+  depths. The table is allocated to be much larger than the CPU caches so that
+  each insert is a random DRAM access.
+
+  Usage: ./hashbench31 [-n <nkmers>] [-k <kmer_size>] [-b <batch>]
+*/
+
+#define DEFAULT_NKMERS 20000000
+#define DEFAULT_BATCH 64
+
+static double get_secs()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void bench_usage()
+{
+  fprintf(stderr, "usage: hashbench [-n <nkmers>] [-k <kmer_size>] [-b <batch>]\n");
+  exit(EXIT_FAILURE);
+}
+
+// depth == 0 means use the unbatched function
+static double run_bench(const BinaryKmer *bkmers, size_t n, size_t batch,
+                        size_t depth)
+{
+  HashTable ht;
+  hash_table_alloc(&ht, n*1.3);
+  uint8_t *bktlocks = ctx_calloc(roundup_bits2bytes(ht.num_of_buckets), 1);
+  hkey_t hkeys[batch];
+  bool found[batch];
+  size_t i, m;
+
+  double start = get_secs();
+
+  if(depth == 0) {
+    for(i = 0; i < n; i++)
+      hash_table_find_or_insert_mt(&ht, bkmers[i], &found[0], bktlocks);
+  } else {
+    for(i = 0; i < n; i += m) {
+      m = MIN2(batch, n-i);
+      hash_table_find_or_insert_batch_mt(&ht, bkmers+i, m, depth,
+                                         hkeys, found, bktlocks);
+    }
+  }
+
+  double secs = get_secs() - start;
+  if(hash_table_nkmers(&ht) > n) die("Too many kmers in the table");
+
+  ctx_free(bktlocks);
+  hash_table_dealloc(&ht);
+  return secs;
+}
+
+int main(int argc, char **argv)
+{
+  cortex_init();
+  ctx_msg_out = NULL;
+
+  size_t i, n = DEFAULT_NKMERS, kmer_size = MAX_KMER_SIZE, batch = DEFAULT_BATCH;
+  int c;
+
+  while((c = getopt(argc, argv, "n:k:b:h")) >= 0) {
+    switch(c) {
+      case 'n': n = strtoul(optarg, NULL, 10); break;
+      case 'k': kmer_size = strtoul(optarg, NULL, 10); break;
+      case 'b': batch = strtoul(optarg, NULL, 10); break;
+      default: bench_usage();
+    }
+  }
+
+  if(!(kmer_size & 1) || kmer_size < MIN_KMER_SIZE || kmer_size > MAX_KMER_SIZE)
+    die("Invalid kmer size: %zu", kmer_size);
+  if(n == 0 || batch == 0) bench_usage();
+
+  BinaryKmer *bkmers = ctx_malloc(n * sizeof(BinaryKmer));
+  for(i = 0; i < n; i++)
+    bkmers[i] = binary_kmer_random(kmer_size);
+
+  size_t depths[] = {0, 1, 2, 4, 8, 16, 32, 64};
+  size_t ndepths = sizeof(depths) / sizeof(depths[0]);
+
+  printf("nkmers: %zu k: %zu batch: %zu\n", n, kmer_size, batch);
+  printf("depth\tsecs\tMkmers/s\n");
+
+  for(i = 0; i < ndepths; i++) {
+    double secs = run_bench(bkmers, n, batch, depths[i]);
+    if(depths[i]) printf("%zu", depths[i]);
+    else printf("none");
+    printf("\t%.3f\t%.2f\n", secs, n / (secs * 1e6));
+  }
+
+  ctx_free(bkmers);
+  cortex_destroy();
+  return EXIT_SUCCESS;
+}
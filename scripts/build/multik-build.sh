@@ -2,7 +2,5 @@
 
 set -euo pipefail
 
-for k in 31 63 95 127
-do
-  make MAXK=$k $@
-done
+# Build mccortex31,63,95,127 and the bin/mccortex launcher
+make multik $@
@@ -0,0 +1,146 @@
+#!/usr/bin/env python
+from __future__ import print_function
+
+# usage: python perf-check.py [options] <baseline.tsv> <run.json> [...]
+#
+# Compare runs of mccortex against a baseline, to catch performance
+# regressions (see tests/perf). Each <run.json> is the output of
+# `mccortex --stats-json <run.json> <command> ...`, and the run is named after
+# the file (e.g. build.json => build). The baseline has one line per run:
+#
+#   <run> <throughput_counter> <throughput_per_sec> <max_rss_bytes>
+#
+# separated by tabs, where lines starting '#' are comments. A run fails if its
+# throughput (counter / wall time) is below the baseline divided by
+# --max-slowdown, or its peak memory is above the baseline times
+# --max-mem-growth. A run without a baseline line is skipped, unless --strict
+# is given in which case it fails.
+#
+# With --update, write the runs as the new baseline instead of checking.
+#
+# Exits 0 if every run passed or was skipped, 1 otherwise.
+
+import os
+import sys
+import json
+import argparse
+
+def load_scaling_report():
+  path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                      'scaling-report.py')
+  try:
+    import importlib.util
+    spec = importlib.util.spec_from_file_location('scaling_report', path)
+    mod = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(mod)
+    return mod
+  except ImportError:
+    import imp
+    return imp.load_source('scaling_report', path)
+
+# Counter used to measure throughput of each command
+THROUGHPUT = load_scaling_report().THROUGHPUT
+
+BASELINE_HDR = ('# Performance baseline for perf-check.py, written with --update\n'
+                '# run\tthroughput_counter\tthroughput_per_sec\tmax_rss_bytes\n')
+
+def load_baseline(path):
+  base = {}
+  if not os.path.exists(path): return base
+  with open(path) as fh:
+    for line in fh:
+      line = line.strip()
+      if len(line) == 0 or line.startswith('#'): continue
+      f = line.split('\t')
+      if len(f) != 4: raise ValueError('Bad baseline line: '+line)
+      base[f[0]] = {'counter': f[1], 'per_sec': float(f[2]),
+                    'max_rss_bytes': float(f[3])}
+  return base
+
+def load_run(path):
+  name = os.path.basename(path)
+  if name.endswith('.json'): name = name[:-5]
+  with open(path) as fh: s = json.load(fh)
+  counter = THROUGHPUT.get(s['command'], 'kmer_lookups')
+  wall = s['wall_sec']
+  nwork = s.get('counters', {}).get(counter, 0)
+  return {'name': name, 'command': s['command'],
+          'exit_status': s.get('exit_status', 0),
+          'counter': counter, 'wall_sec': wall,
+          'per_sec': nwork / wall if wall > 0 else 0,
+          'max_rss_bytes': s['max_rss_bytes']}
+
+def check(runs, base, max_slowdown, max_mem_growth, strict, fh):
+  nfail = 0
+  print('run\tcounter\trate/s\tbase_rate/s\tmax_rss_MB\tbase_rss_MB\tresult',
+        file=fh)
+  for r in runs:
+    b = base.get(r['name'])
+    errs = []
+    if r['exit_status'] != 0: errs.append('exit status %i' % r['exit_status'])
+    result = 'ok'
+    if b is None:
+      if strict: errs.append('no baseline (record one with --update)')
+      else: result = 'skipped: no baseline'
+    else:
+      if b['counter'] != r['counter']:
+        errs.append('baseline counter is '+b['counter'])
+      elif r['per_sec'] * max_slowdown < b['per_sec']:
+        errs.append('throughput %.2fx baseline' % (r['per_sec'] / b['per_sec']))
+      if r['max_rss_bytes'] > b['max_rss_bytes'] * max_mem_growth:
+        errs.append('memory %.2fx baseline' %
+                    (r['max_rss_bytes'] / b['max_rss_bytes']))
+    if len(errs) > 0:
+      result = 'FAIL: '+', '.join(errs)
+      nfail += 1
+    print('%s\t%s\t%.0f\t%s\t%.1f\t%s\t%s' %
+          (r['name'], r['counter'], r['per_sec'],
+           '%.0f' % b['per_sec'] if b else '-',
+           r['max_rss_bytes'] / 1e6,
+           '%.1f' % (b['max_rss_bytes'] / 1e6) if b else '-', result), file=fh)
+  return nfail
+
+def write_baseline(path, runs):
+  with open(path, 'w') as fh:
+    fh.write(BASELINE_HDR)
+    for r in runs:
+      fh.write('%s\t%s\t%.1f\t%.0f\n' %
+               (r['name'], r['counter'], r['per_sec'], r['max_rss_bytes']))
+
+def main():
+  parser = argparse.ArgumentParser(description='Check runs against a '
+                                               'performance baseline')
+  parser.add_argument('baseline', help='baseline TSV file')
+  parser.add_argument('runs', nargs='+', help='--stats-json output files')
+  parser.add_argument('--max-slowdown', type=float, default=1.25,
+                      help='fail if throughput drops by more than this factor '
+                           '[default: 1.25]')
+  parser.add_argument('--max-mem-growth', type=float, default=1.10,
+                      help='fail if peak memory grows by more than this factor '
+                           '[default: 1.10]')
+  parser.add_argument('--strict', action='store_true',
+                      help='fail runs that have no baseline')
+  parser.add_argument('--update', action='store_true',
+                      help='write runs as the new baseline')
+  args = parser.parse_args()
+
+  if args.max_slowdown < 1 or args.max_mem_growth < 1:
+    parser.error('--max-slowdown and --max-mem-growth must be >= 1')
+
+  runs = [load_run(path) for path in args.runs]
+
+  if args.update:
+    write_baseline(args.baseline, runs)
+    print('Wrote baseline of %i runs: %s' % (len(runs), args.baseline),
+          file=sys.stderr)
+    return
+
+  base = load_baseline(args.baseline)
+  nfail = check(runs, base, args.max_slowdown, args.max_mem_growth,
+                args.strict, sys.stdout)
+  if nfail > 0:
+    print('%i of %i runs failed' % (nfail, len(runs)), file=sys.stderr)
+    sys.exit(1)
+
+if __name__ == '__main__':
+  main()
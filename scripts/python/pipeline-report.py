@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+from __future__ import print_function
+
+# usage: python pipeline-report.py [options] <stats-dir> [baseline.json]
+#
+# Summarise the JSON written by `mccortex --stats-json` for each stage of a
+# pipeline run (see `make bench` in benchmark/calling-comparison.mk). Prints a
+# table of wall time, CPU time, peak RSS, kmers/s and links/s per stage and
+# writes the summary as JSON with --out.
+#
+# If a baseline summary is given, each stage is compared against it and we
+# exit with status 1 if any stage is slower or uses more memory than the
+# baseline by more than --tolerance (default 0.1 i.e. 10%).
+#
+# Stages are run in this order, any missing are skipped.
+
+import os
+import sys
+import json
+import argparse
+
+STAGES = ['build', 'clean', 'inferedges', 'thread', 'links', 'contigs',
+          'bubbles']
+
+# (field, larger_is_worse)
+COMPARE = [('wall_sec', True), ('max_rss_bytes', True),
+           ('kmers_per_sec', False), ('links_per_sec', False)]
+
+def load_stage(path):
+  with open(path) as fh:
+    stats = json.load(fh)
+  wall = stats['wall_sec']
+  counters = stats.get('counters', {})
+  kmers = counters.get('kmers_inserted', 0)
+  links = counters.get('links_added', 0)
+  return {'exit_status': stats['exit_status'],
+          'wall_sec': wall,
+          'cpu_sec': stats['user_sec'] + stats['sys_sec'],
+          'cpu_util': stats['cpu_util'],
+          'max_rss_bytes': stats['max_rss_bytes'],
+          'kmers_inserted': kmers,
+          'links_added': links,
+          'kmers_per_sec': kmers / wall if wall > 0 else 0,
+          'links_per_sec': links / wall if wall > 0 else 0}
+
+def print_table(summary, fh):
+  hdr = ['stage', 'wall_s', 'cpu_s', 'cpu_util', 'rss_MB', 'kmers/s', 'links/s']
+  print('\t'.join(hdr), file=fh)
+  for stage in STAGES:
+    if stage not in summary: continue
+    s = summary[stage]
+    print('%s\t%.2f\t%.2f\t%.2f\t%.1f\t%.0f\t%.0f' %
+          (stage, s['wall_sec'], s['cpu_sec'], s['cpu_util'],
+           s['max_rss_bytes'] / 1e6, s['kmers_per_sec'], s['links_per_sec']),
+          file=fh)
+
+# Returns list of regression messages
+def compare(summary, baseline, tol):
+  msgs = []
+  for stage in STAGES:
+    if stage not in summary or stage not in baseline: continue
+    for field,larger_is_worse in COMPARE:
+      new,old = summary[stage][field], baseline[stage][field]
+      if old == 0: continue
+      change = (new - old) / float(old)
+      if (larger_is_worse and change > tol) or (not larger_is_worse and change < -tol):
+        msgs.append('%s %s: %g -> %g (%+.1f%%)' %
+                    (stage, field, old, new, 100*change))
+  return msgs
+
+def main():
+  parser = argparse.ArgumentParser(description='Summarise pipeline stats')
+  parser.add_argument('statsdir', help='directory of <stage>.json files')
+  parser.add_argument('baseline', nargs='?', help='baseline summary JSON')
+  parser.add_argument('--out', help='write summary JSON to file')
+  parser.add_argument('--tolerance', type=float, default=0.1,
+                      help='allowed fractional regression [default: 0.1]')
+  args = parser.parse_args()
+
+  summary = {}
+  for stage in STAGES:
+    path = os.path.join(args.statsdir, stage+'.json')
+    if os.path.exists(path): summary[stage] = load_stage(path)
+
+  if len(summary) == 0:
+    print('No stage stats found in: '+args.statsdir, file=sys.stderr)
+    sys.exit(2)
+
+  print_table(summary, sys.stdout)
+
+  if args.out:
+    with open(args.out, 'w') as fh:
+      json.dump(summary, fh, indent=2, sort_keys=True)
+      fh.write('\n')
+
+  if args.baseline:
+    with open(args.baseline) as fh:
+      baseline = json.load(fh)
+    msgs = compare(summary, baseline, args.tolerance)
+    for msg in msgs: print('Regression: '+msg, file=sys.stderr)
+    if len(msgs) > 0: sys.exit(1)
+    print('No regressions vs '+args.baseline+' (tolerance %.0f%%)' %
+          (100*args.tolerance), file=sys.stderr)
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,165 @@
+#!/usr/bin/env python
+from __future__ import print_function
+
+# usage: python scaling-report.py [options] <scaling-dir>
+#
+# Summarise thread scaling runs (see `make scaling` in
+# benchmark/calling-comparison.mk). Reads the JSON written by
+# `mccortex --stats-json` from <scaling-dir>/<mode>/t<threads>/<command>.json
+# where <mode> is 'strong' (same input at every thread count) or 'weak' (input
+# grows with the number of threads).
+#
+# Writes one CSV row per mode, command and thread count with wall time, CPU
+# time, throughput, speedup and efficiency relative to the fewest threads run:
+#   strong: speedup = T(1) / T(n), efficiency = speedup / n
+#   weak:   speedup = n * T(1) / T(n), efficiency = T(1) / T(n)
+# and a second CSV (<out>.phases.csv) of the time spent in each phase.
+#
+# With --plot <prefix>, plots speedup and efficiency to <prefix>.speedup.pdf
+# and <prefix>.efficiency.pdf (requires matplotlib).
+
+import os
+import re
+import sys
+import csv
+import json
+import argparse
+
+MODES = ['strong', 'weak']
+COMMANDS = ['build', 'clean', 'thread', 'contigs', 'bubbles', 'vcfcov']
+
+# Counter used to measure throughput of each command (also used by
+# perf-check.py)
+THROUGHPUT = {'build': 'reads', 'thread': 'reads', 'correct': 'reads',
+              'clean': 'kmer_lookups', 'contigs': 'kmer_lookups',
+              'bubbles': 'kmer_lookups', 'vcfcov': 'kmer_lookups'}
+
+COLUMNS = ['mode', 'command', 'threads', 'wall_sec', 'cpu_sec', 'cpu_util',
+           'max_rss_bytes', 'throughput_counter', 'throughput_per_sec',
+           'speedup', 'efficiency']
+
+PHASE_COLUMNS = ['mode', 'command', 'threads', 'phase', 'wall_sec', 'cpu_sec',
+                 'cpu_util', 'fraction_of_wall']
+
+def load_runs(scaledir):
+  runs = {} # (mode,cmd) -> {threads: stats}
+  for mode in MODES:
+    mdir = os.path.join(scaledir, mode)
+    if not os.path.isdir(mdir): continue
+    for tdir in os.listdir(mdir):
+      m = re.match(r'^t(\d+)$', tdir)
+      if not m: continue
+      nthreads = int(m.group(1))
+      for cmd in COMMANDS:
+        path = os.path.join(mdir, tdir, cmd+'.json')
+        if not os.path.exists(path): continue
+        with open(path) as fh:
+          runs.setdefault((mode,cmd), {})[nthreads] = json.load(fh)
+  return runs
+
+def summarise(runs):
+  rows, phase_rows = [], []
+  for mode in MODES:
+    for cmd in COMMANDS:
+      if (mode,cmd) not in runs: continue
+      byt = runs[(mode,cmd)]
+      base_t = min(byt.keys())
+      base_wall = byt[base_t]['wall_sec']
+      counter = THROUGHPUT[cmd]
+      for nthreads in sorted(byt.keys()):
+        s = byt[nthreads]
+        wall = s['wall_sec']
+        ratio = base_wall / wall if wall > 0 else 0
+        # Speedup over the fewest threads run, scaled as if that were 1
+        scale = float(nthreads) / base_t
+        speedup = ratio if mode == 'strong' else scale * ratio
+        nwork = s.get('counters', {}).get(counter, 0)
+        rows.append({'mode': mode, 'command': cmd, 'threads': nthreads,
+                     'wall_sec': wall,
+                     'cpu_sec': s['user_sec'] + s['sys_sec'],
+                     'cpu_util': s['cpu_util'],
+                     'max_rss_bytes': s['max_rss_bytes'],
+                     'throughput_counter': counter,
+                     'throughput_per_sec': nwork / wall if wall > 0 else 0,
+                     'speedup': speedup,
+                     'efficiency': speedup / scale})
+        for p in s.get('phases', []):
+          pwall = p['wall_sec']
+          phase_rows.append({'mode': mode, 'command': cmd,
+                             'threads': nthreads, 'phase': p['name'],
+                             'wall_sec': pwall,
+                             'cpu_sec': p['user_sec'] + p['sys_sec'],
+                             'cpu_util': p['cpu_util'],
+                             'fraction_of_wall': pwall / wall if wall > 0 else 0})
+  return rows, phase_rows
+
+def write_csv(path, columns, rows):
+  with open(path, 'w') as fh:
+    out = csv.DictWriter(fh, fieldnames=columns, lineterminator='\n')
+    out.writeheader()
+    for row in rows: out.writerow(row)
+
+def print_table(rows, fh):
+  hdr = ['mode', 'command', 'threads', 'wall_s', 'cpu_util', 'rate/s',
+         'speedup', 'efficiency']
+  print('\t'.join(hdr), file=fh)
+  for r in rows:
+    print('%s\t%s\t%d\t%.2f\t%.2f\t%.0f\t%.2f\t%.2f' %
+          (r['mode'], r['command'], r['threads'], r['wall_sec'], r['cpu_util'],
+           r['throughput_per_sec'], r['speedup'], r['efficiency']), file=fh)
+
+def plot(rows, prefix):
+  try:
+    import matplotlib
+    matplotlib.use('Agg')
+    import matplotlib.pyplot as plt
+  except ImportError:
+    print('matplotlib not available, not plotting', file=sys.stderr)
+    return
+  for field in ['speedup', 'efficiency']:
+    fig, axes = plt.subplots(1, len(MODES), figsize=(6*len(MODES), 4.5))
+    for ax,mode in zip(axes, MODES):
+      nmax = 1
+      for cmd in COMMANDS:
+        pts = [(r['threads'], r[field]) for r in rows
+               if r['mode'] == mode and r['command'] == cmd]
+        if len(pts) == 0: continue
+        xs, ys = zip(*pts)
+        nmax = max(nmax, max(xs))
+        ax.plot(xs, ys, marker='o', label=cmd)
+      # Perfect scaling
+      if field == 'speedup': ax.plot([1,nmax], [1,nmax], 'k--', label='ideal')
+      else: ax.plot([1,nmax], [1,1], 'k--', label='ideal')
+      ax.set_title(mode+' scaling')
+      ax.set_xlabel('threads')
+      ax.set_ylabel(field)
+      ax.legend(loc='best', fontsize='small')
+    fig.tight_layout()
+    path = prefix+'.'+field+'.pdf'
+    fig.savefig(path)
+    plt.close(fig)
+    print('Plotted: '+path, file=sys.stderr)
+
+def main():
+  parser = argparse.ArgumentParser(description='Summarise thread scaling runs')
+  parser.add_argument('scaledir', help='directory of <mode>/t<N>/<cmd>.json')
+  parser.add_argument('--out', required=True, help='CSV file to write')
+  parser.add_argument('--plot', help='prefix of plots to write')
+  args = parser.parse_args()
+
+  runs = load_runs(args.scaledir)
+  if len(runs) == 0:
+    print('No scaling stats found in: '+args.scaledir, file=sys.stderr)
+    sys.exit(2)
+
+  rows, phase_rows = summarise(runs)
+  print_table(rows, sys.stdout)
+
+  write_csv(args.out, COLUMNS, rows)
+  base = args.out[:-4] if args.out.endswith('.csv') else args.out
+  write_csv(base+'.phases.csv', PHASE_COLUMNS, phase_rows)
+
+  if args.plot: plot(rows, args.plot)
+
+if __name__ == '__main__':
+  main()
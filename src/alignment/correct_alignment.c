@@ -10,7 +10,8 @@ bool gen_paths_print_reads = false;
 
 size_t correct_aln_worker_est_mem(const dBGraph *graph) {
   return 2*graph_walker_est_mem() + 2*rpt_walker_est_mem(graph->ht.capacity, 22) +
-         db_alignment_est_mem() + 2*INIT_BUFLEN*sizeof(dBNode) +
+         db_alignment_est_mem() + gap_cache_est_mem() +
+         2*INIT_BUFLEN*sizeof(dBNode) +
          2*INIT_BUFLEN*sizeof(size_t) + sizeof(CorrectAlnWorker);
 }
 
@@ -35,6 +36,7 @@ void correct_aln_worker_alloc(CorrectAlnWorker *wrkr, bool store_contig_lens,
   db_node_buf_alloc(&tmp.revcontig, INIT_BUFLEN);
   int32_buf_alloc(&tmp.rpos, INIT_BUFLEN);
 
+  gap_cache_alloc(&tmp.gap_cache);
   correct_aln_stats_alloc(&tmp.aln_stats);
   seq_loading_stats_init(&tmp.load_stats);
 
@@ -51,6 +53,7 @@ void correct_aln_worker_dealloc(CorrectAlnWorker *wrkr)
   db_node_buf_dealloc(&wrkr->contig);
   db_node_buf_dealloc(&wrkr->revcontig);
   int32_buf_dealloc(&wrkr->rpos);
+  gap_cache_dealloc(&wrkr->gap_cache);
   correct_aln_stats_dealloc(&wrkr->aln_stats);
 }
 
@@ -73,6 +76,10 @@ void correct_alignment_init(CorrectAlnWorker *wrkr,
 
   const dBAlignment *aln = &wrkr->aln;
 
+  // Links of the read's kmers are read as we walk its gaps
+  if(wrkr->db_graph->prefetch_walks)
+    db_graph_prefetch_node_links(wrkr->db_graph, aln->nodes.b, aln->nodes.len);
+
   // Copy parameters
   wrkr->params = *params;
 
@@ -84,6 +91,8 @@ void correct_alignment_init(CorrectAlnWorker *wrkr,
   wrkr->end_idx_missing_edge = wrkr->gap_idx_missing_edge;
 
   wrkr->aln_stats.num_missing_edges += wrkr->gap_idx_missing_edge;
+  correct_aln_stats_start_read(&wrkr->aln_stats, r1->seq.b, r1->seq.end,
+                               aln->passed_r2);
 
   // Update stats
   wrkr->load_stats.total_bases_read += aln->r1bases + aln->r2bases;
@@ -282,9 +291,12 @@ static TraversalResult traverse_two_way2(dBNodeBuffer *contig0,
   return result;
 }
 
+// Result of each attempt is stored in results[0..*nresults-1]
 static TraversalResult traverse_one_way(CorrectAlnWorker *wrkr,
                                         size_t gap_idx, size_t end_idx,
-                                        size_t gap_min, size_t gap_max)
+                                        size_t gap_min, size_t gap_max,
+                                        TraversalResult results[2],
+                                        size_t *nresults)
 {
   const CorrectAlnParam *params = &wrkr->params;
   const int aln_colour = wrkr->aln.colour; // -1 for all
@@ -309,6 +321,8 @@ static TraversalResult traverse_one_way(CorrectAlnWorker *wrkr,
                              only_in_one_col, params->use_end_check);
 
   correct_aln_stats_update(&wrkr->aln_stats, result);
+  results[0] = result;
+  *nresults = 1;
 
   if(result.traversed) return result;
 
@@ -324,13 +338,16 @@ static TraversalResult traverse_one_way(CorrectAlnWorker *wrkr,
                              only_in_one_col, params->use_end_check);
 
   correct_aln_stats_update(&wrkr->aln_stats, result);
+  results[(*nresults)++] = result;
 
   return result;
 }
 
 static TraversalResult traverse_two_way(CorrectAlnWorker *wrkr,
                                         size_t gap_idx, size_t end_idx,
-                                        size_t gap_min, size_t gap_max)
+                                        size_t gap_min, size_t gap_max,
+                                        TraversalResult results[2],
+                                        size_t *nresults)
 {
   const CorrectAlnParam *params = &wrkr->params;
   const int aln_colour = wrkr->aln.colour; // -1 for all
@@ -353,6 +370,72 @@ static TraversalResult traverse_two_way(CorrectAlnWorker *wrkr,
                              aln_colour != -1, params->use_end_check);
 
   correct_aln_stats_update(&wrkr->aln_stats, result);
+  results[0] = result;
+  *nresults = 1;
+
+  return result;
+}
+
+// Fill the gap between the end of wrkr->contig and aln nodes [gap_idx..],
+// adding nodes to contig and revcontig. Without links to follow the result
+// only depends on the nodes either side of the gap, so is memoised.
+static TraversalResult traverse_gap(CorrectAlnWorker *wrkr,
+                                    size_t gap_idx, size_t end_idx,
+                                    size_t gap_min, size_t gap_max)
+{
+  const CorrectAlnParam *params = &wrkr->params;
+  dBNodeBuffer *contig = &wrkr->contig, *revcontig = &wrkr->revcontig;
+  const size_t init_len = contig->len;
+  TraversalResult results[2], result;
+  size_t i, nresults = 0;
+
+  const GPathStore *gpstore = &wrkr->db_graph->gpstore;
+  bool use_cache = !gpath_store_use_traverse(gpstore) || !gpstore->num_paths;
+  GapCacheKey key;
+
+  if(use_cache) {
+    memset(&key, 0, sizeof(key));
+    key.left = contig->b[contig->len-1];
+    key.right = wrkr->aln.nodes.b[gap_idx];
+    key.gap_min = gap_min;
+    key.gap_max = gap_max;
+    key.colour = wrkr->aln.colour;
+    key.ctxcol = params->ctxcol;
+    key.two_way = !params->one_way_gap_traverse;
+
+    const GapCacheEntry *entry = gap_cache_find(&wrkr->gap_cache, &key);
+    if(entry != NULL) {
+      for(i = 0; i < entry->nresults; i++)
+        correct_aln_stats_update(&wrkr->aln_stats, entry->results[i]);
+      wrkr->aln_stats.num_gap_cache_hits++;
+      result = entry->results[entry->nresults-1];
+      if(result.traversed) {
+        db_node_buf_push(contig, gap_cache_nodes(&wrkr->gap_cache, entry),
+                         result.gap_len);
+      }
+      return result;
+    }
+  }
+
+  if(params->one_way_gap_traverse)
+    result = traverse_one_way(wrkr, gap_idx, end_idx, gap_min, gap_max,
+                              results, &nresults);
+  else
+    result = traverse_two_way(wrkr, gap_idx, end_idx, gap_min, gap_max,
+                              results, &nresults);
+
+  if(use_cache) {
+    // Gap nodes left to right: added to contig, then revcontig reversed
+    dBNode nodes[GAP_CACHE_MAX_GAP];
+    size_t n = contig->len - init_len, j;
+    if(result.traversed && result.gap_len <= GAP_CACHE_MAX_GAP) {
+      ctx_assert(n + revcontig->len == result.gap_len);
+      memcpy(nodes, contig->b + init_len, n * sizeof(dBNode));
+      for(j = revcontig->len; j > 0; j--)
+        nodes[n++] = db_node_reverse(revcontig->b[j-1]);
+    }
+    gap_cache_add(&wrkr->gap_cache, &key, results, nresults, nodes);
+  }
 
   return result;
 }
@@ -443,12 +526,7 @@ dBNodeBuffer* correct_alignment_nxt(CorrectAlnWorker *wrkr)
     // gap len is the number of kmers filling the gap
     TraversalResult result;
 
-    if(params.one_way_gap_traverse)
-      result = traverse_one_way(wrkr, wrkr->gap_idx, wrkr->end_idx,
-                                gap_min, gap_max);
-    else
-      result = traverse_two_way(wrkr, wrkr->gap_idx, wrkr->end_idx,
-                                gap_min, gap_max);
+    result = traverse_gap(wrkr, wrkr->gap_idx, wrkr->end_idx, gap_min, gap_max);
 
     // status("traversal: %s!\n", result.traversed ? "worked" : "failed");
 
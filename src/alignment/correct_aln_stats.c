@@ -1,11 +1,26 @@
 #include "global.h"
 #include "correct_aln_stats.h"
 #include "util.h"
+#include "misc/city.h"
+
+static size_t aln_stats_sample_rate = ALN_STATS_DEFAULT_SAMPLE;
+
+void correct_aln_stats_set_sample(size_t sample_rate)
+{
+  aln_stats_sample_rate = sample_rate ? sample_rate : ALN_STATS_DEFAULT_SAMPLE;
+}
+
+size_t correct_aln_stats_get_sample()
+{
+  return aln_stats_sample_rate;
+}
 
 void correct_aln_stats_alloc(CorrectAlnStats *stats)
 {
   memset(stats, 0, sizeof(*stats));
   zsize_buf_alloc(&stats->contig_histgrm, 1024);
+  stats->sample_rate = (uint32_t)aln_stats_sample_rate;
+  stats->sample_read = true;
 }
 
 void correct_aln_stats_dealloc(CorrectAlnStats *stats)
@@ -16,8 +31,13 @@ void correct_aln_stats_dealloc(CorrectAlnStats *stats)
 
 void correct_aln_stats_reset(CorrectAlnStats *stats)
 {
-  zsize_buf_reset(&stats->contig_histgrm);
+  ZeroSizeBuffer contig_histgrm = stats->contig_histgrm;
+  uint32_t sample_rate = stats->sample_rate;
+  zsize_buf_reset(&contig_histgrm);
   memset(stats, 0, sizeof(*stats));
+  stats->contig_histgrm = contig_histgrm;
+  stats->sample_rate = sample_rate;
+  stats->sample_read = true;
 }
 
 void correct_aln_stats_merge(CorrectAlnStats *restrict dst,
@@ -52,14 +72,34 @@ void correct_aln_stats_merge(CorrectAlnStats *restrict dst,
   dst->num_gap_successes += src->num_gap_successes;
   dst->num_paths_disagreed += src->num_paths_disagreed;
   dst->num_gaps_too_short += src->num_gaps_too_short;
+  dst->num_gap_cache_hits += src->num_gap_cache_hits;
 
   dst->num_missing_edges += src->num_missing_edges;
+
+  dst->num_reads += src->num_reads;
+  dst->num_sampled_reads += src->num_sampled_reads;
+  dst->num_sampled_pairs += src->num_sampled_pairs;
+}
+
+// Hash the sequence rather than count reads so the same reads are sampled
+// however reads are shared between threads
+void correct_aln_stats_start_read(CorrectAlnStats *stats,
+                                  const char *seq, size_t len, bool is_pair)
+{
+  stats->sample_read = (stats->sample_rate <= 1 ||
+                        CityHash64(seq, len) % stats->sample_rate == 0);
+  stats->num_reads += 1 + is_pair;
+  if(stats->sample_read) {
+    stats->num_sampled_reads += 1 + is_pair;
+    stats->num_sampled_pairs += is_pair;
+  }
 }
 
 // Sequencing error gap
 void correct_aln_stats_add(CorrectAlnStats *stats,
                            size_t exp_seq_gap, size_t act_gap)
 {
+  if(!stats->sample_read) return;
   exp_seq_gap = MIN2(exp_seq_gap, ALN_STATS_MAX_GAP-1);
   act_gap     = MIN2(act_gap,     ALN_STATS_MAX_GAP-1);
   stats->gap_err_histgrm[exp_seq_gap][act_gap]++;
@@ -70,6 +110,7 @@ void correct_aln_stats_add_mp(CorrectAlnStats *stats, size_t gap_kmers,
                               size_t r1bases, size_t r2bases,
                               size_t kmer_size)
 {
+  if(!stats->sample_read) return;
   // We want to record fragment length in bases, therefore:
   size_t fraglen_bp = r1bases + r2bases + gap_kmers - kmer_size + 1;
   fraglen_bp = MIN2(fraglen_bp, ALN_STATS_MAX_FRAGLEN-1);
@@ -134,6 +175,13 @@ void correct_aln_stats_print_summary(const CorrectAlnStats *stats,
     return;
   }
 
+  // Histograms only saw the sampled reads
+  bool sampled = (stats->num_sampled_reads < stats->num_reads);
+  if(sampled) {
+    num_reads = stats->num_sampled_reads;
+    num_read_pairs = stats->num_sampled_pairs;
+  }
+
   size_t i, j;
   size_t exp_gaps[ALN_STATS_MAX_GAP] = {0}, act_gaps[ALN_STATS_MAX_GAP] = {0};
   size_t num_seq_gaps = 0, num_frags_resolved = 0;
@@ -176,6 +224,15 @@ void correct_aln_stats_print_summary(const CorrectAlnStats *stats,
          (size_t)stats->num_end_traversed, (size_t)stats->num_end_gaps,
          (100.0 * stats->num_end_traversed) / stats->num_end_gaps);
 
+  if(sampled) {
+    char num_sampled_str[50], num_reads_str[50];
+    ulong_to_str(stats->num_sampled_reads, num_sampled_str);
+    ulong_to_str(stats->num_reads, num_reads_str);
+    status("[CorrectAln] Gap and fragment sizes from a sample of %s / %s "
+           "reads (%.2f%%)", num_sampled_str, num_reads_str,
+           (100.0 * stats->num_sampled_reads) / stats->num_reads);
+  }
+
   if(num_seq_gaps == 0)
   {
     status("[CorrectAln] Couldn't traverse any sequence gaps");
@@ -270,6 +327,16 @@ void correct_aln_stats_print_summary(const CorrectAlnStats *stats,
          num_gaps_too_short_str, num_gap_attempts_str,
          (100.0 * stats->num_gaps_too_short) / stats->num_gap_attempts);
 
+  if(stats->num_gap_cache_hits > 0) {
+    char num_mid_gaps_str[100], num_hits_str[100];
+    uint64_t num_gaps = stats->num_mid_gaps + stats->num_ins_gaps;
+    ulong_to_str(stats->num_gap_cache_hits, num_hits_str);
+    ulong_to_str(num_gaps, num_mid_gaps_str);
+    status("[CorrectAln] gaps filled from cache: %s / %s (%.2f%%)",
+           num_hits_str, num_mid_gaps_str,
+           (100.0 * stats->num_gap_cache_hits) / num_gaps);
+  }
+
   // Missing edges
   char num_missing_edges_str[50];
   ulong_to_str(stats->num_missing_edges, num_missing_edges_str);
@@ -7,6 +7,10 @@
 #define ALN_STATS_MAX_GAP 128
 #define ALN_STATS_MAX_FRAGLEN 1024
 
+// Gap and fragment length histograms are filled from 1 in
+// ALN_STATS_DEFAULT_SAMPLE reads unless they are being saved
+#define ALN_STATS_DEFAULT_SAMPLE 16
+
 typedef struct
 {
   // contig is a reconstructed run of kmers that match the graph
@@ -19,11 +23,18 @@ typedef struct
   // Count cases where traversal worked but paths disagreed with remaining contig
   uint64_t num_gap_attempts, num_gap_successes;
   uint64_t num_paths_disagreed, num_gaps_too_short;
+  uint64_t num_gap_cache_hits; // gaps filled from the GapCache
   // Specific gap type counts
   uint64_t num_ins_gaps, num_ins_traversed; // gaps between pairs of reads
   uint64_t num_mid_gaps, num_mid_traversed; // gaps in the middle of reads
   uint64_t num_end_gaps, num_end_traversed; // gaps at the ends of reads
   uint64_t num_missing_edges; // gaps due to missing edges
+  // Gap and fragment length histograms only count a deterministic sample of
+  // reads: 1 in sample_rate, picked by hashing the sequence of the read
+  uint32_t sample_rate;
+  bool sample_read; // current read is in the sample
+  uint64_t num_reads, num_sampled_reads, num_sampled_pairs; // mates count
+                                                            // as two reads
 } CorrectAlnStats;
 
 typedef struct {
@@ -31,6 +42,11 @@ typedef struct {
   bool traversed, paths_disagreed, gap_too_short;
 } TraversalResult;
 
+// Set the sample rate of stats allocated afterwards, 1 to count every read.
+// Zero restores the default (ALN_STATS_DEFAULT_SAMPLE).
+void correct_aln_stats_set_sample(size_t sample_rate);
+size_t correct_aln_stats_get_sample();
+
 void correct_aln_stats_alloc(CorrectAlnStats *stats);
 void correct_aln_stats_dealloc(CorrectAlnStats *stats);
 void correct_aln_stats_reset(CorrectAlnStats *stats);
@@ -48,6 +64,11 @@ static inline void correct_aln_stats_update(CorrectAlnStats *stats,
   stats->num_gaps_too_short += result.gap_too_short;
 }
 
+// Call for each read or read pair before adding its gaps, pairs are
+// sampled by the sequence of the first read
+void correct_aln_stats_start_read(CorrectAlnStats *stats,
+                                  const char *seq, size_t len, bool is_pair);
+
 // Sequencing error gap
 void correct_aln_stats_add(CorrectAlnStats *stats,
                            size_t exp_seq_gap, size_t act_gap);
@@ -1,6 +1,9 @@
 #include "global.h"
 #include "db_alignment.h"
 #include "seq_reader.h"
+#include "db_graph_disk.h"
+#include "unitig_map.h"
+#include "ctx_stats.h"
 
 
 #define INIT_BUFLEN 1024
@@ -8,22 +11,85 @@
 // Estimate initial memory required
 size_t db_alignment_est_mem()
 {
-  return (sizeof(size_t)+sizeof(dBNode))*INIT_BUFLEN;
+  return (sizeof(int32_t)+sizeof(dBNode)+sizeof(uint8_t))*2*INIT_BUFLEN +
+         (sizeof(BinaryKmer)+sizeof(hkey_t)+sizeof(Orientation))*INIT_BUFLEN +
+         (sizeof(uint8_t)+2*sizeof(uint64_t)+
+          sizeof(BinaryKmer)+sizeof(hkey_t))*INIT_BUFLEN;
 }
 
 void db_alignment_alloc(dBAlignment *aln)
 {
-  db_node_buf_alloc(&aln->nodes, INIT_BUFLEN);
-  int32_buf_alloc(&aln->rpos, INIT_BUFLEN);
+  memset(aln, 0, sizeof(dBAlignment));
+  db_node_buf_alloc(&aln->nodes, 2*INIT_BUFLEN);
+  int32_buf_alloc(&aln->rpos, 2*INIT_BUFLEN);
+  aln->max_read_len = INIT_BUFLEN;
+  aln->bkeys = ctx_malloc(INIT_BUFLEN * sizeof(BinaryKmer));
+  aln->hkeys = ctx_malloc(INIT_BUFLEN * sizeof(hkey_t));
+  aln->orients = ctx_malloc(INIT_BUFLEN * sizeof(Orientation));
+  aln->brks = ctx_malloc(2*INIT_BUFLEN * sizeof(uint8_t));
+  aln->placed = ctx_malloc(INIT_BUFLEN * sizeof(uint8_t));
+  aln->mkeys = ctx_malloc(INIT_BUFLEN * sizeof(uint64_t));
+  aln->mhash = ctx_malloc(INIT_BUFLEN * sizeof(uint64_t));
+  aln->qkeys = ctx_malloc(INIT_BUFLEN * sizeof(BinaryKmer));
+  aln->qhkeys = ctx_malloc(INIT_BUFLEN * sizeof(hkey_t));
 }
 
 void db_alignment_dealloc(dBAlignment *aln)
 {
   db_node_buf_dealloc(&aln->nodes);
   int32_buf_dealloc(&aln->rpos);
+  ctx_free(aln->bkeys);
+  ctx_free(aln->hkeys);
+  ctx_free(aln->orients);
+  ctx_free(aln->brks);
+  ctx_free(aln->placed);
+  ctx_free(aln->mkeys);
+  ctx_free(aln->mhash);
+  ctx_free(aln->qkeys);
+  ctx_free(aln->qhkeys);
   memset(aln, 0, sizeof(dBAlignment));
 }
 
+void db_alignment_reserve(dBAlignment *aln, size_t max_read_len)
+{
+  if(max_read_len <= aln->max_read_len) return;
+  size_t n = roundup2pow(max_read_len);
+  db_node_buf_capacity(&aln->nodes, 2*n);
+  int32_buf_capacity(&aln->rpos, 2*n);
+  aln->bkeys = ctx_realloc(aln->bkeys, n * sizeof(BinaryKmer));
+  aln->hkeys = ctx_realloc(aln->hkeys, n * sizeof(hkey_t));
+  aln->orients = ctx_realloc(aln->orients, n * sizeof(Orientation));
+  aln->brks = ctx_realloc(aln->brks, 2*n * sizeof(uint8_t));
+  aln->placed = ctx_realloc(aln->placed, n * sizeof(uint8_t));
+  aln->mkeys = ctx_realloc(aln->mkeys, n * sizeof(uint64_t));
+  aln->mhash = ctx_realloc(aln->mhash, n * sizeof(uint64_t));
+  aln->qkeys = ctx_realloc(aln->qkeys, n * sizeof(BinaryKmer));
+  aln->qhkeys = ctx_realloc(aln->qhkeys, n * sizeof(hkey_t));
+  aln->max_read_len = n;
+}
+
+// Place kmers of a contig on unitigs by their minimizers, then look up the
+// kmers that could not be placed together
+static void db_alignment_find_umap(dBAlignment *aln, const char *contig,
+                                   size_t contig_len, size_t nkmers,
+                                   const dBGraph *db_graph)
+{
+  size_t j, nq = 0, nplaced;
+  nplaced = unitig_map_seq(db_graph->umap, contig, contig_len,
+                           aln->hkeys, aln->placed, aln->mkeys, aln->mhash);
+  ctx_stats_add(CTX_STAT_KMERS_MAPPED, nplaced);
+  if(nplaced == nkmers) return;
+
+  for(j = 0; j < nkmers; j++)
+    if(!aln->placed[j]) aln->qkeys[nq++] = aln->bkeys[j];
+
+  hash_table_find_batch(&db_graph->ht, aln->qkeys, nq,
+                        HT_PREFETCH_DEPTH, aln->qhkeys);
+
+  for(j = 0, nq = 0; j < nkmers; j++)
+    if(!aln->placed[j]) aln->hkeys[j] = aln->qhkeys[nq++];
+}
+
 // if colour is -1 aligns to all colours, otherwise aligns to given colour only
 // Returns number of kmers lost from the end
 static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
@@ -33,19 +99,22 @@ static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
   size_t contig_start, contig_end = 0, search_start = 0;
   const size_t kmer_size = db_graph->kmer_size;
 
-  BinaryKmer bkmer, tmp_key;
-  Nucleotide nuc;
+  BinaryKmerIter kiter;
   hkey_t node;
-  size_t i, offset, nxtbse;
+  size_t i, j, offset, nxtbse, nkmers;
 
   dBNodeBuffer *nodes = &aln->nodes;
   Int32Buffer *rpos = &aln->rpos;
+  Edges edges;
+  Nucleotide nuc;
+  bool prev_found;
 
   ctx_assert(nodes->len == rpos->len);
   size_t n = nodes->len, init_len = n;
 
-  db_node_buf_capacity(nodes, n + r->seq.end);
-  int32_buf_capacity(rpos, n + r->seq.end);
+  // Space reserved by db_alignment_from_reads()
+  ctx_assert(r->seq.end <= aln->max_read_len);
+  ctx_assert(n + r->seq.end <= nodes->size);
 
   while((contig_start = seq_contig_start(r, search_start, kmer_size,
                                          qcutoff, hp_cutoff)) < r->seq.end)
@@ -56,24 +125,56 @@ static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
     const char *contig = r->seq.b + contig_start;
     size_t contig_len = contig_end - contig_start;
 
-    bkmer = binary_kmer_from_str(contig, kmer_size);
-    bkmer = binary_kmer_right_shift_one_base(bkmer);
+    binary_kmer_iter_init(&kiter, contig, kmer_size);
 
-    for(offset=contig_start, nxtbse=kmer_size-1; nxtbse < contig_len; nxtbse++,offset++)
+    // Get all kmer keys first, then look them up together so hash table
+    // buckets can be prefetched
+    for(nkmers = 0, nxtbse = kmer_size-1; nxtbse < contig_len; nxtbse++)
     {
-      nuc = dna_char_to_nuc(contig[nxtbse]);
-      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-      tmp_key = binary_kmer_get_key(bkmer, kmer_size);
-      node = hash_table_find(&db_graph->ht, tmp_key);
+      binary_kmer_iter_next(&kiter, dna_char_to_nuc(contig[nxtbse]));
+      aln->bkeys[nkmers] = binary_kmer_iter_key(&kiter, &aln->orients[nkmers]);
+      nkmers++;
+    }
 
+    if(db_graph->umap != NULL && db_graph->disk == NULL)
+      db_alignment_find_umap(aln, contig, contig_len, nkmers, db_graph);
+    else
+      hash_table_find_batch(&db_graph->ht, aln->bkeys, nkmers,
+                            HT_PREFETCH_DEPTH, aln->hkeys);
+
+    // Load kmers we have not seen yet from disk
+    if(db_graph->disk != NULL)
+      for(j = 0; j < nkmers; j++)
+        aln->hkeys[j] = db_graph_disk_find((dBGraph*)db_graph, aln->bkeys[j],
+                                           aln->hkeys[j]);
+
+    // Record where segments end as we go: after a kmer that is not found or
+    // where the previous node has no edge to this one
+    prev_found = false;
+
+    for(j = 0, offset = contig_start; j < nkmers; j++, offset++)
+    {
+      node = aln->hkeys[j];
       if(node != HASH_NOT_FOUND &&
          (colour == -1 || db_node_has_col(db_graph, node, colour)))
       {
         nodes->b[n].key = node;
-        nodes->b[n].orient = bkmer_get_orientation(bkmer, tmp_key);
+        nodes->b[n].orient = aln->orients[j];
         rpos->b[n] = offset;
+
+        if(prev_found) {
+          edges = colour < 0 ? db_node_get_edges_union(db_graph, nodes->b[n-1].key)
+                             : db_node_get_edges(db_graph, nodes->b[n-1].key, colour);
+          nuc = bkmer_get_last_nuc(aln->bkeys[j], aln->orients[j], kmer_size);
+          aln->brks[n] = edges_has_edge(edges, nuc, nodes->b[n-1].orient)
+                           ? DB_ALN_BRK_NONE : DB_ALN_BRK_EDGE;
+        }
+        else aln->brks[n] = DB_ALN_BRK_SEQ;
+
+        prev_found = true;
         n++;
       }
+      else prev_found = false;
     }
   }
 
@@ -114,6 +215,8 @@ void db_alignment_from_reads(dBAlignment *alignment,
   alignment->r1bases = r1->seq.end;
   alignment->r2bases = r2 ? r2->seq.end : 0;
 
+  db_alignment_reserve(alignment, MAX2(alignment->r1bases, alignment->r2bases));
+
   alignment->r1enderr = db_alignment_from_read(alignment, r1,
                                                qcutoff1, hp_cutoff,
                                                db_graph, colour);
@@ -145,12 +248,9 @@ void db_alignment_from_reads(dBAlignment *alignment,
 size_t db_alignment_next_gap(const dBAlignment *aln, size_t start,
                              bool *missing_edge, const dBGraph *db_graph)
 {
+  (void)db_graph;
   size_t i, end = aln->rpos.len;
-  const int32_t *rpos = aln->rpos.b;
-  const dBNode *nodes = aln->nodes.b;
-  int colour = aln->colour;
-  Edges edges;
-  Nucleotide nuc;
+  const uint8_t *brks = aln->brks;
 
   *missing_edge = false;
 
@@ -160,18 +260,9 @@ size_t db_alignment_next_gap(const dBAlignment *aln, size_t start,
   if(aln->used_r1 && aln->used_r2 && start < aln->r2strtidx)
     end = aln->r2strtidx;
 
-  for(i = start+1; i < end && rpos[i-1]+1 == rpos[i]; i++)
-  {
-    // Check for a missing edge
-    edges = colour < 0 ? db_node_get_edges_union(db_graph, nodes[i-1].key)
-                       : db_node_get_edges(db_graph, nodes[i-1].key, colour);
-    nuc = db_node_get_last_nuc(nodes[i], db_graph);
+  for(i = start+1; i < end && brks[i] == DB_ALN_BRK_NONE; i++) {}
 
-    if(!edges_has_edge(edges, nuc, nodes[i-1].orient)) {
-      *missing_edge = true;
-      break;
-    }
-  }
+  *missing_edge = (i < end && brks[i] == DB_ALN_BRK_EDGE);
 
   // Return position after gap
   return i;
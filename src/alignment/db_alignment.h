@@ -26,14 +26,37 @@ typedef struct
   // gap between r1 and r2: nodes[r2strtidx-1] .. nodes[r2strtidx]
   // = r1enderr + insgapsize + rpos[r2strtidx]
   int colour; // -1 if colour agnostic, otherwise only nodes in colour used
+  // Scratch space for looking up all kmers of a read in one batch
+  BinaryKmer *bkeys;
+  hkey_t *hkeys;
+  Orientation *orients;
+  // Scratch space for placing kmers with a unitig map (db_graph->umap)
+  uint8_t *placed;
+  uint64_t *mkeys, *mhash;
+  BinaryKmer *qkeys; // kmers left to look up
+  hkey_t *qhkeys;
+  // Why each node does not continue the segment of the previous node
+  // (DB_ALN_BRK_*), set whilst aligning so finding gaps needs no lookups
+  uint8_t *brks;
+  // Buffers are reserved for reads up to this length, nodes for a read pair
+  size_t max_read_len;
 } dBAlignment;
 
+#define DB_ALN_BRK_NONE 0 // follows the previous node
+#define DB_ALN_BRK_SEQ  1 // first node of a read or after a sequence gap
+#define DB_ALN_BRK_EDGE 2 // no edge from the previous node
+
 // Estimate memory required
 size_t db_alignment_est_mem();
 
 void db_alignment_alloc(dBAlignment *alignment);
 void db_alignment_dealloc(dBAlignment *alignment);
 
+// Reserve buffers for reads up to `max_read_len` bases so that aligning does
+// not allocate. Called with the longest read seen by db_alignment_from_reads(),
+// so buffers grow only when a longer read than any before is seen.
+void db_alignment_reserve(dBAlignment *alignment, size_t max_read_len);
+
 #define db_aln_r1enderr(aln,k) ((aln)->r1bases - \
   ((aln)->r2strtidx > 0 ? (aln)->rpos.b[(aln)->r2strtidx-1] + (k) : 0))
 
@@ -47,7 +70,8 @@ void db_alignment_from_reads(dBAlignment *alignment,
 
 /*
  * Get position after current segment. A segement is a stretch of kmers aligned
- * to the graph with no gaps.
+ * to the graph with no gaps. Gaps and missing edges are found whilst aligning,
+ * so this does not look up the graph.
  * @param aln           alignment of read to the graph
  * @param start         offset in the alignment that starts this segments
  * @param missing_edge  set to 1 if the segment was ended due to a missing edge
@@ -0,0 +1,89 @@
+#include "global.h"
+#include "gap_cache.h"
+#include "db_node.h"
+
+size_t gap_cache_est_mem()
+{
+  return GAP_CACHE_NSETS * GAP_CACHE_NWAYS *
+         (sizeof(GapCacheEntry) + GAP_CACHE_MAX_GAP * sizeof(dBNode));
+}
+
+void gap_cache_alloc(GapCache *cache)
+{
+  size_t n = GAP_CACHE_NSETS * GAP_CACHE_NWAYS;
+  cache->entries = ctx_calloc(n, sizeof(GapCacheEntry));
+  cache->nodes = ctx_malloc(n * GAP_CACHE_MAX_GAP * sizeof(dBNode));
+  cache->clock = 0;
+}
+
+void gap_cache_dealloc(GapCache *cache)
+{
+  ctx_free(cache->entries);
+  ctx_free(cache->nodes);
+  memset(cache, 0, sizeof(*cache));
+}
+
+void gap_cache_reset(GapCache *cache)
+{
+  memset(cache->entries, 0, GAP_CACHE_NSETS * GAP_CACHE_NWAYS *
+                            sizeof(GapCacheEntry));
+  cache->clock = 0;
+}
+
+static inline bool gap_cache_keys_equal(const GapCacheKey *a,
+                                        const GapCacheKey *b)
+{
+  return db_nodes_are_equal(a->left, b->left) &&
+         db_nodes_are_equal(a->right, b->right) &&
+         a->gap_min == b->gap_min && a->gap_max == b->gap_max &&
+         a->colour == b->colour && a->ctxcol == b->ctxcol &&
+         a->two_way == b->two_way;
+}
+
+static inline GapCacheEntry* gap_cache_set(GapCache *cache,
+                                           const GapCacheKey *key)
+{
+  uint64_t h = db_node_hash(key->left) ^ (db_node_hash(key->right) * 31) ^
+               ((uint64_t)key->gap_max << 32 | key->gap_min);
+  return cache->entries + (h % GAP_CACHE_NSETS) * GAP_CACHE_NWAYS;
+}
+
+const GapCacheEntry* gap_cache_find(GapCache *cache, const GapCacheKey *key)
+{
+  GapCacheEntry *set = gap_cache_set(cache, key);
+  size_t i;
+
+  for(i = 0; i < GAP_CACHE_NWAYS; i++) {
+    if(set[i].last_used && gap_cache_keys_equal(&set[i].key, key)) {
+      set[i].last_used = ++cache->clock;
+      return &set[i];
+    }
+  }
+  return NULL;
+}
+
+void gap_cache_add(GapCache *cache, const GapCacheKey *key,
+                   const TraversalResult *results, size_t nresults,
+                   const dBNode *nodes)
+{
+  ctx_assert(nresults > 0 && nresults <= 2);
+  const TraversalResult *last = &results[nresults-1];
+  if(last->traversed && last->gap_len > GAP_CACHE_MAX_GAP) return;
+
+  // Replace the least recently used entry in the set (empty ones first)
+  GapCacheEntry *set = gap_cache_set(cache, key), *entry = &set[0];
+  size_t i;
+
+  for(i = 1; i < GAP_CACHE_NWAYS; i++)
+    if(set[i].last_used < entry->last_used) entry = &set[i];
+
+  entry->key = *key;
+  entry->last_used = ++cache->clock;
+  memcpy(entry->results, results, nresults * sizeof(TraversalResult));
+  entry->nresults = (uint8_t)nresults;
+
+  if(last->traversed) {
+    memcpy(cache->nodes + (entry - cache->entries) * GAP_CACHE_MAX_GAP, nodes,
+           last->gap_len * sizeof(dBNode));
+  }
+}
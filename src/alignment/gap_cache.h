@@ -0,0 +1,70 @@
+#ifndef GAP_CACHE_H_
+#define GAP_CACHE_H_
+
+#include "cortex_types.h"
+#include "correct_aln_stats.h" // TraversalResult
+
+//
+// Memoised gap filling for correct_alignment_nxt()
+//
+// Without links to follow, whether a gap between two aligned blocks is
+// bridged, and by which nodes, only depends on the nodes either side of it,
+// the permitted gap length and the colour. Reads with errors at the same
+// place (e.g. a repeat boundary) give the same gap many times over, so results
+// are kept in a small set associative cache, replacing the least recently used
+// entry of a set. Gaps longer than GAP_CACHE_MAX_GAP kmers are not stored.
+// Not thread safe: each CorrectAlnWorker has its own.
+//
+
+#define GAP_CACHE_NSETS 1024
+#define GAP_CACHE_NWAYS 4
+#define GAP_CACHE_MAX_GAP 64
+
+typedef struct
+{
+  dBNode left, right; // last node before and first node after the gap
+  uint32_t gap_min, gap_max;
+  int32_t colour; // -1 if alignment is not restricted to a colour
+  uint32_t ctxcol;
+  bool two_way;
+} GapCacheKey;
+
+typedef struct
+{
+  GapCacheKey key;
+  uint64_t last_used; // zero if entry is empty
+  TraversalResult results[2]; // result of each traversal attempted
+  uint8_t nresults;
+} GapCacheEntry;
+
+typedef struct
+{
+  GapCacheEntry *entries; // GAP_CACHE_NSETS * GAP_CACHE_NWAYS
+  dBNode *nodes; // GAP_CACHE_MAX_GAP nodes per entry, left to right
+  uint64_t clock;
+} GapCache;
+
+size_t gap_cache_est_mem();
+
+void gap_cache_alloc(GapCache *cache);
+void gap_cache_dealloc(GapCache *cache);
+void gap_cache_reset(GapCache *cache);
+
+// Returns NULL if `key` is not in the cache
+const GapCacheEntry* gap_cache_find(GapCache *cache, const GapCacheKey *key);
+
+// Nodes filling the gap of an entry whose last result traversed the gap
+static inline const dBNode* gap_cache_nodes(const GapCache *cache,
+                                            const GapCacheEntry *entry)
+{
+  return cache->nodes + (entry - cache->entries) * GAP_CACHE_MAX_GAP;
+}
+
+// Store the results of traversal attempts for `key`. If the last result
+// traversed the gap, `nodes` are the nodes filling it, left to right.
+// Does nothing if the gap is too long to store.
+void gap_cache_add(GapCache *cache, const GapCacheKey *key,
+                   const TraversalResult *results, size_t nresults,
+                   const dBNode *nodes);
+
+#endif /* GAP_CACHE_H_ */
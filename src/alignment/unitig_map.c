@@ -0,0 +1,386 @@
+#include "global.h"
+#include "unitig_map.h"
+#include "db_node.h"
+#include "util.h"
+
+// Bijective so two m-mers never share a hash (splitmix64 finaliser)
+static inline uint64_t umap_mmer_hash(uint64_t x)
+{
+  x += UINT64_C(0x9e3779b97f4a7c15);
+  x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return x ^ (x >> 31);
+}
+
+static inline Nucleotide umap_base(const uint64_t *useq, size_t i)
+{
+  return (Nucleotide)((useq[i>>5] >> ((i&31)*2)) & 3);
+}
+
+// Add the next base to forward and reverse complement m-mers
+static inline void umap_mmer_add(uint64_t *fwd, uint64_t *rev, Nucleotide nuc,
+                                 size_t mmer_size)
+{
+  const uint64_t mask = (UINT64_C(1) << (2*mmer_size)) - 1;
+  *fwd = ((*fwd << 2) | nuc) & mask;
+  *rev = (*rev >> 2) | ((uint64_t)dna_nuc_complement(nuc) << (2*(mmer_size-1)));
+}
+
+// Canonical m-mer with the strand in the lowest bit
+static inline uint64_t umap_mmer_key(uint64_t fwd, uint64_t rev)
+{
+  return fwd <= rev ? fwd << 1 : (rev << 1) | 1;
+}
+
+/**
+ * Minimizer of kmer `j`: leftmost m-mer with the smallest hash in
+ * mhash[j..j+w-1], indexed modulo mask+1.
+ * @param mpos minimizer of kmer j-1 or SIZE_MAX
+ */
+static inline size_t umap_window_min(const uint64_t *mhash, size_t mask,
+                                     size_t j, size_t w, size_t mpos)
+{
+  size_t i, end = j + w;
+  if(mpos == SIZE_MAX || mpos < j) {
+    for(mpos = j, i = j+1; i < end; i++)
+      if(mhash[i & mask] < mhash[mpos & mask]) mpos = i;
+  }
+  else if(mhash[(end-1) & mask] < mhash[mpos & mask]) mpos = end-1;
+  return mpos;
+}
+
+void unitig_map_alloc(UnitigMap *umap, const dBGraph *db_graph)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  memset(umap, 0, sizeof(*umap));
+  umap->db_graph = db_graph;
+  umap->mmer_size = MIN2(kmer_size, UNITIG_MAP_MMER);
+  umap->window = kmer_size - umap->mmer_size + 1;
+}
+
+void unitig_map_dealloc(UnitigMap *umap)
+{
+  ctx_free(umap->nodestart);
+  ctx_free(umap->nodes);
+  ctx_free(umap->seqstart);
+  ctx_free(umap->seq);
+  ctx_free(umap->table);
+  memset(umap, 0, sizeof(*umap));
+}
+
+//
+// Building
+//
+
+typedef struct {
+  UnitigMap *umap;
+  const UnitigIndex *uidx;
+  uint64_t *counts; // [nthreads] minimizers sampled by each thread
+  bool insert;
+} UnitigMapBuilder;
+
+// Put each kmer at its offset in its unitig
+static bool _umap_store_nodes(size_t start, size_t end, size_t threadid,
+                              void *arg)
+{
+  (void)threadid;
+  const UnitigMapBuilder *bld = (const UnitigMapBuilder*)arg;
+  UnitigMap *umap = bld->umap;
+  const UnitigIndex *uidx = bld->uidx;
+  UnitigIndexKmer k;
+  hkey_t hkey;
+
+  for(hkey = start; hkey < end; hkey++) {
+    if(!hash_table_assigned(&umap->db_graph->ht, hkey)) continue;
+    k = uidx->kmers[hkey];
+    if(k.unitigid == UNITIG_INDEX_NONE) continue;
+    umap->nodes[umap->nodestart[k.unitigid] + uidx->offsets[hkey]]
+      = (dBNode){.key = hkey, .orient = k.orient};
+  }
+  return false;
+}
+
+// Pack the bases of unitigs [start,end), each starts on a new word
+static bool _umap_store_seq(size_t start, size_t end, size_t threadid,
+                            void *arg)
+{
+  (void)threadid;
+  const UnitigMapBuilder *bld = (const UnitigMapBuilder*)arg;
+  UnitigMap *umap = bld->umap;
+  const dBGraph *db_graph = umap->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  char str[MAX_KMER_SIZE+1];
+  size_t u, i, n;
+  Nucleotide nuc;
+
+  for(u = start; u < end; u++) {
+    const dBNode *nodes = umap->nodes + umap->nodestart[u];
+    uint64_t *useq = umap->seq + umap->seqstart[u];
+    n = umap->nodestart[u+1] - umap->nodestart[u];
+    binary_kmer_to_str(db_node_oriented_bkmer(db_graph, nodes[0]), kmer_size, str);
+    for(i = 0; i < kmer_size; i++)
+      useq[i>>5] |= (uint64_t)dna_char_to_nuc(str[i]) << ((i&31)*2);
+    for(i = 1; i < n; i++) {
+      nuc = db_node_get_last_nuc(nodes[i], db_graph);
+      useq[(i+kmer_size-1)>>5] |= (uint64_t)nuc << (((i+kmer_size-1)&31)*2);
+    }
+  }
+  return false;
+}
+
+// Record that m-mer `mkey` is at `offset` in unitig `uid`. Threads own whole
+// unitigs, so an entry set by another thread is always a repeat.
+static void _umap_insert(UnitigMap *umap, uint64_t mkey, uint64_t hash,
+                         size_t uid, size_t offset)
+{
+  const uint64_t key = (mkey >> 1) + 1, val = uid + 1;
+  const size_t mask = umap->table_size - 1;
+  size_t i, h = hash & mask;
+  uint64_t cur;
+  UnitigMapEntry *e;
+
+  for(i = 0; i < umap->table_size; i++, h = (h+1) & mask) {
+    e = &umap->table[h];
+    cur = e->mmer;
+    if(cur == 0 && (cur = __sync_val_compare_and_swap(&e->mmer, 0, key)) == 0)
+      cur = key;
+    if(cur != key) continue;
+
+    cur = __sync_val_compare_and_swap(&e->unitigid, 0, val);
+    if(cur == 0) {
+      e->offset = (uint32_t)offset;
+      e->strand = mkey & 1;
+    }
+    else if(cur != val || e->offset != offset) e->unitigid = UINT64_MAX;
+    return;
+  }
+  die("Unitig map full");
+}
+
+// Count or insert the minimizers of every kmer in unitig `u`
+static size_t _umap_unitig_minimizers(UnitigMap *umap, size_t u, bool insert)
+{
+  const size_t kmer_size = umap->db_graph->kmer_size;
+  const size_t m = umap->mmer_size, w = umap->window;
+  const size_t nbases = umap->nodestart[u+1] - umap->nodestart[u] + kmer_size-1;
+  const uint64_t *useq = umap->seq + umap->seqstart[u];
+  const size_t rmask = roundup2pow(w) - 1;
+  uint64_t mkeys[rmask+1], mhash[rmask+1], fwd = 0, rev = 0;
+  size_t i, p, mpos = SIZE_MAX, last = SIZE_MAX, n = 0;
+
+  for(i = 0; i < nbases; i++) {
+    umap_mmer_add(&fwd, &rev, umap_base(useq, i), m);
+    if(i+1 < m) continue;
+    p = i+1-m;
+    mkeys[p & rmask] = umap_mmer_key(fwd, rev);
+    mhash[p & rmask] = umap_mmer_hash(mkeys[p & rmask] >> 1);
+    if(p+1 < w) continue;
+    mpos = umap_window_min(mhash, rmask, p+1-w, w, mpos);
+    if(mpos != last) {
+      last = mpos;
+      n++;
+      if(insert) _umap_insert(umap, mkeys[mpos & rmask], mhash[mpos & rmask],
+                              u, mpos);
+    }
+  }
+  return n;
+}
+
+static bool _umap_sample(size_t start, size_t end, size_t threadid, void *arg)
+{
+  const UnitigMapBuilder *bld = (const UnitigMapBuilder*)arg;
+  size_t u, n = 0;
+  for(u = start; u < end; u++)
+    n += _umap_unitig_minimizers(bld->umap, u, bld->insert);
+  bld->counts[threadid] += n;
+  return false;
+}
+
+// Build from an index of the graph's unitigs. uidx can be freed afterwards.
+void unitig_map_build(UnitigMap *umap, const UnitigIndex *uidx, size_t nthreads)
+{
+  const dBGraph *db_graph = umap->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  const size_t nunitigs = uidx->num_unitigs, capacity = db_graph->ht.capacity;
+  size_t u, t, nwords = 0, nsampled = 0;
+
+  ctx_assert(uidx->db_graph == db_graph);
+
+  ctx_free(umap->nodestart);
+  ctx_free(umap->nodes);
+  ctx_free(umap->seqstart);
+  ctx_free(umap->seq);
+  ctx_free(umap->table);
+
+  umap->num_unitigs = nunitigs;
+  umap->num_kmers = uidx->num_kmers;
+  umap->nodestart = ctx_malloc((nunitigs+1) * sizeof(uint64_t));
+  umap->seqstart = ctx_malloc(MAX2(nunitigs, 1) * sizeof(uint64_t));
+
+  umap->nodestart[0] = 0;
+  for(u = 0; u < nunitigs; u++) {
+    umap->nodestart[u+1] = umap->nodestart[u] + uidx->unitigs[u].len;
+    umap->seqstart[u] = nwords;
+    nwords += (uidx->unitigs[u].len + kmer_size-1 + 31) / 32;
+  }
+  ctx_assert(umap->nodestart[nunitigs] == umap->num_kmers);
+
+  umap->nodes = ctx_malloc(MAX2(umap->num_kmers, 1) * sizeof(dBNode));
+  umap->seq = ctx_calloc(MAX2(nwords, 1), sizeof(uint64_t));
+
+  UnitigMapBuilder bld = {.umap = umap, .uidx = uidx,
+                          .counts = ctx_calloc(nthreads, sizeof(uint64_t)),
+                          .insert = false};
+
+  size_t chunk = capacity / (nthreads*HASH_ITERATE_CHUNKS_PER_THREAD);
+  util_run_ranges(capacity, MAX2(chunk, HASH_ITERATE_MIN_CHUNK), nthreads,
+                  _umap_store_nodes, &bld);
+
+  chunk = MAX2(nunitigs / (nthreads*64), 64);
+  util_run_ranges(nunitigs, chunk, nthreads, _umap_store_seq, &bld);
+
+  // Count minimizers to size the table at most half full, then fill it
+  util_run_ranges(nunitigs, chunk, nthreads, _umap_sample, &bld);
+  for(t = 0; t < nthreads; t++) nsampled += bld.counts[t];
+
+  umap->table_size = roundup2pow(MAX2(2*nsampled, 64));
+  umap->table = ctx_calloc(umap->table_size, sizeof(UnitigMapEntry));
+  bld.insert = true;
+  util_run_ranges(nunitigs, chunk, nthreads, _umap_sample, &bld);
+  ctx_free(bld.counts);
+
+  size_t nuniq = 0;
+  for(u = 0; u < umap->table_size; u++)
+    nuniq += (umap->table[u].mmer && umap->table[u].unitigid != UINT64_MAX);
+  umap->num_minimizers = nuniq;
+
+  char nu_str[50], nm_str[50];
+  ulong_to_str(nunitigs, nu_str);
+  ulong_to_str(nuniq, nm_str);
+  status("[UnitigMap] %s unitigs, %s unique minimizers (m=%zu, w=%zu)",
+         nu_str, nm_str, umap->mmer_size, umap->window);
+}
+
+//
+// Mapping
+//
+
+static inline const UnitigMapEntry* _umap_find(const UnitigMap *umap,
+                                               uint64_t mkey, uint64_t hash)
+{
+  const uint64_t key = (mkey >> 1) + 1;
+  const size_t mask = umap->table_size - 1;
+  size_t i, h = hash & mask;
+  const UnitigMapEntry *e;
+
+  for(i = 0; i < umap->table_size; i++, h = (h+1) & mask) {
+    e = &umap->table[h];
+    if(e->mmer == 0) return NULL;
+    if(e->mmer == key)
+      return e->unitigid == 0 || e->unitigid == UINT64_MAX ? NULL : e;
+  }
+  return NULL;
+}
+
+// Read base i is unitig base d+i (fw) or the complement of unitig base d-i
+static inline bool _umap_base_eq(const char *seq, int64_t i,
+                                 const uint64_t *useq, int64_t nbases,
+                                 bool fw, int64_t d)
+{
+  int64_t q = fw ? d + i : d - i;
+  if(q < 0 || q >= nbases) return false;
+  Nucleotide nuc = umap_base(useq, q);
+  if(!fw) nuc = dna_nuc_complement(nuc);
+  return nuc == dna_char_to_nuc(seq[i]);
+}
+
+/**
+ * Place read kmer `j` on the unitig of minimizer entry `e`, then extend along
+ * the unitig in both directions one base at a time.
+ * @param rpos, rstrand position and strand of the read m-mer that hit `e`
+ * @return index after the last kmer placed, or j if kmer j does not match
+ */
+static size_t _umap_place(const UnitigMap *umap, const UnitigMapEntry *e,
+                          size_t rpos, bool rstrand,
+                          const char *seq, size_t j, size_t nkmers,
+                          hkey_t *hkeys, uint8_t *placed, size_t *nplaced)
+{
+  const int64_t k = umap->db_graph->kmer_size, m = umap->mmer_size;
+  const uint64_t uid = e->unitigid - 1;
+  const int64_t nbases = umap->nodestart[uid+1] - umap->nodestart[uid] + k-1;
+  const dBNode *unodes = umap->nodes + umap->nodestart[uid];
+  const uint64_t *useq = umap->seq + umap->seqstart[uid];
+  const bool fw = (rstrand == e->strand);
+  const int64_t d = fw ? (int64_t)e->offset - (int64_t)rpos
+                       : (int64_t)e->offset + (m-1) + (int64_t)rpos;
+  int64_t i, b, f;
+
+  #define umap_kmer_idx(x) (fw ? d + (x) : d - (x) - (k-1))
+  #define umap_set(x) do { \
+    hkeys[x] = unodes[umap_kmer_idx(x)].key; placed[x] = 1; (*nplaced)++; \
+  } while(0)
+
+  for(i = j; i < (int64_t)j+k; i++)
+    if(!_umap_base_eq(seq, i, useq, nbases, fw, d)) return j;
+
+  umap_set(j);
+
+  for(b = (int64_t)j-1; b >= 0 && !placed[b] &&
+                        _umap_base_eq(seq, b, useq, nbases, fw, d); b--)
+    umap_set(b);
+
+  for(f = j+1; f < (int64_t)nkmers &&
+               _umap_base_eq(seq, f+k-1, useq, nbases, fw, d); f++)
+    umap_set(f);
+
+  #undef umap_set
+  #undef umap_kmer_idx
+
+  return (size_t)f;
+}
+
+/**
+ * Place the kmers of a sequence of ACGT bases onto unitigs.
+ * @param seq, len  bases to map, len >= kmer_size
+ * @param hkeys     set to the hkey of each placed kmer, others are not touched
+ * @param placed    set to whether each of the len-k+1 kmers was placed
+ * @param mkeys, mhash scratch space of `len` entries
+ * @return number of kmers placed
+ */
+size_t unitig_map_seq(const UnitigMap *umap, const char *seq, size_t len,
+                      hkey_t *hkeys, uint8_t *placed,
+                      uint64_t *mkeys, uint64_t *mhash)
+{
+  const size_t kmer_size = umap->db_graph->kmer_size;
+  const size_t m = umap->mmer_size, w = umap->window;
+  ctx_assert(len >= kmer_size);
+  const size_t nkmers = len - kmer_size + 1;
+  size_t i, j, end, mpos = SIZE_MAX, tried = SIZE_MAX, nplaced = 0;
+  uint64_t fwd = 0, rev = 0;
+  const UnitigMapEntry *e;
+
+  memset(placed, 0, nkmers);
+
+  for(i = 0; i < len; i++) {
+    umap_mmer_add(&fwd, &rev, dna_char_to_nuc(seq[i]), m);
+    if(i+1 >= m) {
+      mkeys[i+1-m] = umap_mmer_key(fwd, rev);
+      mhash[i+1-m] = umap_mmer_hash(mkeys[i+1-m] >> 1);
+    }
+  }
+
+  // Kmers sharing a minimizer usually lie on the same unitig, so only look up
+  // a minimizer the first time we see it
+  for(j = 0; j < nkmers; j++)
+  {
+    mpos = umap_window_min(mhash, SIZE_MAX, j, w, mpos);
+    if(mpos == tried) continue;
+    tried = mpos;
+    if((e = _umap_find(umap, mkeys[mpos], mhash[mpos])) == NULL) continue;
+    end = _umap_place(umap, e, mpos, mkeys[mpos] & 1, seq, j, nkmers,
+                      hkeys, placed, &nplaced);
+    if(end > j) { j = end-1; mpos = SIZE_MAX; }
+  }
+
+  return nplaced;
+}
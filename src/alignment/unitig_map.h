@@ -0,0 +1,76 @@
+#ifndef UNITIG_MAP_H_
+#define UNITIG_MAP_H_
+
+//
+// Map reads onto unitigs with sampled minimizers
+//
+// Most kmers of a read lie on a few unitigs. Instead of looking up every kmer
+// in the hash table, we look up the minimizer of a kmer in a small index of
+// minimizers sampled from every unitig, giving a (unitig, offset, strand).
+// The read is then compared base by base against the 2-bit packed sequence of
+// the unitig and each matching kmer is given the node stored at its offset.
+// Only kmers that could not be placed (unitig ends, mismatches, repetitive
+// minimizers) need looking up in the hash table.
+//
+// A minimizer is the canonical m-mer of a kmer with the smallest hash. Every
+// kmer of every unitig has its minimizer indexed, so any read kmer in a unitig
+// finds it, unless the minimizer occurs more than once in the graph. Repetitive
+// minimizers are dropped from the index.
+//
+// Built from a UnitigIndex, which can be freed once the map is built. Read
+// only once built. Must be rebuilt if kmers or edges change.
+//
+
+#include "db_graph.h"
+#include "unitig_graph.h"
+
+// Length of minimizers (odd so no m-mer is its own reverse complement)
+#define UNITIG_MAP_MMER 15
+
+typedef struct
+{
+  uint64_t mmer; // canonical m-mer + 1, 0 if empty
+  uint64_t unitigid; // unitig id + 1, UINT64_MAX if the m-mer is repetitive
+  uint32_t offset; // start of the m-mer in the unitig
+  uint8_t strand; // 1 if the unitig has the reverse complement of the m-mer
+} UnitigMapEntry;
+
+// Approximate memory required per kmer in the hash table, excluding the
+// UnitigIndex: a node per kmer plus a minimizer table entry every few kmers
+#define UNITIG_MAP_BITS_PER_KMER \
+        ((sizeof(dBNode) + sizeof(UnitigMapEntry)/2) * 8)
+
+struct UnitigMap
+{
+  const dBGraph *db_graph;
+  size_t mmer_size, window; // kmers have window = k-mmer+1 m-mers
+  size_t num_unitigs, num_kmers, num_minimizers;
+  uint64_t *nodestart; // [num_unitigs+1] index of first node of each unitig
+  dBNode *nodes; // [num_kmers] nodes of each unitig, first to last
+  uint64_t *seqstart; // [num_unitigs] word of seq where each unitig starts
+  uint64_t *seq; // 2-bit bases of each unitig, 32 per word, first base lowest
+  UnitigMapEntry *table; // [table_size] open addressing, power of two
+  size_t table_size;
+};
+
+// typedef struct UnitigMap UnitigMap; in db_graph.h
+
+void unitig_map_alloc(UnitigMap *umap, const dBGraph *db_graph);
+void unitig_map_dealloc(UnitigMap *umap);
+
+// Build from an index of the graph's unitigs. uidx can be freed afterwards.
+void unitig_map_build(UnitigMap *umap, const UnitigIndex *uidx, size_t nthreads);
+
+/**
+ * Place the kmers of a sequence of ACGT bases onto unitigs.
+ * @param seq, len  bases to map, len >= kmer_size
+ * @param hkeys     set to the hkey of each placed kmer, others are not touched
+ * @param placed    set to whether each of the len-k+1 kmers was placed
+ * @param mkeys, mhash scratch space of `len` entries
+ * @return number of kmers placed
+ */
+size_t unitig_map_seq(const UnitigMap *umap, const char *seq, size_t len,
+                      hkey_t *hkeys, uint8_t *placed,
+                      uint64_t *mkeys, uint64_t *mhash);
+
+#endif /* UNITIG_MAP_H_ */
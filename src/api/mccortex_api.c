@@ -0,0 +1,418 @@
+#include "global.h"
+#include "mccortex_api.h"
+#include "file_util.h"
+#include "hash_mem.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "db_unitig.h"
+#include "graphs_load.h"
+#include "graph_shm.h"
+#include "query_graph.h"
+
+#include <pthread.h>
+
+// Kmers are looked up in chunks so bucket fetches overlap
+#define API_CHUNK 256
+
+struct McGraph
+{
+  dBGraph db_graph; // loaded or shared graph, unused with a query graph
+  QueryGraph qgraph;
+  bool is_qgraph;
+  size_t kmer_size, ncols, nedgecols;
+};
+
+typedef struct
+{
+  BinaryKmer bkeys[API_CHUNK];
+  hkey_t hkeys[API_CHUNK];
+  uint64_t qidxs[API_CHUNK];
+  uint8_t orients[API_CHUNK], status[API_CHUNK];
+  size_t n;
+} ApiChunk;
+
+static pthread_once_t api_once = PTHREAD_ONCE_INIT;
+static FILE *api_log = NULL;
+
+static void api_init()
+{
+  cortex_init();
+  ctx_msg_out = api_log;
+}
+
+void mccortex_set_log(FILE *fh)
+{
+  pthread_once(&api_once, api_init);
+  ctx_msg_out = api_log = fh;
+}
+
+// Returns true if `path` can be read and starts with `magic`
+static bool api_file_has_magic(const char *path, const char *magic)
+{
+  size_t len = strlen(magic);
+  char buf[16];
+  ctx_assert(len <= sizeof(buf));
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) return false;
+  bool ret = (fread(buf, 1, len, fh) == len && memcmp(buf, magic, len) == 0);
+  fclose(fh);
+  return ret;
+}
+
+static void api_load_graph_files(dBGraph *db_graph, char **paths,
+                                 size_t npaths, size_t nthreads)
+{
+  GraphFileReader *gfiles = ctx_calloc(npaths, sizeof(GraphFileReader));
+  size_t i, ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+
+  ncols = graph_files_open(paths, gfiles, npaths,
+                           &ctx_max_kmers, &ctx_sum_kmers);
+
+  // Files may not share kmers, so make room for all of them
+  size_t bits_per_kmer = sizeof(BinaryKmer)*8 +
+                         (sizeof(CovgStore) + sizeof(Edges)) * 8 * ncols;
+  uint64_t kmers_in_hash;
+  hash_table_mem(MAX2(ctx_sum_kmers, 1024) / IDEAL_OCCUPANCY, bits_per_kmer,
+                 &kmers_in_hash);
+
+  db_graph_alloc(db_graph, gfiles[0].hdr.kmer_size, ncols, ncols,
+                 kmers_in_hash, DBG_ALLOC_EDGES | DBG_ALLOC_COVGS);
+
+  GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
+  gprefs.nthreads = nthreads;
+  gprefs.empty_colours = true;
+
+  for(i = 0; i < npaths; i++) {
+    graph_load(&gfiles[i], gprefs, NULL);
+    graph_file_close(&gfiles[i]);
+    gprefs.empty_colours = false;
+  }
+  ctx_free(gfiles);
+
+  // No more kmers are added, so most absent kmers can be rejected by a filter
+  hash_table_filter_build(&db_graph->ht);
+  hash_table_print_stats(&db_graph->ht);
+}
+
+McGraph* mccortex_graph_open(char **paths, size_t npaths, size_t nthreads)
+{
+  size_t i;
+  pthread_once(&api_once, api_init);
+
+  if(npaths == 0) return NULL;
+
+  if(npaths == 1 && api_file_has_magic(paths[0], QUERY_GRAPH_MAGIC)) {
+    McGraph *graph = ctx_calloc(1, sizeof(McGraph));
+    query_graph_load(&graph->qgraph, paths[0]);
+    graph->is_qgraph = true;
+    graph->kmer_size = graph->qgraph.kmer_size;
+    graph->ncols = graph->qgraph.num_of_cols;
+    graph->nedgecols = graph->qgraph.num_edge_cols;
+    return graph;
+  }
+
+  for(i = 0; i < npaths; i++) {
+    if(!api_file_has_magic(paths[i], "CORTEX")) {
+      warn("Not a graph file: %s", paths[i]);
+      return NULL;
+    }
+  }
+
+  McGraph *graph = ctx_calloc(1, sizeof(McGraph));
+  api_load_graph_files(&graph->db_graph, paths, npaths, MAX2(nthreads, 1));
+  graph->kmer_size = graph->db_graph.kmer_size;
+  graph->ncols = graph->db_graph.num_of_cols;
+  graph->nedgecols = graph->db_graph.num_edge_cols;
+  return graph;
+}
+
+McGraph* mccortex_graph_attach(const char *name)
+{
+  pthread_once(&api_once, api_init);
+
+  if(!graph_shm_exists(name)) {
+    warn("No graph segment: %s", name);
+    return NULL;
+  }
+
+  McGraph *graph = ctx_calloc(1, sizeof(McGraph));
+  graph_shm_attach(name, &graph->db_graph, DBG_ALLOC_EDGES | DBG_ALLOC_COVGS);
+  graph->kmer_size = graph->db_graph.kmer_size;
+  graph->ncols = graph->db_graph.num_of_cols;
+  graph->nedgecols = graph->db_graph.num_edge_cols;
+  return graph;
+}
+
+void mccortex_graph_close(McGraph *graph)
+{
+  if(graph == NULL) return;
+  if(graph->is_qgraph) query_graph_dealloc(&graph->qgraph);
+  else db_graph_dealloc(&graph->db_graph);
+  ctx_free(graph);
+}
+
+size_t mccortex_graph_kmer_size(const McGraph *graph) { return graph->kmer_size; }
+size_t mccortex_graph_ncols(const McGraph *graph) { return graph->ncols; }
+size_t mccortex_graph_nedgecols(const McGraph *graph) { return graph->nedgecols; }
+
+size_t mccortex_graph_nkmers(const McGraph *graph)
+{
+  return graph->is_qgraph ? graph->qgraph.num_kmers
+                          : hash_table_nkmers(&graph->db_graph.ht);
+}
+
+const char* mccortex_graph_sample_name(const McGraph *graph, size_t col)
+{
+  if(graph->is_qgraph || col >= graph->ncols) return "";
+  const StrBuf *name = &graph->db_graph.ginfo[col].sample_name;
+  return name->b != NULL ? name->b : "";
+}
+
+// Edges of a node, relative to the kmer as it was queried
+// [c]AGG[t]
+// [a]CCT[g]
+static inline Edges api_orient_edges(Edges e, Orientation orient)
+{
+  return orient == REVERSE ? (Edges)((e>>4) | (e<<4)) : e;
+}
+
+static inline void api_chunk_add(ApiChunk *chunk, BinaryKmer bkmer, bool valid,
+                                 size_t kmer_size)
+{
+  size_t i = chunk->n++;
+  if(valid) {
+    chunk->bkeys[i] = binary_kmer_get_key(bkmer, kmer_size);
+    chunk->orients[i] = bkmer_get_orientation(bkmer, chunk->bkeys[i]);
+    chunk->status[i] = MCCORTEX_KMER_ABSENT;
+  } else {
+    // looked up with an empty key whose result is ignored
+    chunk->bkeys[i] = zero_bkmer;
+    chunk->status[i] = MCCORTEX_KMER_INVALID;
+  }
+}
+
+// Look up the kmers of a chunk and write their results to index
+// offset..offset+chunk->n-1 of each output array. Empties the chunk.
+// Returns number of kmers found
+static size_t api_chunk_find(const McGraph *graph, ApiChunk *chunk,
+                             size_t offset, uint8_t *status,
+                             uint32_t *covgs, uint8_t *edges)
+{
+  const size_t n = chunk->n, ncols = graph->ncols, nedgecols = graph->nedgecols;
+  const dBGraph *db_graph = &graph->db_graph;
+  const QueryGraph *qgraph = &graph->qgraph;
+  size_t i, col, nfound = 0;
+  uint32_t *kcovgs;
+  uint8_t *kedges;
+
+  if(graph->is_qgraph) query_graph_find_batch(qgraph, chunk->bkeys, n, chunk->qidxs);
+  else hash_table_find_batch(&db_graph->ht, chunk->bkeys, n, HT_PREFETCH_DEPTH,
+                             chunk->hkeys);
+
+  if(covgs) memset(covgs + offset*ncols, 0, n * ncols * sizeof(uint32_t));
+  if(edges) memset(edges + offset*nedgecols, 0, n * nedgecols * sizeof(uint8_t));
+
+  for(i = 0; i < n; i++) {
+    if(chunk->status[i] == MCCORTEX_KMER_INVALID) continue;
+    if(graph->is_qgraph ? chunk->qidxs[i] == QG_NOT_FOUND
+                        : chunk->hkeys[i] == HASH_NOT_FOUND) continue;
+
+    chunk->status[i] = MCCORTEX_KMER_FOUND;
+    nfound++;
+
+    kcovgs = covgs ? covgs + (offset+i)*ncols : NULL;
+    kedges = edges ? edges + (offset+i)*nedgecols : NULL;
+
+    if(graph->is_qgraph) {
+      const CovgStore *qcovgs = query_graph_covgs(qgraph, chunk->qidxs[i]);
+      const Edges *qedges = query_graph_edges(qgraph, chunk->qidxs[i]);
+      if(kcovgs) for(col = 0; col < ncols; col++) kcovgs[col] = qcovgs[col];
+      if(kedges)
+        for(col = 0; col < nedgecols; col++)
+          kedges[col] = api_orient_edges(qedges[col], chunk->orients[i]);
+    } else {
+      if(kcovgs)
+        for(col = 0; col < ncols; col++)
+          kcovgs[col] = db_node_get_covg(db_graph, chunk->hkeys[i], col);
+      if(kedges)
+        for(col = 0; col < nedgecols; col++)
+          kedges[col] = api_orient_edges(db_node_get_edges(db_graph,
+                                                           chunk->hkeys[i], col),
+                                         chunk->orients[i]);
+    }
+  }
+
+  if(status) memcpy(status + offset, chunk->status, n);
+  chunk->n = 0;
+  return nfound;
+}
+
+static bool api_seq_is_acgt(const char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len && char_is_acgt(seq[i]); i++) {}
+  return i == len;
+}
+
+size_t mccortex_query_kmers(const McGraph *graph, const char *kmers, size_t n,
+                            uint8_t *status, uint32_t *covgs, uint8_t *edges)
+{
+  const size_t kmer_size = graph->kmer_size;
+  size_t i, nfound = 0;
+  const char *kmer;
+  bool valid;
+  ApiChunk chunk;
+  chunk.n = 0;
+
+  for(i = 0; i < n; i++) {
+    kmer = kmers + i*kmer_size;
+    valid = api_seq_is_acgt(kmer, kmer_size);
+    api_chunk_add(&chunk, valid ? binary_kmer_from_str(kmer, kmer_size)
+                                : zero_bkmer,
+                  valid, kmer_size);
+    if(chunk.n == API_CHUNK || i+1 == n)
+      nfound += api_chunk_find(graph, &chunk, i+1-chunk.n, status, covgs, edges);
+  }
+
+  return nfound;
+}
+
+size_t mccortex_query_seq(const McGraph *graph, const char *seq, size_t len,
+                          uint8_t *status, uint32_t *covgs, uint8_t *edges)
+{
+  const size_t kmer_size = graph->kmer_size;
+  size_t i, run = 0, nfound = 0, nkmers;
+  BinaryKmer bkmer = zero_bkmer;
+  ApiChunk chunk;
+  chunk.n = 0;
+
+  if(len < kmer_size) return 0;
+
+  // run is the number of ACGT bases ending at seq[i]
+  for(i = 0; i < len; i++) {
+    if(char_is_acgt(seq[i])) {
+      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, dna_char_to_nuc(seq[i]));
+      run++;
+    }
+    else run = 0;
+
+    if(i+1 < kmer_size) continue;
+    api_chunk_add(&chunk, bkmer, run >= kmer_size, kmer_size);
+    nkmers = i+2-kmer_size; // kmers so far
+    if(chunk.n == API_CHUNK || i+1 == len)
+      nfound += api_chunk_find(graph, &chunk, nkmers-chunk.n, status, covgs, edges);
+  }
+
+  return nfound;
+}
+
+static size_t api_unitig_fetch_graph(const dBGraph *db_graph, BinaryKmer bkmer,
+                                     char *seq, size_t size)
+{
+  dBNode node = db_graph_find(db_graph, bkmer);
+  if(node.key == HASH_NOT_FOUND) return 0;
+
+  dBNodeBuffer nbuf;
+  size_t i, len;
+  db_node_buf_alloc(&nbuf, 64);
+  db_unitig_fetch(node.key, &nbuf, db_graph);
+
+  // Orient so the kmer we were given is forwards
+  for(i = 0; nbuf.b[i].key != node.key; i++) {}
+  if(nbuf.b[i].orient != node.orient)
+    db_nodes_reverse_complement(nbuf.b, nbuf.len);
+
+  len = nbuf.len + db_graph->kmer_size - 1;
+  if(len < size) db_nodes_to_str(nbuf.b, nbuf.len, db_graph, seq);
+  db_node_buf_dealloc(&nbuf);
+  return len;
+}
+
+static inline Edges api_qg_edges_union(const QueryGraph *qg, uint64_t idx)
+{
+  const Edges *edges = query_graph_edges(qg, idx);
+  Edges uedges = 0;
+  size_t col;
+  for(col = 0; col < qg->num_edge_cols; col++) uedges |= edges[col];
+  return uedges;
+}
+
+// Walk a query graph from oriented kmer `bkmer` (which must be in the graph)
+// until the unitig ends, appending the bases added to `sbuf`.
+// Returns false if the walk came back to `bkey0`, the unitig is a cycle.
+static bool api_qg_unitig_extend(const QueryGraph *qg, BinaryKmer bkmer,
+                                 BinaryKmer bkey0, StrBuf *sbuf)
+{
+  const size_t kmer_size = qg->kmer_size;
+  BinaryKmer bkey = binary_kmer_get_key(bkmer, kmer_size), next, nkey;
+  Orientation orient = bkmer_get_orientation(bkmer, bkey);
+  Edges edges = api_qg_edges_union(qg, query_graph_find(qg, bkey));
+  Nucleotide nuc, lnuc;
+  uint64_t idx;
+
+  while(edges_has_precisely_one_edge(edges, orient, &nuc))
+  {
+    next = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
+    nkey = binary_kmer_get_key(next, kmer_size);
+    if((idx = query_graph_find(qg, nkey)) == QG_NOT_FOUND) break;
+
+    orient = bkmer_get_orientation(next, nkey);
+    edges = api_qg_edges_union(qg, idx);
+
+    if(!edges_has_precisely_one_edge(edges, rev_orient(orient), &lnuc)) break;
+    if(binary_kmer_eq(nkey, bkey0)) return false;
+    if(binary_kmer_eq(nkey, bkey)) break; // don't create a loop a->A
+
+    strbuf_append_char(sbuf, dna_nuc_to_char(nuc));
+    bkmer = next;
+    bkey = nkey;
+  }
+
+  return true;
+}
+
+static size_t api_unitig_fetch_qgraph(const QueryGraph *qg, BinaryKmer bkmer,
+                                      char *seq, size_t size)
+{
+  const size_t kmer_size = qg->kmer_size;
+  BinaryKmer bkey = binary_kmer_get_key(bkmer, kmer_size);
+  if(query_graph_find(qg, bkey) == QG_NOT_FOUND) return 0;
+
+  StrBuf fw, rv;
+  strbuf_alloc(&fw, 64);
+  strbuf_alloc(&rv, 64);
+
+  // bases after the kmer, then bases before it on the other strand
+  if(api_qg_unitig_extend(qg, bkmer, bkey, &fw)) {
+    api_qg_unitig_extend(qg, binary_kmer_reverse_complement(bkmer, kmer_size),
+                         bkey, &rv);
+  }
+
+  size_t len = rv.end + kmer_size + fw.end;
+  if(len < size) {
+    dna_revcomp_str(seq, rv.b, rv.end);
+    binary_kmer_to_str(bkmer, kmer_size, seq + rv.end);
+    memcpy(seq + rv.end + kmer_size, fw.b, fw.end);
+    seq[len] = '\0';
+  }
+
+  strbuf_dealloc(&fw);
+  strbuf_dealloc(&rv);
+  return len;
+}
+
+size_t mccortex_unitig_fetch(const McGraph *graph, const char *kmer,
+                             char *seq, size_t size)
+{
+  const size_t kmer_size = graph->kmer_size;
+  if(!api_seq_is_acgt(kmer, kmer_size)) return 0;
+
+  BinaryKmer bkmer = binary_kmer_from_str(kmer, kmer_size);
+  return graph->is_qgraph ? api_unitig_fetch_qgraph(&graph->qgraph, bkmer, seq, size)
+                          : api_unitig_fetch_graph(&graph->db_graph, bkmer, seq, size);
+}
+
+char* mccortex_edges_str(uint8_t edges, char *str)
+{
+  return db_node_get_edges_str(edges, str);
+}
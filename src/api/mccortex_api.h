@@ -0,0 +1,101 @@
+#ifndef MCCORTEX_API_H_
+#define MCCORTEX_API_H_
+
+//
+// libmccortex: query McCortex graphs from other programs
+//
+// Build with `make libmccortex` (bin/libmccortex<MAXK>.a) or
+// `make PIC=1 libmccortex-shared` (bin/libmccortex<MAXK>.so). Programs using the
+// static library also need libs/htslib/libhts.a,
+// libs/seq-align/src/libalign.a and -lpthread -lz -lm.
+//
+// A graph is opened once and can then be queried from any number of threads:
+// handles are read-only and lookups use no shared state. Three kinds of graph
+// can be opened:
+//   - graph files (.ctx), loaded into memory
+//   - query graphs (`mccortex index --query`, .ctx.qg), memory mapped
+//   - shared memory segments (`mccortex load --shm <name>`), mapped
+//     copy-on-write so many processes share one copy of the graph
+//
+// Lookups are batched: the caller passes many kmers (or a sequence) and arrays
+// to fill, so hash table buckets can be prefetched. Coverages and edges are
+// written per kmer, colour by colour:
+//   covgs[i*ncols + col]          for i in 0..n-1, col in 0..ncols-1
+//   edges[i*nedgecols + col]      for i in 0..n-1, col in 0..nedgecols-1
+// Edges are given relative to the kmer as queried (not its canonical key):
+// bit b (0-3) is an edge adding base "ACGT"[b] after the kmer, bit 4+b is an
+// edge adding the complement of "ACGT"[b] before it.
+//
+// Opening returns NULL if a file or segment does not exist or is not a graph.
+// Corrupt files and running out of memory end the process, as in the rest of
+// McCortex.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MCCORTEX_API_VERSION 1
+
+typedef struct McGraph McGraph;
+
+// Kmer status values returned by lookups
+#define MCCORTEX_KMER_ABSENT  0 // valid kmer not in the graph
+#define MCCORTEX_KMER_FOUND   1 // kmer in the graph
+#define MCCORTEX_KMER_INVALID 2 // kmer has bases other than ACGT
+
+// Status messages are printed to `fh`, NULL to silence (the default)
+void mccortex_set_log(FILE *fh);
+
+// Load graph files into memory, or map a query graph if `paths[0]` is one.
+// Graph files are loaded with `nthreads` threads, colours one after another.
+McGraph* mccortex_graph_open(char **paths, size_t npaths, size_t nthreads);
+
+// Attach shared memory segment `name` created with `mccortex load --shm`,
+// which must have edges and coverages
+McGraph* mccortex_graph_attach(const char *name);
+
+void mccortex_graph_close(McGraph *graph);
+
+size_t mccortex_graph_kmer_size(const McGraph *graph);
+size_t mccortex_graph_ncols(const McGraph *graph);
+size_t mccortex_graph_nedgecols(const McGraph *graph); // 1 or ncols
+size_t mccortex_graph_nkmers(const McGraph *graph);
+
+// Sample name of colour `col`, "" if not known
+const char* mccortex_graph_sample_name(const McGraph *graph, size_t col);
+
+/**
+ * Look up `n` kmers, each of kmer_size bases, packed one after another in
+ * `kmers` (no separators). Any output array may be NULL.
+ * @param status set to MCCORTEX_KMER_* for each kmer
+ * @param covgs  [n*ncols] zero for kmers not found
+ * @param edges  [n*nedgecols] zero for kmers not found
+ * @return number of kmers found
+ */
+size_t mccortex_query_kmers(const McGraph *graph, const char *kmers, size_t n,
+                            uint8_t *status, uint32_t *covgs, uint8_t *edges);
+
+/**
+ * Look up all len-kmer_size+1 kmers of sequence `seq`, output arrays are
+ * filled as mccortex_query_kmers() does. Does nothing if len < kmer_size.
+ * @return number of kmers found
+ */
+size_t mccortex_query_seq(const McGraph *graph, const char *seq, size_t len,
+                          uint8_t *status, uint32_t *covgs, uint8_t *edges);
+
+/**
+ * Fetch the unitig (maximal non-branching path) containing `kmer`, oriented
+ * so that `kmer` is on the forward strand. Writes a NUL terminated sequence to
+ * `seq` if it fits in `size` bytes, like snprintf().
+ * @return length of the unitig in bases, 0 if `kmer` is not in the graph
+ */
+size_t mccortex_unitig_fetch(const McGraph *graph, const char *kmer,
+                             char *seq, size_t size);
+
+// Write edges as `view --kmers` prints them e.g. "..g.A..T", str must have
+// room for 9 bytes. Returns str.
+char* mccortex_edges_str(uint8_t edges, char *str);
+
+#endif /* MCCORTEX_API_H_ */
@@ -31,6 +31,13 @@ void acall_destroy(AlignedCall *call)
 // Decomposer
 //
 
+// Record held in the sort window
+typedef struct
+{
+  bcf1_t *v;
+  uint64_t seq; // order added, keeps records at the same position in order
+} CallDecompRec;
+
 struct CallDecompStruct
 {
   nw_aligner_t *nw_aligner;
@@ -39,7 +46,12 @@ struct CallDecompStruct
   htsFile *vcffh;
   bcf_hdr_t *vcfhdr;
   bcf1_t *v;
-  StrBuf sbuf;
+  StrBuf sbuf, *outbuf; // outbuf is NULL unless buffering VCF lines
+  // Sort window: min-heap of records ordered by (chrom, pos, seq)
+  CallDecompRec *heap;
+  bcf1_t **spare; // pool of free records
+  size_t window, heap_len, nspare, nwritten;
+  int64_t last_rid, last_pos; // last record written from the window
   DecomposeStats stats;
 };
 
@@ -54,11 +66,17 @@ CallDecomp* call_decomp_init(htsFile *vcffh, bcf_hdr_t *vcfhdr)
   dc->vcfhdr = vcfhdr;
   dc->v = bcf_init();
   strbuf_alloc(&dc->sbuf, 256);
+  dc->last_rid = dc->last_pos = -1;
   return dc;
 }
 
 void call_decomp_destroy(CallDecomp *dc)
 {
+  size_t i;
+  ctx_assert2(dc->heap_len == 0, "call call_decomp_flush() first");
+  for(i = 0; i < dc->nspare; i++) bcf_destroy(dc->spare[i]);
+  ctx_free(dc->heap);
+  ctx_free(dc->spare);
   alignment_free(dc->aln);
   needleman_wunsch_free(dc->nw_aligner);
   ctx_free(dc->scoring);
@@ -77,6 +95,132 @@ void call_decomp_cpy_stats(DecomposeStats *stats, const CallDecomp *dc)
   memcpy(stats, &dc->stats, sizeof(*stats));
 }
 
+void call_decomp_add_stats(DecomposeStats *stats, const CallDecomp *dc)
+{
+  const DecomposeStats *s = &dc->stats;
+  stats->ncalls                     += s->ncalls;
+  stats->ncalls_mapped              += s->ncalls_mapped;
+  stats->ncalls_ref_allele_too_long += s->ncalls_ref_allele_too_long;
+  stats->nlines                     += s->nlines;
+  stats->nlines_too_long            += s->nlines_too_long;
+  stats->nlines_match_ref           += s->nlines_match_ref;
+  stats->nlines_mapped              += s->nlines_mapped;
+  stats->nvars                      += s->nvars;
+  stats->nallele_too_long           += s->nallele_too_long;
+  stats->nvars_printed              += s->nvars_printed;
+  stats->nvars_unsorted             += s->nvars_unsorted;
+}
+
+void call_decomp_set_outbuf(CallDecomp *dc, StrBuf *outbuf)
+{
+  dc->outbuf = outbuf;
+}
+
+void call_decomp_set_sort_window(CallDecomp *dc, size_t window)
+{
+  ctx_assert(dc->heap_len == 0);
+  size_t i;
+  for(i = 0; i < dc->nspare; i++) bcf_destroy(dc->spare[i]);
+  ctx_free(dc->heap);
+  ctx_free(dc->spare);
+  dc->window = window;
+  dc->nspare = dc->nwritten = 0;
+  dc->heap = window ? ctx_calloc(window+1, sizeof(dc->heap[0])) : NULL;
+  dc->spare = window ? ctx_calloc(window+1, sizeof(dc->spare[0])) : NULL;
+}
+
+static inline bool _rec_lt(const CallDecompRec *a, const CallDecompRec *b)
+{
+  if(a->v->rid != b->v->rid) return a->v->rid < b->v->rid;
+  if(a->v->pos != b->v->pos) return a->v->pos < b->v->pos;
+  return a->seq < b->seq;
+}
+
+static inline void _rec_heap_up(CallDecompRec *heap, size_t i)
+{
+  CallDecompRec tmp;
+  size_t parent;
+  while(i > 0 && _rec_lt(&heap[i], &heap[parent = (i-1)/2])) {
+    tmp = heap[i]; heap[i] = heap[parent]; heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+static inline void _rec_heap_down(CallDecompRec *heap, size_t n, size_t i)
+{
+  CallDecompRec tmp;
+  size_t child;
+  while((child = 2*i+1) < n) {
+    if(child+1 < n && _rec_lt(&heap[child+1], &heap[child])) child++;
+    if(!_rec_lt(&heap[child], &heap[i])) break;
+    tmp = heap[i]; heap[i] = heap[child]; heap[child] = tmp;
+    i = child;
+  }
+}
+
+static void call_decomp_write_rec(CallDecomp *dc, bcf1_t *v)
+{
+  if(bcf_write(dc->vcffh, dc->vcfhdr, v) != 0)
+    die("Cannot write VCF entry [nsamples: %zu]",
+        (size_t)bcf_hdr_nsamples(dc->vcfhdr));
+}
+
+// Write the first record in the window and return it to the pool
+static void call_decomp_pop_rec(CallDecomp *dc)
+{
+  bcf1_t *v = dc->heap[0].v;
+  if(v->rid < dc->last_rid || (v->rid == dc->last_rid && v->pos < dc->last_pos))
+    dc->stats.nvars_unsorted++;
+  else { dc->last_rid = v->rid; dc->last_pos = v->pos; }
+  call_decomp_write_rec(dc, v);
+  dc->spare[dc->nspare++] = v;
+  dc->heap[0] = dc->heap[--dc->heap_len];
+  _rec_heap_down(dc->heap, dc->heap_len, 0);
+}
+
+void call_decomp_flush(CallDecomp *dc)
+{
+  while(dc->heap_len > 0) call_decomp_pop_rec(dc);
+}
+
+// Parse a VCF line in `line` and write it, or add it to the sort window
+static void call_decomp_write_line(CallDecomp *dc, StrBuf *line)
+{
+  bcf1_t *v = dc->v;
+  if(dc->window) v = dc->nspare ? dc->spare[--dc->nspare] : bcf_init();
+
+  kstring_t ks = {.l = line->end, .m = line->size, .s = line->b};
+  if(vcf_parse(&ks, dc->vcfhdr, v) != 0)
+    die("Cannot construct VCF entry: %s", line->b);
+  // Move back into our string buffer
+  line->b = ks.s;
+  line->size = ks.m;
+
+  if(!dc->window) { call_decomp_write_rec(dc, v); return; }
+
+  dc->heap[dc->heap_len] = (CallDecompRec){.v = v, .seq = dc->nwritten++};
+  _rec_heap_up(dc->heap, dc->heap_len++);
+  if(dc->heap_len > dc->window) call_decomp_pop_rec(dc);
+}
+
+void call_decomp_write(CallDecomp *dc, StrBuf *lines)
+{
+  ctx_assert(dc->outbuf == NULL);
+  const char *line = lines->b, *end;
+  size_t len;
+
+  while(line < lines->b + lines->end) {
+    end = strchr(line, '\n');
+    len = end - line;
+    strbuf_reset(&dc->sbuf);
+    strbuf_append_strn(&dc->sbuf, line, len);
+    call_decomp_write_line(dc, &dc->sbuf);
+    line = end+1;
+  }
+
+  strbuf_reset(lines);
+}
+
 //
 // Decompose AlignedCall
 //
@@ -137,14 +281,11 @@ static void print_vcf_entry(size_t vcf_pos, int8_t prev_base, int8_t next_base,
   // fprintf(stderr, " prev_base:%i next_base:%i info:%s\n", prev_base, next_base, call->info.b);
   // fprintf(stderr, "%s [%zu vs %zu]\n", sbuf->b, sbuf->end, strlen(sbuf->b));
 
-  kstring_t ks = {.l = sbuf->end, .m = sbuf->size, .s = sbuf->b};
-  if(vcf_parse(&ks, dc->vcfhdr, dc->v) != 0)
-    die("Cannot construct VCF entry: %s", sbuf->b);
-  if(bcf_write(dc->vcffh, dc->vcfhdr, dc->v) != 0)
-    die("Cannot write VCF entry [nsamples: %zu vs %zu]", nsamples, (size_t)bcf_hdr_nsamples(dc->vcfhdr));
-  // Move back into our string buffer
-  sbuf->b = ks.s;
-  sbuf->size = ks.m;
+  if(dc->outbuf != NULL) {
+    strbuf_append_strn(dc->outbuf, sbuf->b, sbuf->end);
+    strbuf_append_char(dc->outbuf, '\n');
+  }
+  else call_decomp_write_line(dc, sbuf);
 
   dc->stats.nvars_printed++;
 }
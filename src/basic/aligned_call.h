@@ -33,6 +33,7 @@ typedef struct {
   uint64_t ncalls, ncalls_mapped, ncalls_ref_allele_too_long;
   uint64_t nlines, nlines_too_long, nlines_match_ref, nlines_mapped;
   uint64_t nvars, nallele_too_long, nvars_printed; // decomposed ALTs
+  uint64_t nvars_unsorted; // printed out of order despite the sort window
 } DecomposeStats;
 
 CallDecomp* call_decomp_init(htsFile *vcffh, bcf_hdr_t *vcfhdr);
@@ -40,6 +41,25 @@ void call_decomp_destroy(CallDecomp *dc);
 scoring_t* call_decomp_get_scoring(CallDecomp *dc);
 
 void call_decomp_cpy_stats(DecomposeStats *stats, const CallDecomp *dc);
+// Add stats from `dc` to `stats`, to combine stats from multiple threads
+void call_decomp_add_stats(DecomposeStats *stats, const CallDecomp *dc);
+
+// Append VCF lines to `outbuf` instead of writing them. Lets threads decompose
+// calls in parallel, then write out in call order with call_decomp_write().
+// Pass NULL to write to the VCF file again.
+void call_decomp_set_outbuf(CallDecomp *dc, StrBuf *outbuf);
+
+// Write VCF lines made by a buffered CallDecomp, empties `lines`
+void call_decomp_write(CallDecomp *dc, StrBuf *lines);
+
+// Hold up to `window` records and write them in (chrom, pos) order. Output is
+// sorted if no record arrives more than `window` records after one that should
+// follow it; others are written as soon as possible and counted in
+// stats.nvars_unsorted. Records are parsed into a reused pool. 0 turns it off.
+void call_decomp_set_sort_window(CallDecomp *dc, size_t window);
+
+// Write all records held in the sort window
+void call_decomp_flush(CallDecomp *dc);
 
 void acall_decompose(CallDecomp *dc, const AlignedCall *call,
                      size_t max_line_len, size_t max_allele_len);
@@ -0,0 +1,406 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE // fopencookie(), O_DIRECT
+#endif
+
+#include "global.h"
+#include "async_file.h"
+#include "util.h"
+#include "file_util.h"
+#include "remote_file.h"
+
+#include <fcntl.h> // open
+#include <unistd.h> // pread, pwrite
+
+static bool async_enabled = false, async_direct = false;
+static size_t async_bufsize = ASYNC_FILE_DEFAULT_BUFSIZE;
+
+void async_file_enable(size_t bufsize, bool direct)
+{
+  if(bufsize == 0) bufsize = ASYNC_FILE_DEFAULT_BUFSIZE;
+  async_bufsize = roundup2pow(MAX2(bufsize, ASYNC_FILE_ALIGN));
+  async_direct = direct;
+  async_enabled = true;
+}
+
+void async_file_disable() { async_enabled = false; }
+bool async_file_enabled() { return async_enabled; }
+
+#if defined(__GLIBC__)
+
+// Buffers [head..head+nfull) are ready for the caller (reading) or queued for
+// the I/O thread (writing). The I/O thread only touches a buffer outside that
+// range (reading) or the one at head (writing).
+typedef struct AsyncFileStruct AsyncFile;
+
+struct AsyncFileStruct
+{
+  int fd, userfd; // userfd: fd without O_DIRECT, for async_file_fileno()
+  FILE *fh;
+  AsyncFile *next; // list of open streams
+  bool writing;
+  char *mem, *bufs[ASYNC_FILE_NBUFS];
+  size_t lens[ASYNC_FILE_NBUFS];
+  off_t offs[ASYNC_FILE_NBUFS]; // file offset of each queued write
+  size_t bufsize, align;
+  size_t head, nfull, pos; // pos: read/write position in the caller's buffer
+  off_t fileoff; // next offset for the I/O thread to read
+  off_t useroff; // caller's position in the file
+  size_t skip; // bytes to skip in the first buffer after a seek
+  uint64_t gen; // incremented by seeks, to drop reads already in flight
+  bool eof, stop, busy;
+  int errnum;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t th;
+};
+
+static AsyncFile *async_files = NULL;
+static pthread_mutex_t async_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int async_file_fileno(FILE *fh)
+{
+  int fd = fileno(fh);
+  if(fd >= 0) return fd;
+  AsyncFile *af;
+  pthread_mutex_lock(&async_files_lock);
+  for(af = async_files; af != NULL && af->fh != fh; af = af->next) {}
+  if(af != NULL) fd = af->userfd;
+  pthread_mutex_unlock(&async_files_lock);
+  return af != NULL ? fd : remote_file_fileno(fh);
+}
+
+#define af_fill_idx(af) (((af)->head + (af)->nfull) % ASYNC_FILE_NBUFS)
+
+static void* _async_read_thread(void *arg)
+{
+  AsyncFile *af = (AsyncFile*)arg;
+  size_t i;
+  off_t off;
+  uint64_t gen;
+  ssize_t n;
+
+  pthread_mutex_lock(&af->lock);
+  while(!af->stop)
+  {
+    if(af->eof || af->errnum || af->nfull == ASYNC_FILE_NBUFS) {
+      pthread_cond_wait(&af->cond, &af->lock);
+      continue;
+    }
+
+    i = af_fill_idx(af);
+    off = af->fileoff;
+    gen = af->gen;
+    af->busy = true;
+    pthread_mutex_unlock(&af->lock);
+
+    while((n = pread(af->fd, af->bufs[i], af->bufsize, off)) < 0 &&
+          errno == EINTR) {}
+
+    pthread_mutex_lock(&af->lock);
+    af->busy = false;
+    if(gen == af->gen) {
+      if(n < 0) af->errnum = errno;
+      else if(n == 0) af->eof = true;
+      else {
+        af->lens[i] = n;
+        ctx_stats_add(CTX_STAT_BYTES_IN, n);
+        af->fileoff += n;
+        af->nfull++;
+        // An unaligned short read is the end of the file
+        if((size_t)n % af->align) af->eof = true;
+      }
+    }
+    pthread_cond_broadcast(&af->cond);
+  }
+  pthread_mutex_unlock(&af->lock);
+  return NULL;
+}
+
+static void* _async_write_thread(void *arg)
+{
+  AsyncFile *af = (AsyncFile*)arg;
+  size_t i, done;
+  ssize_t n;
+
+  pthread_mutex_lock(&af->lock);
+  while(1)
+  {
+    if(af->nfull == 0) {
+      if(af->stop) break;
+      pthread_cond_wait(&af->cond, &af->lock);
+      continue;
+    }
+
+    i = af->head;
+    pthread_mutex_unlock(&af->lock);
+
+    for(done = 0; done < af->lens[i]; done += n) {
+      n = pwrite(af->fd, af->bufs[i]+done, af->lens[i]-done, af->offs[i]+done);
+      if(n < 0 && errno == EINTR) { n = 0; continue; }
+      if(n <= 0) break;
+    }
+
+    pthread_mutex_lock(&af->lock);
+    if(done < af->lens[i] && !af->errnum) af->errnum = n < 0 ? errno : EIO;
+    ctx_stats_add(CTX_STAT_BYTES_OUT, done);
+    af->head = (af->head + 1) % ASYNC_FILE_NBUFS;
+    af->nfull--;
+    pthread_cond_broadcast(&af->cond);
+  }
+  pthread_mutex_unlock(&af->lock);
+  return NULL;
+}
+
+static ssize_t _async_read(void *cookie, char *buf, size_t size)
+{
+  AsyncFile *af = (AsyncFile*)cookie;
+  size_t done = 0, n;
+
+  pthread_mutex_lock(&af->lock);
+  while(done < size)
+  {
+    if(af->nfull == 0) {
+      if(af->errnum) { errno = af->errnum; pthread_mutex_unlock(&af->lock); return -1; }
+      if(af->eof) break;
+      pthread_cond_wait(&af->cond, &af->lock);
+      continue;
+    }
+
+    if(af->skip) { af->pos = af->skip; af->skip = 0; }
+
+    if(af->pos >= af->lens[af->head]) {
+      // Hand buffer back to the I/O thread
+      af->head = (af->head + 1) % ASYNC_FILE_NBUFS;
+      af->nfull--;
+      af->pos = 0;
+      pthread_cond_broadcast(&af->cond);
+      continue;
+    }
+
+    // Buffer at head belongs to us, copy without holding the lock
+    n = MIN2(size - done, af->lens[af->head] - af->pos);
+    pthread_mutex_unlock(&af->lock);
+    memcpy(buf+done, af->bufs[af->head]+af->pos, n);
+    pthread_mutex_lock(&af->lock);
+    af->pos += n;
+    done += n;
+  }
+  af->useroff += done;
+  pthread_mutex_unlock(&af->lock);
+  return done;
+}
+
+// Queue the caller's buffer for writing and wait for a free one
+// Lock must be held
+static void _async_write_queue(AsyncFile *af)
+{
+  size_t i = af_fill_idx(af);
+  af->lens[i] = af->pos;
+  af->offs[i] = af->useroff - af->pos;
+  af->nfull++;
+  af->pos = 0;
+  pthread_cond_broadcast(&af->cond);
+  while(af->nfull == ASYNC_FILE_NBUFS)
+    pthread_cond_wait(&af->cond, &af->lock);
+}
+
+// Lock must be held
+static void _async_write_drain(AsyncFile *af)
+{
+  if(af->pos) _async_write_queue(af);
+  while(af->nfull) pthread_cond_wait(&af->cond, &af->lock);
+}
+
+static ssize_t _async_write(void *cookie, const char *buf, size_t size)
+{
+  AsyncFile *af = (AsyncFile*)cookie;
+  size_t done = 0, n;
+
+  pthread_mutex_lock(&af->lock);
+  if(af->errnum) { errno = af->errnum; pthread_mutex_unlock(&af->lock); return 0; }
+  while(done < size) {
+    if(af->pos == af->bufsize) _async_write_queue(af);
+    n = MIN2(size - done, af->bufsize - af->pos);
+    memcpy(af->bufs[af_fill_idx(af)]+af->pos, buf+done, n);
+    af->pos += n;
+    af->useroff += n;
+    done += n;
+  }
+  pthread_mutex_unlock(&af->lock);
+  return done;
+}
+
+static int _async_seek(void *cookie, off64_t *offset, int whence)
+{
+  AsyncFile *af = (AsyncFile*)cookie;
+  struct stat st;
+  off_t target;
+
+  pthread_mutex_lock(&af->lock);
+
+  switch(whence) {
+    case SEEK_SET: target = *offset; break;
+    case SEEK_CUR: target = af->useroff + *offset; break;
+    case SEEK_END:
+      if(af->writing) _async_write_drain(af);
+      if(fstat(af->fd, &st) != 0) { pthread_mutex_unlock(&af->lock); return -1; }
+      target = MAX2(st.st_size, af->useroff) + *offset;
+      break;
+    default: errno = EINVAL; pthread_mutex_unlock(&af->lock); return -1;
+  }
+
+  if(target < 0) { errno = EINVAL; pthread_mutex_unlock(&af->lock); return -1; }
+
+  // ftell() seeks by zero, don't drop buffers
+  if(target != af->useroff)
+  {
+    if(af->writing) {
+      _async_write_drain(af);
+    } else {
+      // Drop buffered reads, restart reading at an aligned offset
+      af->gen++;
+      af->head = af->nfull = af->pos = 0;
+      af->fileoff = target - (target % af->align);
+      af->skip = target - af->fileoff;
+      af->eof = false;
+      pthread_cond_broadcast(&af->cond);
+    }
+    af->useroff = target;
+  }
+
+  *offset = target;
+  pthread_mutex_unlock(&af->lock);
+  return 0;
+}
+
+static int _async_close(void *cookie)
+{
+  AsyncFile *af = (AsyncFile*)cookie;
+  int err;
+
+  pthread_mutex_lock(&af->lock);
+  if(af->writing) _async_write_drain(af);
+  else { while(af->busy) pthread_cond_wait(&af->cond, &af->lock); }
+  af->stop = true;
+  pthread_cond_broadcast(&af->cond);
+  pthread_mutex_unlock(&af->lock);
+
+  if(pthread_join(af->th, NULL) != 0) die("Cannot join I/O thread");
+
+  AsyncFile **ptr;
+  pthread_mutex_lock(&async_files_lock);
+  for(ptr = &async_files; *ptr != af; ptr = &(*ptr)->next) {}
+  *ptr = af->next;
+  pthread_mutex_unlock(&async_files_lock);
+
+  err = af->errnum;
+  if(af->userfd != af->fd) close(af->userfd);
+  if(close(af->fd) != 0 && !err) err = errno;
+
+  pthread_cond_destroy(&af->cond);
+  pthread_mutex_destroy(&af->lock);
+  ctx_free(af->mem);
+  ctx_free(af);
+
+  if(err) { errno = err; return -1; }
+  return 0;
+}
+
+static FILE* _async_file_open(const char *path, bool writing)
+{
+  int fd = -1, userfd, flags = writing ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+  size_t i, align = 1;
+
+  if((userfd = open(path, flags, 0666)) < 0)
+    die("Cannot open file: %s [%s]", futil_outpath_str(path), strerror(errno));
+
+  #ifdef O_DIRECT
+    // O_DIRECT needs aligned buffers, offsets and lengths
+    if(async_direct && !writing) {
+      fd = open(path, flags | O_DIRECT);
+      if(fd >= 0) align = ASYNC_FILE_ALIGN;
+    }
+  #endif
+
+  if(fd < 0) fd = userfd;
+
+  AsyncFile *af = ctx_calloc(1, sizeof(AsyncFile));
+  af->fd = fd;
+  af->userfd = userfd;
+  af->writing = writing;
+  af->bufsize = async_bufsize;
+  af->align = align;
+  af->mem = ctx_malloc(ASYNC_FILE_NBUFS * af->bufsize + ASYNC_FILE_ALIGN);
+
+  char *ptr = af->mem + ASYNC_FILE_ALIGN - ((size_t)af->mem % ASYNC_FILE_ALIGN);
+  for(i = 0; i < ASYNC_FILE_NBUFS; i++) af->bufs[i] = ptr + i * af->bufsize;
+
+  if(pthread_mutex_init(&af->lock, NULL) != 0) die("Mutex init failed");
+  if(pthread_cond_init(&af->cond, NULL) != 0) die("Cond init failed");
+
+  #ifdef POSIX_FADV_SEQUENTIAL
+    if(!writing) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  #endif
+
+  int rc = pthread_create(&af->th, NULL,
+                          writing ? _async_write_thread : _async_read_thread, af);
+  if(rc != 0) die("Creating I/O thread failed: %s", strerror(rc));
+
+  cookie_io_functions_t funcs = {.read = writing ? NULL : _async_read,
+                                 .write = writing ? _async_write : NULL,
+                                 .seek = _async_seek,
+                                 .close = _async_close};
+
+  FILE *fh = fopencookie(af, writing ? "w" : "r", funcs);
+  if(fh == NULL) die("Cannot open async stream: %s", futil_outpath_str(path));
+
+  // Small stdio buffer: only batches tiny freads/fwrites into one call
+  setvbuf(fh, NULL, _IOFBF, 64*1024);
+
+  af->fh = fh;
+  pthread_mutex_lock(&async_files_lock);
+  af->next = async_files;
+  async_files = af;
+  pthread_mutex_unlock(&async_files_lock);
+
+  return fh;
+}
+
+FILE* async_file_fopen(const char *path, const char *mode)
+{
+  struct stat st;
+  bool reading = !strcmp(mode,"r") || !strcmp(mode,"rb");
+  bool writing = !strcmp(mode,"w") || !strcmp(mode,"wb");
+
+  if(remote_file_is_url(path)) {
+    if(!reading) die("Cannot open URL for writing: %s", path);
+    return remote_file_fopen(path);
+  }
+
+  if(!async_enabled || path == NULL || !strcmp(path,"-") ||
+     (!reading && !writing) ||
+     (reading && (stat(path, &st) != 0 || !S_ISREG(st.st_mode))))
+    return futil_fopen(path, mode);
+
+  return _async_file_open(path, writing);
+}
+
+#else
+
+// fopencookie() is not available, always use regular streams
+FILE* async_file_fopen(const char *path, const char *mode)
+{
+  if(remote_file_is_url(path)) return remote_file_fopen(path);
+  return futil_fopen(path, mode);
+}
+
+int async_file_fileno(FILE *fh) { return fileno(fh); }
+
+#endif /* defined(__GLIBC__) */
+
+FILE* async_file_fopen_create(const char *path, const char *mode)
+{
+  ctx_assert(path != NULL);
+  futil_create_output(path);
+  return async_file_fopen(path, mode);
+}
@@ -0,0 +1,43 @@
+#ifndef ASYNC_FILE_H_
+#define ASYNC_FILE_H_
+
+//
+// Asynchronous file streams for large sequential graph and link files
+//
+// A background I/O thread reads ahead of (or writes behind) the caller with
+// pread()/pwrite() into a ring of large buffers, so parsing and I/O overlap
+// and the device sees a few large requests in flight rather than many small
+// blocking ones. Streams are returned as FILE* (via fopencookie()) so existing
+// fread()/fwrite()/fseek() code does not change.
+//
+// Off by default. Only used for regular files opened with mode "r" or "w",
+// anything else (STDIN/STDOUT, "r+", "a") falls back to futil_fopen().
+//
+
+#include "cortex_types.h"
+
+#define ASYNC_FILE_NBUFS 2 // double buffered
+#define ASYNC_FILE_DEFAULT_BUFSIZE (4*ONE_MEGABYTE)
+#define ASYNC_FILE_ALIGN 4096 // buffer and offset alignment needed for O_DIRECT
+
+// Enable async streams for async_file_fopen(). `bufsize` is the size of each
+// buffer (0 for default). If `direct`, files opened for reading use O_DIRECT
+// to skip the page cache, falling back to cached reads if not supported.
+void async_file_enable(size_t bufsize, bool direct);
+void async_file_disable();
+bool async_file_enabled();
+
+// Open `path` with an async stream if enabled, otherwise as futil_fopen().
+// URLs are opened read-only with remote_file_fopen().
+// Calls die() if cannot open the file. Close with fclose().
+FILE* async_file_fopen(const char *path, const char *mode);
+
+// As async_file_fopen() but creates the file, see futil_fopen_create()
+FILE* async_file_fopen_create(const char *path, const char *mode);
+
+// fileno() of an async stream is -1. Returns a descriptor of the file behind
+// `fh` for pread()/mmap() (never opened with O_DIRECT), or fileno(fh) for
+// other streams. Remote streams give a descriptor for remote_file_pread_fd().
+int async_file_fileno(FILE *fh);
+
+#endif /* ASYNC_FILE_H_ */
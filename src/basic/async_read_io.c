@@ -1,19 +1,89 @@
 #include "global.h"
 #include "async_read_io.h"
 #include "seq_reader.h"
+#include "seq_inflate.h"
 #include "file_util.h"
 #include "util.h" // util_run_threads()
+#include "ctx_progress.h"
 
 #include <pthread.h>
 
+// Inputs waiting to be read, shared by the reader threads and any workers
+// helping to read
+struct AsyncIOInputList
+{
+  const AsyncIOInput *inputs;
+  size_t num_inputs;
+  volatile size_t next, num_running;
+  volatile size_t num_helped; // inputs read by workers
+};
+
+typedef struct {
+  AsyncIOQueue *queue;
+  // Only one of func, batch_func is set
+  void (*func)(AsyncIOData *_data, size_t _tid, void *_arg);
+  void (*batch_func)(AsyncIOBatch *_batch, size_t _tid, void *_arg);
+  void *arg;
+} PoolFuncPair;
+
 struct AsyncIOWorker
 {
   pthread_t thread;
-  MsgPool *const pool;
+  AsyncIOQueue *const queue;
   AsyncIOInput task;
-  size_t *const num_running;
+  AsyncIOInputList *const list;
+  AsyncIOBatch *batch; // batch currently being filled
+  // Set if a worker is reading: batches are processed, not queued
+  const PoolFuncPair *inline_job;
+  size_t threadid;
 };
 
+static size_t asyncio_batch_size = ASYNCIO_BATCH_READS;
+static AsyncIOQueueType asyncio_queue_type = ASYNCIO_QUEUE_RING;
+static size_t asyncio_max_open = 0; // 0 => read all inputs at once
+
+#define asyncio_num_open(n) (asyncio_max_open ? MIN2(n, asyncio_max_open) : (n))
+
+void asyncio_set_batch_size(size_t nreads)
+{
+  ctx_assert(nreads > 0);
+  asyncio_batch_size = nreads;
+}
+
+size_t asyncio_get_batch_size()
+{
+  return asyncio_batch_size;
+}
+
+void asyncio_set_queue_type(AsyncIOQueueType type)
+{
+  asyncio_queue_type = type;
+}
+
+AsyncIOQueueType asyncio_get_queue_type()
+{
+  return asyncio_queue_type;
+}
+
+void asyncio_set_max_open(size_t n)
+{
+  asyncio_max_open = n;
+}
+
+size_t asyncio_get_max_open()
+{
+  return asyncio_max_open;
+}
+
+// Without batching we keep the old pool of MSGPOOLSIZE reads, otherwise
+// enough batches to keep every reader and worker busy
+size_t asyncio_pool_nbatches(size_t num_inputs, size_t num_readers)
+{
+  if(asyncio_batch_size == 1) return MSGPOOLSIZE;
+  size_t num_open = asyncio_num_open(num_inputs);
+  return MAX2(MSGPOOLSIZE / asyncio_batch_size, 2*(num_open+num_readers));
+}
+
 
 // if out_base != NULL, we expect an output string as well:
 //   -1, --seq <in>:<out>
@@ -86,6 +156,25 @@ void asyncio_task_close(AsyncIOInput *task)
   task->file1 = task->file2 = NULL;
 }
 
+static seq_file_t* _asyncio_reopen(seq_file_t *sf)
+{
+  if(sf == NULL) return NULL;
+  if(strcmp(sf->path,"-") == 0) die("Cannot read STDIN twice");
+  char *path = strdup(sf->path);
+  seq_close(sf);
+  if((sf = seq_open(path)) == NULL) die("Cannot reopen file: %s", path);
+  free(path);
+  return sf;
+}
+
+// Close and reopen input files, so they can be read again from the start.
+// Dies if reading from STDIN.
+void asyncio_task_reopen(AsyncIOInput *task)
+{
+  task->file1 = _asyncio_reopen(task->file1);
+  task->file2 = _asyncio_reopen(task->file2);
+}
+
 void asynciodata_alloc(AsyncIOData *iod)
 {
   if(seq_read_alloc(&iod->r1) == NULL ||
@@ -98,36 +187,193 @@ void asynciodata_dealloc(AsyncIOData *iod)
   seq_read_dealloc(&iod->r2);
 }
 
-void asynciodata_pool_init(void *el, size_t idx, void *args)
+void asynciobatch_alloc(AsyncIOBatch *batch, size_t nreads)
+{
+  size_t i;
+  batch->data = ctx_malloc(nreads * sizeof(AsyncIOData));
+  for(i = 0; i < nreads; i++) asynciodata_alloc(&batch->data[i]);
+  batch->size = nreads;
+  batch->len = batch->nbases = 0;
+  batch->pos = -1;
+}
+
+void asynciobatch_dealloc(AsyncIOBatch *batch)
+{
+  size_t i;
+  for(i = 0; i < batch->size; i++) asynciodata_dealloc(&batch->data[i]);
+  ctx_free(batch->data);
+  memset(batch, 0, sizeof(*batch));
+}
+
+void asynciobatch_pool_init(void *el, size_t idx, void *args)
+{
+  AsyncIOBatch *store = (AsyncIOBatch*)args, *batch = store + idx;
+  memcpy(el, &batch, sizeof(AsyncIOBatch*));
+}
+
+//
+// Queue of batches
+//
+
+void asyncio_queue_alloc(AsyncIOQueue *q, AsyncIOBatch *batches,
+                         size_t nbatches)
+{
+  size_t i;
+  memset(q, 0, sizeof(*q));
+  q->type = asyncio_queue_type;
+  q->nbatches = nbatches;
+  q->progress_id = ctx_progress_add_queue("read_batches", nbatches, &q->nfull);
+
+  if(q->type == ASYNCIO_QUEUE_MSGPOOL) {
+    msgpool_alloc(&q->pool, nbatches, sizeof(AsyncIOBatch*), USE_MSG_POOL);
+    msgpool_iterate(&q->pool, asynciobatch_pool_init, batches);
+  }
+  else {
+    AsyncIOBatch **ptrs = ctx_malloc(nbatches * sizeof(AsyncIOBatch*));
+    for(i = 0; i < nbatches; i++) ptrs[i] = &batches[i];
+    mpmc_ring_alloc(&q->empty, nbatches);
+    mpmc_ring_alloc(&q->full, nbatches);
+    mpmc_ring_push_batch(&q->empty, (void*const*)ptrs, nbatches);
+    ctx_free(ptrs);
+  }
+}
+
+void asyncio_queue_dealloc(AsyncIOQueue *q)
+{
+  ctx_progress_del_queue(q->progress_id);
+  if(q->type == ASYNCIO_QUEUE_MSGPOOL) msgpool_dealloc(&q->pool);
+  else {
+    mpmc_ring_dealloc(&q->empty);
+    mpmc_ring_dealloc(&q->full);
+  }
+}
+
+// Get an empty batch to fill
+static AsyncIOBatch* asyncio_queue_claim(AsyncIOQueue *q)
+{
+  AsyncIOBatch *batch;
+  int pos;
+
+  if(q->type == ASYNCIO_QUEUE_MSGPOOL) {
+    ctx_stats_time(CTX_STAT_MSGPOOL_WRITE_NS,
+                   pos = msgpool_claim_write(&q->pool));
+    memcpy(&batch, msgpool_get_ptr(&q->pool, pos), sizeof(AsyncIOBatch*));
+    batch->pos = pos;
+  }
+  else {
+    // Empty ring is never closed
+    bool popped;
+    ctx_stats_time(CTX_STAT_MSGPOOL_WRITE_NS,
+                   popped = mpmc_ring_pop(&q->empty, &batch));
+    if(!popped) die("Empty batch queue closed");
+  }
+
+  return batch;
+}
+
+// Pass a full batch on to the workers
+static void asyncio_queue_push(AsyncIOQueue *q, AsyncIOBatch *batch)
+{
+  __sync_fetch_and_add(&q->nfull, 1);
+  if(q->type == ASYNCIO_QUEUE_MSGPOOL)
+    msgpool_release(&q->pool, batch->pos, MPOOL_FULL);
+  else
+    mpmc_ring_push(&q->full, batch);
+}
+
+AsyncIOBatch* asyncio_queue_pop(AsyncIOQueue *q)
+{
+  AsyncIOBatch *batch = NULL;
+  int pos;
+
+  if(q->type == ASYNCIO_QUEUE_MSGPOOL) {
+    ctx_stats_time(CTX_STAT_MSGPOOL_READ_NS,
+                   pos = msgpool_claim_read(&q->pool));
+    if(pos == -1) return NULL;
+    memcpy(&batch, msgpool_get_ptr(&q->pool, pos), sizeof(AsyncIOBatch*));
+    batch->pos = pos;
+  }
+  else {
+    bool popped;
+    ctx_stats_time(CTX_STAT_MSGPOOL_READ_NS,
+                   popped = mpmc_ring_pop(&q->full, &batch));
+    if(!popped) return NULL;
+  }
+
+  __sync_fetch_and_sub(&q->nfull, 1);
+
+  return batch;
+}
+
+void asyncio_queue_release(AsyncIOQueue *q, AsyncIOBatch *batch)
 {
-  // status("alloc: %zu %p", idx, el);
-  AsyncIOData *store = (AsyncIOData*)args, *data = store + idx;
-  memcpy(el, &data, sizeof(AsyncIOData*));
+  if(q->type == ASYNCIO_QUEUE_MSGPOOL)
+    msgpool_release(&q->pool, batch->pos, MPOOL_EMPTY);
+  else
+    mpmc_ring_push(&q->empty, batch);
+}
+
+// No more batches will be pushed
+static void asyncio_queue_close(AsyncIOQueue *q)
+{
+  if(q->type == ASYNCIO_QUEUE_MSGPOOL) msgpool_close(&q->pool);
+  else mpmc_ring_close(&q->full);
 }
 
 // No memory allocated for io worker
-static void async_io_worker_init(AsyncIOWorker *wrkr,
-                                 const AsyncIOInput *task,
-                                 MsgPool *pool, size_t *num_running)
+static void async_io_worker_init(AsyncIOWorker *wrkr, AsyncIOQueue *q,
+                                 AsyncIOInputList *list)
 {
-  ctx_assert(pool->elsize == sizeof(AsyncIOData*));
-  AsyncIOWorker tmp = {.pool = pool, .task = *task, .num_running = num_running};
+  AsyncIOWorker tmp = {.queue = q, .list = list, .batch = NULL,
+                       .inline_job = NULL, .threadid = 0};
   memcpy(wrkr, &tmp, sizeof(AsyncIOWorker));
 }
 
+static void asyncio_process_batch(const PoolFuncPair *wrkr,
+                                  AsyncIOBatch *batch, size_t threadid)
+{
+  size_t i;
+  ctx_stats_add(CTX_STAT_READS, batch->len);
+  ctx_stats_add(CTX_STAT_BASES, batch->nbases);
+  if(wrkr->batch_func) wrkr->batch_func(batch, threadid, wrkr->arg);
+  else {
+    for(i = 0; i < batch->len; i++)
+      wrkr->func(&batch->data[i], threadid, wrkr->arg);
+  }
+}
+
+// Pass the current batch on to the workers, or process it now if a worker is
+// reading (then the batch is kept and refilled)
+static void flush_batch(AsyncIOWorker *wrkr)
+{
+  if(wrkr->batch == NULL) return;
+  if(wrkr->inline_job) {
+    if(wrkr->batch->len > 0)
+      asyncio_process_batch(wrkr->inline_job, wrkr->batch, wrkr->threadid);
+    wrkr->batch->len = wrkr->batch->nbases = 0;
+  }
+  else {
+    asyncio_queue_push(wrkr->queue, wrkr->batch);
+    wrkr->batch = NULL;
+  }
+}
+
 static void add_to_pool(read_t *r1, read_t *r2,
                         uint8_t fq_offset1, uint8_t fq_offset2,
                         void *arg)
 {
   AsyncIOWorker *wrkr = (AsyncIOWorker*)arg;
-  MsgPool *pool = wrkr->pool;
-  int pos;
+  AsyncIOBatch *batch = wrkr->batch;
   AsyncIOData *data;
 
-  // Swap reads and parameters into the data obj
-  pos = msgpool_claim_write(pool);
-  memcpy(&data, msgpool_get_ptr(pool, pos), sizeof(AsyncIOData*));
+  if(batch == NULL) {
+    batch = asyncio_queue_claim(wrkr->queue);
+    batch->len = batch->nbases = 0;
+    wrkr->batch = batch;
+  }
 
+  // Swap reads and parameters into the next data obj in the batch
+  data = &batch->data[batch->len++];
   data->fq_offset1 = fq_offset1;
   data->fq_offset2 = fq_offset2;
   data->ptr = wrkr->task.ptr;
@@ -137,75 +383,152 @@ static void add_to_pool(read_t *r1, read_t *r2,
   if(r2) SWAP(data->r2, *r2);
   else seq_read_reset(&data->r2);
 
-  msgpool_release(pool, pos, MPOOL_FULL);
+  batch->nbases += data->r1.seq.end + data->r2.seq.end;
+
+  if(batch->len == batch->size || batch->nbases >= ASYNCIO_BATCH_BYTES)
+    flush_batch(wrkr);
 }
 
 static void* async_io_reader(void *ptr) __attribute__((noreturn));
 
-static void* async_io_reader(void *ptr)
+static void async_io_read_input(AsyncIOWorker *wrkr, read_t *r1, read_t *r2)
 {
-  AsyncIOWorker *wrkr = (AsyncIOWorker*)ptr;
   AsyncIOInput *task = &wrkr->task;
 
-  read_t r1, r2;
-  seq_read_alloc(&r1);
-  seq_read_alloc(&r2);
-
   if(task->interleaved)
   {
     seq_parse_interleaved_sf(task->file1, task->fq_offset,
-                             &r1, &r2, add_to_pool, wrkr);
-  } else {
+                             r1, r2, add_to_pool, wrkr);
+  }
+  // Single plain FASTQ files use the block parser. Split files are read
+  // through a socket so must be parsed by seq_file.
+  else if(task->file2 != NULL || task->split ||
+          !seq_parse_se_fastq_block(task->file1, task->fq_offset,
+                                    r1, add_to_pool, wrkr))
+  {
     seq_parse_pe_sf(task->file1, task->file2, task->fq_offset,
-                    &r1, &r2, add_to_pool, wrkr);
+                    r1, r2, add_to_pool, wrkr);
   }
 
+  flush_batch(wrkr); // pass on any remaining reads
+}
+
+// Take the next unread input, returns false if there are none left
+static bool asyncio_input_claim(AsyncIOInputList *list, AsyncIOInput *task)
+{
+  size_t i = __sync_fetch_and_add(&list->next, 1);
+  if(i >= list->num_inputs) return false;
+  memcpy(task, &list->inputs[i], sizeof(AsyncIOInput));
+  return true;
+}
+
+// Called by each reader when it stops reading. The last one closes the queue.
+static void asyncio_reader_done(AsyncIOInputList *list, AsyncIOQueue *q)
+{
+  if(__sync_sub_and_fetch(&list->num_running, 1) == 0)
+    asyncio_queue_close(q);
+}
+
+static void* async_io_reader(void *ptr)
+{
+  AsyncIOWorker *wrkr = (AsyncIOWorker*)ptr;
+
+  read_t r1, r2;
+  seq_read_alloc(&r1);
+  seq_read_alloc(&r2);
+
+  // Take the next input until there are none left
+  while(asyncio_input_claim(wrkr->list, &wrkr->task))
+    async_io_read_input(wrkr, &r1, &r2);
+
   seq_read_dealloc(&r1);
   seq_read_dealloc(&r2);
 
-  // Check if we are the last thread to finish, if so close the pool
-  size_t n = __sync_sub_and_fetch((volatile size_t*)wrkr->num_running, 1);
+  asyncio_reader_done(wrkr->list, wrkr->queue);
+
+  pthread_exit(NULL);
+}
+
+// Called by a worker that found no full batches waiting. Read unstarted inputs
+// on this thread, processing batches as they are filled, until there are full
+// batches for the other workers again. `batch` is the worker's own batch.
+// Returns the number of inputs read.
+static size_t asyncio_help_read(const PoolFuncPair *job, size_t threadid,
+                                AsyncIOBatch *batch)
+{
+  AsyncIOQueue *q = job->queue;
+  AsyncIOInputList *list = q->inputs;
+  size_t n, ninputs = 0;
+
+  // Only join while other readers are running, otherwise the queue may
+  // already be closed
+  do {
+    n = list->num_running;
+    if(n == 0 || list->next >= list->num_inputs) return 0;
+  } while(!__sync_bool_compare_and_swap(&list->num_running, n, n+1));
+
+  AsyncIOWorker wrkr;
+  async_io_worker_init(&wrkr, q, list);
+  wrkr.inline_job = job;
+  wrkr.threadid = threadid;
+  wrkr.batch = batch;
+  batch->len = batch->nbases = 0;
+
+  read_t r1, r2;
+  seq_read_alloc(&r1);
+  seq_read_alloc(&r2);
 
-  if(n == 0) {
-    msgpool_close(wrkr->pool);
-    ctx_free(wrkr->num_running);
+  while(q->nfull == 0 && asyncio_input_claim(list, &wrkr.task)) {
+    async_io_read_input(&wrkr, &r1, &r2);
+    ninputs++;
   }
 
-  pthread_exit(NULL);
+  seq_read_dealloc(&r1);
+  seq_read_dealloc(&r2);
+
+  __sync_fetch_and_add(&list->num_helped, ninputs);
+  asyncio_reader_done(list, q);
+  return ninputs;
 }
 
-// Start loading into a pool
-// returns an array of AsyncIOWorker of length len_files, each is a running
-// thread putting reading into the pool passed.
-static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
+// Start loading into a queue
+// returns an array of AsyncIOWorker of length num_workers, each is a running
+// thread taking the next of `inputs` and putting reads into the queue passed.
+static AsyncIOWorker* asyncio_read_start(AsyncIOQueue *q,
                                          const AsyncIOInput *inputs,
-                                         size_t num_inputs)
+                                         size_t num_inputs, size_t num_workers)
 {
   if(num_inputs == 0) return NULL;
 
   size_t i;
   int rc;
 
-  // Initiate all reads in the pool
-  ctx_assert(pool->elsize == sizeof(AsyncIOData*));
+  ctx_assert(q->type != ASYNCIO_QUEUE_MSGPOOL ||
+             q->pool.elsize == sizeof(AsyncIOBatch*));
+  ctx_assert(num_workers > 0 && num_workers <= num_inputs);
 
   // Create workers
-  AsyncIOWorker *workers = ctx_malloc(num_inputs * sizeof(AsyncIOWorker));
+  AsyncIOWorker *workers = ctx_malloc(num_workers * sizeof(AsyncIOWorker));
 
   // Keep a counter of how many threads are still running
-  // last thread to finish closes the pool
-  size_t *num_running = ctx_malloc(sizeof(size_t));
-  *num_running = num_inputs;
-
-  for(i = 0; i < num_inputs; i++)
-    async_io_worker_init(&workers[i], &inputs[i], pool, num_running);
+  // last thread to finish closes the queue
+  AsyncIOInputList *list = ctx_malloc(sizeof(AsyncIOInputList));
+  list->inputs = inputs;
+  list->num_inputs = num_inputs;
+  list->next = 0;
+  list->num_running = num_workers;
+  list->num_helped = 0;
+  q->inputs = list;
+
+  for(i = 0; i < num_workers; i++)
+    async_io_worker_init(&workers[i], q, list);
 
   // Start threads
   pthread_attr_t thread_attr;
   pthread_attr_init(&thread_attr);
   pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE);
 
-  for(i = 0; i < num_inputs; i++) {
+  for(i = 0; i < num_workers; i++) {
     rc = pthread_create(&workers[i].thread, &thread_attr,
                         async_io_reader, (void*)&workers[i]);
     if(rc != 0) die("Creating thread failed: %s", strerror(rc));
@@ -215,7 +538,7 @@ static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
   return workers;
 }
 
-// Wait until the pool is empty
+// Wait until the queue is empty
 static void asyncio_read_finish(AsyncIOWorker *workers, size_t num_workers)
 {
   if(num_workers == 0) return;
@@ -229,15 +552,92 @@ static void asyncio_read_finish(AsyncIOWorker *workers, size_t num_workers)
     if(rc != 0) die("Joining thread failed: %s", strerror(rc));
   }
 
-  MsgPool *pool = workers[0].pool;
-  msgpool_close(pool);
-  msgpool_wait_til_empty(pool);
-  ctx_assert(pool->num_full == 0);
+  AsyncIOQueue *q = workers[0].queue;
+  asyncio_queue_close(q);
+  if(q->type == ASYNCIO_QUEUE_MSGPOOL) {
+    msgpool_wait_til_empty(&q->pool);
+    ctx_assert(q->pool.num_full == 0);
+  }
+  else {
+    // workers only return once the closed ring is empty
+    ctx_assert(mpmc_ring_len(&q->full) == 0);
+  }
 
+  ctx_free(q->inputs);
+  q->inputs = NULL;
   ctx_free(workers);
 }
 
-void asyncio_run_threads(MsgPool *pool,
+// Share `num_readers` threads between inputs for reading and decompression,
+// sets nthreads[i] for each input. If all inputs are read at once, larger
+// inputs get more threads. Otherwise each gets an even share of the threads
+// for the inputs open at a time.
+static void asyncio_share_threads(const AsyncIOInput *inputs, size_t num_inputs,
+                                  size_t num_readers, size_t *nthreads)
+{
+  size_t i, num_open = asyncio_num_open(num_inputs);
+  size_t even = num_readers / num_open, nkmers, total = 0;
+
+  for(i = 0; i < num_inputs; i++) nthreads[i] = even;
+  if(num_open < num_inputs) return;
+
+  // Don't weight by size if we can't get the size of all inputs (e.g. STDIN)
+  for(i = 0; i < num_inputs; i++) {
+    if((nkmers = asyncio_input_nkmers(&inputs[i])) == SIZE_MAX) return;
+    total += nkmers;
+  }
+
+  if(total == 0) return;
+
+  for(i = 0; i < num_inputs; i++) {
+    nkmers = asyncio_input_nkmers(&inputs[i]);
+    nthreads[i] = MAX2(1, (size_t)((double)num_readers * nkmers / total));
+  }
+}
+
+// Split large single-file inputs so input i is read by nsplits[i] threads.
+// Returns a new array of tasks of length *num_tasks. File handles in `inputs`
+// are updated, those only used by new tasks are added to `extra`.
+static AsyncIOInput* asyncio_split_inputs(AsyncIOInput *inputs,
+                                          size_t num_inputs,
+                                          const size_t *nsplits,
+                                          size_t *num_tasks,
+                                          SeqFilePtrBuffer *extra)
+{
+  size_t i, j, n = 0, nfiles, max_splits = 1, total_splits = 0;
+  for(i = 0; i < num_inputs; i++) {
+    max_splits = MAX2(max_splits, nsplits[i]);
+    total_splits += MAX2(nsplits[i], 1);
+  }
+
+  AsyncIOInput *tasks = ctx_malloc(total_splits * sizeof(AsyncIOInput));
+  seq_file_t *files[max_splits];
+
+  for(i = 0; i < num_inputs; i++) {
+    nfiles = 0;
+    if(inputs[i].file2 == NULL && nsplits[i] > 1)
+      nfiles = seq_split_file(inputs[i].file1, inputs[i].interleaved,
+                              files, nsplits[i]);
+
+    if(nfiles > 0) { inputs[i].file1 = files[0]; inputs[i].split = true; }
+    memcpy(&tasks[n++], &inputs[i], sizeof(AsyncIOInput));
+
+    for(j = 1; j < nfiles; j++) {
+      AsyncIOInput tmp = {.file1 = files[j], .file2 = NULL,
+                          .ptr = inputs[i].ptr,
+                          .fq_offset = inputs[i].fq_offset,
+                          .interleaved = inputs[i].interleaved,
+                          .split = true};
+      memcpy(&tasks[n++], &tmp, sizeof(AsyncIOInput));
+      seq_file_ptr_buf_add(extra, files[j]);
+    }
+  }
+
+  *num_tasks = n;
+  return tasks;
+}
+
+void asyncio_run_threads(AsyncIOQueue *q,
                          AsyncIOInput *asyncio_inputs, size_t num_inputs,
                          void (*job)(void *_arg, size_t _tid),
                          void *args, size_t num_readers, size_t elsize)
@@ -245,68 +645,137 @@ void asyncio_run_threads(MsgPool *pool,
   if(!num_inputs) return;
   ctx_assert(num_readers > 0);
 
-  status("[asyncio] Inputs: %zu; Threads: %zu", num_inputs, num_readers);
+  size_t num_open = asyncio_num_open(num_inputs);
+  if(num_open < num_inputs) {
+    status("[asyncio] Inputs: %zu (%zu at a time); Threads: %zu",
+           num_inputs, num_open, num_readers);
+  } else {
+    status("[asyncio] Inputs: %zu; Threads: %zu", num_inputs, num_readers);
+  }
+
+  // Share spare threads between inputs for reading and decompression
+  size_t i, num_tasks, *nthreads = ctx_calloc(num_inputs, sizeof(size_t));
+  SeqFilePtrBuffer extra;
+  seq_file_ptr_buf_alloc(&extra, 16);
+
+  asyncio_share_threads(asyncio_inputs, num_inputs, num_readers, nthreads);
+
+  for(i = 0; i < num_inputs; i++) {
+    asyncio_inputs[i].file1 = seq_inflate_reopen(asyncio_inputs[i].file1,
+                                                 nthreads[i]);
+    asyncio_inputs[i].file2 = seq_inflate_reopen(asyncio_inputs[i].file2,
+                                                 nthreads[i]);
+  }
+
+  // Only uncompressed files are split
+  AsyncIOInput *tasks = asyncio_split_inputs(asyncio_inputs, num_inputs,
+                                             nthreads, &num_tasks, &extra);
+  ctx_free(nthreads);
+
+  // One reader thread per task, unless inputs are queued, but no more readers
+  // than workers. Workers with no reads waiting read the remaining tasks
+  // themselves. Readers take tasks in order, so the splits of an input are
+  // read together.
+  size_t num_workers = num_open < num_inputs ? MIN2(num_open, num_tasks)
+                                             : num_tasks;
+  num_workers = MIN2(num_workers, num_readers);
 
   // Start async io reading
   AsyncIOWorker *asyncio_workers;
-  asyncio_workers = asyncio_read_start(pool, asyncio_inputs, num_inputs);
+  asyncio_workers = asyncio_read_start(q, tasks, num_tasks, num_workers);
 
   util_run_threads(args, num_readers, elsize, num_readers, job);
 
+  size_t num_helped = q->inputs->num_helped;
+  status("[asyncio] Balance: %zu reader threads, %zu workers; "
+         "workers read %zu / %zu tasks (%.1f%%)",
+         num_workers, num_readers, num_helped, num_tasks,
+         (100.0 * num_helped) / num_tasks);
+
   // Finish with the async io (waits until queue is empty)
-  asyncio_read_finish(asyncio_workers, num_inputs);
-}
+  asyncio_read_finish(asyncio_workers, num_workers);
 
-typedef struct {
-  MsgPool *pool;
-  void (*func)(AsyncIOData *_data, size_t _tid, void *_arg);
-  void *arg;
-} PoolFuncPair;
+  // Close the extra files we opened when splitting inputs
+  for(i = 0; i < extra.len; i++) seq_close(extra.b[i]);
+  seq_file_ptr_buf_dealloc(&extra);
+  ctx_free(tasks);
+}
 
-// pthread method, loop: reads from pool, call function
+// pthread method, loop: reads batch from pool, call function on each read
+// or on the whole batch. If no batches are waiting and there are inputs left
+// to read, read one on this thread instead.
 static void grab_reads_from_pool(void *arg, size_t threadid)
 {
   PoolFuncPair wrkr = *(PoolFuncPair*)arg;
-  int pos;
-  AsyncIOData *data = NULL;
+  AsyncIOQueue *q = wrkr.queue;
+  AsyncIOBatch *batch, own = {.data = NULL};
 
-  while((pos = msgpool_claim_read(wrkr.pool)) != -1)
+  while(1)
   {
-    memcpy(&data, msgpool_get_ptr(wrkr.pool, pos), sizeof(AsyncIOData*));
-    wrkr.func(data, threadid, wrkr.arg);
-    msgpool_release(wrkr.pool, pos, MPOOL_EMPTY);
+    if(q->nfull == 0 && q->inputs != NULL &&
+       q->inputs->next < q->inputs->num_inputs)
+    {
+      if(own.data == NULL) asynciobatch_alloc(&own, asyncio_batch_size);
+      if(asyncio_help_read(&wrkr, threadid, &own) > 0) continue;
+    }
+
+    if((batch = asyncio_queue_pop(q)) == NULL) break;
+    asyncio_process_batch(&wrkr, batch, threadid);
+    asyncio_queue_release(q, batch);
   }
+
+  if(own.data != NULL) asynciobatch_dealloc(&own);
 }
 
-// `num_inputs` number of threads pushing reads into the pool
-// `num_readers` number of threads pulling reads from the pool
-void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
-                      void (*job)(AsyncIOData *_data, size_t _tid, void *_arg),
-                      void *args, size_t num_readers, size_t elsize)
+static void _asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
+                              void (*job)(AsyncIOData*, size_t, void*),
+                              void (*batch_job)(AsyncIOBatch*, size_t, void*),
+                              void *args, size_t num_readers, size_t elsize)
 {
-  size_t i;
-  AsyncIOData *data = ctx_malloc(MSGPOOLSIZE * sizeof(AsyncIOData));
-  for(i = 0; i < MSGPOOLSIZE; i++) asynciodata_alloc(&data[i]);
+  size_t i, nbatches = asyncio_pool_nbatches(num_inputs, num_readers);
+  AsyncIOBatch *batches = ctx_malloc(nbatches * sizeof(AsyncIOBatch));
+  for(i = 0; i < nbatches; i++)
+    asynciobatch_alloc(&batches[i], asyncio_batch_size);
 
-  MsgPool pool;
-  msgpool_alloc(&pool, MSGPOOLSIZE, sizeof(AsyncIOData*), USE_MSG_POOL);
-  msgpool_iterate(&pool, asynciodata_pool_init, data);
+  AsyncIOQueue q;
+  asyncio_queue_alloc(&q, batches, nbatches);
 
   PoolFuncPair *poolfunc = ctx_calloc(num_readers, sizeof(PoolFuncPair));
 
   for(i = 0; i < num_readers; i++) {
-    poolfunc[i] = (PoolFuncPair){.pool = &pool, .func = job,
+    poolfunc[i] = (PoolFuncPair){.queue = &q,
+                                 .func = job, .batch_func = batch_job,
                                  .arg = (char*)args+i*elsize};
   }
 
-  asyncio_run_threads(&pool, asyncio_inputs, num_inputs, grab_reads_from_pool,
+  asyncio_run_threads(&q, asyncio_inputs, num_inputs, grab_reads_from_pool,
                       poolfunc, num_readers, sizeof(PoolFuncPair));
 
   ctx_free(poolfunc);
 
-  for(i = 0; i < MSGPOOLSIZE; i++) asynciodata_dealloc(&data[i]);
-  ctx_free(data);
-  msgpool_dealloc(&pool);
+  for(i = 0; i < nbatches; i++) asynciobatch_dealloc(&batches[i]);
+  ctx_free(batches);
+  asyncio_queue_dealloc(&q);
+}
+
+// `num_inputs` number of threads pushing reads into the pool
+// `num_readers` number of threads pulling reads from the pool
+void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
+                      void (*job)(AsyncIOData *_data, size_t _tid, void *_arg),
+                      void *args, size_t num_readers, size_t elsize)
+{
+  _asyncio_run_pool(asyncio_inputs, num_inputs, job, NULL,
+                    args, num_readers, elsize);
+}
+
+// As asyncio_run_pool() but `job` is called once per batch of reads
+void asyncio_run_batch_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
+                            void (*job)(AsyncIOBatch *_batch, size_t _tid,
+                                        void *_arg),
+                            void *args, size_t num_readers, size_t elsize)
+{
+  _asyncio_run_pool(asyncio_inputs, num_inputs, NULL, job,
+                    args, num_readers, elsize);
 }
 
 // Guess numer of kmers
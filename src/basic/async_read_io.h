@@ -5,6 +5,7 @@
 #include "msg-pool/msgpool.h"
 
 #include "seq_loading_stats.h"
+#include "mpmc_ring.h"
 
 // Rename async_read_io.h -> async_read.h
 // AsyncIOInput->AsyncReadFiles AsyncIOData->AsyncReadData
@@ -15,6 +16,7 @@ typedef struct
   void *ptr; // general porpoise pointer for this file is passed into AsyncIOData
   const uint8_t fq_offset;
   const bool interleaved; // if file1 is an interleaved PE file
+  bool split; // file1 is one range of a file split across threads
 } AsyncIOInput;
 
 typedef struct
@@ -24,6 +26,36 @@ typedef struct
   uint8_t fq_offset1, fq_offset2;
 } AsyncIOData;
 
+// Readers hand reads to workers in batches of up to `size` reads (or
+// ASYNCIO_BATCH_BYTES bases), to cut the number of trips through the queue
+typedef struct
+{
+  AsyncIOData *data;
+  size_t len, size, nbases;
+  int pos; // MsgPool position while claimed (ASYNCIO_QUEUE_MSGPOOL only)
+} AsyncIOBatch;
+
+#define ASYNCIO_BATCH_READS 256
+#define ASYNCIO_BATCH_BYTES (1<<20)
+
+// How batches are passed between reader threads and workers:
+//  ASYNCIO_QUEUE_RING: two lock-free rings, one of empty batches for readers to
+//    fill and one of full batches for workers (default)
+//  ASYNCIO_QUEUE_MSGPOOL: a MsgPool guarded by a mutex and condition variables
+typedef enum { ASYNCIO_QUEUE_RING, ASYNCIO_QUEUE_MSGPOOL } AsyncIOQueueType;
+
+typedef struct AsyncIOInputList AsyncIOInputList;
+
+typedef struct
+{
+  AsyncIOQueueType type;
+  MsgPool pool; // elements are AsyncIOBatch*
+  MpmcRing empty, full;
+  size_t nbatches, progress_id;
+  volatile size_t nfull; // full batches waiting for workers
+  AsyncIOInputList *inputs; // inputs left to read, set while readers run
+} AsyncIOQueue;
+
 #define asyncio_task_is_pe(a) ((a)->file2 != NULL || (a)->interleaved)
 
 // if out_base != NULL, we expect an output string as well:
@@ -40,25 +72,73 @@ void asyncio_task_parse(AsyncIOInput *task, char shortopt, char *path_arg,
 
 void asyncio_task_close(AsyncIOInput *task);
 
+// Close and reopen input files, so they can be read again from the start.
+// Dies if reading from STDIN.
+void asyncio_task_reopen(AsyncIOInput *task);
+
 void asynciodata_alloc(AsyncIOData *iod);
 void asynciodata_dealloc(AsyncIOData *iod);
 
 typedef struct AsyncIOWorker AsyncIOWorker;
 
-void asynciodata_pool_init(void *el, size_t idx, void *args);
-void asynciodata_pool_destroy(void *el, size_t idx, void *args);
+// Set the number of reads per batch (default: ASYNCIO_BATCH_READS)
+// Set to 1 to pass reads to workers one at a time
+void asyncio_set_batch_size(size_t nreads);
+size_t asyncio_get_batch_size();
+
+// Set how batches are queued (default: ASYNCIO_QUEUE_RING)
+void asyncio_set_queue_type(AsyncIOQueueType type);
+AsyncIOQueueType asyncio_get_queue_type();
+
+// Read at most `n` inputs at a time (0 for no limit, the default). Inputs
+// are then queued and each reader thread takes the next input when it
+// finishes one, rather than waiting for every input in a batch.
+void asyncio_set_max_open(size_t n);
+size_t asyncio_get_max_open();
+
+// Number of pool slots used by asyncio_run_pool()
+size_t asyncio_pool_nbatches(size_t num_inputs, size_t num_readers);
+
+void asynciobatch_alloc(AsyncIOBatch *batch, size_t nreads);
+void asynciobatch_dealloc(AsyncIOBatch *batch);
 
-void asyncio_run_threads(MsgPool *pool,
+// Pool elements are pointers to AsyncIOBatch, `args` is the AsyncIOBatch array
+void asynciobatch_pool_init(void *el, size_t idx, void *args);
+
+// Queue `nbatches` empty batches, using the current queue type
+void asyncio_queue_alloc(AsyncIOQueue *q, AsyncIOBatch *batches,
+                         size_t nbatches);
+void asyncio_queue_dealloc(AsyncIOQueue *q);
+
+// Returns next full batch, or NULL once readers have finished and the queue
+// is empty. Hand it back with asyncio_queue_release().
+AsyncIOBatch* asyncio_queue_pop(AsyncIOQueue *q);
+void asyncio_queue_release(AsyncIOQueue *q, AsyncIOBatch *batch);
+
+// `job` threads should pull batches from `q` with asyncio_queue_pop()
+void asyncio_run_threads(AsyncIOQueue *q,
                          AsyncIOInput *asyncio_tasks, size_t num_inputs,
                          void (*job)(void *_arg, size_t _tid),
                          void *args, size_t num_readers, size_t elsize);
 
-// `num_inputs` number of threads pushing reads into the pool
-// `num_readers` number of threads pulling reads from the pool
+// Reads are pushed into the pool by up to `num_readers` reader threads (one
+// per input or split of an input) and processed by `num_readers` workers.
+// Workers that find no reads waiting read the next unstarted input
+// themselves, processing its reads as they are parsed, so threads move to
+// whichever side is the bottleneck. The balance reached is reported with
+// status() at the end.
 void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
                       void (*job)(AsyncIOData *_data, size_t _tid, void *_arg),
                       void *args, size_t num_readers, size_t elsize);
 
+// As asyncio_run_pool() but `job` is passed a whole batch of reads at a time,
+// so workers can do per-batch setup once. All reads in a batch are from the
+// same input.
+void asyncio_run_batch_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
+                            void (*job)(AsyncIOBatch *_batch, size_t _tid,
+                                        void *_arg),
+                            void *args, size_t num_readers, size_t elsize);
+
 // Guess numer of kmers
 size_t asyncio_input_nkmers(const AsyncIOInput *io);
 
@@ -1,5 +1,10 @@
 #include "global.h"
 #include "binary_seq.h"
+#include "cpu_dispatch.h"
+
+#if CPU_DISPATCH
+  #include <immintrin.h>
+#endif
 
 // byte reverse complement look up table
 // Example: byte representing ACTG -> CAGT
@@ -78,10 +83,9 @@ void binary_seq_reverse_complement(uint8_t *bases, size_t nbases)
   }
 }
 
-// Convert from unpacked representation (1 base per byte) to packed
-// representation (4 bases per byte)
-void binary_seq_pack(uint8_t *restrict ptr,
-                     const Nucleotide *restrict bases, size_t len)
+static void _binary_seq_pack_generic(uint8_t *restrict ptr,
+                                     const Nucleotide *restrict bases,
+                                     size_t len)
 {
   size_t i, full_bytes = len/4;
   const uint8_t *endptr = ptr+full_bytes;
@@ -103,10 +107,9 @@ void binary_seq_pack(uint8_t *restrict ptr,
 }
 
 
-// Convert from compact representation (4 bases per byte) to unpacked
-// representation (1 base per byte)
-void binary_seq_unpack(const uint8_t *restrict ptr,
-                       Nucleotide *restrict bases, size_t len)
+static void _binary_seq_unpack_generic(const uint8_t *restrict ptr,
+                                       Nucleotide *restrict bases,
+                                       size_t len)
 {
   size_t i, full_bytes = len/4;
   const uint8_t *endptr = ptr+full_bytes;
@@ -126,6 +129,257 @@ void binary_seq_unpack(const uint8_t *restrict ptr,
   }
 }
 
+#if CPU_DISPATCH
+// 32 bases -> 8 bytes per iteration
+static CPU_TARGET_AVX2 void _binary_seq_pack_avx2(uint8_t *restrict ptr,
+                                                  const Nucleotide *restrict bases,
+                                                  size_t len)
+{
+  // b0 + b1*4 in each 16 bits, then (b0,b1) + (b2,b3)*16 in each 32 bits
+  const __m256i mul16 = _mm256_set1_epi16(0x0401);
+  const __m256i mul32 = _mm256_set1_epi32(0x00100001);
+  const __m256i gather = _mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+                                          0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+  const __m256i lanes = _mm256_setr_epi32(0,4,1,1,1,1,1,1);
+  __m256i v;
+  size_t i;
+
+  for(i = 0; i+32 <= len; i += 32, ptr += 8) {
+    v = _mm256_loadu_si256((const __m256i*)(bases+i));
+    v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, mul16), mul32);
+    v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, gather), lanes);
+    _mm_storel_epi64((__m128i*)ptr, _mm256_castsi256_si128(v));
+  }
+
+  _binary_seq_pack_generic(ptr, bases+i, len-i);
+}
+
+// 8 bytes -> 32 bases per iteration
+static CPU_TARGET_AVX2 void _binary_seq_unpack_avx2(const uint8_t *restrict ptr,
+                                                    Nucleotide *restrict bases,
+                                                    size_t len)
+{
+  // Copy each byte four times, then take bits 0-1, 2-3, 4-5, 6-7 of the copies
+  const __m256i spread = _mm256_setr_epi8(0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,
+                                          4,4,4,4,5,5,5,5,6,6,6,6,7,7,7,7);
+  const __m256i m0 = _mm256_set1_epi32(0x000000ff), m1 = _mm256_set1_epi32(0x0000ff00);
+  const __m256i m2 = _mm256_set1_epi32(0x00ff0000), m3 = _mm256_set1_epi32((int)0xff000000);
+  const __m256i three = _mm256_set1_epi8(3);
+  __m256i v, r;
+  uint64_t word;
+  size_t i;
+
+  for(i = 0; i+32 <= len; i += 32, ptr += 8) {
+    memcpy(&word, ptr, sizeof(word));
+    v = _mm256_shuffle_epi8(_mm256_set1_epi64x((long long)word), spread);
+    r = _mm256_or_si256(_mm256_and_si256(v, m0),
+                        _mm256_and_si256(_mm256_srli_epi16(v, 2), m1));
+    r = _mm256_or_si256(r, _mm256_and_si256(_mm256_srli_epi16(v, 4), m2));
+    r = _mm256_or_si256(r, _mm256_and_si256(_mm256_srli_epi16(v, 6), m3));
+    _mm256_storeu_si256((__m256i*)(bases+i), _mm256_and_si256(r, three));
+  }
+
+  _binary_seq_unpack_generic(ptr, bases+i, len-i);
+}
+#endif /* CPU_DISPATCH */
+
+// Shift copy 8 bytes at a time, starting at byte `byte` (a multiple of 8)
+static inline void _binary_seq_cpy_words(uint8_t *restrict dst,
+                                         const uint8_t *restrict src,
+                                         size_t bitshift, size_t byte, size_t n,
+                                         size_t src_bytes, size_t dst_bytes)
+{
+  size_t endbyte = ((n-1)/32)*8; // -1 so we can look ahead
+  uint64_t word = 0;
+
+  for(; byte<endbyte; byte+=8) {
+    memcpy(&word, &src[byte], 8);
+    word = (word >> bitshift) | ((uint64_t)src[byte+8] << (64-bitshift));
+    memcpy(&dst[byte], &word, 8);
+  }
+
+  if(byte < dst_bytes) {
+    size_t rem_src_bytes = src_bytes - byte;
+    size_t rem_dst_bytes = dst_bytes - byte;
+
+    word = 0;
+    memcpy(&word, &src[byte], rem_src_bytes);
+    word >>= bitshift;
+    memcpy(&dst[byte], &word, rem_dst_bytes);
+  }
+}
+
+// Copy 8 bytes at a time
+static void _binary_seq_cpy_generic(uint8_t *restrict dst,
+                                    const uint8_t *restrict src,
+                                    uint8_t shift, size_t n)
+{
+  size_t src_bytes = binary_seq_mem(n), dst_bytes = binary_seq_mem(n-shift);
+  dst[dst_bytes-1] = 0; // zero top byte, so we don't complain when masking later
+  _binary_seq_cpy_words(dst, src, shift*2, 0, n, src_bytes, dst_bytes);
+  dst[dst_bytes-1] &= bitmask64((n-shift)*2-(dst_bytes-1)*8);
+}
+
+// Compare two bytes at the bases set in mask `m`
+static inline int _binary_seq_byte_cmp(uint8_t x, uint8_t y, uint8_t m)
+{
+  uint8_t d = (x ^ y) & m;
+  if(!d) return 0;
+  int o = __builtin_ctz(d) & ~1;
+  return (int)((x >> o) & 3) - (int)((y >> o) & 3);
+}
+
+// Compare bases from byte `b` up to base `len`, 8 bytes at a time
+static int _binary_seqs_cmp_generic(const uint8_t *arr0, const uint8_t *arr1,
+                                    size_t b, size_t len)
+{
+  size_t nfull = len/4;
+  uint64_t w0, w1, d;
+  int o;
+
+  for(; b+8 <= nfull; b += 8) {
+    memcpy(&w0, arr0+b, 8);
+    memcpy(&w1, arr1+b, 8);
+    if((d = w0 ^ w1) != 0) {
+      o = __builtin_ctzll(d) & ~1;
+      return (int)((w0 >> o) & 3) - (int)((w1 >> o) & 3);
+    }
+  }
+
+  for(; b < nfull; b++)
+    if(arr0[b] != arr1[b]) return _binary_seq_byte_cmp(arr0[b], arr1[b], 0xff);
+
+  // Top byte, only some bases used
+  size_t topbits = (len&3)*2;
+  if(topbits)
+    return _binary_seq_byte_cmp(arr0[b], arr1[b], bitmask64(topbits));
+
+  return 0;
+}
+
+#if CPU_DISPATCH
+// Shift copy 32 bytes at a time
+static CPU_TARGET_AVX2 void _binary_seq_cpy_avx2(uint8_t *restrict dst,
+                                                 const uint8_t *restrict src,
+                                                 uint8_t shift, size_t n)
+{
+  size_t src_bytes = binary_seq_mem(n), dst_bytes = binary_seq_mem(n-shift);
+  size_t byte = 0, endbyte = ((n-1)/32)*8;
+  dst[dst_bytes-1] = 0;
+
+  // Each 64 bit lane takes its top bits from the next 8 bytes. Loads read
+  // up to 40 bytes past `byte`.
+  const __m128i rshift = _mm_cvtsi32_si128(shift*2);
+  const __m128i lshift = _mm_cvtsi32_si128(64-shift*2);
+  __m256i v, w;
+
+  for(; byte+32 <= endbyte && byte+40 <= src_bytes; byte += 32) {
+    v = _mm256_loadu_si256((const __m256i*)(src+byte));
+    w = _mm256_loadu_si256((const __m256i*)(src+byte+8));
+    v = _mm256_or_si256(_mm256_srl_epi64(v, rshift), _mm256_sll_epi64(w, lshift));
+    _mm256_storeu_si256((__m256i*)(dst+byte), v);
+  }
+
+  _binary_seq_cpy_words(dst, src, shift*2, byte, n, src_bytes, dst_bytes);
+  dst[dst_bytes-1] &= bitmask64((n-shift)*2-(dst_bytes-1)*8);
+}
+
+// Compare 32 bytes at a time
+static CPU_TARGET_AVX2 int _binary_seqs_cmp_avx2(const uint8_t *arr0,
+                                                 const uint8_t *arr1,
+                                                 size_t b, size_t len)
+{
+  size_t nfull = len/4;
+  __m256i v0, v1;
+  uint32_t eq;
+
+  for(; b+32 <= nfull; b += 32) {
+    v0 = _mm256_loadu_si256((const __m256i*)(arr0+b));
+    v1 = _mm256_loadu_si256((const __m256i*)(arr1+b));
+    eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, v1));
+    if(eq != UINT32_MAX) {
+      b += __builtin_ctz(~eq);
+      return _binary_seq_byte_cmp(arr0[b], arr1[b], 0xff);
+    }
+  }
+
+  return _binary_seqs_cmp_generic(arr0, arr1, b, len);
+}
+#endif /* CPU_DISPATCH */
+
+static void (*binary_seq_pack_func)(uint8_t *restrict, const Nucleotide *restrict, size_t)
+  = _binary_seq_pack_generic;
+static void (*binary_seq_unpack_func)(const uint8_t *restrict, Nucleotide *restrict, size_t)
+  = _binary_seq_unpack_generic;
+static void (*binary_seq_cpy_func)(uint8_t *restrict, const uint8_t *restrict,
+                                   uint8_t, size_t) = _binary_seq_cpy_generic;
+static int (*binary_seqs_cmp_func)(const uint8_t*, const uint8_t*, size_t, size_t)
+  = _binary_seqs_cmp_generic;
+static CpuSimd binary_seq_lvl = CPU_SIMD_NONE;
+static uint32_t binary_seq_gen = 0;
+
+static void binary_seq_select(CpuSimd lvl)
+{
+  binary_seq_pack_func = _binary_seq_pack_generic;
+  binary_seq_unpack_func = _binary_seq_unpack_generic;
+  binary_seq_cpy_func = _binary_seq_cpy_generic;
+  binary_seqs_cmp_func = _binary_seqs_cmp_generic;
+  binary_seq_lvl = CPU_SIMD_NONE;
+  #if CPU_DISPATCH
+    // No AVX-512 version, 32 bases at a time already covers most reads
+    if(lvl >= CPU_SIMD_AVX2) {
+      binary_seq_pack_func = _binary_seq_pack_avx2;
+      binary_seq_unpack_func = _binary_seq_unpack_avx2;
+      binary_seq_cpy_func = _binary_seq_cpy_avx2;
+      binary_seqs_cmp_func = _binary_seqs_cmp_avx2;
+      binary_seq_lvl = CPU_SIMD_AVX2;
+    }
+  #else
+    (void)lvl;
+  #endif
+}
+
+const char* binary_seq_simd_str()
+{
+  cpu_dispatch_check(binary_seq_gen, binary_seq_select);
+  return cpu_simd_str(binary_seq_lvl);
+}
+
+// Copy a packed path, shifting by `shift` bases (see binary_seq_cpy_slow)
+void binary_seq_cpy_fast(uint8_t *restrict dst, const uint8_t *restrict src,
+                         uint8_t shift, size_t n)
+{
+  size_t src_bytes = binary_seq_mem(n);
+
+  if(shift >= n) { dst[0] = 0; return; }
+  if(!shift) {
+    memcpy(dst, src, src_bytes);
+    dst[src_bytes-1] &= bitmask64(n*2-(src_bytes-1)*8); // mask top byte
+    return;
+  }
+
+  cpu_dispatch_check(binary_seq_gen, binary_seq_select);
+  binary_seq_cpy_func(dst, src, shift, n);
+}
+
+// Convert from unpacked representation (1 base per byte) to packed
+// representation (4 bases per byte)
+void binary_seq_pack(uint8_t *restrict ptr,
+                     const Nucleotide *restrict bases, size_t len)
+{
+  cpu_dispatch_check(binary_seq_gen, binary_seq_select);
+  binary_seq_pack_func(ptr, bases, len);
+}
+
+// Convert from compact representation (4 bases per byte) to unpacked
+// representation (1 base per byte)
+void binary_seq_unpack(const uint8_t *restrict ptr,
+                       Nucleotide *restrict bases, size_t len)
+{
+  cpu_dispatch_check(binary_seq_gen, binary_seq_select);
+  binary_seq_unpack_func(ptr, bases, len);
+}
+
 // Copy a packed path from one place in memory to another, applying left shift
 // Shifting by N bases results in N fewer bases in output
 // len_bases is length before shifting
@@ -165,45 +419,6 @@ void binary_seq_cpy_med(uint8_t *restrict dst, const uint8_t *restrict src,
 }
 
 
-// Copy 8 bytes at a time
-void binary_seq_cpy_fast(uint8_t *restrict dst, const uint8_t *restrict src,
-                         uint8_t shift, size_t n)
-{
-  size_t src_bytes = binary_seq_mem(n), dst_bytes = binary_seq_mem(n-shift);
-
-  if(shift >= n) { dst[0] = 0; return; }
-  if(!shift) {
-    memcpy(dst, src, src_bytes);
-    dst[src_bytes-1] &= bitmask64(n*2-(src_bytes-1)*8); // mask top byte
-    return;
-  }
-
-  size_t nwords64, endbyte, byte, bitshift;
-  uint64_t word = 0;
-
-  bitshift = shift*2;
-  nwords64 = (n-1)/32; // -1 so we can look ahead
-  endbyte = nwords64*8;
-  dst[dst_bytes-1] = 0; // zero top byte, so we don't complain when masking later
-
-  for(byte=0; byte<endbyte; byte+=8) {
-    memcpy(&word, &src[byte], 8);
-    word = (word >> bitshift) | ((uint64_t)src[byte+8] << (64-bitshift));
-    memcpy(&dst[byte], &word, 8);
-  }
-
-  if(byte < dst_bytes) {
-    size_t rem_src_bytes = src_bytes - byte;
-    size_t rem_dst_bytes = dst_bytes - byte;
-
-    memcpy(&word, &src[byte], rem_src_bytes);
-    word >>= bitshift;
-    memcpy(&dst[byte], &word, rem_dst_bytes);
-  }
-
-  dst[dst_bytes-1] &= bitmask64((n-shift)*2-(dst_bytes-1)*8);
-}
-
 char* binary_seq_to_str(const uint8_t *arr, size_t len, char *str)
 {
   char *ptr = str;
@@ -252,14 +467,32 @@ void binary_seq_gzprint(const uint8_t *arr, size_t len, gzFile gzout)
 int binary_seqs_cmp(const uint8_t *arr0, size_t len0,
                     const uint8_t *arr1, size_t len1)
 {
-  size_t i, b = 0, o = 0, len = MIN2(len0, len1);
-  int x, y, ret;
-  // Loop over one base at a time
-  for(i = 0; i < len; i++) {
-    x = (arr0[b] >> o) & 3;
-    y = (arr1[b] >> o) & 3;
-    if((ret = x - y) != 0) return ret;
-    o+=2; b += (o == 8); o &= 7;
+  cpu_dispatch_check(binary_seq_gen, binary_seq_select);
+  int ret = binary_seqs_cmp_func(arr0, arr1, 0, MIN2(len0, len1));
+  return ret ? ret : cmp(len0, len1);
+}
+
+// As binary_seqs_cmp() but only compare bases from `start`, bases before
+// `start` are assumed to match
+int binary_seqs_cmp_from(const uint8_t *arr0, size_t len0,
+                         const uint8_t *arr1, size_t len1, size_t start)
+{
+  size_t len = MIN2(len0, len1), b = start/4, endbits, startbits;
+  int ret = 0;
+
+  // Compare the rest of a partially used first byte
+  if(start < len && (start & 3)) {
+    endbits = (MIN2(len, 4*(b+1)) - 4*b) * 2;
+    startbits = (start&3)*2;
+    ret = _binary_seq_byte_cmp(arr0[b], arr1[b],
+                               bitmask64(endbits) & ~bitmask64(startbits));
+    b++;
+  }
+
+  if(!ret && 4*b < len) {
+    cpu_dispatch_check(binary_seq_gen, binary_seq_select);
+    ret = binary_seqs_cmp_func(arr0, arr1, b, len);
   }
-  return cmp(len0, len1);
+
+  return ret ? ret : cmp(len0, len1);
 }
@@ -53,6 +53,10 @@ void binary_seq_pack(uint8_t *restrict ptr,
 void binary_seq_unpack(const uint8_t *restrict ptr,
                        Nucleotide *restrict bases, size_t len);
 
+// SIMD level used by binary_seq_pack(), binary_seq_unpack(),
+// binary_seq_cpy_fast() and binary_seqs_cmp()
+const char* binary_seq_simd_str();
+
 // Copy a packed path from one place in memory to another, applying left shift
 // Shifting by N bases results in N fewer bases in output
 // len_bases is length before shifting
@@ -87,4 +91,9 @@ void binary_seq_gzprint(const uint8_t *arr, size_t len, gzFile gzout);
 int binary_seqs_cmp(const uint8_t *arr0, size_t len0,
                     const uint8_t *arr1, size_t len1);
 
+// As binary_seqs_cmp() but skip the first `start` bases, which are assumed
+// to match. Used when sorting paths that are known to share a prefix.
+int binary_seqs_cmp_from(const uint8_t *arr0, size_t len0,
+                         const uint8_t *arr1, size_t len1, size_t start);
+
 #endif /* BINARY_SEQ_H_ */
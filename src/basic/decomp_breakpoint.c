@@ -32,6 +32,18 @@ void decomp_brkpt_cpy_stats(DecompBreakpointStats *stats,
   memcpy(stats, &db->stats, sizeof(*stats));
 }
 
+void decomp_brkpt_add_stats(DecompBreakpointStats *stats,
+                            const DecompBreakpoint *db)
+{
+  const DecompBreakpointStats *s = &db->stats;
+  stats->nflanks_not_uniquely_mapped += s->nflanks_not_uniquely_mapped;
+  stats->nflanks_diff_chroms         += s->nflanks_diff_chroms;
+  stats->nflanks_diff_strands        += s->nflanks_diff_strands;
+  stats->nflanks_overlap_too_much    += s->nflanks_overlap_too_much;
+  stats->ncalls                      += s->ncalls;
+  stats->ncalls_mapped               += s->ncalls_mapped;
+}
+
 //
 // Decompose
 //
@@ -18,6 +18,9 @@ void decomp_brkpt_destroy(DecompBreakpoint *bd);
 
 void decomp_brkpt_cpy_stats(DecompBreakpointStats *stats,
                             const DecompBreakpoint *bd);
+// Add stats from `bd` to `stats`, to combine stats from multiple threads
+void decomp_brkpt_add_stats(DecompBreakpointStats *stats,
+                            const DecompBreakpoint *bd);
 
 // Convert a call into an aligned call
 // return 0 on success, otherwise non-zero on failure
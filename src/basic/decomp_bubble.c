@@ -38,6 +38,20 @@ void decomp_bubble_cpy_stats(DecompBubbleStats *stats, const DecompBubble *db)
   memcpy(stats, &db->stats, sizeof(*stats));
 }
 
+void decomp_bubble_add_stats(DecompBubbleStats *stats, const DecompBubble *db)
+{
+  const DecompBubbleStats *s = &db->stats;
+  stats->nflank5p_unmapped        += s->nflank5p_unmapped;
+  stats->nflank5p_lowqual         += s->nflank5p_lowqual;
+  stats->nflank3p_multihits       += s->nflank3p_multihits;
+  stats->nflank3p_not_found       += s->nflank3p_not_found;
+  stats->nflank3p_exact_found     += s->nflank3p_exact_found;
+  stats->nflank3p_approx_found    += s->nflank3p_approx_found;
+  stats->nflanks_overlap_too_much += s->nflanks_overlap_too_much;
+  stats->ncalls                   += s->ncalls;
+  stats->ncalls_mapped            += s->ncalls_mapped;
+}
+
 scoring_t* decomp_bubble_get_scoring(DecompBubble *db)
 {
   return db->scoring;
@@ -19,6 +19,8 @@ DecompBubble* decomp_bubble_init();
 void decomp_bubble_destroy(DecompBubble *db);
 
 void decomp_bubble_cpy_stats(DecompBubbleStats *stats, const DecompBubble *db);
+// Add stats from `db` to `stats`, to combine stats from multiple threads
+void decomp_bubble_add_stats(DecompBubbleStats *stats, const DecompBubble *db);
 scoring_t* decomp_bubble_get_scoring(DecompBubble *db);
 
 // Convert a call into an aligned call
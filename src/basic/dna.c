@@ -1,5 +1,6 @@
 #include "global.h"
 #include "dna.h"
+#include "cpu_dispatch.h"
 #include <ctype.h> // tolower()
 
 const char dna_nuc_to_char_arr[4] = "ACGT";
@@ -162,3 +163,151 @@ size_t dna_bases_list_to_str(const bool bases[4], char *out)
   *str = '\0';
   return str-out;
 }
+
+//
+// Check for invalid bases
+//
+
+static size_t _dna_check_acgtn_generic(const char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len && char_is_acgtn(seq[i]); i++) {}
+  return i;
+}
+
+#if CPU_DISPATCH
+#include <immintrin.h>
+
+// Setting bit 0x20 lower cases letters, then compare 32 bytes at a time
+// against each valid base
+static CPU_TARGET_AVX2 size_t _dna_check_acgtn_avx2(const char *seq, size_t len)
+{
+  const __m256i lc = _mm256_set1_epi8(0x20);
+  const __m256i a = _mm256_set1_epi8('a'), c = _mm256_set1_epi8('c');
+  const __m256i g = _mm256_set1_epi8('g'), t = _mm256_set1_epi8('t');
+  const __m256i n = _mm256_set1_epi8('n');
+  __m256i v, ok;
+  uint32_t mask;
+  size_t i;
+
+  for(i = 0; i+32 <= len; i += 32) {
+    v = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(seq+i)), lc);
+    ok = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, a),
+                                         _mm256_cmpeq_epi8(v, c)),
+                         _mm256_or_si256(_mm256_cmpeq_epi8(v, g),
+                                         _mm256_cmpeq_epi8(v, t)));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, n));
+    mask = (uint32_t)_mm256_movemask_epi8(ok);
+    if(mask != UINT32_MAX) return i + __builtin_ctz(~mask);
+  }
+
+  return i + _dna_check_acgtn_generic(seq+i, len-i);
+}
+#endif /* CPU_DISPATCH */
+
+static size_t (*dna_check_acgtn_func)(const char*, size_t)
+  = _dna_check_acgtn_generic;
+static CpuSimd dna_check_acgtn_lvl = CPU_SIMD_NONE;
+static uint32_t dna_check_acgtn_gen = 0;
+
+static void dna_check_acgtn_select(CpuSimd lvl)
+{
+  dna_check_acgtn_func = _dna_check_acgtn_generic;
+  dna_check_acgtn_lvl = CPU_SIMD_NONE;
+  #if CPU_DISPATCH
+    if(lvl >= CPU_SIMD_AVX2) {
+      dna_check_acgtn_func = _dna_check_acgtn_avx2;
+      dna_check_acgtn_lvl = CPU_SIMD_AVX2;
+    }
+  #else
+    (void)lvl;
+  #endif
+}
+
+size_t dna_check_acgtn(const char *seq, size_t len)
+{
+  cpu_dispatch_check(dna_check_acgtn_gen, dna_check_acgtn_select);
+  return dna_check_acgtn_func(seq, len);
+}
+
+const char* dna_check_acgtn_simd_str()
+{
+  cpu_dispatch_check(dna_check_acgtn_gen, dna_check_acgtn_select);
+  return cpu_simd_str(dna_check_acgtn_lvl);
+}
+
+//
+// Convert bases to 2 bit nucleotides
+//
+
+static size_t _dna_encode_nucs_generic(const char *seq, size_t len,
+                                       Nucleotide *nucs)
+{
+  size_t i;
+  for(i = 0; i < len && char_is_acgt(seq[i]); i++)
+    if(nucs) nucs[i] = dna_char_to_nuc_arr[(uint8_t)seq[i]];
+  return i;
+}
+
+#if CPU_DISPATCH
+// ACGT and acgt are encoded as ((c >> 1) ^ (c >> 2)) & 3 => 0,1,2,3
+static CPU_TARGET_AVX2 size_t _dna_encode_nucs_avx2(const char *seq, size_t len,
+                                                    Nucleotide *nucs)
+{
+  const __m256i lc = _mm256_set1_epi8(0x20), three = _mm256_set1_epi8(3);
+  const __m256i a = _mm256_set1_epi8('a'), c = _mm256_set1_epi8('c');
+  const __m256i g = _mm256_set1_epi8('g'), t = _mm256_set1_epi8('t');
+  __m256i b, v, ok, codes;
+  uint32_t mask;
+  size_t i;
+
+  for(i = 0; i+32 <= len; i += 32) {
+    b = _mm256_loadu_si256((const __m256i*)(seq+i));
+    v = _mm256_or_si256(b, lc);
+    ok = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, a),
+                                         _mm256_cmpeq_epi8(v, c)),
+                         _mm256_or_si256(_mm256_cmpeq_epi8(v, g),
+                                         _mm256_cmpeq_epi8(v, t)));
+    mask = (uint32_t)_mm256_movemask_epi8(ok);
+    if(nucs) {
+      // 16 bit shifts: bits shifted in from the next byte are masked off
+      codes = _mm256_xor_si256(_mm256_srli_epi16(b, 1), _mm256_srli_epi16(b, 2));
+      _mm256_storeu_si256((__m256i*)(nucs+i), _mm256_and_si256(codes, three));
+    }
+    if(mask != UINT32_MAX) return i + __builtin_ctz(~mask);
+  }
+
+  return i + _dna_encode_nucs_generic(seq+i, len-i, nucs ? nucs+i : NULL);
+}
+#endif /* CPU_DISPATCH */
+
+static size_t (*dna_encode_nucs_func)(const char*, size_t, Nucleotide*)
+  = _dna_encode_nucs_generic;
+static CpuSimd dna_encode_nucs_lvl = CPU_SIMD_NONE;
+static uint32_t dna_encode_nucs_gen = 0;
+
+static void dna_encode_nucs_select(CpuSimd lvl)
+{
+  dna_encode_nucs_func = _dna_encode_nucs_generic;
+  dna_encode_nucs_lvl = CPU_SIMD_NONE;
+  #if CPU_DISPATCH
+    if(lvl >= CPU_SIMD_AVX2) {
+      dna_encode_nucs_func = _dna_encode_nucs_avx2;
+      dna_encode_nucs_lvl = CPU_SIMD_AVX2;
+    }
+  #else
+    (void)lvl;
+  #endif
+}
+
+size_t dna_encode_nucs(const char *seq, size_t len, Nucleotide *nucs)
+{
+  cpu_dispatch_check(dna_encode_nucs_gen, dna_encode_nucs_select);
+  return dna_encode_nucs_func(seq, len, nucs);
+}
+
+const char* dna_encode_nucs_simd_str()
+{
+  cpu_dispatch_check(dna_encode_nucs_gen, dna_encode_nucs_select);
+  return cpu_simd_str(dna_encode_nucs_lvl);
+}
@@ -48,6 +48,18 @@ int dna_revncasecmp(const char *a, const char *b, size_t len);
 // out must be at least 11 bytes long: "A, C, G, T"
 size_t dna_bases_list_to_str(const bool bases[4], char *out);
 
+// Returns the index of the first character of `seq` that is not one of
+// ACGTNacgtn, or `len` if all are valid. Vectorised where the CPU allows.
+size_t dna_check_acgtn(const char *seq, size_t len);
+const char* dna_check_acgtn_simd_str();
+
+// Convert the leading ACGTacgt bases of `seq` to nucleotides (0-3) in `nucs`,
+// stopping at the first other character. `nucs` must have space for `len`
+// values and may be NULL to only find the first non-ACGT base.
+// Returns the number of bases converted. Vectorised where the CPU allows.
+size_t dna_encode_nucs(const char *seq, size_t len, Nucleotide *nucs);
+const char* dna_encode_nucs_simd_str();
+
 // Case insensitive comparison that converts non-ACGT characters to N before
 // comparing. Useful for VCF ref comparisons.
 // Returns true iff sequences match
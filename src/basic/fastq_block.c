@@ -0,0 +1,127 @@
+#include "global.h"
+#include "fastq_block.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+void fastq_block_open(FastqBlock *fb, const char *path, size_t bufsize)
+{
+  memset(fb, 0, sizeof(*fb));
+  if((fb->fd = open(path, O_RDONLY)) < 0)
+    die("Cannot open file: %s [%s]", path, strerror(errno));
+  fb->path = strdup(path);
+  fb->size = MAX2(bufsize, 64);
+  fb->buf = ctx_malloc(fb->size+1);
+}
+
+void fastq_block_close(FastqBlock *fb)
+{
+  close(fb->fd);
+  free(fb->path);
+  ctx_free(fb->buf);
+  memset(fb, 0, sizeof(*fb));
+}
+
+// Move the unparsed end of the buffer to the start and read more
+// Returns false if there is no more input
+static bool fastq_block_fill(FastqBlock *fb)
+{
+  ssize_t n;
+
+  if(fb->eof) return false;
+
+  if(fb->pos > 0) {
+    memmove(fb->buf, fb->buf+fb->pos, fb->len-fb->pos);
+    fb->len -= fb->pos;
+    fb->pos = 0;
+  }
+
+  // A record longer than the buffer
+  if(fb->len == fb->size) {
+    fb->size *= 2;
+    fb->buf = ctx_realloc(fb->buf, fb->size+1);
+  }
+
+  while((n = read(fb->fd, fb->buf+fb->len, fb->size-fb->len)) < 0 &&
+        errno == EINTR) {}
+
+  if(n < 0) die("Cannot read file: %s [%s]", fb->path, strerror(errno));
+
+  if(n == 0) {
+    fb->eof = true;
+    // Last line may be missing its new line, there is always room for one
+    if(fb->len == 0 || fb->buf[fb->len-1] == '\n') return false;
+    fb->buf[fb->len++] = '\n';
+    return true;
+  }
+
+  fb->len += n;
+  return true;
+}
+
+static inline void fastq_block_set_view(StrBuf *sbuf, char *str, size_t len)
+{
+  str[len] = '\0';
+  sbuf->b = str;
+  sbuf->end = len;
+  sbuf->size = len + 1;
+}
+
+// Returns 1 if a record was parsed, 0 if we need more input, -1 if malformed
+static int fastq_block_parse(FastqBlock *fb, read_t *r)
+{
+  char *p = fb->buf + fb->pos, *end = fb->buf + fb->len, *nl, *lines[4];
+  size_t i, lens[4];
+
+  // Skip blank lines between records
+  while(p < end && (*p == '\n' || *p == '\r')) p++;
+  fb->pos = p - fb->buf;
+
+  if(p == end) return 0;
+  if(*p != '@') return -1;
+
+  for(i = 0; i < 4; i++) {
+    if((nl = memchr(p, '\n', end-p)) == NULL) return 0;
+    lines[i] = p;
+    lens[i] = nl - p;
+    if(lens[i] > 0 && p[lens[i]-1] == '\r') lens[i]--;
+    p = nl+1;
+  }
+
+  if(lens[2] == 0 || lines[2][0] != '+') return -1;
+
+  fastq_block_set_view(&r->name, lines[0]+1, lens[0]-1);
+  fastq_block_set_view(&r->seq, lines[1], lens[1]);
+  fastq_block_set_view(&r->qual, lines[3], lens[3]);
+  fb->pos = p - fb->buf;
+  return 1;
+}
+
+int fastq_block_read(FastqBlock *fb, read_t *r)
+{
+  int s;
+  while((s = fastq_block_parse(fb, r)) == 0) {
+    if(!fastq_block_fill(fb)) {
+      if(fb->pos < fb->len) die("Truncated FASTQ file: %s", fb->path);
+      return 0;
+    }
+  }
+  if(s < 0) die("Malformed FASTQ record: %s", fb->path);
+  return 1;
+}
+
+bool fastq_block_usable(const char *path)
+{
+  struct stat st;
+  if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+  FastqBlock fb;
+  read_t r;
+  memset(&r, 0, sizeof(r));
+  fastq_block_open(&fb, path, 1<<16);
+  bool ok = fastq_block_fill(&fb) &&
+            fastq_block_parse(&fb, &r) == 1 && fastq_block_parse(&fb, &r) == 1;
+  fastq_block_close(&fb);
+  return ok;
+}
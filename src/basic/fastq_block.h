@@ -0,0 +1,42 @@
+#ifndef FASTQ_BLOCK_H_
+#define FASTQ_BLOCK_H_
+
+#include "seq_file/seq_file.h"
+
+//
+// Block parser for plain (uncompressed) four line FASTQ files
+//
+// Reads the file in large blocks with read() and finds line ends with memchr(),
+// instead of going through the input a character at a time. Reads are returned
+// as views into the block: the name, seq and qual of the read_t point into the
+// buffer, with each line's new line overwritten by '\0'. A view is only valid
+// until the next call to fastq_block_read(). Views must start zeroed (never
+// seq_read_alloc()'d) and must not be resized or freed.
+//
+// Multi-line FASTQ, FASTA, SAM/BAM and compressed files need seq_file.
+//
+
+#define FASTQ_BLOCK_SIZE (4UL<<20)
+
+typedef struct
+{
+  int fd;
+  char *path;
+  char *buf; // `size`+1 bytes
+  size_t size, pos, len; // buffer size, parse position, bytes in buffer
+  bool eof;
+} FastqBlock;
+
+// Returns true if `path` is a regular file that starts with two four line
+// FASTQ records
+bool fastq_block_usable(const char *path);
+
+// Dies on error
+void fastq_block_open(FastqBlock *fb, const char *path, size_t bufsize);
+void fastq_block_close(FastqBlock *fb);
+
+// Set `r` to a view of the next read
+// Returns 1 on success, 0 at the end of the file. Dies on malformed input.
+int fastq_block_read(FastqBlock *fb, read_t *r);
+
+#endif /* FASTQ_BLOCK_H_ */
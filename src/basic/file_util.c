@@ -1,5 +1,6 @@
 #include "global.h"
 #include "file_util.h"
+#include "zstd_file.h"
 
 #include <libgen.h> // dirname
 #include <fcntl.h> // open
@@ -173,6 +174,14 @@ void futil_create_output(const char *path) {
   }
 }
 
+// Write zstd to paths ending .zst, read zstd from files starting with its magic
+static bool _futil_is_zstd(const char *path, const char *mode)
+{
+  if(mode[0] == 'w') return zstd_file_is_path(path);
+  if(mode[0] == 'r' && mode[1] != '+') return zstd_file_is_zstd(path);
+  return false;
+}
+
 /*!
   Open a file and set the buffer to be DEFAULT_IO_BUFSIZE. Call die() if cannot
   open the file.
@@ -188,6 +197,9 @@ FILE *futil_fopen(const char *path, const char *mode)
     else if(!strcmp(mode,"r")) fout = stdin;
     else die("Cannot open pipe with mode: %s", mode);
   }
+  else if(_futil_is_zstd(path, mode)) {
+    return zstd_file_fopen(path, mode);
+  }
   else if((fout = fopen(path, mode)) == NULL) {
     die("Cannot open file: %s [%s]", futil_outpath_str(path), strerror(errno));
   }
@@ -205,7 +217,8 @@ gzFile futil_gzopen(const char *path, const char *mode)
 {
   ctx_assert(strcmp(path, "-") != 0 || strcmp(mode,"w") == 0);
   gzFile gzout = strcmp(path, "-") == 0 ? gzdopen(fileno(stdout), mode)
-                                        : gzopen(path, mode);
+                 : _futil_is_zstd(path, mode) ? zstd_file_gzopen(path, mode)
+                                              : gzopen(path, mode);
   if(gzout == NULL)
     die("Cannot open gzfile: %s [%s]", futil_outpath_str(path), strerror(errno));
 
@@ -256,7 +269,7 @@ void gzutil_fclose(gzFile gz)
   int ecode;
   const char *errstr = gzerror(gz, &ecode);
   if(ecode < 0) warn("GZIP File error: %s [%i]", errstr, ecode);
-  gzclose(gz);
+  zstd_file_gzclose(gz);
 }
 
 
@@ -318,7 +331,7 @@ FILE** futil_create_tmp_files(size_t num_tmp_files)
   {
     strbuf_reset(&tmppath);
     strbuf_sprintf(&tmppath, "/tmp/cortex.tmp.%i.%zu", r, i);
-    if((tmp_files[i] = fopen(tmppath.b, "r+")) == NULL) {
+    if((tmp_files[i] = fopen(tmppath.b, "w+")) == NULL) {
       die("Cannot write temporary file: %s [%s]", tmppath.b, strerror(errno));
     }
     unlink(tmppath.b); // Immediately unlink to hide temp file
@@ -354,3 +367,42 @@ void futil_merge_tmp_files(FILE **tmp_files, size_t num_files, FILE *fout)
 
   #undef TMP_BUF_SIZE
 }
+
+// Append `len` bytes of `data` to `out` as a gzip member, or as plain text if
+// the output is zstd (compressed by the zstd stream)
+void futil_pack_block(const char *data, size_t len, int level, bool zstd,
+                      StrBuf *out)
+{
+  if(zstd) strbuf_append_strn(out, data, len);
+  else futil_gzip_block(data, len, level, out);
+}
+
+// Compress `len` bytes of `data` as a complete gzip member, appended to `out`
+void futil_gzip_block(const char *data, size_t len, int level, StrBuf *out)
+{
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  ctx_assert(len <= UINT_MAX);
+
+  // windowBits+16 => gzip header and trailer
+  if(deflateInit2(&strm, level, Z_DEFLATED, MAX_WBITS+16, 8,
+                  Z_DEFAULT_STRATEGY) != Z_OK) {
+    die("Cannot initialise gzip compression: %s", strm.msg ? strm.msg : "");
+  }
+
+  // deflateBound() includes the gzip wrapper in zlib >= 1.2.5.1
+  size_t bound = deflateBound(&strm, len) + 32;
+  strbuf_ensure_capacity(out, out->end + bound);
+
+  strm.next_in = (Bytef*)data;
+  strm.avail_in = len;
+  strm.next_out = (Bytef*)out->b + out->end;
+  strm.avail_out = bound;
+
+  if(deflate(&strm, Z_FINISH) != Z_STREAM_END)
+    die("gzip compression failed: %s", strm.msg ? strm.msg : "");
+
+  out->end += strm.total_out;
+  out->b[out->end] = '\0';
+  deflateEnd(&strm);
+}
@@ -58,6 +58,8 @@ void futil_create_output(const char *path);
 /*!
   Open a file and set the buffer to be DEFAULT_IO_BUFSIZE. Call die() if cannot
   open the file.
+  Paths ending .zst are written with zstd and files starting with the zstd
+  magic number are decompressed when read (see zstd_file.h).
   @param path If "-" return stdout
   @param mode one of: "r","rw","rw+","a"
  */
@@ -74,6 +76,7 @@ FILE* futil_fopen_create(const char *path, const char *mode);
 gzFile futil_gzopen_create(const char *path, const char *mode);
 
 // Safe close with checks
+// gzutil_fclose() also waits for zstd output to be written (see zstd_file.h)
 void futil_fclose(FILE *fh);
 void gzutil_fclose(gzFile gz);
 
@@ -123,4 +126,14 @@ FILE** futil_create_tmp_files(size_t num_tmp_files);
 // Merge temporary files, closes tmp files
 void futil_merge_tmp_files(FILE **tmp_files, size_t num_files, FILE *fout);
 
+// Compress `len` bytes of `data` as a complete gzip member, appended to `out`.
+// Concatenated gzip members are a valid gzip file, so blocks of output can be
+// compressed by different threads. `level` is a zlib level (0-9 or -1)
+void futil_gzip_block(const char *data, size_t len, int level, StrBuf *out);
+
+// As futil_gzip_block() or, if `zstd`, append the text uncompressed for a zstd
+// output stream to compress (see zstd_file.h)
+void futil_pack_block(const char *data, size_t len, int level, bool zstd,
+                      StrBuf *out);
+
 #endif /* FILE_UTIL_H_ */
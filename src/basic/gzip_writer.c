@@ -0,0 +1,69 @@
+#include "global.h"
+#include "gzip_writer.h"
+#include "file_util.h"
+#include "zstd_file.h"
+
+void gzip_writer_alloc(GzipWriter *gzw, FILE *fout, const char *path, int level)
+{
+  memset(gzw, 0, sizeof(*gzw));
+  gzw->fout = fout;
+  gzw->path = path;
+  gzw->level = level;
+  gzw->zstd = zstd_file_is_path(path);
+  if(pthread_mutex_init(&gzw->lock, NULL) != 0) die("mutex init failed");
+}
+
+void gzip_writer_dealloc(GzipWriter *gzw)
+{
+  if(fflush(gzw->fout) != 0)
+    die("Cannot write to file: %s", futil_outpath_str(gzw->path));
+  pthread_mutex_destroy(&gzw->lock);
+  memset(gzw, 0, sizeof(*gzw));
+}
+
+void gzip_writer_buf_alloc(GzipWriterBuf *buf)
+{
+  strbuf_alloc(&buf->text, GZIP_WRITER_BLOCK_SIZE + 4096);
+  strbuf_alloc(&buf->zbuf, 4096);
+}
+
+void gzip_writer_buf_dealloc(GzipWriterBuf *buf)
+{
+  strbuf_dealloc(&buf->text);
+  strbuf_dealloc(&buf->zbuf);
+}
+
+// Write compressed bytes in zbuf under the lock
+static void _gzip_writer_write_zbuf(GzipWriter *gzw, size_t text_len,
+                                    StrBuf *zbuf)
+{
+  pthread_mutex_lock(&gzw->lock);
+  if(fwrite(zbuf->b, 1, zbuf->end, gzw->fout) != zbuf->end)
+    die("Cannot write to file: %s", futil_outpath_str(gzw->path));
+  gzw->nbytes_in += text_len;
+  gzw->nbytes_out += zbuf->end;
+  pthread_mutex_unlock(&gzw->lock);
+  ctx_stats_add(CTX_STAT_BYTES_OUT, zbuf->end);
+  strbuf_reset(zbuf);
+}
+
+void gzip_writer_flush_mt(GzipWriter *gzw, GzipWriterBuf *buf)
+{
+  if(buf->text.end == 0) return;
+  strbuf_reset(&buf->zbuf);
+  futil_pack_block(buf->text.b, buf->text.end, gzw->level, gzw->zstd,
+                   &buf->zbuf);
+  _gzip_writer_write_zbuf(gzw, buf->text.end, &buf->zbuf);
+  strbuf_reset(&buf->text);
+}
+
+void gzip_writer_puts_mt(GzipWriter *gzw, const char *str)
+{
+  size_t len = strlen(str);
+  if(len == 0) return;
+  StrBuf zbuf;
+  strbuf_alloc(&zbuf, 4096);
+  futil_pack_block(str, len, gzw->level, gzw->zstd, &zbuf);
+  _gzip_writer_write_zbuf(gzw, len, &zbuf);
+  strbuf_dealloc(&zbuf);
+}
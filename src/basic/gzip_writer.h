@@ -0,0 +1,59 @@
+#ifndef GZIP_WRITER_H_
+#define GZIP_WRITER_H_
+
+//
+// Gzip output shared by many threads
+//
+// Each thread formats text into its own GzipWriterBuf. Once it holds
+// GZIP_WRITER_BLOCK_SIZE bytes the thread compresses it as a complete gzip
+// member (see futil_gzip_block()) and appends the member to the output file.
+// Only the write of the (much smaller) compressed member is done under the
+// lock, so threads no longer wait for each other to deflate. Concatenated gzip
+// members are read as one file by gzip and zlib.
+//
+// If `path` ends .zst, `fout` is a zstd stream (see zstd_file.h) and text is
+// written to it uncompressed, zstd's worker threads compress it.
+//
+
+#include "string_buffer/string_buffer.h"
+#include <pthread.h>
+
+#define GZIP_WRITER_BLOCK_SIZE (1<<20) /* 1MB of text per gzip member */
+
+typedef struct
+{
+  FILE *fout;
+  const char *path;
+  int level; // zlib compression level
+  bool zstd; // write text, `fout` compresses it
+  pthread_mutex_t lock;
+  size_t nbytes_in, nbytes_out; // text and compressed bytes written
+} GzipWriter;
+
+// Per thread
+typedef struct
+{
+  StrBuf text, zbuf;
+} GzipWriterBuf;
+
+// `fout` should be opened by the caller in binary write mode
+void gzip_writer_alloc(GzipWriter *gzw, FILE *fout, const char *path, int level);
+void gzip_writer_dealloc(GzipWriter *gzw);
+
+void gzip_writer_buf_alloc(GzipWriterBuf *buf);
+void gzip_writer_buf_dealloc(GzipWriterBuf *buf);
+
+// Compress text held in `buf` as one gzip member and write it, then reset
+// the text. Does nothing if there is no text. Thread safe
+void gzip_writer_flush_mt(GzipWriter *gzw, GzipWriterBuf *buf);
+
+// Flush if `buf` holds at least GZIP_WRITER_BLOCK_SIZE bytes of text
+static inline void gzip_writer_write_mt(GzipWriter *gzw, GzipWriterBuf *buf)
+{
+  if(buf->text.end >= GZIP_WRITER_BLOCK_SIZE) gzip_writer_flush_mt(gzw, buf);
+}
+
+// Write `str` as its own gzip member e.g. a file header. Thread safe
+void gzip_writer_puts_mt(GzipWriter *gzw, const char *str);
+
+#endif /* GZIP_WRITER_H_ */
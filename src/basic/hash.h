@@ -16,8 +16,13 @@
   #define ctx_hash64(src,n,rehash) XXH64((src), (n), (rehash))
 #else
   // Use Bob Jenkin's lookup3
+  // (USE_MIX_HASH only changes the kmer hash, see kmer_mixhash.h)
   #include "misc/lookup3.h"
-  #define HASH_NAME_STR "Lookup3"
+  #if defined(USE_MIX_HASH)
+    #define HASH_NAME_STR "KmerMix64"
+  #else
+    #define HASH_NAME_STR "Lookup3"
+  #endif
   #define ctx_hash32(src,n,rehash) lk3_hashlittle((src), (n), (rehash))
 
 static inline uint64_t ctx_hash64(void *ptr, size_t n, uint64_t init)
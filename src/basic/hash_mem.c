@@ -1,6 +1,12 @@
 #include "global.h"
 #include "hash_mem.h"
 
+// Layout assumed by memory estimates, see hash_table_mem_set_layout()
+static int ht_mem_layout = 0;
+
+void hash_table_mem_set_layout(int layout) { ht_mem_layout = layout; }
+int hash_table_mem_get_layout() { return ht_mem_layout; }
+
 // Returns capacity of a hash table that holds at least nkmers
 size_t hash_table_cap(uint64_t nkmers, uint64_t *num_bkts_ptr, uint8_t *bkt_size_ptr)
 {
@@ -20,21 +26,29 @@ size_t hash_table_mem(uint64_t nkmers, size_t entrybits, uint64_t *nkmers_ptr)
   uint64_t num_of_buckets, capacity; uint8_t bktsize;
   capacity = hash_table_cap(nkmers, &num_of_buckets, &bktsize);
   if(nkmers_ptr != NULL) *nkmers_ptr = capacity;
-  return ht_mem(bktsize,num_of_buckets,entrybits);
+  return ht_mem(bktsize,num_of_buckets,entrybits,ht_mem_layout);
 }
 
 // Returns memory used for hashtable no more than some memory limit
 size_t hash_table_mem_limit(size_t memlimit, size_t entrybits, uint64_t *nkmers_ptr)
 {
   size_t bktsize, num_of_bits = 10, num_of_buckets = 1UL<<num_of_bits, num_of_kmers;
+  size_t hdrbytes, kmerbits = entrybits;
 
-  while(ht_mem(MAX_BUCKET_SIZE, num_of_buckets, entrybits) < memlimit) {
+  while(ht_mem(MAX_BUCKET_SIZE, num_of_buckets, entrybits,
+               ht_mem_layout) < memlimit) {
     num_of_bits++;
     num_of_buckets = 1UL << num_of_bits;
   }
 
-  bktsize = (memlimit - num_of_buckets*sizeof(uint8_t[2])) /
-            ((num_of_buckets * entrybits) /8);
+  // Tags are per entry unless they are held in bucket headers
+  hdrbytes = ht_bkt_mem(0, ht_mem_layout);
+  if((ht_mem_layout & HT_MEM_TAGS) && !(ht_mem_layout & HT_MEM_BUCKET_HDRS))
+    kmerbits += HT_TAG_BITS;
+
+  bktsize = memlimit < num_of_buckets*hdrbytes ? 0
+            : (memlimit - num_of_buckets*hdrbytes) /
+              ((num_of_buckets * kmerbits) /8);
 
   if(bktsize == 0) {
     num_of_bits--;
@@ -47,5 +61,5 @@ size_t hash_table_mem_limit(size_t memlimit, size_t entrybits, uint64_t *nkmers_
 
   if(nkmers_ptr != NULL) *nkmers_ptr = num_of_buckets * bktsize;
 
-  return ht_mem(bktsize,num_of_buckets,entrybits);
+  return ht_mem(bktsize,num_of_buckets,entrybits,ht_mem_layout);
 }
@@ -6,16 +6,39 @@
 #define WARN_OCCUPANCY 0.9f
 // bucket size must be <256
 #define MAX_BUCKET_SIZE 48
+// bits per entry used by hash table fingerprints (tags) if enabled
+#define HT_TAG_BITS 8
+// bytes per bucket header (size, lock and tags) with HT_ALLOC_COLOCATE
+#define HT_BUCKET_HDR 64
+
+// Hash table layouts, for memory estimates
+// HT_MEM_TAGS: HT_TAG_BITS per entry (HT_ALLOC_TAGS)
+// HT_MEM_BUCKET_HDRS: HT_BUCKET_HDR bytes per bucket, which hold the tags
+//                     (HT_ALLOC_COLOCATE)
+#define HT_MEM_TAGS        1
+#define HT_MEM_BUCKET_HDRS 2
+
+// Bytes per bucket on top of its entries' `nbits`
+static inline size_t ht_bkt_mem(size_t bktsize, int layout) {
+  if(layout & HT_MEM_BUCKET_HDRS) return HT_BUCKET_HDR;
+  return sizeof(uint8_t[2]) + (layout & HT_MEM_TAGS ? (bktsize*HT_TAG_BITS)/8 : 0);
+}
 
 // Hash table capacity is x*(2^y) where x and y are parameters
-// memory is x*(2^y)*sizeof(BinaryKmer) + (2^y) * 2
-static inline size_t ht_mem(size_t bktsize, size_t nbkts, size_t nbits) {
-  return (bktsize * nbkts * nbits)/8 + (nbkts) * sizeof(uint8_t[2]);
+// memory is x*(2^y)*sizeof(BinaryKmer) + (2^y) * 2, plus tags or headers
+static inline size_t ht_mem(size_t bktsize, size_t nbkts, size_t nbits,
+                            int layout) {
+  return (bktsize * nbkts * nbits)/8 + nbkts * ht_bkt_mem(bktsize, layout);
 }
 
 // Returns capacity of a hash table that holds at least nkmers
 size_t hash_table_cap(uint64_t nkmers, uint64_t *num_bkts_ptr, uint8_t *bkt_size_ptr);
 
+// Layout assumed by hash_table_mem() and hash_table_mem_limit(), OR together
+// HT_MEM_* values. Default is 0: two bytes per bucket, no tags
+void hash_table_mem_set_layout(int layout);
+int hash_table_mem_get_layout();
+
 // Returns memory required to hold nkmers
 size_t hash_table_mem(uint64_t nkmers, size_t entrybits, uint64_t *nkmers_ptr);
 
@@ -0,0 +1,116 @@
+#include "global.h"
+#include "mpmc_ring.h"
+
+#include <sched.h> // sched_yield()
+
+// Spin this many times on a full / empty ring before yielding
+#define MPMC_SPINS 64
+
+void mpmc_ring_alloc(MpmcRing *ring, size_t size)
+{
+  size_t i, cap = roundup2pow(MAX2(size, 2));
+  memset(ring, 0, sizeof(MpmcRing));
+  ring->slots = ctx_malloc(cap * sizeof(MpmcSlot));
+  ring->mask = cap - 1;
+  for(i = 0; i < cap; i++) { ring->slots[i].seq = i; ring->slots[i].ptr = NULL; }
+}
+
+void mpmc_ring_dealloc(MpmcRing *ring)
+{
+  ctx_free(ring->slots);
+  memset(ring, 0, sizeof(MpmcRing));
+}
+
+size_t mpmc_ring_len(const MpmcRing *ring)
+{
+  size_t head = ring->head, tail = ring->tail;
+  return tail > head ? tail - head : 0;
+}
+
+size_t mpmc_ring_try_push_batch(MpmcRing *ring, void *const *ptrs, size_t n)
+{
+  size_t i, k, pos;
+  MpmcSlot *slot;
+
+  while(1)
+  {
+    pos = ring->tail;
+    // Count free slots from pos, a slot is free when seq == its position
+    for(k = 0; k < n && ring->slots[(pos+k) & ring->mask].seq == pos+k; k++) {}
+    if(k == 0) {
+      slot = &ring->slots[pos & ring->mask];
+      // seq < pos: slot still holds an item from the last lap, ring is full
+      if((long)(slot->seq - pos) < 0) return 0;
+      continue; // another producer moved tail on
+    }
+    if(__sync_bool_compare_and_swap(&ring->tail, pos, pos+k)) break;
+  }
+
+  for(i = 0; i < k; i++) {
+    slot = &ring->slots[(pos+i) & ring->mask];
+    slot->ptr = ptrs[i];
+    __sync_synchronize();
+    slot->seq = pos+i+1;
+  }
+
+  return k;
+}
+
+size_t mpmc_ring_try_pop_batch(MpmcRing *ring, void **ptrs, size_t n)
+{
+  size_t i, k, pos;
+  MpmcSlot *slot;
+
+  while(1)
+  {
+    pos = ring->head;
+    // A slot is full when seq == its position + 1
+    for(k = 0; k < n && ring->slots[(pos+k) & ring->mask].seq == pos+k+1; k++) {}
+    if(k == 0) {
+      slot = &ring->slots[pos & ring->mask];
+      // seq < pos+1: slot not written yet, ring is empty
+      if((long)(slot->seq - (pos+1)) < 0) return 0;
+      continue; // another consumer moved head on
+    }
+    if(__sync_bool_compare_and_swap(&ring->head, pos, pos+k)) break;
+  }
+
+  for(i = 0; i < k; i++) {
+    slot = &ring->slots[(pos+i) & ring->mask];
+    ptrs[i] = slot->ptr;
+    __sync_synchronize();
+    slot->seq = pos+i+ring->mask+1; // free for the next lap
+  }
+
+  return k;
+}
+
+void mpmc_ring_push_batch(MpmcRing *ring, void *const *ptrs, size_t n)
+{
+  size_t k, spins = 0;
+  while(n > 0) {
+    if((k = mpmc_ring_try_push_batch(ring, ptrs, n)) > 0) {
+      ptrs += k; n -= k; spins = 0;
+    }
+    else if(++spins < MPMC_SPINS) __sync_synchronize();
+    else sched_yield();
+  }
+}
+
+size_t mpmc_ring_pop_batch(MpmcRing *ring, void **ptrs, size_t n)
+{
+  size_t k, spins = 0;
+  while(1) {
+    if((k = mpmc_ring_try_pop_batch(ring, ptrs, n)) > 0) return k;
+    // Check again after seeing closed, items may have been added before it
+    if(ring->closed) return mpmc_ring_try_pop_batch(ring, ptrs, n);
+    if(++spins < MPMC_SPINS) __sync_synchronize();
+    else sched_yield();
+  }
+}
+
+void mpmc_ring_close(MpmcRing *ring)
+{
+  __sync_synchronize();
+  ring->closed = true;
+}
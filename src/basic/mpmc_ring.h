@@ -0,0 +1,72 @@
+#ifndef MPMC_RING_H_
+#define MPMC_RING_H_
+
+//
+// Bounded lock-free multi-producer multi-consumer queue of pointers
+//
+// Dmitry Vyukov's design: each slot has a sequence number saying whether it is
+// ready to be written (seq == pos) or read (seq == pos+1) by whoever claims
+// position `pos`. Producers and consumers claim positions with a
+// compare-and-swap on `tail` / `head`, so they never take a lock, and only
+// contend with threads on the same end of the queue.
+//
+// The blocking calls spin then yield while the queue is full / empty.
+// Once closed, mpmc_ring_pop() returns false when the queue is empty.
+//
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct
+{
+  volatile size_t seq;
+  void *ptr;
+} MpmcSlot;
+
+typedef struct
+{
+  MpmcSlot *slots;
+  size_t mask; // capacity-1, capacity is a power of two
+  char pad0[64];
+  volatile size_t tail; // next position to write
+  char pad1[64];
+  volatile size_t head; // next position to read
+  char pad2[64];
+  volatile bool closed;
+} MpmcRing;
+
+// Capacity is `size` rounded up to a power of two
+void mpmc_ring_alloc(MpmcRing *ring, size_t size);
+void mpmc_ring_dealloc(MpmcRing *ring);
+
+#define mpmc_ring_capacity(ring) ((ring)->mask+1)
+
+// Approximate number of entries, exact if no threads are using the ring
+size_t mpmc_ring_len(const MpmcRing *ring);
+
+// Add up to `n` pointers, returns number added (0 if full)
+size_t mpmc_ring_try_push_batch(MpmcRing *ring, void *const *ptrs, size_t n);
+
+// Remove up to `n` pointers, returns number removed (0 if empty)
+size_t mpmc_ring_try_pop_batch(MpmcRing *ring, void **ptrs, size_t n);
+
+// `ptr` is a pointer variable to add / the address of one to set
+#define mpmc_ring_try_push(ring,ptr) \
+        (mpmc_ring_try_push_batch(ring,(void*const*)&(ptr),1) == 1)
+#define mpmc_ring_try_pop(ring,ptrptr) \
+        (mpmc_ring_try_pop_batch(ring,(void**)(ptrptr),1) == 1)
+
+// Block until all `n` pointers have been added
+void mpmc_ring_push_batch(MpmcRing *ring, void *const *ptrs, size_t n);
+
+// Block until at least one pointer can be removed, then remove up to `n`.
+// Returns 0 only if the ring is closed and empty.
+size_t mpmc_ring_pop_batch(MpmcRing *ring, void **ptrs, size_t n);
+
+#define mpmc_ring_push(ring,ptr) mpmc_ring_push_batch(ring,(void*const*)&(ptr),1)
+#define mpmc_ring_pop(ring,ptrptr) (mpmc_ring_pop_batch(ring,(void**)(ptrptr),1) == 1)
+
+// No more pointers will be pushed. Threadsafe.
+void mpmc_ring_close(MpmcRing *ring);
+
+#endif /* MPMC_RING_H_ */
@@ -0,0 +1,169 @@
+#include "global.h"
+#include "ref_cache.h"
+#include "util.h"
+#include "file_util.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ref_cache_pad(n) (((n)+7) & ~(size_t)7)
+
+#define ref_cache_hdr_bytes \
+        (strlen(REF_CACHE_MAGIC) + 2*sizeof(uint32_t) + 3*sizeof(uint64_t))
+
+bool ref_cache_is_file(const char *path)
+{
+  char magic[sizeof(REF_CACHE_MAGIC)];
+  FILE *fin = fopen(path, "r");
+  if(fin == NULL) return false;
+  bool ret = (fread(magic, 1, sizeof(magic)-1, fin) == sizeof(magic)-1 &&
+              memcmp(magic, REF_CACHE_MAGIC, sizeof(magic)-1) == 0);
+  fclose(fin);
+  return ret;
+}
+
+/**
+ * Write chromosomes to a cache file. Sequences should already be upper case
+ * with names truncated, as done by chrom_hash_load().
+ * `path` is only used for error messages
+ * @return number of bytes written
+ **/
+size_t ref_cache_write(const read_t *chroms, size_t nchroms,
+                       FILE *fout, const char *path)
+{
+  uint32_t version = REF_CACHE_VERSION, zero = 0;
+  uint64_t nchroms64 = nchroms, names_len = 0, seq_len = 0, offset, len;
+  size_t i, nbytes = 0;
+
+  for(i = 0; i < nchroms; i++) {
+    names_len += chroms[i].name.end + 1;
+    seq_len += chroms[i].seq.end + 1;
+  }
+  size_t names_end = names_len;
+  names_len = ref_cache_pad(names_len);
+
+  nbytes += fwrite(REF_CACHE_MAGIC, 1, strlen(REF_CACHE_MAGIC), fout);
+  nbytes += fwrite(&version,   1, sizeof(version),   fout);
+  nbytes += fwrite(&zero,      1, sizeof(zero),      fout);
+  nbytes += fwrite(&nchroms64, 1, sizeof(nchroms64), fout);
+  nbytes += fwrite(&names_len, 1, sizeof(names_len), fout);
+  nbytes += fwrite(&seq_len,   1, sizeof(seq_len),   fout);
+
+  for(i = 0, offset = 0; i < nchroms; i++) {
+    len = chroms[i].seq.end;
+    nbytes += fwrite(&offset, 1, sizeof(offset), fout);
+    nbytes += fwrite(&len,    1, sizeof(len),    fout);
+    offset += len + 1;
+  }
+
+  const char padding[8] = {0};
+  for(i = 0; i < nchroms; i++)
+    nbytes += fwrite(chroms[i].name.b, 1, chroms[i].name.end + 1, fout);
+  nbytes += fwrite(padding, 1, names_len - names_end, fout);
+
+  for(i = 0; i < nchroms; i++)
+    nbytes += fwrite(chroms[i].seq.b, 1, chroms[i].seq.end + 1, fout);
+
+  size_t expbytes = ref_cache_hdr_bytes + nchroms * 2 * sizeof(uint64_t) +
+                    names_len + seq_len;
+
+  if(nbytes != expbytes)
+    die("Cannot write to file: %s", futil_outpath_str(path));
+
+  return nbytes;
+}
+
+// Point a StrBuf at a string in the mapped file
+static inline void ref_cache_set_strbuf(StrBuf *sbuf, const char *str,
+                                        size_t len)
+{
+  sbuf->b = (char*)str;
+  sbuf->end = len;
+  sbuf->size = len + 1;
+}
+
+void ref_cache_load(RefCache *rc, const char *path)
+{
+  uint32_t version;
+  uint64_t nchroms, names_len, seq_len;
+  size_t i, nbytes, namelen;
+  khiter_t k;
+  int hret;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) die("Cannot open file: %s", path);
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < ref_cache_hdr_bytes)
+    die("Corrupt reference cache file: %s", path);
+
+  nbytes = st.st_size;
+  uint8_t *mem = mmap(NULL, nbytes, PROT_READ, MAP_SHARED, fd, 0);
+  if(mem == MAP_FAILED) die("Cannot memory map file: %s", path);
+  close(fd);
+
+  if(memcmp(mem, REF_CACHE_MAGIC, strlen(REF_CACHE_MAGIC)) != 0)
+    die("Not a reference cache file: %s", path);
+
+  const uint8_t *ptr = mem + strlen(REF_CACHE_MAGIC);
+  memcpy(&version,   ptr, sizeof(version));   ptr += 2*sizeof(uint32_t);
+  memcpy(&nchroms,   ptr, sizeof(nchroms));   ptr += sizeof(uint64_t);
+  memcpy(&names_len, ptr, sizeof(names_len)); ptr += sizeof(uint64_t);
+  memcpy(&seq_len,   ptr, sizeof(seq_len));
+
+  if(version != REF_CACHE_VERSION)
+    die("Reference cache version %u not supported: %s", version, path);
+
+  size_t index_off = ref_cache_hdr_bytes;
+  size_t names_off = index_off + nchroms * 2 * sizeof(uint64_t);
+  size_t seq_off = names_off + names_len;
+
+  if(nchroms > nbytes || names_len > nbytes || names_len % 8 != 0 ||
+     seq_off + seq_len != nbytes)
+    die("Corrupt reference cache file: %s", path);
+
+  const uint64_t *index = (const uint64_t*)(mem + index_off);
+  const char *name = (const char*)(mem + names_off);
+  const char *names_end = name + names_len;
+  const char *seq = (const char*)(mem + seq_off);
+
+  memset(rc, 0, sizeof(*rc));
+  rc->mmap_ptr = mem;
+  rc->mmap_len = nbytes;
+  rc->nchroms = nchroms;
+  rc->chroms = ctx_calloc(MAX2(nchroms, 1), sizeof(read_t));
+  rc->genome = chrom_hash_init();
+
+  for(i = 0; i < nchroms; i++)
+  {
+    namelen = strnlen(name, names_end - name);
+    if(name + namelen >= names_end ||
+       index[2*i] + index[2*i+1] >= seq_len || seq[index[2*i]+index[2*i+1]])
+      die("Corrupt reference cache file: %s", path);
+
+    ref_cache_set_strbuf(&rc->chroms[i].name, name, namelen);
+    ref_cache_set_strbuf(&rc->chroms[i].seq, seq + index[2*i], index[2*i+1]);
+    name += namelen + 1;
+
+    k = kh_put(kChromHash, rc->genome, rc->chroms[i].name.b, &hret);
+    if(hret == 0)
+      warn("duplicate chromosome (take first only): '%s'", rc->chroms[i].name.b);
+    else
+      kh_value(rc->genome, k) = &rc->chroms[i];
+  }
+
+  char memstr[50];
+  bytes_to_str(nbytes, 1, memstr);
+  status("[refcache] Mapped %zu chromosomes, %zu bases (%s) from: %s",
+         (size_t)nchroms, (size_t)(seq_len - nchroms), memstr, path);
+}
+
+void ref_cache_close(RefCache *rc)
+{
+  chrom_hash_destroy(rc->genome);
+  ctx_free(rc->chroms);
+  munmap(rc->mmap_ptr, rc->mmap_len);
+  memset(rc, 0, sizeof(*rc));
+}
@@ -0,0 +1,53 @@
+#ifndef REF_CACHE_H_
+#define REF_CACHE_H_
+
+//
+// Reference genome cache file
+//
+// Parsing a large reference FASTA takes a long time, and every process then
+// holds a private copy. A cache file holds the parsed chromosomes (names cut
+// at the first whitespace, bases in upper case) with an index. It is memory
+// mapped read-only, so it loads without parsing and processes using the same
+// cache share one copy of it in the page cache.
+//
+// Bases are stored one per byte, each chromosome followed by '\0', rather than
+// 2-bit packed, so chromosomes can be used in place as C strings (searching,
+// alignment) without decoding them into private memory.
+//
+// Format:
+//   "CTXREFCH" <uint32:version> <uint32:0>
+//   <uint64:nchroms> <uint64:names_len> <uint64:seq_len>
+//   nchroms x {<uint64:offset> <uint64:length>}  // offset in sequence block
+//   names: nchroms '\0' terminated strings, padded to 8 bytes (names_len)
+//   sequence block: seq_len bytes
+//
+
+#include "seq_reader.h"
+
+#define REF_CACHE_MAGIC "CTXREFCH"
+#define REF_CACHE_VERSION 1
+
+typedef struct
+{
+  void *mmap_ptr;
+  size_t mmap_len;
+  // name and seq of each read_t point into the file: do not modify or free
+  read_t *chroms;
+  size_t nchroms;
+  ChromHash *genome; // chromosome name -> chroms[i]
+} RefCache;
+
+// Returns true if `path` starts with REF_CACHE_MAGIC
+bool ref_cache_is_file(const char *path);
+
+// Write chromosomes loaded with chrom_hash_load(). Returns bytes written.
+size_t ref_cache_write(const read_t *chroms, size_t nchroms,
+                       FILE *fout, const char *path);
+
+// Memory map a cache file, dies on error
+void ref_cache_load(RefCache *rc, const char *path);
+void ref_cache_close(RefCache *rc);
+
+#define ref_cache_fetch(rc,chrom_name) chrom_hash_fetch((rc)->genome,chrom_name)
+
+#endif /* REF_CACHE_H_ */
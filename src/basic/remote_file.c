@@ -0,0 +1,684 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE // fopencookie()
+#endif
+
+#include "global.h"
+#include "remote_file.h"
+#include "util.h"
+
+#include <unistd.h> // close, pread
+#include <strings.h> // strncasecmp
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h> // getaddrinfo
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
+
+#define REMOTE_CACHE_WAYS 8 // slots per set, evicting the least recently used
+#define REMOTE_HDR_MAX 16384 // longest response header we accept
+#define REMOTE_TIMEOUT_SECS 60
+
+static size_t remote_cache_bytes = REMOTE_FILE_DEFAULT_CACHE;
+static size_t remote_nconns = REMOTE_FILE_DEFAULT_CONNS;
+
+void remote_file_set_cache(size_t cache_bytes)
+{
+  remote_cache_bytes = cache_bytes ? cache_bytes : REMOTE_FILE_DEFAULT_CACHE;
+}
+
+void remote_file_set_conns(size_t nconns)
+{
+  remote_nconns = nconns ? nconns : REMOTE_FILE_DEFAULT_CONNS;
+}
+
+bool remote_file_is_url(const char *path)
+{
+  return path != NULL &&
+         (strncmp(path,"http://",7) == 0 || strncmp(path,"https://",8) == 0);
+}
+
+enum RemoteBlockState {BLOCK_EMPTY, BLOCK_QUEUED, BLOCK_LOADING,
+                       BLOCK_READY, BLOCK_FAILED};
+
+typedef struct
+{
+  uint64_t blk; // block index in the file
+  char *data; // REMOTE_FILE_BLOCKSIZE bytes
+  size_t len; // bytes in data, the last block of a file may be short
+  uint64_t used; // rf->tick of last use, for LRU eviction
+  uint32_t refs; // readers copying out of data, cannot evict if > 0
+  uint8_t state; // enum RemoteBlockState
+} RemoteBlock;
+
+struct RemoteFile
+{
+  char *url, *host, *port;
+  char *req; // request line and headers, without the Range header
+  size_t reqlen, size;
+  int id; // descriptor is -2-id
+  size_t refs; // remote_file_open() calls not yet closed
+  RemoteFile *next; // list of open files
+  // Cache: slot i is in set i / REMOTE_CACHE_WAYS
+  RemoteBlock *slots;
+  char *mem;
+  size_t nslots, nsets, depth; // depth: blocks to have in flight per read
+  uint64_t tick;
+  // Circular queue of slots waiting to be fetched
+  size_t *queue, qhead, qlen;
+  pthread_t *ths;
+  size_t nths;
+  bool stop;
+  // Stats
+  size_t nreads, nmisses, nrequests, nretries;
+  uint64_t nbytes;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+static RemoteFile *remote_files = NULL;
+static int remote_next_id = 0;
+static pthread_mutex_t remote_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// HTTP
+//
+
+static int remote_connect(const RemoteFile *rf)
+{
+  struct addrinfo hints, *res, *ai;
+  struct timeval tv = {.tv_sec = REMOTE_TIMEOUT_SECS, .tv_usec = 0};
+  int rc, fd = -1, on = 1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if((rc = getaddrinfo(rf->host, rf->port, &hints, &res)) != 0) {
+    warn("Cannot resolve host %s: %s", rf->host, gai_strerror(rc));
+    return -1;
+  }
+
+  for(ai = res; ai != NULL; ai = ai->ai_next) {
+    if((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+      continue;
+    if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if(fd >= 0) {
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+  return fd;
+}
+
+static bool remote_send_all(int fd, const char *buf, size_t n)
+{
+  ssize_t r;
+  while(n > 0) {
+    if((r = send(fd, buf, n, MSG_NOSIGNAL)) < 0 && errno == EINTR) continue;
+    if(r <= 0) return false;
+    buf += r;
+    n -= r;
+  }
+  return true;
+}
+
+static bool remote_recv_all(int fd, char *buf, size_t n)
+{
+  ssize_t r;
+  while(n > 0) {
+    if((r = recv(fd, buf, n, 0)) < 0 && errno == EINTR) continue;
+    if(r <= 0) return false;
+    buf += r;
+    n -= r;
+  }
+  return true;
+}
+
+// Value of header `name` in a NUL terminated response header, or NULL
+static const char* remote_hdr_value(const char *hdr, const char *name)
+{
+  size_t n = strlen(name);
+  const char *line;
+  for(line = strstr(hdr, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+    line += 2;
+    if(strncasecmp(line, name, n) == 0 && line[n] == ':') {
+      for(line += n+1; *line == ' ' || *line == '\t'; line++) {}
+      return line;
+    }
+  }
+  return NULL;
+}
+
+// Request bytes [start, start+len) into `buf` on connection *fdp (connecting
+// if it is -1). If `total` is not NULL, set it to the file size.
+// Returns 0 on success, -1 on an error worth retrying, -2 otherwise.
+static int remote_get_range(RemoteFile *rf, int *fdp, uint64_t start,
+                            size_t len, char *buf, uint64_t *total)
+{
+  char req[rf->reqlen + 64], hdr[REMOTE_HDR_MAX+1], *end = NULL;
+  size_t hlen = 0, hdrlen, extra;
+  ssize_t r;
+  int status, n, fd;
+  const char *v;
+  uint64_t clen;
+
+  if(*fdp < 0 && (*fdp = remote_connect(rf)) < 0) return -1;
+  fd = *fdp;
+
+  memcpy(req, rf->req, rf->reqlen);
+  n = snprintf(req+rf->reqlen, 64, "Range: bytes=%"PRIu64"-%"PRIu64"\r\n\r\n",
+               start, start+len-1);
+
+  if(!remote_send_all(fd, req, rf->reqlen+n)) goto retry;
+
+  // Read response header, the start of the body may come with it
+  while(end == NULL) {
+    if(hlen == REMOTE_HDR_MAX) goto retry;
+    if((r = recv(fd, hdr+hlen, REMOTE_HDR_MAX-hlen, 0)) < 0 && errno == EINTR)
+      continue;
+    if(r <= 0) goto retry;
+    hlen += r;
+    hdr[hlen] = '\0';
+    end = strstr(hdr, "\r\n\r\n");
+  }
+  hdrlen = end+4 - hdr;
+  extra = hlen - hdrlen;
+  end[2] = '\0'; // terminate header, body starts at hdr+hdrlen
+
+  if(sscanf(hdr, "HTTP/%*u.%*u %d", &status) != 1) goto retry;
+
+  if(status == 416 && total != NULL &&
+     (v = remote_hdr_value(hdr, "Content-Range")) != NULL &&
+     (v = strchr(v, '/')) != NULL) {
+    // Range not satisfiable: empty file
+    *total = strtoull(v+1, NULL, 10);
+    close(fd);
+    *fdp = -1;
+    return 0;
+  }
+
+  if(status != 206) {
+    close(fd);
+    *fdp = -1;
+    if(status == 200) {
+      warn("Server does not support range requests: %s", rf->url);
+      return -2;
+    }
+    if(status >= 500 || status == 408 || status == 429) return -1;
+    warn("HTTP %i for %s", status, rf->url);
+    return -2;
+  }
+
+  if(remote_hdr_value(hdr, "Transfer-Encoding") != NULL ||
+     (v = remote_hdr_value(hdr, "Content-Length")) == NULL ||
+     (clen = strtoull(v, NULL, 10)) != len || extra > len) {
+    warn("Unexpected range response from %s", rf->url);
+    goto retry;
+  }
+
+  if(total != NULL && (v = remote_hdr_value(hdr, "Content-Range")) != NULL &&
+     (v = strchr(v, '/')) != NULL && v[1] != '*') {
+    *total = strtoull(v+1, NULL, 10);
+  }
+
+  memcpy(buf, hdr+hdrlen, extra);
+  if(!remote_recv_all(fd, buf+extra, len-extra)) goto retry;
+
+  if((v = remote_hdr_value(hdr, "Connection")) != NULL &&
+     strncasecmp(v, "close", 5) == 0) {
+    close(fd);
+    *fdp = -1;
+  }
+
+  return 0;
+
+  retry:
+  close(fd);
+  *fdp = -1;
+  return -1;
+}
+
+// Fetch with retries, returns true on success
+static bool remote_fetch(RemoteFile *rf, int *fdp, uint64_t start, size_t len,
+                         char *buf, uint64_t *total, size_t *nretries)
+{
+  int i, r = -1;
+  for(i = 0; i <= REMOTE_FILE_RETRIES && r == -1; i++) {
+    if(i > 0) { (*nretries)++; sleep(1); }
+    r = remote_get_range(rf, fdp, start, len, buf, total);
+  }
+  if(r != 0) {
+    warn("Range request failed: %s [bytes %"PRIu64"-%"PRIu64"]",
+         rf->url, start, start+len-1);
+  }
+  return r == 0;
+}
+
+//
+// Block cache
+//
+
+#define remote_set(rf,blk) ((rf)->slots + ((blk) % (rf)->nsets) * REMOTE_CACHE_WAYS)
+
+// Slot holding block `blk` or NULL. Lock must be held.
+static RemoteBlock* remote_cache_find(RemoteFile *rf, uint64_t blk)
+{
+  RemoteBlock *set = remote_set(rf, blk);
+  size_t i;
+  for(i = 0; i < REMOTE_CACHE_WAYS; i++)
+    if(set[i].state != BLOCK_EMPTY && set[i].blk == blk) return &set[i];
+  return NULL;
+}
+
+// Queue a fetch of block `blk` unless it is cached or queued already.
+// Returns false if every slot it could use is busy. Lock must be held.
+static bool remote_cache_request(RemoteFile *rf, uint64_t blk)
+{
+  RemoteBlock *set = remote_set(rf, blk), *s = remote_cache_find(rf, blk);
+  size_t i;
+
+  if(s != NULL) { s->used = ++rf->tick; return true; }
+
+  for(i = 0; i < REMOTE_CACHE_WAYS; i++) {
+    if(set[i].state == BLOCK_EMPTY || set[i].state == BLOCK_FAILED) {
+      s = &set[i];
+      break;
+    }
+    if(set[i].state == BLOCK_READY && set[i].refs == 0 &&
+       (s == NULL || set[i].used < s->used)) s = &set[i];
+  }
+
+  if(s == NULL) return false;
+
+  s->blk = blk;
+  s->len = 0;
+  s->state = BLOCK_QUEUED;
+  s->used = ++rf->tick;
+  rf->queue[(rf->qhead + rf->qlen) % rf->nslots] = s - rf->slots;
+  rf->qlen++;
+  rf->nmisses++;
+  pthread_cond_broadcast(&rf->cond);
+  return true;
+}
+
+static void* remote_worker(void *arg)
+{
+  RemoteFile *rf = (RemoteFile*)arg;
+  RemoteBlock *s;
+  uint64_t start;
+  size_t len, nretries = 0;
+  int fd = -1;
+  bool ok;
+
+  pthread_mutex_lock(&rf->lock);
+  while(!rf->stop)
+  {
+    if(rf->qlen == 0) { pthread_cond_wait(&rf->cond, &rf->lock); continue; }
+
+    s = &rf->slots[rf->queue[rf->qhead]];
+    rf->qhead = (rf->qhead + 1) % rf->nslots;
+    rf->qlen--;
+    s->state = BLOCK_LOADING; // slot is ours until READY/FAILED
+    start = s->blk * REMOTE_FILE_BLOCKSIZE;
+    len = MIN2(REMOTE_FILE_BLOCKSIZE, rf->size - start);
+    pthread_mutex_unlock(&rf->lock);
+
+    ok = remote_fetch(rf, &fd, start, len, s->data, NULL, &nretries);
+    if(ok) ctx_stats_add(CTX_STAT_BYTES_IN, len);
+
+    pthread_mutex_lock(&rf->lock);
+    s->len = len;
+    s->state = ok ? BLOCK_READY : BLOCK_FAILED;
+    rf->nrequests++;
+    rf->nretries += nretries;
+    rf->nbytes += ok ? len : 0;
+    nretries = 0;
+    pthread_cond_broadcast(&rf->cond);
+  }
+  pthread_mutex_unlock(&rf->lock);
+
+  if(fd >= 0) close(fd);
+  return NULL;
+}
+
+ssize_t remote_file_pread(RemoteFile *rf, void *buf, size_t n, off_t offset)
+{
+  if(offset < 0) { errno = EINVAL; return -1; }
+  if(n == 0 || (uint64_t)offset >= rf->size) return 0;
+  n = MIN2(n, rf->size - offset);
+
+  const size_t bs = REMOTE_FILE_BLOCKSIZE;
+  uint64_t first = offset / bs, last = (offset+n-1) / bs, b, ahead = first;
+  size_t done = 0, off, m;
+  RemoteBlock *s;
+
+  pthread_mutex_lock(&rf->lock);
+  for(b = first; b <= last; b++)
+  {
+    // Keep up to rf->depth blocks of this read in flight
+    for(; ahead <= last && ahead < b + rf->depth; ahead++)
+      if(!remote_cache_request(rf, ahead)) break;
+
+    while((s = remote_cache_find(rf, b)) == NULL ||
+          s->state == BLOCK_QUEUED || s->state == BLOCK_LOADING) {
+      if(s == NULL) remote_cache_request(rf, b); // may have been evicted
+      pthread_cond_wait(&rf->cond, &rf->lock);
+    }
+
+    if(s->state == BLOCK_FAILED) {
+      s->state = BLOCK_EMPTY; // try again on the next read
+      pthread_mutex_unlock(&rf->lock);
+      errno = EIO;
+      return -1;
+    }
+
+    // Slot cannot be evicted while refs > 0, copy without the lock
+    s->used = ++rf->tick;
+    s->refs++;
+    off = (b == first ? offset - b*bs : 0);
+    m = MIN2(n - done, s->len - off);
+    pthread_mutex_unlock(&rf->lock);
+    memcpy((char*)buf + done, s->data + off, m);
+    pthread_mutex_lock(&rf->lock);
+    if(--s->refs == 0) pthread_cond_broadcast(&rf->cond);
+    done += m;
+  }
+  rf->nreads += last+1-first;
+  pthread_mutex_unlock(&rf->lock);
+
+  return done;
+}
+
+void remote_file_prefetch(RemoteFile *rf, off_t offset, size_t n)
+{
+  if(offset < 0 || n == 0 || (uint64_t)offset >= rf->size) return;
+  n = MIN2(n, rf->size - offset);
+
+  uint64_t b = offset / REMOTE_FILE_BLOCKSIZE;
+  uint64_t last = (offset+n-1) / REMOTE_FILE_BLOCKSIZE;
+
+  // Never queue more than half the cache, or we would evict our own blocks
+  last = MIN2(last, b + rf->nslots/2);
+
+  pthread_mutex_lock(&rf->lock);
+  for(; b <= last && remote_cache_request(rf, b); b++) {}
+  pthread_mutex_unlock(&rf->lock);
+}
+
+//
+// Open/close
+//
+
+// Split http://host[:port]/path into rf->host, rf->port and request header
+static void remote_parse_url(RemoteFile *rf, const char *url)
+{
+  if(strncmp(url,"https://",8) == 0) {
+    die("https:// is not supported, use an http:// endpoint or a local "
+        "TLS proxy: %s", url);
+  }
+
+  const char *hostport = url+7, *path = strchr(hostport, '/'), *colon;
+  size_t hplen = path ? (size_t)(path - hostport) : strlen(hostport);
+  if(path == NULL) path = "/";
+
+  if(hplen == 0 || memchr(hostport, '@', hplen) != NULL)
+    die("Invalid URL (user:password@ is not supported): %s", url);
+
+  // [ipv6]:port or host:port
+  const char *hend = hostport + hplen;
+  if(hostport[0] == '[') {
+    const char *rb = memchr(hostport, ']', hplen);
+    if(rb == NULL) die("Invalid URL: %s", url);
+    rf->host = strndup(hostport+1, rb-hostport-1);
+    colon = (rb+1 < hend && rb[1] == ':') ? rb+1 : NULL;
+  } else {
+    colon = memchr(hostport, ':', hplen);
+    rf->host = strndup(hostport, (colon ? colon : hend) - hostport);
+  }
+  rf->port = colon ? strndup(colon+1, hend-colon-1) : strdup("80");
+
+  size_t reqcap = strlen(path) + hplen + 128;
+  rf->req = ctx_malloc(reqcap);
+  rf->reqlen = snprintf(rf->req, reqcap,
+                        "GET %s HTTP/1.1\r\nHost: %.*s\r\n"
+                        "User-Agent: mccortex\r\nConnection: keep-alive\r\n",
+                        path, (int)hplen, hostport);
+}
+
+static RemoteFile* remote_file_new(const char *url)
+{
+  RemoteFile *rf = ctx_calloc(1, sizeof(RemoteFile));
+  size_t i, nretries = 0;
+  uint64_t total = UINT64_MAX;
+  int fd = -1;
+  char tmp[1];
+
+  rf->url = strdup(url);
+  remote_parse_url(rf, url);
+
+  // A one byte range gets the file size from Content-Range. A presigned URL
+  // only allows GET, so we do not use HEAD.
+  if(!remote_fetch(rf, &fd, 0, 1, tmp, &total, &nretries) || total == UINT64_MAX)
+    die("Cannot open URL: %s", url);
+  if(fd >= 0) close(fd);
+  rf->size = total;
+
+  size_t nblocks = (rf->size + REMOTE_FILE_BLOCKSIZE-1) / REMOTE_FILE_BLOCKSIZE;
+  size_t nsets = remote_cache_bytes / (REMOTE_FILE_BLOCKSIZE * REMOTE_CACHE_WAYS);
+  nsets = MAX2(MIN2(nsets, (nblocks + REMOTE_CACHE_WAYS-1) / REMOTE_CACHE_WAYS), 1);
+
+  rf->nsets = nsets;
+  rf->nslots = nsets * REMOTE_CACHE_WAYS;
+  rf->depth = MAX2(MIN2(remote_nconns*2, rf->nslots/2), 1);
+  rf->slots = ctx_calloc(rf->nslots, sizeof(RemoteBlock));
+  rf->mem = ctx_malloc(rf->nslots * REMOTE_FILE_BLOCKSIZE);
+  rf->queue = ctx_calloc(rf->nslots, sizeof(size_t));
+  for(i = 0; i < rf->nslots; i++)
+    rf->slots[i].data = rf->mem + i * REMOTE_FILE_BLOCKSIZE;
+
+  if(pthread_mutex_init(&rf->lock, NULL) != 0) die("Mutex init failed");
+  if(pthread_cond_init(&rf->cond, NULL) != 0) die("Cond init failed");
+
+  rf->nths = MIN2(remote_nconns, rf->nslots);
+  rf->ths = ctx_calloc(rf->nths, sizeof(pthread_t));
+  for(i = 0; i < rf->nths; i++) {
+    int rc = pthread_create(&rf->ths[i], NULL, remote_worker, rf);
+    if(rc != 0) die("Creating remote I/O thread failed: %s", strerror(rc));
+  }
+
+  char sizestr[50], cachestr[50];
+  bytes_to_str(rf->size, 1, sizestr);
+  bytes_to_str(rf->nslots * REMOTE_FILE_BLOCKSIZE, 1, cachestr);
+  status("[remote] %s: %s, cache %s, %zu connections",
+         url, sizestr, cachestr, rf->nths);
+
+  return rf;
+}
+
+RemoteFile* remote_file_open(const char *url)
+{
+  RemoteFile *rf;
+  pthread_mutex_lock(&remote_files_lock);
+  for(rf = remote_files; rf != NULL && strcmp(rf->url, url) != 0; rf = rf->next) {}
+  if(rf == NULL) {
+    rf = remote_file_new(url);
+    rf->id = remote_next_id++;
+    rf->next = remote_files;
+    remote_files = rf;
+  }
+  rf->refs++;
+  pthread_mutex_unlock(&remote_files_lock);
+  return rf;
+}
+
+void remote_file_close(RemoteFile *rf)
+{
+  RemoteFile **ptr;
+  size_t i;
+
+  pthread_mutex_lock(&remote_files_lock);
+  bool last = (--rf->refs == 0);
+  if(last) {
+    for(ptr = &remote_files; *ptr != rf; ptr = &(*ptr)->next) {}
+    *ptr = rf->next;
+  }
+  pthread_mutex_unlock(&remote_files_lock);
+  if(!last) return;
+
+  pthread_mutex_lock(&rf->lock);
+  rf->stop = true;
+  pthread_cond_broadcast(&rf->cond);
+  pthread_mutex_unlock(&rf->lock);
+
+  for(i = 0; i < rf->nths; i++)
+    if(pthread_join(rf->ths[i], NULL) != 0) die("Cannot join remote I/O thread");
+
+  char bytesstr[50];
+  bytes_to_str(rf->nbytes, 1, bytesstr);
+  size_t nhits = rf->nreads - MIN2(rf->nmisses, rf->nreads);
+  status("[remote] %s: %zu range requests (%zu retries) fetched %s, "
+         "%.1f%% of block reads cached", rf->url, rf->nrequests, rf->nretries,
+         bytesstr, rf->nreads ? (100.0 * nhits) / rf->nreads : 0.0);
+
+  pthread_cond_destroy(&rf->cond);
+  pthread_mutex_destroy(&rf->lock);
+  free(rf->url);
+  free(rf->host);
+  free(rf->port);
+  ctx_free(rf->req);
+  ctx_free(rf->ths);
+  ctx_free(rf->queue);
+  ctx_free(rf->mem);
+  ctx_free(rf->slots);
+  ctx_free(rf);
+}
+
+size_t remote_file_size(const RemoteFile *rf)
+{
+  return rf->size;
+}
+
+ssize_t remote_file_pread_fd(int fd, void *buf, size_t n, off_t offset)
+{
+  if(fd >= -1) return pread(fd, buf, n, offset);
+  RemoteFile *rf;
+  pthread_mutex_lock(&remote_files_lock);
+  for(rf = remote_files; rf != NULL && rf->id != -2-fd; rf = rf->next) {}
+  pthread_mutex_unlock(&remote_files_lock);
+  if(rf == NULL) { errno = EBADF; return -1; }
+  return remote_file_pread(rf, buf, n, offset);
+}
+
+//
+// FILE* streams
+//
+
+#if defined(__GLIBC__)
+
+typedef struct RemoteStreamStruct RemoteStream;
+
+struct RemoteStreamStruct
+{
+  RemoteFile *rf;
+  FILE *fh;
+  off_t pos;
+  size_t nseq; // reads since the last seek, read ahead once sequential
+  RemoteStream *next;
+};
+
+static RemoteStream *remote_streams = NULL;
+
+static ssize_t _remote_read(void *cookie, char *buf, size_t size)
+{
+  RemoteStream *rs = (RemoteStream*)cookie;
+  ssize_t n = remote_file_pread(rs->rf, buf, size, rs->pos);
+  if(n <= 0) return n;
+  rs->pos += n;
+  if(++rs->nseq > 1)
+    remote_file_prefetch(rs->rf, rs->pos, rs->rf->depth * REMOTE_FILE_BLOCKSIZE);
+  return n;
+}
+
+static int _remote_seek(void *cookie, off64_t *offset, int whence)
+{
+  RemoteStream *rs = (RemoteStream*)cookie;
+  off_t target;
+
+  switch(whence) {
+    case SEEK_SET: target = *offset; break;
+    case SEEK_CUR: target = rs->pos + *offset; break;
+    case SEEK_END: target = rs->rf->size + *offset; break;
+    default: errno = EINVAL; return -1;
+  }
+
+  if(target < 0) { errno = EINVAL; return -1; }
+  if(target != rs->pos) rs->nseq = 0;
+  rs->pos = target;
+  *offset = target;
+  return 0;
+}
+
+static int _remote_close(void *cookie)
+{
+  RemoteStream *rs = (RemoteStream*)cookie, **ptr;
+
+  pthread_mutex_lock(&remote_files_lock);
+  for(ptr = &remote_streams; *ptr != rs; ptr = &(*ptr)->next) {}
+  *ptr = rs->next;
+  pthread_mutex_unlock(&remote_files_lock);
+
+  remote_file_close(rs->rf);
+  ctx_free(rs);
+  return 0;
+}
+
+FILE* remote_file_fopen(const char *url)
+{
+  RemoteStream *rs = ctx_calloc(1, sizeof(RemoteStream));
+  rs->rf = remote_file_open(url);
+
+  cookie_io_functions_t funcs = {.read = _remote_read, .write = NULL,
+                                 .seek = _remote_seek, .close = _remote_close};
+
+  FILE *fh = fopencookie(rs, "r", funcs);
+  if(fh == NULL) die("Cannot open remote stream: %s", url);
+
+  // Small stdio buffer, blocks are cached behind it
+  setvbuf(fh, NULL, _IOFBF, 64*1024);
+
+  rs->fh = fh;
+  pthread_mutex_lock(&remote_files_lock);
+  rs->next = remote_streams;
+  remote_streams = rs;
+  pthread_mutex_unlock(&remote_files_lock);
+
+  return fh;
+}
+
+int remote_file_fileno(FILE *fh)
+{
+  RemoteStream *rs;
+  int fd = -1;
+  pthread_mutex_lock(&remote_files_lock);
+  for(rs = remote_streams; rs != NULL && rs->fh != fh; rs = rs->next) {}
+  if(rs != NULL) fd = -2 - rs->rf->id;
+  pthread_mutex_unlock(&remote_files_lock);
+  return fd;
+}
+
+#else
+
+// fopencookie() is not available
+FILE* remote_file_fopen(const char *url)
+{
+  die("Reading URLs is not supported on this platform: %s", url);
+}
+
+int remote_file_fileno(FILE *fh) { (void)fh; return -1; }
+
+#endif /* defined(__GLIBC__) */
@@ -0,0 +1,67 @@
+#ifndef REMOTE_FILE_H_
+#define REMOTE_FILE_H_
+
+//
+// Read files from object storage (S3-compatible, or any web server) with HTTP
+// range requests, so a sorted graph can be searched without copying it to
+// local disk first
+//
+// Files are read in REMOTE_FILE_BLOCKSIZE blocks through a block cache shared
+// by every stream open on the same URL. A pool of worker threads, each with its
+// own keep-alive connection, fetches blocks: a read spanning many blocks (or
+// the read-ahead of a sequential stream) has up to --remote-conns range
+// requests in flight at once. Failed requests are retried
+// REMOTE_FILE_RETRIES times on a new connection.
+//
+// Only plain http:// URLs are supported (e.g. a presigned URL, a bucket
+// endpoint or a local TLS-terminating proxy). Read only.
+//
+// Streams are returned as FILE* (via fopencookie()) like async_file.h. Their
+// descriptor (remote_file_fileno()) is negative, so mmap() fails and callers
+// fall back to fread(), and remote_file_pread_fd() reads blocks for pread()
+// users such as graph_block.c.
+//
+
+#include "cortex_types.h"
+#include <sys/types.h> // off_t, ssize_t
+
+#define REMOTE_FILE_BLOCKSIZE (256*1024)
+#define REMOTE_FILE_DEFAULT_CACHE (256*ONE_MEGABYTE)
+#define REMOTE_FILE_DEFAULT_CONNS 16
+#define REMOTE_FILE_RETRIES 3
+
+typedef struct RemoteFile RemoteFile;
+
+// Set block cache size per URL (0 for default) and number of parallel
+// requests per URL (0 for default). Only affects files opened afterwards.
+void remote_file_set_cache(size_t cache_bytes);
+void remote_file_set_conns(size_t nconns);
+
+// True if path is a URL (http:// or https://)
+bool remote_file_is_url(const char *path);
+
+// Open a URL, calls die() on error. Opening a URL that is already open
+// returns the same RemoteFile with its cache.
+RemoteFile* remote_file_open(const char *url);
+void remote_file_close(RemoteFile *rf);
+
+size_t remote_file_size(const RemoteFile *rf);
+
+// Read up to `n` bytes at `offset`. Thread safe.
+// Returns bytes read (fewer than `n` only at the end of the file) or -1 on
+// error.
+ssize_t remote_file_pread(RemoteFile *rf, void *buf, size_t n, off_t offset);
+
+// Queue blocks covering [offset, offset+n) without waiting for them
+void remote_file_prefetch(RemoteFile *rf, off_t offset, size_t n);
+
+// Open a read stream of `url`. Calls die() on error. Close with fclose().
+FILE* remote_file_fopen(const char *url);
+
+// Descriptor of a remote stream (< -1) or -1 if `fh` is not one
+int remote_file_fileno(FILE *fh);
+
+// pread() that also accepts descriptors from remote_file_fileno()
+ssize_t remote_file_pread_fd(int fd, void *buf, size_t n, off_t offset);
+
+#endif /* REMOTE_FILE_H_ */
@@ -0,0 +1,468 @@
+#include "global.h"
+#include "seq_inflate.h"
+#include "file_util.h"
+#include "zstd_file.h"
+#include "dna.h"
+
+#include "htslib/hts.h"
+#include "htslib/bgzf.h"
+#include "htslib/sam.h"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define INFLATE_BUFSIZE (1<<20)
+
+typedef struct
+{
+  char *path;
+  int fd; // write end of the socket pair
+  size_t nthreads;
+  bool bgzf;
+  FILE *zfh; // zstd stream, if not NULL
+} InflateJob;
+
+static bool file_magic(const char *path, uint8_t *h, size_t n)
+{
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) return false;
+  size_t r = fread(h, 1, n, fh);
+  fclose(fh);
+  return (r == n);
+}
+
+// BGZF files are gzip files with a 'BC' extra subfield in each block header
+bool seq_inflate_is_bgzf(const char *path)
+{
+  uint8_t h[14];
+  return file_magic(path, h, sizeof(h)) &&
+         h[0] == 0x1f && h[1] == 0x8b && h[2] == 8 && (h[3] & 4) &&
+         h[12] == 'B' && h[13] == 'C';
+}
+
+static bool seq_inflate_is_gzip(const char *path)
+{
+  uint8_t h[2];
+  return file_magic(path, h, sizeof(h)) && h[0] == 0x1f && h[1] == 0x8b;
+}
+
+// Returns false if the reader has gone away
+static bool send_all(int fd, const char *buf, size_t n)
+{
+  ssize_t w;
+  while(n > 0) {
+    w = send(fd, buf, n, MSG_NOSIGNAL);
+    if(w < 0 && errno == EINTR) continue;
+    if(w <= 0) return false;
+    buf += w; n -= w;
+  }
+  return true;
+}
+
+static void* inflate_thread(void *arg)
+{
+  InflateJob *job = (InflateJob*)arg;
+  char *buf = ctx_malloc(INFLATE_BUFSIZE);
+  ssize_t n;
+
+  if(job->zfh) {
+    while((n = fread(buf, 1, INFLATE_BUFSIZE, job->zfh)) > 0 &&
+          send_all(job->fd, buf, n)) {}
+    if(ferror(job->zfh)) n = -1;
+    fclose(job->zfh);
+  }
+  else if(job->bgzf) {
+    BGZF *fp = bgzf_open(job->path, "r");
+    if(fp == NULL) die("Cannot open file: %s", job->path);
+    if(bgzf_mt(fp, job->nthreads, 256) != 0)
+      warn("Cannot start BGZF threads: %s", job->path);
+    while((n = bgzf_read(fp, buf, INFLATE_BUFSIZE)) > 0 &&
+          send_all(job->fd, buf, n)) {}
+    bgzf_close(fp);
+  }
+  else {
+    gzFile gz = gzopen(job->path, "r");
+    if(gz == NULL) die("Cannot open file: %s", job->path);
+    gzbuffer(gz, INFLATE_BUFSIZE);
+    while((n = gzread(gz, buf, INFLATE_BUFSIZE)) > 0 &&
+          send_all(job->fd, buf, n)) {}
+    gzclose(gz);
+  }
+
+  if(n < 0) die("Error decompressing file: %s", job->path);
+
+  close(job->fd);
+  ctx_free(buf);
+  free(job->path);
+  ctx_free(job);
+  return NULL;
+}
+
+// Start `func` on a detached thread writing to fds[1], return a seq_file_t
+// reading from fds[0]. The thread exits at the end of the input or when the
+// reader closes its end of the socket
+static seq_file_t* seq_open_thread(const char *path, int fds[2],
+                                   void* (*func)(void*), void *job)
+{
+  seq_file_t *sf = seq_dopen(fds[0], false, false, INFLATE_BUFSIZE);
+  if(sf == NULL) die("Cannot read from socket: %s", path);
+  free(sf->path);
+  sf->path = strdup(path);
+
+  int rc;
+  pthread_t thread;
+  pthread_attr_t thread_attr;
+  pthread_attr_init(&thread_attr);
+  pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+  rc = pthread_create(&thread, &thread_attr, func, job);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  pthread_attr_destroy(&thread_attr);
+  return sf;
+}
+
+//
+// SAM/BAM/CRAM options and region queries
+//
+
+static char **hts_regions = NULL;
+static size_t hts_nregions = 0;
+static char *hts_cram_ref = NULL;
+
+void seq_inflate_add_region(const char *region)
+{
+  hts_regions = ctx_reallocarray(hts_regions, hts_nregions+1, sizeof(char*));
+  hts_regions[hts_nregions++] = strdup(region);
+}
+
+void seq_inflate_set_cram_ref(const char *path)
+{
+  free(hts_cram_ref);
+  hts_cram_ref = strdup(path);
+}
+
+typedef struct
+{
+  char *path;
+  int fd; // write end of the socket pair
+  size_t nthreads;
+} RegionJob;
+
+// Write a BAM record as a FASTQ record in its original orientation. Missing
+// qualities are written as 'I' so they pass any quality cutoff.
+static bool bam_rec_send(int fd, const bam1_t *b, char **buf, size_t *cap)
+{
+  const uint8_t *seq = bam_get_seq(b), *qual = bam_get_qual(b);
+  const char *name = bam_get_qname(b);
+  size_t i, j, len = b->core.l_qseq, namelen = strlen(name);
+  bool rev = (b->core.flag & BAM_FREVERSE) != 0;
+  bool noqual = (len > 0 && qual[0] == 0xff);
+  size_t n = namelen + 2*len + 6;
+  char *p, c;
+
+  if(n > *cap) { *cap = 2*n; *buf = ctx_realloc(*buf, *cap); }
+  p = *buf;
+
+  *(p++) = '@';
+  memcpy(p, name, namelen);
+  p += namelen;
+  *(p++) = '\n';
+  for(i = 0; i < len; i++) {
+    j = rev ? len-1-i : i;
+    c = seq_nt16_str[bam_seqi(seq, j)];
+    *(p++) = rev ? (char)dna_complement_char_arr[(uint8_t)c] : c;
+  }
+  memcpy(p, "\n+\n", 3);
+  p += 3;
+  for(i = 0; i < len; i++) {
+    j = rev ? len-1-i : i;
+    *(p++) = noqual ? 'I' : (char)(qual[j] + 33);
+  }
+  *(p++) = '\n';
+
+  return send_all(fd, *buf, p - *buf);
+}
+
+static void* region_thread(void *arg)
+{
+  RegionJob *job = (RegionJob*)arg;
+  char *buf = NULL;
+  size_t cap = 0;
+  int r;
+
+  samFile *fp = sam_open(job->path, "r");
+  if(fp == NULL) die("Cannot open file: %s", job->path);
+  if(hts_cram_ref && hts_set_fai_filename(fp, hts_cram_ref) != 0)
+    die("Cannot load CRAM reference: %s", hts_cram_ref);
+  if(job->nthreads > 1 && hts_set_threads(fp, job->nthreads) != 0)
+    warn("Cannot decompress with %zu threads: %s", job->nthreads, job->path);
+
+  bam_hdr_t *hdr = sam_hdr_read(fp);
+  if(hdr == NULL) die("Cannot read header: %s", job->path);
+  hts_idx_t *idx = sam_index_load(fp, job->path);
+  if(idx == NULL) die("Cannot load index for --region: %s", job->path);
+  hts_itr_t *itr = sam_itr_regarray(idx, hdr, hts_regions, hts_nregions);
+  if(itr == NULL) die("Cannot parse --region: %s", job->path);
+
+  bam1_t *b = bam_init1();
+  while((r = sam_itr_next(fp, itr, b)) >= 0) {
+    if(b->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
+    if(!bam_rec_send(job->fd, b, &buf, &cap)) break;
+  }
+
+  if(r < -1) die("Error reading file: %s", job->path);
+
+  bam_destroy1(b);
+  hts_itr_destroy(itr);
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(hdr);
+  sam_close(fp);
+  close(job->fd);
+  ctx_free(buf);
+  free(job->path);
+  ctx_free(job);
+  return NULL;
+}
+
+// Read only the regions given with seq_inflate_add_region()
+static seq_file_t* seq_region_reopen(seq_file_t *sf, size_t nthreads)
+{
+  if(strcmp(sf->path,"-") == 0)
+    die("--region needs an indexed file, not STDIN");
+
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    die("Cannot create socket pair: %s", strerror(errno));
+
+  RegionJob *job = ctx_malloc(sizeof(RegionJob));
+  job->path = strdup(sf->path);
+  job->fd = fds[1];
+  job->nthreads = nthreads;
+
+  status("[seq_region] Reading %zu region(s) from %s", hts_nregions, sf->path);
+  seq_file_t *nsf = seq_open_thread(sf->path, fds, region_thread, job);
+  seq_close(sf);
+  return nsf;
+}
+
+seq_file_t* seq_inflate_reopen(seq_file_t *sf, size_t nthreads)
+{
+  if(sf == NULL) return sf;
+
+  if(seq_is_sam(sf) || seq_is_bam(sf)) {
+    if(hts_nregions > 0) return seq_region_reopen(sf, nthreads);
+    if(hts_cram_ref && sf->s_file &&
+       hts_set_fai_filename(sf->s_file, hts_cram_ref) != 0)
+      die("Cannot load CRAM reference: %s", hts_cram_ref);
+  }
+
+  if(strcmp(sf->path,"-") == 0) return sf;
+
+  // seq_file cannot read zstd, decompress it on a thread whatever `nthreads`
+  FILE *zfh = zstd_file_is_zstd(sf->path) ? zstd_file_fopen(sf->path, "r")
+                                           : NULL;
+
+  if(nthreads <= 1 && zfh == NULL) return sf;
+
+  if(seq_is_sam(sf) || seq_is_bam(sf)) {
+    if(sf->s_file && hts_set_threads(sf->s_file, nthreads) != 0)
+      warn("Cannot decompress with %zu threads: %s", nthreads, sf->path);
+    return sf;
+  }
+
+  bool bgzf = !zfh && seq_inflate_is_bgzf(sf->path);
+  if(!zfh && !bgzf && !seq_inflate_is_gzip(sf->path)) return sf;
+
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    if(zfh) die("Cannot create socket pair: %s", strerror(errno));
+    warn("Cannot create socket pair: %s", strerror(errno));
+    return sf;
+  }
+
+  InflateJob *job = ctx_malloc(sizeof(InflateJob));
+  job->path = strdup(sf->path);
+  job->fd = fds[1];
+  job->nthreads = nthreads;
+  job->bgzf = bgzf;
+  job->zfh = zfh;
+
+  seq_file_t *nsf = seq_open_thread(sf->path, fds, inflate_thread, job);
+  seq_close(sf);
+  return nsf;
+}
+
+//
+// Splitting uncompressed FASTQ
+//
+
+static size_t split_min_bytes = SEQ_SPLIT_MIN_BYTES;
+
+void seq_split_set_min_bytes(size_t nbytes) { split_min_bytes = nbytes; }
+
+typedef struct
+{
+  char *path;
+  int fd;
+  off_t start, end;
+  bool interleaved;
+} SplitJob;
+
+typedef struct
+{
+  char *lines[4];
+  size_t caps[4];
+  ssize_t lens[4];
+} FastqRecord;
+
+static void fastq_rec_dealloc(FastqRecord *rec)
+{
+  size_t i;
+  for(i = 0; i < 4; i++) free(rec->lines[i]);
+}
+
+static bool fastq_rec_read(FILE *fh, FastqRecord *rec)
+{
+  size_t i;
+  for(i = 0; i < 4; i++)
+    if((rec->lens[i] = getline(&rec->lines[i], &rec->caps[i], fh)) <= 0)
+      return false;
+  return (rec->lines[0][0] == '@' && rec->lines[2][0] == '+');
+}
+
+static bool fastq_rec_send(int fd, const FastqRecord *rec)
+{
+  size_t i;
+  for(i = 0; i < 4; i++)
+    if(!send_all(fd, rec->lines[i], rec->lens[i])) return false;
+  return true;
+}
+
+// Length of read name without trailing whitespace or /1, /2
+static size_t read_name_len(const char *name)
+{
+  size_t len = strcspn(name, " \t\r\n");
+  if(len > 2 && name[len-2] == '/' && (name[len-1] == '1' || name[len-1] == '2'))
+    len -= 2;
+  return len;
+}
+
+static bool fastq_recs_paired(const FastqRecord *a, const FastqRecord *b)
+{
+  size_t len = read_name_len(a->lines[0]);
+  return len == read_name_len(b->lines[0]) &&
+         strncmp(a->lines[0], b->lines[0], len) == 0;
+}
+
+// Move to the start of the first record header at or after the current line.
+// A header line starts with '@' and the line after next starts with '+'.
+// Quality lines may start with '@', but then the line after next is sequence.
+static bool fastq_sync(FILE *fh, FastqRecord *rec)
+{
+  off_t pos, next;
+  while(1) {
+    if((pos = ftello(fh)) < 0 ||
+       (rec->lens[0] = getline(&rec->lines[0], &rec->caps[0], fh)) <= 0)
+      return false;
+    if(rec->lines[0][0] != '@') continue;
+    next = ftello(fh);
+    if((rec->lens[1] = getline(&rec->lines[1], &rec->caps[1], fh)) <= 0 ||
+       (rec->lens[2] = getline(&rec->lines[2], &rec->caps[2], fh)) <= 0)
+      return false;
+    if(rec->lines[2][0] == '+') return (fseeko(fh, pos, SEEK_SET) == 0);
+    if(fseeko(fh, next, SEEK_SET) != 0) return false;
+  }
+}
+
+static void* split_thread(void *arg)
+{
+  SplitJob *job = (SplitJob*)arg;
+  FastqRecord rec, rec2;
+  memset(&rec, 0, sizeof(rec));
+  memset(&rec2, 0, sizeof(rec2));
+  bool ok = true;
+  off_t pos, next;
+
+  FILE *fh = fopen(job->path, "r");
+  if(fh == NULL) die("Cannot open file: %s", job->path);
+  setvbuf(fh, NULL, _IOFBF, INFLATE_BUFSIZE);
+
+  if(job->start > 0) {
+    // Start from the line after the one containing byte start-1
+    if(fseeko(fh, job->start-1, SEEK_SET) != 0)
+      die("Cannot seek: %s", job->path);
+    ok = (getline(&rec.lines[0], &rec.caps[0], fh) > 0) && fastq_sync(fh, &rec);
+    // Start on the first read of a pair
+    if(ok && job->interleaved) {
+      pos = ftello(fh);
+      ok = fastq_rec_read(fh, &rec);
+      next = ftello(fh);
+      ok = ok && fastq_rec_read(fh, &rec2) &&
+           fseeko(fh, fastq_recs_paired(&rec,&rec2) ? pos : next, SEEK_SET) == 0;
+    }
+  }
+
+  while(ok && (pos = ftello(fh)) >= 0 && pos < job->end &&
+        fastq_rec_read(fh, &rec) &&
+        (!job->interleaved || fastq_rec_read(fh, &rec2)))
+  {
+    ok = fastq_rec_send(job->fd, &rec) &&
+         (!job->interleaved || fastq_rec_send(job->fd, &rec2));
+  }
+
+  fclose(fh);
+  close(job->fd);
+  fastq_rec_dealloc(&rec);
+  fastq_rec_dealloc(&rec2);
+  free(job->path);
+  ctx_free(job);
+  return NULL;
+}
+
+// Check the start of the file looks like four line FASTQ and, if interleaved,
+// that the first two reads have matching names
+static bool fastq_splittable(const char *path, bool interleaved)
+{
+  FastqRecord rec, rec2;
+  memset(&rec, 0, sizeof(rec));
+  memset(&rec2, 0, sizeof(rec2));
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) return false;
+  bool ok = fastq_rec_read(fh, &rec) && fastq_rec_read(fh, &rec2) &&
+            (!interleaved || fastq_recs_paired(&rec, &rec2));
+  fclose(fh);
+  fastq_rec_dealloc(&rec);
+  fastq_rec_dealloc(&rec2);
+  return ok;
+}
+
+size_t seq_split_file(seq_file_t *sf, bool interleaved,
+                      seq_file_t **out, size_t nsplits)
+{
+  if(nsplits <= 1 || strcmp(sf->path,"-") == 0 || !seq_is_fastq(sf) ||
+     seq_inflate_is_gzip(sf->path)) return 0;
+
+  off_t fsize = futil_get_file_size(sf->path);
+  if(fsize < 0 || (size_t)fsize < split_min_bytes ||
+     !fastq_splittable(sf->path, interleaved)) return 0;
+
+  size_t i;
+  int fds[2];
+  off_t chunk = fsize / nsplits;
+
+  for(i = 0; i < nsplits; i++) {
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      die("Cannot create socket pair: %s", strerror(errno));
+    SplitJob *job = ctx_malloc(sizeof(SplitJob));
+    job->path = strdup(sf->path);
+    job->fd = fds[1];
+    job->start = chunk * (off_t)i;
+    job->end = (i+1 == nsplits ? fsize : chunk * (off_t)(i+1));
+    job->interleaved = interleaved;
+    out[i] = seq_open_thread(sf->path, fds, split_thread, job);
+  }
+
+  status("[seq_split] Reading %s with %zu threads", sf->path, nsplits);
+  seq_close(sf);
+  return nsplits;
+}
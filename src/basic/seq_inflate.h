@@ -0,0 +1,58 @@
+#ifndef SEQ_INFLATE_H_
+#define SEQ_INFLATE_H_
+
+#include "seq_file/seq_file.h"
+
+//
+// Decompress sequence files on their own threads
+//
+// SAM/BAM files use htslib's thread pool. BGZF compressed FASTQ/FASTA is
+// decompressed by a BGZF thread pool and plain gzip is inflated on a separate
+// thread (gzip streams cannot be split), both feeding the parser through a
+// socket pair. This decouples decompression from the number of input files.
+// Zstd files (see zstd_file.h), which seq_file cannot read, are always
+// decompressed on a thread in the same way.
+//
+// Large uncompressed FASTQ files can also be split into byte ranges, each read
+// by its own thread. A range starts at the first record header after its start
+// offset and includes every record whose header starts before its end offset.
+//
+
+// Returns true if `path` starts with a BGZF block header
+bool seq_inflate_is_bgzf(const char *path);
+
+// Returns `sf` or a new seq_file_t reading the same file decompressed with
+// `nthreads` threads. If a new seq_file_t is returned `sf` has been closed.
+// Does nothing if the file is stdin or is not compressed, or nthreads <= 1 and
+// the file is not zstd.
+// SAM/BAM/CRAM files are reopened to read only the regions added with
+// seq_inflate_add_region(), if any.
+// Must be called before reading from `sf`.
+seq_file_t* seq_inflate_reopen(seq_file_t *sf, size_t nthreads);
+
+// Only load reads overlapping `region` (e.g. chr1:1000-2000) from SAM/BAM/CRAM
+// inputs, using their index. May be called more than once. Unmapped reads and
+// secondary or supplementary alignments are skipped.
+void seq_inflate_add_region(const char *region);
+
+// Reference used to decode CRAM files
+void seq_inflate_set_cram_ref(const char *path);
+
+// Don't split files smaller than this
+#define SEQ_SPLIT_MIN_BYTES (64UL<<20)
+
+// Change the minimum file size to split (default SEQ_SPLIT_MIN_BYTES), used
+// by tests to split small files
+void seq_split_set_min_bytes(size_t nbytes);
+
+// Split an uncompressed FASTQ file (four lines per record) into up to
+// `nsplits` seq_file_t, stored in `out`. If `interleaved`, ranges start on the
+// first read of a pair, which requires read names of a pair to match once any
+// /1 /2 suffix is removed.
+// Returns number of files in `out`, if > 0 `sf` has been closed.
+// Returns 0 and leaves `sf` open if the file cannot be split.
+// Must be called before reading from `sf`.
+size_t seq_split_file(seq_file_t *sf, bool interleaved,
+                      seq_file_t **out, size_t nsplits);
+
+#endif /* SEQ_INFLATE_H_ */
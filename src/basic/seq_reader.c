@@ -3,6 +3,7 @@
 #include "util.h"
 #include "file_util.h"
 #include "dna.h"
+#include "fastq_block.h"
 
 #include "seq_file/seq_file.h"
 
@@ -182,6 +183,86 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
                          search_start);
 }
 
+// Same as seq_contig_start2() then seq_contig_end2(), but in a single forward
+// pass that checks bases, qualities and homopolymer runs together rather than
+// re-scanning each candidate kmer. Quality and homopolymer boundaries follow
+// the rules of those two functions exactly.
+size_t seq_contig_next2(const char *seq, size_t seqlen,
+                        const char *qual, size_t quallen,
+                        size_t offset, size_t kmer_size,
+                        uint8_t qual_cutoff, uint8_t hp_cutoff,
+                        size_t *contig_end, size_t *search_start)
+{
+  if(!qual || !quallen) { qual = NULL; quallen = 0; }
+
+  size_t i, start = offset, end, run = 0, hp_run = 1;
+  // Low quality bases end a contig if qual < cutoff, but a kmer is only
+  // started if all qual > cutoff
+  const size_t start_quallen = qual_cutoff > 0 ? quallen : 0;
+
+  *contig_end = *search_start = seqlen;
+
+  // Without quality or homopolymer cutoffs contigs are runs of ACGT
+  if(hp_cutoff == 0 && start_quallen == 0) {
+    for(; start + kmer_size <= seqlen; start = end + 1) {
+      end = start + dna_encode_nucs(seq+start, seqlen-start, NULL);
+      if(end - start >= kmer_size) {
+        *contig_end = *search_start = end;
+        return start;
+      }
+    }
+    return seqlen;
+  }
+
+  // Find the first kmer of good bases without a homopolymer run of hp_cutoff
+  // (a cutoff of 1 is not applied here, as in seq_contig_start2())
+  for(i = offset; i < seqlen; i++) {
+    if(!char_is_acgt(seq[i]) ||
+       (i < start_quallen && qual[i] <= qual_cutoff)) {
+      start = i+1;
+      run = 0;
+      continue;
+    }
+    run = (i > start && seq[i] == seq[i-1]) ? run+1 : 1;
+    if(hp_cutoff > 1 && run >= hp_cutoff) start = MAX2(start, i+2-hp_cutoff);
+    if(i+1-start == kmer_size) break;
+  }
+
+  if(i == seqlen) return seqlen;
+
+  // Extend the kmer. The homopolymer run at the end of the first kmer may
+  // reach back before the start of the contig.
+  end = start + kmer_size;
+  if(hp_cutoff > 0)
+    while(hp_run < end && seq[end-1-hp_run] == seq[end-1]) hp_run++;
+
+  for(; end < seqlen; end++) {
+    if(!char_is_acgt(seq[end]) || (end < quallen && qual[end] < qual_cutoff))
+      break;
+    if(hp_cutoff > 0) {
+      if(seq[end] != seq[end-1]) hp_run = 1;
+      else if(++hp_run >= (size_t)hp_cutoff) break;
+    }
+  }
+
+  *contig_end = end;
+  if(hp_cutoff > 0 && hp_run >= (size_t)hp_cutoff)
+    *search_start = end - (size_t)hp_cutoff + 1;
+  else
+    *search_start = end;
+
+  return start;
+}
+
+size_t seq_contig_next(const read_t *r, size_t offset, size_t kmer_size,
+                       uint8_t qual_cutoff, uint8_t hp_cutoff,
+                       size_t *contig_end, size_t *search_start)
+{
+  return seq_contig_next2(r->seq.b, r->seq.end, r->qual.b, r->qual.end,
+                          offset, kmer_size, qual_cutoff, hp_cutoff,
+                          contig_end, search_start);
+}
+
 // Warning bits
 #define WFLAG_INVALID_BASE  1
 #define WFLAG_QLEN_MISMATCH 2
@@ -196,11 +277,10 @@ static uint8_t check_new_read(const read_t *r, uint8_t qmin, uint8_t qmax,
   // Test if we've already warned about issue (e.g. bad base) before checking
   if(!(warn_flags & WFLAG_INVALID_BASE))
   {
-    const char *tmp;
-    for(tmp = r->seq.b; char_is_acgtn(*tmp); tmp++) {}
+    size_t i = dna_check_acgtn(r->seq.b, r->seq.end);
 
-    if(*tmp != '\0') {
-      warn("Invalid base '%c' [read: %s; path: %s]\n", *tmp, r->name.b, path);
+    if(i < r->seq.end) {
+      warn("Invalid base '%c' [read: %s; path: %s]\n", r->seq.b[i], r->name.b, path);
       warn_flags |= WFLAG_INVALID_BASE;
     }
   }
@@ -461,6 +541,70 @@ void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
          num_se_reads_str, num_pe_pairs_str, futil_inpath_str(sf->path));
 }
 
+// Copy a read view from the block parser into a read we own
+static void seq_read_copy_view(read_t *r, const read_t *view)
+{
+  strbuf_ensure_capacity(&r->name, view->name.end);
+  strbuf_ensure_capacity(&r->seq, view->seq.end);
+  strbuf_ensure_capacity(&r->qual, view->qual.end);
+  memcpy(r->name.b, view->name.b, view->name.end+1);
+  memcpy(r->seq.b, view->seq.b, view->seq.end+1);
+  memcpy(r->qual.b, view->qual.b, view->qual.end+1);
+  r->name.end = view->name.end;
+  r->seq.end = view->seq.end;
+  r->qual.end = view->qual.end;
+  r->from_sam = false;
+}
+
+bool seq_parse_se_fastq_block(seq_file_t *sf, uint8_t ascii_fq_offset,
+                              read_t *r1,
+                              void (*read_func)(read_t *r1, read_t *r2,
+                                                uint8_t qoffset1,
+                                                uint8_t qoffset2, void *ptr),
+                              void *reader_ptr)
+{
+  if(strcmp(sf->path,"-") == 0 || !seq_is_fastq(sf) ||
+     !fastq_block_usable(sf->path)) return false;
+
+  status("[seq] Parsing FASTQ file in blocks %s", futil_inpath_str(sf->path));
+
+  // Guess offset if needed
+  uint8_t qoffset = ascii_fq_offset;
+  uint8_t qmin = ascii_fq_offset, qmax = 126;
+  int format;
+
+  if(ascii_fq_offset == 0 && (format = guess_fastq_format(sf)) != -1)
+  {
+    qmin = (uint8_t)FASTQ_MIN[format];
+    qmax = (uint8_t)FASTQ_MAX[format];
+    qoffset = (uint8_t)FASTQ_OFFSET[format];
+  }
+
+  FastqBlock fb;
+  read_t view;
+  memset(&view, 0, sizeof(view));
+  fastq_block_open(&fb, sf->path, FASTQ_BLOCK_SIZE);
+
+  uint8_t warn_flags = 0;
+  size_t num_se_reads = 0;
+
+  while(fastq_block_read(&fb, &view))
+  {
+    warn_flags = check_new_read(&view, qmin, qmax, sf->path, warn_flags);
+    seq_read_copy_view(r1, &view);
+    read_func(r1, NULL, qoffset, 0, reader_ptr);
+    num_se_reads++;
+  }
+
+  fastq_block_close(&fb);
+
+  char num_se_reads_str[100];
+  ulong_to_str(num_se_reads, num_se_reads_str);
+  status("[seq] Loaded %s reads and 0 reads pairs (file: %s)",
+         num_se_reads_str, futil_inpath_str(sf->path));
+  return true;
+}
+
 void seq_parse_pe(const char *path1, const char *path2, uint8_t ascii_fq_offset,
                   read_t *r1, read_t *r2,
                   void (*read_func)(read_t *_r1, read_t *_r2,
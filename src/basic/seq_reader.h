@@ -44,6 +44,20 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
                       uint8_t qual_cutoff, uint8_t hp_cutoff,
                       size_t *search_start);
 
+// Find the next contig in one pass: same as seq_contig_start() followed by
+// seq_contig_end(). Returns the contig start, or seqlen (r->seq.end) if there
+// are no more kmers. Sets *contig_end to the index after the last good base
+// and *search_start to the offset to search for the next contig from.
+size_t seq_contig_next2(const char *seq, size_t seqlen,
+                        const char *qual, size_t quallen,
+                        size_t offset, size_t kmer_size,
+                        uint8_t qual_cutoff, uint8_t hp_cutoff,
+                        size_t *contig_end, size_t *search_start);
+
+size_t seq_contig_next(const read_t *r, size_t offset, size_t kmer_size,
+                       uint8_t qual_cutoff, uint8_t hp_cutoff,
+                       size_t *contig_end, size_t *search_start);
+
 void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
                      read_t *r1, read_t *r2,
                      void (*read_func)(read_t *_r1, read_t *_r2,
@@ -58,6 +72,18 @@ void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
                                        void *_ptr),
                      void *reader_ptr);
 
+// As seq_parse_se_sf() but parse a plain FASTQ file with the block parser
+// (see fastq_block.h), reading the file by path rather than through `sf`.
+// Returns false without reading if the file is not a plain four line FASTQ
+// file on disk.
+bool seq_parse_se_fastq_block(seq_file_t *sf, uint8_t ascii_fq_offset,
+                              read_t *r1,
+                              void (*read_func)(read_t *_r1, read_t *_r2,
+                                                uint8_t _qoffset1,
+                                                uint8_t _qoffset2,
+                                                void *_ptr),
+                              void *reader_ptr);
+
 void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
                               read_t *r1, read_t *r2,
                               void (*read_func)(read_t *_r1, read_t *_r2,
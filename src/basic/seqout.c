@@ -116,3 +116,28 @@ void seqout_print(SeqOutput *seqout, const read_t *r1, const read_t *r2)
     pthread_mutex_unlock(&seqout->lock_pe);
   }
 }
+
+static inline void seqout_gzwrite_buf(const StrBuf *sbuf, gzFile gzout)
+{
+  if(sbuf != NULL && sbuf->end > 0 &&
+     gzwrite(gzout, sbuf->b, sbuf->end) != (int)sbuf->end)
+  {
+    die("Cannot write sequence");
+  }
+}
+
+void seqout_print_bufs(SeqOutput *seqout, const StrBuf *se,
+                       const StrBuf *pe1, const StrBuf *pe2)
+{
+  if(se != NULL && se->end > 0) {
+    pthread_mutex_lock(&seqout->lock_se);
+    seqout_gzwrite_buf(se, seqout->gzout_se);
+    pthread_mutex_unlock(&seqout->lock_se);
+  }
+  if((pe1 != NULL && pe1->end > 0) || (pe2 != NULL && pe2->end > 0)) {
+    pthread_mutex_lock(&seqout->lock_pe);
+    seqout_gzwrite_buf(pe1, seqout->gzout_pe[0]);
+    seqout_gzwrite_buf(pe2, seqout->gzout_pe[1]);
+    pthread_mutex_unlock(&seqout->lock_pe);
+  }
+}
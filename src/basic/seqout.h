@@ -31,6 +31,12 @@ void seqout_close(SeqOutput *output, bool rm);
 
 void seqout_print(SeqOutput *output, const read_t *r1, const read_t *r2);
 
+// Write reads buffered with seqout_sbuf_read(), each buffer in one go.
+// `se` is written to <O>.fq.gz, `pe1` and `pe2` to <O>.{1,2}.fq.gz together so
+// pairs stay in step. Any buffer may be NULL or empty.
+void seqout_print_bufs(SeqOutput *output, const StrBuf *se,
+                       const StrBuf *pe1, const StrBuf *pe2);
+
 static inline void seqout_gzprint_read(const read_t *r, seq_format fmt, gzFile gzout)
 {
   int ret = 0;
@@ -61,6 +67,37 @@ static inline void seqout_print_read(const read_t *r, seq_format fmt, FILE *fout
   if(ret == -1) die("Cannot write sequence");
 }
 
+// Append a read to a buffer in the same format as seqout_gzprint_read()
+static inline void seqout_sbuf_read(const read_t *r, seq_format fmt,
+                                    StrBuf *sbuf)
+{
+  size_t i;
+  switch(fmt) {
+    case SEQ_FMT_PLAIN:
+      strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+      strbuf_append_char(sbuf, '\n');
+      break;
+    case SEQ_FMT_FASTA:
+      strbuf_append_char(sbuf, '>');
+      strbuf_append_strn(sbuf, r->name.b, r->name.end);
+      strbuf_append_char(sbuf, '\n');
+      strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+      strbuf_append_char(sbuf, '\n');
+      break;
+    case SEQ_FMT_FASTQ:
+      strbuf_append_char(sbuf, '@');
+      strbuf_append_strn(sbuf, r->name.b, r->name.end);
+      strbuf_append_char(sbuf, '\n');
+      strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+      strbuf_append_str(sbuf, "\n+\n");
+      strbuf_append_strn(sbuf, r->qual.b, MIN2(r->qual.end, r->seq.end));
+      for(i = r->qual.end; i < r->seq.end; i++) strbuf_append_char(sbuf, '.');
+      strbuf_append_char(sbuf, '\n');
+      break;
+    default: die("Invalid output format: %i", fmt);
+  }
+}
+
 static inline void seqout_print_strs(const char *name,
                                      const char *seq, size_t slen,
                                      const char *quals, size_t qlen,
@@ -0,0 +1,340 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE // fopencookie()
+#endif
+
+#include "global.h"
+#include "zstd_file.h"
+#include "file_util.h"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef USE_ZSTD
+  #include <zstd.h>
+#endif
+
+#define ZSTD_FILE_BUFSIZE (1<<20)
+
+static int zstd_level = ZSTD_FILE_DEFAULT_LEVEL;
+static size_t zstd_nthreads = 0;
+static char *zstd_dict_path = NULL;
+
+void zstd_file_set_level(int level) { zstd_level = level; }
+void zstd_file_set_threads(size_t nthreads) { zstd_nthreads = nthreads; }
+
+void zstd_file_set_dict(const char *path)
+{
+  free(zstd_dict_path);
+  zstd_dict_path = path ? strdup(path) : NULL;
+}
+
+bool zstd_file_is_path(const char *path)
+{
+  size_t len, extlen = strlen(ZSTD_FILE_EXT);
+  if(path == NULL || (len = strlen(path)) < extlen) return false;
+  return strcmp(path + len - extlen, ZSTD_FILE_EXT) == 0;
+}
+
+bool zstd_file_is_zstd(const char *path)
+{
+  uint8_t h[4];
+  if(path == NULL || strcmp(path,"-") == 0) return false;
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) return false;
+  size_t n = fread(h, 1, sizeof(h), fh);
+  fclose(fh);
+  return n == sizeof(h) &&
+         h[0] == 0x28 && h[1] == 0xb5 && h[2] == 0x2f && h[3] == 0xfd;
+}
+
+#if defined(USE_ZSTD) && defined(__GLIBC__)
+
+typedef struct
+{
+  char *path;
+  FILE *fh; // compressed file
+  bool writing, eof;
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+  ZSTD_inBuffer in; // reading: compressed bytes not yet decompressed
+  size_t last; // reading: last return value of ZSTD_decompressStream()
+  char *buf; // compressed bytes
+} ZstdFile;
+
+// Load the dictionary each time a file is opened, it is small
+static char* _zstd_load_dict(size_t *len)
+{
+  FILE *fh = fopen(zstd_dict_path, "r");
+  if(fh == NULL)
+    die("Cannot open zstd dictionary: %s [%s]", zstd_dict_path, strerror(errno));
+  size_t cap = 1<<16, n = 0, r;
+  char *dict = ctx_malloc(cap);
+  while((r = fread(dict+n, 1, cap-n, fh)) > 0) {
+    n += r;
+    if(n == cap) dict = ctx_realloc(dict, cap *= 2);
+  }
+  if(ferror(fh)) die("Cannot read zstd dictionary: %s", zstd_dict_path);
+  fclose(fh);
+  *len = n;
+  return dict;
+}
+
+static ssize_t _zstd_read(void *cookie, char *buf, size_t size)
+{
+  ZstdFile *zf = (ZstdFile*)cookie;
+  ZSTD_outBuffer out = {.dst = buf, .size = size, .pos = 0};
+
+  while(out.pos == 0 && !zf->eof)
+  {
+    if(zf->in.pos == zf->in.size) {
+      zf->in.size = fread(zf->buf, 1, ZSTD_FILE_BUFSIZE, zf->fh);
+      zf->in.pos = 0;
+      if(zf->in.size == 0) {
+        if(ferror(zf->fh)) return -1;
+        if(zf->last != 0) warn("Truncated zstd file: %s", zf->path);
+        zf->eof = true;
+        break;
+      }
+      ctx_stats_add(CTX_STAT_BYTES_IN, zf->in.size);
+    }
+    zf->last = ZSTD_decompressStream(zf->dctx, &out, &zf->in);
+    if(ZSTD_isError(zf->last)) {
+      warn("Cannot decompress: %s [%s]", zf->path, ZSTD_getErrorName(zf->last));
+      errno = EIO;
+      return -1;
+    }
+  }
+
+  return out.pos;
+}
+
+// Compress and write `size` bytes, or finish the frame if `end`
+static bool _zstd_compress(ZstdFile *zf, const char *buf, size_t size, bool end)
+{
+  ZSTD_inBuffer in = {.src = buf, .size = size, .pos = 0};
+  ZSTD_outBuffer out;
+  size_t rc;
+
+  do {
+    out = (ZSTD_outBuffer){.dst = zf->buf, .size = ZSTD_FILE_BUFSIZE, .pos = 0};
+    rc = ZSTD_compressStream2(zf->cctx, &out, &in,
+                              end ? ZSTD_e_end : ZSTD_e_continue);
+    if(ZSTD_isError(rc)) {
+      warn("Cannot compress: %s [%s]", zf->path, ZSTD_getErrorName(rc));
+      return false;
+    }
+    if(out.pos > 0 && fwrite(zf->buf, 1, out.pos, zf->fh) != out.pos)
+      return false;
+    ctx_stats_add(CTX_STAT_BYTES_OUT, out.pos);
+  } while(end ? rc != 0 : in.pos < in.size);
+
+  return true;
+}
+
+static ssize_t _zstd_write(void *cookie, const char *buf, size_t size)
+{
+  ZstdFile *zf = (ZstdFile*)cookie;
+  return _zstd_compress(zf, buf, size, false) ? (ssize_t)size : 0;
+}
+
+static int _zstd_close(void *cookie)
+{
+  ZstdFile *zf = (ZstdFile*)cookie;
+  bool err = false;
+
+  if(zf->writing) {
+    err = !_zstd_compress(zf, NULL, 0, true);
+    ZSTD_freeCCtx(zf->cctx);
+  }
+  else ZSTD_freeDCtx(zf->dctx);
+
+  err |= (fclose(zf->fh) != 0);
+  free(zf->path);
+  ctx_free(zf->buf);
+  ctx_free(zf);
+  return err ? -1 : 0;
+}
+
+FILE* zstd_file_fopen(const char *path, const char *mode)
+{
+  bool writing = (mode[0] == 'w');
+  if(!writing && mode[0] != 'r')
+    die("Cannot open zstd file with mode '%s': %s", mode, path);
+
+  ZstdFile *zf = ctx_calloc(1, sizeof(ZstdFile));
+  zf->path = strdup(path);
+  zf->writing = writing;
+  zf->buf = ctx_malloc(ZSTD_FILE_BUFSIZE);
+  zf->in.src = zf->buf;
+
+  if((zf->fh = fopen(path, writing ? "w" : "r")) == NULL)
+    die("Cannot open file: %s [%s]", futil_outpath_str(path), strerror(errno));
+
+  size_t rc, dictlen = 0;
+  char *dict = zstd_dict_path ? _zstd_load_dict(&dictlen) : NULL;
+
+  if(writing) {
+    if((zf->cctx = ZSTD_createCCtx()) == NULL) die("Out of memory");
+    rc = ZSTD_CCtx_setParameter(zf->cctx, ZSTD_c_compressionLevel, zstd_level);
+    if(ZSTD_isError(rc)) die("Bad zstd level %i: %s", zstd_level, path);
+    // Fails if libzstd was built without threads, then compress on this thread
+    if(zstd_nthreads > 0 &&
+       ZSTD_isError(ZSTD_CCtx_setParameter(zf->cctx, ZSTD_c_nbWorkers,
+                                           (int)zstd_nthreads))) {
+      warn("libzstd cannot compress with threads: %s", path);
+    }
+    if(dict && ZSTD_isError(ZSTD_CCtx_loadDictionary(zf->cctx, dict, dictlen)))
+      die("Cannot load zstd dictionary: %s", zstd_dict_path);
+  }
+  else {
+    if((zf->dctx = ZSTD_createDCtx()) == NULL) die("Out of memory");
+    if(dict && ZSTD_isError(ZSTD_DCtx_loadDictionary(zf->dctx, dict, dictlen)))
+      die("Cannot load zstd dictionary: %s", zstd_dict_path);
+  }
+
+  ctx_free(dict);
+
+  cookie_io_functions_t funcs = {.read = writing ? NULL : _zstd_read,
+                                 .write = writing ? _zstd_write : NULL,
+                                 .seek = NULL,
+                                 .close = _zstd_close};
+
+  FILE *fh = fopencookie(zf, writing ? "w" : "r", funcs);
+  if(fh == NULL) die("Cannot open zstd stream: %s", futil_outpath_str(path));
+  setvbuf(fh, NULL, _IOFBF, DEFAULT_IO_BUFSIZE);
+  return fh;
+}
+
+//
+// gzFile streams through a socket pair
+//
+
+typedef struct ZstdPipeStruct ZstdPipe;
+
+struct ZstdPipeStruct
+{
+  char *path;
+  FILE *fh; // zstd stream
+  int fd; // thread's end of the socket pair
+  bool writing;
+  gzFile gz;
+  pthread_t th;
+  ZstdPipe *next; // list of open pipes
+};
+
+static ZstdPipe *zstd_pipes = NULL;
+static pthread_mutex_t zstd_pipes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns false if the reader has gone away
+static bool send_all(int fd, const char *buf, size_t n)
+{
+  ssize_t w;
+  while(n > 0) {
+    w = send(fd, buf, n, MSG_NOSIGNAL);
+    if(w < 0 && errno == EINTR) continue;
+    if(w <= 0) return false;
+    buf += w; n -= w;
+  }
+  return true;
+}
+
+static void* _zstd_pipe_thread(void *arg)
+{
+  ZstdPipe *zp = (ZstdPipe*)arg;
+  char *buf = ctx_malloc(ZSTD_FILE_BUFSIZE);
+  ssize_t n;
+
+  if(zp->writing) {
+    while((n = recv(zp->fd, buf, ZSTD_FILE_BUFSIZE, 0)) != 0) {
+      if(n < 0 && errno == EINTR) continue;
+      if(n < 0) die("Cannot read from socket: %s [%s]", zp->path, strerror(errno));
+      if(fwrite(buf, 1, n, zp->fh) != (size_t)n)
+        die("Cannot write to file: %s", zp->path);
+    }
+    if(fclose(zp->fh) != 0) die("Cannot write to file: %s", zp->path);
+  }
+  else {
+    while((n = fread(buf, 1, ZSTD_FILE_BUFSIZE, zp->fh)) > 0 &&
+          send_all(zp->fd, buf, n)) {}
+    if(ferror(zp->fh)) die("Error decompressing file: %s", zp->path);
+    fclose(zp->fh);
+  }
+
+  close(zp->fd);
+  ctx_free(buf);
+  return NULL;
+}
+
+gzFile zstd_file_gzopen(const char *path, const char *mode)
+{
+  bool writing = (mode[0] == 'w');
+  FILE *fh = zstd_file_fopen(path, writing ? "w" : "r");
+
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    die("Cannot create socket pair: %s", strerror(errno));
+
+  ZstdPipe *zp = ctx_calloc(1, sizeof(ZstdPipe));
+  zp->path = strdup(path);
+  zp->fh = fh;
+  zp->fd = fds[1];
+  zp->writing = writing;
+
+  // Mode "wT" writes without a gzip wrapper, the thread compresses with zstd.
+  // Reading, zlib passes through input that has no gzip header.
+  if((zp->gz = gzdopen(fds[0], writing ? "wT" : "r")) == NULL)
+    die("Cannot open gzfile: %s", path);
+
+  int rc = pthread_create(&zp->th, NULL, _zstd_pipe_thread, zp);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+
+  pthread_mutex_lock(&zstd_pipes_lock);
+  zp->next = zstd_pipes;
+  zstd_pipes = zp;
+  pthread_mutex_unlock(&zstd_pipes_lock);
+
+  return zp->gz;
+}
+
+int zstd_file_gzclose(gzFile gz)
+{
+  ZstdPipe *zp, **ptr;
+  pthread_mutex_lock(&zstd_pipes_lock);
+  for(ptr = &zstd_pipes; *ptr != NULL && (*ptr)->gz != gz; ptr = &(*ptr)->next) {}
+  zp = *ptr;
+  if(zp != NULL) *ptr = zp->next;
+  pthread_mutex_unlock(&zstd_pipes_lock);
+
+  // Closing our end of the socket ends the thread
+  int ret = gzclose(gz);
+
+  if(zp != NULL) {
+    pthread_join(zp->th, NULL);
+    free(zp->path);
+    ctx_free(zp);
+  }
+
+  return ret;
+}
+
+#else
+
+FILE* zstd_file_fopen(const char *path, const char *mode)
+{
+  (void)mode;
+  die("Cannot open zstd file, rebuild with `make ZSTD=1`: %s", path);
+}
+
+gzFile zstd_file_gzopen(const char *path, const char *mode)
+{
+  (void)mode;
+  die("Cannot open zstd file, rebuild with `make ZSTD=1`: %s", path);
+}
+
+int zstd_file_gzclose(gzFile gz)
+{
+  return gzclose(gz);
+}
+
+#endif /* defined(USE_ZSTD) && defined(__GLIBC__) */
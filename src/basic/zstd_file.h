@@ -0,0 +1,51 @@
+#ifndef ZSTD_FILE_H_
+#define ZSTD_FILE_H_
+
+#include <zlib.h>
+
+//
+// Zstandard compressed text files (links, contigs, calls)
+//
+// Output files named *.zst are written with zstd instead of gzip, and input
+// files starting with the zstd magic number are decompressed whatever their
+// name. futil_fopen() and futil_gzopen() pick these streams automatically.
+//
+// FILE* streams are made with fopencookie(), as async_file.h does. gzFile
+// streams are fed through a socket pair by a thread, as seq_inflate.h does for
+// sequence files, with zlib passing the text through without a gzip wrapper.
+// Close gzFile streams with gzutil_fclose() or zstd_file_gzclose() so that all
+// output has been written once it returns.
+//
+// Frames are compressed by zstd's own worker threads (--zstd-threads) and may
+// use a dictionary trained on similar files (e.g. `zstd --train` on uncompressed
+// link files), which is also needed to read them back (--zstd-dict).
+//
+// Requires building with `make ZSTD=1`, otherwise opening zstd files calls
+// die().
+//
+
+#define ZSTD_FILE_EXT ".zst"
+#define ZSTD_FILE_DEFAULT_LEVEL 3
+
+// Compression level, number of compression threads (0 compresses on the
+// calling thread) and dictionary for reading and writing (NULL for none)
+void zstd_file_set_level(int level);
+void zstd_file_set_threads(size_t nthreads);
+void zstd_file_set_dict(const char *path);
+
+// Returns true if `path` ends with ZSTD_FILE_EXT
+bool zstd_file_is_path(const char *path);
+
+// Returns true if `path` starts with the zstd magic number
+bool zstd_file_is_zstd(const char *path);
+
+// mode is "r" or "w". Calls die() on error. Close with fclose().
+FILE* zstd_file_fopen(const char *path, const char *mode);
+
+// mode is "r" or "w". Calls die() on error. Close with zstd_file_gzclose().
+gzFile zstd_file_gzopen(const char *path, const char *mode);
+
+// Close any gzFile, waiting for zstd output to be written. Returns as gzclose()
+int zstd_file_gzclose(gzFile gz);
+
+#endif /* ZSTD_FILE_H_ */
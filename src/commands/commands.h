@@ -32,6 +32,11 @@ int ctx_dist_matrix(int argc, char **argv);
 int ctx_server(int argc, char **argv);
 int ctx_vcfcov(int argc, char **argv);
 int ctx_vcfgeno(int argc, char **argv);
+int ctx_pipeline(int argc, char **argv);
+int ctx_load(int argc, char **argv);
+int ctx_growk(int argc, char **argv);
+int ctx_unitigs2ctx(int argc, char **argv);
+int ctx_popstore(int argc, char **argv);
 
 // Experiments
 int ctx_exp_abc(int argc, char **argv);
@@ -65,6 +70,11 @@ extern const char dist_matrix_usage[];
 extern const char server_usage[];
 extern const char vcfcov_usage[];
 extern const char vcfgeno_usage[];
+extern const char pipeline_usage[];
+extern const char load_usage[];
+extern const char growk_usage[];
+extern const char unitigs2ctx_usage[];
+extern const char popstore_usage[];
 
 // Experiments
 extern const char exp_abc_usage[];
@@ -28,6 +28,14 @@ const char breakpoints_usage[] =
 "  -r, --minref <N>        Require <N> kmers at ref breakpoint [default: "QUOTE_VALUE(DEFAULT_MIN_REF_NKMERS)"]\n"
 "  -R, --maxref <N>        Stop after <N> kmers at ref breakpoint [default: "QUOTE_VALUE(DEFAULT_MAX_REF_NKMERS)"]\n"
 "  -E, --no-ref-edges      Don't load edges from the reference\n"
+"  -I, --index <in.koidx>  Load reference kmer index instead of --seq files\n"
+"  -S, --save-index <out>  Save reference kmer index for reuse with --index\n"
+"  -B, --max-fork-kmers <N> Defer ref kmers whose paths cache more than <N> kmers\n"
+"  -T, --max-fork-ms <ms>  Defer ref kmers that take longer than <ms> milliseconds\n"
+"  -D, --skip-deferred     Drop deferred ref kmers instead of calling them at the end\n"
+"\n"
+"  Deferred ref kmers are called once all others are done, shared between all\n"
+"  threads, so a few repeats don't hold up a thread.\n"
 "\n";
 
 static struct option longopts[] =
@@ -46,6 +54,11 @@ static struct option longopts[] =
   {"minref",       required_argument, NULL, 'r'},
   {"maxref",       required_argument, NULL, 'R'},
   {"no-ref-edges", no_argument,       NULL, 'E'},
+  {"index",        required_argument, NULL, 'I'},
+  {"save-index",   required_argument, NULL, 'S'},
+  {"max-fork-kmers", required_argument, NULL, 'B'},
+  {"max-fork-ms",  required_argument, NULL, 'T'},
+  {"skip-deferred", no_argument,      NULL, 'D'},
   {NULL, 0, NULL, 0}
 };
 
@@ -56,6 +69,9 @@ int ctx_breakpoints(int argc, char **argv)
   const char *output_file = NULL;
   size_t min_ref_flank = 0, max_ref_flank = 0;
   bool load_ref_edges = true; // by default load kmers and edges
+  size_t max_fork_kmers = 0, max_fork_ms = 0;
+  bool skip_deferred = false;
+  const char *index_path = NULL, *save_index_path = NULL;
 
   GPathReader tmp_gpfile;
   GPathFileBuffer gpfiles;
@@ -97,6 +113,11 @@ int ctx_breakpoints(int argc, char **argv)
         seq_file_ptr_buf_add(&sfilebuf, tmp_sfile);
         break;
       case 'E': cmd_check(load_ref_edges,cmd); load_ref_edges = false; break;
+      case 'I': cmd_check(!index_path, cmd); index_path = optarg; break;
+      case 'S': cmd_check(!save_index_path, cmd); save_index_path = optarg; break;
+      case 'B': cmd_check(!max_fork_kmers, cmd); max_fork_kmers = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'T': cmd_check(!max_fork_ms, cmd); max_fork_ms = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'D': cmd_check(!skip_deferred, cmd); skip_deferred = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -110,7 +131,15 @@ int ctx_breakpoints(int argc, char **argv)
   if(min_ref_flank == 0) min_ref_flank = DEFAULT_MIN_REF_NKMERS;
   if(max_ref_flank == 0) max_ref_flank = DEFAULT_MAX_REF_NKMERS;
 
-  if(sfilebuf.len == 0) cmd_print_usage("Require at least one --seq file");
+  if(skip_deferred && !max_fork_kmers && !max_fork_ms)
+    cmd_print_usage("--skip-deferred requires --max-fork-kmers or --max-fork-ms");
+
+  if(index_path != NULL && sfilebuf.len > 0)
+    cmd_print_usage("Cannot use --seq with --index");
+  if(index_path != NULL && save_index_path != NULL)
+    cmd_print_usage("Cannot use --save-index with --index");
+  if(index_path == NULL && sfilebuf.len == 0)
+    cmd_print_usage("Require at least one --seq file or an --index");
   if(optind == argc) cmd_print_usage("Require input graph files (.ctx)");
 
   //
@@ -132,8 +161,17 @@ int ctx_breakpoints(int argc, char **argv)
   // Get file sizes of sequence files
   //
   // set to -1 if we cannot calc
-  int64_t est_num_bases = seq_est_seq_bases(sfilebuf.b, sfilebuf.len);
-  if(est_num_bases < 0) {
+  KOIndexHeader kohdr;
+  int64_t est_num_bases;
+
+  if(index_path != NULL) {
+    kograph_load_header(index_path, &kohdr);
+    if(kohdr.kmer_size != gfiles[0].hdr.kmer_size)
+      die("Index kmer size %u does not match graph (%u): %s",
+          kohdr.kmer_size, gfiles[0].hdr.kmer_size, index_path);
+    est_num_bases = kohdr.nkmers;
+  }
+  else if((est_num_bases = seq_est_seq_bases(sfilebuf.b, sfilebuf.len)) < 0) {
     warn("Cannot get file sizes, using pipes");
     est_num_bases = memargs.num_kmers;
   }
@@ -148,9 +186,10 @@ int ctx_breakpoints(int argc, char **argv)
 
   // TODO: use threads in memory calculation
 
-  // kmer memory = Edges + paths + 1 bit per colour for in-colour
+  // kmer memory = Edges + paths + link orient/colour summary +
+  //               1 bit per colour for in-colour
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
-                  (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0) +
+                  (gpfiles.len > 0 ? sizeof(GPath*)*8 + 2 + ncols : 0) +
                   ncols +
                   sizeof(KONodeList) + sizeof(KOccur) + // see kmer_occur.h
                   8; // 1 byte per kmer for each base to load sequence files
@@ -186,7 +225,8 @@ int ctx_breakpoints(int argc, char **argv)
   //
   // Open output file
   //
-  gzFile gzout = futil_gzopen_create(output_file != NULL ? output_file : "-", "w");
+  // Threads write gzip blocks (see gzip_writer.h)
+  FILE *fout = futil_fopen_create(output_file != NULL ? output_file : "-", "w");
 
   //
   // Set up memory
@@ -205,6 +245,7 @@ int ctx_breakpoints(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -223,26 +264,65 @@ int ctx_breakpoints(int argc, char **argv)
   for(i = 0; i < gpfiles.len; i++)
     gpath_reader_load(&gpfiles.b[i], true, &db_graph);
 
+  // Let crawlers skip kmers without links in the orientation and colour
+  // they arrive in
+  gpath_store_build_summary(&db_graph.gpstore, nthreads);
+  gpath_store_build_col_summary(&db_graph.gpstore, nthreads);
+
   // Get array of sequence file paths
-  size_t num_seq_paths = sfilebuf.len;
+  size_t num_seq_paths = index_path != NULL ? 1 : sfilebuf.len;
   char **seq_paths = ctx_calloc(num_seq_paths, sizeof(char*));
-  for(i = 0; i < num_seq_paths; i++)
+  if(index_path != NULL) seq_paths[0] = strdup(index_path);
+  for(i = 0; i < sfilebuf.len; i++)
     seq_paths[i] = strdup(sfilebuf.b[i]->path);
 
-  //
-  // Load reference sequence into a read buffer
-  //
-  ReadBuffer rbuf;
-  read_buf_alloc(&rbuf, 1024);
-  seq_load_all_reads(sfilebuf.b, sfilebuf.len, &rbuf);
-
-  // Remove commas and colons from read names so we can print:
-  //   chr1:start1-end1,chr2:start2-end2...
-  for(i = 0; i < rbuf.len; i++) {
-    read_t *r = &rbuf.b[i];
-    seq_read_truncate_name(r); // strip fast[aq] comments (after whitespace)
-    string_char_replace(r->name.b, ',', '.'); // change , -> . in read name
-    string_char_replace(r->name.b, ':', ';'); // change : -> ; in read name
+  KOGraph kograph;
+
+  if(index_path != NULL) {
+    kograph = kograph_load(index_path, load_ref_edges, ncols-1,
+                           nthreads, &db_graph);
+  }
+  else {
+    //
+    // Load reference sequence into a read buffer
+    //
+    ReadBuffer rbuf;
+    read_buf_alloc(&rbuf, 1024);
+    seq_load_all_reads(sfilebuf.b, sfilebuf.len, &rbuf);
+
+    // Remove commas and colons from read names so we can print:
+    //   chr1:start1-end1,chr2:start2-end2...
+    for(i = 0; i < rbuf.len; i++) {
+      read_t *r = &rbuf.b[i];
+      seq_read_truncate_name(r); // strip fast[aq] comments (after whitespace)
+      string_char_replace(r->name.b, ',', '.'); // change , -> . in read name
+      string_char_replace(r->name.b, ':', ';'); // change : -> ; in read name
+    }
+
+    // Temporarily hide edges from kograph_create if we don't want to load edges
+    Edges *tmp_edges = db_graph.col_edges;
+    if(!load_ref_edges) db_graph.col_edges = NULL;
+
+    kograph = kograph_create(rbuf.b, rbuf.len, true, ncols-1,
+                             nthreads, &db_graph);
+
+    // Restore graph edges
+    db_graph.col_edges = tmp_edges;
+
+    if(save_index_path != NULL) {
+      FILE *fidx = futil_fopen_create(save_index_path, "w");
+      size_t nbytes = kograph_write(&kograph, rbuf.b, rbuf.len, &db_graph,
+                                    fidx, save_index_path);
+      char mem_str[50];
+      bytes_to_str(nbytes, 1, mem_str);
+      status("Saved reference kmer index (%s) to: %s",
+             mem_str, futil_outpath_str(save_index_path));
+      futil_fclose(fidx);
+    }
+
+    // Sequence is no longer needed, names are copied into kograph
+    for(i = 0; i < rbuf.len; i++) seq_read_dealloc(&rbuf.b[i]);
+    read_buf_dealloc(&rbuf);
   }
 
   // Create array of cJSON** from input files
@@ -250,16 +330,20 @@ int ctx_breakpoints(int argc, char **argv)
   for(i = 0; i < gpfiles.len; i++) hdrs[i] = gpfiles.b[i].json;
 
   // Call breakpoints. Put reference in last colour
+  GraphCrawlBudget budget = {.max_kmers = max_fork_kmers,
+                             .max_ns = max_fork_ms * 1000000UL};
+
   breakpoints_call(nthreads, ncols-1,
-                   gzout, output_file,
-                   rbuf.b, rbuf.len,
+                   fout, output_file,
+                   &kograph,
                    seq_paths, num_seq_paths,
                    load_ref_edges, min_ref_flank, max_ref_flank,
+                   &budget, skip_deferred,
                    hdrs, gpfiles.len,
                    &db_graph);
 
   // Finished: do clean up
-  gzclose(gzout);
+  futil_fclose(fout);
   ctx_free(hdrs);
 
   // Close input files
@@ -267,8 +351,7 @@ int ctx_breakpoints(int argc, char **argv)
     gpath_reader_close(&gpfiles.b[i]);
   gpfile_buf_dealloc(&gpfiles);
 
-  for(i = 0; i < rbuf.len; i++) seq_read_dealloc(&rbuf.b[i]);
-  read_buf_dealloc(&rbuf);
+  kograph_dealloc(&kograph);
 
   seq_file_ptr_buf_dealloc(&sfilebuf);
 
@@ -7,7 +7,12 @@
 #include "graphs_load.h"
 #include "gpath_reader.h"
 #include "gpath_checks.h"
+#include "db_unitig.h"
 #include "bubble_caller.h"
+#include "graph_snapshot.h"
+#include "zstd_file.h"
+
+#include <unistd.h> // ftruncate(), unlink()
 
 // Long flanks help us map calls
 // increasing allele length can be costly
@@ -34,9 +39,23 @@ const char bubbles_usage[] =
 "  -A, --max-allele <len>  Max bubble branch length in kmers [default: "QUOTE_VALUE(DEFAULT_MAX_ALLELE)"]\n"
 "  -F, --max-flank <len>   Max flank length in kmers [default: "QUOTE_VALUE(DEFAULT_MAX_FLANK)"]\n"
 "  -S, --keep-serial       Keep serial bubbles. Use if mapping is hard. Higher FP.\n"
+"  -C, --checkpoint <f>    Save graph+links to snapshot <f> and record progress.\n"
+"                          If <f> exists, resume from it (inputs are ignored).\n"
+"  -L, --relayout          Store kmers of each unitig next to each other in memory\n"
+"                          so walks read adjacent entries. Uses ~16 bytes per kmer.\n"
+"  -B, --max-fork-kmers <N> Defer forks that cache more than <N> kmers\n"
+"  -T, --max-fork-ms <ms>  Defer forks that take longer than <ms> milliseconds\n"
+"  -D, --skip-deferred     Drop deferred forks instead of calling them at the end\n"
 "\n"
 "  When loading link files with -p, use offset (e.g. 2:in.ctp) to specify\n"
 "  which colour to load the data into.\n"
+"\n"
+"  With --checkpoint, rerun the same command after being interrupted to carry\n"
+"  on where it stopped. <f> is removed when bubble calling finishes.\n"
+"\n"
+"  Forks in repeats can take millions of steps. With --max-fork-kmers or\n"
+"  --max-fork-ms, forks over the limit are put aside so the thread moves on,\n"
+"  then called once all other forks are done, shared between all threads.\n"
 "\n";
 
 static struct option longopts[] =
@@ -54,16 +73,145 @@ static struct option longopts[] =
   {"max-allele",   required_argument, NULL, 'A'},
   {"max-flank",    required_argument, NULL, 'F'},
   {"keep-serial",  required_argument, NULL, 'S'},
+  {"checkpoint",   required_argument, NULL, 'C'},
+  {"relayout",     no_argument,       NULL, 'L'},
+  {"max-fork-kmers", required_argument, NULL, 'B'},
+  {"max-fork-ms",  required_argument, NULL, 'T'},
+  {"skip-deferred", no_argument,      NULL, 'D'},
   {NULL, 0, NULL, 0}
 };
 
+// Open graphs, decide on memory, then load graphs and links
+static void bubbles_load_graph(char **graph_paths, size_t num_gfiles,
+                               GPathFileBuffer *gpfiles,
+                               const struct MemArgs *memargs, size_t nthreads,
+                               bool relayout,
+                               dBGraph *db_graph)
+{
+  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+  size_t i, ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+
+  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
+                           &ctx_max_kmers, &ctx_sum_kmers);
+
+  // Check graph + paths are compatible
+  graphs_gpaths_compatible(gfiles, num_gfiles, gpfiles->b, gpfiles->len, -1);
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem, path_mem, thread_mem;
+  char thread_mem_str[100];
+
+  // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col) +
+  // visitedfw/rv(2bits/thread) + link orient/colour summary (2+1bit/col)
+
+  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
+                  (gpfiles->len > 0 ? sizeof(GPath*)*8 + 2 + ncols : 0) +
+                  ncols + 2*nthreads;
+
+  // Copy of kmers in hashed slots and their hkeys
+  if(relayout) bits_per_kmer += HT_RELAYOUT_BYTES * 8;
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs->mem_to_use,
+                                        memargs->mem_to_use_set,
+                                        memargs->num_kmers,
+                                        memargs->num_kmers_set,
+                                        bits_per_kmer,
+                                        ctx_max_kmers, ctx_sum_kmers,
+                                        false, &graph_mem);
+
+  // Thread memory
+  thread_mem = roundup_bits2bytes(kmers_in_hash) * 2;
+  bytes_to_str(thread_mem * nthreads, 1, thread_mem_str);
+  status("[memory] (of which threads: %zu x %zu = %s)\n",
+          nthreads, thread_mem, thread_mem_str);
+
+  // Paths memory
+  size_t rem_mem = memargs->mem_to_use - MIN2(memargs->mem_to_use, graph_mem+thread_mem);
+  path_mem = gpath_reader_mem_req(gpfiles->b, gpfiles->len, ncols, rem_mem, false,
+                                  kmers_in_hash, false);
+
+  // Shift path store memory from graphs->paths
+  graph_mem -= sizeof(GPath*)*kmers_in_hash;
+  path_mem  += sizeof(GPath*)*kmers_in_hash;
+  cmd_print_mem(path_mem, "paths");
+
+  size_t total_mem = graph_mem + thread_mem + path_mem;
+  cmd_check_mem_limit(memargs->mem_to_use, total_mem);
+
+  // Allocate memory
+  db_graph_alloc(db_graph, gfiles[0].hdr.kmer_size, ncols, 1, kmers_in_hash,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL);
+
+  // Paths
+  gpath_reader_alloc_gpstore(gpfiles->b, gpfiles->len, path_mem, false, db_graph);
+
+  //
+  // Load graphs
+  //
+  GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
+  gprefs.nthreads = nthreads;
+  gprefs.empty_colours = true;
+
+  for(i = 0; i < num_gfiles; i++) {
+    graph_load(&gfiles[i], gprefs, NULL);
+    graph_file_close(&gfiles[i]);
+    gprefs.empty_colours = false;
+  }
+  ctx_free(gfiles);
+
+  hash_table_print_stats(&db_graph->ht);
+
+  // Load link files
+  for(i = 0; i < gpfiles->len; i++)
+    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS, db_graph);
+
+  // Graph no longer changes, put kmers of a unitig next to each other
+  if(relayout) {
+    uint8_t *visited = ctx_calloc(roundup_bits2bytes(db_graph->ht.capacity), 1);
+    db_unitigs_relayout(db_graph, nthreads, visited);
+    ctx_free(visited);
+  }
+}
+
+// Load graph and links from a snapshot and reopen the output where the
+// snapshot's progress marker says we stopped
+static FILE* bubbles_resume(const char *snapshot_path, const char *out_path,
+                            SnapshotProgress *progress, dBGraph *db_graph)
+{
+  status("Resuming from checkpoint: %s (input graph and link files ignored)",
+         snapshot_path);
+
+  graph_snapshot_load(snapshot_path, db_graph, progress);
+
+  if(strcmp(progress->cmd, SUBCMD) != 0)
+    die("Checkpoint was not written by "SUBCMD": %s", snapshot_path);
+  if(db_graph->num_edge_cols != 1 || db_graph->col_edges == NULL ||
+     db_graph->node_in_cols == NULL)
+    die("Checkpoint graph is missing edges or colours: %s", snapshot_path);
+
+  hash_table_print_stats(&db_graph->ht);
+
+  // Drop output written after the last checkpoint
+  FILE *fout = fopen(out_path, "r+");
+  if(fout == NULL) die("Cannot open output to resume: %s", out_path);
+  if(futil_get_file_size(out_path) < (off_t)progress->out_bytes ||
+     ftruncate(fileno(fout), progress->out_bytes) != 0 ||
+     fseeko(fout, progress->out_bytes, SEEK_SET) != 0)
+    die("Cannot resume output file: %s", out_path);
+
+  return fout;
+}
+
 int ctx_bubbles(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *out_path = NULL;
+  const char *out_path = NULL, *snapshot_path = NULL;
   size_t max_allele_len = 0, max_flank_len = 0;
-  bool remove_serial_bubbles = true;
+  bool remove_serial_bubbles = true, relayout = false, skip_deferred = false;
+  size_t max_fork_kmers = 0, max_fork_ms = 0;
 
   // List of haploid colours
   size_t *hapcols = NULL;
@@ -102,6 +250,11 @@ int ctx_bubbles(int argc, char **argv)
       case 'A': cmd_check(!max_allele_len, cmd); max_allele_len = cmd_uint32_nonzero(cmd, optarg); break;
       case 'F': cmd_check(!max_flank_len, cmd); max_flank_len = cmd_uint32_nonzero(cmd, optarg); break;
       case 'S': cmd_check(remove_serial_bubbles,cmd); remove_serial_bubbles = false; break;
+      case 'C': cmd_check(!snapshot_path, cmd); snapshot_path = optarg; break;
+      case 'L': cmd_check(!relayout, cmd); relayout = true; break;
+      case 'B': cmd_check(!max_fork_kmers, cmd); max_fork_kmers = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'T': cmd_check(!max_fork_ms, cmd); max_fork_ms = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'D': cmd_check(!skip_deferred, cmd); skip_deferred = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -116,27 +269,51 @@ int ctx_bubbles(int argc, char **argv)
   if(max_allele_len == 0) max_allele_len = DEFAULT_MAX_ALLELE;
   if(max_flank_len == 0) max_flank_len = DEFAULT_MAX_FLANK;
 
-  if(optind >= argc) cmd_print_usage("Require input graph files (.ctx)");
-
-  //
-  // Open graph files
-  //
-  const size_t num_gfiles = argc - optind;
-  char **graph_paths = argv + optind;
-  ctx_assert(num_gfiles > 0);
-
-  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
-  size_t i, ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+  bool resume = (snapshot_path != NULL && graph_snapshot_is_file(snapshot_path));
+
+  if(snapshot_path != NULL && strcmp(out_path, "-") == 0)
+    cmd_print_usage("--checkpoint requires an output file (-o)");
+  if(snapshot_path != NULL && zstd_file_is_path(out_path))
+    cmd_print_usage("Cannot use --checkpoint with zstd output (.zst)");
+  if(snapshot_path != NULL && relayout)
+    cmd_print_usage("Cannot use --relayout with --checkpoint");
+  if(skip_deferred && !max_fork_kmers && !max_fork_ms)
+    cmd_print_usage("--skip-deferred requires --max-fork-kmers or --max-fork-ms");
+  if(!resume && snapshot_path != NULL && futil_file_exists(snapshot_path))
+    die("Checkpoint file exists but is not a snapshot: %s", snapshot_path);
+  if(!resume && optind >= argc)
+    cmd_print_usage("Require input graph files (.ctx)");
+
+  size_t i;
+  dBGraph db_graph;
+  SnapshotProgress progress;
+  FILE *fout;
 
-  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
-                           &ctx_max_kmers, &ctx_sum_kmers);
+  if(resume) {
+    fout = bubbles_resume(snapshot_path, out_path, &progress, &db_graph);
+  }
+  else {
+    // Threads write gzip blocks (see gzip_writer.h)
+    fout = futil_fopen_create(out_path, "w");
+    bubbles_load_graph(argv + optind, argc - optind, &gpfiles, &memargs,
+                       nthreads, relayout, &db_graph);
+
+    if(snapshot_path != NULL) {
+      graph_snapshot_progress_init(&progress, SUBCMD);
+      graph_snapshot_save(snapshot_path, &db_graph, &progress);
+    }
+  }
 
-  // Check graph + paths are compatible
-  graphs_gpaths_compatible(gfiles, num_gfiles, gpfiles.b, gpfiles.len, -1);
+  // Let crawlers skip kmers without links in the orientation and colour
+  // they arrive in
+  gpath_store_build_summary(&db_graph.gpstore, nthreads);
+  gpath_store_build_col_summary(&db_graph.gpstore, nthreads);
 
   //
   // Check haploid colours are valid
   //
+  size_t ncols = db_graph.num_of_cols;
+
   if(hapcols_arg != NULL) {
     if((nhapcols = range_get_num(hapcols_arg, ncols)) < 0)
       die("Invalid haploid colour list: %s", hapcols_arg);
@@ -146,78 +323,6 @@ int ctx_bubbles(int argc, char **argv)
       die("Invalid haploid colour list: %s", hapcols_arg);
   }
 
-  //
-  // Decide on memory
-  //
-  size_t bits_per_kmer, kmers_in_hash, graph_mem, path_mem, thread_mem;
-  char thread_mem_str[100];
-
-  // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col) +
-  // visitedfw/rv(2bits/thread)
-
-  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
-                  (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0) +
-                  ncols + 2*nthreads;
-
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
-                                        memargs.mem_to_use_set,
-                                        memargs.num_kmers,
-                                        memargs.num_kmers_set,
-                                        bits_per_kmer,
-                                        ctx_max_kmers, ctx_sum_kmers,
-                                        false, &graph_mem);
-
-  // Thread memory
-  thread_mem = roundup_bits2bytes(kmers_in_hash) * 2;
-  bytes_to_str(thread_mem * nthreads, 1, thread_mem_str);
-  status("[memory] (of which threads: %zu x %zu = %s)\n",
-          nthreads, thread_mem, thread_mem_str);
-
-  // Paths memory
-  size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem+thread_mem);
-  path_mem = gpath_reader_mem_req(gpfiles.b, gpfiles.len, ncols, rem_mem, false,
-                                  kmers_in_hash, false);
-
-  // Shift path store memory from graphs->paths
-  graph_mem -= sizeof(GPath*)*kmers_in_hash;
-  path_mem  += sizeof(GPath*)*kmers_in_hash;
-  cmd_print_mem(path_mem, "paths");
-
-  size_t total_mem = graph_mem + thread_mem + path_mem;
-  cmd_check_mem_limit(memargs.mem_to_use, total_mem);
-
-  //
-  // Open output file
-  //
-  gzFile gzout = futil_gzopen_create(out_path, "w");
-
-  // Allocate memory
-  dBGraph db_graph;
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, ncols, 1, kmers_in_hash,
-                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL);
-
-  // Paths
-  gpath_reader_alloc_gpstore(gpfiles.b, gpfiles.len, path_mem, false, &db_graph);
-
-  //
-  // Load graphs
-  //
-  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
-  gprefs.empty_colours = true;
-
-  for(i = 0; i < num_gfiles; i++) {
-    graph_load(&gfiles[i], gprefs, NULL);
-    graph_file_close(&gfiles[i]);
-    gprefs.empty_colours = false;
-  }
-  ctx_free(gfiles);
-
-  hash_table_print_stats(&db_graph.ht);
-
-  // Load link files
-  for(i = 0; i < gpfiles.len; i++)
-    gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
-
   // Create array of cJSON** from input files
   cJSON **hdrs = ctx_malloc(gpfiles.len * sizeof(cJSON*));
   for(i = 0; i < gpfiles.len; i++) hdrs[i] = gpfiles.b[i].json;
@@ -227,17 +332,27 @@ int ctx_bubbles(int argc, char **argv)
                                    .max_flank_len = max_flank_len,
                                    .haploid_cols = hapcols,
                                    .nhaploid_cols = nhapcols,
-                                   .remove_serial_bubbles = remove_serial_bubbles};
+                                   .remove_serial_bubbles = remove_serial_bubbles,
+                                   .budget = {.max_kmers = max_fork_kmers,
+                                              .max_ns = max_fork_ms * 1000000UL},
+                                   .skip_deferred = skip_deferred};
 
   invoke_bubble_caller(nthreads, &call_prefs,
-                       gzout, out_path,
+                       fout, out_path,
                        hdrs, gpfiles.len,
+                       snapshot_path, snapshot_path ? &progress : NULL,
                        &db_graph);
 
   status("  saved to: %s\n", out_path);
-  gzclose(gzout);
+  futil_fclose(fout);
   ctx_free(hdrs);
 
+  if(snapshot_path != NULL) {
+    status("Removing checkpoint: %s", snapshot_path);
+    if(unlink(snapshot_path) != 0)
+      warn("Cannot remove checkpoint %s: %s", snapshot_path, strerror(errno));
+  }
+
   // Close input link files
   for(i = 0; i < gpfiles.len; i++)
     gpath_reader_close(&gpfiles.b[i]);
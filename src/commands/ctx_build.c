@@ -3,10 +3,17 @@
 #include "util.h"
 #include "file_util.h"
 #include "db_graph.h"
+#include "db_node.h"
 #include "graph_info.h"
+#include "graph_pass.h"
 #include "graphs_load.h"
 #include "graph_writer.h"
 #include "build_graph.h"
+#include "graph_shards.h"
+#include "graph_search.h"
+#include "seq_inflate.h"
+#include "infer_edges.h"
+#include "kmer_hll.h"
 
 #include "seq_file/seq_file.h"
 
@@ -32,18 +39,50 @@ const char build_usage[] =
 "  -H, --cut-hp <bp>        Breaks reads at homopolymers >= <bp> [default: off]\n"
 "  -p, --remove-pcr         Remove (or keep) PCR duplicate reads\n"
 "  -P, --keep-pcr           Don't do PCR duplicate removal [default]\n"
+"  -D, --pcr-mem <M>        Use M bytes of read start fingerprints for PCR\n"
+"                           duplicate removal, instead of 2 bits per kmer\n"
 "  -M, --matepair <orient>  Mate pair orientation: FF,FR,RF,RR [default: FR]\n"
 "                           (for --keep_pcr only)\n"
+"  -r, --region <chr:s-e>   Only load reads overlapping a region from indexed\n"
+"                           SAM/BAM/CRAM inputs (can specify multiple times)\n"
+"  -T, --cram-ref <ref.fa>  Reference used to decode CRAM inputs\n"
 "  -g, --graph <in.ctx>     Load samples from a graph file (.ctx)\n"
+"  -A, --append <in.ctx>    Add to an existing graph: load all of its samples,\n"
+"                           --sample <name> matching one of them adds reads to\n"
+"                           that sample. Must be first. (-f to overwrite in.ctx)\n"
 "  -I, --intersect <i.ctx>  Only load kmers that appear in i.ctx. Multiple -I\n"
 "                           graphs will be merged, not intersected. Treated as\n"
 "                           single colour graphs.\n"
 "  -S, --sort               Output a graph file ordered by kmer\n"
+"  -z, --compress           Write a block compressed graph (format version 7)\n"
+"  -c, --min-count <N>      Only load kmers seen at least N times in a sample.\n"
+"                           Uses a Bloom filter for first sightings, or exact\n"
+"                           counts per shard with --shards [default: 1]\n"
+"  -G, --grow               Double the hash table when it fills up instead of\n"
+"                           exiting. -m/-n give the starting size.\n"
+"  -X, --partitioned        Route kmers by minimizer to one partition per thread\n"
+"                           with no locking, then merge. Uses ~2x hash memory.\n"
+"  -R, --shard <i/N>        Only load kmers in shard i of N (1 <= i <= N), split\n"
+"                           by minimizer. Implies --partitioned. Build all N\n"
+"                           with --sort, then `join --sorted-merge 0:s1.ctx ...`\n"
+"  -N, --shards <N>         Write N sorted minimizer shards and a manifest to\n"
+"                           <out.shards>, loading one shard at a time. Reads are\n"
+"                           routed to N spill files next to the output first.\n"
+"                           Merge with `join --gather <out.shards>`.\n"
+"  -C, --colour-major       Store coverages and edges one colour after another,\n"
+"                           so per sample passes are sequential (-c with many\n"
+"                           samples)\n"
+"  -E, --infer-edges        Add all missing edges between kmers once built, same\n"
+"                           as `"CMD" inferedges --all`\n"
+"  -e, --estimate-kmers     Read inputs twice: first count distinct kmers with a\n"
+"                           HyperLogLog sketch, to size the hash table\n"
 "\n"
 "  Note: Argument must come before input file\n"
 "  PCR duplicate removal works by ignoring read (pairs) if (both) reads\n"
 "  start at the same k-mer as any previous read. Carried out per sample, not \n"
-"  per file. --sample <name> is required before sequence input can be loaded.\n"
+"  per file. With --pcr-mem, read pairs are duplicates if they match the first\n"
+"  k-mers of a previous pair. --sample <name> is required before sequence input\n"
+"  can be loaded.\n"
 "  Consecutive sequence options are loaded into the same colour.\n"
 "  --graph argument can have colours specifed e.g. in.ctx:0,6-8 will load\n"
 "  samples 0,6,7,8.  Graphs are loaded into new colours.\n"
@@ -62,17 +101,30 @@ static struct option longopts[] =
   {"kmer",         required_argument, NULL, 'k'},
   {"sample",       required_argument, NULL, 's'},
   {"sort",         no_argument,       NULL, 'S'},
+  {"compress",     no_argument,       NULL, 'z'},
+  {"partitioned",  no_argument,       NULL, 'X'},
+  {"shard",        required_argument, NULL, 'R'},
+  {"shards",       required_argument, NULL, 'N'},
+  {"grow",         no_argument,       NULL, 'G'},
+  {"colour-major", no_argument,       NULL, 'C'},
+  {"min-count",    required_argument, NULL, 'c'},
   {"seq",          required_argument, NULL, '1'},
   {"seq2",         required_argument, NULL, '2'},
   {"seqi",         required_argument, NULL, 'i'},
   {"matepair",     required_argument, NULL, 'M'},
+  {"region",       required_argument, NULL, 'r'},
+  {"cram-ref",     required_argument, NULL, 'T'},
   {"fq-cutoff",    required_argument, NULL, 'Q'},
   {"fq-offset",    required_argument, NULL, 'O'},
   {"cut-hp",       required_argument, NULL, 'H'},
   {"remove-pcr",   no_argument,       NULL, 'p'},
   {"keep-pcr",     no_argument,       NULL, 'P'},
+  {"pcr-mem",      required_argument, NULL, 'D'},
   {"graph",        required_argument, NULL, 'g'},
+  {"append",       required_argument, NULL, 'A'},
   {"intersect",    required_argument, NULL, 'I'},
+  {"infer-edges",  no_argument,       NULL, 'E'},
+  {"estimate-kmers", no_argument,     NULL, 'e'},
   {NULL, 0, NULL, 0}
 };
 
@@ -94,7 +146,18 @@ static struct MemArgs memargs = MEM_ARGS_INIT;
 static char *out_path = NULL;
 static size_t output_colours = 0, kmer_size = 0;
 
-static bool sort_kmers = false;
+static bool sort_kmers = false, partitioned = false, grow_graph = false;
+static bool colour_major = false, infer = false, estimate_kmers = false;
+static size_t shard = 0, nshards = 0; // --shard <shard+1>/<nshards>
+static size_t out_nshards = 0; // --shards <N>
+static size_t min_count = 0;
+static bool bloom_count = false; // use a Bloom filter to apply min_count
+static size_t pcr_mem = 0; // bytes for read start fingerprints, 0 if not used
+static const char *cram_ref = NULL; // --cram-ref <ref.fa>
+
+// --append: graph we are adding to, loaded into colours 0..append_ncols-1
+static const char *append_path = NULL;
+static size_t append_ncols = 0;
 
 static void add_task(BuildGraphTask *task)
 {
@@ -116,6 +179,20 @@ static void add_task(BuildGraphTask *task)
   }
 }
 
+// Returns colour of sample `sname` in the graph being appended to, or -1
+static int append_sample_colour(const char *sname)
+{
+  if(append_path == NULL) return -1;
+  const GraphFileReader *file = &gfilebuf.b[0];
+  size_t i, fromcol;
+  for(i = 0; i < file_filter_num(&file->fltr); i++) {
+    fromcol = file_filter_fromcol(&file->fltr, i);
+    if(strcmp(file->hdr.ginfo[fromcol].sample_name.b, sname) == 0)
+      return file_filter_intocol(&file->fltr, i);
+  }
+  return -1;
+}
+
 // Exit with error if bad sample name
 static void check_sample_name(const char *sname)
 {
@@ -130,6 +207,270 @@ static void check_sample_name(const char *sname)
   }
 }
 
+// Spill files are next to the output so they can be as large as the input.
+// They are unlinked once open, so are removed when closed.
+static FILE** spill_files_open(const char *path, size_t n)
+{
+  FILE **files = ctx_calloc(n, sizeof(FILE*));
+  StrBuf tmppath;
+  strbuf_alloc(&tmppath, strlen(path)+50);
+  size_t i;
+
+  for(i = 0; i < n; i++) {
+    strbuf_reset(&tmppath);
+    strbuf_sprintf(&tmppath, "%s.spill.%zu", path, i+1);
+    if((files[i] = fopen(tmppath.b, "w+")) == NULL)
+      die("Cannot write spill file: %s [%s]", tmppath.b, strerror(errno));
+    unlink(tmppath.b);
+  }
+
+  strbuf_dealloc(&tmppath);
+  return files;
+}
+
+// Load spilled kmers one shard at a time, writing out each shard as a sorted
+// graph with the header of the whole graph, then write the manifest
+typedef struct {
+  dBGraph *db_graph;
+  GraphFileSearch **searches; // [num_shards]
+  size_t num_shards;
+} ShardEdgesJob;
+
+// Delete edges to kmers in other shards that were removed or have no coverage
+// in the edge's colour
+static bool prune_cross_shard_edges(hkey_t hkey, size_t threadid, void *arg)
+{
+  (void)threadid;
+  const ShardEdgesJob *job = (const ShardEdgesJob*)arg;
+  dBGraph *db_graph = job->db_graph;
+  const size_t ncols = db_graph->num_of_cols;
+  BinaryKmer bkey = db_node_get_bkey(db_graph, hkey), next;
+  Edges union_edges = db_node_get_edges_union(db_graph, hkey), nedges[ncols];
+  Covg ncovgs[ncols];
+  Orientation orient;
+  Nucleotide nuc;
+  size_t col, s;
+
+  for(orient = 0; orient < 2; orient++) {
+    for(nuc = 0; nuc < 4; nuc++) {
+      if(!edges_has_edge(union_edges, nuc, orient)) continue;
+      next = bkmer_shift_add_last_nuc(bkey, orient, db_graph->kmer_size, nuc);
+      if(db_graph_find(db_graph, next).key != HASH_NOT_FOUND) continue;
+      next = binary_kmer_get_key(next, db_graph->kmer_size);
+      s = graph_shard_of_kmer(next, db_graph->kmer_size, job->num_shards);
+      if(!graph_search_find(job->searches[s], next, ncovgs, nedges))
+        memset(ncovgs, 0, sizeof(ncovgs));
+      for(col = 0; col < ncols; col++) {
+        if(ncovgs[col] == 0) {
+          db_node_edges(db_graph, hkey, col)
+            = edges_del_edge(db_node_edges(db_graph, hkey, col), nuc, orient);
+        }
+      }
+    }
+  }
+
+  db_graph_union_edges_update(db_graph, hkey);
+  return false; // keep iterating
+}
+
+// Kmers removed with --min-count in one shard may have edges to them from other
+// shards. Once all shards are saved, reload each one, check edges to kmers in
+// other shards against the shard files and save it again. Shards are replaced
+// by renaming, so the other shards' searches keep their files open.
+static void prune_shard_edges(dBGraph *db_graph, const GraphShards *shards,
+                              const GraphInfo *ginfo)
+{
+  const size_t ncols_used = db_graph->num_of_cols_used;
+  const size_t n = shards->num_shards;
+  GraphFileReader *files = ctx_calloc(n, sizeof(GraphFileReader));
+  GraphFileSearch **searches = ctx_calloc(n, sizeof(GraphFileSearch*));
+  GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
+  gprefs.nthreads = nthreads;
+  StrBuf tmp_path;
+  strbuf_alloc(&tmp_path, 1024);
+  size_t s, col;
+
+  for(s = 0; s < n; s++) {
+    graph_file_open2(&files[s], shards->paths[s], "r", true, 0);
+    searches[s] = graph_search_new(&files[s]);
+  }
+
+  ShardEdgesJob job = {.db_graph = db_graph, .searches = searches,
+                       .num_shards = n};
+
+  for(s = 0; s < n; s++) {
+    status("[build] Checking edges between shards %zu of %zu", s+1, n);
+    GraphFileReader file;
+    memset(&file, 0, sizeof(file));
+    graph_file_open2(&file, shards->paths[s], "r", true, 0);
+    graph_load(&file, gprefs, NULL);
+    graph_file_close(&file);
+
+    hash_table_iterate(&db_graph->ht, nthreads, prune_cross_shard_edges, &job);
+
+    for(col = 0; col < output_colours; col++)
+      graph_info_cpy(&db_graph->ginfo[col], &ginfo[col]);
+    db_graph->num_of_cols_used = ncols_used;
+
+    strbuf_sprintf(&tmp_path, "%s.tmp", shards->paths[s]);
+    graph_writer_save_mkhdr(tmp_path.b, db_graph, true, output_colours);
+    if(rename(tmp_path.b, shards->paths[s]) != 0) {
+      die("Cannot rename %s -> %s: %s", tmp_path.b, shards->paths[s],
+          strerror(errno));
+    }
+
+    db_graph_reset(db_graph);
+  }
+
+  for(s = 0; s < n; s++) {
+    graph_search_destroy(searches[s]);
+    graph_file_close(&files[s]);
+  }
+
+  for(col = 0; col < output_colours; col++)
+    graph_info_cpy(&db_graph->ginfo[col], &ginfo[col]);
+  db_graph->num_of_cols_used = ncols_used;
+
+  strbuf_dealloc(&tmp_path);
+  ctx_free(searches);
+  ctx_free(files);
+}
+
+static void save_shards(dBGraph *db_graph, BuildPartitions *bp, FILE **spill,
+                        const GraphShards *shards)
+{
+  const size_t ncols_used = db_graph->num_of_cols_used;
+  GraphInfo *ginfo = ctx_calloc(output_colours, sizeof(GraphInfo));
+  size_t s, col;
+
+  for(col = 0; col < output_colours; col++) {
+    graph_info_alloc(&ginfo[col]);
+    graph_info_cpy(&ginfo[col], &db_graph->ginfo[col]);
+  }
+
+  for(s = 0; s < shards->num_shards; s++) {
+    status("[build] Loading shard %zu of %zu", s+1, shards->num_shards);
+    build_partitions_load_spill(bp, spill[s], s, shards->num_shards, nthreads);
+    fclose(spill[s]);
+
+    // All of a kmer's sightings are in the same shard, so counts are exact.
+    // Edges to other shards are checked once all shards are saved.
+    if(min_count > 1) {
+      for(col = 0; col < ncols_used; col++)
+        db_graph_remove_low_covg_in_shard(db_graph, col, min_count, nthreads);
+      db_graph_remove_no_covg_kmers(db_graph, nthreads);
+    }
+
+    hash_table_print_stats(&db_graph->ht);
+    graph_writer_save_mkhdr(shards->paths[s], db_graph, true, output_colours);
+
+    // Wipe kmers, keep sample names and read stats
+    db_graph_reset(db_graph);
+    for(col = 0; col < output_colours; col++)
+      graph_info_cpy(&db_graph->ginfo[col], &ginfo[col]);
+    db_graph->num_of_cols_used = ncols_used;
+  }
+
+  if(min_count > 1 && shards->num_shards > 1)
+    prune_shard_edges(db_graph, shards, ginfo);
+
+  graph_shards_save(shards, out_path);
+
+  for(col = 0; col < output_colours; col++) graph_info_dealloc(&ginfo[col]);
+  ctx_free(ginfo);
+}
+
+static size_t _estimate_contig(const char *seq, size_t len, void *arg)
+{
+  kmer_hll_add_str_mt((KmerHLL*)arg, seq, len, kmer_size);
+  return 0;
+}
+
+// Stream all inputs through a HyperLogLog sketch to estimate the number of
+// distinct kmers, then reopen sequence inputs so they can be loaded
+static size_t estimate_input_kmers(BuildGraphTask *tasks, size_t ntasks)
+{
+  size_t i, start, end, est;
+  char est_str[50];
+  KmerHLL hll;
+  kmer_hll_alloc(&hll, KMER_HLL_BITS);
+
+  status("[build] Estimating number of kmers...");
+
+  for(i = 0; i < gfilebuf.len; i++) {
+    if(file_filter_isstdin(&gfilebuf.b[i].fltr))
+      cmd_print_usage("Cannot use --estimate-kmers when reading from STDIN");
+    kmer_hll_add_graph(&hll, &gfilebuf.b[i]);
+  }
+
+  for(i = 0; i < ntasks; i++) {
+    if(strcmp(tasks[i].files.file1->path,"-") == 0)
+      cmd_print_usage("Cannot use --estimate-kmers when reading from STDIN");
+  }
+
+  if(ntasks > 0)
+  {
+    // Reads are passed to the sketch instead of a graph. Mock up a graph for
+    // the read loading stats, and copy the tasks so their stats are unchanged
+    dBGraph tmp_graph;
+    db_graph_alloc(&tmp_graph, kmer_size, output_colours, 0, 1024, 0);
+
+    BuildGraphTask *tmp_tasks = ctx_calloc(ntasks, sizeof(BuildGraphTask));
+    void **args = ctx_calloc(ntasks, sizeof(void*));
+    memcpy(tmp_tasks, tasks, ntasks * sizeof(BuildGraphTask));
+
+    for(i = 0; i < ntasks; i++) {
+      tmp_tasks[i].prefs.remove_pcr_dups = false;
+      tmp_tasks[i].prefs.must_exist_in_graph = false;
+      tmp_tasks[i].stats = SEQ_LOADING_STATS_INIT;
+      args[i] = &hll;
+    }
+
+    for(start = 0; start < ntasks; start = end) {
+      end = MIN2(start+MAX_IO_THREADS, ntasks);
+      build_graph_func(&tmp_graph, tmp_tasks+start, end-start, nthreads,
+                       _estimate_contig, args+start);
+    }
+
+    for(i = 0; i < ntasks; i++) {
+      memcpy(&tasks[i].files, &tmp_tasks[i].files, sizeof(AsyncIOInput));
+      asyncio_task_reopen(&tasks[i].files);
+    }
+
+    ctx_free(tmp_tasks);
+    ctx_free(args);
+    db_graph_dealloc(&tmp_graph);
+  }
+
+  // Allow for ~3 standard errors
+  est = kmer_hll_estimate(&hll);
+  est += est / 32;
+  kmer_hll_dealloc(&hll);
+
+  status("[build] Estimated %s distinct kmers", ulong_to_str(est, est_str));
+  return est;
+}
+
+// Parse --shard <i/N>, 1 <= i <= N
+static void parse_shard(const char *cmd, const char *arg)
+{
+  char tmp[100];
+  const char *sep = strchr(arg, '/');
+  size_t i = 0, n = 0;
+  if(sep != NULL && (size_t)(sep-arg) < sizeof(tmp)) {
+    memcpy(tmp, arg, sep-arg);
+    tmp[sep-arg] = '\0';
+  }
+  if(sep == NULL || (size_t)(sep-arg) >= sizeof(tmp) ||
+     !parse_entire_size(tmp, &i) || !parse_entire_size(sep+1, &n) ||
+     i < 1 || i > n)
+  {
+    cmd_print_usage("%s <i/N> expects 1 <= i <= N: %s", cmd, arg);
+  }
+  shard = i-1;
+  nshards = n;
+}
+
 static void parse_args(int argc, char **argv)
 {
   BuildGraphTask task;
@@ -137,7 +478,7 @@ static void parse_args(int argc, char **argv)
   task.prefs = SEQ_LOADING_PREFS_INIT;
   task.stats = SEQ_LOADING_STATS_INIT;
   uint8_t fq_offset = 0;
-  int intocolour = -1;
+  int intocolour = -1, seqcolour = -1, appcol;
   GraphFileReader tmp_gfile;
 
   // Arg parsing
@@ -157,21 +498,38 @@ static void parse_args(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'k': cmd_check(!kmer_size,cmd); kmer_size = cmd_kmer_size(cmd, optarg); break;
       case 's':
-        intocolour++;
         check_sample_name(optarg);
-        sample_name_buf_add(&snamebuf, (SampleName){.colour = intocolour,
-                                                    .name = optarg});
-        sample_named = true;
+        if((appcol = append_sample_colour(optarg)) >= 0) {
+          status("[append] Adding to sample %i: %s", appcol, optarg);
+          seqcolour = appcol;
+        } else {
+          seqcolour = ++intocolour;
+          sample_name_buf_add(&snamebuf, (SampleName){.colour = intocolour,
+                                                      .name = optarg});
+          sample_named = true;
+        }
         break;
       case 'S': cmd_check(!sort_kmers,cmd); sort_kmers = true; break;
+      case 'X': cmd_check(!partitioned,cmd); partitioned = true; break;
+      case 'R': cmd_check(!nshards,cmd); parse_shard(cmd, optarg); break;
+      case 'N': cmd_check(!out_nshards,cmd); out_nshards = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'G': cmd_check(!grow_graph,cmd); grow_graph = true; break;
+      case 'C': cmd_check(!colour_major,cmd); colour_major = true; break;
+      case 'E': cmd_check(!infer,cmd); infer = true; break;
+      case 'e': cmd_check(!estimate_kmers,cmd); estimate_kmers = true; break;
+      case 'c': cmd_check(!min_count,cmd); min_count = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'z':
+        cmd_check(graph_writer_get_version() != CTX_GRAPH_FILEFORMAT_BLOCKS, cmd);
+        graph_writer_set_version(CTX_GRAPH_FILEFORMAT_BLOCKS);
+        break;
       case '1':
       case '2':
       case 'i':
         pref_unused = false;
-        if(!sample_named)
+        if(seqcolour < 0)
           cmd_print_usage("Please give sample name first [-s,--sample <name>]");
         asyncio_task_parse(&task.files, c, optarg, fq_offset, NULL);
-        task.prefs.colour = intocolour;
+        task.prefs.colour = seqcolour;
         add_task(&task);
         break;
       case 'M':
@@ -181,11 +539,18 @@ static void parse_args(int argc, char **argv)
         else if(!strcmp(optarg,"RR")) task.prefs.matedir = READPAIR_RR;
         else die("-M,--matepair <orient> must be one of: FF,FR,RF,RR");
         pref_unused = true; break;
+      case 'r': seq_inflate_add_region(optarg); break;
+      case 'T': cmd_check(!cram_ref,cmd); cram_ref = optarg; seq_inflate_set_cram_ref(optarg); break;
       case 'O': fq_offset = cmd_uint8(cmd, optarg); pref_unused = true; break;
       case 'Q': task.prefs.fq_cutoff = cmd_uint8(cmd, optarg); pref_unused = true; break;
       case 'H': task.prefs.hp_cutoff = cmd_uint8(cmd, optarg); pref_unused = true; break;
       case 'p': task.prefs.remove_pcr_dups = true; pref_unused = true; break;
       case 'P': task.prefs.remove_pcr_dups = false; pref_unused = true; break;
+      case 'D':
+        cmd_check(!pcr_mem,cmd);
+        pcr_mem = cmd_parse_arg_mem(cmd, optarg);
+        if(!pcr_mem) cmd_print_usage("%s cannot be zero", cmd);
+        break;
       case 'g':
         if(intocolour == -1) intocolour = 0;
         graph_file_reset(&tmp_gfile);
@@ -193,6 +558,18 @@ static void parse_args(int argc, char **argv)
         intocolour = MAX2((size_t)intocolour, file_filter_into_ncols(&tmp_gfile.fltr)-1);
         gfile_buf_push(&gfilebuf, &tmp_gfile, 1);
         sample_named = false;
+        seqcolour = -1;
+        break;
+      case 'A':
+        cmd_check(!append_path, cmd);
+        if(intocolour != -1 || gfilebuf.len > 0 || gtaskbuf.len > 0)
+          cmd_print_usage("%s must be given before other inputs", cmd);
+        append_path = optarg;
+        graph_file_reset(&tmp_gfile);
+        graph_file_open2(&tmp_gfile, optarg, "r", true, 0);
+        append_ncols = file_filter_into_ncols(&tmp_gfile.fltr);
+        intocolour = append_ncols-1;
+        gfile_buf_push(&gfilebuf, &tmp_gfile, 1);
         break;
       case 'I':
         graph_file_reset(&tmp_gfile);
@@ -212,6 +589,40 @@ static void parse_args(int argc, char **argv)
 
   // Defaults
   if(!nthreads) nthreads = DEFAULT_NTHREADS;
+  graph_writer_set_nthreads(nthreads);
+  if(!min_count) min_count = 1;
+
+  if(nshards && out_nshards)
+    cmd_print_usage("Cannot use --shard and --shards");
+
+  if(nshards || out_nshards) {
+    const char *opt = nshards ? "--shard" : "--shards";
+    size_t t;
+    if(nshards && min_count > 1)
+      cmd_print_usage("Cannot use --min-count and %s", opt);
+    if(grow_graph) cmd_print_usage("Cannot use --grow and %s", opt);
+    if(gfilebuf.len > 0)
+      cmd_print_usage("Cannot use --graph or --append with %s", opt);
+    if(gisecbuf.len > 0) cmd_print_usage("Cannot use --intersect and %s", opt);
+    // Neighbouring kmers may be in other shards
+    if(infer) cmd_print_usage("Cannot use --infer-edges and %s", opt);
+    // Read starts would be added to the graph, even if not in our shard
+    for(t = 0; t < gtaskbuf.len; t++)
+      if(gtaskbuf.b[t].prefs.remove_pcr_dups && !pcr_mem)
+        cmd_print_usage("--remove-pcr with %s requires --pcr-mem", opt);
+    partitioned = true;
+  }
+
+  // Shards are always sorted
+  if(out_nshards) sort_kmers = true;
+
+  if(min_count > 1 && partitioned && !out_nshards)
+    cmd_print_usage("Cannot use --min-count and --partitioned");
+  if(grow_graph && partitioned)
+    cmd_print_usage("Cannot use --grow and --partitioned");
+
+  // Spilled shards are counted exactly once loaded, without a Bloom filter
+  bloom_count = (min_count > 1 && !out_nshards);
 
   // Check that optind+1 == argc
   if(optind+1 > argc)
@@ -222,10 +633,15 @@ static void parse_args(int argc, char **argv)
   out_path = argv[optind];
   status("Saving graph to: %s", futil_outpath_str(out_path));
 
-  if(snamebuf.len == 0) cmd_print_usage("No inputs given");
+  if(snamebuf.len == 0 && (append_path == NULL || gtaskbuf.len == 0))
+    cmd_print_usage("No inputs given");
 
   if(pref_unused) cmd_print_usage("Arguments not given BEFORE sequence file");
 
+  // Take kmer size from the graph we are appending to
+  if(!kmer_size && append_path != NULL)
+    kmer_size = gfilebuf.b[0].hdr.kmer_size;
+
   if(!kmer_size) die("kmer size not set with -k <K>");
 
   // Check kmer size in graphs to load
@@ -239,6 +655,7 @@ static void parse_args(int argc, char **argv)
   }
 
   output_colours = intocolour + (sample_named ? 1 : 0);
+  output_colours = MAX2(output_colours, append_ncols);
 }
 
 
@@ -259,6 +676,10 @@ int ctx_build(int argc, char **argv)
   // Did any tasks require PCR duplicate removal
   for(i = 0; i < ntasks && !tasks[i].prefs.remove_pcr_dups; i++) {}
   bool remove_pcr_used = (i < ntasks);
+  bool pcr_fingerprints = remove_pcr_used && pcr_mem > 0;
+
+  if(pcr_mem && !remove_pcr_used)
+    warn("--pcr-mem given but no inputs use --remove-pcr");
 
   //
   // Print inputs
@@ -291,8 +712,14 @@ int ctx_build(int argc, char **argv)
   // Check if we are intersecting with graphs
   if(gisecbuf.len > 0)
   {
+    if(estimate_kmers)
+      cmd_print_usage("Cannot use --estimate-kmers and --intersect");
     if(remove_pcr_used)
       cmd_print_usage("Cannot use --remove-pcr and --intersect");
+    if(partitioned)
+      cmd_print_usage("Cannot use --partitioned and --intersect");
+    if(min_count > 1)
+      cmd_print_usage("Cannot use --min-count and --intersect");
 
     for(t = 0; t < ntasks; t++)
       tasks[t].prefs.must_exist_in_graph = true;
@@ -302,38 +729,70 @@ int ctx_build(int argc, char **argv)
       max_kmers += gisecbuf.b[i].num_of_kmers;
   }
 
+  // Count kmers instead of guessing from file sizes
+  if(estimate_kmers)
+  {
+    size_t phase = ctx_stats_phase_start("estimate_kmers");
+    max_kmers = estimate_input_kmers(tasks, ntasks);
+    ctx_stats_phase_end(phase);
+  }
+
   //
   // Decide on memory
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
-  // remove_pcr_dups requires a fw and rv bit per kmer
+  // remove_pcr_dups requires a fw and rv bit per kmer,
+  // unless using a fixed size table of read start fingerprints
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  (sizeof(Covg) + sizeof(Edges)) * 8 * output_colours +
+                  (sizeof(CovgStore) + sizeof(Edges)) * 8 * output_colours +
                   (gisecbuf.len > 0 ? sizeof(Edges)*8 : 0) +
-                  (remove_pcr_used ? 2 : 0) +
-                  (sort_kmers ? sizeof(hkey_t)*8 : 0);
+                  (remove_pcr_used && !pcr_fingerprints ? 2 : 0) +
+                  (sort_kmers ? sizeof(hkey_t)*8 : 0) +
+                  (partitioned ? BUILD_PART_BITS_PER_KMER : 0) +
+                  (bloom_count ? KMER_BLOOM_BITS_PER_KMER : 0);
+
+  size_t extra_mem = pcr_fingerprints ? pcr_mem : 0;
+  if(extra_mem >= memargs.mem_to_use)
+    cmd_print_usage("--pcr-mem must be less than --memory");
 
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use - extra_mem,
                                         memargs.mem_to_use_set,
                                         memargs.num_kmers,
                                         memargs.num_kmers_set,
                                         bits_per_kmer, 0, max_kmers,
                                         true, &graph_mem);
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem + extra_mem);
+
+  if(estimate_kmers && kmers_in_hash < max_kmers && !grow_graph)
+    warn("Hash table may be too small for estimated kmers (use -m or --grow)");
 
   //
   // Check output path
   //
   futil_create_output(out_path);
 
-  status("Writing %zu colour graph to %s\n", output_colours, futil_outpath_str(out_path));
+  // Shard graph files are written next to the manifest
+  GraphShards shards;
+  FILE **spill = NULL;
+  if(out_nshards) {
+    if(strcmp(out_path,"-") == 0)
+      cmd_print_usage("Cannot write --shards to STDOUT");
+    graph_shards_alloc(&shards, out_path, kmer_size, out_nshards);
+    for(i = 0; i < out_nshards; i++) futil_create_output(shards.paths[i]);
+    spill = spill_files_open(out_path, out_nshards);
+    status("Writing %zu colour graph in %zu shards to %s\n",
+           output_colours, out_nshards, out_path);
+  }
+  else
+    status("Writing %zu colour graph to %s\n", output_colours, futil_outpath_str(out_path));
 
   // Create db_graph
   dBGraph db_graph;
   int alloc_flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS |
-                    (remove_pcr_used ? DBG_ALLOC_READSTRT : 0);
+                    (remove_pcr_used && !pcr_fingerprints ? DBG_ALLOC_READSTRT : 0) |
+                    (colour_major ? DBG_ALLOC_COLMAJOR : 0);
 
   db_graph_alloc(&db_graph, kmer_size, output_colours, output_colours,
                  kmers_in_hash, alloc_flags);
@@ -344,11 +803,28 @@ int ctx_build(int argc, char **argv)
 
   hash_table_print_stats(&db_graph.ht);
 
+  // Kmers go into the bloom filter on first sighting
+  KmerBloom bloom;
+  if(bloom_count) {
+    kmer_bloom_alloc(&bloom, db_graph.ht.capacity * KMER_BLOOM_BITS_PER_KMER);
+    db_graph.bloom = &bloom;
+  }
+
+  // Fingerprints of read starts for PCR duplicate removal
+  ReadStartHash rshash;
+  if(pcr_fingerprints) {
+    read_start_hash_alloc(&rshash, pcr_mem);
+    db_graph.readstrt_hash = &rshash;
+  }
+
+  size_t phase = ctx_stats_phase_start("load_graphs");
+
   // Load intersection graphs
   if(gisecbuf.len > 0)
   {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
-    Covg *tmp_covgs = NULL;
+    gprefs.nthreads = nthreads;
+    CovgStore *tmp_covgs = NULL;
     SWAP(db_graph.col_covgs, tmp_covgs);
     SWAP(db_graph.col_edges, isec_edges); db_graph.num_edge_cols = 1;
     for(i = 0; i < gisecbuf.len; i++) {
@@ -366,6 +842,7 @@ int ctx_build(int argc, char **argv)
   if(gfilebuf.len > 0)
   {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.nthreads = nthreads;
     gprefs.must_exist_in_graph = (gisecbuf.len > 0);
     gprefs.must_exist_in_edges = isec_edges;
 
@@ -381,35 +858,104 @@ int ctx_build(int argc, char **argv)
     strbuf_set(&db_graph.ginfo[samples[i].colour].sample_name, samples[i].name);
   }
 
+  ctx_stats_phase_end(phase);
+
   size_t start, end, num_load, colour, prev_colour = 0;
 
-  // If we are using PCR duplicate removal,
+  // Partitions are reused for each colour
+  BuildPartitions partitions;
+  if(partitioned) build_partitions_alloc(&partitions, &db_graph, nthreads);
+  if(nshards) {
+    status("[build] Loading kmers in shard %zu of %zu", shard+1, nshards);
+    build_partitions_set_shard(&partitions, shard, nshards);
+  }
+  if(out_nshards) {
+    status("[build] Spilling kmers to %zu shards", out_nshards);
+    build_partitions_set_spill(&partitions, spill, out_nshards);
+  }
+
+  // Hash table can grow while loading sequence
+  if(grow_graph) db_graph_grow_alloc(&db_graph, nthreads);
+
+  phase = ctx_stats_phase_start("load_seq");
+
+  // If we are using PCR duplicate removal, partitions or a minimum count,
   // it's best to load one colour at a time
-  for(start = 0; start < ntasks; start = end, prev_colour = colour)
+  if(remove_pcr_used || partitioned || bloom_count)
   {
-    // Wipe read start bitfield
-    colour = tasks[start].prefs.colour;
-    if(remove_pcr_used)
+    for(start = 0; start < ntasks; start = end, prev_colour = colour)
     {
-      if(colour != prev_colour)
-        memset(db_graph.readstrt, 0, roundup_bits2bytes(db_graph.ht.capacity)*2);
+      // Wipe read start bitfield
+      colour = tasks[start].prefs.colour;
+      if(remove_pcr_used && colour != prev_colour) {
+        if(pcr_fingerprints) read_start_hash_reset(&rshash);
+        else memset(db_graph.readstrt, 0, roundup_bits2bytes(db_graph.ht.capacity)*2);
+      }
+      if(bloom_count && colour != prev_colour)
+        kmer_bloom_reset(&bloom);
 
       end = start+1;
       while(end < ntasks && end-start < MAX_IO_THREADS &&
             tasks[end].prefs.colour == colour) end++;
+
+      num_load = end-start;
+      if(partitioned)
+        build_graph_partitioned(&db_graph, &partitions, tasks+start, num_load, nthreads);
+      else
+        build_graph(&db_graph, tasks+start, num_load, nthreads);
+
+      // Kmers have been added on their second sighting, drop those below
+      // min_count once the colour has been loaded
+      if(bloom_count && min_count > 2 &&
+         (end == ntasks || tasks[end].prefs.colour != colour))
+        db_graph_remove_low_covg_in_col(&db_graph, colour, min_count, nthreads);
+
+      if(pcr_fingerprints && (end == ntasks || tasks[end].prefs.colour != colour))
+        read_start_hash_print_stats(&rshash);
     }
-    else {
-      end = MIN2(start+MAX_IO_THREADS, ntasks);
-    }
+  }
+  else {
+    // Samples are independent, so load them all at once into their colours
+    build_graph_scheduled(&db_graph, tasks, ntasks, nthreads);
+  }
 
-    num_load = end-start;
-    build_graph(&db_graph, tasks+start, num_load, nthreads);
+  ctx_stats_phase_end(phase);
+
+  if(out_nshards) {
+    phase = ctx_stats_phase_start("save_shards");
+    save_shards(&db_graph, &partitions, spill, &shards);
+    ctx_stats_phase_end(phase);
+    graph_shards_dealloc(&shards);
+    ctx_free(spill);
   }
 
-  // Remove kmers with no coverage
-  if(gisecbuf.len > 0) {
+  if(partitioned) build_partitions_dealloc(&partitions);
+  if(grow_graph) db_graph_grow_dealloc(&db_graph);
+
+  if(pcr_fingerprints) {
+    db_graph.readstrt_hash = NULL;
+    read_start_hash_dealloc(&rshash);
+  }
+
+  if(bloom_count) {
+    db_graph.bloom = NULL;
+    kmer_bloom_dealloc(&bloom);
     db_graph_remove_no_covg_kmers(&db_graph, nthreads);
-    db_graph_intersect_edges(&db_graph, nthreads, isec_edges);
+  }
+
+  // Remove kmers with no coverage and intersect edges in one sweep
+  if(gisecbuf.len > 0) {
+    GraphPass pass = {.remove_no_covg = true, .isec_edges = isec_edges};
+    graph_pass_run(&pass, &db_graph, nthreads);
+  }
+
+  if(infer) {
+    phase = ctx_stats_phase_start("infer_edges");
+    status("[build] Inferring all missing edges...");
+    size_t num_modified = infer_edges(nthreads, true, &db_graph);
+    char nstr[50];
+    status("[build] %s kmers had edges added", ulong_to_str(num_modified, nstr));
+    ctx_stats_phase_end(phase);
   }
 
   // Print stats for hash table
@@ -421,8 +967,12 @@ int ctx_build(int argc, char **argv)
     build_graph_task_destroy(&tasks[i]);
   }
 
-  status("Dumping graph...\n");
-  graph_writer_save_mkhdr(out_path, &db_graph, sort_kmers, output_colours);
+  if(!out_nshards) {
+    status("Dumping graph...\n");
+    phase = ctx_stats_phase_start("save");
+    graph_writer_save_mkhdr(out_path, &db_graph, sort_kmers, output_colours);
+    ctx_stats_phase_end(phase);
+  }
 
   build_graph_task_buf_dealloc(&gtaskbuf);
   gfile_buf_dealloc(&gfilebuf);
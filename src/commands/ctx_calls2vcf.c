@@ -11,6 +11,7 @@
 #include "aligned_call.h"
 #include "decomp_breakpoint.h"
 #include "decomp_bubble.h"
+#include "ref_cache.h"
 
 #include "htslib/sam.h"
 #include "seq-align/src/needleman_wunsch.h"
@@ -18,25 +19,33 @@
 #define DEFAULT_MIN_MAPQ 30 /* min MAPQ considered (bubble caller only) */
 #define DEFAULT_MAX_ALIGN 500 /* max path/bubble_branch length */
 #define DEFAULT_MAX_ALLELE 500 /* max ALT allele length */
+#define DEFAULT_SORT_WINDOW 10000 /* VCF records held to sort output */
+#define CALLS2VCF_BATCH_SIZE 4096 /* calls decomposed in parallel */
 
 #define SUBCMD "calls2vcf"
 
 const char calls2vcf_usage[] =
 "usage: "CMD" "SUBCMD" [options] <in.txt.gz> <ref.fa> [ref2.fa ...]\n"
+"       "CMD" "SUBCMD" [options] <in.txt.gz> <ref.cache>\n"
 "\n"
 "  Convert a bubble or breakpoint call file to VCF. If input is a bubble file\n"
-"  the --mapped <flanks.sam> argument is required.\n"
+"  the --mapped <flanks.sam> argument is required. The reference may be a\n"
+"  cache file saved with --save-ref, which is memory mapped instead of parsed.\n"
 "\n"
 "  -h, --help             This help message\n"
 "  -q, --quiet            Silence status output normally printed to STDERR\n"
 "  -f, --force            Overwrite output files\n"
 "  -o, --out <out.txt>    Save output graph file [default: STDOUT]\n"
 "  -O, --out-fmt <f>      Format vcf|vcfgz|bcf|ubcf\n"
+"  -t, --threads <T>      Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -W, --sort-window <N>  Hold <N> records to sort output by position, 0 to\n"
+"                         print in call order [default: "QUOTE_VALUE(DEFAULT_SORT_WINDOW)"]\n"
 "\n"
 "  -F, --flanks <in.bam>  Mapped flanks in SAM or BAM file (bubble caller only)\n"
 "  -Q, --min-mapq <Q>     Flank must map with MAPQ >= <Q> [default: "QUOTE_VALUE(DEFAULT_MIN_MAPQ)"]\n"
 "  -A, --max-align <M>    Max alignment attempted [default: "QUOTE_VALUE(DEFAULT_MAX_ALIGN)"]\n"
 "  -L, --max-allele <M>   Max allele length printed [default: "QUOTE_VALUE(DEFAULT_MAX_ALLELE)"]\n"
+"  -R, --save-ref <out>   Save reference FASTA as a cache file for later runs\n"
 "\n"
 "  Alignment scoring:\n"
 "  -m, --match <m>       [default:  1]\n"
@@ -52,12 +61,15 @@ static struct option longopts[] =
   {"out",          required_argument, NULL, 'o'},
   {"out-fmt",      required_argument, NULL, 'O'},
   {"force",        no_argument,       NULL, 'f'},
+  {"threads",      required_argument, NULL, 't'},
 // command specific
   {"flanks",       required_argument, NULL, 'F'},
   {"min-mapq",     required_argument, NULL, 'Q'},
   {"max-align",    required_argument, NULL, 'A'},
   {"max-allele",   required_argument, NULL, 'L'},
   {"max-diff",     required_argument, NULL, 'D'},
+  {"sort-window",  required_argument, NULL, 'W'},
+  {"save-ref",     required_argument, NULL, 'R'},
 // alignment
   {"match",        required_argument, NULL, 'm'},
   {"mismatch",     required_argument, NULL, 'M'},
@@ -105,6 +117,11 @@ static void print_acall_stats(const DecomposeStats *stats)
          ulong_to_str(stats->nvars_printed, n0),
          ulong_to_str(stats->nvars, n1),
          safe_percent(stats->nvars_printed, stats->nvars));
+  if(stats->nvars_unsorted) {
+    warn("%s / %s ALTs printed out of order, increase --sort-window or "
+         "sort the VCF", ulong_to_str(stats->nvars_unsorted, n0),
+         ulong_to_str(stats->nvars_printed, n1));
+  }
 }
 
 static void print_bubble_stats(const DecompBubbleStats *stats)
@@ -311,9 +328,111 @@ static void brkpnt_check_refs_match(cJSON *json,
   }
 }
 
+// One call in a batch
+typedef struct
+{
+  CallFileEntry centry;
+  bam1_t *mflank; // mapped 5' flank (bubble calls only)
+  StrBuf vcf; // VCF lines decomposed from this call
+} C2VCall;
+
+// Per thread aligners
+typedef struct
+{
+  AlignedCall *call;
+  CallDecomp *aligner;
+  DecompBubble *bubbles;
+  DecompBreakpoint *breakpoints;
+} C2VWorker;
+
+typedef struct
+{
+  C2VCall *calls;
+  size_t ncalls;
+  C2VWorker *workers;
+  size_t nthreads;
+  bool isbubble;
+  ChromHash *genome;
+  const bam_hdr_t *bam_hdr;
+  size_t kmer_size, min_mapq, num_samples, max_align_len, max_allele_len;
+  const char *kmer_str;
+  // Reader fills `next` while the batch is decomposed
+  gzFile gzin;
+  const char *in_path;
+  htsFile *samfh;
+  bam_hdr_t *bam_hdr_rd;
+  C2VCall *next;
+  size_t nnext;
+} C2VBatch;
+
+// Read the next batch of calls (and their mapped flanks), returns number read
+static size_t calls2vcf_read_batch(gzFile gzin, const char *in_path,
+                                   htsFile *samfh, bam_hdr_t *bam_hdr,
+                                   C2VCall *calls)
+{
+  size_t n;
+  for(n = 0; n < CALLS2VCF_BATCH_SIZE &&
+             call_file_read(gzin, in_path, &calls[n].centry); n++)
+  {
+    // Reuses the record's data buffer (incl. cigar) allocated by earlier reads
+    if(samfh != NULL) {
+      do {
+        if(sam_read1(samfh, bam_hdr, calls[n].mflank) < 0)
+          die("We've run out of SAM entries!");
+      } while(calls[n].mflank->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY));
+    }
+  }
+  return n;
+}
+
+// Align calls [start..end) of a batch, VCF lines are buffered in each call
+static bool calls2vcf_decompose(size_t start, size_t end, size_t threadid,
+                                void *arg)
+{
+  const C2VBatch *batch = (const C2VBatch*)arg;
+  C2VWorker *wrkr = &batch->workers[threadid];
+  AlignedCall *call = wrkr->call;
+  C2VCall *c2v;
+  size_t i;
+
+  for(i = start; i < end; i++) {
+    c2v = &batch->calls[i];
+    strbuf_reset(&call->info);
+    if(batch->isbubble) {
+      decomp_bubble_call(wrkr->bubbles, batch->genome, batch->kmer_size,
+                         batch->min_mapq, &c2v->centry, c2v->mflank,
+                         batch->bam_hdr, call);
+    } else {
+      decomp_brkpt_call(wrkr->breakpoints, batch->genome, batch->num_samples,
+                        &c2v->centry, call);
+    }
+    strbuf_append_str(&call->info, batch->kmer_str);
+    call_decomp_set_outbuf(wrkr->aligner, &c2v->vcf);
+    acall_decompose(wrkr->aligner, call,
+                    batch->max_align_len, batch->max_allele_len);
+  }
+
+  return false;
+}
+
+// Thread 0 reads the next batch, thread 1 decomposes the current batch
+static void calls2vcf_read_and_decompose(void *arg, size_t threadid)
+{
+  C2VBatch *batch = (C2VBatch*)arg;
+  if(threadid == 0) {
+    batch->nnext = calls2vcf_read_batch(batch->gzin, batch->in_path,
+                                        batch->samfh, batch->bam_hdr_rd,
+                                        batch->next);
+  } else {
+    util_run_ranges(batch->ncalls, 16, batch->nthreads,
+                    calls2vcf_decompose, batch);
+  }
+}
+
 int ctx_calls2vcf(int argc, char **argv)
 {
   const char *in_path = NULL, *out_path = NULL, *out_type = NULL;
+  size_t nthreads = 0, sort_window = SIZE_MAX;
   // Filtering parameters
   int32_t min_mapq = -1, max_align_len = -1, max_allele_len = -1;
   // Alignment parameters
@@ -323,6 +442,7 @@ int ctx_calls2vcf(int argc, char **argv)
   size_t nref_paths = 0;
   // flank file
   const char *sam_path = NULL;
+  const char *save_ref_path = NULL;
 
   //
   // Things we figure out by looking at the input
@@ -337,6 +457,8 @@ int ctx_calls2vcf(int argc, char **argv)
   // Hash map of chromosome name -> sequence
   ChromHash *genome;
   ReadBuffer chroms;
+  RefCache refcache;
+  bool use_refcache = false;
 
   // Arg parsing
   char cmd[100];
@@ -355,6 +477,9 @@ int ctx_calls2vcf(int argc, char **argv)
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
       case 'O': cmd_check(!out_type, cmd); out_type = optarg; break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'W': cmd_check(sort_window == SIZE_MAX, cmd); sort_window = cmd_uint32(cmd, optarg); break;
+      case 'R': cmd_check(!save_ref_path, cmd); save_ref_path = optarg; break;
       case 'F': cmd_check(!sam_path,cmd); sam_path = optarg; break;
       case 'Q': cmd_check(min_mapq < 0,cmd); min_mapq = cmd_uint32(cmd, optarg); break;
       case 'A': cmd_check(max_align_len  < 0,cmd); max_align_len  = cmd_uint32(cmd, optarg); break;
@@ -372,6 +497,8 @@ int ctx_calls2vcf(int argc, char **argv)
 
   // Defaults for unset values
   if(out_path == NULL) out_path = "-";
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+  if(sort_window == SIZE_MAX) sort_window = DEFAULT_SORT_WINDOW;
   if(max_align_len  < 0) max_align_len  = DEFAULT_MAX_ALIGN;
   if(max_allele_len < 0) max_allele_len = DEFAULT_MAX_ALLELE;
 
@@ -382,6 +509,10 @@ int ctx_calls2vcf(int argc, char **argv)
   ref_paths = (char const*const*)argv + optind;
   nref_paths = argc - optind;
 
+  use_refcache = (nref_paths == 1 && ref_cache_is_file(ref_paths[0]));
+  if(use_refcache && save_ref_path)
+    cmd_print_usage("Reference is already a cache file: %s", ref_paths[0]);
+
   // These functions call die() on error
   gzFile gzin = futil_gzopen(in_path, "r");
 
@@ -413,20 +544,23 @@ int ctx_calls2vcf(int argc, char **argv)
       cmd_print_usage("-Q,--min-mapq <Q> only valid with bubble calls");
   }
 
+  // BAM input and compressed VCF/BCF output share a pool of threads
+  htsThreadPool htspool;
+  vcf_misc_pool_alloc(&htspool, nthreads);
+
   // Open flank file if it exists
   htsFile *samfh = NULL;
   bam_hdr_t *bam_hdr = NULL;
-  bam1_t *mflank = NULL;
 
   if(sam_path)
   {
     if((samfh = hts_open(sam_path, "r")) == NULL)
       die("Cannot open SAM/BAM %s", sam_path);
+    vcf_misc_pool_attach(&htspool, samfh);
 
     // Load BAM header
     bam_hdr = sam_hdr_read(samfh);
     if(bam_hdr == NULL) die("Cannot load BAM header: %s", sam_path);
-    mflank = bam_init1();
   }
 
   // Output VCF has 0 samples if bubbles file, otherwise has N where N is
@@ -448,11 +582,17 @@ int ctx_calls2vcf(int argc, char **argv)
   int mode = vcf_misc_get_outtype(out_type, out_path);
   futil_create_output(out_path);
   htsFile *vcffh = hts_open(out_path, modes_htslib[mode]);
+  if(vcffh == NULL) die("Cannot open output: %s", futil_outpath_str(out_path));
+  vcf_misc_pool_attach(&htspool, vcffh);
 
   status("[calls2vcf] Reading %s call file with %zu samples",
          isbubble ? "Bubble" : "Breakpoint", num_graph_samples);
   status("[calls2vcf] %zu sample output to: %s format: %s",
          num_samples, futil_outpath_str(out_path), hsmodes_htslib[mode]);
+  status("[calls2vcf] Using %zu thread%s", nthreads, util_plural_str(nthreads));
+  if(sort_window) status("[calls2vcf] sorting output in a window of %zu records",
+                         sort_window);
+  else status("[calls2vcf] printing in call order");
 
   if(isbubble) status("[calls2vcf] min. MAPQ: %i", min_mapq);
   status("[calls2vcf] max alignment length: %i", max_align_len);
@@ -460,15 +600,29 @@ int ctx_calls2vcf(int argc, char **argv)
   status("[calls2vcf] alignment match:%i mismatch:%i gap open:%i extend:%i",
          nwmatch, nwmismatch, nwgapopen, nwgapextend);
 
-  // Load reference genome
+  // Load reference genome, chrom_hash_load() converts to upper case
   read_buf_alloc(&chroms, 1024);
-  genome = chrom_hash_init();
-  chrom_hash_load(ref_paths, nref_paths, &chroms, genome);
 
-  // convert to upper case
-  char *s;
-  for(i = 0; i < chroms.len; i++)
-    for(s = chroms.b[i].seq.b; *s; s++) *s = toupper(*s);
+  if(use_refcache) {
+    ref_cache_load(&refcache, ref_paths[0]);
+    genome = refcache.genome;
+    // Chromosomes point into the mapped file, they are not copied
+    read_buf_push(&chroms, refcache.chroms, refcache.nchroms);
+  }
+  else {
+    genome = chrom_hash_init();
+    chrom_hash_load(ref_paths, nref_paths, &chroms, genome);
+  }
+
+  if(save_ref_path) {
+    FILE *fref = futil_fopen_create(save_ref_path, "w");
+    size_t nbytes = ref_cache_write(chroms.b, chroms.len, fref, save_ref_path);
+    char mem_str[50];
+    bytes_to_str(nbytes, 1, mem_str);
+    status("Saved reference cache (%s) to: %s",
+           mem_str, futil_outpath_str(save_ref_path));
+    futil_fclose(fref);
+  }
 
   if(!isbubble) brkpnt_check_refs_match(json, genome, in_path);
 
@@ -478,98 +632,139 @@ int ctx_calls2vcf(int argc, char **argv)
 
   if(bcf_hdr_write(vcffh, vcfhdr) != 0) die("Cannot write VCF header");
 
-  AlignedCall *call = acall_init();
-  CallDecomp *aligner = call_decomp_init(vcffh, vcfhdr);
-
-  scoring_t *scoring = call_decomp_get_scoring(aligner);
-  scoring_init(scoring, nwmatch, nwmismatch, nwgapopen, nwgapextend,
-               false, false, 0, 0, 0, 0);
+  // Calls are read in batches and decomposed in parallel, while the next
+  // batch is read. VCF lines are buffered per call and passed to the writer
+  // in the order calls were read, which sorts them in a bounded window.
+  // Two batches of calls and their flank records are allocated once and
+  // swapped, so sam_read1() reuses their buffers.
+  CallDecomp *writer = call_decomp_init(vcffh, vcfhdr);
+  call_decomp_set_sort_window(writer, sort_window);
+  C2VWorker *workers = ctx_calloc(nthreads, sizeof(C2VWorker));
+  C2VCall *calls = ctx_calloc(2*CALLS2VCF_BATCH_SIZE, sizeof(C2VCall));
+  C2VCall *curr = calls, *next = calls + CALLS2VCF_BATCH_SIZE;
+  scoring_t *scoring;
+
+  for(i = 0; i < nthreads; i++) {
+    workers[i].call = acall_init();
+    workers[i].aligner = call_decomp_init(vcffh, vcfhdr);
+    scoring = call_decomp_get_scoring(workers[i].aligner);
+    scoring_init(scoring, nwmatch, nwmismatch, nwgapopen, nwgapextend,
+                 false, false, 0, 0, 0, 0);
+    if(isbubble) {
+      workers[i].bubbles = decomp_bubble_init();
+      // Set scoring for aligning 3' flank
+      scoring = decomp_bubble_get_scoring(workers[i].bubbles);
+      scoring_init(scoring, nwmatch, nwmismatch, nwgapopen, nwgapextend,
+                   true, true, 0, 0, 0, 0);
+    }
+    else workers[i].breakpoints = decomp_brkpt_init();
+  }
 
-  CallFileEntry centry;
-  call_file_entry_alloc(&centry);
+  for(i = 0; i < 2*CALLS2VCF_BATCH_SIZE; i++) {
+    call_file_entry_alloc(&calls[i].centry);
+    strbuf_alloc(&calls[i].vcf, 256);
+    if(isbubble) calls[i].mflank = bam_init1();
+  }
 
   char kmer_str[50];
   sprintf(kmer_str, ";K%zu", kmer_size);
 
-  if(isbubble)
+  C2VBatch batch = {.workers = workers, .nthreads = nthreads,
+                    .isbubble = isbubble,
+                    .genome = genome, .bam_hdr = bam_hdr,
+                    .kmer_size = kmer_size,
+                    .min_mapq = isbubble ? min_mapq : 0,
+                    .num_samples = num_samples,
+                    .max_align_len = max_align_len,
+                    .max_allele_len = max_allele_len,
+                    .kmer_str = kmer_str,
+                    .gzin = gzin, .in_path = in_path,
+                    .samfh = isbubble ? samfh : NULL, .bam_hdr_rd = bam_hdr};
+
+  size_t ncalls = calls2vcf_read_batch(gzin, in_path, batch.samfh, bam_hdr,
+                                       curr);
+
+  while(ncalls > 0)
   {
-    // Bubble calls
-    DecompBubble *bubbles = decomp_bubble_init();
-
-    // Set scoring for aligning 3' flank
-    scoring = decomp_bubble_get_scoring(bubbles);
-    scoring_init(scoring, nwmatch, nwmismatch, nwgapopen, nwgapextend,
-                 true, true, 0, 0, 0, 0);
+    batch.calls = curr;
+    batch.ncalls = ncalls;
+    batch.next = next;
+    batch.nnext = 0;
+
+    // Only read ahead if this batch did not reach the end of the input
+    if(ncalls == CALLS2VCF_BATCH_SIZE)
+      util_multi_thread(&batch, 2, calls2vcf_read_and_decompose);
+    else
+      util_run_ranges(ncalls, 16, nthreads, calls2vcf_decompose, &batch);
+
+    for(i = 0; i < ncalls; i++)
+      call_decomp_write(writer, &curr[i].vcf);
+
+    ncalls = batch.nnext;
+    SWAP(curr, next);
+  }
 
-    while(call_file_read(gzin, in_path, &centry)) {
-      do {
-        if(sam_read1(samfh, bam_hdr, mflank) < 0)
-          die("We've run out of SAM entries!");
-      } while(mflank->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY));
-
-      // Align call
-      strbuf_reset(&call->info);
-      decomp_bubble_call(bubbles, genome, kmer_size, min_mapq,
-                         &centry, mflank, bam_hdr, call);
-      strbuf_append_str(&call->info, kmer_str);
-      acall_decompose(aligner, call, max_align_len, max_allele_len);
-    }
+  call_decomp_flush(writer);
 
-    // print bubble stats
+  // Print stats
+  if(isbubble) {
     DecompBubbleStats *bub_stats = ctx_calloc(1, sizeof(*bub_stats));
-    decomp_bubble_cpy_stats(bub_stats, bubbles);
+    for(i = 0; i < nthreads; i++)
+      decomp_bubble_add_stats(bub_stats, workers[i].bubbles);
     print_bubble_stats(bub_stats);
     ctx_free(bub_stats);
-
-    decomp_bubble_destroy(bubbles);
   }
-  else
-  {
-    // Breakpoint calls
-    DecompBreakpoint *breakpoints = decomp_brkpt_init();
-
-    while(call_file_read(gzin, in_path, &centry)) {
-      strbuf_reset(&call->info);
-      decomp_brkpt_call(breakpoints, genome, num_samples, &centry, call);
-      strbuf_append_str(&call->info, kmer_str);
-      acall_decompose(aligner, call, max_align_len, max_allele_len);
-    }
-
-    // print bubble stats
+  else {
     DecompBreakpointStats *brk_stats = ctx_calloc(1, sizeof(*brk_stats));
-    decomp_brkpt_cpy_stats(brk_stats, breakpoints);
+    for(i = 0; i < nthreads; i++)
+      decomp_brkpt_add_stats(brk_stats, workers[i].breakpoints);
     print_breakpoint_stats(brk_stats);
     ctx_free(brk_stats);
-
-    decomp_brkpt_destroy(breakpoints);
   }
 
-  // Print stats
   DecomposeStats *astats = ctx_calloc(1, sizeof(*astats));
-  call_decomp_cpy_stats(astats, aligner);
+  for(i = 0; i < nthreads; i++)
+    call_decomp_add_stats(astats, workers[i].aligner);
+  call_decomp_add_stats(astats, writer); // out of order count
   print_acall_stats(astats);
   ctx_free(astats);
 
-  call_file_entry_dealloc(&centry);
-  call_decomp_destroy(aligner);
-  acall_destroy(call);
+  for(i = 0; i < 2*CALLS2VCF_BATCH_SIZE; i++) {
+    call_file_entry_dealloc(&calls[i].centry);
+    strbuf_dealloc(&calls[i].vcf);
+    if(isbubble) bam_destroy1(calls[i].mflank);
+  }
+  ctx_free(calls);
+
+  for(i = 0; i < nthreads; i++) {
+    acall_destroy(workers[i].call);
+    call_decomp_destroy(workers[i].aligner);
+    if(isbubble) decomp_bubble_destroy(workers[i].bubbles);
+    else decomp_brkpt_destroy(workers[i].breakpoints);
+  }
+  ctx_free(workers);
+  call_decomp_destroy(writer);
 
   // Finished - clean up
   cJSON_Delete(json);
-  gzclose(gzin);
+  gzutil_fclose(gzin);
 
   bcf_hdr_destroy(vcfhdr);
   hts_close(vcffh);
 
-  for(i = 0; i < chroms.len; i++) seq_read_dealloc(&chroms.b[i]);
+  if(use_refcache) ref_cache_close(&refcache);
+  else {
+    for(i = 0; i < chroms.len; i++) seq_read_dealloc(&chroms.b[i]);
+    chrom_hash_destroy(genome);
+  }
   read_buf_dealloc(&chroms);
-  chrom_hash_destroy(genome);
 
   if(sam_path) {
     hts_close(samfh);
     bam_hdr_destroy(bam_hdr);
-    bam_destroy1(mflank);
   }
 
+  vcf_misc_pool_dealloc(&htspool);
+
   return EXIT_SUCCESS;
 }
@@ -30,12 +30,19 @@ const char clean_usage[] =
 "  -T[L], --tips[=L]        Clip tips shorter than <L> kmers [default: auto]\n"
 "  -U[X], --unitigs[=X]     Remove low coverage unitigs with median cov < X [default: auto]\n"
 "  -B, --fallback <T>       Fall back threshold if we can't pick\n"
+"  -R, --tip-rounds <N>     Repeat tip clipping around removed nodes [default: 1]\n"
+"  -P, --per-colour         Remove unitigs from each colour they have low coverage\n"
+"                           in, rather than by coverage summed over colours.\n"
+"                           Auto thresholds are picked for each colour.\n"
 "\n"
 "  Statistics:\n"
 "  -c, --covg-before <out.csv> Save kmer coverage histogram before cleaning\n"
 "  -C, --covg-after <out.csv>  Save kmer coverage histogram after cleaning\n"
 "  -l, --len-before <out.csv>  Save unitig length histogram before cleaning\n"
 "  -L, --len-after <out.csv>   Save unitig length histogram after cleaning\n"
+"  -E, --estimate-only      Stream input graphs to print kmer coverage threshold\n"
+"                           for each colour without loading them. Only\n"
+"                           --covg-before may be used with this option.\n"
 "\n"
 "  --unitigs without a threshold, causes a calculated threshold to be used\n"
 "  Default: --tips 2*kmer_size --unitigs\n"
@@ -57,30 +64,67 @@ static struct option longopts[] =
   {"tips",         optional_argument, NULL, 'T'},
   {"unitigs",      optional_argument, NULL, 'U'},
   {"fallback",     required_argument, NULL, 'B'},
+  {"tip-rounds",   required_argument, NULL, 'R'},
+  {"per-colour",   no_argument,       NULL, 'P'},
 // output
   {"len-before",   required_argument, NULL, 'l'},
   {"len-after",    required_argument, NULL, 'L'},
   {"covg-before",  required_argument, NULL, 'c'},
   {"covg-after",   required_argument, NULL, 'C'},
+  {"estimate-only", no_argument,      NULL, 'E'},
   {NULL, 0, NULL, 0}
 };
 
+// Threshold for each colour for --per-colour. --unitigs=<X> is used for all
+// colours, otherwise one is picked for each colour, using --fallback <T> if
+// none is picked or it is lower. Colours without a threshold are not cleaned.
+static void pick_col_thresholds(size_t nthreads, int unitig_min,
+                                uint32_t fallback_thresh,
+                                const dBGraph *db_graph, size_t *col_thresholds)
+{
+  size_t col, ncols = db_graph->num_of_cols;
+
+  if(unitig_min >= 0) {
+    for(col = 0; col < ncols; col++) col_thresholds[col] = unitig_min;
+    return;
+  }
+
+  int *picked = ctx_calloc(ncols, sizeof(int));
+  cleaning_get_col_thresholds(nthreads, db_graph, picked);
+
+  for(col = 0; col < ncols; col++) {
+    if(fallback_thresh > 0 && picked[col] < (int)fallback_thresh) {
+      status("Colour %zu: using fallback threshold: %u", col, fallback_thresh);
+      picked[col] = fallback_thresh;
+    }
+    if(picked[col] < 0)
+      warn("Colour %zu: no cleaning threshold, not cleaning unitigs", col);
+    col_thresholds[col] = MAX2(picked[col], 0);
+  }
+
+  ctx_free(picked);
+}
+
 // Returns number of kmers in the hash table
 static size_t ctx_cleaning_memory(struct MemArgs memargs, bool use_mem_limit,
                                   uint64_t ctx_max_kmers, uint64_t ctx_sum_kmers,
                                   size_t file_ncols, size_t graph_ncols,
-                                  bool sort_kmers, size_t *graph_mem_ptr)
+                                  bool sort_kmers, bool per_colour,
+                                  size_t *graph_mem_ptr)
 {
   bool all_colours_loaded = (file_ncols <= graph_ncols);
 
   size_t bits_per_kmer, per_col_bits;
   size_t extra_edge_bits, sort_kmers_bits;
 
-  per_col_bits = (sizeof(Covg)+sizeof(Edges)) * 8;
+  per_col_bits = (sizeof(CovgStore)+sizeof(Edges)) * 8;
   // We need to store pop edges + sample edges if we haven't loaded all sample
   extra_edge_bits = (all_colours_loaded ? 0 : sizeof(Edges) * 8);
   sort_kmers_bits = (sort_kmers ? sizeof(hkey_t)*8 : 0);
 
+  // --per-colour marks removal with a bit per kmer per colour
+  if(per_colour) per_col_bits++;
+
   bits_per_kmer = sizeof(BinaryKmer)*8 +
                   per_col_bits * graph_ncols +
                   extra_edge_bits +
@@ -104,7 +148,7 @@ static size_t ctx_max_cols(struct MemArgs memargs, uint64_t ctx_max_kmers,
   size_t per_col_bits, extra_edge_bits, sort_kmers_bits, ncols;
 
   kmers_in_hash = ctx_max_kmers / IDEAL_OCCUPANCY;
-  per_col_bits = (sizeof(Covg)+sizeof(Edges)) * 8;
+  per_col_bits = (sizeof(CovgStore)+sizeof(Edges)) * 8;
   // We need to store pop edges + sample edges if we haven't loaded all sample
   extra_edge_bits = sizeof(Edges) * 8;
   sort_kmers_bits = (sort_kmers ? sizeof(hkey_t)*8 : 0);
@@ -138,9 +182,10 @@ int ctx_clean(int argc, char **argv)
   bool sort_kmers = false;
   int min_keep_tip = -1, unitig_min = -1; // <0 => default, 0 => noclean
   bool unitig_cleaning = false, tip_cleaning = false;
-  uint32_t fallback_thresh = 0;
+  uint32_t fallback_thresh = 0, tip_rounds = 0;
   const char *len_before_path = NULL, *len_after_path = NULL;
   const char *covg_before_path = NULL, *covg_after_path = NULL;
+  bool estimate_only = false, per_colour = false;
 
   // User specified ncols, input colours, how many colours choose to use
   size_t user_ncols = 0, file_ncols = 0, using_ncols = 0;
@@ -180,10 +225,13 @@ int ctx_clean(int argc, char **argv)
         unitig_cleaning = true;
         break;
       case 'B': cmd_check(!fallback_thresh, cmd); fallback_thresh = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'R': cmd_check(!tip_rounds, cmd); tip_rounds = cmd_uint32_nonzero(cmd, optarg); break;
       case 'l': cmd_check(!len_before_path, cmd); len_before_path = optarg; break;
       case 'L': cmd_check(!len_after_path, cmd); len_after_path = optarg; break;
       case 'c': cmd_check(!covg_before_path, cmd); covg_before_path = optarg; break;
       case 'C': cmd_check(!covg_after_path, cmd); covg_after_path = optarg; break;
+      case 'E': cmd_check(!estimate_only, cmd); estimate_only = true; break;
+      case 'P': cmd_check(!per_colour, cmd); per_colour = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -193,11 +241,17 @@ int ctx_clean(int argc, char **argv)
   }
 
   if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+  graph_writer_set_nthreads(nthreads);
 
   if(optind >= argc) cmd_print_usage("Please give input graph files");
 
   bool doing_cleaning = (unitig_cleaning || tip_cleaning);
 
+  if(estimate_only && (doing_cleaning || out_ctx_path || covg_after_path ||
+                       len_before_path || len_after_path || sort_kmers)) {
+    cmd_print_usage("--estimate-only only takes --covg-before <out.csv>");
+  }
+
   // set default cleaning
   if(!doing_cleaning && out_ctx_path != NULL) {
     unitig_cleaning = tip_cleaning = true;
@@ -225,6 +279,14 @@ int ctx_clean(int argc, char **argv)
   if(fallback_thresh && !unitig_cleaning)
     warn("-B, --fallback <T> without --unitigs");
 
+  if(tip_rounds > 1 && !tip_cleaning)
+    warn("-R, --tip-rounds <N> without --tips");
+
+  if(per_colour && !unitig_cleaning)
+    cmd_print_usage("-P, --per-colour requires --unitigs");
+
+  if(tip_rounds == 0) tip_rounds = 1;
+
   // Use remaining args as graph files
   char **gfile_paths = argv + optind;
   size_t i, j, num_gfiles = (size_t)(argc - optind);
@@ -238,6 +300,27 @@ int ctx_clean(int argc, char **argv)
 
   size_t kmer_size = gfiles[0].hdr.kmer_size;
 
+  // Pick thresholds from a kmer coverage histogram without loading the graph
+  if(estimate_only)
+  {
+    futil_create_output(covg_before_path);
+
+    int *col_thresholds = ctx_calloc(file_ncols, sizeof(int));
+    int est_min_covg = cleaning_estimate_threshold(gfiles, num_gfiles,
+                                                   file_ncols, nthreads,
+                                                   col_thresholds,
+                                                   covg_before_path);
+
+    if(est_min_covg < 0) status("Cannot find recommended cleaning threshold");
+    else status("Recommended cleaning threshold is: %i", est_min_covg);
+
+    ctx_free(col_thresholds);
+    for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
+    ctx_free(gfiles);
+
+    return EXIT_SUCCESS;
+  }
+
   // Flatten if we don't have to remember colours / output a graph
   if(out_ctx_path == NULL)
   {
@@ -284,12 +367,14 @@ int ctx_clean(int argc, char **argv)
   if(len_before_path != NULL)
     status("%zu. Saving unitig length distribution to: %s", step++, len_before_path);
   if(tip_cleaning)
-    status("%zu. Cleaning tips shorter than %i nodes", step++, min_keep_tip);
+    status("%zu. Cleaning tips shorter than %i nodes%s", step++, min_keep_tip,
+           tip_rounds > 1 ? " (repeated around removed nodes)" : "");
   if(unitig_cleaning) {
+    const char *in_cols = per_colour ? " in each colour" : "";
     if(unitig_min > 0)
-      status("%zu. Cleaning unitigs with coverage < %i", step++, unitig_min);
+      status("%zu. Cleaning unitigs with coverage < %i%s", step++, unitig_min, in_cols);
     if(unitig_min < 0)
-      status("%zu. Cleaning unitigs with auto-detected threshold", step++);
+      status("%zu. Cleaning unitigs with auto-detected threshold%s", step++, in_cols);
   }
   if(covg_after_path != NULL)
     status("%zu. Saving kmer coverage distribution to: %s", step++, covg_after_path);
@@ -309,10 +394,13 @@ int ctx_clean(int argc, char **argv)
     using_ncols = ctx_max_cols(memargs, ctx_max_kmers, file_ncols, sort_kmers);
 
   all_colours_loaded = (using_ncols == file_ncols);
+
+  if(per_colour && !all_colours_loaded)
+    die("--per-colour needs all %zu colours loaded (give more memory)", file_ncols);
   kmers_in_hash = ctx_cleaning_memory(memargs, use_mem_limit,
                                       ctx_max_kmers, ctx_sum_kmers,
                                       file_ncols, using_ncols,
-                                      sort_kmers, &graph_mem);
+                                      sort_kmers, per_colour, &graph_mem);
 
   char max_kmers_str[100];
   ulong_to_str(ctx_max_kmers, max_kmers_str);
@@ -347,6 +435,7 @@ int ctx_clean(int argc, char **argv)
 
   // Load graph into a single colour
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   // Construct cleaned graph header
   GraphFileHeader outhdr;
@@ -356,11 +445,12 @@ int ctx_clean(int argc, char **argv)
 
   if(!all_colours_loaded)
   {
-    db_graph.num_of_cols = db_graph.num_edge_cols = 1;
+    db_graph.num_of_cols = db_graph.num_edge_cols = db_graph.num_covg_cols = 1;
     SWAP(edges_union, db_graph.col_edges);
     graphs_load_files_flat(gfiles, num_gfiles, gprefs, NULL);
     SWAP(edges_union, db_graph.col_edges);
     db_graph.num_of_cols = db_graph.num_edge_cols = using_ncols;
+    db_graph.num_covg_cols = using_ncols;
   }
   else {
     for(i = 0; i < num_gfiles; i++)
@@ -377,27 +467,48 @@ int ctx_clean(int argc, char **argv)
   uint8_t *visited = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
   uint8_t *keep = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
 
-  // Always estimate cleaning threshold
-  // if(unitig_min <= 0 || covg_before_path || len_before_path)
-  // {
+  // If we were given a threshold, histograms before cleaning and the
+  // estimated threshold are collected by the cleaning pass itself,
+  // otherwise we need an extra pass over the graph to pick a threshold
+  bool fused = (doing_cleaning && unitig_min >= 0 && !per_colour);
+  int est_min_covg = -1;
+
+  if(!fused)
+  {
     // Get coverage distribution and estimate cleaning threshold
-    int est_min_covg = cleaning_get_threshold(nthreads,
-                                              covg_before_path,
-                                              len_before_path,
-                                              visited, &db_graph);
+    est_min_covg = cleaning_get_threshold(nthreads,
+                                          covg_before_path,
+                                          len_before_path,
+                                          visited, &db_graph);
 
     if(est_min_covg < 0) status("Cannot find recommended cleaning threshold");
     else status("Recommended cleaning threshold is: %i", est_min_covg);
 
     // Use estimated threshold if threshold not set
-    if(unitig_min < 0) {
+    if(unitig_min < 0 && !per_colour) {
       if(fallback_thresh > 0 && est_min_covg < (int)fallback_thresh) {
         status("Using fallback threshold: %i", fallback_thresh);
         unitig_min = fallback_thresh;
       }
       else if(est_min_covg >= 0) unitig_min = est_min_covg;
     }
-  // }
+  }
+
+  // Unitigs are cleaned colour by colour, tips on the whole graph after
+  size_t *col_thresholds = NULL;
+  if(per_colour) {
+    col_thresholds = ctx_calloc(using_ncols, sizeof(size_t));
+    pick_col_thresholds(nthreads, unitig_min, fallback_thresh,
+                        &db_graph, col_thresholds);
+    clean_graph_per_colour(nthreads, col_thresholds, visited, &db_graph);
+    unitig_min = 0;
+    if(!tip_cleaning || min_keep_tip == 0) {
+      tip_cleaning = false;
+      if(covg_after_path || len_after_path)
+        warn("--covg-after / --len-after are only saved with --per-colour if "
+             "tips are also cleaned");
+    }
+  }
 
   // Die if we failed to find suitable cleaning threshold
   if(unitig_min < 0)
@@ -407,16 +518,27 @@ int ctx_clean(int argc, char **argv)
   ctx_assert(unitig_min >= 0);
   ctx_assert(min_keep_tip >= 0);
 
-  if(unitig_cleaning || tip_cleaning)
+  if((unitig_cleaning && !per_colour) || tip_cleaning)
   {
     // Clean graph of tips (if min_keep_tip > 0) and unitigs (if threshold > 0)
-    clean_graph(nthreads, unitig_min, min_keep_tip,
-                covg_after_path, len_after_path,
-                visited, keep, &db_graph);
+    est_min_covg = clean_graph(nthreads, unitig_min, min_keep_tip, tip_rounds,
+                               fused ? covg_before_path : NULL,
+                               fused ? len_before_path : NULL,
+                               covg_after_path, len_after_path,
+                               visited, keep, &db_graph);
+
+    if(fused) {
+      if(est_min_covg < 0) status("Cannot find recommended cleaning threshold");
+      else status("Recommended cleaning threshold is: %i", est_min_covg);
+    }
   }
 
   ctx_free(visited);
   ctx_free(keep);
+  ctx_free(col_thresholds);
+
+  // Fewer empty slots to scan whilst writing
+  db_graph_compact(&db_graph, DBG_COMPACT_OCCUPANCY, nthreads);
 
   if(out_ctx_path != NULL)
   {
@@ -424,7 +546,8 @@ int ctx_clean(int argc, char **argv)
     for(col = 0; col < using_ncols; col++)
     {
       cleaning = &outhdr.ginfo[col].cleaning;
-      cleaning->cleaned_unitigs |= unitig_cleaning;
+      cleaning->cleaned_unitigs |= unitig_cleaning &&
+                                   (!per_colour || col_thresholds[col] > 0);
       cleaning->cleaned_tips |= tip_cleaning;
 
       // if(tip_cleaning) {
@@ -433,8 +556,8 @@ int ctx_clean(int argc, char **argv)
 
       if(unitig_cleaning) {
         size_t thresh = cleaning->clean_unitigs_thresh;
-        thresh = cleaning->cleaned_unitigs ? MAX2(thresh, (uint32_t)unitig_min)
-                                          : (uint32_t)unitig_min;
+        size_t new_thresh = per_colour ? col_thresholds[col] : (size_t)unitig_min;
+        thresh = cleaning->cleaned_unitigs ? MAX2(thresh, new_thresh) : new_thresh;
         cleaning->clean_unitigs_thresh = thresh;
 
         // char name_append[200];
@@ -455,7 +578,7 @@ int ctx_clean(int argc, char **argv)
     graph_writer_merge(out_ctx_path, gfiles, num_gfiles,
                        true, all_colours_loaded,
                        edges_union, &outhdr,
-                       sort_kmers, &db_graph);
+                       sort_kmers, nthreads, &db_graph);
   }
 
   ctx_check(hash_table_nkmers(&db_graph.ht) == hash_table_count_kmers(&db_graph.ht));
@@ -8,6 +8,8 @@
 #include "graphs_load.h"
 #include "gpath_reader.h"
 #include "gpath_checks.h"
+#include "unitig_graph.h"
+#include "db_unitig.h"
 
 const char contigs_usage[] =
 "usage: "CMD" contigs [options] <input.ctx> [in2.ctx ...]\n"
@@ -28,6 +30,16 @@ const char contigs_usage[] =
 "  -r, --reseed          Sample seed kmers with replacement\n"
 "  -R, --no-reseed       Do not use a seed kmer if it is used in a contig [default]\n"
 "  -P, --use-seed-paths  Use unused paths to seed contigs [default: off]\n"
+"  -U, --claim-unitigs   Threads claim unitigs, stop at one claimed by another\n"
+"                        contig. Avoids assembling the same contig twice.\n"
+"  -O, --sort            Number contigs in order of seed kmer. Holds contigs in\n"
+"                        memory until assembly has finished.\n"
+"  -X, --next-cache      Cache the next kmer of non-branching kmers so walks\n"
+"                        skip hash table lookups. Uses 16 bytes per kmer.\n"
+"  -L, --relayout        Store kmers of each unitig next to each other in memory\n"
+"                        so walks read adjacent entries. Uses ~16 bytes per kmer.\n"
+"  -a, --prefetch        Prefetch the next step of walks while taking this one,\n"
+"                        and the links of upcoming seeds\n"
 "  -G, --genome <G>      Genome size in bases\n"
 "  -C, --confid-cumul <C>   Halt if cumulative confidence is < C {0..1} [default: off]\n"
 "  -T, --confid-step <C>    Halt if single step confidence is < C {0..1} [default: off]\n"
@@ -51,6 +63,11 @@ static struct option longopts[] =
   {"reseed",       no_argument,       NULL, 'r'},
   {"no-reseed",    no_argument,       NULL, 'R'},
   {"use-seed-paths",no_argument,      NULL, 'P'},
+  {"claim-unitigs",no_argument,       NULL, 'U'},
+  {"sort",         no_argument,       NULL, 'O'},
+  {"next-cache",   no_argument,       NULL, 'X'},
+  {"relayout",     no_argument,       NULL, 'L'},
+  {"prefetch",     no_argument,       NULL, 'a'},
   {"ncontigs",     required_argument, NULL, 'N'},
   {"colour",       required_argument, NULL, 'c'},
   {"color",        required_argument, NULL, 'c'},
@@ -71,6 +88,9 @@ int ctx_contigs(int argc, char **argv)
   bool cmd_reseed = false, cmd_no_reseed = false; // -r, -R
   const char *conf_table_path = NULL; // save confidence table to here
   bool use_missing_info_check = true, seed_with_unused_paths = false;
+  bool claim_unitigs = false, sort_contigs = false, next_cache = false;
+  bool relayout = false;
+  bool prefetch = false;
   double min_step_confid = -1.0, min_cumul_confid = -1.0; // < 0 => no min
 
   // Read length and expected depth for calculating confidences
@@ -124,6 +144,11 @@ int ctx_contigs(int argc, char **argv)
       case 'S': cmd_check(!conf_table_path,cmd); conf_table_path = optarg; break;
       case 'M': cmd_check(use_missing_info_check,cmd); use_missing_info_check = false; break;
       case 'P': cmd_check(!seed_with_unused_paths,cmd); seed_with_unused_paths = true; break;
+      case 'U': cmd_check(!claim_unitigs,cmd); claim_unitigs = true; break;
+      case 'O': cmd_check(!sort_contigs,cmd); sort_contigs = true; break;
+      case 'X': cmd_check(!next_cache,cmd); next_cache = true; break;
+      case 'L': cmd_check(!relayout,cmd); relayout = true; break;
+      case 'a': cmd_check(!prefetch,cmd); prefetch = true; break;
       case 'C':
         cmd_check(min_cumul_confid < 0,cmd);
         min_cumul_confid = cmd_udouble(cmd,optarg);
@@ -147,6 +172,9 @@ int ctx_contigs(int argc, char **argv)
   if(contig_limit && seed_with_unused_paths)
     cmd_print_usage("Cannot combine --ncontigs with --use-seed-paths");
 
+  if(claim_unitigs && cmd_reseed)
+    cmd_print_usage("Cannot combine --claim-unitigs with --reseed");
+
   bool sample_with_replacement = cmd_reseed;
 
   // Defaults
@@ -199,6 +227,15 @@ int ctx_contigs(int argc, char **argv)
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 + sizeof(GPath*)*8 +
                   ncols + !sample_with_replacement;
 
+  // Unitig index and a claim per unitig (at most one unitig per kmer)
+  if(claim_unitigs) bits_per_kmer += UNITIG_INDEX_BITS_PER_KMER + 64;
+
+  // Next hkey in each orientation
+  if(next_cache) bits_per_kmer += 2 * sizeof(uint64_t) * 8;
+
+  // Copy of kmers in hashed slots and their hkeys
+  if(relayout) bits_per_kmer += HT_RELAYOUT_BYTES * 8;
+
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
                                         memargs.num_kmers,
@@ -265,6 +302,7 @@ int ctx_contigs(int argc, char **argv)
 
   // Load graph
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -283,16 +321,48 @@ int ctx_contigs(int argc, char **argv)
   }
   gpfile_buf_dealloc(&gpfiles);
 
+  // Graph no longer changes, put kmers of a unitig next to each other
+  if(relayout) {
+    uint8_t *relayout_visited = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
+    db_unitigs_relayout(&db_graph, nthreads, relayout_visited);
+    ctx_free(relayout_visited);
+  }
+
+  // Let walkers skip kmers without links in the orientation they arrive in
+  gpath_store_build_summary(&db_graph.gpstore, nthreads);
+
+  // Graph no longer changes, walkers can follow cached next kmers
+  if(next_cache) {
+    status("Caching next kmers of non-branching kmers...");
+    db_graph_next_cache_alloc(&db_graph, nthreads);
+  }
+
+  // Claimed unitigs replace the visited bitset
+  UnitigIndex uidx;
+  if(claim_unitigs) {
+    unitig_index_alloc(&uidx, &db_graph);
+    unitig_index_build(&uidx, nthreads, visited);
+    ctx_free(visited);
+    visited = NULL;
+  }
+
+  db_graph.prefetch_walks = prefetch;
+
   AssembleContigStats assem_stats;
   assemble_contigs_stats_init(&assem_stats);
 
+  size_t phase = ctx_stats_phase_start("assemble");
+
   assemble_contigs(nthreads, seed_buf.b, seed_buf.len,
                    contig_limit, visited,
                    use_missing_info_check, seed_with_unused_paths,
+                   claim_unitigs ? &uidx : NULL, sort_contigs,
                    min_step_confid, min_cumul_confid,
                    fout, out_path, &assem_stats, &conf_table,
                    &db_graph, 0); // Sample always loaded into colour zero
 
+  ctx_stats_phase_end(phase);
+
   if(fout && fout != stdout) fclose(fout);
 
   assemble_contigs_stats_print(&assem_stats);
@@ -305,6 +375,7 @@ int ctx_contigs(int argc, char **argv)
 
   seq_file_ptr_buf_dealloc(&seed_buf);
 
+  if(claim_unitigs) unitig_index_dealloc(&uidx);
   ctx_free(visited);
   db_graph_dealloc(&db_graph);
 
@@ -4,6 +4,8 @@
 #include "file_util.h"
 #include "db_graph.h"
 #include "graphs_load.h"
+#include "graph_search.h"
+#include "db_graph_disk.h"
 #include "gpath_reader.h"
 #include "gpath_checks.h"
 #include "correct_reads.h"
@@ -22,6 +24,12 @@ const char correct_usage[] =
 "  -n, --nkmers <N>         Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -p, --paths <in.ctp>     Load link file (can specify multiple times)\n"
+"  -K, --disk               Search sorted graph on disk, only keep kmers used\n"
+"                           in memory (uses -m/-n to limit memory)\n"
+"  -a, --prefetch           Prefetch the next step of walks while taking this one,\n"
+"                           and the links of each read's kmers\n"
+"  -U, --unitig-map         Place reads on unitigs by their minimizers instead of\n"
+"                           looking up every kmer (faster, uses more memory)\n"
 "\n"
 "  Input:\n"
 "  -1, --seq <in:out>       Correct reads (output: <out>.fa.gz)\n"
@@ -47,6 +55,8 @@ const char correct_usage[] =
 "  -P, --print-orig         Print original sequence in the read name ('orig=SEQ')\n"
 "  -g, --gap-hist <o.csv>   Save size distribution of sequence gaps bridged\n"
 "  -G, --frag-hist <o.csv>  Save size distribution of PE fragments\n"
+"  -R, --stats-sample <R>   Gap/fragment sizes from 1 in <R> reads, 1 for all\n"
+"                           [default: "QUOTE_VALUE(ALN_STATS_DEFAULT_SAMPLE)", 1 with -g/-G]\n"
 "  -C, --contig-hist <.csv> Save size distribution of assembled contigs\n"
 "\n"
 "  -c, --colour <col>       Sample graph colour to correct against\n"
@@ -65,6 +75,9 @@ static struct option longopts[] =
   {"threads",       required_argument, NULL, 't'},
   {"paths",         required_argument, NULL, 'p'},
   {"force",         no_argument,       NULL, 'f'},
+  {"disk",          no_argument,       NULL, 'K'},
+  {"prefetch",      no_argument,       NULL, 'a'},
+  {"unitig-map",    no_argument,       NULL, 'U'},
 // command specific
   {"seq",           required_argument, NULL, '1'},
   {"seq2",          required_argument, NULL, '2'},
@@ -88,6 +101,7 @@ static struct option longopts[] =
   {"print-orig",    no_argument,       NULL, 'P'},
   {"gap-hist",      required_argument, NULL, 'g'},
   {"frag-hist",     required_argument, NULL, 'G'},
+  {"stats-sample",  required_argument, NULL, 'R'},
   {"contig-hist",   required_argument, NULL, 'C'},
 
 //
@@ -132,13 +146,37 @@ int ctx_correct(int argc, char **argv)
                   (gpfiles->len > 0 ? sizeof(GPath*)*8 : 0) +
                   ncols; // in colour
 
-  kmers_in_hash = cmd_get_kmers_in_hash(args.memargs.mem_to_use,
-                                        args.memargs.mem_to_use_set,
-                                        args.memargs.num_kmers,
-                                        args.memargs.num_kmers_set,
-                                        bits_per_kmer,
-                                        ctx_num_kmers, ctx_num_kmers,
-                                        false, &graph_mem);
+  if(args.unitig_map) bits_per_kmer += READ_THREAD_UNITIG_MAP_BITS;
+
+  if(args.use_disk)
+  {
+    // Hash table only holds kmers with links and kmers we've looked up, so
+    // fill the memory left after links. 2 bits per kmer for loading from disk.
+    size_t ctp_max_kmers = 0, ctp_sum_kmers = 0, link_mem;
+    gpath_reader_count_kmers(gpfiles->b, gpfiles->len,
+                             &ctp_max_kmers, &ctp_sum_kmers);
+    link_mem = gpath_reader_sum_mem(gpfiles->b, gpfiles->len, ncols,
+                                    false, false, NULL, NULL, NULL);
+    bits_per_kmer += 2;
+    kmers_in_hash = cmd_get_kmers_in_hash(args.memargs.mem_to_use -
+                                            MIN2(args.memargs.mem_to_use, link_mem),
+                                          args.memargs.mem_to_use_set,
+                                          args.memargs.num_kmers,
+                                          args.memargs.num_kmers_set,
+                                          bits_per_kmer,
+                                          ctp_sum_kmers, ctx_num_kmers,
+                                          true, &graph_mem);
+  }
+  else
+  {
+    kmers_in_hash = cmd_get_kmers_in_hash(args.memargs.mem_to_use,
+                                          args.memargs.mem_to_use_set,
+                                          args.memargs.num_kmers,
+                                          args.memargs.num_kmers_set,
+                                          bits_per_kmer,
+                                          ctx_num_kmers, ctx_num_kmers,
+                                          false, &graph_mem);
+  }
 
   // Paths memory
   size_t rem_mem = args.memargs.mem_to_use - MIN2(args.memargs.mem_to_use, graph_mem);
@@ -185,7 +223,8 @@ int ctx_correct(int argc, char **argv)
 
   dBGraph db_graph;
   db_graph_alloc(&db_graph, gfile->hdr.kmer_size, ncols, 1, kmers_in_hash,
-                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL);
+                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL |
+                 (args.use_disk ? DBG_ALLOC_BKTLOCKS : 0));
 
   // Create a path store that does not tracks path counts
   gpath_reader_alloc_gpstore(gpfiles->b, gpfiles->len, path_mem, false, &db_graph);
@@ -194,27 +233,66 @@ int ctx_correct(int argc, char **argv)
   // Load Graph and link files
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = args.nthreads;
   gprefs.empty_colours = true;
 
-  // Load graph, print stats, close file
-  graph_load(gfile, gprefs, NULL);
-  hash_table_print_stats_brief(&db_graph.ht);
-  graph_file_close(gfile);
+  GraphFileSearch *gsearch = NULL;
+  dBGraphDisk disk;
+
+  if(args.use_disk) {
+    // Only load graph info, kmers are loaded from disk as they are used
+    graph_load_ginfo(&db_graph, gfile);
+    gsearch = graph_search_new(gfile);
+    db_graph_disk_alloc(&disk, gsearch, &db_graph);
+  }
+  else {
+    // Load graph, print stats, close file
+    graph_load(gfile, gprefs, NULL);
+    hash_table_print_stats_brief(&db_graph.ht);
+    graph_file_close(gfile);
+  }
 
   // Load link files
+  int link_flags = args.use_disk ? GPATH_ADD_MISSING_KMERS
+                                 : GPATH_DIE_MISSING_KMERS;
   for(i = 0; i < gpfiles->len; i++) {
-    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load(&gpfiles->b[i], link_flags, &db_graph);
     gpath_reader_close(&gpfiles->b[i]);
   }
 
+  // Let walkers skip kmers without links in the orientation they arrive in
+  gpath_store_build_summary(&db_graph.gpstore, args.nthreads);
+
+  db_graph.prefetch_walks = args.prefetch;
+
+  UnitigMap umap;
+  if(args.unitig_map) read_thread_unitig_map(&umap, &db_graph, args.nthreads);
+
   //
   // Run alignment
   //
+  size_t phase = ctx_stats_phase_start("correct");
+
   correct_reads(inputs->b, inputs->len,
                 args.dump_seq_sizes, args.dump_frag_sizes,
                 args.fq_zero, args.append_orig_seq,
                 args.nthreads, &db_graph);
 
+  ctx_stats_phase_end(phase);
+
+  if(args.use_disk) {
+    db_graph_disk_print_stats(&disk);
+    hash_table_print_stats_brief(&db_graph.ht);
+    db_graph_disk_dealloc(&disk, &db_graph);
+    graph_search_destroy(gsearch);
+    graph_file_close(gfile);
+  }
+
+  if(args.unitig_map) {
+    db_graph.umap = NULL;
+    unitig_map_dealloc(&umap);
+  }
+
   // Close and free output files
   for(i = 0; i < inputs->len; i++)
     seqout_close(&outputs[i], false);
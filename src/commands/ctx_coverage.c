@@ -2,13 +2,18 @@
 #include "commands.h"
 #include "file_util.h"
 #include "util.h"
+#include "range.h"
 #include "db_graph.h"
 #include "db_node.h"
 #include "seq_reader.h"
 #include "graphs_load.h"
+#include "graph_shm.h"
+#include "query_graph.h"
 
 const char coverage_usage[] =
 "usage: "CMD" coverage [options] <in.ctx> [in2.ctx ..]\n"
+"       "CMD" coverage [options] --graph-shm <name>\n"
+"       "CMD" coverage [options] --query-graph <in.ctx.qg>\n"
 "\n"
 "  Print contig coverage\n"
 "\n"
@@ -17,10 +22,24 @@ const char coverage_usage[] =
 "  -f, --force          Overwrite output files\n"
 "  -m, --memory <mem>   Memory to use (e.g. 1M, 20GB)\n"
 "  -n, --nkmers <N>     Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>    Number of threads to load with [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -e, --edges          Print edges as well. Uses hex encoding [TGCA|TGCA].\n"
 "  -E, --degree         Print edge degree: 00. 01/ 02[ 10\\ 11- 12{ 20] 21} 22X\n"
 "  -s, --seq <in>       Sequence file to get coverages for (can specify multiple times)\n"
 "  -o, --out <out.txt>  Save output [default: STDOUT]\n"
+"  -b, --binary         Write binary columns instead of text (see below)\n"
+"  -P, --presence <col> Only store whether kmers are in these colours (e.g. ref)\n"
+"                       which then have coverage 1 or 0. Saves memory.\n"
+"  -G, --graph-shm <name>\n"
+"                       Use a graph in shared memory instead of files (see load)\n"
+"  -Q, --query-graph <in.ctx.qg>\n"
+"                       Use a read-only query graph (see index --query)\n"
+"\n"
+"  Binary output is little endian. A header of 'CTXCOVG1' then uint32 ncols,\n"
+"  kmer size, edges flag (0/1). Then for each read: uint32 name length, name,\n"
+"  uint32 sequence length, sequence, uint32 nkmers, uint32 coverages colour by\n"
+"  colour ([col][kmer]), then if edges flag: uint8 edges in the same layout.\n"
+"  Kmers not in the graph have zero coverage and edges.\n"
 "\n";
 
 static struct option longopts[] =
@@ -31,11 +50,16 @@ static struct option longopts[] =
   {"force",        no_argument,       NULL, 'f'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
 // command specific
   {"edges",        no_argument,       NULL, 'e'},
   {"degrees",      no_argument,       NULL, 'E'},
   {"seq",          required_argument, NULL, '1'},
   {"seq",          required_argument, NULL, 's'},
+  {"binary",       no_argument,       NULL, 'b'},
+  {"presence",     required_argument, NULL, 'P'},
+  {"graph-shm",    required_argument, NULL, 'G'},
+  {"query-graph",  required_argument, NULL, 'Q'},
   {NULL, 0, NULL, 0}
 };
 
@@ -43,21 +67,42 @@ static struct option longopts[] =
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(covg_buf,  CovgBuffer,  Covg);
 madcrow_buffer(edges_buf, EdgesBuffer, Edges);
+madcrow_buffer(bkmer_buf, BinaryKmerBuffer, BinaryKmer);
+madcrow_buffer(hkey_buf,  HKeyBuffer, hkey_t);
+madcrow_buffer(qidx_buf,  QIdxBuffer, uint64_t);
+madcrow_buffer(orient_buf, OrientBuffer, uint8_t);
+
+#define COVG_BIN_MAGIC "CTXCOVG1"
+
+// Graph to look kmers up in: a loaded graph or a query graph
+typedef struct
+{
+  const dBGraph *db_graph; // NULL if qgraph is used
+  const QueryGraph *qgraph;
+  size_t kmer_size, ncols, nedgecols; // nedgecols is zero without edges
+} CovgGraph;
+
+// Per read coverages and edges are stored colour by colour: [col*nkmers+i]
+typedef struct
+{
+  CovgBuffer covgs;
+  EdgesBuffer edges;
+  // kmers of the current contig
+  BinaryKmerBuffer bkeys;
+  HKeyBuffer hkeys;
+  QIdxBuffer qidxs;
+  OrientBuffer orients;
+  Covg *nodecovgs; // [ncols]
+  Edges *nodeedges; // [ncols]
+  StrBuf sbuf; // text output for one read
+} ReadCovgBuffers;
 
 // [c]AGG[t]
 // [a]CCT[g]
-static inline void fetch_node_edges(const dBGraph *db_graph, dBNode node,
-                                    Edges *dst)
+static inline Edges orient_edges(Edges e, Orientation orient)
 {
-  size_t i, ncols = db_graph->num_edge_cols;
-  const Edges *edges = &db_node_edges(db_graph, node.key, 0);
-  memcpy(dst, edges, ncols * sizeof(Edges));
-  if(node.orient == REVERSE) {
-    for(i = 0; i < ncols; i++) {
-      // dst[i] = rev_nibble_lookup(dst[i]>>4) | (rev_nibble_lookup(dst[i]&0xf)<<4);
-      dst[i] = (dst[i]>>4) | (dst[i]<<4);
-    }
-  }
+  // rev_nibble_lookup(e>>4) | (rev_nibble_lookup(e&0xf)<<4);
+  return orient == REVERSE ? (Edges)((e>>4) | (e<<4)) : e;
 }
 
 // Print in/outdegree - For debugging mostly
@@ -65,61 +110,107 @@ static inline void fetch_node_edges(const dBGraph *db_graph, dBNode node,
 // 00: . 01: / 02: [
 // 10: \ 11: - 12: {
 // 20: ] 21: } 22: X
-static inline
-void _print_edge_degrees(const Edges *edges, size_t col, size_t ncols,
-                         size_t num, FILE *fout)
+static inline void _sbuf_edge_degrees(const Edges *edges, size_t num,
+                                      StrBuf *sbuf)
 {
   size_t i, indegree, outdegree;
   const char symbols[3][3] = {"./[", "\\-{", "]}X"};
+  strbuf_ensure_capacity(sbuf, sbuf->end + num + 1);
   for(i = 0; i < num; i++) {
-    indegree  = MIN2(edges_get_indegree(edges[i*ncols+col],  FORWARD), 2);
-    outdegree = MIN2(edges_get_outdegree(edges[i*ncols+col], FORWARD), 2);
-    fputc(symbols[indegree][outdegree], fout);
+    indegree  = MIN2(edges_get_indegree(edges[i],  FORWARD), 2);
+    outdegree = MIN2(edges_get_outdegree(edges[i], FORWARD), 2);
+    sbuf->b[sbuf->end++] = symbols[indegree][outdegree];
   }
-  fputc('\n', fout);
+  sbuf->b[sbuf->end++] = '\n';
+  sbuf->b[sbuf->end] = '\0';
 }
 
 // Print edges using hex coding, two characters [0-9a-f] per edge
 // 1=>A, 2=>C, 4=>G, 8=>T
 // "3b" => [AC] AACTA [ACT]
-static inline
-void _print_edges(const Edges *edges, size_t col, size_t ncols,
-                  size_t num, FILE *fout)
+static inline void _sbuf_edges(const Edges *edges, size_t num, StrBuf *sbuf)
 {
   size_t i;
-  if(num) {
-    edges_print(fout, edges[col]);
-    for(i = 1; i < num; i++) {
-      fputc(' ', fout);
-      edges_print(fout, edges[i*ncols+col]);
+  char *p;
+  strbuf_ensure_capacity(sbuf, sbuf->end + num*3 + 1);
+  p = sbuf->b + sbuf->end;
+  for(i = 0; i < num; i++) {
+    if(i) *p++ = ' ';
+    edges_to_char(edges[i], p);
+    p += 2;
+  }
+  *p++ = '\n';
+  *p = '\0';
+  sbuf->end = p - sbuf->b;
+}
+
+// Print coverages as with printf("%2u") separated by spaces
+static inline void _sbuf_covgs(const Covg *covgs, size_t num, StrBuf *sbuf)
+{
+  size_t i, n;
+  char *p, tmp[10];
+  Covg c;
+  strbuf_ensure_capacity(sbuf, sbuf->end + num*11 + 1); // <= 10 digits + ' '
+  p = sbuf->b + sbuf->end;
+  for(i = 0; i < num; i++) {
+    if(i) *p++ = ' ';
+    c = covgs[i];
+    if(c < 10) { *p++ = ' '; *p++ = '0' + c; }
+    else {
+      for(n = 0; c; c /= 10) tmp[n++] = '0' + c % 10;
+      while(n) *p++ = tmp[--n];
     }
   }
-  fputc('\n', fout);
+  *p++ = '\n';
+  *p = '\0';
+  sbuf->end = p - sbuf->b;
 }
 
-static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
-                                   CovgBuffer *covgbuf, EdgesBuffer *edgebuf,
-                                   bool print_edges, bool print_edge_degrees,
-                                   FILE *fout)
+static inline void _sbuf_read_hdr(const read_t *r, size_t col,
+                                  const char *suffix, StrBuf *sbuf)
 {
-  // Find nodes, set covgs
-  const size_t kmer_size = db_graph->kmer_size, ncols = db_graph->num_of_cols;
+  strbuf_append_char(sbuf, '>');
+  strbuf_append_strn(sbuf, r->name.b, r->name.end);
+  strbuf_append_str(sbuf, "_c");
+  strbuf_append_ulong(sbuf, col);
+  strbuf_append_str(sbuf, suffix);
+}
+
+// Fill covgs (and edges if loaded) for each kmer of the read, looking up the
+// kmers of each contig as one batch so hash table buckets can be prefetched
+// Returns number of kmers in the read
+static size_t fetch_read_covg(const CovgGraph *cg, const read_t *r,
+                              ReadCovgBuffers *rbufs)
+{
+  const dBGraph *db_graph = cg->db_graph;
+  const QueryGraph *qgraph = cg->qgraph;
+  const size_t kmer_size = cg->kmer_size, ncols = cg->ncols;
+  const size_t nedgecols = cg->nedgecols;
   size_t klen = r->seq.end < kmer_size ? 0 : r->seq.end - kmer_size + 1;
 
-  covg_buf_capacity(covgbuf, ncols * klen);
-  memset(covgbuf->b, 0, ncols * klen * sizeof(Covg));
+  covg_buf_capacity(&rbufs->covgs, ncols * klen);
+  memset(rbufs->covgs.b, 0, ncols * klen * sizeof(Covg));
 
-  if(db_graph->col_edges) {
-    edges_buf_capacity(edgebuf, ncols * klen);
-    memset(edgebuf->b, 0, ncols * klen * sizeof(Edges));
+  if(nedgecols) {
+    edges_buf_capacity(&rbufs->edges, ncols * klen);
+    memset(rbufs->edges.b, 0, ncols * klen * sizeof(Edges));
   }
 
-  size_t i, j, col, search_start = 0;
+  bkmer_buf_capacity(&rbufs->bkeys, klen);
+  hkey_buf_capacity(&rbufs->hkeys, klen);
+  qidx_buf_capacity(&rbufs->qidxs, klen);
+  orient_buf_capacity(&rbufs->orients, klen);
+
+  Covg *covgs = rbufs->covgs.b, *nodecovgs = rbufs->nodecovgs;
+  Edges *edges = rbufs->edges.b, *nodeedges = rbufs->nodeedges;
+  BinaryKmer *bkeys = rbufs->bkeys.b, bkmer;
+  hkey_t *hkeys = rbufs->hkeys.b;
+  uint64_t *qidxs = rbufs->qidxs.b;
+  uint8_t *orients = rbufs->orients.b;
+
+  size_t i, j, n, pos, col, search_start = 0;
   size_t contig_start, contig_end;
-  BinaryKmer bkmer;
   Nucleotide nuc;
-  dBNode node;
-  Covg *covgs;
 
   while((contig_start = seq_contig_start(r, search_start, kmer_size, 0, 0)) < r->seq.end)
   {
@@ -128,52 +219,209 @@ static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
     bkmer = binary_kmer_from_str(r->seq.b + contig_start, kmer_size);
     bkmer = binary_kmer_right_shift_one_base(bkmer);
 
-    for(i = contig_start, j = contig_start+kmer_size-1; j < contig_end; j++, i++)
-    {
+    for(n = 0, j = contig_start+kmer_size-1; j < contig_end; j++, n++) {
       nuc = dna_char_to_nuc(r->seq.b[j]);
       bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-      node = db_graph_find(db_graph, bkmer);
-      if(node.key != HASH_NOT_FOUND) {
-        covgs = &db_node_covg(db_graph, node.key, 0);
-        memcpy(covgbuf->b+i*ncols, covgs, ncols * sizeof(Covg));
-        if(db_graph->col_edges) {
-          fetch_node_edges(db_graph, node, edgebuf->b+i*ncols);
-        }
+      bkeys[n] = binary_kmer_get_key(bkmer, kmer_size);
+      orients[n] = bkmer_get_orientation(bkmer, bkeys[n]);
+    }
+
+    if(qgraph != NULL) {
+      query_graph_find_batch(qgraph, bkeys, n, qidxs);
+      for(i = 0, pos = contig_start; i < n; i++, pos++) {
+        if(qidxs[i] == QG_NOT_FOUND) continue;
+        const CovgStore *qcovgs = query_graph_covgs(qgraph, qidxs[i]);
+        const Edges *qedges = query_graph_edges(qgraph, qidxs[i]);
+        for(col = 0; col < ncols; col++) covgs[col*klen+pos] = qcovgs[col];
+        for(col = 0; col < nedgecols; col++)
+          edges[col*klen+pos] = orient_edges(qedges[col], orients[i]);
+      }
+      continue;
+    }
+
+    hash_table_find_batch(&db_graph->ht, bkeys, n, HT_PREFETCH_DEPTH, hkeys);
+
+    for(i = 0, pos = contig_start; i < n; i++, pos++) {
+      if(hkeys[i] == HASH_NOT_FOUND) continue;
+      db_node_get_covgs(db_graph, hkeys[i], nodecovgs);
+      for(col = 0; col < ncols; col++) covgs[col*klen+pos] = nodecovgs[col];
+      if(nedgecols) {
+        db_node_get_all_edges(db_graph, hkeys[i], nodeedges);
+        for(col = 0; col < nedgecols; col++)
+          edges[col*klen+pos] = orient_edges(nodeedges[col], orients[i]);
       }
     }
   }
 
+  return klen;
+}
+
+static inline void print_read_covg(const CovgGraph *cg, const read_t *r,
+                                   ReadCovgBuffers *rbufs,
+                                   bool print_edges, bool print_edge_degrees,
+                                   FILE *fout)
+{
+  const size_t ncols = cg->ncols;
+  size_t col, klen = fetch_read_covg(cg, r, rbufs);
+  StrBuf *sbuf = &rbufs->sbuf;
+
   // Print sequence
-  fprintf(fout, ">%s\n%s\n", r->name.b, r->seq.b);
+  strbuf_reset(sbuf);
+  strbuf_append_char(sbuf, '>');
+  strbuf_append_strn(sbuf, r->name.b, r->name.end);
+  strbuf_append_char(sbuf, '\n');
+  strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+  strbuf_append_char(sbuf, '\n');
 
   for(col = 0; col < ncols; col++)
   {
     if(print_edges) {
-      fprintf(fout, ">%s_c%zu_edges\n", r->name.b, col);
-      _print_edges(edgebuf->b, col, ncols, klen, fout);
+      _sbuf_read_hdr(r, col, "_edges\n", sbuf);
+      _sbuf_edges(rbufs->edges.b + col*klen, klen, sbuf);
     }
 
     if(print_edge_degrees) {
-      fprintf(fout, ">%s_c%zu_degree\n", r->name.b, col);
-      _print_edge_degrees(edgebuf->b, col, ncols, klen, fout);
+      _sbuf_read_hdr(r, col, "_degree\n", sbuf);
+      _sbuf_edge_degrees(rbufs->edges.b + col*klen, klen, sbuf);
     }
 
     // Print coverages
-    fprintf(fout, ">%s_c%zu_covgs\n", r->name.b, col);
-    if(klen > 0) {
-      fprintf(fout, "%2u", covgbuf->b[col]);
-      for(i = 1; i < klen; i++)
-        fprintf(fout, " %2u", covgbuf->b[i*ncols+col]);
+    _sbuf_read_hdr(r, col, "_covgs\n", sbuf);
+    _sbuf_covgs(rbufs->covgs.b + col*klen, klen, sbuf);
+  }
+
+  if(fwrite(sbuf->b, 1, sbuf->end, fout) != sbuf->end)
+    die("Cannot write output: %s", strerror(errno));
+}
+
+static inline void fwrite_u32(uint32_t x, FILE *fout)
+{
+  if(fwrite(&x, sizeof(x), 1, fout) != 1)
+    die("Cannot write output: %s", strerror(errno));
+}
+
+static inline void fwrite_bytes(const void *ptr, size_t len, FILE *fout)
+{
+  if(len && fwrite(ptr, 1, len, fout) != len)
+    die("Cannot write output: %s", strerror(errno));
+}
+
+static void print_binary_hdr(const CovgGraph *cg, bool print_edges,
+                             FILE *fout)
+{
+  fwrite_bytes(COVG_BIN_MAGIC, strlen(COVG_BIN_MAGIC), fout);
+  fwrite_u32(cg->ncols, fout);
+  fwrite_u32(cg->kmer_size, fout);
+  fwrite_u32(print_edges, fout);
+}
+
+static void print_read_covg_binary(const CovgGraph *cg, const read_t *r,
+                                   ReadCovgBuffers *rbufs, bool print_edges,
+                                   FILE *fout)
+{
+  const size_t ncols = cg->ncols;
+  size_t klen = fetch_read_covg(cg, r, rbufs);
+  fwrite_u32(r->name.end, fout);
+  fwrite_bytes(r->name.b, r->name.end, fout);
+  fwrite_u32(r->seq.end, fout);
+  fwrite_bytes(r->seq.b, r->seq.end, fout);
+  fwrite_u32(klen, fout);
+  fwrite_bytes(rbufs->covgs.b, ncols*klen*sizeof(Covg), fout);
+  if(print_edges)
+    fwrite_bytes(rbufs->edges.b, ncols*klen*sizeof(Edges), fout);
+}
+
+// Load graph files into a new graph. Colours listed in presence_arg (may be
+// NULL) are stored presence-only, without coverages.
+static void load_graph_files(dBGraph *db_graph, char **graph_paths,
+                             size_t num_gfiles, bool load_edges,
+                             const char *presence_arg,
+                             const struct MemArgs *memargs, size_t nthreads)
+{
+  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+  size_t i, ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+
+  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
+                           &ctx_max_kmers, &ctx_sum_kmers);
+
+  // Presence-only colours
+  bool *presence = NULL;
+  size_t npresence = 0;
+
+  if(presence_arg != NULL) {
+    int n = range_get_num(presence_arg, ncols-1);
+    if(n < 0) die("Invalid presence colour list: %s", presence_arg);
+    size_t *cols = ctx_calloc(MAX2(n, 1), sizeof(size_t));
+    if(range_parse_array(presence_arg, cols, ncols-1) < 0)
+      die("Invalid presence colour list: %s", presence_arg);
+    presence = ctx_calloc(ncols, sizeof(bool));
+    for(i = 0; i < (size_t)n; i++) {
+      npresence += !presence[cols[i]];
+      presence[cols[i]] = true;
     }
-    fputc('\n', fout);
+    ctx_free(cols);
   }
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+
+  // kmer memory = kmer + (coverage + edges) per colour
+  // presence-only colours have 1 bit per colour instead of coverages
+  bits_per_kmer = sizeof(BinaryKmer)*8 +
+                  sizeof(CovgStore) * 8 * (ncols - npresence) +
+                  (load_edges ? sizeof(Edges) * 8 * ncols : 0) +
+                  (presence != NULL ? ncols : 0);
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs->mem_to_use,
+                                        memargs->mem_to_use_set,
+                                        memargs->num_kmers,
+                                        memargs->num_kmers_set,
+                                        bits_per_kmer,
+                                        ctx_max_kmers, ctx_sum_kmers,
+                                        memargs->mem_to_use_set, &graph_mem);
+
+  cmd_check_mem_limit(memargs->mem_to_use, graph_mem);
+
+  //
+  // Set up memory
+  //
+  size_t kmer_size = gfiles[0].hdr.kmer_size;
+
+  db_graph_alloc(db_graph, kmer_size, ncols, load_edges ? ncols : 0, kmers_in_hash,
+                 DBG_ALLOC_COVGS | (load_edges ? DBG_ALLOC_EDGES : 0) |
+                 (presence != NULL ? DBG_ALLOC_NODE_IN_COL : 0));
+
+  if(presence != NULL) {
+    db_graph_set_presence_only(db_graph, presence);
+    ctx_free(presence);
+  }
+
+  //
+  // Load graphs
+  //
+  GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
+  gprefs.nthreads = nthreads;
+  gprefs.empty_colours = true;
+
+  for(i = 0; i < num_gfiles; i++) {
+    graph_load(&gfiles[i], gprefs, NULL);
+    graph_file_close(&gfiles[i]);
+    gprefs.empty_colours = false;
+  }
+  ctx_free(gfiles);
+
+  hash_table_print_stats(&db_graph->ht);
 }
 
 int ctx_coverage(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool print_edges = false, print_edge_degrees = false;
-  const char *output_file = NULL;
+  size_t nthreads = 0;
+  bool print_edges = false, print_edge_degrees = false, binary = false;
+  const char *output_file = NULL, *graph_shm = NULL, *qgraph_path = NULL;
+  const char *presence_arg = NULL;
   SeqFilePtrBuffer sfilebuf;
 
   seq_file_ptr_buf_alloc(&sfilebuf, 16);
@@ -196,8 +444,13 @@ int ctx_coverage(int argc, char **argv)
       case 'o': cmd_check(!output_file, cmd); output_file = optarg; break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'e': cmd_check(!print_edges,cmd); print_edges = true; break;
       case 'E': cmd_check(!print_edge_degrees,cmd); print_edge_degrees = true; break;
+      case 'b': cmd_check(!binary,cmd); binary = true; break;
+      case 'G': cmd_check(!graph_shm,cmd); graph_shm = optarg; break;
+      case 'Q': cmd_check(!qgraph_path,cmd); qgraph_path = optarg; break;
+      case 'P': cmd_check(!presence_arg,cmd); presence_arg = optarg; break;
       case '1':
       case 's':
         if((tmp_sfile = seq_open(optarg)) == NULL)
@@ -212,76 +465,70 @@ int ctx_coverage(int argc, char **argv)
     }
   }
 
-  if(sfilebuf.len == 0) cmd_print_usage("Require at least one --seq file");
-  if(optind == argc) cmd_print_usage("Require input graph files (.ctx)");
-
-  //
-  // Open graph files
-  //
-  char **graph_paths = argv + optind;
-  size_t num_gfiles = argc - optind;
-  ctx_assert(num_gfiles > 0);
-  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
-  size_t ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
-
-  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
-                           &ctx_max_kmers, &ctx_sum_kmers);
-
-  //
-  // Decide on memory
-  //
-  size_t bits_per_kmer, kmers_in_hash, graph_mem;
-
-  // kmer memory = kmer + (coverage + edges) per colour
-  bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  (sizeof(Covg) + (print_edges ? sizeof(Edges) : 0)) * 8 * ncols;
-
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
-                                        memargs.mem_to_use_set,
-                                        memargs.num_kmers,
-                                        memargs.num_kmers_set,
-                                        bits_per_kmer,
-                                        ctx_max_kmers, ctx_sum_kmers,
-                                        memargs.mem_to_use_set, &graph_mem);
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  if(sfilebuf.len == 0) cmd_print_usage("Require at least one --seq file");
+  if(binary && print_edge_degrees)
+    cmd_print_usage("--degree is only printed in text output, use --edges");
+
+  // Degrees are calculated from the edges
+  bool load_edges = print_edges || print_edge_degrees;
+  if(graph_shm != NULL && qgraph_path != NULL)
+    cmd_print_usage("Cannot use --graph-shm with --query-graph");
+  if(graph_shm == NULL && qgraph_path == NULL && optind == argc)
+    cmd_print_usage("Require input graph files (.ctx), --graph-shm or --query-graph");
+  if((graph_shm != NULL || qgraph_path != NULL) && optind < argc)
+    cmd_print_usage("Cannot give graph files with --graph-shm or --query-graph");
+  if((graph_shm != NULL || qgraph_path != NULL) && presence_arg != NULL)
+    cmd_print_usage("--presence only applies when loading graph files");
 
   //
   // Open output file
   //
   FILE *fout = futil_fopen_create(output_file ? output_file : "-", "w");
 
-  //
-  // Set up memory
-  //
-  size_t kmer_size = gfiles[0].hdr.kmer_size;
-
   dBGraph db_graph;
-  db_graph_alloc(&db_graph, kmer_size, ncols, print_edges ? ncols : 0, kmers_in_hash,
-                 DBG_ALLOC_COVGS | (print_edges ? DBG_ALLOC_EDGES : 0));
-
-  //
-  // Load graphs
-  //
-  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
-  gprefs.empty_colours = true;
-
-  for(i = 0; i < num_gfiles; i++) {
-    graph_load(&gfiles[i], gprefs, NULL);
-    graph_file_close(&gfiles[i]);
-    gprefs.empty_colours = false;
+  QueryGraph qgraph;
+  CovgGraph cg;
+  memset(&cg, 0, sizeof(cg));
+
+  if(qgraph_path != NULL) {
+    query_graph_load(&qgraph, qgraph_path);
+    cg.qgraph = &qgraph;
+    cg.kmer_size = qgraph.kmer_size;
+    cg.ncols = qgraph.num_of_cols;
+    cg.nedgecols = load_edges ? qgraph.num_edge_cols : 0;
+  } else {
+    if(graph_shm != NULL) {
+      graph_shm_attach(graph_shm, &db_graph,
+                       DBG_ALLOC_COVGS | (load_edges ? DBG_ALLOC_EDGES : 0));
+    } else {
+      load_graph_files(&db_graph, argv + optind, argc - optind, load_edges,
+                       presence_arg, &memargs, nthreads);
+    }
+    cg.db_graph = &db_graph;
+    cg.kmer_size = db_graph.kmer_size;
+    cg.ncols = db_graph.num_of_cols;
+    cg.nedgecols = db_graph.col_edges ? db_graph.num_edge_cols : 0;
   }
-  ctx_free(gfiles);
 
-  hash_table_print_stats(&db_graph.ht);
+  size_t ncols = cg.ncols;
 
   //
   // Load sequence
   //
-  CovgBuffer covgbuf;
-  EdgesBuffer edgebuf;
-  covg_buf_alloc(&covgbuf, 2048);
-  edges_buf_alloc(&edgebuf, 2048);
+  ReadCovgBuffers rbufs;
+  covg_buf_alloc(&rbufs.covgs, 2048);
+  edges_buf_alloc(&rbufs.edges, 2048);
+  bkmer_buf_alloc(&rbufs.bkeys, 256);
+  hkey_buf_alloc(&rbufs.hkeys, 256);
+  qidx_buf_alloc(&rbufs.qidxs, 256);
+  orient_buf_alloc(&rbufs.orients, 256);
+  rbufs.nodecovgs = ctx_calloc(ncols, sizeof(Covg));
+  rbufs.nodeedges = ctx_calloc(ncols, sizeof(Edges));
+  strbuf_alloc(&rbufs.sbuf, 4096);
+
+  if(binary) print_binary_hdr(&cg, print_edges, fout);
 
   read_t r;
   seq_read_alloc(&r);
@@ -292,8 +539,9 @@ int ctx_coverage(int argc, char **argv)
   // Deal with one read at a time
   for(i = 0; i < sfilebuf.len; i++) {
     while(seq_read_primary(sfilebuf.b[i], &r) > 0) {
-      print_read_covg(&db_graph, &r, &covgbuf, &edgebuf,
-                      print_edges, print_edge_degrees, fout);
+      if(binary) print_read_covg_binary(&cg, &r, &rbufs, print_edges, fout);
+      else print_read_covg(&cg, &r, &rbufs,
+                           print_edges, print_edge_degrees, fout);
       nreads++;
     }
     seq_close(sfilebuf.b[i]);
@@ -303,13 +551,21 @@ int ctx_coverage(int argc, char **argv)
   status("Printed graph coverage for %s reads", ulong_to_str(nreads, nstr));
 
   seq_read_dealloc(&r);
-  covg_buf_dealloc(&covgbuf);
-  edges_buf_dealloc(&edgebuf);
+  covg_buf_dealloc(&rbufs.covgs);
+  edges_buf_dealloc(&rbufs.edges);
+  bkmer_buf_dealloc(&rbufs.bkeys);
+  hkey_buf_dealloc(&rbufs.hkeys);
+  qidx_buf_dealloc(&rbufs.qidxs);
+  orient_buf_dealloc(&rbufs.orients);
+  ctx_free(rbufs.nodecovgs);
+  ctx_free(rbufs.nodeedges);
+  strbuf_dealloc(&rbufs.sbuf);
 
   seq_file_ptr_buf_dealloc(&sfilebuf);
 
   fclose(fout);
-  db_graph_dealloc(&db_graph);
+  if(qgraph_path != NULL) query_graph_dealloc(&qgraph);
+  else db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
 }
@@ -7,6 +7,10 @@
 #include "graphs_load.h"
 #include "gpath_checks.h"
 
+#include "misc/city.h"
+
+#define DEFAULT_SKETCH_SIZE 1000
+
 const char dist_matrix_usage[] =
 "usage: "CMD" dist [options] <in.ctx> [in2.ctx ...]\n"
 "\n"
@@ -19,6 +23,11 @@ const char dist_matrix_usage[] =
 "  -n, --nkmers <kmers>  Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>     Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -o, --out <out.csv>   Ouput matrix, tab separated [defaults to STDOUT]\n"
+"  -s, --sketch <out>    Also write Jaccard estimates from MinHash sketches\n"
+"  -S, --sketch-size <N> Kmer hashes to keep per colour [default: "QUOTE_VALUE(DEFAULT_SKETCH_SIZE)"]\n"
+"\n"
+"  Counts are exact. Sketches keep the N smallest kmer hashes of each colour\n"
+"  (bottom-N MinHash) to estimate the Jaccard index between colours.\n"
 "\n";
 
 static struct option longopts[] =
@@ -30,33 +39,233 @@ static struct option longopts[] =
   {"threads",      required_argument, NULL, 't'},
   {"force",        no_argument,       NULL, 'f'},
   {"out",          required_argument, NULL, 'o'},
+  {"sketch",       required_argument, NULL, 's'},
+  {"sketch-size",  required_argument, NULL, 'S'},
   {NULL, 0, NULL, 0}
 };
 
+// Kmers are counted in blocks of 64-bit words, transposed from node_in_cols
+// (8 kmers x ncols bytes) into one bit vector per colour. Pairs of colours are
+// then intersected with popcount_and(), in tiles of colours that fit in cache.
+#define DIST_BLOCK_WORDS 64 /* 4096 kmers per block */
+#define DIST_COL_TILE 64 /* 64 colours x 512 bytes = 32KB per tile */
+
+typedef struct {
+  uint64_t *matrix; // [ncols*ncols] upper triangle used
+  uint64_t *cols; // [ncols*DIST_BLOCK_WORDS] colour-major bit vectors
+  uint64_t *masks; // [DIST_BLOCK_WORDS] assigned hash table entries
+  uint8_t *nonempty; // [ncols] colour has a kmer in the current block
+  uint64_t *sketches; // [ncols*sketch_size] max-heap of smallest hashes
+  size_t *sketch_lens; // [ncols]
+} DistWorker;
+
 typedef struct {
   const dBGraph *db_graph;
-  uint64_t **matrices;
-} DistMatrixThreads;
+  DistWorker *workers;
+  size_t sketch_size; // 0 if not sketching
+  uint64_t *sketches; // merged sorted sketches [ncols*sketch_size]
+  size_t *sketch_lens;
+  double *jaccard; // [ncols*ncols]
+} DistMatrix;
+
+// Transpose words [w0,w0+nw) of node_in_cols into wkr->cols
+// Returns false if no kmers are in the block
+static bool dist_load_block(const dBGraph *db_graph, size_t w0, size_t nw,
+                            DistWorker *wkr)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  const size_t capacity = db_graph->ht.capacity;
+  const size_t bytes_per_col = roundup_bits2bytes(capacity);
+  const uint8_t *nic = db_graph->node_in_cols;
+  size_t w, k, c, b, byte, hkey;
+  uint64_t mask, any = 0, *cols = wkr->cols;
+
+  for(w = 0; w < nw; w++) {
+    mask = 0;
+    for(b = 0, hkey = (w0+w)*64; b < 64 && hkey < capacity; b++, hkey++)
+      if(hash_table_assigned(&db_graph->ht, hkey)) mask |= 1UL << b;
+    wkr->masks[w] = mask;
+    any |= mask;
+  }
+
+  if(!any) return false;
+
+  memset(cols, 0, ncols * DIST_BLOCK_WORDS * sizeof(uint64_t));
+  memset(wkr->nonempty, 0, ncols);
+
+  for(w = 0; w < nw; w++) {
+    if(!wkr->masks[w]) continue;
+    // Bytes of a word are adjacent in memory for each colour
+    for(k = 0; k < 8; k++) {
+      byte = (w0+w)*8 + k;
+      if(byte >= bytes_per_col) break;
+      for(c = 0; c < ncols; c++)
+        cols[c*DIST_BLOCK_WORDS+w] |= (uint64_t)nic[byte*ncols+c] << (8*k);
+    }
+    for(c = 0; c < ncols; c++) {
+      cols[c*DIST_BLOCK_WORDS+w] &= wkr->masks[w];
+      wkr->nonempty[c] |= (cols[c*DIST_BLOCK_WORDS+w] != 0);
+    }
+  }
+
+  return true;
+}
 
-static bool dist_matrix_thread(hkey_t hkey, size_t threadid, void *arg)
+static void dist_count_block(size_t ncols, size_t nw, DistWorker *wkr)
+{
+  size_t ti, tj, i, j, iend, jend;
+  const uint64_t *a, *b;
+
+  for(ti = 0; ti < ncols; ti += DIST_COL_TILE) {
+    iend = MIN2(ti+DIST_COL_TILE, ncols);
+    for(tj = ti; tj < ncols; tj += DIST_COL_TILE) {
+      jend = MIN2(tj+DIST_COL_TILE, ncols);
+      for(i = ti; i < iend; i++) {
+        if(!wkr->nonempty[i]) continue;
+        a = wkr->cols + i*DIST_BLOCK_WORDS;
+        // i == j counts colour with self
+        for(j = MAX2(i, tj); j < jend; j++) {
+          if(!wkr->nonempty[j]) continue;
+          b = wkr->cols + j*DIST_BLOCK_WORDS;
+          wkr->matrix[ncols*i+j] += popcount_and(a, b, nw);
+        }
+      }
+    }
+  }
+}
+
+// Keep the `size` smallest hashes in a max-heap
+static inline void dist_heap_add(uint64_t *heap, size_t *len, size_t size,
+                                 uint64_t h)
+{
+  size_t i = *len, p, l, r, m;
+
+  if(i < size) {
+    // sift up
+    heap[i] = h;
+    (*len)++;
+    while(i > 0 && heap[p = (i-1)/2] < heap[i]) {
+      SWAP(heap[p], heap[i]);
+      i = p;
+    }
+  }
+  else if(h < heap[0]) {
+    // replace root and sift down
+    heap[0] = h;
+    for(i = 0; ; i = m) {
+      l = 2*i+1; r = l+1; m = i;
+      if(l < size && heap[l] > heap[m]) m = l;
+      if(r < size && heap[r] > heap[m]) m = r;
+      if(m == i) break;
+      SWAP(heap[m], heap[i]);
+    }
+  }
+}
+
+static void dist_sketch_block(const dBGraph *db_graph, size_t w0, size_t nw,
+                              size_t sketch_size, DistWorker *wkr)
 {
-  DistMatrixThreads *workers = (DistMatrixThreads*)arg;
-  const dBGraph *db_graph = workers->db_graph;
   const size_t ncols = db_graph->num_of_cols;
-  uint64_t *matrix = workers->matrices[threadid];
-  size_t i, j;
-  for(i = 0; i < ncols; i++) {
-    if(db_node_has_col(db_graph, hkey, i)) {
-      matrix[ncols*i+i]++; // colour with self
-      for(j = i+1; j < ncols; j++) {
-        if(db_node_has_col(db_graph, hkey, j)) {
-          matrix[ncols*i+j]++;
+  size_t w, b, c;
+  uint64_t mask, h;
+  hkey_t hkey;
+  BinaryKmer bkey;
+
+  for(w = 0; w < nw; w++) {
+    for(mask = wkr->masks[w]; mask; mask &= mask-1) {
+      b = __builtin_ctzll(mask);
+      hkey = (w0+w)*64 + b;
+      bkey = db_node_get_bkey(db_graph, hkey);
+      h = CityHash64((const char*)bkey.b, sizeof(BinaryKmer));
+      for(c = 0; c < ncols; c++) {
+        if((wkr->cols[c*DIST_BLOCK_WORDS+w] >> b) & 1) {
+          dist_heap_add(wkr->sketches + c*sketch_size, &wkr->sketch_lens[c],
+                        sketch_size, h);
         }
       }
     }
   }
+}
 
-  return false; // keep iterating
+static bool dist_matrix_range(size_t start, size_t end, size_t threadid,
+                              void *arg)
+{
+  DistMatrix *dm = (DistMatrix*)arg;
+  const dBGraph *db_graph = dm->db_graph;
+  DistWorker *wkr = &dm->workers[threadid];
+  size_t w0, nw;
+
+  for(w0 = start; w0 < end; w0 += DIST_BLOCK_WORDS) {
+    nw = MIN2(DIST_BLOCK_WORDS, end-w0);
+    if(dist_load_block(db_graph, w0, nw, wkr)) {
+      dist_count_block(db_graph->num_of_cols, nw, wkr);
+      if(dm->sketch_size)
+        dist_sketch_block(db_graph, w0, nw, dm->sketch_size, wkr);
+    }
+  }
+
+  return false; // keep going
+}
+
+static int dist_hash_cmp(const void *aa, const void *bb)
+{
+  uint64_t a = *(const uint64_t*)aa, b = *(const uint64_t*)bb;
+  return a < b ? -1 : (a > b);
+}
+
+// Merge thread sketches, keep the smallest sketch_size for each colour sorted
+static void dist_merge_sketches(DistMatrix *dm, size_t nthreads)
+{
+  const size_t ncols = dm->db_graph->num_of_cols, size = dm->sketch_size;
+  uint64_t *tmp = ctx_malloc(nthreads * size * sizeof(uint64_t));
+  size_t c, t, n;
+
+  for(c = 0; c < ncols; c++) {
+    for(t = n = 0; t < nthreads; t++) {
+      memcpy(tmp+n, dm->workers[t].sketches + c*size,
+             dm->workers[t].sketch_lens[c] * sizeof(uint64_t));
+      n += dm->workers[t].sketch_lens[c];
+    }
+    qsort(tmp, n, sizeof(uint64_t), dist_hash_cmp);
+    n = MIN2(n, size);
+    memcpy(dm->sketches + c*size, tmp, n * sizeof(uint64_t));
+    dm->sketch_lens[c] = n;
+  }
+
+  ctx_free(tmp);
+}
+
+// Jaccard estimate from the smallest `size` hashes of the union of two sketches
+static double dist_sketch_jaccard(const uint64_t *a, size_t na,
+                                  const uint64_t *b, size_t nb, size_t size)
+{
+  size_t i = 0, j = 0, n = 0, shared = 0;
+  while(n < size && (i < na || j < nb)) {
+    if(j == nb || (i < na && a[i] < b[j])) i++;
+    else if(i == na || b[j] < a[i]) j++;
+    else { shared++; i++; j++; }
+    n++;
+  }
+  return n ? (double)shared / n : 0;
+}
+
+static bool dist_jaccard_rows(size_t start, size_t end, size_t threadid,
+                              void *arg)
+{
+  (void)threadid;
+  DistMatrix *dm = (DistMatrix*)arg;
+  const size_t ncols = dm->db_graph->num_of_cols, size = dm->sketch_size;
+  size_t i, j;
+
+  for(i = start; i < end; i++) {
+    for(j = i; j < ncols; j++) {
+      dm->jaccard[ncols*i+j]
+        = dist_sketch_jaccard(dm->sketches + i*size, dm->sketch_lens[i],
+                              dm->sketches + j*size, dm->sketch_lens[j], size);
+    }
+  }
+
+  return false; // keep going
 }
 
 int ctx_dist_matrix(int argc, char **argv)
@@ -64,7 +273,8 @@ int ctx_dist_matrix(int argc, char **argv)
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
 
-  char *out_path = NULL;
+  char *out_path = NULL, *sketch_path = NULL;
+  size_t sketch_size = 0;
 
   // Arg parsing
   char cmd[100];
@@ -85,6 +295,8 @@ int ctx_dist_matrix(int argc, char **argv)
       case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
+      case 's': cmd_check(!sketch_path, cmd); sketch_path = optarg; break;
+      case 'S': cmd_check(!sketch_size, cmd); sketch_size = cmd_size_nonzero(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -95,6 +307,8 @@ int ctx_dist_matrix(int argc, char **argv)
 
   // Defaults
   if(!nthreads) nthreads = DEFAULT_NTHREADS;
+  if(sketch_size && !sketch_path) cmd_print_usage("--sketch-size requires --sketch <out>");
+  if(sketch_path && !sketch_size) sketch_size = DEFAULT_SKETCH_SIZE;
 
   if(optind >= argc) cmd_print_usage("Require input graph files (.ctx)");
 
@@ -131,7 +345,12 @@ int ctx_dist_matrix(int argc, char **argv)
                                         ctx_max_kmers, ctx_sum_kmers,
                                         true, &graph_mem);
 
-  size_t total_mem = graph_mem;
+  // matrix + transposed block per thread, sketches per thread and merged
+  size_t thread_mem = ncols*ncols*sizeof(uint64_t) +
+                      ncols*DIST_BLOCK_WORDS*sizeof(uint64_t) + ncols;
+  size_t sketch_mem = ncols*(sketch_size*sizeof(uint64_t) + sizeof(size_t));
+  size_t total_mem = graph_mem + nthreads*(thread_mem + sketch_mem) +
+                     (sketch_size ? sketch_mem + ncols*ncols*sizeof(double) : 0);
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
 
@@ -141,20 +360,32 @@ int ctx_dist_matrix(int argc, char **argv)
                  DBG_ALLOC_NODE_IN_COL);
 
   // Allocate thread memory
-  uint64_t **matrices = ctx_calloc(nthreads, sizeof(DistMatrixThreads));
-  DistMatrixThreads workers = {.db_graph = &db_graph, .matrices = matrices};
-  for(i = 0; i < nthreads; i++)
-    workers.matrices[i] = ctx_calloc(ncols*ncols, sizeof(uint64_t));
+  DistMatrix dm = {.db_graph = &db_graph, .sketch_size = sketch_size,
+                   .sketches = NULL, .sketch_lens = NULL, .jaccard = NULL};
+  dm.workers = ctx_calloc(nthreads, sizeof(DistWorker));
+  for(i = 0; i < nthreads; i++) {
+    DistWorker *wkr = &dm.workers[i];
+    wkr->matrix = ctx_calloc(ncols*ncols, sizeof(uint64_t));
+    wkr->cols = ctx_calloc(ncols*DIST_BLOCK_WORDS, sizeof(uint64_t));
+    wkr->masks = ctx_calloc(DIST_BLOCK_WORDS, sizeof(uint64_t));
+    wkr->nonempty = ctx_calloc(ncols, 1);
+    if(sketch_size) {
+      wkr->sketches = ctx_calloc(ncols*sketch_size, sizeof(uint64_t));
+      wkr->sketch_lens = ctx_calloc(ncols, sizeof(size_t));
+    }
+  }
 
   // Open output file
   // Print to stdout unless --out <out> is specified
   FILE *fout = futil_fopen_create(!out_path ? "-" : out_path, "w");
+  FILE *fsketch = sketch_path ? futil_fopen_create(sketch_path, "w") : NULL;
 
 
   //
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -169,15 +400,16 @@ int ctx_dist_matrix(int argc, char **argv)
   // Generate matrix
   status("[dist_matrix] Generating matrix between %zu colours with %zu thread%s",
          ncols, nthreads, util_plural_str(nthreads));
-  hash_table_iterate(&db_graph.ht, nthreads, dist_matrix_thread, &workers);
+  size_t nwords = (db_graph.ht.capacity+63)/64;
+  util_run_ranges(nwords, DIST_BLOCK_WORDS*4, nthreads, dist_matrix_range, &dm);
 
   // Merge matrices
   for(i = 1; i < nthreads; i++)
     for(j = 0; j < ncols*ncols; j++)
-      matrices[0][j] += matrices[i][j];
+      dm.workers[0].matrix[j] += dm.workers[i].matrix[j];
 
   size_t row, col;
-  uint64_t *mat = matrices[0];
+  uint64_t *mat = dm.workers[0].matrix;
 
   // Print matrix
   fprintf(fout, ".");// top left column empty
@@ -195,9 +427,44 @@ int ctx_dist_matrix(int argc, char **argv)
   status("[dist_matrix]   written to %s", futil_outpath_str(out_path));
   fclose(fout);
 
-  for(i = 0; i < nthreads; i++)
-    ctx_free(workers.matrices[i]);
-  ctx_free(workers.matrices);
+  if(sketch_size) {
+    status("[dist_matrix] Estimating Jaccard index from sketches of %zu kmers",
+           sketch_size);
+    dm.sketches = ctx_malloc(ncols*sketch_size*sizeof(uint64_t));
+    dm.sketch_lens = ctx_calloc(ncols, sizeof(size_t));
+    dm.jaccard = ctx_calloc(ncols*ncols, sizeof(double));
+    dist_merge_sketches(&dm, nthreads);
+    util_run_ranges(ncols, 1, nthreads, dist_jaccard_rows, &dm);
+
+    fprintf(fsketch, ".");
+    for(row = 0; row < ncols; row++) fprintf(fsketch, "\tcol%zu", row);
+    fprintf(fsketch, "\n");
+    for(row = 0; row < ncols; row++) {
+      fprintf(fsketch, "col%zu", row);
+      for(col = 0; col < ncols; col++) {
+        if(col < row) fprintf(fsketch, "\t.");
+        else fprintf(fsketch, "\t%.6f", dm.jaccard[ncols*row+col]);
+      }
+      fprintf(fsketch, "\n");
+    }
+
+    status("[dist_matrix]   written to %s", futil_outpath_str(sketch_path));
+    fclose(fsketch);
+
+    ctx_free(dm.sketches);
+    ctx_free(dm.sketch_lens);
+    ctx_free(dm.jaccard);
+  }
+
+  for(i = 0; i < nthreads; i++) {
+    ctx_free(dm.workers[i].matrix);
+    ctx_free(dm.workers[i].cols);
+    ctx_free(dm.workers[i].masks);
+    ctx_free(dm.workers[i].nonempty);
+    ctx_free(dm.workers[i].sketches);
+    ctx_free(dm.workers[i].sketch_lens);
+  }
+  ctx_free(dm.workers);
 
   db_graph_dealloc(&db_graph);
 
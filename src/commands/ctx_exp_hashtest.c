@@ -3,11 +3,14 @@
 #include "util.h"
 #include "db_graph.h"
 #include "binary_kmer.h"
+#include "kmer_fpindex.h"
+#include "binary_seq.h"
 
 const char exp_hashtest_usage[] =
 "usage: "CMD" hashtest [options] <num_ops>\n"
 "\n"
 "  Test hash table speed. If threads is set to 0, use single-threaded code.\n"
+"  Inserts <num_ops> kmers, then finds each of them again.\n"
 "\n"
 "  -h, --help        This help message\n"
 "  -m, --memory <M>  Memory to use\n"
@@ -15,6 +18,19 @@ const char exp_hashtest_usage[] =
 "  -t, --threads <T> Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -k, --kmer <K>    Kmer size must be odd ("QUOTE_VALUE(MAX_KMER_SIZE)" >= k >= "QUOTE_VALUE(MIN_KMER_SIZE)")\n"
 "  -F, --func-only   Only use the hash function, do not store kmers\n"
+"  -L, --lockfree    Insert with compare-and-swap instead of bucket locks\n"
+"  -T, --tags        Store a fingerprint per kmer to speed up bucket probes\n"
+"  -B, --bucket-headers  Keep each bucket's size, lock and fingerprints in one\n"
+"                    cache line (implies --tags)\n"
+"  -H, --hugepages   Use huge pages interleaved across NUMA nodes\n"
+"  -C, --cuckoo      Move kmers to make room on insert (requires --threads 0)\n"
+"  -o, --occupancy <f> Size the table to be <f> full after inserting (e.g. 0.95)\n"
+"  -P, --fingerprint Use a fingerprint index over packed sequence instead of\n"
+"                    the hash table (requires --threads 0)\n"
+"\n"
+"  To compare tables at high load, run with and without --cuckoo at the same\n"
+"  --occupancy. Use "CMD" --stats-json <out.json> to record probe distances.\n"
+"  To compare bucket layouts, run with --tags and with --bucket-headers.\n"
 "\n";
 
 static struct option longopts[] =
@@ -27,12 +43,19 @@ static struct option longopts[] =
 // command specific
   {"kmer",         required_argument, NULL, 'k'},
   {"func-only",    no_argument,       NULL, 'F'},
+  {"lockfree",     no_argument,       NULL, 'L'},
+  {"tags",         no_argument,       NULL, 'T'},
+  {"bucket-headers",no_argument,      NULL, 'B'},
+  {"hugepages",    no_argument,       NULL, 'H'},
+  {"cuckoo",       no_argument,       NULL, 'C'},
+  {"occupancy",    required_argument, NULL, 'o'},
+  {"fingerprint",  no_argument,       NULL, 'P'},
   {NULL, 0, NULL, 0}
 };
 
 struct HashLoopJob {
   dBGraph *db_graph;
-  bool single_threaded;
+  bool single_threaded, lockfree, find;
   size_t start, end;
   size_t hash; // return value
 };
@@ -47,11 +70,22 @@ static inline void hash_loop(void *arg, size_t threadid)
   bool found;
   uint32_t hash = 0;
 
-  if(j.db_graph && j.single_threaded) {
+  if(j.db_graph && j.find) {
+    for(i = j.start; i < j.end; i++) {
+      bkmer.b[0] = i;
+      hash ^= (uint32_t)hash_table_find(&j.db_graph->ht, bkmer);
+    }
+  } else if(j.db_graph && j.single_threaded) {
     for(i = j.start; i < j.end; i++) {
       bkmer.b[0] = i;
       hash_table_find_or_insert(&j.db_graph->ht, bkmer, &found);
     }
+  } else if(j.db_graph && j.lockfree) {
+    for(i = j.start; i < j.end; i++) {
+      bkmer.b[0] = i;
+      hash_table_find_or_insert_lockfree(&j.db_graph->ht, bkmer, &found,
+                                         j.db_graph->bktlocks);
+    }
   } else if(j.db_graph) {
     for(i = j.start; i < j.end; i++) {
       bkmer.b[0] = i;
@@ -68,11 +102,65 @@ static inline void hash_loop(void *arg, size_t threadid)
   jptr->hash = hash;
 }
 
+// Index one random sequence of num_ops+k-1 bases, then find each kmer again
+static void fpindex_test(size_t kmer_size, size_t num_ops,
+                         const struct MemArgs *memargs)
+{
+  size_t i, len = num_ops+kmer_size-1, nkmers, nfound = 0;
+  size_t mem = kmer_fpindex_mem(num_ops, len);
+  KmerFPIndex idx;
+  KmerFPRef ref;
+  BinaryKmerIter kiter;
+  BinaryKmer bkmer;
+  Orientation orient;
+
+  cmd_print_mem(mem, "fingerprint index");
+  cmd_check_mem_limit(memargs->mem_to_use, mem);
+
+  char *seq = ctx_malloc(len+1);
+  for(i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+  seq[len] = '\0';
+
+  kmer_fpindex_alloc(&idx, kmer_size, num_ops);
+
+  uint64_t t0 = ctx_stats_now_ns();
+  nkmers = kmer_fpindex_add(&idx, seq, len);
+  uint64_t t1 = ctx_stats_now_ns();
+
+  status("Insert: %.3f sec (%.1f ns per kmer)", (t1-t0)/1e9,
+         num_ops ? (double)(t1-t0)/num_ops : 0.0);
+
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+  t0 = ctx_stats_now_ns();
+  for(i = kmer_size-1; i < len; i++) {
+    binary_kmer_iter_next(&kiter, dna_char_to_nuc(seq[i]));
+    bkmer = binary_kmer_iter_key(&kiter, &orient);
+    nfound += kmer_fpindex_find(&idx, bkmer, &ref);
+  }
+  t1 = ctx_stats_now_ns();
+
+  status("Find: %.3f sec (%.1f ns per kmer)", (t1-t0)/1e9,
+         num_ops ? (double)(t1-t0)/num_ops : 0.0);
+
+  size_t idx_mem = idx.capacity * sizeof(KmerFPEntry) +
+                   binary_seq_mem(idx.seq_cap);
+  status("Fingerprint index: %zu unique kmers of %zu, %zu found, "
+         "%.1f bytes per kmer (%zu bytes per BinaryKmer)",
+         nkmers, num_ops, nfound,
+         nkmers ? (double)idx_mem / nkmers : 0.0, sizeof(BinaryKmer));
+
+  kmer_fpindex_dealloc(&idx);
+  ctx_free(seq);
+}
+
 int ctx_exp_hashtest(int argc, char **argv)
 {
   size_t nthreads = 0, kmer_size = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool store_kmers = true;
+  bool store_kmers = true, lockfree = false, use_tags = false;
+  bool hugepages = false, cuckoo = false, fingerprint = false, headers = false;
+  bool occupancy_set = false;
+  double occupancy = 0;
 
   // Arg parsing
   char cmd[100], shortopts[100];
@@ -89,6 +177,18 @@ int ctx_exp_hashtest(int argc, char **argv)
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'k': cmd_check(!kmer_size,cmd); kmer_size = cmd_uint32_nonzero(cmd, optarg); break;
       case 'F': cmd_check(store_kmers,cmd); store_kmers = false; break;
+      case 'L': cmd_check(!lockfree,cmd); lockfree = true; break;
+      case 'T': cmd_check(!use_tags,cmd); use_tags = true; break;
+      case 'B': cmd_check(!headers,cmd); headers = true; break;
+      case 'H': cmd_check(!hugepages,cmd); hugepages = true; break;
+      case 'C': cmd_check(!cuckoo,cmd); cuckoo = true; break;
+      case 'P': cmd_check(!fingerprint,cmd); fingerprint = true; break;
+      case 'o':
+        cmd_check(!occupancy_set,cmd);
+        occupancy = cmd_udouble_nonzero(cmd, optarg);
+        occupancy_set = true;
+        if(occupancy > 1) cmd_print_usage("--occupancy must be <= 1");
+        break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -110,18 +210,48 @@ int ctx_exp_hashtest(int argc, char **argv)
 
   if(optind+1 != argc) cmd_print_usage(NULL);
 
+  if(lockfree && single_threaded)
+    cmd_print_usage("--lockfree requires --threads <T> with T > 0");
+  if(cuckoo && !single_threaded)
+    cmd_print_usage("--cuckoo requires --threads 0");
+  if(occupancy_set && (memargs.mem_to_use_set || memargs.num_kmers_set))
+    cmd_print_usage("--occupancy cannot be used with --memory or --nkmers");
+  if((occupancy_set || cuckoo) && !store_kmers)
+    cmd_print_usage("--func-only cannot be used with --occupancy or --cuckoo");
+  if(fingerprint && (!single_threaded || !store_kmers || lockfree || use_tags ||
+                     headers || hugepages || cuckoo || occupancy_set ||
+                     memargs.num_kmers_set)) {
+    cmd_print_usage("--fingerprint requires --threads 0 and cannot be used "
+                    "with other table options");
+  }
+
   size_t i, num_ops;
   if(!parse_entire_size(argv[optind], &num_ops))
     cmd_print_usage("Invalid <num_ops>");
 
+  if(fingerprint) {
+    if(num_ops == 0) cmd_print_usage("--fingerprint requires <num_ops> > 0");
+    fpindex_test(kmer_size, num_ops, &memargs);
+    return EXIT_SUCCESS;
+  }
+
   // Decide on memory
   size_t kmers_in_hash = 0, graph_mem = 0, bits_per_kmer = sizeof(BinaryKmer)*8;
   dBGraph db_graph;
 
+  // Count tags or bucket headers in the memory used by the hash table
+  hash_table_mem_set_layout((use_tags ? HT_MEM_TAGS : 0) |
+                            (headers ? HT_MEM_BUCKET_HDRS : 0));
+
   if(store_kmers)
   {
     // Min and max number of kmers both `num_ops`, since each iterations adds a
     // (probably unique) kmer to the graph
+    if(occupancy_set) {
+      memargs.num_kmers = (size_t)(num_ops / occupancy);
+      memargs.num_kmers_set = true;
+    }
+
     kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                           memargs.mem_to_use_set,
                                           memargs.num_kmers,
@@ -132,13 +262,19 @@ int ctx_exp_hashtest(int argc, char **argv)
 
     cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
 
-    db_graph_alloc(&db_graph, kmer_size, 1, 0, kmers_in_hash, DBG_ALLOC_BKTLOCKS);
+    db_graph_alloc(&db_graph, kmer_size, 1, 0, kmers_in_hash,
+                   (lockfree ? DBG_ALLOC_HT_LOCKFREE : DBG_ALLOC_BKTLOCKS) |
+                   (use_tags ? DBG_ALLOC_HT_TAGS : 0) |
+                   (hugepages ? DBG_ALLOC_HUGEPAGES : 0) |
+                   (cuckoo ? DBG_ALLOC_HT_CUCKOO : 0) |
+                   (headers ? DBG_ALLOC_HT_COLOCATE : 0));
     hash_table_print_stats(&db_graph.ht);
   }
 
-  status("[threads] using %zu thread%s (%s-threaded code)",
+  status("[threads] using %zu thread%s (%s-threaded code%s)",
          nthreads, util_plural_str(nthreads),
-         single_threaded ? "single" : "multi");
+         single_threaded ? "single" : "multi",
+         lockfree ? ", lock-free inserts" : "");
 
   struct HashLoopJob jobs[nthreads];
   size_t hash = 0;
@@ -148,15 +284,31 @@ int ctx_exp_hashtest(int argc, char **argv)
     size_t end = (i+1 == nthreads ? num_ops : start + (num_ops / nthreads));
     jobs[i] = (struct HashLoopJob){.db_graph = store_kmers ? &db_graph : NULL,
                                    .single_threaded = single_threaded,
+                                   .lockfree = lockfree, .find = false,
                                    .start = start, .end = end, .hash = 0};
   }
 
+  uint64_t t0 = ctx_stats_now_ns();
   util_run_threads(jobs, nthreads, sizeof(jobs[0]), nthreads, hash_loop);
+  uint64_t t1 = ctx_stats_now_ns();
 
   for(i = 0; i < nthreads; i++) hash += jobs[i].hash;
 
+  status("Insert: %.3f sec (%.1f ns per kmer)", (t1-t0)/1e9,
+         num_ops ? (double)(t1-t0)/num_ops : 0.0);
+
   if(store_kmers) {
     hash_table_print_stats(&db_graph.ht);
+
+    // Find all kmers again
+    for(i = 0; i < nthreads; i++) jobs[i].find = true;
+    t0 = ctx_stats_now_ns();
+    util_run_threads(jobs, nthreads, sizeof(jobs[0]), nthreads, hash_loop);
+    t1 = ctx_stats_now_ns();
+    for(i = 0; i < nthreads; i++) hash += jobs[i].hash;
+    status("Find: %.3f sec (%.1f ns per kmer)", (t1-t0)/1e9,
+           num_ops ? (double)(t1-t0)/num_ops : 0.0);
+
     db_graph_dealloc(&db_graph);
   }
 
@@ -0,0 +1,281 @@
+#include "global.h"
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "db_graph.h"
+#include "graphs_load.h"
+#include "graph_writer.h"
+#include "build_graph.h"
+#include "grow_graph.h"
+
+// Most kmer sizes to grow in one run
+#define GROWK_MAX_KMERS 16
+
+const char growk_usage[] =
+"usage: "CMD" growk [options] -k <K> [-k <K2> ...] -o <out> <in.ctx>\n"
+"\n"
+"  Derive graphs with larger kmer sizes from a graph of kmer size k, without\n"
+"  rebuilding from reads. Kmers inside unitigs of in.ctx are taken from the\n"
+"  unitigs. Kmers that span a junction need reads: they are added from any\n"
+"  sequence given if every k-mer within them is in in.ctx. Sequence files\n"
+"  are read once for all kmer sizes. Saves <out>.k<K>.ctx for each -k.\n"
+"\n"
+"  -h, --help               This help message\n"
+"  -q, --quiet              Silence status output normally printed to STDERR\n"
+"  -f, --force              Overwrite output files\n"
+"  -m, --memory <mem>       Memory to use\n"
+"  -n, --nkmers <kmers>     Number of hash table entries in each graph\n"
+"  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -k, --kmer <K>           Kmer size to grow to, can be given multiple times\n"
+"                           ("QUOTE_VALUE(MAX_KMER_SIZE)" >= K > k, K must be odd)\n"
+"  -o, --out <out>          Output prefix [required]\n"
+"  -S, --sort               Write kmers in sorted order\n"
+"\n"
+"  Input:\n"
+"  -c, --colour <c>         Colour to load following sequence into [default: 0]\n"
+"  -1, --seq <in.fa>        Load sequence data\n"
+"  -2, --seq2 <in1:in2>     Load paired end sequence data\n"
+"  -i, --seqi <in.bam>      Load paired end sequence from a single file\n"
+"  -Q, --fq-cutoff <Q>      Filter quality scores [default: 0 (off)]\n"
+"  -O, --fq-offset <N>      FASTQ ASCII offset    [default: 0 (auto-detect)]\n"
+"  -H, --cut-hp <bp>        Breaks reads at homopolymers >= <bp> [default: off]\n"
+"\n"
+"  Input options must come before the sequence file they apply to.\n"
+"  Without sequence, kmers spanning junctions of in.ctx are missing.\n"
+"  All kmer sizes must be supported by this binary, e.g. k=33 to K=63 with\n"
+"  "CMD" built with MAXK=63.\n"
+"\n";
+
+static struct option longopts[] =
+{
+// General options
+  {"help",         no_argument,       NULL, 'h'},
+  {"force",        no_argument,       NULL, 'f'},
+  {"memory",       required_argument, NULL, 'm'},
+  {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
+  {"kmer",         required_argument, NULL, 'k'},
+  {"out",          required_argument, NULL, 'o'},
+  {"sort",         no_argument,       NULL, 'S'},
+// input
+  {"colour",       required_argument, NULL, 'c'},
+  {"seq",          required_argument, NULL, '1'},
+  {"seq2",         required_argument, NULL, '2'},
+  {"seqi",         required_argument, NULL, 'i'},
+  {"fq-cutoff",    required_argument, NULL, 'Q'},
+  {"fq-offset",    required_argument, NULL, 'O'},
+  {"cut-hp",       required_argument, NULL, 'H'},
+  {NULL, 0, NULL, 0}
+};
+
+static BuildGraphTaskBuffer gtasks;
+
+static size_t nthreads = 0;
+static struct MemArgs memargs = MEM_ARGS_INIT;
+static const char *out_prefix = NULL;
+static bool sort_kmers = false;
+static size_t kmer_sizes[GROWK_MAX_KMERS], num_kmer_sizes = 0;
+
+static int _cmp_kmer_size(const void *a, const void *b)
+{
+  return cmp(*(const size_t*)a, *(const size_t*)b);
+}
+
+static void parse_args(int argc, char **argv)
+{
+  SeqLoadingPrefs prefs = SEQ_LOADING_PREFS_INIT;
+  uint8_t fq_offset = 0;
+  bool used = true;
+  size_t i;
+
+  // Arg parsing
+  char cmd[100], shortopts[300];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    cmd_get_longopt_str(longopts, c, cmd, sizeof(cmd));
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
+      case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads,cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'k':
+        if(num_kmer_sizes == GROWK_MAX_KMERS)
+          cmd_print_usage("Too many kmer sizes (max %i)", GROWK_MAX_KMERS);
+        kmer_sizes[num_kmer_sizes++] = cmd_kmer_size(cmd, optarg);
+        break;
+      case 'o': cmd_check(!out_prefix,cmd); out_prefix = optarg; break;
+      case 'S': cmd_check(!sort_kmers,cmd); sort_kmers = true; break;
+      case '1':
+      case '2':
+      case 'i':
+      {
+        BuildGraphTask task;
+        memset(&task, 0, sizeof(task));
+        task.prefs = prefs;
+        task.stats = SEQ_LOADING_STATS_INIT;
+        asyncio_task_parse(&task.files, c, optarg, fq_offset, NULL);
+        uint8_t offset = task.files.fq_offset;
+        if(offset >= 128) die("fq-offset too big: %i", (int)offset);
+        if(offset+prefs.fq_cutoff >= 128) die("fq-cutoff too big: %i", offset+prefs.fq_cutoff);
+        build_graph_task_buf_push(&gtasks, &task, 1);
+        used = true;
+        break;
+      }
+      case 'c': prefs.colour = cmd_uint32(cmd, optarg); used = false; break;
+      case 'O': fq_offset = cmd_uint8(cmd, optarg); used = false; break;
+      case 'Q': prefs.fq_cutoff = cmd_uint8(cmd, optarg); used = false; break;
+      case 'H': prefs.hp_cutoff = cmd_uint8(cmd, optarg); used = false; break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        die("`"CMD" growk -h` for help. Bad option: %s", argv[optind-1]);
+      default: die("Bad option: %s", cmd);
+    }
+  }
+
+  if(!nthreads) nthreads = DEFAULT_NTHREADS;
+  graph_writer_set_nthreads(nthreads);
+
+  if(optind+1 != argc) cmd_print_usage("Please give one input graph");
+  if(!used) cmd_print_usage("Arguments not given BEFORE sequence file");
+  if(out_prefix == NULL) cmd_print_usage("--out <out> is required");
+  if(num_kmer_sizes == 0) cmd_print_usage("Please give a kmer size (-k <K>)");
+
+  qsort(kmer_sizes, num_kmer_sizes, sizeof(kmer_sizes[0]), _cmp_kmer_size);
+  for(i = 1; i < num_kmer_sizes; i++)
+    if(kmer_sizes[i] == kmer_sizes[i-1])
+      cmd_print_usage("Kmer size given twice: %zu", kmer_sizes[i]);
+}
+
+int ctx_growk(int argc, char **argv)
+{
+  size_t i, d, col;
+  build_graph_task_buf_alloc(&gtasks, 16);
+
+  parse_args(argc, argv);
+
+  char *ctx_path = argv[optind];
+  GraphFileReader gfile;
+  memset(&gfile, 0, sizeof(gfile));
+  size_t ctx_max_kmers = 0, ctx_sum_kmers = 0;
+  graph_files_open(&ctx_path, &gfile, 1, &ctx_max_kmers, &ctx_sum_kmers);
+
+  const size_t ksrc = gfile.hdr.kmer_size;
+  const size_t ncols = file_filter_into_ncols(&gfile.fltr);
+
+  if(kmer_sizes[0] <= ksrc)
+    die("Kmer size %zu is not bigger than that of %s (k=%zu)",
+        kmer_sizes[0], ctx_path, ksrc);
+
+  for(i = 0; i < gtasks.len; i++) {
+    if(gtasks.b[i].prefs.colour >= ncols)
+      die("--colour %zu is not a colour of %s (%zu colours)",
+          (size_t)gtasks.b[i].prefs.colour, ctx_path, ncols);
+  }
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+
+  // Every graph has the same capacity, input graph also has a visited bit
+  bits_per_kmer = sizeof(BinaryKmer)*8 +
+                  (sizeof(CovgStore) + sizeof(Edges)) * 8 * ncols +
+                  ncols; // in colour
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+                                        memargs.mem_to_use_set,
+                                        memargs.num_kmers,
+                                        memargs.num_kmers_set,
+                                        bits_per_kmer * (num_kmer_sizes+1) + 1,
+                                        ctx_max_kmers, ctx_sum_kmers,
+                                        true, &graph_mem);
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+
+  //
+  // Check output paths
+  //
+  StrBuf *out_paths = ctx_calloc(num_kmer_sizes, sizeof(StrBuf));
+  bool err = false;
+  for(d = 0; d < num_kmer_sizes; d++) {
+    strbuf_alloc(&out_paths[d], 256);
+    strbuf_sprintf(&out_paths[d], "%s.k%zu.ctx", out_prefix, kmer_sizes[d]);
+    err |= futil_check_outfile(out_paths[d].b);
+  }
+  if(err) die("Use -f,--force to overwrite files");
+
+  //
+  // Allocate and load input graph
+  //
+  dBGraph src;
+  db_graph_alloc(&src, ksrc, ncols, ncols, kmers_in_hash,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL);
+
+  GraphLoadingPrefs gprefs = graph_loading_prefs(&src);
+  gprefs.nthreads = nthreads;
+  graph_load(&gfile, gprefs, NULL);
+  graph_file_close(&gfile);
+
+  hash_table_print_stats(&src.ht);
+
+  dBGraph *dsts = ctx_calloc(num_kmer_sizes, sizeof(dBGraph));
+  for(d = 0; d < num_kmer_sizes; d++) {
+    db_graph_alloc(&dsts[d], kmer_sizes[d], ncols, ncols, kmers_in_hash,
+                   DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                   DBG_ALLOC_BKTLOCKS);
+  }
+
+  GrowGraph gg = {.src = &src, .dsts = dsts, .ndsts = num_kmer_sizes};
+
+  //
+  // Grow
+  //
+  status("[growk] Adding kmers from unitigs with %zu threads", nthreads);
+  size_t phase = ctx_stats_phase_start("unitigs");
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(src.ht.capacity), 1);
+  grow_graph_from_unitigs(&gg, nthreads, visited);
+  ctx_free(visited);
+  ctx_stats_phase_end(phase);
+
+  if(gtasks.len > 0)
+  {
+    status("[growk] Adding kmers spanning junctions from reads");
+    phase = ctx_stats_phase_start("reads");
+    for(i = 0; i < gtasks.len; i++) build_graph_task_print(&gtasks.b[i]);
+    grow_graph_from_reads(&gg, gtasks.b, gtasks.len, nthreads);
+    for(i = 0; i < gtasks.len; i++) {
+      build_graph_task_print_stats(&gtasks.b[i]);
+      build_graph_task_destroy(&gtasks.b[i]);
+    }
+    ctx_stats_phase_end(phase);
+  }
+  else warn("No sequence given: kmers that span junctions will be missing");
+
+  //
+  // Save
+  //
+  for(d = 0; d < num_kmer_sizes; d++)
+  {
+    for(col = 0; col < ncols; col++)
+      graph_info_cpy(&dsts[d].ginfo[col], &src.ginfo[col]);
+    dsts[d].num_of_cols_used = src.num_of_cols_used;
+
+    status("[growk] k=%zu -> k=%zu", ksrc, kmer_sizes[d]);
+    hash_table_print_stats(&dsts[d].ht);
+    graph_writer_save_mkhdr(out_paths[d].b, &dsts[d], sort_kmers, ncols);
+
+    db_graph_dealloc(&dsts[d]);
+    strbuf_dealloc(&out_paths[d]);
+  }
+
+  ctx_free(dsts);
+  ctx_free(out_paths);
+  db_graph_dealloc(&src);
+  build_graph_task_buf_dealloc(&gtasks);
+
+  return EXIT_SUCCESS;
+}
@@ -20,6 +20,11 @@ const char health_usage[] =
 "  -p, --paths <in.ctp>   Load link file (can specify multiple times)\n"
 //
 "  -E, --no-edge-check    Don't check kmer edges\n"
+"  -S, --sample <f>       Only check a random fraction <f> of kmers and their\n"
+"                         links, e.g. 0.01 for a quick check [default: 1]\n"
+"  -r, --seed <n>         Seed for picking kmers with --sample\n"
+"\n"
+"  Kmer edges, colours and coverages are checked with <T> threads.\n"
 "\n";
 
 // Note: although it seems like we should load link files one at a time and
@@ -35,7 +40,9 @@ static struct option longopts[] =
   {"threads",       required_argument, NULL, 't'},
   {"paths",         required_argument, NULL, 'p'},
 // command specific
-  {"no-edge-check", no_argument,       NULL, 'H'},
+  {"no-edge-check", no_argument,       NULL, 'E'},
+  {"sample",        required_argument, NULL, 'S'},
+  {"seed",          required_argument, NULL, 'r'},
   {NULL, 0, NULL, 0}
 };
 
@@ -44,6 +51,9 @@ int ctx_health_check(int argc, char **argv)
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
   bool do_edge_check = true;
+  double sample_fraction = 1;
+  bool sample_set = false, seed_set = false;
+  uint64_t seed = 0;
 
   GPathReader tmp_gpfile;
   GPathFileBuffer gpfiles;
@@ -75,6 +85,17 @@ int ctx_health_check(int argc, char **argv)
         gpfile_buf_push(&gpfiles, &tmp_gpfile, 1);
         break;
       case 'E': if(!do_edge_check) die("%s set twice", cmd); do_edge_check=false; break;
+      case 'S':
+        if(sample_set) die("%s set twice", cmd);
+        sample_fraction = cmd_udouble_nonzero(cmd, optarg);
+        if(sample_fraction > 1) die("%s must be <= 1: %s", cmd, optarg);
+        sample_set = true;
+        break;
+      case 'r':
+        if(seed_set) die("%s set twice", cmd);
+        seed = cmd_size(cmd, optarg);
+        seed_set = true;
+        break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         die("`"CMD" check -h` for help. Bad option: %s", argv[optind-1]);
@@ -83,6 +104,8 @@ int ctx_health_check(int argc, char **argv)
   }
 
   if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+  if(!seed_set) seed = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+  if(seed_set && !sample_set) cmd_print_usage("--seed only used with --sample");
 
   if(optind+1 != argc)
     cmd_print_usage("Too %s arguments", optind == argc ? "few" : "many");
@@ -144,6 +167,7 @@ int ctx_health_check(int argc, char **argv)
   gpath_reader_alloc_gpstore(gpfiles.b, gpfiles.len, path_mem, false, &db_graph);
 
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   graph_load(&gfile, gprefs, NULL);
@@ -154,12 +178,18 @@ int ctx_health_check(int argc, char **argv)
     gpath_reader_close(&gpfiles.b[i]);
   }
 
+  hash_table_print_stats(&db_graph.ht);
+
+  if(sample_fraction < 1)
+    status("Checking %.2f%% of kmers, seed: %"PRIu64, sample_fraction*100, seed);
+
   if(do_edge_check)
-    db_graph_healthcheck(&db_graph);
+    db_graph_healthcheck_mt(&db_graph, nthreads, sample_fraction, seed);
 
   if(gpfiles.len) {
     status("Tracing reads through the graph...");
-    gpath_checks_all_paths(&db_graph, nthreads);
+    if(!gpath_checks_sample_paths(&db_graph, nthreads, sample_fraction, seed))
+      die("Link check failed");
   }
 
   graph_file_close(&gfile);
@@ -5,20 +5,41 @@
 #include "file_util.h"
 #include "graphs_load.h"
 #include "binary_kmer.h"
+#include "query_graph.h"
+#include "graph_footer.h"
 
 // TODO: add .ctp.gz indexing
 
 const char index_usage[] =
 "usage: "CMD" index [options] <in.ctx>\n"
+"       "CMD" index --query [options] <in.ctx>\n"
+"       "CMD" index --footer [-t <T>] <in.ctx>\n"
 "\n"
 "  Index a sorted cortex graph file (sort with `"CMD" sort` first).\n"
 "\n"
+"  With --footer, add a prefix index to the end of the graph file, replacing any\n"
+"  existing one (as `"CMD" sort --index`). <T> threads each index a range of\n"
+"  the file.\n"
+"\n"
+"  With --query, build a read-only query graph for `"CMD" coverage --query-graph`.\n"
+"  Kmers are numbered with a minimal perfect hash and are not stored: a 32 bit\n"
+"  fingerprint per kmer rejects kmers not in the graph (false positive rate\n"
+"  ~2^-32). Edges and coverages are packed with no empty slots. The graph does\n"
+"  not need to be sorted but should be cleaned.\n"
+"\n"
 "  -h, --help               This help message\n"
 "  -q, --quiet              Silence status output normally printed to STDERR\n"
 "  -f, --force              Overwrite output files\n"
 "  -o, --out <out.ctx.idx>  Output file [default: STDOUT]\n"
 "  -s, --block-size <S>     Block of <S> bytes [default: 4MB]\n"
 "  -b, --block-kmers <B>    Block of <B> kmers\n"
+"\n"
+"  -F, --footer             Write index into the graph file\n"
+"  -t, --threads <T>        Threads to use with --footer [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"\n"
+"  -Q, --query              Build a query graph [default out: <in.ctx>"QUERY_GRAPH_EXT"]\n"
+"  -m, --memory <mem>       Memory to load the graph with (--query only)\n"
+"  -n, --nkmers <N>         Hash table entries to load with (--query only)\n"
 "\n";
 
 static struct option longopts[] =
@@ -28,13 +49,66 @@ static struct option longopts[] =
   {"out",          required_argument, NULL, 'o'},
   {"block-size",   required_argument, NULL, 's'},
   {"block-kmers",  required_argument, NULL, 'b'},
+  {"query",        no_argument,       NULL, 'Q'},
+  {"memory",       required_argument, NULL, 'm'},
+  {"nkmers",       required_argument, NULL, 'n'},
+  {"footer",       no_argument,       NULL, 'F'},
+  {"threads",      required_argument, NULL, 't'},
   {NULL, 0, NULL, 0}
 };
 
+// Load a graph into a hash table then build and save a query graph
+static void index_query_graph(const char *ctx_path, const char *out_path,
+                              const struct MemArgs *memargs)
+{
+  GraphFileReader gfile;
+  memset(&gfile, 0, sizeof(GraphFileReader));
+  size_t ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+  char *paths[1] = {(char*)ctx_path};
+
+  ncols = graph_files_open(paths, &gfile, 1, &ctx_max_kmers, &ctx_sum_kmers);
+
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+  bits_per_kmer = sizeof(BinaryKmer)*8 +
+                  (sizeof(CovgStore) + sizeof(Edges)) * 8 * ncols;
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs->mem_to_use,
+                                        memargs->mem_to_use_set,
+                                        memargs->num_kmers,
+                                        memargs->num_kmers_set,
+                                        bits_per_kmer,
+                                        ctx_max_kmers, ctx_sum_kmers,
+                                        true, &graph_mem);
+
+  cmd_check_mem_limit(memargs->mem_to_use, graph_mem);
+
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, gfile.hdr.kmer_size, ncols, ncols, kmers_in_hash,
+                 DBG_ALLOC_COVGS | DBG_ALLOC_EDGES);
+
+  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.empty_colours = true;
+  graph_load(&gfile, gprefs, NULL);
+  graph_file_close(&gfile);
+
+  hash_table_print_stats(&db_graph.ht);
+
+  QueryGraph qgraph;
+  query_graph_build(&qgraph, &db_graph);
+  db_graph_dealloc(&db_graph);
+
+  query_graph_save(&qgraph, out_path);
+  query_graph_dealloc(&qgraph);
+
+  status("Saved query graph to %s", out_path);
+}
+
 int ctx_index(int argc, char **argv)
 {
+  struct MemArgs memargs = MEM_ARGS_INIT;
   const char *out_path = NULL;
-  size_t block_size = 0, block_kmers = 0;
+  size_t block_size = 0, block_kmers = 0, nthreads = 0;
+  bool query = false, footer = false;
 
   // Arg parsing
   char cmd[100];
@@ -59,6 +133,11 @@ int ctx_index(int argc, char **argv)
         cmd_check(!block_size, cmd);
         block_size = cmd_size_nonzero(cmd, optarg);
         break;
+      case 'Q': cmd_check(!query, cmd); query = true; break;
+      case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
+      case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 'F': cmd_check(!footer, cmd); footer = true; break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -75,6 +154,30 @@ int ctx_index(int argc, char **argv)
 
   const char *ctx_path = argv[optind];
 
+  if(nthreads && !footer)
+    cmd_print_usage("--threads is only used with --footer");
+
+  if(footer && (query || out_path || block_size || block_kmers))
+    cmd_print_usage("Cannot use --query, --out, --block-size or --block-kmers "
+                    "with --footer");
+
+  if(query) {
+    if(block_size || block_kmers)
+      cmd_print_usage("Cannot use --block-size or --block-kmers with --query");
+    char *qg_path = NULL;
+    if(out_path == NULL) {
+      qg_path = ctx_malloc(strlen(ctx_path) + strlen(QUERY_GRAPH_EXT) + 1);
+      sprintf(qg_path, "%s"QUERY_GRAPH_EXT, ctx_path);
+      out_path = qg_path;
+    }
+    index_query_graph(ctx_path, out_path, &memargs);
+    ctx_free(qg_path);
+    return EXIT_SUCCESS;
+  }
+
+  if(memargs.mem_to_use_set || memargs.num_kmers_set)
+    cmd_print_usage("--memory and --nkmers are only used with --query");
+
   //
   // Open Graph file
   //
@@ -85,6 +188,16 @@ int ctx_index(int argc, char **argv)
   if(!file_filter_from_direct(&gfile.fltr))
     die("Cannot open graph file with a filter ('in.ctx:blah' syntax)");
 
+  if(graph_file_is_blocked(&gfile))
+    die("Block compressed graphs already have an index: %s", ctx_path);
+
+  if(footer) {
+    graph_footer_index_file(&gfile, nthreads ? nthreads : DEFAULT_NTHREADS);
+    status("Saved index footer to %s", ctx_path);
+    graph_file_close(&gfile);
+    return EXIT_SUCCESS;
+  }
+
   // Open output file
   FILE *fout = out_path ? futil_fopen_create(out_path, "w") : stdout;
 
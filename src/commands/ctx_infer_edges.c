@@ -113,7 +113,8 @@ static size_t inferedges_on_mmap(const dBGraph *db_graph, bool add_all_edges,
 
 // Using file so can call fseek and don't need to load whole graph
 static size_t inferedges_on_file(const dBGraph *db_graph, bool add_all_edges,
-                                 GraphFileReader *file, FILE *fout)
+                                 GraphFileReader *file,
+                                 const GraphFileHeader *outhdr, FILE *fout)
 {
   // ctx_assert(db_graph->num_of_cols == file->hdr.num_of_cols);
   ctx_assert(file_filter_from_direct(&file->fltr));
@@ -124,7 +125,7 @@ static size_t inferedges_on_file(const dBGraph *db_graph, bool add_all_edges,
   status("[inferedges] Processing file: %s", file_filter_path(&file->fltr));
 
   // Print header
-  graph_write_header(fout, &file->hdr);
+  graph_write_header(fout, outhdr);
 
   // Read the input file again
   if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
@@ -222,6 +223,13 @@ int ctx_infer_edges(int argc, char **argv)
   if(!file_filter_from_direct(&file.fltr))
     cmd_print_usage("Inferedges with filter not implemented - sorry");
 
+  if(editing_file && graph_file_is_blocked(&file))
+    cmd_print_usage("Cannot edit block compressed graph in place, use --out");
+
+  // Output has fixed size kmer records
+  GraphFileHeader outhdr = file.hdr;
+  outhdr.version = CTX_GRAPH_FILEFORMAT;
+
   FILE *fout = NULL;
 
   // Editing input file or writing a new file
@@ -273,6 +281,7 @@ int ctx_infer_edges(int argc, char **argv)
                  kmers_in_hash, alloc_flags);
 
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = num_of_threads;
 
   // We need to load the graph for both --pop and --all since we need to check
   // if the next kmer is in each of the colours
@@ -288,15 +297,16 @@ int ctx_infer_edges(int argc, char **argv)
     // Reading STDIN, writing STDOUT/file
     ctx_assert(fout != NULL);
     num_kmers_edited = infer_edges(num_of_threads, add_all_edges, &db_graph);
-    graph_write_header(fout, &file.hdr);
-    graph_write_all_kmers_direct(fout, &db_graph, false, &file.hdr);
+    graph_write_header(fout, &outhdr);
+    graph_write_all_kmers_direct(fout, &db_graph, false, &outhdr);
   }
   else if(fout == NULL) {
     // Reading from file, writing to same file
     num_kmers_edited = inferedges_on_mmap(&db_graph, add_all_edges, &file);
   } else {
     // Reading from file, writing to STDOUT/file
-    num_kmers_edited = inferedges_on_file(&db_graph, add_all_edges, &file, fout);
+    num_kmers_edited = inferedges_on_file(&db_graph, add_all_edges, &file,
+                                          &outhdr, fout);
   }
 
   if(fout != NULL && fout != stdout) fclose(fout);
@@ -9,6 +9,9 @@
 #include "db_node.h"
 #include "graphs_load.h"
 #include "graph_writer.h"
+#include "graph_shards.h"
+#include "infer_edges.h"
+#include "kmer_hll.h"
 
 // Given (A,B,C) are ctx binaries, A:1 means colour 1 in A,
 // {A:1,B:0} is loading A:1 and B:0 into a single colour
@@ -28,12 +31,36 @@ const char join_usage[] =
 "  -o, --out <out.ctx>     Output file [required]\n"
 "  -m, --memory <mem>      Memory to use\n"
 "  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>       Number of threads to load with [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 //
 "  -N, --ncols <c>         How many colours to load at once [default: 1]\n"
 "  -i, --intersect <a.ctx> Only load the kmers that are in graph A.ctx. Can be\n"
 "                          specified multiple times. <a.ctx> is NOT merged into\n"
 "                          the output file.\n"
 "  -S, --sort              Output sorted graph file\n"
+"  -z, --compress          Write a block compressed graph (format version 7)\n"
+"  -Z, --colour-blocks     Block compress with colours stored separately, for\n"
+"                          fast loading of a few colours (implies -z)\n"
+"  -D, --delta-covgs       Block compress storing each kmer as a base coverage\n"
+"                          plus per-colour differences, for related samples\n"
+"                          (implies -z, cannot be used with -Z)\n"
+"  -M, --sorted-merge      Inputs are sorted, merge them as a stream without\n"
+"                          loading kmers into memory. --intersect files must\n"
+"                          also be sorted.\n"
+"  -x, --subtract <b.ctx>  Drop kmers that are in graph B.ctx. Can be specified\n"
+"                          multiple times. Requires --sorted-merge.\n"
+"  -C, --min-cols <N>      Only write kmers with coverage in at least N colours.\n"
+"                          Requires --sorted-merge.\n"
+"  -s, --shards <N>        Split into N sorted minimizer shards, loading one at\n"
+"                          a time. --out is the manifest <out.shards>\n"
+"  -g, --gather <in.shards>\n"
+"                          Merge the shards listed in a manifest as a stream.\n"
+"                          No input graphs are given.\n"
+"  -E, --infer-edges       Add all missing edges between kmers once merged,\n"
+"                          same as `"CMD" inferedges --all` (all colours must\n"
+"                          fit in memory)\n"
+"  -e, --estimate-kmers    Read inputs twice: first count distinct kmers in the\n"
+"                          union with a HyperLogLog sketch, to size the table\n"
 "\n"
 "  Files can be specified with specific colours: samples.ctx:2,3\n"
 "  Offset specifies where to load the first colour: 3:samples.ctx\n"
@@ -47,30 +74,134 @@ static struct option longopts[] =
   {"force",        no_argument,       NULL, 'f'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
 // command specific
   {"ncols",        required_argument, NULL, 'N'},
   {"intersect",    required_argument, NULL, 'i'},
   {"sort",         no_argument,       NULL, 'S'},
+  {"compress",     no_argument,       NULL, 'z'},
+  {"colour-blocks", no_argument,      NULL, 'Z'},
+  {"delta-covgs",  no_argument,       NULL, 'D'},
+  {"sorted-merge", no_argument,       NULL, 'M'},
+  {"subtract",     required_argument, NULL, 'x'},
+  {"min-cols",     required_argument, NULL, 'C'},
+  {"shards",       required_argument, NULL, 's'},
+  {"gather",       required_argument, NULL, 'g'},
+  {"infer-edges",  no_argument,       NULL, 'E'},
+  {"estimate-kmers", no_argument,     NULL, 'e'},
   {NULL, 0, NULL, 0}
 };
 
-static inline void remove_non_intersect_nodes(hkey_t node, Covg *covgs,
+static inline void remove_non_intersect_nodes(hkey_t node, const dBGraph *graph,
                                               Covg num, HashTable *ht)
 {
-  if(covgs[node] != num)
+  if(db_node_get_covg(graph, node, 0) != num)
     hash_table_delete(ht, node);
 }
 
+// Merge the sorted shards listed in a manifest. Every shard has the header of
+// the whole graph, so the header is taken from the first shard.
+static void join_gather(const char *out_path, const char *manifest_path)
+{
+  GraphShards shards;
+  graph_shards_load(&shards, manifest_path);
+
+  size_t i, n = shards.num_shards;
+  GraphFileReader *files = ctx_calloc(n, sizeof(GraphFileReader));
+
+  for(i = 0; i < n; i++) {
+    graph_file_open2(&files[i], shards.paths[i], "r", true, 0);
+    if(files[i].hdr.kmer_size != files[0].hdr.kmer_size ||
+       (shards.kmer_size && files[i].hdr.kmer_size != shards.kmer_size)) {
+      die("Shard kmer size doesn't match [%u vs %zu]: %s",
+          files[i].hdr.kmer_size, shards.kmer_size, shards.paths[i]);
+    }
+    if(file_filter_into_ncols(&files[i].fltr) !=
+       file_filter_into_ncols(&files[0].fltr)) {
+      die("Shards have different numbers of colours: %s vs %s",
+          shards.paths[0], shards.paths[i]);
+    }
+  }
+
+  GraphFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  graph_file_merge_header(&hdr, &files[0]);
+  hdr.version = graph_writer_get_version();
+
+  graph_writer_merge_sorted(out_path, files, n, &hdr);
+
+  graph_header_dealloc(&hdr);
+  for(i = 0; i < n; i++) graph_file_close(&files[i]);
+  ctx_free(files);
+  graph_shards_dealloc(&shards);
+}
+
+// Split graphs into sorted minimizer shards, loading all of the input graphs'
+// colours for one shard at a time
+static void join_split(const char *manifest_path, size_t nshards,
+                       GraphFileReader *gfiles, size_t num_gfiles,
+                       size_t ncols, uint64_t max_kmers, uint64_t sum_kmers,
+                       const struct MemArgs *memargs, size_t nthreads)
+{
+  size_t i, s, bits_per_kmer, kmers_in_hash, graph_mem;
+
+  // Allow for uneven shard sizes
+  max_kmers = (max_kmers*5/4)/nshards+1;
+  sum_kmers = (sum_kmers*5/4)/nshards+1;
+
+  bits_per_kmer = sizeof(BinaryKmer)*8 +
+                  (sizeof(CovgStore) + sizeof(Edges)) * 8 * ncols +
+                  sizeof(hkey_t)*8;
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs->mem_to_use,
+                                        memargs->mem_to_use_set,
+                                        memargs->num_kmers,
+                                        memargs->num_kmers_set,
+                                        bits_per_kmer,
+                                        max_kmers, sum_kmers,
+                                        true, &graph_mem);
+
+  cmd_check_mem_limit(memargs->mem_to_use, graph_mem);
+
+  GraphShards shards;
+  graph_shards_alloc(&shards, manifest_path, gfiles[0].hdr.kmer_size, nshards);
+  for(s = 0; s < nshards; s++) futil_create_output(shards.paths[s]);
+
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, ncols, ncols,
+                 kmers_in_hash, DBG_ALLOC_EDGES | DBG_ALLOC_COVGS);
+
+  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
+  gprefs.nshards = nshards;
+
+  for(s = 0; s < nshards; s++) {
+    status("[join] Loading shard %zu of %zu", s+1, nshards);
+    db_graph_reset(&db_graph);
+    gprefs.shard = s;
+    for(i = 0; i < num_gfiles; i++) graph_load(&gfiles[i], gprefs, NULL);
+    hash_table_print_stats(&db_graph.ht);
+    graph_writer_save_mkhdr(shards.paths[s], &db_graph, true, ncols);
+  }
+
+  graph_shards_save(&shards, manifest_path);
+
+  db_graph_dealloc(&db_graph);
+  graph_shards_dealloc(&shards);
+}
+
 int ctx_join(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *out_path = NULL;
-  size_t use_ncols = 0;
-  bool sort_kmers = false;
+  const char *out_path = NULL, *gather_path = NULL;
+  size_t use_ncols = 0, nthreads = 0, nshards = 0, min_cols = 0;
+  bool sort_kmers = false, sorted_merge = false, infer = false;
+  bool estimate_kmers = false;
 
   GraphFileReader tmp_gfile;
-  GraphFileBuffer isec_gfiles_buf;
+  GraphFileBuffer isec_gfiles_buf, sub_gfiles_buf;
   gfile_buf_alloc(&isec_gfiles_buf, 8);
+  gfile_buf_alloc(&sub_gfiles_buf, 8);
 
   // Arg parsing
   char cmd[100], shortopts[100];
@@ -86,6 +217,7 @@ int ctx_join(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'N': cmd_check(!use_ncols, cmd); use_ncols = cmd_uint32_nonzero(cmd, optarg); break;
       case 'i':
         graph_file_reset(&tmp_gfile);
@@ -95,7 +227,37 @@ int ctx_join(int argc, char **argv)
         file_filter_flatten(&tmp_gfile.fltr, 0);
         gfile_buf_push(&isec_gfiles_buf, &tmp_gfile, 1);
         break;
+      case 'x':
+        graph_file_reset(&tmp_gfile);
+        graph_file_open(&tmp_gfile, optarg);
+        file_filter_flatten(&tmp_gfile.fltr, 0);
+        gfile_buf_push(&sub_gfiles_buf, &tmp_gfile, 1);
+        break;
+      case 'C': cmd_check(!min_cols,cmd); min_cols = cmd_uint32_nonzero(cmd, optarg); break;
       case 'S': cmd_check(!sort_kmers,cmd); sort_kmers = true; break;
+      case 'M': cmd_check(!sorted_merge,cmd); sorted_merge = true; break;
+      case 's': cmd_check(!nshards,cmd); nshards = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'g': cmd_check(!gather_path,cmd); gather_path = optarg; break;
+      case 'E': cmd_check(!infer,cmd); infer = true; break;
+      case 'e': cmd_check(!estimate_kmers,cmd); estimate_kmers = true; break;
+      case 'z':
+        cmd_check(graph_writer_get_version() != CTX_GRAPH_FILEFORMAT_BLOCKS, cmd);
+        graph_writer_set_version(CTX_GRAPH_FILEFORMAT_BLOCKS);
+        break;
+      case 'Z':
+        cmd_check(!graph_writer_get_colour_blocks(), cmd);
+        if(graph_writer_get_delta_covgs())
+          cmd_print_usage("Cannot use --colour-blocks with --delta-covgs");
+        graph_writer_set_colour_blocks(true);
+        graph_writer_set_version(CTX_GRAPH_FILEFORMAT_BLOCKS);
+        break;
+      case 'D':
+        cmd_check(!graph_writer_get_delta_covgs(), cmd);
+        if(graph_writer_get_colour_blocks())
+          cmd_print_usage("Cannot use --colour-blocks with --delta-covgs");
+        graph_writer_set_delta_covgs(true);
+        graph_writer_set_version(CTX_GRAPH_FILEFORMAT_BLOCKS);
+        break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -104,14 +266,45 @@ int ctx_join(int argc, char **argv)
     }
   }
 
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+  graph_writer_set_nthreads(nthreads);
+
   GraphFileReader *igfiles = isec_gfiles_buf.b;
   size_t num_igfiles = isec_gfiles_buf.len;
+  GraphFileReader *sgfiles = sub_gfiles_buf.b;
+  size_t num_sgfiles = sub_gfiles_buf.len;
 
   if(!out_path) cmd_print_usage("--out <out.ctx> required");
 
+  if(gather_path)
+  {
+    if(optind < argc)
+      cmd_print_usage("Input graphs are not given with --gather");
+    if(nshards || sorted_merge || num_igfiles > 0 || num_sgfiles > 0 ||
+       min_cols || use_ncols || sort_kmers || infer || estimate_kmers)
+      cmd_print_usage("--gather cannot be used with other join options");
+    futil_create_output(out_path);
+    join_gather(out_path, gather_path);
+    gfile_buf_dealloc(&isec_gfiles_buf);
+    gfile_buf_dealloc(&sub_gfiles_buf);
+    return EXIT_SUCCESS;
+  }
+
   if(optind >= argc)
     cmd_print_usage("Please specify at least one input graph file");
 
+  if(!sorted_merge && (num_sgfiles > 0 || min_cols))
+    cmd_print_usage("--subtract and --min-cols require --sorted-merge");
+
+  if(nshards && (sorted_merge || num_igfiles > 0 || use_ncols))
+    cmd_print_usage("Cannot use --shards with --sorted-merge, --intersect or --ncols");
+
+  if(infer && (sorted_merge || nshards))
+    cmd_print_usage("Cannot use --infer-edges with --sorted-merge or --shards");
+
+  if(estimate_kmers && (sorted_merge || num_igfiles > 0))
+    cmd_print_usage("Cannot use --estimate-kmers with --sorted-merge or --intersect");
+
   // optind .. argend-1 are graphs to load
   size_t num_gfiles = (size_t)(argc - optind);
   char **gfile_paths = argv + optind;
@@ -139,6 +332,13 @@ int ctx_join(int argc, char **argv)
     ctx_sum_kmers += graph_file_nkmers(&gfiles[i]);
   }
 
+  for(i = 0; i < num_sgfiles; i++) {
+    if(gfiles[0].hdr.kmer_size != sgfiles[i].hdr.kmer_size) {
+      cmd_print_usage("Kmer sizes don't match [%u vs %u]",
+                      gfiles[0].hdr.kmer_size, sgfiles[i].hdr.kmer_size);
+    }
+  }
+
   // Probe intersection graph files
   for(i = 0; i < num_igfiles; i++)
   {
@@ -158,6 +358,27 @@ int ctx_join(int argc, char **argv)
     }
   }
 
+  // Kmers shared between graphs are counted once, instead of summing
+  if(estimate_kmers)
+  {
+    KmerHLL hll;
+    kmer_hll_alloc(&hll, KMER_HLL_BITS);
+    status("[join] Estimating number of kmers...");
+    for(i = 0; i < num_gfiles; i++) {
+      if(file_filter_isstdin(&gfiles[i].fltr))
+        cmd_print_usage("Cannot use --estimate-kmers when reading from STDIN");
+      kmer_hll_add_graph(&hll, &gfiles[i]);
+    }
+    // Allow for ~3 standard errors
+    uint64_t est = kmer_hll_estimate(&hll);
+    est += est / 32;
+    kmer_hll_dealloc(&hll);
+
+    char est_str[50];
+    status("[join] Estimated %s distinct kmers", ulong_to_str(est, est_str));
+    ctx_sum_kmers = MAX2(est, ctx_max_kmers);
+  }
+
   bool take_intersect = (num_igfiles > 0);
 
   // If we are taking an intersection,
@@ -182,13 +403,53 @@ int ctx_join(int argc, char **argv)
     use_ncols = output_to_stdout ? ctx_max_cols : 1;
   }
 
+  // Inferring edges needs to know which colours have each neighbour
+  if(infer) {
+    if(use_ncols_set && use_ncols < ctx_max_cols)
+      cmd_print_usage("--infer-edges requires all %zu colours (--ncols)", ctx_max_cols);
+    use_ncols = ctx_max_cols;
+    use_ncols_set = true;
+  }
+
   // Check out_path is writable
   futil_create_output(out_path);
 
-  status("Output %zu cols; from %zu files; intersecting %zu graphs; ",
-         ctx_max_cols, num_gfiles, num_igfiles);
+  status("Output %zu cols; from %zu files; intersecting %zu graphs; "
+         "subtracting %zu graphs", ctx_max_cols, num_gfiles, num_igfiles,
+         num_sgfiles);
+
+  if(nshards)
+  {
+    if(output_to_stdout) cmd_print_usage("Cannot write --shards to STDOUT");
+    for(i = 0; i < num_gfiles; i++)
+      if(file_filter_isstdin(&gfiles[i].fltr))
+        cmd_print_usage("--shards reads inputs once per shard, cannot use STDIN");
+    join_split(out_path, nshards, gfiles, num_gfiles, ctx_max_cols,
+               ctx_max_kmers, ctx_sum_kmers, &memargs, nthreads);
+    for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
+    gfile_buf_dealloc(&isec_gfiles_buf);
+    gfile_buf_dealloc(&sub_gfiles_buf);
+    ctx_free(gfiles);
+    return EXIT_SUCCESS;
+  }
+
+  if(sorted_merge)
+  {
+    // Stream through sorted inputs and filters, no hash table required
+    GraphMergeFilter filter = {.isec_files = igfiles, .num_isec = num_igfiles,
+                               .sub_files = sgfiles, .num_sub = num_sgfiles,
+                               .min_cols = min_cols};
+    graph_writer_merge_sorted_mkhdr(out_path, gfiles, num_gfiles, &filter);
+    for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
+    for(i = 0; i < num_igfiles; i++) graph_file_close(&igfiles[i]);
+    for(i = 0; i < num_sgfiles; i++) graph_file_close(&sgfiles[i]);
+    gfile_buf_dealloc(&isec_gfiles_buf);
+    gfile_buf_dealloc(&sub_gfiles_buf);
+    ctx_free(gfiles);
+    return EXIT_SUCCESS;
+  }
 
-  if(num_gfiles == 1 && num_igfiles == 0)
+  if(num_gfiles == 1 && num_igfiles == 0 && !infer)
   {
     // Loading only one file with no intersection files
     // Don't need to store a graph in memory, can filter as stream
@@ -201,6 +462,7 @@ int ctx_join(int argc, char **argv)
     graph_writer_stream_mkhdr(out_path, &gfiles[0], &db_graph, NULL, NULL);
     graph_file_close(&gfiles[0]);
     gfile_buf_dealloc(&isec_gfiles_buf);
+    gfile_buf_dealloc(&sub_gfiles_buf);
     ctx_free(gfiles);
 
     db_graph_dealloc(&db_graph);
@@ -214,7 +476,7 @@ int ctx_join(int argc, char **argv)
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  (sizeof(Covg) + sizeof(Edges)) * 8 * use_ncols +
+                  (sizeof(CovgStore) + sizeof(Edges)) * 8 * use_ncols +
                   (sort_kmers ? sizeof(hkey_t)*8 : 0);
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -232,7 +494,7 @@ int ctx_join(int argc, char **argv)
 
     use_ncols = MIN2(max_usencols, ctx_max_cols);
     bits_per_kmer = sizeof(BinaryKmer)*8 +
-                    (sizeof(Covg) + sizeof(Edges)) * 8 * use_ncols;
+                    (sizeof(CovgStore) + sizeof(Edges)) * 8 * use_ncols;
 
     // Re-check memory used
     kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -268,6 +530,7 @@ int ctx_join(int argc, char **argv)
   {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
     gprefs.boolean_covgs = true; // covg++ only
+    gprefs.nthreads = nthreads;
 
     for(i = 0; i < num_igfiles; i++)
     {
@@ -285,7 +548,7 @@ int ctx_join(int argc, char **argv)
     {
       // Remove nodes where covg != num_igfiles
       HASH_ITERATE_SAFE(&db_graph.ht, remove_non_intersect_nodes,
-                        db_graph.col_covgs, (Covg)num_igfiles, &db_graph.ht);
+                        &db_graph, (Covg)num_igfiles, &db_graph.ht);
     }
 
     status("Loaded intersection set\n");
@@ -298,7 +561,7 @@ int ctx_join(int argc, char **argv)
       graph_info_init(&db_graph.ginfo[i]);
 
     // Zero covgs
-    memset(db_graph.col_covgs, 0, db_graph.ht.capacity * sizeof(Covg));
+    memset(db_graph.col_covgs, 0, db_graph.ht.capacity * sizeof(CovgStore));
 
     // Use union edges we loaded to intersect new edges
     intersect_edges = db_graph.col_edges;
@@ -307,9 +570,29 @@ int ctx_join(int argc, char **argv)
 
   bool kmers_loaded = take_intersect, colours_loaded = false;
 
+  if(infer)
+  {
+    // Load all colours then add edges before saving
+    GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.must_exist_in_graph = take_intersect;
+    gprefs.must_exist_in_edges = intersect_edges;
+    gprefs.nthreads = nthreads;
+
+    for(i = 0; i < num_gfiles; i++)
+      graph_load(&gfiles[i], gprefs, NULL);
+    hash_table_print_stats(&db_graph.ht);
+
+    status("[join] Inferring all missing edges...");
+    size_t num_modified = infer_edges(nthreads, true, &db_graph);
+    char nstr[50];
+    status("[join] %s kmers had edges added", ulong_to_str(num_modified, nstr));
+
+    kmers_loaded = colours_loaded = true;
+  }
+
   graph_writer_merge_mkhdr(out_path, gfiles, num_gfiles,
                           kmers_loaded, colours_loaded, intersect_edges,
-                          intsct_gname_ptr, sort_kmers, &db_graph);
+                          intsct_gname_ptr, sort_kmers, nthreads, &db_graph);
 
   if(take_intersect)
     db_graph.col_edges -= db_graph.ht.capacity;
@@ -318,6 +601,7 @@ int ctx_join(int argc, char **argv)
 
   strbuf_dealloc(&intersect_gname);
   gfile_buf_dealloc(&isec_gfiles_buf);
+  gfile_buf_dealloc(&sub_gfiles_buf);
   ctx_free(gfiles);
 
   db_graph_dealloc(&db_graph);
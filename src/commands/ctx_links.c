@@ -7,12 +7,19 @@
 #include "json_hdr.h"
 #include "gpath_save.h"
 #include "clean_graph.h"
+#include "zstd_file.h"
 
 #include "carrays/carrays.h" // gca_median_size()
 
 #define DEFAULT_MAX_DIST 6
 #define DEFAULT_MAX_COVG 100
 
+// Number of kmers written by each thread at a time with --auto-clean
+#define AUTO_CLEAN_WRITE_KMERS (1<<16)
+
+// Number of kmers read at a time when streaming
+#define LINKS_BATCH_KMERS (1<<16)
+
 const char links_usage[] =
 "usage: "CMD" links [options] <in.ctp.gz>\n"
 "\n"
@@ -34,6 +41,11 @@ const char links_usage[] =
 "  -H,--covg-hist <f.csv>  Write link coverage matrix to a csv file\n"
 "  -D,--max-dist <max>     Set max dist when using --covg-hist ...\n"
 "  -C,--max-covg <max>     Set max covg when using --covg-hist ...\n"
+"\n"
+"  -a,--auto-clean         Pick the threshold (as -T) and clean with it (as -c)\n"
+"                          reading the input once. Requires --out. Holds all\n"
+"                          links in memory rather than streaming them\n"
+"  -t,--threads <T>        Threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "\n";
 
 static struct option longopts[] =
@@ -50,6 +62,8 @@ static struct option longopts[] =
   {"covg-hist",    required_argument, NULL, 'H'},
   {"max-dist",     required_argument, NULL, 'D'},
   {"max-covg",     required_argument, NULL, 'C'},
+  {"auto-clean",   no_argument,       NULL, 'a'},
+  {"threads",      required_argument, NULL, 't'},
 //
   {"limit",        required_argument, NULL, 'L'},
   {NULL, 0, NULL, 0}
@@ -79,9 +93,10 @@ static FILE* create_tmp_file(StrBuf *path, const char *base)
   return fh;
 }
 
-static void print_suggest_cutoff(size_t hist_distsize, size_t hist_covgsize,
-                                 uint64_t (*hists)[hist_covgsize],
-                                 FILE *fh)
+// Returns suggested cutoff, printed to `fh` with its working if not NULL
+static size_t print_suggest_cutoff(size_t hist_distsize, size_t hist_covgsize,
+                                   uint64_t (*hists)[hist_covgsize],
+                                   FILE *fh)
 {
   size_t i, dist, median, nthresh_failed = 0;
   size_t cutoffs[hist_distsize], sumcovgs[hist_distsize];
@@ -99,6 +114,13 @@ static void print_suggest_cutoff(size_t hist_distsize, size_t hist_covgsize,
     for(i = 0; i < hist_covgsize; i++) sumcovgs[dist] += hists[dist][i];
   }
 
+  median = gca_median_size(cutoffs+1, hist_distsize-1);
+
+  if(nthresh_failed)
+    warn("Threshold failed in %zu cases [default to 0]", nthresh_failed);
+
+  if(fh == NULL) return median;
+
   // Print cutoffs
   fprintf(fh, "sumcovgs=%zu", sumcovgs[1]);
   for(i = 2; i < hist_distsize; i++) fprintf(fh, ",%zu", sumcovgs[i]);
@@ -106,12 +128,476 @@ static void print_suggest_cutoff(size_t hist_distsize, size_t hist_covgsize,
   for(i = 2; i < hist_distsize; i++) fprintf(fh, ",%zu", cutoffs[i]);
   fprintf(fh, "\n");
 
-  median = gca_median_size(cutoffs+1, hist_distsize-1);
-
   fprintf(fh, "suggested_cutoff=%zu\n", median);
 
-  if(nthresh_failed)
-    warn("Threshold failed in %zu cases [default to 0]", nthresh_failed);
+  return median;
+}
+
+//
+// --auto-clean: trees of all kmers are kept in a LinkTreeStore. Coverage
+// histograms, cleaning and writing each split the trees between threads.
+//
+
+typedef struct
+{
+  size_t nthreads, kmer_size, hist_distsize, hist_covgsize, cutoff;
+  LinkTreeStore *store;
+  const char *kmers; // kmer_size chars per tree
+  uint32_t *nlinks; // [num_trees] links in each tree after cleaning
+  LinkTree *trees; // [nthreads]
+  uint64_t *hists; // [nthreads][hist_distsize][hist_covgsize]
+  LinkTreeStats *stats; // [nthreads]
+  StrBuf *sbufs, *zbufs; // [nthreads] text and gzip members
+  bool zstd; // output is a zstd stream, zbufs hold text
+  size_t start, end; // trees to write
+} LinksAutoClean;
+
+#define _auto_clean_part(ac,tid,s,e,start,end) do {                        \
+  (s) = (start) + (((end)-(start)) * (tid)) / (ac)->nthreads;              \
+  (e) = (start) + (((end)-(start)) * ((tid)+1)) / (ac)->nthreads;          \
+} while(0)
+
+static void _auto_clean_hist_thread(void *arg, size_t threadid)
+{
+  LinksAutoClean *ac = (LinksAutoClean*)arg;
+  LinkTree *tree = &ac->trees[threadid];
+  size_t histsize = ac->hist_distsize * ac->hist_covgsize;
+  uint64_t *hists = ac->hists + threadid * histsize;
+  size_t i, start, end;
+
+  _auto_clean_part(ac, threadid, start, end, 0, ltree_store_num_trees(ac->store));
+
+  for(i = start; i < end; i++) {
+    ltree_store_fetch(ac->store, i, tree);
+    ltree_update_covg_hists(tree, hists, ac->hist_distsize, ac->hist_covgsize);
+  }
+}
+
+static void _auto_clean_clean_thread(void *arg, size_t threadid)
+{
+  LinksAutoClean *ac = (LinksAutoClean*)arg;
+  LinkTree *tree = &ac->trees[threadid];
+  LinkTreeStats *stats = &ac->stats[threadid];
+  size_t i, start, end, init_num_links;
+
+  _auto_clean_part(ac, threadid, start, end, 0, ltree_store_num_trees(ac->store));
+
+  for(i = start; i < end; i++) {
+    ltree_store_fetch(ac->store, i, tree);
+    ltree_clean(tree, ac->cutoff);
+    ltree_store_update(ac->store, i, tree);
+    init_num_links = stats->num_links;
+    ltree_get_stats(tree, stats);
+    ac->nlinks[i] = stats->num_links - init_num_links;
+  }
+}
+
+static void _auto_clean_write_thread(void *arg, size_t threadid)
+{
+  LinksAutoClean *ac = (LinksAutoClean*)arg;
+  LinkTree *tree = &ac->trees[threadid];
+  StrBuf *sbuf = &ac->sbufs[threadid], *zbuf = &ac->zbufs[threadid];
+  char kmer[MAX_KMER_SIZE+1];
+  size_t i, start, end;
+
+  _auto_clean_part(ac, threadid, start, end, ac->start, ac->end);
+  strbuf_reset(sbuf);
+  strbuf_reset(zbuf);
+
+  for(i = start; i < end; i++) {
+    if(ac->nlinks[i] == 0) continue;
+    ltree_store_fetch(ac->store, i, tree);
+    memcpy(kmer, ac->kmers + i * ac->kmer_size, ac->kmer_size);
+    kmer[ac->kmer_size] = '\0';
+    ltree_write_ctp(tree, kmer, ac->nlinks[i], sbuf);
+  }
+
+  if(sbuf->end > 0)
+    futil_pack_block(sbuf->b, sbuf->end, Z_DEFAULT_COMPRESSION, ac->zstd, zbuf);
+}
+
+/**
+ * Pick a cleaning threshold from the coverage of all links then clean and save
+ * them. `hists` is set to the coverage histogram before cleaning.
+ * Returns the threshold used.
+ */
+static size_t links_auto_clean(LinkTreeStore *store, const char *kmers,
+                               size_t kmer_size, size_t nthreads,
+                               size_t hist_distsize, size_t hist_covgsize,
+                               uint64_t (*hists)[hist_covgsize],
+                               cJSON *hdr, const char *out_path,
+                               LinkTreeStats *tree_stats)
+{
+  const size_t ntrees = ltree_store_num_trees(store);
+  const size_t histsize = hist_distsize * hist_covgsize;
+  size_t i, j, t;
+
+  LinksAutoClean ac = {.nthreads = nthreads, .kmer_size = kmer_size,
+                       .hist_distsize = hist_distsize,
+                       .hist_covgsize = hist_covgsize,
+                       .store = store, .kmers = kmers,
+                       .zstd = zstd_file_is_path(out_path)};
+
+  ac.nlinks = ctx_calloc(MAX2(ntrees, 1), sizeof(uint32_t));
+  ac.trees = ctx_calloc(nthreads, sizeof(LinkTree));
+  ac.hists = ctx_calloc(nthreads * histsize, sizeof(uint64_t));
+  ac.stats = ctx_calloc(nthreads, sizeof(LinkTreeStats));
+  ac.sbufs = ctx_calloc(nthreads, sizeof(StrBuf));
+  ac.zbufs = ctx_calloc(nthreads, sizeof(StrBuf));
+
+  for(t = 0; t < nthreads; t++) {
+    ltree_alloc(&ac.trees[t], kmer_size);
+    strbuf_alloc(&ac.sbufs[t], 1024);
+    strbuf_alloc(&ac.zbufs[t], 1024);
+  }
+
+  status("[links] Picking threshold from %zu kmers with %zu threads",
+         ntrees, nthreads);
+
+  util_multi_thread(&ac, nthreads, _auto_clean_hist_thread);
+
+  memset(hists, 0, histsize * sizeof(uint64_t));
+  for(t = 0; t < nthreads; t++)
+    for(i = 0; i < histsize; i++)
+      ((uint64_t*)hists)[i] += ac.hists[t*histsize + i];
+
+  // Use median of first five cutoffs, as with --threshold
+  ac.cutoff = print_suggest_cutoff(MIN2(hist_distsize, 6), hist_covgsize,
+                                   hists, NULL);
+  status("[links] Cleaning coverage below %zu", ac.cutoff);
+
+  util_multi_thread(&ac, nthreads, _auto_clean_clean_thread);
+
+  memset(tree_stats, 0, sizeof(*tree_stats));
+  for(t = 0; t < nthreads; t++) {
+    tree_stats->num_trees_with_links += ac.stats[t].num_trees_with_links;
+    tree_stats->num_links += ac.stats[t].num_links;
+    tree_stats->num_link_bytes += ac.stats[t].num_link_bytes;
+  }
+
+  // Header, uncompressed in ac.sbufs[0] then compressed into ac.zbufs[0]
+  FILE *fout = futil_fopen_create(out_path, "w");
+  json_hdr_add_curr_cmd(hdr, out_path);
+  json_hdr_augment_cmd(hdr, "links", "auto_clean_threshold",
+                       cJSON_CreateInt(ac.cutoff));
+
+  cJSON *links_json  = json_hdr_get(hdr, "paths", cJSON_Object, out_path);
+  cJSON *nkmers_json = json_hdr_get(links_json, "num_kmers_with_paths", cJSON_Number, out_path);
+  cJSON *nlinks_json = json_hdr_get(links_json, "num_paths",            cJSON_Number, out_path);
+  cJSON *nbytes_json = json_hdr_get(links_json, "path_bytes",           cJSON_Number, out_path);
+  nkmers_json->valuedouble = nkmers_json->valueint = tree_stats->num_trees_with_links;
+  nlinks_json->valuedouble = nlinks_json->valueint = tree_stats->num_links;
+  nbytes_json->valuedouble = nbytes_json->valueint = tree_stats->num_link_bytes;
+
+  char *json_str = cJSON_Print(hdr);
+  strbuf_set(&ac.sbufs[0], json_str);
+  strbuf_append_str(&ac.sbufs[0], "\n\n");
+  strbuf_append_str(&ac.sbufs[0], ctp_explanation_comment);
+  strbuf_append_str(&ac.sbufs[0], "\n");
+  free(json_str);
+
+  futil_pack_block(ac.sbufs[0].b, ac.sbufs[0].end, Z_DEFAULT_COMPRESSION,
+                   ac.zstd, &ac.zbufs[0]);
+  if(fwrite(ac.zbufs[0].b, 1, ac.zbufs[0].end, fout) != ac.zbufs[0].end)
+    die("Cannot write ctp file to: %s", out_path);
+
+  // Write links in order, each thread compresses part of a batch
+  for(i = 0; i < ntrees; i = ac.end) {
+    ac.start = i;
+    ac.end = MIN2(ntrees, i + nthreads * AUTO_CLEAN_WRITE_KMERS);
+    util_multi_thread(&ac, nthreads, _auto_clean_write_thread);
+    for(t = 0; t < nthreads; t++) {
+      j = ac.zbufs[t].end;
+      if(fwrite(ac.zbufs[t].b, 1, j, fout) != j)
+        die("Cannot write ctp file to: %s", out_path);
+    }
+  }
+
+  futil_fclose(fout);
+
+  for(t = 0; t < nthreads; t++) {
+    ltree_dealloc(&ac.trees[t]);
+    strbuf_dealloc(&ac.sbufs[t]);
+    strbuf_dealloc(&ac.zbufs[t]);
+  }
+  ctx_free(ac.nlinks);
+  ctx_free(ac.trees);
+  ctx_free(ac.hists);
+  ctx_free(ac.stats);
+  ctx_free(ac.sbufs);
+  ctx_free(ac.zbufs);
+
+  return ac.cutoff;
+}
+
+//
+// Streaming: one thread reads a batch of kmers and their links whilst the
+// other threads build, clean and write the trees of the previous batch. Each
+// worker has a contiguous part of the batch, so output is written in order.
+//
+
+typedef struct
+{
+  bool fw;
+  size_t covg, juncs, seq, jpos; // offsets into LinksBatch text and jpos
+} LinksRawLink;
+
+madcrow_buffer(links_raw_buf, LinksRawBuffer, LinksRawLink);
+
+typedef struct
+{
+  size_t first_knum, nkmers;
+  StrBuf kmers; // kmer_size chars per kmer
+  SizeBuffer link_starts; // [nkmers+1] index of first link of each kmer
+  LinksRawBuffer links;
+  StrBuf text; // NUL terminated junctions and sequences of links
+  SizeBuffer jpos;
+} LinksBatch;
+
+typedef struct
+{
+  LinkTree tree; // capacity kept between kmers
+  LinkTreeStats stats;
+  uint64_t *hists; // [hist_distsize][hist_covgsize]
+  StrBuf ctp, list, plot;
+} LinksWorker;
+
+typedef struct
+{
+  size_t nworkers, kmer_size, limit, cutoff, plot_kmer_idx;
+  size_t hist_distsize, hist_covgsize;
+  bool clean, list, plot, save, hist_covg;
+  GPathReader *ctpin;
+  // Reading buffers
+  SizeBuffer countbuf, jposbuf;
+  StrBuf kmerbuf, juncsbuf, seqbuf;
+  size_t knum; // kmers read
+  bool eof;
+  LinksBatch batches[2];
+  size_t cur; // batch to process
+  LinksWorker *workers; // [nworkers]
+  // Output, may be NULL
+  FILE *list_fh, *plot_fh, *link_fh;
+  const char *list_path, *plot_path, *link_path;
+} LinksStream;
+
+static void links_batch_alloc(LinksBatch *batch)
+{
+  memset(batch, 0, sizeof(*batch));
+  strbuf_alloc(&batch->kmers, 1024);
+  size_buf_alloc(&batch->link_starts, 1024);
+  links_raw_buf_alloc(&batch->links, 1024);
+  strbuf_alloc(&batch->text, 4096);
+  size_buf_alloc(&batch->jpos, 1024);
+}
+
+static void links_batch_dealloc(LinksBatch *batch)
+{
+  strbuf_dealloc(&batch->kmers);
+  size_buf_dealloc(&batch->link_starts);
+  links_raw_buf_dealloc(&batch->links);
+  strbuf_dealloc(&batch->text);
+  size_buf_dealloc(&batch->jpos);
+}
+
+// Read the next batch of kmers and their links
+static void links_batch_read(LinksStream *ls, LinksBatch *batch)
+{
+  size_t nlinks, njuncs, num_links_exp = 0;
+  LinksRawLink link;
+
+  batch->first_knum = ls->knum;
+  batch->nkmers = 0;
+  strbuf_reset(&batch->kmers);
+  size_buf_reset(&batch->link_starts);
+  links_raw_buf_reset(&batch->links);
+  strbuf_reset(&batch->text);
+  size_buf_reset(&batch->jpos);
+
+  while(!ls->eof && batch->nkmers < LINKS_BATCH_KMERS)
+  {
+    if((ls->limit && ls->knum >= ls->limit) ||
+       !gpath_reader_read_kmer(ls->ctpin, &ls->kmerbuf, &num_links_exp)) {
+      ls->eof = true;
+      break;
+    }
+    ctx_assert2(ls->kmerbuf.end == ls->kmer_size,
+                "Kmer incorrect length %zu != %zu",
+                ls->kmerbuf.end, ls->kmer_size);
+
+    strbuf_append_strn(&batch->kmers, ls->kmerbuf.b, ls->kmer_size);
+    size_buf_add(&batch->link_starts, batch->links.len);
+
+    for(nlinks = 0;
+        gpath_reader_read_link(ls->ctpin, &link.fw, &njuncs,
+                               &ls->countbuf, &ls->juncsbuf,
+                               &ls->seqbuf, &ls->jposbuf);
+        nlinks++)
+    {
+      link.covg = ls->countbuf.b[0];
+      link.juncs = batch->text.end;
+      strbuf_append_strn(&batch->text, ls->juncsbuf.b, ls->juncsbuf.end+1);
+      link.seq = batch->text.end;
+      strbuf_append_strn(&batch->text, ls->seqbuf.b, ls->seqbuf.end+1);
+      link.jpos = batch->jpos.len;
+      size_buf_push(&batch->jpos, ls->jposbuf.b, ls->jposbuf.len);
+      links_raw_buf_add(&batch->links, link);
+    }
+
+    if(nlinks != num_links_exp)
+      warn("Links count mismatch %zu != %zu", nlinks, num_links_exp);
+
+    batch->nkmers++;
+    ls->knum++;
+  }
+
+  size_buf_add(&batch->link_starts, batch->links.len);
+}
+
+// Build, clean and write this worker's part of a batch
+static void links_batch_process(LinksStream *ls, const LinksBatch *batch,
+                                LinksWorker *w, size_t workerid)
+{
+  const size_t kmer_size = ls->kmer_size;
+  size_t i, l, start, end, init_num_links, num_links;
+  const LinksRawLink *link;
+  char kmer[MAX_KMER_SIZE+1];
+
+  start = (batch->nkmers * workerid) / ls->nworkers;
+  end = (batch->nkmers * (workerid+1)) / ls->nworkers;
+
+  strbuf_reset(&w->ctp);
+  strbuf_reset(&w->list);
+  strbuf_reset(&w->plot);
+
+  for(i = start; i < end; i++)
+  {
+    ltree_reset(&w->tree);
+    for(l = batch->link_starts.b[i]; l < batch->link_starts.b[i+1]; l++) {
+      link = &batch->links.b[l];
+      ltree_add(&w->tree, link->fw, link->covg, batch->jpos.b + link->jpos,
+                batch->text.b + link->juncs, batch->text.b + link->seq);
+    }
+
+    if(ls->hist_covg)
+      ltree_update_covg_hists(&w->tree, w->hists,
+                              ls->hist_distsize, ls->hist_covgsize);
+    if(ls->clean)
+      ltree_clean(&w->tree, ls->cutoff);
+
+    // Accumulate statistics
+    init_num_links = w->stats.num_links;
+    ltree_get_stats(&w->tree, &w->stats);
+    num_links = w->stats.num_links - init_num_links;
+
+    if(ls->list)
+      ltree_write_list(&w->tree, &w->list);
+
+    if(ls->save && num_links) {
+      memcpy(kmer, batch->kmers.b + i*kmer_size, kmer_size);
+      kmer[kmer_size] = '\0';
+      ltree_write_ctp(&w->tree, kmer, num_links, &w->ctp);
+    }
+
+    if(ls->plot && batch->first_knum + i == ls->plot_kmer_idx) {
+      status("Plotting tree...");
+      ltree_write_dot(&w->tree, &w->plot);
+    }
+  }
+}
+
+// Thread 0 reads the next batch, the others process the current batch
+static void links_stream_thread(void *arg, size_t threadid)
+{
+  LinksStream *ls = (LinksStream*)arg;
+  if(threadid == 0) {
+    if(!ls->eof) links_batch_read(ls, &ls->batches[!ls->cur]);
+    else ls->batches[!ls->cur].nkmers = 0;
+  }
+  else {
+    links_batch_process(ls, &ls->batches[ls->cur],
+                        &ls->workers[threadid-1], threadid-1);
+  }
+}
+
+static void links_fwrite(const StrBuf *sbuf, FILE *fh, const char *path)
+{
+  if(sbuf->end && fwrite(sbuf->b, 1, sbuf->end, fh) != sbuf->end)
+    die("Cannot write to: %s", path);
+}
+
+/**
+ * Read, clean and write all kmers with `ls->nworkers` threads plus a reader.
+ * Adds coverage histograms to `hists` if ls->hist_covg and sets `tree_stats`.
+ */
+static void links_stream(LinksStream *ls, uint64_t *hists,
+                         LinkTreeStats *tree_stats)
+{
+  const size_t histsize = ls->hist_distsize * ls->hist_covgsize;
+  size_t i, t;
+  LinksWorker *w;
+
+  size_buf_alloc(&ls->countbuf, 16);
+  size_buf_alloc(&ls->jposbuf, 1024);
+  strbuf_alloc(&ls->kmerbuf, 1024);
+  strbuf_alloc(&ls->juncsbuf, 1024);
+  strbuf_alloc(&ls->seqbuf, 1024);
+  links_batch_alloc(&ls->batches[0]);
+  links_batch_alloc(&ls->batches[1]);
+
+  ls->workers = ctx_calloc(ls->nworkers, sizeof(LinksWorker));
+  for(t = 0; t < ls->nworkers; t++) {
+    w = &ls->workers[t];
+    ltree_alloc(&w->tree, ls->kmer_size);
+    if(ls->hist_covg) w->hists = ctx_calloc(histsize, sizeof(uint64_t));
+    strbuf_alloc(&w->ctp, 1024);
+    strbuf_alloc(&w->list, 1024);
+    strbuf_alloc(&w->plot, 1024);
+  }
+
+  ls->knum = 0;
+  ls->eof = false;
+  ls->cur = 0;
+  links_batch_read(ls, &ls->batches[0]);
+
+  // Process batch `cur` whilst reading the next one
+  while(ls->batches[ls->cur].nkmers > 0)
+  {
+    util_multi_thread(ls, ls->nworkers+1, links_stream_thread);
+
+    for(t = 0; t < ls->nworkers; t++) {
+      w = &ls->workers[t];
+      if(ls->list_fh) links_fwrite(&w->list, ls->list_fh, ls->list_path);
+      if(ls->link_fh) links_fwrite(&w->ctp,  ls->link_fh, ls->link_path);
+      if(ls->plot_fh) links_fwrite(&w->plot, ls->plot_fh, ls->plot_path);
+    }
+
+    ls->cur = !ls->cur;
+  }
+
+  memset(tree_stats, 0, sizeof(*tree_stats));
+  for(t = 0; t < ls->nworkers; t++) {
+    w = &ls->workers[t];
+    tree_stats->num_trees_with_links += w->stats.num_trees_with_links;
+    tree_stats->num_links += w->stats.num_links;
+    tree_stats->num_link_bytes += w->stats.num_link_bytes;
+    if(ls->hist_covg)
+      for(i = 0; i < histsize; i++) hists[i] += w->hists[i];
+    ltree_dealloc(&w->tree);
+    ctx_free(w->hists);
+    strbuf_dealloc(&w->ctp);
+    strbuf_dealloc(&w->list);
+    strbuf_dealloc(&w->plot);
+  }
+  ctx_free(ls->workers);
+
+  links_batch_dealloc(&ls->batches[0]);
+  links_batch_dealloc(&ls->batches[1]);
+  size_buf_dealloc(&ls->countbuf);
+  size_buf_dealloc(&ls->jposbuf);
+  strbuf_dealloc(&ls->kmerbuf);
+  strbuf_dealloc(&ls->juncsbuf);
+  strbuf_dealloc(&ls->seqbuf);
 }
 
 int ctx_links(int argc, char **argv)
@@ -121,8 +607,8 @@ int ctx_links(int argc, char **argv)
   const char *thresh_path = NULL, *hist_path = NULL;
 
   size_t hist_distsize = 0, hist_covgsize = 0;
-  size_t cutoff = 0;
-  bool clean = false;
+  size_t cutoff = 0, nthreads = 0;
+  bool clean = false, auto_clean = false;
 
   // Arg parsing
   char cmd[100];
@@ -145,6 +631,8 @@ int ctx_links(int argc, char **argv)
       case 'H': cmd_check(!hist_path, cmd); hist_path = optarg; break;
       case 'C': cmd_check(!hist_covgsize, cmd); hist_covgsize = cmd_size(cmd, optarg); break;
       case 'D': cmd_check(!hist_distsize, cmd); hist_distsize = cmd_size(cmd, optarg); break;
+      case 'a': cmd_check(!auto_clean, cmd); auto_clean = true; break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -159,6 +647,7 @@ int ctx_links(int argc, char **argv)
   // Defaults
   if(!hist_distsize) hist_distsize = DEFAULT_MAX_DIST;
   if(!hist_covgsize) hist_covgsize = DEFAULT_MAX_COVG;
+  if(!nthreads) nthreads = DEFAULT_NTHREADS;
 
   if(optind + 1 != argc) cmd_print_usage("Wrong number of arguments");
   const char *ctp_path = argv[optind];
@@ -166,13 +655,18 @@ int ctx_links(int argc, char **argv)
   bool list = (csv_out_path != NULL);
   bool plot = (plot_out_path != NULL);
   bool save = (link_out_path != NULL);
-  bool hist_covg = (thresh_path != NULL || hist_path != NULL);
+  bool hist_covg = (thresh_path != NULL || hist_path != NULL || auto_clean);
 
   size_t plot_kmer_idx = (limit == 0 ? 0 : limit - 1);
 
   if(clean && !save)
     cmd_print_usage("Need to give --out <out.ctp.gz> with --clean");
 
+  if(auto_clean && !save)
+    cmd_print_usage("Need to give --out <out.ctp.gz> with --auto-clean");
+  if(auto_clean && (clean || list || plot))
+    cmd_print_usage("--auto-clean cannot be used with --clean, --list or --plot");
+
   if(!save && !list && !plot && !hist_covg)
     cmd_print_usage("Please specify one of --plot, --list or --clean");
 
@@ -229,7 +723,7 @@ int ctx_links(int argc, char **argv)
     message("\n");
   }
 
-  if(save)
+  if(save && !auto_clean)
   {
     // Check we can find the fields we need
     cJSON *links_json  = json_hdr_get(newhdr, "paths", cJSON_Object, link_out_path);
@@ -271,85 +765,90 @@ int ctx_links(int argc, char **argv)
       die("Cannot open output .dot file %s", plot_out_path);
   }
 
-  SizeBuffer countbuf, jposbuf;
-  size_buf_alloc(&countbuf, 16);
-  size_buf_alloc(&jposbuf, 1024);
-
-  StrBuf kmerbuf, juncsbuf, seqbuf, outbuf;
-  strbuf_alloc(&kmerbuf, 1024);
-  strbuf_alloc(&juncsbuf, 1024);
-  strbuf_alloc(&seqbuf, 1024);
-  strbuf_alloc(&outbuf, 1024);
-
-  bool link_fw;
-  size_t njuncs;
-  size_t knum, nlinks, num_links_exp = 0;
-
-  LinkTree ltree;
-  ltree_alloc(&ltree, kmer_size);
-
   LinkTreeStats tree_stats;
   memset(&tree_stats, 0, sizeof(tree_stats));
-  size_t init_num_links = 0, num_links = 0;
 
-  for(knum = 0; !limit || knum < limit; knum++)
+  if(!auto_clean)
   {
-    ltree_reset(&ltree);
-    if(!gpath_reader_read_kmer(&ctpin, &kmerbuf, &num_links_exp)) break;
-    ctx_assert2(kmerbuf.end == kmer_size, "Kmer incorrect length %zu != %zu",
-                kmerbuf.end, kmer_size);
-    // status("kmer: %s", kmerbuf.b);
+    LinksStream ls = {.nworkers = nthreads, .kmer_size = kmer_size,
+                      .limit = limit, .cutoff = cutoff,
+                      .plot_kmer_idx = plot_kmer_idx,
+                      .hist_distsize = hist_distsize,
+                      .hist_covgsize = hist_covgsize,
+                      .clean = clean, .list = list, .plot = plot, .save = save,
+                      .hist_covg = hist_covg, .ctpin = &ctpin,
+                      .list_fh = list_fh, .plot_fh = plot_fh,
+                      .link_fh = link_tmp_fh,
+                      .list_path = csv_out_path, .plot_path = plot_out_path,
+                      .link_path = link_tmp_path.b};
+
+    status("[links] Processing kmers with %zu threads", nthreads);
+    links_stream(&ls, (uint64_t*)hists, &tree_stats);
+  }
+  else
+  {
+    // --auto-clean keeps every tree and kmer
+    SizeBuffer countbuf, jposbuf;
+    size_buf_alloc(&countbuf, 16);
+    size_buf_alloc(&jposbuf, 1024);
 
-    for(nlinks = 0;
-        gpath_reader_read_link(&ctpin, &link_fw, &njuncs,
-                               &countbuf, &juncsbuf,
-                               &seqbuf, &jposbuf);
-        nlinks++)
-    {
-      ltree_add(&ltree, link_fw, countbuf.b[0], jposbuf.b,
-                juncsbuf.b, seqbuf.b);
-    }
+    StrBuf kmerbuf, juncsbuf, seqbuf, kmers;
+    strbuf_alloc(&kmerbuf, 1024);
+    strbuf_alloc(&juncsbuf, 1024);
+    strbuf_alloc(&seqbuf, 1024);
+    strbuf_alloc(&kmers, 1024);
 
-    if(nlinks != num_links_exp)
-      warn("Links count mismatch %zu != %zu", nlinks, num_links_exp);
+    bool link_fw;
+    size_t njuncs;
+    size_t knum, nlinks, num_links_exp = 0;
 
-    if(hist_covg)
-    {
-      ltree_update_covg_hists(&ltree, (uint64_t*)hists,
-                              hist_distsize, hist_covgsize);
-    }
-    if(clean)
-    {
-      ltree_clean(&ltree, cutoff);
-    }
+    LinkTree ltree;
+    ltree_alloc(&ltree, kmer_size);
 
-    // Accumulate statistics
-    ltree_get_stats(&ltree, &tree_stats);
-    num_links = tree_stats.num_links - init_num_links;
-    init_num_links = tree_stats.num_links;
+    LinkTreeStore ltstore;
+    ltree_store_alloc(&ltstore);
 
-    if(list)
+    for(knum = 0; !limit || knum < limit; knum++)
     {
-      ltree_write_list(&ltree, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, list_fh) != outbuf.end)
-        die("Cannot write CSV file to: %s", csv_out_path);
-      strbuf_reset(&outbuf);
-    }
-    if(save && num_links)
-    {
-      ltree_write_ctp(&ltree, kmerbuf.b, num_links, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, link_tmp_fh) != outbuf.end)
-        die("Cannot write ctp file to: %s", link_tmp_path.b);
-      strbuf_reset(&outbuf);
-    }
-    if(plot && knum == plot_kmer_idx)
-    {
-      status("Plotting tree...");
-      ltree_write_dot(&ltree, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, plot_fh) != outbuf.end)
-        die("Cannot write plot DOT file to: %s", plot_out_path);
-      strbuf_reset(&outbuf);
+      ltree_reset(&ltree);
+      if(!gpath_reader_read_kmer(&ctpin, &kmerbuf, &num_links_exp)) break;
+      ctx_assert2(kmerbuf.end == kmer_size, "Kmer incorrect length %zu != %zu",
+                  kmerbuf.end, kmer_size);
+
+      for(nlinks = 0;
+          gpath_reader_read_link(&ctpin, &link_fw, &njuncs,
+                                 &countbuf, &juncsbuf,
+                                 &seqbuf, &jposbuf);
+          nlinks++)
+      {
+        ltree_add(&ltree, link_fw, countbuf.b[0], jposbuf.b,
+                  juncsbuf.b, seqbuf.b);
+      }
+
+      if(nlinks != num_links_exp)
+        warn("Links count mismatch %zu != %zu", nlinks, num_links_exp);
+
+      ltree_store_add(&ltstore, &ltree);
+      strbuf_append_strn(&kmers, kmerbuf.b, kmer_size);
     }
+
+    // Keep input counts in newhdr to report below
+    cJSON *outhdr = cJSON_Duplicate(newhdr, 1);
+    size_t auto_cutoff;
+    auto_cutoff = links_auto_clean(&ltstore, kmers.b, kmer_size, nthreads,
+                                   hist_distsize, hist_covgsize, hists,
+                                   outhdr, link_out_path, &tree_stats);
+    status("Cleaned links with threshold %zu", auto_cutoff);
+    cJSON_Delete(outhdr);
+
+    ltree_store_dealloc(&ltstore);
+    ltree_dealloc(&ltree);
+    size_buf_dealloc(&countbuf);
+    size_buf_dealloc(&jposbuf);
+    strbuf_dealloc(&kmerbuf);
+    strbuf_dealloc(&juncsbuf);
+    strbuf_dealloc(&seqbuf);
+    strbuf_dealloc(&kmers);
   }
 
   gpath_reader_close(&ctpin);
@@ -363,7 +862,7 @@ int ctx_links(int argc, char **argv)
   status("Number of links %li -> %zu", nlinks_json->valueint, tree_stats.num_links);
   status("Number of bytes %li -> %zu", nbytes_json->valueint, tree_stats.num_link_bytes);
 
-  if(save)
+  if(save && !auto_clean)
   {
     // Update JSON
     nkmers_json->valuedouble = nkmers_json->valueint = tree_stats.num_trees_with_links;
@@ -390,7 +889,7 @@ int ctx_links(int argc, char **argv)
     }
     ctx_free(tmp);
 
-    gzclose(link_gz);
+    gzutil_fclose(link_gz);
     fclose(link_tmp_fh);
   }
 
@@ -431,13 +930,6 @@ int ctx_links(int argc, char **argv)
   ctx_free(hists);
   cJSON_Delete(newhdr);
   strbuf_dealloc(&link_tmp_path);
-  ltree_dealloc(&ltree);
-  size_buf_dealloc(&countbuf);
-  size_buf_dealloc(&jposbuf);
-  strbuf_dealloc(&kmerbuf);
-  strbuf_dealloc(&juncsbuf);
-  strbuf_dealloc(&seqbuf);
-  strbuf_dealloc(&outbuf);
 
   return EXIT_SUCCESS;
 }
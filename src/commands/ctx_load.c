@@ -0,0 +1,153 @@
+#include "global.h"
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "db_graph.h"
+#include "graphs_load.h"
+#include "graph_shm.h"
+
+const char load_usage[] =
+"usage: "CMD" load [options] --shm <name> <in.ctx> [in2.ctx ...]\n"
+"       "CMD" load --remove <name>\n"
+"\n"
+"  Load graphs once into shared memory, for other commands on the same host to\n"
+"  use with --graph-shm <name> instead of loading graph files. Commands map the\n"
+"  segment copy-on-write, so it is never modified. Keeps per colour edges,\n"
+"  coverages and kmer sets. The segment stays until removed with --remove.\n"
+"\n"
+"  -h, --help             This help message\n"
+"  -q, --quiet            Silence status output normally printed to STDERR\n"
+"  -m, --memory <mem>     Memory to use (e.g. 1M, 20GB)\n"
+"  -n, --nkmers <N>       Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>      Number of threads to load with [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -s, --shm <name>       Segment to create or replace\n"
+"  -r, --remove <name>    Delete a segment\n"
+"  -C, --cuckoo           Move kmers to make room when loading, so the table can\n"
+"                         be ~95% full [default size: kmers/0.9]. Single threaded.\n"
+"\n"
+"  <name> is a POSIX shared memory object (/dev/shm/mccortex.<name> on Linux),\n"
+"  or a file path if it contains a '/', e.g. a file on a hugetlbfs mount.\n"
+"  Memory required is twice the graph while the segment is being written.\n"
+"\n";
+
+static struct option longopts[] =
+{
+// General options
+  {"help",         no_argument,       NULL, 'h'},
+  {"memory",       required_argument, NULL, 'm'},
+  {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
+// command specific
+  {"shm",          required_argument, NULL, 's'},
+  {"remove",       required_argument, NULL, 'r'},
+  {"cuckoo",       no_argument,       NULL, 'C'},
+  {NULL, 0, NULL, 0}
+};
+
+int ctx_load(int argc, char **argv)
+{
+  size_t nthreads = 0;
+  struct MemArgs memargs = MEM_ARGS_INIT;
+  const char *shm_name = NULL, *rm_name = NULL;
+  bool cuckoo = false;
+
+  // Arg parsing
+  char cmd[100], shortopts[100];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    cmd_get_longopt_str(longopts, c, cmd, sizeof(cmd));
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
+      case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case 's': cmd_check(!shm_name, cmd); shm_name = optarg; break;
+      case 'r': cmd_check(!rm_name, cmd); rm_name = optarg; break;
+      case 'C': cmd_check(!cuckoo, cmd); cuckoo = true; break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        // cmd_print_usage(NULL);
+        die("`"CMD" load -h` for help. Bad option: %s", argv[optind-1]);
+      default: abort();
+    }
+  }
+
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
+  if(rm_name != NULL) {
+    if(shm_name != NULL || optind < argc)
+      cmd_print_usage("--remove takes no other arguments");
+    graph_shm_remove(rm_name);
+    return EXIT_SUCCESS;
+  }
+
+  if(shm_name == NULL) cmd_print_usage("Require --shm <name>");
+  if(optind == argc) cmd_print_usage("Require input graph files (.ctx)");
+
+  //
+  // Open graph files
+  //
+  char **graph_paths = argv + optind;
+  size_t i, num_gfiles = argc - optind;
+  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+  size_t ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+
+  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
+                           &ctx_max_kmers, &ctx_sum_kmers);
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+
+  // kmer + (edges + coverage + in colour) per colour
+  bits_per_kmer = sizeof(BinaryKmer)*8 +
+                  ((sizeof(Edges) + sizeof(CovgStore)) * 8 + 1) * ncols;
+
+  // Cuckoo inserts can fill the table past IDEAL_OCCUPANCY
+  if(cuckoo && !memargs.mem_to_use_set && !memargs.num_kmers_set) {
+    memargs.num_kmers = ctx_sum_kmers / WARN_OCCUPANCY;
+    memargs.num_kmers_set = true;
+  }
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+                                        memargs.mem_to_use_set,
+                                        memargs.num_kmers,
+                                        memargs.num_kmers_set,
+                                        bits_per_kmer,
+                                        ctx_max_kmers, ctx_sum_kmers,
+                                        true, &graph_mem);
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, ncols, ncols,
+                 kmers_in_hash,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                 (cuckoo ? DBG_ALLOC_HT_CUCKOO : 0));
+
+  //
+  // Load graphs
+  //
+  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
+  gprefs.empty_colours = true;
+
+  for(i = 0; i < num_gfiles; i++) {
+    graph_load(&gfiles[i], gprefs, NULL);
+    graph_file_close(&gfiles[i]);
+    gprefs.empty_colours = false;
+  }
+  ctx_free(gfiles);
+
+  hash_table_print_stats(&db_graph.ht);
+
+  graph_shm_save(shm_name, &db_graph);
+
+  db_graph_dealloc(&db_graph);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,525 @@
+#include "global.h"
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "db_graph.h"
+#include "graph_writer.h"
+#include "build_graph.h"
+#include "clean_graph.h"
+#include "infer_edges.h"
+#include "generate_paths.h"
+#include "correct_aln_input.h"
+#include "gpath_save.h"
+
+const char pipeline_usage[] =
+"usage: "CMD" pipeline [options] -s <name> --seq <in> -o <out.ctp.gz>\n"
+"\n"
+"  Run build -> clean -> inferedges -> thread for one sample, keeping the graph\n"
+"  in memory between steps instead of writing and re-loading graph files.\n"
+"  Sequence files are read twice: once to build the graph, once to thread.\n"
+"  Two thirds of --memory is used for the graph, the rest for links.\n"
+"\n"
+"  -h, --help               This help message\n"
+"  -q, --quiet              Silence status output normally printed to STDERR\n"
+"  -f, --force              Overwrite output files\n"
+"  -m, --memory <mem>       Memory to use\n"
+"  -n, --nkmers <kmers>     Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -k, --kmer <kmer>        Kmer size must be odd ("QUOTE_VALUE(MAX_KMER_SIZE)" >= k >= "QUOTE_VALUE(MIN_KMER_SIZE)")\n"
+"  -s, --sample <name>      Sample name [required]\n"
+"  -o, --out <out.ctp.gz>   Save link file [required]\n"
+"  -c, --ctx <out.ctx>      Also save the cleaned graph with inferred edges\n"
+"  -S, --sort               Write kmers in sorted order\n"
+"\n"
+"  Input:\n"
+"  -1, --seq <in.fa>        Load sequence data\n"
+"  -2, --seq2 <in1:in2>     Load paired end sequence data\n"
+"  -i, --seqi <in.bam>      Load paired end sequence from a single file\n"
+"  -M, --matepair <orient>  Mate pair orientation: FF,FR,RF,RR [default: FR]\n"
+"  -Q, --fq-cutoff <Q>      Filter quality scores [default: 0 (off)]\n"
+"  -O, --fq-offset <N>      FASTQ ASCII offset    [default: 0 (auto-detect)]\n"
+"  -H, --cut-hp <bp>        Breaks reads at homopolymers >= <bp> [default: off]\n"
+"  -p, --remove-pcr         Remove PCR duplicate reads when building\n"
+"  -P, --keep-pcr           Don't do PCR duplicate removal [default]\n"
+"\n"
+"  Cleaning:\n"
+"  -T, --tips <L>           Clip tips shorter than <L> kmers [default: 2*kmer_size]\n"
+"  -U, --unitigs <X>        Remove unitigs with median cov < X [default: auto]\n"
+"  -B, --fallback <T>       Fall back threshold if we can't pick\n"
+"\n"
+"  Link Params:\n"
+"  -l, --min-frag-len <bp>  Min fragment size for --seq2 [default:"QUOTE_VALUE(DEFAULT_CRTALN_FRAGLEN_MIN)"]\n"
+"  -L, --max-frag-len <bp>  Max fragment size for --seq2 [default:"QUOTE_VALUE(DEFAULT_CRTALN_FRAGLEN_MAX)"]\n"
+"  -w, --one-way            Use one-way gap filling (conservative) [default]\n"
+"  -W, --two-way            Use two-way gap filling (liberal)\n"
+"  -d, --gap-diff-const <d> Set parameters for allowable gap lengths (decimals):\n"
+"  -D, --gap-diff-coeff <D>   abs(gap_exp - gap_seen) <= gap_exp*D + d\n"
+"  -e, --end-check          Extra check after bridging gap [default: on]\n"
+"  -E, --no-end-check       Skip extra check after gap bridging\n"
+"  -g, --gap-hist <o.csv>   Save size distribution of sequence gaps bridged\n"
+"  -G, --frag-hist <o.csv>  Save size distribution of PE fragments\n"
+"  -u, --use-new-paths      Use links as they are being added (higher err rate) [default: no]\n"
+"\n"
+"  Input options must come before the sequence file they apply to.\n"
+"  Set --tips 0 or --unitigs 0 to turn off that cleaning step.\n"
+"  Sequence cannot be read from STDIN, since it is read twice.\n"
+"\n";
+
+static struct option longopts[] =
+{
+// General options
+  {"help",           no_argument,       NULL, 'h'},
+  {"force",          no_argument,       NULL, 'f'},
+  {"memory",         required_argument, NULL, 'm'},
+  {"nkmers",         required_argument, NULL, 'n'},
+  {"threads",        required_argument, NULL, 't'},
+  {"kmer",           required_argument, NULL, 'k'},
+  {"sample",         required_argument, NULL, 's'},
+  {"out",            required_argument, NULL, 'o'},
+  {"ctx",            required_argument, NULL, 'c'},
+  {"sort",           no_argument,       NULL, 'S'},
+// input
+  {"seq",            required_argument, NULL, '1'},
+  {"seq2",           required_argument, NULL, '2'},
+  {"seqi",           required_argument, NULL, 'i'},
+  {"matepair",       required_argument, NULL, 'M'},
+  {"fq-cutoff",      required_argument, NULL, 'Q'},
+  {"fq-offset",      required_argument, NULL, 'O'},
+  {"cut-hp",         required_argument, NULL, 'H'},
+  {"remove-pcr",     no_argument,       NULL, 'p'},
+  {"keep-pcr",       no_argument,       NULL, 'P'},
+// cleaning
+  {"tips",           required_argument, NULL, 'T'},
+  {"unitigs",        required_argument, NULL, 'U'},
+  {"fallback",       required_argument, NULL, 'B'},
+// threading
+  {"min-frag-len",   required_argument, NULL, 'l'},
+  {"max-frag-len",   required_argument, NULL, 'L'},
+  {"one-way",        no_argument,       NULL, 'w'},
+  {"two-way",        no_argument,       NULL, 'W'},
+  {"gap-diff-const", required_argument, NULL, 'd'},
+  {"gap-diff-coeff", required_argument, NULL, 'D'},
+  {"end-check",      no_argument,       NULL, 'e'},
+  {"no-end-check",   no_argument,       NULL, 'E'},
+  {"gap-hist",       required_argument, NULL, 'g'},
+  {"frag-hist",      required_argument, NULL, 'G'},
+  {"use-new-paths",  no_argument,       NULL, 'u'},
+  {NULL, 0, NULL, 0}
+};
+
+// Each input is opened twice, one copy for building and one for threading
+static BuildGraphTaskBuffer btasks;
+static CorrectAlnInputBuffer tinputs;
+
+static size_t nthreads = 0, kmer_size = 0;
+static struct MemArgs memargs = MEM_ARGS_INIT;
+static const char *sample_name = NULL;
+static const char *out_ctp_path = NULL, *out_ctx_path = NULL;
+static const char *dump_seq_sizes = NULL, *dump_frag_sizes = NULL;
+static bool sort_kmers = false, use_new_paths = false, remove_pcr_used = false;
+static int min_keep_tip = -1, unitig_min = -1; // <0 => default, 0 => noclean
+static uint32_t fallback_thresh = 0;
+
+// As in ctx_build.c: read paired end files separately unless removing PCR
+// duplicates, since it's faster
+static void add_build_task(BuildGraphTask *task)
+{
+  if(task->prefs.remove_pcr_dups || task->files.file2 == NULL) {
+    build_graph_task_buf_push(&btasks, task, 1);
+  }
+  else {
+    BuildGraphTask task2 = *task;
+    task2.files.file1 = task->files.file2;
+    task->files.file2 = task2.files.file2 = NULL;
+    build_graph_task_buf_push(&btasks, task, 1);
+    build_graph_task_buf_push(&btasks, &task2, 1);
+  }
+}
+
+static void add_input(char shortopt, const char *arg, uint8_t fq_offset,
+                      const CorrectAlnInput *tmpl, const SeqLoadingPrefs *prefs)
+{
+  if(strcmp(arg,"-") == 0)
+    cmd_print_usage("Cannot read sequence from STDIN (it is read twice)");
+
+  // asyncio_task_parse() splits the argument in place, so parse a copy
+  size_t len = strlen(arg);
+  char *argcpy = ctx_malloc(len+1);
+
+  BuildGraphTask btask;
+  memset(&btask, 0, sizeof(btask));
+  btask.prefs = *prefs;
+  btask.stats = SEQ_LOADING_STATS_INIT;
+  memcpy(argcpy, arg, len+1);
+  asyncio_task_parse(&btask.files, shortopt, argcpy, fq_offset, NULL);
+
+  uint8_t offset = btask.files.fq_offset;
+  if(offset >= 128) die("fq-offset too big: %i", (int)offset);
+  if(offset+prefs->fq_cutoff >= 128) die("fq-cutoff too big: %i", offset+prefs->fq_cutoff);
+
+  add_build_task(&btask);
+
+  correct_aln_input_buf_push(&tinputs, tmpl, 1);
+  memcpy(argcpy, arg, len+1);
+  asyncio_task_parse(&tinputs.b[tinputs.len-1].files, shortopt, argcpy,
+                     fq_offset, NULL);
+
+  ctx_free(argcpy);
+}
+
+static void parse_args(int argc, char **argv)
+{
+  CorrectAlnInput task = CORRECT_ALN_INPUT_INIT;
+  SeqLoadingPrefs prefs = SEQ_LOADING_PREFS_INIT;
+  uint8_t fq_offset = 0;
+  bool used = true;
+  size_t i;
+
+  // Arg parsing
+  char cmd[100], shortopts[300];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    cmd_get_longopt_str(longopts, c, cmd, sizeof(cmd));
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
+      case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads,cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'k': cmd_check(!kmer_size,cmd); kmer_size = cmd_kmer_size(cmd, optarg); break;
+      case 's': cmd_check(!sample_name,cmd); sample_name = optarg; break;
+      case 'o': cmd_check(!out_ctp_path,cmd); out_ctp_path = optarg; break;
+      case 'c': cmd_check(!out_ctx_path,cmd); out_ctx_path = optarg; break;
+      case 'S': cmd_check(!sort_kmers,cmd); sort_kmers = true; break;
+      case '1':
+      case '2':
+      case 'i':
+        add_input(c, optarg, fq_offset, &task, &prefs);
+        used = true;
+        break;
+      case 'M':
+             if(!strcmp(optarg,"FF")) task.matedir = READPAIR_FF;
+        else if(!strcmp(optarg,"FR")) task.matedir = READPAIR_FR;
+        else if(!strcmp(optarg,"RF")) task.matedir = READPAIR_RF;
+        else if(!strcmp(optarg,"RR")) task.matedir = READPAIR_RR;
+        else cmd_print_usage("-M,--matepair <orient> must be one of: FF,FR,RF,RR");
+        prefs.matedir = task.matedir;
+        used = false; break;
+      case 'O': fq_offset = cmd_uint8(cmd, optarg); used = false; break;
+      case 'Q': task.fq_cutoff = prefs.fq_cutoff = cmd_uint8(cmd, optarg); used = false; break;
+      case 'H': task.hp_cutoff = prefs.hp_cutoff = cmd_uint8(cmd, optarg); used = false; break;
+      case 'p': prefs.remove_pcr_dups = remove_pcr_used = true; used = false; break;
+      case 'P': prefs.remove_pcr_dups = false; used = false; break;
+      case 'T': cmd_check(min_keep_tip<0, cmd); min_keep_tip = cmd_uint32(cmd, optarg); break;
+      case 'U': cmd_check(unitig_min<0, cmd); unitig_min = cmd_uint32(cmd, optarg); break;
+      case 'B': cmd_check(!fallback_thresh, cmd); fallback_thresh = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'l': task.crt_params.frag_len_min = cmd_uint32(cmd, optarg); used = false; break;
+      case 'L': task.crt_params.frag_len_max = cmd_uint32(cmd, optarg); used = false; break;
+      case 'w': task.crt_params.one_way_gap_traverse = true; used = false; break;
+      case 'W': task.crt_params.one_way_gap_traverse = false; used = false; break;
+      case 'd': task.crt_params.gap_wiggle = cmd_udouble(cmd, optarg); used = false; break;
+      case 'D': task.crt_params.gap_variance = cmd_udouble(cmd, optarg); used = false; break;
+      case 'e': task.crt_params.use_end_check = true; used = false; break;
+      case 'E': task.crt_params.use_end_check = false; used = false; break;
+      case 'g': cmd_check(!dump_seq_sizes, cmd); dump_seq_sizes = optarg; break;
+      case 'G': cmd_check(!dump_frag_sizes, cmd); dump_frag_sizes = optarg; break;
+      case 'u': cmd_check(!use_new_paths, cmd); use_new_paths = true; break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        die("`"CMD" pipeline -h` for help. Bad option: %s", argv[optind-1]);
+      default: die("Bad option: %s", cmd);
+    }
+  }
+
+  if(!nthreads) nthreads = DEFAULT_NTHREADS;
+  graph_writer_set_nthreads(nthreads);
+
+  if(optind < argc)
+    cmd_print_usage("Unexpected argument: %s", argv[optind]);
+
+  if(!used) cmd_print_usage("Arguments not given BEFORE sequence file");
+  if(tinputs.len == 0) cmd_print_usage("No sequence inputs given");
+  if(sample_name == NULL) cmd_print_usage("Please give a sample name (-s <name>)");
+  if(out_ctp_path == NULL) cmd_print_usage("--out <out.ctp> is required");
+  if(!kmer_size) die("kmer size not set with -k <K>");
+
+  if(fallback_thresh && unitig_min >= 0)
+    warn("-B, --fallback <T> ignored with --unitigs <X>");
+
+  // If no arguments given we default to removing tips < 2*kmer_size
+  if(min_keep_tip < 0) min_keep_tip = 2 * kmer_size;
+
+  // No links are loaded, so only one kmer of context is useful
+  for(i = 0; i < tinputs.len; i++)
+  {
+    CorrectAlnInput *t = &tinputs.b[i];
+    t->files.ptr = t;
+    t->crt_params.max_context = 1;
+    if(t->crt_params.frag_len_min > t->crt_params.frag_len_max) {
+      die("--min-frag-len %u is greater than --max-frag-len %u",
+          t->crt_params.frag_len_min, t->crt_params.frag_len_max);
+    }
+  }
+}
+
+// Load sequence into colour 0
+static void pipeline_build(dBGraph *db_graph)
+{
+  size_t i, start, end;
+  BuildGraphTask *tasks = btasks.b;
+  size_t ntasks = btasks.len;
+
+  status("[pipeline] Building graph for sample: %s", sample_name);
+  strbuf_set(&db_graph->ginfo[0].sample_name, sample_name);
+
+  for(i = 0; i < ntasks; i++) build_graph_task_print(&tasks[i]);
+
+  for(start = 0; start < ntasks; start = end) {
+    end = MIN2(start+MAX_IO_THREADS, ntasks);
+    build_graph(db_graph, tasks+start, end-start, nthreads);
+  }
+
+  hash_table_print_stats(&db_graph->ht);
+
+  for(i = 0; i < ntasks; i++) {
+    build_graph_task_print_stats(&tasks[i]);
+    build_graph_task_destroy(&tasks[i]);
+  }
+}
+
+// Clip tips and remove low coverage unitigs, as in ctx_clean.c
+static void pipeline_clean(dBGraph *db_graph)
+{
+  size_t initial_nkmers = hash_table_nkmers(&db_graph->ht);
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(db_graph->ht.capacity), 1);
+  uint8_t *keep = ctx_calloc(roundup_bits2bytes(db_graph->ht.capacity), 1);
+  int est_min_covg;
+
+  // Pick a threshold if we weren't given one
+  if(unitig_min < 0)
+  {
+    est_min_covg = cleaning_get_threshold(nthreads, NULL, NULL, visited, db_graph);
+
+    if(est_min_covg < 0) status("Cannot find recommended cleaning threshold");
+    else status("Recommended cleaning threshold is: %i", est_min_covg);
+
+    if(fallback_thresh > 0 && est_min_covg < (int)fallback_thresh) {
+      status("Using fallback threshold: %i", fallback_thresh);
+      unitig_min = fallback_thresh;
+    }
+    else if(est_min_covg >= 0) unitig_min = est_min_covg;
+    else die("Need cleaning threshold (--unitigs=<D> or --fallback <D>)");
+  }
+
+  if(unitig_min > 0 || min_keep_tip > 0)
+  {
+    status("[pipeline] Cleaning tips shorter than %i nodes, unitigs with "
+           "coverage < %i", min_keep_tip, unitig_min);
+    clean_graph(nthreads, unitig_min, min_keep_tip, 1,
+                NULL, NULL, NULL, NULL, visited, keep, db_graph);
+  }
+
+  ctx_free(visited);
+  ctx_free(keep);
+
+  ErrorCleaning *cleaning = &db_graph->ginfo[0].cleaning;
+  cleaning->cleaned_tips = (min_keep_tip > 0);
+  cleaning->cleaned_unitigs = (unitig_min > 0);
+  cleaning->clean_unitigs_thresh = unitig_min;
+
+  size_t removed_nkmers = initial_nkmers - hash_table_nkmers(&db_graph->ht);
+  double removed_pct = initial_nkmers ? (100.0 * removed_nkmers) / initial_nkmers : 0;
+  char removed_str[100], init_str[100];
+  ulong_to_str(removed_nkmers, removed_str);
+  ulong_to_str(initial_nkmers, init_str);
+  status("Removed %s of %s (%.2f%%) kmers", removed_str, init_str, removed_pct);
+}
+
+static void pipeline_infer_edges(dBGraph *db_graph)
+{
+  status("[pipeline] Inferring all missing edges...");
+  size_t num_kmers_edited = infer_edges(nthreads, true, db_graph);
+
+  char modified_str[100], kmers_str[100];
+  ulong_to_str(num_kmers_edited, modified_str);
+  ulong_to_str(hash_table_nkmers(&db_graph->ht), kmers_str);
+
+  double modified_rate = 0;
+  if(hash_table_nkmers(&db_graph->ht))
+    modified_rate = (100.0 * num_kmers_edited) / hash_table_nkmers(&db_graph->ht);
+
+  status("%s of %s (%.2f%%) nodes modified\n",
+         modified_str, kmers_str, modified_rate);
+}
+
+// Thread reads, as in ctx_thread.c
+static void pipeline_thread(dBGraph *db_graph, size_t path_mem, FILE *fout)
+{
+  size_t i, start, end;
+  CorrectAlnInput *inputs = tinputs.b;
+  size_t ninputs = tinputs.len;
+
+  size_t pentry_hash_mem = sizeof(GPEntry)/0.7;
+  size_t pentry_store_mem = sizeof(GPath) + 8 + // struct + sequence
+                            1 + // in colour
+                            sizeof(uint8_t) + // counts
+                            sizeof(uint32_t); // kmer length
+
+  size_t max_paths = path_mem / (pentry_store_mem + pentry_hash_mem);
+  size_t path_store_mem = max_paths * pentry_store_mem;
+  size_t path_hash_mem = max_paths * pentry_hash_mem;
+  cmd_print_mem(path_hash_mem, "paths hash");
+  cmd_print_mem(path_store_mem, "paths store");
+
+  gpath_store_alloc(&db_graph->gpstore, db_graph->num_of_cols,
+                    db_graph->ht.capacity, 0, path_store_mem, true, false);
+  gpath_hash_alloc2(&db_graph->gphash, &db_graph->gpstore,
+                    path_hash_mem, path_hash_mem);
+
+  status("[pipeline] Threading reads through the graph");
+  if(use_new_paths) status("Using paths as they are added (risky)");
+  else status("Not using new paths as they are added (safe)");
+
+  for(i = 0; i < ninputs; i++) correct_aln_input_print(&inputs[i]);
+
+  GenPathWorker *workers = gen_paths_workers_alloc(nthreads, db_graph);
+  SeqLoadingStats *load_stats = gen_paths_get_stats(workers);
+  CorrectAlnStats *aln_stats = gen_paths_get_aln_stats(workers);
+
+  if(!use_new_paths) gpath_store_split_read_write(&db_graph->gpstore);
+
+  for(start = 0; start < ninputs; start = end) {
+    end = MIN2(ninputs, start+MAX_IO_THREADS);
+    generate_paths(inputs+start, end-start, workers, nthreads);
+  }
+
+  gpath_hash_print_stats(&db_graph->gphash);
+  gpath_store_print_stats(&db_graph->gpstore);
+
+  correct_aln_dump_stats(aln_stats, load_stats,
+                         dump_seq_sizes, dump_frag_sizes,
+                         hash_table_nkmers(&db_graph->ht));
+
+  gpath_hash_dealloc(&db_graph->gphash);
+
+  // Generate a cJSON header for all inputs
+  cJSON *thread_hdr = cJSON_CreateObject();
+  cJSON *inputs_hdr = cJSON_CreateArray();
+  cJSON_AddItemToObject(thread_hdr, "inputs", inputs_hdr);
+  for(i = 0; i < ninputs; i++)
+    cJSON_AddItemToArray(inputs_hdr, correct_aln_input_json_hdr(&inputs[i]));
+
+  gpath_save(fout, out_ctp_path, MIN2(nthreads, MAX_IO_THREADS), true,
+             sort_kmers, "pipeline", thread_hdr, NULL, 0,
+             &aln_stats->contig_histgrm, 1, db_graph);
+
+  gen_paths_workers_dealloc(workers, nthreads);
+}
+
+int ctx_pipeline(int argc, char **argv)
+{
+  size_t i;
+  build_graph_task_buf_alloc(&btasks, 16);
+  correct_aln_input_buf_alloc(&tinputs, 16);
+
+  parse_args(argc, argv);
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem, path_mem, max_kmers = 0;
+
+  for(i = 0; i < btasks.len; i++) {
+    size_t nkmers = asyncio_input_nkmers(&btasks.b[i].files);
+    if(nkmers == SIZE_MAX) { max_kmers = nkmers; break; }
+    max_kmers += nkmers;
+  }
+
+  // Graph needs coverage for cleaning, 'in colour' and link pointers for
+  // threading (see ctx_build.c and ctx_thread.c)
+  bits_per_kmer = sizeof(BinaryKmer)*8 +
+                  (sizeof(CovgStore) + sizeof(Edges)) * 8 +
+                  1 + // in colour
+                  sizeof(GPath*)*8 +
+                  2 * nthreads + // have traversed
+                  (remove_pcr_used ? 2 : 0);
+
+  // Leave a third of the memory for links
+  size_t graph_mem_limit = memargs.mem_to_use / 3 * 2;
+
+  kmers_in_hash = cmd_get_kmers_in_hash(graph_mem_limit,
+                                        memargs.mem_to_use_set,
+                                        memargs.num_kmers,
+                                        memargs.num_kmers_set,
+                                        bits_per_kmer, 0, max_kmers,
+                                        true, &graph_mem);
+
+  if(graph_mem >= memargs.mem_to_use) {
+    char buf[50];
+    die("Require more than %s memory", bytes_to_str(graph_mem, 1, buf));
+  }
+
+  path_mem = memargs.mem_to_use - graph_mem;
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem + path_mem);
+
+  //
+  // Check output paths
+  //
+  futil_create_output(out_ctx_path);
+  futil_create_output(dump_seq_sizes);
+  futil_create_output(dump_frag_sizes);
+
+  FILE *fout = futil_fopen_create(out_ctp_path, "w");
+  status("Creating paths file: %s", futil_outpath_str(out_ctp_path));
+
+  //
+  // Allocate graph
+  //
+  dBGraph db_graph;
+  int alloc_flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                    DBG_ALLOC_BKTLOCKS |
+                    (remove_pcr_used ? DBG_ALLOC_READSTRT : 0);
+
+  db_graph_alloc(&db_graph, kmer_size, 1, 1, kmers_in_hash, alloc_flags);
+  hash_table_print_stats(&db_graph.ht);
+
+  size_t phase = ctx_stats_phase_start("build");
+  pipeline_build(&db_graph);
+  ctx_stats_phase_end(phase);
+
+  phase = ctx_stats_phase_start("clean");
+  pipeline_clean(&db_graph);
+  ctx_stats_phase_end(phase);
+
+  // Memory released by shrinking the graph is given to links
+  size_t capacity = db_graph.ht.capacity;
+  if(db_graph_compact(&db_graph, DBG_COMPACT_OCCUPANCY, nthreads))
+    path_mem += ((capacity - db_graph.ht.capacity) * bits_per_kmer) / 8;
+
+  phase = ctx_stats_phase_start("inferedges");
+  pipeline_infer_edges(&db_graph);
+  ctx_stats_phase_end(phase);
+
+  if(out_ctx_path != NULL) {
+    status("Dumping graph...\n");
+    phase = ctx_stats_phase_start("save");
+    graph_writer_save_mkhdr(out_ctx_path, &db_graph, sort_kmers, 1);
+    ctx_stats_phase_end(phase);
+  }
+
+  phase = ctx_stats_phase_start("thread");
+  pipeline_thread(&db_graph, path_mem, fout);
+  ctx_stats_phase_end(phase);
+
+  futil_fclose(fout);
+
+  for(i = 0; i < tinputs.len; i++) asyncio_task_close(&tinputs.b[i].files);
+  build_graph_task_buf_dealloc(&btasks);
+  correct_aln_input_buf_dealloc(&tinputs);
+  db_graph_dealloc(&db_graph);
+
+  return EXIT_SUCCESS;
+}
@@ -7,6 +7,9 @@
 #include "gpath_reader.h"
 #include "gpath_checks.h"
 #include "gpath_save.h"
+#include "gpath_set.h"
+#include "gpath_subset.h"
+#include "binary_seq.h"
 
 const char pjoin_usage[] =
 "usage: "CMD" pjoin [options] <in1.ctp.gz> [[offset:]in2.ctp[:0,2-4] ...]\n"
@@ -24,9 +27,16 @@ const char pjoin_usage[] =
 "  -g, --graph <in.ctx>   Get number of hash table entries from graph file\n"
 "  -c, --outcols <C>      How many 'colours' should the output file have\n"
 "  -r, --noredundant      Remove redundant paths\n"
+"  -S, --sort             Write kmers in sorted order\n"
+"  -s, --stream           Merge sorted link files one kmer at a time, without\n"
+"                         loading them. Uses very little memory. Inputs must\n"
+"                         be sorted (.ctp.bin or saved with --sort)\n"
 "\n"
 "  Files can be specified with specific colours: samples.ctp:2,3\n"
 "  Offset specifies where to load the first colour: 3:samples.ctp\n"
+"  Output is a binary link file if <out> ends in .ctp.bin. Binary link files\n"
+"  are memory mapped when loaded, which is much faster than .ctp.gz\n"
+"  --stream output is always sorted and cannot be a .ctp.bin file\n"
 "\n";
 
 static struct option longopts[] =
@@ -42,6 +52,8 @@ static struct option longopts[] =
   {"graph",        required_argument, NULL, 'g'},
   {"outcols",      required_argument, NULL, 'c'},
   {"noredundant",  required_argument, NULL, 'r'},
+  {"sort",         no_argument,       NULL, 'S'},
+  {"stream",       no_argument,       NULL, 's'},
   {NULL, 0, NULL, 0}
 };
 
@@ -49,7 +61,7 @@ int ctx_pjoin(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool noredundant = false;
+  bool noredundant = false, sort_kmers = false, stream = false;
   size_t output_ncols = 0;
   char *graph_file = NULL;
   const char *out_ctp_path = NULL;
@@ -76,6 +88,8 @@ int ctx_pjoin(int argc, char **argv)
       case 'g': cmd_check(!graph_file,cmd); graph_file = optarg; break;
       case 'c': cmd_check(!output_ncols, cmd); output_ncols = cmd_uint32_nonzero(cmd, optarg); break;
       case 'r': cmd_check(!noredundant,cmd); noredundant = true; break;
+      case 'S': cmd_check(!sort_kmers,cmd); sort_kmers = true; break;
+      case 's': cmd_check(!stream,cmd); stream = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -89,6 +103,8 @@ int ctx_pjoin(int argc, char **argv)
 
   if(out_ctp_path == NULL) cmd_print_usage("--out <out.ctp.gz> required");
   if(optind >= argc) cmd_print_usage("Please specify at least one input file");
+  if(stream && gpath_reader_is_bin(out_ctp_path))
+    cmd_print_usage("--stream cannot write a binary link file (.ctp.bin)");
 
   // argi .. argend-1 are graphs to load
   size_t num_pfiles = (size_t)(argc - optind);
@@ -142,6 +158,48 @@ int ctx_pjoin(int argc, char **argv)
   if(graph_file != NULL)
     graph_file_close(&gfile);
 
+  // Load contig hist distribution
+  ZeroSizeBuffer *contig_histgrms = ctx_calloc(output_ncols, sizeof(ZeroSizeBuffer));
+
+  for(i = 0; i < output_ncols; i++)
+    zsize_buf_alloc(&contig_histgrms[i], 512);
+
+  size_t fromcol, intocol;
+  for(i = 0; i < num_pfiles; i++) {
+    for(j = 0; j < file_filter_num(&pfiles[i].fltr); j++) {
+      fromcol = file_filter_fromcol(&pfiles[i].fltr, j);
+      intocol = file_filter_intocol(&pfiles[i].fltr, j);
+      gpath_reader_load_contig_hist(pfiles[i].json, pfiles[i].fltr.path.b,
+                                    fromcol, &contig_histgrms[intocol]);
+    }
+  }
+
+  if(stream)
+  {
+    for(i = 0; i < num_pfiles; i++) {
+      if(!gpath_reader_kmers_sorted(&pfiles[i])) {
+        die("Link file is not sorted, save with --sort to use --stream: %s",
+            file_filter_path(&pfiles[i].fltr));
+      }
+    }
+
+    cJSON **hdrs = ctx_calloc(num_pfiles, sizeof(cJSON*));
+    for(i = 0; i < num_pfiles; i++) hdrs[i] = pfiles[i].json;
+
+    FILE *fout = futil_fopen_create(out_ctp_path, "w");
+    gpath_save_merge_sorted(fout, out_ctp_path, pfiles, num_pfiles,
+                            NULL, NULL, hdrs, num_pfiles,
+                            contig_histgrms, output_ncols);
+    futil_fclose(fout);
+    ctx_free(hdrs);
+
+    for(i = 0; i < output_ncols; i++) zsize_buf_dealloc(&contig_histgrms[i]);
+    ctx_free(contig_histgrms);
+    for(i = 0; i < num_pfiles; i++) gpath_reader_close(&pfiles[i]);
+    ctx_free(pfiles);
+    return EXIT_SUCCESS;
+  }
+
   if(memargs.num_kmers_set && memargs.num_kmers > ctp_sum_kmers) {
     char num_kmers_str[100], args_num_kmers_str[100];
     ulong_to_str(ctp_sum_kmers, num_kmers_str);
@@ -185,12 +243,14 @@ int ctx_pjoin(int argc, char **argv)
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
   // Open output file
-  gzFile gzout = futil_gzopen_create(out_ctp_path, "w");
+  // Binary link files (.ctp.bin) and gzip text are both written by gpath_save()
+  FILE *fout = futil_fopen_create(out_ctp_path, "w");
 
   // Set up graph and PathStore
   size_t kmer_size = gpath_reader_get_kmer_size(&pfiles[0]);
   dBGraph db_graph;
-  db_graph_alloc(&db_graph, kmer_size, output_ncols, 0, kmers_in_hash, 0);
+  db_graph_alloc(&db_graph, kmer_size, output_ncols, 0, kmers_in_hash,
+                 DBG_ALLOC_BKTLOCKS);
 
   // Create a path store that tracks path counts
   gpath_reader_alloc_gpstore(pfiles, num_pfiles,
@@ -199,25 +259,10 @@ int ctx_pjoin(int argc, char **argv)
   for(i = 0; i < num_pfiles; i++)
     gpath_reader_load_sample_names(&pfiles[i], &db_graph);
 
-  // Load contig hist distribution
-  ZeroSizeBuffer *contig_histgrms = ctx_calloc(output_ncols, sizeof(ZeroSizeBuffer));
-
-  for(i = 0; i < output_ncols; i++)
-    zsize_buf_alloc(&contig_histgrms[i], 512);
-
-  size_t fromcol, intocol;
-  for(i = 0; i < num_pfiles; i++) {
-    for(j = 0; j < file_filter_num(&pfiles[i].fltr); j++) {
-      fromcol = file_filter_fromcol(&pfiles[i].fltr, j);
-      intocol = file_filter_intocol(&pfiles[i].fltr, j);
-      gpath_reader_load_contig_hist(pfiles[i].json, pfiles[i].fltr.path.b,
-                                    fromcol, &contig_histgrms[intocol]);
-    }
-  }
-
   // Load link files
   for(i = 0; i < num_pfiles; i++)
-    gpath_reader_load(&pfiles[i], GPATH_ADD_MISSING_KMERS, &db_graph);
+    gpath_reader_load_mt(&pfiles[i], GPATH_ADD_MISSING_KMERS, nthreads,
+                         &db_graph);
 
   status("Got %zu path bytes", (size_t)db_graph.gpstore.path_bytes);
 
@@ -227,7 +272,7 @@ int ctx_pjoin(int argc, char **argv)
   for(i = 0; i < num_pfiles; i++) hdrs[i] = pfiles[i].json;
 
   // Write output file
-  gpath_save(gzout, out_ctp_path, output_threads, false,
+  gpath_save(fout, out_ctp_path, output_threads, false, sort_kmers,
              NULL, NULL, hdrs, num_pfiles,
              contig_histgrms, output_ncols,
              &db_graph);
@@ -237,7 +282,7 @@ int ctx_pjoin(int argc, char **argv)
 
   ctx_free(contig_histgrms);
 
-  gzclose(gzout);
+  futil_fclose(fout);
   ctx_free(hdrs);
 
   // Close ctp files
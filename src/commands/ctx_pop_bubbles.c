@@ -7,7 +7,6 @@
 #include "graph_writer.h"
 #include "gpath_reader.h"
 #include "gpath_checks.h"
-#include "prune_nodes.h"
 #include "pop_bubbles.h"
 
 const char pop_bubbles_usage[] =
@@ -26,6 +25,8 @@ const char pop_bubbles_usage[] =
 "  -C, --max-covg <C>    Only remove branches whose mean coverage is less than <C>\n"
 "  -L, --max-len <L>     Only remove branches whose lengths are less than <L> kmers\n"
 "  -D, --max-diff <D>    Only pop bubbles whose branch lengths are within <D> kmers\n"
+"  -R, --rounds <R>      Repeat around popped bubbles up to <R> times, 0 => until\n"
+"                        no more are popped [default: 1]\n"
 "\n";
 
 static struct option longopts[] =
@@ -40,6 +41,7 @@ static struct option longopts[] =
   {"max-covg",     required_argument, NULL, 'C'},
   {"max-len",      required_argument, NULL, 'L'},
   {"max-diff",     required_argument, NULL, 'D'},
+  {"rounds",       required_argument, NULL, 'R'},
   {NULL, 0, NULL, 0}
 };
 
@@ -51,6 +53,7 @@ int ctx_pop_bubbles(int argc, char **argv)
   int32_t max_covg  = -1; // max mean coverage to remove <=0 => ignore
   int32_t max_klen  = -1; // max length (kmers) to remove <=0 => ignore
   int32_t max_kdiff = -1; // max diff between bubble branch lengths <0 => ignore
+  int32_t max_rounds = -1; // number of rounds, 0 => until none popped
 
   // Arg parsing
   char cmd[100];
@@ -74,6 +77,7 @@ int ctx_pop_bubbles(int argc, char **argv)
       case 'C': cmd_check(max_covg<0,  cmd); max_covg  = cmd_uint32(cmd, optarg); break;
       case 'L': cmd_check(max_klen<0,  cmd); max_klen  = cmd_uint32(cmd, optarg); break;
       case 'D': cmd_check(max_kdiff<0, cmd); max_kdiff = cmd_uint32(cmd, optarg); break;
+      case 'R': cmd_check(max_rounds<0, cmd); max_rounds = cmd_uint32(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -85,6 +89,8 @@ int ctx_pop_bubbles(int argc, char **argv)
   // Defaults for unset values
   if(out_path == NULL) out_path = "-";
   if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+  if(max_rounds < 0) max_rounds = 1;
+  graph_writer_set_nthreads(nthreads);
 
   if(optind >= argc) cmd_print_usage("Require input graph files (.ctx)");
 
@@ -118,8 +124,9 @@ int ctx_pop_bubbles(int argc, char **argv)
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  sizeof(Covg)*8*ncols +
+                  sizeof(CovgStore)*8*ncols +
                   sizeof(Edges)*8*ncols +
+                  (ncols > 1 ? sizeof(Edges)*8 : 0) + // union of edges
                   2; // 1 bit for visited, 1 for removed
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -148,6 +155,7 @@ int ctx_pop_bubbles(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -161,19 +169,20 @@ int ctx_pop_bubbles(int argc, char **argv)
 
   PopBubblesPrefs prefs = {.max_rmv_covg = max_covg,
                            .max_rmv_klen = max_klen,
-                           .max_rmv_kdiff = max_kdiff};
+                           .max_rmv_kdiff = max_kdiff,
+                           .max_rounds = max_rounds};
   size_t npopped = 0;
   char npopped_str[50];
 
+  // Bubbles are found in the union graph, cache the union of edges
+  db_graph_union_edges_alloc(&db_graph, nthreads);
+
+  size_t nkmers0 = hash_table_nkmers(&db_graph.ht);
   status("Popping bubbles...");
   npopped = pop_bubbles(&db_graph, nthreads, prefs, visited, rmvbits);
+  db_graph_union_edges_dealloc(&db_graph);
   ulong_to_str(npopped, npopped_str);
   status("Popped %s bubbles", npopped_str);
-
-  size_t nkmers0 = hash_table_nkmers(&db_graph.ht);
-  status("Removing nodes...");
-  for(i = 0; i < nkwords; i++) rmvbits[i] = ~rmvbits[i];
-  prune_nodes_lacking_flag(nthreads, rmvbits, &db_graph);
   size_t nkmers1 = hash_table_nkmers(&db_graph.ht);
 
   ctx_assert(nkmers1 <= nkmers0);
@@ -183,6 +192,11 @@ int ctx_pop_bubbles(int argc, char **argv)
   ulong_to_str(nkmers0-nkmers1, ndiffstr);
   status("Number of kmers %s -> %s (-%s)", nkmers0str, nkmers1str, ndiffstr);
 
+  ctx_free(visited);
+  ctx_free(rmvbits);
+
+  db_graph_compact(&db_graph, DBG_COMPACT_OCCUPANCY, nthreads);
+
   if(reread_graph_to_filter)
   {
     status("Streaming filtered file to: %s\n", out_path);
@@ -199,9 +213,6 @@ int ctx_pop_bubbles(int argc, char **argv)
     graph_writer_save_mkhdr(out_path, &db_graph, false, ncols);
   }
 
-  ctx_free(visited);
-  ctx_free(rmvbits);
-
   db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
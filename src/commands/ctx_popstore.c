@@ -0,0 +1,241 @@
+#include "global.h"
+
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "binary_kmer.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "graph_info.h"
+#include "graphs_load.h"
+#include "graph_popstore.h"
+
+const char popstore_usage[] =
+"usage: "CMD" popstore [options] <pop.popstore> <in.ctx> [in2.ctx ...]\n"
+"\n"
+"  Add samples to a population store: one kmer dictionary shared by all\n"
+"  samples, with the coverages and edges of each sample in its own column\n"
+"  file. The store is created if it doesn't exist. Each colour of the input\n"
+"  graphs is added as a sample. Adding samples only writes their columns and a\n"
+"  dictionary part of the kmers not seen before.\n"
+"\n"
+"  -h, --help              This help message\n"
+"  -q, --quiet             Silence status output normally printed to STDERR\n"
+"  -f, --force             Overwrite output files\n"
+"  -m, --memory <mem>      Memory to use\n"
+"  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>       Number of threads to load with [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"\n"
+"  A store can be given to any command that loads graphs, with colours\n"
+"  selecting samples: pop.popstore:3,7\n"
+"\n";
+
+static struct option longopts[] =
+{
+// General options
+  {"help",         no_argument,       NULL, 'h'},
+  {"force",        no_argument,       NULL, 'f'},
+  {"memory",       required_argument, NULL, 'm'},
+  {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
+  {NULL, 0, NULL, 0}
+};
+
+// Add the kmers of a new dictionary part to the graph, recording their ranks
+static void popstore_insert_dict(dBGraph *db_graph, const BinaryKmer *bkmers,
+                                 size_t n, hkey_t *byrank, uint8_t *indict)
+{
+  size_t i;
+  bool found;
+  hkey_t hkey;
+  for(i = 0; i < n; i++) {
+    hkey = hash_table_find_or_insert(&db_graph->ht, bkmers[i], &found);
+    byrank[i] = hkey;
+    indict[hkey] = 1;
+  }
+}
+
+int ctx_popstore(int argc, char **argv)
+{
+  struct MemArgs memargs = MEM_ARGS_INIT;
+  size_t nthreads = 0;
+
+  // Arg parsing
+  char cmd[100], shortopts[100];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    cmd_get_longopt_str(longopts, c, cmd, sizeof(cmd));
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
+      case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        die("`"CMD" popstore -h` for help. Bad option: %s", argv[optind-1]);
+      default: abort();
+    }
+  }
+
+  // Defaults for unset values
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
+  if(optind+2 > argc)
+    cmd_print_usage("Require a population store and at least one input graph");
+
+  const char *manifest_path = argv[optind];
+  char **paths = argv + optind + 1;
+  size_t i, j, col, num_gfiles = argc - optind - 1;
+
+  //
+  // Open input graphs
+  //
+  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+  size_t ncols = 0, nsamples = 0, sum_kmers = 0;
+
+  for(i = 0; i < num_gfiles; i++) {
+    graph_file_open(&gfiles[i], paths[i]);
+    if(gfiles[i].hdr.kmer_size != gfiles[0].hdr.kmer_size) {
+      die("Graphs have different kmer sizes [%u vs %u]: %s",
+          gfiles[0].hdr.kmer_size, gfiles[i].hdr.kmer_size, paths[i]);
+    }
+    ncols = MAX2(ncols, file_filter_into_ncols(&gfiles[i].fltr));
+    nsamples += file_filter_into_ncols(&gfiles[i].fltr);
+    sum_kmers += graph_file_nkmers(&gfiles[i]);
+  }
+
+  //
+  // Load existing store or start a new one
+  //
+  const size_t kmer_size = gfiles[0].hdr.kmer_size;
+  GraphPopStore ps;
+
+  if(futil_file_exists(manifest_path)) {
+    if(!graph_popstore_is_file(manifest_path))
+      die("Not a population store: %s", manifest_path);
+    graph_popstore_load(&ps, manifest_path);
+    if(ps.kmer_size != kmer_size) {
+      die("Store kmer size doesn't match graphs [%zu vs %zu]: %s",
+          ps.kmer_size, kmer_size, manifest_path);
+    }
+    // Only the dictionary is needed to add samples
+    uint8_t *sel = ctx_calloc(MAX2(ps.nsamples, 1), 1);
+    graph_popstore_map(&ps, sel);
+    ctx_free(sel);
+  }
+  else {
+    futil_create_output(manifest_path);
+    graph_popstore_alloc(&ps, kmer_size);
+  }
+
+  status("[popstore] Adding %zu samples from %zu graphs to store of %zu samples",
+         nsamples, num_gfiles, ps.nsamples);
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+
+  // rank of each kmer plus one byte to mark kmers in the dictionary
+  bits_per_kmer = sizeof(BinaryKmer)*8 +
+                  (sizeof(CovgStore) + sizeof(Edges)) * 8 * ncols +
+                  sizeof(hkey_t)*8 + 8;
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+                                        memargs.mem_to_use_set,
+                                        memargs.num_kmers,
+                                        memargs.num_kmers_set,
+                                        bits_per_kmer,
+                                        ps.nkmers + sum_kmers / num_gfiles,
+                                        ps.nkmers + sum_kmers,
+                                        true, &graph_mem);
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, kmer_size, ncols, ncols, kmers_in_hash,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS);
+
+  // byrank[r] is the hkey of the kmer of rank r
+  size_t byrank_cap = ps.nkmers + 1024;
+  hkey_t *byrank = ctx_malloc(byrank_cap * sizeof(hkey_t));
+  uint8_t *indict = ctx_calloc(db_graph.ht.capacity, sizeof(uint8_t));
+
+  size_t r = 0;
+  for(i = 0; i < ps.ndicts; i++) {
+    popstore_insert_dict(&db_graph, ps.dicts[i].bkmers, ps.dicts[i].nkmers,
+                         byrank + r, indict);
+    r += ps.dicts[i].nkmers;
+  }
+
+  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
+
+  BinaryKmer *novel = NULL;
+  size_t novel_cap = 0, nnovel;
+  hkey_t hkey;
+  char *path;
+
+  for(i = 0; i < num_gfiles; i++)
+  {
+    graph_load(&gfiles[i], gprefs, NULL);
+
+    // Kmers not in the dictionary go in a new part
+    for(nnovel = 0, hkey = 0; hkey < db_graph.ht.capacity; hkey++) {
+      if(hash_table_assigned(&db_graph.ht, hkey) && !indict[hkey]) {
+        if(nnovel == novel_cap) {
+          novel_cap = novel_cap ? novel_cap*2 : 1024;
+          novel = ctx_reallocarray(novel, novel_cap, sizeof(BinaryKmer));
+        }
+        novel[nnovel++] = db_node_get_bkey(&db_graph, hkey);
+      }
+    }
+
+    if(nnovel > 0) {
+      r = ps.nkmers;
+      path = graph_popstore_new_path(manifest_path, ps.ndicts+1, "dict");
+      futil_create_output(path);
+      graph_popstore_add_dict(&ps, path, novel, nnovel); // sorts `novel`
+      free(path);
+
+      if(ps.nkmers > byrank_cap) {
+        byrank_cap = roundup2pow(ps.nkmers);
+        byrank = ctx_reallocarray(byrank, byrank_cap, sizeof(hkey_t));
+      }
+      for(j = 0; j < nnovel; j++) {
+        hkey = hash_table_find(&db_graph.ht, novel[j]);
+        byrank[r+j] = hkey;
+        indict[hkey] = 1;
+      }
+    }
+
+    for(col = 0; col < file_filter_into_ncols(&gfiles[i].fltr); col++) {
+      path = graph_popstore_new_path(manifest_path, ps.nsamples+1, "col");
+      futil_create_output(path);
+      graph_popstore_add_col(&ps, path, &db_graph, col, byrank);
+      free(path);
+    }
+
+    // Keep the kmers (the dictionary), clear the samples
+    for(col = 0; col < ncols; col++) {
+      db_graph_wipe_colour(&db_graph, col, nthreads);
+      graph_info_init(&db_graph.ginfo[col]);
+    }
+    graph_file_close(&gfiles[i]);
+  }
+
+  graph_popstore_save(&ps, manifest_path);
+
+  ctx_free(novel);
+  ctx_free(indict);
+  ctx_free(byrank);
+  ctx_free(gfiles);
+  graph_popstore_dealloc(&ps);
+  db_graph_dealloc(&db_graph);
+
+  return EXIT_SUCCESS;
+}
@@ -20,6 +20,7 @@ const char pview_usage[] =
 // "  -o, --out <out.txt>    Output file [required]\n"
 "  -m, --memory <mem>     Memory to use\n"
 "  -n, --nkmers <kmers>   Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>      Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -p, --paths <in.ctp>   Load link file (can specify multiple times)\n"
 // "  -H, --header-only      Only print the header (no paths)\n"
 // "  -P, --paths-only       Only print the paths (no header)\n"
@@ -33,6 +34,7 @@ static struct option longopts[] =
   {"out",          required_argument, NULL, 'o'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
   {"paths",        required_argument, NULL, 'p'},
   {"force",        no_argument,       NULL, 'f'},
 // command specific
@@ -41,15 +43,77 @@ static struct option longopts[] =
   {NULL, 0, NULL, 0}
 };
 
-static int _print_paths(hkey_t hkey,
-                        StrBuf *sbuf, GPathSubset *subset,
-                        dBNodeBuffer *nbuf, SizeBuffer *jposbuf,
-                        FILE *fout, const dBGraph *db_graph)
+// Threads format links of one chunk of hash table entries each, chunks are
+// printed in hash table order
+#define PVIEW_CHUNK_ENTRIES (1<<20)
+
+typedef struct
+{
+  StrBuf sbuf;
+  dBNodeBuffer nbuf;
+  SizeBuffer jposbuf;
+  GPathSubset subset;
+} PViewBuffers;
+
+typedef struct
+{
+  const dBGraph *db_graph;
+  PViewBuffers *bufs; // [nthreads]
+  size_t first_chunk; // chunk of thread 0 in this round
+} PViewPrinting;
+
+static void _print_paths_thread(void *arg, size_t threadid)
 {
-  strbuf_reset(sbuf);
-  gpath_save_sbuf(hkey, sbuf, subset, nbuf, jposbuf, db_graph);
-  fputs(sbuf->b, fout);
-  return 0; // 0 => keep iterating
+  PViewPrinting *pv = (PViewPrinting*)arg;
+  PViewBuffers *bufs = &pv->bufs[threadid];
+  const HashTable *ht = &pv->db_graph->ht;
+  size_t hkey, start, end;
+
+  start = (pv->first_chunk + threadid) * PVIEW_CHUNK_ENTRIES;
+  end = MIN2(start + PVIEW_CHUNK_ENTRIES, hash_table_size(ht));
+
+  for(hkey = start; hkey < end; hkey++) {
+    if(hash_table_assigned(ht, hkey)) {
+      gpath_save_sbuf(hkey, &bufs->sbuf, &bufs->subset, &bufs->nbuf,
+                      &bufs->jposbuf, pv->db_graph);
+    }
+  }
+}
+
+static void _print_paths(size_t nthreads, FILE *fout, dBGraph *db_graph)
+{
+  size_t i, n, nchunks;
+  PViewBuffers *bufs = ctx_calloc(nthreads, sizeof(PViewBuffers));
+
+  for(i = 0; i < nthreads; i++) {
+    strbuf_alloc(&bufs[i].sbuf, 4096);
+    db_node_buf_alloc(&bufs[i].nbuf, 1024);
+    size_buf_alloc(&bufs[i].jposbuf, 256);
+    gpath_subset_alloc(&bufs[i].subset);
+    gpath_subset_init(&bufs[i].subset, &db_graph->gpstore.gpset);
+  }
+
+  PViewPrinting pv = {.db_graph = db_graph, .bufs = bufs, .first_chunk = 0};
+  nchunks = (hash_table_size(&db_graph->ht) + PVIEW_CHUNK_ENTRIES - 1) /
+            PVIEW_CHUNK_ENTRIES;
+
+  for(; pv.first_chunk < nchunks; pv.first_chunk += n) {
+    n = MIN2(nthreads, nchunks - pv.first_chunk);
+    util_multi_thread(&pv, n, _print_paths_thread);
+    for(i = 0; i < n; i++) {
+      if(fwrite(bufs[i].sbuf.b, 1, bufs[i].sbuf.end, fout) != bufs[i].sbuf.end)
+        die("Cannot write links: %s", strerror(errno));
+      strbuf_reset(&bufs[i].sbuf);
+    }
+  }
+
+  for(i = 0; i < nthreads; i++) {
+    strbuf_dealloc(&bufs[i].sbuf);
+    db_node_buf_dealloc(&bufs[i].nbuf);
+    size_buf_dealloc(&bufs[i].jposbuf);
+    gpath_subset_dealloc(&bufs[i].subset);
+  }
+  ctx_free(bufs);
 }
 
 static cJSON* _get_header(GPathFileBuffer *gpfiles, const dBGraph *db_graph)
@@ -77,7 +141,7 @@ static cJSON* _get_header(GPathFileBuffer *gpfiles, const dBGraph *db_graph)
   for(i = 0; i < gpfiles->len; i++) hdrs[i] = gpfiles->b[i].json;
   cJSON *json = gpath_save_mkhdr("STDOUT", NULL, NULL, hdrs, gpfiles->len,
                                  contig_histgrms, db_graph->num_of_cols,
-                                 db_graph);
+                                 false, db_graph);
 
   for(i = 0; i < db_graph->num_of_cols; i++)
     zsize_buf_dealloc(&contig_histgrms[i]);
@@ -90,6 +154,7 @@ static cJSON* _get_header(GPathFileBuffer *gpfiles, const dBGraph *db_graph)
 int ctx_pview(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
+  size_t nthreads = 0;
   const char *out_path = NULL;
   bool header_only = false, paths_only = false;
 
@@ -115,6 +180,7 @@ int ctx_pview(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'p':
         memset(&tmp_gpfile, 0, sizeof(GPathReader));
         gpath_reader_open(&tmp_gpfile, optarg);
@@ -131,6 +197,7 @@ int ctx_pview(int argc, char **argv)
   }
 
   // Defaults for unset values
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
   if(out_path == NULL) out_path = "-";
 
   if(optind >= argc)   cmd_print_usage("Please give input graph files");
@@ -199,6 +266,7 @@ int ctx_pview(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -222,29 +290,8 @@ int ctx_pview(int argc, char **argv)
     cJSON_Delete(json);
   }
 
-  if(!header_only)
-  {
-    // Print paths
-    StrBuf sbuf;
-    dBNodeBuffer nbuf;
-    SizeBuffer jposbuf;
-    GPathSubset subset;
-
-    strbuf_alloc(&sbuf, 4096);
-    db_node_buf_alloc(&nbuf, 1024);
-    size_buf_alloc(&jposbuf, 256);
-    gpath_subset_alloc(&subset);
-    gpath_subset_init(&subset, &db_graph.gpstore.gpset);
-
-    HASH_ITERATE(&db_graph.ht, _print_paths,
-                 &sbuf, &subset, &nbuf, &jposbuf,
-                 fout, &db_graph);
-
-    strbuf_dealloc(&sbuf);
-    db_node_buf_dealloc(&nbuf);
-    size_buf_dealloc(&jposbuf);
-    gpath_subset_dealloc(&subset);
-  }
+  // Print paths
+  if(!header_only) _print_paths(nthreads, fout, &db_graph);
 
   if(fout != stdout) fclose(fout);
 
@@ -9,9 +9,11 @@
 #include "graphs_load.h"
 #include "seqout.h"
 #include "async_read_io.h"
+#include "graph_shm.h"
 
 const char reads_usage[] =
 "usage: "CMD" reads [options] <in.ctx>[:cols] [in2.ctx ...]\n"
+"       "CMD" reads [options] --graph-shm <name>\n"
 "\n"
 "  Filters reads based on which have a kmer in the graph. \n"
 "\n"
@@ -24,16 +26,23 @@ const char reads_usage[] =
 //
 "  -F, --format <f>            Output format may be: FASTA, FASTQ [default: FASTQ]\n"
 "  -v, --invert                Print reads/read pairs with no kmer in graph\n"
+"  -H, --hits <N>              Kmers in the graph for a read to hit [default: 1]\n"
 "  -1, --seq  <in>:<O>         Writes output to <O>.fq.gz\n"
 "  -2, --seq2 <in1>:<in2>:<O>  Writes output to <O>.{1,2}.fq.gz\n"
 "  -i, --seqi <in>:<O>         Writes output to <O>.{1,2}.fq.gz\n"
+"  -G, --graph-shm <name>      Use kmers of a graph in shared memory (see load)\n"
+"  -B, --kmer-filter           Check kmers against a Bloom filter of the graph\n"
+"                              first. Faster when most kmers are not in the graph.\n"
+"                              Uses 16-32 more bits of memory per kmer.\n"
 "\n"
 "  Output is <O>.fq.gz for FASTQ, <O>.fa.gz for FASTA, <O>.txt.gz for plain\n"
 "  Paired reads are saved to e.g. <O>.1.fq.gz, <O>.2.fq.gz, and unpaired reads\n"
 "  to <O>.fq.gz.\n"
 "\n"
 "  User can specify --seq/--seq2/--seqi multiple times. If either read of a\n"
-"  pair touches the graph, both are printed.\n"
+"  pair touches the graph, both are printed. Matching stops as soon as a read\n"
+"  is known to hit or miss. Reads are written a batch at a time, in input order\n"
+"  within each batch.\n"
 "\n";
 
 static struct option longopts[] =
@@ -47,9 +56,12 @@ static struct option longopts[] =
 // command specific
   {"format",       required_argument, NULL, 'F'},
   {"invert",       no_argument,       NULL, 'v'},
+  {"hits",         required_argument, NULL, 'H'},
   {"seq",          required_argument, NULL, '1'},
   {"seq2",         required_argument, NULL, '2'},
   {"seqi",         required_argument, NULL, 'i'},
+  {"graph-shm",    required_argument, NULL, 'G'},
+  {"kmer-filter",  no_argument,       NULL, 'B'},
   {NULL, 0, NULL, 0}
 };
 
@@ -62,28 +74,43 @@ typedef struct
   SeqOutput seqout;
 
   // Stats
-  size_t num_of_reads_printed;
+  volatile size_t num_of_reads_printed;
 
   // Global settings
   dBGraph *db_graph;
-  volatile size_t *rcounter;
-  SeqLoadingStats *stats;
   bool invert;
+  size_t min_hits; // kmers in the graph for a read to hit
   seq_format fmt; // output format
 
 } AlignReadsData;
 
+// Kmers are looked up in windows so hash table buckets can be prefetched.
+// Windows start small and double, so reads that hit early do few lookups.
+#define READS_MIN_WINDOW 4
+#define READS_MAX_WINDOW 64
+
+// Per thread: output buffers for the current batch and stats
+typedef struct
+{
+  StrBuf out_se, out_pe[2];
+  BinaryKmer bkeys[READS_MAX_WINDOW];
+  hkey_t hkeys[READS_MAX_WINDOW];
+  SeqLoadingStats stats;
+} FilterReadsWorker;
+
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(aln_reads_buf, AlignReadsBuffer,   AlignReadsData);
 madcrow_buffer(asyncio_buf,   AsyncIOInputBuffer, AsyncIOInput);
 
 static AsyncIOInputBuffer files;
 static AlignReadsBuffer inputs;
-static size_t nthreads = 0;
+static size_t nthreads = 0, min_hits = 0;
 static struct MemArgs memargs = MEM_ARGS_INIT;
 
 static size_t num_gfiles = 0;
 static char **gfile_paths = NULL;
+static const char *graph_shm = NULL;
+static bool kmer_filter = false;
 
 static volatile size_t read_counter = 0;
 
@@ -116,6 +143,9 @@ static void parse_args(int argc, char **argv)
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'F': cmd_check(fmt==SEQ_FMT_FASTQ, cmd); fmt = cmd_parse_format(cmd, optarg); break;
       case 'v': cmd_check(!invert,cmd); invert = true; break;
+      case 'H': cmd_check(!min_hits,cmd); min_hits = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'G': cmd_check(!graph_shm,cmd); graph_shm = optarg; break;
+      case 'B': cmd_check(!kmer_filter,cmd); kmer_filter = true; break;
       case '1':
       case '2':
       case 'i':
@@ -137,18 +167,22 @@ static void parse_args(int argc, char **argv)
 
   // Defaults
   if(!nthreads) nthreads = DEFAULT_NTHREADS;
+  if(!min_hits) min_hits = 1;
 
   if(inputs.len == 0)
     cmd_print_usage("Please specify at least one sequence file (-1, -2 or -i)");
 
-  if(optind >= argc)
-    cmd_print_usage("Please specify input graph file(s)");
+  if(graph_shm == NULL && optind >= argc)
+    cmd_print_usage("Please specify input graph file(s) or --graph-shm");
+  if(graph_shm != NULL && optind < argc)
+    cmd_print_usage("Cannot give graph files with --graph-shm");
 
   num_gfiles = (size_t)(argc - optind);
   gfile_paths = argv + optind;
 
   for(i = 0; i < inputs.len; i++) {
     inputs.b[i].invert = invert;
+    inputs.b[i].min_hits = min_hits;
     inputs.b[i].fmt = fmt;
     files.b[i].ptr = &inputs.b[i];
   }
@@ -173,83 +207,124 @@ static void inputs_attempt_open()
   }
 }
 
+// Returns true if at least `min_hits` kmers of the read are in the graph.
+// Stops as soon as the answer is known: enough hits, or too few kmers left.
 static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
-                               SeqLoadingStats *stats)
+                               size_t req_hits, FilterReadsWorker *wrkr)
 {
-  bool found = false;
-  BinaryKmer bkmer; Nucleotide nuc; dBNode node;
+  BinaryKmer bkmer; Nucleotide nuc;
   const size_t kmer_size = db_graph->kmer_size;
-  size_t i, num_contigs = 0, num_kmers_loaded = 0;
+  size_t i, j, n, num_contigs = 0, num_kmers_loaded = 0, nhits = 0;
   size_t search_pos = 0, start, end = 0, contig_len;
+  size_t window = READS_MIN_WINDOW;
+  SeqLoadingStats *stats = &wrkr->stats;
 
   if(r->seq.end >= kmer_size)
   {
-    while((start = seq_contig_start(r, search_pos, kmer_size, 0,0)) < r->seq.end &&
-          !found)
+    while(nhits < req_hits &&
+          nhits + (r->seq.end - search_pos) >= req_hits + kmer_size - 1 &&
+          (start = seq_contig_start(r, search_pos, kmer_size, 0,0)) < r->seq.end)
     {
       end = seq_contig_end(r, start, kmer_size, 0, 0, &search_pos);
       contig_len = end - start;
-      __sync_fetch_and_add((volatile size_t*)&stats->total_bases_loaded, contig_len);
-
+      stats->total_bases_loaded += contig_len;
       num_contigs++;
 
       bkmer = binary_kmer_from_str(r->seq.b + start, kmer_size);
-      num_kmers_loaded++;
-      node = db_graph_find(db_graph, bkmer);
-      if(node.key != HASH_NOT_FOUND) { found = true; break; }
+      bkmer = binary_kmer_right_shift_one_base(bkmer);
 
-      for(i = start+kmer_size; i < end; i++)
+      for(i = start+kmer_size-1; i < end && nhits < req_hits; )
       {
-        nuc = dna_char_to_nuc(r->seq.b[i]);
-        bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-        num_kmers_loaded++;
-        node = db_graph_find(db_graph, bkmer);
-        if(node.key != HASH_NOT_FOUND) { found = true; break; }
+        // Can we still reach req_hits? (one kmer per remaining base here, and
+        // at most that in the rest of the read)
+        if(nhits + (r->seq.end - i) < req_hits) break;
+
+        for(n = 0; n < window && i < end; n++, i++) {
+          nuc = dna_char_to_nuc(r->seq.b[i]);
+          bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
+          wrkr->bkeys[n] = binary_kmer_get_key(bkmer, kmer_size);
+        }
+
+        hash_table_find_batch(&db_graph->ht, wrkr->bkeys, n,
+                              HT_PREFETCH_DEPTH, wrkr->hkeys);
+
+        for(j = 0; j < n && nhits < req_hits; j++)
+          nhits += (wrkr->hkeys[j] != HASH_NOT_FOUND);
+
+        num_kmers_loaded += j;
+        window = MIN2(window*2, READS_MAX_WINDOW);
       }
     }
   }
 
   // Update stats
-  __sync_fetch_and_add((volatile size_t*)&stats->total_bases_read, r->seq.end);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_loaded, num_kmers_loaded);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_novel, num_kmers_loaded - found);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_good_reads, num_contigs > 0);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_bad_reads, num_contigs == 0);
+  stats->total_bases_read += r->seq.end;
+  stats->num_kmers_loaded += num_kmers_loaded;
+  stats->num_kmers_novel += num_kmers_loaded - nhits;
+  stats->num_good_reads += (num_contigs > 0);
+  stats->num_bad_reads += (num_contigs == 0);
 
-  return found;
+  return nhits >= req_hits;
 }
 
-void filter_reads(AsyncIOData *data, size_t threadid, void *arg)
+// All reads in a batch are from the same input, print the batch in one write
+static void filter_reads_batch(AsyncIOBatch *batch, size_t threadid, void *arg)
 {
-  (void)arg; (void)threadid;
-  read_t *r1 = (read_t*)&data->r1, *r2 = data->r2.seq.end ? (read_t*)&data->r2 : NULL;
-  AlignReadsData *input = (AlignReadsData*)data->ptr;
-  const dBGraph *db_graph = input->db_graph;
-  SeqLoadingStats *stats = input->stats;
+  (void)threadid;
+  FilterReadsWorker *wrkr = (FilterReadsWorker*)arg;
+  if(batch->len == 0) return;
 
-  ctx_assert2(r2 == NULL || input->seqout.is_pe,
-              "Were not expecting r2: %p %i", r2, (int)input->seqout.is_pe);
+  AlignReadsData *input = (AlignReadsData*)batch->data[0].ptr;
+  const dBGraph *db_graph = input->db_graph;
+  const seq_format fmt = input->fmt;
+  size_t i, nprinted = 0;
+  read_t *r1, *r2;
+  bool touches_graph;
 
-  bool touches_graph = read_touches_graph(r1, db_graph, stats) ||
-                       (r2 != NULL && read_touches_graph(r2, db_graph, stats));
+  strbuf_reset(&wrkr->out_se);
+  strbuf_reset(&wrkr->out_pe[0]);
+  strbuf_reset(&wrkr->out_pe[1]);
 
-  if(touches_graph != input->invert)
+  for(i = 0; i < batch->len; i++)
   {
-    seqout_print(&input->seqout, r1, r2);
-    input->num_of_reads_printed += 1 + (r2 != NULL);
+    AsyncIOData *data = &batch->data[i];
+    ctx_assert(data->ptr == input);
+    r1 = &data->r1;
+    r2 = data->r2.seq.end ? &data->r2 : NULL;
+
+    ctx_assert2(r2 == NULL || input->seqout.is_pe,
+                "Were not expecting r2: %p %i", r2, (int)input->seqout.is_pe);
+
+    touches_graph = read_touches_graph(r1, db_graph, input->min_hits, wrkr) ||
+                    (r2 != NULL &&
+                     read_touches_graph(r2, db_graph, input->min_hits, wrkr));
+
+    if(touches_graph != input->invert)
+    {
+      if(r2 == NULL) seqout_sbuf_read(r1, fmt, &wrkr->out_se);
+      else {
+        seqout_sbuf_read(r1, fmt, &wrkr->out_pe[0]);
+        seqout_sbuf_read(r2, fmt, &wrkr->out_pe[1]);
+      }
+      nprinted += 1 + (r2 != NULL);
+    }
+
+    if(r2 == NULL) wrkr->stats.num_se_reads++;
+    else           wrkr->stats.num_pe_reads += 2;
   }
 
-  if(r2 == NULL) __sync_add_and_fetch((volatile size_t*)&stats->num_se_reads, 1);
-  else           __sync_add_and_fetch((volatile size_t*)&stats->num_pe_reads, 2);
+  seqout_print_bufs(&input->seqout, &wrkr->out_se,
+                    &wrkr->out_pe[0], &wrkr->out_pe[1]);
 
-  size_t n = __sync_add_and_fetch(&read_counter, 1);
-  ctx_update("FilterReads", n);
+  __sync_fetch_and_add(&input->num_of_reads_printed, nprinted);
+
+  size_t n = __sync_fetch_and_add(&read_counter, batch->len);
+  ctx_update2("FilterReads", n, n+batch->len, CTX_UPDATE_REPORT_RATE);
 }
 
-int ctx_reads(int argc, char **argv)
+// Load graph files, flattened into one colour
+static void load_graph_files(dBGraph *db_graph)
 {
-  parse_args(argc, argv);
-
   //
   // Open input graphs
   //
@@ -280,11 +355,11 @@ int ctx_reads(int argc, char **argv)
   //
   // Set up graph
   //
-  dBGraph db_graph;
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, 1, 0, kmers_in_hash, 0);
+  db_graph_alloc(db_graph, gfiles[0].hdr.kmer_size, 1, 0, kmers_in_hash, 0);
 
   // Load graphs
-  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -294,6 +369,24 @@ int ctx_reads(int argc, char **argv)
     gprefs.empty_colours = false;
   }
   ctx_free(gfiles);
+}
+
+int ctx_reads(int argc, char **argv)
+{
+  parse_args(argc, argv);
+
+  size_t i;
+  dBGraph db_graph;
+
+  if(graph_shm != NULL) {
+    inputs_attempt_open();
+    graph_shm_attach(graph_shm, &db_graph, 0);
+  }
+  else {
+    load_graph_files(&db_graph);
+  }
+
+  if(kmer_filter) hash_table_filter_build(&db_graph.ht);
 
   status("Printing reads that do %stouch the graph\n",
          inputs.b[0].invert ? "not " : "");
@@ -304,9 +397,14 @@ int ctx_reads(int argc, char **argv)
   SeqLoadingStats seq_stats;
   memset(&seq_stats, 0, sizeof(seq_stats));
 
-  for(i = 0; i < inputs.len; i++) {
-    inputs.b[i].stats = &seq_stats;
+  for(i = 0; i < inputs.len; i++)
     inputs.b[i].db_graph = &db_graph;
+
+  FilterReadsWorker *workers = ctx_calloc(nthreads, sizeof(FilterReadsWorker));
+  for(i = 0; i < nthreads; i++) {
+    strbuf_alloc(&workers[i].out_se, 1<<16);
+    strbuf_alloc(&workers[i].out_pe[0], 1<<16);
+    strbuf_alloc(&workers[i].out_pe[1], 1<<16);
   }
 
   // Deal with a set of files at once
@@ -315,8 +413,17 @@ int ctx_reads(int argc, char **argv)
   {
     // Can have different numbers of inputs vs threads
     end = MIN2(inputs.len, start+MAX_IO_THREADS);
-    asyncio_run_pool(files.b+start, end-start, filter_reads, NULL, nthreads, 0);
+    asyncio_run_batch_pool(files.b+start, end-start, filter_reads_batch,
+                           workers, nthreads, sizeof(FilterReadsWorker));
+  }
+
+  for(i = 0; i < nthreads; i++) {
+    seq_loading_stats_merge(&seq_stats, &workers[i].stats);
+    strbuf_dealloc(&workers[i].out_se);
+    strbuf_dealloc(&workers[i].out_pe[0]);
+    strbuf_dealloc(&workers[i].out_pe[1]);
   }
+  ctx_free(workers);
 
   size_t total_reads_printed = 0;
   size_t total_reads = seq_stats.num_se_reads + seq_stats.num_pe_reads;
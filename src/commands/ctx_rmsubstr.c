@@ -46,26 +46,60 @@ static struct option longopts[] =
 #  define DEFAULT_KMER MIN_KMER_SIZE
 #endif
 
+// Start of the last kmer of only ACGT bases in a read
+// Call only if the read has at least one such kmer
+static size_t _last_kmer_start(const read_t *r, size_t kmer_size)
+{
+  size_t end = r->seq.end, run = 0;
+  while(run < kmer_size) {
+    ctx_assert(end > 0);
+    end--;
+    run = char_is_acgt(r->seq.b[end]) ? run+1 : 0;
+  }
+  return end;
+}
+
+// Returns true if the list at `a` is no longer than the list at `b`
+// Only walks as far as the end of the shorter list
+static bool _koccur_list_shorter(const KOccur *a, const KOccur *b)
+{
+  while(a->next && b->next) { a++; b++; }
+  return !a->next;
+}
+
 // Returns 1 if a read is a substring of ANY read in the list or a complete
 // match with a read before it in the list. Returns <= 0 otherwise.
 //  1 => is substr
 //  0 => not substr
 // -1 => not enough bases of ACGT
+// Only reads that share the rarer of the first and last kmers are compared.
 static int _is_substr(const ReadBuffer *rbuf, size_t idx,
                       const KOGraph *kograph, const dBGraph *db_graph)
 {
   const size_t kmer_size = db_graph->kmer_size;
   const read_t *r = &rbuf->b[idx], *r2;
-  size_t contig_start;
+  size_t kpos, last_kpos;
 
-  contig_start = seq_contig_start(r, 0, kmer_size, 0, 0);
-  if(contig_start >= r->seq.end) return -1; // No kmers in this sequence
+  kpos = seq_contig_start(r, 0, kmer_size, 0, 0);
+  if(kpos >= r->seq.end) return -1; // No kmers in this sequence
 
-  dBNode node = db_graph_find_str(db_graph, r->seq.b+contig_start);
+  dBNode node = db_graph_find_str(db_graph, r->seq.b+kpos);
   ctx_assert(node.key != HASH_NOT_FOUND);
 
   // expect at least one hit (for this read!)
   ctx_assert(kograph_occurs(kograph, node.key));
+
+  last_kpos = _last_kmer_start(r, kmer_size);
+  if(last_kpos != kpos) {
+    dBNode last = db_graph_find_str(db_graph, r->seq.b+last_kpos);
+    ctx_assert(last.key != HASH_NOT_FOUND);
+    if(!_koccur_list_shorter(kograph_get(kograph, node.key),
+                             kograph_get(kograph, last.key))) {
+      node = last;
+      kpos = last_kpos;
+    }
+  }
+
   KOccur *hit;
 
   for(hit = kograph_get(kograph, node.key); 1; hit++)
@@ -81,9 +115,9 @@ static int _is_substr(const ReadBuffer *rbuf, size_t idx,
       if(r->seq.end < r2->seq.end || (r->seq.end == r2->seq.end && idx > hit->chrom)) {
         if(hit->orient == node.orient) {
           // potential FORWARD match
-          if(hit->offset >= contig_start &&
-             hit->offset + r->seq.end <= r2->seq.end &&
-             strncasecmp(r->seq.b, r2->seq.b+hit->offset-contig_start, r->seq.end) == 0)
+          if(hit->offset >= kpos &&
+             hit->offset - kpos + r->seq.end <= r2->seq.end &&
+             strncasecmp(r->seq.b, r2->seq.b+hit->offset-kpos, r->seq.end) == 0)
           {
             return 1;
           }
@@ -91,11 +125,11 @@ static int _is_substr(const ReadBuffer *rbuf, size_t idx,
         else {
           // potential REVERSE match
           // if read is '<NNNN>[kmer]<rem>' rX_rem is the number of chars after
-          // the first valid kmer
-          size_t r1_rem = r->seq.end - (contig_start + kmer_size);
+          // the kmer we looked up
+          size_t r1_rem = r->seq.end - (kpos + kmer_size);
           size_t r2_rem = r2->seq.end - (hit->offset + kmer_size);
 
-          if(r1_rem <= hit->offset && r2_rem >= contig_start &&
+          if(r1_rem <= hit->offset && r2_rem >= kpos &&
              dna_revncasecmp(r->seq.b, r2->seq.b+hit->offset-r1_rem, r->seq.end) == 0)
           {
             return 1;
@@ -110,6 +144,24 @@ static int _is_substr(const ReadBuffer *rbuf, size_t idx,
   return 0;
 }
 
+typedef struct {
+  const ReadBuffer *rbuf;
+  const KOGraph *kograph;
+  const dBGraph *db_graph;
+  int8_t *results; // one per read, return value of _is_substr()
+} RmSubstrJob;
+
+static bool _reads_is_substr(size_t start, size_t end, size_t threadid,
+                             void *arg)
+{
+  (void)threadid;
+  const RmSubstrJob *job = (const RmSubstrJob*)arg;
+  size_t i;
+  for(i = start; i < end; i++)
+    job->results[i] = _is_substr(job->rbuf, i, job->kograph, job->db_graph);
+  return false;
+}
+
 int ctx_rmsubstr(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
@@ -238,10 +290,19 @@ int ctx_rmsubstr(int argc, char **argv)
 
   size_t num_reads = rbuf.len, num_reads_printed = 0, num_bad_reads = 0;
 
+  // Check reads in parallel then print in input order
+  status("[rmsubstr] Checking %zu reads with %zu thread%s",
+         num_reads, nthreads, util_plural_str(nthreads));
+
+  int8_t *results = ctx_malloc(MAX2(num_reads, 1));
+  RmSubstrJob job = {.rbuf = &rbuf, .kograph = &kograph,
+                     .db_graph = &db_graph, .results = results};
+  util_run_ranges(num_reads, 256, nthreads, _reads_is_substr, &job);
+
   // Loop over reads printing those that are not substrings
   int ret;
   for(i = 0; i < rbuf.len; i++) {
-    ret = _is_substr(&rbuf, i, &kograph, &db_graph);
+    ret = results[i];
     if(ret == -1) num_bad_reads++;
     else if((ret && invert) || (!ret && !invert)) {
       seqout_print_read(&rbuf.b[i], fmt, fout);
@@ -267,6 +328,7 @@ int ctx_rmsubstr(int argc, char **argv)
   }
 
   fclose(fout);
+  ctx_free(results);
   kograph_dealloc(&kograph);
 
   // Free sequence memory
@@ -8,25 +8,84 @@
 #include "gpath_checks.h"
 #include "graph_search.h"
 #include "json_hdr.h"
+#include "graph_shm.h"
+#include "assemble_contigs.h"
+#include "build_graph.h"
+
+#include "madcrowlib/madcrow_buffer.h"
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SERVER_CONTIG_NODES 100000 /* default max kmers in a contig */
+#define SERVER_CONTIG_MS 1000 /* default max milliseconds per contig */
 
 const char server_usage[] =
 "usage: "CMD" server [options] <in.ctx> [in2.ctx ...]\n"
+"       "CMD" server [options] --graph-shm <name>\n"
 "\n"
 "  Interactively query the graph. Responds to STDOUT with JSON.\n"
 "  Commands are:\n"
 "  * 'info'     - print graph header\n"
 "  * 'random'   - print a random kmer\n"
 "  * 'ACACCAA'  - print information for the given kmer\n"
+"  * 'batch ACACCAA CCAAGGT ...' - print information for each kmer\n"
+"  * 'seq ACACCAAGGT' - print information for every kmer of the sequence\n"
+"  * 'contig ACACCAAGGT [nodes=N] [ms=T] [colour=C]'\n"
+"                 - assemble a contig from the first kmer of the sequence found\n"
+"                   in colour C [default: 0], stopping after N kmers or T\n"
+"                   milliseconds (at most --contig-nodes and --contig-ms)\n"
+"  * 'add ACACCAAGGT [colour=C]'\n"
+"                 - add the kmers and edges of the sequence to colour C\n"
+"                   [default: 0], needs --updates\n"
+"\n"
+"  A batch replies with a JSON array, in the order of the kmers. Batches are\n"
+"  answered with all threads.\n"
+"\n"
+"  With --port or --socket the graph is loaded once and served to many clients\n"
+"  at a time, each with the same commands as STDIN. 'quit' closes a connection.\n"
+"  The server runs until killed.\n"
 "\n"
 "  -h, --help            This help message\n"
 "  -q, --quiet           Silence status output normally printed to STDERR\n"
 "  -m, --memory <mem>    Memory to use\n"
 "  -n, --nkmers <kmers>  Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>     Number of threads to load and query with [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -p, --paths <in.ctp>  Load link file (can specify multiple times)\n"
 "  -S, --single-line     Reponses on a single line\n"
+"  -T, --tsv             Respond with one tab separated line per kmer:\n"
+"                        key, colours, left, right, edges, number of links.\n"
+"                        Kmers not in the graph are 'key<tab>.'. No prompt is\n"
+"                        printed and each reply ends with an empty line, so\n"
+"                        requests can be sent without waiting for replies.\n"
 "  -C, --coverages       Load coverages for kmers+links\n"
 "  -E, --edges           Load per sample edges\n"
 "  -D, --disk            Read from disk (one graph only, must be sorted)\n"
+"  -w, --sparse          Store colours sparsely (many colours, few per kmer)\n"
+"  -U, --shared-edges    Store per sample edges as their union plus differences\n"
+"  -G, --graph-shm <name>\n"
+"                        Use a graph in shared memory instead of files (see load).\n"
+"                        Cannot be used with --disk, --sparse or --shared-edges\n"
+"  -B, --kmer-filter     Check kmers against a Bloom filter of the graph first.\n"
+"                        Faster when most kmers queried are not in the graph.\n"
+"                        Uses 16-32 more bits of memory per kmer.\n"
+"  -L, --contig-nodes <N> Max kmers in a contig [default: "QUOTE_VALUE(SERVER_CONTIG_NODES)"]\n"
+"  -W, --contig-ms <T>   Max milliseconds to assemble a contig [default: "QUOTE_VALUE(SERVER_CONTIG_MS)"]\n"
+"  -M, --no-missing-check Do not use the missing information check in contigs\n"
+"  -a, --updates         Accept 'add' requests. Queries are answered while kmers\n"
+"                        are added; the hash table doubles in size when full so\n"
+"                        memory use can grow past --memory. Graph must be in\n"
+"                        memory (not --disk, --sparse, --shared-edges,\n"
+"                        --graph-shm or --kmer-filter)\n"
+"\n"
+"  -P, --port <port>     Listen for clients on a TCP port instead of STDIN\n"
+"  -A, --address <ip>    IPv4 address to listen on [default: 127.0.0.1]\n"
+"  -u, --socket <path>   Listen for clients on a Unix socket instead of STDIN\n"
+"  -c, --clients <N>     Clients to serve at once [default: threads]\n"
 "\n";
 
 static struct option longopts[] =
@@ -35,15 +94,30 @@ static struct option longopts[] =
   {"help",         no_argument,       NULL, 'h'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
   {"paths",        required_argument, NULL, 'p'},
   {"single-line",  no_argument,       NULL, 'S'},
+  {"tsv",          no_argument,       NULL, 'T'},
   {"coverages",    no_argument,       NULL, 'C'},
   {"edges",        no_argument,       NULL, 'E'},
   {"disk",         no_argument,       NULL, 'D'},
+  {"sparse",       no_argument,       NULL, 'w'},
+  {"shared-edges", no_argument,       NULL, 'U'},
+  {"graph-shm",    required_argument, NULL, 'G'},
+  {"kmer-filter",  no_argument,       NULL, 'B'},
+  {"contig-nodes", required_argument, NULL, 'L'},
+  {"contig-ms",    required_argument, NULL, 'W'},
+  {"no-missing-check", no_argument,   NULL, 'M'},
+  {"updates",      no_argument,       NULL, 'a'},
+  {"port",         required_argument, NULL, 'P'},
+  {"address",      required_argument, NULL, 'A'},
+  {"socket",       required_argument, NULL, 'u'},
+  {"clients",      required_argument, NULL, 'c'},
   {NULL, 0, NULL, 0}
 };
 
 #define MAX_RANDOM_TRIES 100
+#define SERVER_BATCH_CHUNK 256 /* kmers per batch job */
 
 typedef struct {
   dBNode node;
@@ -69,6 +143,60 @@ static void query_dealloc(ServerQuery *q) {
   ctx_free(q->edges);
 }
 
+// Get bases to the left and right of the union of edges
+static inline void query_left_right(ServerQuery q, char left[5], char right[5])
+{
+  size_t i;
+  Edges uedges = 0; // get union of edges
+  for(i = 0; i < q.nedges; i++) uedges |= q.edges[i];
+  char edgesstr[9], *l = left, *r = right;
+  *l = *r = '\0';
+  db_node_get_edges_str(uedges, edgesstr);
+  for(i = 0; i < 4; i++)
+    if(edgesstr[i] != '.') { *l = toupper(edgesstr[i]); *(++l) = '\0'; }
+  for(i = 4; i < 8; i++)
+    if(edgesstr[i] != '.') { *r = edgesstr[i]; *(++r) = '\0'; }
+}
+
+// Links of a kmer, the kmer may not be in the hash table when using --disk
+static inline const GPath* query_links(ServerQuery q, const dBGraph *db_graph)
+{
+  if(q.node.key == HASH_NOT_FOUND) return NULL;
+  return gpath_store_safe_fetch(&db_graph->gpstore, q.node.key);
+}
+
+// key colours left right edges nlinks
+// ACACAAA 1,0,1   AC   .     c0    2
+static inline void kmer_response_tsv(StrBuf *resp, ServerQuery q,
+                                     const dBGraph *db_graph)
+{
+  size_t i, nlinks = 0;
+  char keystr[MAX_KMER_SIZE+1], left[5], right[5], sedges[3];
+  binary_kmer_to_str(q.bkey, db_graph->kmer_size, keystr);
+  query_left_right(q, left, right);
+
+  strbuf_append_str(resp, keystr);
+  strbuf_append_char(resp, '\t');
+  strbuf_append_ulong(resp, q.covgs[0]);
+  for(i = 1; i < q.ncols; i++) {
+    strbuf_append_char(resp, ',');
+    strbuf_append_ulong(resp, q.covgs[i]);
+  }
+  strbuf_append_char(resp, '\t');
+  strbuf_append_str(resp, left[0] ? left : ".");
+  strbuf_append_char(resp, '\t');
+  strbuf_append_str(resp, right[0] ? right : ".");
+  strbuf_append_char(resp, '\t');
+  for(i = 0; i < q.nedges; i++)
+    strbuf_append_str(resp, edges_to_char(q.edges[i], sedges));
+  strbuf_append_char(resp, '\t');
+
+  const GPath *gpath = query_links(q, db_graph);
+  for(; gpath != NULL; gpath = gpath_next(gpath)) nlinks++;
+  strbuf_append_ulong(resp, nlinks);
+  strbuf_append_char(resp, '\n');
+}
+
 static inline void kmer_response(StrBuf *resp, ServerQuery q, bool pretty,
                                  const dBGraph *db_graph)
 {
@@ -90,14 +218,8 @@ static inline void kmer_response(StrBuf *resp, ServerQuery q, bool pretty,
   strbuf_append_str(resp, pretty ? "\n  " : " ");
 
   // Edges
-  Edges uedges = 0; // get union of edges
-  for(i = 0; i < q.nedges; i++) uedges |= q.edges[i];
-  char edgesstr[9], left[5] = {0}, right[5] = {0}, *l = left, *r = right;
-  db_node_get_edges_str(uedges, edgesstr);
-  for(i = 0; i < 4; i++)
-    if(edgesstr[i] != '.') { *l = toupper(edgesstr[i]); *(++l) = '\0'; }
-  for(i = 4; i < 8; i++)
-    if(edgesstr[i] != '.') { *r = edgesstr[i]; *(++r) = '\0'; }
+  char left[5], right[5];
+  query_left_right(q, left, right);
 
   strbuf_append_str(resp, "\"left\": \"");
   strbuf_append_str(resp, left);
@@ -119,9 +241,9 @@ static inline void kmer_response(StrBuf *resp, ServerQuery q, bool pretty,
   // Links
   // {"forward": true, "juncs": "ACAA", "colours": [0,0,1]}
   size_t nlinks;
-  const GPath *gpath = gpath_store_safe_fetch(&db_graph->gpstore, q.node.key);
+  const GPath *gpath = query_links(q, db_graph);
   const GPathSet *gpset = &db_graph->gpstore.gpset;
-  for(nlinks = 0; gpath != NULL; gpath = gpath->next, nlinks++)
+  for(nlinks = 0; gpath != NULL; gpath = gpath_next(gpath), nlinks++)
   {
     if(nlinks) strbuf_append_str(resp, pretty ? ",\n            " : ", ");
     strbuf_append_str(resp, "{\"forward\": ");
@@ -130,7 +252,8 @@ static inline void kmer_response(StrBuf *resp, ServerQuery q, bool pretty,
 
     // Print link sequence
     for(i = 0; i < gpath->num_juncs; i++)
-      strbuf_append_char(resp, dna_nuc_to_char(binary_seq_get(gpath->seq, i)));
+      strbuf_append_char(resp,
+                         dna_nuc_to_char(binary_seq_get(gpath_seq(gpath), i)));
 
     // Print link colours
     // counts may be null if user did not specify -C,--coverages
@@ -152,8 +275,8 @@ static inline void query_fetch_from_graph(ServerQuery *q, const dBGraph *db_grap
 {
   size_t i;
   for(i = 0; i < q->ncols; i++)
-    q->covgs[i] = db_graph->col_covgs ? db_node_get_covg(db_graph, q->node.key, i)
-                                      : db_node_has_col(db_graph, q->node.key, i);
+    q->covgs[i] = q->binary_covgs ? db_node_has_col(db_graph, q->node.key, i)
+                                  : db_node_get_covg(db_graph, q->node.key, i);
   for(i = 0; i < q->nedges; i++)
     q->edges[i] = db_node_get_edges(db_graph, q->node.key, i);
 }
@@ -185,67 +308,143 @@ static inline void query_fetch_from_disk(ServerQuery *q)
 // Query: "ACCCCAC" (Not in graph)
 {}
 */
-/**
- * @param qstr    query string - must be "random" or kmer
- * @param resp    string buffer reset, then used to store response
- * @param pretty  pretty print JSON or one line JSON
- * @returns       true iff query was valid kmer
- */
-static inline bool query_response(const char *qstr, ServerQuery q,
-                                  StrBuf *resp, bool pretty,
-                                  GraphFileSearch *disk, const dBGraph *db_graph)
+static inline void query_not_found(StrBuf *resp, ServerQuery q, bool tsv,
+                                   const dBGraph *db_graph)
 {
-  size_t qlen;
-  strbuf_reset(resp);
+  if(tsv) {
+    char keystr[MAX_KMER_SIZE+1];
+    binary_kmer_to_str(q.bkey, db_graph->kmer_size, keystr);
+    strbuf_append_str(resp, keystr);
+    strbuf_append_str(resp, "\t.\n");
+  }
+  else strbuf_append_str(resp, "{}\n");
+}
 
-  // query must be a kmer
-  for(qlen = 0; qstr[qlen]; qlen++) {
-    if(!char_is_acgt(qstr[qlen])) {
-      strbuf_set(resp, "{\"error\": \"Invalid base\"}\n");
-      return false;
-    }
+static inline void query_error(StrBuf *resp, const char *qstr, size_t qlen,
+                               const char *msg, bool tsv)
+{
+  if(tsv) {
+    strbuf_append_strn(resp, qstr, qlen);
+    strbuf_append_str(resp, "\terror\t");
+    strbuf_append_str(resp, msg);
+    strbuf_append_str(resp, "\n");
+  } else {
+    strbuf_append_str(resp, "{\"error\": \"");
+    strbuf_append_str(resp, msg);
+    strbuf_append_str(resp, "\"}\n");
   }
+}
+
+typedef enum {QUERY_OK, QUERY_EMPTY, QUERY_BAD_BASE, QUERY_BAD_KMER_SIZE}
+  QueryStatus;
+
+// Parse a query kmer into q->bkey and q->node.orient
+static inline QueryStatus query_parse(const char *qstr, size_t qlen,
+                                      ServerQuery *q, const dBGraph *db_graph)
+{
+  size_t i;
+
+  // query must be a kmer
+  for(i = 0; i < qlen; i++)
+    if(!char_is_acgt(qstr[i])) return QUERY_BAD_BASE;
 
   // Don't do anything if empty line
-  if(qlen == 0) { return false; }
+  if(qlen == 0) return QUERY_EMPTY;
+  if(qlen != db_graph->kmer_size) return QUERY_BAD_KMER_SIZE;
 
-  if(qlen != db_graph->kmer_size) {
-    strbuf_set(resp, "{\"error\": \"Doesn't match kmer size: ");
-    strbuf_append_ulong(resp, db_graph->kmer_size);
-    strbuf_append_str(resp, "\"}\n");
-    return false;
+  BinaryKmer bkmer = binary_kmer_from_str(qstr, db_graph->kmer_size);
+  q->bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
+  q->node.orient = (binary_kmer_eq(bkmer, q->bkey) ? FORWARD : REVERSE);
+  return QUERY_OK;
+}
+
+static inline void query_parse_error(StrBuf *resp, const char *qstr,
+                                     size_t qlen, QueryStatus qs, bool tsv,
+                                     const dBGraph *db_graph)
+{
+  char msg[100];
+  switch(qs) {
+    case QUERY_BAD_BASE: query_error(resp, qstr, qlen, "Invalid base", tsv); break;
+    case QUERY_BAD_KMER_SIZE:
+      snprintf(msg, sizeof(msg), "Doesn't match kmer size: %zu",
+               db_graph->kmer_size);
+      query_error(resp, qstr, qlen, msg, tsv);
+      break;
+    default: break;
   }
+}
 
-  BinaryKmer bkmer = binary_kmer_from_str(qstr, db_graph->kmer_size);
-  q.bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
-  q.node.orient = (binary_kmer_eq(bkmer, q.bkey) ? FORWARD : REVERSE);
+// Respond to a parsed query, `hkey` is the result of looking up q.bkey in the
+// hash table (with --disk only kmers with links are in it)
+static inline void query_answer(ServerQuery q, hkey_t hkey, StrBuf *resp,
+                                bool pretty, bool tsv,
+                                GraphFileSearch *disk, const dBGraph *db_graph)
+{
+  q.node.key = hkey;
 
   if(disk == NULL) {
     // Fetch from graph
-    q.node.key = hash_table_find(&db_graph->ht, q.bkey);
-    if(q.node.key == HASH_NOT_FOUND) { strbuf_set(resp, "{}\n"); return true; }
+    if(q.node.key == HASH_NOT_FOUND) {
+      query_not_found(resp, q, tsv, db_graph);
+      return;
+    }
     query_fetch_from_graph(&q, db_graph);
   }
   else {
     if(!graph_search_find(disk, q.bkey, q.covgs, q.edges)) {
-      strbuf_set(resp, "{}\n");
-      return true;
+      query_not_found(resp, q, tsv, db_graph);
+      return;
     }
     query_fetch_from_disk(&q);
   }
 
-  kmer_response(resp, q, pretty, db_graph);
+  if(tsv) kmer_response_tsv(resp, q, db_graph);
+  else kmer_response(resp, q, pretty, db_graph);
+}
+
+// With --updates kmers are added while we search (see request_add()), lookups
+// may miss a kmer that is being added at the same time
+static inline hkey_t server_find(const dBGraph *db_graph, BinaryKmer bkey)
+{
+  return db_graph->ht_lockfree ? hash_table_find_lockfree(&db_graph->ht, bkey)
+                               : hash_table_find(&db_graph->ht, bkey);
+}
+
+/**
+ * @param qstr    query string - the kmer, need not be NUL terminated
+ * @param qlen    length of qstr
+ * @param resp    string buffer the response is appended to
+ * @param pretty  pretty print JSON or one line JSON
+ * @param tsv     respond with a tab separated line instead of JSON
+ * @returns       true iff query was valid kmer
+ */
+static inline bool query_response(const char *qstr, size_t qlen, ServerQuery q,
+                                  StrBuf *resp, bool pretty, bool tsv,
+                                  GraphFileSearch *disk, const dBGraph *db_graph)
+{
+  QueryStatus qs = query_parse(qstr, qlen, &q, db_graph);
+  if(qs != QUERY_OK) {
+    query_parse_error(resp, qstr, qlen, qs, tsv, db_graph);
+    return false;
+  }
+
+  hkey_t hkey = server_find(db_graph, q.bkey);
+  query_answer(q, hkey, resp, pretty, tsv, disk, db_graph);
   return true;
 }
 
 // Reply with a random kmer
-static inline void request_random(ServerQuery q, StrBuf *resp, bool pretty,
+static inline void request_random(ServerQuery q, StrBuf *resp,
+                                  bool pretty, bool tsv,
                                   GraphFileSearch *disk, const dBGraph *db_graph)
 {
   strbuf_reset(resp);
   if(disk == NULL) {
     q.node.key = db_graph_rand_node(db_graph, MAX_RANDOM_TRIES);
-    if(q.node.key == HASH_NOT_FOUND) { strbuf_set(resp, "{}\n"); return; }
+    if(q.node.key == HASH_NOT_FOUND) {
+      strbuf_set(resp, tsv ? "error\tNo kmers found\n" : "{}\n");
+      return;
+    }
     q.node.orient = FORWARD;
     q.bkey = db_node_get_bkey(db_graph, q.node.key);
     query_fetch_from_graph(&q, db_graph);
@@ -253,8 +452,613 @@ static inline void request_random(ServerQuery q, StrBuf *resp, bool pretty,
   else {
     graph_search_rand(disk, &q.bkey, q.covgs, q.edges);
     query_fetch_from_disk(&q);
+    q.node.key = hash_table_find(&db_graph->ht, q.bkey);
+  }
+  if(tsv) kmer_response_tsv(resp, q, db_graph);
+  else kmer_response(resp, q, pretty, db_graph);
+}
+
+//
+// Batches of kmers
+//
+
+typedef struct {
+  const char *str; // not NUL terminated
+  size_t len;
+} ServerKmer;
+
+madcrow_buffer(server_kmer_buf, ServerKmerBuffer, ServerKmer);
+
+// Kmers are answered in chunks of SERVER_BATCH_CHUNK, each chunk's responses
+// go into its own buffer so they can be printed in order. All the kmers of a
+// chunk are parsed first then looked up with one call to
+// hash_table_find_batch(), so bucket fetches overlap (one at a time with
+// --updates, see server_find()).
+typedef struct {
+  BinaryKmer bkeys[SERVER_BATCH_CHUNK];
+  hkey_t hkeys[SERVER_BATCH_CHUNK];
+  uint8_t orients[SERVER_BATCH_CHUNK];
+  QueryStatus status[SERVER_BATCH_CHUNK];
+} ServerBatchKeys;
+
+typedef struct {
+  ServerQuery *queries; // one per thread
+  ServerBatchKeys *keys; // one per thread
+  size_t nthreads;
+  StrBuf *bufs; // one per chunk
+  size_t nbufs;
+  ServerKmerBuffer kmers;
+  bool pretty, tsv;
+  GraphFileSearch *disk;
+  const dBGraph *db_graph;
+  volatile size_t nbad;
+} ServerBatch;
+
+static void batch_alloc(ServerBatch *batch, size_t nthreads,
+                        bool binary_covgs, bool flatten_edges,
+                        bool pretty, bool tsv,
+                        GraphFileSearch *disk, const dBGraph *db_graph)
+{
+  size_t i;
+  memset(batch, 0, sizeof(*batch));
+  batch->queries = ctx_calloc(nthreads, sizeof(ServerQuery));
+  batch->keys = ctx_calloc(nthreads, sizeof(ServerBatchKeys));
+  for(i = 0; i < nthreads; i++)
+    query_alloc(&batch->queries[i], db_graph->num_of_cols,
+                binary_covgs, flatten_edges);
+  batch->nthreads = nthreads;
+  server_kmer_buf_alloc(&batch->kmers, 1024);
+  batch->pretty = pretty;
+  batch->tsv = tsv;
+  batch->disk = disk;
+  batch->db_graph = db_graph;
+}
+
+static void batch_dealloc(ServerBatch *batch)
+{
+  size_t i;
+  for(i = 0; i < batch->nthreads; i++) query_dealloc(&batch->queries[i]);
+  for(i = 0; i < batch->nbufs; i++) strbuf_dealloc(&batch->bufs[i]);
+  ctx_free(batch->queries);
+  ctx_free(batch->keys);
+  ctx_free(batch->bufs);
+  server_kmer_buf_dealloc(&batch->kmers);
+  memset(batch, 0, sizeof(*batch));
+}
+
+// Split a list of kmers on whitespace and commas
+static void batch_add_kmers(ServerBatch *batch, const char *str)
+{
+  ServerKmer k;
+  while(1) {
+    while(*str == ' ' || *str == '\t' || *str == ',') str++;
+    if(!*str) break;
+    for(k.str = str; *str && *str != ' ' && *str != '\t' && *str != ','; str++) {}
+    k.len = str - k.str;
+    server_kmer_buf_add(&batch->kmers, k);
+  }
+}
+
+// Add every kmer of a sequence
+static void batch_add_seq(ServerBatch *batch, const char *seq)
+{
+  while(*seq == ' ' || *seq == '\t') seq++;
+  size_t i, len = strlen(seq), kmer_size = batch->db_graph->kmer_size;
+  if(len < kmer_size) {
+    ServerKmer k = {.str = seq, .len = len};
+    if(len) server_kmer_buf_add(&batch->kmers, k);
+    return;
+  }
+  server_kmer_buf_capacity(&batch->kmers, batch->kmers.len + len-kmer_size+1);
+  for(i = 0; i + kmer_size <= len; i++) {
+    ServerKmer k = {.str = seq+i, .len = kmer_size};
+    server_kmer_buf_add(&batch->kmers, k);
+  }
+}
+
+static bool batch_run_chunks(size_t start, size_t end, size_t threadid,
+                             void *arg)
+{
+  ServerBatch *batch = (ServerBatch*)arg;
+  ServerBatchKeys *keys = &batch->keys[threadid];
+  ServerQuery q = batch->queries[threadid];
+  const dBGraph *db_graph = batch->db_graph;
+  size_t c, i, j, n, nbad = 0;
+  const ServerKmer *k;
+  StrBuf *buf;
+
+  for(c = start; c < end; c++) {
+    buf = &batch->bufs[c];
+    strbuf_reset(buf);
+    k = batch->kmers.b + c*SERVER_BATCH_CHUNK;
+    n = MIN2(SERVER_BATCH_CHUNK, batch->kmers.len - c*SERVER_BATCH_CHUNK);
+
+    // Parse then look up the whole chunk. Bad queries are looked up with an
+    // empty key whose result is ignored.
+    for(i = 0; i < n; i++) {
+      keys->status[i] = query_parse(k[i].str, k[i].len, &q, db_graph);
+      if(keys->status[i] == QUERY_OK) {
+        keys->bkeys[i] = q.bkey;
+        keys->orients[i] = q.node.orient;
+      }
+      else keys->bkeys[i] = zero_bkmer;
+    }
+
+    if(db_graph->ht_lockfree) {
+      for(i = 0; i < n; i++) keys->hkeys[i] = server_find(db_graph, keys->bkeys[i]);
+    } else {
+      hash_table_find_batch(&db_graph->ht, keys->bkeys, n,
+                            HT_PREFETCH_DEPTH, keys->hkeys);
+    }
+
+    for(i = 0, j = c*SERVER_BATCH_CHUNK; i < n; i++, j++) {
+      if(j && !batch->tsv) strbuf_append_char(buf, ',');
+      if(keys->status[i] != QUERY_OK) {
+        query_parse_error(buf, k[i].str, k[i].len, keys->status[i],
+                          batch->tsv, db_graph);
+        nbad++;
+        continue;
+      }
+      q.bkey = keys->bkeys[i];
+      q.node.orient = keys->orients[i];
+      query_answer(q, keys->hkeys[i], buf, batch->pretty, batch->tsv,
+                   batch->disk, db_graph);
+    }
+  }
+
+  if(nbad) __sync_fetch_and_add((size_t*)&batch->nbad, nbad);
+  return false; // keep going
+}
+
+// Answer the kmers in the batch and print the responses in order
+// Returns number of bad queries
+static size_t batch_respond(ServerBatch *batch, FILE *fout)
+{
+  size_t i, nchunks = (batch->kmers.len + SERVER_BATCH_CHUNK-1) / SERVER_BATCH_CHUNK;
+
+  if(nchunks > batch->nbufs) {
+    batch->bufs = ctx_realloc(batch->bufs, nchunks * sizeof(StrBuf));
+    for(i = batch->nbufs; i < nchunks; i++) strbuf_alloc(&batch->bufs[i], 1024);
+    batch->nbufs = nchunks;
+  }
+
+  batch->nbad = 0;
+  util_run_ranges(nchunks, 1, batch->nthreads, batch_run_chunks, batch);
+
+  if(!batch->tsv) fputc('[', fout);
+  for(i = 0; i < nchunks; i++)
+    fwrite(batch->bufs[i].b, 1, batch->bufs[i].end, fout);
+  if(!batch->tsv) fputc(']', fout);
+  fputc('\n', fout);
+
+  return batch->nbad;
+}
+
+//
+// Sessions: read requests from one client until it quits
+//
+
+typedef struct {
+  bool pretty, tsv, binary_covgs, flatten_edges;
+  GraphFileSearch *disk;
+  dBGraph *db_graph; // only changed by 'add' requests
+  const char *info_txt;
+  size_t batch_threads; // threads used to answer each batch
+  // 'contig' requests: need kmers in memory with colours
+  bool contigs, missing_check;
+  size_t contig_nodes, contig_ms; // per request limits
+  bool updates; // accept 'add' requests
+  volatile size_t nqueries, nbad_queries; // totals over all sessions
+} ServerPrefs;
+
+//
+// Contigs: assemble through the first kmer of a seed sequence in the graph
+//
+
+/*
+// Query: "contig CCCAGGGTTTAGAT nodes=1000"
+{
+  "seed": "CCCAGGGTTTA",
+  "colour": 0,
+  "kmers": 18,
+  "left": "StopNoCovg", "right": "StopHitLimit",
+  "contig": "AAGCCCAGGGTTTAGATTTCACCGGA"
+}
+// TSV: seed, colour, kmers, left stop, right stop, contig
+*/
+static void contig_response(StrBuf *resp, BinaryKmer seed, size_t colour,
+                            const dBNodeBuffer *nbuf,
+                            const struct ContigStats *s, bool pretty, bool tsv,
+                            const dBGraph *db_graph)
+{
+  char seedstr[MAX_KMER_SIZE+1];
+  const char *sep = pretty ? ",\n  " : ", ";
+  binary_kmer_to_str(seed, db_graph->kmer_size, seedstr);
+
+  if(tsv) {
+    strbuf_sprintf(resp, "%s\t%zu\t%zu\t%s\t%s\t", seedstr, colour, nbuf->len,
+                   assem2str(s->stop_causes[0]), assem2str(s->stop_causes[1]));
+    db_nodes_sbuf(nbuf->b, nbuf->len, db_graph, resp);
+    strbuf_append_char(resp, '\n');
+    return;
+  }
+
+  strbuf_append_str(resp, pretty ? "{\n  " : "{ ");
+  strbuf_sprintf(resp, "\"seed\": \"%s\"%s\"colour\": %zu%s\"kmers\": %zu%s",
+                 seedstr, sep, colour, sep, nbuf->len, sep);
+  strbuf_sprintf(resp, "\"left\": \"%s\", \"right\": \"%s\"%s\"contig\": \"",
+                 assem2str(s->stop_causes[0]), assem2str(s->stop_causes[1]),
+                 sep);
+  db_nodes_sbuf(nbuf->b, nbuf->len, db_graph, resp);
+  strbuf_append_str(resp, pretty ? "\"\n}\n" : "\" }\n");
+}
+
+/**
+ * Answer 'contig SEQ [nodes=N] [ms=T] [colour=C]'. Limits are capped at the
+ * server's limits so each request has bounded latency.
+ * @param args  request after 'contig', modified whilst parsing
+ * @param ca    this thread's assembler, reused between requests
+ * @return true iff request was valid
+ */
+static bool request_contig(char *args, StrBuf *resp, ContigAssembler *ca,
+                           const ServerPrefs *prefs)
+{
+  const dBGraph *db_graph = prefs->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  size_t i, val, len, max_nodes = prefs->contig_nodes;
+  size_t max_ms = prefs->contig_ms, colour = 0;
+  char *seq, *tok, *saveptr = NULL;
+
+  strbuf_reset(resp);
+
+  if(ca == NULL) {
+    query_error(resp, "contig", 6, "Contigs need the graph in memory with "
+                "colours (not --disk or --coverages)", prefs->tsv);
+    return false;
+  }
+
+  if((seq = strtok_r(args, " \t", &saveptr)) == NULL) {
+    query_error(resp, "contig", 6, "Missing seed sequence", prefs->tsv);
+    return false;
+  }
+
+  while((tok = strtok_r(NULL, " \t", &saveptr)) != NULL)
+  {
+    if(strncasecmp(tok, "nodes=", 6) == 0 && parse_entire_size(tok+6, &val) &&
+       val > 0) {
+      max_nodes = MIN2(max_nodes, val);
+    }
+    else if(strncasecmp(tok, "ms=", 3) == 0 && parse_entire_size(tok+3, &val) &&
+            val > 0) {
+      max_ms = MIN2(max_ms, val);
+    }
+    else if(strncasecmp(tok, "colour=", 7) == 0 &&
+            parse_entire_size(tok+7, &val) && val < db_graph->num_of_cols) {
+      colour = val;
+    }
+    else {
+      query_error(resp, tok, strlen(tok), "Bad contig option", prefs->tsv);
+      return false;
+    }
+  }
+
+  len = strlen(seq);
+  for(i = 0; i < len; i++) {
+    if(!char_is_acgt(seq[i])) {
+      query_error(resp, seq, len, "Invalid base", prefs->tsv);
+      return false;
+    }
+  }
+
+  if(len < kmer_size) {
+    char msg[100];
+    snprintf(msg, sizeof(msg), "Shorter than kmer size: %zu", kmer_size);
+    query_error(resp, seq, len, msg, prefs->tsv);
+    return false;
+  }
+
+  // Seed with the first kmer of the sequence in the colour
+  BinaryKmer bkey;
+  hkey_t hkey = HASH_NOT_FOUND;
+  for(i = 0; i+kmer_size <= len && hkey == HASH_NOT_FOUND; i++) {
+    bkey = binary_kmer_from_str(seq+i, kmer_size);
+    bkey = binary_kmer_get_key(bkey, kmer_size);
+    hkey = server_find(db_graph, bkey);
+    if(hkey != HASH_NOT_FOUND && !db_node_has_col(db_graph, hkey, colour))
+      hkey = HASH_NOT_FOUND;
+  }
+
+  if(hkey == HASH_NOT_FOUND) {
+    if(prefs->tsv) {
+      strbuf_append_strn(resp, seq, len);
+      strbuf_append_str(resp, "\t.\n");
+    }
+    else strbuf_append_str(resp, "{}\n");
+    return true;
+  }
+
+  struct ContigStats s;
+  const dBNodeBuffer *nbuf;
+  nbuf = contig_assembler_run(ca, hkey, colour, max_nodes,
+                              (uint64_t)max_ms * 1000000, &s);
+  ctx_assert(nbuf != NULL);
+  contig_response(resp, bkey, colour, nbuf, &s, prefs->pretty, prefs->tsv,
+                  db_graph);
+  return true;
+}
+
+//
+// Updates: add sequence to a graph that is being queried
+//
+
+/*
+// Query: "add CCCAGGGTTTAGATTT colour=1"
+{ "colour": 1, "kmers": 6, "novel": 2 }
+// TSV: colour, kmers, novel kmers
+*/
+
+/**
+ * Answer 'add SEQ [colour=C]'. Kmers, edges and coverage are added with the
+ * threadsafe graph building functions while other clients keep querying.
+ * Readers hold the graph's grow lock for reading (db_graph_grow_enter()), so
+ * when an insert fills the hash table it is only moved to a larger table once
+ * every request using the old one has finished.
+ * @param args  request after 'add', modified whilst parsing
+ * @return true iff request was valid
+ */
+static bool request_add(char *args, StrBuf *resp, const ServerPrefs *prefs)
+{
+  dBGraph *db_graph = prefs->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  size_t i, val, len, nkmers, nfound, colour = 0;
+  char *seq, *tok, *saveptr = NULL;
+
+  strbuf_reset(resp);
+
+  if(!prefs->updates) {
+    query_error(resp, "add", 3, "Start the server with --updates to add "
+                "sequence", prefs->tsv);
+    return false;
+  }
+
+  if((seq = strtok_r(args, " \t", &saveptr)) == NULL) {
+    query_error(resp, "add", 3, "Missing sequence", prefs->tsv);
+    return false;
+  }
+
+  while((tok = strtok_r(NULL, " \t", &saveptr)) != NULL)
+  {
+    if(strncasecmp(tok, "colour=", 7) == 0 &&
+       parse_entire_size(tok+7, &val) && val < db_graph->num_of_cols) {
+      colour = val;
+    }
+    else {
+      query_error(resp, tok, strlen(tok), "Bad add option", prefs->tsv);
+      return false;
+    }
+  }
+
+  len = strlen(seq);
+  for(i = 0; i < len; i++) {
+    if(!char_is_acgt(seq[i])) {
+      query_error(resp, seq, len, "Invalid base", prefs->tsv);
+      return false;
+    }
+  }
+
+  if(len < kmer_size) {
+    char msg[100];
+    snprintf(msg, sizeof(msg), "Shorter than kmer size: %zu", kmer_size);
+    query_error(resp, seq, len, msg, prefs->tsv);
+    return false;
+  }
+
+  // Takes and releases the grow lock itself
+  nkmers = len+1-kmer_size;
+  nfound = build_graph_from_str_mt(db_graph, colour, seq, len, false);
+
+  if(prefs->tsv) {
+    strbuf_sprintf(resp, "%zu\t%zu\t%zu\n", colour, nkmers, nkmers-nfound);
+  } else {
+    const char *sep = prefs->pretty ? ",\n  " : ", ";
+    strbuf_sprintf(resp, "%s\"colour\": %zu%s\"kmers\": %zu%s\"novel\": %zu%s",
+                   prefs->pretty ? "{\n  " : "{ ", colour, sep, nkmers, sep,
+                   nkmers-nfound, prefs->pretty ? "\n}\n" : " }\n");
+  }
+  return true;
+}
+
+static inline bool is_request(const char *line, const char *cmd, size_t len)
+{
+  return strncasecmp(line, cmd, len) == 0 &&
+         (line[len] == ' ' || line[len] == '\t' || line[len] == '\0');
+}
+
+/**
+ * Answer requests from `fin` until end of input or 'quit'
+ * @param ca      assembler for 'contig' requests, NULL if not supported
+ * @param prompt  print a prompt before reading each request
+ * @param stdio   reading STDIN: die on read errors rather than ending session
+ **/
+static void server_session(ServerPrefs *prefs, ContigAssembler *ca,
+                           FILE *fin, FILE *fout,
+                           const char *name, bool prompt, bool stdio)
+{
+  const bool tsv = prefs->tsv;
+  const dBGraph *db_graph = prefs->db_graph;
+  size_t nqueries = 0, nbad_queries = 0, len;
+  bool success;
+
+  StrBuf line, response;
+  strbuf_alloc(&line, 1024);
+  strbuf_alloc(&response, 1024);
+
+  ServerQuery q;
+  query_alloc(&q, db_graph->num_of_cols, prefs->binary_covgs,
+              prefs->flatten_edges);
+
+  ServerBatch batch;
+  batch_alloc(&batch, prefs->batch_threads, prefs->binary_covgs,
+              prefs->flatten_edges, prefs->pretty, tsv,
+              prefs->disk, db_graph);
+
+  // Read from input
+  while(1)
+  {
+    if(prompt) { fprintf(fout, "> "); fflush(fout); }
+    len = strbuf_reset_readline(&line, fin);
+    if(stdio) futil_fcheck(len, fin, name);
+    else if(ferror(fin)) { warn("Error reading from %s", name); break; }
+    if(len == 0) {
+      if(prompt) fprintf(fout, "\n");
+      break;
+    }
+    strbuf_chomp(&line);
+    if(strcasecmp(line.b,"q") == 0 || strcasecmp(line.b,"quit") == 0) { break; }
+    else if(strcasecmp(line.b,"info") == 0) {
+      fputs(prefs->info_txt, fout);
+      fputc('\n', fout);
+      if(tsv) fputc('\n', fout);
+    }
+    else if(strcasecmp(line.b,"random") == 0) {
+      db_graph_grow_enter(prefs->db_graph);
+      request_random(q, &response, prefs->pretty, tsv, prefs->disk, db_graph);
+      db_graph_grow_leave(prefs->db_graph);
+      fputs(response.b, fout);
+      if(tsv) fputc('\n', fout);
+    }
+    else if(is_request(line.b, "contig", 6)) {
+      db_graph_grow_enter(prefs->db_graph);
+      success = request_contig(line.b+6, &response, ca, prefs);
+      db_graph_grow_leave(prefs->db_graph);
+      fputs(response.b, fout);
+      if(tsv) fputc('\n', fout);
+      nbad_queries += !success;
+    }
+    else if(is_request(line.b, "add", 3)) {
+      success = request_add(line.b+3, &response, prefs);
+      fputs(response.b, fout);
+      if(tsv) fputc('\n', fout);
+      nbad_queries += !success;
+    }
+    else if(is_request(line.b, "batch", 5) || is_request(line.b, "seq", 3))
+    {
+      server_kmer_buf_reset(&batch.kmers);
+      if(line.b[0] == 'b' || line.b[0] == 'B') batch_add_kmers(&batch, line.b+5);
+      else batch_add_seq(&batch, line.b+3);
+      db_graph_grow_enter(prefs->db_graph);
+      nbad_queries += batch_respond(&batch, fout);
+      db_graph_grow_leave(prefs->db_graph);
+      nqueries += batch.kmers.len;
+      fflush(fout);
+      continue;
+    }
+    else {
+      strbuf_reset(&response);
+      db_graph_grow_enter(prefs->db_graph);
+      success = query_response(line.b, line.end, q, &response,
+                               prefs->pretty, tsv, prefs->disk, db_graph);
+      db_graph_grow_leave(prefs->db_graph);
+      if(response.end) {
+        fputs(response.b, fout);
+        if(tsv) fputc('\n', fout);
+      }
+      nbad_queries += !success;
+    }
+    fflush(fout);
+    nqueries += (line.end > 0);
+  }
+
+  __sync_fetch_and_add(&prefs->nqueries, nqueries);
+  __sync_fetch_and_add(&prefs->nbad_queries, nbad_queries);
+
+  query_dealloc(&q);
+  batch_dealloc(&batch);
+  strbuf_dealloc(&line);
+  strbuf_dealloc(&response);
+}
+
+//
+// Serve clients over a TCP or Unix socket
+//
+
+typedef struct {
+  ServerPrefs *prefs;
+  int listenfd;
+} ServerListener;
+
+static int server_listen_tcp(const char *address, uint16_t port)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if(inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+    die("Not an IPv4 address: %s", address);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+  if(fd < 0) die("Cannot create socket: %s", strerror(errno));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    die("Cannot listen on %s:%u: %s", address, (unsigned)port, strerror(errno));
+  if(listen(fd, SOMAXCONN) != 0)
+    die("Cannot listen on %s:%u: %s", address, (unsigned)port, strerror(errno));
+  return fd;
+}
+
+static int server_listen_unix(const char *path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path))
+    die("Socket path too long: %s", path);
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) die("Cannot create socket: %s", strerror(errno));
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    die("Cannot listen on %s: %s (remove it if stale)", path, strerror(errno));
+  if(listen(fd, SOMAXCONN) != 0)
+    die("Cannot listen on %s: %s", path, strerror(errno));
+  return fd;
+}
+
+// Each client thread accepts a connection and serves it until it closes
+static void server_client_thread(void *arg, size_t threadid)
+{
+  const ServerListener *lstnr = (const ServerListener*)arg;
+  ServerPrefs *prefs = lstnr->prefs;
+  char name[50];
+  int fd, outfd;
+  FILE *fin, *fout;
+
+  // Walkers are reused by every connection served on this thread
+  ContigAssembler *ca = NULL;
+  if(prefs->contigs)
+    ca = contig_assembler_new(prefs->missing_check, prefs->db_graph);
+
+  while(1)
+  {
+    fd = accept(lstnr->listenfd, NULL, NULL);
+    if(fd < 0) {
+      if(errno != EINTR) warn("accept failed: %s", strerror(errno));
+      continue;
+    }
+    if((outfd = dup(fd)) < 0 ||
+       (fin = fdopen(fd, "r")) == NULL ||
+       (fout = fdopen(outfd, "w")) == NULL)
+    {
+      die("Cannot open connection: %s", strerror(errno));
+    }
+
+    snprintf(name, sizeof(name), "client on thread %zu", threadid);
+    status("[server] Connection opened on thread %zu", threadid);
+    server_session(prefs, ca, fin, fout, name, false, false);
+    fclose(fin);
+    fclose(fout);
+    status("[server] Connection closed on thread %zu", threadid);
   }
-  kmer_response(resp, q, pretty, db_graph);
 }
 
 static char* make_info_json_str(cJSON **hdrs, size_t nhdrs,
@@ -282,15 +1086,25 @@ static char* make_info_json_str(cJSON **hdrs, size_t nhdrs,
 int ctx_server(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
+  size_t nthreads = 0;
 
   GPathReader tmp_gpfile;
   GPathFileBuffer gpfiles;
   gpfile_buf_alloc(&gpfiles, 8);
 
   bool pretty = true;
+  bool tsv = false; // Respond with tab separated lines instead of JSON
   bool binary_covgs = true; // Binary coverage instead of full coverage
   bool per_col_edges = false; // Load per sample or pooled edges
   bool use_disk = false;
+  bool sparse_cols = false; // Store colours in a SparseCols
+  bool shared_edges = false; // Store per sample edges in a SharedEdges
+  bool kmer_filter = false; // Bloom filter in front of the hash table
+  bool missing_check = true; // Missing info check when assembling contigs
+  bool updates = false; // Accept 'add' requests
+  size_t contig_nodes = 0, contig_ms = 0;
+  const char *listen_addr = NULL, *socket_path = NULL, *graph_shm = NULL;
+  size_t port = 0, nclients = 0;
 
   // Arg parsing
   char cmd[100];
@@ -313,10 +1127,24 @@ int ctx_server(int argc, char **argv)
         break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'S': cmd_check(pretty, cmd); pretty = false; break;
+      case 'T': cmd_check(!tsv, cmd); tsv = true; break;
       case 'C': cmd_check(binary_covgs, cmd); binary_covgs = false; break;
       case 'E': cmd_check(!per_col_edges, cmd); per_col_edges = true; break;
       case 'D': cmd_check(!use_disk, cmd); use_disk = true; break;
+      case 'w': cmd_check(!sparse_cols, cmd); sparse_cols = true; break;
+      case 'U': cmd_check(!shared_edges, cmd); shared_edges = true; break;
+      case 'G': cmd_check(!graph_shm, cmd); graph_shm = optarg; break;
+      case 'B': cmd_check(!kmer_filter, cmd); kmer_filter = true; break;
+      case 'L': cmd_check(!contig_nodes, cmd); contig_nodes = cmd_size_nonzero(cmd, optarg); break;
+      case 'W': cmd_check(!contig_ms, cmd); contig_ms = cmd_size_nonzero(cmd, optarg); break;
+      case 'M': cmd_check(missing_check, cmd); missing_check = false; break;
+      case 'a': cmd_check(!updates, cmd); updates = true; break;
+      case 'P': cmd_check(!port, cmd); port = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'A': cmd_check(!listen_addr, cmd); listen_addr = optarg; break;
+      case 'u': cmd_check(!socket_path, cmd); socket_path = optarg; break;
+      case 'c': cmd_check(!nclients, cmd); nclients = cmd_uint32_nonzero(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -325,7 +1153,29 @@ int ctx_server(int argc, char **argv)
     }
   }
 
-  if(optind >= argc) cmd_print_usage("Require input graph files (.ctx)");
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+  if(nclients == 0) nclients = nthreads;
+  if(contig_nodes == 0) contig_nodes = SERVER_CONTIG_NODES;
+  if(contig_ms == 0) contig_ms = SERVER_CONTIG_MS;
+  if(!listen_addr) listen_addr = "127.0.0.1";
+
+  if(port > UINT16_MAX) cmd_print_usage("--port must be <= %u", UINT16_MAX);
+  if(port && socket_path) cmd_print_usage("Cannot use --port with --socket");
+  if(!port && !socket_path && nclients != nthreads)
+    cmd_print_usage("--clients requires --port or --socket");
+
+  if(graph_shm == NULL && optind >= argc)
+    cmd_print_usage("Require input graph files (.ctx) or --graph-shm");
+  if(graph_shm != NULL && optind < argc)
+    cmd_print_usage("Cannot give graph files with --graph-shm");
+  if(graph_shm != NULL && (use_disk || sparse_cols || shared_edges))
+    cmd_print_usage("Cannot use --graph-shm with --disk, --sparse or --shared-edges");
+
+  int allocflags = DBG_ALLOC_EDGES | (binary_covgs ? DBG_ALLOC_NODE_IN_COL
+                                                   : DBG_ALLOC_COVGS);
+  if(use_disk || sparse_cols) allocflags = 0;
+  // Kmers are added with compare-and-swap so lookups need no locks
+  if(updates) allocflags |= DBG_ALLOC_HT_LOCKFREE;
 
   //
   // Open graph files
@@ -333,32 +1183,79 @@ int ctx_server(int argc, char **argv)
   const size_t num_gfiles = argc - optind;
   char **graph_paths = argv + optind;
 
-  ctx_assert(num_gfiles > 0);
-
-  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+  GraphFileReader *gfiles = ctx_calloc(MAX2(num_gfiles, 1), sizeof(GraphFileReader));
   size_t i, ncols;
   size_t ctx_max_kmers = 0, ctx_sum_kmers = 0;
   size_t ctp_max_kmers = 0, ctp_sum_kmers = 0;
-
-  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
-                           &ctx_max_kmers, &ctx_sum_kmers);
+  dBGraph db_graph;
 
   gpath_reader_count_kmers(gpfiles.b, gpfiles.len, &ctp_max_kmers, &ctp_sum_kmers);
 
-  // Check graph + paths are compatible
-  graphs_gpaths_compatible(gfiles, num_gfiles, gpfiles.b, gpfiles.len, -1);
+  if(graph_shm != NULL) {
+    // Graph is already loaded
+    graph_shm_attach(graph_shm, &db_graph, allocflags);
+    ncols = db_graph.num_of_cols;
+    graphs_gpaths_compatible(NULL, 0, gpfiles.b, gpfiles.len, -1);
+    for(i = 0; i < gpfiles.len; i++) {
+      if(gpath_reader_get_kmer_size(&gpfiles.b[i]) != db_graph.kmer_size ||
+         file_filter_into_ncols(&gpfiles.b[i].fltr) > ncols) {
+        die("Link file doesn't match the graph in shared memory: %s",
+            file_filter_input(&gpfiles.b[i].fltr));
+      }
+    }
+  }
+  else {
+    ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
+                             &ctx_max_kmers, &ctx_sum_kmers);
+
+    // Check graph + paths are compatible
+    graphs_gpaths_compatible(gfiles, num_gfiles, gpfiles.b, gpfiles.len, -1);
+  }
 
   if(use_disk && num_gfiles > 1)
     cmd_print_usage("Can only use --disk with one sorted graph file");
+  if(use_disk && kmer_filter)
+    cmd_print_usage("Cannot use --kmer-filter with --disk");
+  if(use_disk && sparse_cols)
+    cmd_print_usage("Cannot use --disk with --sparse");
+  if(shared_edges && !per_col_edges)
+    cmd_print_usage("--shared-edges requires --edges");
+  if(shared_edges && (use_disk || sparse_cols))
+    cmd_print_usage("Cannot use --shared-edges with --disk or --sparse");
+  if(shared_edges && ncols > SHARED_EDGES_MAXCOLS)
+    cmd_print_usage("--shared-edges supports at most %zu colours",
+                    SHARED_EDGES_MAXCOLS);
+  if(sparse_cols && ncols > SPARSE_COLS_MAXCOLS)
+    cmd_print_usage("--sparse supports at most %zu colours", SPARSE_COLS_MAXCOLS);
+  if(updates && (use_disk || sparse_cols || shared_edges || graph_shm))
+    cmd_print_usage("Cannot use --updates with --disk, --sparse, --shared-edges "
+                    "or --graph-shm");
+  if(updates && kmer_filter)
+    cmd_print_usage("Cannot use --updates with --kmer-filter");
 
   //
   // Decide on memory
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem = 0, path_mem = 0;
+  size_t sparse_mem = 0, sparse_nentries = 0;
 
   // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col) +
 
-  if(use_disk && gpfiles.len == 0)
+  if(graph_shm != NULL)
+  {
+    // Graph memory is shared with other processes
+    kmers_in_hash = db_graph.ht.capacity;
+    if(gpfiles.len)
+    {
+      path_mem = gpath_reader_mem_req(gpfiles.b, gpfiles.len,
+                                      ncols, memargs.mem_to_use,
+                                      !binary_covgs, // load path counts
+                                      kmers_in_hash, false);
+      path_mem += sizeof(GPath*)*kmers_in_hash;
+      cmd_print_mem(path_mem, "paths");
+    }
+  }
+  else if(use_disk && gpfiles.len == 0)
   {
     kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                           memargs.mem_to_use_set,
@@ -368,10 +1265,16 @@ int ctx_server(int argc, char **argv)
   }
   else
   {
-    bits_per_kmer = sizeof(BinaryKmer)*8 + // kmer
-                    sizeof(Edges)*8 * (per_col_edges ? ncols : 1) + // edges
-                    (binary_covgs ? 1 : sizeof(Covg)*8) * ncols + // covgs
-                    (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0); // links
+    if(sparse_cols) {
+      bits_per_kmer = sizeof(BinaryKmer)*8 + // kmer
+                      sizeof(uint32_t)*8 + // sparse colour list
+                      (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0); // links
+    } else {
+      bits_per_kmer = sizeof(BinaryKmer)*8 + // kmer
+                      sizeof(Edges)*8 * (per_col_edges ? ncols : 1) + // edges
+                      (binary_covgs ? 1 : sizeof(CovgStore)*8) * ncols + // covgs
+                      (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0); // links
+    }
 
     kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                           memargs.mem_to_use_set,
@@ -398,18 +1301,37 @@ int ctx_server(int argc, char **argv)
     }
   }
 
-  size_t total_mem = graph_mem + path_mem;
+  if(sparse_cols)
+  {
+    // Use remaining memory for sparse colour entries, at most one per kmer
+    // per colour loaded from each file
+    size_t max_entries = 0;
+    for(i = 0; i < num_gfiles; i++)
+      max_entries += gfiles[i].num_of_kmers * file_filter_num(&gfiles[i].fltr);
+    size_t rem_mem = memargs.mem_to_use -
+                     MIN2(memargs.mem_to_use, graph_mem + path_mem);
+    sparse_nentries = MIN2(max_entries, rem_mem / sizeof(SparseColEntry));
+    sparse_nentries = MIN2(sparse_nentries, SPARSE_COLS_NONE-1);
+    sparse_nentries = MAX2(sparse_nentries, 1);
+    sparse_mem = sparse_nentries * sizeof(SparseColEntry);
+    cmd_print_mem(sparse_mem, "sparse colours");
+  }
+
+  size_t total_mem = graph_mem + path_mem + sparse_mem;
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
   // Allocate memory
-  int allocflags = DBG_ALLOC_EDGES | (binary_covgs ? DBG_ALLOC_NODE_IN_COL
-                                                   : DBG_ALLOC_COVGS);
-  if(use_disk) allocflags = 0;
+  if(graph_shm == NULL) {
+    db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size,
+                   ncols, per_col_edges ? ncols : 1, kmers_in_hash,
+                   allocflags);
+  }
 
-  dBGraph db_graph;
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size,
-                 ncols, per_col_edges ? ncols : 1, kmers_in_hash,
-                 allocflags);
+  SparseCols sparse;
+  if(sparse_cols) {
+    sparse_cols_alloc(&sparse, db_graph.ht.capacity, sparse_nentries);
+    db_graph.sparse = &sparse;
+  }
 
   // Paths - allocates nothing if gpfiles.len == 0
   gpath_reader_alloc_gpstore(gpfiles.b, gpfiles.len,
@@ -426,8 +1348,9 @@ int ctx_server(int argc, char **argv)
     graph_load_ginfo(&db_graph, &gfiles[0]);
     disk = graph_search_new(&gfiles[0]);
   }
-  else {
+  else if(graph_shm == NULL) {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.nthreads = nthreads;
     gprefs.empty_colours = true;
     for(i = 0; i < num_gfiles; i++) {
       graph_load(&gfiles[i], gprefs, NULL);
@@ -436,6 +1359,10 @@ int ctx_server(int argc, char **argv)
     }
   }
 
+  // Replace per sample edges with their union plus the samples that differ
+  SharedEdges sedges;
+  if(shared_edges) db_graph_share_edges(&db_graph, &sedges, nthreads);
+
   // Load link files
   int link_flags = use_disk ? GPATH_ADD_MISSING_KMERS : GPATH_DIE_MISSING_KMERS;
   for(i = 0; i < gpfiles.len; i++)
@@ -443,6 +1370,11 @@ int ctx_server(int argc, char **argv)
 
   hash_table_print_stats(&db_graph.ht);
 
+  if(kmer_filter) hash_table_filter_build(&db_graph.ht);
+
+  // 'add' requests double the hash table when it fills up
+  if(updates) db_graph_grow_alloc(&db_graph, nthreads);
+
   // Create array of cJSON** from input files
   cJSON **hdrs = ctx_malloc(gpfiles.len * sizeof(cJSON*));
   for(i = 0; i < gpfiles.len; i++) hdrs[i] = gpfiles.b[i].json;
@@ -458,54 +1390,64 @@ int ctx_server(int argc, char **argv)
     gpath_reader_close(&gpfiles.b[i]);
   gpfile_buf_dealloc(&gpfiles);
 
-  // Answer queries
-  StrBuf line, response;
-  strbuf_alloc(&line, 1024);
-  strbuf_alloc(&response, 1024);
-  size_t nqueries = 0, nbad_queries = 0;
-  bool success;
+  // Searching a compressed or unmapped file on disk takes turns on a lock, so
+  // more threads would not help
+  size_t query_threads = nthreads;
+  if(disk && !graph_search_find_is_mt(disk)) query_threads = 1;
+
+  ServerPrefs prefs = {.pretty = pretty, .tsv = tsv,
+                       .binary_covgs = binary_covgs,
+                       .flatten_edges = !per_col_edges,
+                       .disk = disk, .db_graph = &db_graph,
+                       .info_txt = info_txt,
+                       .batch_threads = query_threads,
+                       .contigs = (disk == NULL &&
+                                   (db_graph.node_in_cols != NULL ||
+                                    db_graph.sparse != NULL)),
+                       .missing_check = missing_check,
+                       .contig_nodes = contig_nodes,
+                       .contig_ms = contig_ms,
+                       .updates = updates,
+                       .nqueries = 0, .nbad_queries = 0};
 
-  ServerQuery q;
-  query_alloc(&q, db_graph.num_of_cols, binary_covgs, !per_col_edges);
-
-  // Read from input
-  while(1)
+  // Answer queries
+  if(port || socket_path)
   {
-    fprintf(stdout, "> "); fflush(stdout);
-    if(futil_fcheck(strbuf_reset_readline(&line, stdin), stdin, "STDIN") == 0) {
-      fprintf(stdout, "\n");
-      break;
+    // Clients share the graph, each is answered by a single thread
+    prefs.batch_threads = 1;
+    signal(SIGPIPE, SIG_IGN); // write errors are seen when a client leaves
+
+    ServerListener lstnr = {.prefs = &prefs};
+    if(port) {
+      lstnr.listenfd = server_listen_tcp(listen_addr, port);
+      status("[server] Listening on %s:%zu for up to %zu clients at once",
+             listen_addr, port, nclients);
+    } else {
+      lstnr.listenfd = server_listen_unix(socket_path);
+      status("[server] Listening on %s for up to %zu clients at once",
+             socket_path, nclients);
     }
-    strbuf_chomp(&line);
-    if(strcasecmp(line.b,"q") == 0 || strcasecmp(line.b,"quit") == 0) { break; }
-    else if(strcasecmp(line.b,"info") == 0) {
-      fputs(info_txt, stdout);
-      fputc('\n', stdout);
-      fflush(stdout);
-    }
-    else if(strcasecmp(line.b,"random") == 0) {
-      request_random(q, &response, pretty, disk, &db_graph);
-      fputs(response.b, stdout);
-      fflush(stdout);
-    }
-    else {
-      success = query_response(line.b, q, &response, pretty, disk, &db_graph);
-      if(response.end) {
-        fputs(response.b, stdout);
-        fflush(stdout);
-      }
-      nbad_queries += !success;
+
+    // never returns
+    util_multi_thread(&lstnr, nclients, server_client_thread);
+    close(lstnr.listenfd);
+  }
+  else {
+    ContigAssembler *ca = NULL;
+    if(prefs.contigs) ca = contig_assembler_new(missing_check, &db_graph);
+    server_session(&prefs, ca, stdin, stdout, "STDIN", !tsv, true);
+    if(ca) {
+      if(contig_assembler_stats(ca)->num_contigs)
+        assemble_contigs_stats_print(contig_assembler_stats(ca));
+      contig_assembler_destroy(ca);
     }
-    nqueries += (line.end > 0);
   }
 
   char nstr[50], badstr[50];
-  ulong_to_str(nqueries, nstr);
-  ulong_to_str(nbad_queries, badstr);
+  ulong_to_str(prefs.nqueries, nstr);
+  ulong_to_str(prefs.nbad_queries, badstr);
   status("Answered %s queries, %s bad queries", nstr, badstr);
 
-  query_dealloc(&q);
-
   if(disk) {
     graph_search_destroy(disk);
     graph_file_close(&gfiles[0]);
@@ -513,8 +1455,8 @@ int ctx_server(int argc, char **argv)
   ctx_free(gfiles);
 
   free(info_txt);
-  strbuf_dealloc(&line);
-  strbuf_dealloc(&response);
+  if(sparse_cols) sparse_cols_dealloc(&sparse);
+  if(shared_edges) shared_edges_dealloc(&sedges);
   db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
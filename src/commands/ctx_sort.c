@@ -2,8 +2,10 @@
 #include "commands.h"
 #include "util.h"
 #include "file_util.h"
+#include "async_file.h"
 #include "graphs_load.h"
 #include "graph_writer.h"
+#include "graph_footer.h"
 #include "binary_kmer.h"
 
 // TODO: add .ctp.gz sorting
@@ -11,7 +13,9 @@
 const char sort_usage[] =
 "usage: "CMD" sort [options] <in.ctx>\n"
 "\n"
-"  Sort a cortex graph file. Loads entire graph into memory then sorts.\n"
+"  Sort a cortex graph file. Loads entire graph into memory then sorts. If the\n"
+"  graph does not fit in memory (-m), sorted runs are written to temporary files\n"
+"  next to the output file and then merged.\n"
 "\n"
 "  -h, --help              This help message\n"
 "  -q, --quiet             Silence status output normally printed to STDERR\n"
@@ -19,6 +23,12 @@ const char sort_usage[] =
 "  -m, --memory <mem>      Memory to use\n"
 "  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -o, --out <out.ctx>     Output file [default: overwrite input]\n"
+"  -t, --threads <T>       Number of threads to sort with [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -I, --index             Write a prefix index footer for fast searching\n"
+"\n"
+"  The index footer lets commands that search the sorted graph on disk (e.g.\n"
+"  '"CMD" server') start without scanning it. Use '"CMD" index --footer' to\n"
+"  index a file that is already sorted.\n"
 "\n";
 
 static struct option longopts[] =
@@ -28,18 +38,244 @@ static struct option longopts[] =
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
   {"out",          required_argument, NULL, 'o'},
+  {"threads",      required_argument, NULL, 't'},
+  {"index",        no_argument,       NULL, 'I'},
   {NULL, 0, NULL, 0}
 };
 
+// Don't radix sort small buckets
+#define RADIX_MIN_ENTRIES 64
+
+// Get byte `i` of the binary kmer at the start of an (unaligned) entry,
+// most significant byte first
+static inline uint8_t entry_byte(const char *entry, size_t i)
+{
+  uint64_t w;
+  memcpy(&w, entry + (i/8)*sizeof(uint64_t), sizeof(uint64_t));
+  return (uint8_t)(w >> (56 - 8*(i%8)));
+}
+
+// MSD radix sort entries on byte `byte` onwards of their binary kmer
+// `tmp` must have space for `num` pointers
+static void radix_sort_entries(char **entries, char **tmp, size_t num,
+                               size_t byte)
+{
+  if(byte == sizeof(BinaryKmer)) return; // all kmers are equal
+  if(num < RADIX_MIN_ENTRIES) {
+    qsort(entries, num, sizeof(char*), binary_kmers_qcmp_unaligned_ptrs);
+    return;
+  }
+
+  size_t i, b, pos, counts[256] = {0}, starts[256];
+
+  for(i = 0; i < num; i++) counts[entry_byte(entries[i], byte)]++;
+  for(b = pos = 0; b < 256; b++) { starts[b] = pos; pos += counts[b]; }
+  for(i = 0; i < num; i++) tmp[starts[entry_byte(entries[i], byte)]++] = entries[i];
+  memcpy(entries, tmp, num * sizeof(char*));
+
+  for(b = pos = 0; b < 256; pos += counts[b], b++)
+    if(counts[b] > 1)
+      radix_sort_entries(entries+pos, tmp+pos, counts[b], byte+1);
+}
+
+typedef struct {
+  char **entries, **tmp;
+  size_t num, byte;
+} SortJob;
+
+static void sort_job(void *arg, size_t threadid)
+{
+  (void)threadid;
+  SortJob *job = (SortJob*)arg;
+  radix_sort_entries(job->entries, job->tmp, job->num, job->byte);
+}
+
 // Sort graph file entries. Pointers must point to binary kmer
-static inline void sort_block(char **entries, size_t num)
+// Splits entries on the first byte of the kmer that is used, then sorts the
+// 256 buckets in parallel. `tmp` must have space for `num` pointers
+static void sort_block(char **entries, char **tmp, size_t num,
+                       size_t kmer_size, size_t nthreads)
 {
-  qsort(entries, num, sizeof(char*), binary_kmers_qcmp_unaligned_ptrs);
+  // Top bits of the first word are unused
+  size_t i, pos, byte = (sizeof(BinaryKmer)*8 - kmer_size*2) / 8;
+  size_t counts[256] = {0}, starts[256];
+
+  if(num < RADIX_MIN_ENTRIES || nthreads <= 1) {
+    radix_sort_entries(entries, tmp, num, byte);
+    return;
+  }
+
+  for(i = 0; i < num; i++) counts[entry_byte(entries[i], byte)]++;
+  for(i = pos = 0; i < 256; i++) { starts[i] = pos; pos += counts[i]; }
+  for(i = 0; i < num; i++) tmp[starts[entry_byte(entries[i], byte)]++] = entries[i];
+  memcpy(entries, tmp, num * sizeof(char*));
+
+  SortJob jobs[256];
+  for(i = pos = 0; i < 256; pos += counts[i], i++) {
+    jobs[i] = (SortJob){.entries = entries+pos, .tmp = tmp+pos,
+                        .num = counts[i], .byte = byte+1};
+  }
+
+  util_run_threads(jobs, 256, sizeof(jobs[0]), nthreads, sort_job);
+}
+
+// Write entries to a new graph file
+// Returns number of bytes written
+static size_t write_entries(FILE *fout, const GraphFileHeader *hdr,
+                            char **entries, size_t num, size_t kmer_mem)
+{
+  size_t i, nbytes = 0;
+  if(hdr) nbytes = graph_write_header(fout, hdr);
+  for(i = 0; i < num; i++)
+    if(fwrite(entries[i], 1, kmer_mem, fout) != kmer_mem)
+      die("Cannot write to file");
+  return nbytes + num * kmer_mem;
+}
+
+// Write the prefix index of sorted entries after the last entry, which ends at
+// file offset `data_end`
+static void write_index(FILE *fout, off_t data_end, char **entries, size_t num,
+                        size_t kmer_size, const char *path)
+{
+  size_t i, x, next = 0, p = graph_pfx_bases(num, kmer_size);
+  uint64_t *pfx = ctx_malloc(graph_pfx_len(p) * sizeof(uint64_t));
+  BinaryKmer bkmer;
+
+  for(i = 0; i < num; i++) {
+    memcpy(bkmer.b, entries[i], sizeof(BinaryKmer));
+    x = p ? graph_pfx_get(bkmer, kmer_size, p) : 0;
+    graph_pfx_add(pfx, &next, x, i);
+  }
+  graph_pfx_add(pfx, &next, graph_pfx_len(p)-1, num);
+
+  status("[sort] Writing index footer, prefix %zu bases", p);
+  graph_footer_write(fout, data_end, pfx, p, num, path);
+  ctx_free(pfx);
+}
+
+typedef struct {
+  GraphFileReader *runs;
+  char *recs; // current record of each run
+  size_t *heap, n, kmer_mem;
+} RunMerge;
+
+#define run_rec(m,r) ((m)->recs + (m)->kmer_mem*(r))
+
+// Order runs by their current kmer, then by run so that equal kmers are
+// written in the order they were read
+static inline bool run_lt(const RunMerge *m, size_t a, size_t b)
+{
+  BinaryKmer x, y;
+  memcpy(x.b, run_rec(m,a), sizeof(BinaryKmer));
+  memcpy(y.b, run_rec(m,b), sizeof(BinaryKmer));
+  int c = binary_kmer_cmp(x, y);
+  return c < 0 || (c == 0 && a < b);
+}
+
+static void run_heap_down(RunMerge *m, size_t i)
+{
+  size_t c;
+  while((c = 2*i+1) < m->n) {
+    if(c+1 < m->n && run_lt(m, m->heap[c+1], m->heap[c])) c++;
+    if(!run_lt(m, m->heap[c], m->heap[i])) break;
+    SWAP(m->heap[c], m->heap[i]);
+    i = c;
+  }
+}
+
+// Read the next record of run `r`, returns false at the end of the run
+static bool run_next(RunMerge *m, size_t r)
+{
+  size_t n = graph_file_fread(&m->runs[r], run_rec(m,r), m->kmer_mem);
+  if(n != 0 && n != m->kmer_mem)
+    die("Truncated sort run: %s", m->runs[r].fltr.path.b);
+  return n != 0;
+}
+
+// k-way merge of sorted runs into `fout`, copying records as they are so the
+// output matches an in-memory sort of the same file
+static void merge_runs(FILE *fout, const GraphFileHeader *hdr,
+                       GraphFileReader *runs, size_t nruns, size_t kmer_mem)
+{
+  RunMerge m = {.runs = runs, .n = 0, .kmer_mem = kmer_mem};
+  m.recs = ctx_malloc(nruns * kmer_mem);
+  m.heap = ctx_malloc(nruns * sizeof(size_t));
+  size_t i, r;
+
+  graph_write_header(fout, hdr);
+
+  for(r = 0; r < nruns; r++)
+    if(run_next(&m, r)) m.heap[m.n++] = r;
+  for(i = m.n/2; i-- > 0; ) run_heap_down(&m, i);
+
+  while(m.n > 0) {
+    r = m.heap[0];
+    if(fwrite(run_rec(&m,r), 1, kmer_mem, fout) != kmer_mem)
+      die("Cannot write to file");
+    if(!run_next(&m, r)) m.heap[0] = m.heap[--m.n];
+    run_heap_down(&m, 0);
+  }
+
+  ctx_free(m.heap);
+  ctx_free(m.recs);
+}
+
+// Sort a graph too big to fit in memory: read runs of `run_kmers` kmers, sort
+// each in memory then write it to a temporary graph file. Finally merge the
+// sorted runs into `out_path`.
+static void sort_external(GraphFileReader *gfile, const char *out_path,
+                          const char *tmp_path_base,
+                          char *mem, char **kmers, char **tmp,
+                          size_t run_kmers, size_t kmer_mem, size_t nthreads)
+{
+  size_t i, n, nread, nruns = 0;
+  StrBuf tmp_fmt, path;
+  strbuf_alloc(&tmp_fmt, 1024);
+  strbuf_alloc(&path, 1024);
+  strbuf_sprintf(&tmp_fmt, "%s.sortrun%%i.ctx", tmp_path_base);
+  GraphFileBuffer runs;
+  gfile_buf_alloc(&runs, 16);
+
+  while((nread = graph_file_fread(gfile, mem, run_kmers*kmer_mem)) > 0)
+  {
+    if(nread % kmer_mem != 0) die("Truncated graph file: %s", gfile->fltr.path.b);
+    n = nread / kmer_mem;
+    for(i = 0; i < n; i++) kmers[i] = mem + kmer_mem*i;
+    sort_block(kmers, tmp, n, gfile->hdr.kmer_size, nthreads);
+
+    if(!futil_generate_filename(tmp_fmt.b, &path))
+      die("Cannot create temporary file name: %s", tmp_fmt.b);
+    status("[sort] Writing sorted run %zu of %zu kmers: %s", nruns, n, path.b);
+    FILE *fh = async_file_fopen(path.b, "w");
+    write_entries(fh, &gfile->hdr, kmers, n, kmer_mem);
+    fclose(fh);
+
+    // Reopen to merge later
+    gfile_buf_push_zero(&runs, 1);
+    graph_file_open2(&runs.b[nruns++], path.b, "r", true, 0);
+  }
+
+  status("[sort] Merging %zu sorted runs", nruns);
+  FILE *fout = async_file_fopen(out_path, "w");
+  merge_runs(fout, &gfile->hdr, runs.b, runs.len, kmer_mem);
+  if(fout != stdout) fclose(fout);
+
+  for(i = 0; i < runs.len; i++) {
+    if(unlink(runs.b[i].fltr.path.b) != 0)
+      warn("Cannot remove temporary file: %s", runs.b[i].fltr.path.b);
+    graph_file_close(&runs.b[i]);
+  }
+
+  gfile_buf_dealloc(&runs);
+  strbuf_dealloc(&tmp_fmt);
+  strbuf_dealloc(&path);
 }
 
 int ctx_sort(int argc, char **argv)
 {
   const char *out_path = NULL;
+  size_t nthreads = 0;
+  bool write_footer = false;
   struct MemArgs memargs = MEM_ARGS_INIT;
 
   // Arg parsing
@@ -60,6 +296,8 @@ int ctx_sort(int argc, char **argv)
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'I': cmd_check(!write_footer, cmd); write_footer = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -71,6 +309,8 @@ int ctx_sort(int argc, char **argv)
   if(optind+1 != argc)
     cmd_print_usage("Require exactly one input graph file (.ctx)");
 
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
   const char *ctx_path = argv[optind];
 
   //
@@ -83,6 +323,9 @@ int ctx_sort(int argc, char **argv)
   if(!file_filter_from_direct(&gfile.fltr))
     die("Cannot open graph file with a filter ('in.ctx:blah' syntax)");
 
+  if(graph_file_is_blocked(&gfile))
+    die("Cannot sort block compressed graph, use '"CMD" join --sort'");
+
   size_t num_kmers, memory;
 
   // Reading from a stream
@@ -94,24 +337,64 @@ int ctx_sort(int argc, char **argv)
   else num_kmers = gfile.num_of_kmers;
 
   // Open output path (if given)
-  FILE *fout = out_path ? futil_fopen_create(out_path, "w") : NULL;
+  FILE *fout = out_path ? async_file_fopen_create(out_path, "w") : NULL;
 
   size_t i;
   size_t ncols = gfile.hdr.num_of_cols;
   size_t kmer_mem = sizeof(BinaryKmer) + (sizeof(Edges)+sizeof(Covg))*ncols;
 
-  memory = (sizeof(char*) + kmer_mem) * num_kmers;
+  // kmer entry + two pointers for radix sorting
+  size_t entry_mem = 2*sizeof(char*) + kmer_mem;
+  memory = entry_mem * num_kmers;
 
   char mem_str[50];
   bytes_to_str(memory, 1, mem_str);
 
   if(memory > memargs.mem_to_use)
-    die("Require at least %s memory", mem_str);
+  {
+    // External sort: sort runs that fit in memory, then merge them
+    size_t run_kmers = memargs.mem_to_use / entry_mem;
+    if(run_kmers < RADIX_MIN_ENTRIES)
+      die("Require at least %s memory", mem_str);
+
+    bytes_to_str(run_kmers * entry_mem, 1, mem_str);
+    status("[memory] Total: %s; graph does not fit in memory, sorting runs of "
+           "%zu kmers", mem_str, run_kmers);
+
+    char *mem = ctx_malloc(kmer_mem * run_kmers);
+    char **kmers = ctx_malloc(run_kmers*sizeof(char*));
+    char **tmp = ctx_malloc(run_kmers*sizeof(char*));
+
+    // Temporary files go next to the output file
+    if(fout && fout != stdout) fclose(fout);
+    const char *dst = out_path ? out_path : ctx_path;
+    const char *tmp_base = strcmp(dst,"-") != 0 ? dst : "ctx_sort";
+    if(write_footer && strcmp(dst,"-") == 0)
+      die("Cannot write index footer to STDOUT when sorting on disk");
+
+    sort_external(&gfile, dst, tmp_base, mem, kmers, tmp,
+                  run_kmers, kmer_mem, nthreads);
+
+    graph_file_close(&gfile);
+
+    // Runs were merged straight to the output, index it in parallel
+    if(write_footer) {
+      graph_file_open2(&gfile, dst, "r+", true, 0);
+      graph_footer_index_file(&gfile, nthreads);
+      graph_file_close(&gfile);
+    }
+
+    ctx_free(tmp);
+    ctx_free(kmers);
+    ctx_free(mem);
+    return EXIT_SUCCESS;
+  }
 
   status("[memory] Total: %s", mem_str);
 
   char *mem = ctx_malloc(kmer_mem * num_kmers);
   char **kmers = ctx_malloc(num_kmers*sizeof(char*));
+  char **tmp = ctx_malloc(num_kmers*sizeof(char*));
 
   // Read in whole file
   // if(graph_file_fseek(gfile, gfile.hdr_size, SEEK_SET) != 0) die("fseek failed");
@@ -133,27 +416,36 @@ int ctx_sort(int argc, char **argv)
   for(i = 0; i < num_kmers; i++)
     kmers[i] = mem + kmer_mem*i;
 
-  sort_block(kmers, num_kmers);
+  sort_block(kmers, tmp, num_kmers, gfile.hdr.kmer_size, nthreads);
 
   // Print
+  off_t data_end;
   if(out_path != NULL) {
     // saving to a different destination - write header
-    graph_write_header(fout, &gfile.hdr);
+    data_end = write_entries(fout, &gfile.hdr, kmers, num_kmers, kmer_mem);
+    if(write_footer)
+      write_index(fout, data_end, kmers, num_kmers, gfile.hdr.kmer_size,
+                  out_path);
+    fclose(fout);
   }
   else {
     // Directly manipulating gfile.fh here, using it to write later
     // Not doing any more reading
     if(fseek(gfile.fh, gfile.hdr_size, SEEK_SET) != 0) die("fseek failed");
-    fout = gfile.fh;
+    data_end = gfile.hdr_size +
+               write_entries(gfile.fh, NULL, kmers, num_kmers, kmer_mem);
+    if(write_footer)
+      write_index(gfile.fh, data_end, kmers, num_kmers, gfile.hdr.kmer_size,
+                  ctx_path);
+    // Drop any old footer
+    if(gfile.file_size >= 0 &&
+       (fflush(gfile.fh) != 0 ||
+        ftruncate(fileno(gfile.fh), ftell(gfile.fh)) != 0))
+      die("Cannot truncate file: %s [%s]", ctx_path, strerror(errno));
   }
 
-  for(i = 0; i < num_kmers; i++)
-    if(fwrite(kmers[i], 1, kmer_mem, fout) != kmer_mem)
-      die("Cannot write to file");
-
-  if(out_path) fclose(fout);
-
   graph_file_close(&gfile);
+  ctx_free(tmp);
   ctx_free(kmers);
   ctx_free(mem);
 
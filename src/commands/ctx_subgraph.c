@@ -11,6 +11,8 @@
 #include "graphs_load.h"
 #include "graph_writer.h"
 #include "subgraph.h"
+#include "graph_search.h"
+#include "db_graph_disk.h"
 #include "hash_mem.h" // for calculating mem usage
 
 const char subgraph_usage[] =
@@ -35,6 +37,9 @@ const char subgraph_usage[] =
 // "  -D, --udist <N>       Number of unitigs to extend by [default: 0]\n"
 "  -v, --invert          Dump kmers not in subgraph\n"
 "  -U, --unitigs         Grab entire runs of kmers that are touched by a read\n"
+"  -K, --disk            Search a sorted graph on disk (build/join --sort),\n"
+"                        memory is only needed for the subgraph. One input graph,\n"
+"                        not with --invert or --unitigs. Output is sorted.\n"
 "\n";
 
 static struct option longopts[] =
@@ -54,16 +59,83 @@ static struct option longopts[] =
   // {"sdist",        required_argument, NULL, 'D'},
   {"invert",       no_argument,       NULL, 'v'},
   {"unitigs",      no_argument,       NULL, 'U'},
+  {"disk",         no_argument,       NULL, 'K'},
   {NULL, 0, NULL, 0}
 };
 
+// Fetch the subgraph from a sorted graph file, holding only the subgraph
+// in memory. All colours are loaded at once.
+static void subgraph_disk(GraphFileReader *gfile, size_t ncols,
+                          const char *out_path, size_t nthreads, size_t dist,
+                          const struct MemArgs *memargs,
+                          SeqFilePtrBuffer *sfilebuf)
+{
+  size_t i, bits_per_kmer, kmers_in_hash, graph_mem;
+
+  // 2 bits per kmer for loading from disk
+  bits_per_kmer = sizeof(BinaryKmer)*8 +
+                  (sizeof(Edges) + sizeof(CovgStore))*ncols*8 + 2;
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs->mem_to_use,
+                                        memargs->mem_to_use_set,
+                                        memargs->num_kmers,
+                                        memargs->num_kmers_set,
+                                        bits_per_kmer,
+                                        0, gfile->num_of_kmers,
+                                        true, &graph_mem);
+
+  cmd_check_mem_limit(memargs->mem_to_use, graph_mem);
+
+  if(out_path == NULL) out_path = "-";
+  futil_create_output(out_path);
+
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, gfile->hdr.kmer_size, ncols, ncols, kmers_in_hash,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  graph_load_ginfo(&db_graph, gfile);
+  GraphFileSearch *gsearch = graph_search_new(gfile);
+  dBGraphDisk disk;
+  db_graph_disk_alloc(&disk, gsearch, &db_graph);
+
+  subgraph_from_reads_disk(&db_graph, nthreads, dist,
+                           sfilebuf->b, sfilebuf->len);
+
+  for(i = 0; i < sfilebuf->len; i++) seq_close(sfilebuf->b[i]);
+  seq_file_ptr_buf_dealloc(sfilebuf);
+
+  db_graph_disk_dealloc(&disk, &db_graph);
+  graph_search_destroy(gsearch);
+  hash_table_print_stats(&db_graph.ht);
+
+  // Header
+  StrBuf intersect_gname;
+  strbuf_alloc(&intersect_gname, 1024);
+  for(i = 0; i < file_filter_num(&gfile->fltr); i++) {
+    size_t fromcol = file_filter_fromcol(&gfile->fltr, i);
+    graph_info_make_intersect(&gfile->hdr.ginfo[fromcol], &intersect_gname);
+  }
+  char subgraphstr[] = "subgraph:{";
+  strbuf_insert(&intersect_gname, 0, subgraphstr, strlen(subgraphstr));
+  strbuf_append_char(&intersect_gname, '}');
+
+  for(i = 0; i < ncols; i++)
+    graph_info_append_intersect(&db_graph.ginfo[i].cleaning, intersect_gname.b);
+
+  graph_writer_save_mkhdr(out_path, &db_graph, true, ncols);
+
+  strbuf_dealloc(&intersect_gname);
+  graph_file_close(gfile);
+  db_graph_dealloc(&db_graph);
+}
+
 int ctx_subgraph(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
   const char *out_path = NULL;
   size_t i, j, use_ncols = 0, dist = 0;
-  bool invert = false, grab_unitigs = false;
+  bool invert = false, grab_unitigs = false, use_disk = false;
 
   seq_file_t *tmp_sfile;
   SeqFilePtrBuffer sfilebuf;
@@ -95,6 +167,7 @@ int ctx_subgraph(int argc, char **argv)
       case 'v': cmd_check(!invert,cmd); invert = true; break;
       case 'S':
       case 'U': cmd_check(!grab_unitigs,cmd); grab_unitigs = true; break;
+      case 'K': cmd_check(!use_disk,cmd); use_disk = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -105,6 +178,7 @@ int ctx_subgraph(int argc, char **argv)
 
   // Defaults
   if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+  graph_writer_set_nthreads(nthreads);
   if(use_ncols == 0) use_ncols = 1;
 
   if(sfilebuf.len == 0) cmd_print_usage("Require at least one --seq file");
@@ -113,6 +187,10 @@ int ctx_subgraph(int argc, char **argv)
   size_t num_gfiles = argc - optind;
   char **gfile_paths = argv + optind;
 
+  if(use_disk && num_gfiles > 1) cmd_print_usage("--disk takes one graph file");
+  if(use_disk && (invert || grab_unitigs))
+    cmd_print_usage("--disk cannot be used with --invert or --unitigs");
+
   size_t total_cols;
 
   // Open graph files
@@ -122,6 +200,15 @@ int ctx_subgraph(int argc, char **argv)
   total_cols = graph_files_open(gfile_paths, gfiles, num_gfiles,
                                 &ctx_max_kmers, &ctx_sum_kmers);
 
+  if(use_disk) {
+    if(file_filter_isstdin(&gfiles[0].fltr))
+      cmd_print_usage("--disk cannot read a graph from STDIN");
+    subgraph_disk(&gfiles[0], total_cols, out_path, nthreads, dist,
+                  &memargs, &sfilebuf);
+    ctx_free(gfiles);
+    return EXIT_SUCCESS;
+  }
+
   if(use_ncols < total_cols && (out_path == NULL || strcmp(out_path,"-")==0))
     cmd_print_usage("Need to use --ncols %zu if output is stdout", total_cols);
 
@@ -134,7 +221,7 @@ int ctx_subgraph(int argc, char **argv)
   char graph_mem_str[100], fringe_mem_str[100], num_fringe_nodes_str[100];
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  ((sizeof(Edges) + sizeof(Covg))*use_ncols*8 + 1);
+                  ((sizeof(Edges) + sizeof(CovgStore))*use_ncols*8 + 1);
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
@@ -185,6 +272,7 @@ int ctx_subgraph(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   StrBuf intersect_gname;
   strbuf_alloc(&intersect_gname, 1024);
@@ -239,7 +327,7 @@ int ctx_subgraph(int argc, char **argv)
   graph_writer_merge_mkhdr(out_path, gfiles, num_gfiles,
                           kmers_loaded, colours_loaded,
                           intersect_edges, intersect_gname.b,
-                          false, &db_graph);
+                          false, nthreads, &db_graph);
 
   ctx_free(intersect_edges);
   strbuf_dealloc(&intersect_gname);
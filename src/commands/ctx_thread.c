@@ -19,13 +19,22 @@ const char thread_usage[] =
 "  -h, --help               This help message\n"
 "  -q, --quiet              Silence status output normally printed to STDERR\n"
 "  -f, --force              Overwrite output files\n"
-"  -o, --out <out.ctp.gz>   Save output file [required]\n"
+"  -o, --out <out.ctp.gz>   Save output file [required unless --append]\n"
 "  -m, --memory <mem>       Memory to use (e.g. 1M, 20GB)\n"
 "  -n, --nkmers <N>         Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -p, --paths <in.ctp>     Load link file (can specify multiple times)\n"
+"  -A, --append <in.ctp>    Add links from new reads to an existing link file.\n"
+"                           Counts are updated, so only new reads are threaded.\n"
+"                           Overwrites <in.ctp> unless --out given (needs -f)\n"
 "  -0, --zero-paths         Zero counts on initially loaded links. Use if existing\n"
 "                           links were built from sequence being re-used by this run\n"
+"  -S, --sort               Write kmers in sorted order (see pjoin --stream)\n"
+"  -s, --spill <dir>        When link memory fills up, write links to sorted\n"
+"                           temporary files in <dir> and merge them at the end\n"
+"  -N, --min-link-count <N> Only store links once seen <N> times (max 255). First\n"
+"                           sightings are counted in a sketch using 1/8 of link\n"
+"                           memory. Counts are approximate [default: 1]\n"
 "\n"
 "  Input:\n"
 "  -1, --seq <in.fa>        Thread reads from file (supports sam,bam,fq,*.gz\n"
@@ -37,6 +46,9 @@ const char thread_usage[] =
 "  -H, --cut-hp <bp>        Breaks reads at homopolymers >= <bp> [default: off]\n"
 "  -l, --min-frag-len <bp>  Min fragment size for --seq2 [default:"QUOTE_VALUE(DEFAULT_CRTALN_FRAGLEN_MIN)"]\n"
 "  -L, --max-frag-len <bp>  Max fragment size for --seq2 [default:"QUOTE_VALUE(DEFAULT_CRTALN_FRAGLEN_MAX)"]\n"
+"  -r, --region <chr:s-e>   Only thread reads overlapping a region from indexed\n"
+"                           SAM/BAM/CRAM inputs (can specify multiple times)\n"
+"  -T, --cram-ref <ref.fa>  Reference used to decode CRAM inputs\n"
 "\n"
 "  Link Params:\n"
 "  -w, --one-way            Use one-way gap filling (conservative) [default]\n"
@@ -48,14 +60,19 @@ const char thread_usage[] =
 "  -E, --no-end-check       Skip extra check after gap bridging\n"
 "  -g, --gap-hist <o.csv>   Save size distribution of sequence gaps bridged\n"
 "  -G, --frag-hist <o.csv>  Save size distribution of PE fragments\n"
+"  -R, --stats-sample <R>   Gap/fragment sizes from 1 in <R> reads, 1 for all\n"
+"                           [default: "QUOTE_VALUE(ALN_STATS_DEFAULT_SAMPLE)", 1 with -g/-G]\n"
 "\n"
 "  -u, --use-new-paths      Use links as they are being added (higher err rate) [default: no]\n"
+"  -U, --unitig-map         Place reads on unitigs by their minimizers instead of\n"
+"                           looking up every kmer (faster, uses more memory)\n"
 "\n"
 "  Debugging Options: Probably best not to touch these\n"
 "    -x,--print-contigs -y,--print-paths -z,--print-reads\n"
 "\n"
 "  When loading existing links with -p, use offset (e.g. 2:in.ctp) to specify\n"
 "  which colour to load the data into. See `"CMD" pjoin` to combine .ctp files\n"
+"  Output is a binary link file if <out> ends in .ctp.bin (fast to load)\n"
 "\n";
 
 static struct option longopts[] =
@@ -68,7 +85,11 @@ static struct option longopts[] =
   {"nkmers",        required_argument, NULL, 'n'},
   {"threads",       required_argument, NULL, 't'},
   {"paths",         required_argument, NULL, 'p'},
+  {"append",        required_argument, NULL, 'A'},
   {"zero-paths",    no_argument,       NULL, '0'},
+  {"sort",          no_argument,       NULL, 'S'},
+  {"spill",         required_argument, NULL, 's'},
+  {"min-link-count",required_argument, NULL, 'N'},
 // command specific
   {"seq",           required_argument, NULL, '1'},
   {"seq2",          required_argument, NULL, '2'},
@@ -79,6 +100,8 @@ static struct option longopts[] =
   {"cut-hp",        required_argument, NULL, 'H'},
   {"min-frag-len",  required_argument, NULL, 'l'},
   {"max-frag-len",  required_argument, NULL, 'L'},
+  {"region",        required_argument, NULL, 'r'},
+  {"cram-ref",      required_argument, NULL, 'T'},
 //
   {"one-way",       no_argument,       NULL, 'w'},
   {"two-way",       no_argument,       NULL, 'W'},
@@ -89,8 +112,10 @@ static struct option longopts[] =
   {"no-end-check",  no_argument,       NULL, 'E'},
   {"gap-hist",      required_argument, NULL, 'g'},
   {"frag-hist",     required_argument, NULL, 'G'},
+  {"stats-sample",  required_argument, NULL, 'R'},
 //
   {"use-new-paths", no_argument,       NULL, 'u'},
+  {"unitig-map",    no_argument,       NULL, 'U'},
 // Debug options
   {"print-contigs", no_argument,       NULL, 'x'},
   {"print-paths",   no_argument,       NULL, 'y'},
@@ -99,6 +124,81 @@ static struct option longopts[] =
 };
 
 
+// Links are spilled to sorted temporary files when memory fills up
+typedef struct
+{
+  const char *dir;
+  int id; // random number to avoid clashing with other runs
+  size_t nthreads;
+  CharPtrBuffer paths; // files written so far
+} ThreadSpill;
+
+// Called with all workers paused: save links to a new sorted temporary file,
+// then remove them from the graph
+static void thread_spill_links(dBGraph *db_graph, void *arg)
+{
+  ThreadSpill *spill = (ThreadSpill*)arg;
+  GPathStore *gpstore = &db_graph->gpstore;
+
+  StrBuf fmt, path;
+  strbuf_alloc(&fmt, 1024);
+  strbuf_alloc(&path, 1024);
+  strbuf_sprintf(&fmt, "%s/cortex.spill.%i.%zu.%%i.ctp.gz",
+                 spill->dir, spill->id, spill->paths.len);
+  if(!futil_generate_filename(fmt.b, &path))
+    die("Cannot find a free file name in: %s", spill->dir);
+
+  char npaths_str[50];
+  ulong_to_str(gpstore->num_paths, npaths_str);
+  status("Link memory full, spilling %s links to: %s", npaths_str, path.b);
+
+  ZeroSizeBuffer contig_hist;
+  zsize_buf_alloc(&contig_hist, 16);
+
+  FILE *fout = futil_fopen_create(path.b, "w");
+  gpath_save(fout, path.b, spill->nthreads, false, true,
+             NULL, NULL, NULL, 0, &contig_hist, 1, db_graph);
+  futil_fclose(fout);
+
+  char *spill_path = ctx_malloc(path.end+1);
+  memcpy(spill_path, path.b, path.end+1);
+  char_ptr_buf_push(&spill->paths, &spill_path, 1);
+
+  zsize_buf_dealloc(&contig_hist);
+  strbuf_dealloc(&fmt);
+  strbuf_dealloc(&path);
+
+  // New links are not used for traversal unless they were before
+  bool split_lists = (gpstore->paths_traverse != gpstore->paths_all);
+  gpath_hash_reset(&db_graph->gphash);
+  gpath_store_reset(gpstore);
+  if(split_lists) gpath_store_split_read_write(gpstore);
+}
+
+// Merge spilled link files into the output, summing counts of duplicate links
+static void thread_spill_merge(ThreadSpill *spill, FILE *fout, const char *path,
+                               cJSON *cmdhdr, cJSON **hdrs, size_t nhdrs,
+                               const ZeroSizeBuffer *contig_hist)
+{
+  size_t i, n = spill->paths.len;
+  GPathReader *pfiles = ctx_calloc(n, sizeof(GPathReader));
+
+  status("Merging %zu spilled link files", n);
+
+  for(i = 0; i < n; i++)
+    gpath_reader_open(&pfiles[i], spill->paths.b[i]);
+
+  gpath_save_merge_sorted(fout, path, pfiles, n, "thread", cmdhdr,
+                          hdrs, nhdrs, contig_hist, 1);
+
+  for(i = 0; i < n; i++) {
+    gpath_reader_close(&pfiles[i]);
+    if(unlink(spill->paths.b[i]) != 0)
+      warn("Cannot remove temporary file: %s", spill->paths.b[i]);
+  }
+  ctx_free(pfiles);
+}
+
 int ctx_thread(int argc, char **argv)
 {
   struct ReadThreadCmdArgs args;
@@ -116,16 +216,33 @@ int ctx_thread(int argc, char **argv)
   // Check each link file only loads one colour
   gpaths_only_for_colour(gpfiles->b, gpfiles->len, 0);
 
+  // Spilled links are removed from the graph, so cannot be used or updated
+  if(args.spill_dir) {
+    if(gpfiles->len > 0)
+      cmd_print_usage("Cannot use --spill with --paths or --append");
+    if(args.use_new_paths)
+      cmd_print_usage("Cannot use --spill with --use-new-paths");
+    if(gpath_reader_is_bin(args.out_ctp_path))
+      cmd_print_usage("--spill cannot write a binary link file (.ctp.bin)");
+  }
+
+  // Counts of loaded links would not be updated until they pass the filter
+  bool filter_links = (args.min_link_count > 1);
+  if(filter_links && gpfiles->len > 0)
+    cmd_print_usage("Cannot use --min-link-count with --paths or --append");
+
   //
   // Decide on memory
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem, total_mem;
-  size_t path_hash_mem, path_store_mem, path_mem;
+  size_t path_hash_mem, path_store_mem, path_mem, sketch_mem = 0;
   bool sep_path_list = (!args.use_new_paths && gpfiles->len > 0);
 
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 + sizeof(GPath*)*8 +
                   2 * args.nthreads; // Have traversed
 
+  if(args.unitig_map) bits_per_kmer += READ_THREAD_UNITIG_MAP_BITS;
+
   // false -> don't use mem_to_use to decide how many kmers to store in hash
   // since we need some of that memory for storing paths
   kmers_in_hash = cmd_get_kmers_in_hash(args.memargs.mem_to_use,
@@ -148,6 +265,14 @@ int ctx_thread(int argc, char **argv)
   }
 
   path_mem = args.memargs.mem_to_use - graph_mem;
+
+  // Sketch for counting links before they are stored
+  if(filter_links) {
+    sketch_mem = path_mem / 8;
+    path_mem -= sketch_mem;
+    cmd_print_mem(sketch_mem, "links filter");
+  }
+
   size_t pentry_hash_mem = sizeof(GPEntry)/0.7;
   size_t pentry_store_mem = sizeof(GPath) + 8 + // struct + sequence
                             1 + // in colour
@@ -160,13 +285,15 @@ int ctx_thread(int argc, char **argv)
   cmd_print_mem(path_hash_mem, "paths hash");
   cmd_print_mem(path_store_mem, "paths store");
 
-  total_mem = graph_mem + path_mem;
+  total_mem = graph_mem + path_mem + sketch_mem;
   cmd_check_mem_limit(args.memargs.mem_to_use, total_mem);
 
   //
   // Open output file
   //
-  gzFile gzout = futil_gzopen_create(args.out_ctp_path, "w");
+  // Binary link files (.ctp.bin) and gzip text are both written by gpath_save()
+  // Not truncated until links are loaded, since it may be the --append file
+  futil_create_output(args.out_ctp_path);
 
   status("Creating paths file: %s", futil_outpath_str(args.out_ctp_path));
 
@@ -185,7 +312,9 @@ int ctx_thread(int argc, char **argv)
                     0, path_store_mem, true, sep_path_list);
 
   // Create path hash table for fast lookup
-  gpath_hash_alloc(&db_graph.gphash, &db_graph.gpstore, path_hash_mem);
+  // Store is a fixed size, so there is no memory to grow the hash into
+  gpath_hash_alloc2(&db_graph.gphash, &db_graph.gpstore,
+                    path_hash_mem, path_hash_mem);
 
   if(args.use_new_paths) {
     status("Using paths as they are added (risky)");
@@ -199,6 +328,26 @@ int ctx_thread(int argc, char **argv)
   GenPathWorker *workers;
   workers = gen_paths_workers_alloc(args.nthreads, &db_graph);
 
+  size_t output_threads = MIN2(args.nthreads, MAX_IO_THREADS);
+
+  ThreadSpill spill = {.dir = args.spill_dir, .id = rand() & ((1<<20)-1),
+                       .nthreads = output_threads};
+  char_ptr_buf_alloc(&spill.paths, 16);
+
+  if(args.spill_dir) {
+    status("Spilling links to %s when link memory is full", args.spill_dir);
+    gen_paths_workers_set_spill(workers, args.nthreads,
+                                thread_spill_links, &spill);
+  }
+
+  GPathSketch sketch;
+  if(filter_links) {
+    status("Only storing links once seen %i times", (int)args.min_link_count);
+    gpath_sketch_alloc(&sketch, sketch_mem);
+    gen_paths_workers_set_filter(workers, args.nthreads,
+                                 &sketch, args.min_link_count);
+  }
+
   // Path statistics
   SeqLoadingStats *load_stats = gen_paths_get_stats(workers);
   CorrectAlnStats *aln_stats = gen_paths_get_aln_stats(workers);
@@ -214,15 +363,20 @@ int ctx_thread(int argc, char **argv)
   // Setup for loading graphs graph
   // Don't set gprefs.empty_colours => we've already loaded paths
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = args.nthreads;
 
   // Load graph, print stats, close file
   graph_load(gfile, gprefs, NULL);
   hash_table_print_stats_brief(&db_graph.ht);
   graph_file_close(gfile);
 
+  UnitigMap umap;
+  if(args.unitig_map) read_thread_unitig_map(&umap, &db_graph, args.nthreads);
+
   // Load existing paths
   for(i = 0; i < gpfiles->len; i++)
-    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load_mt(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS,
+                         args.nthreads, &db_graph);
 
   // zero link counts of already loaded links
   if(args.zero_link_counts) {
@@ -230,9 +384,16 @@ int ctx_thread(int argc, char **argv)
     gpath_set_zero_nseen(&db_graph.gpstore.gpset);
   }
 
+  if(args.append_ctp_path) {
+    status("Appending to %zu links in %s", (size_t)db_graph.gpstore.num_paths,
+           args.append_ctp_path);
+  }
+
   if(!args.use_new_paths)
     gpath_store_split_read_write(&db_graph.gpstore);
 
+  FILE *fout = futil_fopen(args.out_ctp_path, "w");
+
   // Deal with a set of files at once
   // Can have different numbers of inputs vs threads
   size_t start, end;
@@ -251,14 +412,16 @@ int ctx_thread(int argc, char **argv)
                          args.dump_frag_sizes,
                          hash_table_nkmers(&db_graph.ht));
 
+  // Links still in memory go in a final spill file
+  if(spill.paths.len > 0)
+    thread_spill_links(&db_graph, &spill);
+
   // Don't need GPathHash anymore
   gpath_hash_dealloc(&db_graph.gphash);
 
   cJSON **hdrs = ctx_malloc(gpfiles->len * sizeof(cJSON*));
   for(i = 0; i < gpfiles->len; i++) hdrs[i] = gpfiles->b[i].json;
 
-  size_t output_threads = MIN2(args.nthreads, MAX_IO_THREADS);
-
   // Generate a cJSON header for all inputs
   cJSON *thread_hdr = cJSON_CreateObject();
   cJSON *inputs_hdr = cJSON_CreateArray();
@@ -267,20 +430,35 @@ int ctx_thread(int argc, char **argv)
     cJSON_AddItemToArray(inputs_hdr, correct_aln_input_json_hdr(&inputs->b[i]));
 
   // Write output file
-  gpath_save(gzout, args.out_ctp_path, output_threads, true,
-             "thread", thread_hdr, hdrs, gpfiles->len,
-             &aln_stats->contig_histgrm, 1,
-             &db_graph);
+  if(spill.paths.len > 0) {
+    thread_spill_merge(&spill, fout, args.out_ctp_path, thread_hdr,
+                       hdrs, gpfiles->len, &aln_stats->contig_histgrm);
+  } else {
+    gpath_save(fout, args.out_ctp_path, output_threads, true, args.sort_kmers,
+               "thread", thread_hdr, hdrs, gpfiles->len,
+               &aln_stats->contig_histgrm, 1,
+               &db_graph);
+  }
 
-  gzclose(gzout);
+  futil_fclose(fout);
   ctx_free(hdrs);
 
+  for(i = 0; i < spill.paths.len; i++) ctx_free(spill.paths.b[i]);
+  char_ptr_buf_dealloc(&spill.paths);
+
+  if(filter_links) gpath_sketch_dealloc(&sketch);
+
   // Optionally run path checks for debugging
   // gpath_checks_all_paths(&db_graph, args.nthreads);
 
   // ins_gap, err_gap no longer allocated after this line
   gen_paths_workers_dealloc(workers, args.nthreads);
 
+  if(args.unitig_map) {
+    db_graph.umap = NULL;
+    unitig_map_dealloc(&umap);
+  }
+
   // Close and free input files etc.
   read_thread_args_dealloc(&args);
   db_graph_dealloc(&db_graph);
@@ -20,6 +20,7 @@ const char uniqkmers_usage[] =
 "  -o, --out <bub.fa>      Output file [default: STDOUT]\n"
 "  -m, --memory <mem>      Memory to use\n"
 "  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>       Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 //
 "  -k, --kmer <K>          Kmer size (required if only giving --seq input)\n"
 "  -g, --graph <in.ctx>    Load kmers from the graph file\n"
@@ -169,6 +170,131 @@ static inline void _add_uniq_flanks(read_t *r, const char *path,
     die("Unknown format: %i", (int)fmt);
 }
 
+//
+// Generating random unique kmers in parallel
+//
+// Each thread takes ranges of output kmers and fills them from its own random
+// number generator. Candidates are made in batches, those in the loaded graph
+// are dropped with the kmer filter, then the rest are reserved in the hash
+// table with a batched find-or-insert. A candidate is unique if it was not
+// already in the table, whoever else is inserting at the same time. Output is
+// collected per thread and written under a lock once per range.
+//
+
+#define UNIQ_BATCH 256
+#define UNIQ_RANGE 4096
+#define UNIQ_MAX_FAILED_BATCHES 1000
+
+// Only build the kmer filter if random kmers often hit the graph, i.e. the
+// graph holds at least 1/64 of all kmer keys
+#define UNIQ_FILTER_MIN_FRAC 64
+
+typedef struct
+{
+  uint64_t rng;
+  StrBuf sbuf;
+} UniqKmersThread;
+
+typedef struct
+{
+  dBGraph *db_graph;
+  UniqKmersThread *threads;
+  FILE *fout;
+  pthread_mutex_t outlock;
+} UniqKmers;
+
+static bool _uniq_kmers_range(size_t start, size_t end, size_t threadid,
+                              void *arg)
+{
+  UniqKmers *uk = (UniqKmers*)arg;
+  UniqKmersThread *th = &uk->threads[threadid];
+  dBGraph *db_graph = uk->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  const KmerBloom *filter = db_graph->ht.filter;
+  BinaryKmer bkeys[UNIQ_BATCH];
+  hkey_t hkeys[UNIQ_BATCH];
+  bool found[UNIQ_BATCH], has[UNIQ_BATCH];
+  char bkmerstr[MAX_KMER_SIZE+1];
+  size_t i, n, m, next = start, nfailed = 0;
+
+  while(next < end)
+  {
+    n = MIN2(end - next, UNIQ_BATCH);
+    for(i = 0; i < n; i++) {
+      bkeys[i] = binary_kmer_random_r(kmer_size, &th->rng);
+      bkeys[i] = binary_kmer_get_key(bkeys[i], kmer_size);
+    }
+
+    // Drop kmers already in the graph
+    if(filter != NULL) {
+      kmer_bloom_has_batch(filter, bkeys, n, HT_PREFETCH_DEPTH, has);
+      for(i = m = 0; i < n; i++)
+        if(!has[i]) bkeys[m++] = bkeys[i];
+      n = m;
+    }
+
+    hash_table_find_or_insert_batch_mt(&db_graph->ht, bkeys, n,
+                                       HT_PREFETCH_DEPTH, hkeys, found,
+                                       db_graph->bktlocks);
+
+    for(i = m = 0; i < n; i++) {
+      if(!found[i]) {
+        binary_kmer_to_str(bkeys[i], kmer_size, bkmerstr);
+        strbuf_sprintf(&th->sbuf, ">kmer%zu\n%s\n", next++, bkmerstr);
+        m++;
+      }
+    }
+
+    if(m > 0) nfailed = 0;
+    else if(++nfailed == UNIQ_MAX_FAILED_BATCHES)
+      die("Generated %zu kmers but couldn't find a unique binary kmer",
+          (size_t)UNIQ_BATCH * UNIQ_MAX_FAILED_BATCHES);
+  }
+
+  pthread_mutex_lock(&uk->outlock);
+  if(fwrite(th->sbuf.b, 1, th->sbuf.end, uk->fout) != th->sbuf.end)
+    die("Cannot write output");
+  pthread_mutex_unlock(&uk->outlock);
+  strbuf_reset(&th->sbuf);
+
+  return false; // keep going
+}
+
+static void uniq_kmers_generate(dBGraph *db_graph, size_t num_uniqkmers,
+                                size_t nthreads, FILE *fout)
+{
+  if(num_uniqkmers == 0) return;
+
+  const size_t kmer_size = db_graph->kmer_size;
+  size_t i;
+
+  if(kmer_size < 32 && db_graph->ht.num_kmers > 0 &&
+     db_graph->ht.num_kmers >= (1UL << (2*kmer_size-1)) / UNIQ_FILTER_MIN_FRAC)
+  {
+    hash_table_filter_build(&db_graph->ht);
+  }
+
+  UniqKmers uk = {.db_graph = db_graph, .fout = fout};
+  uk.threads = ctx_calloc(nthreads, sizeof(UniqKmersThread));
+  pthread_mutex_init(&uk.outlock, NULL);
+
+  // Seed each thread's generator from rand(), seeded by seed_random()
+  for(i = 0; i < nthreads; i++) {
+    uk.threads[i].rng = ((uint64_t)(rand() & 0xffff) << 48) |
+                        ((uint64_t)(rand() & 0xffff) << 32) |
+                        ((uint64_t)(rand() & 0xffff) << 16) |
+                         (uint64_t)(rand() & 0xffff) | 1;
+    strbuf_alloc(&uk.threads[i].sbuf, 1024);
+  }
+
+  util_run_ranges(num_uniqkmers, UNIQ_RANGE, nthreads, _uniq_kmers_range, &uk);
+
+  for(i = 0; i < nthreads; i++) strbuf_dealloc(&uk.threads[i].sbuf);
+  ctx_free(uk.threads);
+  pthread_mutex_destroy(&uk.outlock);
+  hash_table_filter_free(&db_graph->ht);
+}
+
 int ctx_uniqkmers(int argc, char **argv)
 {
   size_t nthreads = 0;
@@ -292,6 +418,7 @@ int ctx_uniqkmers(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < gfilebuf.len; i++) {
@@ -309,10 +436,6 @@ int ctx_uniqkmers(int argc, char **argv)
   if(sfilebuf.len > 0 || flankbuf.len > 0)
     hash_table_print_stats(&db_graph.ht);
 
-  // Print random kmers
-  BinaryKmer bkmer;
-  char bkmerstr[MAX_KMER_SIZE+1];
-
   seq_format fmt = SEQ_FMT_FASTA;
 
   // Add random kmers to flank input sequences
@@ -339,14 +462,7 @@ int ctx_uniqkmers(int argc, char **argv)
   }
 
   // Generate random kmers not in the graph
-  char sname[100];
-  for(i = 0; i < num_uniqkmers; i++)
-  {
-    db_graph_add_random_node(&db_graph, &bkmer);
-    binary_kmer_to_str(bkmer, kmer_size, bkmerstr);
-    sprintf(sname, ">kmer%zu", i);
-    seqout_print_strs(sname, bkmerstr, kmer_size, NULL, 0, fmt, fout);
-  }
+  uniq_kmers_generate(&db_graph, num_uniqkmers, nthreads, fout);
 
   char num_kmers_str[100];
   ulong_to_str(num_uniqkmers, num_kmers_str);
@@ -9,6 +9,7 @@
 #include "graphs_load.h"
 #include "gpath_checks.h"
 #include "unitig_graph.h"
+#include "compact_graph.h"
 
 const char unitigs_usage[] =
 "usage: "CMD" unitigs [options] <in.ctx> [<in2.ctx> ...]\n"
@@ -27,6 +28,9 @@ const char unitigs_usage[] =
 "  -g, --gfa             Print in Graphical Fragment Assembly (GFA) format\n"
 "  -d, --dot             Print in graphviz (DOT) format\n"
 "  -P, --points          Used with --dot, print contigs as points\n"
+"  -I, --index <out.uidx> Save unitig index for the graph (e.g. <in.ctx>.uidx)\n"
+"  -L, --relayout        Store kmers of each unitig next to each other in memory\n"
+"                        before printing. Uses ~16 bytes per kmer.\n"
 "\n"
 "  e.g. "CMD" unitigs --dot in.ctx | dot -Tpdf > in.pdf\n"
 "\n";
@@ -45,6 +49,8 @@ static struct option longopts[] =
   {"gfa",          no_argument,       NULL, 'g'},
   {"dot",          no_argument,       NULL, 'd'},
   {"points",       no_argument,       NULL, 'P'},
+  {"index",        required_argument, NULL, 'I'},
+  {"relayout",     no_argument,       NULL, 'L'},
   {NULL, 0, NULL, 0}
 };
 
@@ -183,29 +189,6 @@ void unitig_printer_destroy(UnitigPrinter *printer)
   ctx_free(printer->visited);
 }
 
-static void print_unitig_fasta(dBNodeBuffer nbuf, size_t threadid, void *arg)
-{
-  (void)threadid;
-  UnitigPrinter *p = (UnitigPrinter*)arg;
-
-  // get edges as string
-  char prev[5], next[5];
-  prev[0] = next[0] = '\0';
-  Edges e0 = db_node_edges(p->db_graph, nbuf.b[0].key, 0);
-  Edges en = db_node_edges(p->db_graph, nbuf.b[nbuf.len-1].key, 0);
-  e0 = edges_with_orientation(e0, !nbuf.b[0].orient);
-  en = edges_with_orientation(en, nbuf.b[nbuf.len-1].orient);
-  edges_get_str(rev_nibble_lookup(e0), prev);
-  edges_get_str(en, next);
-
-  pthread_mutex_lock(&p->outlock);
-  size_t idx = p->num_unitigs++;
-  fprintf(p->fout, ">unitig%zu prev=%s next=%s\n", idx, prev, next);
-  db_nodes_print(nbuf.b, nbuf.len, p->db_graph, p->fout);
-  fputc('\n', p->fout);
-  pthread_mutex_unlock(&p->outlock);
-}
-
 static void print_unitig_dot(const dBNode *nodes, size_t num_nodes,
                              size_t unitig_idx, void *arg)
 {
@@ -236,27 +219,21 @@ static void print_dot_syntax(UnitigPrinter *p, bool dot_use_points)
 }
 
 
-static void print_unitig_gfa(const dBNode *nodes, size_t num_nodes,
-                             size_t unitig_idx, void *arg)
-{
-  UnitigPrinter *p = (UnitigPrinter*)arg;
-  pthread_mutex_lock(&p->outlock);
-  fprintf(p->fout, "S\tnode%zu\t", unitig_idx);
-  db_nodes_print(nodes, num_nodes, p->db_graph, p->fout);
-  fputc('\n', p->fout);
-  pthread_mutex_unlock(&p->outlock);
-}
-
-static void print_gfa_syntax(UnitigPrinter *p)
+// Write FASTA or GFA from a compacted graph. Unitigs are numbered from the
+// index and formatted in parallel, output is in unitig id order.
+static void print_indexed_syntax(UnitigPrinter *p, const UnitigIndex *uidx)
 {
-  fputs("H\tVN:Z:1.0\n", p->fout);
+  CompactGraph cgraph;
+  cgraph_alloc(&cgraph, uidx);
+  cgraph_build(&cgraph, p->nthreads);
 
-  unitig_graph_create(&p->ugraph, p->nthreads, p->visited,
-                      print_unitig_gfa, p);
+  if(p->syntax == PRINT_FASTA)
+    cgraph_write_fasta(&cgraph, p->nthreads, p->fout);
+  else
+    cgraph_write_gfa(&cgraph, p->nthreads, p->fout);
+  p->num_unitigs = cgraph_num_unitigs(&cgraph);
 
-  p->num_unitigs = p->ugraph.num_unitigs;
-  // Now print edges
-  hash_table_iterate(&p->db_graph->ht, p->nthreads, print_edges, p);
+  cgraph_dealloc(&cgraph);
 }
 
 // Returns 0 on success, otherwise != 0
@@ -264,9 +241,9 @@ int ctx_unitigs(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *out_path = NULL;
+  const char *out_path = NULL, *index_path = NULL;
   UnitigSyntax syntax = PRINT_FASTA;
-  bool dot_use_points = false;
+  bool dot_use_points = false, relayout = false;
 
   // Arg parsing
   char cmd[100];
@@ -291,6 +268,8 @@ int ctx_unitigs(int argc, char **argv)
       case 'g': cmd_check(!syntax, cmd); syntax = PRINT_GFA; break;
       case 'd': cmd_check(!syntax, cmd); syntax = PRINT_DOT; break;
       case 'P': cmd_check(!dot_use_points, cmd); dot_use_points = true; break;
+      case 'I': cmd_check(!index_path, cmd); index_path = optarg; break;
+      case 'L': cmd_check(!relayout, cmd); relayout = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         die("`"CMD" unitigs -h` for help. Bad option: %s", argv[optind-1]);
@@ -328,7 +307,11 @@ int ctx_unitigs(int argc, char **argv)
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 + 1;
-  if(syntax != PRINT_FASTA) bits_per_kmer += sizeof(UnitigEnd) * 8;
+  if(syntax == PRINT_DOT) bits_per_kmer += sizeof(UnitigEnd) * 8;
+  if(syntax != PRINT_DOT) bits_per_kmer += 2; // compacted sequence
+  if(syntax != PRINT_DOT || index_path != NULL)
+    bits_per_kmer += UNITIG_INDEX_BITS_PER_KMER;
+  if(relayout) bits_per_kmer += HT_RELAYOUT_BYTES * 8;
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
@@ -349,6 +332,7 @@ int ctx_unitigs(int argc, char **argv)
 
   // Print to stdout unless --out <out> is specified
   FILE *fout = futil_fopen_create(out_path, "w");
+  FILE *fidx = index_path ? futil_fopen_create(index_path, "w") : NULL;
 
   //
   // Allocate memory
@@ -360,11 +344,12 @@ int ctx_unitigs(int argc, char **argv)
   UnitigPrinter printer;
   unitig_printer_init(&printer, &db_graph, nthreads, syntax, fout);
 
-  if(syntax == PRINT_DOT || syntax == PRINT_GFA)
+  if(syntax == PRINT_DOT)
     unitig_graph_alloc(&printer.ugraph, &db_graph);
 
   // Load graphs
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   for(i = 0; i < num_gfiles; i++) {
     file_filter_flatten(&gfiles[i].fltr, 0);
@@ -375,21 +360,28 @@ int ctx_unitigs(int argc, char **argv)
 
   hash_table_print_stats(&db_graph.ht);
 
-  switch(syntax)
-  {
-    case PRINT_FASTA:
-      status("Printing unitgs in FASTA using %zu threads", nthreads);
-      db_unitigs_iterate(nthreads, printer.visited, &db_graph,
-                         print_unitig_fasta, &printer);
-      break;
-    case PRINT_GFA:
-      print_gfa_syntax(&printer);
-      break;
-    case PRINT_DOT:
-      print_dot_syntax(&printer, dot_use_points);
-      break;
-    default:
-      die("Invalid print syntax: %i", syntax);
+  if(relayout) {
+    db_unitigs_relayout(&db_graph, nthreads, printer.visited);
+    memset(printer.visited, 0, roundup_bits2bytes(db_graph.ht.capacity));
+  }
+
+  // FASTA, GFA and --index share one unitig index
+  UnitigIndex uidx;
+  bool use_index = (syntax != PRINT_DOT || fidx != NULL);
+
+  if(syntax == PRINT_DOT)
+    print_dot_syntax(&printer, dot_use_points);
+
+  if(use_index) {
+    unitig_index_alloc(&uidx, &db_graph);
+    memset(printer.visited, 0, roundup_bits2bytes(db_graph.ht.capacity));
+    unitig_index_build(&uidx, nthreads, printer.visited);
+  }
+
+  if(syntax != PRINT_DOT) {
+    status("Printing unitigs in %s using %zu threads",
+           syntax_strs[syntax], nthreads);
+    print_indexed_syntax(&printer, &uidx);
   }
 
   char num_unitigs_str[50];
@@ -398,6 +390,15 @@ int ctx_unitigs(int argc, char **argv)
 
   fclose(fout);
 
+  if(fidx != NULL)
+  {
+    status("Saving unitig index to: %s", futil_outpath_str(index_path));
+    unitig_index_write(&uidx, fidx, index_path);
+    fclose(fidx);
+  }
+
+  if(use_index) unitig_index_dealloc(&uidx);
+
   unitig_printer_destroy(&printer);
   db_graph_dealloc(&db_graph);
 
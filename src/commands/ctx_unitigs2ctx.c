@@ -0,0 +1,160 @@
+#include "global.h"
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "db_graph.h"
+#include "graph_writer.h"
+#include "unitig_load.h"
+
+const char unitigs2ctx_usage[] =
+"usage: "CMD" unitigs2ctx [options] -o <out.ctx> <in.gfa|in.fa> [...]\n"
+"\n"
+"  Build a single colour graph from unitigs, e.g. the output of `"CMD" unitigs`\n"
+"  after filtering. Much faster than `build` as every kmer is known to occur\n"
+"  once: kmers are inserted without being looked up first and the edges within\n"
+"  each unitig are set directly. Edges between unitigs come from GFA links,\n"
+"  FASTA prev=/next= fields or BCALM L:+:<id>:- tags. Coverage is taken from\n"
+"  KC:i:<sum> or km:f:<mean> tags, otherwise every kmer has coverage 1.\n"
+"\n"
+"  -h, --help               This help message\n"
+"  -q, --quiet              Silence status output normally printed to STDERR\n"
+"  -f, --force              Overwrite output files\n"
+"  -m, --memory <mem>       Memory to use\n"
+"  -n, --nkmers <kmers>     Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -k, --kmer <kmer>        Kmer size [default: from GFA link overlaps]\n"
+"  -s, --sample <name>      Sample name [default: undefined]\n"
+"  -o, --out <out.ctx>      Output graph file [required]\n"
+"  -S, --sort               Output a graph file ordered by kmer\n"
+"  -z, --compress           Write a block compressed graph (format version 7)\n"
+"\n"
+"  Input must not have any kmer twice (in either orientation).\n"
+"\n";
+
+static struct option longopts[] =
+{
+// General options
+  {"help",         no_argument,       NULL, 'h'},
+  {"force",        no_argument,       NULL, 'f'},
+  {"memory",       required_argument, NULL, 'm'},
+  {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
+  {"kmer",         required_argument, NULL, 'k'},
+  {"sample",       required_argument, NULL, 's'},
+  {"out",          required_argument, NULL, 'o'},
+  {"sort",         no_argument,       NULL, 'S'},
+  {"compress",     no_argument,       NULL, 'z'},
+  {NULL, 0, NULL, 0}
+};
+
+int ctx_unitigs2ctx(int argc, char **argv)
+{
+  struct MemArgs memargs = MEM_ARGS_INIT;
+  size_t nthreads = 0, kmer_size = 0;
+  const char *out_path = NULL, *sample_name = NULL;
+  bool sort_kmers = false;
+  size_t i;
+
+  // Arg parsing
+  char cmd[100], shortopts[300];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    cmd_get_longopt_str(longopts, c, cmd, sizeof(cmd));
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
+      case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads,cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'k': cmd_check(!kmer_size,cmd); kmer_size = cmd_kmer_size(cmd, optarg); break;
+      case 's': cmd_check(!sample_name,cmd); sample_name = optarg; break;
+      case 'o': cmd_check(!out_path,cmd); out_path = optarg; break;
+      case 'S': cmd_check(!sort_kmers,cmd); sort_kmers = true; break;
+      case 'z':
+        cmd_check(graph_writer_get_version() != CTX_GRAPH_FILEFORMAT_BLOCKS, cmd);
+        graph_writer_set_version(CTX_GRAPH_FILEFORMAT_BLOCKS);
+        break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        die("`"CMD" unitigs2ctx -h` for help. Bad option: %s", argv[optind-1]);
+      default: die("Bad option: %s", cmd);
+    }
+  }
+
+  if(!nthreads) nthreads = DEFAULT_NTHREADS;
+  graph_writer_set_nthreads(nthreads);
+
+  if(optind >= argc) cmd_print_usage("Please give unitig files");
+  if(out_path == NULL) cmd_print_usage("--out <out.ctx> is required");
+  if(futil_check_outfile(out_path)) die("Use -f,--force to overwrite files");
+
+  //
+  // Read unitigs
+  //
+  UnitigSet us;
+  unitig_set_alloc(&us);
+
+  size_t phase = ctx_stats_phase_start("read");
+  for(i = optind; i < (size_t)argc; i++) unitig_set_read(&us, argv[i]);
+  unitig_set_finish(&us, kmer_size);
+  ctx_stats_phase_end(phase);
+
+  kmer_size = us.kmer_size;
+  db_graph_check_kmer_size(kmer_size, argv[optind]);
+
+  char nkstr[50], nustr[50];
+  status("[unitigs2ctx] k=%zu %s unitigs, %s kmers, %zu links", kmer_size,
+         ulong_to_str(us.num_unitigs, nustr), ulong_to_str(us.num_kmers, nkstr),
+         us.links.len);
+
+  //
+  // Decide on memory, we know exactly how many kmers there are
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+
+  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
+                  sizeof(CovgStore)*8 + 1; // 1 bit for in colour
+
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+                                        memargs.mem_to_use_set,
+                                        memargs.num_kmers,
+                                        memargs.num_kmers_set,
+                                        bits_per_kmer,
+                                        us.num_kmers, us.num_kmers,
+                                        true, &graph_mem);
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, kmer_size, 1, 1, kmers_in_hash,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                 DBG_ALLOC_BKTLOCKS);
+
+  if(sample_name != NULL) strbuf_set(&db_graph.ginfo[0].sample_name, sample_name);
+
+  //
+  // Load
+  //
+  phase = ctx_stats_phase_start("load");
+  unitig_set_load(&us, &db_graph, 0, nthreads);
+  ctx_stats_phase_end(phase);
+
+  unitig_set_dealloc(&us);
+
+  hash_table_print_stats(&db_graph.ht);
+
+  //
+  // Save
+  //
+  status("Dumping graph...\n");
+  phase = ctx_stats_phase_start("save");
+  graph_writer_save_mkhdr(out_path, &db_graph, sort_kmers, 1);
+  ctx_stats_phase_end(phase);
+
+  db_graph_dealloc(&db_graph);
+
+  return EXIT_SUCCESS;
+}
@@ -4,7 +4,9 @@
 #include "file_util.h"
 #include "db_graph.h"
 #include "graphs_load.h"
+#include "graph_shm.h"
 #include "gpath_checks.h"
+#include "db_node.h"
 
 #include "vcf_coverage.h"
 #include "vcf_misc.h"
@@ -16,6 +18,7 @@
 
 const char vcfcov_usage[] =
 "usage: "CMD" "SUBCMD" [options] <in.vcf> <in.ctx> [in2.ctx ...]\n"
+"       "CMD" "SUBCMD" [options] --graph-shm <name> <in.vcf>\n"
 "\n"
 "  Add coverage to a VCF using cortex graphs. It is recommended to use\n"
 "  uncleaned graphs. The VCF must be sorted by position, with duplicates removed\n"
@@ -26,6 +29,7 @@ const char vcfcov_usage[] =
 "  -f, --force            Overwrite output files\n"
 "  -m, --memory <mem>     Memory to use\n"
 "  -n, --nkmers <kmers>   Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>      Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -o, --out <out.vcf>    Output file [default: STDOUT]\n"
 "  -O, --out-fmt <f>      Format vcf|vcfgz|bcf|ubcf\n"
 "  -r, --ref <ref.fa>     Reference file [required]\n"
@@ -33,6 +37,14 @@ const char vcfcov_usage[] =
 "  -N, --max-nvars <N>    Limit haplotypes to <= N variants [default: "QUOTE_VALUE(DEFAULT_MAX_GT_VARS)"]\n"
 "  -M, --low-mem          Two-passes of VCF to only load needed kmers [default]\n"
 "  -H, --high-mem         One-pass of VCF, all kmers loaded (when streaming VCF)\n"
+"  -G, --graph-shm <name> Use a graph in shared memory instead of files (see load)\n"
+"  -B, --kmer-filter      Check kmers against a Bloom filter of the graph first.\n"
+"                         Faster when most kmers are not in the graph (--high-mem).\n"
+"                         Uses 16-32 more bits of memory per kmer.\n"
+"  -S, --sorted           Graphs are sorted (build/join --sort). With --low-mem,\n"
+"                         fetch only the kmers needed from block compressed\n"
+"                         graphs (--compress) instead of reading whole files.\n"
+"                         Sample kmer coverage is then left out of the header.\n"
 "\n";
 
 static struct option longopts[] =
@@ -44,24 +56,87 @@ static struct option longopts[] =
   {"force",        no_argument,       NULL, 'f'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
   {"ref",          required_argument, NULL, 'r'},
   {"max-var-len",  required_argument, NULL, 'L'},
   {"max-nvars",    required_argument, NULL, 'N'},
   {"low-mem",      no_argument,       NULL, 'M'},
   {"high-mem",     no_argument,       NULL, 'H'},
+  {"graph-shm",    required_argument, NULL, 'G'},
+  {"kmer-filter",  no_argument,       NULL, 'B'},
+  {"sorted",       no_argument,       NULL, 'S'},
   {NULL, 0, NULL, 0}
 };
 
 char kcov_ref_tag[10], kcov_alt_tag[10];
 
+// Number of kmers and sum of coverage per colour, for a graph that was not
+// loaded from files (--graph-shm)
+static void graph_covg_stats(const dBGraph *db_graph, GraphLoadingStats *stats)
+{
+  size_t col, ncols = db_graph->num_of_cols;
+  hkey_t hkey;
+  Covg covg;
+
+  graph_loading_stats_capacity(stats, ncols);
+
+  for(hkey = 0; hkey < db_graph->ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(db_graph, hkey)) continue;
+    stats->nkmers_read++;
+    for(col = 0; col < ncols; col++) {
+      if((covg = db_node_get_covg(db_graph, hkey, col)) > 0) {
+        stats->nkmers[col]++;
+        stats->sumcov[col] += covg;
+      }
+    }
+  }
+}
+
+// Open graph files and allocate a graph for them, without loading them
+static void graph_files_alloc(dBGraph *db_graph, GraphFileReader *gfiles,
+                              char **graph_paths, size_t num_gfiles,
+                              bool low_mem, const struct MemArgs *memargs)
+{
+  size_t ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+
+  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
+                           &ctx_max_kmers, &ctx_sum_kmers);
+
+  // Check graph + paths are compatible
+  graphs_gpaths_compatible(gfiles, num_gfiles, NULL, 0, -1);
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+
+  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(CovgStore)*8 * ncols;
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs->mem_to_use,
+                                        memargs->mem_to_use_set,
+                                        memargs->num_kmers,
+                                        memargs->num_kmers_set,
+                                        bits_per_kmer,
+                                        low_mem ? -1 : (int64_t)ctx_max_kmers,
+                                        ctx_sum_kmers,
+                                        true, &graph_mem);
+
+  cmd_check_mem_limit(memargs->mem_to_use, graph_mem);
+
+  // Allocate memory
+  db_graph_alloc(db_graph, gfiles[0].hdr.kmer_size, ncols, 1, kmers_in_hash,
+                 DBG_ALLOC_COVGS);
+}
+
 int ctx_vcfcov(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *out_path = NULL, *out_type = NULL;
+  size_t nthreads = 0;
+  const char *out_path = NULL, *out_type = NULL, *graph_shm = NULL;
 
   uint32_t max_allele_len = 0, max_gt_vars = 0;
   char *ref_path = NULL;
-  bool use_lowmem = false, use_himem = false;
+  bool use_lowmem = false, use_himem = false, kmer_filter = false;
+  bool sorted_graphs = false;
 
   // Arg parsing
   char cmd[100];
@@ -83,11 +158,15 @@ int ctx_vcfcov(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'r': cmd_check(!ref_path, cmd); ref_path = optarg; break;
       case 'L': cmd_check(!max_allele_len,cmd); max_allele_len = cmd_uint32(cmd,optarg); break;
       case 'N': cmd_check(!max_gt_vars,cmd); max_gt_vars = cmd_uint32(cmd,optarg); break;
       case 'M': cmd_check(!use_lowmem, cmd); use_lowmem = true; break;
       case 'H': cmd_check(!use_himem, cmd); use_himem = true; break;
+      case 'G': cmd_check(!graph_shm, cmd); graph_shm = optarg; break;
+      case 'B': cmd_check(!kmer_filter, cmd); kmer_filter = true; break;
+      case 'S': cmd_check(!sorted_graphs, cmd); sorted_graphs = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -97,9 +176,13 @@ int ctx_vcfcov(int argc, char **argv)
   }
 
   // Defaults for unset values
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
   if(out_path == NULL) out_path = "-";
   if(ref_path == NULL) cmd_print_usage("Require a reference (-r,--ref <ref.fa>)");
-  if(optind+2 > argc) cmd_print_usage("Require VCF and graph files");
+  if(graph_shm == NULL && optind+2 > argc)
+    cmd_print_usage("Require VCF and graph files");
+  if(graph_shm != NULL && optind+1 != argc)
+    cmd_print_usage("Require a VCF and no graph files with --graph-shm");
 
   if(use_lowmem && use_himem)
     cmd_print_usage("Cannot use --low-mem and --high-mem together!");
@@ -122,16 +205,23 @@ int ctx_vcfcov(int argc, char **argv)
   faidx_t *fai = fai_load(ref_path);
   if(fai == NULL) die("Cannot load ref index: %s / %s.fai", ref_path, ref_path);
 
+  // Input and output share a pool of (de)compression threads
+  htsThreadPool htspool;
+  vcf_misc_pool_alloc(&htspool, nthreads);
+
   // Open input VCF file
   const char *vcf_path = argv[optind++];
   htsFile *vcffh = hts_open(vcf_path, "r");
   if(vcffh == NULL) die("Cannot open VCF file: %s", vcf_path);
+  vcf_misc_pool_attach(&htspool, vcffh);
   bcf_hdr_t *vcfhdr = bcf_hdr_read(vcffh);
   if(vcfhdr == NULL) die("Cannot read VCF header: %s", vcf_path);
 
   // default to low mem if we're not reading from STDIN
+  // A shared graph already has all of its kmers
   bool low_mem = use_lowmem ||
                  (!use_himem && strcmp(vcf_path,"-"));
+  if(graph_shm != NULL) low_mem = false;
 
   // Test we can close and reopen files
   if(low_mem) {
@@ -139,6 +229,7 @@ int ctx_vcfcov(int argc, char **argv)
     bcf_hdr_destroy(vcfhdr);
     if((vcffh = hts_open(vcf_path, "r")) == NULL)
       die("Cannot re-open VCF file: %s", vcf_path);
+    vcf_misc_pool_attach(&htspool, vcffh);
     if((vcfhdr = bcf_hdr_read(vcffh)) == NULL)
       die("Cannot re-read VCF header: %s", vcf_path);
   }
@@ -148,33 +239,16 @@ int ctx_vcfcov(int argc, char **argv)
   //
   const size_t num_gfiles = argc - optind;
   char **graph_paths = argv + optind;
-  ctx_assert(num_gfiles > 0);
-
-  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
-  size_t ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
-
-  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
-                           &ctx_max_kmers, &ctx_sum_kmers);
-
-  // Check graph + paths are compatible
-  graphs_gpaths_compatible(gfiles, num_gfiles, NULL, 0, -1);
-
-  //
-  // Decide on memory
-  //
-  size_t bits_per_kmer, kmers_in_hash, graph_mem;
-
-  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Covg)*8 * ncols;
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
-                                        memargs.mem_to_use_set,
-                                        memargs.num_kmers,
-                                        memargs.num_kmers_set,
-                                        bits_per_kmer,
-                                        low_mem ? -1 : (int64_t)ctx_max_kmers,
-                                        ctx_sum_kmers,
-                                        true, &graph_mem);
+  GraphFileReader *gfiles = NULL;
+  dBGraph db_graph;
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  if(graph_shm != NULL) {
+    graph_shm_attach(graph_shm, &db_graph, DBG_ALLOC_COVGS);
+  } else {
+    gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+    graph_files_alloc(&db_graph, gfiles, graph_paths, num_gfiles,
+                      low_mem, &memargs);
+  }
 
   //
   // Open output file
@@ -183,14 +257,10 @@ int ctx_vcfcov(int argc, char **argv)
   int mode = vcf_misc_get_outtype(out_type, out_path);
   futil_create_output(out_path);
   htsFile *outfh = hts_open(out_path, modes_htslib[mode]);
+  if(outfh == NULL) die("Cannot open output: %s", futil_outpath_str(out_path));
+  vcf_misc_pool_attach(&htspool, outfh);
   status("[vcfcov] Output format: %s", hsmodes_htslib[mode]);
 
-
-  // Allocate memory
-  dBGraph db_graph;
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, ncols, 1, kmers_in_hash,
-                 DBG_ALLOC_COVGS);
-
   //
   // Set up tag names
   //
@@ -218,6 +288,7 @@ int ctx_vcfcov(int argc, char **argv)
                        .kcov_alt_tag = kcov_alt_tag,
                        .max_allele_len = max_allele_len,
                        .max_gt_vars = max_gt_vars,
+                       .nthreads = nthreads,
                        .load_kmers_only = false};
 
   if(low_mem)
@@ -235,6 +306,7 @@ int ctx_vcfcov(int argc, char **argv)
     // Re-open files
     if((vcffh = hts_open(vcf_path, "r")) == NULL)
       die("Cannot re-open VCF file: %s", vcf_path);
+    vcf_misc_pool_attach(&htspool, vcffh);
     if((vcfhdr = bcf_hdr_read(vcffh)) == NULL)
       die("Cannot re-read VCF header: %s", vcf_path);
 
@@ -246,18 +318,37 @@ int ctx_vcfcov(int argc, char **argv)
   //
   GraphLoadingStats gstats;
   memset(&gstats, 0, sizeof(gstats));
+  bool sample_stats = true; // false if graphs were not read in full
 
-  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
-  gprefs.must_exist_in_graph = low_mem;
-
-  for(i = 0; i < num_gfiles; i++) {
-    graph_load(&gfiles[i], gprefs, &gstats);
-    graph_file_close(&gfiles[i]);
+  if(graph_shm != NULL) {
+    graph_covg_stats(&db_graph, &gstats);
+  }
+  else {
+    GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.nthreads = nthreads;
+    gprefs.must_exist_in_graph = low_mem;
+
+    for(i = 0; i < num_gfiles; i++) {
+      // Only read the blocks of sorted files holding kmers from the VCF
+      if(low_mem && sorted_graphs && graph_file_is_blocked(&gfiles[i]) &&
+         !file_filter_isstdin(&gfiles[i].fltr)) {
+        graph_load_sorted_kmers(&gfiles[i], gprefs, &gstats);
+        sample_stats = false;
+      }
+      else {
+        if(low_mem && sorted_graphs)
+          warn("Not block compressed, reading whole file: %s", graph_paths[i]);
+        graph_load(&gfiles[i], gprefs, &gstats);
+      }
+      graph_file_close(&gfiles[i]);
+    }
+    ctx_free(gfiles);
   }
-  ctx_free(gfiles);
 
   hash_table_print_stats(&db_graph.ht);
 
+  if(kmer_filter) hash_table_filter_build(&db_graph.ht);
+
   //
   // Set up VCF header / graph matchup
   //
@@ -280,7 +371,12 @@ int ctx_vcfcov(int argc, char **argv)
     // Add SAMPLE field
     hrec = bcf_hdr_get_hrec(outhdr, BCF_HL_STR, "ID", sname, "SAMPLE");
 
-    if(hrec == NULL) {
+    if(hrec == NULL && !sample_stats) {
+      sprintf(hdrstr, "##SAMPLE=<ID=%s,%s=%zu>", sname,
+              sample_rlk_tag, (size_t)db_graph.ginfo[i].mean_read_length);
+      bcf_hdr_append(outhdr, hdrstr);
+    }
+    else if(hrec == NULL) {
       sprintf(hdrstr, "##SAMPLE=<ID=%s,%s=%"PRIu64",%s=%"PRIu64",%s=%zu>", sname,
               sample_kcov_tag,
               gstats.nkmers[i] ? gstats.sumcov[i] / gstats.nkmers[i] : 0,
@@ -288,6 +384,11 @@ int ctx_vcfcov(int argc, char **argv)
               sample_rlk_tag, (size_t)db_graph.ginfo[i].mean_read_length);
       bcf_hdr_append(outhdr, hdrstr);
     }
+    else if(!sample_stats) {
+      // mean read length in kmers
+      sprintf(hdrstr, "%zu", (size_t)db_graph.ginfo[i].mean_read_length);
+      vcf_misc_add_update_hrec(hrec, sample_rlk_tag, hdrstr);
+    }
     else {
       // mean kcovg
       sprintf(hdrstr, "%"PRIu64, gstats.sumcov[i] / gstats.nkmers[i]);
@@ -359,6 +460,7 @@ int ctx_vcfcov(int argc, char **argv)
   bcf_hdr_destroy(outhdr);
   hts_close(vcffh);
   hts_close(outfh);
+  vcf_misc_pool_dealloc(&htspool);
   fai_destroy(fai);
   db_graph_dealloc(&db_graph);
 
@@ -51,6 +51,7 @@ const char vcfgeno_usage[] =
 "  -l, --llk            Print all log likelihoods\n"
 "  -r, --rm-cov         Remove tags set by 'vcfcov' command\n"
 "  -R, --read-len <R>   List to override read lengths [optional]\n"
+"  -t, --threads <T>    Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "\n"
 "  Notes: \n"
 "  1. Lists are comma-separated. If given a single value it will apply to all colours.\n"
@@ -81,6 +82,7 @@ static struct option longopts[] =
   {"read-len",     required_argument, NULL, 'R'},
   {"llk",          no_argument,       NULL, 'l'},
   {"rm-cov",       no_argument,       NULL, 'r'},
+  {"threads",      required_argument, NULL, 't'},
   {NULL, 0, NULL, 0}
 };
 
@@ -95,7 +97,8 @@ uint64_t num_missing_covgs = 0, num_non_biallelic = 0;
 uint64_t ploidy_seen[3] = {0,0,0}, num_genotypes_printed = 0;
 
 
-#define N_LFAC 1024
+// ln(x!) for coverages below N_LFAC, covers almost all sites
+#define N_LFAC (1<<14)
 double *lnfac_table = NULL; // log natural of x factorial: ln(x!)
 
 static void math_calcs_init()
@@ -113,19 +116,6 @@ static void math_calcs_destroy() {
 
 #define lnfac(x) ((x) < N_LFAC ? lnfac_table[x] : lgamma((x)+1))
 
-// logerr = log(seq_err)
-static double llk_hom(uint64_t covg1, uint64_t covg2, double theta1, double logerr)
-{
-  double logtheta1 = log(theta1); // log(err*theta) = log(err)+log(theta)
-  return covg1 * logtheta1 - theta1 - lnfac(covg1) + covg2 * (logerr + logtheta1);
-}
-
-static double llk_het(uint64_t covg1, uint64_t covg2, double theta1, double theta2)
-{
-  return covg1 * log(theta1/2) - theta1/2 - lnfac(covg1) +
-         covg2 * log(theta2/2) - theta2/2 - lnfac(covg2);
-}
-
 // TODO: update for ploidy > 2, nalts > 2
 // get number of possible genotypes given ploidy
 // assumes ploidy <= 2
@@ -151,176 +141,294 @@ static inline void set_gts_missing(size_t ploidy, size_t nalts,
   }
 }
 
+// Per sample values fixed for the whole run
+typedef struct
+{
+  size_t nsamples, max_ploidy, max_gts, kmer_size;
+  const uint8_t *const* ploidy_mat; // [chrom][sample]
+  const size_t *readlensk; // read length in kmers
+  const double *rates; // kmer coverage / read length in kmers
+  const double *log_rates; // ln(rates)
+  const double *log_errs; // ln(sample_err_rate)
+  bool add_gllks, rm_vcfcov_tags;
+  bcf_hdr_t *hdr;
+} GenoParams;
+
+typedef struct
+{
+  uint64_t num_missing_tags, num_missing_covgs, num_non_biallelic;
+  uint64_t ploidy_seen[3], num_genotypes_printed;
+} GenoStats;
+
+// Buffers for one thread
+typedef struct
+{
+  int32_t *kcovr, *kcova; // ref / alt kmer coverage, one per ALT allele
+  int nkcovr, nkcova;
+  int32_t *gts, *gtquals;
+  float *gllks;
+  double *llks; // [nsamples*3] hom1, het, hom2 per sample
+  GenoStats stats;
+} GenoWorker;
+
+static void geno_worker_alloc(GenoWorker *wrkr, const GenoParams *prms)
+{
+  memset(wrkr, 0, sizeof(*wrkr));
+  wrkr->gts = ctx_calloc(prms->nsamples * prms->max_ploidy, sizeof(int32_t));
+  wrkr->gtquals = ctx_calloc(prms->nsamples, sizeof(int32_t));
+  wrkr->llks = ctx_calloc(prms->nsamples * 3, sizeof(double));
+  if(prms->add_gllks)
+    wrkr->gllks = ctx_calloc(prms->nsamples * prms->max_gts, sizeof(float));
+}
+
+static void geno_worker_dealloc(GenoWorker *wrkr)
+{
+  free(wrkr->kcovr);
+  free(wrkr->kcova);
+  ctx_free(wrkr->gts);
+  ctx_free(wrkr->gtquals);
+  ctx_free(wrkr->llks);
+  ctx_free(wrkr->gllks);
+}
+
 /**
- * Genotype a single sample
+ * Log10 likelihoods of all samples at a biallelic site. Per site values are
+ * computed once, so the loop over samples has no log() calls and ln(x!) comes
+ * from the lookup table.
+ *
+ * theta1 is expected number of reads arriving on ref allele
+ * theta2 is expected number of reads arriving on alt allele
+ *   theta = kcovg * lenk / readlenk = rate * lenk
+ *   ln(theta) = ln(rate) + ln(lenk)
+ **/
+static void genotype_llks_biallelic(const GenoParams *prms, GenoWorker *wrkr,
+                                    const bcf1_t *v)
+{
+  size_t s, nsamples = prms->nsamples;
+  const uint8_t *ploidies = prms->ploidy_mat[v->rid];
+  const int32_t *rcovgs = wrkr->kcovr, *acovgs = wrkr->kcova;
+  double *llks = wrkr->llks;
+
+  // Get rlen, alen in kmers
+  size_t rlen = 0, alen = 0, rshift;
+  rshift = trimmed_alt_lengths(v, 1, &rlen, &alen);
+
+  uint64_t rlenk = hap_num_exp_kmers(v->pos+rshift, rlen, prms->kmer_size);
+  uint64_t alenk = hap_num_exp_kmers(v->pos+rshift, alen, prms->kmer_size);
+  double log_rlenk = log(rlenk), log_alenk = log(alenk);
+
+  for(s = 0; s < nsamples; s++)
+  {
+    // convert kmer coverage to num. of reads arriving, est. read arrival rate
+    size_t readlenk = MAX2(prms->readlensk[s], 1);
+    uint64_t rkcov = (uint64_t)MAX2(rcovgs[s], 0) * rlenk / readlenk;
+    uint64_t akcov = (uint64_t)MAX2(acovgs[s], 0) * alenk / readlenk;
+    double theta1 = prms->rates[s] * rlenk, theta2 = prms->rates[s] * alenk;
+    double logtheta1 = prms->log_rates[s] + log_rlenk;
+    double logtheta2 = prms->log_rates[s] + log_alenk;
+    double lnfac1 = lnfac(rkcov), lnfac2 = lnfac(akcov);
+    double logerr = prms->log_errs[s];
+
+    // given: loc_b(x) = log_a(x) / log_a(b)
+    // divide natural log by ln(10)=M_LN10 to get in log10
+    // log10 is required by the VCFv4.2 standard for the GL tag
+    // log(err*theta) = log(err)+log(theta)
+    llks[s*3+0] = (rkcov * logtheta1 - theta1 - lnfac1 +
+                   akcov * (logerr + logtheta1)) / M_LN10;
+    llks[s*3+1] = ploidies[s] != 2 ? -DBL_MAX :
+                  (rkcov * (logtheta1 - M_LN2) - theta1/2 - lnfac1 +
+                   akcov * (logtheta2 - M_LN2) - theta2/2 - lnfac2) / M_LN10;
+    llks[s*3+2] = (akcov * logtheta2 - theta2 - lnfac2 +
+                   rkcov * (logerr + logtheta2)) / M_LN10;
+  }
+}
+
+/**
+ * Genotype a single sample from its likelihoods
  * param gts sample genotype goes into: gts[0..(ploidy-1)]
- * param rcovgs,acovgs are of length num_alts (fixed to 1 currently)
  * param ploidy is this samples ploidy on the current chromosome
- * param logerr is ln(sample_err_rate)
- * param readlenk is read length in kmers
  **/
-static void genotype_sample_biallelic(bcf1_t *v, size_t sampleid,
+static void genotype_sample_biallelic(const double llk[3],
                                       int32_t *gts, size_t ngts,
                                       float *gllks, size_t ngllks,
-                                      int32_t *gt_qual,
-                                      const int32_t *rcovgs,
-                                      const int32_t *acovgs,
-                                      double kcovg, uint8_t ploidy,
-                                      size_t ksize, double logerr,
-                                      size_t readlenk)
+                                      int32_t *gt_qual, uint8_t ploidy)
 {
+  int order[3] = {0,1,2};
+
   ctx_assert(ploidy <= ngts);
-  ctx_assert(v->n_allele == 2);
 
-  if(rcovgs[0] == bcf_int32_missing || acovgs[0] == bcf_int32_missing)
-  {
-    num_missing_covgs++;
-    set_gts_missing(ploidy, 2, gts, ngts, gllks, ngllks, gt_qual);
-  }
-  else if(ploidy == 0)
-  {
-    set_gts_missing(ploidy, 2, gts, ngts, gllks, ngllks, gt_qual);
+  if(llk[order[0]] > llk[order[1]]) SWAP(order[0], order[1]);
+  if(llk[order[1]] > llk[order[2]]) SWAP(order[1], order[2]);
+  if(llk[order[0]] > llk[order[1]]) SWAP(order[0], order[1]);
+
+  // if haploid: g0, if diploid: g0/g1
+  uint32_t g0 = (order[2] == 2), g1 = (order[2] > 0);
+
+  // set GT quality to be difference between highest and second highest GT llk
+  *gt_qual = (int32_t)(llk[order[2]] - llk[order[1]] + 0.5);
+
+  gts[0] = bcf_gt_unphased(g0);
+  if(ploidy == 2) gts[1] = bcf_gt_unphased(g1);
+  if(ploidy < ngts) gts[ploidy] = bcf_int32_vector_end;
+
+  // ndecplaces(x,100) gets to two decimal places
+  if(gllks) {
+    if(ploidy == 1) {
+      gllks[0] = ndecplaces(llk[0],100);
+      gllks[1] = ndecplaces(llk[2],100);
+      if(ngllks > 2) bcf_float_set_vector_end(gllks[2]);
+    } else {
+      gllks[0] = ndecplaces(llk[0],100);
+      gllks[1] = ndecplaces(llk[1],100);
+      gllks[2] = ndecplaces(llk[2],100);
+      if(ngllks > 3) bcf_float_set_vector_end(gllks[3]);
+    }
   }
-  else
-  {
-    if(!readlenk)
-      die("Read length is zero for sample: %zu", sampleid);
+}
 
-    // Get rlen, alen in kmers
-    size_t rlen = 0, alen = 0, rshift;
-    rshift = trimmed_alt_lengths(v, 1, &rlen, &alen);
+// Genotype all samples at a site and update the record
+// Returns false if the record should be dropped
+static bool genotype_site(const GenoParams *prms, GenoWorker *wrkr, bcf1_t *v)
+{
+  bcf_hdr_t *hdr = prms->hdr;
+  size_t s, nsamples = prms->nsamples, nalts;
+  size_t max_ploidy = prms->max_ploidy, max_gts = prms->max_gts;
+  GenoStats *stats = &wrkr->stats;
+  int a, b;
 
-    uint64_t rlenk = hap_num_exp_kmers(v->pos+rshift, rlen, ksize);
-    uint64_t alenk = hap_num_exp_kmers(v->pos+rshift, alen, ksize);
+  bcf_unpack(v, BCF_UN_ALL);
 
-    // theta1 is expected number of reads arriving on ref allele
-    // theta2 is expected number of reads arriving on alt allele
-    double theta1, theta2;
-    uint64_t rkcov, akcov;
-    double llk[3]; // hom1, het, hom2
-    int order[3] = {0,1,2};
+  if(v->n_allele != 2) { stats->num_non_biallelic++; return false; }
+  nalts = v->n_allele-1;
 
-    // convert kmer coverage to num. of reads arriving, est. read arrival rate
-    theta1 = kcovg * rlenk / readlenk;
-    theta2 = kcovg * alenk / readlenk;
-    rkcov = rcovgs[0] * rlenk / readlenk;
-    akcov = acovgs[0] * alenk / readlenk;
+  // TODO: if add_gllks and nalts > 1, may need to resize gllks
 
-    // given: loc_b(x) = log_a(x) / log_a(b)
-    // llk_*() return natural log, divide by ln(10)=M_LN10 to get in log10
-    // log10 is required by the VCFv4.2 standard for the GL tag
-    llk[0] = llk_hom(rkcov, akcov, theta1, logerr) / M_LN10;
-    llk[1] = ploidy == 2 ? llk_het(rkcov, akcov, theta1, theta2) / M_LN10 : -DBL_MAX;
-    llk[2] = llk_hom(akcov, rkcov, theta2, logerr) / M_LN10;
-
-    if(llk[order[0]] > llk[order[1]]) SWAP(order[0], order[1]);
-    if(llk[order[1]] > llk[order[2]]) SWAP(order[1], order[2]);
-    if(llk[order[0]] > llk[order[1]]) SWAP(order[0], order[1]);
-
-    // if haploid: g0, if diploid: g0/g1
-    uint32_t g0 = (order[2] == 2), g1 = (order[2] > 0);
-
-    // set GT quality to be difference between highest and second highest GT llk
-    *gt_qual = (int32_t)(llk[order[2]] - llk[order[1]] + 0.5);
-
-    gts[0] = bcf_gt_unphased(g0);
-    if(ploidy == 2) gts[1] = bcf_gt_unphased(g1);
-    if(ploidy < ngts) gts[ploidy] = bcf_int32_vector_end;
-
-    // ndecplaces(x,100) gets to two decimal places
-    if(gllks) {
-      if(ploidy == 1) {
-        gllks[0] = ndecplaces(llk[0],100);
-        gllks[1] = ndecplaces(llk[2],100);
-        if(ngllks > 2) bcf_float_set_vector_end(gllks[2]);
-      } else {
-        gllks[0] = ndecplaces(llk[0],100);
-        gllks[1] = ndecplaces(llk[1],100);
-        gllks[2] = ndecplaces(llk[2],100);
-        if(ngllks > 3) bcf_float_set_vector_end(gllks[3]);
-      }
+  a = bcf_get_format_int32(hdr, v, kcovgs_ref_tag, &wrkr->kcovr, &wrkr->nkcovr);
+  b = bcf_get_format_int32(hdr, v, kcovgs_alt_tag, &wrkr->kcova, &wrkr->nkcova);
+  if(a < 0 || b < 0) { stats->num_missing_tags++; return false; }
+
+  genotype_llks_biallelic(prms, wrkr, v);
+
+  // loop over samples
+  const uint8_t *ploidies = prms->ploidy_mat[v->rid];
+  for(s = 0; s < nsamples; s++) {
+    uint8_t ploidy = ploidies[s];
+    int32_t *gts = wrkr->gts + max_ploidy*s;
+    float *gllks = wrkr->gllks ? wrkr->gllks + max_gts*s : NULL;
+    stats->ploidy_seen[ploidy]++;
+
+    if(wrkr->kcovr[nalts*s] == bcf_int32_missing ||
+       wrkr->kcova[nalts*s] == bcf_int32_missing)
+    {
+      stats->num_missing_covgs++;
+      set_gts_missing(ploidy, 2, gts, max_ploidy, gllks, max_gts,
+                      wrkr->gtquals+s);
+    }
+    else if(ploidy == 0)
+    {
+      set_gts_missing(ploidy, 2, gts, max_ploidy, gllks, max_gts,
+                      wrkr->gtquals+s);
+    }
+    else
+    {
+      if(!prms->readlensk[s])
+        die("Read length is zero for sample: %zu", s);
+      genotype_sample_biallelic(wrkr->llks + s*3, gts, max_ploidy,
+                                gllks, max_gts, wrkr->gtquals+s, ploidy);
+      stats->num_genotypes_printed++; // non-missing genotype printed
     }
+  }
 
-    num_genotypes_printed++; // non-missing genotype printed
+  // Update GTs
+  if(prms->rm_vcfcov_tags) {
+    // remove coverage tags added by vcfcov
+    bcf_update_format_int32(hdr, v, kcovgs_ref_tag, NULL, 0);
+    bcf_update_format_int32(hdr, v, kcovgs_alt_tag, NULL, 0);
   }
+  if(bcf_update_genotypes(hdr, v, wrkr->gts, nsamples*max_ploidy) < 0)
+    die("Cannot update GTs");
+  if(bcf_update_format_int32(hdr, v, "GQ", wrkr->gtquals, nsamples) < 0)
+    die("Cannot update GQs");
+  if(wrkr->gllks &&
+     bcf_update_format_float(hdr, v, "GL", wrkr->gllks, nsamples*max_gts) < 0)
+    die("Cannot update GLs");
+
+  return true;
 }
 
-static void genotype_vcf(htsFile *vcffh, bcf_hdr_t *vcfhdr, htsFile *outfh,
-                         const double *kcovgs, const double *log_errs,
-                         const uint8_t *const* ploidy_mat,
-                         size_t *readlensk,
-                         size_t max_ploidy, size_t kmer_size,
-                         bool add_gllks, bool rm_vcfcov_tags)
-{
-  size_t nalts, s, nsamples = bcf_hdr_nsamples(vcfhdr);
-  bcf1_t *v = bcf_init();
-  int a, b;
+//
+// Records are read in chunks of VCFGENO_CHUNK, genotyped in parallel, then
+// written in input order
+//
+#define VCFGENO_CHUNK 1024
 
-  // ref / alt kmer coverage, one per ALT allele
-  int nkcovr = 0, nkcova = 0;
-  int32_t *kcovr = NULL, *kcova = NULL;
+typedef struct
+{
+  const GenoParams *prms;
+  GenoWorker *wrkrs; // [nthreads]
+  bcf1_t **recs;
+  bool *keep;
+} GenoChunk;
+
+static bool genotype_records(size_t start, size_t end, size_t threadid,
+                             void *arg)
+{
+  GenoChunk *chunk = (GenoChunk*)arg;
+  size_t i;
+  for(i = start; i < end; i++)
+    chunk->keep[i] = genotype_site(chunk->prms, &chunk->wrkrs[threadid],
+                                   chunk->recs[i]);
+  return false; // keep going
+}
 
-  size_t max_gts = num_gts(max_ploidy, 2);
-  size_t ngllks = nsamples * max_gts;
+static void genotype_vcf(htsFile *vcffh, htsFile *outfh,
+                         const GenoParams *prms, size_t nthreads)
+{
+  size_t i, n, t;
+  bcf1_t *recs[VCFGENO_CHUNK];
+  bool keep[VCFGENO_CHUNK];
+  GenoWorker *wrkrs = ctx_calloc(nthreads, sizeof(GenoWorker));
+  GenoChunk chunk = {.prms = prms, .wrkrs = wrkrs, .recs = recs, .keep = keep};
 
-  int ngts = nsamples * max_ploidy;
-  int32_t *gts = ctx_calloc(ngts, sizeof(gts[0]));
-  int32_t *gtquals = ctx_calloc(nsamples, sizeof(gtquals[0]));
-  float *gllks = add_gllks ? ctx_calloc(ngllks, sizeof(gllks[0])) : NULL;
+  for(t = 0; t < nthreads; t++) geno_worker_alloc(&wrkrs[t], prms);
+  for(i = 0; i < VCFGENO_CHUNK; i++) recs[i] = bcf_init();
 
   // Initialise lookup tables
   math_calcs_init();
 
-  // read and print
-  while(bcf_read(vcffh, vcfhdr, v) == 0)
+  // read, genotype, print
+  while(1)
   {
-    bcf_unpack(v, BCF_UN_ALL);
-    num_lines_read++;
-    num_ALTs_read += v->n_allele-1;
+    for(n = 0; n < VCFGENO_CHUNK && bcf_read(vcffh, prms->hdr, recs[n]) == 0; n++)
+    {
+      num_lines_read++;
+      num_ALTs_read += recs[n]->n_allele-1;
+    }
 
-    if(v->n_allele != 2) { num_non_biallelic++; continue; }
-    nalts = v->n_allele-1;
+    if(n == 0) break;
 
-    // TODO: if add_gllks and nalts > 1, may need to resize gllks
+    util_run_ranges(n, 16, nthreads, genotype_records, &chunk);
 
-    a = bcf_get_format_int32(vcfhdr, v, kcovgs_ref_tag, &kcovr, &nkcovr);
-    b = bcf_get_format_int32(vcfhdr, v, kcovgs_alt_tag, &kcova, &nkcova);
-    if(a < 0 || b < 0) { num_missing_tags++; continue; }
+    for(i = 0; i < n; i++)
+      if(keep[i] && bcf_write(outfh, prms->hdr, recs[i]) != 0)
+        die("Cannot write record");
 
-    // loop over samples
-    for(s = 0; s < nsamples; s++) {
-      uint8_t ploidy = ploidy_mat[v->rid][s];
-      ploidy_seen[ploidy]++;
-      genotype_sample_biallelic(v, s,
-                                gts+max_ploidy*s, max_ploidy,
-                                gllks ? gllks+max_gts*s : NULL, max_gts,
-                                gtquals+s,
-                                kcovr+nalts*s, kcova+nalts*s,
-                                kcovgs[s], ploidy, kmer_size, log_errs[s],
-                                readlensk[s]);
-    }
+    if(n < VCFGENO_CHUNK) break;
+  }
 
-    // Update GTs and write out
-    if(rm_vcfcov_tags) {
-      // remove coverage tags added by vcfcov
-      a = bcf_update_format_int32(vcfhdr, v, kcovgs_ref_tag, NULL, 0);
-      b = bcf_update_format_int32(vcfhdr, v, kcovgs_alt_tag, NULL, 0);
-    }
-    if(bcf_update_genotypes(vcfhdr, v, gts, ngts) < 0)
-      die("Cannot update GTs");
-    if(bcf_update_format_int32(vcfhdr, v, "GQ", gtquals, nsamples) < 0)
-      die("Cannot update GQs");
-    if(gllks && bcf_update_format_float(vcfhdr, v, "GL", gllks, ngllks) < 0)
-      die("Cannot update GLs");
-    if(bcf_write(outfh, vcfhdr, v) != 0) die("Cannot write record");
+  for(t = 0; t < nthreads; t++) {
+    GenoStats *st = &wrkrs[t].stats;
+    num_missing_tags += st->num_missing_tags;
+    num_missing_covgs += st->num_missing_covgs;
+    num_non_biallelic += st->num_non_biallelic;
+    num_genotypes_printed += st->num_genotypes_printed;
+    for(i = 0; i < 3; i++) ploidy_seen[i] += st->ploidy_seen[i];
+    geno_worker_dealloc(&wrkrs[t]);
   }
 
-  free(kcovr);
-  free(kcova);
-  ctx_free(gts);
-  ctx_free(gtquals);
-  ctx_free(gllks);
-  bcf_destroy(v);
+  for(i = 0; i < VCFGENO_CHUNK; i++) bcf_destroy(recs[i]);
+  ctx_free(wrkrs);
+  math_calcs_destroy();
 }
 
 static int match_list(const char *s, char const*const* list, size_t n)
@@ -468,6 +576,7 @@ int ctx_vcfgeno(int argc, char **argv)
   char *pl_args[argc];
   size_t npl_args = 0;
   bool add_gllks = false, rm_vcfcov_tags = false;
+  size_t nthreads = 0;
 
   // These are set after we have initially looped over args
   size_t *read_lens = NULL;
@@ -500,6 +609,7 @@ int ctx_vcfgeno(int argc, char **argv)
       case 'R': cmd_check(!readlen_arg, cmd); readlen_arg = optarg; break;
       case 'l': cmd_check(!add_gllks, cmd); add_gllks = true; break;
       case 'r': cmd_check(!rm_vcfcov_tags, cmd); rm_vcfcov_tags = true; break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -512,6 +622,7 @@ int ctx_vcfgeno(int argc, char **argv)
 
   // if(!err_arg) cmd_print_usage("Require '--err 0.01,0.005,...' argument");
   if(!err_arg) err_arg = default_err;
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
   if(!npl_args) cmd_print_usage("Require '--ploidy sample:chr:ploidy' argment");
   if(!kcov_arg && !cov_arg) cmd_print_usage("Require --kcov or --cov argument");
   if(optind+1 != argc) cmd_print_usage("Need to pass a single VCF");
@@ -519,9 +630,14 @@ int ctx_vcfgeno(int argc, char **argv)
 
   size_t s, max_ploidy = 0, kmer_size = 0;
 
+  // Input and output share a pool of (de)compression threads
+  htsThreadPool htspool;
+  vcf_misc_pool_alloc(&htspool, nthreads);
+
   // Open input VCF file
   htsFile *vcffh = hts_open(inpath, "r");
   if(vcffh == NULL) die("Cannot open VCF file: %s", inpath);
+  vcf_misc_pool_attach(&htspool, vcffh);
   bcf_hdr_t *vcfhdr = bcf_hdr_read(vcffh);
   if(vcfhdr == NULL) die("Cannot read VCF header: %s", inpath);
   size_t nsamples = bcf_hdr_nsamples(vcfhdr);
@@ -705,16 +821,38 @@ int ctx_vcfgeno(int argc, char **argv)
   int mode = vcf_misc_get_outtype(out_type, out_path);
   futil_create_output(out_path);
   htsFile *outfh = hts_open(out_path, modes_htslib[mode]);
+  if(outfh == NULL) die("Cannot open output: %s", futil_outpath_str(out_path));
+  vcf_misc_pool_attach(&htspool, outfh);
   status("[vcfgeno] Output to: %s format: %s",
          futil_outpath_str(out_path), hsmodes_htslib[mode]);
 
   if(bcf_hdr_write(outfh, vcfhdr) != 0)
     die("Cannot write header to: %s", futil_outpath_str(out_path));
 
+  // Expected read arrival rate per kmer of allele, and its log
+  double *rates = ctx_calloc(nsamples, sizeof(rates[0]));
+  double *log_rates = ctx_calloc(nsamples, sizeof(log_rates[0]));
+  for(i = 0; i < nsamples; i++) {
+    rates[i] = read_lens[i] ? kcovgs[i] / read_lens[i] : 0;
+    log_rates[i] = log(rates[i]);
+  }
+
+  GenoParams prms = {.nsamples = nsamples, .max_ploidy = max_ploidy,
+                     .max_gts = num_gts(max_ploidy, 2),
+                     .kmer_size = kmer_size,
+                     .ploidy_mat = (const uint8_t *const*)ploidy_mat,
+                     .readlensk = read_lens,
+                     .rates = rates, .log_rates = log_rates,
+                     .log_errs = log_errs,
+                     .add_gllks = add_gllks, .rm_vcfcov_tags = rm_vcfcov_tags,
+                     .hdr = vcfhdr};
+
   // Ready to go
-  genotype_vcf(vcffh, vcfhdr, outfh,
-               kcovgs, log_errs, (const uint8_t *const*)ploidy_mat, read_lens,
-               max_ploidy, kmer_size, add_gllks, rm_vcfcov_tags);
+  status("[vcfgeno] Genotyping with %zu threads", nthreads);
+  genotype_vcf(vcffh, outfh, &prms, nthreads);
+
+  ctx_free(rates);
+  ctx_free(log_rates);
 
   uint64_t n_sample_alts = nsamples * num_ALTs_read;
 
@@ -759,12 +897,11 @@ int ctx_vcfgeno(int argc, char **argv)
   for(r = 0; r < nseqs; r++) ctx_free(ploidy_mat[r]);
   ctx_free(ploidy_mat);
 
-  math_calcs_destroy();
-
   free(seqnames);
   bcf_hdr_destroy(vcfhdr);
   hts_close(vcffh);
   hts_close(outfh);
+  vcf_misc_pool_dealloc(&htspool);
 
   return EXIT_SUCCESS;
 }
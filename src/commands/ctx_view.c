@@ -24,6 +24,9 @@ const char view_usage[] =
 "  -k, --kmers  Print kmers\n"
 "  -c, --check  Check kmers\n"
 "  -i, --info   Print info\n"
+"  -e, --export Print kmers as tab separated columns with a header line\n"
+"               (kmer, covg0.., edges0..) for loading into databases\n"
+"  -t, --threads <T> Number of threads [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 // "\n"
 // "  -r, --readlen  Print mean read length\n"
 // "  -b, --nbases   Print number of bases read\n"
@@ -32,14 +35,16 @@ const char view_usage[] =
 " Default is [--info --check]\n"
 "\n";
 
-int print_info = 0, parse_kmers = 0, print_kmers = 0;
+int print_info = 0, parse_kmers = 0, print_kmers = 0, print_tsv = 0;
 
 static struct option longopts[] =
 {
-  {"help",  no_argument, NULL,        'h'},
-  {"kmers", no_argument, &print_kmers,  1},
-  {"check", no_argument, &parse_kmers,  1},
-  {"info",  no_argument, &print_info,   1},
+  {"help",    no_argument,       NULL,        'h'},
+  {"kmers",   no_argument,       &print_kmers,  1},
+  {"check",   no_argument,       &parse_kmers,  1},
+  {"info",    no_argument,       &print_info,   1},
+  {"export",  no_argument,       &print_tsv,    1},
+  {"threads", required_argument, NULL,        't'},
   // {"help",    no_argument, NULL, 'h'},
   // {"kmers",   no_argument, NULL, 'k'},
   // {"check",   no_argument, NULL, 'c'},
@@ -107,6 +112,182 @@ static void print_header(GraphFileHeader *h, size_t num_of_kmers)
 #define loading_warning(fmt,...) { num_warnings++; warn(fmt, ##__VA_ARGS__);}
 #define loading_error(fmt,...) { num_errors++; warn(fmt, ##__VA_ARGS__);}
 
+// Kmers are formatted and checked by threads one chunk of the file each, with
+// the text printed in file order. Chunk size is a trade off between memory
+// for the text and the number of rounds.
+#define VIEW_CHUNK_KMERS (1<<18)
+
+// Don't bother splitting small files between threads
+#define VIEW_MIN_KMERS_PER_THREAD 10000
+
+typedef struct
+{
+  size_t ncols, nbitfields, kmer_size;
+  bool direct_read, print;
+  char sep; // column separator
+} ViewFormat;
+
+typedef struct
+{
+  const ViewFormat *fmt;
+  GraphFileReader rdr; // each job has its own file handle and buffer
+  size_t start, end; // kmer range [start,end) of the current chunk
+  off_t offset; // file offset of kmer `start`
+  StrBuf sbuf; // formatted kmers of the current chunk
+  uint64_t nkmers_read, nkmers_loaded;
+  uint64_t num_all_zero_kmers, num_zero_covg_kmers;
+  uint64_t *col_nkmers, *col_sum_covgs;
+} ViewJob;
+
+static void view_job_alloc(ViewJob *job, const ViewFormat *fmt)
+{
+  memset(job, 0, sizeof(*job));
+  job->fmt = fmt;
+  strbuf_alloc(&job->sbuf, 1024);
+  job->col_nkmers = ctx_calloc(fmt->ncols, sizeof(job->col_nkmers[0]));
+  job->col_sum_covgs = ctx_calloc(fmt->ncols, sizeof(job->col_sum_covgs[0]));
+}
+
+static void view_job_dealloc(ViewJob *job)
+{
+  strbuf_dealloc(&job->sbuf);
+  ctx_free(job->col_nkmers);
+  ctx_free(job->col_sum_covgs);
+}
+
+// Open a new file handle on `file` for a job to read with
+static void view_job_open(ViewJob *job, const GraphFileReader *file)
+{
+  job->rdr = *file;
+  job->rdr.fh = futil_fopen(file_filter_path(&file->fltr), "r");
+  job->rdr.error_zero_covg = job->rdr.error_missing_covg = 0;
+  strm_buf_alloc(&job->rdr.strm, ONE_MEGABYTE);
+  if(graph_file_is_blocked(file)) graph_block_decoder_alloc(&job->rdr.blk);
+}
+
+// Returns non-zero if there was an error reading
+static int view_job_close(ViewJob *job)
+{
+  int err = ferror(job->rdr.fh);
+  if(graph_file_is_blocked(&job->rdr)) graph_block_decoder_dealloc(&job->rdr.blk);
+  strm_buf_dealloc(&job->rdr.strm);
+  fclose(job->rdr.fh);
+  return err;
+}
+
+static inline void view_kmer(ViewJob *job, BinaryKmer bkmer,
+                             const Covg *covgs, const Edges *edges)
+{
+  const ViewFormat *fmt = job->fmt;
+  size_t i, col, ncols = fmt->ncols;
+  Covg keep_kmer = 0;
+
+  // If kmer has no covg in any samples -> don't load
+  for(col = 0; col < ncols; col++) {
+    job->col_nkmers[col] += (covgs[col] > 0);
+    job->col_sum_covgs[col] += covgs[col];
+    keep_kmer |= covgs[col];
+  }
+
+  if(!fmt->direct_read && !keep_kmer) return;
+  job->nkmers_loaded++;
+
+  /* Kmer Checks */
+  // graph_file_read_reset() already checks for:
+  // 1. oversized kmers
+  // 2. kmers with covg 0 in all colours
+  // 3. edges without coverage in a colour
+
+  // Check for all-zeros (i.e. all As kmer: AAAAAA)
+  uint64_t kmer_words_or = 0;
+
+  for(i = 0; i < fmt->nbitfields; i++)
+    kmer_words_or |= bkmer.b[i];
+
+  job->num_all_zero_kmers += (kmer_words_or == 0);
+
+  // Check covg is 0 for all colours
+  job->num_zero_covg_kmers += (keep_kmer == 0);
+
+  // Print
+  if(fmt->print) {
+    db_graph_sbuf_kmer2(bkmer, covgs, edges, ncols, fmt->kmer_size,
+                        fmt->sep, &job->sbuf);
+  }
+}
+
+// Read and format kmers [job->start, job->end)
+static void view_range(void *arg, size_t threadid)
+{
+  (void)threadid;
+  ViewJob *job = (ViewJob*)arg;
+  size_t n = 0, ncols = job->fmt->ncols;
+  BinaryKmer bkmer;
+  Covg covgs[ncols];
+  Edges edges[ncols];
+
+  if(graph_file_fseek(&job->rdr, job->offset, SEEK_SET) != 0)
+    die("fseek failed: %s", strerror(errno));
+
+  for(; n < job->end - job->start &&
+        graph_file_read_reset(&job->rdr, &bkmer, covgs, edges); n++)
+  {
+    view_kmer(job, bkmer, covgs, edges);
+  }
+
+  job->nkmers_read += n;
+}
+
+static void view_fwrite(StrBuf *sbuf)
+{
+  if(fwrite(sbuf->b, 1, sbuf->end, stdout) != sbuf->end)
+    die("Cannot write to STDOUT: %s", strerror(errno));
+  strbuf_reset(sbuf);
+}
+
+// Get the first kmer and file offset of each chunk of `file`. `starts` and
+// `offsets` have length nchunks+1, the last entry is the end of the file.
+// Returns number of chunks.
+static size_t view_chunks(GraphFileReader *file,
+                          size_t **starts, off_t **offsets)
+{
+  size_t i, n = 0, nkmers = file->num_of_kmers;
+  size_t cap = nkmers / VIEW_CHUNK_KMERS + 2;
+
+  if(graph_file_is_blocked(file)) {
+    // Split on block boundaries using the block index
+    GraphBlockTrailer trailer;
+    GraphBlockBuffer index;
+    gblock_buf_alloc(&index, 1024);
+    int fd = graph_file_fileno(file);
+    if(!graph_block_read_trailer(fd, file->file_size, &trailer) ||
+       !graph_block_read_index(fd, &trailer, &index) ||
+       index.len == 0)
+      die("Cannot read block index: %s", file_filter_path(&file->fltr));
+    *starts = ctx_calloc(index.len+1, sizeof(size_t));
+    *offsets = ctx_calloc(index.len+1, sizeof(off_t));
+    for(i = 0; i < index.len; i++) {
+      if(n == 0 || index.b[i].kmer_offset >= (*starts)[n-1] + VIEW_CHUNK_KMERS) {
+        (*starts)[n] = index.b[i].kmer_offset;
+        (*offsets)[n] = index.b[i].offset;
+        n++;
+      }
+    }
+    gblock_buf_dealloc(&index);
+  }
+  else {
+    *starts = ctx_calloc(cap, sizeof(size_t));
+    *offsets = ctx_calloc(cap, sizeof(off_t));
+    for(n = 0; n * VIEW_CHUNK_KMERS < nkmers; n++) {
+      (*starts)[n] = n * VIEW_CHUNK_KMERS;
+      (*offsets)[n] = graph_file_offset(file, (*starts)[n]);
+    }
+  }
+
+  (*starts)[n] = nkmers;
+  return n;
+}
+
 // Print tab separated cer colour
 // summary => human readable
 typedef enum _print_action {
@@ -120,6 +301,7 @@ int ctx_view(int argc, char **argv)
   char shortopts[300];
   cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
   int c;
+  size_t nthreads = 0;
 
   // TODO:
   // print_action actions[argc];
@@ -133,6 +315,7 @@ int ctx_view(int argc, char **argv)
     switch(c) {
       case 0: /* flag set */ break;
       case 'h': cmd_print_usage(NULL); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -142,6 +325,10 @@ int ctx_view(int argc, char **argv)
     }
   }
 
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
+  if(print_tsv && print_info) cmd_print_usage("Cannot use --export with --info");
+  if(print_tsv) print_kmers = 1;
   if(print_kmers) parse_kmers = 1;
 
   bool no_flags = (!print_info && !parse_kmers && !print_kmers);
@@ -174,68 +361,92 @@ int ctx_view(int argc, char **argv)
   memset(&hdr, 0, sizeof(hdr));
   graph_file_merge_header(&hdr, &gfile);
 
-  uint64_t nkmers_read = 0, nkmers_loaded = 0;
-  uint64_t num_all_zero_kmers = 0, num_zero_covg_kmers = 0;
-  uint64_t *col_nkmers, *col_sum_covgs;
-  col_nkmers = ctx_calloc(ncols, sizeof(col_nkmers[0]));
-  col_sum_covgs = ctx_calloc(ncols, sizeof(col_sum_covgs[0]));
-
   // Print header
   if(print_info) print_header(&hdr, gfile.num_of_kmers);
 
-  BinaryKmer bkmer;
-  Covg covgs[ncols], keep_kmer;
-  Edges edges[ncols];
+  ViewFormat fmt = {.ncols = ncols, .nbitfields = hdr.num_of_bitfields,
+                    .kmer_size = kmer_size,
+                    .direct_read = file_filter_direct(&gfile.fltr),
+                    .print = print_kmers, .sep = print_tsv ? '\t' : ' '};
 
-  bool direct_read = file_filter_direct(&gfile.fltr);
+  // All stats are summed into jobs[0]
+  ViewJob *jobs = ctx_calloc(nthreads, sizeof(ViewJob));
+  for(i = 0; i < nthreads; i++) view_job_alloc(&jobs[i], &fmt);
+  ViewJob *all = &jobs[0];
+
+  int err = 0;
 
   if(parse_kmers || print_kmers)
   {
     if(print_info && print_kmers) printf("----\n");
+    if(print_tsv) {
+      db_graph_sbuf_kmer2_hdr(ncols, &all->sbuf);
+      view_fwrite(&all->sbuf);
+    }
 
-    for(; graph_file_read_reset(&gfile, &bkmer, covgs, edges); nkmers_read++)
+    // Streams can't be split between threads
+    size_t file_nkmers = graph_file_nkmers(&gfile);
+    size_t njobs = 1;
+    if(nthreads > 1 && !file_filter_isstdin(&gfile.fltr)) {
+      njobs = MIN2(nthreads, file_nkmers / VIEW_MIN_KMERS_PER_THREAD);
+      njobs = MAX2(njobs, 1);
+    }
+
+    if(njobs > 1)
     {
-      // If kmer has no covg in any samples -> don't load
-      keep_kmer = 0;
-      for(col = 0; col < ncols; col++) {
-        col_nkmers[col] += (covgs[col] > 0);
-        col_sum_covgs[col] += covgs[col];
-        keep_kmer |= covgs[col];
-      }
+      status("[view] Reading with %zu threads", njobs);
 
-      if(!direct_read && !keep_kmer) continue;
-      nkmers_loaded++;
+      size_t *starts, ci, nchunks, n;
+      off_t *offsets;
+      nchunks = view_chunks(&gfile, &starts, &offsets);
 
-      /* Kmer Checks */
-      // graph_file_read_reset() already checks for:
-      // 1. oversized kmers
-      // 2. kmers with covg 0 in all colours
-      // 3. edges without coverage in a colour
+      for(i = 0; i < njobs; i++) view_job_open(&jobs[i], &gfile);
 
-      // Check for all-zeros (i.e. all As kmer: AAAAAA)
-      uint64_t kmer_words_or = 0;
+      for(ci = 0; ci < nchunks; ci += n) {
+        n = MIN2(njobs, nchunks - ci);
+        for(i = 0; i < n; i++) {
+          jobs[i].start = starts[ci+i];
+          jobs[i].end = starts[ci+i+1];
+          jobs[i].offset = offsets[ci+i];
+        }
+        util_run_threads(jobs, n, sizeof(jobs[0]), n, view_range);
+        // Print chunks in file order
+        for(i = 0; i < n; i++) view_fwrite(&jobs[i].sbuf);
+      }
 
-      for(i = 0; i < hdr.num_of_bitfields; i++)
-        kmer_words_or |= bkmer.b[i];
+      for(i = 0; i < njobs; i++) {
+        err |= view_job_close(&jobs[i]);
+        gfile.error_zero_covg += jobs[i].rdr.error_zero_covg;
+        gfile.error_missing_covg += jobs[i].rdr.error_missing_covg;
+      }
 
-      if(kmer_words_or == 0)
-      {
-        if(num_all_zero_kmers == 1)
-        {
-          loading_error("more than one all 'A's kmers seen [index: %"PRIu64"]\n",
-                        nkmers_read);
+      // Sum stats
+      for(i = 1; i < njobs; i++) {
+        all->nkmers_read += jobs[i].nkmers_read;
+        all->nkmers_loaded += jobs[i].nkmers_loaded;
+        all->num_all_zero_kmers += jobs[i].num_all_zero_kmers;
+        all->num_zero_covg_kmers += jobs[i].num_zero_covg_kmers;
+        for(col = 0; col < ncols; col++) {
+          all->col_nkmers[col] += jobs[i].col_nkmers[col];
+          all->col_sum_covgs[col] += jobs[i].col_sum_covgs[col];
         }
-
-        num_all_zero_kmers++;
       }
 
-      // Check covg is 0 for all colours
-      for(i = 0; i < ncols && covgs[i] == 0; i++);
-      num_zero_covg_kmers += (i == ncols);
+      ctx_free(starts);
+      ctx_free(offsets);
+    }
+    else
+    {
+      BinaryKmer bkmer;
+      Covg covgs[ncols];
+      Edges edges[ncols];
 
-      // Print
-      if(print_kmers)
-        db_graph_print_kmer2(bkmer, covgs, edges, ncols, kmer_size, stdout);
+      for(; graph_file_read_reset(&gfile, &bkmer, covgs, edges); all->nkmers_read++)
+      {
+        view_kmer(all, bkmer, covgs, edges);
+        if(all->sbuf.end >= ONE_MEGABYTE) view_fwrite(&all->sbuf);
+      }
+      view_fwrite(&all->sbuf);
     }
   }
 
@@ -243,10 +454,15 @@ int ctx_view(int argc, char **argv)
   // if(errno != 0)
   //   loading_error("errno set [%i]: %s\n", (int)errno, strerror(errno));
 
-  int err = ferror(gfile.fh);
+  err |= ferror(gfile.fh);
   if(err != 0)
     loading_error("occurred after file reading [%i]\n", err);
 
+  uint64_t nkmers_read = all->nkmers_read, nkmers_loaded = all->nkmers_loaded;
+  uint64_t num_all_zero_kmers = all->num_all_zero_kmers;
+  uint64_t num_zero_covg_kmers = all->num_zero_covg_kmers;
+  uint64_t *col_nkmers = all->col_nkmers, *col_sum_covgs = all->col_sum_covgs;
+
   char nstr[50];
 
   if(print_kmers || parse_kmers)
@@ -314,7 +530,8 @@ int ctx_view(int argc, char **argv)
     req_capacity = (size_t)(gfile.num_of_kmers / IDEAL_OCCUPANCY);
     capacity = hash_table_cap(req_capacity, &num_buckets, &bucket_size);
     mem = ht_mem(bucket_size, num_buckets,
-                 sizeof(BinaryKmer)*8 + ncols*(sizeof(Covg)+sizeof(Edges))*8);
+                 sizeof(BinaryKmer)*8 + ncols*(sizeof(CovgStore)+sizeof(Edges))*8,
+                 hash_table_mem_get_layout());
 
     char memstr[100], capacitystr[100], bucket_size_str[100], num_buckets_str[100];
     bytes_to_str(mem, 1, memstr);
@@ -343,8 +560,8 @@ int ctx_view(int argc, char **argv)
       printf(num_warnings ? "Graph may be ok\n" : "Graph is valid\n");
   }
 
-  ctx_free(col_nkmers);
-  ctx_free(col_sum_covgs);
+  for(i = 0; i < nthreads; i++) view_job_dealloc(&jobs[i]);
+  ctx_free(jobs);
 
   // Close file (which zeros it)
   graph_file_close(&gfile);
@@ -0,0 +1,180 @@
+#include "global.h"
+#include "kmer_fpindex.h"
+#include "binary_seq.h"
+#include "util.h"
+
+#define KMER_FPINDEX_SEED0 0x9e3779b9
+#define KMER_FPINDEX_SEED1 0x85ebca6b
+
+// Fingerprint of a kmer key, never zero
+static inline uint64_t kmer_fpindex_fp(BinaryKmer bkey)
+{
+  uint64_t h = ((uint64_t)binary_kmer_hash(bkey, KMER_FPINDEX_SEED0) << 32) |
+               binary_kmer_hash(bkey, KMER_FPINDEX_SEED1);
+  return h ? h : 1;
+}
+
+static size_t kmer_fpindex_capacity(size_t nkmers)
+{
+  return roundup2pow(MAX2((size_t)(nkmers / KMER_FPINDEX_MAX_LOAD) + 1, 1024));
+}
+
+size_t kmer_fpindex_mem(size_t nkmers, size_t nbases)
+{
+  return kmer_fpindex_capacity(nkmers) * sizeof(KmerFPEntry) +
+         binary_seq_mem(nbases);
+}
+
+void kmer_fpindex_alloc(KmerFPIndex *idx, size_t kmer_size, size_t nkmers)
+{
+  memset(idx, 0, sizeof(KmerFPIndex));
+  idx->kmer_size = kmer_size;
+  idx->capacity = kmer_fpindex_capacity(nkmers);
+  idx->table = ctx_calloc(idx->capacity, sizeof(KmerFPEntry));
+  idx->seq_cap = 1024;
+  idx->seq = ctx_calloc(binary_seq_mem(idx->seq_cap), 1);
+  idx->starts_cap = 64;
+  idx->starts = ctx_malloc(idx->starts_cap * sizeof(uint64_t));
+  idx->starts[0] = 0;
+}
+
+void kmer_fpindex_dealloc(KmerFPIndex *idx)
+{
+  ctx_free(idx->table);
+  ctx_free(idx->seq);
+  ctx_free(idx->starts);
+  memset(idx, 0, sizeof(KmerFPIndex));
+}
+
+// Kmer starting at base `pos` of the packed sequence
+static inline BinaryKmer kmer_fpindex_read(const KmerFPIndex *idx, uint64_t pos)
+{
+  BinaryKmer bkmer = zero_bkmer;
+  size_t i;
+  for(i = 0; i < idx->kmer_size; i++) {
+    bkmer = binary_kmer_left_shift_add(bkmer, idx->kmer_size,
+                                       binary_seq_get(idx->seq, pos+i));
+  }
+  return bkmer;
+}
+
+// Returns slot holding `bkey` or the empty slot where it would go
+static inline size_t kmer_fpindex_probe(const KmerFPIndex *idx,
+                                        BinaryKmer bkey, uint64_t fp)
+{
+  size_t i, mask = idx->capacity-1;
+  BinaryKmer bkmer;
+
+  for(i = fp & mask; idx->table[i].fp != 0; i = (i+1) & mask) {
+    if(idx->table[i].fp == fp) {
+      bkmer = kmer_fpindex_read(idx, idx->table[i].pos);
+      if(binary_kmer_eq(binary_kmer_get_key(bkmer, idx->kmer_size), bkey))
+        return i;
+    }
+  }
+  return i;
+}
+
+static void kmer_fpindex_grow(KmerFPIndex *idx)
+{
+  KmerFPEntry *old = idx->table;
+  size_t i, j, old_cap = idx->capacity, mask;
+
+  idx->capacity *= 2;
+  idx->table = ctx_calloc(idx->capacity, sizeof(KmerFPEntry));
+  mask = idx->capacity-1;
+
+  // Kmers are distinct, so only fingerprints are needed to re-insert
+  for(i = 0; i < old_cap; i++) {
+    if(old[i].fp == 0) continue;
+    for(j = old[i].fp & mask; idx->table[j].fp != 0; j = (j+1) & mask) {}
+    idx->table[j] = old[i];
+  }
+
+  ctx_free(old);
+}
+
+size_t kmer_fpindex_add(KmerFPIndex *idx, const char *seq, size_t len)
+{
+  const size_t kmer_size = idx->kmer_size;
+  ctx_assert(len >= kmer_size);
+
+  size_t i, slot, nadded = 0;
+  uint64_t start = idx->seq_len, fp;
+
+  // Append packed sequence
+  if(idx->seq_len + len > idx->seq_cap) {
+    size_t old_bytes = binary_seq_mem(idx->seq_cap);
+    idx->seq_cap = roundup2pow(idx->seq_len + len);
+    idx->seq = ctx_realloc(idx->seq, binary_seq_mem(idx->seq_cap));
+    memset(idx->seq + old_bytes, 0, binary_seq_mem(idx->seq_cap) - old_bytes);
+  }
+  for(i = 0; i < len; i++)
+    binary_seq_set(idx->seq, start+i, dna_char_to_nuc(seq[i]));
+  idx->seq_len += len;
+
+  if(idx->num_seqs+2 > idx->starts_cap) {
+    idx->starts_cap *= 2;
+    idx->starts = ctx_reallocarray(idx->starts, idx->starts_cap,
+                                   sizeof(uint64_t));
+  }
+  idx->starts[++idx->num_seqs] = idx->seq_len;
+
+  BinaryKmerIter kiter;
+  BinaryKmer bkey;
+  Orientation orient;
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+
+  for(i = kmer_size-1; i < len; i++) {
+    binary_kmer_iter_next(&kiter, dna_char_to_nuc(seq[i]));
+    bkey = binary_kmer_iter_key(&kiter, &orient);
+    fp = kmer_fpindex_fp(bkey);
+    slot = kmer_fpindex_probe(idx, bkey, fp);
+    if(idx->table[slot].fp == 0) {
+      idx->table[slot] = (KmerFPEntry){.fp = fp, .pos = start+i+1-kmer_size};
+      idx->num_kmers++;
+      nadded++;
+      if(idx->num_kmers > idx->capacity * KMER_FPINDEX_MAX_LOAD)
+        kmer_fpindex_grow(idx);
+    }
+  }
+
+  return nadded;
+}
+
+// Sequence holding base `pos`
+static size_t kmer_fpindex_seqid(const KmerFPIndex *idx, uint64_t pos)
+{
+  // Find last start <= pos
+  size_t lo = 0, hi = idx->num_seqs, mid;
+  while(lo + 1 < hi) {
+    mid = (lo + hi) / 2;
+    if(idx->starts[mid] <= pos) lo = mid;
+    else hi = mid;
+  }
+  return lo;
+}
+
+bool kmer_fpindex_find(const KmerFPIndex *idx, BinaryKmer bkmer,
+                       KmerFPRef *ref)
+{
+  BinaryKmer bkey = binary_kmer_get_key(bkmer, idx->kmer_size);
+  size_t slot = kmer_fpindex_probe(idx, bkey, kmer_fpindex_fp(bkey));
+  if(idx->table[slot].fp == 0) return false;
+
+  uint64_t pos = idx->table[slot].pos;
+  ref->seqid = kmer_fpindex_seqid(idx, pos);
+  ref->offset = pos - idx->starts[ref->seqid];
+  ref->orient = binary_kmer_eq(kmer_fpindex_read(idx, pos), bkey) ? FORWARD
+                                                                  : REVERSE;
+  return true;
+}
+
+BinaryKmer kmer_fpindex_get_bkmer(const KmerFPIndex *idx,
+                                  size_t seqid, size_t offset)
+{
+  ctx_assert(seqid < idx->num_seqs);
+  ctx_assert(idx->starts[seqid] + offset + idx->kmer_size <=
+             idx->starts[seqid+1]);
+  return kmer_fpindex_read(idx, idx->starts[seqid] + offset);
+}
@@ -0,0 +1,69 @@
+#ifndef KMER_FPINDEX_H_
+#define KMER_FPINDEX_H_
+
+//
+// Fingerprint kmer index (experimental)
+//
+// A kmer store for large k, where a BinaryKmer in every hash table entry costs
+// too much (64 bytes with MAXK=255). Sequences (e.g. unitigs) are packed two
+// bits per base and the table only holds a 64 bit fingerprint of each
+// canonical kmer and the position of the kmer in the packed sequence, so an
+// entry is 16 bytes whatever k is. When a fingerprint matches, the kmer is
+// read back from the packed sequence and compared, so lookups never return
+// the wrong kmer.
+//
+// Not threadsafe. Kmers are never removed. The table doubles in size once it
+// is KMER_FPINDEX_MAX_LOAD full.
+//
+// Only used by `hashtest --fingerprint` to compare against the hash table.
+//
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+
+#define KMER_FPINDEX_MAX_LOAD 0.8
+
+typedef struct
+{
+  uint64_t fp; // 0 if slot is empty
+  uint64_t pos; // first base of the kmer in KmerFPIndex.seq
+} KmerFPEntry;
+
+typedef struct
+{
+  size_t kmer_size;
+  uint8_t *seq; // 2 bits per base, all sequences concatenated
+  size_t seq_len, seq_cap; // in bases
+  uint64_t *starts; // [num_seqs+1] first base of each sequence
+  size_t num_seqs, starts_cap;
+  KmerFPEntry *table;
+  size_t capacity, num_kmers; // capacity is a power of two
+} KmerFPIndex;
+
+typedef struct
+{
+  size_t seqid, offset; // sequence and position of the kmer in it
+  Orientation orient; // FORWARD if the sequence reads the kmer key forwards
+} KmerFPRef;
+
+// Memory used to hold `nkmers` in sequences of `nbases` in total
+size_t kmer_fpindex_mem(size_t nkmers, size_t nbases);
+
+void kmer_fpindex_alloc(KmerFPIndex *idx, size_t kmer_size, size_t nkmers);
+void kmer_fpindex_dealloc(KmerFPIndex *idx);
+
+// Add a sequence, which must be entirely ACGT with len >= kmer_size. Kmers
+// already in the index are not added again. The sequence gets the next id
+// (idx->num_seqs) even if it adds no kmers.
+// Returns the number of kmers added.
+size_t kmer_fpindex_add(KmerFPIndex *idx, const char *seq, size_t len);
+
+// Returns true and sets *ref if `bkmer` (either orientation) is in the index
+bool kmer_fpindex_find(const KmerFPIndex *idx, BinaryKmer bkmer,
+                       KmerFPRef *ref);
+
+// Get the kmer at base `offset` of sequence `seqid`, as read on the sequence
+BinaryKmer kmer_fpindex_get_bkmer(const KmerFPIndex *idx,
+                                  size_t seqid, size_t offset);
+
+#endif /* KMER_FPINDEX_H_ */
@@ -3,6 +3,7 @@
 #include "read_thread_cmd.h"
 #include "gpath_checks.h"
 #include "file_util.h"
+#include "seq_inflate.h"
 
 //
 // ctx_thread.c and ctx_correct.c use many of the same command line arguments
@@ -61,11 +62,35 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
         gpath_reader_open(&tmp_gpfile, optarg);
         gpfile_buf_push(&args->gpfiles, &tmp_gpfile, 1);
         break;
+      case 'A':
+        if(correct_cmd) cmd_print_usage("Invalid append option: %s", cmd);
+        cmd_check(!args->append_ctp_path, cmd);
+        args->append_ctp_path = optarg;
+        memset(&tmp_gpfile, 0, sizeof(GPathReader));
+        gpath_reader_open(&tmp_gpfile, optarg);
+        gpfile_buf_push(&args->gpfiles, &tmp_gpfile, 1);
+        break;
       case '0':
         if(correct_cmd) cmd_print_usage("Invalid zero option: %s", cmd);
         cmd_check(!args->zero_link_counts, cmd);
         args->zero_link_counts = true;
         break;
+      case 'S':
+        if(correct_cmd) cmd_print_usage("Invalid sort option: %s", cmd);
+        cmd_check(!args->sort_kmers, cmd);
+        args->sort_kmers = true;
+        break;
+      case 's':
+        if(correct_cmd) cmd_print_usage("Invalid spill option: %s", cmd);
+        cmd_check(!args->spill_dir, cmd);
+        args->spill_dir = optarg;
+        break;
+      case 'N':
+        if(correct_cmd) cmd_print_usage("Invalid min link count option: %s", cmd);
+        cmd_check(!args->min_link_count, cmd);
+        args->min_link_count = cmd_uint8(cmd, optarg);
+        if(args->min_link_count == 0) cmd_print_usage("%s must be > 0", cmd);
+        break;
       case 't':
         cmd_check(!args->nthreads, cmd);
         args->nthreads = cmd_uint32_nonzero(cmd, optarg);
@@ -94,6 +119,12 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
         else cmd_print_usage("-M,--matepair <orient> must be one of: FF,FR,RF,RR");
         used = 0; break;
       case 'O': fq_offset = cmd_uint8(cmd, optarg); used = 0; break;
+      case 'r': seq_inflate_add_region(optarg); break;
+      case 'T':
+        cmd_check(!args->cram_ref, cmd);
+        args->cram_ref = optarg;
+        seq_inflate_set_cram_ref(optarg);
+        break;
       case 'Q': task.fq_cutoff = cmd_uint8(cmd, optarg); used = 0; break;
       case 'H': task.hp_cutoff = cmd_uint8(cmd, optarg); used = 0; break;
       case 'l': task.crt_params.frag_len_min = cmd_uint32(cmd, optarg); used = 0; break;
@@ -107,7 +138,9 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
       case 'E': task.crt_params.use_end_check = false; used = 0; break;
       case 'g': cmd_check(!args->dump_seq_sizes, cmd); args->dump_seq_sizes = optarg; break;
       case 'G': cmd_check(!args->dump_frag_sizes, cmd); args->dump_frag_sizes = optarg; break;
+      case 'R': cmd_check(!args->stats_sample, cmd); args->stats_sample = cmd_size_nonzero(cmd, optarg); break;
       case 'u': args->use_new_paths = true; break;
+      case 'U': cmd_check(!args->unitig_map, cmd); args->unitig_map = true; break;
       case 'x': gen_paths_print_contigs = true; break;
       case 'y': gen_paths_print_paths = true; break;
       case 'z': gen_paths_print_reads = true; break;
@@ -118,6 +151,16 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
         args->fq_zero = optarg[0];
         break;
       case 'P': cmd_check(!args->append_orig_seq,cmd); args->append_orig_seq = true; break;
+      case 'K':
+        if(!correct_cmd) cmd_print_usage("Invalid disk option: %s", cmd);
+        cmd_check(!args->use_disk, cmd);
+        args->use_disk = true;
+        break;
+      case 'a':
+        if(!correct_cmd) cmd_print_usage("Invalid prefetch option: %s", cmd);
+        cmd_check(!args->prefetch, cmd);
+        args->prefetch = true;
+        break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -139,6 +182,16 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
 
   if(!used) cmd_print_usage("Ignored arguments after last --seq");
 
+  // --append updates the link file in place unless given --out
+  if(args->append_ctp_path) {
+    if(args->zero_link_counts)
+      cmd_print_usage("Cannot use --append and --zero-paths");
+    if(!args->out_ctp_path) args->out_ctp_path = args->append_ctp_path;
+  }
+
+  if(args->unitig_map && args->use_disk)
+    cmd_print_usage("Cannot use --unitig-map with --disk");
+
   // ctx_thread requires output file
   if(!correct_cmd && !args->out_ctp_path)
     cmd_print_usage("--out <out.ctp> is required");
@@ -192,4 +245,27 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
 
   futil_create_output(args->dump_seq_sizes);
   futil_create_output(args->dump_frag_sizes);
+
+  // Histograms that are saved use every read unless asked otherwise
+  if(!args->stats_sample && (args->dump_seq_sizes || args->dump_frag_sizes))
+    args->stats_sample = 1;
+  correct_aln_stats_set_sample(args->stats_sample);
+}
+
+// Index unitigs of the loaded graph so reads are placed on them by their
+// minimizers (--unitig-map). Sets db_graph->umap.
+void read_thread_unitig_map(UnitigMap *umap, dBGraph *db_graph,
+                            size_t nthreads)
+{
+  status("Building unitig map to place reads with minimizers...");
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(db_graph->ht.capacity), 1);
+  UnitigIndex uidx;
+  unitig_index_alloc(&uidx, db_graph);
+  unitig_index_build(&uidx, nthreads, visited);
+  ctx_free(visited);
+
+  unitig_map_alloc(umap, db_graph);
+  unitig_map_build(umap, &uidx, nthreads);
+  unitig_index_dealloc(&uidx);
+  db_graph->umap = umap;
 }
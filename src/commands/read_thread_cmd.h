@@ -5,6 +5,7 @@
 #include "graph_file_reader.h"
 #include "gpath_reader.h"
 #include "correct_aln_input.h"
+#include "unitig_map.h"
 
 //
 // ctx_thread.c and ctx_correct.c use many of the same command line arguments
@@ -18,13 +19,22 @@ struct ReadThreadCmdArgs
   char *graph_path, *out_ctp_path;
   bool use_new_paths;
   char *dump_seq_sizes, *dump_frag_sizes;
+  size_t stats_sample; // --stats-sample, 0 if not set
+  char *cram_ref; // --cram-ref, also used by seq_inflate
+  bool unitig_map; // --unitig-map
 
   bool zero_link_counts; // ctx_thread only
+  char *append_ctp_path; // ctx_thread only, --append <in.ctp>
+  bool sort_kmers; // ctx_thread only
+  char *spill_dir; // ctx_thread only, --spill <dir>
+  uint8_t min_link_count; // ctx_thread only, --min-link-count <N>
 
   size_t colour; // ctx_correct only
   seq_format fmt; // ctx_correct only
   char fq_zero; // ctx_correct only
   bool append_orig_seq; // ctx_correct only
+  bool use_disk; // ctx_correct only
+  bool prefetch; // ctx_correct only
 
   GraphFileReader gfile;
   GPathFileBuffer gpfiles;
@@ -47,4 +57,14 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
                             int argc, char **argv,
                             const struct option *longopts, bool correct_cmd);
 
+// Memory required per kmer for --unitig-map whilst it is built
+#define READ_THREAD_UNITIG_MAP_BITS \
+        (UNITIG_INDEX_BITS_PER_KMER + UNITIG_MAP_BITS_PER_KMER + 1)
+
+// Index unitigs of the loaded graph so reads are placed on them by their
+// minimizers (--unitig-map). Sets db_graph->umap, which must be unset before
+// unitig_map_dealloc(umap). The graph must not change after this.
+void read_thread_unitig_map(UnitigMap *umap, dBGraph *db_graph,
+                            size_t nthreads);
+
 #endif /* READ_THREAD_CMD_H_ */
@@ -10,6 +10,26 @@ typedef uint32_t Covg;
 #define SAFE_ADD_COVG(a,b) ((uint64_t)(a)+(b) > COVG_MAX ? COVG_MAX : (a)+(b))
 #define SAFE_SUM_COVG(a,b) ((a) = SAFE_ADD_COVG((a), (b)))
 
+// Coverages are always passed around and written to files as 32 bit Covg.
+// Graphs in memory can store them in 8 or 16 bits (compile with COVG_BITS=8 or
+// COVG_BITS=16). Stored values of COVG_STORE_MAX mean the coverage is held in
+// the graph's overflow table (see covg_overflow.h).
+#ifndef COVG_BITS
+  #define COVG_BITS 32
+#endif
+
+#if COVG_BITS == 8
+  typedef uint8_t CovgStore;
+#elif COVG_BITS == 16
+  typedef uint16_t CovgStore;
+#elif COVG_BITS == 32
+  typedef uint32_t CovgStore;
+#else
+  #error Invalid COVG_BITS, choose from 8, 16, 32
+#endif
+
+#define COVG_STORE_MAX ((CovgStore)-1)
+
 typedef uint8_t Orientation;
 #define FORWARD 0
 #define REVERSE 1
@@ -0,0 +1,60 @@
+#include "global.h"
+#include "cpu_dispatch.h"
+
+CpuSimd ctx_cpu_simd = CPU_SIMD_NONE;
+uint32_t ctx_cpu_simd_gen = 0;
+
+static CpuSimd cpu_simd_max = CPU_SIMD_NONE;
+
+static const char *cpu_simd_names[] = {"none", "sse4.1", "avx2", "avx512"};
+
+const char* cpu_simd_str(CpuSimd lvl)
+{
+  return lvl < NUM_CPU_SIMD ? cpu_simd_names[lvl] : "unknown";
+}
+
+static CpuSimd cpu_simd_detect()
+{
+  CpuSimd lvl = CPU_SIMD_NONE;
+  #if CPU_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt")) {
+      lvl = CPU_SIMD_SSE41;
+      if(__builtin_cpu_supports("avx2")) {
+        lvl = CPU_SIMD_AVX2;
+        if(__builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw") &&
+           __builtin_cpu_supports("avx512vl")) lvl = CPU_SIMD_AVX512;
+      }
+    }
+  #endif
+  return lvl;
+}
+
+void cpu_dispatch_init()
+{
+  cpu_simd_max = cpu_simd_detect();
+
+  // Allow user to lower the level
+  const char *env = getenv("CTX_SIMD");
+  if(env != NULL && *env) {
+    CpuSimd i;
+    for(i = 0; i < NUM_CPU_SIMD && strcasecmp(env, cpu_simd_names[i]) != 0; i++) {}
+    if(i == NUM_CPU_SIMD) warn("Bad CTX_SIMD value: %s (ignored)", env);
+    else cpu_simd_max = MIN2(cpu_simd_max, i);
+  }
+
+  cpu_simd_set(cpu_simd_max);
+}
+
+CpuSimd cpu_simd_supported()
+{
+  return cpu_simd_max;
+}
+
+CpuSimd cpu_simd_set(CpuSimd lvl)
+{
+  ctx_cpu_simd = MIN2(lvl, cpu_simd_max);
+  ctx_cpu_simd_gen++;
+  return ctx_cpu_simd;
+}
@@ -0,0 +1,60 @@
+#ifndef CPU_DISPATCH_H_
+#define CPU_DISPATCH_H_
+
+//
+// Runtime selection of SIMD kernels
+//
+// We ship one binary for machines with and without AVX2 / AVX-512, so SIMD
+// kernels are compiled with per-function target attributes and chosen at
+// runtime from the CPU features reported by cpuid. The level can be lowered
+// (never raised) by setting the environment variable CTX_SIMD to one of:
+// none, sse4.1, avx2, avx512.
+//
+// Each kernel keeps a function pointer, initialised to its generic version,
+// and re-selects it when `ctx_cpu_simd_gen` changes (see cpu_dispatch_check).
+//
+
+#include <stdint.h>
+
+typedef enum
+{
+  CPU_SIMD_NONE,
+  CPU_SIMD_SSE41,  // SSE4.1 and POPCNT
+  CPU_SIMD_AVX2,   // AVX2 and POPCNT
+  CPU_SIMD_AVX512, // AVX-512 F, BW and VL
+  NUM_CPU_SIMD
+} CpuSimd;
+
+// Only x86-64 with gcc/clang can compile per-function target attributes
+#if defined(__x86_64__) && (defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+  #define CPU_DISPATCH 1
+  #define CPU_TARGET_SSE41  __attribute__((target("sse4.1,popcnt")))
+  #define CPU_TARGET_AVX2   __attribute__((target("avx2,popcnt")))
+  #define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2,popcnt")))
+#else
+  #define CPU_DISPATCH 0
+#endif
+
+// Level in use and a counter bumped each time it is set
+extern CpuSimd ctx_cpu_simd;
+extern uint32_t ctx_cpu_simd_gen;
+
+// Detect CPU features, called from cortex_init()
+void cpu_dispatch_init();
+
+// Highest level supported by this CPU (and CTX_SIMD)
+CpuSimd cpu_simd_supported();
+
+// Use SIMD level `lvl`, capped at cpu_simd_supported(). Returns level set.
+// Not thread safe, call before starting threads (used by tests and bench).
+CpuSimd cpu_simd_set(CpuSimd lvl);
+
+const char* cpu_simd_str(CpuSimd lvl);
+
+// Call `select()` to pick a kernel if the SIMD level has changed since `gen`
+#define cpu_dispatch_check(gen,select) do {                                    \
+  if((gen) != ctx_cpu_simd_gen) { select(ctx_cpu_simd); (gen) = ctx_cpu_simd_gen; } \
+} while(0)
+
+#endif /* CPU_DISPATCH_H_ */
@@ -2,8 +2,128 @@
 #include "ctx_alloc.h"
 #include "util.h"
 
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
 static volatile size_t ctx_num_allocs = 0, ctx_num_frees = 0;
 
+//
+// Accounting by tag
+//
+
+static const char *alloc_tag_names[NUM_ALLOC_TAGS]
+  = {"other", "graph", "links", "link_hash", "walkers", "reads"};
+
+static volatile size_t alloc_tag_mem[NUM_ALLOC_TAGS];
+static volatile size_t alloc_tag_peak[NUM_ALLOC_TAGS];
+static size_t alloc_tag_budget[NUM_ALLOC_TAGS];
+
+// Source files are matched by the start of their name, first match wins
+static const struct { const char *prefix; AllocTag tag; } alloc_tag_files[] = {
+  {"gpath_hash",       ALLOC_TAG_LINK_HASH},
+  {"gpath_follow",     ALLOC_TAG_WALKERS},
+  {"gpath",            ALLOC_TAG_LINK_STORE},
+  {"link_tree",        ALLOC_TAG_LINK_STORE},
+  {"db_graph",         ALLOC_TAG_GRAPH},
+  {"db_node",          ALLOC_TAG_GRAPH},
+  {"hash_table",       ALLOC_TAG_GRAPH},
+  {"covg_overflow",    ALLOC_TAG_GRAPH},
+  {"sparse_colours",   ALLOC_TAG_GRAPH},
+  {"shared_edges",     ALLOC_TAG_GRAPH},
+  {"kmer_bloom",       ALLOC_TAG_GRAPH},
+  {"read_start_hash",  ALLOC_TAG_GRAPH},
+  {"graph_search",     ALLOC_TAG_GRAPH},
+  {"graph_walker",     ALLOC_TAG_WALKERS},
+  {"repeat_walker",    ALLOC_TAG_WALKERS},
+  {"graph_crawler",    ALLOC_TAG_WALKERS},
+  {"graph_cache",      ALLOC_TAG_WALKERS},
+  {"graph_step",       ALLOC_TAG_WALKERS},
+  {"db_unitig",        ALLOC_TAG_WALKERS},
+  {"seq_",             ALLOC_TAG_READS},
+  {"async_read_io",    ALLOC_TAG_READS},
+  {"db_alignment",     ALLOC_TAG_READS},
+  {"correct_",         ALLOC_TAG_READS},
+  {"build_graph",      ALLOC_TAG_READS},
+  {"generate_paths",   ALLOC_TAG_READS},
+};
+
+#define NUM_ALLOC_TAG_FILES (sizeof(alloc_tag_files)/sizeof(alloc_tag_files[0]))
+
+AllocTag alloc_tag_of_file(const char *file)
+{
+  const char *base = strrchr(file, '/');
+  size_t i;
+  base = base ? base+1 : file;
+  for(i = 0; i < NUM_ALLOC_TAG_FILES; i++)
+    if(!strncmp(base, alloc_tag_files[i].prefix, strlen(alloc_tag_files[i].prefix)))
+      return alloc_tag_files[i].tag;
+  return ALLOC_TAG_OTHER;
+}
+
+// __FILE__ strings are constant, so cache the tag of each by address.
+// Each entry is the file pointer shifted up by 8 bits ORed with its tag.
+#define ALLOC_TAG_CACHE 256
+static volatile uint64_t alloc_tag_cache[ALLOC_TAG_CACHE];
+
+static inline AllocTag _file_tag(const char *file)
+{
+  uint64_t addr = (uint64_t)(uintptr_t)file;
+  size_t idx = (addr >> 4) & (ALLOC_TAG_CACHE-1);
+  uint64_t entry = alloc_tag_cache[idx];
+  if((entry >> 8) == (addr & (UINT64_MAX >> 8))) return (AllocTag)(entry & 0xff);
+  AllocTag tag = alloc_tag_of_file(file);
+  alloc_tag_cache[idx] = (addr << 8) | tag;
+  return tag;
+}
+
+static void _over_budget(AllocTag tag, size_t mem,
+                         const char *file, const char *func, int line)
+__attribute__((noreturn));
+
+static void _over_budget(AllocTag tag, size_t mem,
+                         const char *file, const char *func, int line)
+{
+  char memstr[50], budgetstr[50];
+  bytes_to_str(mem, 1, memstr);
+  bytes_to_str(alloc_tag_budget[tag], 1, budgetstr);
+  dief(file, func, line, "Memory budget exceeded: %s would use %s, budget is %s "
+       "(set with CTX_MEM_BUDGET)", alloc_tag_names[tag], memstr, budgetstr);
+}
+
+static inline void _tag_add(AllocTag tag, size_t nbytes,
+                            const char *file, const char *func, int line)
+{
+  size_t mem = __sync_add_and_fetch(&alloc_tag_mem[tag], nbytes), peak;
+  if(alloc_tag_budget[tag] && mem > alloc_tag_budget[tag])
+    _over_budget(tag, mem, file, func, line);
+  while((peak = alloc_tag_peak[tag]) < mem &&
+        !__sync_bool_compare_and_swap(&alloc_tag_peak[tag], peak, mem)) {}
+}
+
+static inline void _tag_sub(AllocTag tag, size_t nbytes)
+{
+  __sync_sub_and_fetch(&alloc_tag_mem[tag], nbytes);
+}
+
+// Header before each allocation, keeps the memory returned 16 byte aligned
+#define ALLOC_MAGIC 0x6374786d /* "ctxm" */
+
+typedef struct
+{
+  uint32_t magic, tag;
+  size_t size;
+} AllocHdr;
+
+#define ALLOC_HDR_SIZE 16
+
+static inline AllocHdr* _alloc_hdr(void *ptr)
+{
+  AllocHdr *hdr = (AllocHdr*)((char*)ptr - ALLOC_HDR_SIZE);
+  return hdr->magic == ALLOC_MAGIC ? hdr : NULL;
+}
+
 static inline void _oom(void *ptr, size_t nel, size_t elsize,
                         const char *file, const char *func, int line)
 __attribute__((noreturn));
@@ -24,19 +144,43 @@ static inline void _oom(void *ptr, size_t nel, size_t elsize,
 void* alloc_mem(void *ptr, size_t nel, size_t elsize, bool zero,
                 const char *file, const char *func, int line)
 {
-  void *ptr2;
-  if(nel && elsize && SIZE_MAX / elsize < nel)
+  AllocHdr *hdr = NULL, *hdr2;
+  AllocTag tag;
+  size_t size, oldsize = 0;
+
+  if(nel && elsize && (SIZE_MAX - ALLOC_HDR_SIZE) / elsize < nel)
     _oom(ptr, nel, elsize, file, func, line);
 
-  if(ptr || !zero)
-    ptr2 = realloc(ptr, nel*elsize);
+  size = nel * elsize;
+
+  if(ptr != NULL && (hdr = _alloc_hdr(ptr)) == NULL) {
+    // Not allocated by us, cannot account for it
+    void *ptr2 = realloc(ptr, size);
+    if(ptr2 == NULL) _oom(ptr, nel, elsize, file, func, line);
+    return ptr2;
+  }
+
+  // Resized memory stays with the tag it was allocated under
+  if(hdr != NULL) { tag = hdr->tag; oldsize = hdr->size; }
+  else tag = _file_tag(file);
+
+  // Count before allocating, so we fail before going over budget
+  if(size > oldsize) _tag_add(tag, size - oldsize, file, func, line);
+
+  if(hdr || !zero)
+    hdr2 = realloc(hdr, ALLOC_HDR_SIZE + size);
   else
-    ptr2 = calloc(nel, elsize);
+    hdr2 = calloc(1, ALLOC_HDR_SIZE + size);
 
-  if(ptr2 == NULL) _oom(ptr, nel, elsize, file, func, line);
+  if(hdr2 == NULL) _oom(ptr, nel, elsize, file, func, line);
+  if(size < oldsize) _tag_sub(tag, oldsize - size);
   if(ptr == NULL) __sync_add_and_fetch(&ctx_num_allocs, 1); // ++ctx_num_allocs
 
-  return ptr2;
+  hdr2->magic = ALLOC_MAGIC;
+  hdr2->tag = tag;
+  hdr2->size = size;
+
+  return (char*)hdr2 + ALLOC_HDR_SIZE;
 }
 
 // Allocate / resize memory, ensure all new memory is zero'ed
@@ -53,9 +197,150 @@ void* alloc_recallocarray(void *ptr, size_t oldnel, size_t newnel, size_t elsize
 // `ptr` can be NULL
 void alloc_free(void *ptr)
 {
-  free(ptr);
-  if(ptr != NULL)
+  if(ptr == NULL) return;
+  AllocHdr *hdr = _alloc_hdr(ptr);
+  if(hdr != NULL) {
+    _tag_sub(hdr->tag, hdr->size);
+    hdr->magic = 0;
+    free(hdr);
+  }
+  else free(ptr);
+  __sync_add_and_fetch(&ctx_num_frees, 1); // ++ctx_num_frees
+}
+
+//
+// Large allocations
+//
+
+// Header at the start of each large allocation. Padded to a cache line so
+// the memory returned is cache line aligned.
+#define LARGE_HDR_SIZE 64
+
+typedef struct
+{
+  size_t len; // length of mapping, including header
+  AllocPages pages;
+  AllocTag tag;
+} LargeAllocHdr;
+
+#ifndef MAP_HUGE_SHIFT
+  #define MAP_HUGE_SHIFT 26
+#endif
+
+// Returns the number of NUMA nodes, or 1 if unknown
+static size_t _numa_num_nodes()
+{
+  DIR *dir = opendir("/sys/devices/system/node");
+  struct dirent *ent;
+  unsigned int n, max = 0;
+  if(dir == NULL) return 1;
+  while((ent = readdir(dir)) != NULL)
+    if(sscanf(ent->d_name, "node%u", &n) == 1 && n+1 > max) max = n+1;
+  closedir(dir);
+  return max ? max : 1;
+}
+
+// Interleave pages across all NUMA nodes. Must be called before the memory
+// is first touched. Failure is not an error - pages are just not spread.
+static void _numa_interleave(void *ptr, size_t len)
+{
+  #if defined(__linux__) && defined(SYS_mbind)
+    const int mpol_interleave = 3; // MPOL_INTERLEAVE from <numaif.h>
+    size_t nnodes = MIN2(_numa_num_nodes(), 64);
+    if(nnodes > 1) {
+      unsigned long nodemask = nnodes == 64 ? ~0UL : (1UL << nnodes) - 1;
+      syscall(SYS_mbind, ptr, len, mpol_interleave, &nodemask, nnodes+1, 0);
+    }
+  #else
+    (void)ptr; (void)len;
+  #endif
+}
+
+static void* _map_anon(size_t len, int flags)
+{
+  void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+void* alloc_large(size_t nel, size_t elsize,
+                  const char *file, const char *func, int line)
+{
+  const size_t mb2 = 1UL<<21, gb1 = 1UL<<30;
+  LargeAllocHdr *hdr = NULL;
+  AllocPages pages = ALLOC_PAGES_DEFAULT;
+  size_t need, len;
+
+  if(nel && elsize && (SIZE_MAX - LARGE_HDR_SIZE) / elsize < nel)
+    _oom(NULL, nel, elsize, file, func, line);
+
+  need = len = nel * elsize + LARGE_HDR_SIZE;
+
+  AllocTag tag = _file_tag(file);
+  _tag_add(tag, need, file, func, line);
+
+  #ifdef MAP_HUGETLB
+    // hugetlbfs pages must be reserved by the admin, fail quickly otherwise
+    if(need >= gb1) {
+      len = (need + gb1 - 1) & ~(gb1 - 1);
+      hdr = _map_anon(len, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+      pages = ALLOC_PAGES_1GB;
+    }
+    if(hdr == NULL && need >= mb2) {
+      len = (need + mb2 - 1) & ~(mb2 - 1);
+      hdr = _map_anon(len, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT));
+      pages = ALLOC_PAGES_2MB;
+    }
+  #endif
+
+  if(hdr == NULL) {
+    len = need;
+    pages = ALLOC_PAGES_DEFAULT;
+    hdr = _map_anon(len, 0);
+    if(hdr == NULL) _oom(NULL, nel, elsize, file, func, line);
+    #ifdef MADV_HUGEPAGE
+      if(len >= mb2 && madvise(hdr, len, MADV_HUGEPAGE) == 0)
+        pages = ALLOC_PAGES_THP;
+    #endif
+  }
+
+  _numa_interleave(hdr, len);
+
+  hdr->len = len;
+  hdr->pages = pages;
+  hdr->tag = tag;
+
+  // Count what was actually mapped (rounded up to the page size used)
+  if(len > need) _tag_add(tag, len - need, file, func, line);
+  __sync_add_and_fetch(&ctx_num_allocs, 1); // ++ctx_num_allocs
+
+  return (char*)hdr + LARGE_HDR_SIZE;
+}
+
+// `ptr` can be NULL
+void alloc_large_free(void *ptr)
+{
+  if(ptr != NULL) {
+    LargeAllocHdr *hdr = (LargeAllocHdr*)((char*)ptr - LARGE_HDR_SIZE);
+    _tag_sub(hdr->tag, hdr->len);
+    munmap(hdr, hdr->len);
     __sync_add_and_fetch(&ctx_num_frees, 1); // ++ctx_num_frees
+  }
+}
+
+AllocPages alloc_large_pages(const void *ptr)
+{
+  return ((const LargeAllocHdr*)((const char*)ptr - LARGE_HDR_SIZE))->pages;
+}
+
+const char* alloc_pages_str(AllocPages pages)
+{
+  switch(pages) {
+    case ALLOC_PAGES_THP: return "transparent huge pages";
+    case ALLOC_PAGES_2MB: return "2MB huge pages";
+    case ALLOC_PAGES_1GB: return "1GB huge pages";
+    default: return "default pages";
+  }
 }
 
 size_t alloc_get_num_allocs()
@@ -67,3 +352,70 @@ size_t alloc_get_num_frees()
 {
   return (size_t)ctx_num_frees;
 }
+
+//
+// Accounting by tag
+//
+
+const char* alloc_tag_str(AllocTag tag)
+{
+  return tag < NUM_ALLOC_TAGS ? alloc_tag_names[tag] : "unknown";
+}
+
+size_t alloc_get_tag_mem(AllocTag tag)
+{
+  return alloc_tag_mem[tag];
+}
+
+size_t alloc_get_tag_peak(AllocTag tag)
+{
+  return alloc_tag_peak[tag];
+}
+
+void alloc_set_tag_budget(AllocTag tag, size_t bytes)
+{
+  alloc_tag_budget[tag] = bytes;
+}
+
+size_t alloc_get_tag_budget(AllocTag tag)
+{
+  return alloc_tag_budget[tag];
+}
+
+void alloc_init()
+{
+  const char *env = getenv("CTX_MEM_BUDGET");
+  char buf[256], *tok, *save = NULL, *eq;
+  size_t bytes;
+  AllocTag tag;
+
+  if(env == NULL || !*env) return;
+  if(strlen(env) >= sizeof(buf)) die("CTX_MEM_BUDGET too long: %s", env);
+  strcpy(buf, env);
+
+  for(tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+  {
+    if((eq = strchr(tok, '=')) == NULL)
+      die("Bad CTX_MEM_BUDGET entry, expected <tag>=<mem>: %s", tok);
+    *eq = '\0';
+    for(tag = 0; tag < NUM_ALLOC_TAGS && strcmp(tok, alloc_tag_names[tag]); tag++) {}
+    if(tag == NUM_ALLOC_TAGS)
+      die("Bad CTX_MEM_BUDGET tag: %s (expected one of other,graph,links,"
+          "link_hash,walkers,reads)", tok);
+    if(!mem_to_integer(eq+1, &bytes) || bytes == 0)
+      die("Bad CTX_MEM_BUDGET memory for %s: %s", tok, eq+1);
+    alloc_tag_budget[tag] = bytes;
+  }
+}
+
+void alloc_print_tag_stats()
+{
+  char line[400], memstr[50];
+  size_t i, n = 0;
+  for(i = 0; i < NUM_ALLOC_TAGS; i++) {
+    bytes_to_str(alloc_tag_peak[i], 1, memstr);
+    n += snprintf(line+n, sizeof(line)-n, "%s%s=%s", i ? " " : "",
+                  alloc_tag_names[i], memstr);
+  }
+  status("[memory] peak by tag: %s", line);
+}
@@ -11,6 +11,11 @@
 // etc. have returned NULL and exit with an informative message with line number
 // of offending call.
 //
+// Memory is also accounted to a subsystem (AllocTag) picked from the source
+// file of the call. Current and peak bytes are kept per tag. Each allocation
+// carries a small header recording its size and tag, so memory from
+// ctx_malloc() etc. must only be resized / freed with ctx_realloc() / ctx_free().
+//
 
 // Macros for memory management
 // `ptr` can be NULL
@@ -33,8 +38,73 @@ void* alloc_recallocarray(void *ptr, size_t oldnel, size_t newnel, size_t elsize
 // Free allocated memory, `ptr` is allowed to be NULL
 void alloc_free(void *ptr);
 
+//
+// Large allocations for graph arrays, mapped directly from the OS
+//
+// Tries 1GB then 2MB huge pages (hugetlbfs), otherwise asks for transparent
+// huge pages with madvise(). On machines with more than one NUMA node, pages
+// are interleaved across all nodes. Hash table accesses are random, so
+// interleaving beats binding partitions of the table to particular nodes.
+// Memory is zero'd. Must be freed with ctx_free_large().
+//
+#define ctx_calloc_large(nel,elsize) alloc_large(nel,elsize,__FILE__,__func__,__LINE__)
+#define ctx_free_large(ptr) alloc_large_free(ptr)
+
+typedef enum
+{
+  ALLOC_PAGES_DEFAULT = 0, // normal pages (usually 4KB)
+  ALLOC_PAGES_THP     = 1, // transparent huge pages requested with madvise
+  ALLOC_PAGES_2MB     = 2, // hugetlbfs 2MB pages
+  ALLOC_PAGES_1GB     = 3  // hugetlbfs 1GB pages
+} AllocPages;
+
+void* alloc_large(size_t nel, size_t elsize,
+                  const char *file, const char *func, int line);
+
+// `ptr` is allowed to be NULL
+void alloc_large_free(void *ptr);
+
+// Page type obtained for a pointer returned by alloc_large()
+AllocPages alloc_large_pages(const void *ptr);
+const char* alloc_pages_str(AllocPages pages);
+
 // Get number of allocations / frees
 size_t alloc_get_num_allocs();
 size_t alloc_get_num_frees();
 
+//
+// Memory accounting by subsystem
+//
+typedef enum
+{
+  ALLOC_TAG_OTHER,
+  ALLOC_TAG_GRAPH,      // hash table, edges, coverage, colours
+  ALLOC_TAG_LINK_STORE, // GPathStore, GPathSet, link reading / writing
+  ALLOC_TAG_LINK_HASH,  // GPathHash
+  ALLOC_TAG_WALKERS,    // graph walkers, crawlers and caches
+  ALLOC_TAG_READS,      // reading, aligning and correcting reads
+  NUM_ALLOC_TAGS
+} AllocTag;
+
+// Set budgets from the environment variable CTX_MEM_BUDGET, a comma separated
+// list of <tag>=<mem> e.g. CTX_MEM_BUDGET=graph=8G,links=1G
+// Called from cortex_init()
+void alloc_init();
+
+const char* alloc_tag_str(AllocTag tag);
+
+// Tag of allocations made from source file `file` (e.g. __FILE__)
+AllocTag alloc_tag_of_file(const char *file);
+
+// Current and peak bytes allocated under a tag
+size_t alloc_get_tag_mem(AllocTag tag);
+size_t alloc_get_tag_peak(AllocTag tag);
+
+// Exit with an error if `tag` would use more than `bytes`. 0 means no limit.
+void alloc_set_tag_budget(AllocTag tag, size_t bytes);
+size_t alloc_get_tag_budget(AllocTag tag);
+
+// Print peak memory used by each tag
+void alloc_print_tag_stats();
+
 #endif /* CTX_ALLOC_H_ */
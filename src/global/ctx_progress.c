@@ -0,0 +1,237 @@
+#include "global.h"
+#include "ctx_progress.h"
+#include "ctx_stats.h"
+#include "cJSON/cJSON.h"
+
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define PROGRESS_MAX_THREADS 1024
+
+typedef struct
+{
+  const char *name;
+  size_t capacity;
+  const volatile size_t *depth;
+} ProgressQueue;
+
+static struct
+{
+  char *path, *tmppath;
+  const char *cmd;
+  uint64_t interval_ns, start_ns, last_ns;
+  bool running, stop;
+  pthread_t th;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  ProgressQueue queues[CTX_PROGRESS_MAX_QUEUES];
+  // Counters at the last report, to get rates and find stalled threads
+  uint64_t last[NUM_CTX_STATS];
+  uint64_t *last_threads, *curr_threads; // [PROGRESS_MAX_THREADS*NUM_CTX_STATS]
+  size_t last_nthreads, nreports;
+} progress = {.running = false, .lock = PTHREAD_MUTEX_INITIALIZER,
+              .cond = PTHREAD_COND_INITIALIZER};
+
+size_t ctx_progress_add_queue(const char *name, size_t capacity,
+                              const volatile size_t *depth)
+{
+  size_t i, id = SIZE_MAX;
+  pthread_mutex_lock(&progress.lock);
+  if(progress.running) {
+    for(i = 0; i < CTX_PROGRESS_MAX_QUEUES && progress.queues[i].depth; i++) {}
+    if(i < CTX_PROGRESS_MAX_QUEUES) {
+      progress.queues[i] = (ProgressQueue){.name = name, .capacity = capacity,
+                                           .depth = depth};
+      id = i;
+    }
+  }
+  pthread_mutex_unlock(&progress.lock);
+  return id;
+}
+
+void ctx_progress_del_queue(size_t id)
+{
+  if(id == SIZE_MAX) return;
+  pthread_mutex_lock(&progress.lock);
+  memset(&progress.queues[id], 0, sizeof(progress.queues[id]));
+  pthread_mutex_unlock(&progress.lock);
+}
+
+static cJSON* progress_counts_json(const uint64_t *counts)
+{
+  cJSON *json = cJSON_CreateObject();
+  size_t i;
+  for(i = 0; i < NUM_CTX_STATS; i++)
+    cJSON_AddItemToObject(json, ctx_stats_name(i), cJSON_CreateNumber(counts[i]));
+  return json;
+}
+
+// Called with progress.lock held
+static void progress_write(bool final)
+{
+  uint64_t now = ctx_stats_now_ns(), counts[NUM_CTX_STATS];
+  double secs = (now - progress.last_ns) / 1e9, elapsed;
+  size_t i, t, nthreads;
+  elapsed = (now - progress.start_ns) / 1e9;
+
+  ctx_stats_sum(counts);
+  nthreads = ctx_stats_threads(progress.curr_threads, PROGRESS_MAX_THREADS);
+  nthreads = MIN2(nthreads, PROGRESS_MAX_THREADS);
+
+  cJSON *json = cJSON_CreateObject(), *obj, *arr;
+  const char *phase = ctx_stats_current_phase();
+  cJSON_AddItemToObject(json, "command", cJSON_CreateString(progress.cmd));
+  cJSON_AddItemToObject(json, "phase", phase ? cJSON_CreateString(phase)
+                                             : cJSON_CreateNull());
+  cJSON_AddItemToObject(json, "finished", cJSON_CreateBool(final));
+  cJSON_AddItemToObject(json, "elapsed_sec", cJSON_CreateNumber(elapsed));
+  cJSON_AddItemToObject(json, "report", cJSON_CreateNumber(progress.nreports));
+  cJSON_AddItemToObject(json, "counters", progress_counts_json(counts));
+
+  // Per second since the last report
+  obj = cJSON_CreateObject();
+  for(i = 0; i < NUM_CTX_STATS; i++) {
+    double rate = secs > 0 ? (counts[i] - progress.last[i]) / secs : 0;
+    cJSON_AddItemToObject(obj, ctx_stats_name(i), cJSON_CreateNumber(rate));
+  }
+  cJSON_AddItemToObject(json, "rates", obj);
+
+  arr = cJSON_CreateArray();
+  for(i = 0; i < CTX_PROGRESS_MAX_QUEUES; i++) {
+    const ProgressQueue *q = &progress.queues[i];
+    if(q->depth == NULL) continue;
+    obj = cJSON_CreateObject();
+    cJSON_AddItemToObject(obj, "name", cJSON_CreateString(q->name));
+    cJSON_AddItemToObject(obj, "depth", cJSON_CreateNumber(*q->depth));
+    cJSON_AddItemToObject(obj, "capacity", cJSON_CreateNumber(q->capacity));
+    cJSON_AddItemToArray(arr, obj);
+  }
+  cJSON_AddItemToObject(json, "queues", arr);
+
+  // Time waiting on queues is idle, a thread is stalled if nothing changed
+  arr = cJSON_CreateArray();
+  for(t = 0; t < nthreads; t++) {
+    const uint64_t *curr = progress.curr_threads + t*NUM_CTX_STATS;
+    const uint64_t *prev = progress.last_threads + t*NUM_CTX_STATS;
+    bool seen = t < progress.last_nthreads;
+    uint64_t wait_ns = curr[CTX_STAT_MSGPOOL_READ_NS] +
+                       curr[CTX_STAT_MSGPOOL_WRITE_NS];
+    if(seen) wait_ns -= prev[CTX_STAT_MSGPOOL_READ_NS] +
+                        prev[CTX_STAT_MSGPOOL_WRITE_NS];
+    double idle = secs > 0 ? MIN2(wait_ns / (secs*1e9), 1.0) : 0;
+    bool stalled = seen && !final &&
+                   memcmp(curr, prev, NUM_CTX_STATS*sizeof(uint64_t)) == 0;
+    obj = cJSON_CreateObject();
+    cJSON_AddItemToObject(obj, "thread", cJSON_CreateNumber(t));
+    cJSON_AddItemToObject(obj, "busy", cJSON_CreateNumber(1.0 - idle));
+    cJSON_AddItemToObject(obj, "idle", cJSON_CreateNumber(idle));
+    cJSON_AddItemToObject(obj, "stalled", cJSON_CreateBool(stalled));
+    cJSON_AddItemToArray(arr, obj);
+  }
+  cJSON_AddItemToObject(json, "threads", arr);
+
+  size_t alloc_bytes = 0;
+  AllocTag tag;
+  for(tag = 0; tag < NUM_ALLOC_TAGS; tag++) alloc_bytes += alloc_get_tag_mem(tag);
+  cJSON_AddItemToObject(json, "alloc_bytes", cJSON_CreateNumber(alloc_bytes));
+
+  char *jstr = cJSON_Print(json);
+  FILE *fout = fopen(progress.tmppath, "w");
+  if(fout == NULL) warn("Cannot write progress: %s [%s]", progress.tmppath, strerror(errno));
+  else {
+    fputs(jstr, fout);
+    fputc('\n', fout);
+    if(fclose(fout) != 0 || rename(progress.tmppath, progress.path) != 0)
+      warn("Cannot write progress: %s [%s]", progress.path, strerror(errno));
+  }
+  free(jstr);
+  cJSON_Delete(json);
+
+  memcpy(progress.last, counts, sizeof(counts));
+  SWAP(progress.last_threads, progress.curr_threads);
+  progress.last_nthreads = nthreads;
+  progress.last_ns = now;
+  progress.nreports++;
+}
+
+static void* progress_thread(void *arg)
+{
+  (void)arg;
+  struct timespec ts;
+  uint64_t wake;
+
+  pthread_mutex_lock(&progress.lock);
+  while(!progress.stop)
+  {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wake = (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec + progress.interval_ns;
+    ts.tv_sec = wake / 1000000000UL;
+    ts.tv_nsec = wake % 1000000000UL;
+    while(!progress.stop &&
+          pthread_cond_timedwait(&progress.cond, &progress.lock, &ts) != ETIMEDOUT) {}
+    if(!progress.stop) progress_write(false);
+  }
+  pthread_mutex_unlock(&progress.lock);
+  return NULL;
+}
+
+void ctx_progress_start(const char *path, double secs, const char *cmd)
+{
+  ctx_assert(!progress.running);
+  if(secs <= 0) die("Progress interval must be positive: %f", secs);
+  if(!ctx_stats_on) ctx_stats_init();
+
+  size_t len = strlen(path);
+  progress.path = ctx_malloc(len+1);
+  progress.tmppath = ctx_malloc(len+5);
+  memcpy(progress.path, path, len+1);
+  memcpy(progress.tmppath, path, len);
+  memcpy(progress.tmppath+len, ".tmp", 5);
+
+  progress.cmd = cmd;
+  progress.interval_ns = secs * 1e9;
+  progress.start_ns = progress.last_ns = ctx_stats_now_ns();
+  progress.stop = false;
+  progress.nreports = progress.last_nthreads = 0;
+  memset(progress.last, 0, sizeof(progress.last));
+  memset(progress.queues, 0, sizeof(progress.queues));
+  progress.last_threads = ctx_calloc(PROGRESS_MAX_THREADS*NUM_CTX_STATS,
+                                     sizeof(uint64_t));
+  progress.curr_threads = ctx_calloc(PROGRESS_MAX_THREADS*NUM_CTX_STATS,
+                                     sizeof(uint64_t));
+
+  // Fail early if we cannot write the file
+  FILE *fout = fopen(progress.tmppath, "w");
+  if(fout == NULL) die("Cannot write progress: %s [%s]", progress.tmppath, strerror(errno));
+  fclose(fout);
+
+  pthread_mutex_lock(&progress.lock);
+  progress_write(false);
+  progress.running = true;
+  pthread_mutex_unlock(&progress.lock);
+
+  int rc = pthread_create(&progress.th, NULL, progress_thread, NULL);
+  if(rc != 0) die("Creating progress thread failed: %s", strerror(rc));
+}
+
+void ctx_progress_stop()
+{
+  if(!progress.running) return;
+
+  pthread_mutex_lock(&progress.lock);
+  progress.stop = true;
+  pthread_cond_signal(&progress.cond);
+  pthread_mutex_unlock(&progress.lock);
+  pthread_join(progress.th, NULL);
+
+  pthread_mutex_lock(&progress.lock);
+  progress_write(true);
+  progress.running = false;
+  pthread_mutex_unlock(&progress.lock);
+
+  ctx_free(progress.path);
+  ctx_free(progress.tmppath);
+  ctx_free(progress.last_threads);
+  ctx_free(progress.curr_threads);
+}
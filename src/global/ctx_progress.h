@@ -0,0 +1,40 @@
+#ifndef CTX_PROGRESS_H_
+#define CTX_PROGRESS_H_
+
+//
+// Live progress report for long running commands (--progress <file>)
+//
+// A reporter thread wakes every few seconds and rewrites a small JSON file
+// with the profiling counters from ctx_stats.h, their rates since the last
+// report, the depth of registered queues and how busy each thread has been.
+// The file is written to <file>.tmp then renamed, so readers never see a
+// partial report. Counting is per thread and the reporter only sums the
+// counters, so it is cheap enough to leave on.
+//
+// Threads are reported as stalled if none of their counters changed since the
+// previous report.
+//
+
+#include <stddef.h>
+
+#define CTX_PROGRESS_DEFAULT_SECS 10
+#define CTX_PROGRESS_MAX_QUEUES 16
+
+// Start writing reports to `path` every `secs` seconds. Turns on ctx_stats
+// counters if not already on. `cmd` is the name of the command being run.
+void ctx_progress_start(const char *path, double secs, const char *cmd);
+
+// Write a final report and stop the reporter thread
+void ctx_progress_stop();
+
+// Report the depth of a queue holding up to `capacity` items. `depth` must be
+// valid until ctx_progress_del_queue() is called. Returns an id to remove it
+// with, or SIZE_MAX if the reporter is not running or too many queues are
+// registered.
+size_t ctx_progress_add_queue(const char *name, size_t capacity,
+                              const volatile size_t *depth);
+
+// Remove a queue, ignores SIZE_MAX
+void ctx_progress_del_queue(size_t id);
+
+#endif /* CTX_PROGRESS_H_ */
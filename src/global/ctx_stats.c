@@ -0,0 +1,387 @@
+#include "global.h"
+#include "ctx_stats.h"
+#include "cJSON/cJSON.h"
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h> // getrusage()
+
+#define CTX_STATS_MAX_PHASES 128
+#define CTX_STATS_MAX_REHASH 64
+#define CTX_STATS_MAX_FILL 256
+
+static const char *ctx_stat_names[NUM_CTX_STATS] = {
+  "kmers_inserted", "kmer_lookups", "kmer_filtered", "links_added",
+  "lock_acquires",
+  "lock_waits", "lookup_samples", "lookup_hits",
+  "msgpool_write_wait_ns", "msgpool_read_wait_ns",
+  "reads", "bases", "bubbles", "bytes_in", "bytes_out",
+  "kmers_mapped"
+};
+
+typedef struct CtxStatsThreadStruct CtxStatsThread;
+
+struct CtxStatsThreadStruct
+{
+  uint64_t counts[NUM_CTX_STATS];
+  uint64_t probes[CTX_STATS_MAX_PROBES];
+  size_t nlookups; // counts down to the next sampled lookup
+  size_t id;
+  CtxStatsThread *next;
+};
+
+typedef struct
+{
+  uint64_t wall_ns, user_us, sys_us;
+} CtxStatsTime;
+
+typedef struct
+{
+  const char *name;
+  CtxStatsTime start, end;
+  uint64_t counts[NUM_CTX_STATS]; // counter totals at start, then the delta
+  uint64_t max_rss_kb;
+  bool ended;
+} CtxStatsPhase;
+
+bool ctx_stats_on = false;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread CtxStatsThread *stats_local = NULL;
+// Bumped by ctx_stats_destroy() so threads drop their freed stats_local
+static size_t stats_gen = 0;
+static __thread size_t stats_local_gen = 0;
+static CtxStatsThread *stats_threads = NULL;
+static size_t stats_nthreads = 0;
+
+static CtxStatsTime stats_start;
+static CtxStatsPhase stats_phases[CTX_STATS_MAX_PHASES];
+static size_t stats_nphases = 0;
+
+static struct {
+  uint64_t collisions[CTX_STATS_MAX_REHASH];
+  size_t ncollisions;
+  uint64_t fill[CTX_STATS_MAX_FILL];
+  size_t nfill;
+  uint64_t num_kmers, capacity;
+  bool set;
+} stats_ht;
+
+uint64_t ctx_stats_now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+#define timeval_us(tv) ((uint64_t)(tv).tv_sec * 1000000UL + (uint64_t)(tv).tv_usec)
+
+static uint64_t stats_get_time(CtxStatsTime *t)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  t->wall_ns = ctx_stats_now_ns();
+  t->user_us = timeval_us(ru.ru_utime);
+  t->sys_us = timeval_us(ru.ru_stime);
+  return (uint64_t)ru.ru_maxrss; // kilobytes on linux
+}
+
+void ctx_stats_init()
+{
+  stats_get_time(&stats_start);
+  ctx_stats_on = true;
+}
+
+void ctx_stats_destroy()
+{
+  CtxStatsThread *t, *next;
+  pthread_mutex_lock(&stats_lock);
+  for(t = stats_threads; t != NULL; t = next) { next = t->next; ctx_free(t); }
+  stats_threads = NULL;
+  stats_nthreads = stats_nphases = 0;
+  stats_ht.set = false;
+  stats_gen++;
+  ctx_stats_on = false;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+// Called the first time a thread adds to a counter
+static CtxStatsThread* stats_thread_register()
+{
+  CtxStatsThread *t = ctx_calloc(1, sizeof(CtxStatsThread));
+  pthread_mutex_lock(&stats_lock);
+  t->id = stats_nthreads++;
+  t->next = stats_threads;
+  stats_threads = t;
+  pthread_mutex_unlock(&stats_lock);
+  return t;
+}
+
+static inline CtxStatsThread* stats_thread()
+{
+  if(stats_local == NULL || stats_local_gen != stats_gen) {
+    stats_local = stats_thread_register();
+    stats_local_gen = stats_gen;
+  }
+  return stats_local;
+}
+
+void ctx_stats_incr(CtxStat stat, uint64_t n)
+{
+  stats_thread()->counts[stat] += n;
+}
+
+void ctx_stats_sample_lookup(size_t nprobes, bool found)
+{
+  CtxStatsThread *t = stats_thread();
+  if(t->nlookups-- > 0) return;
+  t->nlookups = CTX_STATS_SAMPLE_RATE-1;
+  t->counts[CTX_STAT_LOOKUP_SAMPLES]++;
+  t->counts[CTX_STAT_LOOKUP_HITS] += found;
+  nprobes = MIN2(MAX2(nprobes,1), CTX_STATS_MAX_PROBES);
+  t->probes[nprobes-1]++;
+}
+
+// Sum counters over all threads. Other threads may still be running, so this
+// is a snapshot.
+void ctx_stats_sum(uint64_t counts[NUM_CTX_STATS])
+{
+  const CtxStatsThread *t;
+  size_t i;
+  memset(counts, 0, NUM_CTX_STATS * sizeof(uint64_t));
+  pthread_mutex_lock(&stats_lock);
+  for(t = stats_threads; t != NULL; t = t->next)
+    for(i = 0; i < NUM_CTX_STATS; i++)
+      counts[i] += ((volatile uint64_t*)t->counts)[i];
+  pthread_mutex_unlock(&stats_lock);
+}
+
+size_t ctx_stats_threads(uint64_t *counts, size_t max)
+{
+  const CtxStatsThread *t;
+  size_t i, n;
+  pthread_mutex_lock(&stats_lock);
+  for(t = stats_threads; t != NULL; t = t->next)
+    if(t->id < max)
+      for(i = 0; i < NUM_CTX_STATS; i++)
+        counts[t->id*NUM_CTX_STATS+i] = ((volatile uint64_t*)t->counts)[i];
+  n = stats_nthreads;
+  pthread_mutex_unlock(&stats_lock);
+  return n;
+}
+
+const char* ctx_stats_name(CtxStat stat)
+{
+  ctx_assert(stat < NUM_CTX_STATS);
+  return ctx_stat_names[stat];
+}
+
+void ctx_stats_probe_hist(uint64_t hist[CTX_STATS_MAX_PROBES])
+{
+  const CtxStatsThread *t;
+  size_t i;
+  memset(hist, 0, CTX_STATS_MAX_PROBES * sizeof(uint64_t));
+  pthread_mutex_lock(&stats_lock);
+  for(t = stats_threads; t != NULL; t = t->next)
+    for(i = 0; i < CTX_STATS_MAX_PROBES; i++)
+      hist[i] += ((volatile uint64_t*)t->probes)[i];
+  pthread_mutex_unlock(&stats_lock);
+}
+
+uint64_t ctx_stats_total(CtxStat stat)
+{
+  uint64_t counts[NUM_CTX_STATS];
+  ctx_stats_sum(counts);
+  return counts[stat];
+}
+
+size_t ctx_stats_phase_start(const char *name)
+{
+  if(!ctx_stats_on) return 0;
+  if(stats_nphases == CTX_STATS_MAX_PHASES) {
+    warn("Too many phases to record: %s", name);
+    return SIZE_MAX;
+  }
+  CtxStatsPhase *p = &stats_phases[stats_nphases];
+  memset(p, 0, sizeof(*p));
+  p->name = name;
+  ctx_stats_sum(p->counts);
+  stats_get_time(&p->start);
+  return stats_nphases++;
+}
+
+void ctx_stats_phase_end(size_t phase)
+{
+  if(!ctx_stats_on || phase >= stats_nphases) return;
+  CtxStatsPhase *p = &stats_phases[phase];
+  uint64_t counts[NUM_CTX_STATS];
+  size_t i;
+  p->max_rss_kb = stats_get_time(&p->end);
+  ctx_stats_sum(counts);
+  for(i = 0; i < NUM_CTX_STATS; i++) p->counts[i] = counts[i] - p->counts[i];
+  p->ended = true;
+}
+
+const char* ctx_stats_current_phase()
+{
+  size_t i = stats_nphases;
+  while(i > 0 && stats_phases[i-1].ended) i--;
+  return i > 0 ? stats_phases[i-1].name : NULL;
+}
+
+void ctx_stats_hash_table(const uint64_t *collisions, size_t ncollisions,
+                          const uint64_t *fill_hist, size_t nfill,
+                          uint64_t num_kmers, uint64_t capacity)
+{
+  if(!ctx_stats_on) return;
+  stats_ht.ncollisions = MIN2(ncollisions, CTX_STATS_MAX_REHASH);
+  memcpy(stats_ht.collisions, collisions, stats_ht.ncollisions*sizeof(uint64_t));
+  stats_ht.nfill = MIN2(nfill, CTX_STATS_MAX_FILL);
+  memcpy(stats_ht.fill, fill_hist, stats_ht.nfill*sizeof(uint64_t));
+  stats_ht.num_kmers = num_kmers;
+  stats_ht.capacity = capacity;
+  stats_ht.set = true;
+}
+
+static cJSON* stats_counts_json(const uint64_t counts[NUM_CTX_STATS])
+{
+  cJSON *json = cJSON_CreateObject();
+  size_t i;
+  for(i = 0; i < NUM_CTX_STATS; i++)
+    cJSON_AddItemToObject(json, ctx_stat_names[i], cJSON_CreateNumber(counts[i]));
+  return json;
+}
+
+static void stats_add_times(cJSON *json, const CtxStatsTime *start,
+                            const CtxStatsTime *end, uint64_t max_rss_kb)
+{
+  double wall = (end->wall_ns - start->wall_ns) / 1e9;
+  double user = (end->user_us - start->user_us) / 1e6;
+  double sys = (end->sys_us - start->sys_us) / 1e6;
+  cJSON_AddItemToObject(json, "wall_sec", cJSON_CreateNumber(wall));
+  cJSON_AddItemToObject(json, "user_sec", cJSON_CreateNumber(user));
+  cJSON_AddItemToObject(json, "sys_sec", cJSON_CreateNumber(sys));
+  // Average number of cores kept busy
+  cJSON_AddItemToObject(json, "cpu_util",
+                        cJSON_CreateNumber(wall > 0 ? (user+sys)/wall : 0));
+  cJSON_AddItemToObject(json, "max_rss_bytes",
+                        cJSON_CreateNumber((double)max_rss_kb * 1024));
+}
+
+static cJSON* stats_array_json(const uint64_t *arr, size_t n)
+{
+  cJSON *json = cJSON_CreateArray();
+  size_t i;
+  for(i = 0; i < n; i++) cJSON_AddItemToArray(json, cJSON_CreateNumber(arr[i]));
+  return json;
+}
+
+// Hit ratio and probe distances of sampled lookups
+static cJSON* stats_lookups_json(const uint64_t counts[NUM_CTX_STATS])
+{
+  cJSON *json = cJSON_CreateObject();
+  uint64_t probes[CTX_STATS_MAX_PROBES];
+  uint64_t nsamples = counts[CTX_STAT_LOOKUP_SAMPLES];
+  uint64_t nacquires = counts[CTX_STAT_LOCK_ACQUIRES];
+  size_t n = CTX_STATS_MAX_PROBES;
+  ctx_stats_probe_hist(probes);
+  while(n > 0 && probes[n-1] == 0) n--;
+  cJSON_AddItemToObject(json, "sample_rate", cJSON_CreateNumber(CTX_STATS_SAMPLE_RATE));
+  cJSON_AddItemToObject(json, "hit_ratio",
+    cJSON_CreateNumber(nsamples ? (double)counts[CTX_STAT_LOOKUP_HITS]/nsamples : 0));
+  cJSON_AddItemToObject(json, "lock_wait_ratio",
+    cJSON_CreateNumber(nacquires ? (double)counts[CTX_STAT_LOCK_WAITS]/nacquires : 0));
+  // probe_hist[i] is the number of sampled lookups that visited i+1 buckets
+  cJSON_AddItemToObject(json, "probe_hist", stats_array_json(probes, n));
+  return json;
+}
+
+static cJSON* stats_hash_table_json()
+{
+  cJSON *json = cJSON_CreateObject();
+  size_t i, depth = 0;
+  for(i = 0; i < stats_ht.ncollisions; i++)
+    if(stats_ht.collisions[i]) depth = i+1;
+  cJSON_AddItemToObject(json, "num_kmers", cJSON_CreateNumber(stats_ht.num_kmers));
+  cJSON_AddItemToObject(json, "capacity", cJSON_CreateNumber(stats_ht.capacity));
+  cJSON_AddItemToObject(json, "max_rehash_depth", cJSON_CreateNumber(depth));
+  cJSON_AddItemToObject(json, "inserts_per_rehash",
+                        stats_array_json(stats_ht.collisions, stats_ht.ncollisions));
+  // bucket_fill_hist[i] is the number of buckets holding i entries
+  cJSON_AddItemToObject(json, "bucket_fill_hist",
+                        stats_array_json(stats_ht.fill, stats_ht.nfill));
+  return json;
+}
+
+// Current, peak and budget bytes of each allocation tag, see ctx_alloc.h
+static cJSON* stats_memory_json()
+{
+  cJSON *json = cJSON_CreateObject(), *obj;
+  AllocTag tag;
+  for(tag = 0; tag < NUM_ALLOC_TAGS; tag++) {
+    obj = cJSON_CreateObject();
+    cJSON_AddItemToObject(obj, "current_bytes",
+                          cJSON_CreateNumber(alloc_get_tag_mem(tag)));
+    cJSON_AddItemToObject(obj, "peak_bytes",
+                          cJSON_CreateNumber(alloc_get_tag_peak(tag)));
+    cJSON_AddItemToObject(obj, "budget_bytes",
+                          cJSON_CreateNumber(alloc_get_tag_budget(tag)));
+    cJSON_AddItemToObject(json, alloc_tag_str(tag), obj);
+  }
+  return json;
+}
+
+void ctx_stats_print_json(FILE *fout, const char *cmd, int ret)
+{
+  ctx_assert(ctx_stats_on);
+  CtxStatsTime end;
+  uint64_t max_rss_kb = stats_get_time(&end), counts[NUM_CTX_STATS];
+  const CtxStatsThread *t;
+  size_t i;
+
+  cJSON *json = cJSON_CreateObject(), *phases, *threads, *obj;
+  cJSON_AddItemToObject(json, "command", cJSON_CreateString(cmd));
+  cJSON_AddItemToObject(json, "exit_status", cJSON_CreateInt(ret));
+  stats_add_times(json, &stats_start, &end, max_rss_kb);
+
+  ctx_stats_sum(counts);
+  cJSON_AddItemToObject(json, "counters", stats_counts_json(counts));
+  cJSON_AddItemToObject(json, "lookups", stats_lookups_json(counts));
+
+  phases = cJSON_CreateArray();
+  for(i = 0; i < stats_nphases; i++) {
+    const CtxStatsPhase *p = &stats_phases[i];
+    if(!p->ended) continue;
+    obj = cJSON_CreateObject();
+    cJSON_AddItemToObject(obj, "name", cJSON_CreateString(p->name));
+    stats_add_times(obj, &p->start, &p->end, p->max_rss_kb);
+    cJSON_AddItemToObject(obj, "counters", stats_counts_json(p->counts));
+    cJSON_AddItemToArray(phases, obj);
+  }
+  cJSON_AddItemToObject(json, "phases", phases);
+
+  // Threads are on the list newest first, report them in order of id
+  threads = cJSON_CreateArray();
+  pthread_mutex_lock(&stats_lock);
+  cJSON **tjson = ctx_calloc(MAX2(stats_nthreads, 1), sizeof(cJSON*));
+  for(t = stats_threads; t != NULL; t = t->next) {
+    obj = stats_counts_json(t->counts);
+    cJSON_AddItemToObject(obj, "thread", cJSON_CreateNumber(t->id));
+    tjson[t->id] = obj;
+  }
+  for(i = 0; i < stats_nthreads; i++) cJSON_AddItemToArray(threads, tjson[i]);
+  pthread_mutex_unlock(&stats_lock);
+  ctx_free(tjson);
+  cJSON_AddItemToObject(json, "threads", threads);
+
+  if(stats_ht.set)
+    cJSON_AddItemToObject(json, "hash_table", stats_hash_table_json());
+
+  cJSON_AddItemToObject(json, "memory", stats_memory_json());
+
+  char *jstr = cJSON_Print(json);
+  fputs(jstr, fout);
+  fputc('\n', fout);
+  free(jstr);
+  cJSON_Delete(json);
+}
@@ -0,0 +1,120 @@
+#ifndef CTX_STATS_H_
+#define CTX_STATS_H_
+
+//
+// Profiling counters and per-phase timers, reported as JSON (--stats-json)
+//
+// Counters are kept per thread so incrementing them never contends. They
+// are only updated once ctx_stats_init() has been called, otherwise each
+// ctx_stats_add() costs a single test of `ctx_stats_on`.
+//
+// Phases record wall time and CPU time (getrusage, summed over all threads)
+// along with the counters accumulated during the phase. Phases should be
+// started and ended from the main thread.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum
+{
+  CTX_STAT_KMERS_INSERTED,
+  CTX_STAT_KMER_LOOKUPS,
+  CTX_STAT_KMER_FILTERED,       // lookups rejected by a hash table filter
+  CTX_STAT_LINKS_ADDED,         // links added to the link store
+  CTX_STAT_LOCK_ACQUIRES,       // bucket locks taken
+  CTX_STAT_LOCK_WAITS,          // bucket locks found held on acquire
+  CTX_STAT_LOOKUP_SAMPLES,      // sampled lookups, see ctx_stats_lookup()
+  CTX_STAT_LOOKUP_HITS,         // sampled lookups that found the kmer
+  CTX_STAT_MSGPOOL_WRITE_NS,    // time spent waiting for an empty slot
+  CTX_STAT_MSGPOOL_READ_NS,     // time spent waiting for a full slot
+  CTX_STAT_READS,               // reads handed to worker threads
+  CTX_STAT_BASES,               // bases in those reads
+  CTX_STAT_BUBBLES,             // bubbles called
+  CTX_STAT_BYTES_IN,            // bytes read by async and remote file streams
+  CTX_STAT_BYTES_OUT,           // bytes written by async and gzip writers
+  CTX_STAT_KMERS_MAPPED,        // read kmers placed on unitigs without lookups
+  NUM_CTX_STATS
+} CtxStat;
+
+extern bool ctx_stats_on;
+
+void ctx_stats_init();
+void ctx_stats_destroy();
+
+// Add `n` to counter `stat` of the calling thread
+void ctx_stats_incr(CtxStat stat, uint64_t n);
+
+#define ctx_stats_add(stat,n) do { \
+  if(ctx_stats_on) ctx_stats_incr(stat,n); \
+} while(0)
+
+// Sum of counter `stat` over all threads
+uint64_t ctx_stats_total(CtxStat stat);
+
+// Sum of each counter over all threads into counts[NUM_CTX_STATS]
+void ctx_stats_sum(uint64_t counts[NUM_CTX_STATS]);
+
+// Copy counters of threads with id < `max` into counts[id*NUM_CTX_STATS+stat].
+// Returns the number of threads that have added to a counter.
+size_t ctx_stats_threads(uint64_t *counts, size_t max);
+
+// Name of counter `stat` as used in JSON reports
+const char* ctx_stats_name(CtxStat stat);
+
+// Nanoseconds on a monotonic clock
+uint64_t ctx_stats_now_ns();
+
+// Run `stmt`, adding the nanoseconds it took to counter `stat`
+#define ctx_stats_time(stat,stmt) do {                          \
+  if(ctx_stats_on) {                                            \
+    uint64_t _t0 = ctx_stats_now_ns();                          \
+    stmt;                                                       \
+    ctx_stats_incr(stat, ctx_stats_now_ns() - _t0);             \
+  } else { stmt; }                                              \
+} while(0)
+
+// bitlock_yield_acquire() from bit_array, counting contended acquires
+#define ctx_bitlock_yield_acquire(arr,pos) do {                              \
+  if(ctx_stats_on) {                                                         \
+    ctx_stats_incr(CTX_STAT_LOCK_ACQUIRES, 1);                               \
+    if((((volatile uint8_t*)(arr))[(pos)/8] >> ((pos)%8)) & 1)               \
+      ctx_stats_incr(CTX_STAT_LOCK_WAITS, 1);                                \
+  }                                                                          \
+  bitlock_yield_acquire(arr,pos);                                            \
+} while(0)
+
+// One in every CTX_STATS_SAMPLE_RATE lookups per thread is recorded in the
+// hit/miss counters and the probe distance histogram
+#define CTX_STATS_SAMPLE_RATE 64
+#define CTX_STATS_MAX_PROBES 32
+
+void ctx_stats_sample_lookup(size_t nprobes, bool found);
+
+// Record a hash table lookup that visited `nprobes` buckets
+#define ctx_stats_lookup(nprobes,found) do { \
+  if(ctx_stats_on) ctx_stats_sample_lookup(nprobes,found); \
+} while(0)
+
+// Sum of the sampled probe distance histogram over all threads.
+// hist[i] is the number of lookups that visited i+1 buckets.
+void ctx_stats_probe_hist(uint64_t hist[CTX_STATS_MAX_PROBES]);
+
+// Returns phase id to pass to ctx_stats_phase_end()
+size_t ctx_stats_phase_start(const char *name);
+void ctx_stats_phase_end(size_t phase);
+
+// Name of the most recently started phase that has not ended, or NULL
+const char* ctx_stats_current_phase();
+
+// Record hash table occupancy, number of inserts at each rehash depth and
+// number of buckets with each fill (fill_hist[i] buckets hold i entries)
+void ctx_stats_hash_table(const uint64_t *collisions, size_t ncollisions,
+                          const uint64_t *fill_hist, size_t nfill,
+                          uint64_t num_kmers, uint64_t capacity);
+
+// Write JSON report of the run to `fout`
+void ctx_stats_print_json(FILE *fout, const char *cmd, int ret);
+
+#endif /* CTX_STATS_H_ */
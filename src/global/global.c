@@ -4,6 +4,8 @@
 #include <unistd.h> // getpid()
 
 #include "ctx_output.h" // ctx_output_init()
+#include "cpu_dispatch.h" // cpu_dispatch_init()
+#include "thread_pool.h" // thread_pool_destroy()
 
 #define strhash_fast_mix(h,x) ((h) * 37 + (x))
 #define rotl32(h,r) ((h)<<(r)|(h)>>(32-(r)))
@@ -34,9 +36,12 @@ void cortex_init()
   ctx_output_init();
   // Now safe to use die/warn/message/timestamp methods
   // since mutex and cmdcode have been set
+  cpu_dispatch_init();
+  alloc_init();
 }
 
 void cortex_destroy()
 {
+  thread_pool_destroy();
   ctx_output_destroy();
 }
@@ -36,6 +36,7 @@
 //  MAX_KMER_SIZE    Max kmer-size compiled e.g. 31 for maxk=31, 63 for maxk=63
 //  USE_CITY_HASH=1  Use Google's CityHash instead of Bob Jenkin's lookup3
 //  USE_XXHASH=1     Use xxHash instead of Bob Jenkin's lookup3
+//  USE_MIX_HASH=1   Use multiply-mix kmer hash (kmer_mixhash.h) for kmers
 
 #define ONE_MEGABYTE (1<<20)
 #define MAX_IO_THREADS 10
@@ -45,6 +46,7 @@
 #include "ctx_assert.h"
 #include "ctx_alloc.h" // Wrappers for malloc, calloc etc.
 #include "ctx_output.h" // Printing status messages
+#include "ctx_stats.h" // Profiling counters and timers
 
 #include "htslib/version.h"
 #define LIBS_VERSION "zlib="ZLIB_VERSION" htslib="HTS_VERSION
@@ -0,0 +1,252 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE // pthread_setaffinity_np()
+#endif
+
+#include "global.h"
+#include "thread_pool.h"
+
+#include <sched.h>
+#include <unistd.h> // sysconf()
+
+// Threads of a run report back here when they finish
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t remaining;
+} PoolRun;
+
+typedef struct PoolWorkerStruct PoolWorker;
+
+struct PoolWorkerStruct
+{
+  pthread_t thread;
+  size_t id; // index in the pool, used for pinning
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // Task, set by the pool when the worker is idle
+  void (*func)(void *_arg, size_t _tid);
+  void *arg;
+  size_t tid;
+  PoolRun *run;
+  bool has_task, quit;
+  PoolWorker *next_idle;
+};
+
+// Workers live for the whole process so are allocated with calloc() rather
+// than ctx_calloc(), to stay out of the leak check made before exit
+static struct {
+  pthread_mutex_t lock;
+  PoolWorker **workers, *idle;
+  size_t nworkers, capacity;
+  int pin; // -1 unset, 0 off, 1 on
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .workers = NULL, .idle = NULL,
+          .nworkers = 0, .capacity = 0, .pin = -1};
+
+static void pool_pin_worker(PoolWorker *wrkr)
+{
+  #if defined(__linux__) && defined(CPU_SET)
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(ncpus <= 0) return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(wrkr->id % (size_t)ncpus, &cpus);
+    if(pthread_setaffinity_np(wrkr->thread, sizeof(cpus), &cpus) != 0)
+      warn("Cannot pin thread to CPU %zu", wrkr->id % (size_t)ncpus);
+  #else
+    (void)wrkr;
+  #endif
+}
+
+static void pool_return_idle(PoolWorker *wrkr)
+{
+  pthread_mutex_lock(&pool.lock);
+  wrkr->next_idle = pool.idle;
+  pool.idle = wrkr;
+  pthread_mutex_unlock(&pool.lock);
+}
+
+static void* pool_worker(void *ptr)
+{
+  PoolWorker *wrkr = (PoolWorker*)ptr;
+  void (*func)(void *_arg, size_t _tid);
+  void *arg;
+  size_t tid;
+  PoolRun *run;
+
+  while(1)
+  {
+    pthread_mutex_lock(&wrkr->lock);
+    while(!wrkr->has_task && !wrkr->quit)
+      pthread_cond_wait(&wrkr->cond, &wrkr->lock);
+    if(wrkr->quit) { pthread_mutex_unlock(&wrkr->lock); break; }
+    func = wrkr->func; arg = wrkr->arg; tid = wrkr->tid; run = wrkr->run;
+    wrkr->has_task = false;
+    pthread_mutex_unlock(&wrkr->lock);
+
+    func(arg, tid);
+
+    // Become idle before reporting back, so the next run can reuse us
+    pool_return_idle(wrkr);
+
+    pthread_mutex_lock(&run->lock);
+    if(--run->remaining == 0) pthread_cond_signal(&run->cond);
+    pthread_mutex_unlock(&run->lock);
+  }
+
+  return NULL;
+}
+
+// Called with pool.lock held
+static PoolWorker* pool_new_worker()
+{
+  if(pool.pin < 0) {
+    const char *env = getenv("CTX_PIN_THREADS");
+    pool.pin = (env != NULL && *env && strcmp(env, "0") != 0);
+  }
+
+  if(pool.nworkers == pool.capacity) {
+    pool.capacity = pool.capacity ? pool.capacity*2 : 16;
+    pool.workers = realloc(pool.workers, pool.capacity * sizeof(PoolWorker*));
+    if(pool.workers == NULL) die("Out of memory");
+  }
+
+  PoolWorker *wrkr = calloc(1, sizeof(PoolWorker));
+  if(wrkr == NULL) die("Out of memory");
+  wrkr->id = pool.nworkers;
+
+  if(pthread_mutex_init(&wrkr->lock, NULL) != 0 ||
+     pthread_cond_init(&wrkr->cond, NULL) != 0)
+    die("pthread init failed: %s", strerror(errno));
+
+  if(pthread_create(&wrkr->thread, NULL, pool_worker, wrkr) != 0)
+    die("Creating thread failed");
+
+  if(pool.pin) pool_pin_worker(wrkr);
+
+  pool.workers[pool.nworkers++] = wrkr;
+  return wrkr;
+}
+
+void thread_pool_run(void *arg, size_t nthreads,
+                     void (*func)(void *_arg, size_t _tid))
+{
+  ctx_assert(nthreads > 0);
+  if(nthreads == 1) { func(arg, 0); return; }
+
+  size_t i;
+  PoolWorker *wrkr, *wrkrs = NULL;
+  PoolRun run = {.remaining = nthreads-1};
+
+  if(pthread_mutex_init(&run.lock, NULL) != 0 ||
+     pthread_cond_init(&run.cond, NULL) != 0)
+    die("pthread init failed: %s", strerror(errno));
+
+  // Take idle workers, start new ones if there are not enough
+  pthread_mutex_lock(&pool.lock);
+  for(i = 1; i < nthreads; i++) {
+    if(pool.idle != NULL) { wrkr = pool.idle; pool.idle = wrkr->next_idle; }
+    else wrkr = pool_new_worker();
+    wrkr->next_idle = wrkrs;
+    wrkrs = wrkr;
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+  for(i = 1; wrkrs != NULL; i++) {
+    wrkr = wrkrs;
+    wrkrs = wrkr->next_idle;
+    pthread_mutex_lock(&wrkr->lock);
+    wrkr->func = func;
+    wrkr->arg = arg;
+    wrkr->tid = i;
+    wrkr->run = &run;
+    wrkr->has_task = true;
+    pthread_cond_signal(&wrkr->cond);
+    pthread_mutex_unlock(&wrkr->lock);
+  }
+
+  func(arg, 0);
+
+  // Wait for other threads to complete
+  pthread_mutex_lock(&run.lock);
+  while(run.remaining > 0) pthread_cond_wait(&run.cond, &run.lock);
+  pthread_mutex_unlock(&run.lock);
+
+  pthread_cond_destroy(&run.cond);
+  pthread_mutex_destroy(&run.lock);
+}
+
+size_t thread_pool_num_workers()
+{
+  pthread_mutex_lock(&pool.lock);
+  size_t n = pool.nworkers;
+  pthread_mutex_unlock(&pool.lock);
+  return n;
+}
+
+// All runs must have finished
+void thread_pool_destroy()
+{
+  size_t i;
+  PoolWorker *wrkr;
+
+  for(i = 0; i < pool.nworkers; i++) {
+    wrkr = pool.workers[i];
+    pthread_mutex_lock(&wrkr->lock);
+    wrkr->quit = true;
+    pthread_cond_signal(&wrkr->cond);
+    pthread_mutex_unlock(&wrkr->lock);
+  }
+
+  for(i = 0; i < pool.nworkers; i++) {
+    wrkr = pool.workers[i];
+    if(pthread_join(wrkr->thread, NULL) != 0) die("Joining thread failed");
+    pthread_cond_destroy(&wrkr->cond);
+    pthread_mutex_destroy(&wrkr->lock);
+    free(wrkr);
+  }
+
+  free(pool.workers);
+  pool.workers = NULL;
+  pool.idle = NULL;
+  pool.nworkers = pool.capacity = 0;
+}
+
+//
+// Barrier
+//
+
+void ctx_barrier_init(CtxBarrier *barrier, size_t nthreads)
+{
+  ctx_assert(nthreads > 0);
+  if(pthread_mutex_init(&barrier->lock, NULL) != 0 ||
+     pthread_cond_init(&barrier->cond, NULL) != 0)
+    die("pthread init failed: %s", strerror(errno));
+  barrier->nthreads = nthreads;
+  barrier->nwaiting = barrier->generation = 0;
+}
+
+void ctx_barrier_destroy(CtxBarrier *barrier)
+{
+  pthread_cond_destroy(&barrier->cond);
+  pthread_mutex_destroy(&barrier->lock);
+}
+
+bool ctx_barrier_wait(CtxBarrier *barrier)
+{
+  bool last = false;
+  pthread_mutex_lock(&barrier->lock);
+  size_t gen = barrier->generation;
+  if(++barrier->nwaiting == barrier->nthreads) {
+    barrier->nwaiting = 0;
+    barrier->generation++;
+    pthread_cond_broadcast(&barrier->cond);
+    last = true;
+  }
+  else {
+    while(gen == barrier->generation)
+      pthread_cond_wait(&barrier->cond, &barrier->lock);
+  }
+  pthread_mutex_unlock(&barrier->lock);
+  return last;
+}
@@ -0,0 +1,53 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+//
+// Process-wide pool of persistent worker threads
+//
+// util_run_threads(), util_multi_thread() and util_run_ranges() hand their
+// threads 1..n-1 to idle pool workers instead of creating and joining new
+// pthreads each time. The calling thread is always thread 0. Workers are
+// created the first time they are needed and then kept for the life of the
+// process, so short parallel phases start with a wake up rather than a
+// pthread_create().
+//
+// Every thread of a run gets its own worker and all run at the same time, so
+// threads can wait on each other (e.g. with a CtxBarrier). If all workers are
+// busy, e.g. a worker starts a parallel phase of its own, the pool grows.
+//
+// Setting the environment variable CTX_PIN_THREADS=1 pins worker i to
+// CPU i % ncpus, giving each worker a stable core.
+//
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Run func(arg, tid) for tid in [0,nthreads), tid 0 on the calling thread.
+// Blocks until all have returned.
+void thread_pool_run(void *arg, size_t nthreads,
+                     void (*func)(void *_arg, size_t _tid));
+
+// Number of workers created so far
+size_t thread_pool_num_workers();
+
+// Stop and join all workers (called from cortex_destroy())
+void thread_pool_destroy();
+
+//
+// Barrier for the threads of one run
+//
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t nthreads, nwaiting, generation;
+} CtxBarrier;
+
+void ctx_barrier_init(CtxBarrier *barrier, size_t nthreads);
+void ctx_barrier_destroy(CtxBarrier *barrier);
+
+// Block until `nthreads` threads have called wait. Returns true on one thread.
+bool ctx_barrier_wait(CtxBarrier *barrier);
+
+#endif /* THREAD_POOL_H_ */
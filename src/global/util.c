@@ -1,5 +1,7 @@
 #include "global.h"
 #include "util.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
 
 #include <math.h>
 
@@ -180,6 +182,130 @@ char* bin64_to_str(uint64_t bits, unsigned int n, char *str)
   return str;
 }
 
+// Independent sums let the compiler overlap popcounts
+#define POPCOUNT_AND_BODY(a,b,n,i,s)                                           \
+  uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;                                     \
+  for(; (i)+4 <= (n); (i) += 4) {                                              \
+    s0 += (uint64_t)__builtin_popcountll((a)[(i)  ] & (b)[(i)  ]);             \
+    s1 += (uint64_t)__builtin_popcountll((a)[(i)+1] & (b)[(i)+1]);             \
+    s2 += (uint64_t)__builtin_popcountll((a)[(i)+2] & (b)[(i)+2]);             \
+    s3 += (uint64_t)__builtin_popcountll((a)[(i)+3] & (b)[(i)+3]);             \
+  }                                                                            \
+  for(; (i) < (n); (i)++) s0 += (uint64_t)__builtin_popcountll((a)[(i)] & (b)[(i)]); \
+  (s) += s0 + s1 + s2 + s3;
+
+static uint64_t _popcount_and_generic(const uint64_t *a, const uint64_t *b,
+                                      size_t n)
+{
+  size_t i = 0;
+  uint64_t s = 0;
+  POPCOUNT_AND_BODY(a, b, n, i, s);
+  return s;
+}
+
+#if CPU_DISPATCH
+#include <immintrin.h>
+
+// Same loop compiled to use the POPCNT instruction
+static CPU_TARGET_SSE41 uint64_t _popcount_and_sse41(const uint64_t *a,
+                                                     const uint64_t *b,
+                                                     size_t n)
+{
+  size_t i = 0;
+  uint64_t s = 0;
+  POPCOUNT_AND_BODY(a, b, n, i, s);
+  return s;
+}
+
+// Count bits per nibble with a shuffle lookup table, sum bytes with SAD
+// (Mula, Kurz & Lemire 2016)
+static CPU_TARGET_AVX2 uint64_t _popcount_and_avx2(const uint64_t *a,
+                                                   const uint64_t *b,
+                                                   size_t n)
+{
+  const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                       0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i low4 = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+  __m256i v, cnt, acc = zero;
+  size_t i = 0;
+  uint64_t s = 0;
+
+  for(; i+4 <= n; i += 4) {
+    v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(a+i)),
+                         _mm256_loadu_si256((const __m256i*)(b+i)));
+    cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low4)),
+                          _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low4)));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, zero));
+  }
+
+  s = (uint64_t)_mm256_extract_epi64(acc, 0) + (uint64_t)_mm256_extract_epi64(acc, 1) +
+      (uint64_t)_mm256_extract_epi64(acc, 2) + (uint64_t)_mm256_extract_epi64(acc, 3);
+  POPCOUNT_AND_BODY(a, b, n, i, s);
+  return s;
+}
+
+static CPU_TARGET_AVX512 uint64_t _popcount_and_avx512(const uint64_t *a,
+                                                       const uint64_t *b,
+                                                       size_t n)
+{
+  const __m512i lut = _mm512_broadcast_i32x4(_mm_setr_epi8(0,1,1,2,1,2,2,3,
+                                                           1,2,2,3,2,3,3,4));
+  const __m512i low4 = _mm512_set1_epi8(0x0f), zero = _mm512_setzero_si512();
+  __m512i v, cnt, acc = zero;
+  size_t i = 0;
+  uint64_t s = 0;
+
+  for(; i+8 <= n; i += 8) {
+    v = _mm512_and_si512(_mm512_loadu_si512((const void*)(a+i)),
+                         _mm512_loadu_si512((const void*)(b+i)));
+    cnt = _mm512_add_epi8(_mm512_shuffle_epi8(lut, _mm512_and_si512(v, low4)),
+                          _mm512_shuffle_epi8(lut, _mm512_and_si512(_mm512_srli_epi16(v, 4), low4)));
+    acc = _mm512_add_epi64(acc, _mm512_sad_epu8(cnt, zero));
+  }
+
+  s = (uint64_t)_mm512_reduce_add_epi64(acc);
+  POPCOUNT_AND_BODY(a, b, n, i, s);
+  return s;
+}
+#endif /* CPU_DISPATCH */
+
+static uint64_t (*popcount_and_func)(const uint64_t*, const uint64_t*, size_t)
+  = _popcount_and_generic;
+static CpuSimd popcount_and_lvl = CPU_SIMD_NONE;
+static uint32_t popcount_and_gen = 0;
+
+static void popcount_and_select(CpuSimd lvl)
+{
+  popcount_and_func = _popcount_and_generic;
+  popcount_and_lvl = CPU_SIMD_NONE;
+  #if CPU_DISPATCH
+    if(lvl >= CPU_SIMD_AVX512) {
+      popcount_and_func = _popcount_and_avx512;
+      popcount_and_lvl = CPU_SIMD_AVX512;
+    } else if(lvl >= CPU_SIMD_AVX2) {
+      popcount_and_func = _popcount_and_avx2;
+      popcount_and_lvl = CPU_SIMD_AVX2;
+    } else if(lvl >= CPU_SIMD_SSE41) {
+      popcount_and_func = _popcount_and_sse41;
+      popcount_and_lvl = CPU_SIMD_SSE41;
+    }
+  #else
+    (void)lvl;
+  #endif
+}
+
+uint64_t popcount_and(const uint64_t *a, const uint64_t *b, size_t n)
+{
+  cpu_dispatch_check(popcount_and_gen, popcount_and_select);
+  return popcount_and_func(a, b, n);
+}
+
+const char* popcount_and_simd_str()
+{
+  cpu_dispatch_check(popcount_and_gen, popcount_and_select);
+  return cpu_simd_str(popcount_and_lvl);
+}
+
 //
 // Strings
 //
@@ -245,6 +371,37 @@ size_t num_of_digits(size_t num)
   return digits;
 }
 
+// Write `num` in base 10 without commas to `str`, which must have at least
+// UINT64_DECLEN bytes. Not null terminated. Returns number of chars written.
+// Two digits are written at a time from a lookup table.
+size_t uint64_to_dec(uint64_t num, char *str)
+{
+  static const char pairs[] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+  char tmp[UINT64_DECLEN], *p = tmp + UINT64_DECLEN;
+  size_t len;
+
+  while(num >= 100) {
+    const char *d = pairs + 2*(num % 100);
+    num /= 100;
+    *(--p) = d[1];
+    *(--p) = d[0];
+  }
+  if(num >= 10) {
+    const char *d = pairs + 2*num;
+    *(--p) = d[1];
+    *(--p) = d[0];
+  }
+  else *(--p) = '0' + num;
+
+  len = tmp + UINT64_DECLEN - p;
+  memcpy(str, p, len);
+  return len;
+}
+
 // result must be long enough for result + 1 ('\0'). Max length required is:
 // strlen('18,446,744,073,709,551,615')+1 = 27
 // returns pointer to result
@@ -548,38 +705,22 @@ typedef struct {
   volatile size_t next_job;
 } ThreadedJobs;
 
-typedef struct {
-  pthread_t thread;
-  ThreadedJobs *jobs;
-  size_t curr_job, threadid;
-} ThreadedWorker;
-
-static void threaded_worker_sub(ThreadedWorker *wrkr)
+// Each thread starts with the job matching its id then takes the next free one
+static void threaded_worker(void *arg, size_t threadid)
 {
-  ThreadedJobs *jobs = wrkr->jobs;
-  jobs->func((char*)jobs->args + wrkr->curr_job*jobs->elsize, wrkr->threadid);
+  ThreadedJobs *jobs = (ThreadedJobs*)arg;
+  size_t job = threadid;
 
-  // try to get more work
-  while(jobs->next_job < jobs->nel)
-  {
-    wrkr->curr_job = __sync_fetch_and_add(&jobs->next_job, 1);
-    if(wrkr->curr_job >= jobs->nel) break;
-    jobs->func((char*)jobs->args + wrkr->curr_job*jobs->elsize, wrkr->threadid);
+  while(job < jobs->nel) {
+    jobs->func((char*)jobs->args + job*jobs->elsize, threadid);
+    job = __sync_fetch_and_add(&jobs->next_job, 1);
   }
 }
 
-static __attribute__((noreturn)) void *threaded_worker(void *arg)
-{
-  ThreadedWorker *wrkr = (ThreadedWorker*)arg;
-  threaded_worker_sub(wrkr);
-  pthread_exit(NULL);
-}
-
 // Blocks until all jobs finished
 void util_run_threads(void *args, size_t nel, size_t elsize,
                       size_t nthreads, void (*func)(void *_arg, size_t _tid))
 {
-  int rc;
   size_t i;
   ctx_assert(nthreads > 0);
 
@@ -589,93 +730,126 @@ void util_run_threads(void *args, size_t nel, size_t elsize,
   if(nthreads == 1) {
     for(i = 0; i < nel; i++) func((char*)args + i*elsize, 0);
   }
-  else
+  else if(nthreads > 1)
   {
-    /* Initialize and set thread detached attribute */
-    pthread_attr_t thread_attr;
-    pthread_attr_init(&thread_attr);
-    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE);
-
     ThreadedJobs jobs = {.func = func, .args = args,
                          .nel = nel, .elsize = elsize,
                          .next_job = nthreads};
 
-    ThreadedWorker *workers = ctx_malloc(sizeof(ThreadedWorker) * nthreads);
-
-    for(i = 1; i < nthreads; i++) {
-      workers[i] = (ThreadedWorker){.jobs = &jobs, .curr_job = i, .threadid = i};
-      rc = pthread_create(&workers[i].thread, &thread_attr,
-                          threaded_worker, (void*)&workers[i]);
-      if(rc != 0) die("Creating thread failed");
-    }
+    thread_pool_run(&jobs, nthreads, threaded_worker);
+  }
+}
 
-    // Last thread
-    workers[0] = (ThreadedWorker){.jobs = &jobs, .curr_job = 0, .threadid = 0};
-    threaded_worker_sub(&workers[0]);
+// Blocks until all jobs finished
+void util_multi_thread(void *arg, size_t nthreads,
+                       void (*func)(void *_arg, size_t _tid))
+{
+  thread_pool_run(arg, nthreads, func);
+}
 
-    /* wait for other threads to complete */
-    for(i = 1; i < nthreads; i++) {
-      rc = pthread_join(workers[i].thread, NULL);
-      if(rc != 0) die("Joining thread failed");
-    }
+//
+// Work stealing over ranges
+//
 
-    pthread_attr_destroy(&thread_attr);
-    ctx_free(workers);
-  }
-}
+// Each deque is a range of chunk indices [head,tail) packed into one word so
+// the owner (taking from head) and thieves (taking from tail) can both claim
+// chunks with a single compare-and-swap. Chunks are claimed once and never
+// put back, so a word never returns to an earlier value (no ABA problem).
+typedef struct {
+  volatile uint64_t range; // head << 32 | tail
+  char pad[64 - sizeof(uint64_t)]; // one deque per cache line
+} RangeDeque;
 
 typedef struct {
-  pthread_t thread;
-  const size_t threadid;
+  const size_t n, chunk_size, nthreads;
+  RangeDeque *const deques;
+  bool (*const func)(size_t _start, size_t _end, size_t _tid, void *_arg);
   void *const arg;
-  void (*const func)(void *_arg, size_t _tid);
-} SharedArgWorker;
+} RangeJobs;
+
+#define range_pack(h,t) (((uint64_t)(h) << 32) | (uint64_t)(t))
+#define range_head(r) ((size_t)((r) >> 32))
+#define range_tail(r) ((size_t)((r) & UINT32_MAX))
 
-static __attribute__((noreturn)) void *shared_arg_worker(void *arg)
+// Take one chunk from the front of our deque
+static inline bool range_deque_pop(RangeDeque *dq, size_t *chunk)
 {
-  SharedArgWorker *wrkr = (SharedArgWorker*)arg;
-  wrkr->func(wrkr->arg, wrkr->threadid);
-  pthread_exit(NULL);
+  uint64_t r = dq->range;
+  while(range_head(r) < range_tail(r)) {
+    uint64_t newr = range_pack(range_head(r)+1, range_tail(r));
+    uint64_t curr = __sync_val_compare_and_swap(&dq->range, r, newr);
+    if(curr == r) { *chunk = range_head(r); return true; }
+    r = curr;
+  }
+  return false;
 }
 
-// Blocks until all jobs finished
-void util_multi_thread(void *arg, size_t nthreads,
-                       void (*func)(void *_arg, size_t _tid))
+// Take half of the chunks (rounded up) from the back of `victim`
+static inline bool range_deque_steal(RangeDeque *victim,
+                                     size_t *start, size_t *end)
 {
-  int rc;
-  size_t i;
-  ctx_assert(nthreads > 0);
-
-  if(nthreads == 1) {
-    func(arg, 0);
+  uint64_t r = victim->range;
+  while(range_head(r) < range_tail(r)) {
+    size_t h = range_head(r), t = range_tail(r), split = t - (t-h+1)/2;
+    uint64_t curr = __sync_val_compare_and_swap(&victim->range, r,
+                                                range_pack(h, split));
+    if(curr == r) { *start = split; *end = t; return true; }
+    r = curr;
   }
-  else
+  return false;
+}
+
+static void range_worker(void *arg, size_t threadid)
+{
+  RangeJobs *jobs = (RangeJobs*)arg;
+  RangeDeque *dq = &jobs->deques[threadid];
+  size_t i, chunk, start, end;
+
+  while(1)
   {
-    /* Initialize and set thread detached attribute */
-    pthread_attr_t thread_attr;
-    pthread_attr_init(&thread_attr);
-    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE);
-
-    SharedArgWorker *workers = ctx_calloc(nthreads, sizeof(SharedArgWorker));
-
-    for(i = 1; i < nthreads; i++) {
-      SharedArgWorker tmp = {.threadid = i, .func = func, .arg = arg};
-      memcpy(&workers[i], &tmp, sizeof(tmp));
-      rc = pthread_create(&workers[i].thread, &thread_attr,
-                          shared_arg_worker, &workers[i]);
-      if(rc != 0) die("Creating thread failed");
+    while(range_deque_pop(dq, &chunk)) {
+      start = chunk * jobs->chunk_size;
+      end = MIN2(start + jobs->chunk_size, jobs->n);
+      if(jobs->func(start, end, threadid, jobs->arg)) return;
     }
 
-    // Last thread
-    func(arg, 0);
+    // Out of work, steal from the next thread that has some
+    for(i = 1; i < jobs->nthreads; i++)
+      if(range_deque_steal(&jobs->deques[(threadid+i) % jobs->nthreads],
+                           &start, &end)) break;
 
-    /* wait for other threads to complete */
-    for(i = 1; i < nthreads; i++) {
-      rc = pthread_join(workers[i].thread, NULL);
-      if(rc != 0) die("Joining thread failed");
-    }
+    if(i == jobs->nthreads) return; // no work left (or all in flight)
 
-    pthread_attr_destroy(&thread_attr);
-    ctx_free(workers);
+    // Only we add to our own deque and it is empty, so no need to CAS
+    (void)__sync_lock_test_and_set(&dq->range, range_pack(start, end));
   }
 }
+
+// Blocks until all jobs finished
+void util_run_ranges(size_t n, size_t chunk_size, size_t nthreads,
+                     bool (*func)(size_t _start, size_t _end,
+                                  size_t _tid, void *_arg),
+                     void *arg)
+{
+  ctx_assert(nthreads > 0);
+  size_t i, nchunks;
+
+  if(n == 0) return;
+  if(nthreads == 1) { func(0, n, 0, arg); return; }
+
+  // Chunk indices must fit in 32 bits
+  chunk_size = MAX2(chunk_size, 1);
+  chunk_size = MAX2(chunk_size, (n + UINT32_MAX - 1) / UINT32_MAX);
+  nchunks = (n + chunk_size - 1) / chunk_size;
+  nthreads = MIN2(nthreads, nchunks);
+
+  RangeDeque *deques = ctx_calloc(nthreads, sizeof(RangeDeque));
+  for(i = 0; i < nthreads; i++)
+    deques[i].range = range_pack(nchunks*i/nthreads, nchunks*(i+1)/nthreads);
+
+  RangeJobs jobs = {.n = n, .chunk_size = chunk_size, .nthreads = nthreads,
+                    .deques = deques, .func = func, .arg = arg};
+
+  util_multi_thread(&jobs, nthreads, range_worker);
+  ctx_free(deques);
+}
@@ -38,6 +38,19 @@ extern const uint8_t nibble_popcount_table[16];
 
 char* bin64_to_str(uint64_t bits, unsigned int n, char *str);
 
+// Number of bits set in (a[i] & b[i]) for i in [0,n)
+// SIMD version picked at runtime, see cpu_dispatch.h
+uint64_t popcount_and(const uint64_t *a, const uint64_t *b, size_t n);
+const char* popcount_and_simd_str();
+
+// Set bit `pos` in byte array `arr`, returns true if it was unset before
+// Threadsafe: only one of several threads setting the same bit gets true
+static inline bool bitset_claim_mt(uint8_t *arr, size_t pos)
+{
+  uint8_t bit = (uint8_t)(1U << (pos & 7));
+  return !(__sync_fetch_and_or(&arr[pos >> 3], bit) & bit);
+}
+
 //
 // Strings
 //
@@ -79,6 +92,13 @@ bool mem_to_integer(const char *arg, size_t *bytes);
  */
 size_t num_of_digits(size_t num);
 
+// Max length of a uint64_t written by uint64_to_dec(): 18446744073709551615
+#define UINT64_DECLEN 20
+
+// Write `num` in base 10 without commas to `str`, which must have at least
+// UINT64_DECLEN bytes. Not null terminated. Returns number of chars written.
+size_t uint64_to_dec(uint64_t num, char *str);
+
 #define ULONGSTRLEN 27
 // result must be long enough for result + 1 ('\0'). Max length required is:
 // strlen('18,446,744,073,709,551,615')+1 = 27 bytes
@@ -172,6 +192,8 @@ size_t seconds_to_str(unsigned long seconds, char *str);
 
 //
 // Multi-threading
+// Threads 1..n-1 run on persistent workers from thread_pool.h, thread 0 is
+// the calling thread.
 //
 
 // Do `nel` jobs with `nthreads` threads
@@ -184,6 +206,18 @@ void util_run_threads(void *args, size_t nel, size_t elsize,
 void util_multi_thread(void *arg, size_t nthreads,
                        void (*func)(void *_arg, size_t _tid));
 
+// Split [0,n) into chunks of `chunk_size` and process them with `nthreads`.
+// Each thread starts with an equal share of the chunks in its own deque, taking
+// chunks from the front. A thread that runs out steals half of the chunks
+// left at the back of another thread's deque, so uneven work is rebalanced.
+// `func` is called with a range [start,end) and returns true to stop the
+// calling thread (other threads keep going).
+// Blocks until all jobs finished
+void util_run_ranges(size_t n, size_t chunk_size, size_t nthreads,
+                     bool (*func)(size_t _start, size_t _end,
+                                  size_t _tid, void *_arg),
+                     void *arg);
+
 //
 // Safe Counting (thread-safe + no overflow)
 //
@@ -0,0 +1 @@
+#define CTX_VERSION "5a117c5"
@@ -1,6 +1,7 @@
 #include "global.h"
 #include "binary_kmer.h"
 #include "binary_seq.h"
+#include "cpu_dispatch.h"
 
 #if defined(__APPLE__)
   #include <libkern/OSByteOrder.h>
@@ -56,72 +57,211 @@ BinaryKmer binary_kmer_get_key(const BinaryKmer bkmer, size_t kmer_size)
   return (binary_kmer_lt(bkmer, bkey) ? bkmer : bkey);
 }
 
-#if NUM_BKMER_WORDS > 1
+//
+// Encoding and reverse complementing whole 64 bit words (32 bases)
+// SIMD versions are picked at runtime, only when kmers span enough words
+// for them to be worth the indirect call.
+//
 
-// CTAGT -> ACTAG (add blank 'A' to first position)
-// Shift towards most significant position
-BinaryKmer binary_kmer_right_shift_one_base(const BinaryKmer bkmer)
+// out[n-1-i] = revcmp(in[i]), top word is shifted by the caller
+static inline void _bkmer_revcmp_words_generic(const uint64_t *in,
+                                               uint64_t *out, size_t n)
 {
-  BinaryKmer b = bkmer;
   size_t i;
+  uint64_t word;
+  for(i = 0; i < n; i++) {
+    // Swap byte order
+    word = bswap_64(in[i]);
+    // 4 bases within a byte, so swap their order
+    word = (((word & 0x0303030303030303UL) << 6) |
+            ((word & 0x0c0c0c0c0c0c0c0cUL) << 2) |
+            ((word & 0x3030303030303030UL) >> 2) |
+            ((word & 0xc0c0c0c0c0c0c0c0UL) >> 6));
+    // Bitwise negate to complement bases
+    out[n-1-i] = ~word;
+  }
+}
 
-  for(i = NUM_BKMER_WORDS - 1; i > 0; i--)
-  {
-    b.b[i] >>= 2;
-    b.b[i] |= (b.b[i - 1] << 62);
+// Encode n words of 32 bases, first base in the top bits
+static inline void _bkmer_encode_words_generic(const char *seq,
+                                               uint64_t *out, size_t n)
+{
+  const char *end;
+  size_t i;
+  for(i = 0; i < n; i++) {
+    out[i] = 0;
+    for(end = seq + 32; seq < end; seq++) {
+      ctx_assert(char_is_acgt(*seq));
+      out[i] = (out[i] << 2) | dna_char_to_nuc(*seq);
+    }
   }
+}
+
+// One word kmers have no whole words to encode and are reverse complemented
+// inline, the scalar version is already a handful of instructions
+#if CPU_DISPATCH && NUM_BKMER_WORDS > 1
+  #define BKMER_SIMD 1
+#endif
+
+#ifdef BKMER_SIMD
+#include <immintrin.h>
 
-  b.b[0] >>= 2;
-  return b;
+static void _bkmer_revcmp_words_nosimd(const uint64_t *in, uint64_t *out,
+                                       size_t n)
+{
+  _bkmer_revcmp_words_generic(in, out, n);
+}
+
+static void _bkmer_encode_words_nosimd(const char *seq, uint64_t *out,
+                                       size_t n)
+{
+  _bkmer_encode_words_generic(seq, out, n);
+}
+
+static void (*bkmer_revcmp_words_func)(const uint64_t*, uint64_t*, size_t)
+  = _bkmer_revcmp_words_nosimd;
+static void (*bkmer_encode_words_func)(const char*, uint64_t*, size_t)
+  = _bkmer_encode_words_nosimd;
+static CpuSimd bkmer_revcmp_lvl = CPU_SIMD_NONE, bkmer_encode_lvl = CPU_SIMD_NONE;
+static uint32_t bkmer_gen = 0;
+
+// Reverse the four bases within each byte and complement them using nibble
+// lookups: each nibble (two bases) is swapped, complemented and moved to the
+// other half of the byte
+#define BKMER_RC_NIBBLE_LO 0x004080c0105090d0UL, 0x2060a0e03070b0f0UL
+#define BKMER_RC_NIBBLE_HI 0x0004080c0105090dUL, 0x02060a0e03070b0fUL
+
+static CPU_TARGET_SSE41 inline __m128i _bkmer_revcmp_bytes_sse41(__m128i v)
+{
+  const __m128i lo = _mm_set_epi64x(BKMER_RC_NIBBLE_LO);
+  const __m128i hi = _mm_set_epi64x(BKMER_RC_NIBBLE_HI);
+  const __m128i low4 = _mm_set1_epi8(0x0f);
+  return _mm_or_si128(_mm_shuffle_epi8(lo, _mm_and_si128(v, low4)),
+                      _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), low4)));
 }
 
-// CTAGT -> TAGTA (add blank 'A' to last position)
-// Shift towards least significant position
-BinaryKmer binary_kmer_left_shift_one_base(const BinaryKmer bkmer,
-                                           size_t kmer_size)
+// Two words per iteration: reversing all 16 bytes also swaps the words
+static CPU_TARGET_SSE41 void _bkmer_revcmp_words_sse41(const uint64_t *in,
+                                                       uint64_t *out, size_t n)
 {
-  BinaryKmer b = bkmer;
+  const __m128i rev = _mm_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+  __m128i v;
   size_t i;
 
-  for(i = 0; i+1 < NUM_BKMER_WORDS; i++)
-  {
-    b.b[i] <<= 2;
-    b.b[i] |= (b.b[i + 1] >> 62);
+  for(i = 0; i+2 <= n; i += 2) {
+    v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in+i)), rev);
+    _mm_storeu_si128((__m128i*)(out+n-i-2), _bkmer_revcmp_bytes_sse41(v));
   }
 
-  b.b[NUM_BKMER_WORDS - 1] <<= 2;
+  _bkmer_revcmp_words_generic(in+i, out, n-i);
+}
+
+// Four words per iteration, remainder two at a time
+static CPU_TARGET_AVX2 void _bkmer_revcmp_words_avx2(const uint64_t *in,
+                                                     uint64_t *out, size_t n)
+{
+  const __m256i bswap = _mm256_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+                                         7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+  const __m256i lo = _mm256_set_epi64x(BKMER_RC_NIBBLE_LO, BKMER_RC_NIBBLE_LO);
+  const __m256i hi = _mm256_set_epi64x(BKMER_RC_NIBBLE_HI, BKMER_RC_NIBBLE_HI);
+  const __m256i low4 = _mm256_set1_epi8(0x0f);
+  __m256i v;
+  size_t i;
+
+  for(i = 0; i+4 <= n; i += 4) {
+    v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in+i)), bswap);
+    v = _mm256_or_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, low4)),
+                        _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), low4)));
+    v = _mm256_permute4x64_epi64(v, 0x1B); // reverse word order
+    _mm256_storeu_si256((__m256i*)(out+n-i-4), v);
+  }
 
-  // Mask top word
-  b.b[0] &= (UINT64_MAX >> (64 - BKMER_TOP_BITS(kmer_size)));
-  return b;
+  _bkmer_revcmp_words_sse41(in+i, out, n-i);
 }
 
-#endif /* NUM_BKMER_WORDS > 1 */
+// Bases map to 2 bit codes with ((c>>1)^(c>>2))&3 for upper and lower case:
+//   A,a->0 C,c->1 G,g->2 T,t->3
+static CPU_TARGET_AVX2 void _bkmer_encode_words_avx2(const char *seq,
+                                                     uint64_t *out, size_t n)
+{
+  const __m256i three = _mm256_set1_epi8(3);
+  const __m256i mul16 = _mm256_set1_epi16(0x0104); // b0*4 + b1
+  const __m256i mul32 = _mm256_set1_epi32(0x00010010); // (b0,b1)*16 + (b2,b3)
+  const __m256i gather = _mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+                                          0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+  const __m256i lanes = _mm256_setr_epi32(0,4,1,1,1,1,1,1);
+  __m256i c, v;
+  size_t i;
+
+  for(i = 0; i < n; i++, seq += 32) {
+    c = _mm256_loadu_si256((const __m256i*)seq);
+    v = _mm256_xor_si256(_mm256_srli_epi16(c, 1), _mm256_srli_epi16(c, 2));
+    v = _mm256_and_si256(v, three);
+    v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, mul16), mul32);
+    v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, gather), lanes);
+    // bytes hold bases 0-3, 4-7, ... so byte swap to put base 0 on top
+    out[i] = bswap_64((uint64_t)_mm_cvtsi128_si64(_mm256_castsi256_si128(v)));
+  }
+}
+
+static void bkmer_select(CpuSimd lvl)
+{
+  bkmer_revcmp_words_func = _bkmer_revcmp_words_nosimd;
+  bkmer_encode_words_func = _bkmer_encode_words_nosimd;
+  bkmer_revcmp_lvl = bkmer_encode_lvl = CPU_SIMD_NONE;
+  // AVX2 only helps with four or more words
+  if(lvl >= CPU_SIMD_AVX2 && NUM_BKMER_WORDS >= 4) {
+    bkmer_revcmp_words_func = _bkmer_revcmp_words_avx2;
+    bkmer_revcmp_lvl = CPU_SIMD_AVX2;
+  } else if(lvl >= CPU_SIMD_SSE41) {
+    bkmer_revcmp_words_func = _bkmer_revcmp_words_sse41;
+    bkmer_revcmp_lvl = CPU_SIMD_SSE41;
+  }
+  if(lvl >= CPU_SIMD_AVX2) {
+    bkmer_encode_words_func = _bkmer_encode_words_avx2;
+    bkmer_encode_lvl = CPU_SIMD_AVX2;
+  }
+}
+
+#endif /* BKMER_SIMD */
+
+const char* binary_kmer_revcmp_simd_str()
+{
+  #ifdef BKMER_SIMD
+    cpu_dispatch_check(bkmer_gen, bkmer_select);
+    return cpu_simd_str(bkmer_revcmp_lvl);
+  #else
+    return cpu_simd_str(CPU_SIMD_NONE);
+  #endif
+}
+
+const char* binary_kmer_encode_simd_str()
+{
+  #ifdef BKMER_SIMD
+    cpu_dispatch_check(bkmer_gen, bkmer_select);
+    return cpu_simd_str(bkmer_encode_lvl);
+  #else
+    return cpu_simd_str(CPU_SIMD_NONE);
+  #endif
+}
 
 // For profiling see dev/bkmer_revcmp/
 BinaryKmer binary_kmer_reverse_complement(const BinaryKmer bkmer,
                                           size_t kmer_size)
 {
   const size_t top_bits = BKMER_TOP_BITS(kmer_size), unused_bits = 64 - top_bits;
-  size_t i, j;
   BinaryKmer revcmp = BINARY_KMER_ZERO_MACRO;
-  uint64_t word;
 
-  for(i = 0, j = NUM_BKMER_WORDS-1; i < NUM_BKMER_WORDS; i++, j--)
-  {
-    // Swap byte order
-    word = bswap_64(bkmer.b[i]);
-    // 4 bases within a byte, so swap their order
-    word = (((word & 0x0303030303030303UL) << 6) |
-            ((word & 0x0c0c0c0c0c0c0c0cUL) << 2) |
-            ((word & 0x3030303030303030UL) >> 2) |
-            ((word & 0xc0c0c0c0c0c0c0c0UL) >> 6));
-    // Bitwise negate to complement bases
-    revcmp.b[j] = ~word;
-  }
+#ifdef BKMER_SIMD
+  cpu_dispatch_check(bkmer_gen, bkmer_select);
+  bkmer_revcmp_words_func(bkmer.b, revcmp.b, NUM_BKMER_WORDS);
+#else
+  _bkmer_revcmp_words_generic(bkmer.b, revcmp.b, NUM_BKMER_WORDS);
+#endif
 
 #if NUM_BKMER_WORDS > 1
   // Need to shift right
+  size_t i;
   for(i = NUM_BKMER_WORDS-1; i > 0; i--) {
     revcmp.b[i] = (revcmp.b[i] >> unused_bits) | (revcmp.b[i-1] << top_bits);
   }
@@ -149,6 +289,21 @@ BinaryKmer binary_kmer_random(size_t kmer_size)
   return bkmer;
 }
 
+BinaryKmer binary_kmer_random_r(size_t kmer_size, uint64_t *rng)
+{
+  BinaryKmer bkmer = BINARY_KMER_ZERO_MACRO;
+  uint64_t x = *rng;
+  size_t i;
+  ctx_assert(x != 0);
+  for(i = 0; i < NUM_BKMER_WORDS; i++) {
+    x ^= x >> 12; x ^= x << 25; x ^= x >> 27;
+    bkmer.b[i] = x * UINT64_C(0x2545f4914f6cdd1d);
+  }
+  *rng = x;
+  bkmer.b[0] >>= 64 - BKMER_TOP_BITS(kmer_size);
+  return bkmer;
+}
+
 //
 // Functions operating on strings
 //
@@ -172,14 +327,12 @@ BinaryKmer binary_kmer_from_str(const char *seq, size_t kmer_size)
 
 #if NUM_BKMER_WORDS > 1
   // Do remaining (whole) words
-  size_t i;
-  for(i = 1; i < NUM_BKMER_WORDS; i++) {
-    for(end += 32; k < end; k++) {
-      ctx_assert(char_is_acgt(*k));
-      nuc = dna_char_to_nuc(*k);
-      bkmer.b[i] = (bkmer.b[i] << 2) | nuc;
-    }
-  }
+  #ifdef BKMER_SIMD
+    cpu_dispatch_check(bkmer_gen, bkmer_select);
+    bkmer_encode_words_func(k, bkmer.b+1, NUM_BKMER_WORDS-1);
+  #else
+    _bkmer_encode_words_generic(k, bkmer.b+1, NUM_BKMER_WORDS-1);
+  #endif
 #endif
 
   return bkmer;
@@ -29,12 +29,43 @@ extern const BinaryKmer zero_bkmer;
   #define binary_kmer_hash(bkmer,rehash) ctx_hash32((bkmer).b, BKMER_BYTES, rehash)
 #elif defined(USE_XXHASH)
   #define binary_kmer_hash(bkmer,rehash) ctx_hash32((bkmer).b, BKMER_BYTES, rehash)
+#elif defined(USE_MIX_HASH)
+  // Multiply-mix hash, one 64 bit hash gives all rehash rounds
+  #define binary_kmer_hash(bkmer,rehash) bkmix_hash32((bkmer), (rehash))
 #else
   // Optimised lookup3
   #include "kmer_hash.h"
   #define binary_kmer_hash(bkmer,rehash) bklk3_hashlittle((bkmer), (rehash))
 #endif
 
+#include "kmer_mixhash.h"
+
+// Hash tables probe buckets for rehash rounds i=0,1,2.. using
+// binary_kmer_hash_round(bkmer,seed,h64,i) where h64=binary_kmer_hash64(bkmer,seed).
+// With HASH=MIX later rounds are derived from h64 without rehashing the kmer.
+// Round 0 is always binary_kmer_hash(bkmer,seed).
+#if defined(USE_MIX_HASH)
+  #define binary_kmer_hash64(bkmer,seed) bkmix_hash64((bkmer), (seed))
+  #define binary_kmer_hash_round(bkmer,seed,h64,i) bkmix_round((h64), (i))
+#else
+  #define binary_kmer_hash64(bkmer,seed) ((uint64_t)binary_kmer_hash((bkmer), (seed)))
+  #define binary_kmer_hash_round(bkmer,seed,h64,i) \
+          ((i) == 0 ? (uint32_t)(h64) : binary_kmer_hash((bkmer), (seed)+(i)))
+#endif
+
+// Set h64[i] = binary_kmer_hash64(bkmers[i],seed) for `n` kmers.
+// With HASH=MIX and AVX2, four kmers are hashed at once.
+static inline void binary_kmer_hash64_batch(const BinaryKmer *bkmers, size_t n,
+                                            uint32_t seed, uint64_t *h64)
+{
+  #if defined(USE_MIX_HASH)
+    bkmix_hash64_batch(bkmers, n, seed, h64);
+  #else
+    size_t i;
+    for(i = 0; i < n; i++) h64[i] = binary_kmer_hash64(bkmers[i], seed);
+  #endif
+}
+
 
 // Since kmer_size is always odd, top word always has <= 62 bits used
 // Number of bases store in all but the top word
@@ -56,24 +87,46 @@ extern const BinaryKmer zero_bkmer;
         ((bkmer)->b[NUM_BKMER_WORDS - 1] \
            = ((bkmer)->b[NUM_BKMER_WORDS - 1] & 0xfffffffffffffffcUL) | (nuc))
 
-static inline bool binary_kmer_less_than(BinaryKmer x, BinaryKmer y) {
+// Index of the first word that differs, NUM_BKMER_WORDS if x == y.
+// Up to 8 words, a mask of differing words is built without branches, so the
+// compiler can use vector compares, then the first is found by counting
+// leading zeros. Avoids a mispredicted branch per word for kmers that share
+// a prefix (e.g. neighbouring keys when sorting).
+static inline size_t binary_kmer_first_diff_word(BinaryKmer x, BinaryKmer y)
+{
   size_t i;
+#if NUM_BKMER_WORDS <= 8
+  uint32_t m = 0;
+  for(i = 0; i < NUM_BKMER_WORDS; i++)
+    m |= (uint32_t)(x.b[i] != y.b[i]) << (NUM_BKMER_WORDS-1-i);
+  return m ? (size_t)__builtin_clz(m) - (32 - NUM_BKMER_WORDS) : NUM_BKMER_WORDS;
+#else
   for(i = 0; i < NUM_BKMER_WORDS && x.b[i] == y.b[i]; i++);
+  return i;
+#endif
+}
+
+static inline bool binary_kmer_less_than(BinaryKmer x, BinaryKmer y) {
+  size_t i = binary_kmer_first_diff_word(x, y);
   return (i < NUM_BKMER_WORDS && x.b[i] < y.b[i]);
 }
 static inline bool binary_kmer_less_or_eq(BinaryKmer x, BinaryKmer y) {
-  size_t i;
-  for(i = 0; i < NUM_BKMER_WORDS && x.b[i] == y.b[i]; i++);
+  size_t i = binary_kmer_first_diff_word(x, y);
   return (i == NUM_BKMER_WORDS || x.b[i] < y.b[i]);
 }
 
 static inline int binary_kmers_compare(BinaryKmer a, BinaryKmer b)
 {
-  int i, c;
-  for(i = 0; i < NUM_BKMER_WORDS; i++)
-    if((c = cmp(a.b[i], b.b[i])) != 0)
-      return c;
-  return 0;
+  size_t i = binary_kmer_first_diff_word(a, b);
+  return i == NUM_BKMER_WORDS ? 0 : cmp(a.b[i], b.b[i]);
+}
+
+// OR of XORs of all words, branch free and vectorised by the compiler
+static inline bool binary_kmer_equal(BinaryKmer x, BinaryKmer y) {
+  uint64_t d = 0;
+  size_t i;
+  for(i = 0; i < NUM_BKMER_WORDS; i++) d |= x.b[i] ^ y.b[i];
+  return d == 0;
 }
 
 #if NUM_BKMER_WORDS == 1
@@ -87,7 +140,7 @@ static inline int binary_kmers_compare(BinaryKmer a, BinaryKmer b)
   #define binary_kmer_lt(x,y)  ((x).b[0]<(y).b[0] || ((x).b[0]==(y).b[0] && (x).b[1]< (y).b[1]))
   #define binary_kmer_cmp(x,y) ((x).b[0] != (y).b[0] ? cmp((x).b[0],(y).b[0]) : cmp((x).b[1],(y).b[1]))
 #else /* NUM_BKMER_WORDS > 2 */
-  #define binary_kmer_eq(x,y)  (memcmp((x).b,(y).b,BKMER_BYTES) == 0)
+  #define binary_kmer_eq(x,y)  binary_kmer_equal(x,y)
   #define binary_kmer_le(x,y)  binary_kmer_less_or_eq(x,y)
   #define binary_kmer_lt(x,y)  binary_kmer_less_than(x,y)
   #define binary_kmer_cmp(x,y) binary_kmers_compare(x,y)
@@ -129,33 +182,36 @@ static inline int binary_kmers_qcmp_unaligned_ptrs(const void *aa, const void *b
 // the lower of the kmer vs reverse complement of itself
 BinaryKmer binary_kmer_get_key(const BinaryKmer kmer, size_t kmer_size);
 
-#if NUM_BKMER_WORDS == 1
-
-  static inline BinaryKmer binary_kmer_right_shift_one_base(const BinaryKmer bkmer)
-  {
-    BinaryKmer b = bkmer; b.b[0] >>= 2; return b;
-  }
-
-  static inline BinaryKmer binary_kmer_left_shift_one_base(const BinaryKmer bkmer,
-                                                           size_t kmer_size)
-  {
-    BinaryKmer b = bkmer;
-    b.b[NUM_BKMER_WORDS - 1] <<= 2;
-    b.b[0] &= (UINT64_MAX >> (64 - BKMER_TOP_BITS(kmer_size)));
-    return b;
-  }
+// Shifts are inline for all kmer sizes: the word count is a constant so the
+// loops unroll into one shift and funnel per word, with no call per base
 
-#else
-
-  // CTAGT -> ACTAG (add blank 'A' to first position)
-  // Shift towards most significant position
-  BinaryKmer binary_kmer_right_shift_one_base(const BinaryKmer bkmer);
+// CTAGT -> ACTAG (add blank 'A' to first position)
+// Shift towards most significant position
+static inline BinaryKmer binary_kmer_right_shift_one_base(const BinaryKmer bkmer)
+{
+  BinaryKmer b;
+  size_t i;
+  for(i = NUM_BKMER_WORDS - 1; i > 0; i--)
+    b.b[i] = (bkmer.b[i] >> 2) | (bkmer.b[i - 1] << 62);
+  b.b[0] = bkmer.b[0] >> 2;
+  return b;
+}
 
-  // CTAGT -> TAGTA (add blank 'A' to last position)
-  BinaryKmer binary_kmer_left_shift_one_base(const BinaryKmer bkmer,
-                                             size_t kmer_size);
+// CTAGT -> TAGTA (add blank 'A' to last position)
+// Shift towards least significant position
+static inline BinaryKmer binary_kmer_left_shift_one_base(const BinaryKmer bkmer,
+                                                         size_t kmer_size)
+{
+  BinaryKmer b;
+  size_t i;
+  for(i = 0; i+1 < NUM_BKMER_WORDS; i++)
+    b.b[i] = (bkmer.b[i] << 2) | (bkmer.b[i + 1] >> 62);
+  b.b[NUM_BKMER_WORDS - 1] = bkmer.b[NUM_BKMER_WORDS - 1] << 2;
 
-#endif
+  // Mask top word
+  b.b[0] &= (UINT64_MAX >> (64 - BKMER_TOP_BITS(kmer_size)));
+  return b;
+}
 
 static inline
 BinaryKmer binary_kmer_left_shift_add(const BinaryKmer bkmer, size_t kmer_size,
@@ -175,16 +231,80 @@ BinaryKmer binary_kmer_right_shift_add(const BinaryKmer bkmer, size_t kmer_size,
   return b;
 }
 
+// Add `nuc` to the end of kmer `fw` and its complement to the start of `rv`,
+// where `rv` is the reverse complement of `fw`. Rolling both strands saves
+// reverse complementing every kmer of a sequence to get its key.
+static inline void binary_kmer_roll(BinaryKmer *fw, BinaryKmer *rv,
+                                    size_t kmer_size, Nucleotide nuc)
+{
+  *fw = binary_kmer_left_shift_add(*fw, kmer_size, nuc);
+  *rv = binary_kmer_right_shift_add(*rv, kmer_size, dna_nuc_complement(nuc));
+}
+
 // Reverse complement a binary kmer from kmer into revcmp_kmer
 BinaryKmer binary_kmer_reverse_complement(const BinaryKmer bkmer, size_t kmer_size);
 
 // Get a random binary kmer -- useful for testing
 BinaryKmer binary_kmer_random(size_t kmer_size);
 
+// Get a random binary kmer from the xorshift64* generator with state `*rng`,
+// which must not be zero. Threadsafe if each thread has its own state.
+BinaryKmer binary_kmer_random_r(size_t kmer_size, uint64_t *rng);
+
 // BinaryKmer <-> String functions
 char* binary_kmer_to_str(const BinaryKmer kmer, size_t kmer_size, char *seq);
 BinaryKmer binary_kmer_from_str(const char *seq, size_t kmer_size);
 
+// SIMD level used by binary_kmer_reverse_complement() / binary_kmer_from_str()
+const char* binary_kmer_revcmp_simd_str();
+const char* binary_kmer_encode_simd_str();
+
 void binary_kmer_to_hex(const BinaryKmer bkmer, size_t kmer_size, char *seq);
 
+//
+// Iterate over the canonical kmers (keys) of a sequence, updating the forward
+// and reverse complement strands by one base each step so no kmer needs a full
+// reverse complement:
+//
+//   BinaryKmerIter it;
+//   binary_kmer_iter_init(&it, seq, kmer_size);
+//   for(i = kmer_size-1; i < len; i++) {
+//     binary_kmer_iter_next(&it, dna_char_to_nuc(seq[i]));
+//     bkey = binary_kmer_iter_key(&it, &orient);
+//   }
+//
+typedef struct
+{
+  BinaryKmer fw, rv;
+  size_t kmer_size;
+} BinaryKmerIter;
+
+// Load the first kmer_size-1 bases of `seq`
+// (seq must have at least kmer_size bases)
+static inline void binary_kmer_iter_init(BinaryKmerIter *it, const char *seq,
+                                         size_t kmer_size)
+{
+  BinaryKmer bkmer = binary_kmer_from_str(seq, kmer_size);
+  it->fw = binary_kmer_right_shift_one_base(bkmer);
+  it->rv = binary_kmer_left_shift_one_base(binary_kmer_reverse_complement(bkmer, kmer_size),
+                                           kmer_size);
+  it->kmer_size = kmer_size;
+}
+
+// Add `nuc` to the end of the kmer
+static inline void binary_kmer_iter_next(BinaryKmerIter *it, Nucleotide nuc)
+{
+  binary_kmer_roll(&it->fw, &it->rv, it->kmer_size, nuc);
+}
+
+// Get the lower of the two strands and whether it is the reverse complement.
+// kmer size is odd so a kmer is never its own reverse complement.
+static inline BinaryKmer binary_kmer_iter_key(const BinaryKmerIter *it,
+                                              Orientation *orient)
+{
+  bool rev = binary_kmer_lt(it->rv, it->fw);
+  *orient = rev ? REVERSE : FORWARD;
+  return rev ? it->rv : it->fw;
+}
+
 #endif /* BINARY_KMER_H_ */
@@ -5,6 +5,28 @@
 
 #include "misc/mem_size.h" // in libs/misc/
 
+#define CMD_MEM_PLAN_MAX 64
+#define CMD_MEM_PLAN_NAMELEN 64
+
+// Dry run: structures passed to cmd_print_mem()
+static bool mem_plan = false;
+static size_t mem_plan_nitems = 0;
+static struct {
+  char name[CMD_MEM_PLAN_NAMELEN];
+  size_t bytes;
+} mem_plan_items[CMD_MEM_PLAN_MAX];
+
+void cmd_mem_set_plan(bool plan)
+{
+  mem_plan = plan;
+  mem_plan_nitems = 0;
+}
+
+bool cmd_mem_get_plan()
+{
+  return mem_plan;
+}
+
 void cmd_mem_args_set_memory(struct MemArgs *mem, const char *arg)
 {
   if(mem->mem_to_use_set)
@@ -30,6 +52,46 @@ void cmd_print_mem(size_t mem_bytes, const char *name)
   char mem_str[100];
   bytes_to_str(mem_bytes, 1, mem_str);
   status("[memory] %s: %s", name, mem_str);
+
+  if(mem_plan && mem_plan_nitems < CMD_MEM_PLAN_MAX) {
+    strncpy(mem_plan_items[mem_plan_nitems].name, name, CMD_MEM_PLAN_NAMELEN-1);
+    mem_plan_items[mem_plan_nitems].name[CMD_MEM_PLAN_NAMELEN-1] = '\0';
+    mem_plan_items[mem_plan_nitems].bytes = mem_bytes;
+    mem_plan_nitems++;
+  }
+}
+
+// Print structures, total and a suggested -m, with 5% headroom for buffers not
+// counted, rounded up to a whole MB
+static void cmd_mem_print_plan(size_t mem_to_use, size_t mem_requested)
+  __attribute__((noreturn));
+
+static void cmd_mem_print_plan(size_t mem_to_use, size_t mem_requested)
+{
+  size_t i, ram = getMemorySize(), suggest_mb;
+  char memstr[50];
+
+  suggest_mb = (mem_requested + mem_requested/20 + (1UL<<20) - 1) >> 20;
+
+  printf("# "CMD" memory plan: %s\n", cmd_get_cmdline());
+  printf("structure\tbytes\tsize\n");
+  for(i = 0; i < mem_plan_nitems; i++) {
+    printf("%s\t%zu\t%s\n", mem_plan_items[i].name, mem_plan_items[i].bytes,
+           bytes_to_str(mem_plan_items[i].bytes, 1, memstr));
+  }
+  printf("total\t%zu\t%s\n", mem_requested,
+         bytes_to_str(mem_requested, 1, memstr));
+  printf("ram\t%zu\t%s\n", ram, bytes_to_str(ram, 1, memstr));
+  printf("suggested\t%zu\t-m %zuM\n", suggest_mb << 20, suggest_mb);
+  fflush(stdout);
+
+  if(mem_requested > mem_to_use) {
+    status("[memory] plan needs more than -m %s",
+           bytes_to_str(mem_to_use, 1, memstr));
+  }
+  if(mem_requested > ram) warn("Plan needs more memory than this machine has");
+
+  exit(EXIT_SUCCESS);
 }
 
 // If your command accepts -n <kmers> and -m <mem> this may be useful
@@ -51,6 +113,15 @@ size_t cmd_get_kmers_in_hash(size_t mem_to_use, bool mem_to_use_set,
     cmd_print_usage("Cannot read from stream without -n <nkmers> set");
   }
 
+  // Dry run without -m or -n: size the hash table for the kmers needed rather
+  // than to fill the default memory
+  if(mem_plan && !mem_to_use_set && !num_kmers_set &&
+     (min_num_kmer_req > 0 || max_num_kmers_req > 0)) {
+    if(min_num_kmer_req <= 0) min_num_kmer_req = max_num_kmers_req;
+    use_mem_limit = false;
+    mem_to_use = SIZE_MAX;
+  }
+
   status("[memory] %zu bits per kmer", entry_bits);
 
   if(num_kmers_set)
@@ -135,6 +206,8 @@ void cmd_check_mem_limit(size_t mem_to_use, size_t mem_requested)
   char memstr[50], ramstr[50];
   bytes_to_str(mem_requested, 1, memstr);
 
+  if(mem_plan) cmd_mem_print_plan(mem_to_use, mem_requested);
+
   if(mem_requested > mem_to_use)
     die("Need to set higher memory limit [ at least -m %s ]", memstr);
 
@@ -18,7 +18,8 @@ void cmd_mem_args_set_memory(struct MemArgs *mem, const char *arg);
 void cmd_mem_args_set_nkmers(struct MemArgs *mem, const char *arg);
 
 // If your command accepts -n <kmers> and -m <mem> this may be useful
-//  `entry_bits` is memory per node, including hash table BinaryKmer
+//  `entry_bits` is memory per node, including hash table BinaryKmer. Hash table
+//  tags and bucket headers are added as set with hash_table_mem_set_layout()
 // Resulting graph_mem is always < args->mem_to_use
 // min_num_kmers and max_num_kmers are kmers that need to be held in the graph
 // (i.e. min_num_kmers/IDEAL_OCCUPANCY)
@@ -35,4 +36,10 @@ void cmd_check_mem_limit(size_t mem_to_use, size_t mem_requested);
 // Print memory being used
 void cmd_print_mem(size_t mem_bytes, const char *name);
 
+// Dry run (--plan): the hash table is sized for the kmers needed unless -m or
+// -n are given, and cmd_check_mem_limit() prints each structure passed to
+// cmd_print_mem(), the total and a suggested -m to STDOUT, then exits.
+void cmd_mem_set_plan(bool plan);
+bool cmd_mem_get_plan();
+
 #endif /* CMD_MEM_H_ */
@@ -0,0 +1,301 @@
+#include "global.h"
+#include "compact_graph.h"
+#include "binary_kmer.h"
+#include "dna.h"
+#include "util.h"
+
+/**
+ * Build from a UnitigIndex already built over `uidx->db_graph`
+ * Coverages are only stored if the graph has coverages
+ **/
+void cgraph_alloc(CompactGraph *cg, const UnitigIndex *uidx)
+{
+  const dBGraph *db_graph = uidx->db_graph;
+  memset(cg, 0, sizeof(*cg));
+  cg->uidx = uidx;
+  cg->db_graph = db_graph;
+  cg->kmer_size = db_graph->kmer_size;
+  cg->num_of_cols = db_graph->num_of_cols;
+}
+
+void cgraph_dealloc(CompactGraph *cg)
+{
+  ctx_free(cg->unitigs);
+  ctx_free(cg->seq);
+  ctx_free(cg->covgs);
+  memset(cg, 0, sizeof(*cg));
+}
+
+// Get the step that walking onto `node` takes us on
+static inline CGraphStep cgraph_node_step(const UnitigIndex *uidx, dBNode node)
+{
+  UnitigIndexKmer k = uidx->kmers[node.key];
+  ctx_assert(k.unitigid != UNITIG_INDEX_NONE);
+  return (CGraphStep){.unitigid = k.unitigid,
+                      .orient = (node.orient == k.orient ? FORWARD : REVERSE)};
+}
+
+static inline void cgraph_set_nuc_mt(uint8_t *seq, size_t pos, Nucleotide nuc)
+{
+  (void)__sync_fetch_and_or(&seq[pos/4], (uint8_t)(nuc << (2*(pos%4))));
+}
+
+// Get neighbours leaving `node`
+static inline uint8_t cgraph_get_nbrs(const CompactGraph *cg, BinaryKmer bkey,
+                                      dBNode node, CGraphStep steps[4])
+{
+  const dBGraph *db_graph = cg->db_graph;
+  Edges edges = db_node_get_edges_union(db_graph, node.key);
+  dBNode nodes[4];
+  Nucleotide nucs[4];
+  uint8_t i, n;
+  n = db_graph_next_nodes(db_graph, bkey, node.orient, edges, nodes, nucs);
+  for(i = 0; i < n; i++) steps[i] = cgraph_node_step(cg->uidx, nodes[i]);
+  return n;
+}
+
+// Each kmer writes its last base (first kmer writes all bases), adds its
+// coverage and, if at the end of a unitig, the neighbours
+static bool cgraph_add_kmer(hkey_t hkey, size_t threadid, void *arg)
+{
+  (void)threadid;
+  CompactGraph *cg = (CompactGraph*)arg;
+  const dBGraph *db_graph = cg->db_graph;
+  const UnitigIndex *uidx = cg->uidx;
+  const size_t kmer_size = cg->kmer_size;
+
+  UnitigIndexKmer k = uidx->kmers[hkey];
+  size_t i, col, offset = uidx->offsets[hkey];
+  CGraphUnitig *u = &cg->unitigs[k.unitigid];
+  ctx_assert(k.unitigid < cg->num_unitigs);
+
+  dBNode node = {.key = hkey, .orient = k.orient};
+  BinaryKmer bkey = db_node_get_bkey(db_graph, hkey);
+  BinaryKmer bkmer = bkmer_oriented_bkmer(bkey, node.orient, kmer_size);
+  size_t pos = u->seq_offset + offset;
+  Nucleotide nuc;
+
+  if(offset == 0) {
+    for(i = 0; i < kmer_size; i++) {
+      nuc = binary_kmer_last_nuc(bkmer);
+      cgraph_set_nuc_mt(cg->seq, pos+kmer_size-1-i, nuc);
+      bkmer = binary_kmer_right_shift_one_base(bkmer);
+    }
+  }
+  else {
+    nuc = binary_kmer_last_nuc(bkmer);
+    cgraph_set_nuc_mt(cg->seq, pos+kmer_size-1, nuc);
+  }
+
+  if(cg->covgs != NULL) {
+    for(col = 0; col < cg->num_of_cols; col++) {
+      uint64_t covg = db_node_get_covg(db_graph, hkey, col);
+      (void)__sync_fetch_and_add(&cg->covgs[k.unitigid*cg->num_of_cols+col],
+                                 covg);
+    }
+  }
+
+  // Only one kmer is at each end of a unitig, so ends are not shared
+  if(offset == 0)
+    u->num_prev = cgraph_get_nbrs(cg, bkey, db_node_reverse(node), u->prev);
+  if(offset+1 == u->num_kmers)
+    u->num_next = cgraph_get_nbrs(cg, bkey, node, u->next);
+
+  return false; // keep iterating
+}
+
+void cgraph_build(CompactGraph *cg, size_t nthreads)
+{
+  const UnitigIndex *uidx = cg->uidx;
+  const dBGraph *db_graph = cg->db_graph;
+  size_t i, seq_len = 0;
+
+  ctx_free(cg->unitigs);
+  ctx_free(cg->seq);
+  ctx_free(cg->covgs);
+
+  cg->num_unitigs = uidx->num_unitigs;
+  cg->unitigs = ctx_calloc(MAX2(cg->num_unitigs, 1), sizeof(CGraphUnitig));
+
+  for(i = 0; i < cg->num_unitigs; i++) {
+    cg->unitigs[i].seq_offset = seq_len;
+    cg->unitigs[i].num_kmers = uidx->unitigs[i].len;
+    seq_len += uidx->unitigs[i].len + cg->kmer_size - 1;
+  }
+
+  cg->seq_len = seq_len;
+  cg->seq = ctx_calloc(MAX2((seq_len+3)/4, 1), 1);
+  cg->covgs = NULL;
+
+  if(db_graph->col_covgs != NULL || db_graph->sparse != NULL)
+    cg->covgs = ctx_calloc(MAX2(cg->num_unitigs*cg->num_of_cols, 1),
+                           sizeof(uint64_t));
+
+  hash_table_iterate(&db_graph->ht, nthreads, cgraph_add_kmer, cg);
+}
+
+// Print sequence of step to `str`, which must have space for
+// cgraph_unitig_len()+1 bytes. Returns number of bases printed
+size_t cgraph_step_to_str(const CompactGraph *cg, CGraphStep step, char *str)
+{
+  const CGraphUnitig *u = &cg->unitigs[step.unitigid];
+  size_t i, len = cgraph_unitig_len(cg, u);
+  Nucleotide nuc;
+
+  if(step.orient == FORWARD) {
+    for(i = 0; i < len; i++) {
+      nuc = cgraph_unitig_nuc(cg, step.unitigid, i);
+      str[i] = dna_nuc_to_char(nuc);
+    }
+  } else {
+    for(i = 0; i < len; i++) {
+      nuc = dna_nuc_complement(cgraph_unitig_nuc(cg, step.unitigid, len-1-i));
+      str[i] = dna_nuc_to_char(nuc);
+    }
+  }
+
+  str[len] = '\0';
+  return len;
+}
+
+//
+// Output
+//
+// Unitigs are written in blocks of CGRAPH_WRITE_BLOCK ids. Each round, every
+// thread formats one block into its own buffer, then the buffers are written
+// in block order. Output is in unitig id order whatever the number of threads.
+//
+
+#define CGRAPH_WRITE_BLOCK (1<<14)
+
+typedef struct {
+  const CompactGraph *cg;
+  size_t nthreads, start, end; // unitigs in this round
+  StrBuf *bufs; // [nthreads]
+  size_t *counts; // [nthreads] lines printed
+  size_t (*print)(const CompactGraph *_cg, size_t _uid, StrBuf *_sbuf);
+} CGraphWriter;
+
+static void _cgraph_write_block(void *arg, size_t threadid)
+{
+  CGraphWriter *wr = (CGraphWriter*)arg;
+  StrBuf *sbuf = &wr->bufs[threadid];
+  size_t uid, start, end, n = 0;
+  start = wr->start + threadid * CGRAPH_WRITE_BLOCK;
+  end = MIN2(start + CGRAPH_WRITE_BLOCK, wr->end);
+  strbuf_reset(sbuf);
+  for(uid = start; uid < end; uid++) n += wr->print(wr->cg, uid, sbuf);
+  wr->counts[threadid] = n;
+}
+
+// Returns sum of values returned by `print`
+static size_t cgraph_write_mt(const CompactGraph *cg, size_t nthreads,
+                              FILE *fout,
+                              size_t (*print)(const CompactGraph *_cg,
+                                              size_t _uid, StrBuf *_sbuf))
+{
+  size_t i, total = 0, round = nthreads * CGRAPH_WRITE_BLOCK;
+  CGraphWriter wr = {.cg = cg, .nthreads = nthreads, .print = print,
+                     .bufs = ctx_calloc(nthreads, sizeof(StrBuf)),
+                     .counts = ctx_calloc(nthreads, sizeof(size_t))};
+
+  for(i = 0; i < nthreads; i++) strbuf_alloc(&wr.bufs[i], 1<<20);
+
+  for(wr.start = 0; wr.start < cg->num_unitigs; wr.start += round) {
+    wr.end = MIN2(wr.start + round, cg->num_unitigs);
+    util_multi_thread(&wr, nthreads, _cgraph_write_block);
+    for(i = 0; i < nthreads; i++) {
+      if(fwrite(wr.bufs[i].b, 1, wr.bufs[i].end, fout) != wr.bufs[i].end)
+        die("Cannot write output: %s", strerror(errno));
+      total += wr.counts[i];
+    }
+  }
+
+  for(i = 0; i < nthreads; i++) strbuf_dealloc(&wr.bufs[i]);
+  ctx_free(wr.bufs);
+  ctx_free(wr.counts);
+  return total;
+}
+
+// Append unitig sequence read forward
+static void cgraph_append_seq(const CompactGraph *cg, size_t uid, StrBuf *sbuf)
+{
+  CGraphStep step = {.unitigid = uid, .orient = FORWARD};
+  size_t len = cgraph_unitig_len(cg, &cg->unitigs[uid]);
+  strbuf_ensure_capacity(sbuf, sbuf->end + len + 1);
+  sbuf->end += cgraph_step_to_str(cg, step, sbuf->b + sbuf->end);
+}
+
+static size_t cgraph_print_fasta(const CompactGraph *cg, size_t uid,
+                                 StrBuf *sbuf)
+{
+  // Edges into the first kmer and out of the last, taken from the graph
+  const UnitigIndexEntry *e = &cg->uidx->unitigs[uid];
+  Edges e0 = db_node_get_edges_union(cg->db_graph, e->first.key);
+  Edges en = db_node_get_edges_union(cg->db_graph, e->last.key);
+  char prev[5], next[5];
+  e0 = edges_with_orientation(e0, !e->first.orient);
+  en = edges_with_orientation(en, e->last.orient);
+  edges_get_str(rev_nibble_lookup(e0), prev);
+  edges_get_str(en, next);
+
+  strbuf_sprintf(sbuf, ">unitig%zu prev=%s next=%s\n", uid, prev, next);
+  cgraph_append_seq(cg, uid, sbuf);
+  strbuf_append_char(sbuf, '\n');
+  return 1;
+}
+
+static size_t cgraph_print_gfa_segment(const CompactGraph *cg, size_t uid,
+                                       StrBuf *sbuf)
+{
+  strbuf_sprintf(sbuf, "S\tnode%zu\t", uid);
+  cgraph_append_seq(cg, uid, sbuf);
+  strbuf_append_char(sbuf, '\n');
+  return 1;
+}
+
+// Each link is seen from both unitigs it joins, print it once.
+// Links from a unitig to itself, u+ -> u+ is the same as u- -> u-
+static size_t cgraph_print_gfa_links(const CompactGraph *cg, size_t uid,
+                                     StrBuf *sbuf)
+{
+  const char gfa_orient[2] = "+-";
+  size_t j, nlinks = 0;
+  uint8_t o, n;
+  CGraphStep step, next[4];
+
+  for(o = 0; o < 2; o++) {
+    step = (CGraphStep){.unitigid = uid, .orient = o};
+    n = cgraph_next_steps(cg, step, next);
+    for(j = 0; j < n; j++) {
+      if(uid < next[j].unitigid ||
+         (uid == next[j].unitigid && step.orient + next[j].orient < 2))
+      {
+        strbuf_sprintf(sbuf, "L\tnode%zu\t%c\tnode%zu\t%c\t%zuM\n",
+                       uid, gfa_orient[step.orient],
+                       (size_t)next[j].unitigid, gfa_orient[next[j].orient],
+                       cg->kmer_size - 1);
+        nlinks++;
+      }
+    }
+  }
+
+  return nlinks;
+}
+
+// Write unitigs in FASTA format, with the edges into the first kmer and out
+// of the last kmer in the header
+// Returns number of unitigs printed
+size_t cgraph_write_fasta(const CompactGraph *cg, size_t nthreads, FILE *fout)
+{
+  return cgraph_write_mt(cg, nthreads, fout, cgraph_print_fasta);
+}
+
+// Write unitigs as segments and edges as links in GFA 1.0 format
+// Returns number of links printed
+size_t cgraph_write_gfa(const CompactGraph *cg, size_t nthreads, FILE *fout)
+{
+  fputs("H\tVN:Z:1.0\n", fout);
+  cgraph_write_mt(cg, nthreads, fout, cgraph_print_gfa_segment);
+  return cgraph_write_mt(cg, nthreads, fout, cgraph_print_gfa_links);
+}
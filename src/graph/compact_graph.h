@@ -0,0 +1,100 @@
+#ifndef COMPACT_GRAPH_H_
+#define COMPACT_GRAPH_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+#include "unitig_graph.h"
+
+//
+// Compacted de Bruijn graph
+//
+// Each node is a unitig with its sequence packed 2 bits per base, per-colour
+// coverage and up to four neighbours at each end. Traversal steps from unitig
+// to unitig without any hash table lookups. Built in parallel from a
+// UnitigIndex, unitig ids and orientations are the same as in the index.
+//
+// A step is a unitig with an orientation. Unitig sequence read FORWARD is the
+// sequence of normalised unitig (see db_unitig_normalise()).
+//
+
+typedef struct {
+  uint64_t unitigid:63, orient:1;
+} CGraphStep;
+
+typedef struct {
+  uint64_t seq_offset; // position of first base in CompactGraph.seq
+  uint32_t num_kmers;
+  uint8_t num_prev, num_next;
+  // prev: steps when leaving the first kmer backwards (walking REVERSE)
+  // next: steps when leaving the last kmer forwards (walking FORWARD)
+  CGraphStep prev[4], next[4];
+} CGraphUnitig;
+
+typedef struct {
+  CGraphUnitig *unitigs; // [num_unitigs]
+  uint8_t *seq; // 2 bits per base, all unitigs concatenated
+  uint64_t *covgs; // [num_unitigs*num_of_cols] sum of kmer coverage, or NULL
+  size_t num_unitigs, num_of_cols, kmer_size, seq_len;
+  const UnitigIndex *uidx;
+  const dBGraph *db_graph;
+} CompactGraph;
+
+#define cgraph_num_unitigs(cg) ((cg)->num_unitigs)
+#define cgraph_unitig(cg,uid) (&(cg)->unitigs[uid])
+
+// Number of bases in a unitig
+#define cgraph_unitig_len(cg,u) ((u)->num_kmers + (cg)->kmer_size - 1)
+
+// Mean kmer coverage of unitig `uid` in colour `col` (rounded down)
+#define cgraph_unitig_covg_mean(cg,uid,col) \
+        ((cg)->covgs[(uid)*(cg)->num_of_cols+(col)] / \
+         (cg)->unitigs[uid].num_kmers)
+
+/**
+ * Build from a UnitigIndex already built over `uidx->db_graph`
+ * Coverages are only stored if the graph has coverages
+ **/
+void cgraph_alloc(CompactGraph *cg, const UnitigIndex *uidx);
+void cgraph_dealloc(CompactGraph *cg);
+void cgraph_build(CompactGraph *cg, size_t nthreads);
+
+// Get base `i` of unitig `uid` read forward
+static inline Nucleotide cgraph_unitig_nuc(const CompactGraph *cg,
+                                           size_t uid, size_t i)
+{
+  size_t pos = cg->unitigs[uid].seq_offset + i;
+  return (cg->seq[pos/4] >> (2*(pos%4))) & 3;
+}
+
+// Get steps that follow `step`, returns number of steps (0-4)
+static inline uint8_t cgraph_next_steps(const CompactGraph *cg,
+                                        CGraphStep step, CGraphStep next[4])
+{
+  const CGraphUnitig *u = &cg->unitigs[step.unitigid];
+  if(step.orient == FORWARD) {
+    memcpy(next, u->next, u->num_next * sizeof(CGraphStep));
+    return u->num_next;
+  } else {
+    memcpy(next, u->prev, u->num_prev * sizeof(CGraphStep));
+    return u->num_prev;
+  }
+}
+
+// Print sequence of step to `str`, which must have space for
+// cgraph_unitig_len()+1 bytes. Returns number of bases printed
+size_t cgraph_step_to_str(const CompactGraph *cg, CGraphStep step, char *str);
+
+//
+// Output is in unitig id order and formatted in parallel by `nthreads`
+//
+
+// Write unitigs in FASTA format, with the edges into the first kmer and out
+// of the last kmer in the header
+// Returns number of unitigs printed
+size_t cgraph_write_fasta(const CompactGraph *cg, size_t nthreads, FILE *fout);
+
+// Write unitigs as segments and edges as links in GFA 1.0 format
+// Returns number of links printed
+size_t cgraph_write_gfa(const CompactGraph *cg, size_t nthreads, FILE *fout);
+
+#endif /* COMPACT_GRAPH_H_ */
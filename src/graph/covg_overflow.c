@@ -0,0 +1,70 @@
+#include "global.h"
+#include "covg_overflow.h"
+
+void covg_ovf_alloc(CovgOverflow *ovf)
+{
+  ovf->h = kh_init(CovgOvf);
+  if(pthread_mutex_init(&ovf->lock, NULL) != 0) die("Mutex init failed");
+}
+
+void covg_ovf_dealloc(CovgOverflow *ovf)
+{
+  kh_destroy(CovgOvf, ovf->h);
+  pthread_mutex_destroy(&ovf->lock);
+  memset(ovf, 0, sizeof(*ovf));
+}
+
+void covg_ovf_reset(CovgOverflow *ovf)
+{
+  pthread_mutex_lock(&ovf->lock);
+  kh_clear(CovgOvf, ovf->h);
+  pthread_mutex_unlock(&ovf->lock);
+}
+
+static inline Covg _covg_ovf_get(const CovgOverflow *ovf, uint64_t idx)
+{
+  khiter_t k = kh_get(CovgOvf, ovf->h, idx);
+  return k == kh_end(ovf->h) ? COVG_STORE_MAX : kh_value(ovf->h, k);
+}
+
+static inline void _covg_ovf_set(CovgOverflow *ovf, uint64_t idx, Covg covg)
+{
+  int ret;
+  khiter_t k = kh_put(CovgOvf, ovf->h, idx, &ret);
+  if(ret < 0) die("Out of memory");
+  kh_value(ovf->h, k) = covg;
+}
+
+Covg covg_ovf_get(CovgOverflow *ovf, uint64_t idx)
+{
+  pthread_mutex_lock(&ovf->lock);
+  Covg covg = _covg_ovf_get(ovf, idx);
+  pthread_mutex_unlock(&ovf->lock);
+  return covg;
+}
+
+void covg_ovf_set(CovgOverflow *ovf, uint64_t idx, Covg covg)
+{
+  pthread_mutex_lock(&ovf->lock);
+  _covg_ovf_set(ovf, idx, covg);
+  pthread_mutex_unlock(&ovf->lock);
+}
+
+// The store only reaches COVG_STORE_MAX while we hold the lock, so another
+// thread that sees COVG_STORE_MAX will wait for the entry to be set
+void covg_ovf_add_mt(CovgOverflow *ovf, uint64_t idx, volatile CovgStore *store,
+                     Covg update)
+{
+  CovgStore v;
+  pthread_mutex_lock(&ovf->lock);
+  while((v = *store) < COVG_STORE_MAX &&
+        !__sync_bool_compare_and_swap(store, v, COVG_STORE_MAX)) {}
+  if(v < COVG_STORE_MAX) _covg_ovf_set(ovf, idx, SAFE_ADD_COVG(v, update));
+  else _covg_ovf_set(ovf, idx, SAFE_ADD_COVG(_covg_ovf_get(ovf, idx), update));
+  pthread_mutex_unlock(&ovf->lock);
+}
+
+size_t covg_ovf_size(const CovgOverflow *ovf)
+{
+  return kh_size(ovf->h);
+}
@@ -0,0 +1,46 @@
+#ifndef COVG_OVERFLOW_H_
+#define COVG_OVERFLOW_H_
+
+//
+// Coverages that don't fit in a graph's CovgStore (compiled with COVG_BITS=8
+// or COVG_BITS=16). Keyed by position in col_covgs (db_node_covg_idx()).
+//
+// An entry is only valid while col_covgs holds COVG_STORE_MAX at that
+// position, so wiping col_covgs does not need to remove entries. An entry is
+// always set when a stored coverage first reaches COVG_STORE_MAX.
+//
+// All functions take a lock; they are only called for the rare high counts.
+//
+
+#include <pthread.h>
+#include "htslib/khash.h"
+
+#include "cortex_types.h"
+
+KHASH_MAP_INIT_INT64(CovgOvf, Covg)
+
+typedef struct
+{
+  khash_t(CovgOvf) *h;
+  pthread_mutex_t lock;
+} CovgOverflow;
+
+void covg_ovf_alloc(CovgOverflow *ovf);
+void covg_ovf_dealloc(CovgOverflow *ovf);
+void covg_ovf_reset(CovgOverflow *ovf);
+
+// Threadsafe
+// Returns COVG_STORE_MAX if there is no entry
+Covg covg_ovf_get(CovgOverflow *ovf, uint64_t idx);
+void covg_ovf_set(CovgOverflow *ovf, uint64_t idx, Covg covg);
+
+// Threadsafe
+// Add to `*store`, moving the coverage into the overflow table if it does not
+// fit. Saturates at COVG_MAX.
+void covg_ovf_add_mt(CovgOverflow *ovf, uint64_t idx, volatile CovgStore *store,
+                     Covg update);
+
+// Number of entries, not all may be in use
+size_t covg_ovf_size(const CovgOverflow *ovf);
+
+#endif /* COVG_OVERFLOW_H_ */
@@ -3,7 +3,10 @@
 #include "binary_kmer.h"
 #include "db_graph.h"
 #include "db_node.h"
+#include "db_graph_disk.h"
+#include "graph_shm.h"
 #include "graph_info.h"
+#include "graph_pass.h"
 
 static void db_graph_status(const dBGraph *db_graph)
 {
@@ -11,13 +14,108 @@ static void db_graph_status(const dBGraph *db_graph)
   ulong_to_str(db_graph->ht.capacity, capacity_str);
   status("[graph] kmer-size: %zu; colours: %zu; capacity: %s\n",
          db_graph->kmer_size, db_graph->num_of_cols, capacity_str);
+
+  // Report the page types we actually got, huge pages may have run out
+  if(db_graph->large_pages) {
+    #define _pgstr(ptr) ((ptr) ? alloc_pages_str(alloc_large_pages(ptr)) : "-")
+    status("[graph] pages kmers: %s; edges: %s; covgs: %s; in-colour: %s",
+           _pgstr(db_graph->ht.table), _pgstr(db_graph->col_edges),
+           _pgstr(db_graph->col_covgs), _pgstr(db_graph->node_in_cols));
+    #undef _pgstr
+  }
+}
+
+// Called by cuckoo inserts to move data indexed by hkey with its kmer
+static void db_graph_move_kmer(hkey_t from, hkey_t to, void *arg)
+{
+  dBGraph *db_graph = (dBGraph*)arg;
+  GPathStore *gpstore = &db_graph->gpstore;
+  size_t col;
+
+  ctx_assert2(db_graph->sparse == NULL && db_graph->shared_edges == NULL &&
+              db_graph->disk == NULL && db_graph->next_cache == NULL &&
+              db_graph->union_edges == NULL && db_graph->umap == NULL,
+              "Cannot move kmers in this graph");
+
+  if(db_graph->col_edges != NULL) {
+    for(col = 0; col < db_graph->num_edge_cols; col++)
+      db_node_edges(db_graph, to, col) = db_node_edges(db_graph, from, col);
+    db_node_zero_edges(db_graph, from);
+  }
+
+  if(db_graph->col_covgs != NULL) {
+    for(col = 0; col < db_graph->num_of_cols; col++)
+      db_node_set_covg(db_graph, to, col, db_node_get_covg(db_graph, from, col));
+    db_node_zero_covgs(db_graph, from);
+  }
+
+  if(db_graph->node_in_cols != NULL) {
+    for(col = 0; col < db_graph->num_of_cols; col++) {
+      if(db_node_has_col(db_graph, from, col)) {
+        db_node_set_col(db_graph, to, col);
+        db_node_del_col_mt(db_graph, from, col);
+      }
+    }
+  }
+
+  if(db_graph->readstrt != NULL) {
+    size_t i;
+    for(i = 0; i < 2; i++) {
+      if(bitset_get(db_graph->readstrt, 2*from+i)) {
+        bitset_set(db_graph->readstrt, 2*to+i);
+        bitset_del(db_graph->readstrt, 2*from+i);
+      }
+    }
+  }
+
+  if(gpstore->paths_all != NULL) {
+    gpstore->paths_all[to] = gpstore->paths_all[from];
+    gpstore->paths_all[from] = NULL;
+  }
+  if(gpstore->paths_traverse != NULL && gpstore->paths_traverse != gpstore->paths_all) {
+    gpstore->paths_traverse[to] = gpstore->paths_traverse[from];
+    gpstore->paths_traverse[from] = NULL;
+  }
+
+  // Path summaries are indexed by kmer too
+  if(gpstore->traverse_orients != NULL) {
+    uint8_t orients = (uint8_t)gpath_store_summary_orients(gpstore, from);
+    gpstore->traverse_orients[to/4] &= (uint8_t)~(3 << (2*(to%4)));
+    gpstore->traverse_orients[to/4] |= (uint8_t)(orients << (2*(to%4)));
+    gpstore->traverse_orients[from/4] &= (uint8_t)~(3 << (2*(from%4)));
+  }
+
+  if(gpstore->traverse_cols != NULL) {
+    size_t ncols = gpstore->gpset.ncols;
+    for(col = 0; col < ncols; col++) {
+      if(bitset_get(gpstore->traverse_cols, from*ncols+col)) {
+        bitset_set(gpstore->traverse_cols, to*ncols+col);
+        bitset_del(gpstore->traverse_cols, from*ncols+col);
+      }
+      else bitset_del(gpstore->traverse_cols, to*ncols+col);
+    }
+  }
 }
 
+// Allocate large colour arrays on huge pages if requested
+#define _dbg_calloc(graph,nel,elsize) \
+  ((graph)->large_pages ? ctx_calloc_large(nel,elsize) : ctx_calloc(nel,elsize))
+
+#define _dbg_free(graph,ptr) do { \
+  if((graph)->large_pages) { ctx_free_large(ptr); } else { ctx_free(ptr); } \
+} while(0)
+
 const int DBG_ALLOC_EDGES       =  1;
 const int DBG_ALLOC_COVGS       =  2;
 const int DBG_ALLOC_BKTLOCKS    =  4;
 const int DBG_ALLOC_READSTRT    =  8;
 const int DBG_ALLOC_NODE_IN_COL = 16;
+const int DBG_ALLOC_HT_LOCKFREE = 32;
+const int DBG_ALLOC_HT_TAGS     = 64;
+const int DBG_ALLOC_HUGEPAGES   = 128;
+const int DBG_ALLOC_COLMAJOR    = 256;
+const int DBG_ALLOC_HT_CUCKOO   = 512;
+const int DBG_ALLOC_HT_COLOCATE = 1024;
 
 // alloc_flags specifies where fields to malloc. OR together DBG_ALLOC_* values
 void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
@@ -30,11 +128,24 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
                  .num_edge_cols = num_edge_cols,
                  .num_of_cols_used = 0,
                  .bktlocks = NULL,
+                 .ht_lockfree = !!(alloc_flags & DBG_ALLOC_HT_LOCKFREE),
+                 .large_pages = !!(alloc_flags & DBG_ALLOC_HUGEPAGES),
+                 .col_major = !!(alloc_flags & DBG_ALLOC_COLMAJOR),
                  .ginfo = NULL,
                  .col_edges = NULL,
                  .col_covgs = NULL,
+                 .num_covg_cols = num_of_cols,
+                 .covg_slot = NULL,
                  .node_in_cols = NULL,
-                 .readstrt = NULL};
+                 .readstrt = NULL,
+                 .bloom = NULL,
+                 .readstrt_hash = NULL,
+                 .covg_ovf = NULL,
+                 .sparse = NULL,
+                 .shared_edges = NULL,
+                 .grow = NULL,
+                 .disk = NULL,
+                 .shm = NULL};
 
   ctx_assert(num_of_cols > 0);
   ctx_assert(num_edge_cols == 0 || num_edge_cols == 1 || num_edge_cols == num_of_cols);
@@ -42,7 +153,11 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
   ctx_assert2(kmer_size >= MIN_KMER_SIZE, "kmer size: %zu", kmer_size);
   ctx_assert2(kmer_size <= MAX_KMER_SIZE, "kmer size: %zu", kmer_size);
 
-  hash_table_alloc(&tmp.ht, capacity);
+  hash_table_alloc_flags(&tmp.ht, capacity,
+                         (alloc_flags & DBG_ALLOC_HT_TAGS ? HT_ALLOC_TAGS : 0) |
+                         (alloc_flags & DBG_ALLOC_HUGEPAGES ? HT_ALLOC_HUGEPAGES : 0) |
+                         (alloc_flags & DBG_ALLOC_HT_CUCKOO ? HT_ALLOC_CUCKOO : 0) |
+                         (alloc_flags & DBG_ALLOC_HT_COLOCATE ? HT_ALLOC_COLOCATE : 0));
   memset(&tmp.gpstore, 0, sizeof(GPathStore));
 
   tmp.ginfo = ctx_calloc(num_of_cols, sizeof(GraphInfo));
@@ -50,12 +165,17 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
     graph_info_alloc(&tmp.ginfo[i]);
 
   if(alloc_flags & DBG_ALLOC_EDGES)
-    tmp.col_edges = ctx_calloc(tmp.ht.capacity * num_edge_cols, sizeof(Edges));
-
-  if(alloc_flags & DBG_ALLOC_COVGS)
-    tmp.col_covgs = ctx_calloc(tmp.ht.capacity * num_of_cols, sizeof(Covg));
+    tmp.col_edges = _dbg_calloc(&tmp, tmp.ht.capacity * num_edge_cols, sizeof(Edges));
+
+  if(alloc_flags & DBG_ALLOC_COVGS) {
+    tmp.col_covgs = _dbg_calloc(&tmp, tmp.ht.capacity * num_of_cols, sizeof(CovgStore));
+    #if COVG_BITS < 32
+      tmp.covg_ovf = ctx_calloc(1, sizeof(CovgOverflow));
+      covg_ovf_alloc(tmp.covg_ovf);
+    #endif
+  }
 
-  if(alloc_flags & DBG_ALLOC_BKTLOCKS)
+  if(alloc_flags & (DBG_ALLOC_BKTLOCKS | DBG_ALLOC_HT_LOCKFREE))
     tmp.bktlocks = ctx_calloc(roundup_bits2bytes(tmp.ht.num_of_buckets), 1);
 
   // 1 bit for forward, 1 bit for reverse per kmer
@@ -64,10 +184,11 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
 
   if(alloc_flags & DBG_ALLOC_NODE_IN_COL) {
     size_t bytes_per_col = roundup_bits2bytes(tmp.ht.capacity);
-    tmp.node_in_cols = ctx_calloc(bytes_per_col*num_of_cols, 1);
+    tmp.node_in_cols = _dbg_calloc(&tmp, bytes_per_col*num_of_cols, 1);
   }
 
   memcpy(db_graph, &tmp, sizeof(dBGraph));
+  if(db_graph->ht.cuckoo) hash_table_set_move(&db_graph->ht, db_graph_move_kmer, db_graph);
   db_graph_status(db_graph);
 }
 
@@ -76,6 +197,9 @@ void db_graph_dealloc(dBGraph *db_graph)
 {
   size_t i;
 
+  // Arrays in a shared segment are unmapped, not freed
+  if(db_graph->shm != NULL) graph_shm_detach(db_graph);
+
   hash_table_dealloc(&db_graph->ht);
 
   for(i = 0; i < db_graph->num_of_cols; i++)
@@ -83,17 +207,56 @@ void db_graph_dealloc(dBGraph *db_graph)
   ctx_free(db_graph->ginfo);
 
   ctx_free(db_graph->bktlocks);
-  ctx_free(db_graph->col_covgs); // num_of_cols * capacity
-  ctx_free(db_graph->col_edges); // num_col_edges * capacity
-  ctx_free(db_graph->node_in_cols);
+  _dbg_free(db_graph, db_graph->col_covgs); // num_covg_cols * capacity
+  ctx_free(db_graph->covg_slot);
+  _dbg_free(db_graph, db_graph->col_edges); // num_col_edges * capacity
+  if(db_graph->covg_ovf != NULL) {
+    covg_ovf_dealloc(db_graph->covg_ovf);
+    ctx_free(db_graph->covg_ovf);
+  }
+  _dbg_free(db_graph, db_graph->node_in_cols);
   ctx_free(db_graph->readstrt);
 
   gpath_hash_dealloc(&db_graph->gphash);
   gpath_store_dealloc(&db_graph->gpstore);
+  db_graph_grow_dealloc(db_graph);
+  db_graph_next_cache_dealloc(db_graph);
+  db_graph_union_edges_dealloc(db_graph);
 
   memset(db_graph, 0, sizeof(dBGraph));
 }
 
+// Give presence-only colours no coverage slot, see db_graph.h
+void db_graph_set_presence_only(dBGraph *db_graph, const bool *presence_only)
+{
+  size_t col, nslots = 0;
+
+  ctx_assert(db_graph->node_in_cols != NULL && db_graph->col_covgs != NULL);
+  ctx_assert(db_graph->ht.num_kmers == 0);
+  ctx_assert(db_graph->sparse == NULL && db_graph->shm == NULL);
+
+  uint32_t *slots = ctx_malloc(db_graph->num_of_cols * sizeof(uint32_t));
+  for(col = 0; col < db_graph->num_of_cols; col++)
+    slots[col] = presence_only[col] ? DBG_NO_COVG_SLOT : nslots++;
+
+  ctx_free(db_graph->covg_slot);
+  db_graph->covg_slot = slots;
+
+  if(nslots == db_graph->num_covg_cols) return;
+
+  // Pages of the old array were never touched, so reallocating is cheap
+  _dbg_free(db_graph, db_graph->col_covgs);
+  db_graph->col_covgs = _dbg_calloc(db_graph, db_graph->ht.capacity * MAX2(nslots, 1),
+                                    sizeof(CovgStore));
+  db_graph->num_covg_cols = nslots;
+
+  char nstr[50];
+  ulong_to_str(db_graph->ht.capacity * (db_graph->num_of_cols - nslots) *
+               sizeof(CovgStore), nstr);
+  status("[graph] %zu presence-only colours, %s bytes of coverage not stored",
+         db_graph->num_of_cols - nslots, nstr);
+}
+
 //
 // Add to the de bruijn graph
 //
@@ -119,18 +282,113 @@ dBNode db_graph_find_or_add_node(dBGraph *db_graph, BinaryKmer bkmer,
 dBNode db_graph_find_node_mt(dBGraph *db_graph, BinaryKmer bkmer)
 {
   BinaryKmer bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
-  hkey_t hkey = hash_table_find_mt(&db_graph->ht, bkey, db_graph->bktlocks);
+  hkey_t hkey = db_graph->ht_lockfree
+                ? hash_table_find_lockfree(&db_graph->ht, bkey)
+                : hash_table_find_mt(&db_graph->ht, bkey, db_graph->bktlocks);
   return (dBNode){.key = hkey, .orient = bkmer_get_orientation(bkey, bkmer)};
 }
 
+static void db_graph_grow_full(dBGraph *db_graph, size_t gen);
+
+// Returns HASH_NOT_FOUND if the hash table is full
+static inline hkey_t db_graph_try_find_or_add_key_mt(dBGraph *db_graph,
+                                                     BinaryKmer bkey,
+                                                     bool *foundptr)
+{
+  return db_graph->ht_lockfree
+         ? hash_table_try_find_or_insert_lockfree(&db_graph->ht, bkey, foundptr,
+                                                  db_graph->bktlocks)
+         : hash_table_try_find_or_insert_mt(&db_graph->ht, bkey, foundptr,
+                                            db_graph->bktlocks);
+}
+
+dBNode db_graph_find_or_add_key_mt(dBGraph *db_graph, BinaryKmer bkey,
+                                   Orientation orient, bool *foundptr)
+{
+  hkey_t hkey;
+
+  if(db_graph->grow != NULL) {
+    while((hkey = db_graph_try_find_or_add_key_mt(db_graph, bkey, foundptr))
+            == HASH_NOT_FOUND) {
+      db_graph_grow_full(db_graph, db_graph->grow->generation);
+    }
+  }
+  else if(db_graph->ht_lockfree) {
+    hkey = hash_table_find_or_insert_lockfree(&db_graph->ht, bkey, foundptr,
+                                              db_graph->bktlocks);
+  }
+  else {
+    hkey = hash_table_find_or_insert_mt(&db_graph->ht, bkey, foundptr,
+                                        db_graph->bktlocks);
+  }
+
+  return (dBNode){.key = hkey, .orient = orient};
+}
+
 dBNode db_graph_find_or_add_node_mt(dBGraph *db_graph, BinaryKmer bkmer,
                                     bool *foundptr)
 {
   BinaryKmer bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
-  hkey_t hkey = hash_table_find_or_insert_mt(&db_graph->ht, bkey, foundptr,
+  return db_graph_find_or_add_key_mt(db_graph, bkey,
+                                     bkmer_get_orientation(bkey, bkmer),
+                                     foundptr);
+}
+
+// Batch insert into a graph that can grow. If the table fills up part way
+// through, grow it, find the kmers we've already done again and carry on.
+static void db_graph_find_or_add_keys_grow_mt(dBGraph *db_graph,
+                                              const BinaryKmer *bkeys, size_t n,
+                                              hkey_t *hkeys, bool *found)
+{
+  HashTable *ht = &db_graph->ht;
+  size_t i, done = 0;
+
+  while(1) {
+    done += db_graph->ht_lockfree
+            ? hash_table_try_find_or_insert_batch_lockfree(ht, bkeys+done, n-done,
+                                                           HT_PREFETCH_DEPTH,
+                                                           hkeys+done, found+done,
+                                                           db_graph->bktlocks)
+            : hash_table_try_find_or_insert_batch_mt(ht, bkeys+done, n-done,
+                                                     HT_PREFETCH_DEPTH,
+                                                     hkeys+done, found+done,
+                                                     db_graph->bktlocks);
+    if(done == n) break;
+
+    db_graph_grow_full(db_graph, db_graph->grow->generation);
+
+    for(i = 0; i < done; i++) {
+      hkeys[i] = db_graph->ht_lockfree
+                 ? hash_table_find_lockfree(ht, bkeys[i])
+                 : hash_table_find_mt(ht, bkeys[i], db_graph->bktlocks);
+      ctx_assert(hkeys[i] != HASH_NOT_FOUND);
+    }
+  }
+}
+
+void db_graph_find_or_add_keys_mt(dBGraph *db_graph,
+                                  const BinaryKmer *bkeys, size_t n,
+                                  hkey_t *hkeys, bool *found)
+{
+  if(db_graph->grow != NULL)
+    db_graph_find_or_add_keys_grow_mt(db_graph, bkeys, n, hkeys, found);
+  else if(db_graph->ht_lockfree)
+    hash_table_find_or_insert_batch_lockfree(&db_graph->ht, bkeys, n,
+                                             HT_PREFETCH_DEPTH, hkeys, found,
                                              db_graph->bktlocks);
+  else
+    hash_table_find_or_insert_batch_mt(&db_graph->ht, bkeys, n,
+                                       HT_PREFETCH_DEPTH, hkeys, found,
+                                       db_graph->bktlocks);
+}
 
-  return (dBNode){.key = hkey, .orient = bkmer_get_orientation(bkey, bkmer)};
+dBNode db_graph_find_key(const dBGraph *db_graph, BinaryKmer bkey,
+                         Orientation orient)
+{
+  hkey_t hkey = hash_table_find(&db_graph->ht, bkey);
+  if(db_graph->disk != NULL)
+    hkey = db_graph_disk_find((dBGraph*)db_graph, bkey, hkey);
+  return (dBNode){.key = hkey, .orient = orient};
 }
 
 dBNode db_graph_find_str(const dBGraph *db_graph, const char *str)
@@ -144,6 +402,8 @@ dBNode db_graph_find_node(const dBGraph *db_graph, BinaryKmer bkmer)
 {
   BinaryKmer bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
   hkey_t hkey = hash_table_find(&db_graph->ht, bkey);
+  if(db_graph->disk != NULL)
+    hkey = db_graph_disk_find((dBGraph*)db_graph, bkey, hkey);
   return (dBNode){.key = hkey, .orient = bkmer_get_orientation(bkey, bkmer)};
 }
 
@@ -228,38 +488,134 @@ dBNode db_graph_next_node(const dBGraph *db_graph,
   return next_node;
 }
 
+// Nucleotides set in each 4 bit set of oriented edges, lowest first
+static const struct { uint8_t count, nucs[4]; } edge_nucs[16] = {
+  {0, {0}},          {1, {0}},       {1, {1}},       {2, {0,1}},
+  {1, {2}},          {2, {0,2}},     {2, {1,2}},     {3, {0,1,2}},
+  {1, {3}},          {2, {0,3}},     {2, {1,3}},     {3, {0,1,3}},
+  {2, {2,3}},        {3, {0,2,3}},   {3, {1,2,3}},   {4, {0,1,2,3}}
+};
+
 uint8_t db_graph_next_nodes(const dBGraph *db_graph, const BinaryKmer node_bkey,
                             Orientation orient, Edges edges,
                             dBNode nodes[4], Nucleotide fw_nucs[4])
 {
   const size_t kmer_size = db_graph->kmer_size;
-  Edges tmp_edge;
-  Nucleotide nuc;
-  BinaryKmer bkmer;
-  uint8_t count = 0;
-
-  edges = edges_with_orientation(edges, orient);
-  bkmer = (orient == FORWARD ? binary_kmer_left_shift_one_base(node_bkey, kmer_size)
-                             : binary_kmer_right_shift_one_base(node_bkey));
-
-  for(tmp_edge = 0x1, nuc = 0; nuc < 4; tmp_edge <<= 1, nuc++) {
-    if(edges & tmp_edge) {
-      if(orient == FORWARD) binary_kmer_set_last_nuc(&bkmer, nuc);
-      else binary_kmer_set_first_nuc(&bkmer, dna_nuc_complement(nuc), kmer_size);
-      nodes[count] = db_graph_find(db_graph, bkmer);
-      nodes[count].orient ^= orient;
-      fw_nucs[count] = nuc;
-      ctx_assert(nodes[count].key != HASH_NOT_FOUND);
-      count++;
-    }
+  const uint8_t e = edges_with_orientation(edges, orient);
+  const uint8_t count = edge_nucs[e].count;
+  BinaryKmer fw, rv, bkeys[4];
+  hkey_t hkeys[4];
+  bool rev[4];
+  uint8_t i;
+
+  if(count == 0) return 0;
+
+  // Both strands of the node in the direction we walk. Each next kmer is one
+  // roll of both, so we get its key without a reverse complement per edge.
+  BinaryKmer node_rc = binary_kmer_reverse_complement(node_bkey, kmer_size);
+  const BinaryKmer node_fw = orient == FORWARD ? node_bkey : node_rc;
+  const BinaryKmer node_rv = orient == FORWARD ? node_rc : node_bkey;
+
+  for(i = 0; i < count; i++) {
+    fw = node_fw;
+    rv = node_rv;
+    fw_nucs[i] = edge_nucs[e].nucs[i];
+    binary_kmer_roll(&fw, &rv, kmer_size, fw_nucs[i]);
+    rev[i] = binary_kmer_lt(rv, fw);
+    bkeys[i] = rev[i] ? rv : fw;
+  }
+
+  hash_table_find_batch(&db_graph->ht, bkeys, count, count, hkeys);
+
+  for(i = 0; i < count; i++) {
+    if(db_graph->disk != NULL)
+      hkeys[i] = db_graph_disk_find((dBGraph*)db_graph, bkeys[i], hkeys[i]);
+    nodes[i] = (dBNode){.key = hkeys[i], .orient = rev[i] ? REVERSE : FORWARD};
+    ctx_assert(nodes[i].key != HASH_NOT_FOUND);
   }
 
   return count;
 }
 
+void db_graph_prefetch_node(const dBGraph *db_graph, dBNode node)
+{
+  const GPathStore *gpstore = &db_graph->gpstore;
+  hkey_t hkey = node.key;
+
+  if(db_graph->col_edges != NULL)
+    __builtin_prefetch(&db_node_edges(db_graph, hkey, 0), 0, 1);
+  if(db_graph->union_edges != NULL)
+    __builtin_prefetch(&db_graph->union_edges[hkey], 0, 1);
+  if(db_graph->node_in_cols != NULL) {
+    size_t w = ksetw(db_graph->node_in_cols, db_graph->num_of_cols, hkey, 0);
+    __builtin_prefetch(&db_graph->node_in_cols[w], 0, 1);
+  }
+  if(gpstore->paths_traverse != NULL)
+    __builtin_prefetch(&gpstore->paths_traverse[hkey], 0, 1);
+  if(db_graph->next_cache != NULL)
+    __builtin_prefetch(&db_graph->next_cache[2*hkey + node.orient], 0, 1);
+}
+
+void db_graph_prefetch_next_kmers(const dBGraph *db_graph, BinaryKmer obkmer)
+{
+  if(db_graph->next_cache != NULL) return;
+  const size_t kmer_size = db_graph->kmer_size;
+  BinaryKmer bkmer;
+  Nucleotide nuc;
+
+  for(nuc = 0; nuc < 4; nuc++) {
+    bkmer = binary_kmer_left_shift_add(obkmer, kmer_size, nuc);
+    hash_table_prefetch(&db_graph->ht, binary_kmer_get_key(bkmer, kmer_size));
+  }
+}
+
+void db_graph_prefetch_links(const dBGraph *db_graph, hkey_t hkey, int stage)
+{
+  GPath *const *heads = db_graph->gpstore.paths_traverse;
+  const GPath *gpath;
+  if(heads == NULL || hkey >= db_graph->ht.capacity) return;
+
+  switch(stage) {
+    case 0: __builtin_prefetch(&heads[hkey], 0, 1); break;
+    case 1: if((gpath = heads[hkey]) != NULL) __builtin_prefetch(gpath, 0, 1); break;
+    default: if((gpath = heads[hkey]) != NULL) __builtin_prefetch(gpath_seq(gpath), 0, 1);
+  }
+}
+
+void db_graph_prefetch_node_links(const dBGraph *db_graph,
+                                  const dBNode *nodes, size_t n)
+{
+  size_t i;
+  int stage;
+  if(db_graph->gpstore.paths_traverse == NULL) return;
+  n = MIN2(n, DB_GRAPH_LINK_PREFETCH_MAX);
+  for(stage = 0; stage < 3; stage++)
+    for(i = 0; i < n; i++)
+      db_graph_prefetch_links(db_graph, nodes[i].key, stage);
+}
+
+uint8_t db_graph_next_nodes_of(const dBGraph *db_graph, dBNode node,
+                               BinaryKmer node_bkey, Edges edges,
+                               dBNode nodes[4], Nucleotide fw_nucs[4])
+{
+  Nucleotide nuc;
+  if(db_graph->next_cache != NULL &&
+     edges_has_precisely_one_edge(edges, node.orient, &nuc) &&
+     db_graph_next_cached(db_graph, node, nuc, &nodes[0]))
+  {
+    fw_nucs[0] = nuc;
+    return 1;
+  }
+  return db_graph_next_nodes(db_graph, node_bkey, node.orient, edges,
+                             nodes, fw_nucs);
+}
+
 uint8_t db_graph_next_nodes_union(const dBGraph *db_graph, dBNode node,
                                   dBNode nodes[4], Nucleotide fw_nucs[4])
 {
+  // Cache is built from the union of edges, so holds any single next node
+  if(db_graph_next_cache_get(db_graph, node, &nodes[0], &fw_nucs[0]))
+    return 1;
   BinaryKmer bkey = db_node_get_bkey(db_graph, node.key);
   Edges edges = db_node_get_edges_union(db_graph, node.key);
   return db_graph_next_nodes(db_graph, bkey, node.orient, edges, nodes, fw_nucs);
@@ -297,8 +653,7 @@ uint8_t db_graph_next_nodes_in_col(const dBGraph *db_graph,
 
   bkey = db_node_get_bkey(db_graph, node.key);
 
-  count = db_graph_next_nodes(db_graph, bkey, node.orient, edges,
-                              nodes, fw_nucs);
+  count = db_graph_next_nodes_of(db_graph, node, bkey, edges, nodes, fw_nucs);
 
   // Filter next nodes if needed
   // If we allow kmers to exist and not be in any colour when
@@ -440,14 +795,91 @@ static inline void check_node(hkey_t node, const dBGraph *db_graph,
   *missing_edges_ptr |= missing_edges;
 }
 
-void db_graph_healthcheck(const dBGraph *db_graph)
+// Kmers are in a colour iff they have coverage or edges in it
+static inline void check_node_cols(hkey_t node, const dBGraph *db_graph)
 {
-  status("Running graph edge check...");
-  ctx_assert(db_graph->col_edges != NULL);
+  size_t col;
+  bool in_col, has_covg, has_edges;
+  char seq[MAX_KMER_SIZE+1];
+
+  if(db_graph->node_in_cols == NULL) return;
+
+  for(col = 0; col < db_graph->num_of_cols; col++) {
+    in_col = db_node_has_col(db_graph, node, col);
+    has_covg = (db_graph->col_covgs != NULL &&
+                db_node_get_covg(db_graph, node, col) > 0);
+    has_edges = (db_graph->num_edge_cols == db_graph->num_of_cols &&
+                 db_node_get_edges(db_graph, node, col) != 0);
+
+    if(!in_col && (has_covg || has_edges)) {
+      binary_kmer_to_str(db_node_get_bkey(db_graph, node),
+                         db_graph->kmer_size, seq);
+      die("Kmer has %s in colour %zu but is not in the colour: %s",
+          has_covg ? "coverage" : "edges", col, seq);
+    }
+  }
+}
+
+typedef struct
+{
+  const dBGraph *db_graph;
+  uint64_t seed, threshold;
+  size_t *num_checked; // [nthreads*8], spaced to avoid false sharing
+  volatile bool missing_edges;
+} GraphHealthCheck;
+
+static bool _healthcheck_node(hkey_t hkey, size_t threadid, void *arg)
+{
+  GraphHealthCheck *hc = (GraphHealthCheck*)arg;
   bool missing_edges = false;
-  HASH_ITERATE(&db_graph->ht, check_node, db_graph, &missing_edges);
-  if(missing_edges) status("  edges would be added with infer edges");
-  if(missing_edges) status("  all edges present");
+
+  if(db_graph_sample_kmer(hkey, hc->seed, hc->threshold)) {
+    check_node(hkey, hc->db_graph, &missing_edges);
+    check_node_cols(hkey, hc->db_graph);
+    if(missing_edges) hc->missing_edges = true;
+    hc->num_checked[threadid*8]++;
+  }
+
+  return false; // keep iterating
+}
+
+// As db_graph_healthcheck() using `nthreads`. Only checks a `fraction` of
+// kmers picked with `seed` (see db_graph_sample_kmer()), 1 to check all.
+// Returns the number of kmers checked.
+size_t db_graph_healthcheck_mt(const dBGraph *db_graph, size_t nthreads,
+                               double fraction, uint64_t seed)
+{
+  ctx_assert(db_graph->col_edges != NULL);
+  ctx_assert(fraction > 0);
+
+  if(fraction < 1) status("Running graph edge check on %.2f%% of kmers...",
+                          fraction * 100.0);
+  else status("Running graph edge check...");
+
+  size_t i, num_checked = 0;
+  GraphHealthCheck hc = {.db_graph = db_graph, .seed = seed,
+                         .threshold = db_graph_sample_threshold(fraction),
+                         .num_checked = ctx_calloc(nthreads*8, sizeof(size_t)),
+                         .missing_edges = false};
+
+  hash_table_iterate(&db_graph->ht, nthreads, _healthcheck_node, &hc);
+
+  for(i = 0; i < nthreads; i++) num_checked += hc.num_checked[i*8];
+  ctx_free(hc.num_checked);
+
+  char num_str[50];
+  ulong_to_str(num_checked, num_str);
+  status("  checked %s kmers", num_str);
+
+  if(hc.missing_edges) status("  edges would be added with infer edges");
+  else status("  all edges present");
+
+  return num_checked;
+}
+
+void db_graph_healthcheck(const dBGraph *db_graph)
+{
+  db_graph_healthcheck_mt(db_graph, 1, 1, 0);
 }
 
 //
@@ -458,6 +890,7 @@ void db_graph_reset(dBGraph *db_graph)
 {
   size_t col, capacity = db_graph->ht.capacity;
   size_t ncols = db_graph->num_of_cols, nedgecols = db_graph->num_edge_cols;
+  size_t ncovgcols = db_graph->num_covg_cols;
 
   for(col = 0; col < ncols; col++)
     graph_info_init(&db_graph->ginfo[col]);
@@ -468,69 +901,399 @@ void db_graph_reset(dBGraph *db_graph)
   if(db_graph->col_edges != NULL)
     memset(db_graph->col_edges, 0, nedgecols * sizeof(Edges) * capacity);
   if(db_graph->col_covgs != NULL)
-    memset(db_graph->col_covgs, 0, ncols * sizeof(Covg) * capacity);
+    memset(db_graph->col_covgs, 0, ncovgcols * sizeof(CovgStore) * capacity);
+  if(db_graph->covg_ovf != NULL)
+    covg_ovf_reset(db_graph->covg_ovf);
   if(db_graph->node_in_cols != NULL)
     memset(db_graph->node_in_cols, 0, roundup_bits2bytes(capacity) * ncols);
   if(db_graph->readstrt != NULL)
     memset(db_graph->readstrt, 0, 2 * roundup_bits2bytes(capacity) * ncols);
+  if(db_graph->bloom != NULL)
+    kmer_bloom_reset(db_graph->bloom);
+  if(db_graph->readstrt_hash != NULL)
+    read_start_hash_reset(db_graph->readstrt_hash);
+  if(db_graph->sparse != NULL)
+    sparse_cols_reset(db_graph->sparse);
 
   gpath_store_reset(&db_graph->gpstore);
 }
 
 //
-// Stats: Get kmer coverage in each colour
+// Growing the hash table
 //
 
-typedef struct {
-  const dBGraph *db_graph;
-  const size_t nthreads;
-  uint64_t *nkmers, *sumcov;
-} GetKmerCovg;
+typedef struct
+{
+  const dBGraph *src;
+  dBGraph *dst; // new table and arrays
+  GPath **paths_all, **paths_traverse; // new GPathStore lists, or NULL
+  const hkey_t *newkeys; // new hkey of each kmer, NULL to insert into dst->ht
+  size_t nthreads;
+} GraphResize;
 
-bool get_kmer_covg(hkey_t hkey, const dBGraph *db_graph,
-                   uint64_t *nkmers, uint64_t *sumcov)
+// Copy kmer `hkey` and all of its data into the new graph
+static inline void resize_copy_kmer(hkey_t hkey, GraphResize *job)
 {
-  size_t col, covg;
-  for(col = 0; col < db_graph->num_of_cols; col++) {
-    covg = db_node_get_covg(db_graph, hkey, col);
-    if(covg) {
-      nkmers[col]++;
-      sumcov[col] += covg;
-    }
+  const dBGraph *src = job->src;
+  dBGraph *dst = job->dst;
+  const GPathStore *gpstore = &src->gpstore;
+  size_t col;
+  bool found;
+  hkey_t nkey;
+
+  if(job->newkeys != NULL) nkey = job->newkeys[hkey];
+  else {
+    BinaryKmer bkey = hash_table_fetch(&src->ht, hkey);
+    nkey = hash_table_find_or_insert_mt(&dst->ht, bkey, &found, dst->bktlocks);
+    ctx_assert(!found);
+  }
+
+  if(src->col_edges != NULL) {
+    for(col = 0; col < src->num_edge_cols; col++)
+      db_node_edges(dst, nkey, col) = db_node_edges(src, hkey, col);
+  }
+
+  if(src->col_covgs != NULL) {
+    for(col = 0; col < src->num_of_cols; col++)
+      db_node_set_covg(dst, nkey, col, db_node_get_covg(src, hkey, col));
+  }
+
+  if(src->node_in_cols != NULL) {
+    for(col = 0; col < src->num_of_cols; col++)
+      if(db_node_has_col(src, hkey, col))
+        db_node_set_col_mt(dst, nkey, col);
+  }
+
+  if(src->readstrt != NULL) {
+    if(bitset_get(src->readstrt, 2*hkey))   bitset_set_mt(dst->readstrt, 2*nkey);
+    if(bitset_get(src->readstrt, 2*hkey+1)) bitset_set_mt(dst->readstrt, 2*nkey+1);
   }
+
+  if(job->paths_all != NULL)
+    job->paths_all[nkey] = gpstore->paths_all[hkey];
+  if(job->paths_traverse != NULL)
+    job->paths_traverse[nkey] = gpstore->paths_traverse[hkey];
+}
+
+static bool resize_copy_kmer_thread(hkey_t hkey, size_t threadid, void *arg)
+{
+  (void)threadid;
+  resize_copy_kmer(hkey, (GraphResize*)arg);
   return false; // keep iterating
 }
 
-void get_kmer_covg_thread(void *arg, size_t threadid)
+// Allocate hkey indexed arrays of job->dst for `capacity` kmers, for those
+// arrays job->src has
+static void resize_alloc_arrays(GraphResize *job, size_t capacity)
+{
+  const dBGraph *src = job->src;
+  const GPathStore *gpstore = &src->gpstore;
+  dBGraph *dst = job->dst;
+  size_t ncols = src->num_of_cols;
+
+  if(src->col_edges != NULL)
+    dst->col_edges = _dbg_calloc(dst, capacity * dst->num_edge_cols, sizeof(Edges));
+  if(src->col_covgs != NULL)
+    dst->col_covgs = _dbg_calloc(dst, capacity * src->num_covg_cols,
+                                 sizeof(CovgStore));
+  if(src->covg_ovf != NULL) {
+    dst->covg_ovf = ctx_calloc(1, sizeof(CovgOverflow));
+    covg_ovf_alloc(dst->covg_ovf);
+  }
+  if(src->node_in_cols != NULL)
+    dst->node_in_cols = _dbg_calloc(dst, roundup_bits2bytes(capacity)*ncols, 1);
+  if(src->readstrt != NULL)
+    dst->readstrt = ctx_calloc(roundup_bits2bytes(capacity)*2, 1);
+
+  if(gpstore->paths_all != NULL)
+    job->paths_all = ctx_calloc(capacity, sizeof(GPath*));
+  if(gpstore->paths_traverse != NULL && gpstore->paths_traverse != gpstore->paths_all)
+    job->paths_traverse = ctx_calloc(capacity, sizeof(GPath*));
+}
+
+// Free the hkey indexed arrays of job->src (not the hash table or bucket
+// locks) and give job->dst the new GPathStore lists
+static void resize_swap_arrays(GraphResize *job, size_t capacity)
+{
+  dBGraph *src = (dBGraph*)job->src, *dst = job->dst;
+  GPathStore *gpstore = &src->gpstore;
+
+  _dbg_free(src, src->col_edges);
+  _dbg_free(src, src->col_covgs);
+  _dbg_free(src, src->node_in_cols);
+  ctx_free(src->readstrt);
+  if(src->covg_ovf != NULL) {
+    covg_ovf_dealloc(src->covg_ovf);
+    ctx_free(src->covg_ovf);
+  }
+
+  if(gpstore->paths_traverse != gpstore->paths_all)
+    ctx_free(gpstore->paths_traverse);
+  ctx_free(gpstore->paths_all);
+
+  if(gpstore->paths_all != NULL) {
+    bool shared = (gpstore->paths_traverse == gpstore->paths_all);
+    dst->gpstore.paths_all = job->paths_all;
+    dst->gpstore.paths_traverse = shared ? job->paths_all : job->paths_traverse;
+    dst->gpstore.graph_capacity = capacity;
+  }
+
+  // Summaries were of the old hkeys
+  ctx_free(gpstore->traverse_orients);
+  ctx_free(gpstore->traverse_cols);
+  dst->gpstore.traverse_orients = dst->gpstore.traverse_cols = NULL;
+}
+
+// Move all kmers into a new hash table with at least `capacity` entries,
+// reallocating and remapping all hkey indexed arrays (col_edges, col_covgs,
+// node_in_cols, bktlocks, readstrt and the GPathStore lists).
+// Uses `nthreads` to rehash. Not threadsafe.
+void db_graph_resize(dBGraph *db_graph, uint64_t capacity, size_t nthreads)
+{
+  int ht_flags = (db_graph->ht.tags != NULL ? HT_ALLOC_TAGS : 0) |
+                 (db_graph->ht.large_pages ? HT_ALLOC_HUGEPAGES : 0) |
+                 (db_graph->ht.cuckoo ? HT_ALLOC_CUCKOO : 0) |
+                 (db_graph->ht.colocated ? HT_ALLOC_COLOCATE : 0);
+
+  ctx_assert(nthreads > 0);
+  ctx_assert2(!db_graph_has_path_hash(db_graph),
+              "Cannot resize a graph with a path hash");
+
+  // hkeys change, successor cache would have to be rebuilt
+  db_graph_next_cache_dealloc(db_graph);
+  bool union_edges = (db_graph->union_edges != NULL);
+  db_graph_union_edges_dealloc(db_graph);
+
+  // Copy fields then replace the hash table and hkey indexed arrays
+  dBGraph tmp;
+  memcpy(&tmp, db_graph, sizeof(dBGraph));
+  hash_table_alloc_flags(&tmp.ht, capacity, ht_flags);
+  capacity = tmp.ht.capacity;
+  ctx_assert(capacity >= db_graph->ht.num_kmers);
+
+  // Always need bucket locks to insert with multiple threads
+  tmp.bktlocks = ctx_calloc(roundup_bits2bytes(tmp.ht.num_of_buckets), 1);
+
+  GraphResize job = {.src = db_graph, .dst = &tmp, .nthreads = nthreads,
+                     .paths_all = NULL, .paths_traverse = NULL, .newkeys = NULL};
+
+  resize_alloc_arrays(&job, capacity);
+  hash_table_iterate(&db_graph->ht, nthreads, resize_copy_kmer_thread, &job);
+  ctx_assert(tmp.ht.num_kmers == db_graph->ht.num_kmers);
+
+  // Release the old table and arrays
+  bool had_locks = (db_graph->bktlocks != NULL);
+  hash_table_dealloc(&db_graph->ht);
+  ctx_free(db_graph->bktlocks);
+  resize_swap_arrays(&job, capacity);
+
+  // Graph that didn't have bucket locks doesn't need them now
+  if(!had_locks) { ctx_free(tmp.bktlocks); tmp.bktlocks = NULL; }
+
+  memcpy(db_graph, &tmp, sizeof(dBGraph));
+  if(db_graph->ht.cuckoo) hash_table_set_move(&db_graph->ht, db_graph_move_kmer, db_graph);
+  if(union_edges) db_graph_union_edges_alloc(db_graph, nthreads);
+  db_graph_status(db_graph);
+}
+
+// Move kmer `h` to hkey `newkeys[h]` and its data with it, so that kmers
+// often visited together can be stored together. The hash table is read only
+// afterwards (see hash_table_relayout()). Needs memory for two copies of the
+// hkey indexed arrays while copying. The successor cache and path orientation
+// and colour summaries are rebuilt if present.
+void db_graph_relayout(dBGraph *db_graph, const hkey_t *newkeys, size_t nthreads)
+{
+  GPathStore *gpstore = &db_graph->gpstore;
+  size_t capacity = db_graph->ht.capacity;
+  bool next_cache = (db_graph->next_cache != NULL);
+  bool union_edges = (db_graph->union_edges != NULL);
+  bool summary = (gpstore->traverse_orients != NULL);
+  bool col_summary = (gpstore->traverse_cols != NULL);
+
+  ctx_assert(nthreads > 0);
+  ctx_assert2(!db_graph_has_path_hash(db_graph),
+              "Cannot relayout a graph with a path hash");
+  ctx_assert2(db_graph->sparse == NULL && db_graph->shared_edges == NULL &&
+              db_graph->disk == NULL && db_graph->shm == NULL &&
+              db_graph->grow == NULL, "Cannot relayout this graph");
+
+  db_graph_next_cache_dealloc(db_graph);
+  db_graph_union_edges_dealloc(db_graph);
+
+  // Copy fields then replace the hkey indexed arrays
+  dBGraph tmp;
+  memcpy(&tmp, db_graph, sizeof(dBGraph));
+
+  GraphResize job = {.src = db_graph, .dst = &tmp, .nthreads = nthreads,
+                     .paths_all = NULL, .paths_traverse = NULL,
+                     .newkeys = newkeys};
+
+  resize_alloc_arrays(&job, capacity);
+  hash_table_iterate(&db_graph->ht, nthreads, resize_copy_kmer_thread, &job);
+  resize_swap_arrays(&job, capacity);
+  hash_table_relayout(&tmp.ht, newkeys);
+
+  memcpy(db_graph, &tmp, sizeof(dBGraph));
+
+  if(summary) gpath_store_build_summary(gpstore, nthreads);
+  if(col_summary) gpath_store_build_col_summary(gpstore, nthreads);
+  if(union_edges) db_graph_union_edges_alloc(db_graph, nthreads);
+  if(next_cache) db_graph_next_cache_alloc(db_graph, nthreads);
+}
+
+bool db_graph_compact(dBGraph *db_graph, double min_occupancy, size_t nthreads)
 {
-  GetKmerCovg *d = (GetKmerCovg*)arg;
+  const HashTable *ht = &db_graph->ht;
+  uint64_t nbkts, capacity;
+  uint8_t bktsize;
+
+  if(db_graph->shm != NULL || db_graph_has_path_hash(db_graph)) return false;
+  if(ht->num_kmers >= ht->capacity * min_occupancy) return false;
 
-  size_t col, ncols = d->db_graph->num_of_cols;
-  uint64_t *nkmers = ctx_calloc(ncols, sizeof(uint64_t));
-  uint64_t *sumcov = ctx_calloc(ncols, sizeof(uint64_t));
+  capacity = hash_table_cap(ht->num_kmers / IDEAL_OCCUPANCY + 1, &nbkts, &bktsize);
+  if(capacity >= ht->capacity) return false;
+
+  char nkmers_str[50], oldcap_str[50], newcap_str[50];
+  ulong_to_str(ht->num_kmers, nkmers_str);
+  ulong_to_str(ht->capacity, oldcap_str);
+  ulong_to_str(capacity, newcap_str);
+  status("[graph] Compacting hash table: %s kmers, capacity %s -> %s",
+         nkmers_str, oldcap_str, newcap_str);
+
+  db_graph_resize(db_graph, capacity, nthreads);
+  return true;
+}
 
-  HASH_ITERATE_PART(&d->db_graph->ht, threadid, d->nthreads,
-                    get_kmer_covg, d->db_graph, nkmers, sumcov);
+void db_graph_grow_alloc(dBGraph *db_graph, size_t nthreads)
+{
+  ctx_assert(db_graph->grow == NULL);
+  ctx_assert(nthreads > 0);
+  dBGraphGrow *grow = ctx_calloc(1, sizeof(dBGraphGrow));
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  #ifdef __GLIBC__
+    // Don't let threads adding kmers starve a thread waiting to resize
+    pthread_rwlockattr_setkind_np(&attr,
+                                  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  #endif
+  if(pthread_rwlock_init(&grow->lock, &attr) != 0) die("pthread_rwlock init failed");
+  pthread_rwlockattr_destroy(&attr);
+  grow->generation = 0;
+  grow->nthreads = nthreads;
+  db_graph->grow = grow;
+}
+
+void db_graph_grow_dealloc(dBGraph *db_graph)
+{
+  if(db_graph->grow == NULL) return;
+  pthread_rwlock_destroy(&db_graph->grow->lock);
+  ctx_free(db_graph->grow);
+  db_graph->grow = NULL;
+}
+
+// Called while holding grow->lock for reading, when the hash table was full at
+// generation `gen`. Returns holding the lock for reading, with a larger table.
+static void db_graph_grow_full(dBGraph *db_graph, size_t gen)
+{
+  dBGraphGrow *grow = db_graph->grow;
+  pthread_rwlock_unlock(&grow->lock);
+  pthread_rwlock_wrlock(&grow->lock);
+
+  // Another thread may have already grown the table
+  if(grow->generation == gen) {
+    char cap_str[50];
+    ulong_to_str(db_graph->ht.capacity * 2, cap_str);
+    status("[graph] Hash table full, growing to %s kmers", cap_str);
+    db_graph_resize(db_graph, db_graph->ht.capacity * 2, grow->nthreads);
+    grow->generation++;
+  }
+
+  pthread_rwlock_unlock(&grow->lock);
+  pthread_rwlock_rdlock(&grow->lock);
+}
+
+//
+// Successor cache
+//
+
+static bool next_cache_set_kmer(hkey_t hkey, size_t threadid, void *arg)
+{
+  (void)threadid;
+  dBGraph *db_graph = (dBGraph*)arg;
+  Edges edges = db_node_get_edges_union(db_graph, hkey);
+  BinaryKmer bkey = db_node_get_bkey(db_graph, hkey);
+  dBNode next;
+  Nucleotide nuc;
+  Orientation orient;
 
-  // Add results to array shared with other threads
-  for(col = 0; col < ncols; col++) {
-    __sync_fetch_and_add((volatile uint64_t*)&d->nkmers[col], nkmers[col]);
-    __sync_fetch_and_add((volatile uint64_t*)&d->sumcov[col], sumcov[col]);
+  for(orient = 0; orient < 2; orient++) {
+    if(edges_has_precisely_one_edge(edges, orient, &nuc)) {
+      next = db_graph_next_node(db_graph, bkey, nuc, orient);
+      ctx_assert(next.key != HASH_NOT_FOUND);
+      db_graph->next_cache[2*hkey+orient] = (next.key << 3) |
+                                            ((uint64_t)next.orient << 2) | nuc;
+    }
   }
 
-  ctx_free(nkmers);
-  ctx_free(sumcov);
+  return false; // keep iterating
+}
+
+void db_graph_next_cache_alloc(dBGraph *db_graph, size_t nthreads)
+{
+  ctx_assert(db_graph->next_cache == NULL);
+  size_t nbytes = 2 * db_graph->ht.capacity * sizeof(uint64_t);
+  db_graph->next_cache = ctx_malloc(nbytes);
+  memset(db_graph->next_cache, 0xff, nbytes); // all DBG_NEXT_NONE
+  hash_table_iterate(&db_graph->ht, nthreads, next_cache_set_kmer, db_graph);
+}
+
+void db_graph_next_cache_dealloc(dBGraph *db_graph)
+{
+  if(db_graph->next_cache == NULL) return;
+  ctx_free(db_graph->next_cache);
+  db_graph->next_cache = NULL;
+}
+
+//
+// Union edges cache
+//
+
+static bool union_edges_set_kmer(hkey_t hkey, size_t threadid, void *arg)
+{
+  (void)threadid;
+  dBGraph *db_graph = (dBGraph*)arg;
+  db_graph->union_edges[hkey] = db_node_read_edges_union(db_graph, hkey);
+  return false; // keep iterating
+}
+
+void db_graph_union_edges_alloc(dBGraph *db_graph, size_t nthreads)
+{
+  ctx_assert(db_graph->union_edges == NULL);
+  ctx_assert2(db_graph->disk == NULL, "Cannot cache edges of a disk graph");
+
+  if(db_graph->num_edge_cols == 1 && db_graph->col_edges != NULL) return;
+
+  db_graph->union_edges = ctx_calloc(db_graph->ht.capacity, sizeof(Edges));
+  hash_table_iterate(&db_graph->ht, nthreads, union_edges_set_kmer, db_graph);
 }
 
+void db_graph_union_edges_dealloc(dBGraph *db_graph)
+{
+  if(db_graph->union_edges == NULL) return;
+  ctx_free(db_graph->union_edges);
+  db_graph->union_edges = NULL;
+}
+
+//
+// Stats: Get kmer coverage in each colour
+//
+
 void db_graph_get_kmer_covg(const dBGraph *db_graph, size_t nthreads,
                             uint64_t *nkmers, uint64_t *sumcov)
 {
-  GetKmerCovg getcov = {.db_graph = db_graph,
-                        .nthreads = nthreads,
-                        .nkmers = nkmers,
-                        .sumcov = sumcov};
-
-  util_multi_thread(&getcov, nthreads, get_kmer_covg_thread);
+  // Counting only reads the graph
+  GraphPass pass = {.nkmers = nkmers, .sumcov = sumcov};
+  graph_pass_run(&pass, (dBGraph*)db_graph, nthreads);
 }
 
 //
@@ -538,138 +1301,228 @@ void db_graph_get_kmer_covg(const dBGraph *db_graph, size_t nthreads,
 //
 
 // BEWARE: if num_edge_cols == 1, edges in all colours will be effectively wiped
-void db_graph_wipe_colour(dBGraph *db_graph, Colour col)
+void db_graph_wipe_colour(dBGraph *db_graph, Colour col, size_t nthreads)
 {
   status("Wiping graph colour %zu", (size_t)col);
 
-  Edges (*col_edges)[db_graph->num_edge_cols];
-  Covg (*col_covgs)[db_graph->num_of_cols];
-  const size_t capacity = db_graph->ht.capacity;
-  size_t i;
+  uint8_t wipe_cols[roundup_bits2bytes(db_graph->num_of_cols)];
+  memset(wipe_cols, 0, sizeof(wipe_cols));
+  bitset_set(wipe_cols, col);
 
-  graph_info_init(&db_graph->ginfo[col]);
+  GraphPass pass = {.wipe_cols = wipe_cols};
+  graph_pass_run(&pass, db_graph, nthreads);
+}
 
-  if(db_graph->node_in_cols != NULL)
-  {
-    size_t nbytes = roundup_bits2bytes(capacity);
-    for(i = 0; i < nbytes; i++)
-      db_graph->node_in_cols[db_graph->num_of_cols*i+col] = 0;
-  }
+void db_graph_add_all_edges(dBGraph *db_graph, size_t nthreads)
+{
+  GraphPass pass = {.add_all_edges = true};
+  graph_pass_run(&pass, db_graph, nthreads);
+}
 
-  col_edges = (Edges (*)[db_graph->num_edge_cols])db_graph->col_edges;
-  col_covgs = (Covg (*)[db_graph->num_of_cols])db_graph->col_covgs;
+// remove kmers from the graph if they have no coverage
+void db_graph_remove_no_covg_kmers(dBGraph *db_graph, size_t nthreads)
+{
+  GraphPass pass = {.remove_no_covg = true};
+  graph_pass_run(&pass, db_graph, nthreads);
+}
 
-  if(db_graph->col_covgs != NULL) {
-    if(db_graph->num_of_cols == 1) {
-      memset(db_graph->col_covgs, 0, capacity * sizeof(Covg));
-    } else {
-      for(i = 0; i < capacity; i++)
-        col_covgs[i][col] = 0;
-    }
-  }
+typedef struct {
+  dBGraph *db_graph;
+  Colour col, edge_col;
+  Covg min_covg;
+  bool keep_missing; // keep edges to kmers not in the hash table
+} LowCovgJob;
 
-  if(db_graph->col_edges != NULL) {
-    if(db_graph->num_edge_cols == 1) {
-      memset(db_graph->col_edges, 0, capacity * sizeof(Edges));
-    } else {
-      for(i = 0; i < capacity; i++)
-        col_edges[i][col] = 0;
-    }
+static bool wipe_col_if_low_covg(hkey_t hkey, size_t threadid, void *arg)
+{
+  (void)threadid;
+  const LowCovgJob *job = (const LowCovgJob*)arg;
+  dBGraph *db_graph = job->db_graph;
+  Covg covg = db_node_get_covg(db_graph, hkey, job->col);
+  if(covg > 0 && covg < job->min_covg) {
+    db_node_covg(db_graph, hkey, job->col) = 0;
+    db_node_edges(db_graph, hkey, job->edge_col) = 0;
+    db_graph_union_edges_update(db_graph, hkey);
   }
+  return false; // keep iterating
 }
 
-static inline void add_all_edges(hkey_t node, dBGraph *db_graph)
+static bool prune_col_edges_to_no_covg(hkey_t hkey, size_t threadid, void *arg)
 {
-  const size_t kmer_size = db_graph->kmer_size, edgencols = db_graph->num_edge_cols;
-  size_t col;
-  BinaryKmer bkmer, bkey, node_bkey = db_node_get_bkey(db_graph, node);
+  (void)threadid;
+  const LowCovgJob *job = (const LowCovgJob*)arg;
+  dBGraph *db_graph = job->db_graph;
+  Edges edges = db_node_get_edges(db_graph, hkey, job->edge_col);
+  BinaryKmer bkey = db_node_get_bkey(db_graph, hkey);
   Orientation orient;
   Nucleotide nuc;
-  hkey_t next;
-  Edges edge, *edges = &db_node_edges(db_graph,node,0), iedges = edges[0];
-  bool node_has_col[edgencols];
-
-  for(col = 0; col < edgencols; col++) {
-    iedges &= edges[col];
-    node_has_col[col] = db_node_has_col(db_graph, node, col);
+  dBNode next;
+
+  if(!edges) return false;
+
+  for(orient = 0; orient < 2; orient++) {
+    for(nuc = 0; nuc < 4; nuc++) {
+      if(edges_has_edge(edges, nuc, orient)) {
+        next = db_graph_find(db_graph,
+                             bkmer_shift_add_last_nuc(bkey, orient,
+                                                      db_graph->kmer_size, nuc));
+        if(next.key == HASH_NOT_FOUND ? !job->keep_missing
+                                      : db_node_get_covg(db_graph, next.key,
+                                                         job->col) == 0)
+          edges = edges_del_edge(edges, nuc, orient);
+      }
+    }
   }
 
-  for(orient = 0; orient < 2; orient++)
-  {
-    bkmer = (orient == FORWARD ? binary_kmer_left_shift_one_base(node_bkey, kmer_size)
-                               : binary_kmer_right_shift_one_base(node_bkey));
-
-    for(nuc = 0; nuc < 4; nuc++)
-    {
-      edge = nuc_orient_to_edge(nuc, orient);
+  db_node_edges(db_graph, hkey, job->edge_col) = edges;
+  db_graph_union_edges_update(db_graph, hkey);
+  return false; // keep iterating
+}
 
-      // Check edge is not is all colours
-      if(!(edge & iedges))
-      {
-        if(orient == FORWARD) binary_kmer_set_last_nuc(&bkmer, nuc);
-        else binary_kmer_set_first_nuc(&bkmer, dna_nuc_complement(nuc), kmer_size);
+static void _remove_low_covg_in_col(dBGraph *db_graph, Colour col,
+                                    Covg min_covg, bool keep_missing,
+                                    size_t nthreads)
+{
+  ctx_assert(db_graph->col_covgs != NULL && db_graph->col_edges != NULL);
+  ctx_assert(db_graph->num_edge_cols == db_graph->num_of_cols ||
+             db_graph->num_of_cols == 1);
 
-        bkey = binary_kmer_get_key(bkmer, kmer_size);
-        next = hash_table_find(&db_graph->ht, bkey);
+  LowCovgJob job = {.db_graph = db_graph, .col = col,
+                    .edge_col = db_graph->num_edge_cols == 1 ? 0 : col,
+                    .min_covg = min_covg, .keep_missing = keep_missing};
 
-        if(next != HASH_NOT_FOUND)
-          for(col = 0; col < edgencols; col++)
-            if(node_has_col[col] && db_node_has_col(db_graph, next, col))
-              edges[col] |= edge;
-      }
-    }
-  }
+  // Wipe all low coverage kmers before we look at edges
+  hash_table_iterate(&db_graph->ht, nthreads, wipe_col_if_low_covg, &job);
+  hash_table_iterate(&db_graph->ht, nthreads, prune_col_edges_to_no_covg, &job);
 }
 
-void db_graph_add_all_edges(dBGraph *db_graph)
+// remove kmers from colour `col` if their coverage is less than `min_covg`,
+// along with edges to them. Kmers are left in the hash table, call
+// db_graph_remove_no_covg_kmers() afterwards to remove them.
+// Requires edges per colour (or a single colour graph)
+void db_graph_remove_low_covg_in_col(dBGraph *db_graph, Colour col,
+                                     Covg min_covg, size_t nthreads)
 {
-  ctx_assert(db_graph->num_of_cols == db_graph->num_edge_cols);
-  HASH_ITERATE(&db_graph->ht, add_all_edges, db_graph);
+  _remove_low_covg_in_col(db_graph, col, min_covg, false, nthreads);
 }
 
-static bool wipe_kmer_if_no_covg(hkey_t hkey, size_t threadid, void *arg)
+// As db_graph_remove_low_covg_in_col(), but for one shard of a graph: edges to
+// kmers that are not in the hash table are kept, since they may be in another
+// shard. Those edges must be checked once all shards have been built.
+void db_graph_remove_low_covg_in_shard(dBGraph *db_graph, Colour col,
+                                       Covg min_covg, size_t nthreads)
 {
-  (void)threadid;
-  dBGraph *db_graph = (dBGraph*)arg;
-  size_t col; Covg covg = 0;
-  for(col = 0; col < db_graph->num_of_cols; col++)
-    covg |= db_node_get_covg(db_graph, hkey, col);
-  if(!covg) hash_table_delete(&db_graph->ht, hkey);
-  return false; // keep iterating
+  _remove_low_covg_in_col(db_graph, col, min_covg, true, nthreads);
 }
 
-// remove kmers from the graph if they have no coverage
-void db_graph_remove_no_covg_kmers(dBGraph *db_graph, size_t nthreads)
+void db_graph_intersect_edges(dBGraph *db_graph, size_t nthreads, Edges *edges)
 {
-  hash_table_iterate(&db_graph->ht, nthreads, wipe_kmer_if_no_covg, db_graph);
+  GraphPass pass = {.isec_edges = edges};
+  graph_pass_run(&pass, db_graph, nthreads);
 }
 
 typedef struct {
-  Edges *isec_edges;
-  dBGraph *db_graph;
+  const dBGraph *db_graph;
+  SharedEdges *se;
   size_t nthreads;
-} IntersectEdgesJob;
+  size_t *nexcs; // [nthreads] exceptions in each part of the hash table
+  SharedEdgesExc *excs;
+} ShareEdgesJob;
+
+// Count colours for which the edges are not the union, and store the union
+static inline bool share_edges_count(hkey_t hkey, const ShareEdgesJob *job,
+                                     size_t *nexcs)
+{
+  const dBGraph *db_graph = job->db_graph;
+  Edges edges, uedges = 0, expect;
+  size_t col, n = 0;
+
+  for(col = 0; col < db_graph->num_edge_cols; col++)
+    uedges |= db_node_edges(db_graph, hkey, col);
+
+  for(col = 0; col < db_graph->num_edge_cols; col++) {
+    edges = db_node_edges(db_graph, hkey, col);
+    expect = db_node_shared_edges_in_col(db_graph, hkey, col) ? uedges : 0;
+    n += (edges != expect);
+  }
 
-static void intersect_edges(void *arg, size_t threadid)
+  shared_edges_set_mt(job->se, hkey, uedges, n > 0);
+  *nexcs += n;
+  return false; // keep iterating
+}
+
+static inline bool share_edges_fill(hkey_t hkey, const ShareEdgesJob *job,
+                                    SharedEdgesExc **nxt)
 {
-  IntersectEdgesJob job = *(IntersectEdgesJob*)arg;
-  Edges *edges = job.db_graph->col_edges;
-  size_t step, start, end, i, j, col, ncols;
-  step = job.db_graph->ht.capacity / job.nthreads;
-  start = step * threadid;
-  end = threadid+1 == job.nthreads ? job.db_graph->ht.capacity : start + step;
-  ncols = job.db_graph->num_of_cols;
-  for(i = start, j = i*ncols; i < end; i++)
-    for(col = 0; col < ncols; col++, j++)
-      edges[j] &= job.isec_edges[i];
+  const dBGraph *db_graph = job->db_graph;
+  Edges edges, uedges = shared_edges_union(job->se, hkey), expect;
+  size_t col;
+
+  if(!shared_edges_has_exc(job->se, hkey)) return false;
+
+  for(col = 0; col < db_graph->num_edge_cols; col++) {
+    edges = db_node_edges(db_graph, hkey, col);
+    expect = db_node_shared_edges_in_col(db_graph, hkey, col) ? uedges : 0;
+    if(edges != expect) {
+      **nxt = (SharedEdgesExc){.hkey = hkey,
+                               .coledges = (uint32_t)col << 8 | edges};
+      (*nxt)++;
+    }
+  }
+  return false; // keep iterating
 }
 
-void db_graph_intersect_edges(dBGraph *db_graph, size_t nthreads, Edges *edges)
+static void share_edges_count_thread(void *arg, size_t threadid)
 {
-  IntersectEdgesJob job = {.isec_edges = edges,
-                           .db_graph = db_graph,
-                           .nthreads = nthreads};
-  util_multi_thread(&job, nthreads, intersect_edges);
+  ShareEdgesJob *job = (ShareEdgesJob*)arg;
+  size_t nexcs = 0;
+  HASH_ITERATE_PART(&job->db_graph->ht, threadid, job->nthreads,
+                    share_edges_count, job, &nexcs);
+  job->nexcs[threadid] = nexcs;
+}
+
+// Parts of the hash table are in hkey order, so exceptions end up sorted
+static void share_edges_fill_thread(void *arg, size_t threadid)
+{
+  ShareEdgesJob *job = (ShareEdgesJob*)arg;
+  SharedEdgesExc *nxt = job->excs;
+  size_t t;
+  for(t = 0; t < threadid; t++) nxt += job->nexcs[t];
+  HASH_ITERATE_PART(&job->db_graph->ht, threadid, job->nthreads,
+                    share_edges_fill, job, &nxt);
+}
+
+// Replace col_edges with union edges plus exceptions in `se`
+void db_graph_share_edges(dBGraph *db_graph, SharedEdges *se, size_t nthreads)
+{
+  ctx_assert(db_graph->col_edges != NULL);
+  ctx_assert(db_graph->sparse == NULL && db_graph->shared_edges == NULL);
+  ctx_assert(db_graph->node_in_cols != NULL || db_graph->col_covgs != NULL);
+  ctx_assert(db_graph->num_edge_cols <= SHARED_EDGES_MAXCOLS);
+
+  size_t t, nexcs[nthreads], total = 0;
+
+  shared_edges_alloc(se, db_graph->ht.capacity);
+
+  ShareEdgesJob job = {.db_graph = db_graph, .se = se,
+                       .nthreads = nthreads, .nexcs = nexcs, .excs = NULL};
+
+  util_multi_thread(&job, nthreads, share_edges_count_thread);
+  for(t = 0; t < nthreads; t++) total += nexcs[t];
+
+  job.excs = shared_edges_alloc_excs(se, total);
+  util_multi_thread(&job, nthreads, share_edges_fill_thread);
+
+  _dbg_free(db_graph, db_graph->col_edges);
+  db_graph->col_edges = NULL;
+  db_graph->shared_edges = se;
+
+  char dense_str[50], shared_str[50];
+  bytes_to_str(db_graph->num_edge_cols * db_graph->ht.capacity * sizeof(Edges),
+               1, dense_str);
+  bytes_to_str(shared_edges_mem(se->capacity, se->num_excs), 1, shared_str);
+  status("[shared_edges] Edges of %zu colours use %s instead of %s",
+         db_graph->num_edge_cols, shared_str, dense_str);
 }
 
 // Get a random node from the graph
@@ -717,11 +1570,60 @@ void db_graph_print_kmer2(BinaryKmer bkmer, Covg *covgs, Edges *edges,
   fputc('\n', fout);
 }
 
+// Append a kmer to `sbuf`, fields separated by `sep`. With sep=' ' the line is
+// the same as db_graph_print_kmer2() prints.
+void db_graph_sbuf_kmer2(BinaryKmer bkmer, const Covg *covgs,
+                         const Edges *edges, size_t num_of_cols,
+                         size_t kmer_size, char sep, StrBuf *sbuf)
+{
+  size_t i, j;
+  char *str;
+
+  // kmer + sep,covg + sep,edges + newline + null byte
+  strbuf_ensure_capacity(sbuf, sbuf->end + kmer_size +
+                               num_of_cols * (1+UINT64_DECLEN + 1+8) + 2);
+
+  str = sbuf->b + sbuf->end;
+  binary_kmer_to_str(bkmer, kmer_size, str);
+  str += kmer_size;
+
+  for(i = 0; i < num_of_cols; i++) {
+    *(str++) = sep;
+    str += uint64_to_dec(covgs[i], str);
+  }
+
+  // Same as db_node_get_edges_str(): incoming edges lowercase, outgoing upper
+  for(i = 0; i < num_of_cols; i++) {
+    *(str++) = sep;
+    for(j = 0; j < 4; j++) str[j]   = (edges[i] & (0x80 >> j)) ? "acgt"[j] : '.';
+    for(j = 0; j < 4; j++) str[j+4] = (edges[i] & (0x1  << j)) ? "ACGT"[j] : '.';
+    str += 8;
+  }
+
+  *(str++) = '\n';
+  *str = '\0';
+  sbuf->end = str - sbuf->b;
+}
+
+// Append a tab separated header line of column names to `sbuf`:
+// kmer, covg0..covgN, edges0..edgesN
+void db_graph_sbuf_kmer2_hdr(size_t num_of_cols, StrBuf *sbuf)
+{
+  size_t i;
+  strbuf_append_str(sbuf, "kmer");
+  for(i = 0; i < num_of_cols; i++) strbuf_sprintf(sbuf, "\tcovg%zu", i);
+  for(i = 0; i < num_of_cols; i++) strbuf_sprintf(sbuf, "\tedges%zu", i);
+  strbuf_append_char(sbuf, '\n');
+}
+
 void db_graph_print_kmer(hkey_t node, dBGraph *db_graph, FILE *fout)
 {
   BinaryKmer bkmer = db_node_get_bkey(db_graph, node);
-  Covg *covgs = &db_node_covg(db_graph, node, 0);
-  Edges *edges = &db_node_edges(db_graph, node, 0);
+  Covg covgs[db_graph->num_of_cols];
+  Edges edges[db_graph->num_of_cols];
+  memset(edges, 0, sizeof(edges));
+  db_node_get_all_edges(db_graph, node, edges);
+  db_node_get_covgs(db_graph, node, covgs);
 
   db_graph_print_kmer2(bkmer, covgs, edges,
                        db_graph->num_of_cols, db_graph->kmer_size,
@@ -2,6 +2,7 @@
 #define DB_GRAPH_H_
 
 #include <inttypes.h>
+#include <pthread.h>
 
 #include "string_buffer/string_buffer.h"
 
@@ -10,12 +11,37 @@
 #include "graph_info.h"
 #include "gpath_store.h"
 #include "gpath_hash.h"
+#include "kmer_bloom.h"
+#include "read_start_hash.h"
+#include "covg_overflow.h"
+#include "sparse_colours.h"
+#include "shared_edges.h"
 
 extern const int DBG_ALLOC_EDGES;
 extern const int DBG_ALLOC_COVGS;
 extern const int DBG_ALLOC_BKTLOCKS;
 extern const int DBG_ALLOC_READSTRT;
 extern const int DBG_ALLOC_NODE_IN_COL;
+extern const int DBG_ALLOC_HT_LOCKFREE;
+extern const int DBG_ALLOC_HT_TAGS;
+extern const int DBG_ALLOC_HUGEPAGES;
+extern const int DBG_ALLOC_COLMAJOR;
+extern const int DBG_ALLOC_HT_CUCKOO;
+extern const int DBG_ALLOC_HT_COLOCATE;
+
+// Used to let the hash table grow while threads are adding kmers.
+// Threads adding kmers hold `lock` for reading, a thread that finds the table
+// full releases it and takes it for writing to resize.
+typedef struct
+{
+  pthread_rwlock_t lock;
+  volatile size_t generation; // number of times the table has grown
+  size_t nthreads; // number of threads to use when rehashing
+} dBGraphGrow;
+
+typedef struct dBGraphDisk dBGraphDisk;
+typedef struct dBGraphShm dBGraphShm;
+typedef struct UnitigMap UnitigMap;
 
 //
 // Graph
@@ -36,12 +62,36 @@ typedef struct
   // Optional fields:
 
   // Colour specific arrays
+  // Access with db_node_edges() / db_node_covg(), which handle both layouts
   Edges *col_edges; // num_of_cols*ht.capacity size addr: [hkey*num_of_cols + col]
-  Covg *col_covgs; // num_edge_cols*ht.capacity size addr: [hkey*num_edge_cols + col]
+  CovgStore *col_covgs; // num_of_cols*ht.capacity size addr: [hkey*num_of_cols + col]
+
+  // Colours with a slot in col_covgs (num_of_cols unless some are presence-only)
+  // and the slot of each colour, DBG_NO_COVG_SLOT for presence-only colours.
+  // covg_slot is NULL if every colour has its own slot.
+  // (set with db_graph_set_presence_only())
+  size_t num_covg_cols;
+  uint32_t *covg_slot;
+
+  // col_edges and col_covgs store each colour contiguously:
+  // [col*ht.capacity + hkey] (set with DBG_ALLOC_COLMAJOR)
+  bool col_major;
+
+  // Coverages too high for CovgStore, allocated with col_covgs if COVG_BITS < 32
+  // (NULL otherwise)
+  CovgOverflow *covg_ovf;
 
   // This should be cast to volatile to read / write
   uint8_t *bktlocks;
 
+  // Insert kmers with compare-and-swap rather than taking bucket locks
+  // (set with DBG_ALLOC_HT_LOCKFREE)
+  bool ht_lockfree;
+
+  // Hash table, col_edges, col_covgs and node_in_cols were allocated with
+  // ctx_calloc_large() (set with DBG_ALLOC_HUGEPAGES)
+  bool large_pages;
+
   // 1 bit per kmer, per colour
   // [hkey/64][col] >> hkey%64
   // [num_of_colours*hkey/64+col] >> hkey%64
@@ -53,12 +103,70 @@ typedef struct
 
   // Loading reads, 2 bits per kmers
   uint8_t *readstrt;
+
+  // Loading reads with a minimum kmer count, kmers seen once (not set with
+  // db_graph_alloc(), NULL if not used)
+  KmerBloom *bloom;
+
+  // Loading reads, fingerprints of read starts. If set, used for PCR duplicate
+  // removal instead of readstrt (not set with db_graph_alloc(), NULL if unused)
+  ReadStartHash *readstrt_hash;
+
+  // Colours stored sparsely, in place of col_covgs, col_edges and
+  // node_in_cols. Read only once loaded. (not set with db_graph_alloc(),
+  // NULL if not used)
+  SparseCols *sparse;
+
+  // Per colour edges stored as a union plus exceptions, in place of
+  // col_edges. Read only. (set with db_graph_share_edges(), NULL if not used)
+  SharedEdges *shared_edges;
+
+  // Grow the hash table when it fills up, instead of exiting
+  // (set with db_graph_grow_alloc(), NULL if not used)
+  dBGraphGrow *grow;
+
+  // Load kmers on demand from a sorted graph file when they are looked up
+  // (set with db_graph_disk_alloc(), NULL if not used)
+  dBGraphDisk *disk;
+
+  // Hash table and colour arrays mapped from a shared memory segment
+  // (set with graph_shm_attach(), NULL if not used)
+  dBGraphShm *shm;
+
+  // Successor cache: next node of each kmer orientation with a single edge,
+  // [hkey*2+orient] (set with db_graph_next_cache_alloc(), NULL if not used)
+  uint64_t *next_cache;
+
+  // Union of edges in all colours, [hkey] (set with db_graph_union_edges_alloc(),
+  // NULL if not used)
+  Edges *union_edges;
+
+  // Place read kmers on unitigs by their minimizers when aligning reads,
+  // instead of looking up every kmer (not set with db_graph_alloc(), NULL if
+  // not used)
+  const UnitigMap *umap;
+
+  // GraphWalker and db_unitig_extend() prefetch what the next step will read
+  // (set by the caller, false after db_graph_alloc())
+  bool prefetch_walks;
 } dBGraph;
 
 #define db_graph_has_path_hash(graph) ((graph)->gphash.table != NULL)
 #define db_graph_node_assigned(graph,hkey) hash_table_assigned(&(graph)->ht, hkey)
 
 // alloc_flags specifies where fields to malloc. OR together DBG_ALLOC_* values
+// DBG_ALLOC_HT_LOCKFREE selects lock-free insertion in the *_mt functions
+// and implies DBG_ALLOC_BKTLOCKS (used as a fallback when k > 31)
+// DBG_ALLOC_HT_TAGS stores a fingerprint per kmer (HT_TAG_BITS extra bits)
+// DBG_ALLOC_HUGEPAGES puts the large arrays on huge pages interleaved across
+// NUMA nodes, see ctx_calloc_large()
+// DBG_ALLOC_COLMAJOR lays out col_edges and col_covgs one colour after another,
+// so passes over a single colour are sequential
+// DBG_ALLOC_HT_CUCKOO makes single threaded inserts move kmers (and their
+// edges, coverages, colours, read starts and links) to make room, so the hash
+// table can be filled further. See HT_ALLOC_CUCKOO in hash_table.h
+// DBG_ALLOC_HT_COLOCATE keeps each hash table bucket's size, lock and tags in
+// one cache line header (implies DBG_ALLOC_HT_TAGS). See HT_ALLOC_COLOCATE
 void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
                     size_t num_of_cols, size_t num_edge_cols,
                     uint64_t capacity, int alloc_flags);
@@ -66,8 +174,66 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
 // Free memory used by all fields as well
 void db_graph_dealloc(dBGraph *db_graph);
 
+#define DBG_NO_COVG_SLOT UINT32_MAX
+
+// Store only whether kmers are in colours with presence_only[col] set (e.g. a
+// reference), using node_in_cols, and give them no slot in col_covgs. Their
+// coverage reads as 1 if the kmer is in the colour and adding coverage to them
+// does nothing. Edges are unchanged: load them into the union edges
+// (num_edge_cols == 1) to avoid storing edges for them either.
+// Must be called on an empty graph allocated with DBG_ALLOC_NODE_IN_COL and
+// DBG_ALLOC_COVGS. Coverages must then only be read and written with
+// db_node_get_covg() / db_node_set_covg() etc., not from col_covgs directly.
+void db_graph_set_presence_only(dBGraph *db_graph, const bool *presence_only);
+
 void db_graph_reset(dBGraph *db_graph);
 
+//
+// Growing the hash table
+//
+
+// Move all kmers into a new hash table with at least `capacity` entries,
+// reallocating and remapping all hkey indexed arrays (col_edges, col_covgs,
+// node_in_cols, bktlocks, readstrt and the GPathStore lists).
+// Uses `nthreads` to rehash. Not threadsafe.
+void db_graph_resize(dBGraph *db_graph, uint64_t capacity, size_t nthreads);
+
+// Removing kmers (cleaning, popping bubbles) leaves empty slots that are still
+// scanned by lookups and iteration. If occupancy is below `min_occupancy`,
+// move the remaining kmers into a table sized for IDEAL_OCCUPANCY with
+// db_graph_resize(). Needs memory for both tables while copying.
+// Returns true if the table was compacted. Not threadsafe.
+#define DBG_COMPACT_OCCUPANCY 0.25
+bool db_graph_compact(dBGraph *db_graph, double min_occupancy, size_t nthreads);
+
+// Move kmer `h` to hkey `newkeys[h]` and its data with it, so that kmers
+// often visited together can be stored together. The hash table is read only
+// afterwards (see hash_table_relayout()). Needs memory for two copies of the
+// hkey indexed arrays while copying. The successor cache and path orientation
+// summary are rebuilt if present. Not threadsafe.
+void db_graph_relayout(dBGraph *db_graph, const hkey_t *newkeys, size_t nthreads);
+
+// After calling db_graph_grow_alloc(), threadsafe find_or_add functions
+// double the capacity of the graph when it fills up instead of exiting.
+// Threads adding to the graph must call db_graph_grow_enter() before using any
+// hkey and db_graph_grow_leave() afterwards. hkeys from before an insert are
+// invalid if db_graph_grow_generation() changed during the insert.
+void db_graph_grow_alloc(dBGraph *db_graph, size_t nthreads);
+void db_graph_grow_dealloc(dBGraph *db_graph);
+
+#define db_graph_grow_generation(graph) \
+        ((graph)->grow != NULL ? (graph)->grow->generation : 0)
+
+static inline void db_graph_grow_enter(dBGraph *db_graph)
+{
+  if(db_graph->grow != NULL) pthread_rwlock_rdlock(&db_graph->grow->lock);
+}
+
+static inline void db_graph_grow_leave(dBGraph *db_graph)
+{
+  if(db_graph->grow != NULL) pthread_rwlock_unlock(&db_graph->grow->lock);
+}
+
 //
 // Add to the de bruijn graph
 //
@@ -86,6 +252,20 @@ dBNode db_graph_find_or_add_node(dBGraph *db_graph, BinaryKmer bkmer,
 dBNode db_graph_find_or_add_node_mt(dBGraph *db_graph, BinaryKmer bkmer,
                                     bool *found);
 
+// Same as db_graph_find_or_add_node_mt() and db_graph_find_node() but take
+// the kmer key and orientation, for callers that already have both strands
+dBNode db_graph_find_or_add_key_mt(dBGraph *db_graph, BinaryKmer bkey,
+                                   Orientation orient, bool *found);
+dBNode db_graph_find_key(const dBGraph *db_graph, BinaryKmer bkey,
+                         Orientation orient);
+
+// Thread safe batched find or add of `n` kmer keys, prefetching hash table
+// buckets ahead of each insert. Sets hkeys[i] and found[i] for each key.
+// If the graph grows, hkeys[] are all valid for the new table on return.
+void db_graph_find_or_add_keys_mt(dBGraph *db_graph,
+                                  const BinaryKmer *bkeys, size_t n,
+                                  hkey_t *hkeys, bool *found);
+
 #define db_graph_find(graph,bkmer) db_graph_find_node(graph,bkmer)
 dBNode db_graph_find_node(const dBGraph *db_graph, BinaryKmer bkmer);
 dBNode db_graph_find_node_mt(dBGraph *db_graph, BinaryKmer bkmer);
@@ -118,10 +298,117 @@ dBNode db_graph_next_node(const dBGraph *db_graph, const BinaryKmer node_bkey,
 // edges are forward+reverse, db_graph_next_nodes orients them
 // fw_nucs is the nuc you would add when walking forward
 // returns how many nodes were added to @nodes
+// Next kmer keys are built from a table of the nucleotides of each set of
+// edges and looked up together with hash_table_find_batch()
 uint8_t db_graph_next_nodes(const dBGraph *db_graph, const BinaryKmer node_bkey,
                             Orientation orient, Edges edges,
                             dBNode nodes[4], Nucleotide fw_nucs[4]);
 
+//
+// Successor cache
+//
+// Walking a unitig looks up every kmer in the hash table: the next kmer is
+// built from the current one and hashed, which is a random memory access per
+// base. The successor cache holds, for each kmer orientation with exactly one
+// edge in the union of colours, the hkey and orientation of the next kmer.
+// Traversals follow it instead of hashing (db_graph_next_cached(),
+// db_graph_next_nodes_union(), db_graph_next_nodes_in_col(), GraphWalker and
+// db_unitig_extend()). Uses 16 bytes per hash table entry.
+//
+// Build once the graph will not change (e.g. after cleaning and loading
+// links). Adding or removing kmers or edges invalidates it; db_graph_resize()
+// frees it.
+//
+
+// Entry encoding: hkey << 3 | orient << 2 | nuc, all bits set if not cached
+#define DBG_NEXT_NONE UINT64_MAX
+
+void db_graph_next_cache_alloc(dBGraph *db_graph, size_t nthreads);
+void db_graph_next_cache_dealloc(dBGraph *db_graph);
+
+// Set `next` to the node after `node` and `nuc` to the base added, if `node`
+// has a single edge in its orientation. Returns false if not cached.
+static inline bool db_graph_next_cache_get(const dBGraph *db_graph, dBNode node,
+                                           dBNode *next, Nucleotide *nuc)
+{
+  if(db_graph->next_cache == NULL) return false;
+  uint64_t e = db_graph->next_cache[2*node.key + node.orient];
+  if(e == DBG_NEXT_NONE) return false;
+  next->key = e >> 3;
+  next->orient = (e >> 2) & 1;
+  *nuc = e & 3;
+  return true;
+}
+
+// Set `next` to the node reached from `node` by adding `nuc`, if it is in the
+// successor cache. Returns false if not cached.
+static inline bool db_graph_next_cached(const dBGraph *db_graph, dBNode node,
+                                        Nucleotide nuc, dBNode *next)
+{
+  dBNode tmp;
+  Nucleotide cached_nuc;
+  if(!db_graph_next_cache_get(db_graph, node, &tmp, &cached_nuc) ||
+     cached_nuc != nuc) return false;
+  *next = tmp;
+  return true;
+}
+
+//
+// Union edges cache
+//
+// With many edge colours, db_node_get_edges_union() ORs together one Edges per
+// colour, spread across memory if colour-major or stored sparsely. The cache
+// holds the union for each kmer, so union graph traversals (pop bubbles,
+// db_graph_next_nodes_union(), db_graph_next_nodes_in_col() with colour -1)
+// read one byte. Uses 1 byte per hash table entry.
+//
+// Adding edges with db_node_set_col_edge[_mt]() and db_node_set_all_edges()
+// keeps it up to date. Removing edges any other way invalidates it; call
+// db_graph_union_edges_update() for each kmer changed. db_graph_resize() and
+// db_graph_relayout() rebuild it.
+//
+
+// Does nothing if only one edge colour is stored, since the union is then
+// the stored edges
+void db_graph_union_edges_alloc(dBGraph *db_graph, size_t nthreads);
+void db_graph_union_edges_dealloc(dBGraph *db_graph);
+
+//
+// Lookahead prefetching for walks (see dBGraph.prefetch_walks)
+//
+// Each step of a walk hashes the next kmer, then reads its edges, colours and
+// links: dependent random reads that a single walk cannot overlap. Prefetching
+// them as soon as the next node is known lets the reads run alongside the
+// bookkeeping of the current step.
+//
+
+// Prefetch the edges, colours, link list head and successor cache entry of
+// `node`
+void db_graph_prefetch_node(const dBGraph *db_graph, dBNode node);
+
+// Prefetch the hash table buckets of all four kmers that could follow the
+// oriented kmer `obkmer`. Does nothing if the successor cache is used.
+void db_graph_prefetch_next_kmers(const dBGraph *db_graph, BinaryKmer obkmer);
+
+// Reaching the links of a kmer is three dependent reads: the list head, the
+// first link and its sequence. Prefetch them in stages so that the reads of
+// several kmers overlap: stage 0 fetches the list head, stage 1 reads the head
+// (fetched by stage 0 earlier) and fetches the link, stage 2 fetches the
+// sequence. Does nothing if there are no links.
+void db_graph_prefetch_links(const dBGraph *db_graph, hkey_t hkey, int stage);
+
+// Prefetch the links of the first DB_GRAPH_LINK_PREFETCH_MAX of `n` nodes,
+// e.g. the kmers of a read that is about to be walked
+#define DB_GRAPH_LINK_PREFETCH_MAX 256
+void db_graph_prefetch_node_links(const dBGraph *db_graph,
+                                  const dBNode *nodes, size_t n);
+
+// As db_graph_next_nodes() for a node in the graph. Uses the successor cache
+// when `edges` has a single edge in the node's orientation.
+uint8_t db_graph_next_nodes_of(const dBGraph *db_graph, dBNode node,
+                               BinaryKmer node_bkey, Edges edges,
+                               dBNode nodes[4], Nucleotide fw_nucs[4]);
+
 /**
  * Get next nodes in union graph (pop / all samples)
  */
@@ -159,24 +446,68 @@ void db_graph_get_kmer_covg(const dBGraph *db_graph, size_t nthreads,
 // Healthcheck
 //
 
+// Threshold for db_graph_sample_kmer() to pick `fraction` of kmers
+#define db_graph_sample_threshold(fraction) \
+        ((fraction) >= 1 ? UINT64_MAX : (uint64_t)((fraction) * 18446744073709549568.0))
+
+// Pseudo-random choice of kmer, the same for a given seed
+static inline bool db_graph_sample_kmer(hkey_t hkey, uint64_t seed,
+                                        uint64_t threshold)
+{
+  // splitmix64 finaliser
+  uint64_t x = hkey + seed + UINT64_C(0x9e3779b97f4a7c15);
+  x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return (x ^ (x >> 31)) <= threshold;
+}
+
+// Dies if edges are not reciprocal, or a kmer has edges or coverage in a
+// colour it is not in. Single threaded, checks all kmers.
 void db_graph_healthcheck(const dBGraph *db_graph);
 
+// As db_graph_healthcheck() using `nthreads`. Only checks a `fraction` of
+// kmers picked with `seed` (see db_graph_sample_kmer()), 1 to check all.
+// Returns the number of kmers checked.
+size_t db_graph_healthcheck_mt(const dBGraph *db_graph, size_t nthreads,
+                               double fraction, uint64_t seed);
+
 //
 // Functions applying to whole graph
 //
 
+// These each make one parallel sweep of the hash table, use a GraphPass
+// (graph_pass.h) to combine several of them into one sweep
+
 // remove all coverage, edges associated with a given colour
-void db_graph_wipe_colour(dBGraph *db_graph, Colour col);
+void db_graph_wipe_colour(dBGraph *db_graph, Colour col, size_t nthreads);
 
 // Add edges between all kmers with k-1 bases overlapping
-void db_graph_add_all_edges(dBGraph *db_graph);
+void db_graph_add_all_edges(dBGraph *db_graph, size_t nthreads);
 
 // remove kmers from the graph if they have no coverage
 void db_graph_remove_no_covg_kmers(dBGraph *db_graph, size_t nthreads);
 
+// remove kmers from colour `col` if their coverage is less than `min_covg`,
+// along with edges to them. Kmers are left in the hash table, call
+// db_graph_remove_no_covg_kmers() afterwards to remove them.
+// Requires edges per colour (or a single colour graph)
+void db_graph_remove_low_covg_in_col(dBGraph *db_graph, Colour col,
+                                     Covg min_covg, size_t nthreads);
+
+// As above, but keep edges to kmers that are not in the hash table, since they
+// may be in another shard of the graph
+void db_graph_remove_low_covg_in_shard(dBGraph *db_graph, Colour col,
+                                       Covg min_covg, size_t nthreads);
+
 // Intersect all edges in the graph with the given edges
 void db_graph_intersect_edges(dBGraph *db_graph, size_t nthreads, Edges *edges);
 
+// Move per colour edges into `se`, storing the union of edges of each kmer and
+// the colours that differ from it. Frees col_edges, after which edges can only
+// be read (db_node_get_edges() etc.). Requires node_in_cols or col_covgs to
+// know which colours each kmer is in.
+void db_graph_share_edges(dBGraph *db_graph, SharedEdges *se, size_t nthreads);
+
 //
 // Misc
 //
@@ -195,6 +526,16 @@ void db_graph_check_kmer_size(size_t kmer_size, const char *path);
 void db_graph_print_kmer2(BinaryKmer bkmer, Covg *covgs, Edges *edges,
                           size_t num_of_cols, size_t kmer_size, FILE *fout);
 
+// Append a kmer to `sbuf`, fields separated by `sep`. With sep=' ' the line is
+// the same as db_graph_print_kmer2() prints.
+void db_graph_sbuf_kmer2(BinaryKmer bkmer, const Covg *covgs,
+                         const Edges *edges, size_t num_of_cols,
+                         size_t kmer_size, char sep, StrBuf *sbuf);
+
+// Append a tab separated header line of column names to `sbuf`:
+// kmer, covg0..covgN, edges0..edgesN
+void db_graph_sbuf_kmer2_hdr(size_t num_of_cols, StrBuf *sbuf);
+
 void db_graph_print_kmer(hkey_t node, dBGraph *db_graph, FILE *fout);
 
 #endif /* DB_GRAPH_H_ */
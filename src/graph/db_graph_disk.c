@@ -0,0 +1,127 @@
+#include "global.h"
+#include "db_graph_disk.h"
+#include "db_node.h"
+#include "util.h"
+#include "hash.h"
+
+void db_graph_disk_alloc(dBGraphDisk *disk, GraphFileSearch *gs,
+                         dBGraph *db_graph)
+{
+  ctx_assert2(db_graph->bktlocks != NULL, "Need DBG_ALLOC_BKTLOCKS");
+  ctx_assert(db_graph->disk == NULL);
+  size_t nbytes = roundup_bits2bytes(db_graph->ht.capacity);
+  dBGraphDisk tmp = {.gs = gs,
+                     .claimed = ctx_calloc(nbytes, 1),
+                     .ready = ctx_calloc(nbytes, 1),
+                     .misses = ctx_calloc(DB_GRAPH_DISK_MISS_CACHE,
+                                          sizeof(uint64_t)),
+                     .num_loaded = 0, .num_missing = 0,
+                     .num_miss_cache_hits = 0};
+  memcpy(disk, &tmp, sizeof(dBGraphDisk));
+  db_graph->disk = disk;
+}
+
+void db_graph_disk_dealloc(dBGraphDisk *disk, dBGraph *db_graph)
+{
+  if(db_graph->disk == disk) db_graph->disk = NULL;
+  ctx_free(disk->claimed);
+  ctx_free(disk->ready);
+  ctx_free(disk->misses);
+  memset(disk, 0, sizeof(dBGraphDisk));
+}
+
+// Never zero, so an empty cache entry does not match
+static inline uint64_t disk_miss_hash(BinaryKmer bkey)
+{
+  return ctx_hash64(bkey.b, sizeof(BinaryKmer), 0) | 1;
+}
+
+// Copy edges and colours of a kmer from disk into the graph
+static void disk_load_node(dBGraph *db_graph, hkey_t hkey,
+                           const Covg *covgs, const Edges *edges)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  Edges uedges = 0;
+  size_t col;
+
+  if(db_graph->col_edges != NULL) {
+    for(col = 0; col < ncols; col++) uedges |= edges[col];
+    for(col = 0; col < db_graph->num_edge_cols; col++)
+      db_node_edges(db_graph, hkey, col) = db_graph->num_edge_cols == 1
+                                           ? uedges : edges[col];
+  }
+
+  for(col = 0; col < ncols; col++) {
+    if(db_graph->col_covgs != NULL)
+      db_node_set_covg(db_graph, hkey, col, covgs[col]);
+    if(db_graph->node_in_cols != NULL && (covgs[col] > 0 || edges[col]))
+      db_node_set_col_mt(db_graph, hkey, col);
+  }
+}
+
+hkey_t db_graph_disk_find(dBGraph *db_graph, BinaryKmer bkey, hkey_t hkey)
+{
+  dBGraphDisk *disk = db_graph->disk;
+  const size_t ncols = db_graph->num_of_cols;
+  Covg covgs[ncols];
+  Edges edges[ncols];
+  uint64_t h = 0, *miss = NULL;
+  bool found, on_disk;
+
+  if(hkey == HASH_NOT_FOUND)
+  {
+    h = disk_miss_hash(bkey);
+    miss = &disk->misses[h & (DB_GRAPH_DISK_MISS_CACHE-1)];
+    if(*(volatile uint64_t*)miss == h) {
+      __sync_fetch_and_add(&disk->num_miss_cache_hits, 1);
+      return HASH_NOT_FOUND;
+    }
+  }
+
+  if(hkey != HASH_NOT_FOUND && bitset_get_mt(disk->ready, hkey))
+    return hkey;
+
+  // Search disk before taking a hash table entry, so kmers not in the graph
+  // do not use up space
+  on_disk = graph_search_find(disk->gs, bkey, covgs, edges);
+
+  if(!on_disk && hkey == HASH_NOT_FOUND) {
+    *(volatile uint64_t*)miss = h;
+    __sync_fetch_and_add(&disk->num_missing, 1);
+    return HASH_NOT_FOUND;
+  }
+
+  if(hkey == HASH_NOT_FOUND) {
+    hkey = hash_table_try_find_or_insert_mt(&db_graph->ht, bkey, &found,
+                                            db_graph->bktlocks);
+    if(hkey == HASH_NOT_FOUND)
+      die("Hash table is full, please increase memory (-m) or --nkmers");
+  }
+
+  if(bitset_claim_mt(disk->claimed, hkey)) {
+    // Kmer may already be in the table without edges, if it was added when
+    // loading links and is missing from the graph file
+    if(on_disk) {
+      disk_load_node(db_graph, hkey, covgs, edges);
+      __sync_fetch_and_add(&disk->num_loaded, 1);
+    }
+    __sync_synchronize();
+    bitset_set_mt(disk->ready, hkey);
+  }
+  else {
+    // Another thread is loading this kmer
+    while(!bitset_get_mt(disk->ready, hkey)) {}
+  }
+
+  return hkey;
+}
+
+void db_graph_disk_print_stats(const dBGraphDisk *disk)
+{
+  char nloaded[50], nmissing[50], ncached[50];
+  ulong_to_str(disk->num_loaded, nloaded);
+  ulong_to_str(disk->num_missing, nmissing);
+  ulong_to_str(disk->num_miss_cache_hits, ncached);
+  status("[disk] kmers loaded: %s; not on disk: %s (+%s cached)",
+         nloaded, nmissing, ncached);
+}
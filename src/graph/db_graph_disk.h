@@ -0,0 +1,51 @@
+#ifndef DB_GRAPH_DISK_H_
+#define DB_GRAPH_DISK_H_
+
+//
+// Fault kmers into the graph from a sorted graph file on disk
+//
+// With a dBGraphDisk attached (db_graph->disk), db_graph_find_node() and
+// db_graph_find_key() look for kmers missing from the hash table in the sorted
+// graph file (see graph_search.h) and add them with their edges and colours.
+// The hash table then holds only the kmers that have been used, so it can be
+// sized from memory rather than from the number of kmers in the graph.
+// Kmers that are not on disk are remembered in a small direct mapped cache to
+// avoid searching the file again for the same sequencing error.
+//
+// Kmers already in the hash table (e.g. added with GPATH_ADD_MISSING_KMERS when
+// loading links) are filled in from disk the first time they are looked up.
+//
+// Requires a graph allocated with DBG_ALLOC_BKTLOCKS. Threadsafe as long as
+// nothing else is adding to or removing from the graph. Dies if the hash
+// table fills up.
+//
+
+#include "db_graph.h"
+#include "graph_search.h"
+
+// Number of entries in the cache of kmers not on disk (power of two)
+#define DB_GRAPH_DISK_MISS_CACHE (1UL<<20)
+
+struct dBGraphDisk
+{
+  GraphFileSearch *gs;
+  uint8_t *claimed, *ready; // 1 bit per hash table entry
+  uint64_t *misses; // cache of hashes of kmers not on disk
+  size_t num_loaded, num_missing, num_miss_cache_hits; // stats
+};
+
+// Attach `disk` to `db_graph`
+void db_graph_disk_alloc(dBGraphDisk *disk, GraphFileSearch *gs,
+                         dBGraph *db_graph);
+
+// Detach `disk` from its graph and free it. Does not free `disk->gs`.
+void db_graph_disk_dealloc(dBGraphDisk *disk, dBGraph *db_graph);
+
+// `hkey` is the result of searching the hash table for `bkey`
+// Returns hkey of the kmer, loading it from disk if needed, otherwise
+// HASH_NOT_FOUND if the kmer is not in the graph file
+hkey_t db_graph_disk_find(dBGraph *db_graph, BinaryKmer bkey, hkey_t hkey);
+
+void db_graph_disk_print_stats(const dBGraphDisk *disk);
+
+#endif /* DB_GRAPH_DISK_H_ */
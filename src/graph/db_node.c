@@ -4,6 +4,50 @@
 #include "db_node.h"
 #include "util.h"
 
+//
+// kmer in colours
+//
+
+static inline bool _db_node_in_col_any_store(const dBGraph *graph,
+                                             hkey_t hkey, size_t col)
+{
+  if(graph->sparse != NULL) return sparse_cols_has(graph->sparse, hkey, col);
+  if(graph->node_in_cols != NULL) return db_node_has_col(graph, hkey, col);
+  if(graph->col_covgs != NULL) return db_node_covg(graph, hkey, col) > 0;
+  return true;
+}
+
+// Colours of a kmer are in num_of_cols consecutive bytes of node_in_cols, at
+// the same bit (hkey%8) of each byte. Take 8 bytes at a time, move that bit
+// to the bottom of each byte, then multiply to gather the 8 bits into the top
+// byte (bit i of byte i ends up at bit 56+i, with no carries).
+void db_node_get_colset(const dBGraph *graph, hkey_t hkey, uint64_t *colset)
+{
+  const size_t ncols = graph->num_of_cols;
+  size_t col;
+
+  memset(colset, 0, db_node_colset_words(ncols) * sizeof(uint64_t));
+
+  if(graph->sparse != NULL || graph->node_in_cols == NULL) {
+    for(col = 0; col < ncols; col++)
+      if(_db_node_in_col_any_store(graph, hkey, col))
+        colset[col/64] |= (uint64_t)1 << (col%64);
+    return;
+  }
+
+  const uint8_t *bytes = graph->node_in_cols +
+                         ksetw(graph->node_in_cols, ncols, hkey, 0);
+  const size_t shift = kseto(graph->node_in_cols, hkey);
+  uint64_t word;
+
+  for(col = 0; col < ncols; col += 8) {
+    word = 0;
+    memcpy(&word, bytes + col, MIN2(ncols - col, 8)); // little endian
+    word = (word >> shift) & 0x0101010101010101ULL;
+    colset[col/64] |= ((word * 0x0102040810204080ULL) >> 56) << (col%64);
+  }
+}
+
 //
 // Edges
 //
@@ -86,8 +130,8 @@ Edges edges_get_union(const Edges *edges_arr, size_t num)
     edges |= tmp;
   }
 
-  memcpy(&tmp, edges_arr+i, sizeof(uint64_t));
-  edges |= tmp & (~(uint64_t)0 >> (64-(8*(num % 8))));
+  // Remaining bytes, don't read past the end of the array
+  for(; i < num; i++) edges |= edges_arr[i];
 
   // with unaligned memory access
   // const uint64_t *ptr = (const uint64_t*)((size_t)edges_arr);
@@ -127,20 +171,52 @@ char* db_node_get_edges_str(Edges edges, char *kmer_col_edge_str)
 
 void db_node_add_col_covg(dBGraph *graph, hkey_t hkey, Colour col, Covg update)
 {
-  SAFE_SUM_COVG(db_node_covg(graph,hkey,col), update);
+  if(!db_node_col_has_covg(graph, col)) return;
+  #if COVG_BITS < 32
+    Covg covg = db_node_get_covg(graph, hkey, col);
+    db_node_set_covg(graph, hkey, col, SAFE_ADD_COVG(covg, update));
+  #else
+    SAFE_SUM_COVG(db_node_covg(graph,hkey,col), update);
+  #endif
+}
+
+// Thread safe, overflow safe, coverage addition
+void db_node_add_col_covg_mt(dBGraph *graph, hkey_t hkey, Colour col, Covg update)
+{
+  if(!db_node_col_has_covg(graph, col)) return;
+  volatile CovgStore *ptr = &db_node_covg(graph,hkey,col);
+  CovgStore v;
+
+  #if COVG_BITS < 32
+    // Counts that don't fit move to the overflow table
+    while((v = *ptr) < COVG_STORE_MAX) {
+      if((Covg)v + update >= COVG_STORE_MAX) break;
+      if(__sync_bool_compare_and_swap(ptr, v, (CovgStore)(v + update))) return;
+    }
+    covg_ovf_add_mt(graph->covg_ovf, db_node_covg_idx(graph, hkey, col),
+                    ptr, update);
+  #else
+    while((v = *ptr) < COVG_MAX &&
+          !__sync_bool_compare_and_swap(ptr, v, SAFE_ADD_COVG(v, update)));
+  #endif
 }
 
 void db_node_increment_coverage(dBGraph *graph, hkey_t hkey, Colour col)
 {
-  SAFE_SUM_COVG(db_node_covg(graph,hkey,col), 1);
+  db_node_add_col_covg(graph, hkey, col, 1);
 }
 
 // Thread safe, overflow safe, coverage increment
 void db_node_increment_coverage_mt(dBGraph *graph, hkey_t hkey, Colour col)
 {
-  Covg v;
-  while((v = db_node_covg(graph,hkey,col)) < COVG_MAX &&
-        !__sync_bool_compare_and_swap(&db_node_covg(graph,hkey,col), v, v+1));
+  #if COVG_BITS < 32
+    db_node_add_col_covg_mt(graph, hkey, col, 1);
+  #else
+    if(!db_node_col_has_covg(graph, col)) return;
+    volatile CovgStore *ptr = &db_node_covg(graph,hkey,col);
+    CovgStore v;
+    while((v = *ptr) < COVG_MAX && !__sync_bool_compare_and_swap(ptr, v, v+1));
+  #endif
 }
 
 //
@@ -264,34 +340,37 @@ void db_nodes_print(const dBNode *nodes, size_t num,
   }
 }
 
-void db_nodes_gzprint(const dBNode *nodes, size_t num,
-                      const dBGraph *db_graph, gzFile out)
+void db_nodes_sbuf(const dBNode *nodes, size_t num,
+                   const dBGraph *db_graph, StrBuf *sbuf)
 {
   size_t i, kmer_size = db_graph->kmer_size;
   Nucleotide nuc;
   BinaryKmer bkmer;
-  char tmp[MAX_KMER_SIZE+1];
 
+  strbuf_ensure_capacity(sbuf, sbuf->end + kmer_size + num);
   bkmer = db_node_oriented_bkmer(db_graph, nodes[0]);
-  binary_kmer_to_str(bkmer, kmer_size, tmp);
-  gzputs(out, tmp);
+  binary_kmer_to_str(bkmer, kmer_size, sbuf->b + sbuf->end);
+  sbuf->end += kmer_size;
 
   for(i = 1; i < num; i++) {
     nuc = db_node_get_last_nuc(nodes[i], db_graph);
-    gzputc(out, dna_nuc_to_char(nuc));
+    sbuf->b[sbuf->end++] = dna_nuc_to_char(nuc);
   }
+  sbuf->b[sbuf->end] = '\0';
 }
 
 // Do not print first k-1 bases => 3 nodes gives 3bp instead of 3+k-1
-void db_nodes_gzprint_cont(const dBNode *nodes, size_t num,
-                           const dBGraph *db_graph, gzFile out)
+void db_nodes_sbuf_cont(const dBNode *nodes, size_t num,
+                        const dBGraph *db_graph, StrBuf *sbuf)
 {
   size_t i;
   Nucleotide nuc;
+  strbuf_ensure_capacity(sbuf, sbuf->end + num);
   for(i = 0; i < num; i++) {
     nuc = db_node_get_last_nuc(nodes[i], db_graph);
-    gzputc(out, dna_nuc_to_char(nuc));
+    sbuf->b[sbuf->end++] = dna_nuc_to_char(nuc);
   }
+  sbuf->b[sbuf->end] = '\0';
 }
 
 // Print:
@@ -7,6 +7,7 @@
 
 #include "cortex_types.h"
 #include "db_graph.h"
+#include "covg_overflow.h"
 #include "util.h"
 
 #define DB_NODE_INIT {.key = HASH_NOT_FOUND, .orient = FORWARD}
@@ -46,6 +47,7 @@ static inline BinaryKmer db_node_get_bkey(const dBGraph *db_graph, hkey_t hkey)
 
 static inline bool db_node_in_col(const dBGraph *graph, hkey_t hkey, size_t col)
 {
+  if(graph->sparse != NULL) return sparse_cols_has(graph->sparse, hkey, col);
   return graph->node_in_cols == NULL ||
          bitset2_get(graph->node_in_cols,
                      ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
@@ -54,6 +56,7 @@ static inline bool db_node_in_col(const dBGraph *graph, hkey_t hkey, size_t col)
 
 static inline bool db_node_has_col(const dBGraph *graph, hkey_t hkey, size_t col)
 {
+  if(graph->sparse != NULL) return sparse_cols_has(graph->sparse, hkey, col);
   return bitset2_get(graph->node_in_cols,
                      ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
                      kseto(graph->node_in_cols,hkey));
@@ -90,6 +93,15 @@ static inline void db_node_set_col_mt(const dBGraph *graph,
                        kseto(graph->node_in_cols,hkey));
 }
 
+// Colour sets hold one bit per colour in uint64_t words
+#define db_node_colset_words(ncols) (((ncols)+63)/64)
+#define db_node_colset_has(colset,col) (((colset)[(col)/64] >> ((col)%64)) & 1)
+
+// Set bits in `colset` (db_node_colset_words(num_of_cols) words) for the
+// colours hkey is in. Reads node_in_cols eight colours at a time, rather than
+// one db_node_has_col() call per colour.
+void db_node_get_colset(const dBGraph *graph, hkey_t hkey, uint64_t *colset);
+
 
 //
 // Node traversal
@@ -237,18 +249,96 @@ static inline char *edges_get_str(Edges fw_edges, char *str)
 // dBNode Edges
 //
 
+// Position of (hkey,col) in col_edges / col_covgs, which hold `ncols` colours.
+// Kmer-major (default): [hkey*ncols + col]
+// Colour-major (DBG_ALLOC_COLMAJOR): [col*capacity + hkey]
+#define db_graph_col_idx(graph,hkey,col,ncols) \
+        ((graph)->col_major ? (size_t)(col)*(graph)->ht.capacity + (hkey) \
+                            : (size_t)(hkey)*(ncols) + (col))
+
+#define db_node_edges_idx(graph,hkey,col) \
+        db_graph_col_idx(graph,hkey,col,(graph)->num_edge_cols)
+
+// Presence-only colours have no slot in col_covgs (see
+// db_graph_set_presence_only()), check with db_node_col_has_covg()
+#define db_node_covg_slot(graph,col) \
+        ((graph)->covg_slot ? (size_t)(graph)->covg_slot[col] : (size_t)(col))
+
+#define db_node_col_has_covg(graph,col) \
+        ((graph)->covg_slot == NULL || (graph)->covg_slot[col] != DBG_NO_COVG_SLOT)
+
+#define db_node_covg_idx(graph,hkey,col) \
+        db_graph_col_idx(graph,hkey,db_node_covg_slot(graph,col), \
+                         (graph)->num_covg_cols)
+
 #define db_node_edges(graph,hkey,col) \
-        ((graph)->col_edges[(hkey)*(graph)->num_edge_cols + (col)])
+        ((graph)->col_edges[db_node_edges_idx(graph,hkey,col)])
+
+// Sparse graphs (graph->sparse != NULL) do not have col_edges, col_covgs or
+// node_in_cols, so must only be read with db_node_get_* and db_node_has_col()
+// Graphs with shared edges (graph->shared_edges != NULL) do not have
+// col_edges, so edges must only be read with db_node_get_*
+
+static inline bool db_node_shared_edges_in_col(const dBGraph *graph,
+                                               hkey_t hkey, Colour col);
 
 static inline Edges db_node_get_edges(const dBGraph *graph, hkey_t hkey, Colour col) {
+  if(graph->sparse != NULL) {
+    return graph->num_edge_cols == 1 ? sparse_cols_edges_union(graph->sparse, hkey)
+                                     : sparse_cols_edges(graph->sparse, hkey, col);
+  }
+  if(graph->shared_edges != NULL) {
+    return shared_edges_get(graph->shared_edges, hkey, col,
+                            db_node_shared_edges_in_col(graph, hkey, col));
+  }
   return db_node_edges(graph, hkey, col);
 }
 
-static inline Edges db_node_get_edges_union(const dBGraph *graph, hkey_t hkey) {
+// Union of edges across colours, without using graph->union_edges
+static inline Edges db_node_read_edges_union(const dBGraph *graph, hkey_t hkey) {
+  if(graph->sparse != NULL) return sparse_cols_edges_union(graph->sparse, hkey);
+  if(graph->shared_edges != NULL)
+    return shared_edges_union(graph->shared_edges, hkey);
+  if(graph->col_major) {
+    Edges edges = 0;
+    size_t col;
+    for(col = 0; col < graph->num_edge_cols; col++)
+      edges |= db_node_edges(graph, hkey, col);
+    return edges;
+  }
   return edges_get_union(graph->col_edges + hkey * graph->num_edge_cols,
                          graph->num_edge_cols);
 }
 
+static inline Edges db_node_get_edges_union(const dBGraph *graph, hkey_t hkey) {
+  if(graph->union_edges != NULL) return graph->union_edges[hkey];
+  return db_node_read_edges_union(graph, hkey);
+}
+
+// Copy edges of all edge colours into edges[0..num_edge_cols-1]
+static inline void db_node_get_all_edges(const dBGraph *graph, hkey_t hkey,
+                                         Edges *edges) {
+  size_t col;
+  if(graph->sparse != NULL || graph->shared_edges != NULL || graph->col_major) {
+    for(col = 0; col < graph->num_edge_cols; col++)
+      edges[col] = db_node_get_edges(graph, hkey, col);
+  }
+  else memcpy(edges, &db_node_edges(graph, hkey, 0),
+              graph->num_edge_cols * sizeof(Edges));
+}
+
+// Set edges of all edge colours from edges[0..num_edge_cols-1]
+static inline void db_node_set_all_edges(dBGraph *graph, hkey_t hkey,
+                                         const Edges *edges) {
+  size_t col;
+  Edges union_edges = 0;
+  for(col = 0; col < graph->num_edge_cols; col++) {
+    db_node_edges(graph, hkey, col) = edges[col];
+    union_edges |= edges[col];
+  }
+  if(graph->union_edges != NULL) graph->union_edges[hkey] = union_edges;
+}
+
 // Edges restricted to this colour, only in one direction (node.orient)
 Edges db_node_edges_in_col(dBNode node, size_t col, const dBGraph *db_graph);
 
@@ -262,16 +352,58 @@ Edges db_node_both_edges_in_col(hkey_t hkey, size_t col, const dBGraph *db_graph
 #define db_node_indegree_in_col(node,col,graph) \
         db_node_outdegree_in_col(db_node_reverse(node),col,graph)
 
-#define db_node_zero_edges(graph,hkey) \
-        memset((graph)->col_edges + (hkey)*(graph)->num_edge_cols, 0, \
-               (graph)->num_edge_cols * sizeof(Edges))
+static inline void db_node_zero_edges(dBGraph *graph, hkey_t hkey) {
+  size_t col;
+  if(graph->col_major) {
+    for(col = 0; col < graph->num_edge_cols; col++)
+      db_node_edges(graph, hkey, col) = 0;
+  }
+  else memset(graph->col_edges + hkey*graph->num_edge_cols, 0,
+              graph->num_edge_cols * sizeof(Edges));
+  if(graph->union_edges != NULL) graph->union_edges[hkey] = 0;
+}
+
+// Update the union of edges of a kmer after removing edges from it with
+// db_node_edges(). Threadsafe if edges are only being removed.
+static inline void db_graph_union_edges_update(dBGraph *graph, hkey_t hkey) {
+  if(graph->union_edges != NULL) {
+    (void)__sync_fetch_and_and(&graph->union_edges[hkey],
+                               db_node_read_edges_union(graph, hkey));
+  }
+}
 
-#define db_node_set_col_edge(graph,hkey,col,nuc,or) \
-        (db_node_edges(graph,hkey,col) \
-           = edges_set_edge(db_node_get_edges(graph,hkey,col),nuc,or))
+static inline void db_node_set_col_edge(dBGraph *graph, hkey_t hkey,
+                                        size_t col, Nucleotide nuc,
+                                        Orientation orient) {
+  db_node_edges(graph,hkey,col)
+    = edges_set_edge(db_node_get_edges(graph,hkey,col),nuc,orient);
+  if(graph->union_edges != NULL)
+    graph->union_edges[hkey] = edges_set_edge(graph->union_edges[hkey],nuc,orient);
+}
 
-#define db_node_set_col_edge_mt(graph,hkey,col,nuc,or) \
-        __sync_or_and_fetch(&db_node_edges(graph,hkey,col), nuc_orient_to_edge(nuc,or))
+static inline void db_node_set_col_edge_mt(dBGraph *graph, hkey_t hkey,
+                                           size_t col, Nucleotide nuc,
+                                           Orientation orient) {
+  Edges edge = nuc_orient_to_edge(nuc,orient);
+  (void)__sync_or_and_fetch(&db_node_edges(graph,hkey,col), edge);
+  if(graph->union_edges != NULL)
+    (void)__sync_or_and_fetch(&graph->union_edges[hkey], edge);
+}
+
+// Add edges to a colour, keeping graph->union_edges up to date
+static inline void db_node_add_col_edges(dBGraph *graph, hkey_t hkey,
+                                         size_t col, Edges edges) {
+  db_node_edges(graph,hkey,col) |= edges;
+  if(graph->union_edges != NULL) graph->union_edges[hkey] |= edges;
+}
+
+static inline void db_node_add_col_edges_mt(dBGraph *graph, hkey_t hkey,
+                                            size_t col, Edges edges) {
+  if(!edges) return;
+  (void)__sync_or_and_fetch(&db_node_edges(graph,hkey,col), edges);
+  if(graph->union_edges != NULL)
+    (void)__sync_or_and_fetch(&graph->union_edges[hkey], edges);
+}
 
 // kmer_col_edge_str should be 9 chars long
 // Return pointer to kmer_col_edge_str
@@ -282,18 +414,73 @@ char* db_node_get_edges_str(Edges edges, char *kmer_col_edge_str);
 //
 
 #define db_node_covg(graph,hkey,col) \
-        ((graph)->col_covgs[(hkey)*(graph)->num_of_cols+(col)])
+        ((graph)->col_covgs[db_node_covg_idx(graph,hkey,col)])
 
+// db_node_covg() is the stored value, use db_node_get_covg() and
+// db_node_set_covg() to read and write coverages
 static inline Covg db_node_get_covg(const dBGraph *db_graph,
                                     hkey_t hkey, Colour col) {
-  return db_node_covg(db_graph, hkey, col);
+  if(db_graph->sparse != NULL) return sparse_cols_covg(db_graph->sparse, hkey, col);
+  if(!db_node_col_has_covg(db_graph, col)) return db_node_has_col(db_graph, hkey, col);
+  Covg covg = db_node_covg(db_graph, hkey, col);
+  #if COVG_BITS < 32
+    if(covg == COVG_STORE_MAX)
+      covg = covg_ovf_get(db_graph->covg_ovf,
+                          db_node_covg_idx(db_graph, hkey, col));
+  #endif
+  return covg;
 }
 
-#define db_node_zero_covgs(graph,hkey) \
-        memset((graph)->col_covgs + (hkey)*(graph)->num_of_cols, 0, \
-               (graph)->num_of_cols * sizeof(Covg))
+// Colours without the kmer have no edges in a SharedEdges store unless listed
+// as an exception
+static inline bool db_node_shared_edges_in_col(const dBGraph *graph,
+                                               hkey_t hkey, Colour col) {
+  if(graph->node_in_cols != NULL) return db_node_has_col(graph, hkey, col);
+  return db_node_covg(graph, hkey, col) > 0;
+}
+
+// Not thread safe on the same node. Does nothing for presence-only colours.
+static inline void db_node_set_covg(dBGraph *db_graph, hkey_t hkey, Colour col,
+                                    Covg covg) {
+  if(!db_node_col_has_covg(db_graph, col)) return;
+  #if COVG_BITS < 32
+    if(covg >= COVG_STORE_MAX) {
+      covg_ovf_set(db_graph->covg_ovf, db_node_covg_idx(db_graph, hkey, col),
+                   covg);
+      covg = COVG_STORE_MAX;
+    }
+  #endif
+  db_node_covg(db_graph, hkey, col) = (CovgStore)covg;
+}
+
+// Copy coverages of all colours into covgs[0..num_of_cols-1]
+static inline void db_node_get_covgs(const dBGraph *db_graph, hkey_t hkey,
+                                     Covg *covgs) {
+  size_t col;
+  if(db_graph->sparse != NULL) {
+    const SparseColEntry *e = sparse_cols_first(db_graph->sparse, hkey);
+    memset(covgs, 0, db_graph->num_of_cols * sizeof(Covg));
+    for(; e != NULL; e = sparse_cols_next(db_graph->sparse, e))
+      covgs[sparse_col_entry_col(e)] = e->covg;
+    return;
+  }
+  for(col = 0; col < db_graph->num_of_cols; col++)
+    covgs[col] = db_node_get_covg(db_graph, hkey, col);
+}
+
+static inline void db_node_zero_covgs(dBGraph *graph, hkey_t hkey) {
+  size_t col;
+  if(graph->col_major) {
+    for(col = 0; col < graph->num_covg_cols; col++)
+      graph->col_covgs[col*graph->ht.capacity + hkey] = 0;
+  }
+  else memset(graph->col_covgs + hkey*graph->num_covg_cols, 0,
+              graph->num_covg_cols * sizeof(CovgStore));
+}
 
 void db_node_add_col_covg(dBGraph *graph, hkey_t hkey, Colour col, Covg update);
+// Thread safe, overflow safe, coverage addition
+void db_node_add_col_covg_mt(dBGraph *graph, hkey_t hkey, Colour col, Covg update);
 void db_node_increment_coverage(dBGraph *graph, hkey_t hkey, Colour col);
 
 // Thread safe, overflow safe, coverage increment
@@ -301,10 +488,15 @@ void db_node_increment_coverage_mt(dBGraph *graph, hkey_t hkey, Colour col);
 
 static inline Covg db_node_sum_covg(const dBGraph *graph, hkey_t hkey)
 {
-  const Covg *covgs = &db_node_covg(graph,hkey,0);
-  Covg sum_covg = covgs[0];
+  if(graph->sparse != NULL) {
+    const SparseColEntry *e = sparse_cols_first(graph->sparse, hkey);
+    Covg sum = 0;
+    for(; e != NULL; e = sparse_cols_next(graph->sparse, e)) SAFE_SUM_COVG(sum, e->covg);
+    return sum;
+  }
+  Covg sum_covg = db_node_get_covg(graph,hkey,0);
   size_t c, ncols = graph->num_of_cols;
-  for(c = 1; c < ncols; c++) SAFE_SUM_COVG(sum_covg, covgs[c]);
+  for(c = 1; c < ncols; c++) SAFE_SUM_COVG(sum_covg, db_node_get_covg(graph,hkey,c));
   return sum_covg;
 }
 
@@ -350,12 +542,13 @@ size_t db_nodes_to_str(const dBNode *nodes, size_t num,
 void db_nodes_print(const dBNode *nodes, size_t num,
                     const dBGraph *db_graph, FILE *out);
 
-void db_nodes_gzprint(const dBNode *nodes, size_t num,
-                      const dBGraph *db_graph, gzFile out);
+// Append to sbuf
+void db_nodes_sbuf(const dBNode *nodes, size_t num,
+                   const dBGraph *db_graph, StrBuf *sbuf);
 
 // Do not print first k-1 bases => 3 nodes gives 3bp instead of 3+k-1
-void db_nodes_gzprint_cont(const dBNode *nodes, size_t num,
-                           const dBGraph *db_graph, gzFile out);
+void db_nodes_sbuf_cont(const dBNode *nodes, size_t num,
+                        const dBGraph *db_graph, StrBuf *sbuf);
 
 // Print:
 // 0: AAACCCAAATGCAAACCCAAATGCAAACCCA:1 TGGGTTTGCATTTGGGTTTGCATTTGGGTTT
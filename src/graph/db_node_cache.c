@@ -0,0 +1,125 @@
+#include "global.h"
+#include "db_node_cache.h"
+#include "db_node.h"
+
+void db_node_cache_alloc(dBNodeCache *cache, dBGraph *db_graph, size_t nslots)
+{
+  ctx_assert(nslots > 0 && !(nslots & (nslots-1)));
+  size_t i;
+  cache->db_graph = db_graph;
+  cache->slots = ctx_malloc(nslots * sizeof(dBNodeCacheEntry));
+  cache->mask = nslots-1;
+  cache->gen = db_graph_grow_generation(db_graph);
+  for(i = 0; i < nslots; i++) cache->slots[i].hkey = HASH_NOT_FOUND;
+}
+
+void db_node_cache_dealloc(dBNodeCache *cache)
+{
+  ctx_free(cache->slots);
+  memset(cache, 0, sizeof(*cache));
+}
+
+#define db_node_cache_edge_col(graph,col) ((graph)->num_edge_cols == 1 ? 0 : (col))
+
+static inline void db_node_cache_add_col_edges_mt(dBGraph *db_graph,
+                                                  hkey_t hkey, Colour col,
+                                                  Edges edges)
+{
+  if(db_graph->col_edges == NULL || !edges) return;
+  (void)__sync_or_and_fetch(&db_node_edges(db_graph, hkey, col), edges);
+  if(db_graph->union_edges != NULL)
+    (void)__sync_or_and_fetch(&db_graph->union_edges[hkey], edges);
+}
+
+// Write an entry to the graph and empty its slot
+static void db_node_cache_write(dBNodeCache *cache, dBNodeCacheEntry *entry)
+{
+  dBGraph *db_graph = cache->db_graph;
+  hkey_t hkey = entry->hkey;
+  if(hkey == HASH_NOT_FOUND) return;
+
+  if(db_graph->node_in_cols != NULL)
+    db_node_set_col_mt(db_graph, hkey, entry->col);
+  if(db_graph->col_covgs != NULL)
+    db_node_add_col_covg_mt(db_graph, hkey, entry->col, entry->covg);
+  db_node_cache_add_col_edges_mt(db_graph, hkey,
+                                 db_node_cache_edge_col(db_graph, entry->col),
+                                 entry->edges);
+  entry->hkey = HASH_NOT_FOUND;
+}
+
+// If the graph has grown since hkeys were cached, find them again and flush
+static void db_node_cache_sync(dBNodeCache *cache)
+{
+  size_t i, gen = db_graph_grow_generation(cache->db_graph);
+  if(gen == cache->gen) return;
+
+  for(i = 0; i <= cache->mask; i++) {
+    if(cache->slots[i].hkey != HASH_NOT_FOUND) {
+      cache->slots[i].hkey = db_graph_find_node_mt(cache->db_graph,
+                                                   cache->slots[i].bkey).key;
+      db_node_cache_write(cache, &cache->slots[i]);
+    }
+  }
+  cache->gen = gen;
+}
+
+void db_node_cache_update_node(dBNodeCache *cache, dBNode node,
+                               BinaryKmer bkey, Colour col, Covg covg)
+{
+  db_node_cache_sync(cache);
+  dBNodeCacheEntry *entry = &cache->slots[node.key & cache->mask];
+
+  if(entry->hkey == node.key && entry->col == col) {
+    entry->covg = SAFE_ADD_COVG(entry->covg, covg);
+    return;
+  }
+
+  db_node_cache_write(cache, entry);
+  entry->bkey = bkey;
+  entry->hkey = node.key;
+  entry->col = col;
+  entry->covg = covg;
+  entry->edges = 0;
+}
+
+// Add an edge to the cached entry of a node if there is one, otherwise to the
+// graph
+static inline void db_node_cache_set_edge(dBNodeCache *cache, hkey_t hkey,
+                                          Colour col, Nucleotide nuc,
+                                          Orientation orient)
+{
+  dBNodeCacheEntry *entry = &cache->slots[hkey & cache->mask];
+  Edges edge = nuc_orient_to_edge(nuc, orient);
+
+  if(entry->hkey == hkey && entry->col == col) entry->edges |= edge;
+  else {
+    db_node_cache_add_col_edges_mt(cache->db_graph, hkey,
+                                   db_node_cache_edge_col(cache->db_graph, col),
+                                   edge);
+  }
+}
+
+void db_node_cache_add_edge(dBNodeCache *cache, Colour col,
+                            dBNode src, dBNode tgt)
+{
+  dBGraph *db_graph = cache->db_graph;
+  if(db_graph->col_edges == NULL) return;
+  db_node_cache_sync(cache);
+
+  Nucleotide lhs_nuc, rhs_nuc;
+  lhs_nuc = db_node_get_first_nuc(src, db_graph);
+  rhs_nuc = db_node_get_last_nuc(tgt, db_graph);
+
+  db_node_cache_set_edge(cache, src.key, col, rhs_nuc, src.orient);
+  db_node_cache_set_edge(cache, tgt.key, col, dna_nuc_complement(lhs_nuc),
+                         !tgt.orient);
+}
+
+void db_node_cache_flush(dBNodeCache *cache)
+{
+  size_t i;
+  db_node_cache_sync(cache);
+  for(i = 0; i <= cache->mask; i++)
+    db_node_cache_write(cache, &cache->slots[i]);
+}
@@ -0,0 +1,61 @@
+#ifndef DB_NODE_CACHE_H_
+#define DB_NODE_CACHE_H_
+
+//
+// Per-thread cache of pending coverage and edge updates
+//
+// Building a graph takes an atomic increment per kmer occurrence. High copy
+// kmers (e.g. ALU, satellite repeats) make threads fight over the same cache
+// lines. A dBNodeCache is a small direct-mapped table (by hkey) owned by one
+// thread: repeated updates to a node are summed locally and written to the
+// graph when the entry is evicted or the cache is flushed. Once flushed the
+// graph is the same as if db_graph_update_node_mt() and
+// db_graph_add_edge_mt() had been called for each update.
+//
+// Coverage and colour bits are not visible to other threads until flushed, so
+// don't use a cache if anything reads them while building (e.g. the bloom
+// filter of `build --min-count`). Only use between db_graph_grow_enter() and
+// db_graph_grow_leave(). Entries keep their kmer so they can be found again if
+// the graph grows.
+//
+
+#include "db_graph.h"
+
+#define DB_NODE_CACHE_SLOTS 1024
+
+typedef struct
+{
+  BinaryKmer bkey;
+  hkey_t hkey; // HASH_NOT_FOUND if the slot is empty
+  Colour col;
+  Covg covg;
+  Edges edges; // edges to add to colour col (0 if one edge colour)
+} dBNodeCacheEntry;
+
+typedef struct
+{
+  dBGraph *db_graph;
+  dBNodeCacheEntry *slots;
+  size_t mask, gen; // gen: db_graph_grow_generation() of cached hkeys
+} dBNodeCache;
+
+// nslots must be a power of two
+void db_node_cache_alloc(dBNodeCache *cache, dBGraph *db_graph, size_t nslots);
+void db_node_cache_dealloc(dBNodeCache *cache);
+
+// Same as db_graph_update_node_mt(db_graph, node, col) with `covg` added to
+// the coverage instead of one. `bkey` is the key of node.
+void db_node_cache_update_node(dBNodeCache *cache, dBNode node,
+                               BinaryKmer bkey, Colour col, Covg covg);
+
+// Same as db_graph_add_edge_mt(db_graph, edge_col, src, tgt) where `col` is
+// the colour given to db_node_cache_update_node() and edge_col is 0 if the
+// graph has one edge colour, otherwise `col`. Edges of nodes not in the cache
+// are written straight to the graph.
+void db_node_cache_add_edge(dBNodeCache *cache, Colour col,
+                            dBNode src, dBNode tgt);
+
+// Write all pending updates to the graph
+void db_node_cache_flush(dBNodeCache *cache);
+
+#endif /* DB_NODE_CACHE_H_ */
@@ -98,10 +98,22 @@ bool db_unitig_extend(dBNodeBuffer *nbuf, size_t limit,
   Edges edges = db_node_get_edges_union(db_graph, node.key);
   Nucleotide nuc;
 
+  // bkmer is only kept up to date while not using the successor cache
+  bool bkmer_valid = true;
+
   while(edges_has_precisely_one_edge(edges, node.orient, &nuc))
   {
-    bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-    node = db_graph_find(db_graph, bkmer);
+    if(db_graph_next_cached(db_graph, node, nuc, &node)) {
+      bkmer_valid = false;
+      if(db_graph->prefetch_walks) db_graph_prefetch_node(db_graph, node);
+    } else {
+      if(!bkmer_valid) bkmer = db_node_oriented_bkmer(db_graph, node);
+      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
+      // Fetch the buckets of the step after this one while finding this one
+      if(db_graph->prefetch_walks) db_graph_prefetch_next_kmers(db_graph, bkmer);
+      node = db_graph_find(db_graph, bkmer);
+      bkmer_valid = true;
+    }
     edges = db_node_get_edges_union(db_graph, node.key);
 
     ctx_assert(node.key != HASH_NOT_FOUND);
@@ -209,21 +221,16 @@ typedef struct {
   const dBGraph *db_graph;
   void (*func)(dBNodeBuffer _nbuf, size_t threadid, void *_arg);
   void *arg;
+  dBNodeBuffer *nbufs; // one per thread
+  const dBNode *nodes; // seed nodes for db_unitigs_iterate_nodes()
 } UnitigIterating;
 
-static void db_unitigs_iterate_thread(void *arg, size_t threadid)
+static bool db_unitigs_iterate_kmer(hkey_t hkey, size_t threadid, void *arg)
 {
-  UnitigIterating iter = *(UnitigIterating*)arg;
-
-  dBNodeBuffer nbuf;
-  db_node_buf_alloc(&nbuf, 2048);
-
-  HASH_ITERATE_PART(&iter.db_graph->ht, threadid, iter.nthreads,
-                    unitig_iterate_node,
-                    threadid, &nbuf, iter.visited, iter.db_graph,
-                    iter.func, iter.arg);
-
-  db_node_buf_dealloc(&nbuf);
+  UnitigIterating *iter = (UnitigIterating*)arg;
+  return unitig_iterate_node(hkey, threadid, &iter->nbufs[threadid],
+                             iter->visited, iter->db_graph,
+                             iter->func, iter->arg);
 }
 
 /**
@@ -234,11 +241,93 @@ void db_unitigs_iterate(size_t nthreads, uint8_t *visited,
                         void (*func)(dBNodeBuffer nbuf, size_t threadid, void *arg),
                         void *arg)
 {
+  size_t i;
+  UnitigIterating iter = {.nthreads = nthreads,
+                          .visited = visited,
+                          .db_graph = db_graph,
+                          .func = func,
+                          .arg = arg,
+                          .nbufs = ctx_calloc(nthreads, sizeof(dBNodeBuffer))};
+
+  for(i = 0; i < nthreads; i++) db_node_buf_alloc(&iter.nbufs[i], 2048);
+
+  // Unitig lengths vary a lot, balance work by stealing
+  hash_table_iterate_steal(&db_graph->ht, nthreads,
+                           db_unitigs_iterate_kmer, &iter);
+
+  for(i = 0; i < nthreads; i++) db_node_buf_dealloc(&iter.nbufs[i]);
+  ctx_free(iter.nbufs);
+}
+
+static bool db_unitigs_iterate_range(size_t start, size_t end,
+                                     size_t threadid, void *arg)
+{
+  UnitigIterating *iter = (UnitigIterating*)arg;
+  size_t i;
+  for(i = start; i < end; i++) {
+    unitig_iterate_node(iter->nodes[i].key, threadid, &iter->nbufs[threadid],
+                        iter->visited, iter->db_graph, iter->func, iter->arg);
+  }
+  return false; // => keep going
+}
+
+/**
+ * Same as db_unitigs_iterate() but only visits unitigs containing `nodes`
+ * @param visited unitigs with nodes marked in visited are skipped
+ **/
+void db_unitigs_iterate_nodes(size_t nthreads, uint8_t *visited,
+                              const dBNode *nodes, size_t num_nodes,
+                              const dBGraph *db_graph,
+                              void (*func)(dBNodeBuffer nbuf, size_t threadid, void *arg),
+                              void *arg)
+{
+  size_t i;
   UnitigIterating iter = {.nthreads = nthreads,
                           .visited = visited,
                           .db_graph = db_graph,
                           .func = func,
-                          .arg = arg};
+                          .arg = arg,
+                          .nbufs = ctx_calloc(nthreads, sizeof(dBNodeBuffer)),
+                          .nodes = nodes};
+
+  for(i = 0; i < nthreads; i++) db_node_buf_alloc(&iter.nbufs[i], 2048);
+
+  util_run_ranges(num_nodes, 64, nthreads, db_unitigs_iterate_range, &iter);
+
+  for(i = 0; i < nthreads; i++) db_node_buf_dealloc(&iter.nbufs[i]);
+  ctx_free(iter.nbufs);
+}
+
+typedef struct {
+  hkey_t *newkeys;
+  volatile uint64_t next; // first unused hkey
+} UnitigRelayout;
+
+static void _unitig_relayout(dBNodeBuffer nbuf, size_t threadid, void *arg)
+{
+  (void)threadid;
+  UnitigRelayout *relayout = (UnitigRelayout*)arg;
+  hkey_t start = __sync_fetch_and_add(&relayout->next, nbuf.len);
+  size_t i;
+  for(i = 0; i < nbuf.len; i++)
+    relayout->newkeys[nbuf.b[i].key] = start + i;
+}
+
+/**
+ * Renumber kmers so that the kmers of each unitig have consecutive hkeys, in
+ * the order they are walked.
+ * @param visited must be initialised to zero, will be dirty upon return
+ **/
+void db_unitigs_relayout(dBGraph *db_graph, size_t nthreads, uint8_t *visited)
+{
+  UnitigRelayout relayout = {
+    .newkeys = ctx_malloc(db_graph->ht.capacity * sizeof(hkey_t)),
+    .next = 0};
+
+  status("[unitigs] Ordering kmers by unitig...");
+  db_unitigs_iterate(nthreads, visited, db_graph, _unitig_relayout, &relayout);
+  ctx_assert(relayout.next == db_graph->ht.num_kmers);
 
-  util_multi_thread(&iter, nthreads, db_unitigs_iterate_thread);
+  db_graph_relayout(db_graph, relayout.newkeys, nthreads);
+  ctx_free(relayout.newkeys);
 }
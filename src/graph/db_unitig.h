@@ -33,4 +33,23 @@ void db_unitigs_iterate(size_t nthreads, uint8_t *visited,
                         void (*func)(dBNodeBuffer nbuf, size_t threadid, void *arg),
                         void *arg);
 
+/**
+ * Same as db_unitigs_iterate() but only visits unitigs containing `nodes`
+ * @param visited unitigs with nodes marked in visited are skipped
+ **/
+void db_unitigs_iterate_nodes(size_t nthreads, uint8_t *visited,
+                              const dBNode *nodes, size_t num_nodes,
+                              const dBGraph *db_graph,
+                              void (*func)(dBNodeBuffer nbuf, size_t threadid, void *arg),
+                              void *arg);
+
+/**
+ * Renumber kmers so that the kmers of each unitig have consecutive hkeys, in
+ * the order they are walked. Walking a unitig then reads edges, coverages and
+ * links from adjacent memory. The graph is read only afterwards, see
+ * db_graph_relayout().
+ * @param visited must be initialised to zero, will be dirty upon return
+ **/
+void db_unitigs_relayout(dBGraph *db_graph, size_t nthreads, uint8_t *visited);
+
 #endif /* DB_UNITIG_H_ */
@@ -0,0 +1,557 @@
+#include "global.h"
+#include "graph_block.h"
+#include "remote_file.h"
+
+
+//
+// Varints: 7 bits per byte, least significant first, top bit set if more
+//
+
+static inline void varint_write(ByteBuffer *buf, uint64_t x)
+{
+  byte_buf_capacity(buf, buf->len+10);
+  while(x >= 0x80) { buf->b[buf->len++] = (uint8_t)(x | 0x80); x >>= 7; }
+  buf->b[buf->len++] = (uint8_t)x;
+}
+
+// Returns false if we run out of bytes or the varint is too long
+static inline bool varint_read(const uint8_t **ptr, const uint8_t *end,
+                               uint64_t *x)
+{
+  const uint8_t *p = *ptr;
+  uint64_t v = 0;
+  size_t shift;
+  for(shift = 0; p < end && shift < 64; shift += 7, p++) {
+    v |= (uint64_t)(*p & 0x7f) << shift;
+    if(!(*p & 0x80)) { *x = v; *ptr = p+1; return true; }
+  }
+  return false;
+}
+
+// b[0] is the most significant word
+static inline BinaryKmer bkmer_sub(BinaryKmer a, BinaryKmer b)
+{
+  BinaryKmer d;
+  uint64_t borrow = 0, w;
+  size_t i;
+  for(i = NUM_BKMER_WORDS; i-- > 0; ) {
+    w = a.b[i] - b.b[i] - borrow;
+    borrow = (a.b[i] < b.b[i]) || (a.b[i] == b.b[i] && borrow);
+    d.b[i] = w;
+  }
+  return d;
+}
+
+static inline BinaryKmer bkmer_add(BinaryKmer a, BinaryKmer b)
+{
+  BinaryKmer s;
+  uint64_t carry = 0;
+  size_t i;
+  for(i = NUM_BKMER_WORDS; i-- > 0; ) {
+    s.b[i] = a.b[i] + b.b[i] + carry;
+    carry = (s.b[i] < a.b[i]) || (s.b[i] == a.b[i] && carry);
+  }
+  return s;
+}
+
+//
+// Delta coverage
+//
+
+// 0,-1,1,-2,2.. => 0,1,2,3,4..
+static inline uint64_t zigzag_enc(int64_t x)
+{
+  return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+static inline int64_t zigzag_dec(uint64_t x)
+{
+  return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+
+void graph_covg_delta_encode(ByteBuffer *buf, const Covg *covgs,
+                             const Edges *edges, size_t ncols)
+{
+  uint64_t z[GRAPH_COVG_DELTA_GROUP], sum = 0, base, maxz, acc;
+  size_t i, j, n, w, nbits, nmask = (ncols+7)/8;
+  ctx_assert(ncols > 0);
+
+  for(i = 0; i < ncols; i++) sum += covgs[i];
+  base = (sum + ncols/2) / ncols;
+  varint_write(buf, base);
+
+  for(i = 0; i < ncols; i += GRAPH_COVG_DELTA_GROUP) {
+    n = MIN2(ncols-i, GRAPH_COVG_DELTA_GROUP);
+    for(j = 0, maxz = 0; j < n; j++) {
+      z[j] = zigzag_enc((int64_t)covgs[i+j] - (int64_t)base);
+      maxz |= z[j];
+    }
+    w = maxz ? 64 - (size_t)__builtin_clzll(maxz) : 0;
+    byte_buf_capacity(buf, buf->len + 1 + (n*w+7)/8);
+    buf->b[buf->len++] = (uint8_t)w;
+    for(j = 0, acc = 0, nbits = 0; j < n; j++) {
+      acc |= z[j] << nbits;
+      for(nbits += w; nbits >= 8; nbits -= 8, acc >>= 8)
+        buf->b[buf->len++] = (uint8_t)acc;
+    }
+    if(nbits) buf->b[buf->len++] = (uint8_t)acc;
+  }
+
+  // Edges that differ from those of the first colour
+  byte_buf_capacity(buf, buf->len + 1 + nmask + ncols);
+  buf->b[buf->len++] = edges[0];
+  uint8_t *mask = buf->b + buf->len;
+  memset(mask, 0, nmask);
+  buf->len += nmask;
+  for(i = 1; i < ncols; i++) {
+    if(edges[i] != edges[0]) {
+      mask[i/8] |= (uint8_t)(1 << (i%8));
+      buf->b[buf->len++] = edges[i];
+    }
+  }
+}
+
+bool graph_covg_delta_decode(const uint8_t **ptr, const uint8_t *end,
+                             size_t ncols, Covg *covgs, Edges *edges)
+{
+  const uint8_t *p = *ptr, *mask;
+  uint64_t base, acc, wmask;
+  int64_t c;
+  size_t i, j, n, w, nbits, nmask = (ncols+7)/8;
+
+  if(!varint_read(&p, end, &base) || base > UINT32_MAX) return false;
+
+  for(i = 0; i < ncols; i += GRAPH_COVG_DELTA_GROUP) {
+    n = MIN2(ncols-i, GRAPH_COVG_DELTA_GROUP);
+    if(p == end || *p > 34) return false; // deltas need at most 34 bits
+    w = *(p++);
+    if(w == 0) {
+      for(j = 0; j < n; j++) covgs[i+j] = (Covg)base;
+      continue;
+    }
+    if((size_t)(end-p) < (n*w+7)/8) return false;
+    wmask = (1UL << w) - 1;
+    for(j = 0, acc = 0, nbits = 0; j < n; j++) {
+      for(; nbits < w; nbits += 8) acc |= (uint64_t)*(p++) << nbits;
+      c = (int64_t)base + zigzag_dec(acc & wmask);
+      if(c < 0 || c > UINT32_MAX) return false;
+      covgs[i+j] = (Covg)c;
+      acc >>= w;
+      nbits -= w;
+    }
+  }
+
+  if((size_t)(end-p) < 1 + nmask) return false;
+  edges[0] = *(p++);
+  mask = p;
+  p += nmask;
+  for(i = 1; i < ncols; i++) {
+    if(mask[i/8] & (1 << (i%8))) {
+      if(p == end) return false;
+      edges[i] = *(p++);
+    }
+    else edges[i] = edges[0];
+  }
+
+  *ptr = p;
+  return true;
+}
+
+//
+// Writing
+//
+
+void graph_block_writer_alloc(GraphBlockWriter *wtr, FILE *fh, size_t ncols,
+                              size_t offset, uint32_t layout)
+{
+  ctx_assert(layout == 0 || layout == GRAPH_BLOCK_COLMAJOR ||
+             layout == GRAPH_BLOCK_DELTACOV);
+  bool colmajor = (layout == GRAPH_BLOCK_COLMAJOR);
+  memset(wtr, 0, sizeof(*wtr));
+  wtr->fh = fh;
+  wtr->ncols = ncols;
+  wtr->offset = offset;
+  wtr->colmajor = colmajor;
+  wtr->deltacov = (layout == GRAPH_BLOCK_DELTACOV);
+  gblock_buf_alloc(&wtr->index, 1024);
+
+  if(colmajor) {
+    byte_buf_alloc(&wtr->buf, GRAPH_BLOCK_NKMERS * sizeof(BinaryKmer));
+    byte_buf_alloc(&wtr->colbuf, GRAPH_BLOCK_NKMERS * 4 * ncols);
+    wtr->blkcovgs = ctx_malloc(GRAPH_BLOCK_NKMERS * ncols * sizeof(Covg));
+    wtr->blkedges = ctx_malloc(GRAPH_BLOCK_NKMERS * ncols * sizeof(Edges));
+  }
+  else {
+    byte_buf_alloc(&wtr->buf, GRAPH_BLOCK_NKMERS * (sizeof(BinaryKmer)+4*ncols));
+  }
+}
+
+void graph_block_writer_dealloc(GraphBlockWriter *wtr)
+{
+  byte_buf_dealloc(&wtr->buf);
+  gblock_buf_dealloc(&wtr->index);
+  if(wtr->colmajor) {
+    byte_buf_dealloc(&wtr->colbuf);
+    ctx_free(wtr->blkcovgs);
+    ctx_free(wtr->blkedges);
+  }
+  memset(wtr, 0, sizeof(*wtr));
+}
+
+static void block_write_hdr(FILE *fh, uint32_t nbytes, uint32_t nkmers)
+{
+  if(fwrite(&nbytes, 1, sizeof(uint32_t), fh) != sizeof(uint32_t) ||
+     fwrite(&nkmers, 1, sizeof(uint32_t), fh) != sizeof(uint32_t))
+    die("Cannot write to file");
+}
+
+// Encode the colour table and colour sections of the current block into
+// wtr->colbuf
+static void block_encode_cols(GraphBlockWriter *wtr)
+{
+  const size_t ncols = wtr->ncols, n = wtr->blknkmers;
+  const Covg *covgs = wtr->blkcovgs;
+  const Edges *edges = wtr->blkedges;
+  size_t col, k, run, start;
+  uint32_t nbytes;
+
+  byte_buf_reset(&wtr->colbuf);
+  byte_buf_capacity(&wtr->colbuf, ncols * sizeof(uint32_t));
+  wtr->colbuf.len = ncols * sizeof(uint32_t);
+
+  for(col = 0; col < ncols; col++)
+  {
+    start = wtr->colbuf.len;
+    for(k = 0; k < n; ) {
+      for(run = 0; k < n && !covgs[k*ncols+col] && !edges[k*ncols+col]; k++, run++) {}
+      if(k == n && start == wtr->colbuf.len) break; // colour not in block
+      varint_write(&wtr->colbuf, run);
+      if(k == n) break;
+      varint_write(&wtr->colbuf, covgs[k*ncols+col]);
+      byte_buf_add(&wtr->colbuf, edges[k*ncols+col]);
+      k++;
+    }
+    ctx_assert(wtr->colbuf.len - start <= UINT32_MAX);
+    nbytes = (uint32_t)(wtr->colbuf.len - start);
+    memcpy(wtr->colbuf.b + col*sizeof(uint32_t), &nbytes, sizeof(uint32_t));
+  }
+}
+
+static void block_flush(GraphBlockWriter *wtr)
+{
+  if(wtr->blknkmers == 0) return;
+  size_t nbytes = wtr->buf.len;
+  uint32_t nkmers = (uint32_t)wtr->blknkmers, kbytes = (uint32_t)wtr->buf.len;
+
+  if(wtr->colmajor) {
+    block_encode_cols(wtr);
+    nbytes = sizeof(uint32_t) + wtr->buf.len + wtr->colbuf.len;
+    nkmers |= GRAPH_BLOCK_COLMAJOR;
+  }
+  else if(wtr->deltacov) nkmers |= GRAPH_BLOCK_DELTACOV;
+
+  ctx_assert(nbytes <= UINT32_MAX);
+  block_write_hdr(wtr->fh, (uint32_t)nbytes, nkmers);
+  if(wtr->colmajor &&
+     fwrite(&kbytes, 1, sizeof(uint32_t), wtr->fh) != sizeof(uint32_t))
+    die("Cannot write to file");
+  if(fwrite(wtr->buf.b, 1, wtr->buf.len, wtr->fh) != wtr->buf.len)
+    die("Cannot write to file");
+  if(wtr->colmajor &&
+     fwrite(wtr->colbuf.b, 1, wtr->colbuf.len, wtr->fh) != wtr->colbuf.len)
+    die("Cannot write to file");
+  wtr->offset += GRAPH_BLOCK_HDR_SIZE + nbytes;
+  wtr->nkmers += wtr->blknkmers;
+  wtr->blknkmers = 0;
+  byte_buf_reset(&wtr->buf);
+}
+
+void graph_block_writer_add(GraphBlockWriter *wtr, BinaryKmer bkmer,
+                            const Covg *covgs, const Edges *edges)
+{
+  size_t i, col, run;
+
+  if(wtr->blknkmers == GRAPH_BLOCK_NKMERS) block_flush(wtr);
+
+  if(wtr->blknkmers == 0) {
+    GraphBlockEntry entry = {.first = bkmer, .offset = wtr->offset,
+                             .kmer_offset = wtr->nkmers};
+    gblock_buf_add(&wtr->index, entry);
+    memset(&wtr->prev, 0, sizeof(BinaryKmer));
+  }
+
+  BinaryKmer delta = bkmer_sub(bkmer, wtr->prev);
+  for(i = 0; i < NUM_BKMER_WORDS; i++) varint_write(&wtr->buf, delta.b[i]);
+  wtr->prev = bkmer;
+
+  if(wtr->colmajor) {
+    memcpy(wtr->blkcovgs + wtr->blknkmers*wtr->ncols, covgs,
+           wtr->ncols * sizeof(Covg));
+    memcpy(wtr->blkedges + wtr->blknkmers*wtr->ncols, edges,
+           wtr->ncols * sizeof(Edges));
+    wtr->blknkmers++;
+    return;
+  }
+
+  if(wtr->deltacov) {
+    graph_covg_delta_encode(&wtr->buf, covgs, edges, wtr->ncols);
+    wtr->blknkmers++;
+    return;
+  }
+
+  for(col = 0; col < wtr->ncols; ) {
+    for(run = 0; col < wtr->ncols && !covgs[col] && !edges[col]; col++, run++) {}
+    varint_write(&wtr->buf, run);
+    if(col == wtr->ncols) break;
+    varint_write(&wtr->buf, covgs[col]);
+    byte_buf_add(&wtr->buf, edges[col]);
+    col++;
+  }
+
+  wtr->blknkmers++;
+}
+
+// Write last block, end marker, index and trailer
+// Returns number of bytes written since graph_block_writer_alloc()
+size_t graph_block_writer_finish(GraphBlockWriter *wtr)
+{
+  size_t i, start;
+  block_flush(wtr);
+  block_write_hdr(wtr->fh, 0, 0); // end marker
+  uint64_t index_offset = wtr->offset + GRAPH_BLOCK_HDR_SIZE;
+  uint64_t nblocks = wtr->index.len;
+
+  for(i = 0; i < wtr->index.len; i++) {
+    const GraphBlockEntry *e = &wtr->index.b[i];
+    if(fwrite(e->first.b, 1, sizeof(BinaryKmer), wtr->fh) != sizeof(BinaryKmer) ||
+       fwrite(&e->offset, 1, sizeof(uint64_t), wtr->fh) != sizeof(uint64_t) ||
+       fwrite(&e->kmer_offset, 1, sizeof(uint64_t), wtr->fh) != sizeof(uint64_t))
+      die("Cannot write to file");
+  }
+
+  if(fwrite(&nblocks, 1, sizeof(uint64_t), wtr->fh) != sizeof(uint64_t) ||
+     fwrite(&wtr->nkmers, 1, sizeof(uint64_t), wtr->fh) != sizeof(uint64_t) ||
+     fwrite(&index_offset, 1, sizeof(uint64_t), wtr->fh) != sizeof(uint64_t) ||
+     fwrite(GRAPH_BLOCK_MAGIC, 1, strlen(GRAPH_BLOCK_MAGIC), wtr->fh) !=
+       strlen(GRAPH_BLOCK_MAGIC))
+    die("Cannot write to file");
+
+  start = wtr->index.len ? wtr->index.b[0].offset : wtr->offset;
+  return index_offset - start +
+         nblocks * (sizeof(BinaryKmer)+2*sizeof(uint64_t)) +
+         GRAPH_BLOCK_TRAILER_SIZE;
+}
+
+//
+// Reading
+//
+
+void graph_block_decoder_alloc(GraphBlockDecoder *dec)
+{
+  memset(dec, 0, sizeof(*dec));
+  byte_buf_alloc(&dec->buf, 4096);
+  gblock_sec_buf_alloc(&dec->secs, 16);
+}
+
+void graph_block_decoder_dealloc(GraphBlockDecoder *dec)
+{
+  byte_buf_dealloc(&dec->buf);
+  gblock_sec_buf_dealloc(&dec->secs);
+  memset(dec, 0, sizeof(*dec));
+}
+
+// Start decoding the kmers of a block from the payload in dec->buf
+void graph_block_decoder_reset(GraphBlockDecoder *dec, uint32_t hdr_nkmers)
+{
+  dec->pos = 0;
+  dec->nkmers = dec->blknkmers = hdr_nkmers & ~GRAPH_BLOCK_FLAGS;
+  dec->colmajor = (hdr_nkmers & GRAPH_BLOCK_COLMAJOR) != 0;
+  dec->deltacov = !dec->colmajor && (hdr_nkmers & GRAPH_BLOCK_DELTACOV);
+  dec->secs_ready = false;
+  dec->kend = dec->buf.len;
+  memset(&dec->prev, 0, sizeof(BinaryKmer));
+}
+
+// Parse the colour table of a colour-major block, returns false if corrupt
+static bool block_load_sections(GraphBlockDecoder *dec, size_t ncols)
+{
+  const size_t len = dec->buf.len;
+  const uint8_t *p, *end;
+  size_t col, pos;
+  uint32_t kbytes, nbytes;
+  uint64_t run;
+
+  if(len < sizeof(uint32_t)) return false;
+  memcpy(&kbytes, dec->buf.b, sizeof(uint32_t));
+  dec->kend = sizeof(uint32_t) + (size_t)kbytes;
+  pos = dec->kend + ncols*sizeof(uint32_t);
+  if(pos > len) return false;
+
+  gblock_sec_buf_reset(&dec->secs);
+
+  for(col = 0; col < ncols; col++) {
+    memcpy(&nbytes, dec->buf.b + dec->kend + col*sizeof(uint32_t),
+           sizeof(uint32_t));
+    if(nbytes > len - pos) return false;
+    if(nbytes > 0) {
+      p = dec->buf.b + pos;
+      end = p + nbytes;
+      if(!varint_read(&p, end, &run) || run >= dec->blknkmers) return false;
+      GraphBlockColSec sec = {.col = col, .pos = p - dec->buf.b,
+                              .end = pos + nbytes, .skip = run};
+      gblock_sec_buf_add(&dec->secs, sec);
+    }
+    pos += nbytes;
+  }
+
+  if(pos != len) return false;
+  dec->pos = sizeof(uint32_t);
+  dec->secs_ready = true;
+  return true;
+}
+
+// Fill in the colours of the next kmer of a colour-major block
+static bool block_decode_cols(GraphBlockDecoder *dec, size_t ncols,
+                              Covg *covgs, Edges *edges)
+{
+  size_t i, row = dec->blknkmers - dec->nkmers;
+  const uint8_t *p, *end;
+  uint64_t x;
+
+  for(i = 0; i < dec->secs.len; i++) {
+    GraphBlockColSec *sec = &dec->secs.b[i];
+    if(sec->skip > 0) { sec->skip--; continue; }
+    if(sec->col >= ncols) return false;
+    p = dec->buf.b + sec->pos;
+    end = dec->buf.b + sec->end;
+    if(!varint_read(&p, end, &x) || x > UINT32_MAX || p == end) return false;
+    covgs[sec->col] = (Covg)x;
+    edges[sec->col] = *(p++);
+    if(row+1 < dec->blknkmers) {
+      if(!varint_read(&p, end, &x) || x > dec->blknkmers-row-1) return false;
+      sec->skip = x;
+    }
+    sec->pos = p - dec->buf.b;
+  }
+
+  return true;
+}
+
+// Returns 1 on success, 0 if no kmers left in the block, -1 if corrupt
+int graph_block_decode(GraphBlockDecoder *dec, size_t ncols,
+                       BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+{
+  if(dec->nkmers == 0) return 0;
+  if(dec->colmajor && !dec->secs_ready && !block_load_sections(dec, ncols))
+    return -1;
+
+  const uint8_t *p = dec->buf.b + dec->pos, *end = dec->buf.b + dec->kend;
+  BinaryKmer delta;
+  uint64_t x;
+  size_t i, col;
+
+  for(i = 0; i < NUM_BKMER_WORDS; i++) {
+    if(!varint_read(&p, end, &x)) return -1;
+    delta.b[i] = x;
+  }
+  *bkmer = dec->prev = bkmer_add(dec->prev, delta);
+
+  if(dec->deltacov) {
+    if(!graph_covg_delta_decode(&p, end, ncols, covgs, edges)) return -1;
+    dec->pos = p - dec->buf.b;
+    dec->nkmers--;
+    return 1;
+  }
+
+  memset(covgs, 0, ncols * sizeof(Covg));
+  memset(edges, 0, ncols * sizeof(Edges));
+
+  if(dec->colmajor) {
+    dec->pos = p - dec->buf.b;
+    if(!block_decode_cols(dec, ncols, covgs, edges)) return -1;
+    dec->nkmers--;
+    return 1;
+  }
+
+  for(col = 0; col < ncols; ) {
+    if(!varint_read(&p, end, &x) || x > ncols-col) return -1;
+    col += x;
+    if(col == ncols) break;
+    if(!varint_read(&p, end, &x) || x > UINT32_MAX || p == end) return -1;
+    covgs[col] = (Covg)x;
+    edges[col] = *(p++);
+    col++;
+  }
+
+  dec->pos = p - dec->buf.b;
+  dec->nkmers--;
+  return 1;
+}
+
+static inline bool pread_all(int fd, void *ptr, size_t n, uint64_t offset)
+{
+  ssize_t r;
+  char *p = ptr;
+  while(n > 0) {
+    r = remote_file_pread_fd(fd, p, n, (off_t)offset);
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) return false;
+    p += r; n -= r; offset += r;
+  }
+  return true;
+}
+
+// Read the trailer at the end of a file
+// Returns true on success, false if the trailer is missing or corrupt
+bool graph_block_read_trailer(int fd, size_t file_size, GraphBlockTrailer *t)
+{
+  uint8_t mem[GRAPH_BLOCK_TRAILER_SIZE];
+  if(file_size < GRAPH_BLOCK_TRAILER_SIZE) return false;
+  if(!pread_all(fd, mem, sizeof(mem), file_size - sizeof(mem))) return false;
+  if(memcmp(mem+3*sizeof(uint64_t), GRAPH_BLOCK_MAGIC,
+            strlen(GRAPH_BLOCK_MAGIC)) != 0) return false;
+  memcpy(&t->nblocks,      mem,                  sizeof(uint64_t));
+  memcpy(&t->nkmers,       mem+sizeof(uint64_t), sizeof(uint64_t));
+  memcpy(&t->index_offset, mem+2*sizeof(uint64_t), sizeof(uint64_t));
+  size_t entsize = sizeof(BinaryKmer)+2*sizeof(uint64_t);
+  return (t->index_offset + t->nblocks*entsize + sizeof(mem) == file_size);
+}
+
+// Load the block index into `index`, returns true on success
+bool graph_block_read_index(int fd, const GraphBlockTrailer *t,
+                            GraphBlockBuffer *index)
+{
+  size_t i, entsize = sizeof(BinaryKmer)+2*sizeof(uint64_t);
+  size_t nbytes = t->nblocks * entsize;
+  uint8_t *mem = ctx_malloc(nbytes ? nbytes : 1);
+  bool success = pread_all(fd, mem, nbytes, t->index_offset);
+
+  if(success) {
+    gblock_buf_reset(index);
+    gblock_buf_capacity(index, t->nblocks);
+    for(i = 0; i < t->nblocks; i++) {
+      GraphBlockEntry *e = &index->b[i];
+      memcpy(e->first.b, mem+i*entsize, sizeof(BinaryKmer));
+      memcpy(&e->offset, mem+i*entsize+sizeof(BinaryKmer), sizeof(uint64_t));
+      memcpy(&e->kmer_offset, mem+i*entsize+sizeof(BinaryKmer)+sizeof(uint64_t),
+             sizeof(uint64_t));
+    }
+    index->len = t->nblocks;
+  }
+
+  ctx_free(mem);
+  return success;
+}
+
+// Load a block from file offset `offset` into `dec` ready for decoding
+// Returns number of kmers in the block or -1 on error
+int64_t graph_block_pread(int fd, uint64_t offset, GraphBlockDecoder *dec)
+{
+  uint32_t fields[2];
+  if(!pread_all(fd, fields, sizeof(fields), offset)) return -1;
+  byte_buf_capacity(&dec->buf, fields[0]);
+  if(!pread_all(fd, dec->buf.b, fields[0], offset+sizeof(fields))) return -1;
+  dec->buf.len = fields[0];
+  graph_block_decoder_reset(dec, fields[1]);
+  return dec->nkmers;
+}
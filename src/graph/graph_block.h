@@ -0,0 +1,181 @@
+#ifndef GRAPH_BLOCK_H_
+#define GRAPH_BLOCK_H_
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+#include "common_buffers.h"
+
+//
+// Block compressed graph file records (graph file format version 7)
+//
+// After the usual graph header, kmers are stored in blocks of up to
+// GRAPH_BLOCK_NKMERS kmers:
+//
+//   <uint32_t:nbytes><uint32_t:nkmers><payload:nbytes>
+//
+// Each kmer in the payload is stored as the difference from the previous kmer
+// in the block (first kmer is relative to zero), one varint per word, most
+// significant word first. Sorted kmers therefore usually take 2-3 bytes.
+// Colours are stored as <varint:run of empty colours>[<varint:covg><edges>]
+// repeated until all colours are accounted for, so empty colours are nearly
+// free. Blocks are followed by an end marker (a block with zero kmers), then
+// an index of the first kmer and file offset of each block and a trailer:
+//
+//   <uint64_t:nblocks><uint64_t:nkmers><uint64_t:index offset>"CTXBLKIX"
+//
+// Kmers do not need to be sorted, but graph_search requires sorted files.
+//
+// Colour-major blocks have GRAPH_BLOCK_COLMAJOR set in nkmers and store each
+// colour separately, so that loading a few colours of a wide file can skip the
+// rest without reading them:
+//
+//   <uint32_t:kmer bytes><kmer deltas><ncols x uint32_t:colour bytes>
+//   <colour sections>
+//
+// A colour section is <varint:run of kmers missing from the colour>
+// [<varint:covg><edges>] repeated until all kmers in the block are accounted
+// for. Colours with no kmers in the block have an empty section.
+//
+// Delta coverage blocks have GRAPH_BLOCK_DELTACOV set in nkmers and suit
+// related samples (e.g. trios or clonal cohorts) whose coverages move
+// together. After its kmer delta, each kmer stores:
+//
+//   <varint:base covg>
+//   per group of GRAPH_COVG_DELTA_GROUP colours:
+//     <uint8_t:bits w><ceil(n*w/8) bytes:n zigzag deltas of w bits>
+//   <uint8_t:base edges><ceil(ncols/8) bytes:colours with other edges>
+//   <uint8_t:edges> for each colour marked
+//
+// The base coverage is the mean over colours. Deltas from the base are
+// zigzag encoded (0,-1,1,-2.. => 0,1,2,3..) and bit packed, least significant
+// first, with one width per group. A group with w=0 has every colour at the
+// base. The base edges are those of the first colour. Coverages of a kmer are
+// always decoded as a whole vector.
+//
+
+#define GRAPH_BLOCK_NKMERS 1024
+#define GRAPH_BLOCK_HDR_SIZE (2*sizeof(uint32_t))
+#define GRAPH_BLOCK_MAGIC "CTXBLKIX"
+#define GRAPH_BLOCK_TRAILER_SIZE (3*sizeof(uint64_t)+strlen(GRAPH_BLOCK_MAGIC))
+#define GRAPH_BLOCK_COLMAJOR (1U<<31)
+#define GRAPH_BLOCK_DELTACOV (1U<<30)
+#define GRAPH_BLOCK_FLAGS (GRAPH_BLOCK_COLMAJOR|GRAPH_BLOCK_DELTACOV)
+#define GRAPH_COVG_DELTA_GROUP 8
+
+typedef struct
+{
+  BinaryKmer first; // first kmer in the block
+  uint64_t offset, kmer_offset; // file offset of block, index of first kmer
+} GraphBlockEntry;
+
+#include "madcrowlib/madcrow_buffer.h"
+madcrow_buffer(gblock_buf, GraphBlockBuffer, GraphBlockEntry);
+
+typedef struct
+{
+  uint64_t nblocks, nkmers, index_offset;
+} GraphBlockTrailer;
+
+typedef struct
+{
+  FILE *fh;
+  size_t ncols;
+  ByteBuffer buf; // current block payload (kmer deltas if colmajor)
+  size_t blknkmers; // number of kmers in the current block
+  BinaryKmer prev;
+  uint64_t offset, nkmers; // file offset of current block, kmers written
+  GraphBlockBuffer index;
+  bool deltacov; // delta coverage blocks
+  // Colour-major blocks only: coverages and edges of the current block
+  // [kmer*ncols+col] and the encoded colour sections
+  bool colmajor;
+  Covg *blkcovgs;
+  Edges *blkedges;
+  ByteBuffer colbuf;
+} GraphBlockWriter;
+
+// Position in a colour section of a colour-major block
+typedef struct
+{
+  size_t col, pos, end;
+  size_t skip; // number of kmers before the next one in this colour
+} GraphBlockColSec;
+
+madcrow_buffer(gblock_sec_buf, GraphBlockSecBuffer, GraphBlockColSec);
+
+typedef struct
+{
+  ByteBuffer buf; // block payload
+  size_t pos, nkmers; // read position, kmers left to decode
+  BinaryKmer prev;
+  bool deltacov; // delta coverage block
+  // Colour-major blocks only
+  bool colmajor, secs_ready;
+  size_t blknkmers, kend; // kmers in the block, end of kmer deltas
+  GraphBlockSecBuffer secs; // non-empty colour sections
+} GraphBlockDecoder;
+
+//
+// Delta coverage encoding of one kmer, also usable for keeping the colours of
+// related samples packed in memory
+//
+
+// Append coverages and edges of `ncols` colours to `buf`
+void graph_covg_delta_encode(ByteBuffer *buf, const Covg *covgs,
+                             const Edges *edges, size_t ncols);
+
+// Decode all `ncols` coverages and edges from `*ptr`, advancing it
+// Returns false if we run past `end` or the input is corrupt
+bool graph_covg_delta_decode(const uint8_t **ptr, const uint8_t *end,
+                             size_t ncols, Covg *covgs, Edges *edges);
+
+//
+// Writing
+//
+
+// `offset` is the file position of the first block (i.e. header size)
+// `layout` is 0 for the default layout, GRAPH_BLOCK_COLMAJOR for colour-major
+// blocks or GRAPH_BLOCK_DELTACOV for delta coverage blocks
+void graph_block_writer_alloc(GraphBlockWriter *wtr, FILE *fh, size_t ncols,
+                              size_t offset, uint32_t layout);
+void graph_block_writer_dealloc(GraphBlockWriter *wtr);
+
+void graph_block_writer_add(GraphBlockWriter *wtr, BinaryKmer bkmer,
+                            const Covg *covgs, const Edges *edges);
+
+// Write last block, end marker, index and trailer
+// Returns number of bytes written since graph_block_writer_alloc()
+size_t graph_block_writer_finish(GraphBlockWriter *wtr);
+
+//
+// Reading
+//
+
+void graph_block_decoder_alloc(GraphBlockDecoder *dec);
+void graph_block_decoder_dealloc(GraphBlockDecoder *dec);
+
+// Start decoding `nkmers` kmers from the payload in dec->buf
+// `hdr_nkmers` is the number of kmers field of the block header, which may have
+// GRAPH_BLOCK_COLMAJOR or GRAPH_BLOCK_DELTACOV set
+void graph_block_decoder_reset(GraphBlockDecoder *dec, uint32_t hdr_nkmers);
+
+// Returns 1 on success, 0 if no kmers left in the block, -1 if corrupt
+// Colours with empty sections in colour-major blocks are returned as zero
+int graph_block_decode(GraphBlockDecoder *dec, size_t ncols,
+                       BinaryKmer *bkmer, Covg *covgs, Edges *edges);
+
+// Descriptors below may be from graph_file_fileno(), including remote streams
+
+// Read the trailer at the end of a file
+// Returns true on success, false if the trailer is missing or corrupt
+bool graph_block_read_trailer(int fd, size_t file_size, GraphBlockTrailer *t);
+
+// Load the block index into `index`, returns true on success
+bool graph_block_read_index(int fd, const GraphBlockTrailer *t,
+                            GraphBlockBuffer *index);
+
+// Load a block from file offset `offset` into `dec` ready for decoding
+// Returns number of kmers in the block or -1 on error
+int64_t graph_block_pread(int fd, uint64_t offset, GraphBlockDecoder *dec);
+
+#endif /* GRAPH_BLOCK_H_ */
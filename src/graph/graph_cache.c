@@ -13,19 +13,26 @@
 // Warning: not thread safe! Do not use the same GraphCache in more than one
 //          thread at the same time.
 
+#define GC_N2U_INIT_SIZE 1024
+
 void graph_cache_alloc(GraphCache *cache, const dBGraph *db_graph)
 {
   db_node_buf_alloc(&cache->node_buf, 1024);
   cache_unitig_buf_alloc(&cache->unitig_buf, 1024);
   cache_step_buf_alloc(&cache->step_buf, 1024);
   cache_path_buf_alloc(&cache->path_buf, 1024);
-  cache->node2unitig = kh_init(Node2Unitig);
+  cache->node2unitig = ctx_calloc(GC_N2U_INIT_SIZE, sizeof(GCacheNodeEntry));
+  cache->n2u_size = GC_N2U_INIT_SIZE;
+  cache->n2u_len = 0;
+  cache->epoch = 1; // calloc'd entries have epoch 0 => empty
+  gc_map_alloc(&cache->dupes);
   cache->db_graph = db_graph;
 }
 
 void graph_cache_dealloc(GraphCache *cache)
 {
-  kh_destroy(Node2Unitig, cache->node2unitig);
+  ctx_free(cache->node2unitig);
+  gc_map_dealloc(&cache->dupes);
   db_node_buf_dealloc(&cache->node_buf);
   cache_unitig_buf_dealloc(&cache->unitig_buf);
   cache_step_buf_dealloc(&cache->step_buf);
@@ -34,17 +41,120 @@ void graph_cache_dealloc(GraphCache *cache)
 
 void graph_cache_reset(GraphCache *cache)
 {
-  kh_clear(Node2Unitig, cache->node2unitig);
+  // Start a new epoch, only clearing the table when the epoch wraps around
+  if(++cache->epoch == 0) {
+    memset(cache->node2unitig, 0, cache->n2u_size * sizeof(GCacheNodeEntry));
+    cache->epoch = 1;
+  }
+  cache->n2u_len = 0;
   db_node_buf_reset(&cache->node_buf);
   cache_unitig_buf_reset(&cache->unitig_buf);
   cache_step_buf_reset(&cache->step_buf);
   cache_path_buf_reset(&cache->path_buf);
 }
 
+//
+// uint32_t -> uint32_t map
+//
+
+#define GC_MAP_INIT_SIZE 64
+
+void gc_map_alloc(GCacheMap *map)
+{
+  map->b = ctx_calloc(GC_MAP_INIT_SIZE, sizeof(GCacheMapEntry));
+  map->size = GC_MAP_INIT_SIZE;
+  map->epoch = 0; // first reset moves to epoch 1, calloc'd entries are empty
+}
+
+void gc_map_dealloc(GCacheMap *map)
+{
+  ctx_free(map->b);
+  memset(map, 0, sizeof(*map));
+}
+
+void gc_map_reset(GCacheMap *map, size_t nkeys)
+{
+  size_t size = map->size;
+  while(2*nkeys > size) size *= 2;
+
+  if(size > map->size) {
+    ctx_free(map->b);
+    map->b = ctx_calloc(size, sizeof(GCacheMapEntry));
+    map->size = size;
+    map->epoch = 1;
+  }
+  else if(++map->epoch == 0) {
+    memset(map->b, 0, map->size * sizeof(GCacheMapEntry));
+    map->epoch = 1;
+  }
+}
+
+//
+// Node -> unitig map
+//
+
+#define gc_n2u_key(node) (((uint64_t)(node).key << 1) | (node).orient)
+
+// Returns entry for `node` if found, otherwise the empty entry to put it in
+static inline GCacheNodeEntry* gc_n2u_find(const GraphCache *cache,
+                                           dBNode node)
+{
+  const uint64_t key = gc_n2u_key(node);
+  const size_t mask = cache->n2u_size - 1;
+  size_t i = db_node_hash(node) & mask;
+  GCacheNodeEntry *e;
+
+  for(e = &cache->node2unitig[i]; e->epoch == cache->epoch;
+      i = (i+1) & mask, e = &cache->node2unitig[i])
+  {
+    if(e->node == key) break;
+  }
+
+  return e;
+}
+
+// Double the table, keeping only entries in the current epoch
+static void gc_n2u_grow(GraphCache *cache)
+{
+  GCacheNodeEntry *old = cache->node2unitig, *e;
+  size_t i, old_size = cache->n2u_size;
+
+  cache->n2u_size *= 2;
+  cache->node2unitig = ctx_calloc(cache->n2u_size, sizeof(GCacheNodeEntry));
+
+  for(i = 0; i < old_size; i++) {
+    if(old[i].epoch == cache->epoch) {
+      dBNode node = {.key = old[i].node >> 1, .orient = old[i].node & 1};
+      e = gc_n2u_find(cache, node);
+      *e = old[i];
+    }
+  }
+
+  ctx_free(old);
+}
+
+// Returns true if `node` was already in the map, otherwise adds it
+// mapping to `unitigid`. Sets `unitigid` to the unitig found or added.
+static inline bool gc_n2u_put(GraphCache *cache, dBNode node,
+                              uint32_t *unitigid)
+{
+  // Keep load below 1/2, leaving space for the other end of a new unitig
+  if(2*(cache->n2u_len+2) > cache->n2u_size) gc_n2u_grow(cache);
+
+  GCacheNodeEntry *e = gc_n2u_find(cache, node);
+  if(e->epoch == cache->epoch) { *unitigid = e->unitigid; return true; }
+
+  *e = (GCacheNodeEntry){.node = gc_n2u_key(node), .unitigid = *unitigid,
+                         .epoch = cache->epoch};
+  cache->n2u_len++;
+  return false;
+}
+
 // Returns pathid
 const GCachePath* graph_cache_new_path(GraphCache *cache)
 {
-  GCachePath path = {.first_step = cache->step_buf.len, .num_steps = 0};
+  GCachePath path = {.first_step = cache->step_buf.len, .num_steps = 0,
+                     .hash = 0};
   uint32_t pid = cache_path_buf_add(&cache->path_buf, path);
   return cache->path_buf.b + pid;
 }
@@ -133,25 +243,21 @@ const GCacheStep* graph_cache_new_step(GraphCache *cache, dBNode node)
   GCachePath *path = graph_cache_path(cache, pathid);
 
   // Find or add unitig beginning with given node
-  uint32_t unitigid;
-  int hashret;
-  khiter_t k = kh_put(Node2Unitig, cache->node2unitig, node, &hashret);
-  bool unitig_already_exists = (hashret == 0);
+  uint32_t unitigid = cache->unitig_buf.len;
+  bool unitig_already_exists = gc_n2u_put(cache, node, &unitigid);
 
-  if(unitig_already_exists) {
-    unitigid = kh_value(cache->node2unitig, k);
-  }
-  else {
+  if(!unitig_already_exists) {
     // Create unitig
     GCacheUnitig tmp_unitig;
     gc_create_unitig(cache, node, &tmp_unitig);
-    unitigid = cache_unitig_buf_add(&cache->unitig_buf, tmp_unitig);
-    kh_value(cache->node2unitig, k) = unitigid;
+    cache_unitig_buf_add(&cache->unitig_buf, tmp_unitig);
 
     // Get node at other end
     dBNode end_node = get_node_at_unitig_end(cache, &tmp_unitig, node);
-    k = kh_put(Node2Unitig, cache->node2unitig, end_node, &hashret);
-    kh_value(cache->node2unitig, k) = unitigid;
+    GCacheNodeEntry *e = gc_n2u_find(cache, end_node);
+    cache->n2u_len += (e->epoch != cache->epoch);
+    *e = (GCacheNodeEntry){.node = gc_n2u_key(end_node), .unitigid = unitigid,
+                           .epoch = cache->epoch};
   }
 
   GCacheUnitig *unitig = graph_cache_unitig(cache, unitigid);
@@ -159,9 +265,13 @@ const GCacheStep* graph_cache_new_step(GraphCache *cache, dBNode node)
   // Get orient
   Orientation unitig_orient = gc_unitig_get_orient(cache, unitig, node);
 
-  // New step
+  // New step, extending the path's hash
+  uint32_t word = ((uint32_t)unitigid << 1) | unitig_orient;
+  path->hash = gc_hash32(path->hash * 0x9e3779b1u + word + 1);
+
   GCacheStep next = {.orient = unitig_orient, .unitigid = unitigid,
-                     .pathid = pathid, .next_step = unitig->stepid};
+                     .pathid = pathid, .next_step = unitig->stepid,
+                     .hash = path->hash};
   uint32_t stepid = cache_step_buf_push(&cache->step_buf, &next, 1);
 
   // Add link from prev unitig step
@@ -174,15 +284,8 @@ const GCacheStep* graph_cache_new_step(GraphCache *cache, dBNode node)
 // Returns NULL if not found
 GCacheUnitig* graph_cache_find_unitig(GraphCache *cache, dBNode node)
 {
-  uint32_t unitigid;
-  khiter_t k = kh_get(Node2Unitig, cache->node2unitig, node);
-  bool is_missing = (k == kh_end(cache->node2unitig));
-
-  if(!is_missing) {
-    unitigid = kh_value(cache->node2unitig, k);
-    return graph_cache_unitig(cache, unitigid);
-  }
-
+  const GCacheNodeEntry *e = gc_n2u_find(cache, node);
+  if(e->epoch == cache->epoch) return graph_cache_unitig(cache, e->unitigid);
   return NULL;
 }
 
@@ -325,6 +428,10 @@ int graph_cache_pathids_cmp(const void *aa, const void *bb, void *arg)
 bool graph_cache_pathids_are_equal(GraphCache *cache,
                                    uint32_t pathid0, uint32_t pathid1)
 {
+  const GCachePath *path0 = graph_cache_path(cache, pathid0);
+  const GCachePath *path1 = graph_cache_path(cache, pathid1);
+  if(path0->num_steps != path1->num_steps || path0->hash != path1->hash)
+    return false;
   return graph_cache_pathids_cmp(&pathid0, &pathid1, cache) == 0;
 }
 
@@ -385,17 +492,28 @@ size_t graph_cache_remove_dupes(GraphCache *cache,
                                 GCacheStep **steps, size_t num_steps)
 {
   size_t i, j;
+  GCacheMap *map = &cache->dupes;
+  GCacheMapEntry *e;
+  uint32_t hash;
 
   if(num_steps <= 1) return num_steps;
 
-  graph_cache_steps_qsort(cache, steps, num_steps);
+  // Keep the first of each path, map holds hash -> index of kept step
+  gc_map_reset(map, num_steps);
 
-  for(i = j = 0; i+1 < num_steps; i++) {
-    if(graph_cache_steps_cmp(steps[i], steps[i+1], cache) != 0)
+  for(i = j = 0; i < num_steps; i++) {
+    hash = steps[i]->hash;
+    for(e = gc_map_start(map, hash); gc_map_used(map, e); e = gc_map_next(map, e))
+      if(e->key == hash &&
+         graph_cache_steps_cmp(steps[i], steps[e->value], cache) == 0) break;
+    if(!gc_map_used(map, e)) {
+      gc_map_set(map, e, hash, j);
       steps[j++] = steps[i];
+    }
   }
 
-  steps[j++] = steps[i];
+  // Paths are reported in sorted order
+  graph_cache_steps_qsort(cache, steps, j);
   return j;
 }
 
@@ -1,7 +1,6 @@
 #ifndef GRAPH_CACHE_H_
 #define GRAPH_CACHE_H_
 
-#include "htslib/khash.h"
 #include "db_node.h"
 
 // Build and store paths through the graph
@@ -32,12 +31,14 @@ typedef struct
   const uint32_t unitigid:31, orient:1;
   const uint32_t pathid; // path that this step belongs to
   uint32_t next_step; // linked list of steps that visit this unitig
+  const uint32_t hash; // hash of the path up to and including this step
 } GCacheStep;
 
 typedef struct
 {
   const uint32_t first_step;
   uint32_t num_steps;
+  uint32_t hash; // rolling hash of the steps, updated as steps are added
 } GCachePath;
 
 #include "madcrowlib/madcrow_buffer.h"
@@ -45,17 +46,94 @@ madcrow_buffer(cache_unitig_buf, GCacheUnitigBuffer, GCacheUnitig);
 madcrow_buffer(cache_step_buf,   GCacheStepBuffer,   GCacheStep);
 madcrow_buffer(cache_path_buf,   GCachePathBuffer,   GCachePath);
 
-KHASH_INIT(Node2Unitig, dBNode, uint32_t, 1, db_node_hash, db_nodes_are_equal)
+// Open addressing hash map uint32_t -> uint32_t, linear probing.
+// Entries from before the last gc_map_reset() have an old epoch and count as
+// empty, so a map is reused without clearing it. Load is kept below 1/2 by
+// gc_map_reset(), which must be told how many keys will be added.
+typedef struct
+{
+  uint32_t key, value, epoch;
+} GCacheMapEntry;
 
 typedef struct
 {
+  GCacheMapEntry *b;
+  size_t size; // power of two
+  uint32_t epoch;
+} GCacheMap;
+
+void gc_map_alloc(GCacheMap *map);
+void gc_map_dealloc(GCacheMap *map);
+
+// Empty the map, making space for `nkeys` keys
+void gc_map_reset(GCacheMap *map, size_t nkeys);
+
+// MurmurHash3 finalizer
+static inline uint32_t gc_hash32(uint32_t h)
+{
+  h ^= h >> 16; h *= 0x85ebca6b;
+  h ^= h >> 13; h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+// First entry to probe for `key`
+static inline GCacheMapEntry* gc_map_start(const GCacheMap *map, uint32_t key)
+{
+  return map->b + (gc_hash32(key) & (map->size - 1));
+}
+
+// Next entry to probe
+static inline GCacheMapEntry* gc_map_next(const GCacheMap *map,
+                                          const GCacheMapEntry *e)
+{
+  return e+1 == map->b + map->size ? map->b : (GCacheMapEntry*)e+1;
+}
+
+static inline bool gc_map_used(const GCacheMap *map, const GCacheMapEntry *e)
+{
+  return e->epoch == map->epoch;
+}
+
+static inline void gc_map_set(const GCacheMap *map, GCacheMapEntry *e,
+                              uint32_t key, uint32_t value)
+{
+  *e = (GCacheMapEntry){.key = key, .value = value, .epoch = map->epoch};
+}
+
+// Returns entry for `key` if found, otherwise the empty entry to put it in
+static inline GCacheMapEntry* gc_map_find(const GCacheMap *map, uint32_t key)
+{
+  GCacheMapEntry *e = gc_map_start(map, key);
+  while(gc_map_used(map, e) && e->key != key) e = gc_map_next(map, e);
+  return e;
+}
+
+// Entry in the node -> unitig map, only valid if epoch matches the cache
+typedef struct
+{
+  uint64_t node; // hkey << 1 | orient
+  uint32_t unitigid, epoch;
+} GCacheNodeEntry;
+
+typedef struct
+{
+  // Buffers are reset but never shrink, so after the first few forks
+  // no more memory is allocated
   dBNodeBuffer       node_buf;
   GCacheUnitigBuffer unitig_buf;
   GCacheStepBuffer   step_buf;
   GCachePathBuffer   path_buf;
 
-  // hash map dBNode->uint32_t (unitig_id)
-  khash_t(Node2Unitig) *node2unitig;
+  // Open addressing hash map dBNode->uint32_t (unitig_id), linear probing.
+  // Entries from before the last reset have an old epoch and count as empty,
+  // so graph_cache_reset() does not have to touch the table.
+  GCacheNodeEntry *node2unitig;
+  size_t n2u_size, n2u_len; // size is a power of two
+  uint32_t epoch;
+
+  // path hash -> index into list of steps, for graph_cache_remove_dupes()
+  GCacheMap dupes;
 
   const dBGraph *db_graph;
 } GraphCache;
@@ -210,6 +288,7 @@ int graph_cache_steps_cmp(const GCacheStep *a, const GCacheStep *b,
 
 void graph_cache_steps_qsort(GraphCache *cache, GCacheStep **list, size_t n);
 
+// Paths with different lengths or hashes are unequal without comparing steps
 bool graph_cache_pathids_are_equal(GraphCache *cache,
                                    uint32_t pathid0, uint32_t pathid1);
 
@@ -221,7 +300,8 @@ bool graph_cache_pathids_are_equal(GraphCache *cache,
 bool graph_cache_is_3p_flank(GraphCache *cache,
                              GCacheStep ** steps, size_t num_steps);
 
-// Remove duplicate paths
+// Remove duplicate paths (up to and including each step), then sort them.
+// Duplicates are found by hash, only paths with equal hashes are compared.
 size_t graph_cache_remove_dupes(GraphCache *cache,
                                 GCacheStep **steps, size_t num_steps);
 
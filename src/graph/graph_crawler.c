@@ -18,20 +18,14 @@ static inline void walk_unitig_end(const GraphCache *cache,
   }
 }
 
-/**
- * Constructs a path of unitigs (GCachePath)
- * @param wlk GraphWalker should be set to go at `node`
- * @param rptwlk RepeatWalker should be clear
- * @param jmpfunc is called with each unitig traversed and if it returns true
-                  we continue crawling, otherwise we stop.
-                  If NULL assume always true
- * @return pathid in GraphCache
- */
-uint32_t graph_crawler_load_path(GraphCache *cache, dBNode node,
-                                 GraphWalker *wlk, RepeatWalker *rptwlk,
-                                 bool (*jmpfunc)(const GraphCache *_c,
-                                                 const GCacheStep *_s, void *_a),
-                                 void *arg)
+// Reason a walk stopped
+typedef enum {GCRAWL_JMPFUNC, GCRAWL_NO_CHOICE, GCRAWL_REPEAT} GCrawlEnd;
+
+static uint32_t gcrawler_load_path(GraphCache *cache, dBNode node,
+                                   GraphWalker *wlk, RepeatWalker *rptwlk,
+                                   bool (*jmpfunc)(const GraphCache *_c,
+                                                   const GCacheStep *_s, void *_a),
+                                   void *arg, GCrawlEnd *end)
 {
   size_t i;
   const GCachePath *path = graph_cache_new_path(cache);
@@ -46,7 +40,10 @@ uint32_t graph_crawler_load_path(GraphCache *cache, dBNode node,
     // Traverse to the end of the unitig
     walk_unitig_end(cache, unitig, step->orient, wlk);
 
-    if(jmpfunc != NULL && !jmpfunc(cache, step, arg)) break;
+    if(jmpfunc != NULL && !jmpfunc(cache, step, arg)) {
+      *end = GCRAWL_JMPFUNC;
+      break;
+    }
 
     // Find next node
     uint8_t num_edges;
@@ -65,8 +62,14 @@ uint32_t graph_crawler_load_path(GraphCache *cache, dBNode node,
     }
 
     // Traverse to next unitig
-    if(!graph_walker_next_nodes(wlk, num_edges, next_nodes, next_bases) ||
-       !rpt_walker_attempt_traverse(rptwlk, wlk)) break;
+    if(!graph_walker_next_nodes(wlk, num_edges, next_nodes, next_bases)) {
+      *end = GCRAWL_NO_CHOICE;
+      break;
+    }
+    if(!rpt_walker_attempt_traverse(rptwlk, wlk)) {
+      *end = GCRAWL_REPEAT;
+      break;
+    }
 
     node = wlk->node;
   }
@@ -74,6 +77,25 @@ uint32_t graph_crawler_load_path(GraphCache *cache, dBNode node,
   return graph_cache_path_id(cache, path);
 }
 
+/**
+ * Constructs a path of unitigs (GCachePath)
+ * @param wlk GraphWalker should be set to go at `node`
+ * @param rptwlk RepeatWalker should be clear
+ * @param jmpfunc is called with each unitig traversed and if it returns true
+                  we continue crawling, otherwise we stop.
+                  If NULL assume always true
+ * @return pathid in GraphCache
+ */
+uint32_t graph_crawler_load_path(GraphCache *cache, dBNode node,
+                                 GraphWalker *wlk, RepeatWalker *rptwlk,
+                                 bool (*jmpfunc)(const GraphCache *_c,
+                                                 const GCacheStep *_s, void *_a),
+                                 void *arg)
+{
+  GCrawlEnd end;
+  return gcrawler_load_path(cache, node, wlk, rptwlk, jmpfunc, arg, &end);
+}
+
 /**
  * Constructs a path of unitigs (GCachePath)
  * @param wlk GraphWalker should be set to go at `node`
@@ -125,12 +147,15 @@ void graph_crawler_alloc(GraphCrawler *crawler, const dBGraph *db_graph)
   GCMultiColPath *multicol_paths = ctx_calloc(ncols, sizeof(GCMultiColPath));
   GCUniColPath *unicol_paths = ctx_calloc(ncols, sizeof(GCUniColPath));
   uint32_t *col_list = ctx_calloc(ncols, sizeof(uint32_t));
+  uint64_t *colsets = ctx_calloc(5 * db_node_colset_words(ncols), sizeof(uint64_t));
 
   GraphCrawler tmp = {.num_paths = 0,
+                      .union_crawl = true,
                       .col_paths = col_paths,
                       .multicol_paths = multicol_paths,
                       .unicol_paths = unicol_paths,
-                      .col_list = col_list};
+                      .col_list = col_list,
+                      .colsets = colsets};
 
   memcpy(crawler, &tmp, sizeof(GraphCrawler));
 
@@ -145,6 +170,12 @@ void graph_crawler_dealloc(GraphCrawler *crawler)
   ctx_free(crawler->multicol_paths);
   ctx_free(crawler->unicol_paths);
   ctx_free(crawler->col_list);
+  ctx_free(crawler->colsets);
+  if(crawler->col_starts != NULL) {
+    size_t i, ncols = crawler->cache.db_graph->num_of_cols;
+    for(i = 0; i < ncols; i++) graph_walker_state_dealloc(&crawler->col_starts[i]);
+    ctx_free(crawler->col_starts);
+  }
   graph_cache_dealloc(&crawler->cache);
   graph_walker_dealloc(&crawler->wlk);
   rpt_walker_dealloc(&crawler->rptwlk);
@@ -159,6 +190,105 @@ static inline int unicol_path_cmp(const void *aa, const void *bb, void *arg)
   return graph_cache_pathids_cmp(&a->pathid, &b->pathid, cache);
 }
 
+// Without links, the choice a colour makes at the end of a unitig only depends
+// on which of the next nodes are in that colour (see graph_walker_choose())
+// Returns index of the next node taken or -1 if the walk stops
+static inline int gcrawler_col_choose(const dBGraph *db_graph, size_t col,
+                                      size_t num_next, const dBNode *next_nodes)
+{
+  if(num_next <= 1) return (int)num_next - 1;
+
+  int i, idx = -1;
+  for(i = 0; i < (int)num_next; i++) {
+    if(db_node_has_col(db_graph, next_nodes[i].key, col)) {
+      if(idx >= 0) return -1;
+      idx = i;
+    }
+  }
+  return idx;
+}
+
+/**
+ * Check if walking colour `col` from the start of path `pathid` would build
+ * the same path, using only the colour bitsets at the end of each unitig.
+ * Only valid when no links are loaded.
+ * @param end is the reason the walk that built the path stopped
+ * @param end_node is the node the walk was rejected at if end is GCRAWL_REPEAT
+ */
+static bool gcrawler_col_takes_path(const GraphCache *cache, uint32_t pathid,
+                                    size_t col, GCrawlEnd end, dBNode end_node)
+{
+  const dBGraph *db_graph = cache->db_graph;
+  const GCachePath *path = graph_cache_path(cache, pathid);
+  const GCacheStep *step = gc_path_first_step(cache, path);
+  const GCacheStep *last = gc_path_last_step(cache, path);
+  const GCacheUnitig *unitig;
+  const dBNode *next_nodes;
+  dBNode node;
+  size_t num_next;
+  int idx;
+
+  for(; ; step++)
+  {
+    // jmpfunc only depends on the path so far
+    if(step == last && end == GCRAWL_JMPFUNC) return true;
+
+    unitig = gc_step_get_unitig(cache, step);
+    if(step->orient == FORWARD) {
+      num_next = unitig->num_next;
+      next_nodes = unitig->next_nodes;
+    } else {
+      num_next = unitig->num_prev;
+      next_nodes = unitig->prev_nodes;
+    }
+
+    idx = gcrawler_col_choose(db_graph, col, num_next, next_nodes);
+    if(step == last) break;
+    if(idx < 0) return false;
+
+    // Must take the same next unitig in the same orientation
+    unitig = gc_step_get_unitig(cache, step+1);
+    node = db_nodes_get(gc_unitig_get_nodes(cache, unitig), unitig->num_nodes,
+                        step[1].orient == FORWARD, 0);
+    if(!db_nodes_are_equal(next_nodes[idx], node)) return false;
+  }
+
+  if(end == GCRAWL_NO_CHOICE) return (idx < 0);
+  return (idx >= 0 && db_nodes_are_equal(next_nodes[idx], end_node));
+}
+
+// Start the walker at node0 in colour `col`. With links, the paths picked up
+// at node0 are saved so that crawling another branch from the same fork
+// restores them rather than picking them up again.
+static inline void gcrawler_walker_start(GraphCrawler *crawler, dBNode node0,
+                                         size_t col)
+{
+  GraphWalker *wlk = &crawler->wlk;
+  const dBGraph *db_graph = wlk->db_graph;
+  size_t i;
+
+  if(!gpath_store_use_traverse(&db_graph->gpstore)) {
+    graph_walker_start(wlk, node0);
+    return;
+  }
+
+  if(crawler->col_starts == NULL) {
+    crawler->col_starts = ctx_calloc(db_graph->num_of_cols,
+                                     sizeof(GraphWalkerState));
+    for(i = 0; i < db_graph->num_of_cols; i++)
+      graph_walker_state_alloc(&crawler->col_starts[i]);
+  }
+
+  GraphWalkerState *state = &crawler->col_starts[col];
+
+  if(db_nodes_are_equal(state->node, node0)) {
+    graph_walker_restore(wlk, state);
+  } else {
+    graph_walker_start(wlk, node0);
+    graph_walker_save(wlk, state);
+  }
+}
+
 /**
  * @param node1 should be the first node of a unitig
  * @param node0 should be the previous node
@@ -187,42 +317,88 @@ void graph_crawler_fetch(GraphCrawler *crawler, dBNode node0,
   ctx_assert(!db_nodes_are_equal(node0, next_nodes[take_idx]));
 
   // Fetch all paths in all colours
-  dBNode node1 = next_nodes[take_idx];
+  dBNode node1 = next_nodes[take_idx], end_node;
   bool is_fork;
-  size_t i, c, col, nedges_cols, num_unicol_paths = 0;
-  int pathid;
+  size_t i, j, c, w, col, nedges_cols, npending = 0, num_unicol_paths = 0;
+  uint32_t *pending = crawler->col_list; // filled with paths at the end
+  uint32_t pathid;
+  uint64_t bits;
+  GCrawlEnd end;
+
+  // Colours of node0 and each next node, read once rather than per colour
+  const size_t nwords = db_node_colset_words(db_graph->num_of_cols);
+  uint64_t *colset0 = crawler->colsets, *next_colsets = colset0 + nwords;
+  const uint64_t *colset1 = next_colsets + take_idx*nwords;
+
+  db_node_get_colset(db_graph, node0.key, colset0);
+  for(i = 0; i < num_next; i++)
+    db_node_get_colset(db_graph, next_nodes[i].key, next_colsets + i*nwords);
+
+  // Without links a walk only depends on colour membership, so colours that
+  // take the same path are found from the colour bitsets instead of walking
+  // each one: the union graph is explored once per distinct path
+  bool union_crawl = crawler->union_crawl &&
+                     !gpath_store_use_traverse(&db_graph->gpstore);
 
   for(c = 0; c < ncols; c++)
+    crawler->col_paths[cols != NULL ? cols[c] : c] = -1;
+
+  // Colours with both node0 and node1
+  if(cols == NULL) {
+    for(w = 0; w < nwords; w++) {
+      for(bits = colset0[w] & colset1[w]; bits; bits &= bits-1) {
+        col = w*64 + __builtin_ctzll(bits);
+        if(col < ncols) pending[npending++] = col;
+      }
+    }
+  }
+  else {
+    for(c = 0; c < ncols; c++) {
+      col = cols[c];
+      if(db_node_colset_has(colset0, col) && db_node_colset_has(colset1, col))
+        pending[npending++] = col;
+    }
+  }
+
+  while(npending > 0)
   {
-    col = (cols != NULL ? cols[c] : c);
+    col = pending[0];
 
-    if(db_node_has_col(db_graph, node0.key, col) &&
-       db_node_has_col(db_graph, node1.key, col))
-    {
-      // Determine if this fork is a fork in the current colour
-      for(nedges_cols = 0, i = 0; i < num_next && nedges_cols <= 1; i++)
-        nedges_cols += db_node_has_col(db_graph, next_nodes[i].key, col);
+    // Determine if this fork is a fork in the current colour
+    for(nedges_cols = 0, i = 0; i < num_next && nedges_cols <= 1; i++)
+      nedges_cols += db_node_colset_has(next_colsets + i*nwords, col);
+
+    is_fork = (nedges_cols > 1);
 
-      is_fork = (nedges_cols > 1);
+    graph_walker_setup(wlk, true, col, col, db_graph);
+    gcrawler_walker_start(crawler, node0, col);
+    graph_walker_force(wlk, node1, is_fork);
 
-      graph_walker_setup(wlk, true, col, col, db_graph);
-      graph_walker_start(wlk, node0);
-      graph_walker_force(wlk, node1, is_fork);
+    pathid = gcrawler_load_path(cache, node1, wlk, rptwlk, jmpfunc, arg, &end);
+    end_node = wlk->node;
 
-      pathid = graph_crawler_load_path(cache, node1, wlk, rptwlk, jmpfunc, arg);
+    if(endfunc != NULL) endfunc(cache, pathid, arg);
 
-      if(endfunc != NULL) endfunc(cache, pathid, arg);
+    graph_walker_finish(wlk);
+    graph_crawler_reset_rpt_walker(rptwlk, cache, pathid);
 
-      graph_walker_finish(wlk);
-      graph_crawler_reset_rpt_walker(rptwlk, cache, pathid);
+    unipaths[num_unicol_paths++] = (GCUniColPath){.colour = col,
+                                                  .pathid = pathid};
+    crawler->col_paths[col] = pathid;
 
-      unipaths[num_unicol_paths++] = (GCUniColPath){.colour = col,
-                                                    .pathid = pathid};
+    // Remove colours that take the same path
+    for(i = 1, j = 0; i < npending; i++) {
+      col = pending[i];
+      if(union_crawl &&
+         gcrawler_col_takes_path(cache, pathid, col, end, end_node)) {
+        unipaths[num_unicol_paths++] = (GCUniColPath){.colour = col,
+                                                      .pathid = pathid};
+        crawler->col_paths[col] = pathid;
+      }
+      else pending[j++] = col;
     }
-    else
-      pathid = -1;
 
-    crawler->col_paths[col] = pathid;
+    npending = j;
   }
 
   if(num_unicol_paths == 0) {
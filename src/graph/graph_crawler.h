@@ -4,6 +4,7 @@
 #include "graph_cache.h"
 #include "graph_walker.h"
 #include "repeat_walker.h"
+#include "ctx_stats.h" // ctx_stats_now_ns()
 
 typedef struct {
   int pathid; // set to -1 if not used
@@ -22,9 +23,15 @@ typedef struct
   int *col_paths; // one per colour, col_paths[i] = -1 if colour i has no path
   GCMultiColPath *multicol_paths; // one path with multiple colours
 
+  // If no links are loaded, walk once per distinct path and assign other
+  // colours to it from the colour bitsets (default: true)
+  bool union_crawl;
+
   // used internally
   GCUniColPath *unicol_paths;
   uint32_t *col_list;
+  uint64_t *colsets; // colours of the fork node and up to 4 next nodes
+  GraphWalkerState *col_starts; // walker at the fork node in each colour
   GraphCache cache;
 
   // Temporary variables for walking
@@ -120,4 +127,33 @@ static inline bool gcrawler_load_path_limit_kmer_len(const GraphCache *cache,
   return (data[0] < data[1]);
 }
 
+//
+// Work budget for crawling from one start point (e.g. a fork). Repeats can
+// make a single start point take millions of steps; callers stop and defer
+// start points that go over budget so other work carries on.
+//
+
+typedef struct
+{
+  size_t max_kmers; // max kmers in the cache, 0 for no limit
+  uint64_t max_ns; // max time in nanoseconds, 0 for no limit
+  uint64_t deadline_ns; // set by graph_crawl_budget_start()
+} GraphCrawlBudget;
+
+#define graph_crawl_budget_is_set(b) ((b)->max_kmers || (b)->max_ns)
+
+static inline void graph_crawl_budget_start(GraphCrawlBudget *b)
+{
+  if(b->max_ns) b->deadline_ns = ctx_stats_now_ns() + b->max_ns;
+}
+
+// Returns true if `cache` holds more than the budgeted number of kmers or
+// time is up
+static inline bool graph_crawl_budget_exceeded(const GraphCrawlBudget *b,
+                                               const GraphCache *cache)
+{
+  return (b->max_kmers && graph_cache_num_nodes(cache) > b->max_kmers) ||
+         (b->max_ns && ctx_stats_now_ns() > b->deadline_ns);
+}
+
 #endif /* GRAPH_CRAWLER_H_ */
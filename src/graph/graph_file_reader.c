@@ -1,8 +1,11 @@
 #include "global.h"
 #include "graph_file_reader.h"
+#include "graph_popstore.h"
+#include "graph_footer.h"
 #include "db_node.h"
 #include "cmd.h"
 #include "file_util.h"
+#include "remote_file.h"
 
 // Buffer size `bufsize` is in bytes
 void graph_file_set_buffered(GraphFileReader *file, size_t bufsize)
@@ -19,14 +22,32 @@ void graph_file_set_buffered(GraphFileReader *file, size_t bufsize)
 int graph_file_fseek(GraphFileReader *file, off_t offset, int whence)
 {
   if(file_filter_isstdin(&file->fltr)) die("Cannot fseek on STDIN");
+  if(file->pop != NULL) {
+    // Only rewinding to the first kmer (offset hdr_size = 0)
+    if(offset != 0 || whence != SEEK_SET) die("Cannot fseek population store");
+    graph_popstore_reader_seek(file->poprdr, 0, file->pop->nkmers);
+    return 0;
+  }
+  if(graph_file_is_blocked(file)) {
+    graph_block_decoder_reset(&file->blk, 0);
+    file->blkend = false;
+  }
+  int r;
   if(graph_file_is_buffered(file))
-    return fseek_buf(file->fh, offset, whence, &file->strm);
+    r = fseek_buf(file->fh, offset, whence, &file->strm);
   else
-    return fseek(file->fh, offset, whence);
+    r = fseek(file->fh, offset, whence);
+  if(r == 0 && file->data_end > 0) {
+    if(whence == SEEK_SET) file->pos = offset;
+    else if(whence == SEEK_CUR) file->pos += offset;
+    else file->pos = file->file_size + offset;
+  }
+  return r;
 }
 
 off_t graph_file_ftell(GraphFileReader *file)
 {
+  if(file->pop != NULL) return file->poprdr->rank;
   if(graph_file_is_buffered(file))
     return ftell_buf(file->fh, &file->strm);
   else
@@ -37,6 +58,9 @@ off_t graph_file_ftell(GraphFileReader *file)
 size_t graph_file_fread(GraphFileReader *file, void *ptr, size_t n)
 {
   size_t nread;
+  // Don't read the index footer as kmers
+  if(file->data_end > 0)
+    n = MIN2(n, (size_t)MAX2(file->data_end - file->pos, 0));
   if(graph_file_is_buffered(file))
     nread = fread_buf(file->fh, ptr, n, &file->strm);
   else
@@ -44,6 +68,7 @@ size_t graph_file_fread(GraphFileReader *file, void *ptr, size_t n)
   // check for error
   if(ferror(file->fh))
     die("File error: %s [%s]", strerror(errno), file_filter_path(&file->fltr));
+  file->pos += nread;
   return nread;
 }
 
@@ -269,6 +294,48 @@ size_t graph_file_read_header(GraphFileReader *file)
   return bytes_read;
 }
 
+// Read a population store manifest as a graph with one colour per sample.
+// Only the samples selected by the filter are mapped.
+static int graph_file_open_popstore(GraphFileReader *file, const char *mode,
+                                    size_t into_offset)
+{
+  GraphFileHeader *hdr = &file->hdr;
+  FileFilter *fltr = &file->fltr;
+  const char *path = fltr->path.b;
+  size_t i;
+
+  if(strcmp(mode, "r") != 0) die("Population stores are read only: %s", path);
+
+  GraphPopStore *ps = ctx_calloc(1, sizeof(GraphPopStore));
+  graph_popstore_load(ps, path);
+
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->version = CTX_GRAPH_FILEFORMAT;
+  hdr->kmer_size = ps->kmer_size;
+  hdr->num_of_bitfields = NUM_BKMER_WORDS;
+  hdr->num_of_cols = ps->nsamples;
+  graph_header_capacity(hdr, hdr->num_of_cols);
+  for(i = 0; i < ps->nsamples; i++)
+    graph_info_cpy(&hdr->ginfo[i], &ps->cols[i].ginfo);
+
+  file_filter_set_cols(fltr, hdr->num_of_cols, into_offset);
+  db_graph_check_kmer_size(hdr->kmer_size, path);
+
+  uint8_t *sel = ctx_calloc(MAX2(ps->nsamples, 1), 1);
+  for(i = 0; i < file_filter_num(fltr); i++) sel[file_filter_fromcol(fltr, i)] = 1;
+  graph_popstore_map(ps, sel);
+  ctx_free(sel);
+
+  file->fh = NULL;
+  file->hdr_size = 0;
+  file->num_of_kmers = ps->nkmers;
+  file->pop = ps;
+  file->poprdr = ctx_calloc(1, sizeof(PopStoreReader));
+  graph_popstore_reader_alloc(file->poprdr, ps);
+
+  return 1;
+}
+
 int graph_file_open(GraphFileReader *file, const char *path)
 {
   return graph_file_open2(file, path, "r", true, 0);
@@ -290,18 +357,33 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
   // Reset reading errors
   file->error_zero_covg = false;
   file->error_missing_covg = false;
+  file->blkend = false;
 
   // Stat will fail on streams, so file_size and num_of_kmers with both be -1
   struct stat st;
+  bool remote = remote_file_is_url(path);
   file->file_size = -1;
   file->num_of_kmers = -1;
+  file->data_end = file->pos = 0;
 
-  if(strcmp(input,"-") != 0) {
+  if(strcmp(input,"-") != 0 && !remote) {
     if(stat(path, &st) == 0) file->file_size = st.st_size;
     else warn("Couldn't get file size: %s", futil_outpath_str(path));
   }
 
-  file->fh = futil_fopen(path, mode);
+  file->pop = NULL;
+  file->poprdr = NULL;
+  if(strcmp(input,"-") != 0 && !remote && graph_popstore_is_file(path))
+    return graph_file_open_popstore(file, mode, into_offset);
+
+  file->fh = async_file_fopen(path, mode);
+
+  // No stat() for URLs, the stream knows the size
+  if(remote && fseek(file->fh, 0, SEEK_END) == 0) {
+    file->file_size = ftell(file->fh);
+    rewind(file->fh);
+  }
+
   if(usebuf) strm_buf_alloc(&file->strm, ONE_MEGABYTE);
   else memset(&file->strm, 0, sizeof(file->strm));
   file->hdr_size = graph_file_read_header(file);
@@ -313,8 +395,26 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
 
   size_t bytes_per_kmer, bytes_remaining;
 
+  if(graph_file_is_blocked(file))
+  {
+    if(hdr->num_of_bitfields != NUM_BKMER_WORDS) {
+      die("Block compressed graph needs %u bitfields, compiled for %i "
+          "[path: %s]", hdr->num_of_bitfields, NUM_BKMER_WORDS, path);
+    }
+
+    graph_block_decoder_alloc(&file->blk);
+
+    // Number of kmers is in the trailer at the end of the file
+    GraphBlockTrailer trailer;
+    if(file->file_size != -1) {
+      if(graph_block_read_trailer(graph_file_fileno(file), file->file_size, &trailer))
+        file->num_of_kmers = trailer.nkmers;
+      else
+        warn("Truncated graph file, missing block index: %s", path);
+    }
+  }
   // If reading from STDIN we don't know file size
-  if(file->file_size != -1)
+  else if(file->file_size != -1)
   {
     // File header checks
     // Get number of kmers
@@ -323,6 +423,18 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
     bytes_remaining = (size_t)(file->file_size - file->hdr_size);
     file->num_of_kmers = (bytes_remaining / bytes_per_kmer);
 
+    // Sorted files may have an index footer after the kmers
+    GraphFooter footer;
+    if(graph_footer_read(graph_file_fileno(file), file->file_size, &footer)) {
+      off_t data_end = file->hdr_size + bytes_per_kmer * footer.nkmers;
+      if(graph_footer_offset(data_end) == (off_t)footer.index_offset) {
+        file->num_of_kmers = footer.nkmers;
+        file->data_end = data_end;
+        bytes_remaining = (size_t)(data_end - file->hdr_size);
+      }
+      else warn("Ignoring corrupt index footer: %s", path);
+    }
+
     if(bytes_remaining % bytes_per_kmer != 0) {
       warn("Truncated graph file: %s [bytes per kmer: %zu "
            "remaining: %zu; fsize: %zu; header: %zu; nkmers: %zu]",
@@ -338,15 +450,157 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
 // Close file
 void graph_file_close(GraphFileReader *file)
 {
+  if(file->pop != NULL) {
+    graph_popstore_reader_dealloc(file->poprdr);
+    graph_popstore_dealloc(file->pop);
+    ctx_free(file->poprdr);
+    ctx_free(file->pop);
+  }
   strm_buf_dealloc(&file->strm);
+  graph_block_decoder_dealloc(&file->blk);
   if(file->fh) fclose(file->fh);
   file_filter_close(&file->fltr);
   graph_header_dealloc(&file->hdr);
   memset(file, 0, sizeof(*file));
 }
 
-size_t graph_file_read_raw(GraphFileReader *file,
-                           BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+// Each copy has its own file handle and buffer, sharing the header and filter
+void graph_file_dup(const GraphFileReader *file, GraphFileReader *rdr,
+                    off_t offset)
+{
+  *rdr = *file;
+
+  if(file->pop != NULL) {
+    rdr->poprdr = ctx_calloc(1, sizeof(PopStoreReader));
+    graph_popstore_reader_alloc(rdr->poprdr, file->pop);
+    graph_popstore_reader_seek(rdr->poprdr, offset, file->pop->nkmers);
+    return;
+  }
+
+  rdr->fh = async_file_fopen(file_filter_path(&file->fltr), "r");
+  strm_buf_alloc(&rdr->strm, ONE_MEGABYTE);
+  if(graph_file_is_blocked(file)) graph_block_decoder_alloc(&rdr->blk);
+
+  if(graph_file_fseek(rdr, offset, SEEK_SET) != 0)
+    die("fseek failed: %s", strerror(errno));
+}
+
+void graph_file_dup_close(GraphFileReader *rdr)
+{
+  if(rdr->pop != NULL) {
+    graph_popstore_reader_dealloc(rdr->poprdr);
+    ctx_free(rdr->poprdr);
+    return;
+  }
+  if(graph_file_is_blocked(rdr)) graph_block_decoder_dealloc(&rdr->blk);
+  strm_buf_dealloc(&rdr->strm);
+  fclose(rdr->fh);
+}
+
+// Skip `n` bytes of input
+static void graph_file_skip(GraphFileReader *file, size_t n)
+{
+  uint8_t tmp[4096];
+  size_t len;
+
+  if(file_filter_isstdin(&file->fltr)) {
+    for(; n > 0; n -= len) {
+      len = MIN2(n, sizeof(tmp));
+      _gfread(file, tmp, len, "Kmer block");
+    }
+  }
+  else if(graph_file_is_buffered(file)) {
+    if(fseek_buf(file->fh, graph_file_ftell(file)+n, SEEK_SET, &file->strm) != 0)
+      die("fseek failed: %s", strerror(errno));
+  }
+  else if(fseek(file->fh, (off_t)n, SEEK_CUR) != 0)
+    die("fseek failed: %s", strerror(errno));
+}
+
+// Load a colour-major block payload of `nbytes` bytes, only reading the
+// sections of colours we are loading. Other colours are skipped on disk and
+// given empty sections.
+static void graph_file_read_colmajor(GraphFileReader *file, size_t nbytes,
+                                     const uint8_t *sel)
+{
+  GraphBlockDecoder *dec = &file->blk;
+  const char *path = file_filter_path(&file->fltr);
+  size_t col, ncols = file->hdr.num_of_cols, len, remaining, skip = 0;
+  uint32_t kbytes, secbytes, zero = 0;
+
+  // Seek over skipped sections rather than pulling them through the buffer
+  if(graph_file_is_buffered(file) && !file_filter_isstdin(&file->fltr))
+    graph_file_set_buffered(file, 0);
+
+  byte_buf_capacity(&dec->buf, nbytes);
+  if(nbytes < sizeof(uint32_t)) die("Corrupt kmer block: %s", path);
+  _gfread(file, &kbytes, sizeof(uint32_t), "Kmer block");
+  len = sizeof(uint32_t) + (size_t)kbytes + ncols*sizeof(uint32_t);
+  if(len > nbytes) die("Corrupt kmer block: %s", path);
+  memcpy(dec->buf.b, &kbytes, sizeof(uint32_t));
+  _gfread(file, dec->buf.b+sizeof(uint32_t), len-sizeof(uint32_t), "Kmer block");
+
+  uint8_t *table = dec->buf.b + sizeof(uint32_t) + kbytes;
+  remaining = nbytes - len;
+
+  for(col = 0; col < ncols; col++) {
+    memcpy(&secbytes, table + col*sizeof(uint32_t), sizeof(uint32_t));
+    if(secbytes > remaining) die("Corrupt kmer block: %s", path);
+    remaining -= secbytes;
+    if(sel[col]) {
+      if(skip) { graph_file_skip(file, skip); skip = 0; }
+      _gfread(file, dec->buf.b+len, secbytes, "Kmer block");
+      len += secbytes;
+    } else {
+      skip += secbytes;
+      memcpy(table + col*sizeof(uint32_t), &zero, sizeof(uint32_t));
+    }
+  }
+
+  if(remaining) die("Corrupt kmer block: %s", path);
+  if(skip) graph_file_skip(file, skip);
+  dec->buf.len = len;
+}
+
+// Read the next kmer from a block compressed file
+// `sel` marks the colours to load, or NULL for all colours. Unselected colours
+// may be returned as zero.
+// Returns number of bytes decoded or 0 at the end of the file
+static size_t graph_file_read_block(GraphFileReader *file, const uint8_t *sel,
+                                    BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+{
+  GraphBlockDecoder *dec = &file->blk;
+  const char *path = file_filter_path(&file->fltr);
+  size_t ncols = file->hdr.num_of_cols, pos = dec->pos, nread;
+  uint32_t fields[2];
+  int r;
+
+  while((r = graph_block_decode(dec, ncols, bkmer, covgs, edges)) == 0)
+  {
+    if(file->blkend) return 0;
+    nread = graph_file_fread(file, fields, sizeof(fields));
+    if(nread == 0) { file->blkend = true; return 0; } // no end marker
+    if(nread != sizeof(fields)) die("Unexpected end of file: %s", path);
+    if(fields[1] == 0) { file->blkend = true; return 0; } // end marker
+    file->blkpartial = (sel != NULL && (fields[1] & GRAPH_BLOCK_COLMAJOR));
+    if(file->blkpartial) graph_file_read_colmajor(file, fields[0], sel);
+    else {
+      byte_buf_capacity(&dec->buf, fields[0]);
+      _gfread(file, dec->buf.b, fields[0], "Kmer block");
+      dec->buf.len = fields[0];
+    }
+    graph_block_decoder_reset(dec, fields[1]);
+    pos = 0;
+  }
+
+  if(r < 0) die("Corrupt kmer block: %s", path);
+  return dec->pos - pos;
+}
+
+// `sel` is only used with colour-major block compressed files, see
+// graph_file_read_block()
+static size_t graph_file_read_kmer(GraphFileReader *file, const uint8_t *sel,
+                                   BinaryKmer *bkmer, Covg *covgs, Edges *edges)
 {
   GraphFileHeader *h = &file->hdr;
   const char *path = file_filter_path(&file->fltr);
@@ -355,20 +609,34 @@ size_t graph_file_read_raw(GraphFileReader *file,
   int num_bytes_read;
   char kstr[MAX_KMER_SIZE+1];
 
-  num_bytes_read = graph_file_fread(file, bkmer->b, sizeof(BinaryKmer));
+  if(file->pop != NULL) {
+    // Samples not selected are not mapped, so kmers may have no coverage
+    if(!graph_popstore_reader_next(file->poprdr, bkmer, covgs, edges)) return 0;
+    return sizeof(BinaryKmer) + h->num_of_cols * (sizeof(Covg) + sizeof(Edges));
+  }
+  else if(graph_file_is_blocked(file)) {
+    num_bytes_read = graph_file_read_block(file, sel, bkmer, covgs, edges);
+    if(num_bytes_read == 0) return 0;
+  }
+  else {
+    num_bytes_read = graph_file_fread(file, bkmer->b, sizeof(BinaryKmer));
 
-  if(num_bytes_read == 0) return 0;
-  if(num_bytes_read != (int)(sizeof(uint64_t)*h->num_of_bitfields))
-    die("Unexpected end of file: %s", path);
+    if(num_bytes_read == 0) return 0;
+    if(num_bytes_read != (int)(sizeof(uint64_t)*h->num_of_bitfields))
+      die("Unexpected end of file: %s", path);
 
-  _gfread(file, covgs, h->num_of_cols * sizeof(uint32_t), "Coverages");
-  _gfread(file, edges, h->num_of_cols * sizeof(uint8_t), "Edges");
-  num_bytes_read += h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
+    _gfread(file, covgs, h->num_of_cols * sizeof(uint32_t), "Coverages");
+    _gfread(file, edges, h->num_of_cols * sizeof(uint8_t), "Edges");
+    num_bytes_read += h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
+  }
 
   // Check top word of each kmer
   if(binary_kmer_oversized(*bkmer, h->kmer_size))
     die("Oversized kmer in path [kmer: %u]: %s", h->kmer_size, path);
 
+  // Skipped colours are missing, so we can't check the whole kmer
+  if(graph_file_is_blocked(file) && file->blkpartial) return num_bytes_read;
+
   // Check covg is not 0 for all colours
   for(i = 0; i < h->num_of_cols && covgs[i] == 0; i++) {}
   if(i == h->num_of_cols && !file->error_zero_covg) {
@@ -388,6 +656,12 @@ size_t graph_file_read_raw(GraphFileReader *file,
   return num_bytes_read;
 }
 
+size_t graph_file_read_raw(GraphFileReader *file,
+                           BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+{
+  return graph_file_read_kmer(file, NULL, bkmer, covgs, edges);
+}
+
 // Read a kmer from the file
 // returns true on success, false otherwise
 // prints warnings if dirty kmers in file
@@ -400,8 +674,25 @@ bool graph_file_read(GraphFileReader *file,
   Edges kmeredges[file->hdr.num_of_cols];
   size_t i, from, into;
   const FileFilter *fltr = &file->fltr;
+  uint8_t colsel[file->hdr.num_of_cols];
+  const uint8_t *sel = NULL;
+  size_t nsel = 0;
+
+  // Colours to read from colour-major blocks, only set up when we are about
+  // to load a new block and not all colours are wanted
+  if(graph_file_is_blocked(file) && file->blk.nkmers == 0)
+  {
+    memset(colsel, 0, file->hdr.num_of_cols);
+    for(i = 0; i < file_filter_num(fltr); i++) {
+      from = file_filter_fromcol(fltr, i);
+      nsel += !colsel[from];
+      colsel[from] = 1;
+    }
+    if(nsel < file->hdr.num_of_cols) sel = colsel;
+  }
 
-  if(!graph_file_read_raw(file, bkmer, kmercovgs, kmeredges)) return false;
+  if(!graph_file_read_kmer(file, sel, bkmer, kmercovgs, kmeredges))
+    return false;
 
   for(i = 0; i < file_filter_num(fltr); i++) {
     from = file_filter_fromcol(fltr, i);
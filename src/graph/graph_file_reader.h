@@ -5,11 +5,17 @@
 #include "graph_format.h"
 #include "file_filter.h"
 #include "binary_kmer.h"
+#include "graph_block.h"
+#include "async_file.h"
 
 //
 // Read graph files from disk
 //
 
+// Population stores are read as graph files (see graph_popstore.h)
+typedef struct GraphPopStore GraphPopStore;
+typedef struct PopStoreReader PopStoreReader;
+
 typedef struct
 {
   FILE *fh;
@@ -18,7 +24,17 @@ typedef struct
   GraphFileHeader hdr;
   off_t hdr_size, file_size;
   int64_t num_of_kmers; // set if reading from file (i.e. not stream) else -1
+  // Uncompressed files with an index footer (see graph_footer.h) only:
+  // end of the kmer records, else 0. Reads stop at data_end.
+  off_t data_end, pos; // pos is the read position, tracked if data_end > 0
   bool error_zero_covg, error_missing_covg; // Whether we saw loading errors
+  // Block compressed files (version 7) only
+  GraphBlockDecoder blk; // current block
+  bool blkend; // reached end of blocks marker
+  bool blkpartial; // only some colours of the current block were read
+  // Population store manifests only (fh is NULL), kmers are read by rank
+  GraphPopStore *pop;
+  PopStoreReader *poprdr;
 } GraphFileReader;
 
 #include "madcrowlib/madcrow_buffer.h"
@@ -30,17 +46,27 @@ madcrow_buffer(gfile_buf, GraphFileBuffer, GraphFileReader);
 // Returns 0 if not set instead of -1
 #define graph_file_nkmers(rdr) ((uint64_t)MAX2((rdr)->num_of_kmers, 0))
 
+// Block compressed files do not have fixed size kmer records
+#define graph_file_is_blocked(rdr) \
+        ((rdr)->hdr.version == CTX_GRAPH_FILEFORMAT_BLOCKS)
+
 // Get file offset of a given kmer
+// Only valid for files with fixed size records (!graph_file_is_blocked())
 static inline off_t graph_file_offset(const GraphFileReader *gfr, size_t i)
 {
   size_t s = sizeof(BinaryKmer)+gfr->fltr.srcncols*(sizeof(Covg)+sizeof(Edges));
   return gfr->hdr_size + s*i;
 }
 
+// Descriptor for pread()/mmap(), since fileno() is -1 for async streams
+#define graph_file_fileno(file) async_file_fileno((file)->fh)
+
 #define graph_file_is_buffered(file) ((file)->strm.b != NULL)
 // Buffer size `bufsize` is in bytes
 void graph_file_set_buffered(GraphFileReader *file, size_t bufsize);
 
+// For block compressed files, only seeking to the start of a block
+// (e.g. hdr_size) is valid
 int graph_file_fseek(GraphFileReader *file, off_t offset, int whence);
 off_t graph_file_ftell(GraphFileReader *file);
 
@@ -63,6 +89,14 @@ int graph_file_open2(GraphFileReader *file, const char *path, const char *mode,
 // Close file, release all memory
 void graph_file_close(GraphFileReader *file);
 
+// Open another reader of an open file, positioned at `offset` (a kmer rank
+// for population stores), so threads can each read part of the file. Shares
+// the header and filter of `file`, which must stay open until
+// graph_file_dup_close() is called on the copy.
+void graph_file_dup(const GraphFileReader *file, GraphFileReader *rdr,
+                    off_t offset);
+void graph_file_dup_close(GraphFileReader *rdr);
+
 // Merge the header from this file into a new file
 void graph_file_merge_header(GraphFileHeader *hdr, const GraphFileReader *file);
 
@@ -0,0 +1,192 @@
+#include "global.h"
+#include "graph_footer.h"
+#include "remote_file.h"
+#include "util.h"
+
+#include <sys/mman.h>
+
+size_t graph_pfx_bases(size_t nkmers, size_t kmer_size)
+{
+  size_t p = 0;
+  while(p < GRAPH_PFX_MAX_BASES && p < kmer_size &&
+        ((size_t)GRAPH_PFX_MIN_BUCKET << (2*(p+1))) <= nkmers) p++;
+  return p;
+}
+
+void graph_footer_write(FILE *fh, off_t data_end, const uint64_t *pfx,
+                        size_t pfxbases, uint64_t nkmers, const char *path)
+{
+  const uint8_t zeros[8] = {0};
+  size_t npad = graph_footer_offset(data_end) - data_end;
+  size_t n = graph_pfx_len(pfxbases);
+  uint64_t trailer[3] = {pfxbases, nkmers, graph_footer_offset(data_end)};
+
+  if(fwrite(zeros, 1, npad, fh) != npad ||
+     fwrite(pfx, sizeof(uint64_t), n, fh) != n ||
+     fwrite(trailer, sizeof(uint64_t), 3, fh) != 3 ||
+     fwrite(GRAPH_FOOTER_MAGIC, 1, strlen(GRAPH_FOOTER_MAGIC), fh) !=
+       strlen(GRAPH_FOOTER_MAGIC))
+  {
+    die("Cannot write graph index: %s [%s]", path, strerror(errno));
+  }
+}
+
+// pread() until we have `n` bytes, remote descriptors are accepted
+static bool footer_pread(int fd, void *ptr, size_t n, off_t offset)
+{
+  ssize_t r;
+  char *p = ptr;
+  while(n > 0) {
+    r = remote_file_pread_fd(fd, p, n, offset);
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) return false;
+    p += r; n -= r; offset += r;
+  }
+  return true;
+}
+
+bool graph_footer_read(int fd, size_t file_size, GraphFooter *f)
+{
+  uint8_t mem[GRAPH_FOOTER_SIZE];
+  if(file_size < GRAPH_FOOTER_SIZE) return false;
+  if(!footer_pread(fd, mem, sizeof(mem), file_size - sizeof(mem))) return false;
+  if(memcmp(mem+3*sizeof(uint64_t), GRAPH_FOOTER_MAGIC,
+            strlen(GRAPH_FOOTER_MAGIC)) != 0) return false;
+  memcpy(&f->pfxbases,     mem,                    sizeof(uint64_t));
+  memcpy(&f->nkmers,       mem+sizeof(uint64_t),   sizeof(uint64_t));
+  memcpy(&f->index_offset, mem+2*sizeof(uint64_t), sizeof(uint64_t));
+  return (f->pfxbases <= GRAPH_PFX_MAX_BASES && f->index_offset % 8 == 0 &&
+          f->index_offset + graph_pfx_len(f->pfxbases)*sizeof(uint64_t) +
+            sizeof(mem) == file_size);
+}
+
+uint64_t* graph_footer_map(int fd, const GraphFooter *f,
+                           void **map, size_t *maplen)
+{
+  if(fd < 0) return NULL;
+  size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  off_t start = f->index_offset & ~(off_t)(pagesize-1);
+  size_t skip = f->index_offset - start;
+  size_t len = skip + graph_pfx_len(f->pfxbases)*sizeof(uint64_t);
+  void *ptr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, start);
+  if(ptr == MAP_FAILED) return NULL;
+  *map = ptr;
+  *maplen = len;
+  return (uint64_t*)((char*)ptr + skip);
+}
+
+uint64_t* graph_footer_load(int fd, const GraphFooter *f)
+{
+  size_t nbytes = graph_pfx_len(f->pfxbases)*sizeof(uint64_t);
+  uint64_t *pfx = ctx_malloc(nbytes);
+  if(!footer_pread(fd, pfx, nbytes, f->index_offset)) {
+    ctx_free(pfx);
+    return NULL;
+  }
+  return pfx;
+}
+
+typedef struct
+{
+  const GraphFileReader *file;
+  size_t pfxbases;
+  uint64_t *pfx;
+  uint64_t start, end; // records [start,end)
+} PfxJob;
+
+// Each job sets the table entries for the prefixes starting in its range,
+// so threads never write the same entry
+static void pfx_job(void *arg, size_t threadid)
+{
+  (void)threadid;
+  const PfxJob *job = (const PfxJob*)arg;
+  const GraphFileReader *file = job->file;
+  const char *path = file_filter_path(&file->fltr);
+  const size_t kmer_size = file->hdr.kmer_size, p = job->pfxbases;
+  const size_t entrysize = sizeof(BinaryKmer) +
+                           file->hdr.num_of_cols * (sizeof(Covg)+sizeof(Edges));
+  const uint64_t nkmers = graph_file_nkmers(file);
+  char rec[entrysize];
+  size_t x, next = 0;
+  uint64_t i = job->start;
+  BinaryKmer bkmer, prev;
+  GraphFileReader rdr;
+
+  // Start one record early to check the sort order across the boundary and
+  // skip prefixes already set by the previous range
+  if(i > 0) i--;
+  graph_file_dup(file, &rdr, graph_file_offset(file, i));
+
+  for(; i < job->end; i++) {
+    if(graph_file_fread(&rdr, rec, entrysize) != entrysize)
+      die("Cannot index graph: %s", path);
+    memcpy(bkmer.b, rec, sizeof(BinaryKmer));
+    x = p ? graph_pfx_get(bkmer, kmer_size, p) : 0;
+    if(i < job->start) next = x+1;
+    else {
+      if(i > 0 && !binary_kmer_lt(prev, bkmer))
+        die("File is not sorted: %s", path);
+      graph_pfx_add(job->pfx, &next, x, i);
+    }
+    prev = bkmer;
+  }
+
+  if(job->end == nkmers)
+    graph_pfx_add(job->pfx, &next, graph_pfx_len(p)-1, nkmers);
+
+  graph_file_dup_close(&rdr);
+}
+
+void graph_footer_build(const GraphFileReader *file, size_t pfxbases,
+                        size_t nthreads, uint64_t *pfx)
+{
+  ctx_assert(!graph_file_is_blocked(file) && file->pop == NULL);
+  ctx_assert(file->num_of_kmers >= 0);
+
+  const uint64_t nkmers = graph_file_nkmers(file);
+  size_t i, njobs = MAX2(MIN2(nthreads, nkmers), 1);
+
+  if(nkmers == 0) {
+    memset(pfx, 0, graph_pfx_len(pfxbases)*sizeof(uint64_t));
+    return;
+  }
+
+  PfxJob *jobs = ctx_calloc(njobs, sizeof(PfxJob));
+  for(i = 0; i < njobs; i++) {
+    jobs[i] = (PfxJob){.file = file, .pfxbases = pfxbases, .pfx = pfx,
+                       .start = (nkmers * i) / njobs,
+                       .end = (nkmers * (i+1)) / njobs};
+  }
+
+  util_run_threads(jobs, njobs, sizeof(jobs[0]), nthreads, pfx_job);
+  ctx_free(jobs);
+}
+
+void graph_footer_index_file(GraphFileReader *file, size_t nthreads)
+{
+  const char *path = file_filter_path(&file->fltr);
+
+  if(graph_file_is_blocked(file) || file->pop != NULL ||
+     file->num_of_kmers < 0 || file_filter_isstdin(&file->fltr))
+    die("Can only add an index footer to an uncompressed graph file: %s", path);
+
+  const uint64_t nkmers = graph_file_nkmers(file);
+  const size_t p = graph_pfx_bases(nkmers, file->hdr.kmer_size);
+  const off_t data_end = graph_file_offset(file, nkmers);
+  uint64_t *pfx = ctx_malloc(graph_pfx_len(p) * sizeof(uint64_t));
+
+  status("[footer] Indexing %zu kmers, prefix %zu bases, with %zu threads",
+         (size_t)nkmers, p, nthreads);
+
+  graph_footer_build(file, p, nthreads, pfx);
+
+  // Overwrite any old footer, then drop what is left of it
+  if(fseek(file->fh, data_end, SEEK_SET) != 0)
+    die("fseek failed: %s [%s]", strerror(errno), path);
+  graph_footer_write(file->fh, data_end, pfx, p, nkmers, path);
+  if(fflush(file->fh) != 0 ||
+     ftruncate(fileno(file->fh), ftell(file->fh)) != 0)
+    die("Cannot write graph index: %s [%s]", path, strerror(errno));
+
+  ctx_free(pfx);
+}
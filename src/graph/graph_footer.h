@@ -0,0 +1,94 @@
+#ifndef GRAPH_FOOTER_H_
+#define GRAPH_FOOTER_H_
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+#include "graph_file_reader.h"
+
+//
+// Prefix index stored in a footer of sorted uncompressed graph files
+//
+// graph_search builds a table of where each prefix (the first p bases) of the
+// kmers starts. Rather than scanning every kmer each time a file is opened,
+// `ctx sort --index` and `ctx index --footer` append the table after the kmer
+// records, padded to an 8 byte boundary:
+//
+//   <uint64_t:pfx[4^p+1]><uint64_t:p><uint64_t:nkmers><uint64_t:index offset>
+//   "CTXPFXIX"
+//
+// Kmers with prefix x are records [pfx[x], pfx[x+1]). The footer is only
+// written to files with fixed size records (version 6). Readers that do not
+// know about it see a file with a few extra bytes after the last record,
+// graph_file_reader stops at the last record.
+//
+
+#define GRAPH_FOOTER_MAGIC "CTXPFXIX"
+#define GRAPH_FOOTER_SIZE (3*sizeof(uint64_t)+strlen(GRAPH_FOOTER_MAGIC))
+
+// Prefix table has 4^p+1 entries, aim for at least GRAPH_PFX_MIN_BUCKET kmers
+// per prefix so the table never uses more than one byte per kmer
+#define GRAPH_PFX_MAX_BASES 14
+#define GRAPH_PFX_MIN_BUCKET 8
+
+#define graph_pfx_len(p) ((1UL << (2*(p)))+1)
+
+typedef struct
+{
+  uint64_t pfxbases, nkmers, index_offset;
+} GraphFooter;
+
+// Get the first `p` bases of a kmer (p > 0)
+static inline size_t graph_pfx_get(BinaryKmer bkmer, size_t kmer_size, size_t p)
+{
+  size_t pos = 2*(kmer_size-p); // bit offset of prefix from least significant
+  size_t w = NUM_BKMER_WORDS-1-pos/64, off = pos%64;
+  uint64_t x = bkmer.b[w] >> off;
+  if(off + 2*p > 64) x |= bkmer.b[w-1] << (64-off);
+  return x & ((1UL << (2*p))-1);
+}
+
+// Fill the table from kmers visited in sorted order: kmer `idx` has prefix `x`.
+// `*next` is the first entry not yet set, start from zero. Finish with
+// graph_pfx_add(pfx, &next, graph_pfx_len(p)-1, nkmers).
+static inline void graph_pfx_add(uint64_t *pfx, size_t *next,
+                                 size_t x, uint64_t idx)
+{
+  while(*next <= x) pfx[(*next)++] = idx;
+}
+
+// Pick prefix length from the number of kmers
+size_t graph_pfx_bases(size_t nkmers, size_t kmer_size);
+
+// Offset of the prefix table after records ending at `data_end`
+#define graph_footer_offset(data_end) (((data_end)+7) & ~(off_t)7)
+
+// Write prefix table and trailer at the current position of `fh`, which must
+// be `data_end`, the end of the kmer records
+void graph_footer_write(FILE *fh, off_t data_end, const uint64_t *pfx,
+                        size_t pfxbases, uint64_t nkmers, const char *path);
+
+// Read the trailer at the end of a file
+// Returns true on success, false if the footer is missing or corrupt
+bool graph_footer_read(int fd, size_t file_size, GraphFooter *f);
+
+// Memory map the prefix table. Returns NULL if the file cannot be mapped.
+// Release with munmap(*map, *maplen).
+uint64_t* graph_footer_map(int fd, const GraphFooter *f,
+                           void **map, size_t *maplen);
+
+// Read the prefix table into memory (e.g. for remote files, see
+// remote_file.h). Returns NULL on error. Release with ctx_free().
+uint64_t* graph_footer_load(int fd, const GraphFooter *f);
+
+// Build the prefix table of a sorted uncompressed file with `nthreads`,
+// each reading a range of records. Calls die() if the file is not sorted.
+// `pfx` must have graph_pfx_len(pfxbases) entries.
+void graph_footer_build(const GraphFileReader *file, size_t pfxbases,
+                        size_t nthreads, uint64_t *pfx);
+
+// Build the prefix table of an open sorted file (opened with mode "r+") and
+// write it as the footer, replacing any existing footer.
+// `file` must not be read afterwards.
+void graph_footer_index_file(GraphFileReader *file, size_t nthreads);
+
+#endif /* GRAPH_FOOTER_H_ */
@@ -0,0 +1,313 @@
+#include "global.h"
+#include "graph_pass.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "hash_table.h"
+#include "graph_info.h"
+#include "util.h"
+
+typedef struct
+{
+  const GraphPass *pass;
+  dBGraph *db_graph;
+  // What this sweep does
+  bool slot_ops, add_edges, kmer_ops;
+  const CovgStore *covg_keep; // [num_covg_cols] 0 to wipe slot, ~0 to keep
+  const Edges *edge_keep; // [num_edge_cols] 0 to wipe colour, ~0 to keep
+  uint64_t *nkmers, *sumcov; // [nthreads*num_of_cols]
+} GraphPassJob;
+
+// Wipe colours and intersect edges of slots [start,end), assigned or not.
+// Ranges start at a multiple of 8 so each node_in_cols byte has one owner.
+static void _pass_slots(const GraphPassJob *job, size_t start, size_t end)
+{
+  const GraphPass *pass = job->pass;
+  dBGraph *db_graph = job->db_graph;
+  const size_t ncols = db_graph->num_of_cols, necols = db_graph->num_edge_cols;
+  const size_t nslots = db_graph->num_covg_cols;
+  const size_t n = end - start;
+  size_t i, col;
+
+  if(pass->wipe_cols != NULL)
+  {
+    if(db_graph->node_in_cols != NULL) {
+      for(col = 0; col < ncols; col++)
+        if(bitset_get(pass->wipe_cols, col))
+          for(i = start/8; i < (end+7)/8; i++)
+            db_graph->node_in_cols[ncols*i+col] = 0;
+    }
+
+    if(db_graph->col_major) {
+      // Each colour is contiguous
+      if(db_graph->col_covgs != NULL) {
+        for(col = 0; col < nslots; col++)
+          if(!job->covg_keep[col])
+            memset(db_graph->col_covgs + col*db_graph->ht.capacity + start, 0,
+                   n*sizeof(CovgStore));
+      }
+      if(db_graph->col_edges != NULL) {
+        for(col = 0; col < necols; col++)
+          if(!job->edge_keep[col])
+            memset(&db_node_edges(db_graph, start, col), 0, n*sizeof(Edges));
+      }
+    }
+    else {
+      if(db_graph->col_covgs != NULL) {
+        CovgStore *restrict covgs = db_graph->col_covgs + start*nslots;
+        const CovgStore *restrict keep = job->covg_keep;
+        for(i = 0; i < n; i++, covgs += nslots)
+          for(col = 0; col < nslots; col++) covgs[col] &= keep[col];
+      }
+      if(db_graph->col_edges != NULL) {
+        Edges *restrict edges = db_graph->col_edges + start*necols;
+        const Edges *restrict keep = job->edge_keep;
+        for(i = 0; i < n; i++, edges += necols)
+          for(col = 0; col < necols; col++) edges[col] &= keep[col];
+      }
+    }
+  }
+
+  if(pass->isec_edges != NULL)
+  {
+    const Edges *restrict isec = pass->isec_edges + start;
+    Edges *restrict edges;
+    if(db_graph->col_major) {
+      for(col = 0; col < necols; col++) {
+        edges = &db_node_edges(db_graph, start, col);
+        for(i = 0; i < n; i++) edges[i] &= isec[i];
+      }
+    }
+    else {
+      edges = db_graph->col_edges + start*necols;
+      for(i = 0; i < n; i++, edges += necols)
+        for(col = 0; col < necols; col++) edges[col] &= isec[i];
+    }
+  }
+}
+
+static inline void _pass_add_all_edges(hkey_t node, dBGraph *db_graph)
+{
+  const size_t kmer_size = db_graph->kmer_size, edgencols = db_graph->num_edge_cols;
+  size_t col;
+  BinaryKmer bkmer, bkey, node_bkey = db_node_get_bkey(db_graph, node);
+  Orientation orient;
+  Nucleotide nuc;
+  hkey_t next;
+  Edges edge, edges[edgencols], iedges;
+  bool node_has_col[edgencols];
+
+  db_node_get_all_edges(db_graph, node, edges);
+  iedges = edges[0];
+
+  for(col = 0; col < edgencols; col++) {
+    iedges &= edges[col];
+    node_has_col[col] = db_node_has_col(db_graph, node, col);
+  }
+
+  for(orient = 0; orient < 2; orient++)
+  {
+    bkmer = (orient == FORWARD ? binary_kmer_left_shift_one_base(node_bkey, kmer_size)
+                               : binary_kmer_right_shift_one_base(node_bkey));
+
+    for(nuc = 0; nuc < 4; nuc++)
+    {
+      edge = nuc_orient_to_edge(nuc, orient);
+
+      // Check edge is not is all colours
+      if(!(edge & iedges))
+      {
+        if(orient == FORWARD) binary_kmer_set_last_nuc(&bkmer, nuc);
+        else binary_kmer_set_first_nuc(&bkmer, dna_nuc_complement(nuc), kmer_size);
+
+        bkey = binary_kmer_get_key(bkmer, kmer_size);
+        next = hash_table_find(&db_graph->ht, bkey);
+
+        if(next != HASH_NOT_FOUND)
+          for(col = 0; col < edgencols; col++)
+            if(node_has_col[col] && db_node_has_col(db_graph, next, col))
+              edges[col] |= edge;
+      }
+    }
+  }
+
+  db_node_set_all_edges(db_graph, node, edges);
+}
+
+static inline bool _pass_kmer_has_covg(const dBGraph *db_graph, hkey_t hkey)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  size_t col;
+  Covg covg = 0;
+  // Presence-only colours (covg_slot) are read from node_in_cols
+  if(db_graph->sparse != NULL || db_graph->col_major ||
+     db_graph->covg_slot != NULL) {
+    for(col = 0; col < ncols; col++)
+      covg |= db_node_get_covg(db_graph, hkey, col);
+  }
+  else {
+    // A stored value is non-zero iff the coverage is
+    const CovgStore *restrict covgs = db_graph->col_covgs + hkey*ncols;
+    for(col = 0; col < ncols; col++) covg |= covgs[col];
+  }
+  return covg != 0;
+}
+
+static inline void _pass_count_covg(const dBGraph *db_graph, hkey_t hkey,
+                                    uint64_t *restrict nkmers,
+                                    uint64_t *restrict sumcov)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  size_t col;
+  Covg covg;
+  if(db_graph->sparse != NULL || db_graph->col_major ||
+     db_graph->covg_slot != NULL) {
+    for(col = 0; col < ncols; col++) {
+      covg = db_node_get_covg(db_graph, hkey, col);
+      nkmers[col] += (covg != 0);
+      sumcov[col] += covg;
+    }
+  }
+  else {
+    const CovgStore *restrict covgs = db_graph->col_covgs + hkey*ncols;
+    for(col = 0; col < ncols; col++) {
+      nkmers[col] += (covgs[col] != 0);
+      sumcov[col] += covgs[col];
+    }
+    #if COVG_BITS < 32
+      // Saturated coverages continue in the overflow table
+      for(col = 0; col < ncols; col++)
+        if(covgs[col] == COVG_STORE_MAX)
+          sumcov[col] += db_node_get_covg(db_graph, hkey, col) - COVG_STORE_MAX;
+    #endif
+  }
+}
+
+static bool _graph_pass_range(size_t start, size_t end, size_t threadid,
+                              void *arg)
+{
+  const GraphPassJob *job = (const GraphPassJob*)arg;
+  const GraphPass *pass = job->pass;
+  dBGraph *db_graph = job->db_graph;
+  const size_t ncols = db_graph->num_of_cols;
+  uint64_t *nkmers = job->nkmers ? job->nkmers + threadid*ncols : NULL;
+  uint64_t *sumcov = job->sumcov ? job->sumcov + threadid*ncols : NULL;
+  const bool union_update = (job->slot_ops || job->add_edges) &&
+                            db_graph->union_edges != NULL;
+  hkey_t hkey;
+
+  if(job->slot_ops) _pass_slots(job, start, end);
+
+  if(!job->add_edges && !job->kmer_ops && !union_update) return false;
+
+  for(hkey = start; hkey < end; hkey++)
+  {
+    if(!hash_table_assigned(&db_graph->ht, hkey)) continue;
+
+    if(job->add_edges) _pass_add_all_edges(hkey, db_graph);
+
+    // Each thread owns its range so the cached union can be set directly
+    if(union_update)
+      db_graph->union_edges[hkey] = db_node_read_edges_union(db_graph, hkey);
+
+    if(job->kmer_ops) {
+      if(pass->remove_no_covg && !_pass_kmer_has_covg(db_graph, hkey)) {
+        hash_table_delete(&db_graph->ht, hkey);
+        continue;
+      }
+      if(nkmers != NULL) _pass_count_covg(db_graph, hkey, nkmers, sumcov);
+    }
+  }
+
+  return false; // keep going
+}
+
+static void _graph_pass_sweep(GraphPassJob *job, size_t nthreads,
+                              bool slot_ops, bool add_edges, bool kmer_ops)
+{
+  const size_t capacity = job->db_graph->ht.capacity;
+  job->slot_ops = slot_ops;
+  job->add_edges = add_edges;
+  job->kmer_ops = kmer_ops;
+
+  // Chunks are a multiple of 64 kmers so node_in_cols bytes are not shared
+  size_t chunk = capacity / (nthreads*HASH_ITERATE_CHUNKS_PER_THREAD);
+  chunk = (MAX2(chunk, HASH_ITERATE_MIN_CHUNK) + 63) & ~(size_t)63;
+  util_run_ranges(capacity, chunk, nthreads, _graph_pass_range, job);
+}
+
+size_t graph_pass_run(const GraphPass *pass, dBGraph *db_graph,
+                      size_t nthreads)
+{
+  ctx_assert(nthreads > 0);
+
+  const size_t ncols = db_graph->num_of_cols, necols = db_graph->num_edge_cols;
+  const bool slot_ops = pass->wipe_cols != NULL || pass->isec_edges != NULL;
+  const bool count = pass->nkmers != NULL || pass->sumcov != NULL;
+  const bool kmer_ops = pass->remove_no_covg || count;
+  size_t col, t, nsweeps = 0;
+
+  if(slot_ops || pass->add_all_edges) {
+    ctx_assert(db_graph->sparse == NULL && db_graph->shared_edges == NULL);
+  }
+  if(pass->isec_edges != NULL) ctx_assert(db_graph->col_edges != NULL);
+  if(pass->add_all_edges) {
+    ctx_assert(db_graph->col_edges != NULL && db_graph->node_in_cols != NULL);
+    ctx_assert(ncols == necols);
+  }
+  if(kmer_ops) {
+    ctx_assert(db_graph->col_covgs != NULL || db_graph->sparse != NULL);
+  }
+  ctx_assert(!count || (pass->nkmers != NULL && pass->sumcov != NULL));
+
+  const size_t nslots = db_graph->num_covg_cols;
+  CovgStore covg_keep[nslots+1];
+  Edges edge_keep[necols];
+  memset(covg_keep, 0xff, sizeof(covg_keep));
+  memset(edge_keep, 0xff, sizeof(edge_keep));
+
+  if(pass->wipe_cols != NULL) {
+    for(col = 0; col < ncols; col++) {
+      if(bitset_get(pass->wipe_cols, col)) {
+        graph_info_init(&db_graph->ginfo[col]);
+        if(db_node_col_has_covg(db_graph, col))
+          covg_keep[db_node_covg_slot(db_graph, col)] = 0;
+        edge_keep[necols == 1 ? 0 : col] = 0;
+      }
+    }
+  }
+
+  GraphPassJob job = {.pass = pass, .db_graph = db_graph,
+                      .covg_keep = covg_keep, .edge_keep = edge_keep,
+                      .nkmers = NULL, .sumcov = NULL};
+
+  if(count) {
+    job.nkmers = ctx_calloc(nthreads*ncols, sizeof(uint64_t));
+    job.sumcov = ctx_calloc(nthreads*ncols, sizeof(uint64_t));
+  }
+
+  if(!pass->add_all_edges) {
+    _graph_pass_sweep(&job, nthreads, slot_ops, false, kmer_ops);
+    nsweeps++;
+  }
+  else {
+    // Adding edges reads the colours of neighbours, which must not be changed
+    // or removed by other threads during the sweep
+    if(slot_ops) { _graph_pass_sweep(&job, nthreads, true, false, false); nsweeps++; }
+    _graph_pass_sweep(&job, nthreads, false, true, kmer_ops && !pass->remove_no_covg);
+    nsweeps++;
+    if(pass->remove_no_covg) { _graph_pass_sweep(&job, nthreads, false, false, true); nsweeps++; }
+  }
+
+  if(count) {
+    for(t = 0; t < nthreads; t++) {
+      for(col = 0; col < ncols; col++) {
+        pass->nkmers[col] += job.nkmers[t*ncols+col];
+        pass->sumcov[col] += job.sumcov[t*ncols+col];
+      }
+    }
+    ctx_free(job.nkmers);
+    ctx_free(job.sumcov);
+  }
+
+  return nsweeps;
+}
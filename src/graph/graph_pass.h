@@ -0,0 +1,53 @@
+#ifndef GRAPH_PASS_H_
+#define GRAPH_PASS_H_
+
+//
+// Fused passes over the whole graph
+//
+// A GraphPass lists per-kmer maintenance operations (wiping colours,
+// intersecting edges, adding edges, removing kmers with no coverage, counting
+// coverage) and runs them together in as few parallel sweeps of the hash table
+// as possible, doing all the work on a range of kmers while it is in cache.
+//
+// Operations are applied in this order:
+//   1. wipe colours         every slot in the table, assigned or not
+//   2. intersect edges      every slot in the table
+//   3. add all edges        reads neighbours, so gets a sweep of its own if
+//                           combined with operations that change them
+//   4. remove kmers with no coverage
+//   5. count kmers and coverage per colour
+//
+// Wiping, intersecting and counting loop over the contiguous row of colours of
+// each kmer (or the contiguous run of kmers of a colour in colour-major graphs)
+// so the compiler can vectorise them.
+//
+
+#include "db_graph.h"
+
+typedef struct
+{
+  // Colours to wipe coverage, edges and node_in_cols of. Bitset of
+  // num_of_cols bits, NULL for none. If only one edge colour is stored, edges
+  // are wiped in all colours.
+  const uint8_t *wipe_cols;
+
+  // Intersect edges of every colour with isec_edges[hkey], NULL to skip
+  const Edges *isec_edges;
+
+  // Add edges between kmers overlapping by k-1 bases that are both in a colour
+  // Requires node_in_cols and an edge colour per colour
+  bool add_all_edges;
+
+  // Remove kmers with no coverage in any colour
+  bool remove_no_covg;
+
+  // If not NULL, count kmers with coverage and sum their coverage in each
+  // colour, adding to nkmers[col] and sumcov[col] (num_of_cols each)
+  uint64_t *nkmers, *sumcov;
+} GraphPass;
+
+// Returns the number of sweeps of the hash table made
+size_t graph_pass_run(const GraphPass *pass, dBGraph *db_graph,
+                      size_t nthreads);
+
+#endif /* GRAPH_PASS_H_ */
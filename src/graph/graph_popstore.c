@@ -0,0 +1,543 @@
+#include "global.h"
+#include "graph_popstore.h"
+#include "db_node.h"
+#include "file_util.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define popstore_pad(n) (((n)+7) & ~(size_t)7)
+
+// magic, 4 x uint32, uint64
+#define POPSTORE_DICT_HDR_BYTES (strlen(POPSTORE_DICT_MAGIC) + \
+                                 4*sizeof(uint32_t) + sizeof(uint64_t))
+
+// magic, 2 x uint32, 2 x uint64, 2 x uint32, uint64, double, 4 x uint32
+#define POPSTORE_COL_HDR_BYTES (strlen(POPSTORE_COL_MAGIC) + \
+                                8*sizeof(uint32_t) + 3*sizeof(uint64_t) + \
+                                sizeof(double))
+
+// Cleaning flags in column headers
+#define POPSTORE_CLEANED_TIPS     1
+#define POPSTORE_CLEANED_UNITIGS  2
+#define POPSTORE_CLEANED_KMERS    4
+#define POPSTORE_INTERSECTION     8
+
+#define popstore_bit(arr,i) (((arr)[(i)/64] >> ((i)%64)) & 1)
+
+bool graph_popstore_is_file(const char *path)
+{
+  char hdr[sizeof(POPSTORE_MANIFEST_HDR)];
+  FILE *fin = fopen(path, "r");
+  if(fin == NULL) return false;
+  bool ret = (fread(hdr, 1, sizeof(hdr)-1, fin) == sizeof(hdr)-1 &&
+              memcmp(hdr, POPSTORE_MANIFEST_HDR, sizeof(hdr)-1) == 0);
+  fclose(fin);
+  return ret;
+}
+
+void graph_popstore_alloc(GraphPopStore *ps, size_t kmer_size)
+{
+  memset(ps, 0, sizeof(*ps));
+  ps->kmer_size = kmer_size;
+}
+
+static void popstore_unmap(void *mem, size_t len)
+{
+  if(mem != NULL) munmap(mem, len);
+}
+
+void graph_popstore_dealloc(GraphPopStore *ps)
+{
+  size_t i;
+  for(i = 0; i < ps->ndicts; i++) {
+    popstore_unmap(ps->dicts[i].mem, ps->dicts[i].mem_len);
+    free(ps->dicts[i].path);
+  }
+  for(i = 0; i < ps->nsamples; i++) {
+    popstore_unmap(ps->cols[i].mem, ps->cols[i].mem_len);
+    graph_info_dealloc(&ps->cols[i].ginfo);
+    free(ps->cols[i].path);
+  }
+  ctx_free(ps->dicts);
+  ctx_free(ps->cols);
+  memset(ps, 0, sizeof(*ps));
+}
+
+// Returns mapping of a whole file, sets *len to its size
+static uint8_t* popstore_map_file(const char *path, size_t *len)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) die("Cannot open file: %s", path);
+
+  struct stat st;
+  if(fstat(fd, &st) != 0) die("Cannot stat file: %s", path);
+  *len = st.st_size;
+
+  uint8_t *mem = NULL;
+  if(*len > 0) {
+    mem = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+    if(mem == MAP_FAILED) die("Cannot memory map file: %s", path);
+  }
+  close(fd);
+  return mem;
+}
+
+//
+// Column headers
+//
+
+static void popstore_col_read_hdr(PopStoreColumn *col, size_t kmer_size)
+{
+  const char *path = col->path;
+  FILE *fin = futil_fopen(path, "r");
+  uint8_t hdr[POPSTORE_COL_HDR_BYTES], *ptr = hdr;
+  uint32_t u32[8];
+  uint64_t u64[3];
+  double seq_err;
+
+  if(fread(hdr, 1, sizeof(hdr), fin) != sizeof(hdr) ||
+     memcmp(hdr, POPSTORE_COL_MAGIC, strlen(POPSTORE_COL_MAGIC)) != 0)
+    die("Not a population store column: %s", path);
+
+  ptr += strlen(POPSTORE_COL_MAGIC);
+  memcpy(u32, ptr, 2*sizeof(uint32_t)); ptr += 2*sizeof(uint32_t);
+  memcpy(u64, ptr, 2*sizeof(uint64_t)); ptr += 2*sizeof(uint64_t);
+  memcpy(u32+2, ptr, 2*sizeof(uint32_t)); ptr += 2*sizeof(uint32_t);
+  memcpy(u64+2, ptr, sizeof(uint64_t)); ptr += sizeof(uint64_t);
+  memcpy(&seq_err, ptr, sizeof(double)); ptr += sizeof(double);
+  memcpy(u32+4, ptr, 4*sizeof(uint32_t));
+
+  if(u32[0] != POPSTORE_VERSION)
+    die("Population store column version %u not supported: %s", u32[0], path);
+  if(u32[1] != kmer_size)
+    die("Column kmer size doesn't match [%u vs %zu]: %s", u32[1], kmer_size, path);
+  if(u64[1] > u64[0]) die("Corrupt population store column: %s", path);
+
+  col->nkmers = u64[0];
+  col->npresent = u64[1];
+
+  GraphInfo *ginfo = &col->ginfo;
+  graph_info_alloc(ginfo);
+  ginfo->mean_read_length = u32[2];
+  ginfo->total_sequence = u64[2];
+  ginfo->seq_err = seq_err;
+  ginfo->cleaning.cleaned_tips = !!(u32[3] & POPSTORE_CLEANED_TIPS);
+  ginfo->cleaning.cleaned_unitigs = !!(u32[3] & POPSTORE_CLEANED_UNITIGS);
+  ginfo->cleaning.cleaned_kmers = !!(u32[3] & POPSTORE_CLEANED_KMERS);
+  ginfo->cleaning.is_graph_intersection = !!(u32[3] & POPSTORE_INTERSECTION);
+  ginfo->cleaning.clean_unitigs_thresh = u32[4];
+  ginfo->cleaning.clean_kmers_thresh = u32[5];
+
+  StrBuf *names[2] = {&ginfo->sample_name, &ginfo->cleaning.intersection_name};
+  size_t i;
+  for(i = 0; i < 2; i++) {
+    strbuf_ensure_capacity(names[i], u32[6+i]);
+    if(fread(names[i]->b, 1, u32[6+i], fin) != u32[6+i])
+      die("Corrupt population store column: %s", path);
+    names[i]->b[u32[6+i]] = '\0';
+    names[i]->end = u32[6+i];
+  }
+
+  fclose(fin);
+}
+
+// Byte offsets of arrays in a column file
+static void popstore_col_layout(const PopStoreColumn *col, size_t namelens,
+                                size_t *bits, size_t *covgs, size_t *edges,
+                                size_t *len)
+{
+  *bits = popstore_pad(POPSTORE_COL_HDR_BYTES + namelens);
+  *covgs = *bits + (col->nkmers+63)/64 * sizeof(uint64_t);
+  *edges = *covgs + col->npresent * sizeof(Covg);
+  *len = *edges + col->npresent * sizeof(Edges);
+}
+
+//
+// Manifest
+//
+
+void graph_popstore_load(GraphPopStore *ps, const char *manifest_path)
+{
+  FILE *fin = futil_fopen(manifest_path, "r");
+  StrBuf line, dir;
+  strbuf_alloc(&line, 1024);
+  strbuf_alloc(&dir, 1024);
+  futil_get_strbuf_of_dir_path(manifest_path, &dir);
+
+  size_t lineno = 0, kmer_size = 0, dirlen = dir.end, nkmers;
+  char *path, *sep;
+  graph_popstore_alloc(ps, 0);
+
+  while(strbuf_reset_readline(&line, fin) > 0)
+  {
+    lineno++;
+    strbuf_chomp(&line);
+    if(line.end == 0 || line.b[0] == '#') continue;
+
+    if(!strncmp(line.b, "kmer_size ", 10)) {
+      if(!parse_entire_size(line.b+10, &kmer_size) || kmer_size == 0)
+        die("Bad kmer_size [%s:%zu]: %s", manifest_path, lineno, line.b);
+      db_graph_check_kmer_size(kmer_size, manifest_path);
+      continue;
+    }
+
+    if(strncmp(line.b, "dict ", 5) && strncmp(line.b, "sample ", 7))
+      die("Bad line [%s:%zu]: %s", manifest_path, lineno, line.b);
+    if(kmer_size == 0)
+      die("kmer_size must come first [%s:%zu]", manifest_path, lineno);
+
+    // Paths are relative to the manifest
+    path = line.b + (line.b[0] == 'd' ? 5 : 7);
+    if(line.b[0] == 'd') {
+      if((sep = strrchr(path, ' ')) == NULL || !parse_entire_size(sep+1, &nkmers))
+        die("Bad dict line [%s:%zu]: %s", manifest_path, lineno, line.b);
+      *sep = '\0';
+    }
+    if(path[0] != '/') {
+      strbuf_append_str(&dir, path);
+      path = dir.b;
+    }
+
+    if(line.b[0] == 'd') {
+      if(ps->nsamples)
+        die("Dictionary parts must come first [%s:%zu]", manifest_path, lineno);
+      ps->dicts = ctx_reallocarray(ps->dicts, ps->ndicts+1, sizeof(PopStoreDict));
+      memset(&ps->dicts[ps->ndicts], 0, sizeof(PopStoreDict));
+      ps->dicts[ps->ndicts].path = strdup(path);
+      ps->dicts[ps->ndicts].nkmers = nkmers;
+      ps->ndicts++;
+      ps->nkmers += nkmers;
+    }
+    else {
+      ps->cols = ctx_reallocarray(ps->cols, ps->nsamples+1, sizeof(PopStoreColumn));
+      memset(&ps->cols[ps->nsamples], 0, sizeof(PopStoreColumn));
+      ps->cols[ps->nsamples].path = strdup(path);
+      popstore_col_read_hdr(&ps->cols[ps->nsamples], kmer_size);
+      if(ps->cols[ps->nsamples].nkmers > ps->nkmers)
+        die("Column has more kmers than the dictionary: %s", path);
+      ps->nsamples++;
+    }
+
+    strbuf_shrink(&dir, dirlen);
+  }
+
+  if(kmer_size == 0) die("Missing kmer_size: %s", manifest_path);
+  ps->kmer_size = kmer_size;
+
+  futil_fclose(fin);
+  strbuf_dealloc(&line);
+  strbuf_dealloc(&dir);
+}
+
+void graph_popstore_save(const GraphPopStore *ps, const char *manifest_path)
+{
+  size_t i;
+  const char *name;
+  FILE *fout = futil_fopen(manifest_path, "w");
+
+  fprintf(fout, POPSTORE_MANIFEST_HDR"\n");
+  fprintf(fout, "kmer_size %zu\n", ps->kmer_size);
+  // files are written next to the manifest
+  for(i = 0; i < ps->ndicts; i++) {
+    name = strrchr(ps->dicts[i].path, '/');
+    fprintf(fout, "dict %s %zu\n", name ? name+1 : ps->dicts[i].path,
+            ps->dicts[i].nkmers);
+  }
+  for(i = 0; i < ps->nsamples; i++) {
+    name = strrchr(ps->cols[i].path, '/');
+    fprintf(fout, "sample %s\n", name ? name+1 : ps->cols[i].path);
+  }
+
+  futil_fclose(fout);
+  status("[popstore] Saved %zu samples, %zu dictionary parts to: %s",
+         ps->nsamples, ps->ndicts, manifest_path);
+}
+
+char* graph_popstore_new_path(const char *manifest_path, size_t i,
+                              const char *ext)
+{
+  size_t baselen = strlen(manifest_path);
+  const char *dot = strrchr(manifest_path, '.'), *slash;
+  slash = strrchr(manifest_path, '/');
+  if(dot != NULL && (slash == NULL || dot > slash))
+    baselen = dot - manifest_path;
+
+  StrBuf path;
+  strbuf_alloc(&path, baselen+50);
+  strbuf_append_strn(&path, manifest_path, baselen);
+  strbuf_sprintf(&path, ".%zu.%s", i, ext);
+  char *str = strdup(path.b);
+  strbuf_dealloc(&path);
+  return str;
+}
+
+//
+// Mapping
+//
+
+static void popstore_map_dict(PopStoreDict *d, size_t kmer_size)
+{
+  uint8_t *mem = popstore_map_file(d->path, &d->mem_len);
+  uint32_t u32[4];
+  uint64_t nkmers;
+
+  d->mem = mem;
+  if(d->mem_len < POPSTORE_DICT_HDR_BYTES ||
+     memcmp(mem, POPSTORE_DICT_MAGIC, strlen(POPSTORE_DICT_MAGIC)) != 0)
+    die("Not a population store dictionary: %s", d->path);
+
+  memcpy(u32, mem + strlen(POPSTORE_DICT_MAGIC), sizeof(u32));
+  memcpy(&nkmers, mem + strlen(POPSTORE_DICT_MAGIC) + sizeof(u32), sizeof(nkmers));
+
+  if(u32[0] != POPSTORE_VERSION)
+    die("Population store dictionary version %u not supported: %s",
+        u32[0], d->path);
+  if(u32[1] != kmer_size || u32[2] != NUM_BKMER_WORDS)
+    die("Dictionary kmer size doesn't match [%u vs %zu]: %s",
+        u32[1], kmer_size, d->path);
+  if(nkmers != d->nkmers ||
+     d->mem_len != POPSTORE_DICT_HDR_BYTES + nkmers * sizeof(BinaryKmer))
+    die("Dictionary doesn't match manifest [kmers: %zu vs %zu]: %s",
+        (size_t)nkmers, d->nkmers, d->path);
+
+  d->bkmers = (const BinaryKmer*)(mem + POPSTORE_DICT_HDR_BYTES);
+}
+
+static void popstore_map_col(PopStoreColumn *col)
+{
+  size_t bits, covgs, edges, len;
+  size_t namelens = col->ginfo.sample_name.end +
+                    col->ginfo.cleaning.intersection_name.end;
+  popstore_col_layout(col, namelens, &bits, &covgs, &edges, &len);
+
+  uint8_t *mem = popstore_map_file(col->path, &col->mem_len);
+  col->mem = mem;
+  if(col->mem_len != len) die("Corrupt population store column: %s", col->path);
+
+  col->bits = (const uint64_t*)(mem + bits);
+  col->covgs = (const Covg*)(mem + covgs);
+  col->edges = (const Edges*)(mem + edges);
+}
+
+void graph_popstore_map(GraphPopStore *ps, const uint8_t *sel)
+{
+  size_t i, nmapped = 0;
+  for(i = 0; i < ps->ndicts; i++)
+    if(ps->dicts[i].mem == NULL)
+      popstore_map_dict(&ps->dicts[i], ps->kmer_size);
+  for(i = 0; i < ps->nsamples; i++) {
+    if((sel == NULL || sel[i]) && ps->cols[i].mem == NULL)
+      popstore_map_col(&ps->cols[i]);
+    nmapped += (ps->cols[i].mem != NULL);
+  }
+
+  char kstr[50];
+  ulong_to_str(ps->nkmers, kstr);
+  status("[popstore] Mapped %s kmers, %zu / %zu samples",
+         kstr, nmapped, ps->nsamples);
+}
+
+//
+// Writing
+//
+
+static int _bkmer_cmp(const void *a, const void *b)
+{
+  return binary_kmer_cmp(*(const BinaryKmer*)a, *(const BinaryKmer*)b);
+}
+
+#define _pswrite(fh,ptr,size,path) do { \
+  if((size) != 0 && fwrite(ptr, 1, size, fh) != (size)) \
+    die("Cannot write to file: %s", futil_outpath_str(path)); \
+} while(0)
+
+void graph_popstore_add_dict(GraphPopStore *ps, const char *path,
+                             BinaryKmer *bkeys, size_t n)
+{
+  qsort(bkeys, n, sizeof(BinaryKmer), _bkmer_cmp);
+
+  uint32_t u32[4] = {POPSTORE_VERSION, ps->kmer_size, NUM_BKMER_WORDS, 0};
+  uint64_t nkmers = n;
+  FILE *fout = futil_fopen_create(path, "w");
+  _pswrite(fout, POPSTORE_DICT_MAGIC, strlen(POPSTORE_DICT_MAGIC), path);
+  _pswrite(fout, u32, sizeof(u32), path);
+  _pswrite(fout, &nkmers, sizeof(nkmers), path);
+  _pswrite(fout, bkeys, n * sizeof(BinaryKmer), path);
+  futil_fclose(fout);
+
+  ps->dicts = ctx_reallocarray(ps->dicts, ps->ndicts+1, sizeof(PopStoreDict));
+  memset(&ps->dicts[ps->ndicts], 0, sizeof(PopStoreDict));
+  ps->dicts[ps->ndicts].path = strdup(path);
+  ps->dicts[ps->ndicts].nkmers = n;
+  ps->ndicts++;
+  ps->nkmers += n;
+}
+
+static inline bool popstore_has_col(const dBGraph *db_graph, hkey_t hkey,
+                                    size_t col, size_t edgecol)
+{
+  return hkey != HASH_NOT_FOUND &&
+         (db_node_get_covg(db_graph, hkey, col) > 0 ||
+          (edgecol == col && db_node_get_edges(db_graph, hkey, edgecol) != 0));
+}
+
+void graph_popstore_add_col(GraphPopStore *ps, const char *path,
+                            const dBGraph *db_graph, size_t col,
+                            const hkey_t *ranks)
+{
+  const size_t nkmers = ps->nkmers;
+  const size_t edgecol = db_graph->num_edge_cols == 1 ? 0 : col;
+  const GraphInfo *ginfo = &db_graph->ginfo[col];
+  size_t r, i, npresent = 0, nbytes;
+  uint64_t word;
+  Covg covg;
+  Edges edges;
+
+  for(r = 0; r < nkmers; r++)
+    npresent += popstore_has_col(db_graph, ranks[r], col, edgecol);
+
+  uint32_t flags = (ginfo->cleaning.cleaned_tips ? POPSTORE_CLEANED_TIPS : 0) |
+                   (ginfo->cleaning.cleaned_unitigs ? POPSTORE_CLEANED_UNITIGS : 0) |
+                   (ginfo->cleaning.cleaned_kmers ? POPSTORE_CLEANED_KMERS : 0) |
+                   (ginfo->cleaning.is_graph_intersection ? POPSTORE_INTERSECTION : 0);
+  uint32_t u32a[2] = {POPSTORE_VERSION, ps->kmer_size};
+  uint64_t u64a[2] = {nkmers, npresent};
+  uint32_t u32b[2] = {ginfo->mean_read_length, flags};
+  uint64_t total_seq = ginfo->total_sequence;
+  double seq_err = ginfo->seq_err;
+  uint32_t u32c[4] = {ginfo->cleaning.clean_unitigs_thresh,
+                      ginfo->cleaning.clean_kmers_thresh,
+                      ginfo->sample_name.end,
+                      ginfo->cleaning.intersection_name.end};
+  uint8_t zero[8] = {0};
+
+  FILE *fout = futil_fopen_create(path, "w");
+  _pswrite(fout, POPSTORE_COL_MAGIC, strlen(POPSTORE_COL_MAGIC), path);
+  _pswrite(fout, u32a, sizeof(u32a), path);
+  _pswrite(fout, u64a, sizeof(u64a), path);
+  _pswrite(fout, u32b, sizeof(u32b), path);
+  _pswrite(fout, &total_seq, sizeof(total_seq), path);
+  _pswrite(fout, &seq_err, sizeof(seq_err), path);
+  _pswrite(fout, u32c, sizeof(u32c), path);
+  _pswrite(fout, ginfo->sample_name.b, u32c[2], path);
+  _pswrite(fout, ginfo->cleaning.intersection_name.b, u32c[3], path);
+  nbytes = POPSTORE_COL_HDR_BYTES + u32c[2] + u32c[3];
+  _pswrite(fout, zero, popstore_pad(nbytes) - nbytes, path);
+
+  // Presence bits, then coverages and edges of kmers present
+  for(r = 0; r < nkmers; r += 64) {
+    for(word = 0, i = 0; i < 64 && r+i < nkmers; i++)
+      word |= (popstore_has_col(db_graph, ranks[r+i], col, edgecol) ? 1ULL : 0) << i;
+    _pswrite(fout, &word, sizeof(word), path);
+  }
+
+  for(r = 0; r < nkmers; r++) {
+    if(popstore_has_col(db_graph, ranks[r], col, edgecol)) {
+      covg = db_node_get_covg(db_graph, ranks[r], col);
+      _pswrite(fout, &covg, sizeof(covg), path);
+    }
+  }
+
+  for(r = 0; r < nkmers; r++) {
+    if(popstore_has_col(db_graph, ranks[r], col, edgecol)) {
+      edges = db_node_get_edges(db_graph, ranks[r], edgecol);
+      _pswrite(fout, &edges, sizeof(edges), path);
+    }
+  }
+
+  futil_fclose(fout);
+
+  ps->cols = ctx_reallocarray(ps->cols, ps->nsamples+1, sizeof(PopStoreColumn));
+  PopStoreColumn *c = &ps->cols[ps->nsamples++];
+  memset(c, 0, sizeof(*c));
+  c->path = strdup(path);
+  c->nkmers = nkmers;
+  c->npresent = npresent;
+  graph_info_alloc(&c->ginfo);
+  graph_info_cpy(&c->ginfo, ginfo);
+
+  char nstr[50], kstr[50];
+  ulong_to_str(npresent, nstr);
+  ulong_to_str(nkmers, kstr);
+  status("[popstore] Sample '%s': %s / %s kmers [%s]",
+         ginfo->sample_name.b, nstr, kstr, futil_outpath_str(path));
+}
+
+//
+// Reading
+//
+
+void graph_popstore_reader_alloc(PopStoreReader *rdr, const GraphPopStore *ps)
+{
+  memset(rdr, 0, sizeof(*rdr));
+  rdr->ps = ps;
+  rdr->colpos = ctx_calloc(MAX2(ps->nsamples, 1), sizeof(uint64_t));
+  graph_popstore_reader_seek(rdr, 0, ps->nkmers);
+}
+
+void graph_popstore_reader_dealloc(PopStoreReader *rdr)
+{
+  ctx_free(rdr->colpos);
+  memset(rdr, 0, sizeof(*rdr));
+}
+
+void graph_popstore_reader_seek(PopStoreReader *rdr,
+                                uint64_t start, uint64_t end)
+{
+  const GraphPopStore *ps = rdr->ps;
+  const PopStoreColumn *col;
+  size_t i, w, nwords;
+  uint64_t pos;
+
+  ctx_assert(start <= end && end <= ps->nkmers);
+  rdr->rank = start;
+  rdr->end = end;
+  rdr->dict = 0;
+  rdr->dictstart = 0;
+
+  // Coverages of each column start after those of the kmers before `start`
+  for(i = 0; i < ps->nsamples; i++) {
+    col = &ps->cols[i];
+    if(col->mem == NULL) continue;
+    pos = MIN2(start, col->nkmers);
+    for(nwords = pos / 64, w = 0, rdr->colpos[i] = 0; w < nwords; w++)
+      rdr->colpos[i] += (uint64_t)__builtin_popcountll(col->bits[w]);
+    if(pos % 64) {
+      rdr->colpos[i] += (uint64_t)__builtin_popcountll(col->bits[nwords] &
+                                                       ((1UL << (pos%64))-1));
+    }
+  }
+}
+
+bool graph_popstore_reader_next(PopStoreReader *rdr, BinaryKmer *bkmer,
+                                Covg *covgs, Edges *edges)
+{
+  const GraphPopStore *ps = rdr->ps;
+  const PopStoreColumn *col;
+  const uint64_t r = rdr->rank;
+  size_t i;
+
+  if(r >= rdr->end) return false;
+
+  while(r >= rdr->dictstart + ps->dicts[rdr->dict].nkmers)
+    rdr->dictstart += ps->dicts[rdr->dict++].nkmers;
+
+  *bkmer = ps->dicts[rdr->dict].bkmers[r - rdr->dictstart];
+
+  for(i = 0; i < ps->nsamples; i++) {
+    col = &ps->cols[i];
+    if(col->mem != NULL && r < col->nkmers && popstore_bit(col->bits, r)) {
+      covgs[i] = col->covgs[rdr->colpos[i]];
+      edges[i] = col->edges[rdr->colpos[i]];
+      rdr->colpos[i]++;
+    }
+    else { covgs[i] = 0; edges[i] = 0; }
+  }
+
+  rdr->rank++;
+  return true;
+}
@@ -0,0 +1,135 @@
+#ifndef GRAPH_POPSTORE_H_
+#define GRAPH_POPSTORE_H_
+
+//
+// Population store: one kmer dictionary shared by many samples, with the
+// coverages and edges of each sample in its own column file
+//
+// Kmers are numbered by rank in the dictionary. The dictionary is one or more
+// parts, each a sorted list of kmer keys, and ranks run through the parts in
+// order. Adding a sample never changes the rank of a kmer: kmers not seen
+// before go in a new (small) dictionary part at the end. A column covers the
+// ranks that existed when it was written, later ranks are absent from it.
+// Adding a sample writes its column, a dictionary part and the manifest only.
+//
+// The store is a text manifest listing the files, which are written next to
+// it (paths are relative to the directory of the manifest):
+//
+//   # mccortex population store
+//   kmer_size 31
+//   dict pop.1.dict 1000000
+//   dict pop.2.dict 2013
+//   sample pop.1.col
+//   sample pop.2.col
+//
+// Dictionary part:
+//   "CTXPDICT" <uint32:version> <uint32:kmer_size> <uint32:num_bkmer_words>
+//   <uint32:0> <uint64:nkmers> nkmers x BinaryKmer (sorted keys)
+//
+// Column (presence bit r set if the sample has the kmer of rank r, coverages
+// and edges are only stored for kmers present, in rank order):
+//   "CTXPCOLS" <uint32:version> <uint32:kmer_size> <uint64:nkmers>
+//   <uint64:npresent> <uint32:mean_read_length> <uint32:cleaning flags>
+//   <uint64:total_sequence> <double:seq_err> <uint32:clean_unitigs_thresh>
+//   <uint32:clean_kmers_thresh> <uint32:name_len> <uint32:isec_name_len>
+//   sample name, intersection name (padded to 8 bytes)
+//   ceil(nkmers/64) x uint64 presence bits
+//   npresent x Covg, npresent x Edges
+//
+// Files are memory mapped when read. Graph files opened with graph_file_open()
+// may be a manifest, with colours selecting samples (e.g. pop.popstore:3,7),
+// so any command loading graphs can load a subset of the samples. Only the
+// columns of selected samples are mapped.
+//
+
+#include "db_graph.h"
+#include "graph_file_reader.h"
+
+#define POPSTORE_MANIFEST_HDR "# mccortex population store"
+#define POPSTORE_DICT_MAGIC "CTXPDICT"
+#define POPSTORE_COL_MAGIC "CTXPCOLS"
+#define POPSTORE_VERSION 1
+
+typedef struct
+{
+  char *path;
+  size_t nkmers;
+  const BinaryKmer *bkmers; // set once mapped
+  void *mem;
+  size_t mem_len;
+} PopStoreDict;
+
+typedef struct
+{
+  char *path;
+  size_t nkmers, npresent; // ranks covered, kmers present
+  GraphInfo ginfo;
+  const uint64_t *bits; // set once mapped
+  const Covg *covgs;
+  const Edges *edges;
+  void *mem;
+  size_t mem_len;
+} PopStoreColumn;
+
+struct GraphPopStore
+{
+  size_t kmer_size, nkmers; // nkmers is the sum over dictionary parts
+  size_t ndicts, nsamples;
+  PopStoreDict *dicts;
+  PopStoreColumn *cols;
+};
+
+// Reads kmers in rank order with the coverages and edges of every sample
+// (zero for samples whose columns are not mapped)
+struct PopStoreReader
+{
+  const GraphPopStore *ps;
+  uint64_t rank, end; // next rank to read, end of range
+  size_t dict; // dictionary part holding `rank`
+  uint64_t dictstart; // first rank of part `dict`
+  uint64_t *colpos; // [nsamples] next coverage of each column
+};
+
+// Returns true if `path` starts with POPSTORE_MANIFEST_HDR
+bool graph_popstore_is_file(const char *path);
+
+void graph_popstore_alloc(GraphPopStore *ps, size_t kmer_size);
+void graph_popstore_dealloc(GraphPopStore *ps);
+
+// Read manifest and the header of each column, call die() on error
+void graph_popstore_load(GraphPopStore *ps, const char *manifest_path);
+
+// Write manifest, call die() on error. Overwrites any existing file.
+void graph_popstore_save(const GraphPopStore *ps, const char *manifest_path);
+
+// Map dictionary parts and the columns with sel[i] != 0 (all if sel is NULL)
+void graph_popstore_map(GraphPopStore *ps, const uint8_t *sel);
+
+// Path of a new file next to the manifest: pop.popstore -> pop.<i>.<ext>
+// Returns a string to be free'd
+char* graph_popstore_new_path(const char *manifest_path, size_t i,
+                              const char *ext);
+
+// Sort `bkeys` (kmer keys) and write them as a dictionary part, then add the
+// part to `ps`
+void graph_popstore_add_dict(GraphPopStore *ps, const char *path,
+                             BinaryKmer *bkeys, size_t n);
+
+// Write colour `col` of `db_graph` as a column and add it to `ps`.
+// ranks[r] is the hkey of the kmer of rank r, for r < ps->nkmers
+void graph_popstore_add_col(GraphPopStore *ps, const char *path,
+                            const dBGraph *db_graph, size_t col,
+                            const hkey_t *ranks);
+
+// Read ranks [start,end) of a mapped store
+void graph_popstore_reader_alloc(PopStoreReader *rdr, const GraphPopStore *ps);
+void graph_popstore_reader_dealloc(PopStoreReader *rdr);
+void graph_popstore_reader_seek(PopStoreReader *rdr,
+                                uint64_t start, uint64_t end);
+
+// covgs and edges have ps->nsamples entries
+// Returns false at the end of the range
+bool graph_popstore_reader_next(PopStoreReader *rdr, BinaryKmer *bkmer,
+                                Covg *covgs, Edges *edges);
+
+#endif /* GRAPH_POPSTORE_H_ */
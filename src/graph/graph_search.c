@@ -1,51 +1,250 @@
 #include "global.h"
 #include "graph_search.h"
+#include "graph_footer.h"
+#include "remote_file.h"
+
+#include <sys/mman.h>
 
 struct GraphFileSearch {
   GraphFileReader *file;
   size_t nkmers, ncols, entrysize; // nkmers in file, size of kmer entry in file
   BinaryKmer *index;
   size_t blocksize, nblocks;
+  // Uncompressed files: kmers with prefix x (first pfxbases bases) are
+  // records [pfx[x], pfx[x+1])
+  uint64_t *pfx;
+  size_t pfxbases;
+  void *pfxmap; // pfx is in a mapping of the index footer if not NULL
+  size_t pfxmaplen;
   void *block; // read file into block to linear search
+  // If the file could be memory mapped, search the mapped records directly
+  // instead of using fseek()/fread(). mapping is NULL otherwise.
+  char *mapping;
+  size_t maplen;
+  const char *records; // mapping + hdr_size
+  // Remote uncompressed files are binary searched with range reads
+  // (remote_file_pread_fd()), so lookups only fetch the blocks they touch
+  bool remote;
+  int fd;
+  // Block compressed files: index is the first kmer of each file block,
+  // the current block is decoded into `block`
+  GraphBlockBuffer blkindex;
+  GraphBlockDecoder dec;
+  size_t curblk, curblk_nkmers;
+  // Taken around lookups that use `block` or the file position
+  pthread_mutex_t lock;
 };
 
-// #define INDEX_SIZE 4 /* debugging */
-#define INDEX_SIZE 4*1024*1024 /* 4M */
+#define gs_record(gs,i) ((gs)->records + (gs)->entrysize*(i))
+#define gs_block_record(gs,i) ((char*)(gs)->block + (gs)->entrysize*(i))
+
 #define MAX_LIN_SEARCH 512
 
 /* with MAX_LIN_SEARCH of 512, 1 MiB allows 227 colours to be loaded */
 
+// Block compressed files store an index of the first kmer in each block,
+// so we only need to read the index and decode one block per lookup
+static void graph_search_load_blocks(GraphFileSearch *gs)
+{
+  size_t i;
+  GraphFileReader *file = gs->file;
+  const char *path = file_filter_path(&file->fltr);
+  GraphBlockTrailer trailer;
+  int fd = graph_file_fileno(file);
+
+  gblock_buf_alloc(&gs->blkindex, 1024);
+  graph_block_decoder_alloc(&gs->dec);
+
+  if(!graph_block_read_trailer(fd, file->file_size, &trailer) ||
+     !graph_block_read_index(fd, &trailer, &gs->blkindex))
+    die("Cannot read block index: %s", path);
+
+  gs->nblocks = gs->blkindex.len;
+  gs->blocksize = GRAPH_BLOCK_NKMERS;
+  gs->curblk = SIZE_MAX;
+  gs->index = ctx_calloc(sizeof(BinaryKmer), gs->nblocks+1); // sentinel
+  gs->block = ctx_calloc(GRAPH_BLOCK_NKMERS, gs->entrysize);
+  memset(gs->index[gs->nblocks].b,0xff,BKMER_BYTES); // sentinel kmer
+
+  for(i = 0; i < gs->nblocks; i++)
+    gs->index[i] = gs->blkindex.b[i].first;
+
+  status("[graph_search] on-disk-graph %zu cols %zu blocks %zu kmers "
+         "(block compressed)", gs->ncols, gs->nblocks, gs->nkmers);
+
+  for(i = 0; i+1 < gs->nblocks; i++)
+    if(!binary_kmer_lt(gs->index[i],gs->index[i+1]))
+      die("File is not sorted: %s", path);
+}
+
+// Decode block `b` of a block compressed file into gs->block
+static void graph_search_decode_block(GraphFileSearch *gs, size_t b)
+{
+  if(gs->curblk == b) return;
+  const char *path = file_filter_path(&gs->file->fltr);
+  int64_t i, n = graph_block_pread(graph_file_fileno(gs->file),
+                                   gs->blkindex.b[b].offset, &gs->dec);
+  if(n < 0 || n > GRAPH_BLOCK_NKMERS) die("Cannot read kmer block: %s", path);
+
+  Covg covgs[gs->ncols];
+  Edges edges[gs->ncols];
+  BinaryKmer bkmer;
+  char *ptr;
+
+  for(i = 0; i < n; i++) {
+    if(graph_block_decode(&gs->dec, gs->ncols, &bkmer, covgs, edges) != 1)
+      die("Corrupt kmer block: %s", path);
+    ptr = gs_block_record(gs, i);
+    memcpy(ptr, bkmer.b, sizeof(BinaryKmer));
+    memcpy(ptr+sizeof(BinaryKmer), covgs, gs->ncols*sizeof(Covg));
+    memcpy(ptr+sizeof(BinaryKmer)+gs->ncols*sizeof(Covg), edges,
+           gs->ncols*sizeof(Edges));
+  }
+
+  gs->curblk = b;
+  gs->curblk_nkmers = n;
+}
+
+// Single pass over all kmers to count prefixes and check the file is sorted
+static void graph_search_build_prefixes(GraphFileSearch *gs)
+{
+  GraphFileReader *file = gs->file;
+  const char *path = file_filter_path(&file->fltr);
+  size_t i, x, npfx = 1UL << (2*gs->pfxbases);
+  const size_t kmer_size = file->hdr.kmer_size;
+  BinaryKmer bkmer, prev;
+
+  if(!gs->mapping &&
+     graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
+    die("fseek failed: %s", strerror(errno));
+
+  for(i = 0; i < gs->nkmers; i++) {
+    if(gs->mapping) memcpy(bkmer.b, gs_record(gs, i), sizeof(BinaryKmer));
+    else if(graph_file_fread(file, gs->block, gs->entrysize) != gs->entrysize)
+      die("Cannot index graph: %s", path);
+    else memcpy(bkmer.b, gs->block, sizeof(BinaryKmer));
+    if(i > 0 && !binary_kmer_lt(prev, bkmer))
+      die("File is not sorted: %s", path);
+    x = gs->pfxbases ? graph_pfx_get(bkmer, kmer_size, gs->pfxbases) : 0;
+    gs->pfx[x+1]++;
+    prev = bkmer;
+  }
+
+  // Cumulative sum gives the index of the first kmer with each prefix
+  for(x = 0; x < npfx; x++) gs->pfx[x+1] += gs->pfx[x];
+}
+
+// Files sorted with `ctx sort --index` (or `ctx index --footer`) store the
+// prefix table after the kmers, so we map it rather than scan every kmer.
+// Returns false if there is no usable footer.
+static bool graph_search_load_footer(GraphFileSearch *gs)
+{
+  GraphFileReader *file = gs->file;
+  GraphFooter footer;
+
+  if(file->data_end == 0 ||
+     !graph_footer_read(gs->fd, file->file_size, &footer) ||
+     footer.nkmers != gs->nkmers || footer.pfxbases > file->hdr.kmer_size)
+    return false;
+
+  if(!gs->remote)
+    gs->pfx = graph_footer_map(gs->fd, &footer, &gs->pfxmap, &gs->pfxmaplen);
+  if(gs->pfx == NULL)
+    gs->pfx = graph_footer_load(gs->fd, &footer);
+  if(gs->pfx == NULL) {
+    warn("Cannot read index footer: %s", file_filter_path(&file->fltr));
+    return false;
+  }
+
+  if(gs->pfx[graph_pfx_len(footer.pfxbases)-1] != gs->nkmers) {
+    warn("Ignoring corrupt index footer: %s", file_filter_path(&file->fltr));
+    if(gs->pfxmap) munmap(gs->pfxmap, gs->pfxmaplen);
+    else ctx_free(gs->pfx);
+    gs->pfx = NULL;
+    gs->pfxmap = NULL;
+    return false;
+  }
+
+  gs->pfxbases = footer.pfxbases;
+  return true;
+}
+
 GraphFileSearch *graph_search_new(GraphFileReader *file)
 {
   if(file->num_of_kmers < 0) {
     warn("Cannot open GraphFileSearch with file stream");
     return NULL;
   }
-  size_t i;
+  if(file->pop != NULL) {
+    // Dictionary parts are each sorted, but not as a whole
+    warn("Cannot open GraphFileSearch on a population store");
+    return NULL;
+  }
   GraphFileSearch *gs = ctx_calloc(sizeof(GraphFileSearch), 1);
   gs->file = file;
   gs->nkmers = file->num_of_kmers;
   gs->ncols = file->hdr.num_of_cols;
   gs->entrysize = sizeof(BinaryKmer) + gs->ncols * (sizeof(Covg)+sizeof(Edges));
-  gs->nblocks = MIN2(gs->nkmers, INDEX_SIZE);
-  gs->blocksize = gs->nkmers / gs->nblocks;
-  gs->nblocks = (gs->nkmers+gs->blocksize-1) / gs->blocksize;
-  gs->index = ctx_calloc(sizeof(BinaryKmer), gs->nblocks+1); // sentinel
+
+  if(pthread_mutex_init(&gs->lock, NULL) != 0)
+    die("Mutex init failed: %s", strerror(errno));
+
+  if(graph_file_is_blocked(file)) {
+    graph_search_load_blocks(gs);
+    return gs;
+  }
+
+  gs->remote = remote_file_is_url(file_filter_path(&file->fltr));
+  gs->fd = graph_file_fileno(file);
+  bool has_footer = graph_search_load_footer(gs);
+
+  if(gs->remote) {
+    // Building prefixes would read every kmer, i.e. fetch the whole file.
+    // Without a footer, binary search all records instead, the cache keeps
+    // the top levels of the search. Sort order is not checked.
+    if(!has_footer) {
+      gs->pfxbases = 0;
+      gs->pfx = ctx_calloc(2, sizeof(uint64_t));
+      gs->pfx[1] = gs->nkmers;
+    }
+    status("[graph_search] on-disk-graph %zu cols %zu kmers prefix %zu bases "
+           "(remote, range reads)", gs->ncols, gs->nkmers, gs->pfxbases);
+    return gs;
+  }
+
   gs->block = ctx_calloc(MAX_LIN_SEARCH * gs->entrysize, 1);
-  memset(gs->index[gs->nblocks].b,0xff,BKMER_BYTES); // sentinel kmer
-  status("[graph_search] on-disk-graph %zu cols %zu blocks %zu bsize %zu kmers"
-         " building...", gs->ncols, gs->nblocks, gs->blocksize, gs->nkmers);
-  graph_file_set_buffered(file, 0); // Turn OFF buffered input
-  for(i = 0; i < gs->nblocks; i++) {
-    if(graph_file_fseek(file, graph_file_offset(file, i*gs->blocksize), SEEK_SET) != 0)
-      die("fseek failed: %s", strerror(errno));
-    if(graph_file_fread(file, &gs->index[i], sizeof(BinaryKmer)) != sizeof(BinaryKmer))
-      die("Cannot index graph: %s", file_filter_path(&gs->file->fltr));
+
+  // Map the file read-only, so lookups hit the page cache directly and
+  // several processes can share one copy of the graph
+  gs->maplen = graph_file_offset(file, gs->nkmers);
+  if(file->file_size >= 0 && (size_t)file->file_size >= gs->maplen) {
+    gs->mapping = mmap(NULL, gs->maplen, PROT_READ, MAP_SHARED,
+                       graph_file_fileno(file), 0);
+    if(gs->mapping == MAP_FAILED) gs->mapping = NULL;
+    else gs->records = gs->mapping + file->hdr_size;
   }
-  // check file is sorted
-  for(i = 0; i+1 < gs->nblocks; i++)
-    if(!binary_kmer_lt(gs->index[i],gs->index[i+1]))
-      die("File is not sorted: %s", file_filter_path(&file->fltr));
+
+  if(has_footer) {
+    status("[graph_search] on-disk-graph %zu cols %zu kmers prefix %zu bases "
+           "loaded from footer%s", gs->ncols, gs->nkmers, gs->pfxbases,
+           gs->mapping ? " (memory mapped)" : "");
+  }
+  else {
+    gs->pfxbases = graph_pfx_bases(gs->nkmers, file->hdr.kmer_size);
+    gs->pfx = ctx_calloc(graph_pfx_len(gs->pfxbases), sizeof(uint64_t));
+
+    status("[graph_search] on-disk-graph %zu cols %zu kmers prefix %zu bases "
+           "building%s...", gs->ncols, gs->nkmers, gs->pfxbases,
+           gs->mapping ? " (memory mapped)" : "");
+
+    graph_search_build_prefixes(gs);
+  }
+
+  #ifdef MADV_RANDOM
+    if(gs->mapping) madvise(gs->mapping, gs->maplen, MADV_RANDOM);
+  #endif
+
+  graph_file_set_buffered(file, 0); // Turn OFF buffered input
   status("[graph_search] Index built.");
   return gs;
 }
@@ -53,7 +252,13 @@ GraphFileSearch *graph_search_new(GraphFileReader *file)
 // We don't close the file
 void graph_search_destroy(GraphFileSearch *gs)
 {
+  if(gs->mapping) munmap(gs->mapping, gs->maplen);
+  pthread_mutex_destroy(&gs->lock);
+  gblock_buf_dealloc(&gs->blkindex);
+  graph_block_decoder_dealloc(&gs->dec);
   ctx_free(gs->index);
+  if(gs->pfxmap) munmap(gs->pfxmap, gs->pfxmaplen);
+  else ctx_free(gs->pfx);
   ctx_free(gs->block);
   ctx_free(gs);
 }
@@ -74,6 +279,48 @@ static inline int binary_search_index(BinaryKmer bkey,
   return -1;
 }
 
+// Binary search the in memory records in [start,end)
+// Return pointer to the matching record or NULL if not found
+static inline const void* search_mapped_sec(const GraphFileSearch *gs,
+                                            const char *records,
+                                            BinaryKmer bkey,
+                                            size_t start, size_t end)
+{
+  size_t mid;
+  BinaryKmer bmid;
+  const char *rec;
+  while(start < end) {
+    mid = (start+end) / 2;
+    rec = records + gs->entrysize*mid;
+    memcpy(bmid.b, rec, sizeof(BinaryKmer)); // may be unaligned
+    if(binary_kmer_eq(bkey,bmid)) return rec;
+    if(binary_kmer_lt(bkey,bmid)) end = mid;
+    else start = mid + 1;
+  }
+  return NULL;
+}
+
+// Binary search records [start,end) with pread, reading the match into `rec`
+// Returns true if found
+static inline bool search_pread_sec(const GraphFileSearch *gs, BinaryKmer bkey,
+                                    size_t start, size_t end, char *rec)
+{
+  const size_t hdrsize = gs->file->hdr_size;
+  size_t mid;
+  BinaryKmer bmid;
+  while(start < end) {
+    mid = (start+end) / 2;
+    if(remote_file_pread_fd(gs->fd, rec, gs->entrysize,
+                            hdrsize+gs->entrysize*mid) != (ssize_t)gs->entrysize)
+      die("Cannot search graph: %s", file_filter_path(&gs->file->fltr));
+    memcpy(bmid.b, rec, sizeof(BinaryKmer));
+    if(binary_kmer_eq(bkey,bmid)) return true;
+    if(binary_kmer_lt(bkey,bmid)) end = mid;
+    else start = mid + 1;
+  }
+  return false;
+}
+
 // Return pointer to block of Covgs+Edges
 static inline void* search_file_sec(GraphFileSearch *gs, BinaryKmer bkey,
                                     size_t start, size_t end)
@@ -135,23 +382,73 @@ static inline void filter_covgs_edges(const FileFilter *fltr,
   }
 }
 
-bool graph_search_find(GraphFileSearch *gs, BinaryKmer bkey,
-                       Covg *covgs, Edges *edges)
+static bool _graph_search_find(GraphFileSearch *gs, BinaryKmer bkey,
+                               Covg *covgs, Edges *edges)
 {
-  char *ptr;
-  // Binary search on the index
-  long x = binary_search_index(bkey,gs->index,gs->nblocks);
-  if(x < 0) return false;
-  size_t blockstart = x*gs->blocksize;
-  size_t blockend = (size_t)x+1 < gs->nblocks ? blockstart+gs->blocksize : gs->nkmers;
-  if((ptr = search_file_sec(gs, bkey, blockstart, blockend)) == NULL) return false;
+  const void *ptr;
+  char rec[gs->entrysize];
+  if(gs->blkindex.len) {
+    // Binary search on the block index
+    long x = binary_search_index(bkey,gs->index,gs->nblocks);
+    if(x < 0) return false;
+    graph_search_decode_block(gs, x);
+    ptr = search_mapped_sec(gs, gs->block, bkey, 0, gs->curblk_nkmers);
+    if(ptr == NULL) return false;
+    filter_covgs_edges(&gs->file->fltr, covgs, edges, ptr);
+    return true;
+  }
+  // Jump straight to the kmers sharing our prefix
+  size_t x = gs->pfxbases ? graph_pfx_get(bkey, gs->file->hdr.kmer_size,
+                                         gs->pfxbases) : 0;
+  size_t blockstart = gs->pfx[x], blockend = gs->pfx[x+1];
+  if(blockstart == blockend) return false;
+  if(gs->mapping)
+    ptr = search_mapped_sec(gs, gs->records, bkey, blockstart, blockend);
+  else if(gs->remote)
+    ptr = search_pread_sec(gs, bkey, blockstart, blockend, rec) ? rec : NULL;
+  else ptr = search_file_sec(gs, bkey, blockstart, blockend);
+  if(ptr == NULL) return false;
   filter_covgs_edges(&gs->file->fltr, covgs, edges, ptr);
   return true;
 }
 
-void graph_search_fetch(GraphFileSearch *gs, size_t idx, BinaryKmer *bkey,
-                        Covg *covgs, Edges *edges)
+bool graph_search_find_is_mt(const GraphFileSearch *gs)
 {
+  return (gs->mapping != NULL || gs->remote) && gs->blkindex.len == 0;
+}
+
+static void _graph_search_fetch(GraphFileSearch *gs, size_t idx,
+                                BinaryKmer *bkey, Covg *covgs, Edges *edges)
+{
+  if(gs->blkindex.len) {
+    // Find last block starting at or before idx
+    size_t l = 0, r = gs->nblocks, mid;
+    while(l+1 < r) {
+      mid = (l+r)/2;
+      if(gs->blkindex.b[mid].kmer_offset <= idx) l = mid;
+      else r = mid;
+    }
+    graph_search_decode_block(gs, l);
+    idx -= gs->blkindex.b[l].kmer_offset;
+    ctx_assert(idx < gs->curblk_nkmers);
+    memcpy(bkey, gs_block_record(gs, idx), sizeof(BinaryKmer));
+    filter_covgs_edges(&gs->file->fltr, covgs, edges, gs_block_record(gs, idx));
+    return;
+  }
+  if(gs->mapping) {
+    memcpy(bkey, gs_record(gs, idx), sizeof(BinaryKmer)); // copy binary kmer
+    filter_covgs_edges(&gs->file->fltr, covgs, edges, gs_record(gs, idx));
+    return;
+  }
+  if(gs->remote) {
+    char rec[gs->entrysize];
+    if(remote_file_pread_fd(gs->fd, rec, gs->entrysize,
+                            graph_file_offset(gs->file, idx)) != (ssize_t)gs->entrysize)
+      die("Cannot search graph: %s", file_filter_path(&gs->file->fltr));
+    memcpy(bkey, rec, sizeof(BinaryKmer));
+    filter_covgs_edges(&gs->file->fltr, covgs, edges, rec);
+    return;
+  }
   if(graph_file_fseek(gs->file, gs->file->hdr_size+gs->entrysize*idx, SEEK_SET) != 0)
     die("fseek failed: %s", strerror(errno));
   // read one entry
@@ -165,5 +462,29 @@ void graph_search_rand(GraphFileSearch *gs,
                        BinaryKmer *bkey, Covg *covgs, Edges *edges)
 {
   size_t idx = (rand() / (double)RAND_MAX) * gs->nkmers;
+  idx = MIN2(idx, gs->nkmers-1);
   graph_search_fetch(gs, idx, bkey, covgs, edges);
 }
+
+bool graph_search_find(GraphFileSearch *gs, BinaryKmer bkey,
+                       Covg *covgs, Edges *edges)
+{
+  if(graph_search_find_is_mt(gs))
+    return _graph_search_find(gs, bkey, covgs, edges);
+  pthread_mutex_lock(&gs->lock);
+  bool found = _graph_search_find(gs, bkey, covgs, edges);
+  pthread_mutex_unlock(&gs->lock);
+  return found;
+}
+
+void graph_search_fetch(GraphFileSearch *gs, size_t idx, BinaryKmer *bkey,
+                        Covg *covgs, Edges *edges)
+{
+  if(graph_search_find_is_mt(gs)) {
+    _graph_search_fetch(gs, idx, bkey, covgs, edges);
+  } else {
+    pthread_mutex_lock(&gs->lock);
+    _graph_search_fetch(gs, idx, bkey, covgs, edges);
+    pthread_mutex_unlock(&gs->lock);
+  }
+}
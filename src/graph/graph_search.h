@@ -8,6 +8,21 @@
 //
 // Search a sorted graph file on disk
 //
+// On opening we make one pass over the kmers to build a dense prefix table: the
+// first p bases (p picked from the number of kmers, up to 14) give the range of
+// records to binary search, so a lookup is one jump plus a short search.
+// Files written with `ctx sort --index` store the table in a footer (see
+// graph_footer.h), which is mapped instead of scanning the kmers.
+// If possible the file is memory mapped and searched without copying, so the
+// page cache can be shared between processes. Falls back to fseek()/fread().
+// Block compressed files (version 7) use the block index stored in the file,
+// decoding a single block per lookup. Remote files (URLs, see remote_file.h)
+// without a footer skip the prefix table and binary search with range reads.
+//
+// Lookups are thread safe. Only memory mapped or remote uncompressed files are
+// searched concurrently, other lookups share a buffer and are serialised by a
+// lock.
+//
 
 typedef struct GraphFileSearch GraphFileSearch;
 
@@ -17,6 +32,9 @@ void graph_search_destroy(GraphFileSearch *gs);
 bool graph_search_find(GraphFileSearch *gs, BinaryKmer bkey,
                        Covg *covgs, Edges *edges);
 
+// True if lookups run concurrently rather than taking turns on a lock
+bool graph_search_find_is_mt(const GraphFileSearch *gs);
+
 void graph_search_fetch(GraphFileSearch *gs, size_t idx,
                         BinaryKmer *bkey, Covg *covgs, Edges *edges);
 
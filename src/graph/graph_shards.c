@@ -0,0 +1,142 @@
+#include "global.h"
+#include "graph_shards.h"
+#include "file_util.h"
+#include "util.h"
+#include "dna.h"
+
+#include <libgen.h> // dirname
+
+// Same minimizer as build_part_router_add() picks for this kmer
+size_t graph_shard_of_kmer(BinaryKmer bkmer, size_t kmer_size, size_t nshards)
+{
+  const size_t m = MIN2(kmer_size, GRAPH_SHARD_MMER);
+  const uint64_t mask = (m == 32 ? UINT64_MAX : ((uint64_t)1 << (2*m)) - 1);
+  uint64_t fw = 0, rv = 0, h, minh = UINT64_MAX;
+  char str[MAX_KMER_SIZE+1];
+  Nucleotide nuc;
+  size_t i;
+
+  if(nshards <= 1) return 0;
+
+  binary_kmer_to_str(bkmer, kmer_size, str);
+  for(i = 0; i < kmer_size; i++) {
+    nuc = dna_char_to_nuc(str[i]);
+    fw = ((fw << 2) | nuc) & mask;
+    rv = (rv >> 2) | ((uint64_t)dna_nuc_complement(nuc) << (2*(m-1)));
+    if(i+1 >= m) {
+      h = graph_shard_mmer_hash(MIN2(fw, rv));
+      minh = MIN2(minh, h);
+    }
+  }
+
+  return graph_shard_of_hash(minh, nshards);
+}
+
+void graph_shards_alloc(GraphShards *gs, const char *manifest_path,
+                        size_t kmer_size, size_t num_shards)
+{
+  ctx_assert(num_shards > 0);
+  size_t i, baselen = strlen(manifest_path);
+  const char *dot = strrchr(manifest_path, '.'), *slash;
+  slash = strrchr(manifest_path, '/');
+  if(dot != NULL && (slash == NULL || dot > slash))
+    baselen = dot - manifest_path;
+
+  StrBuf path;
+  strbuf_alloc(&path, baselen+50);
+
+  gs->kmer_size = kmer_size;
+  gs->num_shards = num_shards;
+  gs->paths = ctx_calloc(num_shards, sizeof(char*));
+
+  for(i = 0; i < num_shards; i++) {
+    strbuf_reset(&path);
+    strbuf_append_strn(&path, manifest_path, baselen);
+    strbuf_sprintf(&path, ".%zu.ctx", i+1);
+    gs->paths[i] = strdup(path.b);
+  }
+
+  strbuf_dealloc(&path);
+}
+
+void graph_shards_dealloc(GraphShards *gs)
+{
+  size_t i;
+  for(i = 0; i < gs->num_shards; i++) free(gs->paths[i]);
+  ctx_free(gs->paths);
+  memset(gs, 0, sizeof(*gs));
+}
+
+void graph_shards_save(const GraphShards *gs, const char *manifest_path)
+{
+  size_t i;
+  const char *name;
+  FILE *fout = futil_fopen(manifest_path, "w");
+
+  fprintf(fout, "# mccortex graph shards\n");
+  fprintf(fout, "kmer_size %zu\n", gs->kmer_size);
+  fprintf(fout, "num_shards %zu\n", gs->num_shards);
+  for(i = 0; i < gs->num_shards; i++) {
+    // shards are written next to the manifest
+    name = strrchr(gs->paths[i], '/');
+    fprintf(fout, "shard %s\n", name ? name+1 : gs->paths[i]);
+  }
+
+  futil_fclose(fout);
+  status("[shards] Saved manifest of %zu shards to: %s",
+         gs->num_shards, manifest_path);
+}
+
+void graph_shards_load(GraphShards *gs, const char *manifest_path)
+{
+  FILE *fin = futil_fopen(manifest_path, "r");
+  StrBuf line, dir;
+  strbuf_alloc(&line, 1024);
+  strbuf_alloc(&dir, 1024);
+  futil_get_strbuf_of_dir_path(manifest_path, &dir);
+
+  size_t lineno = 0, nshards = 0, kmer_size = 0;
+  memset(gs, 0, sizeof(*gs));
+
+  while(strbuf_reset_readline(&line, fin) > 0)
+  {
+    lineno++;
+    strbuf_chomp(&line);
+    if(line.end == 0 || line.b[0] == '#') continue;
+
+    if(!strncmp(line.b, "kmer_size ", 10)) {
+      if(!parse_entire_size(line.b+10, &kmer_size) || kmer_size == 0)
+        die("Bad kmer_size [%s:%zu]: %s", manifest_path, lineno, line.b);
+    }
+    else if(!strncmp(line.b, "num_shards ", 11)) {
+      if(gs->paths != NULL || !parse_entire_size(line.b+11, &gs->num_shards) ||
+         gs->num_shards == 0)
+        die("Bad num_shards [%s:%zu]: %s", manifest_path, lineno, line.b);
+      gs->paths = ctx_calloc(gs->num_shards, sizeof(char*));
+    }
+    else if(!strncmp(line.b, "shard ", 6)) {
+      if(nshards == gs->num_shards)
+        die("Too many shards [%s:%zu]: %s", manifest_path, lineno, line.b);
+      if(line.b[6] == '/') gs->paths[nshards] = strdup(line.b+6);
+      else {
+        size_t dirlen = dir.end;
+        strbuf_append_str(&dir, line.b+6);
+        gs->paths[nshards] = strdup(dir.b);
+        strbuf_shrink(&dir, dirlen);
+      }
+      nshards++;
+    }
+    else die("Bad line [%s:%zu]: %s", manifest_path, lineno, line.b);
+  }
+
+  if(nshards == 0 || nshards != gs->num_shards) {
+    die("Manifest lists %zu shards, expected %zu: %s",
+        nshards, gs->num_shards, manifest_path);
+  }
+
+  gs->kmer_size = kmer_size;
+
+  futil_fclose(fin);
+  strbuf_dealloc(&line);
+  strbuf_dealloc(&dir);
+}
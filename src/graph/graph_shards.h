@@ -0,0 +1,66 @@
+#ifndef GRAPH_SHARDS_H_
+#define GRAPH_SHARDS_H_
+
+//
+// Graphs split into minimizer shards
+//
+// A kmer's shard is picked from the hash of its canonical minimizer, so
+// consecutive kmers (and so most of a unitig) usually land in the same shard.
+// A kmer and its reverse complement always have the same minimizer.
+//
+// A sharded graph is a set of sorted graph files, one per shard, with a text
+// manifest listing them:
+//
+//   # mccortex graph shards
+//   kmer_size 31
+//   num_shards 4
+//   shard graph.1.ctx
+//   ...
+//
+// Shard paths are relative to the directory of the manifest. Each shard file
+// has the full header (sample names and read stats) of the whole graph.
+//
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+
+// Minimizer length (shortened to kmer size for small k)
+#define GRAPH_SHARD_MMER 15
+
+// Mix bits of a canonical minimizer (MurmurHash3 finaliser) so that low
+// complexity minimizers (e.g. AAAA...) don't all land in one shard
+static inline uint64_t graph_shard_mmer_hash(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Shards use the high bits of the minimizer hash, leaving the low bits to
+// pick a partition in build --partitioned
+#define graph_shard_of_hash(h,nshards) (((h) >> 32) % (nshards))
+
+// Returns shard 0..nshards-1 of a kmer
+size_t graph_shard_of_kmer(BinaryKmer bkmer, size_t kmer_size, size_t nshards);
+
+typedef struct
+{
+  size_t kmer_size, num_shards;
+  char **paths; // [num_shards] paths to shard graph files
+} GraphShards;
+
+// Make shard paths from the manifest path: out.shards -> out.1.ctx, ...
+void graph_shards_alloc(GraphShards *gs, const char *manifest_path,
+                        size_t kmer_size, size_t num_shards);
+void graph_shards_dealloc(GraphShards *gs);
+
+// Write manifest, call die() on error. Overwrites any existing file.
+void graph_shards_save(const GraphShards *gs, const char *manifest_path);
+
+// Read manifest, call die() on error
+void graph_shards_load(GraphShards *gs, const char *manifest_path);
+
+#endif /* GRAPH_SHARDS_H_ */
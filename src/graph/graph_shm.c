@@ -0,0 +1,384 @@
+#include "global.h"
+#include "graph_shm.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct dBGraphShm
+{
+  void *mem;
+  size_t len;
+};
+
+#define shm_align(x) (((x) + GRAPH_SHM_ALIGN - 1) & ~(GRAPH_SHM_ALIGN - 1))
+
+// Which optional arrays are in the segment
+#define SHM_TAGS      1
+#define SHM_COLMAJOR  2
+
+typedef struct
+{
+  char magic[8];
+  uint32_t kmer_size, bkmer_words, covg_bytes, flags;
+  uint32_t bucket_size, seed;
+  uint64_t hash_mask, ncols, nedgecols, ncols_used;
+  uint64_t capacity, nbuckets, nkmers;
+  uint64_t collisions[REHASH_LIMIT];
+  uint64_t len; // size of the segment in bytes
+  // offsets of arrays from the start of the segment, 0 if not present
+  uint64_t table, buckets, tags, edges, covgs, in_cols;
+} GraphShmHdr;
+
+typedef struct
+{
+  uint64_t total_sequence, clean_unitigs_thresh, clean_kmers_thresh;
+  double seq_err;
+  uint32_t mean_read_length, sample_name_len, isec_name_len;
+  uint8_t cleaned[4];
+} GraphShmInfo;
+
+// Open segment `name`, a file if it contains a slash
+static int shm_name_open(const char *name, int flags, mode_t mode)
+{
+  if(strchr(name, '/') != NULL) return open(name, flags, mode);
+  char shmname[PATH_MAX+1];
+  snprintf(shmname, sizeof(shmname), "/mccortex.%s", name);
+  return shm_open(shmname, flags, mode);
+}
+
+static int shm_name_unlink(const char *name)
+{
+  if(strchr(name, '/') != NULL) return unlink(name);
+  char shmname[PATH_MAX+1];
+  snprintf(shmname, sizeof(shmname), "/mccortex.%s", name);
+  return shm_unlink(shmname);
+}
+
+bool graph_shm_exists(const char *name)
+{
+  int fd = shm_name_open(name, O_RDONLY, 0);
+  if(fd < 0) return false;
+  close(fd);
+  return true;
+}
+
+void graph_shm_remove(const char *name)
+{
+  if(shm_name_unlink(name) != 0)
+    die("Cannot remove graph segment: %s [%s]", name, strerror(errno));
+  status("[shm] Removed graph segment: %s", name);
+}
+
+// Add array of `nbytes` to the layout, returns its offset or 0 if empty
+static uint64_t shm_layout_add(uint64_t *len, size_t nbytes)
+{
+  if(nbytes == 0) return 0;
+  uint64_t offset = shm_align(*len);
+  *len = offset + nbytes;
+  return offset;
+}
+
+static size_t shm_ginfo_bytes(const GraphInfo *ginfo)
+{
+  return sizeof(GraphShmInfo) + ginfo->sample_name.end +
+         ginfo->cleaning.intersection_name.end;
+}
+
+static uint8_t* shm_write_ginfo(uint8_t *ptr, const GraphInfo *ginfo)
+{
+  const ErrorCleaning *ec = &ginfo->cleaning;
+  GraphShmInfo info = {.total_sequence = ginfo->total_sequence,
+                       .clean_unitigs_thresh = ec->clean_unitigs_thresh,
+                       .clean_kmers_thresh = ec->clean_kmers_thresh,
+                       .seq_err = ginfo->seq_err,
+                       .mean_read_length = ginfo->mean_read_length,
+                       .sample_name_len = ginfo->sample_name.end,
+                       .isec_name_len = ec->intersection_name.end,
+                       .cleaned = {ec->cleaned_tips, ec->cleaned_unitigs,
+                                   ec->cleaned_kmers,
+                                   ec->is_graph_intersection}};
+  memcpy(ptr, &info, sizeof(info));
+  ptr += sizeof(info);
+  memcpy(ptr, ginfo->sample_name.b, info.sample_name_len);
+  ptr += info.sample_name_len;
+  memcpy(ptr, ec->intersection_name.b, info.isec_name_len);
+  return ptr + info.isec_name_len;
+}
+
+void graph_shm_save(const char *name, const dBGraph *db_graph)
+{
+  const HashTable *ht = &db_graph->ht;
+  size_t i, capacity = ht->capacity, ncols = db_graph->num_of_cols;
+  size_t ginfo_bytes = 0;
+
+  if(db_graph->sparse || db_graph->shared_edges || db_graph->disk)
+    die("Cannot share sparse, shared-edge or on-disk graphs");
+  if(db_graph->covg_ovf != NULL)
+    die("Cannot share a graph built with COVG_BITS=%i", COVG_BITS);
+  if(db_graph->ht.slot_table != NULL)
+    die("Cannot share a relaid out graph");
+  if(db_graph->ht.colocated)
+    die("Cannot share a graph with bucket headers");
+  if(db_graph->covg_slot != NULL)
+    die("Cannot share a graph with presence-only colours");
+
+  for(i = 0; i < ncols; i++) ginfo_bytes += shm_ginfo_bytes(&db_graph->ginfo[i]);
+
+  GraphShmHdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.kmer_size = db_graph->kmer_size;
+  hdr.bkmer_words = NUM_BKMER_WORDS;
+  hdr.covg_bytes = sizeof(CovgStore);
+  hdr.flags = (ht->tags ? SHM_TAGS : 0) |
+              (db_graph->col_major ? SHM_COLMAJOR : 0);
+  hdr.bucket_size = ht->bucket_size;
+  hdr.seed = ht->seed;
+  hdr.hash_mask = ht->hash_mask;
+  hdr.ncols = ncols;
+  hdr.nedgecols = db_graph->num_edge_cols;
+  hdr.ncols_used = db_graph->num_of_cols_used;
+  hdr.capacity = capacity;
+  hdr.nbuckets = ht->num_of_buckets;
+  hdr.nkmers = ht->num_kmers;
+  memcpy(hdr.collisions, ht->collisions, sizeof(hdr.collisions));
+
+  // Lay out arrays
+  uint64_t len = sizeof(GraphShmHdr) + ginfo_bytes;
+  hdr.table   = shm_layout_add(&len, capacity * sizeof(BinaryKmer));
+  hdr.buckets = shm_layout_add(&len, ht->num_of_buckets * sizeof(uint8_t[2]));
+  hdr.tags    = ht->tags ? shm_layout_add(&len, capacity) : 0;
+  hdr.edges   = db_graph->col_edges == NULL ? 0 :
+                shm_layout_add(&len, capacity*hdr.nedgecols*sizeof(Edges));
+  hdr.covgs   = db_graph->col_covgs == NULL ? 0 :
+                shm_layout_add(&len, capacity*ncols*sizeof(CovgStore));
+  hdr.in_cols = db_graph->node_in_cols == NULL ? 0 :
+                shm_layout_add(&len, roundup_bits2bytes(capacity)*ncols);
+
+  // hugetlbfs files must be a multiple of the huge page size
+  hdr.len = shm_align(len);
+
+  // Replace, rather than overwrite, so processes using an old segment are
+  // not affected
+  if(shm_name_unlink(name) != 0 && errno != ENOENT)
+    die("Cannot replace graph segment: %s [%s]", name, strerror(errno));
+
+  int fd = shm_name_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if(fd < 0) die("Cannot create graph segment: %s [%s]", name, strerror(errno));
+
+  if(ftruncate(fd, hdr.len) != 0) {
+    shm_name_unlink(name);
+    die("Cannot resize graph segment: %s [%s]", name, strerror(errno));
+  }
+
+  uint8_t *mem = mmap(NULL, hdr.len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(mem == MAP_FAILED) {
+    shm_name_unlink(name);
+    die("Cannot map graph segment: %s [%s]", name, strerror(errno));
+  }
+  close(fd);
+
+  uint8_t *ptr = mem + sizeof(GraphShmHdr);
+  for(i = 0; i < ncols; i++) ptr = shm_write_ginfo(ptr, &db_graph->ginfo[i]);
+
+  memcpy(mem + hdr.table, ht->table, capacity * sizeof(BinaryKmer));
+  memcpy(mem + hdr.buckets, ht->buckets, ht->num_of_buckets * sizeof(uint8_t[2]));
+  if(hdr.tags) memcpy(mem + hdr.tags, ht->tags, capacity);
+  if(hdr.edges)
+    memcpy(mem + hdr.edges, db_graph->col_edges,
+           capacity * hdr.nedgecols * sizeof(Edges));
+  if(hdr.covgs)
+    memcpy(mem + hdr.covgs, db_graph->col_covgs,
+           capacity * ncols * sizeof(CovgStore));
+  if(hdr.in_cols)
+    memcpy(mem + hdr.in_cols, db_graph->node_in_cols,
+           roundup_bits2bytes(capacity) * ncols);
+
+  // Write the header last, so a partly written segment is never attached
+  memcpy(hdr.magic, GRAPH_SHM_MAGIC, sizeof(hdr.magic));
+  memcpy(mem, &hdr, sizeof(hdr));
+  munmap(mem, hdr.len);
+
+  char kmers_str[50], mem_str[50];
+  ulong_to_str(hdr.nkmers, kmers_str);
+  bytes_to_str(hdr.len, 1, mem_str);
+  status("[shm] Saved %s kmers to graph segment %s (%s)",
+         kmers_str, name, mem_str);
+}
+
+// Check array [offset, offset+nbytes) is in the segment
+static void shm_check_array(uint64_t offset, size_t nbytes, size_t len,
+                            const char *name)
+{
+  if(offset < sizeof(GraphShmHdr) || offset > len || nbytes > len - offset)
+    die("Corrupt graph segment: %s", name);
+}
+
+static void shm_read_str(StrBuf *sbuf, const uint8_t *ptr, size_t len)
+{
+  strbuf_ensure_capacity(sbuf, len);
+  memcpy(sbuf->b, ptr, len);
+  sbuf->b[len] = '\0';
+  sbuf->end = len;
+}
+
+static const uint8_t* shm_read_ginfo(const uint8_t *ptr, const uint8_t *end,
+                                     GraphInfo *ginfo, const char *name)
+{
+  ErrorCleaning *ec = &ginfo->cleaning;
+  GraphShmInfo info;
+
+  if((size_t)(end - ptr) < sizeof(info)) die("Corrupt graph segment: %s", name);
+  memcpy(&info, ptr, sizeof(info));
+  ptr += sizeof(info);
+
+  if((size_t)(end - ptr) < (size_t)info.sample_name_len + info.isec_name_len)
+    die("Corrupt graph segment: %s", name);
+
+  ginfo->total_sequence = info.total_sequence;
+  ginfo->mean_read_length = info.mean_read_length;
+  ginfo->seq_err = info.seq_err;
+  ec->clean_unitigs_thresh = info.clean_unitigs_thresh;
+  ec->clean_kmers_thresh = info.clean_kmers_thresh;
+  ec->cleaned_tips = info.cleaned[0];
+  ec->cleaned_unitigs = info.cleaned[1];
+  ec->cleaned_kmers = info.cleaned[2];
+  ec->is_graph_intersection = info.cleaned[3];
+
+  shm_read_str(&ginfo->sample_name, ptr, info.sample_name_len);
+  ptr += info.sample_name_len;
+  shm_read_str(&ec->intersection_name, ptr, info.isec_name_len);
+  return ptr + info.isec_name_len;
+}
+
+void graph_shm_attach(const char *name, dBGraph *db_graph, int alloc_flags)
+{
+  struct stat st;
+  size_t i;
+
+  int fd = shm_name_open(name, O_RDONLY, 0);
+  if(fd < 0) die("Cannot open graph segment: %s [%s]", name, strerror(errno));
+  if(fstat(fd, &st) != 0)
+    die("Cannot stat graph segment: %s [%s]", name, strerror(errno));
+
+  size_t len = st.st_size;
+  if(len < sizeof(GraphShmHdr)) die("Not a graph segment: %s", name);
+
+  // Private mapping: writes are copy-on-write, the segment is never modified
+  uint8_t *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(mem == MAP_FAILED)
+    die("Cannot map graph segment: %s [%s]", name, strerror(errno));
+  close(fd);
+
+  GraphShmHdr hdr;
+  memcpy(&hdr, mem, sizeof(hdr));
+
+  if(memcmp(hdr.magic, GRAPH_SHM_MAGIC, sizeof(hdr.magic)) != 0)
+    die("Not a graph segment (or still being written): %s", name);
+
+  if(hdr.bkmer_words != NUM_BKMER_WORDS || hdr.kmer_size > MAX_KMER_SIZE ||
+     hdr.kmer_size < MIN_KMER_SIZE) {
+    die("Graph segment has kmer size %u, this binary supports %i-%i: %s",
+        hdr.kmer_size, MIN_KMER_SIZE, MAX_KMER_SIZE, name);
+  }
+
+  if(hdr.covgs && hdr.covg_bytes != sizeof(CovgStore))
+    die("Cannot use graph segment with COVG_BITS=%i: %s", COVG_BITS, name);
+
+  if(hdr.len > len || hdr.ncols == 0 || hdr.ncols_used > hdr.ncols ||
+     hdr.capacity == 0 || hdr.nkmers > hdr.capacity ||
+     hdr.capacity != hdr.nbuckets * hdr.bucket_size ||
+     (hdr.nedgecols != 0 && hdr.nedgecols != 1 && hdr.nedgecols != hdr.ncols))
+    die("Corrupt graph segment: %s", name);
+
+  shm_check_array(hdr.table, hdr.capacity * sizeof(BinaryKmer), len, name);
+  shm_check_array(hdr.buckets, hdr.nbuckets * sizeof(uint8_t[2]), len, name);
+  if(hdr.tags) shm_check_array(hdr.tags, hdr.capacity, len, name);
+  if(hdr.edges)
+    shm_check_array(hdr.edges, hdr.capacity*hdr.nedgecols*sizeof(Edges), len, name);
+  if(hdr.covgs)
+    shm_check_array(hdr.covgs, hdr.capacity*hdr.ncols*sizeof(CovgStore), len, name);
+  if(hdr.in_cols)
+    shm_check_array(hdr.in_cols, roundup_bits2bytes(hdr.capacity)*hdr.ncols,
+                    len, name);
+
+  if((alloc_flags & DBG_ALLOC_EDGES) && !hdr.edges)
+    die("Graph segment has no edges: %s", name);
+  if((alloc_flags & DBG_ALLOC_COVGS) && !hdr.covgs)
+    die("Graph segment has no coverages: %s", name);
+  if((alloc_flags & DBG_ALLOC_NODE_IN_COL) && !hdr.in_cols)
+    die("Graph segment has no per colour kmer sets: %s", name);
+
+  HashTable ht = {.table = (BinaryKmer*)(mem + hdr.table),
+                  .num_of_buckets = hdr.nbuckets,
+                  .hash_mask = hdr.hash_mask,
+                  .bucket_size = hdr.bucket_size,
+                  .capacity = hdr.capacity,
+                  .buckets = mem + hdr.buckets,
+                  .tags = hdr.tags ? mem + hdr.tags : NULL,
+                  .large_pages = false,
+                  .num_kmers = hdr.nkmers,
+                  .collisions = {0},
+                  .seed = hdr.seed};
+  memcpy(ht.collisions, hdr.collisions, sizeof(hdr.collisions));
+
+  dBGraph tmp = {.kmer_size = hdr.kmer_size,
+                 .num_of_cols = hdr.ncols,
+                 .num_edge_cols = hdr.nedgecols,
+                 .num_covg_cols = hdr.ncols,
+                 .num_of_cols_used = hdr.ncols_used,
+                 .ht_lockfree = !!(alloc_flags & DBG_ALLOC_HT_LOCKFREE),
+                 .large_pages = false,
+                 .col_major = !!(hdr.flags & SHM_COLMAJOR)};
+
+  memcpy(&tmp.ht, &ht, sizeof(HashTable));
+
+  if(alloc_flags & DBG_ALLOC_EDGES)
+    tmp.col_edges = (Edges*)(mem + hdr.edges);
+  if(alloc_flags & DBG_ALLOC_COVGS)
+    tmp.col_covgs = (CovgStore*)(mem + hdr.covgs);
+  if(alloc_flags & DBG_ALLOC_NODE_IN_COL)
+    tmp.node_in_cols = mem + hdr.in_cols;
+
+  if(alloc_flags & (DBG_ALLOC_BKTLOCKS | DBG_ALLOC_HT_LOCKFREE))
+    tmp.bktlocks = ctx_calloc(roundup_bits2bytes(hdr.nbuckets), 1);
+  if(alloc_flags & DBG_ALLOC_READSTRT)
+    tmp.readstrt = ctx_calloc(roundup_bits2bytes(hdr.capacity)*2, 1);
+
+  const uint8_t *ptr = mem + sizeof(GraphShmHdr), *end = mem + hdr.table;
+  tmp.ginfo = ctx_calloc(hdr.ncols, sizeof(GraphInfo));
+  for(i = 0; i < hdr.ncols; i++) {
+    graph_info_alloc(&tmp.ginfo[i]);
+    ptr = shm_read_ginfo(ptr, end, &tmp.ginfo[i], name);
+  }
+
+  tmp.shm = ctx_malloc(sizeof(dBGraphShm));
+  tmp.shm->mem = mem;
+  tmp.shm->len = len;
+
+  memcpy(db_graph, &tmp, sizeof(dBGraph));
+
+  char kmers_str[50], cap_str[50];
+  ulong_to_str(hdr.nkmers, kmers_str);
+  ulong_to_str(hdr.capacity, cap_str);
+  status("[shm] Attached graph segment %s: %s kmers, capacity %s, "
+         "kmer-size %u, colours %zu", name, kmers_str, cap_str,
+         hdr.kmer_size, (size_t)hdr.ncols);
+}
+
+void graph_shm_detach(dBGraph *db_graph)
+{
+  dBGraphShm *shm = db_graph->shm;
+  if(shm == NULL) return;
+  hash_table_filter_free(&db_graph->ht);
+  munmap(shm->mem, shm->len);
+  ctx_free(shm);
+  memset(&db_graph->ht, 0, sizeof(HashTable));
+  db_graph->col_edges = NULL;
+  db_graph->col_covgs = NULL;
+  db_graph->node_in_cols = NULL;
+  db_graph->shm = NULL;
+}
@@ -0,0 +1,57 @@
+#ifndef GRAPH_SHM_H_
+#define GRAPH_SHM_H_
+
+//
+// Graphs shared between processes on the same host
+//
+// `load --shm <name>` loads graph files once and copies the hash table and
+// colour arrays into a shared memory segment. Commands given
+// --graph-shm <name> then map the segment instead of calling graph_load():
+// the dBGraph's table, buckets, tags, col_edges, col_covgs and node_in_cols
+// point straight into the mapping. The mapping is private (copy-on-write), so
+// pages are shared until a command writes to them and the segment itself is
+// never modified by its users.
+//
+// <name> is a POSIX shared memory object (/dev/shm/mccortex.<name> on Linux),
+// or a file path if it contains a '/' (e.g. a file on a hugetlbfs mount).
+// Arrays start on 2MB boundaries so they can be backed by huge pages.
+// Segments persist until removed with `load --remove <name>`.
+//
+// Segments are specific to the build that wrote them (MAXK, COVG_BITS).
+// Links, sparse, shared-edge and on-disk graphs are not supported.
+//
+// Layout:
+//   GraphShmHdr, num_of_cols x (GraphShmInfo, sample name, intersection name)
+//   [align] capacity x BinaryKmer  [align] num_of_buckets x uint8_t[2]
+//   [align] [capacity x uint8_t tags]
+//   [align] [capacity*num_edge_cols x Edges]
+//   [align] [capacity*num_of_cols x CovgStore]
+//   [align] [roundup_bits2bytes(capacity)*num_of_cols bytes node_in_cols]
+//
+
+#include "db_graph.h"
+
+#define GRAPH_SHM_MAGIC "CTXSHM01"
+#define GRAPH_SHM_ALIGN (2UL<<20)
+
+// Copy a loaded graph into segment `name`, replacing any existing segment.
+// Dies on error.
+void graph_shm_save(const char *name, const dBGraph *db_graph);
+
+// Map segment `name` into `db_graph`, which must not be allocated.
+// `alloc_flags` are DBG_ALLOC_* values: the segment must have the arrays
+// requested (edges, covgs, node_in_cols); bucket locks and read starts are
+// allocated as normal. Arrays not requested are left NULL.
+// Dies on error. Free with db_graph_dealloc().
+void graph_shm_attach(const char *name, dBGraph *db_graph, int alloc_flags);
+
+// Unmap arrays, called by db_graph_dealloc()
+void graph_shm_detach(dBGraph *db_graph);
+
+// Returns true if segment `name` exists and can be opened for reading
+bool graph_shm_exists(const char *name);
+
+// Delete segment `name`. Processes that have it mapped are not affected.
+void graph_shm_remove(const char *name);
+
+#endif /* GRAPH_SHM_H_ */
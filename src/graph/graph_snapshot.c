@@ -0,0 +1,451 @@
+#include "global.h"
+#include "graph_snapshot.h"
+#include "util.h"
+#include "file_util.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Offset of the progress marker, after the magic, version and kmer size
+#define SNAP_PROGRESS_OFFSET (strlen(GRAPH_SNAPSHOT_MAGIC) + 2*sizeof(uint32_t))
+
+// Which optional arrays are in the file
+#define SNAP_EDGES     1
+#define SNAP_COVGS     2
+#define SNAP_IN_COLS   4
+#define SNAP_TAGS      8
+#define SNAP_PATHS    16
+#define SNAP_NSEEN    32
+#define SNAP_COLMAJOR 64
+
+// Number of path list heads converted per write / read
+#define SNAP_PATHS_BLOCK (1<<16)
+
+bool graph_snapshot_is_file(const char *path)
+{
+  char magic[sizeof(GRAPH_SNAPSHOT_MAGIC)];
+  FILE *fin = fopen(path, "r");
+  if(fin == NULL) return false;
+  bool ret = (fread(magic, 1, sizeof(magic)-1, fin) == sizeof(magic)-1 &&
+              memcmp(magic, GRAPH_SNAPSHOT_MAGIC, sizeof(magic)-1) == 0);
+  fclose(fin);
+  return ret;
+}
+
+void graph_snapshot_progress_init(SnapshotProgress *progress, const char *cmd)
+{
+  memset(progress, 0, sizeof(*progress));
+  strncpy(progress->cmd, cmd, GRAPH_SNAPSHOT_CMDLEN-1);
+}
+
+//
+// Writing
+//
+
+static void snap_write(const void *ptr, size_t nbytes,
+                       FILE *fout, const char *path)
+{
+  if(nbytes && fwrite(ptr, 1, nbytes, fout) != nbytes)
+    die("Cannot write to file: %s", path);
+}
+
+#define snap_write_val(val,fout,path) snap_write(&(val),sizeof(val),fout,path)
+
+static void snap_write_progress(const SnapshotProgress *progress,
+                                FILE *fout, const char *path)
+{
+  snap_write(progress->cmd, GRAPH_SNAPSHOT_CMDLEN, fout, path);
+  snap_write_val(progress->next_hkey, fout, path);
+  snap_write_val(progress->nitems,    fout, path);
+  snap_write_val(progress->out_bytes, fout, path);
+}
+
+static void snap_write_str(const StrBuf *sbuf, FILE *fout, const char *path)
+{
+  uint32_t len = sbuf->end;
+  snap_write_val(len, fout, path);
+  snap_write(sbuf->b, len, fout, path);
+}
+
+static void snap_write_ginfo(const GraphInfo *ginfo,
+                             FILE *fout, const char *path)
+{
+  const ErrorCleaning *ec = &ginfo->cleaning;
+  uint8_t cleaned[4] = {ec->cleaned_tips, ec->cleaned_unitigs,
+                        ec->cleaned_kmers, ec->is_graph_intersection};
+  double seq_err = ginfo->seq_err;
+
+  snap_write_val(ginfo->mean_read_length,   fout, path);
+  snap_write_val(ginfo->total_sequence,     fout, path);
+  snap_write_val(seq_err,                   fout, path);
+  snap_write_val(cleaned,                   fout, path);
+  snap_write_val(ec->clean_unitigs_thresh,  fout, path);
+  snap_write_val(ec->clean_kmers_thresh,    fout, path);
+  snap_write_str(&ginfo->sample_name,       fout, path);
+  snap_write_str(&ec->intersection_name,    fout, path);
+}
+
+// Paths are stored as they are in memory. Their offsets to their sequence and
+// to the next path are relative, so only the list heads need converting.
+static void snap_write_paths(const GPathStore *gpstore, size_t capacity,
+                             FILE *fout, const char *path)
+{
+  const GPathSet *gpset = &gpstore->gpset;
+  uint64_t ncols = gpset->ncols;
+  uint64_t elen = gpset->entries.len, esize = gpset->entries.size;
+  uint64_t slen = gpset->seqs.len, ssize = gpset->seqs.size;
+  uint64_t nseen_len = gpath_set_has_nseen(gpset) ? elen * ncols : 0;
+  size_t i, j, end;
+
+  snap_write_val(ncols, fout, path);
+  snap_write_val(gpstore->num_kmers_with_paths, fout, path);
+  snap_write_val(gpstore->num_paths, fout, path);
+  snap_write_val(gpstore->path_bytes, fout, path);
+  snap_write_val(elen, fout, path);
+  snap_write_val(esize, fout, path);
+  snap_write_val(slen, fout, path);
+  snap_write_val(ssize, fout, path);
+  snap_write_val(nseen_len, fout, path);
+
+  snap_write(gpset->entries.b, elen * sizeof(GPath), fout, path);
+  snap_write(gpset->seqs.b, slen, fout, path);
+  if(gpath_set_has_nseen(gpset))
+    snap_write(gpset->nseen_buf.b, elen * ncols, fout, path);
+
+  uint64_t *heads = ctx_malloc(SNAP_PATHS_BLOCK * sizeof(uint64_t));
+  for(i = 0; i < capacity; i = end) {
+    end = MIN2(i + SNAP_PATHS_BLOCK, capacity);
+    for(j = i; j < end; j++) {
+      const GPath *gpath = gpstore->paths_all[j];
+      heads[j-i] = gpath ? gpset_get_pkey(gpset, gpath) + 1 : 0;
+    }
+    snap_write(heads, (end - i) * sizeof(uint64_t), fout, path);
+  }
+  ctx_free(heads);
+}
+
+void graph_snapshot_save(const char *path, const dBGraph *db_graph,
+                         const SnapshotProgress *progress)
+{
+  const HashTable *ht = &db_graph->ht;
+  const GPathStore *gpstore = &db_graph->gpstore;
+  size_t i, capacity = ht->capacity;
+
+  if(db_graph->sparse || db_graph->shared_edges || db_graph->disk)
+    die("Cannot snapshot sparse, shared-edge or on-disk graphs");
+  if(db_graph->covg_ovf != NULL)
+    die("Cannot snapshot a graph built with COVG_BITS=%i", COVG_BITS);
+  if(db_graph->ht.slot_table != NULL)
+    die("Cannot snapshot a relaid out graph");
+  if(db_graph->ht.colocated)
+    die("Cannot snapshot a graph with bucket headers");
+  if(db_graph->covg_slot != NULL)
+    die("Cannot snapshot a graph with presence-only colours");
+  if(gpstore->paths_all != NULL && gpstore->paths_traverse != gpstore->paths_all)
+    die("Cannot snapshot split read/write link lists");
+
+  uint32_t version = GRAPH_SNAPSHOT_VERSION, kmer_size = db_graph->kmer_size;
+  uint32_t bkmer_words = NUM_BKMER_WORDS, flags = 0;
+  uint32_t bucket_size = ht->bucket_size, seed = ht->seed;
+  uint64_t ncols = db_graph->num_of_cols, nedgecols = db_graph->num_edge_cols;
+  uint64_t ncols_used = db_graph->num_of_cols_used, cap64 = capacity;
+  uint64_t nbuckets = ht->num_of_buckets, nkmers = ht->num_kmers;
+
+  if(db_graph->col_edges)    flags |= SNAP_EDGES;
+  if(db_graph->col_covgs)    flags |= SNAP_COVGS;
+  if(db_graph->node_in_cols) flags |= SNAP_IN_COLS;
+  if(ht->tags)               flags |= SNAP_TAGS;
+  if(gpstore->paths_all)     flags |= SNAP_PATHS;
+  if(gpstore->paths_all && gpath_set_has_nseen(&gpstore->gpset))
+    flags |= SNAP_NSEEN;
+  if(db_graph->col_major)    flags |= SNAP_COLMAJOR;
+
+  StrBuf tmp_path;
+  strbuf_alloc(&tmp_path, strlen(path) + 10);
+  strbuf_sprintf(&tmp_path, "%s.tmp", path);
+
+  FILE *fout = fopen(tmp_path.b, "w");
+  if(fout == NULL) die("Cannot open file: %s", tmp_path.b);
+
+  snap_write(GRAPH_SNAPSHOT_MAGIC, strlen(GRAPH_SNAPSHOT_MAGIC), fout, path);
+  snap_write_val(version,   fout, path);
+  snap_write_val(kmer_size, fout, path);
+  snap_write_progress(progress, fout, path);
+  snap_write_val(bkmer_words, fout, path);
+  snap_write_val(flags,       fout, path);
+  snap_write_val(ncols,       fout, path);
+  snap_write_val(nedgecols,   fout, path);
+  snap_write_val(ncols_used,  fout, path);
+  snap_write_val(cap64,       fout, path);
+  snap_write_val(nbuckets,    fout, path);
+  snap_write_val(bucket_size, fout, path);
+  snap_write_val(seed,        fout, path);
+  snap_write_val(nkmers,      fout, path);
+  snap_write(ht->collisions, REHASH_LIMIT * sizeof(uint64_t), fout, path);
+
+  for(i = 0; i < ncols; i++)
+    snap_write_ginfo(&db_graph->ginfo[i], fout, path);
+
+  snap_write(ht->table, capacity * sizeof(BinaryKmer), fout, path);
+  snap_write(ht->buckets, nbuckets * sizeof(uint8_t[2]), fout, path);
+  if(ht->tags) snap_write(ht->tags, capacity, fout, path);
+
+  if(db_graph->col_edges)
+    snap_write(db_graph->col_edges, capacity*nedgecols*sizeof(Edges), fout, path);
+  if(db_graph->col_covgs)
+    snap_write(db_graph->col_covgs, capacity*ncols*sizeof(CovgStore), fout, path);
+  if(db_graph->node_in_cols)
+    snap_write(db_graph->node_in_cols, roundup_bits2bytes(capacity)*ncols,
+               fout, path);
+
+  if(flags & SNAP_PATHS) snap_write_paths(gpstore, capacity, fout, path);
+
+  if(fflush(fout) != 0 || fsync(fileno(fout)) != 0)
+    die("Cannot write to file: %s", path);
+  fclose(fout);
+
+  if(rename(tmp_path.b, path) != 0)
+    die("Cannot rename %s -> %s: %s", tmp_path.b, path, strerror(errno));
+
+  strbuf_dealloc(&tmp_path);
+
+  char kmers_str[50];
+  ulong_to_str(nkmers, kmers_str);
+  status("[snapshot] Saved %s kmers to: %s", kmers_str, path);
+}
+
+void graph_snapshot_set_progress(const char *path,
+                                 const SnapshotProgress *progress)
+{
+  FILE *fh = fopen(path, "r+");
+  if(fh == NULL) die("Cannot open file: %s", path);
+  if(fseek(fh, SNAP_PROGRESS_OFFSET, SEEK_SET) != 0)
+    die("Cannot seek in file: %s", path);
+  snap_write_progress(progress, fh, path);
+  if(fflush(fh) != 0 || fsync(fileno(fh)) != 0)
+    die("Cannot write to file: %s", path);
+  fclose(fh);
+}
+
+//
+// Reading
+//
+
+static void snap_read(int fd, void *ptr, size_t nbytes, const char *path)
+{
+  uint8_t *buf = (uint8_t*)ptr;
+  ssize_t n;
+  while(nbytes > 0) {
+    n = read(fd, buf, MIN2(nbytes, 1UL<<30));
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) die("Truncated or unreadable snapshot: %s", path);
+    buf += n;
+    nbytes -= n;
+  }
+}
+
+#define snap_read_val(fd,val,path) snap_read(fd,&(val),sizeof(val),path)
+
+static void snap_read_str(int fd, StrBuf *sbuf, const char *path)
+{
+  uint32_t len;
+  snap_read_val(fd, len, path);
+  if(len > 10000) die("Corrupt snapshot (string length %u): %s", len, path);
+  strbuf_ensure_capacity(sbuf, len);
+  snap_read(fd, sbuf->b, len, path);
+  sbuf->b[len] = '\0';
+  sbuf->end = len;
+}
+
+static void snap_read_ginfo(int fd, GraphInfo *ginfo, const char *path)
+{
+  ErrorCleaning *ec = &ginfo->cleaning;
+  uint8_t cleaned[4];
+  double seq_err;
+
+  snap_read_val(fd, ginfo->mean_read_length,  path);
+  snap_read_val(fd, ginfo->total_sequence,    path);
+  snap_read_val(fd, seq_err,                  path);
+  snap_read_val(fd, cleaned,                  path);
+  snap_read_val(fd, ec->clean_unitigs_thresh, path);
+  snap_read_val(fd, ec->clean_kmers_thresh,   path);
+  snap_read_str(fd, &ginfo->sample_name,      path);
+  snap_read_str(fd, &ec->intersection_name,   path);
+
+  ginfo->seq_err = seq_err;
+  ec->cleaned_tips = cleaned[0];
+  ec->cleaned_unitigs = cleaned[1];
+  ec->cleaned_kmers = cleaned[2];
+  ec->is_graph_intersection = cleaned[3];
+}
+
+// Allocate a GPathStore with the same entry and sequence capacity as the one
+// saved, so that path to sequence offsets are unchanged
+static void snap_read_paths(int fd, dBGraph *db_graph, bool nseen,
+                            const char *path)
+{
+  GPathStore *gpstore = &db_graph->gpstore;
+  GPathSet *gpset = &gpstore->gpset;
+  size_t i, j, end, capacity = db_graph->ht.capacity;
+  uint64_t ncols, nkmers_with_paths, npaths, path_bytes;
+  uint64_t elen, esize, slen, ssize, nseen_len;
+
+  snap_read_val(fd, ncols, path);
+  snap_read_val(fd, nkmers_with_paths, path);
+  snap_read_val(fd, npaths, path);
+  snap_read_val(fd, path_bytes, path);
+  snap_read_val(fd, elen, path);
+  snap_read_val(fd, esize, path);
+  snap_read_val(fd, slen, path);
+  snap_read_val(fd, ssize, path);
+  snap_read_val(fd, nseen_len, path);
+
+  if(ncols != db_graph->num_of_cols || elen > esize || slen > ssize ||
+     esize == 0 || ssize < SEQ_STORE_PADDING)
+    die("Corrupt snapshot (links): %s", path);
+
+  size_t counts_size = nseen ? ncols : 0;
+  size_t set_mem = (ssize - SEQ_STORE_PADDING) +
+                   esize * (sizeof(GPath) + counts_size);
+  gpath_store_alloc(gpstore, ncols, capacity, esize,
+                    gpath_store_mem(capacity, false) + set_mem,
+                    nseen, false);
+
+  if(gpset->entries.size != esize || gpset->seqs.size != ssize)
+    die("Corrupt snapshot (link store sizes): %s", path);
+
+  snap_read(fd, gpset->entries.b, elen * sizeof(GPath), path);
+  snap_read(fd, gpset->seqs.b, slen, path);
+  if(nseen) snap_read(fd, gpset->nseen_buf.b, elen * ncols, path);
+
+  gpset->entries.len = elen;
+  gpset->seqs.len = slen;
+  gpset->nseen_buf.len = nseen ? nseen_len : 0;
+  gpstore->num_kmers_with_paths = nkmers_with_paths;
+  gpstore->num_paths = npaths;
+  gpstore->path_bytes = path_bytes;
+
+  uint64_t *heads = ctx_malloc(SNAP_PATHS_BLOCK * sizeof(uint64_t));
+  for(i = 0; i < capacity; i = end) {
+    end = MIN2(i + SNAP_PATHS_BLOCK, capacity);
+    snap_read(fd, heads, (end - i) * sizeof(uint64_t), path);
+    for(j = i; j < end; j++) {
+      if(heads[j-i] > elen) die("Corrupt snapshot (link lists): %s", path);
+      gpstore->paths_all[j] = heads[j-i] ? gpset->entries.b + heads[j-i] - 1
+                                         : NULL;
+    }
+  }
+  ctx_free(heads);
+}
+
+void graph_snapshot_load(const char *path, dBGraph *db_graph,
+                         SnapshotProgress *progress)
+{
+  char magic[sizeof(GRAPH_SNAPSHOT_MAGIC)];
+  uint32_t version, kmer_size, bkmer_words, flags, bucket_size, seed;
+  uint64_t ncols, nedgecols, ncols_used, capacity, nbuckets, nkmers;
+  uint64_t collisions[REHASH_LIMIT];
+  size_t i;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) die("Cannot open file: %s", path);
+
+  snap_read(fd, magic, strlen(GRAPH_SNAPSHOT_MAGIC), path);
+  if(memcmp(magic, GRAPH_SNAPSHOT_MAGIC, strlen(GRAPH_SNAPSHOT_MAGIC)) != 0)
+    die("Not a graph snapshot file: %s", path);
+
+  snap_read_val(fd, version, path);
+  snap_read_val(fd, kmer_size, path);
+  if(version != GRAPH_SNAPSHOT_VERSION)
+    die("Graph snapshot version %u not supported: %s", version, path);
+
+  snap_read(fd, progress->cmd, GRAPH_SNAPSHOT_CMDLEN, path);
+  progress->cmd[GRAPH_SNAPSHOT_CMDLEN-1] = '\0';
+  snap_read_val(fd, progress->next_hkey, path);
+  snap_read_val(fd, progress->nitems,    path);
+  snap_read_val(fd, progress->out_bytes, path);
+
+  snap_read_val(fd, bkmer_words, path);
+  snap_read_val(fd, flags,       path);
+  snap_read_val(fd, ncols,       path);
+  snap_read_val(fd, nedgecols,   path);
+  snap_read_val(fd, ncols_used,  path);
+  snap_read_val(fd, capacity,    path);
+  snap_read_val(fd, nbuckets,    path);
+  snap_read_val(fd, bucket_size, path);
+  snap_read_val(fd, seed,        path);
+  snap_read_val(fd, nkmers,      path);
+  snap_read(fd, collisions, sizeof(collisions), path);
+
+  if(bkmer_words != NUM_BKMER_WORDS || kmer_size > MAX_KMER_SIZE ||
+     kmer_size < MIN_KMER_SIZE) {
+    die("Snapshot has kmer size %u, this binary supports %i-%i: %s",
+        kmer_size, MIN_KMER_SIZE, MAX_KMER_SIZE, path);
+  }
+
+  if((flags & SNAP_COVGS) && COVG_BITS < 32)
+    die("Cannot load snapshot with COVG_BITS=%i: %s", COVG_BITS, path);
+
+  if(ncols == 0 || ncols_used > ncols || capacity == 0 || nkmers > capacity ||
+     (nedgecols != 0 && nedgecols != 1 && nedgecols != ncols))
+    die("Corrupt snapshot: %s", path);
+
+  int alloc_flags = ((flags & SNAP_EDGES)    ? DBG_ALLOC_EDGES       : 0) |
+                    ((flags & SNAP_COVGS)    ? DBG_ALLOC_COVGS       : 0) |
+                    ((flags & SNAP_IN_COLS)  ? DBG_ALLOC_NODE_IN_COL : 0) |
+                    ((flags & SNAP_TAGS)     ? DBG_ALLOC_HT_TAGS     : 0) |
+                    ((flags & SNAP_COLMAJOR) ? DBG_ALLOC_COLMAJOR    : 0);
+
+  db_graph_alloc(db_graph, kmer_size, ncols, nedgecols, capacity, alloc_flags);
+  db_graph->num_of_cols_used = ncols_used;
+
+  // Same capacity gives the same table shape
+  HashTable *ht = &db_graph->ht;
+  if(ht->capacity != capacity || ht->num_of_buckets != nbuckets ||
+     ht->bucket_size != bucket_size)
+    die("Corrupt snapshot (hash table shape): %s", path);
+
+  // Restore the seed so kmers hash to the buckets they were saved in
+  HashTable tmp = {.table = ht->table,
+                   .num_of_buckets = ht->num_of_buckets,
+                   .hash_mask = ht->hash_mask,
+                   .bucket_size = ht->bucket_size,
+                   .capacity = ht->capacity,
+                   .buckets = ht->buckets,
+                   .tags = ht->tags,
+                   .large_pages = ht->large_pages,
+                   .num_kmers = nkmers,
+                   .collisions = {0},
+                   .seed = seed};
+  memcpy(tmp.collisions, collisions, sizeof(collisions));
+  memcpy(ht, &tmp, sizeof(HashTable));
+
+  for(i = 0; i < ncols; i++)
+    snap_read_ginfo(fd, &db_graph->ginfo[i], path);
+
+  snap_read(fd, ht->table, capacity * sizeof(BinaryKmer), path);
+  snap_read(fd, ht->buckets, nbuckets * sizeof(uint8_t[2]), path);
+  if(flags & SNAP_TAGS) snap_read(fd, ht->tags, capacity, path);
+
+  if(flags & SNAP_EDGES)
+    snap_read(fd, db_graph->col_edges, capacity*nedgecols*sizeof(Edges), path);
+  if(flags & SNAP_COVGS)
+    snap_read(fd, db_graph->col_covgs, capacity*ncols*sizeof(CovgStore), path);
+  if(flags & SNAP_IN_COLS)
+    snap_read(fd, db_graph->node_in_cols, roundup_bits2bytes(capacity)*ncols,
+              path);
+
+  if(flags & SNAP_PATHS)
+    snap_read_paths(fd, db_graph, (flags & SNAP_NSEEN), path);
+
+  char c;
+  if(read(fd, &c, 1) != 0) die("Corrupt snapshot (trailing bytes): %s", path);
+  close(fd);
+
+  char kmers_str[50], hkey_str[50];
+  ulong_to_str(nkmers, kmers_str);
+  ulong_to_str(progress->next_hkey, hkey_str);
+  status("[snapshot] Loaded %s kmers from: %s", kmers_str, path);
+  if(progress->cmd[0])
+    status("[snapshot]  %s progress: hkey %s", progress->cmd, hkey_str);
+}
@@ -0,0 +1,79 @@
+#ifndef GRAPH_SNAPSHOT_H_
+#define GRAPH_SNAPSHOT_H_
+
+//
+// Graph snapshot files for checkpoint / restart
+//
+// A snapshot is a raw dump of an in-memory graph: the hash table arrays,
+// col_edges, col_covgs, node_in_cols and the GPathStore buffers are written
+// verbatim. Loading allocates a graph of the same capacity and read()s each
+// array straight into place, so no kmer or path is re-inserted. The hash
+// table seed is restored so hkeys are the same as when the snapshot was saved.
+//
+// A snapshot also holds a progress marker for the command that wrote it.
+// Commands that iterate over the hash table (e.g. bubbles) record the next
+// hkey to process, how many items they have written and the size of their
+// output, and update the marker in place as they go. After being preempted
+// the command is rerun, loads the snapshot and carries on from the marker.
+//
+// Snapshots are specific to the build that wrote them (MAXK, COVG_BITS) and
+// are not a replacement for graph / link files.
+//
+// Not saved: bucket locks, read starts, the path hash (gphash), traversal
+// summaries and split read/write link lists (links must be merged).
+// Sparse, shared-edge, on-disk graphs and overflow coverages are not supported.
+//
+// Format:
+//   "CTXSNAPS" <uint32:version> <uint32:kmer_size>
+//   progress: <char[16]:cmd> <uint64:next_hkey> <uint64:nitems> <uint64:out_bytes>
+//   <uint32:num_bkmer_words> <uint32:flags>
+//   <uint64:num_of_cols> <uint64:num_edge_cols> <uint64:num_of_cols_used>
+//   <uint64:capacity> <uint64:num_of_buckets> <uint32:bucket_size> <uint32:seed>
+//   <uint64:num_kmers> REHASH_LIMIT x <uint64:collisions>
+//   num_of_cols x GraphInfo
+//   hash table: capacity x BinaryKmer, num_of_buckets x uint8_t[2]
+//               [capacity x uint8_t tags]
+//   [capacity*num_edge_cols x Edges] [capacity*num_of_cols x CovgStore]
+//   [roundup_bits2bytes(capacity)*num_of_cols bytes node_in_cols]
+//   [links: <uint64:ncols> <uint64:num_kmers_with_paths> <uint64:num_paths>
+//           <uint64:path_bytes> <uint64:entries.len> <uint64:entries.size>
+//           <uint64:seqs.len> <uint64:seqs.size> <uint64:nseen_buf.len>
+//           entries.len x GPath, seqs.len bytes, [entries.len*ncols nseen]
+//           capacity x <uint64:pkey+1 of first path, 0 if none>]
+//
+
+#include "db_graph.h"
+
+#define GRAPH_SNAPSHOT_MAGIC "CTXSNAPS"
+#define GRAPH_SNAPSHOT_VERSION 1
+#define GRAPH_SNAPSHOT_CMDLEN 16
+
+typedef struct
+{
+  char cmd[GRAPH_SNAPSHOT_CMDLEN]; // command that owns the marker e.g. "bubbles"
+  uint64_t next_hkey; // hkeys before this have been processed
+  uint64_t nitems; // command specific count, e.g. bubbles written
+  uint64_t out_bytes; // output file size at next_hkey
+} SnapshotProgress;
+
+// Returns true if `path` starts with GRAPH_SNAPSHOT_MAGIC
+bool graph_snapshot_is_file(const char *path);
+
+// Save to a temporary file then rename to `path`, so an existing snapshot is
+// only replaced by a complete one. Dies on error.
+void graph_snapshot_save(const char *path, const dBGraph *db_graph,
+                         const SnapshotProgress *progress);
+
+// Allocate `db_graph` (and its GPathStore if the snapshot has links) and load
+// the snapshot into it. Dies on error.
+void graph_snapshot_load(const char *path, dBGraph *db_graph,
+                         SnapshotProgress *progress);
+
+// Overwrite the progress marker of an existing snapshot and sync it to disk
+void graph_snapshot_set_progress(const char *path,
+                                 const SnapshotProgress *progress);
+
+// Set the command name of a progress marker, truncated if too long
+void graph_snapshot_progress_init(SnapshotProgress *progress, const char *cmd);
+
+#endif /* GRAPH_SNAPSHOT_H_ */
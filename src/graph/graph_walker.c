@@ -33,7 +33,7 @@ static void print_path_list(const GPathFollowBuffer *pbuf, FILE *fout)
 
   for(i = 0; i < pbuf->len; i++) {
     path = &pbuf->b[i];
-    fprintf(fout, "   %p ", path->gpath->seq);
+    fprintf(fout, "   %p ", gpath_seq(path->gpath));
     for(j = 0; j < path->len; j++)
       fputc(dna_nuc_to_char(gpath_follow_get_base(path, j)), fout);
     fprintf(fout, " [%zu/%zu] age: %zu %c\n", (size_t)path->pos,
@@ -57,7 +57,8 @@ void graph_walker_print_state(const GraphWalker *wlk, FILE *fout)
 
 size_t graph_walker_est_mem()
 {
-  return sizeof(GPathFollow)*1024;
+  return sizeof(GPathFollow)*1024 +
+         sizeof(GraphWalkerMemo)*GRAPH_WALKER_MEMO_SIZE;
 }
 
 // Allocate memory, default to colour 0 and using missing info check
@@ -67,6 +68,8 @@ void graph_walker_alloc(GraphWalker *wlk, const dBGraph *graph)
   gpath_follow_buf_alloc(&wlk->paths, 256);
   gpath_follow_buf_alloc(&wlk->cntr_paths, 512);
   gseg_list_alloc(&wlk->gsegs, 128);
+  wlk->memo = ctx_calloc(GRAPH_WALKER_MEMO_SIZE, sizeof(GraphWalkerMemo));
+  wlk->memo_gen = 1;
   graph_walker_setup(wlk, true, 0, 0, graph);
 }
 
@@ -76,9 +79,19 @@ void graph_walker_dealloc(GraphWalker *wlk)
   gpath_follow_buf_dealloc(&wlk->paths);
   gpath_follow_buf_dealloc(&wlk->cntr_paths);
   gseg_list_dealloc(&wlk->gsegs);
+  ctx_free(wlk->memo);
   memset(wlk, 0, sizeof(GraphWalker));
 }
 
+void graph_walker_memo_clear(GraphWalker *wlk)
+{
+  // Bump the generation rather than clearing the table
+  if(++wlk->memo_gen == 0) {
+    memset(wlk->memo, 0, GRAPH_WALKER_MEMO_SIZE * sizeof(GraphWalkerMemo));
+    wlk->memo_gen = 1;
+  }
+}
+
 void graph_walker_setup(GraphWalker *wlk, bool missing_path_check,
                         Colour ctxcol, Colour ctpcol,
                         const dBGraph *graph)
@@ -87,6 +100,10 @@ void graph_walker_setup(GraphWalker *wlk, bool missing_path_check,
   ctx_assert(graph->num_edge_cols == 1);
   ctx_assert(graph->num_of_cols == 1 || graph->node_in_cols != NULL);
 
+  if(wlk->db_graph != graph || wlk->ctxcol != ctxcol ||
+     wlk->ctpcol != ctpcol || wlk->missing_path_check != missing_path_check)
+    graph_walker_memo_clear(wlk);
+
   wlk->db_graph = graph;
   wlk->gpstore = &graph->gpstore;
   wlk->ctxcol = ctxcol;
@@ -159,6 +176,8 @@ static inline size_t pickup_paths(GraphWalker *wlk, dBNode node,
   // Picking up paths is turned off
   if(!gpath_store_use_traverse(gpstore)) return 0;
   if(!db_node_in_col(db_graph, wlk->node.key, wlk->ctxcol)) return 0;
+  if(!gpath_store_maybe_has_orient(gpstore, node.key, node.orient)) return 0;
+  if(!gpath_store_maybe_has_col(gpstore, node.key, wlk->ctpcol)) return 0;
 
   // DEBUG
   // char kstr[MAX_KMER_SIZE+3]; // <kmer>:<orient>
@@ -172,7 +191,7 @@ static inline size_t pickup_paths(GraphWalker *wlk, dBNode node,
 
   GPath *gpath = gpath_store_fetch_traverse(gpstore, node.key);
 
-  for(; gpath != NULL; gpath = gpath->next)
+  for(; gpath != NULL; gpath = gpath_next(gpath))
   {
     if(node.orient == gpath->orient && gpath_has_colour(gpath, ncols, wlk->ctpcol))
     {
@@ -180,10 +199,9 @@ static inline size_t pickup_paths(GraphWalker *wlk, dBNode node,
 
       if(!cntr_filter_nuc0) gpath_follow_buf_add(pbuf, fpath);
       else if(gpath_follow_get_base(&fpath, 0) == next_nuc) {
-        // Loading a counter path at a fork
-        fpath.pos++; // already took a base
+        // Loading a counter path at a fork, already took a base
         // check there are still junctions to take
-        if(fpath.pos < fpath.len)
+        if(gpath_follow_advance(&fpath))
           gpath_follow_buf_add(pbuf, fpath);
       }
     }
@@ -279,6 +297,79 @@ void graph_walker_finish(GraphWalker *wlk)
   gseg_list_reset(&wlk->gsegs);
 }
 
+//
+// Save / restore
+//
+
+void graph_walker_state_alloc(GraphWalkerState *state)
+{
+  memset(state, 0, sizeof(GraphWalkerState));
+  gpath_follow_buf_alloc(&state->paths, 16);
+  gpath_follow_buf_alloc(&state->cntr_paths, 16);
+  gseg_list_alloc(&state->gsegs, 16);
+  state->node.key = HASH_NOT_FOUND;
+}
+
+void graph_walker_state_dealloc(GraphWalkerState *state)
+{
+  gpath_follow_buf_dealloc(&state->paths);
+  gpath_follow_buf_dealloc(&state->cntr_paths);
+  gseg_list_dealloc(&state->gsegs);
+  memset(state, 0, sizeof(GraphWalkerState));
+}
+
+static inline void _gw_copy_state(GPathFollowBuffer *dst_paths,
+                                  GPathFollowBuffer *dst_cntr,
+                                  GSegList *dst_gsegs,
+                                  const GPathFollowBuffer *src_paths,
+                                  const GPathFollowBuffer *src_cntr,
+                                  const GSegList *src_gsegs)
+{
+  size_t i, nsegs = gseg_list_len(src_gsegs);
+
+  gpath_follow_buf_reset(dst_paths);
+  gpath_follow_buf_reset(dst_cntr);
+  gseg_list_reset(dst_gsegs);
+
+  gpath_follow_buf_push(dst_paths, src_paths->b, src_paths->len);
+  gpath_follow_buf_push(dst_cntr, src_cntr->b, src_cntr->len);
+
+  for(i = 0; i < nsegs; i++)
+    gseg_list_push(dst_gsegs, gseg_list_getconstptr(src_gsegs, i), 1);
+}
+
+void graph_walker_save(const GraphWalker *wlk, GraphWalkerState *state)
+{
+  ctx_assert(gseg_list_len(&wlk->gsegs) > 0); // walker has been started
+
+  state->node = wlk->node;
+  state->bkey = wlk->bkey;
+  state->ctxcol = wlk->ctxcol;
+  state->ctpcol = wlk->ctpcol;
+  state->missing_path_check = wlk->missing_path_check;
+  state->fork_count = wlk->fork_count;
+  state->last_step = wlk->last_step;
+
+  _gw_copy_state(&state->paths, &state->cntr_paths, &state->gsegs,
+                 &wlk->paths, &wlk->cntr_paths, &wlk->gsegs);
+}
+
+void graph_walker_restore(GraphWalker *wlk, const GraphWalkerState *state)
+{
+  ctx_assert(gseg_list_len(&state->gsegs) > 0); // state has been saved
+
+  wlk->node = state->node;
+  wlk->bkey = state->bkey;
+  wlk->ctxcol = state->ctxcol;
+  wlk->ctpcol = state->ctpcol;
+  wlk->missing_path_check = state->missing_path_check;
+  wlk->fork_count = state->fork_count;
+  wlk->last_step = state->last_step;
+
+  _gw_copy_state(&wlk->paths, &wlk->cntr_paths, &wlk->gsegs,
+                 &state->paths, &state->cntr_paths, &state->gsegs);
+}
+
 //
 // Hash function
 //
@@ -432,46 +523,60 @@ GraphStep graph_walker_choose(const GraphWalker *wlk, size_t num_next,
   // abandon if no path info
   if(wlk->paths.len == 0) _gw_choose_return(-1, GRPHWLK_NOLINKS, 0);
 
-  // Mark next bases available
-  bool forks[4] = {false}, taken[4] = {false};
-
-  // mark in forks the branches that are available
-  for(i = 0; i < num_next; i++) forks[bases[i]] = true;
-
-  // Check for path corruption
-  update_path_forks(&wlk->paths,      taken);
-  update_path_forks(&wlk->cntr_paths, taken);
-
-  if((taken[0] && !forks[0]) || (taken[1] && !forks[1]) ||
-     (taken[2] && !forks[2]) || (taken[3] && !forks[3]))
-  {
-    _corrupt_paths(wlk, num_next, nodes, bases);
-  }
-
-  // Do all the oldest paths pick a consistent next node?
-  GPathFollow *path, *oldest_path = &wlk->paths.b[0];
-  size_t greatest_age;
-  Nucleotide greatest_nuc;
-
-  greatest_age = oldest_path->age;
-  greatest_nuc = gpath_follow_get_base(oldest_path, oldest_path->pos);
+  // Paths are sorted oldest first
+  const GPathFollow *path, *oldest_path = &wlk->paths.b[0];
+  size_t greatest_age = oldest_path->age;
 
   ctx_assert(oldest_path->pos < oldest_path->len);
 
+  // Paths picked up at this node cannot have passed a fork yet
   if(greatest_age == 0) _gw_choose_return(-1, GRPHWLK_NOLINKS, 0);
 
-  // Set i to the index of the oldest path to disagree with our oldest path
-  // OR wlk->paths.length if all paths agree
-  for(i = 1; i < wlk->paths.len; i++) {
+  // Vote table: bit per base. `forks` is the branches that are available,
+  // `taken` the branches that paths vote for
+  uint8_t forks = 0, taken = 0, vote;
+  for(i = 0; i < num_next; i++) forks |= (uint8_t)(1 << bases[i]);
+
+  Nucleotide nuc, greatest_nuc = gpath_follow_get_base(oldest_path,
+                                                       oldest_path->pos);
+  size_t disagree = wlk->paths.len;
+
+  // Set disagree to the index of the oldest path to disagree with our oldest
+  // path OR wlk->paths.len if all paths agree. Each vote is checked against
+  // the forks for path corruption.
+  for(i = 0; i < wlk->paths.len; i++) {
     path = &wlk->paths.b[i];
-    if(gpath_follow_get_base(path, path->pos) != greatest_nuc) break;
+    nuc = gpath_follow_get_base(path, path->pos);
+    vote = (uint8_t)(1 << nuc);
+    if(!(vote & forks)) _corrupt_paths(wlk, num_next, nodes, bases);
+    taken |= vote;
+    if(nuc != greatest_nuc && disagree == wlk->paths.len) {
+      disagree = i;
+      // If a path of the same age disagrees, cannot proceed
+      #ifndef CTXCHECKS
+        if(path->age == greatest_age)
+          _gw_choose_return(-1, GRPHWLK_SPLIT_LINKS, 0);
+      #endif
+    }
+  }
+
+  // Counter paths only add votes: stop once every branch has a vote
+  // (or when we are not doing the missing info check)
+  for(i = 0; i < wlk->cntr_paths.len; i++) {
+    #ifndef CTXCHECKS
+      if(!wlk->missing_path_check || taken == forks) break;
+    #endif
+    path = &wlk->cntr_paths.b[i];
+    vote = (uint8_t)(1 << gpath_follow_get_base(path, path->pos));
+    if(!(vote & forks)) _corrupt_paths(wlk, num_next, nodes, bases);
+    taken |= vote;
   }
 
   // If a path of the same age disagrees, cannot proceed
-  if(i < wlk->paths.len && wlk->paths.b[i].age == greatest_age)
+  if(disagree < wlk->paths.len && wlk->paths.b[disagree].age == greatest_age)
     _gw_choose_return(-1, GRPHWLK_SPLIT_LINKS, 0);
 
-  size_t choice_age = (i < wlk->paths.len ? wlk->paths.b[i].age : 0);
+  size_t choice_age = (disagree < wlk->paths.len ? wlk->paths.b[disagree].age : 0);
   const GraphSegment *gseg, *first_seg = mdc_list_getptr(&wlk->gsegs, 0);
 
   // for(i = 0; i < gseg_list_len(&wlk->gsegs); i++)
@@ -497,8 +602,7 @@ GraphStep graph_walker_choose(const GraphWalker *wlk, size_t num_next,
 
   // Does every next node have a path?
   // Fail if missing assembly info
-  if(wlk->missing_path_check &&
-     (size_t)taken[0]+taken[1]+taken[2]+taken[3] < num_next) {
+  if(wlk->missing_path_check && taken != forks) {
     _gw_choose_return(-1, GRPHWLK_MISSING_LINKS, path_gap);
   }
 
@@ -551,6 +655,14 @@ static void _graph_walker_force_jump(GraphWalker *wlk,
   wlk->bkey = db_node_get_bkey(db_graph, node.key);
   wlk->node = node;
 
+  // Start fetching what the next step reads, while we update paths
+  if(db_graph->prefetch_walks) {
+    db_graph_prefetch_node(db_graph, node);
+    db_graph_prefetch_next_kmers(db_graph,
+                                 bkmer_oriented_bkmer(wlk->bkey, node.orient,
+                                                      db_graph->kmer_size));
+  }
+
   if(is_fork)
   {
     // We passed a fork - take all paths that agree with said nucleotide and
@@ -567,8 +679,7 @@ static void _graph_walker_force_jump(GraphWalker *wlk,
       path = &wlk->paths.b[i];
       pnuc = gpath_follow_get_base(path, path->pos);
       if(base == pnuc) {
-        path->pos++;
-        if(path->pos < path->len) {
+        if(gpath_follow_advance(path)) {
           wlk->paths.b[j++] = *path;
         }
         else {
@@ -590,7 +701,7 @@ static void _graph_walker_force_jump(GraphWalker *wlk,
       path = &wlk->cntr_paths.b[i];
       pnuc = gpath_follow_get_base(path, path->pos);
       if(base == pnuc && path->pos+1 < path->len) {
-        path->pos++;
+        gpath_follow_advance(path);
         wlk->cntr_paths.b[j++] = *path;
       }
     }
@@ -669,11 +780,47 @@ void graph_walker_force(GraphWalker *wlk, dBNode node, bool is_fork)
   _graph_walker_force_jump(wlk, node, is_fork, 1, (int)lost_nuc);
 }
 
+// Digest of everything graph_walker_choose() reads at a fork: the node, the
+// paths and counter paths, the graph sections they span and the next bases
+static inline uint64_t _gw_memo_key(GraphWalker *wlk, size_t num_next,
+                                    const Nucleotide bases[4])
+{
+  size_t i, nsegs = gseg_list_len(&wlk->gsegs);
+  uint64_t next = num_next;
+  for(i = 0; i < num_next; i++) next |= (uint64_t)bases[i] << (3+2*i);
+  return CityHash64WithSeeds((const char*)gseg_list_getptr(&wlk->gsegs, 0),
+                             nsegs*sizeof(GraphSegment),
+                             graph_walker_hash64(wlk), next);
+}
+
+// In repeats, walkers (e.g. one per read when correcting) arrive at the same
+// junctions following the same paths many times, each time voting over all
+// of the paths. Remember the decisions at forks with paths.
+static inline GraphStep _gw_choose_memo(GraphWalker *wlk, size_t num_next,
+                                        const dBNode nodes[4],
+                                        const Nucleotide bases[4])
+{
+  if(num_next < 2 || wlk->paths.len == 0)
+    return graph_walker_choose(wlk, num_next, nodes, bases);
+
+  uint64_t key = _gw_memo_key(wlk, num_next, bases);
+  GraphWalkerMemo *memo = &wlk->memo[key & (GRAPH_WALKER_MEMO_SIZE-1)];
+
+  if(memo->gen == wlk->memo_gen && memo->key == key) {
+    wlk->memo_hits++;
+    return memo->step;
+  }
+
+  GraphStep step = graph_walker_choose(wlk, num_next, nodes, bases);
+  *memo = (GraphWalkerMemo){.key = key, .gen = wlk->memo_gen, .step = step};
+  return step;
+}
+
 // return 1 on success, 0 otherwise
 bool graph_walker_next_nodes(GraphWalker *wlk, size_t num_next,
                              const dBNode nodes[4], const Nucleotide bases[4])
 {
-  wlk->last_step = graph_walker_choose(wlk, num_next, nodes, bases);
+  wlk->last_step = _gw_choose_memo(wlk, num_next, nodes, bases);
   int idx = wlk->last_step.idx;
   if(idx == -1) return false;
   graph_walker_force(wlk, nodes[idx],
@@ -691,8 +838,8 @@ bool graph_walker_next(GraphWalker *wlk)
   Nucleotide bases[4];
   size_t num_next;
 
-  num_next = db_graph_next_nodes(db_graph, wlk->bkey, wlk->node.orient, edges,
-                                 nodes, bases);
+  num_next = db_graph_next_nodes_of(db_graph, wlk->node, wlk->bkey, edges,
+                                    nodes, bases);
 
   return graph_walker_next_nodes(wlk, num_next, nodes, bases);
 }
@@ -811,8 +958,8 @@ bool graph_walker_agrees_contig(GraphWalker *wlk,
       n = 1;
     } else {
       // Need to look up possible next nodes
-      n = db_graph_next_nodes(wlk->db_graph, wlk->bkey, wlk->node.orient,
-                              edges, nodes, nucs);
+      n = db_graph_next_nodes_of(wlk->db_graph, wlk->node, wlk->bkey,
+                                 edges, nodes, nucs);
     }
 
     // If we can't progress -> success
@@ -16,6 +16,18 @@ typedef struct
 
 madcrow_list(gseg_list,GSegList,GraphSegment);
 
+// Junction decisions are remembered by a digest of the walker state, so
+// revisiting a junction with the same paths is one lookup (see
+// graph_walker_next_nodes()). Direct mapped, must be a power of two.
+#define GRAPH_WALKER_MEMO_SIZE 1024
+
+typedef struct
+{
+  uint64_t key;
+  uint32_t gen; // entry is valid if gen == GraphWalker.memo_gen
+  GraphStep step;
+} GraphWalkerMemo;
+
 typedef struct
 {
   const dBGraph *db_graph;
@@ -33,11 +45,30 @@ typedef struct
   GPathFollowBuffer paths, cntr_paths;
   GSegList gsegs;
 
+  // Decisions at forks with paths, kept across walks
+  GraphWalkerMemo *memo;
+  uint32_t memo_gen;
+
   // Statistics
   size_t fork_count; // how many forks we have traversed
+  size_t memo_hits; // decisions taken from the memo
   GraphStep last_step;
 } GraphWalker;
 
+// Copy of a GraphWalker's position and the paths it is following, so that
+// several branches can be explored from one point without priming each time
+typedef struct
+{
+  dBNode node;
+  BinaryKmer bkey;
+  Colour ctxcol, ctpcol;
+  bool missing_path_check;
+  GPathFollowBuffer paths, cntr_paths;
+  GSegList gsegs;
+  size_t fork_count;
+  GraphStep last_step;
+} GraphWalkerState;
+
 void graph_walker_print_state(const GraphWalker *wlk, FILE *fout);
 
 // Get initial memory requirement
@@ -47,14 +78,32 @@ size_t graph_walker_est_mem();
 void graph_walker_alloc(GraphWalker *wlk, const dBGraph *graph);
 void graph_walker_dealloc(GraphWalker *gw);
 
+// Changing the graph, colours or missing path check clears remembered
+// junction decisions
 void graph_walker_setup(GraphWalker *wlk, bool missing_path_check,
                         Colour ctxcol, Colour ctpcol,
                         const dBGraph *graph);
 
+// Forget junction decisions, call if the graph or its paths have been edited
+// since the walker last walked
+void graph_walker_memo_clear(GraphWalker *wlk);
+
 // Always call finish after calling start
 void graph_walker_start(GraphWalker *wlk, dBNode node);
 void graph_walker_finish(GraphWalker *wlk);
 
+void graph_walker_state_alloc(GraphWalkerState *state);
+void graph_walker_state_dealloc(GraphWalkerState *state);
+
+/**
+ * Save the state of a started walker. Restoring replaces the walker's paths
+ * and position, as if it had been primed again. Restoring a walker counts as
+ * starting it: call graph_walker_finish() when done.
+ * Costs O(number of paths held) rather than a traversal of the context.
+ */
+void graph_walker_save(const GraphWalker *wlk, GraphWalkerState *state);
+void graph_walker_restore(GraphWalker *wlk, const GraphWalkerState *state);
+
 // Hash a binary kmer + GraphWalker paths with offsets
 uint64_t graph_walker_hash64(GraphWalker *wlk);
 
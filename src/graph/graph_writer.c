@@ -5,6 +5,56 @@
 #include "db_node.h"
 #include "util.h"
 #include "file_util.h"
+#include "async_file.h"
+#include "remote_file.h"
+#include "cmd.h"
+
+#include <unistd.h> // pwrite
+
+static uint32_t graph_writer_version = CTX_GRAPH_FILEFORMAT;
+
+void graph_writer_set_version(uint32_t version)
+{
+  ctx_assert(version == CTX_GRAPH_FILEFORMAT ||
+             version == CTX_GRAPH_FILEFORMAT_BLOCKS);
+  graph_writer_version = version;
+}
+
+uint32_t graph_writer_get_version()
+{
+  return graph_writer_version;
+}
+
+// 0, GRAPH_BLOCK_COLMAJOR or GRAPH_BLOCK_DELTACOV
+static uint32_t graph_writer_layout = 0;
+
+void graph_writer_set_colour_blocks(bool colmajor)
+{
+  graph_writer_layout = colmajor ? GRAPH_BLOCK_COLMAJOR : 0;
+}
+
+bool graph_writer_get_colour_blocks()
+{
+  return graph_writer_layout == GRAPH_BLOCK_COLMAJOR;
+}
+
+void graph_writer_set_delta_covgs(bool deltacov)
+{
+  graph_writer_layout = deltacov ? GRAPH_BLOCK_DELTACOV : 0;
+}
+
+bool graph_writer_get_delta_covgs()
+{
+  return graph_writer_layout == GRAPH_BLOCK_DELTACOV;
+}
+
+static size_t graph_writer_nthreads = 1;
+
+void graph_writer_set_nthreads(size_t nthreads)
+{
+  ctx_assert(nthreads > 0);
+  graph_writer_nthreads = nthreads;
+}
 
 // Construct graph header
 // Free with graph_header_free(hdr)
@@ -14,7 +64,7 @@ GraphFileHeader* graph_writer_mkhdr(const dBGraph *db_graph,
 {
   size_t i, from, into;
   GraphFileHeader *hdr = ctx_calloc(1, sizeof(*hdr));
-  hdr->version = CTX_GRAPH_FILEFORMAT;
+  hdr->version = graph_writer_version;
   hdr->kmer_size = (uint32_t)db_graph->kmer_size;
   hdr->num_of_bitfields = NUM_BKMER_WORDS;
   hdr->num_of_cols = (uint32_t)filencols;
@@ -126,21 +176,35 @@ size_t graph_write_kmer(FILE *fh, size_t filencols,
   return m;
 }
 
+// Write kmer to block writer `bw` if not NULL, otherwise to `fh`
+static inline void graph_write_kmer2(FILE *fh, GraphBlockWriter *bw,
+                                     size_t filencols, const BinaryKmer bkmer,
+                                     const Covg *covgs, const Edges *edges)
+{
+  if(bw) graph_block_writer_add(bw, bkmer, covgs, edges);
+  else graph_write_kmer(fh, filencols, bkmer, covgs, edges);
+}
+
 // Write kmer with no re-ordering of colours
 static inline void graph_write_kmer_direct(hkey_t hkey,
                                            const GraphFileHeader *hdr,
-                                           FILE *fh, const dBGraph *db_graph)
+                                           FILE *fh, GraphBlockWriter *bw,
+                                           const dBGraph *db_graph)
 {
-  graph_write_kmer(fh, hdr->num_of_cols,
+  Covg covgs[db_graph->num_of_cols];
+  Edges edges[db_graph->num_edge_cols];
+  db_node_get_covgs(db_graph, hkey, covgs);
+  db_node_get_all_edges(db_graph, hkey, edges);
+  graph_write_kmer2(fh, bw, hdr->num_of_cols,
                    hash_table_fetch(&db_graph->ht, hkey),
-                   &db_node_covg(db_graph, hkey, 0),
-                   &db_node_edges(db_graph, hkey, 0));
+                   covgs, edges);
 }
 
 
 // Dump node: only print kmers with coverages in given colours
 static void graph_write_kmer_indirect(hkey_t hkey, const GraphFileHeader *hdr,
-                                      const FileFilter *fltr, FILE *fh,
+                                      const FileFilter *fltr,
+                                      FILE *fh, GraphBlockWriter *bw,
                                       const dBGraph *db_graph,
                                       size_t *num_dumped)
 {
@@ -152,63 +216,262 @@ static void graph_write_kmer_indirect(hkey_t hkey, const GraphFileHeader *hdr,
   memset(covgs, 0, sizeof(Covg) * hdr->num_of_cols);
   memset(edges, 0, sizeof(Edges) * hdr->num_of_cols);
 
-  Edges (*col_edges)[db_graph->num_of_cols]
-    = (Edges (*)[db_graph->num_of_cols])db_graph->col_edges;
-  Covg (*col_covgs)[db_graph->num_of_cols]
-    = (Covg (*)[db_graph->num_of_cols])db_graph->col_covgs;
-
   for(i = 0; i < file_filter_num(fltr); i++) {
     into = file_filter_intocol(fltr, i);
     from = file_filter_fromcol(fltr, i);
-    SAFE_SUM_COVG(covgs[into], col_covgs[hkey][from]);
-    edges[into] |= col_edges[hkey][from];
+    SAFE_SUM_COVG(covgs[into], db_node_get_covg(db_graph, hkey, from));
+    edges[into] |= db_node_edges(db_graph, hkey, from);
     merge_covgs |= covgs[into];
     merge_edges |= edges[into];
   }
 
   // Check this node has coverage in one of the specified colours
   if(merge_covgs > 0) {
-    graph_write_kmer(fh, hdr->num_of_cols, bkmer, covgs, edges);
+    graph_write_kmer2(fh, bw, hdr->num_of_cols, bkmer, covgs, edges);
     (*num_dumped)++;
   }
 }
 
 
-// Dump all kmers with all colours to given file.
-// Write kmer with no re-ordering of colours
-// write the first `ncols` from the graph in memory to the file handle
-// `sort_kmer` if true, sort kmers before writing. Uses extra memory.
-// Returns num of kmers written
-size_t graph_write_all_kmers_direct(FILE *fh, const dBGraph *db_graph,
-                                    bool sort_kmers, const GraphFileHeader *hdr)
+static size_t _graph_write_all_kmers_direct(FILE *fh, GraphBlockWriter *bw,
+                                            const dBGraph *db_graph,
+                                            bool sort_kmers,
+                                            const GraphFileHeader *hdr)
 {
   if(sort_kmers) {
     HASH_ITERATE_SORTED(&db_graph->ht, graph_write_kmer_direct,
-                        hdr, fh, db_graph);
+                        hdr, fh, bw, db_graph);
   } else {
     HASH_ITERATE(&db_graph->ht, graph_write_kmer_direct,
-                 hdr, fh, db_graph);
+                 hdr, fh, bw, db_graph);
   }
   return hash_table_nkmers(&db_graph->ht);
 }
 
-size_t graph_write_all_kmers_filtered(FILE *fh, const dBGraph *db_graph,
-                                      bool sort_kmers, const GraphFileHeader *hdr,
-                                      const FileFilter *fltr)
+static size_t _graph_write_all_kmers_filtered(FILE *fh, GraphBlockWriter *bw,
+                                              const dBGraph *db_graph,
+                                              bool sort_kmers,
+                                              const GraphFileHeader *hdr,
+                                              const FileFilter *fltr)
 {
   size_t num_nodes_dumped = 0;
   if(sort_kmers) {
     HASH_ITERATE_SORTED(&db_graph->ht, graph_write_kmer_indirect,
-                        hdr, fltr, fh, db_graph,
+                        hdr, fltr, fh, bw, db_graph,
                         &num_nodes_dumped);
   } else {
     HASH_ITERATE(&db_graph->ht, graph_write_kmer_indirect,
-                 hdr, fltr, fh, db_graph,
+                 hdr, fltr, fh, bw, db_graph,
                  &num_nodes_dumped);
   }
   return num_nodes_dumped;
 }
 
+// Dump all kmers with all colours to given file.
+// Write kmer with no re-ordering of colours
+// write the first `ncols` from the graph in memory to the file handle
+// `sort_kmer` if true, sort kmers before writing. Uses extra memory.
+// Returns num of kmers written
+size_t graph_write_all_kmers_direct(FILE *fh, const dBGraph *db_graph,
+                                    bool sort_kmers, const GraphFileHeader *hdr)
+{
+  return _graph_write_all_kmers_direct(fh, NULL, db_graph, sort_kmers, hdr);
+}
+
+size_t graph_write_all_kmers_filtered(FILE *fh, const dBGraph *db_graph,
+                                      bool sort_kmers, const GraphFileHeader *hdr,
+                                      const FileFilter *fltr)
+{
+  return _graph_write_all_kmers_filtered(fh, NULL, db_graph, sort_kmers,
+                                         hdr, fltr);
+}
+
+//
+// Parallel writing
+//
+// Each thread serialises a range of the hash table (or of the sorted kmers)
+// into its own buffer and writes it with pwrite() at an offset calculated from
+// the number of kmers written by the threads before it.
+//
+
+#define GWRITER_BUF_KMERS 4096
+
+typedef struct
+{
+  const dBGraph *db_graph;
+  const GraphFileHeader *hdr;
+  const FileFilter *fltr; // NULL if colours are written directly
+  const hkey_t *hkeys; // sorted kmers, or NULL for hash table order
+  size_t nthreads, recsize;
+  uint64_t *nkmers; // [nthreads] kmers written by each thread
+  uint64_t *offsets; // [nthreads] file offset of each thread's first kmer
+  int fd;
+  const char *path;
+} GraphWriterThreads;
+
+static inline void gwriter_range(const GraphWriterThreads *gw, size_t threadid,
+                                 size_t *start, size_t *end)
+{
+  size_t n;
+  if(gw->hkeys) {
+    n = hash_table_nkmers(&gw->db_graph->ht);
+    *start = threadid * n / gw->nthreads;
+    *end = (threadid+1) * n / gw->nthreads;
+  } else {
+    // Same ranges as HASH_ITERATE_PART
+    n = hash_table_size(&gw->db_graph->ht);
+    *start = threadid * (n / gw->nthreads);
+    *end = (threadid+1 == gw->nthreads ? n : *start + n / gw->nthreads);
+  }
+}
+
+// Serialise kmer `hkey` into `out`, returns false if the kmer is filtered out
+static inline bool gwriter_kmer(const GraphWriterThreads *gw, hkey_t hkey,
+                                uint8_t *out)
+{
+  const dBGraph *db_graph = gw->db_graph;
+  size_t i, into, from, filencols = gw->hdr->num_of_cols;
+  size_t ncovgs = MAX2(db_graph->num_of_cols, filencols);
+  size_t nedges = MAX2(db_graph->num_edge_cols, filencols);
+  Covg covgs[ncovgs], merge_covgs = 0;
+  Edges edges[nedges];
+  BinaryKmer bkmer = db_node_get_bkey(db_graph, hkey);
+
+  if(gw->fltr == NULL) {
+    db_node_get_covgs(db_graph, hkey, covgs);
+    db_node_get_all_edges(db_graph, hkey, edges);
+  }
+  else {
+    memset(covgs, 0, sizeof(Covg) * filencols);
+    memset(edges, 0, sizeof(Edges) * filencols);
+    for(i = 0; i < file_filter_num(gw->fltr); i++) {
+      into = file_filter_intocol(gw->fltr, i);
+      from = file_filter_fromcol(gw->fltr, i);
+      SAFE_SUM_COVG(covgs[into], db_node_get_covg(db_graph, hkey, from));
+      edges[into] |= db_node_edges(db_graph, hkey, from);
+      merge_covgs |= covgs[into];
+    }
+    // Only write kmers with coverage in one of the specified colours
+    if(merge_covgs == 0) return false;
+  }
+
+  memcpy(out, bkmer.b, BKMER_BYTES);
+  memcpy(out+BKMER_BYTES, covgs, sizeof(uint32_t) * filencols);
+  memcpy(out+BKMER_BYTES+sizeof(uint32_t)*filencols, edges, filencols);
+  return true;
+}
+
+static inline bool gwriter_next(const GraphWriterThreads *gw, size_t *i,
+                                size_t end, hkey_t *hkey)
+{
+  const HashTable *ht = &gw->db_graph->ht;
+  for(; *i < end; (*i)++) {
+    *hkey = gw->hkeys ? gw->hkeys[*i] : (hkey_t)*i;
+    if(gw->hkeys || hash_table_assigned(ht, *hkey)) { (*i)++; return true; }
+  }
+  return false;
+}
+
+// Count kmers to be written by each thread
+static void gwriter_count_thread(void *arg, size_t threadid)
+{
+  GraphWriterThreads *gw = (GraphWriterThreads*)arg;
+  size_t i, end, n = 0;
+  hkey_t hkey;
+  uint8_t rec[gw->recsize];
+
+  gwriter_range(gw, threadid, &i, &end);
+
+  if(gw->fltr == NULL && gw->hkeys) n = end - i;
+  else if(gw->fltr == NULL) {
+    while(gwriter_next(gw, &i, end, &hkey)) n++;
+  }
+  else {
+    while(gwriter_next(gw, &i, end, &hkey)) n += gwriter_kmer(gw, hkey, rec);
+  }
+
+  gw->nkmers[threadid] = n;
+}
+
+static void gwriter_flush(int fd, const char *path, const uint8_t *buf,
+                          size_t len, uint64_t offset)
+{
+  ssize_t r;
+  while(len > 0) {
+    r = pwrite(fd, buf, len, (off_t)offset);
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) die("Cannot write to file: %s [%s]", path, strerror(errno));
+    buf += r; len -= r; offset += r;
+  }
+}
+
+static void gwriter_write_thread(void *arg, size_t threadid)
+{
+  GraphWriterThreads *gw = (GraphWriterThreads*)arg;
+  size_t i, end, nbuf = 0, nwritten = 0;
+  uint64_t offset = gw->offsets[threadid];
+  hkey_t hkey;
+  uint8_t *buf = ctx_malloc(GWRITER_BUF_KMERS * gw->recsize);
+
+  gwriter_range(gw, threadid, &i, &end);
+
+  while(gwriter_next(gw, &i, end, &hkey)) {
+    if(!gwriter_kmer(gw, hkey, buf + nbuf*gw->recsize)) continue;
+    if(++nbuf == GWRITER_BUF_KMERS) {
+      gwriter_flush(gw->fd, gw->path, buf, nbuf*gw->recsize, offset);
+      offset += nbuf*gw->recsize;
+      nwritten += nbuf;
+      nbuf = 0;
+    }
+  }
+
+  gwriter_flush(gw->fd, gw->path, buf, nbuf*gw->recsize, offset);
+  nwritten += nbuf;
+  ctx_assert(nwritten == gw->nkmers[threadid]);
+  ctx_free(buf);
+}
+
+// Write kmers after the header in file `fh` using `nthreads` threads
+// `fltr` is NULL if colours are written directly
+// Returns number of kmers written
+static size_t graph_write_all_kmers_mt(FILE *fh, size_t hdr_size,
+                                       const char *path,
+                                       const dBGraph *db_graph,
+                                       bool sort_kmers,
+                                       const GraphFileHeader *hdr,
+                                       const FileFilter *fltr,
+                                       size_t nthreads)
+{
+  size_t i, total = 0;
+
+  if(fflush(fh) != 0) die("Cannot write to file: %s", path);
+
+  const hkey_t *hkeys = NULL;
+  if(sort_kmers) hkeys = hash_table_sorted_mt(&db_graph->ht, nthreads);
+
+  GraphWriterThreads gw = {.db_graph = db_graph, .hdr = hdr, .fltr = fltr,
+                           .hkeys = hkeys,
+                           .nthreads = nthreads,
+                           .recsize = BKMER_BYTES + 5*hdr->num_of_cols,
+                           .nkmers = ctx_calloc(nthreads, sizeof(uint64_t)),
+                           .offsets = ctx_calloc(nthreads, sizeof(uint64_t)),
+                           .fd = fileno(fh), .path = path};
+
+  util_multi_thread(&gw, nthreads, gwriter_count_thread);
+
+  for(i = 0; i < nthreads; i++) {
+    gw.offsets[i] = hdr_size + total * gw.recsize;
+    total += gw.nkmers[i];
+  }
+
+  util_multi_thread(&gw, nthreads, gwriter_write_thread);
+
+  ctx_free((hkey_t*)gw.hkeys);
+  ctx_free(gw.nkmers);
+  ctx_free(gw.offsets);
+  return total;
+}
+
 // Pass your own header
 // If sort_kmers is true, save kmers in lexigraphical order
 // returns number of nodes written out
@@ -225,17 +488,42 @@ uint64_t graph_writer_save(const char *path, const dBGraph *db_graph,
   status("[graphwriter] Saving file to: %s", path);
   file_filter_status(fltr, true);
 
-  FILE *fh = futil_fopen(path, "w");
+  // Blocks are written serially, as is output to STDOUT since we cannot seek
+  bool blocked = (hdr->version == CTX_GRAPH_FILEFORMAT_BLOCKS);
+  bool direct = file_filter_into_direct(fltr,hdr->num_of_cols);
+  bool parallel = (graph_writer_nthreads > 1 && !blocked &&
+                   strcmp(path,"-") != 0);
+
+  // Parallel writers pwrite() to the file themselves
+  FILE *fh = parallel ? futil_fopen(path, "w") : async_file_fopen(path, "w");
 
   // Write header
-  graph_write_header(fh, hdr);
+  size_t hdr_size = graph_write_header(fh, hdr);
+
+  // Block compressed output
+  GraphBlockWriter blkwtr, *bw = NULL;
+  if(blocked) {
+    graph_block_writer_alloc(&blkwtr, fh, hdr->num_of_cols, hdr_size,
+                             graph_writer_layout);
+    bw = &blkwtr;
+  }
 
-  if(file_filter_into_direct(fltr,hdr->num_of_cols)) {
-    n_nodes = graph_write_all_kmers_direct(fh, db_graph, sort_kmers, hdr);
+  if(parallel) {
+    n_nodes = graph_write_all_kmers_mt(fh, hdr_size, out_name, db_graph,
+                                       sort_kmers, hdr, direct ? NULL : fltr,
+                                       graph_writer_nthreads);
+  }
+  else if(direct) {
+    n_nodes = _graph_write_all_kmers_direct(fh, bw, db_graph, sort_kmers, hdr);
   }
   else {
-    n_nodes = graph_write_all_kmers_filtered(fh, db_graph, sort_kmers, hdr,
-                                             fltr);
+    n_nodes = _graph_write_all_kmers_filtered(fh, bw, db_graph, sort_kmers,
+                                              hdr, fltr);
+  }
+
+  if(bw) {
+    graph_block_writer_finish(bw);
+    graph_block_writer_dealloc(bw);
   }
 
   fclose(fh);
@@ -348,8 +636,9 @@ static void graph_writer_update_file_kmers(const dBGraph *db_graph,
   size_t nkmers_printed = 0, nkmers, nbytes, end;
   uint8_t *mem = ctx_malloc(block_size), *memptr;
   hkey_t hkey = 0;
-  const Covg *covgs = db_graph->col_covgs;
-  const Edges *edges = db_graph->col_edges;
+  Covg covgs[ngraphcols];
+  Edges edges[ngraphcols];
+  size_t col;
   BinaryKmer bkmer;
 
   if(fseek(fh, hdrsize, SEEK_SET) != 0) die("Cannot seek to file start: %s", path);
@@ -372,8 +661,10 @@ static void graph_writer_update_file_kmers(const dBGraph *db_graph,
       else { // linear search of the hash table (it's fast!)
         while(!db_graph_node_assigned(db_graph, hkey)) hkey++;
       }
-      covgs = db_graph->col_covgs + hkey * db_graph->num_of_cols;
-      edges = db_graph->col_edges + hkey * db_graph->num_of_cols;
+      for(col = 0; col < ngraphcols; col++) {
+        covgs[col] = db_node_get_covg(db_graph, hkey, col);
+        edges[col] = db_node_edges(db_graph, hkey, col);
+      }
       memptr += sizeof(BinaryKmer);
       memcpy(memptr + first_filecol*sizeof(Covg), covgs, ngraphcols*sizeof(Covg));
       memptr += sizeof(Covg)*nfilecols;
@@ -409,8 +700,15 @@ size_t graph_writer_stream(const char *out_ctx_path, GraphFileReader *file,
   if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
     die("fseek failed: %s", strerror(errno));
 
-  FILE *out = futil_fopen(out_ctx_path, "w");
-  graph_write_header(out, hdr);
+  FILE *out = async_file_fopen(out_ctx_path, "w");
+  size_t hdr_size = graph_write_header(out, hdr);
+
+  GraphBlockWriter blkwtr, *bw = NULL;
+  if(hdr->version == CTX_GRAPH_FILEFORMAT_BLOCKS) {
+    graph_block_writer_alloc(&blkwtr, out, hdr->num_of_cols, hdr_size,
+                             graph_writer_layout);
+    bw = &blkwtr;
+  }
 
   size_t i, nodes_dumped = 0, ncols = file_filter_into_ncols(fltr);
 
@@ -439,12 +737,17 @@ size_t graph_writer_stream(const char *out_ctx_path, GraphFileReader *file,
       }
 
       if(keep_kmer) {
-        graph_write_kmer(out, hdr->num_of_cols, bkmer, covgs, edges);
+        graph_write_kmer2(out, bw, hdr->num_of_cols, bkmer, covgs, edges);
         nodes_dumped++;
       }
     }
   }
 
+  if(bw) {
+    graph_block_writer_finish(bw);
+    graph_block_writer_dealloc(bw);
+  }
+
   fflush(out);
   fclose(out);
 
@@ -468,6 +771,7 @@ size_t graph_writer_stream_mkhdr(const char *out_ctx_path,
   GraphFileHeader outhdr;
   memset(&outhdr, 0, sizeof(outhdr));
   graph_file_merge_header(&outhdr, file);
+  outhdr.version = graph_writer_version;
 
   for(i = 0; i < outhdr.num_of_cols; i++)
     if(intersect_gname != NULL)
@@ -490,7 +794,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
                           bool kmers_loaded, bool colours_loaded,
                           const Edges *only_load_if_in_edges,
                           GraphFileHeader *hdr, bool sort_kmers,
-                          dBGraph *db_graph)
+                          size_t nthreads, dBGraph *db_graph)
 {
   bool only_load_if_in_graph = (only_load_if_in_edges != NULL);
   ctx_assert(!only_load_if_in_graph || kmers_loaded);
@@ -514,6 +818,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
   GraphLoadingPrefs gprefs = graph_loading_prefs(db_graph);
   gprefs.must_exist_in_graph = only_load_if_in_graph;
   gprefs.must_exist_in_edges = only_load_if_in_edges;
+  gprefs.nthreads = nthreads;
 
   if(kmers_loaded && colours_loaded)
   {
@@ -558,6 +863,13 @@ size_t graph_writer_merge(const char *out_ctx_path,
     status("[overwriting] Saving %zu colours, %zu colours at a time",
            out_ncols, db_graph->num_of_cols);
 
+    // Updating kmers in place needs fixed size records
+    if(hdr->version == CTX_GRAPH_FILEFORMAT_BLOCKS) {
+      warn("Cannot write block compressed graph when merging a few colours at "
+           "a time; writing version %i instead", CTX_GRAPH_FILEFORMAT);
+      hdr->version = CTX_GRAPH_FILEFORMAT;
+    }
+
     // Open file, write header
     FILE *fout = futil_fopen(out_ctx_path, "r+");
 
@@ -591,7 +903,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
       if(firstcol == 0 || files_loaded) {
         status("Wiping colours");
         memset(db_graph->col_edges, 0, num_kmer_cols * sizeof(Edges));
-        memset(db_graph->col_covgs, 0, num_kmer_cols * sizeof(Covg));
+        memset(db_graph->col_covgs, 0, num_kmer_cols * sizeof(CovgStore));
       }
 
       files_loaded = false;
@@ -654,7 +966,8 @@ size_t graph_writer_merge_mkhdr(const char *out_ctx_path,
                                bool kmers_loaded, bool colours_loaded,
                                const Edges *only_load_if_in_edges,
                                const char *intersect_gname,
-                               bool sort_kmers, dBGraph *db_graph)
+                               bool sort_kmers, size_t nthreads,
+                               dBGraph *db_graph)
 {
   size_t i, num_kmers;
   GraphFileHeader hdr;
@@ -662,6 +975,7 @@ size_t graph_writer_merge_mkhdr(const char *out_ctx_path,
 
   for(i = 0; i < num_files; i++)
     graph_file_merge_header(&hdr, &files[i]);
+  hdr.version = graph_writer_version;
 
   if(intersect_gname != NULL) {
     for(i = 0; i < hdr.num_of_cols; i++)
@@ -672,8 +986,601 @@ size_t graph_writer_merge_mkhdr(const char *out_ctx_path,
   num_kmers = graph_writer_merge(out_ctx_path, files, num_files,
                                  kmers_loaded, colours_loaded,
                                  only_load_if_in_edges,
-                                 &hdr, sort_kmers, db_graph);
+                                 &hdr, sort_kmers, nthreads, db_graph);
 
   graph_header_dealloc(&hdr);
   return num_kmers;
 }
+
+//
+// Merge sorted graph files with a k-way merge
+//
+
+// Min-heap of file indices ordered by each file's current kmer
+static inline void _merge_heap_down(size_t *heap, size_t n, size_t i,
+                                    const BinaryKmer *bkmers)
+{
+  size_t child, tmp;
+  while((child = 2*i+1) < n) {
+    if(child+1 < n && binary_kmer_lt(bkmers[heap[child+1]], bkmers[heap[child]]))
+      child++;
+    if(!binary_kmer_lt(bkmers[heap[child]], bkmers[heap[i]])) break;
+    tmp = heap[i]; heap[i] = heap[child]; heap[child] = tmp;
+    i = child;
+  }
+}
+
+// A filter file being read in lock-step with the merge
+typedef struct
+{
+  BinaryKmer bkmer;
+  Edges edges;
+  bool live, started;
+} MergeCursor;
+
+// Read the next kmer with coverage, set c->live = false at end of file
+static inline void _merge_cursor_next(GraphFileReader *file, MergeCursor *c)
+{
+  BinaryKmer prev = c->bkmer;
+  Covg covg = 0;
+  while(covg == 0) {
+    if(!graph_file_read_reset(file, &c->bkmer, &covg, &c->edges)) {
+      c->live = false;
+      return;
+    }
+    if(c->started && !binary_kmer_lt(prev, c->bkmer)) {
+      die("Graph file is not sorted, use '"CMD" sort' first: %s",
+          file_filter_path(&file->fltr));
+    }
+    prev = c->bkmer;
+    c->started = true;
+  }
+}
+
+// Start reading a filter file from its current position
+static void _merge_cursor_start(GraphFileReader *file, MergeCursor *c)
+{
+  ctx_assert(file_filter_into_ncols(&file->fltr) == 1);
+  memset(c, 0, sizeof(*c));
+  c->live = true;
+  _merge_cursor_next(file, c);
+}
+
+// Move cursor to the first kmer >= bkmer, return true if it is bkmer
+static inline bool _merge_cursor_find(GraphFileReader *file, MergeCursor *c,
+                                      BinaryKmer bkmer)
+{
+  while(c->live && binary_kmer_lt(c->bkmer, bkmer)) _merge_cursor_next(file, c);
+  return c->live && binary_kmer_eq(c->bkmer, bkmer);
+}
+
+// Returns true if the kmer passes the filter, intersecting edges with those
+// of the isec files
+static inline bool _merge_filter_kmer(const GraphMergeFilter *filter,
+                                      MergeCursor *isec, MergeCursor *sub,
+                                      BinaryKmer bkmer, const Covg *covgs,
+                                      Edges *edges, size_t ncols)
+{
+  size_t i, nhave = 0;
+  Edges mask = 0xff;
+
+  if(filter->min_cols > 1) {
+    for(i = 0; i < ncols; i++) nhave += (covgs[i] > 0);
+    if(nhave < filter->min_cols) return false;
+  }
+
+  for(i = 0; i < filter->num_isec; i++) {
+    if(!_merge_cursor_find(&filter->isec_files[i], &isec[i], bkmer)) return false;
+    mask &= isec[i].edges;
+  }
+
+  for(i = 0; i < filter->num_sub; i++)
+    if(_merge_cursor_find(&filter->sub_files[i], &sub[i], bkmer)) return false;
+
+  for(i = 0; i < ncols; i++) edges[i] &= mask;
+  return true;
+}
+
+// K-way merge of sorted files that have been positioned by the caller.
+// Only kmers in [lo,hi) are merged when the merge is split between threads.
+typedef struct
+{
+  GraphFileReader *files;
+  size_t num_files, ncols;
+  const GraphMergeFilter *filter;
+  MergeCursor *isec, *sub;
+  // Each file's current kmer and its coverages and edges
+  BinaryKmer *bkmers;
+  Covg *covgs;
+  Edges *edges;
+  size_t *heap, n; // files with kmers left
+  const BinaryKmer *lo, *hi; // NULL if unbounded
+} KmerMerge;
+
+// Read the next kmer from file `f` into its slot, return false at the end of
+// the file or of the range
+static inline bool _merge_read_next(KmerMerge *m, size_t f)
+{
+  BinaryKmer prev = m->bkmers[f];
+  if(!graph_file_read_reset(&m->files[f], &m->bkmers[f],
+                            m->covgs+f*m->ncols, m->edges+f*m->ncols))
+    return false;
+  if(!binary_kmer_lt(prev, m->bkmers[f])) {
+    die("Graph file is not sorted, use '"CMD" sort' first: %s",
+        file_filter_path(&m->files[f].fltr));
+  }
+  return m->hi == NULL || binary_kmer_lt(m->bkmers[f], *m->hi);
+}
+
+// Read the first kmer of file `f` that is in the range
+static inline bool _merge_read_first(KmerMerge *m, size_t f)
+{
+  if(!graph_file_read_reset(&m->files[f], &m->bkmers[f],
+                            m->covgs+f*m->ncols, m->edges+f*m->ncols))
+    return false;
+  while(m->lo != NULL && binary_kmer_lt(m->bkmers[f], *m->lo))
+    if(!_merge_read_next(m, f)) return false;
+  return m->hi == NULL || binary_kmer_lt(m->bkmers[f], *m->hi);
+}
+
+static void _merge_begin(KmerMerge *m, GraphFileReader *files, size_t num_files,
+                         size_t ncols, const GraphMergeFilter *filter,
+                         const BinaryKmer *lo, const BinaryKmer *hi)
+{
+  size_t i, f;
+  memset(m, 0, sizeof(*m));
+  m->files = files;
+  m->num_files = num_files;
+  m->ncols = ncols;
+  m->filter = filter;
+  m->lo = lo;
+  m->hi = hi;
+  m->bkmers = ctx_calloc(num_files, sizeof(BinaryKmer));
+  m->covgs = ctx_calloc(num_files * ncols, sizeof(Covg));
+  m->edges = ctx_calloc(num_files * ncols, sizeof(Edges));
+  m->heap = ctx_calloc(num_files, sizeof(size_t));
+
+  if(filter != NULL) {
+    m->isec = ctx_calloc(filter->num_isec, sizeof(MergeCursor));
+    m->sub = ctx_calloc(filter->num_sub, sizeof(MergeCursor));
+    for(i = 0; i < filter->num_isec; i++)
+      _merge_cursor_start(&filter->isec_files[i], &m->isec[i]);
+    for(i = 0; i < filter->num_sub; i++)
+      _merge_cursor_start(&filter->sub_files[i], &m->sub[i]);
+  }
+
+  // Read first kmer from each file
+  for(f = 0; f < num_files; f++)
+    if(_merge_read_first(m, f))
+      m->heap[m->n++] = f;
+
+  for(i = m->n/2; i-- > 0; ) _merge_heap_down(m->heap, m->n, i, m->bkmers);
+}
+
+// Get the next kmer to write, returns false when there are none left
+static bool _merge_next(KmerMerge *m, BinaryKmer *bkmer,
+                        Covg *kcovgs, Edges *kedges)
+{
+  size_t i, f, ncols = m->ncols;
+  Covg keep_kmer;
+
+  while(m->n > 0)
+  {
+    *bkmer = m->bkmers[m->heap[0]];
+    memset(kcovgs, 0, ncols * sizeof(Covg));
+    memset(kedges, 0, ncols * sizeof(Edges));
+
+    // Pop every file with this kmer
+    while(m->n > 0 && binary_kmer_eq(m->bkmers[m->heap[0]], *bkmer)) {
+      f = m->heap[0];
+      for(i = 0; i < ncols; i++) {
+        kcovgs[i] = SAFE_ADD_COVG(kcovgs[i], m->covgs[f*ncols+i]);
+        kedges[i] |= m->edges[f*ncols+i];
+      }
+      if(!_merge_read_next(m, f))
+        m->heap[0] = m->heap[--m->n];
+      _merge_heap_down(m->heap, m->n, 0, m->bkmers);
+    }
+
+    for(i = 0, keep_kmer = 0; i < ncols; i++) keep_kmer |= kcovgs[i];
+
+    if(keep_kmer && m->filter != NULL)
+      keep_kmer = _merge_filter_kmer(m->filter, m->isec, m->sub, *bkmer,
+                                     kcovgs, kedges, ncols);
+
+    if(keep_kmer) return true;
+  }
+
+  return false;
+}
+
+static void _merge_end(KmerMerge *m)
+{
+  ctx_free(m->bkmers);
+  ctx_free(m->covgs);
+  ctx_free(m->edges);
+  ctx_free(m->heap);
+  ctx_free(m->isec);
+  ctx_free(m->sub);
+  memset(m, 0, sizeof(*m));
+}
+
+static void _merge_seek_start(GraphFileReader *file)
+{
+  graph_loading_print_status(file);
+  if(!file_filter_isstdin(&file->fltr) &&
+     graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
+    die("fseek failed: %s", strerror(errno));
+}
+
+//
+// Parallel merge of sorted files
+//
+// The kmer space is cut into ranges at kmers sampled from the largest input.
+// For each input we find where each range starts: by binary search for fixed
+// size records, or at the block that may hold the first kmer of the range for
+// block compressed files (kmers before the range are skipped). Each thread
+// then k-way merges its range of every input. As with
+// graph_write_all_kmers_mt(), threads first count the kmers in their range
+// then pwrite() them at an offset calculated from the counts of the threads
+// before them.
+//
+
+#define GWRITER_MERGE_MIN_KMERS 10000
+
+typedef struct
+{
+  GraphFileReader *files; // inputs, then isec files, then sub files
+  size_t num_files, num_all, ncols, recsize, nthreads;
+  const GraphMergeFilter *filter;
+  BinaryKmer *splits; // [nthreads-1] thread i merges [splits[i-1],splits[i])
+  off_t *starts; // [nthreads*num_all] where each thread reads each file from
+  uint64_t *nkmers, *offsets; // [nthreads]
+  int fd;
+  const char *path;
+} GraphMergeThreads;
+
+// Inputs and filter files are split alike, `i` indexes them all
+static GraphFileReader* _merge_file(const GraphMergeThreads *gm, size_t i)
+{
+  const GraphMergeFilter *filter = gm->filter;
+  if(i < gm->num_files) return &gm->files[i];
+  i -= gm->num_files;
+  if(i < filter->num_isec) return &filter->isec_files[i];
+  return &filter->sub_files[i - filter->num_isec];
+}
+
+// Files must be seekable with a known number of kmers
+static bool _merge_file_can_split(const GraphFileReader *file)
+{
+  return !file_filter_isstdin(&file->fltr) && file->pop == NULL &&
+         file->num_of_kmers > 0 && file->file_size >= 0;
+}
+
+// Kmer `idx` of a file with fixed size records
+static BinaryKmer _merge_file_kmer(GraphFileReader *file, size_t idx)
+{
+  BinaryKmer bkmer;
+  off_t offset = graph_file_offset(file, idx);
+  if(remote_file_pread_fd(graph_file_fileno(file), bkmer.b, BKMER_BYTES,
+                          offset) != BKMER_BYTES)
+    die("Cannot read kmer %zu: %s", idx, file_filter_path(&file->fltr));
+  return bkmer;
+}
+
+// File offset to start reading kmers >= bkmer from. `index` is the block
+// index of a block compressed file.
+static off_t _merge_file_seek_offset(GraphFileReader *file,
+                                     const GraphBlockBuffer *index,
+                                     BinaryKmer bkmer)
+{
+  size_t lo = 0, hi, mid;
+  if(graph_file_is_blocked(file)) {
+    // Last block starting at or before bkmer
+    for(hi = index->len; lo < hi; ) {
+      mid = (lo+hi)/2;
+      if(binary_kmer_lt(bkmer, index->b[mid].first)) hi = mid;
+      else lo = mid+1;
+    }
+    return index->b[lo > 0 ? lo-1 : 0].offset;
+  }
+  // First record >= bkmer
+  for(hi = file->num_of_kmers; lo < hi; ) {
+    mid = (lo+hi)/2;
+    if(binary_kmer_lt(_merge_file_kmer(file, mid), bkmer)) lo = mid+1;
+    else hi = mid;
+  }
+  return graph_file_offset(file, lo);
+}
+
+static void _merge_range(GraphMergeThreads *gm, size_t threadid, bool write)
+{
+  size_t i, nbuf = 0, n = 0, ncols = gm->ncols, recsize = gm->recsize;
+  uint64_t offset = write ? gm->offsets[threadid] : 0;
+  GraphFileReader *rdrs = ctx_calloc(gm->num_all, sizeof(GraphFileReader));
+  uint8_t *buf = write ? ctx_malloc(GWRITER_BUF_KMERS * recsize) : NULL, *rec;
+  BinaryKmer bkmer;
+  Covg kcovgs[ncols];
+  Edges kedges[ncols];
+
+  for(i = 0; i < gm->num_all; i++)
+    graph_file_dup(_merge_file(gm, i), &rdrs[i],
+                   gm->starts[threadid*gm->num_all + i]);
+
+  // Filter files are read with this thread's readers
+  GraphMergeFilter filter;
+  if(gm->filter != NULL) {
+    filter = *gm->filter;
+    filter.isec_files = rdrs + gm->num_files;
+    filter.sub_files = rdrs + gm->num_files + filter.num_isec;
+  }
+
+  KmerMerge m;
+  _merge_begin(&m, rdrs, gm->num_files, ncols,
+               gm->filter != NULL ? &filter : NULL,
+               threadid > 0 ? &gm->splits[threadid-1] : NULL,
+               threadid+1 < gm->nthreads ? &gm->splits[threadid] : NULL);
+
+  while(_merge_next(&m, &bkmer, kcovgs, kedges)) {
+    n++;
+    if(!write) continue;
+    rec = buf + nbuf*recsize;
+    memcpy(rec, bkmer.b, BKMER_BYTES);
+    memcpy(rec+BKMER_BYTES, kcovgs, sizeof(uint32_t) * ncols);
+    memcpy(rec+BKMER_BYTES+sizeof(uint32_t)*ncols, kedges, ncols);
+    if(++nbuf == GWRITER_BUF_KMERS) {
+      gwriter_flush(gm->fd, gm->path, buf, nbuf*recsize, offset);
+      offset += nbuf*recsize;
+      nbuf = 0;
+    }
+  }
+
+  if(write) {
+    gwriter_flush(gm->fd, gm->path, buf, nbuf*recsize, offset);
+    ctx_assert(n == gm->nkmers[threadid]);
+  }
+  else gm->nkmers[threadid] = n;
+
+  _merge_end(&m);
+  for(i = 0; i < gm->num_all; i++) graph_file_dup_close(&rdrs[i]);
+  ctx_free(rdrs);
+  ctx_free(buf);
+}
+
+static void _merge_count_thread(void *arg, size_t threadid)
+{
+  _merge_range((GraphMergeThreads*)arg, threadid, false);
+}
+
+static void _merge_write_thread(void *arg, size_t threadid)
+{
+  _merge_range((GraphMergeThreads*)arg, threadid, true);
+}
+
+// Returns number of threads to merge with, 1 if the merge cannot be split
+static size_t _merge_split(GraphMergeThreads *gm, size_t nthreads)
+{
+  size_t i, f, t, nsplits, largest = 0;
+  GraphFileReader *file;
+
+  for(i = 0; i < gm->num_all; i++) {
+    file = _merge_file(gm, i);
+    if(!_merge_file_can_split(file)) return 1;
+    if(i < gm->num_files && file->num_of_kmers > gm->files[largest].num_of_kmers)
+      largest = i;
+  }
+
+  nthreads = MIN2(nthreads, (size_t)gm->files[largest].num_of_kmers /
+                            GWRITER_MERGE_MIN_KMERS);
+  if(nthreads <= 1) return 1;
+
+  // Block indices of block compressed files
+  GraphBlockBuffer *indices = ctx_calloc(gm->num_all, sizeof(GraphBlockBuffer));
+  GraphBlockTrailer trailer;
+
+  for(i = 0; i < gm->num_all; i++) {
+    file = _merge_file(gm, i);
+    if(!graph_file_is_blocked(file)) continue;
+    gblock_buf_alloc(&indices[i], 1024);
+    if(!graph_block_read_trailer(graph_file_fileno(file), file->file_size,
+                                 &trailer) ||
+       !graph_block_read_index(graph_file_fileno(file), &trailer, &indices[i]) ||
+       indices[i].len == 0)
+      die("Cannot read block index: %s", file_filter_path(&file->fltr));
+  }
+
+  // Sample split kmers from the largest input, dropping repeats
+  gm->splits = ctx_calloc(nthreads, sizeof(BinaryKmer));
+  file = &gm->files[largest];
+  for(t = 1, nsplits = 0; t < nthreads; t++) {
+    BinaryKmer bkmer = graph_file_is_blocked(file)
+                       ? indices[largest].b[t * indices[largest].len / nthreads].first
+                       : _merge_file_kmer(file, t * file->num_of_kmers / nthreads);
+    if(nsplits == 0 || binary_kmer_lt(gm->splits[nsplits-1], bkmer))
+      gm->splits[nsplits++] = bkmer;
+  }
+  nthreads = nsplits + 1;
+
+  gm->starts = ctx_calloc(nthreads * gm->num_all, sizeof(off_t));
+  for(t = 0; t < nthreads; t++) {
+    for(f = 0; f < gm->num_all; f++) {
+      file = _merge_file(gm, f);
+      gm->starts[t*gm->num_all + f]
+        = t == 0 ? file->hdr_size
+                 : _merge_file_seek_offset(file, &indices[f], gm->splits[t-1]);
+    }
+  }
+
+  for(i = 0; i < gm->num_all; i++)
+    if(indices[i].b != NULL) gblock_buf_dealloc(&indices[i]);
+  ctx_free(indices);
+
+  return nthreads;
+}
+
+// Merge with `nthreads` threads. Returns number of kmers written or -1 if
+// the merge cannot be split, in which case nothing has been written.
+static int64_t graph_writer_merge_sorted_mt(const char *out_ctx_path,
+                                            GraphFileReader *files,
+                                            size_t num_files,
+                                            const GraphFileHeader *hdr,
+                                            const GraphMergeFilter *filter,
+                                            size_t nthreads)
+{
+  size_t i, total = 0;
+  GraphMergeThreads gm = {.files = files, .num_files = num_files,
+                          .num_all = num_files, .filter = filter,
+                          .ncols = hdr->num_of_cols,
+                          .recsize = BKMER_BYTES + 5*hdr->num_of_cols,
+                          .path = futil_outpath_str(out_ctx_path)};
+  if(filter != NULL) gm.num_all += filter->num_isec + filter->num_sub;
+
+  gm.nthreads = _merge_split(&gm, nthreads);
+  if(gm.nthreads <= 1) {
+    ctx_free(gm.splits);
+    return -1;
+  }
+
+  status("[graphwriter] Merging %zu sorted graph file%s with %zu threads into: %s",
+         num_files, util_plural_str(num_files), gm.nthreads, gm.path);
+
+  for(i = 0; i < gm.num_all; i++) graph_loading_print_status(_merge_file(&gm, i));
+
+  // Parallel writers pwrite() to the file themselves
+  FILE *out = futil_fopen(out_ctx_path, "w");
+  size_t hdr_size = graph_write_header(out, hdr);
+  if(fflush(out) != 0) die("Cannot write to file: %s", gm.path);
+  gm.fd = fileno(out);
+
+  gm.nkmers = ctx_calloc(gm.nthreads, sizeof(uint64_t));
+  gm.offsets = ctx_calloc(gm.nthreads, sizeof(uint64_t));
+
+  util_multi_thread(&gm, gm.nthreads, _merge_count_thread);
+
+  for(i = 0; i < gm.nthreads; i++) {
+    gm.offsets[i] = hdr_size + total * gm.recsize;
+    total += gm.nkmers[i];
+  }
+
+  util_multi_thread(&gm, gm.nthreads, _merge_write_thread);
+
+  fclose(out);
+
+  ctx_free(gm.splits);
+  ctx_free(gm.starts);
+  ctx_free(gm.nkmers);
+  ctx_free(gm.offsets);
+
+  return (int64_t)total;
+}
+
+size_t graph_writer_merge_sorted(const char *out_ctx_path,
+                                 GraphFileReader *files, size_t num_files,
+                                 const GraphFileHeader *hdr)
+{
+  return graph_writer_merge_sorted_filter(out_ctx_path, files, num_files,
+                                          hdr, NULL);
+}
+
+size_t graph_writer_merge_sorted_filter(const char *out_ctx_path,
+                                        GraphFileReader *files, size_t num_files,
+                                        const GraphFileHeader *hdr,
+                                        const GraphMergeFilter *filter)
+{
+  size_t i, ncols = hdr->num_of_cols, nodes_dumped = 0;
+
+  for(i = 0; i < num_files; i++) {
+    ctx_assert(file_filter_into_ncols(&files[i].fltr) <= ncols);
+    if(files[i].hdr.kmer_size != files[0].hdr.kmer_size) {
+      die("Kmer-size mismatch %u vs %u [%s vs %s]",
+          files[0].hdr.kmer_size, files[i].hdr.kmer_size,
+          files[0].fltr.path.b, files[i].fltr.path.b);
+    }
+  }
+
+  // Blocks are written serially, as is output to STDOUT since we cannot seek
+  if(graph_writer_nthreads > 1 && hdr->version != CTX_GRAPH_FILEFORMAT_BLOCKS &&
+     strcmp(out_ctx_path,"-") != 0)
+  {
+    int64_t n = graph_writer_merge_sorted_mt(out_ctx_path, files, num_files,
+                                             hdr, filter, graph_writer_nthreads);
+    if(n >= 0) {
+      graph_writer_print_status(n, ncols, out_ctx_path, hdr->version);
+      return n;
+    }
+  }
+
+  status("[graphwriter] Merging %zu sorted graph file%s into: %s",
+         num_files, util_plural_str(num_files), futil_outpath_str(out_ctx_path));
+
+  Covg kcovgs[ncols];
+  Edges kedges[ncols];
+  BinaryKmer bkmer;
+
+  for(i = 0; i < num_files; i++) _merge_seek_start(&files[i]);
+  if(filter != NULL) {
+    for(i = 0; i < filter->num_isec; i++) _merge_seek_start(&filter->isec_files[i]);
+    for(i = 0; i < filter->num_sub; i++) _merge_seek_start(&filter->sub_files[i]);
+  }
+
+  FILE *out = async_file_fopen(out_ctx_path, "w");
+  size_t hdr_size = graph_write_header(out, hdr);
+
+  GraphBlockWriter blkwtr, *bw = NULL;
+  if(hdr->version == CTX_GRAPH_FILEFORMAT_BLOCKS) {
+    graph_block_writer_alloc(&blkwtr, out, ncols, hdr_size,
+                             graph_writer_layout);
+    bw = &blkwtr;
+  }
+
+  KmerMerge m;
+  _merge_begin(&m, files, num_files, ncols, filter, NULL, NULL);
+
+  while(_merge_next(&m, &bkmer, kcovgs, kedges)) {
+    graph_write_kmer2(out, bw, ncols, bkmer, kcovgs, kedges);
+    nodes_dumped++;
+  }
+
+  _merge_end(&m);
+
+  if(bw) {
+    graph_block_writer_finish(bw);
+    graph_block_writer_dealloc(bw);
+  }
+
+  fclose(out);
+
+  graph_writer_print_status(nodes_dumped, ncols, out_ctx_path, hdr->version);
+
+  return nodes_dumped;
+}
+
+size_t graph_writer_merge_sorted_mkhdr(const char *out_ctx_path,
+                                       GraphFileReader *files, size_t num_files,
+                                       const GraphMergeFilter *filter)
+{
+  size_t i, nodes_dumped;
+  GraphFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+
+  for(i = 0; i < num_files; i++)
+    graph_file_merge_header(&hdr, &files[i]);
+  hdr.version = graph_writer_version;
+
+  if(filter != NULL && filter->num_isec > 0) {
+    StrBuf intersect_gname;
+    strbuf_alloc(&intersect_gname, 1024);
+    for(i = 0; i < filter->num_isec; i++)
+      graph_info_make_intersect(&filter->isec_files[i].hdr.ginfo[0],
+                                &intersect_gname);
+    for(i = 0; i < hdr.num_of_cols; i++)
+      if(graph_file_is_colour_loaded(i, files, num_files))
+        graph_info_append_intersect(&hdr.ginfo[i].cleaning, intersect_gname.b);
+    strbuf_dealloc(&intersect_gname);
+  }
+
+  nodes_dumped = graph_writer_merge_sorted_filter(out_ctx_path, files, num_files,
+                                                  &hdr, filter);
+  graph_header_dealloc(&hdr);
+  return nodes_dumped;
+}
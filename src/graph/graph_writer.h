@@ -10,6 +10,27 @@
 // Write graphs files to disk and merge graphs files on disk
 //
 
+// Graph file format version used for new headers (CTX_GRAPH_FILEFORMAT by
+// default). Set to CTX_GRAPH_FILEFORMAT_BLOCKS to write block compressed files.
+void graph_writer_set_version(uint32_t version);
+uint32_t graph_writer_get_version();
+
+// Write block compressed files with colour-major blocks (default: false), so
+// that loading a subset of colours skips the other colours on disk
+void graph_writer_set_colour_blocks(bool colmajor);
+bool graph_writer_get_colour_blocks();
+
+// Write block compressed files with delta coverage blocks (default: false),
+// which store each kmer as a base coverage plus small per-colour differences.
+// Suits graphs of related samples. Replaces colour-major blocks.
+void graph_writer_set_delta_covgs(bool deltacov);
+bool graph_writer_get_delta_covgs();
+
+// Number of threads used to write graph files (default: 1). Graph files are
+// written with pwrite() from each thread, except to STDOUT and for the block
+// compressed format, which are always written from a single thread.
+void graph_writer_set_nthreads(size_t nthreads);
+
 // Construct graph header
 // Free with graph_header_free(hdr)
 GraphFileHeader* graph_writer_mkhdr(const dBGraph *db_graph,
@@ -82,15 +103,56 @@ size_t graph_writer_merge(const char *out_ctx_path,
                           bool kmers_loaded, bool colours_loaded,
                           const Edges *only_load_if_in_edges,
                           GraphFileHeader *hdr, bool sort_kmers,
-                          dBGraph *db_graph);
+                          size_t nthreads, dBGraph *db_graph);
 
 // if intersect only load kmers that are already in the hash table
+// `nthreads` is the number of threads used to load each file
 // returns number of kmers written
 size_t graph_writer_merge_mkhdr(const char *out_ctx_path,
                                 GraphFileReader *files, size_t num_files,
                                 bool kmers_loaded, bool colours_loaded,
                                 const Edges *only_load_if_in_edges,
                                 const char *intersect_gname,
-                                bool sort_kmers, dBGraph *db_graph);
+                                bool sort_kmers, size_t nthreads,
+                                dBGraph *db_graph);
+
+// Merge sorted graph files without loading them into a hash table.
+// Streams through the files in kmer order with a k-way merge, so only needs
+// memory for one kmer per file. Dies with an error if a file is not sorted.
+// With graph_writer_set_nthreads() > 1 the kmer space is split into ranges
+// that are merged by separate threads, if all files can be seeked and the
+// output is neither STDOUT nor block compressed.
+// Returns number of kmers written
+size_t graph_writer_merge_sorted(const char *out_ctx_path,
+                                 GraphFileReader *files, size_t num_files,
+                                 const GraphFileHeader *hdr);
+
+// Which merged kmers graph_writer_merge_sorted_filter() writes. Filter files
+// must be sorted and are read in lock-step with the inputs, their colours are
+// flattened into one. Kmers with no coverage in a filter file are ignored.
+typedef struct
+{
+  // Only write kmers in all of these files, edges are intersected with theirs
+  GraphFileReader *isec_files;
+  size_t num_isec;
+  // Do not write kmers in any of these files
+  GraphFileReader *sub_files;
+  size_t num_sub;
+  // Only write kmers with coverage in at least this many colours
+  size_t min_cols;
+} GraphMergeFilter;
+
+// As graph_writer_merge_sorted() but only write kmers that pass `filter`
+// (NULL to write all kmers)
+size_t graph_writer_merge_sorted_filter(const char *out_ctx_path,
+                                        GraphFileReader *files, size_t num_files,
+                                        const GraphFileHeader *hdr,
+                                        const GraphMergeFilter *filter);
+
+// Header is merged from the input files. Output colours are marked as
+// intersected with the filter's isec files.
+size_t graph_writer_merge_sorted_mkhdr(const char *out_ctx_path,
+                                       GraphFileReader *files, size_t num_files,
+                                       const GraphMergeFilter *filter);
 
 #endif /* GRAPH_WRITER_H_ */
@@ -5,6 +5,9 @@
 #include "db_graph.h"
 #include "db_node.h"
 #include "graph_info.h"
+#include "graph_shards.h"
+#include "graph_popstore.h"
+#include "graph_search.h"
 
 //
 // Graph loading stats
@@ -35,7 +38,12 @@ void graph_loading_print_status(const GraphFileReader *file)
 
   file_filter_status(fltr, false);
 
-  if(isatty(fileno(file->fh))) status("  reading from a stream.");
+  if(file->pop != NULL) {
+    ulong_to_str(file->num_of_kmers, nkmers_str);
+    status("[GReader] %s kmers, population store of %zu samples",
+           nkmers_str, file->pop->nsamples);
+  }
+  else if(isatty(fileno(file->fh))) status("  reading from a stream.");
   else {
     ulong_to_str(file->num_of_kmers, nkmers_str);
     bytes_to_str(file->file_size, 1, filesize_str);
@@ -75,6 +83,200 @@ void graph_load_ginfo(dBGraph *graph, GraphFileReader *file)
   graph->num_of_cols_used = MAX2(graph->num_of_cols_used, ncols);
 }
 
+// Add a kmer read from a file to the graph.
+// If `bktlocks` is not NULL, other threads may be loading at the same time.
+// Returns true if the kmer was loaded
+static inline bool _graph_load_kmer(const GraphLoadingPrefs *prefs,
+                                    BinaryKmer bkmer, Covg *covgs, Edges *edges,
+                                    size_t ncols, volatile uint8_t *bktlocks,
+                                    GraphLoadingStats *stats,
+                                    size_t *nkmers_novel)
+{
+  dBGraph *graph = prefs->db_graph;
+  hkey_t hkey;
+  size_t i;
+
+  // If kmer has no covg -> don't load
+  Covg keep_kmer = 0;
+  for(i = 0; i < ncols; i++) keep_kmer |= covgs[i];
+  if(keep_kmer == 0) return false;
+
+  if(prefs->nshards > 1 &&
+     graph_shard_of_kmer(bkmer, graph->kmer_size, prefs->nshards) != prefs->shard)
+    return false;
+
+  if(stats) {
+    for(i = 0; i < ncols; i++) {
+      stats->nkmers[i] += covgs[i] > 0;
+      stats->sumcov[i] += covgs[i];
+    }
+  }
+
+  if(prefs->boolean_covgs)
+    for(i = 0; i < ncols; i++)
+      covgs[i] = covgs[i] > 0;
+
+  // Fetch node in the de bruijn graph
+  if(prefs->must_exist_in_graph)
+  {
+    // No kmers are added, so no locking is needed
+    if((hkey = hash_table_find(&graph->ht, bkmer)) == HASH_NOT_FOUND) return false;
+  }
+  else
+  {
+    bool found;
+    if(bktlocks == NULL)
+      hkey = hash_table_find_or_insert(&graph->ht, bkmer, &found);
+    else if(graph->ht_lockfree)
+      hkey = hash_table_find_or_insert_lockfree(&graph->ht, bkmer, &found, bktlocks);
+    else
+      hkey = hash_table_find_or_insert_mt(&graph->ht, bkmer, &found, bktlocks);
+    if(prefs->empty_colours && found) die("Duplicate kmer loaded");
+    *nkmers_novel += !found;
+  }
+
+  // Sparse graphs store all colour data together
+  if(graph->sparse != NULL) {
+    for(i = 0; i < ncols; i++)
+      if(covgs[i] || edges[i])
+        sparse_cols_add_mt(graph->sparse, hkey, i, covgs[i], edges[i]);
+    return true;
+  }
+
+  // Set presence in colours
+  if(graph->node_in_cols != NULL) {
+    for(i = 0; i < ncols; i++) {
+      if(bktlocks == NULL) db_node_or_col(graph, hkey, i, (covgs[i] || edges[i]));
+      else if(covgs[i] || edges[i]) db_node_set_col_mt(graph, hkey, i);
+    }
+  }
+
+  if(graph->col_covgs != NULL) {
+    for(i = 0; i < ncols; i++) {
+      if(bktlocks == NULL) db_node_add_col_covg(graph, hkey, i, covgs[i]);
+      else if(covgs[i]) db_node_add_col_covg_mt(graph, hkey, i, covgs[i]);
+    }
+  }
+
+  // Merge all edges into one colour
+  if(graph->col_edges != NULL)
+  {
+    // Edges edge_mask = db_node_get_edges_union(graph, hkey);
+    Edges edge_mask = 0xff, e;
+
+    if(prefs->must_exist_in_edges)
+      edge_mask = prefs->must_exist_in_edges[hkey];
+    else if(prefs->must_exist_in_graph)
+      edge_mask = db_node_get_edges_union(graph, hkey);
+
+    size_t col;
+
+    for(i = 0; i < ncols; i++) {
+      e = edges[i] & edge_mask;
+      col = graph->num_edge_cols == 1 ? 0 : i;
+      if(bktlocks == NULL) db_node_add_col_edges(graph, hkey, col, e);
+      else db_node_add_col_edges_mt(graph, hkey, col, e);
+    }
+  }
+
+  return true;
+}
+
+// Each thread reads a contiguous range of kmers from the file
+typedef struct
+{
+  size_t start, end; // kmer range [start,end)
+  off_t offset; // file offset of kmer `start`
+} GraphFileRange;
+
+// Split `file` into `nthreads` contiguous ranges of kmers. Blocked files are
+// split on block boundaries using the block index.
+static void graph_file_split(GraphFileReader *file, size_t nthreads,
+                             GraphFileRange *ranges)
+{
+  size_t i, nkmers = file->num_of_kmers, step = nkmers / nthreads;
+
+  if(graph_file_is_blocked(file)) {
+    GraphBlockTrailer trailer;
+    GraphBlockBuffer index;
+    gblock_buf_alloc(&index, 1024);
+    int fd = graph_file_fileno(file);
+    if(!graph_block_read_trailer(fd, file->file_size, &trailer) ||
+       !graph_block_read_index(fd, &trailer, &index) ||
+       index.len == 0)
+      die("Cannot read block index: %s", file_filter_path(&file->fltr));
+    for(i = 0; i < nthreads; i++) {
+      size_t b0 = (i * index.len) / nthreads;
+      size_t b1 = ((i+1) * index.len) / nthreads;
+      ranges[i].start = index.b[b0].kmer_offset;
+      ranges[i].end = b1 < index.len ? index.b[b1].kmer_offset : nkmers;
+      ranges[i].offset = index.b[b0].offset;
+    }
+    gblock_buf_dealloc(&index);
+  }
+  else {
+    // Population stores are read by rank, the offset is the first rank
+    for(i = 0; i < nthreads; i++) {
+      ranges[i].start = i * step;
+      ranges[i].end = (i+1 == nthreads ? nkmers : (i+1) * step);
+      ranges[i].offset = file->pop != NULL ? (off_t)ranges[i].start
+                                           : graph_file_offset(file, ranges[i].start);
+    }
+  }
+}
+
+typedef struct
+{
+  GraphFileReader *file;
+  const GraphLoadingPrefs *prefs;
+  volatile uint8_t *bktlocks;
+  GraphFileRange range;
+  bool collect_stats;
+  GraphLoadingStats stats;
+  size_t nkmers_read, nkmers_loaded, nkmers_novel;
+} GraphLoadJob;
+
+static void graph_load_range(void *arg, size_t threadid)
+{
+  (void)threadid;
+  GraphLoadJob *job = (GraphLoadJob*)arg;
+  size_t ncols = file_filter_into_ncols(&job->file->fltr);
+  size_t nkmers = job->range.end - job->range.start;
+
+  GraphFileReader rdr;
+  graph_file_dup(job->file, &rdr, job->range.offset);
+
+  BinaryKmer bkmer;
+  Covg covgs[ncols];
+  Edges edges[ncols];
+  GraphLoadingStats *stats = job->collect_stats ? &job->stats : NULL;
+
+  if(stats) graph_loading_stats_capacity(stats, ncols);
+
+  for(; job->nkmers_read < nkmers &&
+        graph_file_read_reset(&rdr, &bkmer, covgs, edges); job->nkmers_read++)
+  {
+    job->nkmers_loaded += _graph_load_kmer(job->prefs, bkmer, covgs, edges,
+                                           ncols, job->bktlocks, stats,
+                                           &job->nkmers_novel);
+  }
+
+  graph_file_dup_close(&rdr);
+}
+
+// Don't bother splitting small files between threads
+#define GRAPH_LOAD_MIN_KMERS_PER_THREAD 10000
+
+// Number of threads to split `file` between, streams can't be split
+size_t graph_file_nthreads(const GraphFileReader *file, size_t nthreads)
+{
+  if(nthreads <= 1 || file_filter_isstdin(&file->fltr) || file->num_of_kmers <= 0)
+    return 1;
+  nthreads = MIN2(nthreads,
+                  (size_t)file->num_of_kmers / GRAPH_LOAD_MIN_KMERS_PER_THREAD);
+  return MAX2(nthreads, 1);
+}
+
 // We assume only_load_if_in_colour < load_first_colour_into
 // if all_kmers_are_unique != 0 an error is thrown if a node already exists
 // If stats != NULL, updates:
@@ -106,83 +308,68 @@ size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
   // Load ginfo from file header into the graph and check compatible
   graph_load_ginfo(graph, file);
 
-  // Read kmers, align colours to those they are updating
-  //  e.g. covgs[i] -> colour i in the graph
-  BinaryKmer bkmer;
-  Covg covgs[ncols];
-  Edges edges[ncols];
-  hkey_t hkey;
   size_t nkmers_read = 0, nkmers_loaded = 0, nkmers_novel = 0;
 
   if(stats) graph_loading_stats_capacity(stats, ncols);
 
-  for(; graph_file_read_reset(file, &bkmer, covgs, edges); nkmers_read++)
+  // Only single threaded inserts make room in cuckoo tables
+  size_t nthreads = graph->ht.cuckoo ? 1
+                    : graph_file_nthreads(file, prefs.nthreads);
+
+  if(nthreads > 1)
   {
-    // If kmer has no covg -> don't load
-    Covg keep_kmer = 0;
-    for(i = 0; i < ncols; i++) keep_kmer |= covgs[i];
-    if(keep_kmer == 0) continue;
-
-    if(stats) {
-      for(i = 0; i < ncols; i++) {
-        stats->nkmers[i] += covgs[i] > 0;
-        stats->sumcov[i] += covgs[i];
-      }
+    // Use the graph's bucket locks if it has them, otherwise temporary ones
+    volatile uint8_t *bktlocks = graph->bktlocks;
+    if(bktlocks == NULL)
+      bktlocks = ctx_calloc(roundup_bits2bytes(graph->ht.num_of_buckets), 1);
+
+    status("[GReader] Loading with %zu threads", nthreads);
+
+    size_t j;
+    GraphLoadJob *jobs = ctx_calloc(nthreads, sizeof(GraphLoadJob));
+    GraphFileRange *ranges = ctx_calloc(nthreads, sizeof(GraphFileRange));
+    graph_file_split(file, nthreads, ranges);
+
+    for(i = 0; i < nthreads; i++) {
+      jobs[i].file = file;
+      jobs[i].prefs = &prefs;
+      jobs[i].bktlocks = bktlocks;
+      jobs[i].range = ranges[i];
+      jobs[i].collect_stats = (stats != NULL);
     }
 
-    if(prefs.boolean_covgs)
-      for(i = 0; i < ncols; i++)
-        covgs[i] = covgs[i] > 0;
+    ctx_free(ranges);
 
-    // Fetch node in the de bruijn graph
-    if(prefs.must_exist_in_graph)
-    {
-      if((hkey = hash_table_find(&graph->ht, bkmer)) == HASH_NOT_FOUND) continue;
-    }
-    else
-    {
-      bool found;
-      hkey = hash_table_find_or_insert(&graph->ht, bkmer, &found);
-      if(prefs.empty_colours && found) die("Duplicate kmer loaded");
-      nkmers_novel += !found;
-    }
+    util_run_threads(jobs, nthreads, sizeof(jobs[0]), nthreads, graph_load_range);
 
-    // Set presence in colours
-    if(graph->node_in_cols != NULL) {
-      for(i = 0; i < ncols; i++) {
-        db_node_or_col(graph, hkey, i, (covgs[i] || edges[i]));
+    for(i = 0; i < nthreads; i++) {
+      nkmers_read += jobs[i].nkmers_read;
+      nkmers_loaded += jobs[i].nkmers_loaded;
+      nkmers_novel += jobs[i].nkmers_novel;
+      if(stats) {
+        for(j = 0; j < ncols; j++) {
+          stats->nkmers[j] += jobs[i].stats.nkmers[j];
+          stats->sumcov[j] += jobs[i].stats.sumcov[j];
+        }
+        graph_loading_stats_destroy(&jobs[i].stats);
       }
     }
 
-    if(graph->col_covgs != NULL) {
-      for(i = 0; i < ncols; i++)
-        db_node_add_col_covg(graph, hkey, i, covgs[i]);
-    }
-
-    // Merge all edges into one colour
-    if(graph->col_edges != NULL)
-    {
-      // Edges edge_mask = db_node_get_edges_union(graph, hkey);
-      Edges edge_mask = 0xff;
-
-      if(prefs.must_exist_in_edges)
-        edge_mask = prefs.must_exist_in_edges[hkey];
-      else if(prefs.must_exist_in_graph)
-        edge_mask = db_node_get_edges_union(graph, hkey);
-
-      Edges *col_edges = &db_node_edges(graph, hkey, 0);
-
-      if(graph->num_edge_cols == 1) {
-        for(i = 0; i < ncols; i++)
-          col_edges[0] |= edges[i] & edge_mask;
-      }
-      else {
-        for(i = 0; i < ncols; i++)
-          col_edges[i] |= edges[i] & edge_mask;
-      }
+    ctx_free(jobs);
+    if(bktlocks != graph->bktlocks) ctx_free((uint8_t*)bktlocks);
+  }
+  else
+  {
+    // Read kmers, align colours to those they are updating
+    //  e.g. covgs[i] -> colour i in the graph
+    BinaryKmer bkmer;
+    Covg covgs[ncols];
+    Edges edges[ncols];
+
+    for(; graph_file_read_reset(file, &bkmer, covgs, edges); nkmers_read++) {
+      nkmers_loaded += _graph_load_kmer(&prefs, bkmer, covgs, edges, ncols,
+                                        NULL, stats, &nkmers_novel);
     }
-
-    nkmers_loaded++;
   }
 
   if(file->num_of_kmers >= 0 && nkmers_read != (uint64_t)file->num_of_kmers)
@@ -213,6 +400,156 @@ size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
   return nkmers_loaded;
 }
 
+static int _bkmer_cmp(const void *a, const void *b)
+{
+  return binary_kmer_cmp(*(const BinaryKmer*)a, *(const BinaryKmer*)b);
+}
+
+size_t graph_load_sorted_kmers(GraphFileReader *file,
+                               const GraphLoadingPrefs prefs,
+                               GraphLoadingStats *stats)
+{
+  dBGraph *graph = prefs.db_graph;
+  FileFilter *fltr = &file->fltr;
+  const size_t ncols = file_filter_into_ncols(fltr);
+  size_t i, n = 0, nkmers_loaded = 0, nkmers_novel = 0;
+  hkey_t hkey;
+
+  ctx_assert(prefs.must_exist_in_graph);
+  ctx_assert(file_filter_num(fltr) > 0);
+
+  if(!graph_file_is_blocked(file) || file_filter_isstdin(fltr))
+    die("Need a block compressed graph file to fetch kmers: %s", fltr->path.b);
+
+  graph_loading_print_status(file);
+  graph_load_ginfo(graph, file);
+  if(stats) graph_loading_stats_capacity(stats, ncols);
+
+  // Sort the kmers we want so the file is read in one forward sweep
+  BinaryKmer *bkeys = ctx_malloc(MAX2(graph->ht.num_kmers, 1) * sizeof(BinaryKmer));
+  for(hkey = 0; hkey < graph->ht.capacity; hkey++)
+    if(hash_table_assigned(&graph->ht, hkey))
+      bkeys[n++] = hash_table_fetch(&graph->ht, hkey);
+  qsort(bkeys, n, sizeof(BinaryKmer), _bkmer_cmp);
+
+  GraphFileSearch *gs = graph_search_new(file);
+  Covg covgs[ncols];
+  Edges edges[ncols];
+
+  for(i = 0; i < n; i++) {
+    if(graph_search_find(gs, bkeys[i], covgs, edges)) {
+      nkmers_loaded += _graph_load_kmer(&prefs, bkeys[i], covgs, edges, ncols,
+                                        NULL, NULL, &nkmers_novel);
+    }
+  }
+
+  graph_search_destroy(gs);
+  ctx_free(bkeys);
+
+  if(stats != NULL) {
+    stats->nkmers_read += n;
+    stats->nkmers_loaded += nkmers_loaded;
+  }
+
+  char n0[50], n1[50];
+  status("[GReader] Fetched %s / %s (%.2f%%) of kmers searched for",
+         ulong_to_str(nkmers_loaded, n0), ulong_to_str(n, n1),
+         safe_percent(nkmers_loaded, n));
+
+  return nkmers_loaded;
+}
+
+typedef struct
+{
+  GraphFileReader *file;
+  GraphFileRange range;
+  GraphKmerFunc func;
+  void *arg;
+  size_t nkmers_read;
+} GraphIterJob;
+
+static void graph_iterate_range(void *arg, size_t threadid)
+{
+  GraphIterJob *job = (GraphIterJob*)arg;
+  size_t ncols = file_filter_into_ncols(&job->file->fltr);
+  size_t nkmers = job->range.end - job->range.start;
+
+  GraphFileReader rdr;
+  graph_file_dup(job->file, &rdr, job->range.offset);
+
+  BinaryKmer bkmer;
+  Covg covgs[ncols];
+  Edges edges[ncols];
+
+  for(; job->nkmers_read < nkmers &&
+        graph_file_read_reset(&rdr, &bkmer, covgs, edges); job->nkmers_read++)
+  {
+    job->func(bkmer, covgs, edges, ncols, threadid, job->arg);
+  }
+
+  graph_file_dup_close(&rdr);
+}
+
+/*!
+  Stream kmers from `file` without loading them into a graph. The file is
+  split between up to `nthreads` threads as with graph_load().
+  @return number of kmers read
+ */
+size_t graph_file_iterate(GraphFileReader *file, size_t nthreads,
+                          GraphKmerFunc func, void *arg)
+{
+  FileFilter *fltr = &file->fltr;
+  size_t i, nkmers_read = 0, ncols = file_filter_into_ncols(fltr);
+
+  if(!file_filter_isstdin(fltr)) {
+    if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
+      die("fseek failed: %s", strerror(errno));
+  }
+
+  nthreads = graph_file_nthreads(file, nthreads);
+
+  if(nthreads > 1)
+  {
+    GraphIterJob *jobs = ctx_calloc(nthreads, sizeof(GraphIterJob));
+    GraphFileRange *ranges = ctx_calloc(nthreads, sizeof(GraphFileRange));
+    graph_file_split(file, nthreads, ranges);
+
+    for(i = 0; i < nthreads; i++) {
+      jobs[i].file = file;
+      jobs[i].range = ranges[i];
+      jobs[i].func = func;
+      jobs[i].arg = arg;
+    }
+
+    util_run_threads(jobs, nthreads, sizeof(jobs[0]), nthreads,
+                     graph_iterate_range);
+
+    for(i = 0; i < nthreads; i++) nkmers_read += jobs[i].nkmers_read;
+
+    ctx_free(ranges);
+    ctx_free(jobs);
+  }
+  else
+  {
+    BinaryKmer bkmer;
+    Covg covgs[ncols];
+    Edges edges[ncols];
+
+    for(; graph_file_read_reset(file, &bkmer, covgs, edges); nkmers_read++)
+      func(bkmer, covgs, edges, ncols, 0, arg);
+  }
+
+  if(file->num_of_kmers >= 0 && nkmers_read != (uint64_t)file->num_of_kmers)
+  {
+    warn("%s kmers in the graph file than expected "
+         "[exp: %zu; act: %zu; path: %s]",
+         nkmers_read > (uint64_t)file->num_of_kmers ? "More" : "Fewer",
+         (size_t)file->num_of_kmers, nkmers_read, fltr->path.b);
+  }
+
+  return nkmers_read;
+}
+
 // Load all files into colour 0
 void graphs_load_files_flat(GraphFileReader *gfiles, size_t num_files,
                             GraphLoadingPrefs prefs, GraphLoadingStats *stats)
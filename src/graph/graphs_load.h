@@ -18,6 +18,11 @@ typedef struct
   // if empty_colours is true an error is thrown if a kmer from a graph file
   // is already in the graph
   bool empty_colours;
+  // Number of threads to load each file with. Files are split into ranges of
+  // kmers, so streams are always loaded with one thread.
+  size_t nthreads;
+  // If nshards > 1, only load kmers in minimizer shard `shard` (graph_shards.h)
+  size_t shard, nshards;
 } GraphLoadingPrefs;
 
 typedef struct
@@ -38,7 +43,10 @@ static inline GraphLoadingPrefs graph_loading_prefs(dBGraph *graph)
     .boolean_covgs = false,
     .must_exist_in_graph = false,
     .must_exist_in_edges = NULL,
-    .empty_colours = false
+    .empty_colours = false,
+    .nthreads = 1,
+    .shard = 0,
+    .nshards = 1
   };
   return prefs;
 }
@@ -58,6 +66,33 @@ void graph_load_ginfo(dBGraph *graph, GraphFileReader *file);
 size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
                   GraphLoadingStats *stats);
 
+// Load only the kmers already in the graph from a sorted, block compressed
+// graph file (format version 7). Kmers in the hash table are sorted and looked
+// up in order with graph_search_find(), so each block of the file is read and
+// decoded at most once and blocks without wanted kmers are skipped.
+// prefs.must_exist_in_graph must be set. stats gets the number of kmers
+// searched for and loaded, but not coverage per colour, since most of the file
+// is never read. Returns the number of kmers loaded.
+size_t graph_load_sorted_kmers(GraphFileReader *file,
+                               const GraphLoadingPrefs prefs,
+                               GraphLoadingStats *stats);
+
+// Number of threads to split `file` between when loading or iterating.
+// Streams and small files are read with a single thread.
+size_t graph_file_nthreads(const GraphFileReader *file, size_t nthreads);
+
+// Called on each kmer by graph_file_iterate(). covgs and edges have one entry
+// per colour of the file's filter (file_filter_into_ncols()). `threadid` is in
+// [0,nthreads) so callers can keep per-thread state.
+typedef void (*GraphKmerFunc)(BinaryKmer bkmer, const Covg *covgs,
+                              const Edges *edges, size_t ncols,
+                              size_t threadid, void *arg);
+
+// Stream kmers from a graph file without a graph, splitting the file between
+// threads as graph_load() does. Returns number of kmers read.
+size_t graph_file_iterate(GraphFileReader *file, size_t nthreads,
+                          GraphKmerFunc func, void *arg);
+
 // Load all files into colour 0
 void graphs_load_files_flat(GraphFileReader *gfiles, size_t num_files,
                            GraphLoadingPrefs prefs, GraphLoadingStats *stats);
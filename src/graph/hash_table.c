@@ -2,6 +2,7 @@
 #include "hash_table.h"
 #include "hash_mem.h"
 #include "util.h"
+#include "cpu_dispatch.h"
 
 // bit macros from BitArray library used for spinlocking
 #include "bit_array/bit_macros.h"
@@ -9,20 +10,52 @@
 // Hash table prefetching doesn't appear to be faster
 // #define HASH_PREFETCH 1
 
-#define ht_bckt_ptr(ht,bckt) ((ht)->table + (size_t)bckt * (ht)->bucket_size)
-#define hash_table_bsize_mt(ht,bkt) (*(volatile uint8_t*)&ht->buckets[bkt][HT_BSIZE])
-#define hash_table_bitems_mt(ht,bkt) (*(volatile uint8_t*)&ht->buckets[bkt][HT_BITEMS])
+// Once relaid out, buckets are probed in slot_table (see hash_table_relayout())
+#define ht_slots(ht) ((ht)->slot_table != NULL ? (ht)->slot_table : (ht)->table)
+#define ht_bckt_ptr(ht,bckt) (ht_slots(ht) + (size_t)bckt * (ht)->bucket_size)
+// hkey of the kmer at `ptr` in a bucket
+#define ht_slot_hkey(ht,ptr) ((ht)->slot_hkeys != NULL ? \
+        (ht)->slot_hkeys[(ptr) - (ht)->slot_table] : (hkey_t)((ptr) - (ht)->table))
+#define hash_table_bsize_mt(ht,bkt) (*(volatile uint8_t*)&hash_table_bsize(ht, bkt))
+#define hash_table_bitems_mt(ht,bkt) (*(volatile uint8_t*)&hash_table_bitems(ht, bkt))
+// Tags of the entries in a bucket
+#define ht_bckt_tags(ht,bckt) ((ht)->tags + (size_t)(bckt) * \
+        ((ht)->colocated ? HT_BUCKET_HDR : (ht)->bucket_size))
+#define ht_slot_tag(ht,slot) \
+        (ht_bckt_tags(ht, (slot) / (ht)->bucket_size)[(slot) % (ht)->bucket_size])
 
-void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
+// Bucket locks are in `bktlocks`, or in the bucket header if colocated
+#define ht_bckt_lock(ht,bktlocks,h) do {                                     \
+  if((ht)->colocated)                                                        \
+    ctx_bitlock_yield_acquire((volatile uint8_t*)hash_table_bmeta(ht,h),     \
+                              HT_BLOCK*8);                                   \
+  else ctx_bitlock_yield_acquire(bktlocks, h);                               \
+} while(0)
+
+#define ht_bckt_unlock(ht,bktlocks,h) do {                                   \
+  if((ht)->colocated)                                                        \
+    bitlock_release((volatile uint8_t*)hash_table_bmeta(ht,h), HT_BLOCK*8);  \
+  else bitlock_release(bktlocks, h);                                         \
+} while(0)
+
+const int HT_ALLOC_TAGS      = 1;
+const int HT_ALLOC_HUGEPAGES = 2;
+const int HT_ALLOC_CUCKOO    = 4;
+const int HT_ALLOC_COLOCATE  = 8;
+
+void hash_table_alloc_flags(HashTable *ht, uint64_t req_capacity, int flags)
 {
   uint64_t num_of_buckets, capacity;
   uint8_t bucket_size;
+  bool tagged = (flags & HT_ALLOC_TAGS), large = (flags & HT_ALLOC_HUGEPAGES);
+  bool cuckoo = (flags & HT_ALLOC_CUCKOO), coloc = (flags & HT_ALLOC_COLOCATE);
 
   capacity = hash_table_cap(req_capacity, &num_of_buckets, &bucket_size);
   uint_fast32_t hash_mask = (uint_fast32_t)(num_of_buckets - 1);
 
-  size_t mem = capacity * sizeof(BinaryKmer) +
-               num_of_buckets * sizeof(uint8_t[2]);
+  size_t mem = ht_mem(bucket_size, num_of_buckets, sizeof(BinaryKmer)*8,
+                      (tagged ? HT_MEM_TAGS : 0) |
+                      (coloc ? HT_MEM_BUCKET_HDRS : 0));
 
   char num_bkts_str[100], bkt_size_str[100], cap_str[100], mem_str[100];
   ulong_to_str(num_of_buckets, num_bkts_str);
@@ -30,12 +63,29 @@ void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
   ulong_to_str(capacity, cap_str);
   bytes_to_str(mem, 1, mem_str);
   status("[hasht] Allocating table with %s entries, using %s", cap_str, mem_str);
-  status("[hasht]  number of buckets: %s, bucket size: %s", num_bkts_str, bkt_size_str);
+  status("[hasht]  number of buckets: %s, bucket size: %s%s%s",
+         num_bkts_str, bkt_size_str, cuckoo ? ", cuckoo inserts" : "",
+         coloc ? ", bucket headers" : "");
 
   // calloc is required for bucket_data to set the first element of each bucket
   // to the 0th pos
-  BinaryKmer *table = ctx_calloc(capacity, sizeof(BinaryKmer));
-  uint8_t (*const buckets)[2] = ctx_calloc(num_of_buckets, sizeof(uint8_t[2]));
+  BinaryKmer *table;
+  uint8_t *buckets, *tags = NULL;
+
+  if(large) {
+    table = ctx_calloc_large(capacity, sizeof(BinaryKmer));
+    if(tagged && !coloc) tags = ctx_calloc_large(capacity, sizeof(uint8_t));
+  } else {
+    table = ctx_calloc(capacity, sizeof(BinaryKmer));
+    if(tagged && !coloc) tags = ctx_calloc(capacity, sizeof(uint8_t));
+  }
+
+  if(coloc) {
+    // ctx_calloc_large() memory is cache line aligned
+    buckets = ctx_calloc_large(num_of_buckets, HT_BUCKET_HDR);
+    tags = buckets + HT_HDR_TAGS;
+  }
+  else buckets = ctx_calloc(num_of_buckets, sizeof(uint8_t[2]));
 
   HashTable data = {
     .table = table,
@@ -44,6 +94,13 @@ void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
     .bucket_size = bucket_size,
     .capacity = capacity,
     .buckets = buckets,
+    .tags = tags,
+    .colocated = coloc,
+    .large_pages = large,
+    .cuckoo = cuckoo,
+    .move_func = NULL,
+    .move_arg = NULL,
+    .num_moves = 0,
     .num_kmers = 0,
     .collisions = {0},
     .seed = rand()};
@@ -51,16 +108,53 @@ void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
   memcpy(ht, &data, sizeof(data));
 }
 
+void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
+{
+  hash_table_alloc_flags(ht, req_capacity, 0);
+}
+
+// Only called when the table is being emptied or freed
+static void hash_table_relayout_free(HashTable *ht)
+{
+  if(ht->slot_table == NULL) return;
+  if(ht->large_pages) ctx_free_large(ht->slot_table);
+  else ctx_free(ht->slot_table);
+  ctx_free(ht->slot_hkeys);
+  ht->slot_table = NULL;
+  ht->slot_hkeys = NULL;
+}
+
 void hash_table_dealloc(HashTable *hash_table)
 {
-  ctx_free(hash_table->table);
-  ctx_free(hash_table->buckets);
+  hash_table_filter_free(hash_table);
+  hash_table_relayout_free(hash_table);
+  if(hash_table->large_pages) {
+    ctx_free_large(hash_table->table);
+    if(!hash_table->colocated) ctx_free_large(hash_table->tags);
+  } else {
+    ctx_free(hash_table->table);
+    if(!hash_table->colocated) ctx_free(hash_table->tags);
+  }
+  if(hash_table->colocated) ctx_free_large(hash_table->buckets);
+  else ctx_free(hash_table->buckets);
+}
+
+void hash_table_set_move(HashTable *ht,
+                         void (*func)(hkey_t from, hkey_t to, void *arg),
+                         void *arg)
+{
+  ht->move_func = func;
+  ht->move_arg = arg;
 }
 
 void hash_table_empty(HashTable *const ht)
 {
+  hash_table_filter_free(ht);
+  hash_table_relayout_free(ht);
   memset(ht->table, 0, ht->capacity * sizeof(BinaryKmer));
-  memset(ht->buckets, 0, ht->num_of_buckets * sizeof(uint8_t[2]));
+  memset(ht->buckets, 0, ht->num_of_buckets * hash_table_bstride(ht));
+  if(ht->tags && !ht->colocated)
+    memset(ht->tags, 0, ht->capacity * sizeof(uint8_t));
 
   HashTable data = {
     .table = ht->table,
@@ -69,12 +163,170 @@ void hash_table_empty(HashTable *const ht)
     .bucket_size = ht->bucket_size,
     .capacity = ht->capacity,
     .buckets = ht->buckets,
+    .tags = ht->tags,
+    .colocated = ht->colocated,
+    .large_pages = ht->large_pages,
+    .cuckoo = ht->cuckoo,
+    .move_func = ht->move_func,
+    .move_arg = ht->move_arg,
+    .num_moves = 0,
     .num_kmers = 0,
     .collisions = {0}};
 
   memcpy(ht, &data, sizeof(data));
 }
 
+// SIMD bucket scans for one and two word kmers, compare several
+// entries per instruction. Version picked at runtime (see cpu_dispatch.h)
+#if NUM_BKMER_WORDS <= 2 && CPU_DISPATCH
+  #include <immintrin.h>
+  #define HASH_SIMD_PROBE 1
+#endif
+
+// Fingerprint of a kmer, stored in ht->tags. Uses a multiplicative hash so it
+// is independent of the bits used to pick a bucket. Never 0 (empty slot).
+static inline uint8_t hash_table_tag(BinaryKmer bkmer)
+{
+  uint64_t x = bkmer.b[0] & 0x3fffffffffffffff;
+  #if NUM_BKMER_WORDS > 1
+    size_t i;
+    for(i = 1; i < NUM_BKMER_WORDS; i++) x = (x ^ bkmer.b[i]) * 0xff51afd7ed558ccdUL;
+  #endif
+  uint8_t tag = (uint8_t)((x * 0x9e3779b97f4a7c15UL) >> 56);
+  return tag ? tag : 1;
+}
+
+// Returns pointer to the first entry in [ptr,end) that matches bkmer, or end
+static inline const BinaryKmer* _ht_scan_generic(const BinaryKmer *ptr,
+                                                 const BinaryKmer *end,
+                                                 BinaryKmer bkmer)
+{
+  for(; ptr < end && !binary_kmer_eq(bkmer, *ptr); ptr++) {}
+  return ptr;
+}
+
+#ifdef HASH_SIMD_PROBE
+
+static const BinaryKmer* _ht_scan_nosimd(const BinaryKmer *ptr,
+                                         const BinaryKmer *end,
+                                         BinaryKmer bkmer)
+{
+  return _ht_scan_generic(ptr, end, bkmer);
+}
+
+static CPU_TARGET_SSE41 const BinaryKmer* _ht_scan_sse41(const BinaryKmer *ptr,
+                                                         const BinaryKmer *end,
+                                                         BinaryKmer bkmer)
+{
+  int m;
+  #if NUM_BKMER_WORDS == 1
+    // 2 kmers per 128 bit register
+    const __m128i key = _mm_set1_epi64x((long long)bkmer.b[0]);
+    for(; ptr+2 <= end; ptr += 2) {
+      __m128i v = _mm_loadu_si128((const __m128i*)ptr);
+      m = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, key)));
+      if(m) return ptr + __builtin_ctz(m);
+    }
+  #else
+    // 1 kmer per 128 bit register
+    const __m128i key = _mm_set_epi64x((long long)bkmer.b[1],
+                                       (long long)bkmer.b[0]);
+    for(; ptr < end; ptr++) {
+      __m128i v = _mm_loadu_si128((const __m128i*)ptr);
+      m = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, key)));
+      if(m == 0x3) return ptr;
+    }
+  #endif
+  return _ht_scan_generic(ptr, end, bkmer);
+}
+
+static CPU_TARGET_AVX2 const BinaryKmer* _ht_scan_avx2(const BinaryKmer *ptr,
+                                                       const BinaryKmer *end,
+                                                       BinaryKmer bkmer)
+{
+  int m;
+  #if NUM_BKMER_WORDS == 1
+    // 4 kmers per 256 bit register
+    const __m256i key = _mm256_set1_epi64x((long long)bkmer.b[0]);
+    for(; ptr+4 <= end; ptr += 4) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)ptr);
+      m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, key)));
+      if(m) return ptr + __builtin_ctz(m);
+    }
+  #else
+    // 2 kmers per 256 bit register, both words must match
+    const __m256i key = _mm256_setr_epi64x((long long)bkmer.b[0],
+                                           (long long)bkmer.b[1],
+                                           (long long)bkmer.b[0],
+                                           (long long)bkmer.b[1]);
+    for(; ptr+2 <= end; ptr += 2) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)ptr);
+      m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, key)));
+      m &= (m >> 1) & 0x5;
+      if(m) return ptr + (__builtin_ctz(m) >> 1);
+    }
+  #endif
+  return _ht_scan_generic(ptr, end, bkmer);
+}
+
+static CPU_TARGET_AVX512 const BinaryKmer* _ht_scan_avx512(const BinaryKmer *ptr,
+                                                           const BinaryKmer *end,
+                                                           BinaryKmer bkmer)
+{
+  unsigned int m;
+  #if NUM_BKMER_WORDS == 1
+    // 8 kmers per 512 bit register
+    const __m512i key = _mm512_set1_epi64((long long)bkmer.b[0]);
+    for(; ptr+8 <= end; ptr += 8) {
+      m = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512((const void*)ptr), key);
+      if(m) return ptr + __builtin_ctz(m);
+    }
+  #else
+    // 4 kmers per 512 bit register, both words must match
+    const __m512i key = _mm512_broadcast_i64x4(
+                          _mm256_setr_epi64x((long long)bkmer.b[0],
+                                             (long long)bkmer.b[1],
+                                             (long long)bkmer.b[0],
+                                             (long long)bkmer.b[1]));
+    for(; ptr+4 <= end; ptr += 4) {
+      m = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512((const void*)ptr), key);
+      m &= (m >> 1) & 0x55;
+      if(m) return ptr + (__builtin_ctz(m) >> 1);
+    }
+  #endif
+  return _ht_scan_avx2(ptr, end, bkmer);
+}
+
+static const BinaryKmer* (*ht_scan_func)(const BinaryKmer*, const BinaryKmer*,
+                                         BinaryKmer) = _ht_scan_nosimd;
+static CpuSimd ht_scan_lvl = CPU_SIMD_NONE;
+static uint32_t ht_scan_gen = 0;
+
+static void ht_scan_select(CpuSimd lvl)
+{
+  const BinaryKmer* (*func)(const BinaryKmer*, const BinaryKmer*, BinaryKmer);
+  switch(lvl) {
+    case CPU_SIMD_AVX512: func = _ht_scan_avx512; break;
+    case CPU_SIMD_AVX2:   func = _ht_scan_avx2;   break;
+    case CPU_SIMD_SSE41:  func = _ht_scan_sse41;  break;
+    default: func = _ht_scan_nosimd; lvl = CPU_SIMD_NONE;
+  }
+  ht_scan_func = func;
+  ht_scan_lvl = lvl;
+}
+
+#endif /* HASH_SIMD_PROBE */
+
+const char* hash_table_probe_simd_str()
+{
+  #ifdef HASH_SIMD_PROBE
+    cpu_dispatch_check(ht_scan_gen, ht_scan_select);
+    return cpu_simd_str(ht_scan_lvl);
+  #else
+    return cpu_simd_str(CPU_SIMD_NONE);
+  #endif
+}
+
 static inline const BinaryKmer* hash_table_find_in_bucket(const HashTable *const ht,
                                                           uint_fast32_t bucket,
                                                           BinaryKmer bkmer)
@@ -83,9 +335,54 @@ static inline const BinaryKmer* hash_table_find_in_bucket(const HashTable *const
   const BinaryKmer *end = ptr + hash_table_bsize(ht, bucket);
   bkmer.b[0] |= BKMER_SET_FLAG; // mark as assigned in the hash table
 
-  while(ptr < end) {
-    if(binary_kmer_eq(bkmer, *ptr)) return ptr;
-    ptr++;
+  if(ht->tags != NULL) {
+    // Only compare kmers whose fingerprint matches
+    const uint8_t tag = hash_table_tag(bkmer);
+    const uint8_t *tptr = ht_bckt_tags(ht, bucket);
+    for(; ptr < end; ptr++, tptr++)
+      if(*tptr == tag && binary_kmer_eq(bkmer, *ptr)) return ptr;
+    return NULL; // Not found
+  }
+
+  #ifdef HASH_SIMD_PROBE
+    cpu_dispatch_check(ht_scan_gen, ht_scan_select);
+    ptr = ht_scan_func(ptr, end, bkmer);
+  #else
+    ptr = _ht_scan_generic(ptr, end, bkmer);
+  #endif
+  return ptr < end ? ptr : NULL;
+}
+
+// Write the first word (holding BKMER_SET_FLAG) last, so that lock-free
+// readers never see a partially written entry marked as assigned
+static inline void hash_table_store_entry(BinaryKmer *ptr, BinaryKmer bkmer)
+{
+  #if NUM_BKMER_WORDS > 1
+    memcpy(ptr->b+1, bkmer.b+1, sizeof(uint64_t)*(NUM_BKMER_WORDS-1));
+    __sync_synchronize();
+  #endif
+  *(volatile uint64_t*)ptr->b = bkmer.b[0];
+}
+
+// Search a bucket without taking its lock. May miss an entry that is being
+// written, but never returns a partially written entry.
+static inline const BinaryKmer* hash_table_find_in_bucket_mt(const HashTable *const ht,
+                                                             uint_fast32_t bucket,
+                                                             BinaryKmer bkmer)
+{
+  const BinaryKmer *ptr = ht_bckt_ptr(ht, bucket);
+  const BinaryKmer *end = ptr + hash_table_bsize_mt(ht, bucket);
+  bkmer.b[0] |= BKMER_SET_FLAG; // mark as assigned in the hash table
+
+  for(; ptr < end; ptr++) {
+    if(*(volatile const uint64_t*)ptr->b == bkmer.b[0]) {
+      #if NUM_BKMER_WORDS > 1
+        __sync_synchronize();
+        if(memcmp(ptr->b+1, bkmer.b+1, sizeof(uint64_t)*(NUM_BKMER_WORDS-1)))
+          continue;
+      #endif
+      return ptr;
+    }
   }
   return NULL; // Not found
 }
@@ -97,6 +394,7 @@ static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
 {
   size_t bsize = hash_table_bsize(ht, bucket);
   size_t bitems = hash_table_bitems(ht, bucket);
+  ctx_assert2(ht->slot_table == NULL, "Cannot insert once relaid out");
   ctx_assert(bitems < ht->bucket_size);
   ctx_assert(bitems <= bsize);
   BinaryKmer *ptr = ht_bckt_ptr(ht, bucket);
@@ -104,15 +402,17 @@ static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
 
   if(bitems == bsize) {
     ptr += bsize;
-    ht->buckets[bucket][HT_BSIZE]++;
+    hash_table_bsize(ht, bucket)++;
   }
   else {
     // Find an entry that has been deleted from this bucket previously
     while(HASH_ENTRY_ASSIGNED(*ptr)) ptr++;
   }
 
-  *ptr = bkmer;
-  ht->buckets[bucket][HT_BITEMS]++;
+  hash_table_store_entry(ptr, bkmer);
+  if(ht->tags)
+    ht_bckt_tags(ht, bucket)[ptr - ht_bckt_ptr(ht, bucket)] = hash_table_tag(bkmer);
+  hash_table_bitems(ht, bucket)++;
   return ptr;
 }
 
@@ -122,14 +422,150 @@ static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
   die("Hash table is full"); \
 } while(0)
 
+// First hash of a kmer, from which the bucket for each rehash round is found
+#define ht_hash64(ht,key) binary_kmer_hash64(key,(ht)->seed)
+// Bucket to probe in rehash round `i`
+#define ht_bucket(ht,key,h64,i) \
+        (binary_kmer_hash_round(key,(ht)->seed,h64,i) & (ht)->hash_mask)
+
+//
+// Cuckoo inserts
+//
+
+// Lowest round, other than those mapping to bucket `bkt`, in which `key` can
+// be stored: the first of its HT_CUCKOO_WAYS buckets with a free slot. All
+// buckets before it are full, so finds will still reach it.
+// Returns REHASH_LIMIT if there are none.
+static inline size_t _ht_cuckoo_free_round(const HashTable *ht, BinaryKmer key,
+                                           uint64_t h64, uint_fast32_t bkt)
+{
+  size_t i;
+  uint_fast32_t h;
+  for(i = 0; i < HT_CUCKOO_WAYS; i++) {
+    h = ht_bucket(ht, key, h64, i);
+    if(h != bkt && hash_table_bitems(ht, h) < ht->bucket_size) return i;
+  }
+  return REHASH_LIMIT;
+}
+
+// Move the kmer in slot `from` to a free slot in bucket `bkt`
+static inline void _ht_cuckoo_move(HashTable *ht, hkey_t from, uint_fast32_t bkt)
+{
+  BinaryKmer bkmer = hash_table_fetch(ht, from);
+  hkey_t to = (hkey_t)(hash_table_insert_in_bucket(ht, bkt, bkmer) - ht->table);
+  memset(ht->table+from, 0, sizeof(BinaryKmer));
+  if(ht->tags) ht_slot_tag(ht, from) = 0;
+  hash_table_bitems(ht, from / ht->bucket_size)--;
+  if(ht->move_func != NULL) ht->move_func(from, to, ht->move_arg);
+  ht->num_moves++;
+}
+
+// `key` is not in the table and its first HT_CUCKOO_WAYS buckets are full.
+// Random walk: evict a kmer from one of them, which evicts a kmer from another
+// of its buckets, until a kmer on the path has a bucket with a free slot. Moves
+// are only made once a free slot is found, last kmer first.
+// Returns HASH_NOT_FOUND if no free slot is found within HT_CUCKOO_MAX_KICKS.
+static hkey_t _ht_cuckoo_walk(HashTable *ht, BinaryKmer key, uint64_t h64)
+{
+  hkey_t path[HT_CUCKOO_MAX_KICKS];
+  size_t npath, i, j, r, round0;
+  uint64_t rnd = h64 | 1, yh64;
+  uint_fast32_t bkt, next;
+  BinaryKmer ykey;
+  hkey_t slot;
+
+  #define cuckoo_rand() (rnd = rnd * 6364136223846793005UL + 1442695040888963407UL, \
+                         rnd >> 33)
+
+  round0 = cuckoo_rand() % HT_CUCKOO_WAYS;
+  bkt = ht_bucket(ht, key, h64, round0);
+
+  for(npath = 0; npath < HT_CUCKOO_MAX_KICKS; npath++)
+  {
+    // Pick a kmer in full bucket `bkt` that is not already on the path
+    ctx_assert(hash_table_bitems(ht, bkt) == ht->bucket_size);
+    j = cuckoo_rand() % ht->bucket_size;
+    for(i = 0; i < ht->bucket_size; i++, j = (j+1 == ht->bucket_size ? 0 : j+1)) {
+      slot = (hkey_t)bkt * ht->bucket_size + j;
+      for(r = 0; r < npath && path[r] != slot; r++) {}
+      if(r == npath) break;
+    }
+    if(i == ht->bucket_size) break;
+    path[npath] = slot;
+
+    ykey = hash_table_fetch(ht, slot);
+    yh64 = ht_hash64(ht, ykey);
+    r = _ht_cuckoo_free_round(ht, ykey, yh64, bkt);
+
+    if(r < REHASH_LIMIT) {
+      // Shift kmers along the path, then `key` takes the first slot
+      next = ht_bucket(ht, ykey, yh64, r);
+      for(i = npath+1; i-- > 0; ) {
+        _ht_cuckoo_move(ht, path[i], next);
+        next = path[i] / ht->bucket_size;
+      }
+      BinaryKmer *ptr = hash_table_insert_in_bucket(ht, next, key);
+      ht->collisions[round0]++;
+      ht->num_kmers++;
+      ctx_stats_add(CTX_STAT_KMERS_INSERTED, 1);
+      return ht_slot_hkey(ht, ptr);
+    }
+
+    // Evict from another of this kmer's buckets
+    r = cuckoo_rand() % HT_CUCKOO_WAYS;
+    for(i = 0; i < HT_CUCKOO_WAYS; i++, r = (r+1) % HT_CUCKOO_WAYS)
+      if((next = ht_bucket(ht, ykey, yh64, r)) != bkt) break;
+    if(i == HT_CUCKOO_WAYS) break;
+    bkt = next;
+  }
+
+  #undef cuckoo_rand
+  return HASH_NOT_FOUND;
+}
+
+// Insert `key`, which is not in the table, moving other kmers if needed
+static hkey_t _ht_cuckoo_insert(HashTable *ht, BinaryKmer key, uint64_t h64)
+{
+  const BinaryKmer *ptr;
+  hkey_t hkey;
+  size_t i;
+  uint_fast32_t h;
+
+  // First round with space, making space in the first few rounds if needed
+  for(i = 0; i < REHASH_LIMIT; i++) {
+    if(i == HT_CUCKOO_WAYS) {
+      hkey = _ht_cuckoo_walk(ht, key, h64);
+      if(hkey != HASH_NOT_FOUND) return hkey;
+    }
+    h = ht_bucket(ht, key, h64, i);
+    if(hash_table_bitems(ht, h) < ht->bucket_size) {
+      ptr = hash_table_insert_in_bucket(ht, h, key);
+      ht->collisions[i]++;
+      ht->num_kmers++;
+      ctx_stats_add(CTX_STAT_KMERS_INSERTED, 1);
+      return ht_slot_hkey(ht, ptr);
+    }
+  }
+
+  rehash_error_exit(ht);
+}
+
 hkey_t hash_table_find(const HashTable *const ht, const BinaryKmer key)
 {
   const BinaryKmer *ptr;
   size_t i;
   uint_fast32_t h;
+  ctx_stats_add(CTX_STAT_KMER_LOOKUPS, 1);
+
+  if(ht->filter != NULL && !kmer_bloom_has(ht->filter, key)) {
+    ctx_stats_add(CTX_STAT_KMER_FILTERED, 1);
+    return HASH_NOT_FOUND;
+  }
+
+  const uint64_t h64 = ht_hash64(ht, key);
 
   #ifdef HASH_PREFETCH
-    uint_fast32_t h2 = binary_kmer_hash(key,ht->seed+0) & ht->hash_mask;
+    uint_fast32_t h2 = ht_bucket(ht, key, h64, 0);
     __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
   #endif
 
@@ -137,19 +573,23 @@ hkey_t hash_table_find(const HashTable *const ht, const BinaryKmer key)
   {
     #ifdef HASH_PREFETCH
       h = h2;
-      if(ht->buckets[h][HT_BSIZE] == ht->bucket_size) {
-        h2 = binary_kmer_hash(key,ht->seed+i+1) & ht->hash_mask;
+      if(hash_table_bsize(ht, h) == ht->bucket_size) {
+        h2 = ht_bucket(ht, key, h64, i+1);
         __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
       }
     #else
-      h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+      h = ht_bucket(ht, key, h64, i);
     #endif
 
     ptr = hash_table_find_in_bucket(ht, h, key);
-    if(ptr != NULL) return (hkey_t)(ptr - ht->table);
-    if(ht->buckets[h][HT_BSIZE] < ht->bucket_size) break;
+    if(ptr != NULL) {
+      ctx_stats_lookup(i+1, true);
+      return ht_slot_hkey(ht, ptr);
+    }
+    if(hash_table_bsize(ht, h) < ht->bucket_size) break;
   }
 
+  ctx_stats_lookup(MIN2(i+1, REHASH_LIMIT), false);
   return HASH_NOT_FOUND;
 }
 
@@ -159,24 +599,29 @@ hkey_t hash_table_find_mt(HashTable *ht, const BinaryKmer key,
   const BinaryKmer *ptr;
   size_t i, bsize;
   uint_fast32_t h;
+  ctx_stats_add(CTX_STAT_KMER_LOOKUPS, 1);
+
+  const uint64_t h64 = ht_hash64(ht, key);
 
   for(i = 0; i < REHASH_LIMIT; i++)
   {
-    h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
-    bitlock_yield_acquire(bktlocks, h);
+    h = ht_bucket(ht, key, h64, i);
+    ht_bckt_lock(ht, bktlocks, h);
     ptr = hash_table_find_in_bucket(ht, h, key);
 
     if(ptr != NULL) {
-      bitlock_release(bktlocks, h);
-      return (hkey_t)(ptr - ht->table);
+      ht_bckt_unlock(ht, bktlocks, h);
+      ctx_stats_lookup(i+1, true);
+      return ht_slot_hkey(ht, ptr);
     }
 
     bsize = hash_table_bsize(ht, h);
-    bitlock_release(bktlocks, h);
+    ht_bckt_unlock(ht, bktlocks, h);
 
     if(bsize < ht->bucket_size) break;
   }
 
+  ctx_stats_lookup(MIN2(i+1, REHASH_LIMIT), false);
   return HASH_NOT_FOUND;
 }
 
@@ -191,29 +636,37 @@ hkey_t hash_table_insert(HashTable *const ht, const BinaryKmer key)
   uint_fast32_t h;
   // prefetch doesn't make sense when not searching..
 
+  const uint64_t h64 = ht_hash64(ht, key);
+
+  if(ht->cuckoo) return _ht_cuckoo_insert(ht, key, h64);
+
   for(i = 0; i < REHASH_LIMIT; i++)
   {
-    h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
-    if(ht->buckets[h][HT_BITEMS] < ht->bucket_size) {
+    h = ht_bucket(ht, key, h64, i);
+    if(hash_table_bitems(ht, h) < ht->bucket_size) {
       ptr = hash_table_insert_in_bucket(ht, h, key);
       ht->collisions[i]++; // only increment collisions when inserting
       ht->num_kmers++;
-      return (hkey_t)(ptr - ht->table);
+      ctx_stats_add(CTX_STAT_KMERS_INSERTED, 1);
+      return ht_slot_hkey(ht, ptr);
     }
   }
 
   rehash_error_exit(ht);
 }
 
-hkey_t hash_table_find_or_insert(HashTable *ht, const BinaryKmer key,
-                                 bool *found)
+hkey_t hash_table_try_find_or_insert(HashTable *ht, const BinaryKmer key,
+                                     bool *found)
 {
   const BinaryKmer *ptr;
   size_t i;
   uint_fast32_t h;
+  ctx_stats_add(CTX_STAT_KMER_LOOKUPS, 1);
+
+  const uint64_t h64 = ht_hash64(ht, key);
 
   #ifdef HASH_PREFETCH
-    uint_fast32_t h2 = binary_kmer_hash(key,ht->seed+0) & ht->hash_mask;
+    uint_fast32_t h2 = ht_bucket(ht, key, h64, 0);
     __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
   #endif
 
@@ -221,63 +674,557 @@ hkey_t hash_table_find_or_insert(HashTable *ht, const BinaryKmer key,
   {
     #ifdef HASH_PREFETCH
       h = h2;
-      if(ht->buckets[h][HT_BSIZE] == ht->bucket_size) {
-        h2 = binary_kmer_hash(key,ht->seed+i+1) & ht->hash_mask;
+      if(hash_table_bsize(ht, h) == ht->bucket_size) {
+        h2 = ht_bucket(ht, key, h64, i+1);
         __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
       }
     #else
-      h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+      h = ht_bucket(ht, key, h64, i);
     #endif
 
     ptr = hash_table_find_in_bucket(ht, h, key);
 
     if(ptr != NULL)  {
       *found = true;
-      return (hkey_t)(ptr - ht->table);
+      ctx_stats_lookup(i+1, true);
+      return ht_slot_hkey(ht, ptr);
+    }
+    else if(ht->cuckoo) {
+      // Search all rounds before inserting
+      if(hash_table_bsize(ht, h) < ht->bucket_size) break;
     }
-    else if(ht->buckets[h][HT_BITEMS] < ht->bucket_size) {
+    else if(hash_table_bitems(ht, h) < ht->bucket_size) {
       *found = false;
+      ctx_stats_lookup(i+1, false);
       ptr = hash_table_insert_in_bucket(ht, h, key);
       ht->collisions[i]++; // only increment collisions when inserting
       ht->num_kmers++;
-      return (hkey_t)(ptr - ht->table);
+      ctx_stats_add(CTX_STAT_KMERS_INSERTED, 1);
+      return ht_slot_hkey(ht, ptr);
     }
   }
 
-  rehash_error_exit(ht);
+  if(ht->cuckoo) {
+    *found = false;
+    ctx_stats_lookup(MIN2(i+1, REHASH_LIMIT), false);
+    return _ht_cuckoo_insert(ht, key, h64);
+  }
+
+  return HASH_NOT_FOUND;
 }
 
-hkey_t hash_table_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
-                                    bool *found, volatile uint8_t *bktlocks)
+hkey_t hash_table_find_or_insert(HashTable *ht, const BinaryKmer key,
+                                 bool *found)
+{
+  hkey_t hkey = hash_table_try_find_or_insert(ht, key, found);
+  if(hkey == HASH_NOT_FOUND) rehash_error_exit(ht);
+  return hkey;
+}
+
+// `h64` is ht_hash64(ht,key)
+// Returns HASH_NOT_FOUND if the table is full
+static inline hkey_t _try_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
+                                            uint64_t h64, bool *found,
+                                            volatile uint8_t *bktlocks)
 {
   const BinaryKmer *ptr;
   size_t i;
   uint_fast32_t h;
+  ctx_stats_add(CTX_STAT_KMER_LOOKUPS, 1);
 
   for(i = 0; i < REHASH_LIMIT; i++)
   {
-    h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
-    bitlock_yield_acquire(bktlocks, h);
+    h = ht_bucket(ht, key, h64, i);
+    ht_bckt_lock(ht, bktlocks, h);
     ptr = hash_table_find_in_bucket(ht, h, key);
 
     if(ptr != NULL)  {
       *found = true;
-      bitlock_release(bktlocks, h);
-      return (hkey_t)(ptr - ht->table);
+      ctx_stats_lookup(i+1, true);
+      ht_bckt_unlock(ht, bktlocks, h);
+      return ht_slot_hkey(ht, ptr);
     }
     else if(hash_table_bitems(ht, h) < ht->bucket_size) {
       *found = false;
+      ctx_stats_lookup(i+1, false);
       ptr = hash_table_insert_in_bucket(ht, h, key);
       __sync_add_and_fetch((volatile uint64_t*)&ht->collisions[i], 1);
       __sync_add_and_fetch((volatile uint64_t*)&ht->num_kmers, 1);
-      bitlock_release(bktlocks, h);
-      return (hkey_t)(ptr - ht->table);
+      ctx_stats_add(CTX_STAT_KMERS_INSERTED, 1);
+      ht_bckt_unlock(ht, bktlocks, h);
+      return ht_slot_hkey(ht, ptr);
     }
 
-    bitlock_release(bktlocks, h);
+    ht_bckt_unlock(ht, bktlocks, h);
   }
 
-  rehash_error_exit(ht);
+  return HASH_NOT_FOUND;
+}
+
+static inline hkey_t _find_or_insert_mt(HashTable *ht, const BinaryKmer key,
+                                        uint64_t h64, bool *found,
+                                        volatile uint8_t *bktlocks)
+{
+  hkey_t hkey = _try_find_or_insert_mt(ht, key, h64, found, bktlocks);
+  if(hkey == HASH_NOT_FOUND) rehash_error_exit(ht);
+  return hkey;
+}
+
+hkey_t hash_table_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
+                                    bool *found, volatile uint8_t *bktlocks)
+{
+  return _find_or_insert_mt(ht, key, ht_hash64(ht, key), found, bktlocks);
+}
+
+hkey_t hash_table_try_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
+                                        bool *found, volatile uint8_t *bktlocks)
+{
+  return _try_find_or_insert_mt(ht, key, ht_hash64(ht, key), found, bktlocks);
+}
+
+// Insert without checking whether the key is already present, for loading
+// kmers known to be distinct. Threadsafe, using bucket level locks.
+// Returns HASH_NOT_FOUND if the table is full. `found` may be NULL.
+static inline hkey_t _insert_mt(HashTable *ht, const BinaryKmer key,
+                                uint64_t h64, bool *found,
+                                volatile uint8_t *bktlocks)
+{
+  const BinaryKmer *ptr;
+  size_t i;
+  uint_fast32_t h;
+  ctx_assert(!ht->cuckoo);
+  if(found) *found = false;
+
+  for(i = 0; i < REHASH_LIMIT; i++)
+  {
+    h = ht_bucket(ht, key, h64, i);
+    if(hash_table_bitems(ht, h) == ht->bucket_size) continue;
+    ht_bckt_lock(ht, bktlocks, h);
+    if(hash_table_bitems(ht, h) < ht->bucket_size) {
+      ptr = hash_table_insert_in_bucket(ht, h, key);
+      __sync_add_and_fetch((volatile uint64_t*)&ht->collisions[i], 1);
+      __sync_add_and_fetch((volatile uint64_t*)&ht->num_kmers, 1);
+      ctx_stats_add(CTX_STAT_KMERS_INSERTED, 1);
+      ht_bckt_unlock(ht, bktlocks, h);
+      return ht_slot_hkey(ht, ptr);
+    }
+    ht_bckt_unlock(ht, bktlocks, h);
+  }
+
+  return HASH_NOT_FOUND;
+}
+
+//
+// Lock-free find / insert
+//
+
+// Raise the size of bucket `bkt` to at least `bsize`
+static inline void hash_table_bsize_raise_mt(HashTable *ht, uint_fast32_t bkt,
+                                             uint8_t bsize)
+{
+  volatile uint8_t *ptr = &hash_table_bsize(ht, bkt);
+  uint8_t curr = *ptr;
+  while(curr < bsize && !__sync_bool_compare_and_swap(ptr, curr, bsize))
+    curr = *ptr;
+}
+
+hkey_t hash_table_find_lockfree(const HashTable *ht, const BinaryKmer key)
+{
+  const BinaryKmer *ptr;
+  size_t i;
+  uint_fast32_t h;
+  ctx_stats_add(CTX_STAT_KMER_LOOKUPS, 1);
+
+  const uint64_t h64 = ht_hash64(ht, key);
+
+  for(i = 0; i < REHASH_LIMIT; i++)
+  {
+    h = ht_bucket(ht, key, h64, i);
+    ptr = hash_table_find_in_bucket_mt(ht, h, key);
+    if(ptr != NULL) {
+      ctx_stats_lookup(i+1, true);
+      return ht_slot_hkey(ht, ptr);
+    }
+    if(hash_table_bsize_mt(ht, h) < ht->bucket_size) break;
+  }
+
+  ctx_stats_lookup(MIN2(i+1, REHASH_LIMIT), false);
+  return HASH_NOT_FOUND;
+}
+
+#if NUM_BKMER_WORDS == 1
+
+// Search the bucket up to its current size, then claim the first empty slot
+// after that with a compare-and-swap on the whole (single word) entry.
+// If another thread beats us to a slot, check whether it wrote our kmer
+// before moving on to the next slot.
+// Returns HASH_NOT_FOUND if the bucket is full.
+static inline hkey_t _ht_find_or_claim_cas(HashTable *ht, uint_fast32_t h,
+                                           size_t rehash, BinaryKmer key,
+                                           bool *found)
+{
+  BinaryKmer *const bptr = ht_bckt_ptr(ht, h);
+  volatile uint64_t *wrd;
+  const uint64_t newv = key.b[0] | BKMER_SET_FLAG;
+  uint64_t v;
+  size_t j, bsize = hash_table_bsize_mt(ht, h);
+
+  for(j = 0; j < bsize; j++) {
+    if(*(volatile uint64_t*)bptr[j].b == newv) {
+      *found = true;
+      return ht_slot_hkey(ht, bptr + j);
+    }
+  }
+
+  while(j < ht->bucket_size)
+  {
+    wrd = (volatile uint64_t*)bptr[j].b;
+    if(*wrd == 0 && __sync_bool_compare_and_swap(wrd, 0, newv)) {
+      ctx_assert2(ht->slot_table == NULL, "Cannot insert once relaid out");
+      *found = false;
+      if(ht->tags) ht_bckt_tags(ht, h)[j] = hash_table_tag(key);
+      hash_table_bsize_raise_mt(ht, h, (uint8_t)(j+1));
+      __sync_add_and_fetch((volatile uint8_t*)&hash_table_bitems(ht, h), 1);
+      __sync_add_and_fetch((volatile uint64_t*)&ht->collisions[rehash], 1);
+      __sync_add_and_fetch((volatile uint64_t*)&ht->num_kmers, 1);
+      ctx_stats_add(CTX_STAT_KMERS_INSERTED, 1);
+      return ht_slot_hkey(ht, bptr + j);
+    }
+    if((v = *wrd) == newv) {
+      *found = true;
+      return ht_slot_hkey(ht, bptr + j);
+    }
+    if(v != 0) j++; // slot taken by another kmer, otherwise retry the CAS
+  }
+
+  return HASH_NOT_FOUND;
+}
+
+#endif
+
+// Returns HASH_NOT_FOUND if the table is full
+static inline hkey_t _try_find_or_insert_lockfree(HashTable *ht,
+                                                  const BinaryKmer key,
+                                                  uint64_t h64, bool *found,
+                                                  volatile uint8_t *bktlocks)
+{
+  size_t i;
+  uint_fast32_t h;
+  ctx_stats_add(CTX_STAT_KMER_LOOKUPS, 1);
+
+  #if NUM_BKMER_WORDS == 1
+    (void)bktlocks;
+    hkey_t hkey;
+
+    for(i = 0; i < REHASH_LIMIT; i++)
+    {
+      h = ht_bucket(ht, key, h64, i);
+      hkey = _ht_find_or_claim_cas(ht, h, i, key, found);
+      if(hkey != HASH_NOT_FOUND) return hkey;
+    }
+  #else
+    // Multi-word kmers cannot be claimed with a single CAS. Search without
+    // the lock, and only take the bucket lock to insert.
+    const BinaryKmer *ptr;
+
+    for(i = 0; i < REHASH_LIMIT; i++)
+    {
+      h = ht_bucket(ht, key, h64, i);
+      ptr = hash_table_find_in_bucket_mt(ht, h, key);
+
+      if(ptr != NULL)  {
+        *found = true;
+        return ht_slot_hkey(ht, ptr);
+      }
+
+      ht_bckt_lock(ht, bktlocks, h);
+      ptr = hash_table_find_in_bucket(ht, h, key);
+
+      if(ptr != NULL)  {
+        *found = true;
+        ht_bckt_unlock(ht, bktlocks, h);
+        return ht_slot_hkey(ht, ptr);
+      }
+      else if(hash_table_bitems(ht, h) < ht->bucket_size) {
+        *found = false;
+        ptr = hash_table_insert_in_bucket(ht, h, key);
+        __sync_add_and_fetch((volatile uint64_t*)&ht->collisions[i], 1);
+        __sync_add_and_fetch((volatile uint64_t*)&ht->num_kmers, 1);
+        ctx_stats_add(CTX_STAT_KMERS_INSERTED, 1);
+        ht_bckt_unlock(ht, bktlocks, h);
+        return ht_slot_hkey(ht, ptr);
+      }
+
+      ht_bckt_unlock(ht, bktlocks, h);
+    }
+  #endif
+
+  return HASH_NOT_FOUND;
+}
+
+static inline hkey_t _find_or_insert_lockfree(HashTable *ht,
+                                              const BinaryKmer key,
+                                              uint64_t h64, bool *found,
+                                              volatile uint8_t *bktlocks)
+{
+  hkey_t hkey = _try_find_or_insert_lockfree(ht, key, h64, found, bktlocks);
+  if(hkey == HASH_NOT_FOUND) rehash_error_exit(ht);
+  return hkey;
+}
+
+hkey_t hash_table_find_or_insert_lockfree(HashTable *ht, const BinaryKmer key,
+                                          bool *found, volatile uint8_t *bktlocks)
+{
+  return _find_or_insert_lockfree(ht, key, ht_hash64(ht, key), found, bktlocks);
+}
+
+hkey_t hash_table_try_find_or_insert_lockfree(HashTable *ht, const BinaryKmer key,
+                                              bool *found,
+                                              volatile uint8_t *bktlocks)
+{
+  return _try_find_or_insert_lockfree(ht, key, ht_hash64(ht, key), found,
+                                      bktlocks);
+}
+
+//
+// Batched find / insert with software prefetching
+//
+
+// Prefetch a bucket and its size fields, we will probably write to both
+#define ht_prefetch_bucket(ht,h) do {                       \
+  __builtin_prefetch(ht_bckt_ptr(ht,h), 1, 1);              \
+  __builtin_prefetch(hash_table_bmeta(ht,h), 1, 1);         \
+} while(0)
+
+// Kmers are hashed HT_HASH_BLOCK at a time (with SIMD if available) into a
+// ring of 2*HT_HASH_BLOCK hashes. Blocks are hashed as kmer i+depth reaches
+// them, so hashes are never overwritten before they are used.
+#define HT_HASH_BLOCK HT_MAX_PREFETCH_DEPTH
+#define HT_HASH_RING (2*HT_HASH_BLOCK)
+
+// Hash keys [s,s+HT_HASH_BLOCK) into `ring`, `s` is a multiple of HT_HASH_BLOCK
+#define ht_hash_block(ht,keys,n,s,ring) \
+        binary_kmer_hash64_batch((keys)+(s), MIN2(HT_HASH_BLOCK,(n)-(s)), \
+                                 (ht)->seed, (ring)+((s)%HT_HASH_RING))
+
+// Prefetch the first bucket of kmer i+depth, while inserting kmer i.
+// Stops early if insertfunc returns HASH_NOT_FOUND (table full), setting
+// `nout` to the number of kmers done.
+#define HT_BATCH_INSERT(ht,keys,n,hkeys,found,depth,insertfunc,bktlocks,nout) do { \
+  uint64_t _h64[HT_HASH_RING];                                                 \
+  size_t _i, _j, _d = MIN2(MAX2(depth,1), HT_MAX_PREFETCH_DEPTH);             \
+  if((n) > 0) ht_hash_block(ht, keys, n, 0, _h64);                             \
+  for(_i = 0; _i < _d && _i < (n); _i++)                                       \
+    ht_prefetch_bucket(ht, ht_bucket(ht, (keys)[_i], _h64[_i], 0));            \
+  for(_i = 0; _i < (n); _i++) {                                                \
+    if((_j = _i + _d) < (n)) {                                                 \
+      if(_j % HT_HASH_BLOCK == 0) ht_hash_block(ht, keys, n, _j, _h64);        \
+      ht_prefetch_bucket(ht, ht_bucket(ht, (keys)[_j],                         \
+                                       _h64[_j % HT_HASH_RING], 0));           \
+    }                                                                          \
+    (hkeys)[_i] = insertfunc(ht, (keys)[_i], _h64[_i % HT_HASH_RING],          \
+                             (found) ? &(found)[_i] : NULL, bktlocks);         \
+    if((hkeys)[_i] == HASH_NOT_FOUND) break;                                   \
+  }                                                                            \
+  (nout) = _i;                                                                 \
+} while(0)
+
+void hash_table_find_or_insert_batch_mt(HashTable *ht, const BinaryKmer *keys,
+                                        size_t n, size_t depth,
+                                        hkey_t *hkeys, bool *found,
+                                        volatile uint8_t *bktlocks)
+{
+  size_t nout;
+  HT_BATCH_INSERT(ht, keys, n, hkeys, found, depth,
+                  _find_or_insert_mt, bktlocks, nout);
+  (void)nout;
+}
+
+void hash_table_find_or_insert_batch_lockfree(HashTable *ht,
+                                              const BinaryKmer *keys,
+                                              size_t n, size_t depth,
+                                              hkey_t *hkeys, bool *found,
+                                              volatile uint8_t *bktlocks)
+{
+  size_t nout;
+  HT_BATCH_INSERT(ht, keys, n, hkeys, found, depth,
+                  _find_or_insert_lockfree, bktlocks, nout);
+  (void)nout;
+}
+
+size_t hash_table_try_find_or_insert_batch_mt(HashTable *ht,
+                                              const BinaryKmer *keys,
+                                              size_t n, size_t depth,
+                                              hkey_t *hkeys, bool *found,
+                                              volatile uint8_t *bktlocks)
+{
+  size_t nout;
+  HT_BATCH_INSERT(ht, keys, n, hkeys, found, depth,
+                  _try_find_or_insert_mt, bktlocks, nout);
+  return nout;
+}
+
+size_t hash_table_try_find_or_insert_batch_lockfree(HashTable *ht,
+                                                    const BinaryKmer *keys,
+                                                    size_t n, size_t depth,
+                                                    hkey_t *hkeys, bool *found,
+                                                    volatile uint8_t *bktlocks)
+{
+  size_t nout;
+  HT_BATCH_INSERT(ht, keys, n, hkeys, found, depth,
+                  _try_find_or_insert_lockfree, bktlocks, nout);
+  return nout;
+}
+
+void hash_table_insert_batch_mt(HashTable *ht, const BinaryKmer *keys,
+                                size_t n, size_t depth, hkey_t *hkeys,
+                                volatile uint8_t *bktlocks)
+{
+  size_t nout;
+  bool *found = NULL;
+  HT_BATCH_INSERT(ht, keys, n, hkeys, found, depth,
+                  _insert_mt, bktlocks, nout);
+  if(nout < n) rehash_error_exit(ht);
+}
+
+// Find given the kmer hash `h64` = ht_hash64(ht,key)
+static inline hkey_t _find_from(const HashTable *ht, const BinaryKmer key,
+                                uint64_t h64)
+{
+  const BinaryKmer *ptr;
+  size_t i;
+  uint_fast32_t h;
+
+  for(i = 0; i < REHASH_LIMIT; i++)
+  {
+    h = ht_bucket(ht, key, h64, i);
+    ptr = hash_table_find_in_bucket(ht, h, key);
+    if(ptr != NULL) {
+      ctx_stats_lookup(i+1, true);
+      return ht_slot_hkey(ht, ptr);
+    }
+    if(hash_table_bsize(ht, h) < ht->bucket_size) break;
+  }
+
+  ctx_stats_lookup(MIN2(i+1, REHASH_LIMIT), false);
+  return HASH_NOT_FOUND;
+}
+
+static void _find_batch(const HashTable *ht, const BinaryKmer *keys,
+                        size_t n, size_t depth, hkey_t *hkeys)
+{
+  uint64_t h64[HT_HASH_RING];
+  uint_fast32_t h;
+  size_t i, j, d = MIN2(MAX2(depth,1), HT_MAX_PREFETCH_DEPTH);
+
+  if(n > 0) ht_hash_block(ht, keys, n, 0, h64);
+
+  for(i = 0; i < d && i < n; i++) {
+    h = ht_bucket(ht, keys[i], h64[i], 0);
+    __builtin_prefetch(ht_bckt_ptr(ht, h), 0, 1);
+    __builtin_prefetch(hash_table_bmeta(ht, h), 0, 1);
+  }
+
+  for(i = 0; i < n; i++) {
+    if((j = i + d) < n) {
+      if(j % HT_HASH_BLOCK == 0) ht_hash_block(ht, keys, n, j, h64);
+      h = ht_bucket(ht, keys[j], h64[j % HT_HASH_RING], 0);
+      __builtin_prefetch(ht_bckt_ptr(ht, h), 0, 1);
+      __builtin_prefetch(hash_table_bmeta(ht, h), 0, 1);
+    }
+    hkeys[i] = _find_from(ht, keys[i], h64[i % HT_HASH_RING]);
+  }
+}
+
+void hash_table_prefetch(const HashTable *ht, const BinaryKmer key)
+{
+  uint_fast32_t h = ht_bucket(ht, key, ht_hash64(ht, key), 0);
+  __builtin_prefetch(ht_bckt_ptr(ht, h), 0, 1);
+  __builtin_prefetch(hash_table_bmeta(ht, h), 0, 1);
+  if(ht->tags && !ht->colocated) __builtin_prefetch(ht_bckt_tags(ht, h), 0, 1);
+}
+
+#define HT_FILTER_BATCH 256
+
+void hash_table_find_batch(const HashTable *ht, const BinaryKmer *keys,
+                           size_t n, size_t depth, hkey_t *hkeys)
+{
+  ctx_stats_add(CTX_STAT_KMER_LOOKUPS, n);
+
+  if(ht->filter == NULL) { _find_batch(ht, keys, n, depth, hkeys); return; }
+
+  // Only look up kmers that pass the filter
+  BinaryKmer fkeys[HT_FILTER_BATCH];
+  hkey_t fhkeys[HT_FILTER_BATCH];
+  uint32_t fidx[HT_FILTER_BATCH];
+  bool has[HT_FILTER_BATCH];
+  size_t s, e, i, m;
+
+  for(s = 0; s < n; s += HT_FILTER_BATCH) {
+    e = MIN2(s + HT_FILTER_BATCH, n);
+    kmer_bloom_has_batch(ht->filter, keys + s, e - s, depth, has);
+    for(i = s, m = 0; i < e; i++) {
+      hkeys[i] = HASH_NOT_FOUND;
+      if(has[i-s]) { fkeys[m] = keys[i]; fidx[m++] = i - s; }
+    }
+    ctx_stats_add(CTX_STAT_KMER_FILTERED, e - s - m);
+    _find_batch(ht, fkeys, m, depth, fhkeys);
+    for(i = 0; i < m; i++) hkeys[s + fidx[i]] = fhkeys[i];
+  }
+}
+
+void hash_table_filter_build(HashTable *ht)
+{
+  hash_table_filter_free(ht);
+
+  ht->filter = ctx_calloc(1, sizeof(KmerBloom));
+  kmer_bloom_alloc(ht->filter, MAX2(ht->num_kmers, 1) * HT_FILTER_BITS_PER_KMER * 2);
+
+  hkey_t hkey;
+  for(hkey = 0; hkey < ht->capacity; hkey++)
+    if(hash_table_assigned(ht, hkey))
+      kmer_bloom_add_mt(ht->filter, hash_table_fetch(ht, hkey));
+
+  status("[hasht] Kmer filter: %.1f bits per kmer",
+         (double)kmer_bloom_nbits(ht->filter) / MAX2(ht->num_kmers, 1));
+}
+
+void hash_table_filter_free(HashTable *ht)
+{
+  if(ht->filter == NULL) return;
+  kmer_bloom_dealloc(ht->filter);
+  ctx_free(ht->filter);
+  ht->filter = NULL;
+}
+
+// Kmers are copied into slot_table, in the slots they were hashed to, for
+// probing. `table` is then refilled with each kmer at its new hkey.
+void hash_table_relayout(HashTable *ht, const hkey_t *newkeys)
+{
+  ctx_assert(ht->slot_table == NULL);
+  hkey_t s, nkey;
+
+  char mem_str[50];
+  bytes_to_str(ht->capacity * HT_RELAYOUT_BYTES, 1, mem_str);
+  status("[hasht] Relaying out table, using %s", mem_str);
+
+  if(ht->large_pages) ht->slot_table = ctx_calloc_large(ht->capacity, sizeof(BinaryKmer));
+  else ht->slot_table = ctx_malloc(ht->capacity * sizeof(BinaryKmer));
+  ht->slot_hkeys = ctx_malloc(ht->capacity * sizeof(hkey_t));
+
+  memcpy(ht->slot_table, ht->table, ht->capacity * sizeof(BinaryKmer));
+  memset(ht->table, 0, ht->capacity * sizeof(BinaryKmer));
+
+  for(s = 0; s < ht->capacity; s++) {
+    nkey = HASH_NOT_FOUND;
+    if(HASH_ENTRY_ASSIGNED(ht->slot_table[s])) {
+      nkey = newkeys[s];
+      ctx_assert(nkey < ht->capacity);
+      ctx_assert(!HASH_ENTRY_ASSIGNED(ht->table[nkey]));
+      ht->table[nkey] = ht->slot_table[s];
+    }
+    ht->slot_hkeys[s] = nkey;
+  }
 }
 
 // Safe to call on different entries at the same time
@@ -287,23 +1234,34 @@ void hash_table_delete(HashTable *const ht, hkey_t pos)
   uint64_t bucket = pos / ht->bucket_size, n, m;
 
   ctx_assert(pos != HASH_NOT_FOUND);
+  ctx_assert2(ht->slot_table == NULL, "Cannot delete once relaid out");
   ctx_assert(HASH_ENTRY_ASSIGNED(ht->table[pos]));
 
   memset(ht->table+pos, 0, sizeof(BinaryKmer));
+  if(ht->tags) ht_slot_tag(ht, pos) = 0;
   n = __sync_fetch_and_sub((volatile uint64_t *)&ht->num_kmers, 1);
-  m = __sync_fetch_and_sub((volatile uint8_t *)&ht->buckets[bucket][HT_BITEMS], 1);
+  m = __sync_fetch_and_sub((volatile uint8_t *)&hash_table_bitems(ht, bucket), 1);
 
   ctx_assert2(n > 0, "Deleted from empty table");
   ctx_assert2(m > 0, "Deleted from empty bucket");
   ctx_assert(!HASH_ENTRY_ASSIGNED(ht->table[pos]));
 }
 
+// Bytes allocated for the kmers, buckets and tags of a table. Matches
+// hash_table_mem() with the table's layout set by hash_table_mem_set_layout()
+size_t hash_table_mem_used(const HashTable *ht)
+{
+  return ht_mem(ht->bucket_size, ht->num_of_buckets, sizeof(BinaryKmer)*8,
+                (ht->tags != NULL ? HT_MEM_TAGS : 0) |
+                (ht->colocated ? HT_MEM_BUCKET_HDRS : 0));
+}
+
 void hash_table_print_stats_brief(const HashTable *const ht)
 {
   size_t nbytes, nkeybits;
   double occupancy = (100.0 * ht->num_kmers) / ht->capacity;
-  nbytes = ht->capacity * sizeof(BinaryKmer) +
-           ht->num_of_buckets * sizeof(uint8_t[2]);
+  nbytes = hash_table_mem_used(ht) +
+           (ht->slot_table ? ht->capacity * HT_RELAYOUT_BYTES : 0);
   nkeybits = (size_t)__builtin_ctzl(ht->num_of_buckets);
 
   char mem_str[50], num_buckets_str[100], num_entries_str[100], capacity_str[100];
@@ -318,10 +1276,58 @@ void hash_table_print_stats_brief(const HashTable *const ht)
          mem_str, num_entries_str, capacity_str, occupancy);
 }
 
+void hash_table_bucket_fill_hist(const HashTable *const ht, uint64_t *hist)
+{
+  uint64_t b;
+  memset(hist, 0, (ht->bucket_size+1) * sizeof(uint64_t));
+  for(b = 0; b < ht->num_of_buckets; b++)
+    hist[hash_table_bitems(ht, b)]++;
+}
+
+// Print sampled lookup hit rate and probe distances, if stats are turned on
+static void hash_table_print_lookup_stats()
+{
+  uint64_t probes[CTX_STATS_MAX_PROBES];
+  uint64_t nsamples = ctx_stats_total(CTX_STAT_LOOKUP_SAMPLES);
+  uint64_t nhits = ctx_stats_total(CTX_STAT_LOOKUP_HITS);
+  uint64_t nacquires = ctx_stats_total(CTX_STAT_LOCK_ACQUIRES);
+  uint64_t nwaits = ctx_stats_total(CTX_STAT_LOCK_WAITS);
+  size_t i;
+
+  if(nsamples == 0) return;
+
+  status("[hasht] sampled lookups: %zu hits: %.2f%% misses: %.2f%%",
+         (size_t)nsamples, (100.0*nhits)/nsamples,
+         (100.0*(nsamples-nhits))/nsamples);
+
+  ctx_stats_probe_hist(probes);
+  for(i = 0; i < CTX_STATS_MAX_PROBES; i++) {
+    if(probes[i] != 0) {
+      status("[hasht]  probes %2zu: %zu (%.2f%%)", i+1, (size_t)probes[i],
+             (100.0*probes[i])/nsamples);
+    }
+  }
+
+  if(nacquires > 0) {
+    status("[hasht] bucket locks: %zu contended: %zu (%.2f%%)",
+           (size_t)nacquires, (size_t)nwaits, (100.0*nwaits)/nacquires);
+  }
+}
+
 void hash_table_print_stats(const HashTable *const ht)
 {
   size_t i;
+  uint64_t fill[256];
   hash_table_print_stats_brief(ht);
+  hash_table_bucket_fill_hist(ht, fill);
+  ctx_stats_hash_table(ht->collisions, REHASH_LIMIT,
+                       fill, (size_t)ht->bucket_size+1,
+                       ht->num_kmers, ht->capacity);
+
+  if(ht->cuckoo) {
+    status("[hasht]  cuckoo moves: %zu (%.2f per kmer)", (size_t)ht->num_moves,
+           ht->num_kmers ? (double)ht->num_moves / ht->num_kmers : 0.0);
+  }
 
   if(ht->num_kmers > 0) {
     for(i = 0; i < REHASH_LIMIT; i++) {
@@ -329,7 +1335,15 @@ void hash_table_print_stats(const HashTable *const ht)
         status("[hasht]  collisions %2zu: %zu\n", i, (size_t)ht->collisions[i]);
       }
     }
+    for(i = 0; i <= ht->bucket_size; i++) {
+      if(fill[i] != 0) {
+        status("[hasht]  buckets with %3zu entries: %zu (%.2f%%)", i,
+               (size_t)fill[i], (100.0*fill[i])/ht->num_of_buckets);
+      }
+    }
   }
+
+  if(ctx_stats_on) hash_table_print_lookup_stats();
 }
 
 
@@ -349,26 +1363,375 @@ uint64_t hash_table_count_kmers(const HashTable *const ht)
 //
 // Get hash indices sorted by kmer value
 //
+// MSD radix sort on 8 bits of the kmer at a time, starting from the first bit
+// at which any two kmers differ. The first pass uses per-thread histograms
+// over slices of the array, then the 256 buckets are sorted in parallel.
+// Small buckets are finished with an insertion sort.
+//
 
-typedef union { BinaryKmer *bptr; hkey_t h; } BkmerPtrHkeyUnion;
-static inline void _fetch_kmer_union(hkey_t hkey, const HashTable *htable,
-                                     BkmerPtrHkeyUnion **bkptr)
+#define HT_RADIX_BITS 8
+#define HT_RADIX_SIZE (1<<HT_RADIX_BITS)
+#define HT_RADIX_SMALL 32
+
+// `HT_RADIX_BITS` bits of a kmer, starting `pos` bits from the most
+// significant bit of the first word
+static inline size_t ht_radix_digit(const HashTable *ht, hkey_t hkey,
+                                    size_t pos)
 {
-  (**bkptr).bptr = htable->table + hkey;
-  (*bkptr)++;
+  BinaryKmer bk = hash_table_fetch(ht, hkey);
+  size_t w = pos / 64, o = pos % 64;
+  uint64_t v = bk.b[w] << o;
+  if(o > 64-HT_RADIX_BITS && w+1 < NUM_BKMER_WORDS) v |= bk.b[w+1] >> (64-o);
+  return v >> (64-HT_RADIX_BITS);
+}
+
+static inline void ht_radix_insertion_sort(const HashTable *ht,
+                                           hkey_t *arr, size_t n)
+{
+  size_t i, j;
+  hkey_t h;
+  BinaryKmer bk;
+  for(i = 1; i < n; i++) {
+    h = arr[i];
+    bk = hash_table_fetch(ht, h);
+    for(j = i; j > 0 && binary_kmer_lt(bk, hash_table_fetch(ht, arr[j-1]));
+        j--)
+      arr[j] = arr[j-1];
+    arr[j] = h;
+  }
+}
+
+// Sort `arr` in place, using `buf` of the same length as scratch space
+static void ht_radix_sort(const HashTable *ht, hkey_t *arr, hkey_t *buf,
+                          size_t n, size_t pos)
+{
+  size_t i, d, start, counts[HT_RADIX_SIZE], offsets[HT_RADIX_SIZE];
+
+  while(n > HT_RADIX_SMALL && pos < NUM_BKMER_WORDS*64)
+  {
+    memset(counts, 0, sizeof(counts));
+    for(i = 0; i < n; i++) counts[ht_radix_digit(ht, arr[i], pos)]++;
+
+    // All kmers have the same digit, move on to the next digit
+    if(counts[ht_radix_digit(ht, arr[0], pos)] == n) {
+      pos += HT_RADIX_BITS;
+      continue;
+    }
+
+    for(d = start = 0; d < HT_RADIX_SIZE; d++) {
+      offsets[d] = start;
+      start += counts[d];
+    }
+    for(i = 0; i < n; i++)
+      buf[offsets[ht_radix_digit(ht, arr[i], pos)]++] = arr[i];
+    memcpy(arr, buf, n * sizeof(hkey_t));
+
+    for(d = start = 0; d < HT_RADIX_SIZE; start += counts[d], d++)
+      if(counts[d] > 1)
+        ht_radix_sort(ht, arr+start, buf+start, counts[d], pos+HT_RADIX_BITS);
+    return;
+  }
+
+  ht_radix_insertion_sort(ht, arr, n);
+}
+
+typedef struct {
+  const HashTable *ht;
+  hkey_t *arr, *buf;
+  size_t n, nthreads, pos;
+  size_t *hists; // [nthreads][HT_RADIX_SIZE]
+  size_t *bounds; // [HT_RADIX_SIZE+1] start of each bucket
+  uint64_t *masks; // [nthreads][2*NUM_BKMER_WORDS] OR and AND of all kmers
+  hkey_t *ranges; // [nthreads] number of kmers in each hash table part
+} HashTableSorter;
+
+#define sorter_slice(srt,t,s,e) do { \
+  *(s) = (t) * (srt)->n / (srt)->nthreads; \
+  *(e) = ((t)+1) * (srt)->n / (srt)->nthreads; \
+} while(0)
+
+static inline bool _ht_count_kmer(hkey_t hkey, const HashTable *ht,
+                                  size_t *count, uint64_t *masks)
+{
+  size_t i;
+  BinaryKmer bk = hash_table_fetch(ht, hkey);
+  for(i = 0; i < NUM_BKMER_WORDS; i++) {
+    masks[i] |= bk.b[i];
+    masks[NUM_BKMER_WORDS+i] &= bk.b[i];
+  }
+  (*count)++;
+  return false;
+}
+
+static inline bool _ht_fetch_hkey(hkey_t hkey, hkey_t **nxt)
+{
+  *((*nxt)++) = hkey;
+  return false;
+}
+
+// Count kmers in each part of the hash table and find which bits vary
+static void ht_sorter_count_thread(void *arg, size_t threadid)
+{
+  HashTableSorter *srt = (HashTableSorter*)arg;
+  uint64_t *masks = srt->masks + threadid*2*NUM_BKMER_WORDS;
+  size_t count = 0;
+  memset(masks, 0, NUM_BKMER_WORDS*sizeof(uint64_t));
+  memset(masks+NUM_BKMER_WORDS, 0xff, NUM_BKMER_WORDS*sizeof(uint64_t));
+  HASH_ITERATE_PART(srt->ht, threadid, srt->nthreads,
+                    _ht_count_kmer, srt->ht, &count, masks);
+  srt->ranges[threadid] = count;
+}
+
+static void ht_sorter_fetch_thread(void *arg, size_t threadid)
+{
+  HashTableSorter *srt = (HashTableSorter*)arg;
+  hkey_t *nxt = srt->arr;
+  size_t t;
+  for(t = 0; t < threadid; t++) nxt += srt->ranges[t];
+  HASH_ITERATE_PART(srt->ht, threadid, srt->nthreads, _ht_fetch_hkey, &nxt);
+}
+
+static void ht_sorter_hist_thread(void *arg, size_t threadid)
+{
+  HashTableSorter *srt = (HashTableSorter*)arg;
+  size_t i, end, *hist = srt->hists + threadid*HT_RADIX_SIZE;
+  memset(hist, 0, HT_RADIX_SIZE*sizeof(size_t));
+  sorter_slice(srt, threadid, &i, &end);
+  for(; i < end; i++) hist[ht_radix_digit(srt->ht, srt->arr[i], srt->pos)]++;
+}
+
+static void ht_sorter_scatter_thread(void *arg, size_t threadid)
+{
+  HashTableSorter *srt = (HashTableSorter*)arg;
+  size_t i, end, *offsets = srt->hists + threadid*HT_RADIX_SIZE;
+  sorter_slice(srt, threadid, &i, &end);
+  for(; i < end; i++) {
+    hkey_t h = srt->arr[i];
+    srt->buf[offsets[ht_radix_digit(srt->ht, h, srt->pos)]++] = h;
+  }
+}
+
+static void ht_sorter_bucket_thread(void *arg, size_t threadid)
+{
+  HashTableSorter *srt = (HashTableSorter*)arg;
+  size_t d, start, n;
+  // Threads take every nthreads-th bucket
+  for(d = threadid; d < HT_RADIX_SIZE; d += srt->nthreads) {
+    start = srt->bounds[d];
+    n = srt->bounds[d+1] - start;
+    if(n > 1) ht_radix_sort(srt->ht, srt->buf+start, srt->arr+start, n,
+                            srt->pos+HT_RADIX_BITS);
+  }
+}
+
+// Sort arr[0..n-1] with `nthreads`, starting at bit `pos`
+// Returns sorted array, which is either `arr` or `buf`
+static hkey_t* ht_radix_sort_mt(const HashTable *ht, hkey_t *arr, hkey_t *buf,
+                                size_t n, size_t pos, size_t nthreads)
+{
+  size_t t, d, start;
+
+  if(nthreads == 1 || n < HT_RADIX_SIZE * nthreads) {
+    ht_radix_sort(ht, arr, buf, n, pos);
+    return arr;
+  }
+
+  size_t hists[nthreads*HT_RADIX_SIZE], bounds[HT_RADIX_SIZE+1];
+  HashTableSorter srt = {.ht = ht, .arr = arr, .buf = buf, .n = n,
+                         .nthreads = nthreads, .pos = pos,
+                         .hists = hists, .bounds = bounds};
+
+  util_multi_thread(&srt, nthreads, ht_sorter_hist_thread);
+
+  // Convert histograms into offsets: bucket major, thread minor
+  for(d = start = 0; d < HT_RADIX_SIZE; d++) {
+    bounds[d] = start;
+    for(t = 0; t < nthreads; t++) {
+      size_t c = hists[t*HT_RADIX_SIZE+d];
+      hists[t*HT_RADIX_SIZE+d] = start;
+      start += c;
+    }
+  }
+  bounds[HT_RADIX_SIZE] = start;
+
+  util_multi_thread(&srt, nthreads, ht_sorter_scatter_thread);
+  util_multi_thread(&srt, nthreads, ht_sorter_bucket_thread);
+  return buf;
+}
+
+// First bit position at which any of the kmers differ
+static size_t ht_sorter_first_bit(const uint64_t *masks, size_t nthreads)
+{
+  uint64_t ors[NUM_BKMER_WORDS], ands[NUM_BKMER_WORDS], diff;
+  size_t i, t;
+  for(i = 0; i < NUM_BKMER_WORDS; i++) {
+    ors[i] = 0; ands[i] = UINT64_MAX;
+    for(t = 0; t < nthreads; t++) {
+      ors[i] |= masks[t*2*NUM_BKMER_WORDS+i];
+      ands[i] &= masks[t*2*NUM_BKMER_WORDS+NUM_BKMER_WORDS+i];
+    }
+    diff = ors[i] ^ ands[i];
+    if(diff) return i*64 + leading_zeros(diff);
+  }
+  return NUM_BKMER_WORDS*64;
+}
+
+// Collect hkeys from the hash table into arr, returns first varying bit
+static size_t ht_sorter_collect(HashTableSorter *srt)
+{
+  uint64_t masks[srt->nthreads*2*NUM_BKMER_WORDS];
+  hkey_t ranges[srt->nthreads];
+  srt->masks = masks;
+  srt->ranges = ranges;
+  util_multi_thread(srt, srt->nthreads, ht_sorter_count_thread);
+  util_multi_thread(srt, srt->nthreads, ht_sorter_fetch_thread);
+  srt->masks = NULL;
+  srt->ranges = NULL;
+  return ht_sorter_first_bit(masks, srt->nthreads);
 }
 
 // Returns sorted array of hkey_t from the hash table
 hkey_t* hash_table_sorted(const HashTable *htable)
 {
-  ctx_assert(sizeof(hkey_t) == sizeof(BinaryKmer*));
-  ctx_assert(sizeof(hkey_t) == sizeof(BkmerPtrHkeyUnion));
-  BkmerPtrHkeyUnion *kmers, *nxt, *end;
-  nxt = kmers = ctx_malloc(sizeof(BkmerPtrHkeyUnion) * htable->num_kmers);
-  end = kmers + htable->num_kmers;
-  HASH_ITERATE(htable, _fetch_kmer_union, htable, &nxt);
-  // Can sort ignoring that the top flag bit is set on all kmers
-  qsort(kmers, htable->num_kmers, sizeof(BinaryKmer*), binary_kmers_qcmp_ptrs);
-  for(nxt = kmers; nxt < end; nxt++) nxt->h = nxt->bptr - htable->table;
-  return (hkey_t*)kmers;
+  return hash_table_sorted_mt(htable, 1);
+}
+
+// Returns sorted array of hkey_t from the hash table, sorted using `nthreads`
+hkey_t* hash_table_sorted_mt(const HashTable *htable, size_t nthreads)
+{
+  size_t n = htable->num_kmers;
+  hkey_t *arr = ctx_malloc(MAX2(n, 1) * sizeof(hkey_t));
+  hkey_t *buf = ctx_malloc(MAX2(n, 1) * sizeof(hkey_t));
+  hkey_t *sorted;
+
+  HashTableSorter srt = {.ht = htable, .arr = arr, .buf = buf, .n = n,
+                         .nthreads = nthreads};
+
+  size_t pos = ht_sorter_collect(&srt);
+  sorted = ht_radix_sort_mt(htable, arr, buf, n, pos, nthreads);
+
+  ctx_free(sorted == arr ? buf : arr);
+  return sorted;
+}
+
+//
+// Sorted chunks, without an array of all hkeys
+//
+
+#define HT_CHUNK_BITS 16
+#define HT_CHUNK_SIZE (1<<HT_CHUNK_BITS)
+
+static inline size_t ht_chunk_digit(const HashTable *ht, hkey_t hkey,
+                                    size_t pos)
+{
+  return (ht_radix_digit(ht, hkey, pos) << HT_RADIX_BITS) |
+         ht_radix_digit(ht, hkey, pos+HT_RADIX_BITS);
+}
+
+typedef struct {
+  const HashTable *ht;
+  size_t nthreads, pos, dstart, dend;
+  size_t *hists; // [nthreads][HT_CHUNK_SIZE]
+  hkey_t *arr; // chunk being filled
+  size_t *offsets; // [nthreads] where each thread adds to arr
+} HashTableChunker;
+
+static inline bool _ht_chunk_count(hkey_t hkey, const HashTable *ht,
+                                   size_t pos, size_t *hist)
+{
+  hist[ht_chunk_digit(ht, hkey, pos)]++;
+  return false;
+}
+
+static inline bool _ht_chunk_fetch(hkey_t hkey, const HashTableChunker *chk,
+                                   hkey_t **nxt)
+{
+  size_t d = ht_chunk_digit(chk->ht, hkey, chk->pos);
+  if(d >= chk->dstart && d < chk->dend) *((*nxt)++) = hkey;
+  return false;
+}
+
+static void ht_chunk_count_thread(void *arg, size_t threadid)
+{
+  HashTableChunker *chk = (HashTableChunker*)arg;
+  size_t *hist = chk->hists + threadid*HT_CHUNK_SIZE;
+  memset(hist, 0, HT_CHUNK_SIZE*sizeof(size_t));
+  HASH_ITERATE_PART(chk->ht, threadid, chk->nthreads,
+                    _ht_chunk_count, chk->ht, chk->pos, hist);
+}
+
+static void ht_chunk_fetch_thread(void *arg, size_t threadid)
+{
+  HashTableChunker *chk = (HashTableChunker*)arg;
+  hkey_t *nxt = chk->arr + chk->offsets[threadid];
+  HASH_ITERATE_PART(chk->ht, threadid, chk->nthreads,
+                    _ht_chunk_fetch, chk, &nxt);
+}
+
+// Call func on chunks of sorted hkeys (in order) until func returns true.
+// Chunks split kmers on their first 16 varying bits, and are at most
+// `max_chunk` kmers unless many kmers share the same first 16 bits.
+// Uses memory for 2*max_chunk hkeys. Returns number of kmers passed to func.
+size_t hash_table_sorted_chunks(const HashTable *htable, size_t nthreads,
+                                size_t max_chunk,
+                                bool (*func)(const hkey_t *hkeys, size_t n,
+                                             void *arg),
+                                void *arg)
+{
+  size_t t, d, dend, n, nseen = 0, cap = MAX2(max_chunk, 1);
+  hkey_t *arr = ctx_malloc(cap * sizeof(hkey_t));
+  hkey_t *buf = ctx_malloc(cap * sizeof(hkey_t)), *sorted;
+  size_t *hists = ctx_malloc(nthreads * HT_CHUNK_SIZE * sizeof(size_t));
+  size_t offsets[nthreads], ranges[nthreads];
+  uint64_t masks[nthreads*2*NUM_BKMER_WORDS];
+
+  // Find first varying bit, without collecting hkeys
+  HashTableSorter srt = {.ht = htable, .nthreads = nthreads,
+                         .masks = masks, .ranges = ranges};
+  util_multi_thread(&srt, nthreads, ht_sorter_count_thread);
+  size_t pos = ht_sorter_first_bit(masks, nthreads);
+  pos = MIN2(pos, NUM_BKMER_WORDS*64 - HT_CHUNK_BITS);
+
+  HashTableChunker chk = {.ht = htable, .nthreads = nthreads, .pos = pos,
+                          .hists = hists, .arr = NULL, .offsets = offsets};
+  util_multi_thread(&chk, nthreads, ht_chunk_count_thread);
+
+  for(d = 0; d < HT_CHUNK_SIZE; d = dend)
+  {
+    // Take as many digits as we can fit in a chunk, at least one
+    for(n = 0, dend = d; dend < HT_CHUNK_SIZE; dend++) {
+      size_t c = 0;
+      for(t = 0; t < nthreads; t++) c += hists[t*HT_CHUNK_SIZE+dend];
+      if(n > 0 && n + c > max_chunk) break;
+      n += c;
+    }
+    if(n == 0) continue;
+
+    if(n > cap) {
+      cap = n;
+      arr = ctx_realloc(arr, cap * sizeof(hkey_t));
+      buf = ctx_realloc(buf, cap * sizeof(hkey_t));
+    }
+
+    // Each thread adds kmers from its part of the table
+    size_t start = 0, i;
+    for(t = 0; t < nthreads; t++) {
+      offsets[t] = start;
+      for(i = d; i < dend; i++) start += hists[t*HT_CHUNK_SIZE+i];
+    }
+
+    chk.arr = arr;
+    chk.dstart = d;
+    chk.dend = dend;
+    util_multi_thread(&chk, nthreads, ht_chunk_fetch_thread);
+
+    sorted = ht_radix_sort_mt(htable, arr, buf, n, pos, nthreads);
+    nseen += n;
+    if(func(sorted, n, arg)) break;
+  }
+
+  ctx_free(arr);
+  ctx_free(buf);
+  ctx_free(hists);
+  return nseen;
 }
@@ -5,10 +5,23 @@
 
 #include "hash_mem.h"
 #include "binary_kmer.h"
+#include "kmer_bloom.h"
 #include "util.h"
 
 #define HT_BSIZE 0
 #define HT_BITEMS 1
+#define HT_BLOCK 2 // bucket lock byte, only in HT_ALLOC_COLOCATE headers
+
+// With HT_ALLOC_COLOCATE each bucket has a cache line (HT_BUCKET_HDR bytes)
+// holding its size, fill count and lock, followed by the tag of each entry
+// from byte HT_HDR_TAGS. A probe reads the bucket's size, lock and tags from
+// one line, then only touches the kmers whose tag matches. Bucket locks are
+// then taken in the header and `bktlocks` arguments below are not used.
+#define HT_HDR_TAGS 4
+
+#if MAX_BUCKET_SIZE + HT_HDR_TAGS > HT_BUCKET_HDR
+  #error Bucket tags do not fit in a HT_ALLOC_COLOCATE header
+#endif
 
 #define HASH_NOT_FOUND (UINT64_MAX>>1)
 #define BKMER_SET_FLAG (1UL<<63)
@@ -22,18 +35,71 @@ typedef struct
   const uint_fast32_t hash_mask; // this is num_of_buckets - 1
   const uint8_t bucket_size; // max value 255
   const uint64_t capacity; // num_of_buckets * bucket_size
-  // buckets[b][0] is the size of the bucket (can only increase)
-  // buckets[b][1] is the number of filled entries in a bucket (can go up/down)
-  uint8_t (*const buckets)[2];
+  // Two bytes per bucket, or a HT_BUCKET_HDR header with HT_ALLOC_COLOCATE.
+  // Use hash_table_bsize() for the size of a bucket (can only increase) and
+  // hash_table_bitems() for its number of filled entries (can go up/down)
+  uint8_t *const buckets;
+  // Optional 8 bit fingerprint per entry, checked before comparing kmers.
+  // NULL unless allocated with HT_ALLOC_TAGS or HT_ALLOC_COLOCATE. 0 means
+  // empty. With HT_ALLOC_COLOCATE points into the bucket headers.
+  uint8_t *const tags;
+  // Bucket sizes, locks and tags in one header per bucket (HT_ALLOC_COLOCATE)
+  const bool colocated;
+  const bool large_pages; // table and tags allocated with ctx_calloc_large()
+  // Single threaded inserts move kmers to make room (set with HT_ALLOC_CUCKOO)
+  const bool cuckoo;
+  // Called when an insert moves a kmer to another slot
+  // (set with hash_table_set_move(), NULL if not used)
+  void (*move_func)(hkey_t from, hkey_t to, void *arg);
+  void *move_arg;
+  uint64_t num_moves; // kmers moved by cuckoo inserts
+  // Optional filter of all kmers, checked before finds
+  // (set with hash_table_filter_build(), NULL if not used)
+  KmerBloom *filter;
+  // Kmers in the slots they were hashed to, and the hkey of each slot, once
+  // kmers have been moved to new hkeys (set with hash_table_relayout(),
+  // NULL if not used)
+  BinaryKmer *slot_table;
+  hkey_t *slot_hkeys;
   uint64_t num_kmers;
   uint64_t collisions[REHASH_LIMIT];
   const uint32_t seed; // random seed used in hashing
 } HashTable;
 
 // Returns NULL if not enough memory
+extern const int HT_ALLOC_TAGS; // fingerprint per entry (HT_TAG_BITS bits)
+extern const int HT_ALLOC_HUGEPAGES; // huge pages, see ctx_calloc_large()
+extern const int HT_ALLOC_CUCKOO; // bucketised cuckoo inserts, see below
+extern const int HT_ALLOC_COLOCATE; // bucket headers, see HT_BUCKET_HDR
+
 void hash_table_alloc(HashTable *htable, uint64_t capacity);
+// flags: OR together HT_ALLOC_* values
+void hash_table_alloc_flags(HashTable *htable, uint64_t capacity, int flags);
 void hash_table_dealloc(HashTable *ht);
 
+// Bytes allocated for the kmers, buckets and tags (not the relayout tables)
+size_t hash_table_mem_used(const HashTable *ht);
+
+// Bucketised cuckoo inserts (HT_ALLOC_CUCKOO)
+// Kmers are kept in the first HT_CUCKOO_WAYS of their REHASH_LIMIT buckets
+// where possible. When those are all full, kmers already in them are moved
+// to another of their first HT_CUCKOO_WAYS buckets to make room (a random walk
+// of at most HT_CUCKOO_MAX_KICKS moves). Only if that fails does a kmer go in
+// a later bucket. Finds are unchanged, but most kmers are found in the first
+// few buckets even when the table is 90-95% full, so tables can be sized
+// closer to the number of kmers.
+// Only hash_table_insert() and hash_table_find_or_insert() move kmers: hkeys
+// held from before one of these calls may be invalid after it. Data indexed by
+// hkey must be moved with its kmer by the function set with
+// hash_table_set_move(). Threadsafe inserts never move kmers.
+#define HT_CUCKOO_WAYS 4
+#define HT_CUCKOO_MAX_KICKS 256
+
+// `func(from,to,arg)` must move data for kmer `from` to `to` and clear `from`
+void hash_table_set_move(HashTable *ht,
+                         void (*func)(hkey_t from, hkey_t to, void *arg),
+                         void *arg);
+
 #define hash_table_size(ht) (ht)->capacity
 #define hash_table_nkmers(ht) (ht)->num_kmers
 #define hash_table_assigned(ht,key) HASH_ENTRY_ASSIGNED((ht)->table[key])
@@ -47,8 +113,11 @@ static inline BinaryKmer hash_table_fetch(const HashTable *const ht, hkey_t key)
 
 #define hash_table_nbuckets(ht) ((ht)->num_of_buckets)
 #define hash_table_bucket_size(ht) ((ht)->bucket_size)
-#define hash_table_bsize(ht,bkt) ((ht)->buckets[bkt][HT_BSIZE])
-#define hash_table_bitems(ht,bkt) ((ht)->buckets[bkt][HT_BITEMS])
+#define hash_table_bstride(ht) ((ht)->colocated ? HT_BUCKET_HDR : 2)
+#define hash_table_bmeta(ht,bkt) \
+        ((ht)->buckets + (size_t)(bkt) * hash_table_bstride(ht))
+#define hash_table_bsize(ht,bkt) (hash_table_bmeta(ht,bkt)[HT_BSIZE])
+#define hash_table_bitems(ht,bkt) (hash_table_bmeta(ht,bkt)[HT_BITEMS])
 
 hkey_t hash_table_find(const HashTable *const htable, const BinaryKmer bkmer);
 hkey_t hash_table_insert(HashTable *const htable, const BinaryKmer bkmer);
@@ -63,6 +132,95 @@ hkey_t hash_table_find_mt(HashTable *ht, const BinaryKmer key,
 hkey_t hash_table_find_or_insert_mt(HashTable *htable, const BinaryKmer key,
                                     bool *found, volatile uint8_t *bktlocks);
 
+// Threadsafe find without taking any locks. May miss a kmer that is being
+// inserted at the same time.
+hkey_t hash_table_find_lockfree(const HashTable *ht, const BinaryKmer key);
+
+// Threadsafe find or insert. Searches without taking a lock, then claims an
+// empty slot with compare-and-swap. When k > 31 a kmer does not fit in one
+// word, so insertion falls back to taking the bucket lock in `bktlocks`.
+// Does not re-use the slots of deleted entries. Do not mix with calls to
+// hash_table_find_or_insert_mt() on the same table.
+hkey_t hash_table_find_or_insert_lockfree(HashTable *htable, const BinaryKmer key,
+                                          bool *found, volatile uint8_t *bktlocks);
+
+// Batched threadsafe find or insert of `n` kmer keys. Buckets of the next
+// `depth` kmers are prefetched while inserting, to hide memory latency on
+// large tables. Results go in hkeys[0..n-1] and found[0..n-1].
+// The _mt version uses bucket locks like hash_table_find_or_insert_mt(), the
+// _lockfree version is like hash_table_find_or_insert_lockfree().
+#define HT_PREFETCH_DEPTH 8
+#define HT_MAX_PREFETCH_DEPTH 64
+
+void hash_table_find_or_insert_batch_mt(HashTable *ht, const BinaryKmer *keys,
+                                        size_t n, size_t depth,
+                                        hkey_t *hkeys, bool *found,
+                                        volatile uint8_t *bktlocks);
+
+void hash_table_find_or_insert_batch_lockfree(HashTable *ht,
+                                              const BinaryKmer *keys,
+                                              size_t n, size_t depth,
+                                              hkey_t *hkeys, bool *found,
+                                              volatile uint8_t *bktlocks);
+
+// As above, but return HASH_NOT_FOUND instead of exiting if the table is full.
+// Batch versions return the number of keys done before the table filled up.
+hkey_t hash_table_try_find_or_insert(HashTable *ht, const BinaryKmer key,
+                                     bool *found);
+
+hkey_t hash_table_try_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
+                                        bool *found, volatile uint8_t *bktlocks);
+
+hkey_t hash_table_try_find_or_insert_lockfree(HashTable *ht, const BinaryKmer key,
+                                              bool *found,
+                                              volatile uint8_t *bktlocks);
+
+size_t hash_table_try_find_or_insert_batch_mt(HashTable *ht,
+                                              const BinaryKmer *keys,
+                                              size_t n, size_t depth,
+                                              hkey_t *hkeys, bool *found,
+                                              volatile uint8_t *bktlocks);
+
+size_t hash_table_try_find_or_insert_batch_lockfree(HashTable *ht,
+                                                    const BinaryKmer *keys,
+                                                    size_t n, size_t depth,
+                                                    hkey_t *hkeys, bool *found,
+                                                    volatile uint8_t *bktlocks);
+
+// Batched threadsafe insert of `n` distinct kmer keys, without checking
+// whether they are already in the table. Only use when every key is known to
+// be new, e.g. loading unitigs. Uses bucket locks like the _mt functions above.
+void hash_table_insert_batch_mt(HashTable *ht, const BinaryKmer *keys,
+                                size_t n, size_t depth, hkey_t *hkeys,
+                                volatile uint8_t *bktlocks);
+
+// Prefetch the first bucket `key` would be found in, ahead of a find
+void hash_table_prefetch(const HashTable *ht, const BinaryKmer key);
+
+// Batched find of `n` kmer keys, prefetching the buckets of the next `depth`
+// kmers. Results go in hkeys[0..n-1] (HASH_NOT_FOUND if missing).
+// Threadsafe as long as no kmers are being added or removed.
+void hash_table_find_batch(const HashTable *ht, const BinaryKmer *keys,
+                           size_t n, size_t depth, hkey_t *hkeys);
+
+// Build a blocked Bloom filter of all kmers in the table. hash_table_find()
+// and hash_table_find_batch() check it first, so most kmers not in the table
+// cost one cache line read instead of a bucket probe per rehash round.
+// Uses HT_FILTER_BITS_PER_KMER to twice that many bits per kmer.
+// Only for tables that are no longer added to: kmers inserted afterwards may
+// not be found. Freed by hash_table_dealloc() and hash_table_empty().
+#define HT_FILTER_BITS_PER_KMER 16
+void hash_table_filter_build(HashTable *ht);
+void hash_table_filter_free(HashTable *ht);
+
+// Move the kmer in each slot `s` to hkey `newkeys[s]`, so callers can choose
+// the order kmers are stored in. Finds probe a copy of the kmers in their
+// hashed slots and map the slot to the new hkey. `newkeys` must give each
+// kmer a distinct hkey below capacity. Read only afterwards: inserting or
+// deleting is an error. Uses HT_RELAYOUT_BYTES extra per entry.
+#define HT_RELAYOUT_BYTES (sizeof(BinaryKmer) + sizeof(hkey_t))
+void hash_table_relayout(HashTable *ht, const hkey_t *newkeys);
+
 // Safe to call on different entries at the same time
 // NOT safe to do find() whilst doing delete()
 void hash_table_delete(HashTable *const htable, hkey_t pos);
@@ -73,9 +231,30 @@ void hash_table_empty(HashTable *const htable);
 void hash_table_print_stats(const HashTable *const htable);
 void hash_table_print_stats_brief(const HashTable *const htable);
 
+// Count buckets by number of entries: hist[i] is the number of buckets holding
+// i kmers. `hist` must have length hash_table_bucket_size(ht)+1
+void hash_table_bucket_fill_hist(const HashTable *const htable, uint64_t *hist);
+
+// SIMD level used to scan buckets
+const char* hash_table_probe_simd_str();
+
 // Returns sorted array of hkey_t from the hash table, use kmers[i].h
 hkey_t* hash_table_sorted(const HashTable *htable);
 
+// Same as hash_table_sorted(), using `nthreads` threads (parallel radix sort)
+// Uses 2 * sizeof(hkey_t) * num_kmers memory whilst sorting
+hkey_t* hash_table_sorted_mt(const HashTable *htable, size_t nthreads);
+
+// Call func on chunks of sorted hkeys (in order) until func returns true.
+// Chunks split kmers on their first 16 varying bits, and are at most
+// `max_chunk` kmers unless many kmers share the same first 16 bits.
+// Uses memory for 2*max_chunk hkeys. Returns number of kmers passed to func.
+size_t hash_table_sorted_chunks(const HashTable *htable, size_t nthreads,
+                                size_t max_chunk,
+                                bool (*func)(const hkey_t *hkeys, size_t n,
+                                             void *arg),
+                                void *arg);
+
 // This is for debugging
 uint64_t hash_table_count_kmers(const HashTable *const htable);
 
@@ -139,6 +318,7 @@ typedef struct
   const size_t nthreads;
   bool (*const func)(hkey_t _h, size_t threadid, void *_arg);
   void *arg;
+  hkey_t start; // first hkey, used by hash_table_iterate_steal_range()
 } HashTableIterator;
 
 static inline void _hash_table_iterate(void *arg, size_t threadid)
@@ -160,4 +340,55 @@ static inline void hash_table_iterate(const HashTable *ht, size_t nthreads,
   util_multi_thread(&ht_iter, nthreads, _hash_table_iterate);
 }
 
+// Work stealing: the table is cut into ~64 chunks per thread (at least 1024
+// entries each) and threads that finish early take chunks from others. Use
+// when work per kmer is very uneven (e.g. bubble calling in repeats).
+#define HASH_ITERATE_CHUNKS_PER_THREAD 64
+#define HASH_ITERATE_MIN_CHUNK 1024
+
+static inline bool _hash_table_iterate_range(size_t start, size_t end,
+                                             size_t threadid, void *arg)
+{
+  HashTableIterator itr = *(HashTableIterator*)arg;
+  hkey_t hkey;
+  for(hkey = itr.start+start; hkey < itr.start+end; hkey++)
+    if(hash_table_assigned(itr.ht, hkey) && itr.func(hkey, threadid, itr.arg))
+      return true;
+  return false;
+}
+
+// Iterate over hkeys [start, end) only, so long runs can stop and resume
+// part way through the table.
+// Stops a thread if func() returns non-zero, other threads keep going
+static inline void hash_table_iterate_steal_range(const HashTable *ht,
+                                                  hkey_t start, hkey_t end,
+                                                  size_t nthreads,
+                                                  bool (*func)(hkey_t _h,
+                                                               size_t threadid,
+                                                               void *_arg),
+                                                  void *arg)
+{
+  ctx_assert(nthreads > 0);
+  ctx_assert(start <= end && end <= hash_table_size(ht));
+  HashTableIterator ht_iter = {.ht = ht, .nthreads = nthreads,
+                               .func = func, .arg = arg, .start = start};
+
+  size_t chunk = (end - start) / (nthreads*HASH_ITERATE_CHUNKS_PER_THREAD);
+  chunk = MAX2(chunk, HASH_ITERATE_MIN_CHUNK);
+  util_run_ranges(end - start, chunk, nthreads,
+                  _hash_table_iterate_range, &ht_iter);
+}
+
+// Stops a thread if func() returns non-zero, other threads keep going
+static inline void hash_table_iterate_steal(const HashTable *ht,
+                                            size_t nthreads,
+                                            bool (*func)(hkey_t _h,
+                                                         size_t threadid,
+                                                         void *_arg),
+                                            void *arg)
+{
+  hash_table_iterate_steal_range(ht, 0, hash_table_size(ht),
+                                 nthreads, func, arg);
+}
+
 #endif /* HASH_TABLE_H_ */
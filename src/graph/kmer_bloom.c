@@ -0,0 +1,127 @@
+#include "global.h"
+#include "kmer_bloom.h"
+#include "util.h"
+
+void kmer_bloom_alloc(KmerBloom *bloom, size_t nbits)
+{
+  size_t nblocks = 1, block_bits = KMER_BLOOM_BLOCK_WORDS*64;
+  while(nblocks * 2 * block_bits <= nbits) nblocks <<= 1;
+
+  char mem_str[50];
+  bytes_to_str(nblocks * KMER_BLOOM_BLOCK_WORDS * sizeof(uint64_t), 1, mem_str);
+  status("[bloom] Allocating filter with %zu blocks, using %s", nblocks, mem_str);
+
+  KmerBloom tmp = {.words = ctx_calloc_large(nblocks * KMER_BLOOM_BLOCK_WORDS,
+                                             sizeof(uint64_t)),
+                   .nblocks = nblocks,
+                   .mask = nblocks-1,
+                   .seed = (uint32_t)rand()};
+
+  memcpy(bloom, &tmp, sizeof(KmerBloom));
+}
+
+void kmer_bloom_dealloc(KmerBloom *bloom)
+{
+  ctx_free_large(bloom->words);
+  memset(bloom, 0, sizeof(KmerBloom));
+}
+
+void kmer_bloom_reset(KmerBloom *bloom)
+{
+  memset(bloom->words, 0, kmer_bloom_mem(bloom));
+}
+
+// Block from the first hash, bit positions from double hashing h2 + i*h3
+#define bloom_block(bloom,bkey) \
+  ((bloom)->words + \
+   (binary_kmer_hash(bkey,(bloom)->seed) & (bloom)->mask) * KMER_BLOOM_BLOCK_WORDS)
+
+#define bloom_bit(h2,h3,i) (((h2) + (i)*(h3)) & (KMER_BLOOM_BLOCK_WORDS*64-1))
+
+// Threadsafe
+// Add a kmer key to the filter
+// Returns true if it was (probably) already in the filter
+bool kmer_bloom_add_mt(KmerBloom *bloom, BinaryKmer bkey)
+{
+  volatile uint64_t *blk = bloom_block(bloom, bkey);
+  uint32_t h2 = binary_kmer_hash(bkey, bloom->seed+1);
+  uint32_t h3 = (h2 >> 16) | 1, pos;
+  uint64_t bit, old;
+  bool found = true;
+  size_t i;
+
+  for(i = 0; i < KMER_BLOOM_NHASH; i++) {
+    pos = bloom_bit(h2, h3, i);
+    bit = (uint64_t)1 << (pos & 63);
+    if(!(blk[pos>>6] & bit)) {
+      old = __sync_fetch_and_or(&blk[pos>>6], bit);
+      found &= !!(old & bit);
+    }
+  }
+
+  return found;
+}
+
+// Returns true if bkey is (probably) in the filter
+bool kmer_bloom_has(const KmerBloom *bloom, BinaryKmer bkey)
+{
+  const uint64_t *blk = bloom_block(bloom, bkey);
+  uint32_t h2 = binary_kmer_hash(bkey, bloom->seed+1);
+  uint32_t h3 = (h2 >> 16) | 1, pos;
+  size_t i;
+
+  for(i = 0; i < KMER_BLOOM_NHASH; i++) {
+    pos = bloom_bit(h2, h3, i);
+    if(!(blk[pos>>6] & ((uint64_t)1 << (pos & 63)))) return false;
+  }
+
+  return true;
+}
+
+#define KMER_BLOOM_HASH_BLOCK 64
+#define KMER_BLOOM_MAX_DEPTH 32
+
+// Test all bits at once with a mask of the block
+static inline bool bloom_block_has(const uint64_t *blk, uint32_t h2)
+{
+  uint64_t mask[KMER_BLOOM_BLOCK_WORDS] = {0}, miss = 0;
+  uint32_t h3 = (h2 >> 16) | 1, pos;
+  size_t i;
+
+  for(i = 0; i < KMER_BLOOM_NHASH; i++) {
+    pos = bloom_bit(h2, h3, i);
+    mask[pos>>6] |= (uint64_t)1 << (pos & 63);
+  }
+
+  for(i = 0; i < KMER_BLOOM_BLOCK_WORDS; i++) miss |= mask[i] & ~blk[i];
+
+  return !miss;
+}
+
+void kmer_bloom_has_batch(const KmerBloom *bloom, const BinaryKmer *bkeys,
+                          size_t n, size_t depth, bool *has)
+{
+  // round 0 of binary_kmer_hash64() is binary_kmer_hash()
+  uint64_t h1[KMER_BLOOM_HASH_BLOCK], h2[KMER_BLOOM_HASH_BLOCK];
+  const uint64_t *blks[KMER_BLOOM_HASH_BLOCK];
+  size_t s, m, i, d = MIN2(MAX2(depth,1), KMER_BLOOM_MAX_DEPTH);
+
+  for(s = 0; s < n; s += KMER_BLOOM_HASH_BLOCK)
+  {
+    m = MIN2(KMER_BLOOM_HASH_BLOCK, n - s);
+    binary_kmer_hash64_batch(bkeys + s, m, bloom->seed,   h1);
+    binary_kmer_hash64_batch(bkeys + s, m, bloom->seed+1, h2);
+
+    for(i = 0; i < m; i++) {
+      blks[i] = bloom->words + ((uint32_t)h1[i] & bloom->mask) *
+                               KMER_BLOOM_BLOCK_WORDS;
+    }
+
+    for(i = 0; i < d && i < m; i++) __builtin_prefetch(blks[i], 0, 1);
+
+    for(i = 0; i < m; i++) {
+      if(i + d < m) __builtin_prefetch(blks[i+d], 0, 1);
+      has[s+i] = bloom_block_has(blks[i], (uint32_t)h2[i]);
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef KMER_BLOOM_H_
+#define KMER_BLOOM_H_
+
+//
+// Blocked Bloom filter of kmer keys
+//
+// Each kmer sets KMER_BLOOM_NHASH bits in a single 512 bit (64 byte) block,
+// so a lookup touches one cache line. Used by `build --min-count` to record
+// the first sighting of each kmer without adding it to the graph, and as a
+// filter in front of a read-only hash table (hash_table_filter_build()).
+//
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+
+#define KMER_BLOOM_BLOCK_WORDS 8 // 8*64 = 512 bits per block
+#define KMER_BLOOM_NHASH 6
+
+// Bits of filter to allocate per kmer in the graph. Aimed at data where most
+// distinct kmers are errors seen once: with ~4 error kmers per real kmer this
+// gives ~8 bits per distinct kmer, a false positive rate of ~2-3%.
+#define KMER_BLOOM_BITS_PER_KMER 32
+
+typedef struct
+{
+  uint64_t *const words;
+  const size_t nblocks; // power of two
+  const uint64_t mask;
+  const uint32_t seed;
+} KmerBloom;
+
+// Allocates at most `nbits` bits (at least one block), as a power of two blocks
+void kmer_bloom_alloc(KmerBloom *bloom, size_t nbits);
+void kmer_bloom_dealloc(KmerBloom *bloom);
+void kmer_bloom_reset(KmerBloom *bloom);
+
+#define kmer_bloom_nbits(bloom) ((bloom)->nblocks*KMER_BLOOM_BLOCK_WORDS*64)
+#define kmer_bloom_mem(bloom) ((bloom)->nblocks*KMER_BLOOM_BLOCK_WORDS*sizeof(uint64_t))
+
+// Threadsafe
+// Add a kmer key to the filter
+// Returns true if it was (probably) already in the filter
+bool kmer_bloom_add_mt(KmerBloom *bloom, BinaryKmer bkey);
+
+// Returns true if bkey is (probably) in the filter
+bool kmer_bloom_has(const KmerBloom *bloom, BinaryKmer bkey);
+
+// Set has[i] = kmer_bloom_has(bloom, bkeys[i]) for `n` kmer keys. Kmers are
+// hashed in blocks (with SIMD if available) and the blocks of the next
+// `depth` kmers are prefetched. Each block is tested against a 512 bit mask
+// of the kmer's bits without branching.
+void kmer_bloom_has_batch(const KmerBloom *bloom, const BinaryKmer *bkeys,
+                          size_t n, size_t depth, bool *has);
+
+#endif /* KMER_BLOOM_H_ */
@@ -0,0 +1,115 @@
+#include "global.h"
+#include "kmer_hll.h"
+#include "util.h"
+
+#include <math.h>
+
+// Fixed seeds so sketches of different inputs can be merged
+#define KMER_HLL_SEED0 0x5bd1e995
+#define KMER_HLL_SEED1 0x1b873593
+
+void kmer_hll_alloc(KmerHLL *hll, size_t nbits)
+{
+  ctx_assert(nbits >= 4 && nbits <= 24);
+  hll->nbits = nbits;
+  hll->regs = ctx_calloc((size_t)1 << nbits, sizeof(uint8_t));
+}
+
+void kmer_hll_dealloc(KmerHLL *hll)
+{
+  ctx_free(hll->regs);
+  memset(hll, 0, sizeof(KmerHLL));
+}
+
+void kmer_hll_reset(KmerHLL *hll)
+{
+  memset(hll->regs, 0, kmer_hll_nregs(hll));
+}
+
+// Threadsafe
+// Add a kmer key to the sketch
+void kmer_hll_add_mt(KmerHLL *hll, BinaryKmer bkey)
+{
+  uint64_t h = ((uint64_t)binary_kmer_hash(bkey, KMER_HLL_SEED0) << 32) |
+               binary_kmer_hash(bkey, KMER_HLL_SEED1);
+  size_t idx = h >> (64 - hll->nbits);
+
+  // Position of first set bit after the index bits, guard bit stops at 64
+  uint64_t w = (h << hll->nbits) | ((uint64_t)1 << (hll->nbits-1));
+  uint8_t rho = (uint8_t)(__builtin_clzll(w) + 1), old;
+
+  volatile uint8_t *reg = hll->regs + idx;
+  while(rho > (old = *reg) && !__sync_bool_compare_and_swap(reg, old, rho)) {}
+}
+
+// Threadsafe
+// Add the kmers of `seq` to the sketch. Sequence must be entirely ACGT and
+// len >= kmer_size. Returns number of kmers added.
+size_t kmer_hll_add_str_mt(KmerHLL *hll, const char *seq, size_t len,
+                           size_t kmer_size)
+{
+  ctx_assert(len >= kmer_size);
+  BinaryKmerIter kiter;
+  Orientation orient;
+  size_t i;
+
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+  for(i = kmer_size-1; i < len; i++) {
+    binary_kmer_iter_next(&kiter, dna_char_to_nuc(seq[i]));
+    kmer_hll_add_mt(hll, binary_kmer_iter_key(&kiter, &orient));
+  }
+
+  return len+1-kmer_size;
+}
+
+// Add all kmers of a graph file to the sketch then seek back to the first
+// kmer, so the file can be loaded. Cannot be used on a stream.
+// Returns number of kmers read.
+size_t kmer_hll_add_graph(KmerHLL *hll, GraphFileReader *file)
+{
+  ctx_assert(!file_filter_isstdin(&file->fltr));
+  size_t ncols = file_filter_into_ncols(&file->fltr), nkmers = 0;
+  BinaryKmer bkmer;
+  Covg covgs[ncols];
+  Edges edges[ncols];
+
+  if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
+    die("fseek failed: %s", strerror(errno));
+
+  for(; graph_file_read_reset(file, &bkmer, covgs, edges); nkmers++)
+    kmer_hll_add_mt(hll, bkmer);
+
+  if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
+    die("fseek failed: %s", strerror(errno));
+
+  return nkmers;
+}
+
+// Merge sketch `src` into `dst`, both must have the same number of registers
+void kmer_hll_merge(KmerHLL *dst, const KmerHLL *src)
+{
+  ctx_assert(dst->nbits == src->nbits);
+  size_t i, n = kmer_hll_nregs(dst);
+  for(i = 0; i < n; i++) dst->regs[i] = MAX2(dst->regs[i], src->regs[i]);
+}
+
+// Estimated number of distinct kmers added
+uint64_t kmer_hll_estimate(const KmerHLL *hll)
+{
+  size_t i, m = kmer_hll_nregs(hll), nzeros = 0;
+  double sum = 0, alpha = 0.7213 / (1.0 + 1.079 / m), est;
+
+  for(i = 0; i < m; i++) {
+    sum += ldexp(1.0, -(int)hll->regs[i]);
+    nzeros += (hll->regs[i] == 0);
+  }
+
+  est = alpha * m * m / sum;
+
+  // Use linear counting for small cardinalities. Hashes are 64 bits so no
+  // correction is needed for large cardinalities.
+  if(est <= 2.5 * m && nzeros > 0)
+    est = m * log((double)m / nzeros);
+
+  return (uint64_t)(est + 0.5);
+}
@@ -0,0 +1,54 @@
+#ifndef KMER_HLL_H_
+#define KMER_HLL_H_
+
+//
+// HyperLogLog sketch of kmer keys, for estimating the number of distinct kmers
+// before allocating a graph (`build --estimate-kmers`, `join --estimate-kmers`)
+//
+// Each kmer is hashed to 64 bits: the top `nbits` bits pick a register, which
+// keeps the maximum position of the first set bit in the rest of the hash.
+// With 2^nbits registers the standard error is ~1.04/sqrt(2^nbits). Sketches
+// use a fixed seed, so sketches of different inputs can be merged.
+//
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+#include "graph_file_reader.h"
+
+// 2^14 registers => 16KB sketch, ~0.8% standard error
+#define KMER_HLL_BITS 14
+
+typedef struct
+{
+  uint8_t *regs; // [1<<nbits]
+  size_t nbits;
+} KmerHLL;
+
+#define kmer_hll_nregs(hll) ((size_t)1 << (hll)->nbits)
+
+void kmer_hll_alloc(KmerHLL *hll, size_t nbits);
+void kmer_hll_dealloc(KmerHLL *hll);
+void kmer_hll_reset(KmerHLL *hll);
+
+// Threadsafe
+// Add a kmer key to the sketch
+void kmer_hll_add_mt(KmerHLL *hll, BinaryKmer bkey);
+
+// Threadsafe
+// Add the kmers of `seq` to the sketch. Sequence must be entirely ACGT and
+// len >= kmer_size. Returns number of kmers added.
+size_t kmer_hll_add_str_mt(KmerHLL *hll, const char *seq, size_t len,
+                           size_t kmer_size);
+
+// Add all kmers of a graph file to the sketch then seek back to the first
+// kmer, so the file can be loaded. Cannot be used on a stream.
+// Returns number of kmers read.
+size_t kmer_hll_add_graph(KmerHLL *hll, GraphFileReader *file);
+
+// Merge sketch `src` into `dst`, both must have the same number of registers
+void kmer_hll_merge(KmerHLL *dst, const KmerHLL *src);
+
+// Estimated number of distinct kmers added
+uint64_t kmer_hll_estimate(const KmerHLL *hll);
+
+#endif /* KMER_HLL_H_ */
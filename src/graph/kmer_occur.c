@@ -3,6 +3,12 @@
 #include "seq_reader.h"
 #include "util.h"
 #include "db_node.h"
+#include "file_util.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 //
 // This file provides a datastore for loading sequences and recording where
@@ -41,7 +47,7 @@ void koruns_print(const KOccurRun *runs, size_t n, size_t kmer_size, FILE *fout)
   }
 }
 
-void korun_gzprint(gzFile gzout, size_t kmer_size,
+void korun_sbuf(StrBuf *sbuf, size_t kmer_size,
                    const KOGraph *kograph, KOccurRun korun,
                    size_t first_kmer_idx, size_t kmer_offset)
 {
@@ -60,20 +66,20 @@ void korun_gzprint(gzFile gzout, size_t kmer_size,
   }
   qoffset = korun.qoffset - first_kmer_idx;
   // +1 to coords to convert to 1-based
-  gzprintf(gzout, "%s:%zu-%zu:%c:%u",
-           chrom, start+1, end+1, strand[korun.strand], qoffset+1);
+  strbuf_sprintf(sbuf, "%s:%zu-%zu:%c:%zu",
+                 chrom, start+1, end+1, strand[korun.strand], qoffset+1);
 }
 
-void koruns_gzprint(gzFile gzout, size_t kmer_size, const KOGraph *kograph,
-                    const KOccurRun *koruns, size_t n,
-                    size_t first_kmer_idx, size_t kmer_offset)
+void koruns_sbuf(StrBuf *sbuf, size_t kmer_size, const KOGraph *kograph,
+                 const KOccurRun *koruns, size_t n,
+                 size_t first_kmer_idx, size_t kmer_offset)
 {
   size_t i;
   if(n == 0) return;
-  korun_gzprint(gzout, kmer_size, kograph, koruns[0], first_kmer_idx, kmer_offset);
+  korun_sbuf(sbuf, kmer_size, kograph, koruns[0], first_kmer_idx, kmer_offset);
   for(i = 1; i < n; i++) {
-    gzputc(gzout, ',');
-    korun_gzprint(gzout, kmer_size, kograph, koruns[i], first_kmer_idx, kmer_offset);
+    strbuf_append_char(sbuf, ',');
+    korun_sbuf(sbuf, kmer_size, kograph, koruns[i], first_kmer_idx, kmer_offset);
   }
 }
 
@@ -125,12 +131,68 @@ static void generate_chrom_list(KOGraph *kograph,
   }
 }
 
+// Reads are split into chunks of up to KOGRAPH_CHUNK_KMERS kmers so that a
+// single long chromosome is processed by many threads
+typedef struct {
+  size_t chrom, start, end; // kmers starting at [start,end) in read `chrom`
+} KOReadChunk;
+
+static KOReadChunk* ko_read_chunks(const read_t *reads, size_t num_reads,
+                                   size_t kmer_size, size_t *nchunks_ptr)
+{
+  size_t i, start, nkmers, nchunks = 0;
+  KOReadChunk *chunks;
+
+  for(i = 0; i < num_reads; i++) {
+    nkmers = reads[i].seq.end < kmer_size ? 0 : reads[i].seq.end+1-kmer_size;
+    nchunks += (nkmers + KOGRAPH_CHUNK_KMERS - 1) / KOGRAPH_CHUNK_KMERS;
+  }
+
+  chunks = ctx_malloc(MAX2(nchunks, 1) * sizeof(KOReadChunk));
+  nchunks = 0;
+
+  for(i = 0; i < num_reads; i++) {
+    nkmers = reads[i].seq.end < kmer_size ? 0 : reads[i].seq.end+1-kmer_size;
+    for(start = 0; start < nkmers; start += KOGRAPH_CHUNK_KMERS) {
+      chunks[nchunks++] = (KOReadChunk){
+        .chrom = i, .start = start,
+        .end = MIN2(start+KOGRAPH_CHUNK_KMERS, nkmers)};
+    }
+  }
+
+  *nchunks_ptr = nchunks;
+  return chunks;
+}
+
+// Get the next contig (run of kmers without Ns) in a chunk
+// `seq` is the sequence from the first kmer of the chunk, `seqlen` includes the
+// first kmer of the next chunk (if any) so the edge to it can be added.
+// Sets *ncount to the number of kmers in the contig that belong to this chunk
+// Returns false when there are no more contigs
+static inline bool ko_chunk_contig(const char *seq, size_t seqlen,
+                                   size_t nkmers, size_t kmer_size,
+                                   size_t *search_start,
+                                   size_t *contig_start, size_t *contig_len,
+                                   size_t *ncount)
+{
+  size_t start, end;
+  start = seq_contig_start2(seq, seqlen, NULL, 0, *search_start, kmer_size, 0, 0);
+  if(start >= nkmers) return false;
+  end = seq_contig_end2(seq, seqlen, NULL, 0, start, kmer_size, 0, 0,
+                        search_start);
+  *contig_start = start;
+  *contig_len = end - start;
+  *ncount = MIN2(end+1-kmer_size, nkmers) - start;
+  return true;
+}
+
 // Add missing kmers and edges to the graph whilst keeping track of the count
 // of how many times each kmer in the graph is seen in sequence (with klists)
-// Returns number of kmers added to the graph
+// Only the first `ncount` kmers are counted, a following kmer is only used to
+// add the edge to it.
 // Threadsafe
 static inline void add_ref_seq_to_graph_mt(const char *seq, size_t len,
-                                           size_t ref_col,
+                                           size_t ncount, size_t ref_col,
                                            KONodeList *klists,
                                            dBGraph *db_graph)
 {
@@ -142,6 +204,7 @@ static inline void add_ref_seq_to_graph_mt(const char *seq, size_t len,
   bool found;
 
   ctx_assert(len >= kmer_size);
+  ctx_assert(ncount > 0 && ncount <= len+1-kmer_size);
 
   bkmer = binary_kmer_from_str(seq, kmer_size);
   prev = db_graph_find_or_add_node_mt(db_graph, bkmer, &found);
@@ -153,107 +216,184 @@ static inline void add_ref_seq_to_graph_mt(const char *seq, size_t len,
     nuc = dna_char_to_nuc(seq[i]);
     bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
     curr = db_graph_find_or_add_node_mt(db_graph, bkmer, &found);
-    db_graph_update_node_mt(db_graph, curr, ref_col);
-    __sync_fetch_and_add((volatile uint64_t*)&klists[curr.key].kcount, 1); // kcount++
+    if(i+1-kmer_size < ncount) {
+      db_graph_update_node_mt(db_graph, curr, ref_col);
+      __sync_fetch_and_add((volatile uint64_t*)&klists[curr.key].kcount, 1);
+    }
     db_graph_add_edge_mt(db_graph, 0, prev, curr);
   }
 }
 
-// Add missing kmers and edges to the graph whilst keeping track of the count
-// of how many times each kmer in the graph is seen in sequence (with klists)
-// Returns number of kmers added to the graph
+// Same as above but don't add missing kmers or edges
 // Threadsafe
-static inline void add_ref_read_to_graph_mt(const read_t *r, size_t ref_col,
-                                            KONodeList *klists,
-                                            dBGraph *db_graph)
+static inline void seq_update_counts_find_mt(const char *seq, size_t ncount,
+                                             KONodeList *klists,
+                                             const dBGraph *db_graph)
 {
   const size_t kmer_size = db_graph->kmer_size;
-  size_t contig_start, contig_end, contig_len;
-  size_t search_start = 0;
-
-  if(r->seq.end < kmer_size) return;
-
-  while((contig_start = seq_contig_start(r, search_start, kmer_size,
-                                         0, 0)) < r->seq.end)
-  {
-    contig_end = seq_contig_end(r, contig_start, kmer_size, 0, 0, &search_start);
+  BinaryKmer bkmer = binary_kmer_from_str(seq, kmer_size);
+  hkey_t hkey;
+  size_t i;
 
-    contig_len = contig_end - contig_start;
-    add_ref_seq_to_graph_mt(r->seq.b+contig_start, contig_len,
-                            ref_col, klists, db_graph);
+  for(i = 0; i < ncount; i++) {
+    if(i > 0) {
+      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size,
+                                         dna_char_to_nuc(seq[i+kmer_size-1]));
+    }
+    hkey = hash_table_find(&db_graph->ht, bkmer);
+    if(hkey != HASH_NOT_FOUND)
+      __sync_fetch_and_add((volatile uint64_t*)&klists[hkey].kcount, 1); // kcount++
   }
 }
 
-// Same as above but don't add missing kmers
-// Threadsafe
-static inline void bkmer_update_counts_find_mt(BinaryKmer bkmer,
-                                               KONodeList *klists,
-                                               const dBGraph *db_graph)
-{
-  hkey_t hkey = hash_table_find(&db_graph->ht, bkmer);
-  if(hkey != HASH_NOT_FOUND)
-    __sync_fetch_and_add((volatile uint64_t*)&klists[hkey].kcount, 1); // kcount++
-}
-
 struct ReadUpdateCounts {
-  const read_t *r;
+  const read_t *reads;
+  const KOReadChunk *chunks;
   KONodeList *klists;
   bool add_missing_kmers;
   size_t ref_col; // only used if add_missing_kmers is true
   dBGraph *db_graph;
 };
 
-// Multithreaded core function to store kmer occurances
-// Also adds read to the graph if `add_missing_kmers` is true
-static void read_update_counts(void *arg, size_t threadid)
+// Multithreaded core function to count kmer occurances
+// Also adds reads to the graph if `add_missing_kmers` is true
+static bool chunks_update_counts(size_t start, size_t end, size_t threadid,
+                                 void *arg)
 {
   (void)threadid;
-  struct ReadUpdateCounts data = *(struct ReadUpdateCounts*)arg;
-  const read_t *r = data.r;
+  const struct ReadUpdateCounts *data = (const struct ReadUpdateCounts*)arg;
+  const size_t kmer_size = data->db_graph->kmer_size;
+  size_t i, nkmers, seqlen, search_start, cstart, clen, ncount;
+  const KOReadChunk *c;
+  const char *seq;
 
-  if(data.add_missing_kmers) {
-    add_ref_read_to_graph_mt(r, data.ref_col, data.klists, data.db_graph);
+  for(i = start; i < end; i++)
+  {
+    c = &data->chunks[i];
+    seq = data->reads[c->chrom].seq.b + c->start;
+    seqlen = MIN2(c->end+kmer_size, data->reads[c->chrom].seq.end) - c->start;
+    nkmers = c->end - c->start;
+    search_start = 0;
+
+    while(ko_chunk_contig(seq, seqlen, nkmers, kmer_size, &search_start,
+                          &cstart, &clen, &ncount))
+    {
+      if(data->add_missing_kmers) {
+        add_ref_seq_to_graph_mt(seq+cstart, clen, ncount, data->ref_col,
+                                data->klists, data->db_graph);
+      } else {
+        seq_update_counts_find_mt(seq+cstart, ncount,
+                                  data->klists, data->db_graph);
+      }
+    }
   }
-  else {
-    SeqLoadingStats stats;
-    memset(&stats, 0, sizeof(stats));
-    READ_TO_BKMERS(r, data.db_graph->kmer_size, 0, 0, &stats,
-                   bkmer_update_counts_find_mt, data.klists, data.db_graph);
+
+  return false;
+}
+
+// Threadsafe, entries of a kmer are stored in any order and sorted later
+static inline void seq_store_kmer_pos_mt(const char *seq, size_t ncount,
+                                         KONodeList *klists,
+                                         size_t chrom_id, uint64_t offset,
+                                         const dBGraph *db_graph)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  BinaryKmer bkmer = binary_kmer_from_str(seq, kmer_size);
+  dBNode node;
+  KOccur *ko;
+  size_t i;
+
+  for(i = 0; i < ncount; i++)
+  {
+    if(i > 0) {
+      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size,
+                                         dna_char_to_nuc(seq[i+kmer_size-1]));
+    }
+
+    // bkmers were already added to graph -> don't need to find_or_insert
+    // if missing kmers weren't added then kmer might be missing -> skip
+    node = db_graph_find(db_graph, bkmer);
+
+    if(node.key != HASH_NOT_FOUND)
+    {
+      // Atomic ops on pointers are not scaled by the size of the type
+      ko = __sync_fetch_and_add(&klists[node.key].first, sizeof(KOccur));
+      *ko = (KOccur){.chrom = chrom_id, .offset = offset+i,
+                     .orient = node.orient, .next = 1};
+    }
   }
 }
 
-static void bkmer_store_kmer_pos(BinaryKmer bkmer, KONodeList *klists,
-                                 size_t chrom_id, uint64_t offset,
-                                 const dBGraph *db_graph)
+struct ReadStorePos {
+  const read_t *reads;
+  const KOReadChunk *chunks;
+  KONodeList *klists;
+  const dBGraph *db_graph;
+};
+
+static bool chunks_store_kmer_pos(size_t start, size_t end, size_t threadid,
+                                  void *arg)
 {
-  // bkmers were already added to graph -> don't need to find_or_insert
-  // if missing kmers weren't added then kmer might be missing -> skip
-  dBNode node = db_graph_find(db_graph, bkmer);
+  (void)threadid;
+  const struct ReadStorePos *data = (const struct ReadStorePos*)arg;
+  const size_t kmer_size = data->db_graph->kmer_size;
+  size_t i, nkmers, seqlen, search_start, cstart, clen, ncount;
+  const KOReadChunk *c;
+  const char *seq;
 
-  if(node.key != HASH_NOT_FOUND)
+  for(i = start; i < end; i++)
   {
-    // set all next to 1, set last one in kmerlist to zero later
-    KONodeList *kl = &klists[node.key];
-    *kl->first = (KOccur){.chrom = chrom_id,
-                          .offset = offset,
-                          .orient = node.orient,
-                          .next = 1};
-    kl->first++;
+    c = &data->chunks[i];
+    seq = data->reads[c->chrom].seq.b + c->start;
+    seqlen = MIN2(c->end+kmer_size-1, data->reads[c->chrom].seq.end) - c->start;
+    nkmers = c->end - c->start;
+    search_start = 0;
+
+    while(ko_chunk_contig(seq, seqlen, nkmers, kmer_size, &search_start,
+                          &cstart, &clen, &ncount))
+    {
+      seq_store_kmer_pos_mt(seq+cstart, ncount, data->klists,
+                            c->chrom, c->start+cstart, data->db_graph);
+    }
   }
+
+  return false;
 }
 
-static void read_store_kmer_pos(const read_t *r, size_t chrom_id,
-                                KONodeList *klists, const dBGraph *db_graph)
+static inline bool koccur_lt(KOccur a, KOccur b)
 {
-  const size_t kmer_size = db_graph->kmer_size;
-  SeqLoadingStats stats;
-  memset(&stats, 0, sizeof(stats));
-  READ_TO_BKMERS(r, kmer_size, 0, 0, &stats, bkmer_store_kmer_pos,
-                 klists, chrom_id, _offset, db_graph);
+  return a.chrom < b.chrom || (a.chrom == b.chrom && a.offset < b.offset);
+}
+
+// Sort occurrences of each kmer by chromosome then offset,
+// set next on all but the last entry of each list
+static bool klists_sort(size_t start, size_t end, size_t threadid, void *arg)
+{
+  (void)threadid;
+  KONodeList *klists = (KONodeList*)arg;
+  KOccur *ko, tmp;
+  size_t i, j, n;
+
+  for(i = start; i < end; i++) {
+    if((ko = klists[i].first) == NULL) continue;
+    for(n = 1; ko[n-1].next; n++) {}
+    // insertion sort, lists are short and often already sorted
+    for(j = 1; j < n; j++) {
+      tmp = ko[j];
+      size_t k;
+      for(k = j; k > 0 && koccur_lt(tmp, ko[k-1]); k--) ko[k] = ko[k-1];
+      ko[k] = tmp;
+    }
+    for(j = 0; j+1 < n; j++) ko[j].next = 1;
+    ko[n-1].next = 0;
+  }
+
+  return false;
 }
 
 // Updates ginfo info add_missing_kmers is true
 static void load_reads_count_kmers(const read_t *reads, size_t num_reads,
+                                   const KOReadChunk *chunks, size_t nchunks,
                                    bool add_missing_kmers, size_t ref_col,
                                    size_t num_threads,
                                    KONodeList *klists,
@@ -262,23 +402,14 @@ static void load_reads_count_kmers(const read_t *reads, size_t num_reads,
   if(!num_reads) return;
 
   // 1. Loop through reads, add to graph and record kmer counts
-  struct ReadUpdateCounts *updates;
+  struct ReadUpdateCounts data = {.reads = reads, .chunks = chunks,
+                                  .klists = klists,
+                                  .add_missing_kmers = add_missing_kmers,
+                                  .ref_col = ref_col,
+                                  .db_graph = db_graph};
   size_t i;
 
-  updates = ctx_malloc(num_reads * sizeof(struct ReadUpdateCounts));
-
-  for(i = 0; i < num_reads; i++) {
-    updates[i] = (struct ReadUpdateCounts){.r = &reads[i],
-                                           .klists = klists,
-                                           .add_missing_kmers = add_missing_kmers,
-                                           .ref_col = ref_col,
-                                           .db_graph = db_graph};
-  }
-
-  util_run_threads(updates, num_reads, sizeof(struct ReadUpdateCounts),
-                   num_threads, read_update_counts);
-
-  ctx_free(updates);
+  util_run_ranges(nchunks, 4, num_threads, chunks_update_counts, &data);
 
   // Update ginfo
   if(add_missing_kmers) {
@@ -294,6 +425,56 @@ static void load_reads_count_kmers(const read_t *reads, size_t num_reads,
   }
 }
 
+// Lists are laid out with a parallel prefix sum: each thread counts the
+// occurrences in its block of the hash table, block offsets are summed, then
+// each thread sets the start of the lists in its block
+typedef struct {
+  KONodeList *klists;
+  KOccur *koccurs;
+  size_t capacity, nthreads;
+  uint64_t *blocks; // [nthreads] count then offset of each block
+} KOListLayout;
+
+#define kolayout_start(l,tid) ((tid)*(l)->capacity/(l)->nthreads)
+#define kolayout_end(l,tid)   (((tid)+1)*(l)->capacity/(l)->nthreads)
+
+static void klists_count_block(void *arg, size_t threadid)
+{
+  KOListLayout *l = (KOListLayout*)arg;
+  size_t i, end = kolayout_end(l, threadid);
+  uint64_t sum = 0;
+  for(i = kolayout_start(l, threadid); i < end; i++) sum += l->klists[i].kcount;
+  l->blocks[threadid] = sum;
+}
+
+static void klists_alloc_block(void *arg, size_t threadid)
+{
+  KOListLayout *l = (KOListLayout*)arg;
+  size_t i, end = kolayout_end(l, threadid);
+  uint64_t kcount, offset = l->blocks[threadid];
+  for(i = kolayout_start(l, threadid); i < end; i++) {
+    // kcount/start are in a union -- can't use both
+    kcount = l->klists[i].kcount;
+    l->klists[i].first = kcount ? l->koccurs + offset : NULL;
+    offset += kcount;
+  }
+}
+
+// After storing, each list pointer is at the end of its list
+// Reset pointers to point to the first item
+static void klists_reset_block(void *arg, size_t threadid)
+{
+  KOListLayout *l = (KOListLayout*)arg;
+  size_t i, end = kolayout_end(l, threadid);
+  KOccur *ptr = l->koccurs + l->blocks[threadid];
+  for(i = kolayout_start(l, threadid); i < end; i++) {
+    if(l->klists[i].first != NULL) {
+      (l->klists[i].first-1)->next = 0;
+      SWAP(l->klists[i].first, ptr);
+    }
+  }
+}
+
 /**
  * Create a KOGraph from given sequence reads
  * BEWARE: We add the reads to the graph if add_missing_kmers is true
@@ -332,17 +513,31 @@ KOGraph kograph_create(const read_t *reads, size_t num_reads,
 
   kograph.klists = ctx_calloc(db_graph->ht.capacity, sizeof(KONodeList));
 
+  size_t nchunks;
+  KOReadChunk *chunks = ko_read_chunks(reads, num_reads, db_graph->kmer_size,
+                                       &nchunks);
+
   // 1. Loop through reads, add to graph and record kmer counts
-  load_reads_count_kmers(reads, num_reads, add_missing_kmers, ref_col,
+  load_reads_count_kmers(reads, num_reads, chunks, nchunks,
+                         add_missing_kmers, ref_col,
                          num_threads, kograph.klists, db_graph);
 
-  status("[kograh] Consolidating annotations (single-threaded)");
+  status("[kograh] Consolidating annotations");
 
   // 2. allocate a list for each kmer (some of length zero)
-  uint64_t offset = 0, kcount, total_read_length = 0, total_kcount = 0;
-
-  for(i = 0; i < db_graph->ht.capacity; i++)
-    total_kcount += kograph.klists[i].kcount;
+  uint64_t total_read_length = 0, total_kcount = 0, cnt;
+  KOListLayout layout = {.klists = kograph.klists,
+                         .capacity = db_graph->ht.capacity,
+                         .nthreads = num_threads,
+                         .blocks = ctx_calloc(num_threads, sizeof(uint64_t))};
+
+  util_multi_thread(&layout, num_threads, klists_count_block);
+
+  for(i = 0; i < num_threads; i++) {
+    cnt = layout.blocks[i];
+    layout.blocks[i] = total_kcount;
+    total_kcount += cnt;
+  }
 
   // Sum lengths of reads
   for(i = 0; i < num_reads; i++)
@@ -353,44 +548,325 @@ KOGraph kograph_create(const read_t *reads, size_t num_reads,
   ctx_assert(total_read_length == 0 || total_kcount < total_read_length);
 
   kograph.koccurs = total_kcount ? ctx_malloc(total_kcount * sizeof(KOccur)) : NULL;
+  layout.koccurs = kograph.koccurs;
 
-  for(i = 0; i < db_graph->ht.capacity; i++)
-  {
-    // kcount/start are in a union -- can't use both
-    kcount = kograph.klists[i].kcount;
-    kograph.klists[i].first = kcount ? kograph.koccurs + offset : NULL;
-    offset += kcount;
-  }
+  util_multi_thread(&layout, num_threads, klists_alloc_block);
 
   // Don't refer to klists[].kcount now -- only use klists[].start
 
   // 3. Loop through reads, record kmer pos
-  //    Don't multithread this section, since we want reads to be added in order
-  //    of read, and position in the read.
+  //    Threads claim slots in each kmer's list, lists are sorted into order
+  //    of read then position in the read below.
   if(total_kcount > 0) {
-    for(i = 0; i < num_reads; i++) {
-      read_store_kmer_pos(&reads[i], i, kograph.klists, db_graph);
-    }
+    struct ReadStorePos data = {.reads = reads, .chunks = chunks,
+                                .klists = kograph.klists,
+                                .db_graph = db_graph};
+    util_run_ranges(nchunks, 4, num_threads, chunks_store_kmer_pos, &data);
   }
 
+  ctx_free(chunks);
+
   // 4. Rest pointers to point to the first item
-  KOccur *ptr = kograph.koccurs;
-  for(i = 0; i < db_graph->ht.capacity; i++) {
-    if(kograph.klists[i].first != NULL) {
-      (kograph.klists[i].first-1)->next = 0;
-      SWAP(kograph.klists[i].first, ptr);
-    }
-  }
+  util_multi_thread(&layout, num_threads, klists_reset_block);
+  ctx_free(layout.blocks);
+
+  status("[kograh] Sorting annotations with %zu thread%s",
+         num_threads, util_plural_str(num_threads));
+
+  util_run_ranges(db_graph->ht.capacity, 1<<16, num_threads,
+                  klists_sort, kograph.klists);
 
   return kograph;
 }
 
 void kograph_dealloc(KOGraph *kograph)
 {
+  if(kograph->mmap_ptr != NULL) munmap(kograph->mmap_ptr, kograph->mmap_len);
+  else ctx_free(kograph->koccurs);
   ctx_free(kograph->chrom_name_buf);
   ctx_free(kograph->chroms);
   ctx_free(kograph->klists);
-  ctx_free(kograph->koccurs);
+}
+
+#define kograph_index_pad(n) (((n)+7) & ~(size_t)7)
+
+#define kograph_index_hdr_bytes \
+        (strlen(KOGRAPH_INDEX_MAGIC) + 4*sizeof(uint32_t) + 4*sizeof(uint64_t))
+
+// Reference edges of a kmer from the bases either side of its occurrences
+static Edges kograph_ref_edges(const KOccur *ko, const read_t *reads,
+                               size_t kmer_size)
+{
+  Edges edges = 0;
+  const read_t *r;
+  char c;
+
+  for(; ; ko++) {
+    r = &reads[ko->chrom];
+    if(ko->offset+kmer_size < r->seq.end) {
+      c = r->seq.b[ko->offset+kmer_size];
+      if(char_is_acgt(c))
+        edges |= nuc_orient_to_edge(dna_char_to_nuc(c), ko->orient);
+    }
+    if(ko->offset > 0) {
+      c = r->seq.b[ko->offset-1];
+      if(char_is_acgt(c))
+        edges |= nuc_orient_to_edge(dna_nuc_complement(dna_char_to_nuc(c)),
+                                    !ko->orient);
+    }
+    if(!ko->next) break;
+  }
+
+  return edges;
+}
+
+/**
+ * Write index of a KOGraph created from `reads` with kograph_create()
+ * `path` is only used for error messages
+ * @return number of bytes written
+ **/
+size_t kograph_write(const KOGraph *kograph,
+                     const read_t *reads, size_t num_reads,
+                     const dBGraph *db_graph, FILE *fout, const char *path)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  uint32_t version = KOGRAPH_INDEX_VERSION, zero = 0;
+  uint32_t ksize = kmer_size, kmer_words = NUM_BKMER_WORDS;
+  uint64_t nchroms = kograph->nchroms, nkmers = 0, nkoccurs = 0, names_len = 0;
+  uint64_t len;
+  size_t i, n, nbytes = 0;
+  const KOccur *ko;
+  KOIndexKmer entry;
+
+  ctx_assert(num_reads == kograph->nchroms);
+  (void)num_reads;
+
+  for(i = 0; i < db_graph->ht.capacity; i++) {
+    if((ko = kograph->klists[i].first) != NULL) {
+      nkmers++;
+      for(n = 1; ko[n-1].next; n++) {}
+      nkoccurs += n;
+    }
+  }
+
+  for(i = 0; i < kograph->nchroms; i++)
+    names_len += strlen(kograph->chroms[i].name) + 1;
+  names_len = kograph_index_pad(names_len);
+
+  nbytes += fwrite(KOGRAPH_INDEX_MAGIC, 1, strlen(KOGRAPH_INDEX_MAGIC), fout);
+  nbytes += fwrite(&version,    1, sizeof(version),    fout);
+  nbytes += fwrite(&ksize,      1, sizeof(ksize),      fout);
+  nbytes += fwrite(&kmer_words, 1, sizeof(kmer_words), fout);
+  nbytes += fwrite(&zero,       1, sizeof(zero),       fout);
+  nbytes += fwrite(&nchroms,    1, sizeof(nchroms),    fout);
+  nbytes += fwrite(&nkmers,     1, sizeof(nkmers),     fout);
+  nbytes += fwrite(&nkoccurs,   1, sizeof(nkoccurs),   fout);
+  nbytes += fwrite(&names_len,  1, sizeof(names_len),  fout);
+
+  for(i = 0; i < kograph->nchroms; i++) {
+    len = kograph->chroms[i].length;
+    nbytes += fwrite(&len, 1, sizeof(len), fout);
+  }
+
+  const char padding[8] = {0};
+  size_t names_end = 0;
+  for(i = 0; i < kograph->nchroms; i++) {
+    n = strlen(kograph->chroms[i].name) + 1;
+    nbytes += fwrite(kograph->chroms[i].name, 1, n, fout);
+    names_end += n;
+  }
+  nbytes += fwrite(padding, 1, names_len - names_end, fout);
+
+  // Kmers in hash table order, each followed by the offset of its occurrences
+  uint64_t offset = 0;
+  for(i = 0; i < db_graph->ht.capacity; i++) {
+    if((ko = kograph->klists[i].first) != NULL) {
+      for(n = 1; ko[n-1].next; n++) {}
+      memset(&entry, 0, sizeof(entry));
+      entry.bkey = db_node_get_bkey(db_graph, i);
+      entry.offset = offset;
+      entry.edges = kograph_ref_edges(ko, reads, kmer_size);
+      nbytes += fwrite(&entry, 1, sizeof(entry), fout);
+      offset += n;
+    }
+  }
+
+  for(i = 0; i < db_graph->ht.capacity; i++) {
+    if((ko = kograph->klists[i].first) != NULL) {
+      for(n = 1; ko[n-1].next; n++) {}
+      nbytes += fwrite(ko, sizeof(KOccur), n, fout) * sizeof(KOccur);
+    }
+  }
+
+  size_t expbytes = kograph_index_hdr_bytes + nchroms * sizeof(uint64_t) +
+                    names_len + nkmers * sizeof(KOIndexKmer) +
+                    nkoccurs * sizeof(KOccur);
+
+  if(nbytes != expbytes)
+    die("Cannot write to file: %s", futil_outpath_str(path));
+
+  return nbytes;
+}
+
+static bool kograph_read_header(FILE *fin, KOIndexHeader *hdr)
+{
+  char magic[sizeof(KOGRAPH_INDEX_MAGIC)];
+  uint32_t zero;
+  magic[sizeof(magic)-1] = '\0';
+  return (fread(magic, 1, sizeof(magic)-1, fin) == sizeof(magic)-1 &&
+          strcmp(magic, KOGRAPH_INDEX_MAGIC) == 0 &&
+          fread(&hdr->version,    1, sizeof(uint32_t), fin) == sizeof(uint32_t) &&
+          fread(&hdr->kmer_size,  1, sizeof(uint32_t), fin) == sizeof(uint32_t) &&
+          fread(&hdr->kmer_words, 1, sizeof(uint32_t), fin) == sizeof(uint32_t) &&
+          fread(&zero,            1, sizeof(uint32_t), fin) == sizeof(uint32_t) &&
+          fread(&hdr->nchroms,    1, sizeof(uint64_t), fin) == sizeof(uint64_t) &&
+          fread(&hdr->nkmers,     1, sizeof(uint64_t), fin) == sizeof(uint64_t) &&
+          fread(&hdr->nkoccurs,   1, sizeof(uint64_t), fin) == sizeof(uint64_t) &&
+          fread(&hdr->names_len,  1, sizeof(uint64_t), fin) == sizeof(uint64_t));
+}
+
+// Read header of an index file, dies if it is not an index file
+void kograph_load_header(const char *path, KOIndexHeader *hdr)
+{
+  FILE *fin = futil_fopen(path, "r");
+  if(!kograph_read_header(fin, hdr))
+    die("Not a kmer occurrence index file: %s", path);
+  fclose(fin);
+
+  if(hdr->version != KOGRAPH_INDEX_VERSION)
+    die("Kmer occurrence index version %u not supported: %s",
+        hdr->version, path);
+  if(hdr->kmer_words != NUM_BKMER_WORDS || hdr->names_len % 8 != 0)
+    die("Kmer occurrence index compiled for a different maxk: %s", path);
+}
+
+typedef struct {
+  const KOIndexKmer *kmers;
+  KOGraph *kograph;
+  bool add_edges;
+  size_t ref_col;
+  dBGraph *db_graph;
+} KOGraphLoader;
+
+static bool kograph_load_add_kmers(size_t start, size_t end, size_t threadid,
+                                   void *arg)
+{
+  (void)threadid;
+  const KOGraphLoader *ldr = (const KOGraphLoader*)arg;
+  dBGraph *db_graph = ldr->db_graph;
+  dBNode node;
+  bool found;
+  size_t i;
+
+  for(i = start; i < end; i++) {
+    node = db_graph_find_or_add_key_mt(db_graph, ldr->kmers[i].bkey,
+                                       FORWARD, &found);
+    db_graph_update_node_mt(db_graph, node, ldr->ref_col);
+    if(ldr->add_edges && db_graph->col_edges != NULL)
+      (void)__sync_or_and_fetch(&db_node_edges(db_graph, node.key, 0),
+                                (Edges)ldr->kmers[i].edges);
+  }
+
+  return false;
+}
+
+// Called after all kmers are added, when hash table positions are final
+static bool kograph_load_set_lists(size_t start, size_t end, size_t threadid,
+                                   void *arg)
+{
+  (void)threadid;
+  const KOGraphLoader *ldr = (const KOGraphLoader*)arg;
+  KOGraph *kograph = ldr->kograph;
+  hkey_t hkey;
+  size_t i;
+
+  for(i = start; i < end; i++) {
+    hkey = hash_table_find(&ldr->db_graph->ht, ldr->kmers[i].bkey);
+    ctx_assert(hkey != HASH_NOT_FOUND);
+    kograph->klists[hkey].first = kograph->koccurs + ldr->kmers[i].offset;
+  }
+
+  return false;
+}
+
+/**
+ * Load an index written with kograph_write(), memory mapping the file
+ * Kmers are added to the graph in colour ref_col, as kograph_create() does
+ * @param add_edges If true, add reference edges to the graph
+ **/
+KOGraph kograph_load(const char *path, bool add_edges, size_t ref_col,
+                     size_t num_threads, dBGraph *db_graph)
+{
+  KOIndexHeader hdr;
+  size_t i, nbytes;
+
+  kograph_load_header(path, &hdr);
+
+  if(hdr.kmer_size != db_graph->kmer_size)
+    die("Kmer occurrence index kmer size %u does not match graph (%zu): %s",
+        hdr.kmer_size, db_graph->kmer_size, path);
+  if(hdr.nchroms > KMER_OCCUR_MAX_CHROMS)
+    die("Corrupt kmer occurrence index file: %s", path);
+
+  size_t chroms_off = kograph_index_hdr_bytes;
+  size_t names_off = chroms_off + hdr.nchroms * sizeof(uint64_t);
+  size_t kmers_off = names_off + hdr.names_len;
+  size_t koccurs_off = kmers_off + hdr.nkmers * sizeof(KOIndexKmer);
+  nbytes = koccurs_off + hdr.nkoccurs * sizeof(KOccur);
+
+  status("[kograph] Loading index of %zu kmers, %zu occurrences from: %s",
+         (size_t)hdr.nkmers, (size_t)hdr.nkoccurs, path);
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) die("Cannot open file: %s", path);
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size != nbytes)
+    die("Corrupt kmer occurrence index file: %s", path);
+
+  uint8_t *mem = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(mem == MAP_FAILED) die("Cannot memory map file: %s", path);
+  close(fd);
+
+  KOGraph kograph;
+  memset(&kograph, 0, sizeof(KOGraph));
+  kograph.mmap_ptr = mem;
+  kograph.mmap_len = nbytes;
+  kograph.koccurs = (KOccur*)(mem + koccurs_off);
+  kograph.nchroms = hdr.nchroms;
+  kograph.chroms = ctx_malloc(MAX2(hdr.nchroms, 1) * sizeof(KOChrom));
+
+  const uint64_t *lengths = (const uint64_t*)(mem + chroms_off);
+  const char *name = (const char*)(mem + names_off);
+  const char *names_end = name + hdr.names_len;
+  SeqLoadingStats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  if(hdr.nchroms > 0 && names_end[-1] != '\0')
+    die("Corrupt kmer occurrence index file: %s", path);
+
+  for(i = 0; i < hdr.nchroms; i++) {
+    if(name >= names_end) die("Corrupt kmer occurrence index file: %s", path);
+    kograph.chroms[i] = (KOChrom){.id = i, .length = lengths[i], .name = name};
+    name += strlen(name) + 1;
+    stats.total_bases_read += lengths[i];
+  }
+
+  KOGraphLoader ldr = {.kmers = (const KOIndexKmer*)(mem + kmers_off),
+                       .kograph = &kograph, .add_edges = add_edges,
+                       .ref_col = ref_col, .db_graph = db_graph};
+
+  util_run_ranges(hdr.nkmers, 1<<14, num_threads, kograph_load_add_kmers, &ldr);
+
+  kograph.klists = ctx_calloc(db_graph->ht.capacity, sizeof(KONodeList));
+  util_run_ranges(hdr.nkmers, 1<<14, num_threads, kograph_load_set_lists, &ldr);
+
+  // Update ginfo
+  stats.num_se_reads = stats.contigs_parsed = hdr.nchroms;
+  stats.total_bases_loaded = stats.total_bases_read;
+  graph_info_update_stats(&db_graph->ginfo[ref_col], &stats);
+
+  return kograph;
 }
 
 
@@ -423,6 +899,22 @@ static size_t korun_extend(KOccurRun *koruns, size_t nruns,
       starti++;
     }
 
+    if(starti == nruns) {
+      // No runs left to extend, start a run at each remaining occurrence
+      for(; pickup; kolist++) {
+        strand = kolist->orient == node.orient ? STRAND_PLUS : STRAND_MINUS;
+        korun_buf_add(new_koruns,
+                         (KOccurRun){.chrom = kolist->chrom,
+                                     .first = kolist->offset,
+                                     .last = kolist->offset,
+                                     .qoffset = qoffset,
+                                     .strand = strand,
+                                     .used = false});
+        if(!kolist->next) break;
+      }
+      break;
+    }
+
     used = false;
     strand = kolist->orient == node.orient ? STRAND_PLUS : STRAND_MINUS;
 
@@ -499,7 +991,7 @@ void kograph_filter_extend(const KOGraph *kograph,
 {
   const KOccur *kolist;
   size_t i, j;
-  dBNode node;
+  dBNode node, next;
 
   KOccurRunBuffer *runs0 = korun, *runs1 = koruns_tmp;
 
@@ -507,6 +999,17 @@ void kograph_filter_extend(const KOGraph *kograph,
   {
     node = db_nodes_get(nodes, num_nodes, forward, i);
     kolist = kograph_get(kograph, node.key);
+
+    // Prefetch the list head two nodes ahead and the list of the next node
+    if(i+2 < num_nodes) {
+      next = db_nodes_get(nodes, num_nodes, forward, i+2);
+      __builtin_prefetch(&kograph->klists[next.key], 0, 1);
+    }
+    if(i+1 < num_nodes) {
+      next = db_nodes_get(nodes, num_nodes, forward, i+1);
+      __builtin_prefetch(kograph_get(kograph, next.key), 0, 1);
+    }
+
     korun_buf_reset(runs1);
     korun_extend(runs0->b, runs0->len, node, kolist, runs1, true, qoffset+i);
 
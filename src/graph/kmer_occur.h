@@ -16,6 +16,9 @@
 #define KMER_OCCUR_MAX_CHROMS (1U<<30)
 #define KMER_OCCUR_MAX_LEN (1UL<<32)
 
+// Reads are loaded in chunks of this many kmers (one chunk per thread)
+#define KOGRAPH_CHUNK_KMERS (1UL<<18)
+
 typedef struct {
   size_t id, length;
   const char *name;
@@ -39,8 +42,42 @@ typedef struct
   KONodeList *klists; // one entry per hash entry
   size_t nchroms;
   char *chrom_name_buf;
+  // If loaded from an index file, koccurs and chrom names point into the file
+  void *mmap_ptr;
+  size_t mmap_len;
 } KOGraph;
 
+//
+// Index file format, to reuse a KOGraph between runs.
+// Everything is 8 byte aligned so the file can be memory mapped:
+//
+//   "CTXKOIDX"<uint32_t:version><uint32_t:kmer_size><uint32_t:kmer_words>
+//   <uint32_t:zero><uint64_t:nchroms><uint64_t:nkmers><uint64_t:nkoccurs>
+//   <uint64_t:names_len>
+//   [<uint64_t:chrom length>]*nchroms
+//   <names: '\0' separated, zero padded to names_len bytes>
+//   [KOIndexKmer]*nkmers
+//   [KOccur]*nkoccurs, occurrences of a kmer are contiguous and in order
+//
+// Hash table positions are not kept between runs, kmers are stored and looked
+// up on load. Edges are those of the reference sequence.
+//
+
+#define KOGRAPH_INDEX_MAGIC "CTXKOIDX"
+#define KOGRAPH_INDEX_VERSION 1
+
+typedef struct
+{
+  BinaryKmer bkey;
+  uint64_t offset:56, edges:8; // offset is index of first KOccur
+} KOIndexKmer;
+
+typedef struct
+{
+  uint32_t version, kmer_size, kmer_words;
+  uint64_t nchroms, nkmers, nkoccurs, names_len;
+} KOIndexHeader;
+
 typedef struct {
   uint64_t first, last; // 0-bases chromosome coordinates
   uint32_t qoffset, chrom; // qoffset some query offset
@@ -65,6 +102,26 @@ KOGraph kograph_create(const read_t *reads, size_t num_reads,
 
 void kograph_dealloc(KOGraph *kograph);
 
+/**
+ * Write index of a KOGraph created from `reads` with kograph_create()
+ * `path` is only used for error messages
+ * @return number of bytes written
+ **/
+size_t kograph_write(const KOGraph *kograph,
+                     const read_t *reads, size_t num_reads,
+                     const dBGraph *db_graph, FILE *fout, const char *path);
+
+// Read header of an index file, dies if it is not an index file
+void kograph_load_header(const char *path, KOIndexHeader *hdr);
+
+/**
+ * Load an index written with kograph_write(), memory mapping the file
+ * Kmers are added to the graph in colour ref_col, as kograph_create() does
+ * @param add_edges If true, add reference edges to the graph
+ **/
+KOGraph kograph_load(const char *path, bool add_edges, size_t ref_col,
+                     size_t num_threads, dBGraph *db_graph);
+
 // Get KOccur* to first occurance of a kmer in sequence
 #define kograph_get(kograph,hkey) ((kograph)->klists[hkey].first)
 
@@ -100,13 +157,14 @@ void korun_print(KOccurRun run, size_t kmer_size, FILE *fout);
 // Mostly used for debugging
 void koruns_print(const KOccurRun *run, size_t n, size_t kmer_size, FILE *fout);
 
-void korun_gzprint(gzFile gzout, size_t kmer_size,
-                   const KOGraph *kograph, KOccurRun korun,
-                   size_t first_kmer_idx, size_t kmer_offset);
+// Append to sbuf
+void korun_sbuf(StrBuf *sbuf, size_t kmer_size,
+                const KOGraph *kograph, KOccurRun korun,
+                size_t first_kmer_idx, size_t kmer_offset);
 
-void koruns_gzprint(gzFile gzout, size_t kmer_size, const KOGraph *kograph,
-                    const KOccurRun *koruns, size_t n,
-                    size_t first_kmer_idx, size_t kmer_offset);
+void koruns_sbuf(StrBuf *sbuf, size_t kmer_size, const KOGraph *kograph,
+                 const KOccurRun *koruns, size_t n,
+                 size_t first_kmer_idx, size_t kmer_offset);
 
 // src, dst can point to the same place
 // returns number of elements added
@@ -65,6 +65,7 @@ int prune_edges_to_nodes_lacking_flag(hkey_t hkey, const uint8_t *flags,
 
   for(col = 0; col < db_graph->num_edge_cols; col++)
     db_node_edges(db_graph, hkey, col) &= keep_edges;
+  if(db_graph->union_edges != NULL) db_graph->union_edges[hkey] &= keep_edges;
 
   return 0; // => keep iterating
 }
@@ -123,7 +124,10 @@ void prune_nodes_lacking_flag(size_t nthreads, const uint8_t *flags,
 }
 
 // Remove all edges in the graph that connect to the given node
-static void prune_connecting_edges(dBGraph *db_graph, hkey_t hkey)
+// Neighbours with a bit set in `skip` are left alone, others are added to `nbrs`
+// Threadsafe: edges are cleared with atomic ops
+void prune_connecting_edges_mt(dBGraph *db_graph, hkey_t hkey,
+                               const uint8_t *skip, dBNodeBuffer *nbrs)
 {
   Edges uedges = db_node_get_edges_union(db_graph, hkey);
   BinaryKmer bkmer = db_node_get_bkey(db_graph, hkey);
@@ -155,12 +159,24 @@ static void prune_connecting_edges(dBGraph *db_graph, hkey_t hkey)
 
         // Sanity test
         ctx_assert(next_node.key != HASH_NOT_FOUND);
+
         ctx_check(next_node.key == hkey ||
           (db_node_get_edges_union(db_graph, next_node.key) & remove_edge_mask)
             == remove_edge_mask);
 
-        for(col = 0; col < db_graph->num_edge_cols; col++)
-          db_node_edges(db_graph, next_node.key, col) &= ~remove_edge_mask;
+        if(skip != NULL && bitset_get_mt(skip, next_node.key)) continue;
+
+        for(col = 0; col < db_graph->num_edge_cols; col++) {
+          __sync_fetch_and_and(&db_node_edges(db_graph, next_node.key, col),
+                               (Edges)~remove_edge_mask);
+        }
+        if(db_graph->union_edges != NULL) {
+          __sync_fetch_and_and(&db_graph->union_edges[next_node.key],
+                               (Edges)~remove_edge_mask);
+        }
+
+        if(nbrs != NULL && next_node.key != hkey)
+          db_node_buf_add(nbrs, next_node);
       }
     }
   }
@@ -168,7 +184,7 @@ static void prune_connecting_edges(dBGraph *db_graph, hkey_t hkey)
 
 void prune_node(dBGraph *db_graph, hkey_t hkey)
 {
-  prune_connecting_edges(db_graph, hkey);
+  prune_connecting_edges_mt(db_graph, hkey, NULL, NULL);
   prune_node_without_edges_mt(db_graph, hkey);
 }
 
@@ -178,8 +194,8 @@ void prune_unitig(dBNode *nodes, size_t len, dBGraph *db_graph)
   if(len == 0) return;
 
   // Remove connecting nodes to first and last nodes
-  prune_connecting_edges(db_graph, nodes[0].key);
-  if(len > 1) prune_connecting_edges(db_graph, nodes[len-1].key);
+  prune_connecting_edges_mt(db_graph, nodes[0].key, NULL, NULL);
+  if(len > 1) prune_connecting_edges_mt(db_graph, nodes[len-1].key, NULL, NULL);
 
   for(i = 0; i < len; i++)
     prune_node_without_edges_mt(db_graph, nodes[i].key);
@@ -13,6 +13,13 @@ void prune_node_without_edges_mt(dBGraph *db_graph, hkey_t hkey);
 
 void prune_node(dBGraph *db_graph, hkey_t node);
 
+// Remove edges from neighbours of `hkey` to `hkey`. Neighbours with a bit set
+// in `skip` are not edited. Edited neighbours are added to `nbrs`.
+// `skip` and `nbrs` may be NULL.
+// Threadsafe as long as no nodes are being added or removed
+void prune_connecting_edges_mt(dBGraph *db_graph, hkey_t hkey,
+                               const uint8_t *skip, dBNodeBuffer *nbrs);
+
 // Unitig pruning used by ctx_clean
 void prune_unitig(dBNode *nodes, size_t len, dBGraph *db_graph);
 
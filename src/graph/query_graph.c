@@ -0,0 +1,347 @@
+#include "global.h"
+#include "query_graph.h"
+#include "db_node.h"
+#include "util.h"
+#include "file_util.h"
+#include "kmer_mixhash.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define QG_SEED 0x51ae
+#define QG_FPRINT_SEED (QG_SEED + QG_MAX_LEVELS)
+#define QG_RANK_WORDS 8 /* one rank count per 512 bits */
+
+#define qg_pad(n) (((n)+7) & ~(size_t)7)
+
+// magic, 4 x uint32, 5 x uint64, level words
+#define QG_HDR_BYTES (strlen(QUERY_GRAPH_MAGIC) + 4*sizeof(uint32_t) + \
+                      (5 + QG_MAX_LEVELS) * sizeof(uint64_t))
+
+// Offsets of arrays from the start of the file / memory
+typedef struct
+{
+  size_t nwords, bits, ranks, fallback, fprints, edges, covgs, len;
+} QGLayout;
+
+static void qg_layout(const QueryGraph *qg, QGLayout *ly)
+{
+  size_t l, nwords = 0;
+  for(l = 0; l < qg->nlevels; l++) nwords += qg->level_bits[l] / 64;
+  ly->nwords   = nwords;
+  ly->bits     = QG_HDR_BYTES;
+  ly->ranks    = ly->bits + nwords * sizeof(uint64_t);
+  ly->fallback = ly->ranks +
+                 (nwords+QG_RANK_WORDS-1)/QG_RANK_WORDS * sizeof(uint64_t);
+  ly->fprints  = ly->fallback + qg->nfallback * sizeof(BinaryKmer);
+  ly->edges    = qg_pad(ly->fprints + qg->num_kmers * sizeof(uint32_t));
+  ly->covgs    = qg_pad(ly->edges + qg->num_kmers * qg->num_edge_cols * sizeof(Edges));
+  ly->len      = qg_pad(ly->covgs + qg->num_kmers * qg->num_of_cols * sizeof(CovgStore));
+}
+
+static void qg_set_arrays(QueryGraph *qg, const QGLayout *ly)
+{
+  const uint8_t *mem = (const uint8_t*)qg->mem;
+  qg->bits     = (const uint64_t*)(mem + ly->bits);
+  qg->ranks    = (const uint64_t*)(mem + ly->ranks);
+  qg->fallback = (const BinaryKmer*)(mem + ly->fallback);
+  qg->fprints  = (const uint32_t*)(mem + ly->fprints);
+  qg->edges    = (const Edges*)(mem + ly->edges);
+  qg->covgs    = (const CovgStore*)(mem + ly->covgs);
+  qg->mem_len  = ly->len;
+}
+
+static inline uint64_t qg_level_pos(BinaryKmer bkey, size_t level, size_t nbits)
+{
+  return bkmix_hash64(bkey, QG_SEED + level) % nbits;
+}
+
+static inline uint32_t qg_fprint(BinaryKmer bkey)
+{
+  return (uint32_t)(bkmix_hash64(bkey, QG_FPRINT_SEED) >> 32);
+}
+
+#define qg_bit(arr,i) (((arr)[(i)/64] >> ((i)%64)) & 1)
+#define qg_bit_set(arr,i) ((arr)[(i)/64] |= 1UL << ((i)%64))
+
+// Number of set bits before bit `pos`
+static inline uint64_t qg_rank(const QueryGraph *qg, uint64_t pos)
+{
+  size_t w = pos / 64, i = w - w % QG_RANK_WORDS;
+  uint64_t r = qg->ranks[w / QG_RANK_WORDS];
+  for(; i < w; i++) r += (uint64_t)__builtin_popcountll(qg->bits[i]);
+  return r + (uint64_t)__builtin_popcountll(qg->bits[w] & ((1UL << (pos%64))-1));
+}
+
+// Minimal perfect hash index, undefined for kmers not in the graph
+static inline uint64_t qg_mphf(const QueryGraph *qg, BinaryKmer bkey)
+{
+  size_t l, off = 0;
+  uint64_t pos;
+
+  for(l = 0; l < qg->nlevels; l++) {
+    pos = off + qg_level_pos(bkey, l, qg->level_bits[l]);
+    if(qg_bit(qg->bits, pos)) return qg_rank(qg, pos);
+    off += qg->level_bits[l];
+  }
+
+  const BinaryKmer *ptr = bsearch(&bkey, qg->fallback, qg->nfallback,
+                                  sizeof(BinaryKmer), binary_kmers_qcmp);
+  return ptr == NULL ? QG_NOT_FOUND : qg->nranked + (ptr - qg->fallback);
+}
+
+uint64_t query_graph_find(const QueryGraph *qg, BinaryKmer bkey)
+{
+  uint64_t idx = qg_mphf(qg, bkey);
+  if(idx >= qg->num_kmers || qg->fprints[idx] != qg_fprint(bkey))
+    return QG_NOT_FOUND;
+  return idx;
+}
+
+void query_graph_find_batch(const QueryGraph *qg, const BinaryKmer *bkeys,
+                            size_t n, uint64_t *idxs)
+{
+  size_t i;
+  uint64_t pos;
+
+  if(qg->nlevels == 0) {
+    for(i = 0; i < n; i++) idxs[i] = query_graph_find(qg, bkeys[i]);
+    return;
+  }
+
+  for(i = 0; i < n; i++) {
+    if(i + HT_PREFETCH_DEPTH < n) {
+      pos = qg_level_pos(bkeys[i+HT_PREFETCH_DEPTH], 0, qg->level_bits[0]);
+      __builtin_prefetch(&qg->bits[pos/64], 0, 0);
+    }
+    idxs[i] = query_graph_find(qg, bkeys[i]);
+  }
+}
+
+// Place `nkeys` kmers in `level`, moving kmers that collide to the start of
+// `keys`. Returns bit array of the level and the number of kmers not placed.
+static uint64_t* qg_build_level(BinaryKmer *keys, size_t *nkeys, size_t level,
+                                size_t nbits, uint64_t *collisions)
+{
+  size_t i, j, nwords = nbits / 64;
+  uint64_t pos, *bits = ctx_calloc(nwords, sizeof(uint64_t));
+  memset(collisions, 0, nwords * sizeof(uint64_t));
+
+  for(i = 0; i < *nkeys; i++) {
+    pos = qg_level_pos(keys[i], level, nbits);
+    if(qg_bit(bits, pos)) qg_bit_set(collisions, pos);
+    else qg_bit_set(bits, pos);
+  }
+
+  for(i = j = 0; i < *nkeys; i++) {
+    pos = qg_level_pos(keys[i], level, nbits);
+    if(qg_bit(collisions, pos)) keys[j++] = keys[i];
+  }
+
+  for(i = 0; i < nwords; i++) bits[i] &= ~collisions[i];
+
+  *nkeys = j;
+  return bits;
+}
+
+static void qg_write_hdr(const QueryGraph *qg)
+{
+  uint8_t *ptr = (uint8_t*)qg->mem;
+  uint32_t u32[4] = {QUERY_GRAPH_VERSION, qg->kmer_size,
+                     NUM_BKMER_WORDS, sizeof(CovgStore)};
+  uint64_t u64[5 + QG_MAX_LEVELS] = {qg->num_of_cols, qg->num_edge_cols,
+                                     qg->num_kmers, qg->nlevels, qg->nfallback};
+  size_t l;
+  for(l = 0; l < QG_MAX_LEVELS; l++) u64[5+l] = qg->level_bits[l] / 64;
+
+  memcpy(ptr, QUERY_GRAPH_MAGIC, strlen(QUERY_GRAPH_MAGIC));
+  ptr += strlen(QUERY_GRAPH_MAGIC);
+  memcpy(ptr, u32, sizeof(u32));
+  memcpy(ptr + sizeof(u32), u64, sizeof(u64));
+}
+
+void query_graph_build(QueryGraph *qg, const dBGraph *db_graph)
+{
+  ctx_assert(db_graph->col_edges != NULL);
+  ctx_assert(db_graph->col_covgs != NULL);
+
+  const size_t ncols = db_graph->num_of_cols, nedgecols = db_graph->num_edge_cols;
+  size_t i, l, nkeys = 0, nwords, off;
+  hkey_t hkey;
+
+  memset(qg, 0, sizeof(*qg));
+  qg->kmer_size = db_graph->kmer_size;
+  qg->num_of_cols = ncols;
+  qg->num_edge_cols = nedgecols;
+  qg->num_kmers = db_graph->ht.num_kmers;
+
+  BinaryKmer *keys = ctx_calloc(MAX2(qg->num_kmers, 1), sizeof(BinaryKmer));
+  for(hkey = 0; hkey < db_graph->ht.capacity; hkey++)
+    if(db_graph_node_assigned(db_graph, hkey))
+      keys[nkeys++] = db_node_get_bkey(db_graph, hkey);
+
+  ctx_assert(nkeys == qg->num_kmers);
+
+  // Levels: first level is the largest
+  uint64_t *levels[QG_MAX_LEVELS];
+  nwords = MAX2((QG_GAMMA * nkeys + 63) / 64, 1);
+  uint64_t *collisions = ctx_calloc(nwords, sizeof(uint64_t));
+
+  for(l = 0; l < QG_MAX_LEVELS && nkeys > 0; l++) {
+    nwords = MAX2((QG_GAMMA * nkeys + 63) / 64, 1);
+    qg->level_bits[l] = nwords * 64;
+    levels[l] = qg_build_level(keys, &nkeys, l, qg->level_bits[l], collisions);
+  }
+  qg->nlevels = l;
+  qg->nfallback = nkeys;
+  qg->nranked = qg->num_kmers - nkeys;
+  ctx_free(collisions);
+
+  // Copy into one block laid out as the file
+  QGLayout ly;
+  qg_layout(qg, &ly);
+  qg->mem = ctx_calloc(ly.len, 1);
+  qg_set_arrays(qg, &ly);
+  qg_write_hdr(qg);
+
+  uint64_t *bits = (uint64_t*)qg->bits, *ranks = (uint64_t*)qg->ranks;
+  for(l = off = 0; l < qg->nlevels; l++) {
+    memcpy(bits + off, levels[l], qg->level_bits[l] / 8);
+    off += qg->level_bits[l] / 64;
+    ctx_free(levels[l]);
+  }
+
+  uint64_t r = 0;
+  for(i = 0; i < ly.nwords; i++) {
+    if(i % QG_RANK_WORDS == 0) ranks[i / QG_RANK_WORDS] = r;
+    r += (uint64_t)__builtin_popcountll(bits[i]);
+  }
+  ctx_assert2(r == qg->nranked, "%zu vs %zu", (size_t)r, qg->nranked);
+
+  qsort(keys, qg->nfallback, sizeof(BinaryKmer), binary_kmers_qcmp);
+  memcpy((BinaryKmer*)qg->fallback, keys, qg->nfallback * sizeof(BinaryKmer));
+  ctx_free(keys);
+
+  // Fill fingerprints, edges and coverages by kmer index
+  uint32_t *fprints = (uint32_t*)qg->fprints;
+  Edges *edges = (Edges*)qg->edges;
+  CovgStore *covgs = (CovgStore*)qg->covgs;
+  Covg *nodecovgs = ctx_calloc(ncols, sizeof(Covg));
+  BinaryKmer bkey;
+  uint64_t idx;
+  size_t col;
+
+  for(hkey = 0; hkey < db_graph->ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(db_graph, hkey)) continue;
+    bkey = db_node_get_bkey(db_graph, hkey);
+    idx = qg_mphf(qg, bkey);
+    ctx_assert(idx < qg->num_kmers);
+    fprints[idx] = qg_fprint(bkey);
+    db_node_get_all_edges(db_graph, hkey, edges + idx*nedgecols);
+    db_node_get_covgs(db_graph, hkey, nodecovgs);
+    for(col = 0; col < ncols; col++)
+      covgs[idx*ncols+col] = (CovgStore)MIN2(nodecovgs[col], COVG_STORE_MAX);
+  }
+  ctx_free(nodecovgs);
+
+  char kstr[50], memstr[50], htstr[50];
+  ulong_to_str(qg->num_kmers, kstr);
+  bytes_to_str(qg->mem_len, 1, memstr);
+  bytes_to_str(db_graph->ht.capacity * (sizeof(BinaryKmer) +
+                                        nedgecols * sizeof(Edges) +
+                                        ncols * sizeof(CovgStore)), 1, htstr);
+  status("[qgraph] %s kmers, %zu levels, %zu unplaced; %s vs %s hash table",
+         kstr, qg->nlevels, qg->nfallback, memstr, htstr);
+}
+
+void query_graph_save(const QueryGraph *qg, const char *path)
+{
+  FILE *fout = futil_fopen_create(path, "w");
+  if(fwrite(qg->mem, 1, qg->mem_len, fout) != qg->mem_len)
+    die("Cannot write to file: %s", futil_outpath_str(path));
+  fclose(fout);
+}
+
+bool query_graph_is_file(const char *path)
+{
+  char magic[sizeof(QUERY_GRAPH_MAGIC)];
+  FILE *fin = fopen(path, "r");
+  if(fin == NULL) return false;
+  bool ret = (fread(magic, 1, sizeof(magic)-1, fin) == sizeof(magic)-1 &&
+              memcmp(magic, QUERY_GRAPH_MAGIC, sizeof(magic)-1) == 0);
+  fclose(fin);
+  return ret;
+}
+
+void query_graph_load(QueryGraph *qg, const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) die("Cannot open file: %s", path);
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < QG_HDR_BYTES)
+    die("Corrupt query graph file: %s", path);
+
+  size_t nbytes = st.st_size;
+  uint8_t *mem = mmap(NULL, nbytes, PROT_READ, MAP_SHARED, fd, 0);
+  if(mem == MAP_FAILED) die("Cannot memory map file: %s", path);
+  close(fd);
+
+  if(memcmp(mem, QUERY_GRAPH_MAGIC, strlen(QUERY_GRAPH_MAGIC)) != 0)
+    die("Not a query graph file: %s", path);
+
+  uint32_t u32[4];
+  uint64_t u64[5 + QG_MAX_LEVELS];
+  memcpy(u32, mem + strlen(QUERY_GRAPH_MAGIC), sizeof(u32));
+  memcpy(u64, mem + strlen(QUERY_GRAPH_MAGIC) + sizeof(u32), sizeof(u64));
+
+  if(u32[0] != QUERY_GRAPH_VERSION)
+    die("Query graph version %u not supported: %s", u32[0], path);
+  if(u32[2] != NUM_BKMER_WORDS || u32[3] != sizeof(CovgStore))
+    die("Query graph was built with a different MAXK or COVG_BITS: %s", path);
+
+  db_graph_check_kmer_size(u32[1], path);
+
+  size_t l;
+  memset(qg, 0, sizeof(*qg));
+  qg->kmer_size = u32[1];
+  qg->num_of_cols = u64[0];
+  qg->num_edge_cols = u64[1];
+  qg->num_kmers = u64[2];
+  qg->nlevels = u64[3];
+  qg->nfallback = u64[4];
+
+  if(qg->nlevels > QG_MAX_LEVELS || qg->nfallback > qg->num_kmers ||
+     qg->num_kmers > nbytes || qg->num_of_cols > nbytes ||
+     qg->num_edge_cols > qg->num_of_cols)
+    die("Corrupt query graph file: %s", path);
+
+  for(l = 0; l < qg->nlevels; l++) {
+    if(u64[5+l] == 0 || u64[5+l] > nbytes) die("Corrupt query graph file: %s", path);
+    qg->level_bits[l] = u64[5+l] * 64;
+  }
+  qg->nranked = qg->num_kmers - qg->nfallback;
+
+  QGLayout ly;
+  qg_layout(qg, &ly);
+  if(ly.len != nbytes) die("Corrupt query graph file: %s", path);
+
+  qg->mem = mem;
+  qg->mapped = true;
+  qg_set_arrays(qg, &ly);
+
+  char kstr[50], memstr[50];
+  ulong_to_str(qg->num_kmers, kstr);
+  bytes_to_str(nbytes, 1, memstr);
+  status("[qgraph] Mapped %s kmers, %zu colours (%s) from: %s",
+         kstr, qg->num_of_cols, memstr, path);
+}
+
+void query_graph_dealloc(QueryGraph *qg)
+{
+  if(qg->mapped) munmap(qg->mem, qg->mem_len);
+  else ctx_free(qg->mem);
+  memset(qg, 0, sizeof(*qg));
+}
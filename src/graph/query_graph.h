@@ -0,0 +1,86 @@
+#ifndef QUERY_GRAPH_H_
+#define QUERY_GRAPH_H_
+
+//
+// Read-only "query graph" built from a cleaned graph
+//
+// Kmers are numbered 0..num_kmers-1 with a minimal perfect hash (BBHash
+// style): level l is a bit array of ~QG_GAMMA bits per kmer still unplaced.
+// Each kmer hashes to one bit per level and takes the first level where no
+// other kmer hit the same bit. A kmer's index is the number of set bits
+// before its bit (rank), found with one stored count per 512 bits. Kmers not
+// placed after QG_MAX_LEVELS levels are kept in a small sorted list.
+//
+// No kmers are stored. A 32 bit fingerprint per kmer rejects kmers that are
+// not in the graph; an absent kmer is reported as present with probability
+// ~2^-32. Edges and coverages are packed by kmer index with no empty slots:
+// num_edge_cols x Edges and num_of_cols x CovgStore per kmer. Coverages above
+// COVG_STORE_MAX (COVG_BITS < 32) are saturated.
+//
+// A lookup reads a bit per level tried (usually one), one rank count, the
+// fingerprint and the kmer's edges and coverages. The graph cannot be
+// modified or iterated by kmer.
+//
+// Format (arrays padded to 8 bytes, memory mapped on load):
+//   "CTXQGRPH" <uint32:version> <uint32:kmer_size>
+//   <uint32:num_bkmer_words> <uint32:covg_bytes>
+//   <uint64:num_of_cols> <uint64:num_edge_cols> <uint64:num_kmers>
+//   <uint64:nlevels> <uint64:nfallback> QG_MAX_LEVELS x <uint64:level_words>
+//   sum(level_words) x uint64 bits, ceil(sum(level_words)/8) x uint64 ranks
+//   nfallback x BinaryKmer (sorted)
+//   num_kmers x uint32 fingerprints
+//   num_kmers*num_edge_cols x Edges, num_kmers*num_of_cols x CovgStore
+//
+
+#include "db_graph.h"
+
+#define QUERY_GRAPH_MAGIC "CTXQGRPH"
+#define QUERY_GRAPH_VERSION 1
+#define QUERY_GRAPH_EXT ".qg"
+
+#define QG_MAX_LEVELS 32
+#define QG_GAMMA 2
+#define QG_NOT_FOUND UINT64_MAX
+
+typedef struct
+{
+  size_t kmer_size, num_of_cols, num_edge_cols, num_kmers;
+  size_t nlevels, nfallback, nranked;
+  size_t level_bits[QG_MAX_LEVELS]; // bits in each level
+  const uint64_t *bits, *ranks;
+  const BinaryKmer *fallback;
+  const uint32_t *fprints;
+  const Edges *edges;
+  const CovgStore *covgs;
+  void *mem; // built in memory or memory mapped
+  size_t mem_len;
+  bool mapped;
+} QueryGraph;
+
+// Build from a loaded graph. Graph must have edges and coverages.
+void query_graph_build(QueryGraph *qg, const dBGraph *db_graph);
+
+// Dies on error
+void query_graph_save(const QueryGraph *qg, const char *path);
+void query_graph_load(QueryGraph *qg, const char *path);
+
+void query_graph_dealloc(QueryGraph *qg);
+
+// Returns true if `path` starts with QUERY_GRAPH_MAGIC
+bool query_graph_is_file(const char *path);
+
+// Returns kmer index of `bkey` or QG_NOT_FOUND
+// `bkey` must be a kmer key (binary_kmer_get_key())
+uint64_t query_graph_find(const QueryGraph *qg, BinaryKmer bkey);
+
+// Find `n` kmer keys, prefetching the first level bits of later kmers
+void query_graph_find_batch(const QueryGraph *qg, const BinaryKmer *bkeys,
+                            size_t n, uint64_t *idxs);
+
+#define query_graph_edges(qg,idx) ((qg)->edges + (idx)*(qg)->num_edge_cols)
+#define query_graph_covgs(qg,idx) ((qg)->covgs + (idx)*(qg)->num_of_cols)
+
+// Bytes needed by the arrays of a query graph of `nkmers` kmers
+size_t query_graph_mem(size_t nkmers, size_t ncols, size_t nedgecols);
+
+#endif /* QUERY_GRAPH_H_ */
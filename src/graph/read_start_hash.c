@@ -0,0 +1,99 @@
+#include "global.h"
+#include "read_start_hash.h"
+#include "util.h"
+
+void read_start_hash_alloc(ReadStartHash *rsh, size_t mem)
+{
+  size_t nbuckets = 1, bucket_mem = READ_START_BUCKET_SIZE*sizeof(uint64_t);
+  while(nbuckets * 2 * bucket_mem <= mem) nbuckets <<= 1;
+
+  char mem_str[50];
+  bytes_to_str(nbuckets * bucket_mem, 1, mem_str);
+  status("[pcrdup] Allocating read start table with %zu buckets, using %s",
+         nbuckets, mem_str);
+
+  ReadStartHash tmp = {.fps = ctx_calloc_large(nbuckets * READ_START_BUCKET_SIZE,
+                                               sizeof(uint64_t)),
+                       .nbuckets = nbuckets,
+                       .mask = nbuckets-1,
+                       .seed = (uint32_t)rand(),
+                       .num_dropped = 0};
+
+  memcpy(rsh, &tmp, sizeof(ReadStartHash));
+}
+
+void read_start_hash_dealloc(ReadStartHash *rsh)
+{
+  ctx_free_large(rsh->fps);
+  memset(rsh, 0, sizeof(ReadStartHash));
+}
+
+void read_start_hash_reset(ReadStartHash *rsh)
+{
+  memset(rsh->fps, 0, read_start_hash_mem(rsh));
+  rsh->num_dropped = 0;
+}
+
+// Hash of a kmer key and its orientation
+static inline uint64_t read_start_kmer_hash(const ReadStartHash *rsh,
+                                            BinaryKmer bkmer, size_t kmer_size)
+{
+  BinaryKmer bkey = binary_kmer_get_key(bkmer, kmer_size);
+  uint64_t orient = !binary_kmer_eq(bkey, bkmer);
+  uint64_t h = ((uint64_t)binary_kmer_hash(bkey, rsh->seed) << 32) |
+               binary_kmer_hash(bkey, rsh->seed+1);
+  return h ^ (orient * 0x9e3779b97f4a7c15UL);
+}
+
+// Fingerprint of the first kmers of a read pair
+// Pass got_kmer1/2 = false for a read with no kmers or no mate
+uint64_t read_start_fingerprint(const ReadStartHash *rsh, size_t kmer_size,
+                                bool got_kmer1, BinaryKmer bkmer1,
+                                bool got_kmer2, BinaryKmer bkmer2)
+{
+  uint64_t h1 = got_kmer1 ? read_start_kmer_hash(rsh, bkmer1, kmer_size) : 0;
+  uint64_t h2 = got_kmer2 ? read_start_kmer_hash(rsh, bkmer2, kmer_size) : 1;
+  // A 64 bit mix (murmur3 fmix64) of the two halves
+  uint64_t fp = h1 ^ (h2 * 0xff51afd7ed558ccdUL + 0x32);
+  fp ^= fp >> 33; fp *= 0xc4ceb9fe1a85ec53UL; fp ^= fp >> 33;
+  return fp ? fp : 1; // 0 is reserved for empty slots
+}
+
+// Threadsafe
+// Returns true if the fingerprint was already in the set, otherwise adds it
+bool read_start_hash_add_mt(ReadStartHash *rsh, uint64_t fp)
+{
+  ctx_assert(fp != 0);
+  volatile uint64_t *bkt = rsh->fps + (fp & rsh->mask) * READ_START_BUCKET_SIZE;
+  uint64_t v;
+  size_t i;
+
+  for(i = 0; i < READ_START_BUCKET_SIZE; i++) {
+    v = bkt[i];
+    if(v == fp) return true;
+    if(v == 0) {
+      v = __sync_val_compare_and_swap(&bkt[i], (uint64_t)0, fp);
+      if(v == 0) return false; // we added it
+      if(v == fp) return true; // someone else added it
+    }
+  }
+
+  __sync_fetch_and_add(&rsh->num_dropped, 1);
+  return false;
+}
+
+void read_start_hash_print_stats(const ReadStartHash *rsh)
+{
+  size_t i, nslots = rsh->nbuckets * READ_START_BUCKET_SIZE, nused = 0;
+  for(i = 0; i < nslots; i++) nused += (rsh->fps[i] != 0);
+
+  char used_str[50], slots_str[50], dropped_str[50];
+  ulong_to_str(nused, used_str);
+  ulong_to_str(nslots, slots_str);
+  ulong_to_str(rsh->num_dropped, dropped_str);
+  status("[pcrdup] read starts stored: %s / %s (%.2f%%), dropped: %s",
+         used_str, slots_str, (100.0*nused)/nslots, dropped_str);
+  if(rsh->num_dropped)
+    warn("PCR duplicate table was full; some duplicates were not removed. "
+         "Use a larger --pcr-mem");
+}
@@ -0,0 +1,51 @@
+#ifndef READ_START_HASH_H_
+#define READ_START_HASH_H_
+
+//
+// Fixed size set of read (pair) start fingerprints for PCR duplicate removal
+//
+// An alternative to the 2 bits per hash table entry of DBG_ALLOC_READSTRT:
+// memory is set by the user rather than by the graph capacity. Each read (pair)
+// is reduced to a 64 bit fingerprint of the first kmer of each read and its
+// orientation. Fingerprints are stored in buckets of one cache line. If a
+// bucket is full the fingerprint is dropped and the read treated as novel, so
+// an undersized table only misses duplicates; it never drops novel reads
+// (other than on a 64 bit fingerprint collision).
+//
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+
+#define READ_START_BUCKET_SIZE 8 // 8*8 = 64 bytes per bucket
+
+typedef struct
+{
+  uint64_t *const fps; // 0 means empty
+  const size_t nbuckets; // power of two
+  const uint64_t mask;
+  const uint32_t seed;
+  volatile size_t num_dropped; // fingerprints not stored since bucket was full
+} ReadStartHash;
+
+// Use at most `mem` bytes (at least one bucket)
+void read_start_hash_alloc(ReadStartHash *rsh, size_t mem);
+void read_start_hash_dealloc(ReadStartHash *rsh);
+void read_start_hash_reset(ReadStartHash *rsh);
+
+#define read_start_hash_mem(rsh) \
+        ((rsh)->nbuckets*READ_START_BUCKET_SIZE*sizeof(uint64_t))
+
+// Fingerprint of the first kmers of a read pair
+// Pass got_kmer1/2 = false for a read with no kmers or no mate
+uint64_t read_start_fingerprint(const ReadStartHash *rsh, size_t kmer_size,
+                                bool got_kmer1, BinaryKmer bkmer1,
+                                bool got_kmer2, BinaryKmer bkmer2);
+
+// Threadsafe
+// Returns true if the fingerprint was already in the set, otherwise adds it
+bool read_start_hash_add_mt(ReadStartHash *rsh, uint64_t fp);
+
+// Print number of fingerprints stored and dropped
+void read_start_hash_print_stats(const ReadStartHash *rsh);
+
+#endif /* READ_START_HASH_H_ */
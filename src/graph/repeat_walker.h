@@ -4,20 +4,134 @@
 #include "graph_walker.h"
 #include "db_node.h"
 
+//
+// Two backends:
+// 1) bitset (rpt_walker_alloc): 2 bits per hash table entry for visited nodes
+//    and a bloom filter of walker states. Clearing walks the nodes visited, or
+//    memsets the bloom filter.
+// 2) epoch (rpt_walker_alloc_epoch): small open addressing sets of visited
+//    nodes and walker states, tagged with a generation. Clearing starts a new
+//    generation in O(1) regardless of walk length. Sets grow with the walk.
+//
+
+// Generation tagged set of uint64_t keys, linear probing
+typedef struct
+{
+  uint64_t *keys;
+  uint32_t *epochs; // entry is in the set iff epochs[i] == epoch
+  size_t nbits, len; // size is 1<<nbits
+  uint32_t epoch;
+} RptEpochSet;
+
 typedef struct
 {
   uint64_t *const visited, *const bloom;
   const size_t bloom_nbits, mem_bytes;
   const uint32_t mask;
   size_t nbloom_entries;
+  // epoch backend, only used if use_epochs is true
+  bool use_epochs;
+  RptEpochSet nodes, states;
 } RepeatWalker;
 
+#define rpt_eset_home(set,key)         (((key) * 0x9E3779B97F4A7C15UL) >> (64 - (set)->nbits))
+
+static inline void rpt_eset_alloc(RptEpochSet *set, size_t nbits)
+{
+  set->nbits = nbits;
+  set->keys = ctx_malloc(sizeof(uint64_t) << nbits);
+  set->epochs = ctx_calloc(1UL << nbits, sizeof(uint32_t));
+  set->len = 0;
+  set->epoch = 1; // calloc'd entries have epoch 0 => empty
+}
+
+static inline void rpt_eset_dealloc(RptEpochSet *set)
+{
+  ctx_free(set->keys);
+  ctx_free(set->epochs);
+  memset(set, 0, sizeof(*set));
+}
+
+// O(1), only touches the table when the epoch wraps around
+static inline void rpt_eset_clear(RptEpochSet *set)
+{
+  if(++set->epoch == 0) {
+    memset(set->epochs, 0, sizeof(uint32_t) << set->nbits);
+    set->epoch = 1;
+  }
+  set->len = 0;
+}
+
+// Returns index of `key` or of the empty slot to put it in
+static inline size_t rpt_eset_find(const RptEpochSet *set, uint64_t key)
+{
+  const size_t mask = (1UL << set->nbits) - 1;
+  size_t i = rpt_eset_home(set, key);
+  while(set->epochs[i] == set->epoch && set->keys[i] != key) i = (i+1) & mask;
+  return i;
+}
+
+static inline void rpt_eset_grow(RptEpochSet *set)
+{
+  RptEpochSet old = *set;
+  size_t i, j, size = 1UL << old.nbits;
+  rpt_eset_alloc(set, old.nbits+1);
+  for(i = 0; i < size; i++) {
+    if(old.epochs[i] == old.epoch) {
+      j = rpt_eset_find(set, old.keys[i]);
+      set->keys[j] = old.keys[i];
+      set->epochs[j] = set->epoch;
+      set->len++;
+    }
+  }
+  rpt_eset_dealloc(&old);
+}
+
+// Returns true if `key` was already in the set, otherwise adds it
+static inline bool rpt_eset_add(RptEpochSet *set, uint64_t key)
+{
+  if(2*(set->len+1) > (1UL << set->nbits)) rpt_eset_grow(set); // load < 1/2
+  size_t i = rpt_eset_find(set, key);
+  if(set->epochs[i] == set->epoch) return true;
+  set->keys[i] = key;
+  set->epochs[i] = set->epoch;
+  set->len++;
+  return false;
+}
+
+// Remove a key, shifting back later entries in its probe run
+static inline void rpt_eset_remove(RptEpochSet *set, uint64_t key)
+{
+  const size_t mask = (1UL << set->nbits) - 1;
+  size_t i = rpt_eset_find(set, key), j, k;
+  if(set->epochs[i] != set->epoch) return;
+
+  for(j = (i+1) & mask; set->epochs[j] == set->epoch; j = (j+1) & mask) {
+    k = rpt_eset_home(set, set->keys[j]);
+    // Move entry j into the gap at i if its home is not in (i,j]
+    if(i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+      set->keys[i] = set->keys[j];
+      i = j;
+    }
+  }
+
+  set->epochs[i] = set->epoch - 1; // any other epoch is empty
+  set->len--;
+}
+
 // GraphWalker wlk is proposing node and orient as next move
 // We determine if it is safe to make the traversal without getting stuck in
 // a loop/cycle in the graph
 static inline bool rpt_walker_attempt_traverse(RepeatWalker *rpt,
                                                GraphWalker *wlk)
 {
+  if(rpt->use_epochs) {
+    uint64_t nodekey = 2*(uint64_t)wlk->node.key + wlk->node.orient;
+    // Exact set of walker states, so no false positives
+    return !rpt_eset_add(&rpt->nodes, nodekey) ||
+           !rpt_eset_add(&rpt->states, graph_walker_hash64(wlk));
+  }
+
   if(!db_node_has_traversed(rpt->visited, wlk->node)) {
     db_node_set_traversed(rpt->visited, wlk->node);
     return true;
@@ -71,8 +185,22 @@ static inline void rpt_walker_alloc(RepeatWalker *rpt,
   memcpy(rpt, &tmp, sizeof(RepeatWalker));
 }
 
+// Epoch backend, sets start with 1<<nbits entries and grow as needed
+static inline void rpt_walker_alloc_epoch(RepeatWalker *rpt, size_t nbits)
+{
+  ctx_assert(nbits > 0 && nbits < 32);
+  memset(rpt, 0, sizeof(*rpt));
+  rpt->use_epochs = true;
+  rpt_eset_alloc(&rpt->nodes, nbits);
+  rpt_eset_alloc(&rpt->states, nbits);
+}
+
 static inline void rpt_walker_dealloc(RepeatWalker *rpt)
 {
+  if(rpt->use_epochs) {
+    rpt_eset_dealloc(&rpt->nodes);
+    rpt_eset_dealloc(&rpt->states);
+  }
   ctx_free(rpt->visited);
 }
 
@@ -85,14 +213,22 @@ static inline void _rpt_walker_clear_bloom(RepeatWalker *rpt)
 
 static inline void rpt_walker_clear(RepeatWalker *rpt)
 {
+  if(rpt->use_epochs) {
+    rpt_eset_clear(&rpt->nodes);
+    rpt_eset_clear(&rpt->states);
+    return;
+  }
   memset(rpt->visited, 0, rpt->mem_bytes);
   _rpt_walker_clear_bloom(rpt);
 }
 
+// Clear walker states and the visited `nodes`
+// With the epoch backend, all nodes and states are cleared in O(1)
 static inline void rpt_walker_fast_clear(RepeatWalker *rpt,
                                          const dBNode *nodes, size_t n)
 {
   size_t i;
+  if(rpt->use_epochs) { rpt_walker_clear(rpt); return; }
   for(i = 0; i < n; i++) db_node_fast_clear_traversed(rpt->visited, nodes[i].key);
   _rpt_walker_clear_bloom(rpt);
 }
@@ -100,6 +236,12 @@ static inline void rpt_walker_fast_clear(RepeatWalker *rpt,
 static inline void rpt_walker_fast_clear_single_node(RepeatWalker *rpt,
                                                      const dBNode node)
 {
+  if(rpt->use_epochs) {
+    // bitset backend clears the word of the kmer => both orientations
+    rpt_eset_remove(&rpt->nodes, 2*(uint64_t)node.key);
+    rpt_eset_remove(&rpt->nodes, 2*(uint64_t)node.key+1);
+    return;
+  }
   db_node_fast_clear_traversed(rpt->visited, node.key);
 }
 
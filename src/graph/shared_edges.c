@@ -0,0 +1,52 @@
+#include "global.h"
+#include "shared_edges.h"
+#include "util.h"
+
+void shared_edges_alloc(SharedEdges *se, size_t capacity)
+{
+  char mem_str[50];
+  bytes_to_str(shared_edges_mem(capacity, 0), 1, mem_str);
+  status("[shared_edges] Allocating shared edges for %zu kmers, using %s",
+         capacity, mem_str);
+
+  SharedEdges tmp = {.unions = ctx_calloc(capacity, sizeof(Edges)),
+                     .has_exc = ctx_calloc((capacity+7)/8, 1),
+                     .excs = NULL,
+                     .capacity = capacity,
+                     .num_excs = 0};
+
+  memcpy(se, &tmp, sizeof(SharedEdges));
+}
+
+void shared_edges_dealloc(SharedEdges *se)
+{
+  ctx_free(se->unions);
+  ctx_free(se->has_exc);
+  ctx_free(se->excs);
+  memset(se, 0, sizeof(SharedEdges));
+}
+
+void shared_edges_set_mt(SharedEdges *se, hkey_t hkey, Edges uedges,
+                         bool has_exc)
+{
+  ctx_assert(hkey < se->capacity);
+  se->unions[hkey] = uedges;
+  // Neighbouring kmers share a byte of the bitset
+  if(has_exc)
+    (void)__sync_fetch_and_or(&se->has_exc[hkey/8], (uint8_t)(1 << (hkey%8)));
+  else
+    (void)__sync_fetch_and_and(&se->has_exc[hkey/8], (uint8_t)~(1 << (hkey%8)));
+}
+
+SharedEdgesExc* shared_edges_alloc_excs(SharedEdges *se, size_t num_excs)
+{
+  char num_str[50], mem_str[50];
+  ulong_to_str(num_excs, num_str);
+  bytes_to_str(num_excs * sizeof(SharedEdgesExc), 1, mem_str);
+  status("[shared_edges] %s colour edge exceptions, using %s",
+         num_str, mem_str);
+
+  se->excs = ctx_realloc(se->excs, MAX2(num_excs, 1) * sizeof(SharedEdgesExc));
+  se->num_excs = num_excs;
+  return se->excs;
+}
@@ -0,0 +1,89 @@
+#ifndef SHARED_EDGES_H_
+#define SHARED_EDGES_H_
+
+//
+// Per colour edges stored as the union of edges plus exceptions
+//
+// A kmer usually has the same edges in every colour it is in. Instead of
+// col_edges ([hkey*ncols+col]) store one union Edges per kmer and list only the
+// colours whose edges differ from the union. Colours that a kmer is not in
+// have no edges unless listed. Uses 1 byte + 1 bit per hash table entry plus
+// 16 bytes per exception, rather than ncols bytes per entry.
+//
+// Built from a loaded graph, after that the store is read only. Which colours a
+// kmer is in has to be given on lookup (see db_node_get_edges()).
+//
+
+#include "cortex_types.h"
+
+#define SHARED_EDGES_MAXCOLS (1UL<<24)
+
+typedef struct
+{
+  hkey_t hkey;
+  uint32_t coledges; // colour << 8 | edges
+} SharedEdgesExc;
+
+typedef struct
+{
+  Edges *const unions; // [capacity] union of edges in all colours
+  uint8_t *const has_exc; // [capacity/8] bit set if a kmer has exceptions
+  SharedEdgesExc *excs; // [num_excs] sorted by hkey then colour
+  const size_t capacity;
+  size_t num_excs;
+} SharedEdges;
+
+#define shared_edges_mem(capacity,nexcs) \
+        ((capacity)*sizeof(Edges) + ((capacity)+7)/8 + \
+         (nexcs)*sizeof(SharedEdgesExc))
+
+#define shared_edges_exc_col(e)   ((e)->coledges >> 8)
+#define shared_edges_exc_edges(e) ((Edges)((e)->coledges & 0xff))
+
+#define shared_edges_union(se,hkey) ((se)->unions[hkey])
+#define shared_edges_has_exc(se,hkey) \
+        (((se)->has_exc[(hkey)/8] >> ((hkey)%8)) & 1)
+
+// `capacity` should be the graph hash table capacity
+void shared_edges_alloc(SharedEdges *se, size_t capacity);
+void shared_edges_dealloc(SharedEdges *se);
+
+// Set the union of edges for a kmer and whether it has exceptions
+// Threadsafe for different kmers
+void shared_edges_set_mt(SharedEdges *se, hkey_t hkey, Edges uedges,
+                         bool has_exc);
+
+// Exceptions must have been added in order of hkey then colour
+// Allocates space for `num_excs` exceptions, to be set before any lookups
+SharedEdgesExc* shared_edges_alloc_excs(SharedEdges *se, size_t num_excs);
+
+// Returns NULL if the edges of `col` are not an exception
+static inline const SharedEdgesExc* shared_edges_find(const SharedEdges *se,
+                                                      hkey_t hkey, Colour col)
+{
+  if(!shared_edges_has_exc(se, hkey)) return NULL;
+
+  // Binary search for first exception of this kmer
+  size_t lo = 0, hi = se->num_excs, mid;
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if(se->excs[mid].hkey < hkey) lo = mid + 1;
+    else hi = mid;
+  }
+
+  for(; lo < se->num_excs && se->excs[lo].hkey == hkey; lo++)
+    if(shared_edges_exc_col(&se->excs[lo]) == col) return &se->excs[lo];
+
+  return NULL;
+}
+
+// `in_col` is whether the kmer is in colour `col`
+static inline Edges shared_edges_get(const SharedEdges *se, hkey_t hkey,
+                                     Colour col, bool in_col)
+{
+  const SharedEdgesExc *e = shared_edges_find(se, hkey, col);
+  if(e != NULL) return shared_edges_exc_edges(e);
+  return in_col ? se->unions[hkey] : 0;
+}
+
+#endif /* SHARED_EDGES_H_ */
@@ -0,0 +1,93 @@
+#include "global.h"
+#include "sparse_colours.h"
+#include "util.h"
+
+void sparse_cols_alloc(SparseCols *sc, size_t capacity, size_t max_entries)
+{
+  ctx_assert2(max_entries < SPARSE_COLS_NONE, "Too many entries: %zu", max_entries);
+
+  char mem_str[50];
+  bytes_to_str(sparse_cols_mem(capacity, max_entries), 1, mem_str);
+  status("[sparse] Allocating sparse colours with %zu entries, using %s",
+         max_entries, mem_str);
+
+  SparseCols tmp = {.heads = ctx_malloc(capacity * sizeof(uint32_t)),
+                    .entries = ctx_malloc(max_entries * sizeof(SparseColEntry)),
+                    .capacity = capacity,
+                    .max_entries = max_entries,
+                    .num_entries = 0};
+
+  memset(tmp.heads, 0xff, capacity * sizeof(uint32_t));
+  memcpy(sc, &tmp, sizeof(SparseCols));
+}
+
+void sparse_cols_dealloc(SparseCols *sc)
+{
+  ctx_free(sc->heads);
+  ctx_free(sc->entries);
+  memset(sc, 0, sizeof(SparseCols));
+}
+
+void sparse_cols_reset(SparseCols *sc)
+{
+  memset(sc->heads, 0xff, sc->capacity * sizeof(uint32_t));
+  sc->num_entries = 0;
+}
+
+// Add to an existing entry for this colour in entries [from,until)
+// Returns true if found
+static inline bool sparse_cols_merge_mt(SparseCols *sc, uint32_t from,
+                                        uint32_t until, Colour col,
+                                        Covg covg, Edges edges)
+{
+  SparseColEntry *e;
+  Covg v;
+
+  for(; from != until; from = e->next) {
+    e = &sc->entries[from];
+    if(sparse_col_entry_col(e) == col) {
+      while((v = e->covg) < COVG_MAX &&
+            !__sync_bool_compare_and_swap(&e->covg, v, SAFE_ADD_COVG(v, covg))) {}
+      if(edges) __sync_or_and_fetch(&e->coledges, (uint32_t)edges);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Entries are only ever prepended to a list, so after a failed compare and
+// swap of the head we only need to check the entries added since
+void sparse_cols_add_mt(SparseCols *sc, hkey_t hkey, Colour col,
+                        Covg covg, Edges edges)
+{
+  ctx_assert(hkey < sc->capacity);
+  ctx_assert2(col < SPARSE_COLS_MAXCOLS, "col: %zu", col);
+
+  volatile uint32_t *head = &sc->heads[hkey];
+  uint32_t prev = *head, searched = SPARSE_COLS_NONE, idx = SPARSE_COLS_NONE;
+
+  while(1)
+  {
+    if(sparse_cols_merge_mt(sc, prev, searched, col, covg, edges)) {
+      // Another thread added this colour, our entry (if any) is unused
+      return;
+    }
+
+    if(idx == SPARSE_COLS_NONE) {
+      size_t n = __sync_fetch_and_add(&sc->num_entries, 1);
+      if(n >= sc->max_entries)
+        die("Sparse colour store full (%zu entries), increase memory",
+            sc->max_entries);
+      idx = (uint32_t)n;
+      sc->entries[idx].coledges = ((uint32_t)col << 8) | edges;
+      sc->entries[idx].covg = covg;
+    }
+
+    sc->entries[idx].next = prev;
+    __sync_synchronize();
+    if(__sync_bool_compare_and_swap(head, prev, idx)) return;
+
+    searched = prev;
+    prev = *head;
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef SPARSE_COLOURS_H_
+#define SPARSE_COLOURS_H_
+
+//
+// Sparse per-kmer colour storage for graphs with many colours
+//
+// Instead of col_covgs, col_edges and node_in_cols ([hkey*ncols+col]) each
+// kmer has a list of the colours it is in, with their coverage and edges.
+// Entries are 12 bytes in a fixed size arena, plus 4 bytes per hash table
+// entry for the list heads. Uses less memory than dense storage when kmers are
+// in fewer than ~40% of colours.
+//
+// Colours are added while loading, after that the store is read only.
+// Lookups walk the list, so are only fast when kmers are in a few colours.
+//
+
+#include "cortex_types.h"
+
+#define SPARSE_COLS_NONE UINT32_MAX
+#define SPARSE_COLS_MAXCOLS (1UL<<24)
+
+typedef struct
+{
+  uint32_t next; // next entry for this kmer, SPARSE_COLS_NONE if last
+  uint32_t coledges; // colour << 8 | edges
+  Covg covg;
+} SparseColEntry;
+
+typedef struct
+{
+  uint32_t *const heads; // [capacity] first entry of each kmer
+  SparseColEntry *const entries; // [max_entries]
+  const size_t capacity, max_entries;
+  volatile size_t num_entries;
+} SparseCols;
+
+#define sparse_cols_mem(capacity,nentries) \
+        ((capacity)*sizeof(uint32_t) + (nentries)*sizeof(SparseColEntry))
+
+// `capacity` should be the graph hash table capacity
+void sparse_cols_alloc(SparseCols *sc, size_t capacity, size_t max_entries);
+void sparse_cols_dealloc(SparseCols *sc);
+void sparse_cols_reset(SparseCols *sc);
+
+// Threadsafe. Adds to the coverage and edges if colour is already present.
+// Dies if the store is full.
+void sparse_cols_add_mt(SparseCols *sc, hkey_t hkey, Colour col,
+                        Covg covg, Edges edges);
+
+#define sparse_col_entry_col(e)   ((e)->coledges >> 8)
+#define sparse_col_entry_edges(e) ((Edges)((e)->coledges & 0xff))
+
+// Iterate over the colours of a kmer
+#define sparse_cols_first(sc,hkey) \
+        ((sc)->heads[hkey] == SPARSE_COLS_NONE ? NULL \
+                                               : &(sc)->entries[(sc)->heads[hkey]])
+#define sparse_cols_next(sc,e) \
+        ((e)->next == SPARSE_COLS_NONE ? NULL : &(sc)->entries[(e)->next])
+
+// Returns NULL if kmer is not in colour
+static inline const SparseColEntry* sparse_cols_find(const SparseCols *sc,
+                                                     hkey_t hkey, Colour col)
+{
+  const SparseColEntry *e;
+  for(e = sparse_cols_first(sc, hkey); e != NULL; e = sparse_cols_next(sc, e))
+    if(sparse_col_entry_col(e) == col) return e;
+  return NULL;
+}
+
+static inline Covg sparse_cols_covg(const SparseCols *sc, hkey_t hkey, Colour col)
+{
+  const SparseColEntry *e = sparse_cols_find(sc, hkey, col);
+  return e ? e->covg : 0;
+}
+
+static inline Edges sparse_cols_edges(const SparseCols *sc, hkey_t hkey,
+                                      Colour col)
+{
+  const SparseColEntry *e = sparse_cols_find(sc, hkey, col);
+  return e ? sparse_col_entry_edges(e) : 0;
+}
+
+static inline Edges sparse_cols_edges_union(const SparseCols *sc, hkey_t hkey)
+{
+  const SparseColEntry *e;
+  Edges edges = 0;
+  for(e = sparse_cols_first(sc, hkey); e != NULL; e = sparse_cols_next(sc, e))
+    edges |= sparse_col_entry_edges(e);
+  return edges;
+}
+
+#define sparse_cols_has(sc,hkey,col) (sparse_cols_find(sc,hkey,col) != NULL)
+
+#endif /* SPARSE_COLOURS_H_ */
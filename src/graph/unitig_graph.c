@@ -2,6 +2,8 @@
 #include "unitig_graph.h"
 #include "db_node.h"
 #include "db_unitig.h"
+#include "util.h"
+#include "file_util.h"
 
 // Store ends of unitig currently stored in `nodes` and `orients` arrays
 size_t unitig_graph_store_end_mt(const dBNode *nodes, size_t n,
@@ -84,3 +86,379 @@ void unitig_graph_dealloc(UnitigKmerGraph *ugraph)
 {
   ctx_free(ugraph->unitig_ends);
 }
+
+//
+// Unitig index
+//
+
+void unitig_index_alloc(UnitigIndex *uidx, const dBGraph *db_graph)
+{
+  size_t capacity = db_graph->ht.capacity;
+  memset(uidx, 0, sizeof(*uidx));
+  uidx->db_graph = db_graph;
+  uidx->kmers = ctx_malloc(capacity * sizeof(UnitigIndexKmer));
+  uidx->offsets = ctx_malloc(capacity * sizeof(uint32_t));
+  memset(uidx->kmers, 0xff, capacity * sizeof(UnitigIndexKmer));
+}
+
+void unitig_index_dealloc(UnitigIndex *uidx)
+{
+  ctx_free(uidx->kmers);
+  ctx_free(uidx->offsets);
+  ctx_free(uidx->unitigs);
+  memset(uidx, 0, sizeof(*uidx));
+}
+
+// Label kmers of a normalised unitig
+static void unitig_index_store(const dBNode *nodes, size_t n, size_t uid,
+                               UnitigIndex *uidx)
+{
+  size_t i;
+  if(n > UINT32_MAX) die("Unitig too long: %zu kmers", n);
+  for(i = 0; i < n; i++) {
+    uidx->kmers[nodes[i].key] = (UnitigIndexKmer){.unitigid = uid,
+                                                  .orient = nodes[i].orient};
+    uidx->offsets[nodes[i].key] = (uint32_t)i;
+  }
+  uidx->unitigs[uid] = (UnitigIndexEntry){.first = nodes[0],
+                                          .last = nodes[n-1],
+                                          .len = (uint32_t)n};
+}
+
+static void _index_unitig(dBNodeBuffer nbuf, size_t threadid, void *arg)
+{
+  (void)threadid;
+  UnitigIndex *uidx = (UnitigIndex*)arg;
+  db_unitig_normalise(nbuf.b, nbuf.len, uidx->db_graph);
+  size_t uid = __sync_fetch_and_add((volatile size_t*)&uidx->num_unitigs, 1);
+  unitig_index_store(nbuf.b, nbuf.len, uid, uidx);
+  __sync_fetch_and_add((volatile size_t*)&uidx->num_kmers, nbuf.len);
+}
+
+// Renumbering: the hash table is split into one range per thread. Each
+// thread counts the unitigs whose first kmer is in its range, a prefix sum of
+// the counts gives the first new id of each range, then each thread numbers
+// its unitigs in hash table order.
+typedef struct {
+  UnitigIndex *uidx;
+  size_t nthreads;
+  uint64_t *counts; // [nthreads] unitigs starting in each range
+  uint64_t *newids; // [num_unitigs] old id -> new id
+} UnitigRenumber;
+
+static inline bool unitig_index_is_first(const UnitigIndex *uidx, hkey_t hkey)
+{
+  return uidx->kmers[hkey].unitigid != UNITIG_INDEX_NONE &&
+         uidx->offsets[hkey] == 0;
+}
+
+static void _renumber_count(void *arg, size_t threadid)
+{
+  UnitigRenumber *rn = (UnitigRenumber*)arg;
+  const UnitigIndex *uidx = rn->uidx;
+  size_t capacity = uidx->db_graph->ht.capacity;
+  size_t h, n = 0, start, end;
+  start = capacity *  threadid    / rn->nthreads;
+  end   = capacity * (threadid+1) / rn->nthreads;
+  for(h = start; h < end; h++) n += unitig_index_is_first(uidx, h);
+  rn->counts[threadid] = n;
+}
+
+static void _renumber_assign(void *arg, size_t threadid)
+{
+  UnitigRenumber *rn = (UnitigRenumber*)arg;
+  const UnitigIndex *uidx = rn->uidx;
+  size_t capacity = uidx->db_graph->ht.capacity;
+  size_t h, uid = rn->counts[threadid], start, end;
+  start = capacity *  threadid    / rn->nthreads;
+  end   = capacity * (threadid+1) / rn->nthreads;
+  for(h = start; h < end; h++)
+    if(unitig_index_is_first(uidx, h))
+      rn->newids[uidx->kmers[h].unitigid] = uid++;
+}
+
+static void _renumber_kmers(void *arg, size_t threadid)
+{
+  UnitigRenumber *rn = (UnitigRenumber*)arg;
+  UnitigIndex *uidx = rn->uidx;
+  size_t capacity = uidx->db_graph->ht.capacity;
+  size_t h, start, end;
+  start = capacity *  threadid    / rn->nthreads;
+  end   = capacity * (threadid+1) / rn->nthreads;
+  for(h = start; h < end; h++)
+    if(uidx->kmers[h].unitigid != UNITIG_INDEX_NONE)
+      uidx->kmers[h].unitigid = rn->newids[uidx->kmers[h].unitigid];
+}
+
+// Number unitigs in hash table order of their first kmer, so ids do not
+// depend on the order threads found the unitigs in
+static void unitig_index_renumber(UnitigIndex *uidx, size_t nthreads)
+{
+  size_t i, j, total = 0, tmp;
+  UnitigRenumber rn = {.uidx = uidx, .nthreads = nthreads,
+                       .counts = ctx_calloc(nthreads, sizeof(uint64_t)),
+                       .newids = ctx_malloc(MAX2(uidx->num_unitigs, 1) *
+                                            sizeof(uint64_t))};
+
+  util_multi_thread(&rn, nthreads, _renumber_count);
+  for(i = 0; i < nthreads; i++) {
+    tmp = rn.counts[i];
+    rn.counts[i] = total;
+    total += tmp;
+  }
+  ctx_assert2(total == uidx->num_unitigs, "%zu vs %zu", total, uidx->num_unitigs);
+  util_multi_thread(&rn, nthreads, _renumber_assign);
+  util_multi_thread(&rn, nthreads, _renumber_kmers);
+
+  // Permute unitig entries in place by following cycles
+  for(i = 0; i < uidx->num_unitigs; i++) {
+    while((j = rn.newids[i]) != i) {
+      SWAP(uidx->unitigs[i], uidx->unitigs[j]);
+      SWAP(rn.newids[i], rn.newids[j]);
+    }
+  }
+
+  ctx_free(rn.counts);
+  ctx_free(rn.newids);
+}
+
+/**
+ * Label every kmer in the graph with its unitig
+ * Unitigs are numbered in hash table order of their first kmer
+ * @param visited must be initialised to zero, will be dirty upon return
+ **/
+void unitig_index_build(UnitigIndex *uidx, size_t nthreads, uint8_t *visited)
+{
+  const dBGraph *db_graph = uidx->db_graph;
+  size_t nkmers = hash_table_nkmers(&db_graph->ht);
+
+  // There cannot be more unitigs than kmers
+  ctx_free(uidx->unitigs);
+  uidx->unitigs = ctx_malloc(MAX2(nkmers, 1) * sizeof(UnitigIndexEntry));
+  uidx->num_unitigs = uidx->num_kmers = 0;
+
+  db_unitigs_iterate(nthreads, visited, db_graph, _index_unitig, uidx);
+
+  ctx_assert(uidx->num_kmers == nkmers);
+  unitig_index_renumber(uidx, nthreads);
+  size_t n = MAX2(uidx->num_unitigs, 1);
+  uidx->unitigs = ctx_realloc(uidx->unitigs, n * sizeof(UnitigIndexEntry));
+}
+
+// Write index to `fout`, returns number of bytes written
+// `path` is only used for error messages
+size_t unitig_index_write(const UnitigIndex *uidx, FILE *fout, const char *path)
+{
+  const dBGraph *db_graph = uidx->db_graph;
+  uint32_t version = UNITIG_INDEX_VERSION;
+  uint32_t kmer_size = db_graph->kmer_size, kmer_words = NUM_BKMER_WORDS;
+  uint64_t num_kmers = uidx->num_kmers, num_unitigs = uidx->num_unitigs;
+  size_t i, nbytes = 0;
+
+  nbytes += fwrite(UNITIG_INDEX_MAGIC, 1, strlen(UNITIG_INDEX_MAGIC), fout);
+  nbytes += fwrite(&version,     1, sizeof(version),     fout);
+  nbytes += fwrite(&kmer_size,   1, sizeof(kmer_size),   fout);
+  nbytes += fwrite(&kmer_words,  1, sizeof(kmer_words),  fout);
+  nbytes += fwrite(&num_kmers,   1, sizeof(num_kmers),   fout);
+  nbytes += fwrite(&num_unitigs, 1, sizeof(num_unitigs), fout);
+
+  for(i = 0; i < uidx->num_unitigs; i++) {
+    const UnitigIndexEntry *e = &uidx->unitigs[i];
+    BinaryKmer bkey = db_node_get_bkey(db_graph, e->first.key);
+    uint8_t orient = e->first.orient;
+    nbytes += fwrite(bkey.b,  1, sizeof(BinaryKmer), fout);
+    nbytes += fwrite(&orient, 1, sizeof(orient),     fout);
+    nbytes += fwrite(&e->len, 1, sizeof(e->len),     fout);
+  }
+
+  size_t expbytes = strlen(UNITIG_INDEX_MAGIC) + 3*sizeof(uint32_t) +
+                    2*sizeof(uint64_t) +
+                    num_unitigs * (sizeof(BinaryKmer)+sizeof(uint8_t)+
+                                   sizeof(uint32_t));
+
+  if(nbytes != expbytes)
+    die("Cannot write to file: %s", futil_outpath_str(path));
+
+  return nbytes;
+}
+
+typedef struct {
+  UnitigIndex *uidx;
+  size_t nthreads;
+  const char *path;
+} UnitigIndexLoader;
+
+// Each thread walks unitigs [tid*n/nthreads .. (tid+1)*n/nthreads)
+static void unitig_index_load_thread(void *arg, size_t threadid)
+{
+  UnitigIndexLoader *ldr = (UnitigIndexLoader*)arg;
+  UnitigIndex *uidx = ldr->uidx;
+  size_t i, n = uidx->num_unitigs;
+  size_t start = threadid*n/ldr->nthreads, end = (threadid+1)*n/ldr->nthreads;
+
+  dBNodeBuffer nbuf;
+  db_node_buf_alloc(&nbuf, 1024);
+
+  for(i = start; i < end; i++) {
+    const UnitigIndexEntry e = uidx->unitigs[i];
+    db_node_buf_reset(&nbuf);
+    db_node_buf_add(&nbuf, e.first);
+    if(!db_unitig_extend(&nbuf, e.len, uidx->db_graph) || nbuf.len != e.len)
+      die("Unitig index does not match graph: %s", ldr->path);
+    unitig_index_store(nbuf.b, nbuf.len, i, uidx);
+  }
+
+  db_node_buf_dealloc(&nbuf);
+}
+
+// Read index written with unitig_index_write()
+// All kmers from the original graph must be loaded into uidx->db_graph
+// Dies if the file does not match the graph
+void unitig_index_read(UnitigIndex *uidx, size_t nthreads,
+                       FILE *fin, const char *path)
+{
+  const dBGraph *db_graph = uidx->db_graph;
+  char magic[sizeof(UNITIG_INDEX_MAGIC)];
+  uint32_t version, kmer_size, kmer_words;
+  uint64_t num_kmers, num_unitigs, i, sum_len = 0;
+  BinaryKmer bkey;
+  uint8_t orient;
+  uint32_t len;
+  hkey_t hkey;
+
+  magic[sizeof(magic)-1] = '\0';
+  if(fread(magic, 1, sizeof(magic)-1, fin) != sizeof(magic)-1 ||
+     strcmp(magic, UNITIG_INDEX_MAGIC) != 0 ||
+     fread(&version,     1, sizeof(version),     fin) != sizeof(version) ||
+     fread(&kmer_size,   1, sizeof(kmer_size),   fin) != sizeof(kmer_size) ||
+     fread(&kmer_words,  1, sizeof(kmer_words),  fin) != sizeof(kmer_words) ||
+     fread(&num_kmers,   1, sizeof(num_kmers),   fin) != sizeof(num_kmers) ||
+     fread(&num_unitigs, 1, sizeof(num_unitigs), fin) != sizeof(num_unitigs))
+  {
+    die("Not a unitig index file: %s", path);
+  }
+
+  if(version != UNITIG_INDEX_VERSION)
+    die("Unitig index version %u not supported: %s", version, path);
+  if(kmer_size != db_graph->kmer_size || kmer_words != NUM_BKMER_WORDS)
+    die("Unitig index kmer size %u does not match graph: %s", kmer_size, path);
+  if(num_kmers != hash_table_nkmers(&db_graph->ht))
+    die("Unitig index has %zu kmers, graph has %zu: %s", (size_t)num_kmers,
+        (size_t)hash_table_nkmers(&db_graph->ht), path);
+
+  ctx_free(uidx->unitigs);
+  uidx->unitigs = ctx_malloc(MAX2(num_unitigs, 1) * sizeof(UnitigIndexEntry));
+  uidx->num_unitigs = num_unitigs;
+  uidx->num_kmers = num_kmers;
+
+  for(i = 0; i < num_unitigs; i++) {
+    if(fread(bkey.b,  1, sizeof(BinaryKmer), fin) != sizeof(BinaryKmer) ||
+       fread(&orient, 1, sizeof(orient),     fin) != sizeof(orient) ||
+       fread(&len,    1, sizeof(len),        fin) != sizeof(len) ||
+       orient > 1 || len == 0)
+    {
+      die("Corrupt unitig index file: %s", path);
+    }
+    hkey = hash_table_find(&db_graph->ht, bkey);
+    if(hkey == HASH_NOT_FOUND)
+      die("Unitig index does not match graph: %s", path);
+    uidx->unitigs[i].first = (dBNode){.key = hkey, .orient = orient};
+    uidx->unitigs[i].len = len;
+    sum_len += len;
+  }
+
+  if(sum_len != num_kmers) die("Corrupt unitig index file: %s", path);
+
+  UnitigIndexLoader ldr = {.uidx = uidx, .nthreads = nthreads, .path = path};
+  util_multi_thread(&ldr, nthreads, unitig_index_load_thread);
+}
+
+//
+// Unitig coverage prefix sums
+//
+
+void unitig_covgs_alloc(UnitigCovgs *ucovgs, const UnitigIndex *uidx)
+{
+  size_t ncols = uidx->db_graph->num_of_cols;
+  size_t nsums = (uidx->num_kmers + uidx->num_unitigs) * ncols;
+  memset(ucovgs, 0, sizeof(*ucovgs));
+  ucovgs->uidx = uidx;
+  ucovgs->ncols = ncols;
+  ucovgs->starts = ctx_malloc(MAX2(uidx->num_unitigs, 1) * sizeof(uint64_t));
+  ucovgs->sums = ctx_malloc(MAX2(nsums, 1) * sizeof(uint64_t));
+}
+
+void unitig_covgs_dealloc(UnitigCovgs *ucovgs)
+{
+  ctx_free(ucovgs->starts);
+  ctx_free(ucovgs->sums);
+  memset(ucovgs, 0, sizeof(*ucovgs));
+}
+
+typedef struct {
+  UnitigCovgs *ucovgs;
+  size_t nthreads;
+} UnitigCovgsBuilder;
+
+// Store the coverage of each kmer after the sums row for its position
+static void _ucovgs_store_kmers(void *arg, size_t threadid)
+{
+  const UnitigCovgsBuilder *bld = (const UnitigCovgsBuilder*)arg;
+  UnitigCovgs *ucovgs = bld->ucovgs;
+  const UnitigIndex *uidx = ucovgs->uidx;
+  const dBGraph *db_graph = uidx->db_graph;
+  const size_t ncols = ucovgs->ncols, capacity = db_graph->ht.capacity;
+  size_t h, uid, col, start, end;
+  uint64_t *row;
+
+  start = capacity *  threadid    / bld->nthreads;
+  end   = capacity * (threadid+1) / bld->nthreads;
+
+  for(h = start; h < end; h++) {
+    uid = uidx->kmers[h].unitigid;
+    if(uid == UNITIG_INDEX_NONE) continue;
+    row = ucovgs->sums + (ucovgs->starts[uid] + uid + uidx->offsets[h] + 1)*ncols;
+    for(col = 0; col < ncols; col++)
+      row[col] = db_node_get_covg(db_graph, h, col);
+  }
+}
+
+// Turn the coverages of each unitig into prefix sums
+static void _ucovgs_sum_unitigs(void *arg, size_t threadid)
+{
+  const UnitigCovgsBuilder *bld = (const UnitigCovgsBuilder*)arg;
+  UnitigCovgs *ucovgs = bld->ucovgs;
+  const UnitigIndex *uidx = ucovgs->uidx;
+  const size_t ncols = ucovgs->ncols, n = uidx->num_unitigs;
+  size_t uid, i, col, start, end;
+  uint64_t *row;
+
+  start = n *  threadid    / bld->nthreads;
+  end   = n * (threadid+1) / bld->nthreads;
+
+  for(uid = start; uid < end; uid++) {
+    row = ucovgs->sums + (ucovgs->starts[uid] + uid)*ncols;
+    memset(row, 0, ncols * sizeof(uint64_t));
+    for(i = 0; i < uidx->unitigs[uid].len; i++, row += ncols)
+      for(col = 0; col < ncols; col++)
+        row[ncols+col] += row[col];
+  }
+}
+
+void unitig_covgs_build(UnitigCovgs *ucovgs, size_t nthreads)
+{
+  const UnitigIndex *uidx = ucovgs->uidx;
+  ctx_assert(uidx->db_graph->col_covgs != NULL);
+  size_t i;
+  uint64_t total = 0;
+
+  for(i = 0; i < uidx->num_unitigs; i++) {
+    ucovgs->starts[i] = total;
+    total += uidx->unitigs[i].len;
+  }
+  ctx_assert(total == uidx->num_kmers);
+
+  UnitigCovgsBuilder bld = {.ucovgs = ucovgs, .nthreads = nthreads};
+  util_multi_thread(&bld, nthreads, _ucovgs_store_kmers);
+  util_multi_thread(&bld, nthreads, _ucovgs_sum_unitigs);
+}
@@ -2,6 +2,7 @@
 #define UNITIG_GRAPH_H_
 
 #include "db_graph.h"
+#include "db_node.h"
 
 /**
  * Each unitig end is packed into 64 bits
@@ -46,4 +47,152 @@ void unitig_graph_create(UnitigKmerGraph *ugraph,
 void unitig_graph_alloc(UnitigKmerGraph *ugraph, const dBGraph *db_graph);
 void unitig_graph_dealloc(UnitigKmerGraph *ugraph);
 
+//
+// Unitig index
+//
+// Labels every kmer with the unitig it belongs to and its offset in that
+// unitig, and stores the first and last node of every unitig, so we can jump
+// from any kmer to the ends of its unitig without walking edges. Unitigs are
+// normalised (see db_unitig_normalise()). The index must be rebuilt if kmers
+// or edges are changed.
+//
+// Saved to a file (e.g. next to the .ctx file as <in.ctx>.uidx):
+//
+//   "CTXUNIDX"<uint32_t:version><uint32_t:kmer_size><uint32_t:kmer_words>
+//   <uint64_t:num_kmers><uint64_t:num_unitigs>
+//   [<BinaryKmer:first kmer key><uint8_t:orient><uint32_t:len>]*num_unitigs
+//
+// Per-kmer labels are not stored since hash table positions are not kept
+// between runs. Loading walks each unitig once from its first node.
+//
+
+#define UNITIG_INDEX_MAGIC "CTXUNIDX"
+#define UNITIG_INDEX_VERSION 1
+
+// Unitig id of kmers not in a unitig
+#define UNITIG_INDEX_NONE ((UINT64_C(1)<<63)-1)
+
+// Memory required per kmer in the hash table
+#define UNITIG_INDEX_BITS_PER_KMER \
+        ((sizeof(UnitigIndexKmer)+sizeof(uint32_t)+sizeof(UnitigIndexEntry))*8)
+
+typedef struct {
+  uint64_t unitigid:63, orient:1; // orient of kmer in the unitig
+} UnitigIndexKmer;
+
+typedef struct {
+  dBNode first, last;
+  uint32_t len;
+} UnitigIndexEntry;
+
+typedef struct {
+  UnitigIndexKmer *kmers; // [capacity] indexed by hkey
+  uint32_t *offsets; // [capacity] offset of kmer in its unitig
+  UnitigIndexEntry *unitigs; // [num_unitigs]
+  size_t num_unitigs, num_kmers;
+  const dBGraph *db_graph;
+} UnitigIndex;
+
+void unitig_index_alloc(UnitigIndex *uidx, const dBGraph *db_graph);
+void unitig_index_dealloc(UnitigIndex *uidx);
+
+/**
+ * Label every kmer in the graph with its unitig
+ * Unitigs are numbered in hash table order of their first kmer, so ids do not
+ * depend on the number of threads used
+ * @param visited must be initialised to zero, will be dirty upon return
+ **/
+void unitig_index_build(UnitigIndex *uidx, size_t nthreads, uint8_t *visited);
+
+// Returns unitig id of kmer `hkey` or UNITIG_INDEX_NONE
+static inline size_t unitig_index_id(const UnitigIndex *uidx, hkey_t hkey)
+{
+  return uidx->kmers[hkey].unitigid;
+}
+
+// Get unitig containing `node`, with `node` in the given orientation
+// Sets `first` and `last` to the ends of the unitig in the orientation that
+// contains `node` and returns its offset from `first`
+static inline size_t unitig_index_ends(const UnitigIndex *uidx, dBNode node,
+                                       dBNode *first, dBNode *last)
+{
+  UnitigIndexKmer k = uidx->kmers[node.key];
+  ctx_assert(k.unitigid != UNITIG_INDEX_NONE);
+  const UnitigIndexEntry *e = &uidx->unitigs[k.unitigid];
+  size_t offset = uidx->offsets[node.key];
+
+  if(node.orient == k.orient) {
+    *first = e->first; *last = e->last;
+    return offset;
+  } else {
+    *first = db_node_reverse(e->last); *last = db_node_reverse(e->first);
+    return e->len - 1 - offset;
+  }
+}
+
+// Write index to `fout`, returns number of bytes written
+// `path` is only used for error messages
+size_t unitig_index_write(const UnitigIndex *uidx, FILE *fout, const char *path);
+
+// Read index written with unitig_index_write()
+// All kmers from the original graph must be loaded into uidx->db_graph
+// Dies if the file does not match the graph
+void unitig_index_read(UnitigIndex *uidx, size_t nthreads,
+                       FILE *fin, const char *path);
+
+//
+// Unitig coverage prefix sums
+//
+// For each unitig and colour, the sums of kmer coverage of the first 0,1,..,len
+// kmers of the (normalised) unitig, so the total coverage of any run of kmers
+// within a unitig is two lookups. Unitig `uid` has len+1 sums per colour,
+// stored from (starts[uid]+uid)*ncols, one row of ncols sums per position.
+// Built from a UnitigIndex, which must be kept as kmers are located with it.
+// Must be rebuilt if coverages change.
+//
+
+typedef struct {
+  uint64_t *starts; // [num_unitigs] number of kmers in unitigs before each one
+  uint64_t *sums; // [(num_kmers+num_unitigs)*ncols]
+  size_t ncols;
+  const UnitigIndex *uidx;
+} UnitigCovgs;
+
+void unitig_covgs_alloc(UnitigCovgs *ucovgs, const UnitigIndex *uidx);
+void unitig_covgs_dealloc(UnitigCovgs *ucovgs);
+void unitig_covgs_build(UnitigCovgs *ucovgs, size_t nthreads);
+
+// Sum of coverage in colour `col` of kmers [start,end) of unitig `uid`
+static inline uint64_t unitig_covgs_range(const UnitigCovgs *ucovgs, size_t uid,
+                                          size_t start, size_t end, size_t col)
+{
+  ctx_assert(start <= end && end <= ucovgs->uidx->unitigs[uid].len);
+  const uint64_t *sums = ucovgs->sums +
+                         (ucovgs->starts[uid] + uid) * ucovgs->ncols + col;
+  return sums[end*ucovgs->ncols] - sums[start*ucovgs->ncols];
+}
+
+// Sum of coverage in colour `col` of the `n` kmers from `node` onwards, which
+// must all be in the unitig of `node`
+static inline uint64_t unitig_covgs_sum(const UnitigCovgs *ucovgs, dBNode node,
+                                        size_t n, size_t col)
+{
+  const UnitigIndex *uidx = ucovgs->uidx;
+  UnitigIndexKmer k = uidx->kmers[node.key];
+  size_t offset = uidx->offsets[node.key];
+  ctx_assert(k.unitigid != UNITIG_INDEX_NONE);
+  if(node.orient == k.orient)
+    return unitig_covgs_range(ucovgs, k.unitigid, offset, offset+n, col);
+  else
+    return unitig_covgs_range(ucovgs, k.unitigid, offset+1-n, offset+1, col);
+}
+
+// Mean coverage in colour `col` of unitig `uid` (rounded down)
+static inline size_t unitig_covgs_mean(const UnitigCovgs *ucovgs, size_t uid,
+                                       size_t col)
+{
+  size_t len = ucovgs->uidx->unitigs[uid].len;
+  return unitig_covgs_range(ucovgs, uid, 0, len, col) / len;
+}
+
 #endif /* UNITIG_GRAPH_H_ */
@@ -0,0 +1,489 @@
+#include "global.h"
+#include "unitig_load.h"
+#include "db_node.h"
+#include "file_util.h"
+#include "util.h"
+#include "dna.h"
+
+#include "sort_r/sort_r.h"
+
+void unitig_set_alloc(UnitigSet *us)
+{
+  memset(us, 0, sizeof(*us));
+  strbuf_alloc(&us->seq, 1<<20);
+  size_buf_alloc(&us->seqstart, 1024);
+  uint32_buf_alloc(&us->covgs, 1024);
+  size_buf_alloc(&us->kcounts, 1024);
+  byte_buf_alloc(&us->prev, 1024);
+  byte_buf_alloc(&us->next, 1024);
+  unitig_link_buf_alloc(&us->links, 1024);
+  strbuf_alloc(&us->names, 4096);
+  strbuf_alloc(&us->lnames, 4096);
+  size_buf_alloc(&us->nameoff, 1024);
+  size_buf_alloc(&us->lnameoff, 2048);
+  size_buf_add(&us->seqstart, 0);
+}
+
+void unitig_set_dealloc(UnitigSet *us)
+{
+  strbuf_dealloc(&us->seq);
+  size_buf_dealloc(&us->seqstart);
+  uint32_buf_dealloc(&us->covgs);
+  size_buf_dealloc(&us->kcounts);
+  byte_buf_dealloc(&us->prev);
+  byte_buf_dealloc(&us->next);
+  unitig_link_buf_dealloc(&us->links);
+  strbuf_dealloc(&us->names);
+  strbuf_dealloc(&us->lnames);
+  size_buf_dealloc(&us->nameoff);
+  size_buf_dealloc(&us->lnameoff);
+  memset(us, 0, sizeof(*us));
+}
+
+//
+// Reading
+//
+
+static void unitig_start(UnitigSet *us, const char *name)
+{
+  size_buf_add(&us->nameoff, us->names.end);
+  strbuf_append_str(&us->names, name);
+  strbuf_append_char(&us->names, '\0');
+  uint32_buf_add(&us->covgs, 0);
+  size_buf_add(&us->kcounts, 0);
+  byte_buf_add(&us->prev, 0);
+  byte_buf_add(&us->next, 0);
+  us->num_unitigs++;
+}
+
+static void unitig_end(UnitigSet *us)
+{
+  size_buf_add(&us->seqstart, us->seq.end);
+}
+
+static void link_name_add(UnitigSet *us, const char *name)
+{
+  size_buf_add(&us->lnameoff, us->lnames.end);
+  strbuf_append_str(&us->lnames, name);
+  strbuf_append_char(&us->lnames, '\0');
+}
+
+// Link ends are resolved by name in unitig_set_finish()
+static void link_add(UnitigSet *us, const char *from, char or0,
+                     const char *to, char or1)
+{
+  UnitigLink link = {.from = 0, .to = 0,
+                     .from_orient = or0 == '+' ? FORWARD : REVERSE,
+                     .to_orient   = or1 == '+' ? FORWARD : REVERSE};
+  unitig_link_buf_add(&us->links, link);
+  link_name_add(us, from);
+  link_name_add(us, to);
+}
+
+static inline bool is_orient_char(const char *str)
+{
+  return (str[0] == '+' || str[0] == '-') && str[1] == '\0';
+}
+
+// Edges from a prev=/next= field, bit n set for base n
+static bool parse_edge_bases(const char *str, uint8_t *edges)
+{
+  *edges = 0;
+  for(; *str; str++) {
+    if(!char_is_acgt(*str)) return false;
+    *edges |= 1 << dna_char_to_nuc(*str);
+  }
+  return true;
+}
+
+// Coverage tags: KC:i:<sum of kmer coverage>, km:f:<mean kmer coverage>
+// Returns false if not a coverage tag
+static bool parse_covg_tag(UnitigSet *us, const char *tag,
+                           const char *path, size_t lineno)
+{
+  size_t kc;
+  double km;
+  if(!strncmp(tag, "KC:i:", 5)) {
+    if(!parse_entire_size(tag+5, &kc))
+      die("Bad KC tag [%s:%zu]: %s", path, lineno, tag);
+    us->kcounts.b[us->num_unitigs-1] = kc;
+  }
+  else if(!strncmp(tag, "km:f:", 5)) {
+    if(!parse_entire_double(tag+5, &km) || km < 0)
+      die("Bad km tag [%s:%zu]: %s", path, lineno, tag);
+    us->covgs.b[us->num_unitigs-1] = MIN2(km+0.5, (double)COVG_MAX);
+  }
+  else return false;
+  return true;
+}
+
+// ">name prev=AC next=G KC:i:20 L:+:name2:-"
+static void parse_fasta_hdr(UnitigSet *us, char *hdr,
+                            const char *path, size_t lineno)
+{
+  char *save = NULL, *name, *tok, *lname, *or1;
+  if((name = strtok_r(hdr+1, " \t", &save)) == NULL)
+    die("FASTA entry without a name [%s:%zu]", path, lineno);
+
+  unitig_start(us, name);
+  size_t u = us->num_unitigs-1;
+
+  while((tok = strtok_r(NULL, " \t", &save)) != NULL)
+  {
+    if(!strncmp(tok, "prev=", 5)) {
+      if(!parse_edge_bases(tok+5, &us->prev.b[u]))
+        die("Bad prev= [%s:%zu]: %s", path, lineno, tok);
+    }
+    else if(!strncmp(tok, "next=", 5)) {
+      if(!parse_edge_bases(tok+5, &us->next.b[u]))
+        die("Bad next= [%s:%zu]: %s", path, lineno, tok);
+    }
+    else if(!strncmp(tok, "L:", 2)) {
+      // L:<+|->:<name>:<+|->
+      lname = tok+4;
+      or1 = strrchr(tok, ':');
+      if((tok[2] != '+' && tok[2] != '-') || tok[3] != ':' ||
+         or1 <= lname || !is_orient_char(or1+1))
+        die("Bad link [%s:%zu]: %s", path, lineno, tok);
+      *or1 = '\0';
+      link_add(us, name, tok[2], lname, or1[1]);
+    }
+    else parse_covg_tag(us, tok, path, lineno);
+  }
+}
+
+// S <name> <seq> [tags]
+static void parse_gfa_segment(UnitigSet *us, char *line,
+                              const char *path, size_t lineno)
+{
+  char *save = NULL, *name, *seq, *tok;
+  strtok_r(line, "\t", &save);
+  if((name = strtok_r(NULL, "\t", &save)) == NULL ||
+     (seq = strtok_r(NULL, "\t", &save)) == NULL)
+    die("Bad GFA segment [%s:%zu]", path, lineno);
+  if(!strcmp(seq, "*"))
+    die("GFA segment without sequence [%s:%zu]: %s", path, lineno, name);
+
+  unitig_start(us, name);
+  strbuf_append_str(&us->seq, seq);
+  unitig_end(us);
+
+  while((tok = strtok_r(NULL, "\t", &save)) != NULL)
+    parse_covg_tag(us, tok, path, lineno);
+}
+
+// L <from> <+|-> <to> <+|-> <overlap>
+static void parse_gfa_link(UnitigSet *us, char *line,
+                           const char *path, size_t lineno)
+{
+  char *save = NULL, *f[5];
+  size_t i, overlap, len;
+  strtok_r(line, "\t", &save);
+  for(i = 0; i < 5; i++)
+    if((f[i] = strtok_r(NULL, "\t", &save)) == NULL)
+      die("Bad GFA link [%s:%zu]", path, lineno);
+  if(!is_orient_char(f[1]) || !is_orient_char(f[3]))
+    die("Bad GFA link orientation [%s:%zu]", path, lineno);
+
+  // Overlap is <k-1>M or '*'
+  if(strcmp(f[4], "*") != 0) {
+    len = strlen(f[4]);
+    if(len < 2 || f[4][len-1] != 'M') die("Bad overlap [%s:%zu]: %s", path, lineno, f[4]);
+    f[4][len-1] = '\0';
+    if(!parse_entire_size(f[4], &overlap))
+      die("Bad overlap [%s:%zu]: %sM", path, lineno, f[4]);
+    if(us->kmer_size == 0) us->kmer_size = overlap+1;
+    else if(us->kmer_size != overlap+1)
+      die("Links have different overlaps [%s:%zu]: %zuM vs %zuM",
+          path, lineno, overlap, us->kmer_size-1);
+  }
+
+  link_add(us, f[0], f[1][0], f[2], f[3][0]);
+}
+
+void unitig_set_read(UnitigSet *us, const char *path)
+{
+  gzFile gz = futil_gzopen(path, "r");
+  StrBuf line;
+  strbuf_alloc(&line, 1024);
+  size_t lineno = 0, nunitigs = us->num_unitigs, nlinks = us->links.len;
+  bool in_fasta = false;
+
+  while(futil_gzcheck(strbuf_reset_gzreadline(&line, gz), gz, path) > 0)
+  {
+    lineno++;
+    strbuf_chomp(&line);
+    if(line.end == 0) continue;
+
+    if(line.b[0] == '>') {
+      if(in_fasta) unitig_end(us);
+      parse_fasta_hdr(us, line.b, path, lineno);
+      in_fasta = true;
+    }
+    else if(in_fasta) strbuf_append_strn(&us->seq, line.b, line.end);
+    else if(line.b[0] == 'S' && line.b[1] == '\t')
+      parse_gfa_segment(us, line.b, path, lineno);
+    else if(line.b[0] == 'L' && line.b[1] == '\t')
+      parse_gfa_link(us, line.b, path, lineno);
+    else if(line.b[0] == '#' || line.b[1] == '\t') {} // comments, other records
+    else die("Not FASTA or GFA [%s:%zu]: %s", path, lineno, line.b);
+  }
+
+  if(in_fasta) unitig_end(us);
+
+  gzutil_fclose(gz);
+  strbuf_dealloc(&line);
+
+  status("[unitigs] Read %zu unitigs, %zu links from %s",
+         us->num_unitigs - nunitigs, us->links.len - nlinks,
+         futil_inpath_str(path));
+}
+
+//
+// Resolving
+//
+
+static int _name_cmp(const void *aa, const void *bb, void *arg)
+{
+  const UnitigSet *us = (const UnitigSet*)arg;
+  const size_t a = *(const size_t*)aa, b = *(const size_t*)bb;
+  return strcmp(us->names.b + us->nameoff.b[a], us->names.b + us->nameoff.b[b]);
+}
+
+// `order` is unitigs sorted by name
+static size_t name_find(const UnitigSet *us, const size_t *order,
+                        const char *name)
+{
+  size_t lo = 0, hi = us->num_unitigs, mid;
+  int c;
+  while(lo < hi) {
+    mid = lo + (hi-lo)/2;
+    c = strcmp(name, us->names.b + us->nameoff.b[order[mid]]);
+    if(c == 0) return order[mid];
+    if(c < 0) hi = mid;
+    else lo = mid+1;
+  }
+  die("Link to unknown unitig: %s", name);
+}
+
+static bool seq_is_acgt(const char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len && char_is_acgt(seq[i]); i++) {}
+  return i == len;
+}
+
+void unitig_set_finish(UnitigSet *us, size_t kmer_size)
+{
+  size_t i, len, nkmers, kc;
+  const char *seq;
+
+  if(kmer_size == 0) kmer_size = us->kmer_size;
+  if(kmer_size == 0) die("Cannot tell kmer size from links, please give -k <K>");
+  if(us->kmer_size && us->kmer_size != kmer_size)
+    die("Link overlaps (%zuM) do not match k=%zu", us->kmer_size-1, kmer_size);
+  us->kmer_size = kmer_size;
+
+  us->num_kmers = 0;
+  us->num_bases = us->seq.end;
+
+  for(i = 0; i < us->num_unitigs; i++)
+  {
+    seq = us->seq.b + us->seqstart.b[i];
+    len = us->seqstart.b[i+1] - us->seqstart.b[i];
+    if(len < kmer_size)
+      die("Unitig shorter than k=%zu: %s", kmer_size, us->names.b + us->nameoff.b[i]);
+    if(!seq_is_acgt(seq, len))
+      die("Unitig has non-ACGT bases: %s", us->names.b + us->nameoff.b[i]);
+
+    nkmers = len - kmer_size + 1;
+    us->num_kmers += nkmers;
+
+    // KC is the sum of coverage over kmers, km the mean
+    kc = us->kcounts.b[i];
+    if(us->covgs.b[i] == 0 && kc > 0)
+      us->covgs.b[i] = MIN2((kc + nkmers/2) / nkmers, COVG_MAX);
+    if(us->covgs.b[i] == 0) us->covgs.b[i] = 1;
+  }
+
+  if(us->links.len == 0) return;
+
+  size_t *order = ctx_malloc(us->num_unitigs * sizeof(size_t));
+  for(i = 0; i < us->num_unitigs; i++) order[i] = i;
+  sort_r(order, us->num_unitigs, sizeof(size_t), _name_cmp, us);
+
+  for(i = 1; i < us->num_unitigs; i++)
+    if(_name_cmp(&order[i-1], &order[i], us) == 0)
+      die("Unitig name used twice: %s", us->names.b + us->nameoff.b[order[i]]);
+
+  for(i = 0; i < us->links.len; i++) {
+    us->links.b[i].from = name_find(us, order, us->lnames.b + us->lnameoff.b[2*i]);
+    us->links.b[i].to   = name_find(us, order, us->lnames.b + us->lnameoff.b[2*i+1]);
+  }
+
+  ctx_free(order);
+}
+
+//
+// Loading into the graph
+//
+
+typedef struct
+{
+  const UnitigSet *us;
+  dBGraph *db_graph;
+  Colour col;
+  dBNode *ends; // [2*num_unitigs] first and last node of each unitig
+  BinaryKmer **bkeys;
+  hkey_t **hkeys;
+  Orientation **orients;
+} UnitigLoader;
+
+// Each unitig owns its kmers, so its edges and coverages can be written
+// without atomic operations. Colour bits share words, so are set with _mt.
+static bool unitigs_load_range(size_t start, size_t end, size_t tid, void *arg)
+{
+  UnitigLoader *ldr = (UnitigLoader*)arg;
+  const UnitigSet *us = ldr->us;
+  dBGraph *db_graph = ldr->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  const Colour col = ldr->col;
+  BinaryKmer *bkeys = ldr->bkeys[tid];
+  hkey_t *hkeys = ldr->hkeys[tid];
+  Orientation *orients = ldr->orients[tid];
+  BinaryKmerIter it;
+  Nucleotide nuc;
+  size_t u, i, len, nkmers;
+  Edges edges;
+  uint8_t b;
+  const char *seq;
+
+  for(u = start; u < end; u++)
+  {
+    seq = us->seq.b + us->seqstart.b[u];
+    len = us->seqstart.b[u+1] - us->seqstart.b[u];
+    nkmers = len - kmer_size + 1;
+
+    binary_kmer_iter_init(&it, seq, kmer_size);
+    for(i = 0; i < nkmers; i++) {
+      binary_kmer_iter_next(&it, dna_char_to_nuc(seq[i+kmer_size-1]));
+      bkeys[i] = binary_kmer_iter_key(&it, &orients[i]);
+    }
+
+    hash_table_insert_batch_mt(&db_graph->ht, bkeys, nkmers, HT_PREFETCH_DEPTH,
+                               hkeys, db_graph->bktlocks);
+
+    ldr->ends[2*u]   = (dBNode){.key = hkeys[0],        .orient = orients[0]};
+    ldr->ends[2*u+1] = (dBNode){.key = hkeys[nkmers-1], .orient = orients[nkmers-1]};
+
+    if(db_graph->col_edges != NULL)
+    {
+      for(i = 0; i < nkmers; i++) {
+        edges = 0;
+        if(i > 0) {
+          nuc = dna_nuc_complement(dna_char_to_nuc(seq[i-1]));
+          edges |= nuc_orient_to_edge(nuc, !orients[i]);
+        }
+        if(i+1 < nkmers) {
+          nuc = dna_char_to_nuc(seq[i+kmer_size]);
+          edges |= nuc_orient_to_edge(nuc, orients[i]);
+        }
+        db_node_edges(db_graph, hkeys[i], col) = edges;
+      }
+
+      // Edges out of the ends from FASTA prev= / next=
+      for(b = 0; b < 4; b++) {
+        if(us->prev.b[u] & (1<<b)) {
+          edges = nuc_orient_to_edge(dna_nuc_complement(b), !orients[0]);
+          db_node_edges(db_graph, hkeys[0], col) |= edges;
+        }
+        if(us->next.b[u] & (1<<b)) {
+          edges = nuc_orient_to_edge(b, orients[nkmers-1]);
+          db_node_edges(db_graph, hkeys[nkmers-1], col) |= edges;
+        }
+      }
+    }
+
+    if(db_graph->col_covgs != NULL) {
+      for(i = 0; i < nkmers; i++)
+        db_node_set_covg(db_graph, hkeys[i], col, us->covgs.b[u]);
+    }
+
+    if(db_graph->node_in_cols != NULL) {
+      for(i = 0; i < nkmers; i++)
+        db_node_set_col_mt(db_graph, hkeys[i], col);
+    }
+  }
+
+  return false;
+}
+
+// Links join the last kmer of one unitig to the first of another, which may
+// be being written by another thread, so these use atomic edge adds
+static bool unitig_links_range(size_t start, size_t end, size_t tid, void *arg)
+{
+  (void)tid;
+  const UnitigLoader *ldr = (const UnitigLoader*)arg;
+  const UnitigLink *links = ldr->us->links.b;
+  dBNode src, tgt;
+  size_t i;
+
+  for(i = start; i < end; i++) {
+    // Leave `from` by its last kmer (first reversed if '-'),
+    // enter `to` by its first kmer (last reversed if '-')
+    src = links[i].from_orient == FORWARD ? ldr->ends[2*links[i].from+1]
+                                          : db_node_reverse(ldr->ends[2*links[i].from]);
+    tgt = links[i].to_orient == FORWARD ? ldr->ends[2*links[i].to]
+                                        : db_node_reverse(ldr->ends[2*links[i].to+1]);
+    db_graph_add_edge_mt(ldr->db_graph, ldr->col, src, tgt);
+  }
+
+  return false;
+}
+
+void unitig_set_load(const UnitigSet *us, dBGraph *db_graph, Colour col,
+                     size_t nthreads)
+{
+  ctx_assert(us->kmer_size == db_graph->kmer_size);
+  ctx_assert(db_graph->bktlocks != NULL);
+  ctx_assert(col < db_graph->num_of_cols);
+  ctx_assert(db_graph->col_edges == NULL || col < db_graph->num_edge_cols);
+
+  size_t i, maxkmers = 0;
+  for(i = 0; i < us->num_unitigs; i++)
+    maxkmers = MAX2(maxkmers, us->seqstart.b[i+1] - us->seqstart.b[i]);
+  if(maxkmers >= us->kmer_size) maxkmers = maxkmers - us->kmer_size + 1;
+
+  UnitigLoader ldr = {.us = us, .db_graph = db_graph, .col = col};
+  ldr.ends = ctx_malloc(2 * us->num_unitigs * sizeof(dBNode));
+  ldr.bkeys = ctx_calloc(nthreads, sizeof(BinaryKmer*));
+  ldr.hkeys = ctx_calloc(nthreads, sizeof(hkey_t*));
+  ldr.orients = ctx_calloc(nthreads, sizeof(Orientation*));
+
+  for(i = 0; i < nthreads; i++) {
+    ldr.bkeys[i] = ctx_malloc(maxkmers * sizeof(BinaryKmer));
+    ldr.hkeys[i] = ctx_malloc(maxkmers * sizeof(hkey_t));
+    ldr.orients[i] = ctx_malloc(maxkmers * sizeof(Orientation));
+  }
+
+  status("[unitigs] Loading %zu unitigs (%zu kmers) with %zu thread%s",
+         us->num_unitigs, us->num_kmers, nthreads, util_plural_str(nthreads));
+
+  if(us->num_unitigs > 0)
+    util_run_ranges(us->num_unitigs, 64, nthreads, unitigs_load_range, &ldr);
+
+  if(us->links.len > 0)
+    util_run_ranges(us->links.len, 1024, nthreads, unitig_links_range, &ldr);
+
+  for(i = 0; i < nthreads; i++) {
+    ctx_free(ldr.bkeys[i]);
+    ctx_free(ldr.hkeys[i]);
+    ctx_free(ldr.orients[i]);
+  }
+  ctx_free(ldr.bkeys);
+  ctx_free(ldr.hkeys);
+  ctx_free(ldr.orients);
+  ctx_free(ldr.ends);
+
+  db_graph->num_of_cols_used = MAX2(db_graph->num_of_cols_used, col+1);
+}
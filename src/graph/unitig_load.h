@@ -0,0 +1,69 @@
+#ifndef UNITIG_LOAD_H_
+#define UNITIG_LOAD_H_
+
+//
+// Load unitigs (FASTA or GFA) straight into a graph
+//
+// `build` treats unitigs like reads: every kmer is looked up before it is
+// inserted and every edge is added with an atomic OR. When the input is known
+// to be the unitigs of a graph, every kmer occurs once, so kmers can be
+// inserted without looking for them first, and the edges inside a unitig can
+// be written directly since no other unitig touches its kmers. Only the
+// edges between unitigs (GFA links) need adding with atomic operations.
+//
+// Accepted input:
+//   FASTA: `unitigs` output, ">name prev=AC next=G". BCALM style headers
+//          with links as L:+:<name>:- are also read.
+//   GFA 1.0: S lines with sequence, L lines with an overlap of k-1 (e.g. 30M)
+// Coverage is read from KC:i:<kmer count sum> or km:f:<mean kmer coverage>
+// tags on headers / S lines. Unitigs without a coverage tag get coverage 1.
+//
+// Input must not contain the same kmer twice (in either orientation),
+// otherwise the graph will hold duplicate kmers.
+//
+
+#include "db_graph.h"
+#include "common_buffers.h"
+
+typedef struct
+{
+  size_t from, to; // unitig indices
+  Orientation from_orient, to_orient; // FORWARD is '+', REVERSE is '-'
+} UnitigLink;
+
+madcrow_buffer(unitig_link_buf, UnitigLinkBuffer, UnitigLink);
+
+typedef struct
+{
+  size_t kmer_size; // 0 until known
+  size_t num_unitigs, num_kmers, num_bases;
+  StrBuf seq; // all sequence, one unitig after another
+  SizeBuffer seqstart; // [num_unitigs+1] start of each unitig in seq
+  Uint32Buffer covgs; // [num_unitigs] coverage of every kmer in each unitig
+  SizeBuffer kcounts; // [num_unitigs] KC tags, 0 if not given
+  ByteBuffer prev, next; // [num_unitigs] edges from FASTA prev=/next= fields
+  UnitigLinkBuffer links;
+  // Unitig names and link ends resolved by unitig_set_finish()
+  StrBuf names, lnames;
+  SizeBuffer nameoff, lnameoff;
+} UnitigSet;
+
+void unitig_set_alloc(UnitigSet *us);
+void unitig_set_dealloc(UnitigSet *us);
+
+// Read unitigs from a FASTA or GFA file, can be called for several files.
+// Calls die() on error.
+void unitig_set_read(UnitigSet *us, const char *path);
+
+// Resolve link names and check every unitig has at least `kmer_size` bases.
+// If `kmer_size` is zero it is taken from GFA link overlaps (k-1).
+// Calls die() on error.
+void unitig_set_finish(UnitigSet *us, size_t kmer_size);
+
+// Add the kmers, edges and coverage of all unitigs to colour `col`.
+// Graph must have room for us->num_kmers more kmers and bucket locks.
+// Kmers must not already be in the graph.
+void unitig_set_load(const UnitigSet *us, dBGraph *db_graph, Colour col,
+                     size_t nthreads);
+
+#endif /* UNITIG_LOAD_H_ */
@@ -48,6 +48,25 @@ void vcf_misc_hdr_add_cmd(bcf_hdr_t *hdr, const char *cmdline, const char *cwd)
   strbuf_dealloc(&sbuf);
 }
 
+void vcf_misc_pool_alloc(htsThreadPool *pool, size_t nthreads)
+{
+  memset(pool, 0, sizeof(*pool));
+  if(nthreads > 1 && (pool->pool = hts_tpool_init(nthreads)) == NULL)
+    die("Cannot create htslib thread pool");
+}
+
+void vcf_misc_pool_attach(htsThreadPool *pool, htsFile *fh)
+{
+  if(pool->pool != NULL && hts_set_thread_pool(fh, pool) != 0)
+    warn("Cannot use threads for file: %s", fh->fn);
+}
+
+void vcf_misc_pool_dealloc(htsThreadPool *pool)
+{
+  if(pool->pool != NULL) hts_tpool_destroy(pool->pool);
+  memset(pool, 0, sizeof(*pool));
+}
+
 // Find/add and then update a header record
 void vcf_misc_add_update_hrec(bcf_hrec_t *hrec, char *key, char *val)
 {
@@ -2,6 +2,7 @@
 #define VCF_MISC_H_
 
 #include "htslib/vcf.h"
+#include "htslib/thread_pool.h"
 #include "cJSON/cJSON.h"
 
 // VCF output type setting
@@ -17,6 +18,14 @@ int vcf_misc_get_outtype(const char *reqtype, const char *path);
 
 void vcf_misc_hdr_add_cmd(bcf_hdr_t *hdr, const char *cmdline, const char *cwd);
 
+// A pool of htslib threads shared by input and output files, to
+// (de)compress BGZF blocks of VCF/BCF/BAM files in parallel. With
+// nthreads <= 1 no pool is created and files are left single threaded.
+// Files using the pool must be closed before it is destroyed.
+void vcf_misc_pool_alloc(htsThreadPool *pool, size_t nthreads);
+void vcf_misc_pool_attach(htsThreadPool *pool, htsFile *fh);
+void vcf_misc_pool_dealloc(htsThreadPool *pool);
+
 // Find/add and then update a header record
 void vcf_misc_add_update_hrec(bcf_hrec_t *hrec, char *key, char *val);
 
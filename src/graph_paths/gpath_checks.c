@@ -216,7 +216,7 @@ size_t gpath_fetch(dBNode node, const GPath *gpath,
     ctx_assert(n > 0);
 
     if(n > 1) {
-      Nucleotide expbase = binary_seq_get(gpath->seq, njuncs);
+      Nucleotide expbase = binary_seq_get(gpath_seq(gpath), njuncs);
       for(i = 0; i < n && nucs[i] != expbase; i++);
       ctx_assert(i < n);
       node = nodes[i];
@@ -308,7 +308,7 @@ bool gpath_checks_path_col(dBNode node, const GPath *gpath,
 
     // If fork check nucleotide
     if(n > 1) {
-      Nucleotide expbase = binary_seq_get(gpath->seq, plen);
+      Nucleotide expbase = binary_seq_get(gpath_seq(gpath), plen);
 
       for(i = 0; i < n && nucs[i] != expbase; i++);
       if(i == n) {
@@ -355,21 +355,27 @@ bool gpath_checks_path(hkey_t hkey, const GPath *gpath, const dBGraph *db_graph)
   return true;
 }
 
+// Paths are counted on every kmer, but only checked on sampled kmers
 static int _kmer_check_paths(hkey_t hkey, const dBGraph *db_graph,
-                             size_t *npaths_ptr, size_t *nkmers_ptr)
+                             uint64_t seed, uint64_t threshold,
+                             size_t *npaths_ptr, size_t *nkmers_ptr,
+                             size_t *nchecked_ptr)
 {
   const GPathStore *gpstore = &db_graph->gpstore;
   size_t num_gpaths = 0;
+  bool check = db_graph_sample_kmer(hkey, seed, threshold);
   GPath *gpath;
 
-  for(gpath = gpstore->paths_all[hkey]; gpath != NULL; gpath = gpath->next)
+  for(gpath = gpstore->paths_all[hkey]; gpath != NULL;
+      gpath = gpath_next(gpath))
   {
-    ctx_assert_ret(gpath_checks_path(hkey, gpath, db_graph));
+    if(check) ctx_assert_ret(gpath_checks_path(hkey, gpath, db_graph));
     num_gpaths++;
   }
 
   *npaths_ptr += num_gpaths;
   *nkmers_ptr += (num_gpaths > 0);
+  if(check) *nchecked_ptr += num_gpaths;
 
   return 0; // 0 => keep iterating
 }
@@ -378,29 +384,40 @@ typedef struct
 {
   const size_t nthreads;
   const dBGraph *db_graph;
-  size_t num_gpaths, num_kmers;
+  const uint64_t seed, threshold;
+  size_t num_gpaths, num_kmers, num_checked;
 } GPathChecking;
 
 void _gpath_check_all_paths_thread(void *arg, size_t threadid)
 {
   GPathChecking *ch = (GPathChecking*)arg;
   const dBGraph *db_graph = ch->db_graph;
-  size_t num_gpaths = 0, num_kmers = 0;
+  size_t num_gpaths = 0, num_kmers = 0, num_checked = 0;
 
   HASH_ITERATE_PART(&db_graph->ht, threadid, ch->nthreads,
-                    _kmer_check_paths, db_graph, &num_gpaths, &num_kmers);
+                    _kmer_check_paths, db_graph, ch->seed, ch->threshold,
+                    &num_gpaths, &num_kmers, &num_checked);
 
   __sync_fetch_and_add((size_t volatile*)&ch->num_gpaths, num_gpaths);
   __sync_fetch_and_add((size_t volatile*)&ch->num_kmers, num_kmers);
+  __sync_fetch_and_add((size_t volatile*)&ch->num_checked, num_checked);
 }
 
-bool gpath_checks_all_paths(const dBGraph *db_graph, size_t nthreads)
+bool gpath_checks_sample_paths(const dBGraph *db_graph, size_t nthreads,
+                               double fraction, uint64_t seed)
 {
-  status("[GPathCheck] Running paths check...");
+  if(fraction < 1)
+    status("[GPathCheck] Running paths check on %.2f%% of kmers...",
+           fraction * 100.0);
+  else
+    status("[GPathCheck] Running paths check...");
 
   GPathChecking checking = {.nthreads = nthreads,
                             .db_graph = db_graph,
-                            .num_gpaths = 0, .num_kmers = 0};
+                            .seed = seed,
+                            .threshold = db_graph_sample_threshold(fraction),
+                            .num_gpaths = 0, .num_kmers = 0,
+                            .num_checked = 0};
 
   util_multi_thread(&checking, nthreads, _gpath_check_all_paths_thread);
 
@@ -410,12 +427,21 @@ bool gpath_checks_all_paths(const dBGraph *db_graph, size_t nthreads)
   size_t act_num_gpaths = db_graph->gpstore.gpset.entries.len;
   size_t act_num_kmers = db_graph->gpstore.num_kmers_with_paths;
 
+  char num_str[50];
+  ulong_to_str(checking.num_checked, num_str);
+  status("[GPathCheck]   checked %s links", num_str);
+
   ctx_assert_ret2(num_gpaths == act_num_gpaths, "%zu vs %zu", num_gpaths, act_num_gpaths);
   ctx_assert_ret2(num_kmers == act_num_kmers, "%zu vs %zu", num_kmers, act_num_kmers);
 
   return true;
 }
 
+bool gpath_checks_all_paths(const dBGraph *db_graph, size_t nthreads)
+{
+  return gpath_checks_sample_paths(db_graph, nthreads, 1, 0);
+}
+
 // For debugging
 static void _gpstore_update_counts(hkey_t hkey, const dBGraph *db_graph,
                                    size_t *nvisited_ptr, size_t *nkmers_ptr,
@@ -431,7 +457,7 @@ static void _gpstore_update_counts(hkey_t hkey, const dBGraph *db_graph,
   (*nkmers_ptr)++;
 
   // Count paths and coloured paths
-  for(npaths = 0; gpath != NULL; gpath = gpath->next, npaths++) {}
+  for(npaths = 0; gpath != NULL; gpath = gpath_next(gpath), npaths++) {}
 
   (*npaths_ptr) += npaths;
 }
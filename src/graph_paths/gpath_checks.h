@@ -52,6 +52,12 @@ bool gpath_checks_path(hkey_t hkey, const GPath *gpath, const dBGraph *db_graph)
 // Returns false on error
 bool gpath_checks_all_paths(const dBGraph *db_graph, size_t nthreads);
 
+// As gpath_checks_all_paths() but only checks links on a `fraction` of
+// kmers picked with `seed` (see db_graph_sample_kmer()). Links on all kmers
+// are still counted. Returns false on error.
+bool gpath_checks_sample_paths(const dBGraph *db_graph, size_t nthreads,
+                               double fraction, uint64_t seed);
+
 // Dies on first error
 void gpath_checks_counts(const dBGraph *db_graph);
 
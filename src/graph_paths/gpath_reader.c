@@ -1,6 +1,7 @@
 #include "global.h"
 #include "gpath_reader.h"
 #include "file_util.h"
+#include "async_file.h"
 #include "util.h"
 #include "hash_mem.h"
 #include "common_buffers.h"
@@ -12,6 +13,9 @@
 #include "gpath_store.h"
 #include "gpath_subset.h"
 #include "json_hdr.h"
+#include "msg-pool/msgpool.h"
+
+#include <sys/mman.h>
 
 /*
 // File format:
@@ -45,6 +49,15 @@ size_t gpath_reader_get_path_bytes(const GPathReader *file)
   return json_hdr_demand_uint(paths, "path_bytes", file->fltr.path.b);
 }
 
+// Binary files are always sorted, text files if saved with sort_kmers
+bool gpath_reader_kmers_sorted(const GPathReader *file)
+{
+  if(file->bin != NULL) return true;
+  cJSON *paths = json_hdr_get_paths(file->json, file->fltr.path.b);
+  cJSON *sorted = cJSON_GetObjectItem(paths, "kmers_sorted");
+  return sorted != NULL && sorted->type == cJSON_True;
+}
+
 static size_t _gpath_reader_get_filencols(const GPathReader *file)
 {
   return json_hdr_get_ncols(file->json, file->fltr.path.b);
@@ -158,6 +171,112 @@ void _parse_json_header(GPathReader *file)
   if(file->ncolours == 0) die("No colours in JSON header");
 }
 
+#define gpath_reader_bin_hdr(file) ((const GPathBinHeader*)(file)->bin)
+#define gpath_reader_bin_kmers(file) \
+        ((const BinaryKmer*)((file)->bin + (file)->binlyt.kmers))
+#define gpath_reader_bin_index(file) \
+        ((const uint64_t*)((file)->bin + (file)->binlyt.index))
+#define gpath_reader_bin_entries(file) \
+        ((const GPathBinEntry*)((file)->bin + (file)->binlyt.entries))
+#define gpath_reader_bin_seqs(file) ((file)->bin + (file)->binlyt.seqs)
+#define gpath_reader_bin_nseen(file) ((file)->bin + (file)->binlyt.nseen)
+#define gpath_reader_bin_has_colidx(file) ((file)->binlyt.cols > 0)
+#define gpath_reader_bin_cols(file) \
+        ((const GPathBinColIndex*)((file)->bin + (file)->binlyt.cols))
+#define gpath_reader_bin_col_kmers(file) \
+        ((const uint64_t*)((file)->bin + (file)->binlyt.col_kmers))
+
+// Whether links can be loaded using the colour index
+// (i.e. not all colours of the file are being loaded)
+static bool _gpath_reader_use_colidx(const GPathReader *file)
+{
+  return file->bin != NULL && gpath_reader_bin_has_colidx(file) &&
+         file_filter_num(&file->fltr) < file->fltr.srcncols;
+}
+
+void gpath_reader_get_filtered_counts(const GPathReader *file,
+                                      size_t *num_paths, size_t *path_bytes)
+{
+  size_t i, npaths = 0, pbytes = 0, fromcol;
+  size_t total_paths = gpath_reader_get_num_paths(file);
+  size_t total_bytes = gpath_reader_get_path_bytes(file);
+
+  if(!_gpath_reader_use_colidx(file)) {
+    *num_paths = total_paths;
+    *path_bytes = total_bytes;
+    return;
+  }
+
+  // Links in more than one requested colour are counted more than once
+  const GPathBinColIndex *cols = gpath_reader_bin_cols(file);
+  for(i = 0; i < file_filter_num(&file->fltr); i++) {
+    fromcol = file_filter_fromcol(&file->fltr, i);
+    npaths += cols[fromcol].num_paths;
+    pbytes += cols[fromcol].path_bytes;
+  }
+
+  *num_paths = MIN2(npaths, total_paths);
+  *path_bytes = MIN2(pbytes, total_bytes);
+}
+
+// Memory map a binary link file and copy its JSON header into hdrstr
+static void _gpath_reader_open_bin(GPathReader *file, StrBuf *hdrstr)
+{
+  const char *path = file->fltr.path.b;
+  FILE *fh = futil_fopen(path, "r");
+  off_t fsize = futil_get_file_size(path);
+
+  if(fsize < (off_t)ctp_bin_hdr_size(1))
+    die("Binary link file is too short: %s", path);
+
+  file->binlen = fsize;
+  void *ptr = mmap(NULL, file->binlen, PROT_READ, MAP_PRIVATE, fileno(fh), 0);
+  if(ptr == MAP_FAILED)
+    die("Cannot mmap file: %s [%s]", path, strerror(errno));
+  fclose(fh);
+  file->bin = ptr;
+
+  // With async I/O, have the kernel read the whole file in ahead of us
+  if(async_file_enabled()) {
+    madvise(ptr, file->binlen, MADV_SEQUENTIAL);
+    madvise(ptr, file->binlen, MADV_WILLNEED);
+  }
+
+  const GPathBinHeader *hdr = gpath_reader_bin_hdr(file);
+  if(memcmp(hdr->magic, CTP_BIN_MAGIC, sizeof(hdr->magic)) != 0)
+    die("Not a binary link file: %s", path);
+  if(hdr->version < 1 || hdr->version > CTP_BIN_VERSION)
+    die("Binary link file version %u not supported: %s", hdr->version, path);
+  if(fsize < (off_t)ctp_bin_hdr_size(hdr->version))
+    die("Binary link file is too short: %s", path);
+  if(hdr->kmer_words != NUM_BKMER_WORDS) {
+    die("Binary link file has %u words per kmer, compiled for %i [path: %s]",
+        hdr->kmer_words, NUM_BKMER_WORDS, path);
+  }
+
+  gpath_bin_layout(hdr, &file->binlyt);
+  if(file->binlyt.end > file->binlen)
+    die("Binary link file is truncated: %s", path);
+
+  const char *json = (const char*)(file->bin + file->binlyt.json);
+  if(hdr->json_len == 0 || json[hdr->json_len-1] != '\0')
+    die("Bad JSON header in binary link file: %s", path);
+
+  if(gpath_reader_bin_has_colidx(file)) {
+    const GPathBinColIndex *cols = gpath_reader_bin_cols(file);
+    size_t c;
+    for(c = 0; c < hdr->ncols; c++) {
+      if(cols[c].kmers_offset + cols[c].num_kmers > hdr->num_col_kmers ||
+         cols[c].num_kmers > hdr->num_kmers ||
+         cols[c].num_paths > hdr->num_paths)
+        die("Bad colour index in binary link file: %s", path);
+    }
+  }
+
+  strbuf_set(hdrstr, json);
+  file->bin_kmer = file->bin_path = file->bin_path_end = 0;
+}
+
 // Open file, exit on error
 // if successful creates a new GPathReader and returns 1
 void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
@@ -166,7 +285,6 @@ void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
   FileFilter *fltr = &file->fltr;
   file_filter_open(fltr, path); // calls die() on error
 
-  file->gz = futil_gzopen(fltr->path.b, mode);
   strm_buf_alloc(&file->strmbuf, 4*ONE_MEGABYTE);
 
   // Temporary variable for loading
@@ -175,7 +293,15 @@ void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
   // Load JSON header into file->hdrstr
   StrBuf *hdrstr = &file->hdrstr;
   if(hdrstr->b == NULL) strbuf_alloc(hdrstr, 1024);
-  json_hdr_read(NULL, file->gz, path, hdrstr);
+
+  if(gpath_reader_is_bin(fltr->path.b)) {
+    file->gz = NULL;
+    _gpath_reader_open_bin(file, hdrstr);
+  } else {
+    file->gz = futil_gzopen(fltr->path.b, mode);
+    json_hdr_read(NULL, file->gz, path, hdrstr);
+  }
+
   file->json = cJSON_Parse(hdrstr->b);
   if(file->json == NULL) die("Invalid JSON header: %s", path);
 
@@ -198,6 +324,12 @@ void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
 
   // Check we can handle the kmer size
   db_graph_check_kmer_size(kmer_size, file->fltr.path.b);
+
+  if(file->bin != NULL) {
+    const GPathBinHeader *binhdr = gpath_reader_bin_hdr(file);
+    if(binhdr->kmer_size != kmer_size || binhdr->ncols != filencols)
+      die("Binary link file header doesn't match JSON: %s", path);
+  }
 }
 
 void gpath_reader_open(GPathReader *file, const char *path)
@@ -207,7 +339,9 @@ void gpath_reader_open(GPathReader *file, const char *path)
 
 void gpath_reader_close(GPathReader *file)
 {
-  if(file->gz) gzclose(file->gz);
+  if(file->gz) gzutil_fclose(file->gz);
+  if(file->bin && munmap(file->bin, file->binlen) == -1)
+    die("Cannot release mmap file: %s [%s]", file->fltr.path.b, strerror(errno));
   strm_buf_dealloc(&file->strmbuf);
   strbuf_dealloc(&file->line);
   file_filter_close(&file->fltr);
@@ -245,6 +379,19 @@ void gpath_reader_check(const GPathReader *file, size_t db_kmer_size,
   }
 }
 
+// Parse line <kmer> <num_links>, truncating the line to just the kmer
+static void _parse_kmer_line(StrBuf *kmer, size_t *num_links, const char *path)
+{
+  char *space;
+  if(!char_is_acgt(kmer->b[0]) ||
+     (space = strchr(kmer->b, ' ')) == NULL ||
+     !parse_entire_size(space+1, num_links))
+  {
+    die("Bad kmer line [%s]: %s", path, kmer->b);
+  }
+  strbuf_resize(kmer, space - kmer->b);
+}
+
 // Reads line <kmer> <num_links>
 // Calls die() on error
 // Returns true unless end of file
@@ -253,9 +400,26 @@ bool gpath_reader_read_kmer(GPathReader *file, StrBuf *kmer, size_t *num_links)
   strbuf_reset(kmer);
   *num_links = 0;
 
+  if(file->bin != NULL) {
+    const GPathBinHeader *hdr = gpath_reader_bin_hdr(file);
+    const uint64_t *index = gpath_reader_bin_index(file);
+    size_t i = file->bin_kmer;
+    if(i == hdr->num_kmers) return false;
+    if(index[i] > index[i+1] || index[i+1] > hdr->num_paths)
+      die("Bad binary link index [%s]", file_filter_path(&file->fltr));
+
+    strbuf_ensure_capacity(kmer, hdr->kmer_size+1);
+    binary_kmer_to_str(gpath_reader_bin_kmers(file)[i], hdr->kmer_size, kmer->b);
+    kmer->end = hdr->kmer_size;
+    file->bin_path = index[i];
+    file->bin_path_end = index[i+1];
+    file->bin_kmer++;
+    *num_links = file->bin_path_end - file->bin_path;
+    return true;
+  }
+
   const char *path = file_filter_path(&file->fltr);
   int c;
-  char *space;
 
   while((c = gzgetc_buf(file->gz, &file->strmbuf)) != -1)
   {
@@ -265,13 +429,7 @@ bool gpath_reader_read_kmer(GPathReader *file, StrBuf *kmer, size_t *num_links)
       strbuf_gzreadline_buf(kmer, file->gz, &file->strmbuf);
       futil_gzcheck(0, file->gz, path);
       strbuf_chomp(kmer);
-      if(!char_is_acgt(c) ||
-         (space = strchr(kmer->b, ' ')) == NULL ||
-         !parse_entire_size(space+1, num_links))
-      {
-        die("Bad kmer line [%s]: %s", path, kmer->b);
-      }
-      strbuf_resize(kmer, space - kmer->b);
+      _parse_kmer_line(kmer, num_links, path);
       return true;
     }
   }
@@ -282,6 +440,23 @@ bool gpath_reader_read_kmer(GPathReader *file, StrBuf *kmer, size_t *num_links)
 
 #define bad_link_line(path,line) die("Bad link line [%s]: %s", path, (line)->b)
 
+// Convert counts for file colours into counts for colours loaded into
+static void _link_counts_filter(SizeBuffer *counts, const FileFilter *fltr)
+{
+  size_t i, fromcol, intocol;
+
+  // Use filter - append zeros first
+  size_t offset = counts->len, num_into = file_filter_into_ncols(fltr);
+  size_buf_push_zero(counts, num_into);
+  for(i = 0; i < file_filter_num(fltr); i++) {
+    fromcol = file_filter_fromcol(fltr, i);
+    intocol = file_filter_intocol(fltr, i);
+    counts->b[offset+intocol] += counts->b[fromcol];
+  }
+  memmove(counts->b, counts->b+offset, num_into*sizeof(counts->b[0]));
+  counts->len = num_into;
+}
+
 /**
  * Parse line with format:
  *  [FR] [njuncs] [nseen0,nseen1,...] [juncs:ACAGT] ([seq=] [juncpos=])?
@@ -294,7 +469,7 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
                      StrBuf *seq, SizeBuffer *juncpos)
 {
   const char *path = file_filter_path(fltr);
-  size_t i, fromcol, intocol;
+  size_t i;
   char *end = NULL;
 
   // First first 5 required columns
@@ -340,17 +515,7 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
   else if(counts->len != fltr->srcncols)
     bad_link_line(path,line);
 
-  // Use filter - append zeros first
-  // size_buf_reset(counts);
-  size_t offset = counts->len, num_into = file_filter_into_ncols(fltr);
-  size_buf_push_zero(counts, num_into);
-  for(i = 0; i < file_filter_num(fltr); i++) {
-    fromcol = file_filter_fromcol(fltr, i);
-    intocol = file_filter_intocol(fltr, i);
-    counts->b[offset+intocol] += counts->b[fromcol];
-  }
-  memmove(counts->b, counts->b+offset, num_into*sizeof(counts->b[0]));
-  counts->len = num_into;
+  _link_counts_filter(counts, fltr);
 
   // 4:[juncs:ACAGA]
   strbuf_reset(juncs);
@@ -424,6 +589,34 @@ bool gpath_reader_read_link(GPathReader *file,
   StrBuf *line = &file->line;
   strbuf_reset(line);
 
+  if(file->bin != NULL) {
+    const GPathBinHeader *hdr = gpath_reader_bin_hdr(file);
+    if(file->bin_path == file->bin_path_end) return false;
+
+    size_t i, pidx = file->bin_path++, ncols = hdr->ncols;
+    const GPathBinEntry *entry = &gpath_reader_bin_entries(file)[pidx];
+    const uint8_t *colset = gpath_reader_bin_seqs(file) + entry->seqoff;
+    const uint8_t *nseen = gpath_reader_bin_nseen(file) + pidx*ncols;
+
+    if(entry->seqoff + (ncols+7)/8 + binary_seq_mem(entry->num_juncs) >
+       hdr->seq_bytes) die("Bad binary link entry [%s]", path);
+
+    *fw = (entry->orient == FORWARD);
+    *njuncs = entry->num_juncs;
+
+    strbuf_ensure_capacity(juncs, entry->num_juncs+1);
+    binary_seq_to_str(colset + (ncols+7)/8, entry->num_juncs, juncs->b);
+    juncs->end = entry->num_juncs;
+
+    size_buf_reset(countbuf);
+    for(i = 0; i < ncols; i++) size_buf_add(countbuf, nseen[i]);
+    _link_counts_filter(countbuf, &file->fltr);
+
+    if(seq) strbuf_reset(seq);
+    if(juncpos) size_buf_reset(juncpos);
+    return true;
+  }
+
   while((c = gzgetc_buf(file->gz, &file->strmbuf)) != -1)
   {
     if(char_is_acgt(c)) {
@@ -457,7 +650,13 @@ static hkey_t find_link_kmer(BinaryKmer bkey, int flags,
 
   switch(flags) {
     case GPATH_ADD_MISSING_KMERS:
-      hkey = hash_table_find_or_insert(&db_graph->ht, bkey, &found);
+      // Multithreaded loading requires bucket locks
+      if(db_graph->bktlocks != NULL) {
+        hkey = hash_table_find_or_insert_mt(&db_graph->ht, bkey, &found,
+                                            db_graph->bktlocks);
+      } else {
+        hkey = hash_table_find_or_insert(&db_graph->ht, bkey, &found);
+      }
       break;
     case GPATH_DIE_MISSING_KMERS:
       hkey = hash_table_find(&db_graph->ht, bkey);
@@ -521,111 +720,563 @@ static size_t _load_paths_from_set(dBGraph *db_graph, GPathSet *gpset,
   return subset1->list.len;
 }
 
-/**
- * @param kmer_flags must be one of:
- *   * GPATH_ADD_MISSING_KMERS - add kmers to the graph before loading path
- *   * GPATH_DIE_MISSING_KMERS - die with error if cannot find kmer
- *   * GPATH_SKIP_MISSING_KMERS - skip paths where kmer is not in graph
- */
-void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
+#define GPATH_BIN_BATCH 64
+
+// Copy links from a memory mapped binary file straight into an empty
+// GPathStore, without parsing or building per kmer sets.
+// Returns false if links have to be loaded one kmer at a time instead
+static bool _gpath_reader_load_bin(GPathReader *file, int kmer_flags,
+                                   dBGraph *db_graph)
 {
+  const GPathBinHeader *hdr = gpath_reader_bin_hdr(file);
   const char *path = file_filter_path(&file->fltr);
+  GPathStore *gpstore = &db_graph->gpstore;
+  GPathSet *gpset = &gpstore->gpset;
+  const size_t ncols = gpset->ncols, colset_bytes = (ncols+7)/8;
+
+  if(gpset->entries.len > 0 || db_graph_has_path_hash(db_graph) ||
+     kmer_flags == GPATH_SKIP_MISSING_KMERS ||
+     !file_filter_full_direct(&file->fltr, ncols) ||
+     hdr->num_paths > gpset->entries.size ||
+     hdr->seq_bytes + SEQ_STORE_PADDING > gpset->seqs.size)
+  {
+    return false;
+  }
 
-  file_filter_status(&file->fltr, false);
+  load_check(gpath_reader_get_num_kmers(file) == hdr->num_kmers &&
+             gpath_reader_get_num_paths(file) == hdr->num_paths,
+             "header number of kmers/links don't match binary [%s]", path);
+
+  const BinaryKmer *bkmers = gpath_reader_bin_kmers(file);
+  const uint64_t *index = gpath_reader_bin_index(file);
+  const GPathBinEntry *entries = gpath_reader_bin_entries(file);
+  GPath *gpaths = gpset->entries.b;
+  size_t i, j, k, n, start, end, num_kmers_loaded = 0, path_bytes = 0;
+  hkey_t hkeys[GPATH_BIN_BATCH];
+
+  // Colsets, sequences and counts are copied in one go
+  memcpy(gpset->seqs.b, gpath_reader_bin_seqs(file), hdr->seq_bytes);
+  gpset->seqs.len = hdr->seq_bytes;
+
+  if(gpath_set_has_nseen(gpset)) {
+    memcpy(gpset->nseen_buf.b, gpath_reader_bin_nseen(file),
+           hdr->num_paths * ncols);
+    gpset->nseen_buf.len = hdr->num_paths * ncols;
+  }
 
-  size_t into_ncols = file_filter_into_ncols(&file->fltr);
+  for(i = 0; i < hdr->num_paths; i++) {
+    if(entries[i].seqoff + colset_bytes + binary_seq_mem(entries[i].num_juncs) >
+       hdr->seq_bytes) die("Bad binary link entry [%s]", path);
 
-  // Load paths into this temporary set for each kmer
-  GPathSet gpset;
-  gpath_set_alloc(&gpset, db_graph->num_of_cols, ONE_MEGABYTE, true, true);
+    gpath_set_seq(&gpaths[i], gpset->seqs.b + entries[i].seqoff + colset_bytes);
+    gpath_set_next(&gpaths[i], NULL);
+    gpaths[i].num_juncs = entries[i].num_juncs;
+    gpaths[i].orient = entries[i].orient;
+    path_bytes += binary_seq_mem(entries[i].num_juncs);
+  }
+  gpset->entries.len = hdr->num_paths;
 
-  GPathSubset subset0, subset1;
-  gpath_subset_alloc(&subset0);
-  gpath_subset_alloc(&subset1);
+  for(i = 0; i < hdr->num_kmers; i += n)
+  {
+    n = MIN2((size_t)GPATH_BIN_BATCH, hdr->num_kmers - i);
 
-  size_t i, nlink, num_links_exp = 0;
-  size_t total_kmers_exp = gpath_reader_get_num_kmers(file);
-  size_t total_links_exp = gpath_reader_get_num_paths(file);
-  size_t num_kmers_seen = 0, num_links_seen = 0;
+    if(kmer_flags == GPATH_DIE_MISSING_KMERS)
+      hash_table_find_batch(&db_graph->ht, bkmers+i, n, 8, hkeys);
+    else
+      for(j = 0; j < n; j++)
+        hkeys[j] = find_link_kmer(bkmers[i+j], kmer_flags, path, db_graph);
+
+    for(j = 0; j < n; j++)
+    {
+      // Reports missing kmer
+      if(hkeys[j] == HASH_NOT_FOUND)
+        (void)find_link_kmer(bkmers[i+j], kmer_flags, path, db_graph);
+
+      start = index[i+j];
+      end = index[i+j+1];
+      if(start >= end || end > hdr->num_paths ||
+         gpstore->paths_all[hkeys[j]] != NULL)
+        die("Bad binary link index [%s]", path);
+
+      // Keep links in the order they were saved
+      for(k = start; k+1 < end; k++) gpath_set_next(&gpaths[k], &gpaths[k+1]);
+      gpstore->paths_all[hkeys[j]] = &gpaths[start];
+      num_kmers_loaded++;
+    }
+  }
+
+  gpstore->num_kmers_with_paths += num_kmers_loaded;
+  gpstore->num_paths += hdr->num_paths;
+  gpstore->path_bytes += path_bytes;
+
+  char nlinks_str[50], nkmers_str[50];
+  ulong_to_str(hdr->num_paths, nlinks_str);
+  ulong_to_str(num_kmers_loaded, nkmers_str);
+  status("Loaded %s paths from %s kmers (memory mapped)",
+         nlinks_str, nkmers_str);
+
+  return true;
+}
+
+// Load links of only the requested colours of a binary file into an empty
+// GPathStore, using the colour index to skip kmers without links in them.
+// Colsets and counts are remapped to the into colours, so the store only
+// needs as many colours as are loaded (e.g. ncols=1 for one sample).
+// Returns false if the file has no colour index or links have to be merged.
+static bool _gpath_reader_load_bin_cols(GPathReader *file, int kmer_flags,
+                                        dBGraph *db_graph)
+{
+  const GPathBinHeader *hdr = gpath_reader_bin_hdr(file);
+  const FileFilter *fltr = &file->fltr;
+  const char *path = file_filter_path(fltr);
+  GPathStore *gpstore = &db_graph->gpstore;
+  GPathSet *gpset = &gpstore->gpset;
+
+  if(!_gpath_reader_use_colidx(file) || gpset->entries.len > 0 ||
+     db_graph_has_path_hash(db_graph))
+  {
+    return false;
+  }
+
+  const size_t src_ncols = hdr->ncols, src_colset_bytes = (src_ncols+7)/8;
+  const size_t dst_ncols = gpset->ncols, dst_colset_bytes = (dst_ncols+7)/8;
+  const size_t nfilter = file_filter_num(fltr);
+  const BinaryKmer *bkmers = gpath_reader_bin_kmers(file);
+  const uint64_t *index = gpath_reader_bin_index(file);
+  const GPathBinEntry *entries = gpath_reader_bin_entries(file);
+  const uint8_t *seqs = gpath_reader_bin_seqs(file);
+  const uint8_t *src_nseen = gpath_reader_bin_nseen(file);
+  const GPathBinColIndex *cols = gpath_reader_bin_cols(file);
+  const uint64_t *col_kmers = gpath_reader_bin_col_kmers(file);
+
+  size_t i, j, k, f, fromcol, intocol, nadded;
   size_t num_kmers_loaded = 0, num_links_loaded = 0;
-  bool warn_nlink_mismatch = false;
+  const uint8_t *src_colset;
+  hkey_t hkey;
+  bool in_cols;
+
+  load_check(gpath_reader_get_num_kmers(file) == hdr->num_kmers &&
+             gpath_reader_get_num_paths(file) == hdr->num_paths,
+             "header number of kmers/links don't match binary [%s]", path);
+
+  // Mark kmers that have links in any of the colours we are loading
+  uint8_t *load_kmers = ctx_calloc(MAX2((hdr->num_kmers+7)/8, 1), 1);
+
+  for(f = 0; f < nfilter; f++) {
+    fromcol = file_filter_fromcol(fltr, f);
+    for(i = 0; i < cols[fromcol].num_kmers; i++) {
+      k = col_kmers[cols[fromcol].kmers_offset + i];
+      if(k >= hdr->num_kmers) die("Bad colour index [%s]", path);
+      bitset_set(load_kmers, k);
+    }
+  }
 
-  StrBuf kmerstr;
-  strbuf_alloc(&kmerstr, 64);
-  bool fw = true;
-  size_t njuncs = 0;
-  StrBuf juncs;
+  uint8_t *colset = ctx_calloc(MAX2(dst_colset_bytes, 1), 1);
+  uint8_t *nseen = ctx_calloc(MAX2(dst_ncols, 1), 1);
+
+  for(k = 0; k < hdr->num_kmers; k++)
+  {
+    if(!bitset_get(load_kmers, k)) continue;
+
+    if(index[k] >= index[k+1] || index[k+1] > hdr->num_paths)
+      die("Bad binary link index [%s]", path);
+
+    hkey = find_link_kmer(bkmers[k], kmer_flags, path, db_graph);
+    if(hkey == HASH_NOT_FOUND) continue;
+
+    // Links are added to the front of the list, go backwards to keep order
+    for(nadded = 0, j = index[k+1]; j-- > index[k]; )
+    {
+      if(entries[j].seqoff + src_colset_bytes +
+         binary_seq_mem(entries[j].num_juncs) > hdr->seq_bytes)
+        die("Bad binary link entry [%s]", path);
+
+      src_colset = seqs + entries[j].seqoff;
+      memset(colset, 0, dst_colset_bytes);
+      memset(nseen, 0, dst_ncols);
+
+      for(in_cols = false, f = 0; f < nfilter; f++) {
+        fromcol = file_filter_fromcol(fltr, f);
+        intocol = file_filter_intocol(fltr, f);
+        if(bitset_get(src_colset, fromcol)) {
+          bitset_set(colset, intocol);
+          nseen[intocol] = MIN2((size_t)UINT8_MAX, (size_t)nseen[intocol] +
+                                src_nseen[j*src_ncols + fromcol]);
+          in_cols = true;
+        }
+      }
+
+      if(in_cols) {
+        GPathNew newgpath = {.seq = (uint8_t*)src_colset + src_colset_bytes,
+                             .colset = colset, .nseen = nseen,
+                             .orient = entries[j].orient,
+                             .num_juncs = entries[j].num_juncs};
+        gpath_store_add_mt(gpstore, hkey, newgpath);
+        nadded++;
+      }
+    }
+
+    num_kmers_loaded += (nadded > 0);
+    num_links_loaded += nadded;
+  }
+
+  ctx_free(nseen);
+  ctx_free(colset);
+  ctx_free(load_kmers);
+
+  char nlinks_str[50], nkmers_str[50];
+  ulong_to_str(num_links_loaded, nlinks_str);
+  ulong_to_str(num_kmers_loaded, nkmers_str);
+  status("Loaded %s paths from %s kmers (colour index)",
+         nlinks_str, nkmers_str);
+
+  return true;
+}
+
+//
+// Loading text link files
+//
+
+// Links of one kmer are collected in `gpset`, then merged into the graph.
+// Each thread loading a file has its own GPathLoader.
+typedef struct
+{
+  GPathReader *file;
+  int kmer_flags;
+  dBGraph *db_graph;
+
+  GPathSet gpset;
+  GPathSubset subset0, subset1;
+  StrBuf kmerstr, juncs, line;
   SizeBuffer counts;
-  strbuf_alloc(&juncs, 256);
-  size_buf_alloc(&counts, 256);
+  ByteBuffer seqbuf;
+
+  size_t num_kmers_seen, num_links_seen;
+  size_t num_kmers_loaded, num_links_loaded;
+  bool warn_nlink_mismatch;
+
+  // Multithreaded loading only
+  MsgPool *pool;
+  pthread_t thread;
+} GPathLoader;
+
+static size_t gpath_load_batch_bytes = GPATH_LOAD_BATCH_BYTES;
+
+void gpath_reader_set_batch_size(size_t nbytes)
+{
+  ctx_assert(nbytes > 0);
+  gpath_load_batch_bytes = nbytes;
+}
+
+size_t gpath_reader_get_batch_size()
+{
+  return gpath_load_batch_bytes;
+}
+
+static void gpath_loader_alloc(GPathLoader *ldr, GPathReader *file,
+                               int kmer_flags, dBGraph *db_graph)
+{
+  memset(ldr, 0, sizeof(*ldr));
+  ldr->file = file;
+  ldr->kmer_flags = kmer_flags;
+  ldr->db_graph = db_graph;
 
+  // Load paths into this temporary set for each kmer
+  gpath_set_alloc(&ldr->gpset, db_graph->num_of_cols, ONE_MEGABYTE, true, true);
+  gpath_subset_alloc(&ldr->subset0);
+  gpath_subset_alloc(&ldr->subset1);
+  strbuf_alloc(&ldr->kmerstr, 64);
+  strbuf_alloc(&ldr->juncs, 256);
+  strbuf_alloc(&ldr->line, 1024);
+  size_buf_alloc(&ldr->counts, 256);
   // Buffer is collapsed into here
-  ByteBuffer seqbuf;
-  byte_buf_alloc(&seqbuf, 64);
+  byte_buf_alloc(&ldr->seqbuf, 64);
+}
+
+static void gpath_loader_dealloc(GPathLoader *ldr)
+{
+  gpath_set_dealloc(&ldr->gpset);
+  gpath_subset_dealloc(&ldr->subset0);
+  gpath_subset_dealloc(&ldr->subset1);
+  strbuf_dealloc(&ldr->kmerstr);
+  strbuf_dealloc(&ldr->juncs);
+  strbuf_dealloc(&ldr->line);
+  size_buf_dealloc(&ldr->counts);
+  byte_buf_dealloc(&ldr->seqbuf);
+}
+
+// Add link in ldr->juncs, ldr->counts to links of the current kmer
+static void gpath_loader_add_link(GPathLoader *ldr, bool fw)
+{
+  GPathSet *gpset = &ldr->gpset;
+  const StrBuf *juncs = &ldr->juncs;
+  const size_t *counts = ldr->counts.b;
+  size_t i, into_ncols = file_filter_into_ncols(&ldr->file->fltr);
 
-  for(num_kmers_seen = 0;
-      gpath_reader_read_kmer(file, &kmerstr, &num_links_exp);
-      num_kmers_seen++)
+  // Check if link has coverage in any colours
+  size_t link_covg = 0;
+  for(i = 0; i < into_ncols; i++) link_covg |= counts[i];
+
+  if(link_covg)
   {
-    gpath_set_reset(&gpset);
+    byte_buf_capacity(&ldr->seqbuf, binary_seq_mem(juncs->end));
+    binary_seq_from_str(juncs->b, juncs->end, ldr->seqbuf.b);
+
+    // Add to GPathSet
+    GPathNew newgpath = {.seq = ldr->seqbuf.b,
+                         .colset = NULL, .nseen = NULL,
+                         .orient = fw ? FORWARD : REVERSE,
+                         .num_juncs = juncs->end};
+
+    GPath *gpath = gpath_set_add_mt(gpset, newgpath);
+
+    // Update nseen and colset
+    // Our temporary gpset always stores nseen counts
+    uint8_t *nseen = gpath_set_get_nseen(gpset, gpath);
+    uint8_t *colset = gpath_get_colset(gpath, gpset->ncols);
+    for(i = 0; i < into_ncols; i++) {
+      nseen[i] = MIN2((size_t)UINT8_MAX, (size_t)nseen[i] + counts[i]);
+      bitset_or(colset, i, counts[i] > 0);
+    }
+  }
+}
+
+// Merge links of kmer ldr->kmerstr into the graph
+static void gpath_loader_end_kmer(GPathLoader *ldr, size_t nlink,
+                                  size_t num_links_exp)
+{
+  const char *path = file_filter_path(&ldr->file->fltr);
+  dBGraph *db_graph = ldr->db_graph;
+
+  if(nlink != num_links_exp && !ldr->warn_nlink_mismatch) {
+    warn("Number of links mismatches: %s %zu != %zu [%s]",
+         ldr->kmerstr.b, num_links_exp, nlink, path);
+    ldr->warn_nlink_mismatch = true;
+  }
 
+  ldr->num_kmers_seen++;
+  ldr->num_links_seen += nlink;
+  ldr->num_kmers_loaded += (ldr->gpset.entries.len > 0);
+
+  if(ldr->gpset.entries.len > 0) {
+    BinaryKmer bkey = binary_kmer_from_str(ldr->kmerstr.b, db_graph->kmer_size);
+    hkey_t hkey = find_link_kmer(bkey, ldr->kmer_flags, path, db_graph);
+
+    if(hkey != HASH_NOT_FOUND) {
+      ldr->num_links_loaded += _load_paths_from_set(db_graph, &ldr->gpset,
+                                                    &ldr->subset0,
+                                                    &ldr->subset1, hkey);
+    }
+  }
+
+  gpath_set_reset(&ldr->gpset);
+}
+
+static void gpath_loader_load_file(GPathLoader *ldr)
+{
+  GPathReader *file = ldr->file;
+  size_t nlink, njuncs = 0, num_links_exp = 0;
+  bool fw = true;
+
+  while(gpath_reader_read_kmer(file, &ldr->kmerstr, &num_links_exp))
+  {
     for(nlink = 0;
         gpath_reader_read_link(file, &fw, &njuncs,
-                               &counts, &juncs, NULL, NULL);
+                               &ldr->counts, &ldr->juncs, NULL, NULL);
         nlink++)
     {
-      // Check if link has coverage in any colours
-      size_t link_covg = 0;
-      for(i = 0; i < into_ncols; i++) link_covg |= counts.b[i];
-
-      if(link_covg)
-      {
-        byte_buf_capacity(&seqbuf, binary_seq_mem(juncs.end));
-        binary_seq_from_str(juncs.b, juncs.end, seqbuf.b);
-
-        // Add to GPathSet
-        GPathNew newgpath = {.seq = seqbuf.b,
-                             .colset = NULL, .nseen = NULL,
-                             .orient = fw ? FORWARD : REVERSE,
-                             .num_juncs = juncs.end};
-
-        GPath *gpath = gpath_set_add_mt(&gpset, newgpath);
-
-        // Update nseen and colset
-        // Our temporary gpset always stores nseen counts
-        uint8_t *nseen = gpath_set_get_nseen(&gpset, gpath);
-        uint8_t *colset = gpath_get_colset(gpath, gpset.ncols);
-        for(i = 0; i < into_ncols; i++) {
-          nseen[i] = MIN2((size_t)UINT8_MAX, (size_t)nseen[i] + counts.b[i]);
-          bitset_or(colset, i, counts.b[i] > 0);
-        }
-      }
+      gpath_loader_add_link(ldr, fw);
     }
 
-    if(nlink != num_links_exp && !warn_nlink_mismatch) {
-      warn("Number of links mismatches: %s %zu != %zu [%s]",
-           kmerstr.b, num_links_exp, nlink, path);
-      warn_nlink_mismatch = true;
+    gpath_loader_end_kmer(ldr, nlink, num_links_exp);
+  }
+}
+
+// Parse a batch of whole kmer blocks (kmer line followed by its link lines)
+static void gpath_loader_load_batch(GPathLoader *ldr, const StrBuf *batch)
+{
+  const GPathReader *file = ldr->file;
+  const char *path = file_filter_path(&file->fltr);
+  const char *ptr = batch->b, *end = batch->b + batch->end, *eol;
+  size_t nlink = 0, njuncs = 0, num_links_exp = 0;
+  bool fw = true, in_kmer = false;
+
+  for(; ptr < end; ptr = eol+1)
+  {
+    eol = memchr(ptr, '\n', end - ptr);
+    ctx_assert(eol != NULL); // batches always end with a newline
+
+    if(char_is_acgt(*ptr)) {
+      if(in_kmer) gpath_loader_end_kmer(ldr, nlink, num_links_exp);
+      strbuf_reset(&ldr->kmerstr);
+      strbuf_append_strn(&ldr->kmerstr, ptr, eol - ptr);
+      _parse_kmer_line(&ldr->kmerstr, &num_links_exp, path);
+      nlink = 0;
+      in_kmer = true;
     }
+    else {
+      if(!in_kmer) die("Link before first kmer [%s]", path);
+      strbuf_reset(&ldr->line);
+      strbuf_append_strn(&ldr->line, ptr, eol - ptr);
+      link_line_parse(&ldr->line, file->version, &file->fltr,
+                      &fw, &njuncs, &ldr->counts, &ldr->juncs, NULL, NULL);
+      gpath_loader_add_link(ldr, fw);
+      nlink++;
+    }
+  }
+
+  if(in_kmer) gpath_loader_end_kmer(ldr, nlink, num_links_exp);
+}
 
-    num_links_seen += nlink;
-    num_kmers_loaded += (gpset.entries.len > 0);
+static void* gpath_loader_thread(void *arg)
+{
+  GPathLoader *ldr = (GPathLoader*)arg;
+  StrBuf *batch;
+  int pos;
+
+  while((pos = msgpool_claim_read(ldr->pool)) != -1)
+  {
+    memcpy(&batch, msgpool_get_ptr(ldr->pool, pos), sizeof(StrBuf*));
+    gpath_loader_load_batch(ldr, batch);
+    msgpool_release(ldr->pool, pos, MPOOL_EMPTY);
+  }
+
+  return NULL;
+}
+
+// Read whole kmer blocks into `batch` until it holds at least
+// gpath_load_batch_bytes, skipping comments and empty lines.
+// Returns false if there is nothing left to read
+static bool _gpath_reader_read_batch(GPathReader *file, StrBuf *batch)
+{
+  const char *path = file_filter_path(&file->fltr);
+  int c;
 
-    if(gpset.entries.len > 0) {
-      BinaryKmer bkey = binary_kmer_from_str(kmerstr.b, db_graph->kmer_size);
-      hkey_t hkey = find_link_kmer(bkey, kmer_flags, path, db_graph);
+  strbuf_reset(batch);
 
-      if(hkey != HASH_NOT_FOUND) {
-        num_links_loaded += _load_paths_from_set(db_graph, &gpset,
-                                                 &subset0, &subset1,
-                                                 hkey);
+  while((c = gzgetc_buf(file->gz, &file->strmbuf)) != -1)
+  {
+    if(c == '#') gzskipline_buf(file->gz, &file->strmbuf);
+    else if(c != '\n') {
+      if(char_is_acgt(c) && batch->end >= gpath_load_batch_bytes) {
+        gzungetc_buf(c, &file->strmbuf);
+        break;
       }
+      strbuf_append_char(batch, c);
+      strbuf_gzreadline_buf(batch, file->gz, &file->strmbuf);
+      if(batch->b[batch->end-1] != '\n') strbuf_append_char(batch, '\n');
+    }
+  }
+
+  futil_gzcheck(0, file->gz, path);
+  return batch->end > 0;
+}
+
+static void _batch_pool_init(char *el, size_t idx, void *args)
+{
+  StrBuf *bufs = (StrBuf*)args, *ptr = &bufs[idx];
+  memcpy(el, &ptr, sizeof(StrBuf*));
+}
+
+// This thread decompresses the file and splits it into batches of kmers,
+// `nthreads` worker threads parse the links and add them to the graph
+static void gpath_loaders_load_file_mt(GPathLoader *ldrs, size_t nthreads,
+                                       GPathReader *file)
+{
+  size_t i, nbatches = 2*nthreads;
+  StrBuf *batches = ctx_calloc(nbatches, sizeof(StrBuf));
+  for(i = 0; i < nbatches; i++)
+    strbuf_alloc(&batches[i], gpath_load_batch_bytes + 1024);
+
+  MsgPool pool;
+  msgpool_alloc(&pool, nbatches, sizeof(StrBuf*), USE_MSG_POOL);
+  msgpool_iterate(&pool, _batch_pool_init, batches);
+
+  int rc, pos;
+  StrBuf *batch;
+
+  for(i = 0; i < nthreads; i++) {
+    ldrs[i].pool = &pool;
+    rc = pthread_create(&ldrs[i].thread, NULL, gpath_loader_thread, &ldrs[i]);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+
+  while(1) {
+    pos = msgpool_claim_write(&pool);
+    memcpy(&batch, msgpool_get_ptr(&pool, pos), sizeof(StrBuf*));
+    if(!_gpath_reader_read_batch(file, batch)) {
+      msgpool_release(&pool, pos, MPOOL_EMPTY);
+      break;
     }
+    msgpool_release(&pool, pos, MPOOL_FULL);
+  }
+
+  msgpool_close(&pool);
+
+  for(i = 0; i < nthreads; i++) {
+    rc = pthread_join(ldrs[i].thread, NULL);
+    if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+  }
+
+  msgpool_dealloc(&pool);
+  for(i = 0; i < nbatches; i++) strbuf_dealloc(&batches[i]);
+  ctx_free(batches);
+}
+
+/**
+ * Binary link files are copied straight into the GPathStore if it is empty,
+ * has no path hash, the colour filter maps file colours directly onto the
+ * graph colours and kmer_flags is not GPATH_SKIP_MISSING_KMERS. Otherwise
+ * links are loaded one kmer at a time, as for text files.
+ *
+ * Text files are decompressed by the calling thread and parsed by `nthreads`
+ * worker threads. Uses one thread if GPATH_ADD_MISSING_KMERS is given but the
+ * graph has no bucket locks (DBG_ALLOC_BKTLOCKS).
+ *
+ * @param kmer_flags must be one of:
+ *   * GPATH_ADD_MISSING_KMERS - add kmers to the graph before loading path
+ *   * GPATH_DIE_MISSING_KMERS - die with error if cannot find kmer
+ *   * GPATH_SKIP_MISSING_KMERS - skip paths where kmer is not in graph
+ */
+void gpath_reader_load_mt(GPathReader *file, int kmer_flags, size_t nthreads,
+                          dBGraph *db_graph)
+{
+  file_filter_status(&file->fltr, false);
+
+  if(file->bin != NULL &&
+     (_gpath_reader_load_bin(file, kmer_flags, db_graph) ||
+      _gpath_reader_load_bin_cols(file, kmer_flags, db_graph)))
+  {
+    gpath_store_sync_stats(&db_graph->gpstore);
+    return;
+  }
+
+  if(file->gz == NULL ||
+     (kmer_flags == GPATH_ADD_MISSING_KMERS && db_graph->bktlocks == NULL))
+    nthreads = 1;
+
+  size_t i, total_kmers_exp = gpath_reader_get_num_kmers(file);
+  size_t total_links_exp = gpath_reader_get_num_paths(file);
+  size_t num_kmers_seen = 0, num_links_seen = 0;
+  size_t num_kmers_loaded = 0, num_links_loaded = 0;
+
+  GPathLoader *ldrs = ctx_calloc(nthreads, sizeof(GPathLoader));
+  for(i = 0; i < nthreads; i++)
+    gpath_loader_alloc(&ldrs[i], file, kmer_flags, db_graph);
+
+  if(nthreads == 1) gpath_loader_load_file(&ldrs[0]);
+  else gpath_loaders_load_file_mt(ldrs, nthreads, file);
+
+  for(i = 0; i < nthreads; i++) {
+    num_kmers_seen += ldrs[i].num_kmers_seen;
+    num_links_seen += ldrs[i].num_links_seen;
+    num_kmers_loaded += ldrs[i].num_kmers_loaded;
+    num_links_loaded += ldrs[i].num_links_loaded;
+    gpath_loader_dealloc(&ldrs[i]);
   }
+  ctx_free(ldrs);
 
-  strbuf_dealloc(&kmerstr);
-  strbuf_dealloc(&juncs);
-  size_buf_dealloc(&counts);
+  gpath_store_sync_stats(&db_graph->gpstore);
 
   load_check(total_kmers_exp == num_kmers_seen,
              "header number of kmers don't match seen (exp %zu vs %zu)",
@@ -640,11 +1291,11 @@ void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
   ulong_to_str(num_links_loaded, nlinks_str);
   ulong_to_str(num_kmers_loaded, nkmers_str);
   status("Loaded %s paths from %s kmers", nlinks_str, nkmers_str);
+}
 
-  gpath_subset_dealloc(&subset0);
-  gpath_subset_dealloc(&subset1);
-  gpath_set_dealloc(&gpset);
-  byte_buf_dealloc(&seqbuf);
+void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
+{
+  gpath_reader_load_mt(file, kmer_flags, 1, db_graph);
 }
 
 void gpath_reader_load_sample_names(const GPathReader *file, dBGraph *db_graph)
@@ -690,9 +1341,9 @@ void gpath_reader_max_mem_req(GPathReader *files, size_t nfiles,
   hash_bytes = (use_hash ? sizeof(GPEntry)/IDEAL_OCCUPANCY : 0);
 
   for(i = 0; i < nfiles; i++) {
-    size_t npaths = gpath_reader_get_num_paths(&files[i]);
-    size_t pbytes = gpath_reader_get_path_bytes(&files[i]) +
-                    npaths * roundup_bits2bytes(ncols);
+    size_t npaths, pbytes;
+    gpath_reader_get_filtered_counts(&files[i], &npaths, &pbytes);
+    pbytes += npaths * roundup_bits2bytes(ncols);
     max_npaths = MAX2(max_npaths, npaths);
     max_pbytes = MAX2(max_pbytes, pbytes);
     sum_npaths += npaths;
@@ -721,8 +1372,7 @@ size_t gpath_reader_sum_mem(GPathReader *files, size_t nfiles,
 
   for(i = 0; i < nfiles; i++)
   {
-    npaths = gpath_reader_get_num_paths(&files[i]);
-    path_bytes = gpath_reader_get_path_bytes(&files[i]);
+    gpath_reader_get_filtered_counts(&files[i], &npaths, &path_bytes);
     file_mem = npaths * sizeof(GPath) + // GPath
                path_bytes + // Sequence
                npaths * roundup_bits2bytes(ncols) + // Colset
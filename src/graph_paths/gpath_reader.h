@@ -6,14 +6,101 @@
 #include "cJSON/cJSON.h"
 
 #include "common_buffers.h"
+#include "file_util.h"
 
 #define CTP_FORMAT_VERSION 4
 
+//
+// Binary link files (.ctp.bin)
+//
+// Same JSON header as .ctp.gz files, followed by kmers with links in sorted
+// order, an index of where each kmer's links start and the link entries.
+// Link sequences are stored as in GPathSet.seqs (colset then packed
+// junctions), so they can be copied straight into a GPathStore. Numbers are
+// stored in host byte order. Sections start on 8 byte boundaries:
+//
+//   GPathBinHeader
+//   char json[json_len] (null terminated)
+//   BinaryKmer kmers[num_kmers]
+//   uint64_t index[num_kmers+1] (links of kmer i are index[i]..index[i+1]-1)
+//   GPathBinEntry entries[num_paths]
+//   uint8_t seqs[seq_bytes]
+//   uint8_t nseen[num_paths*ncols]
+//   GPathBinColIndex cols[ncols]                  (version 2+)
+//   uint64_t col_kmers[num_col_kmers]             (version 2+)
+//
+// The colour index lets a subset of samples be loaded without reading the
+// links of the others. cols[c] gives the number of kmers and links in colour
+// c, and where its kmers start in col_kmers. col_kmers holds, for each colour
+// in turn, the sorted indices (into kmers[]) of kmers with links in it.
+// Version 1 files have no colour index and a shorter header.
+//
+#define CTP_BIN_MAGIC "CTXLNKBN"
+#define CTP_BIN_VERSION 2
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version, kmer_size, ncols, kmer_words;
+  uint64_t num_kmers, num_paths, seq_bytes, json_len;
+  uint64_t num_col_kmers; // version 2+
+} GPathBinHeader;
+
+#define ctp_bin_hdr_size(version) \
+        ((version) < 2 ? offsetof(GPathBinHeader, num_col_kmers) \
+                       : sizeof(GPathBinHeader))
+
+typedef struct
+{
+  // path_bytes is bytes of packed junctions, not including colsets
+  uint64_t num_kmers, num_paths, path_bytes, kmers_offset;
+} GPathBinColIndex;
+
+typedef struct
+{
+  uint64_t seqoff:48, num_juncs:15, orient:1; // seqoff is offset of colset
+} GPathBinEntry;
+
+#define ctp_bin_pad8(x) (((x)+7) & ~(size_t)7)
+
+// Offsets of sections in a binary link file
+// cols and col_kmers are 0 if the file has no colour index
+typedef struct
+{
+  size_t json, kmers, index, entries, seqs, nseen, cols, col_kmers, end;
+} GPathBinLayout;
+
+static inline void gpath_bin_layout(const GPathBinHeader *hdr,
+                                    GPathBinLayout *lyt)
+{
+  lyt->json = ctp_bin_hdr_size(hdr->version);
+  lyt->kmers = ctp_bin_pad8(lyt->json + hdr->json_len);
+  lyt->index = lyt->kmers + hdr->num_kmers * sizeof(BinaryKmer);
+  lyt->entries = lyt->index + (hdr->num_kmers+1) * sizeof(uint64_t);
+  lyt->seqs = lyt->entries + hdr->num_paths * sizeof(GPathBinEntry);
+  lyt->nseen = ctp_bin_pad8(lyt->seqs + hdr->seq_bytes);
+  lyt->end = lyt->nseen + hdr->num_paths * hdr->ncols;
+  lyt->cols = lyt->col_kmers = 0;
+
+  if(hdr->version >= 2) {
+    lyt->cols = ctp_bin_pad8(lyt->end);
+    lyt->col_kmers = lyt->cols + hdr->ncols * sizeof(GPathBinColIndex);
+    lyt->end = lyt->col_kmers + hdr->num_col_kmers * sizeof(uint64_t);
+  }
+}
+
+#define gpath_reader_is_bin(path) futil_path_has_extension(path, ".ctp.bin")
+
 typedef struct
 {
   StreamBuffer strmbuf;
   gzFile gz;
 
+  // Binary files are memory mapped, gz is NULL
+  uint8_t *bin;
+  size_t binlen, bin_kmer, bin_path, bin_path_end; // reading position
+  GPathBinLayout binlyt;
+
   // For parsing input
   StrBuf line;
   SizeBuffer numbuf;
@@ -54,6 +141,17 @@ void gpath_reader_check(const GPathReader *file, size_t kmer_size, size_t ncols)
 //   GPATH_DIE_MISSING_KMERS - die with error if cannot find kmer
 //   GPATH_SKIP_MISSING_KMERS - skip paths where kmer is not in graph
 void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph);
+
+// Same as gpath_reader_load(), text files are decompressed by the calling
+// thread and parsed by `nthreads` threads. GPATH_ADD_MISSING_KMERS needs
+// bucket locks (DBG_ALLOC_BKTLOCKS) to use more than one thread.
+void gpath_reader_load_mt(GPathReader *file, int kmer_flags, size_t nthreads,
+                          dBGraph *db_graph);
+
+// Text passed to each loading thread at a time, in bytes
+#define GPATH_LOAD_BATCH_BYTES (256*1024)
+void gpath_reader_set_batch_size(size_t nbytes);
+size_t gpath_reader_get_batch_size();
 void gpath_reader_close(GPathReader *file);
 
 // Given an array of GPathReaders, find the max and sum of the number of kmers
@@ -94,6 +192,13 @@ size_t gpath_reader_get_kmer_size(const GPathReader *file);
 size_t gpath_reader_get_num_kmers(const GPathReader *file);
 size_t gpath_reader_get_num_paths(const GPathReader *file);
 size_t gpath_reader_get_path_bytes(const GPathReader *file);
+// Number of links and bytes of junctions that would be loaded with the file's
+// colour filter. Only less than the totals for binary files with a colour
+// index, otherwise all links have to be read to know.
+void gpath_reader_get_filtered_counts(const GPathReader *file,
+                                      size_t *num_paths, size_t *path_bytes);
+// True if kmers in the file are in sorted order (see gpath_save())
+bool gpath_reader_kmers_sorted(const GPathReader *file);
 const char* gpath_reader_get_sample_name(const GPathReader *file, size_t idx);
 
 // Copy sample names into the graph
@@ -1,11 +1,13 @@
 #include "global.h"
 #include "gpath_save.h"
+#include "gpath_reader.h"
 #include "gpath_checks.h"
 #include "gpath_set.h"
 #include "gpath_subset.h"
 #include "binary_seq.h"
 #include "util.h"
 #include "json_hdr.h"
+#include "zstd_file.h"
 
 const char ctp_explanation_comment[] =
 "# This file was generated with McCortex\n"
@@ -59,12 +61,13 @@ static void _gpath_save_contig_hist2json(cJSON *json_hists,
  *                    If cmdstr and cmdhdr are both NULL they are ignored
  * @param contig_hist histgram of read contig lengths
  * @param hist_len    length of array contig_hist
+ * @param kmers_sorted if true, record that kmers are written in sorted order
  */
 cJSON* gpath_save_mkhdr(const char *path,
                         const char *cmdstr, cJSON *cmdhdr,
                         cJSON **hdrs, size_t nhdrs,
                         const ZeroSizeBuffer *contig_hists, size_t ncols,
-                        const dBGraph *db_graph)
+                        bool kmers_sorted, const dBGraph *db_graph)
 {
   ctx_assert(!cmdstr == !cmdhdr);
 
@@ -97,6 +100,7 @@ cJSON* gpath_save_mkhdr(const char *path,
   cJSON_AddNumberToObject(paths, "num_kmers_with_paths", gpstore->num_kmers_with_paths);
   cJSON_AddNumberToObject(paths, "num_paths", gpstore->num_paths);
   cJSON_AddNumberToObject(paths, "path_bytes", gpstore->path_bytes);
+  if(kmers_sorted) cJSON_AddTrueToObject(paths, "kmers_sorted");
 
   // Add size distribution
   cJSON *json_hists = cJSON_CreateArray();
@@ -110,13 +114,66 @@ cJSON* gpath_save_mkhdr(const char *path,
 }
 
 
-static inline void _gpath_save_flush(gzFile gzout, StrBuf *sbuf,
-                                     pthread_mutex_t *outlock)
+// Print "<kmer> <npaths>"
+static inline void _gpath_save_kmer_sbuf(const char *bkstr, size_t kmer_size,
+                                         size_t npaths, StrBuf *sbuf)
 {
-  pthread_mutex_lock(outlock);
-  gzwrite(gzout, sbuf->b, sbuf->end);
-  pthread_mutex_unlock(outlock);
-  strbuf_reset(sbuf);
+  // strbuf_sprintf(sbuf, "%s %zu\n", bkstr, npaths);
+  strbuf_append_strn(sbuf, bkstr, kmer_size);
+  strbuf_append_char(sbuf, ' ');
+  strbuf_append_ulong(sbuf, npaths);
+  strbuf_append_char(sbuf, '\n');
+}
+
+// Print "[FR] [njuncs] [nseen0,nseen1,...] [juncs]" without a newline
+static inline void _gpath_save_link_sbuf(const GPath *gpath,
+                                         const GPathSet *gpset, StrBuf *sbuf)
+{
+  const char orchar[2] = {[FORWARD] = 'F', [REVERSE] = 'R'};
+  const uint8_t *nseenptr = gpath_set_get_nseen(gpset, gpath);
+  size_t col;
+
+  // strbuf_sprintf(sbuf, "%c %zu %u %u", orchar[gpath->orient], klen,
+  //                                      gpath->num_juncs, (uint32_t)nseenptr[0]);
+
+  strbuf_append_char(sbuf, orchar[gpath->orient]);
+  strbuf_append_char(sbuf, ' ');
+  strbuf_append_ulong(sbuf, gpath->num_juncs);
+  strbuf_append_char(sbuf, ' ');
+  strbuf_append_ulong(sbuf, nseenptr[0]);
+
+  for(col = 1; col < gpset->ncols; col++) {
+    // strbuf_sprintf(sbuf, ",%u", (uint32_t)nseenptr[col]);
+    strbuf_append_char(sbuf, ',');
+    strbuf_append_ulong(sbuf, nseenptr[col]);
+  }
+
+  strbuf_append_char(sbuf, ' ');
+  strbuf_ensure_capacity(sbuf, sbuf->end + gpath->num_juncs + 2);
+  binary_seq_to_str(gpath_seq(gpath), gpath->num_juncs, sbuf->b+sbuf->end);
+  sbuf->end += gpath->num_juncs;
+}
+
+/**
+ * Print the paths in a subset to a string buffer, in the order they are in the
+ * subset. Does nothing if the subset is empty.
+ *
+ * @param bkstr   kmer the paths belong to
+ * @param subset  paths to write, with nseen counts in subset->gpset
+ * @param sbuf    paths are written this string buffer
+ */
+void gpath_save_subset_sbuf(const char *bkstr, size_t kmer_size,
+                            const GPathSubset *subset, StrBuf *sbuf)
+{
+  size_t i;
+  if(subset->list.len == 0) return;
+
+  _gpath_save_kmer_sbuf(bkstr, kmer_size, subset->list.len, sbuf);
+
+  for(i = 0; i < subset->list.len; i++) {
+    _gpath_save_link_sbuf(subset->list.b[i], subset->gpset, sbuf);
+    strbuf_append_char(sbuf, '\n');
+  }
 }
 
 /**
@@ -154,41 +211,12 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
   char bkstr[MAX_KMER_SIZE+1];
   binary_kmer_to_str(bkmer, db_graph->kmer_size, bkstr);
 
-  // strbuf_sprintf(sbuf, "%s %zu\n", bkstr, subset->list.len);
-  strbuf_append_strn(sbuf, bkstr, db_graph->kmer_size);
-  strbuf_append_char(sbuf, ' ');
-  strbuf_append_ulong(sbuf, subset->list.len);
-  strbuf_append_char(sbuf, '\n');
-
-  char orchar[2] = {0};
-  orchar[FORWARD] = 'F';
-  orchar[REVERSE] = 'R';
-  const uint8_t *nseenptr;
+  _gpath_save_kmer_sbuf(bkstr, db_graph->kmer_size, subset->list.len, sbuf);
 
   for(i = 0; i < subset->list.len; i++)
   {
     gpath = subset->list.b[i];
-    nseenptr = gpath_set_get_nseen(gpset, gpath);
-
-    // strbuf_sprintf(sbuf, "%c %zu %u %u", orchar[gpath->orient], klen,
-    //                                      gpath->num_juncs, (uint32_t)nseenptr[0]);
-
-    strbuf_append_char(sbuf, orchar[gpath->orient]);
-    strbuf_append_char(sbuf, ' ');
-    strbuf_append_ulong(sbuf, gpath->num_juncs);
-    strbuf_append_char(sbuf, ' ');
-    strbuf_append_ulong(sbuf, nseenptr[0]);
-
-    for(col = 1; col < ncols; col++) {
-      // strbuf_sprintf(sbuf, ",%u", (uint32_t)nseenptr[col]);
-      strbuf_append_char(sbuf, ',');
-      strbuf_append_ulong(sbuf, nseenptr[col]);
-    }
-
-    strbuf_append_char(sbuf, ' ');
-    strbuf_ensure_capacity(sbuf, sbuf->end + gpath->num_juncs + 2);
-    binary_seq_to_str(gpath->seq, gpath->num_juncs, sbuf->b+sbuf->end);
-    sbuf->end += gpath->num_juncs;
+    _gpath_save_link_sbuf(gpath, gpset, sbuf);
 
     if(nbuf)
     {
@@ -222,73 +250,313 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
   }
 }
 
-// @subset is a temp variable that is reused each time
-// @sbuf   is a temp variable that is reused each time
-static inline int _gpath_gzsave_node(hkey_t hkey,
-                                     StrBuf *sbuf, GPathSubset *subset,
-                                     dBNodeBuffer *nbuf, SizeBuffer *jposbuf,
-                                     gzFile gzout, pthread_mutex_t *outlock,
-                                     const dBGraph *db_graph)
-{
-  gpath_save_sbuf(hkey, sbuf, subset, nbuf, jposbuf, db_graph);
-
-  if(sbuf->end > DEFAULT_IO_BUFSIZE)
-    _gpath_save_flush(gzout, sbuf, outlock);
+//
+// Text output is compressed in blocks of GPATH_SAVE_BLOCK_SIZE bytes by each
+// thread and written as concatenated gzip members, so deflate is not limited
+// to a single core
+//
 
-  return 0; // => keep iterating
-}
+// Per thread buffers for writing links
+typedef struct
+{
+  StrBuf sbuf, zbuf; // text, compressed gzip members
+  GPathSubset subset;
+  dBNodeBuffer nbuf;
+  SizeBuffer jposbuf;
+} GPathSaveBuffers;
 
 typedef struct
 {
   size_t nthreads;
   bool save_seq; // write seq=... juncpos=...
-  gzFile gzout;
+  bool zstd; // output is a zstd stream, don't gzip blocks
+  FILE *fout;
   pthread_mutex_t *outlock;
-  dBGraph *db_graph;
+  GPathSaveBuffers *bufs; // [nthreads]
+  const hkey_t *hkeys; // sorted kmers of the current chunk
+  size_t nkmers;
+  const dBGraph *db_graph;
 } GPathSaving;
 
+static void _gpath_save_bufs_alloc(GPathSaveBuffers *bufs, GPathSet *gpset)
+{
+  strbuf_alloc(&bufs->sbuf, GPATH_SAVE_BLOCK_SIZE + DEFAULT_IO_BUFSIZE);
+  strbuf_alloc(&bufs->zbuf, GPATH_SAVE_BLOCK_SIZE);
+  gpath_subset_alloc(&bufs->subset);
+  gpath_subset_init(&bufs->subset, gpset);
+  db_node_buf_alloc(&bufs->nbuf, 1024);
+  size_buf_alloc(&bufs->jposbuf, 256);
+}
+
+static void _gpath_save_bufs_dealloc(GPathSaveBuffers *bufs)
+{
+  strbuf_dealloc(&bufs->sbuf);
+  strbuf_dealloc(&bufs->zbuf);
+  gpath_subset_dealloc(&bufs->subset);
+  db_node_buf_dealloc(&bufs->nbuf);
+  size_buf_dealloc(&bufs->jposbuf);
+}
+
+// Compress text in bufs->sbuf as a gzip member on the end of bufs->zbuf
+// (zstd output streams compress it themselves)
+static inline void _gpath_save_compress(GPathSaveBuffers *bufs, bool zstd)
+{
+  if(bufs->sbuf.end == 0) return;
+  futil_pack_block(bufs->sbuf.b, bufs->sbuf.end, Z_DEFAULT_COMPRESSION, zstd,
+                   &bufs->zbuf);
+  strbuf_reset(&bufs->sbuf);
+}
+
+static inline void _gpath_save_write(GPathSaving *save, StrBuf *zbuf,
+                                     bool lock)
+{
+  if(lock) pthread_mutex_lock(save->outlock);
+  if(fwrite(zbuf->b, 1, zbuf->end, save->fout) != zbuf->end)
+    die("Cannot write links: %s", strerror(errno));
+  if(lock) pthread_mutex_unlock(save->outlock);
+  strbuf_reset(zbuf);
+}
+
+static inline void _gpath_save_kmer(hkey_t hkey, GPathSaveBuffers *bufs,
+                                    bool save_seq, bool zstd,
+                                    const dBGraph *db_graph)
+{
+  gpath_save_sbuf(hkey, &bufs->sbuf, &bufs->subset,
+                  save_seq ? &bufs->nbuf : NULL,
+                  save_seq ? &bufs->jposbuf : NULL, db_graph);
+
+  if(bufs->sbuf.end >= GPATH_SAVE_BLOCK_SIZE)
+    _gpath_save_compress(bufs, zstd);
+}
+
+// Kmers can be written in any order, write each block once compressed
+static inline int _gpath_save_node(hkey_t hkey, GPathSaving *save,
+                                   GPathSaveBuffers *bufs)
+{
+  _gpath_save_kmer(hkey, bufs, save->save_seq, save->zstd, save->db_graph);
+  if(bufs->zbuf.end > 0) _gpath_save_write(save, &bufs->zbuf, true);
+  return 0; // => keep iterating
+}
+
 static void gpath_save_thread(void *arg, size_t threadid)
 {
   GPathSaving *save = (GPathSaving*)arg;
-  const dBGraph *db_graph = save->db_graph;
+  GPathSaveBuffers *bufs = &save->bufs[threadid];
 
-  GPathSubset subset;
-  StrBuf sbuf;
+  HASH_ITERATE_PART(&save->db_graph->ht, threadid, save->nthreads,
+                    _gpath_save_node, save, bufs);
 
-  gpath_subset_alloc(&subset);
-  gpath_subset_init(&subset, &save->db_graph->gpstore.gpset);
-  strbuf_alloc(&sbuf, 2 * DEFAULT_IO_BUFSIZE);
+  _gpath_save_compress(bufs, save->zstd);
+  _gpath_save_write(save, &bufs->zbuf, true);
+}
 
-  dBNodeBuffer nbuf;
-  SizeBuffer jposbuf;
-  db_node_buf_alloc(&nbuf, 1024);
-  size_buf_alloc(&jposbuf, 256);
+//
+// Writing kmers in sorted order, allows link files to be merged by streaming
+// them (see ctx_pjoin --stream)
+//
 
-  HASH_ITERATE_PART(&db_graph->ht, threadid, save->nthreads,
-                    _gpath_gzsave_node,
-                    &sbuf, &subset,
-                    save->save_seq ? &nbuf : NULL, save->save_seq ? &jposbuf : NULL,
-                    save->gzout, save->outlock,
-                    db_graph);
+// Each thread formats and compresses a contiguous part of the sorted chunk
+static void gpath_save_sorted_thread(void *arg, size_t threadid)
+{
+  GPathSaving *save = (GPathSaving*)arg;
+  GPathSaveBuffers *bufs = &save->bufs[threadid];
+  size_t i, start, end;
 
-  _gpath_save_flush(save->gzout, &sbuf, save->outlock);
+  start = (save->nkmers * threadid) / save->nthreads;
+  end = (save->nkmers * (threadid+1)) / save->nthreads;
 
-  db_node_buf_dealloc(&nbuf);
-  size_buf_dealloc(&jposbuf);
-  gpath_subset_dealloc(&subset);
-  strbuf_dealloc(&sbuf);
+  for(i = start; i < end; i++)
+    _gpath_save_kmer(save->hkeys[i], bufs, save->save_seq, save->zstd,
+                     save->db_graph);
+
+  _gpath_save_compress(bufs, save->zstd);
+}
+
+static bool _gpath_save_sorted_chunk(const hkey_t *hkeys, size_t n, void *arg)
+{
+  GPathSaving *save = (GPathSaving*)arg;
+  size_t i;
+
+  save->hkeys = hkeys;
+  save->nkmers = n;
+  util_multi_thread(save, save->nthreads, gpath_save_sorted_thread);
+
+  // Write blocks in order
+  for(i = 0; i < save->nthreads; i++)
+    _gpath_save_write(save, &save->bufs[i].zbuf, false);
+
+  return false; // keep iterating
+}
+
+//
+// Binary link files (.ctp.bin), see gpath_reader.h for format
+//
+
+static void _gpath_save_bin_pad(FILE *fout, size_t pos)
+{
+  const uint8_t zeros[8] = {0};
+  fwrite(zeros, 1, ctp_bin_pad8(pos) - pos, fout);
+}
+
+// Set `kcolset` to the union of the colours of a kmer's links
+// If `cols` is not NULL, count links and their junction bytes per colour
+static void _gpath_save_bin_kmer_cols(const GPath *gpath, size_t ncols,
+                                      uint8_t *kcolset, GPathBinColIndex *cols)
+{
+  const uint8_t *colset;
+  size_t c, colset_bytes = (ncols+7)/8;
+  memset(kcolset, 0, colset_bytes);
+
+  for(; gpath != NULL; gpath = gpath_next(gpath)) {
+    colset = gpath_get_colset(gpath, ncols);
+    for(c = 0; c < colset_bytes; c++) kcolset[c] |= colset[c];
+    if(cols != NULL) {
+      for(c = 0; c < ncols; c++) {
+        if(bitset_get(colset, c)) {
+          cols[c].num_paths++;
+          cols[c].path_bytes += binary_seq_mem(gpath->num_juncs);
+        }
+      }
+    }
+  }
+}
+
+static void gpath_save_bin(FILE *fout, const char *path, size_t nthreads,
+                           cJSON *json, const dBGraph *db_graph)
+{
+  const GPathStore *gpstore = &db_graph->gpstore;
+  const GPathSet *gpset = &gpstore->gpset;
+  const size_t ncols = gpset->ncols, colset_bytes = (ncols+7)/8;
+  const GPath *gpath;
+  size_t i, c, nkmers = 0, num_paths = 0, seq_bytes = 0, num_col_kmers = 0;
+
+  GPathBinColIndex *cols = ctx_calloc(MAX2(ncols, 1), sizeof(GPathBinColIndex));
+  uint8_t *kcolset = ctx_calloc(MAX2(colset_bytes, 1), 1);
+
+  // Kmers with links in sorted order
+  hkey_t *hkeys = hash_table_sorted_mt(&db_graph->ht, nthreads);
+
+  for(i = 0; i < db_graph->ht.num_kmers; i++) {
+    gpath = gpath_store_fetch(gpstore, hkeys[i]);
+    if(gpath != NULL) {
+      hkeys[nkmers++] = hkeys[i];
+      _gpath_save_bin_kmer_cols(gpath, ncols, kcolset, cols);
+      for(c = 0; c < ncols; c++) cols[c].num_kmers += bitset_get(kcolset, c);
+      for(; gpath != NULL; gpath = gpath_next(gpath)) {
+        num_paths++;
+        seq_bytes += colset_bytes + binary_seq_mem(gpath->num_juncs);
+      }
+    }
+  }
+
+  for(c = 0; c < ncols; c++) {
+    cols[c].kmers_offset = num_col_kmers;
+    num_col_kmers += cols[c].num_kmers;
+  }
+
+  char *jstr = cJSON_Print(json);
+
+  GPathBinHeader hdr = {.version = CTP_BIN_VERSION,
+                        .kmer_size = db_graph->kmer_size,
+                        .ncols = ncols,
+                        .kmer_words = NUM_BKMER_WORDS,
+                        .num_kmers = nkmers,
+                        .num_paths = num_paths,
+                        .seq_bytes = seq_bytes,
+                        .json_len = strlen(jstr)+1,
+                        .num_col_kmers = num_col_kmers};
+  memcpy(hdr.magic, CTP_BIN_MAGIC, sizeof(hdr.magic));
+
+  GPathBinLayout lyt;
+  gpath_bin_layout(&hdr, &lyt);
+
+  fwrite(&hdr, sizeof(hdr), 1, fout);
+  fwrite(jstr, 1, hdr.json_len, fout);
+  _gpath_save_bin_pad(fout, lyt.json + hdr.json_len);
+  free(jstr);
+
+  for(i = 0; i < nkmers; i++) {
+    BinaryKmer bkey = hash_table_fetch(&db_graph->ht, hkeys[i]);
+    fwrite(&bkey, sizeof(bkey), 1, fout);
+  }
+
+  uint64_t offset = 0;
+  for(i = 0; i < nkmers; i++) {
+    fwrite(&offset, sizeof(offset), 1, fout);
+    gpath = gpath_store_fetch(gpstore, hkeys[i]);
+    for(; gpath != NULL; gpath = gpath_next(gpath)) offset++;
+  }
+  fwrite(&offset, sizeof(offset), 1, fout);
+
+  // Links are kept in linked list order
+  GPathBinEntry entry;
+  offset = 0;
+  for(i = 0; i < nkmers; i++) {
+    gpath = gpath_store_fetch(gpstore, hkeys[i]);
+    for(; gpath != NULL; gpath = gpath_next(gpath)) {
+      entry = (GPathBinEntry){.seqoff = offset, .num_juncs = gpath->num_juncs,
+                              .orient = gpath->orient};
+      fwrite(&entry, sizeof(entry), 1, fout);
+      offset += colset_bytes + binary_seq_mem(gpath->num_juncs);
+    }
+  }
+
+  // colset is stored directly before seq
+  for(i = 0; i < nkmers; i++) {
+    gpath = gpath_store_fetch(gpstore, hkeys[i]);
+    for(; gpath != NULL; gpath = gpath_next(gpath)) {
+      fwrite(gpath_get_colset(gpath, ncols), 1,
+             colset_bytes + binary_seq_mem(gpath->num_juncs), fout);
+    }
+  }
+  _gpath_save_bin_pad(fout, lyt.seqs + seq_bytes);
+
+  for(i = 0; i < nkmers; i++) {
+    gpath = gpath_store_fetch(gpstore, hkeys[i]);
+    for(; gpath != NULL; gpath = gpath_next(gpath))
+      fwrite(gpath_set_get_nseen(gpset, gpath), 1, ncols, fout);
+  }
+  _gpath_save_bin_pad(fout, lyt.nseen + num_paths*ncols);
+
+  // Colour index
+  fwrite(cols, sizeof(GPathBinColIndex), ncols, fout);
+
+  uint64_t *col_kmers = ctx_malloc(MAX2(num_col_kmers, 1) * sizeof(uint64_t));
+  for(c = 0; c < ncols; c++) cols[c].num_kmers = 0; // reuse as fill counts
+
+  for(i = 0; i < nkmers; i++) {
+    gpath = gpath_store_fetch(gpstore, hkeys[i]);
+    _gpath_save_bin_kmer_cols(gpath, ncols, kcolset, NULL);
+    for(c = 0; c < ncols; c++) {
+      if(bitset_get(kcolset, c))
+        col_kmers[cols[c].kmers_offset + cols[c].num_kmers++] = i;
+    }
+  }
+
+  fwrite(col_kmers, sizeof(uint64_t), num_col_kmers, fout);
+
+  futil_fcheck(0, fout, path);
+  ctx_free(col_kmers);
+  ctx_free(kcolset);
+  ctx_free(cols);
+  ctx_free(hkeys);
 }
 
 /**
  * Save paths to a file.
- * @param gzout         gzFile to write to
+ * If path ends .ctp.bin, save in binary format, save_path_seq is ignored and
+ * kmers are always sorted. Otherwise written as gzip compressed text, in
+ * blocks compressed by `nthreads` threads. If path ends .zst, `fout` must be
+ * a zstd stream (see futil_fopen()) and text is written to it uncompressed.
+ * @param fout          file to write to, opened by the caller
  * @param path          path of output file
  * @param save_path_seq if true, save seq= and juncpos= for links, requires
  *                      exactly one colour in the graph
+ * @param sort_kmers    if true, write kmers in sorted order
  * @param hdrs is array of JSON headers of input files
  */
-void gpath_save(gzFile gzout, const char *path,
-                size_t nthreads, bool save_path_seq,
+void gpath_save(FILE *fout, const char *path,
+                size_t nthreads, bool save_path_seq, bool sort_kmers,
                 const char *cmdstr, cJSON *cmdhdr,
                 cJSON **hdrs, size_t nhdrs,
                 const ZeroSizeBuffer *contig_hists, size_t ncols,
@@ -305,27 +573,252 @@ void gpath_save(gzFile gzout, const char *path,
   status("Saving %s paths to: %s", npaths_str, path);
   status("  using %zu threads", nthreads);
 
+  bool is_bin = gpath_reader_is_bin(path);
+  size_t i;
+
   // Write header
   cJSON *json = gpath_save_mkhdr(path, cmdstr, cmdhdr, hdrs, nhdrs,
-                                 contig_hists, ncols, db_graph);
-  json_hdr_gzprint(json, gzout);
-  cJSON_Delete(json);
-
-  // Print comments about the format
-  gzputs(gzout, ctp_explanation_comment);
+                                 contig_hists, ncols, sort_kmers || is_bin,
+                                 db_graph);
+
+  if(is_bin) {
+    gpath_save_bin(fout, path, nthreads, json, db_graph);
+    cJSON_Delete(json);
+    status("[GPathSave] Graph paths saved to %s", path);
+    return;
+  }
 
-  // Multithreaded
   pthread_mutex_t outlock;
   if(pthread_mutex_init(&outlock, NULL) != 0) die("Mutex init failed");
 
+  GPathSaveBuffers *bufs = ctx_calloc(nthreads, sizeof(GPathSaveBuffers));
+  for(i = 0; i < nthreads; i++)
+    _gpath_save_bufs_alloc(&bufs[i], &db_graph->gpstore.gpset);
+
   GPathSaving save = {.nthreads = nthreads,
                       .save_seq = save_path_seq,
-                      .gzout = gzout,
+                      .zstd = zstd_file_is_path(path),
+                      .fout = fout,
                       .outlock = &outlock,
+                      .bufs = bufs,
                       .db_graph = db_graph};
 
-  // Iterate over kmers writing paths
-  util_multi_thread(&save, nthreads, gpath_save_thread);
+  // Header and comments about the format are the first gzip member
+  char *jstr = cJSON_Print(json);
+  strbuf_set(&bufs[0].sbuf, jstr);
+  strbuf_append_str(&bufs[0].sbuf, "\n\n");
+  strbuf_append_str(&bufs[0].sbuf, ctp_explanation_comment);
+  _gpath_save_compress(&bufs[0], save.zstd);
+  _gpath_save_write(&save, &bufs[0].zbuf, false);
+  free(jstr);
+  cJSON_Delete(json);
+
+  if(sort_kmers) {
+    // Kmers are sorted a chunk at a time, each chunk written by all threads
+    hash_table_sorted_chunks(&db_graph->ht, nthreads, GPATH_SAVE_SORT_CHUNK,
+                             _gpath_save_sorted_chunk, &save);
+  }
+  else {
+    // Iterate over kmers writing paths
+    util_multi_thread(&save, nthreads, gpath_save_thread);
+  }
+
+  futil_fcheck(0, fout, path);
+
+  for(i = 0; i < nthreads; i++) _gpath_save_bufs_dealloc(&bufs[i]);
+  ctx_free(bufs);
   pthread_mutex_destroy(&outlock);
-  status("[GPathSave] Graph paths saved to %s", path);
+
+  status("[GPathSave] Graph paths saved to %s%s", path,
+         sort_kmers ? " (sorted)" : "");
+}
+
+// Next kmer of each file, kmers[i].end == 0 if file i has no more kmers
+static void _gpath_merge_next_kmer(GPathReader *file, StrBuf *kmer)
+{
+  StrBuf prev;
+  size_t num_links;
+  strbuf_alloc(&prev, kmer->end+1);
+  strbuf_set(&prev, kmer->b);
+
+  if(!gpath_reader_read_kmer(file, kmer, &num_links)) strbuf_reset(kmer);
+  else if(prev.end > 0 && strcmp(prev.b, kmer->b) >= 0)
+    die("Link file is not sorted: %s [%s]", kmer->b, file_filter_path(&file->fltr));
+
+  strbuf_dealloc(&prev);
+}
+
+// Add links of the current kmer in `file` to `gpset`
+static void _gpath_merge_load_links(GPathReader *file, GPathSet *gpset,
+                                    SizeBuffer *counts, StrBuf *juncs,
+                                    ByteBuffer *seqbuf)
+{
+  size_t i, njuncs, link_covg, into_ncols = file_filter_into_ncols(&file->fltr);
+  bool fw;
+
+  while(gpath_reader_read_link(file, &fw, &njuncs, counts, juncs, NULL, NULL))
+  {
+    // Check if link has coverage in any colours
+    for(i = 0, link_covg = 0; i < into_ncols; i++) link_covg |= counts->b[i];
+    if(!link_covg) continue;
+
+    byte_buf_capacity(seqbuf, binary_seq_mem(juncs->end));
+    binary_seq_from_str(juncs->b, juncs->end, seqbuf->b);
+
+    GPathNew newgpath = {.seq = seqbuf->b,
+                         .colset = NULL, .nseen = NULL,
+                         .orient = fw ? FORWARD : REVERSE,
+                         .num_juncs = juncs->end};
+
+    GPath *gpath = gpath_set_add_mt(gpset, newgpath);
+    uint8_t *nseen = gpath_set_get_nseen(gpset, gpath);
+    uint8_t *colset = gpath_get_colset(gpath, gpset->ncols);
+    for(i = 0; i < into_ncols; i++) {
+      nseen[i] = MIN2((size_t)UINT8_MAX, (size_t)nseen[i] + counts->b[i]);
+      bitset_or(colset, i, counts->b[i] > 0);
+    }
+  }
+}
+
+/**
+ * Merge sorted link files with a k-way merge on their kmers. Only the links of
+ * one kmer are held in memory at a time. Links are written to a temporary file
+ * first, since the header needs the number of kmers and links. The output is
+ * the header followed by the temporary file (two gzip members).
+ */
+void gpath_save_merge_sorted(FILE *fout, const char *path,
+                             GPathReader *pfiles, size_t num_pfiles,
+                             const char *cmdstr, cJSON *cmdhdr,
+                             cJSON **hdrs, size_t nhdrs,
+                             const ZeroSizeBuffer *contig_hists, size_t ncols)
+{
+  ctx_assert(num_pfiles > 0);
+  ctx_assert(!gpath_reader_is_bin(path));
+
+  const size_t kmer_size = gpath_reader_get_kmer_size(&pfiles[0]);
+  uint64_t num_kmers = 0, num_paths = 0, path_bytes = 0;
+  size_t i;
+
+  StrBuf *kmers = ctx_calloc(num_pfiles, sizeof(StrBuf));
+  for(i = 0; i < num_pfiles; i++) {
+    strbuf_alloc(&kmers[i], kmer_size+1);
+    _gpath_merge_next_kmer(&pfiles[i], &kmers[i]);
+  }
+
+  StrBuf kmer, juncs, sbuf;
+  SizeBuffer counts;
+  ByteBuffer seqbuf;
+  strbuf_alloc(&kmer, kmer_size+1);
+  strbuf_alloc(&juncs, 1024);
+  strbuf_alloc(&sbuf, 2 * DEFAULT_IO_BUFSIZE);
+  size_buf_alloc(&counts, 16);
+  byte_buf_alloc(&seqbuf, 1024);
+
+  GPathSet gpset;
+  GPathSubset subset;
+  gpath_set_alloc(&gpset, ncols, ONE_MEGABYTE, true, true);
+  gpath_subset_alloc(&subset);
+  gpath_subset_init(&subset, &gpset);
+
+  FILE **tmp_files = futil_create_tmp_files(1);
+  // Uncompressed ("wT") if copied into a zstd stream
+  bool zstd = zstd_file_is_path(path);
+  gzFile gztmp = gzdopen(dup(fileno(tmp_files[0])), zstd ? "wT" : "w");
+  if(gztmp == NULL) die("Cannot write temporary file");
+
+  while(1)
+  {
+    // Find smallest next kmer
+    const char *minkmer = NULL;
+    for(i = 0; i < num_pfiles; i++) {
+      if(kmers[i].end > 0 && (minkmer == NULL || strcmp(kmers[i].b, minkmer) < 0))
+        minkmer = kmers[i].b;
+    }
+    if(minkmer == NULL) break;
+    strbuf_set(&kmer, minkmer);
+
+    for(i = 0; i < num_pfiles; i++) {
+      if(kmers[i].end > 0 && strcmp(kmers[i].b, kmer.b) == 0) {
+        _gpath_merge_load_links(&pfiles[i], &gpset, &counts, &juncs, &seqbuf);
+        _gpath_merge_next_kmer(&pfiles[i], &kmers[i]);
+      }
+    }
+
+    // Sort links and merge duplicates
+    gpath_subset_reset(&subset);
+    gpath_subset_load_set(&subset);
+    gpath_subset_rmdup(&subset);
+    gpath_save_subset_sbuf(kmer.b, kmer_size, &subset, &sbuf);
+
+    if(sbuf.end > DEFAULT_IO_BUFSIZE) {
+      gzwrite(gztmp, sbuf.b, sbuf.end);
+      strbuf_reset(&sbuf);
+    }
+
+    num_kmers += (subset.list.len > 0);
+    num_paths += subset.list.len;
+    for(i = 0; i < subset.list.len; i++)
+      path_bytes += binary_seq_mem(subset.list.b[i]->num_juncs);
+
+    gpath_set_reset(&gpset);
+  }
+
+  gzwrite(gztmp, sbuf.b, sbuf.end);
+  if(gzclose(gztmp) != Z_OK) die("Cannot write temporary file");
+
+  // Header needs a graph with the sample names and link counts
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, kmer_size, ncols, 0, 1024, 0);
+  gpath_store_alloc(&db_graph.gpstore, ncols, db_graph.ht.capacity,
+                    0, ONE_MEGABYTE, true, false);
+
+  for(i = 0; i < num_pfiles; i++)
+    gpath_reader_load_sample_names(&pfiles[i], &db_graph);
+
+  db_graph.ht.num_kmers = num_kmers;
+  db_graph.gpstore.num_kmers_with_paths = num_kmers;
+  db_graph.gpstore.num_paths = num_paths;
+  db_graph.gpstore.path_bytes = path_bytes;
+
+  cJSON *json = gpath_save_mkhdr(path, cmdstr, cmdhdr, hdrs, nhdrs,
+                                 contig_hists, ncols, true, &db_graph);
+
+  // Header is its own gzip member
+  StrBuf hdrbuf, zbuf;
+  char *jstr = cJSON_Print(json);
+  strbuf_alloc(&hdrbuf, 4096);
+  strbuf_alloc(&zbuf, 4096);
+  strbuf_set(&hdrbuf, jstr);
+  strbuf_append_str(&hdrbuf, "\n\n");
+  strbuf_append_str(&hdrbuf, ctp_explanation_comment);
+  futil_pack_block(hdrbuf.b, hdrbuf.end, Z_DEFAULT_COMPRESSION, zstd, &zbuf);
+
+  fwrite(zbuf.b, 1, zbuf.end, fout);
+  free(jstr);
+  strbuf_dealloc(&hdrbuf);
+  strbuf_dealloc(&zbuf);
+  cJSON_Delete(json);
+
+  futil_merge_tmp_files(tmp_files, 1, fout);
+  futil_fcheck(0, fout, path);
+  ctx_free(tmp_files);
+
+  char pnum_str[100], pbytes_str[100], pkmers_str[100];
+  ulong_to_str(num_paths, pnum_str);
+  bytes_to_str(path_bytes, 1, pbytes_str);
+  ulong_to_str(num_kmers, pkmers_str);
+
+  status("Paths written to: %s\n", path);
+  status("  %s paths, %s path-bytes, %s kmers", pnum_str, pbytes_str, pkmers_str);
+
+  db_graph_dealloc(&db_graph);
+  gpath_subset_dealloc(&subset);
+  gpath_set_dealloc(&gpset);
+  for(i = 0; i < num_pfiles; i++) strbuf_dealloc(&kmers[i]);
+  ctx_free(kmers);
+  strbuf_dealloc(&kmer);
+  strbuf_dealloc(&juncs);
+  strbuf_dealloc(&sbuf);
+  size_buf_dealloc(&counts);
+  byte_buf_dealloc(&seqbuf);
 }
@@ -4,6 +4,7 @@
 #include "db_graph.h"
 #include "db_node.h"
 #include "gpath_subset.h"
+#include "gpath_reader.h"
 #include "cJSON/cJSON.h"
 
 /*
@@ -25,12 +26,24 @@ extern const char ctp_explanation_comment[];
  * @param nhdrs       number of elements in @hdrs
  * @param contig_hist histgram of read contig lengths
  * @param hist_len    length of array contig_hist
+ * @param kmers_sorted if true, adds "kmers_sorted": true to the paths header
  */
 cJSON* gpath_save_mkhdr(const char *path,
                         const char *cmdstr, cJSON *cmdhdr,
                         cJSON **hdrs, size_t nhdrs,
                         const ZeroSizeBuffer *contig_hists, size_t ncols,
-                        const dBGraph *db_graph);
+                        bool kmers_sorted, const dBGraph *db_graph);
+
+/**
+ * Print the paths in a subset to a string buffer, in the order they are in the
+ * subset. Nothing is printed if the subset is empty.
+ *
+ * @param bkstr   kmer the paths belong to
+ * @param subset  paths to write, with nseen counts in subset->gpset
+ * @param sbuf    paths are written this string buffer
+ */
+void gpath_save_subset_sbuf(const char *bkstr, size_t kmer_size,
+                            const GPathSubset *subset, StrBuf *sbuf);
 
 /**
  * Print paths to a string buffer. Paths are sorted before being written.
@@ -45,19 +58,47 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
                      dBNodeBuffer *nbuf, SizeBuffer *jposbuf,
                      const dBGraph *db_graph);
 
+// Number of kmers sorted at a time when saving with sort_kmers
+#define GPATH_SAVE_SORT_CHUNK (1<<20)
+
+// Text output is compressed in blocks of at least this many bytes
+#define GPATH_SAVE_BLOCK_SIZE DEFAULT_IO_BUFSIZE
+
 /**
- * Save paths to a file.
+ * Save paths to a file, `fout` is opened and closed by the caller. Binary
+ * format if path ends in .ctp.bin (see gpath_reader.h), otherwise gzip
+ * compressed text written as concatenated gzip members. Kmers are written in
+ * sorted order if sort_kmers is true or the output is binary.
  * @param cmdstr  name of the command being run, to be used to add @cmdhdr
  * @param cmdhdr  JSON header to add under current command->@cmdstr
  *                If cmdstr and cmdhdr are both NULL they are ignored
  * @param hdrs    array of JSON headers of input files
  * @param nhdrs   number of elements in @hdrs
  */
-void gpath_save(gzFile gzout, const char *path,
-                size_t nthreads, bool save_path_seq,
+void gpath_save(FILE *fout, const char *path,
+                size_t nthreads, bool save_path_seq, bool sort_kmers,
                 const char *cmdstr, cJSON *cmdhdr,
                 cJSON **hdrs, size_t nhdrs,
                 const ZeroSizeBuffer *contig_hists, size_t ncols,
                 dBGraph *db_graph);
 
+/**
+ * Merge link files whose kmers are sorted (see gpath_reader_kmers_sorted())
+ * into `fout`, summing the counts of links found in more than one file. Only
+ * the links of one kmer are held in memory at a time. Output is always gzip
+ * compressed text with kmers in sorted order, and does not have seq= or
+ * juncpos= fields.
+ * @param pfiles  sorted link files, already opened
+ * @param cmdstr  name of the command being run, to be used to add @cmdhdr
+ * @param cmdhdr  JSON header to add under current command->@cmdstr
+ *                If cmdstr and cmdhdr are both NULL they are ignored
+ * @param hdrs    array of JSON headers of input files
+ * @param nhdrs   number of elements in @hdrs
+ */
+void gpath_save_merge_sorted(FILE *fout, const char *path,
+                             GPathReader *pfiles, size_t num_pfiles,
+                             const char *cmdstr, cJSON *cmdhdr,
+                             cJSON **hdrs, size_t nhdrs,
+                             const ZeroSizeBuffer *contig_hists, size_t ncols);
+
 #endif /* GPATH_SAVE_H_ */
@@ -0,0 +1,107 @@
+#ifndef BK_MIXHASH_H_
+#define BK_MIXHASH_H_
+
+//
+// Multiply-mix hash for BinaryKmers (HASH=MIX)
+//
+// Kmers are 1-4 whole 64 bit words, so we skip the byte handling of general
+// purpose hashes. Each word is XORed with a secret and its two 32 bit halves
+// multiplied together, as in xxh3's accumulate step, then the sum is
+// avalanched. Only 32x32->64 bit multiplies are used before the final step so
+// four kmers can be hashed at once with AVX2.
+//
+// A single 64 bit hash gives every rehash position: round i probes
+// lo32 + i*(hi32|1) (double hashing), instead of rehashing with a new seed.
+//
+// Include after BinaryKmer is defined.
+//
+
+#include <stdint.h>
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#endif
+
+#define BKMIX_INIT  0x9E3779B185EBCA87UL
+#define BKMIX_PRIME 0x165667919E3779F9UL
+
+static const uint64_t bkmix_secret[4] = {
+  0xbe4ba423396cfeb8UL, 0x1cad21f72c81017cUL,
+  0xdb979083e96dd4deUL, 0x1f67b3b7a4a44072UL
+};
+
+static inline uint64_t bkmix_avalanche(uint64_t h)
+{
+  h ^= h >> 37;
+  h *= BKMIX_PRIME;
+  h ^= h >> 32;
+  return h;
+}
+
+static inline uint64_t bkmix_hash64(const BinaryKmer bkmer, uint64_t seed)
+{
+  uint64_t w, acc = seed ^ BKMIX_INIT;
+  size_t i;
+  for(i = 0; i < NUM_BKMER_WORDS; i++) {
+    w = bkmer.b[i] ^ (bkmix_secret[i & 3] + seed);
+    acc += bkmer.b[i] + (w & 0xffffffffUL) * (w >> 32);
+  }
+  return bkmix_avalanche(acc);
+}
+
+#define bkmix_hash32(bkmer,seed) ((uint32_t)bkmix_hash64(bkmer,seed))
+
+// Hash for rehash round `i` derived from `h64` = bkmix_hash64()
+static inline uint32_t bkmix_round(uint64_t h64, uint32_t i)
+{
+  return (uint32_t)h64 + i * ((uint32_t)(h64 >> 32) | 1);
+}
+
+#if defined(__AVX2__)
+
+// Low 64 bits of a*b for each lane, from 32x32->64 bit multiplies
+static inline __m256i bkmix_mul64_avx2(__m256i a, __m256i b)
+{
+  __m256i lolo = _mm256_mul_epu32(a, b);
+  __m256i hilo = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+  __m256i lohi = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+  return _mm256_add_epi64(lolo, _mm256_slli_epi64(_mm256_add_epi64(hilo, lohi), 32));
+}
+
+// Hash four kmers at once, same result as bkmix_hash64() on each
+static inline void bkmix_hash64_x4_avx2(const BinaryKmer *bkmers, uint64_t seed,
+                                        uint64_t *out)
+{
+  __m256i acc = _mm256_set1_epi64x((long long)(seed ^ BKMIX_INIT));
+  __m256i d, dk, prod;
+  size_t i;
+
+  for(i = 0; i < NUM_BKMER_WORDS; i++) {
+    d = _mm256_set_epi64x((long long)bkmers[3].b[i], (long long)bkmers[2].b[i],
+                          (long long)bkmers[1].b[i], (long long)bkmers[0].b[i]);
+    dk = _mm256_xor_si256(d, _mm256_set1_epi64x((long long)(bkmix_secret[i & 3] + seed)));
+    prod = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+    acc = _mm256_add_epi64(acc, _mm256_add_epi64(d, prod));
+  }
+
+  // avalanche
+  acc = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 37));
+  acc = bkmix_mul64_avx2(acc, _mm256_set1_epi64x((long long)BKMIX_PRIME));
+  acc = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 32));
+  _mm256_storeu_si256((__m256i*)out, acc);
+}
+
+#endif /* __AVX2__ */
+
+// Hash `n` kmers, four at a time with AVX2 if available
+static inline void bkmix_hash64_batch(const BinaryKmer *bkmers, size_t n,
+                                      uint64_t seed, uint64_t *out)
+{
+  size_t i = 0;
+  #if defined(__AVX2__)
+    for(; i+4 <= n; i += 4) bkmix_hash64_x4_avx2(bkmers+i, seed, out+i);
+  #endif
+  for(; i < n; i++) out[i] = bkmix_hash64(bkmers[i], seed);
+}
+
+#endif /* BK_MIXHASH_H_ */
@@ -0,0 +1,456 @@
+#include "global.h"
+#include "cmd.h"
+#include "util.h"
+#include "file_util.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "binary_kmer.h"
+#include "binary_seq.h"
+#include "graph_writer.h"
+#include "graphs_load.h"
+#include "cJSON/cJSON.h"
+#include "msg-pool/msgpool.h"
+#include "cpu_dispatch.h"
+
+// hash.h only includes the hash function we compiled with
+#if defined(USE_CITY_HASH) || defined(USE_XXHASH)
+  #include "misc/lookup3.h"
+#endif
+#include "misc/city.h"
+#include "xxHash/xxhash.h"
+
+#include <unistd.h>
+#include <sys/utsname.h>
+
+//
+// Microbenchmarks, results are printed as JSON so they can be compared
+// across releases and machines. Run with `make bench`.
+//
+
+static const char bench_usage[] =
+"usage: bench [options]\n"
+"  Time hash functions, hash table operations, sequence packing, message\n"
+"  pools and graph file IO. Prints JSON results.\n"
+"\n"
+"  -h, --help           This help message\n"
+"  -n, --nkmers <N>     Hash table entries [default: 1M]\n"
+"  -t, --threads <T>    Max threads, doubled from 1 [default: 4]\n"
+"  -o, --out <out.json> Output file [default: STDOUT]\n"
+"  -d, --tmpdir <dir>   Directory for temporary graph file [default: /tmp]\n"
+"\n"
+"  Set CTX_SIMD=none|sse4.1|avx2|avx512 to limit the SIMD kernels used.\n"
+"\n";
+
+static struct option longopts[] =
+{
+  {"help",    no_argument,       NULL, 'h'},
+  {"nkmers",  required_argument, NULL, 'n'},
+  {"threads", required_argument, NULL, 't'},
+  {"out",     required_argument, NULL, 'o'},
+  {"tmpdir",  required_argument, NULL, 'd'},
+  {NULL, 0, NULL, 0}
+};
+
+// Table occupancies to time hash table operations at
+static const double bench_occupancy[] = {0.25, 0.5, 0.75};
+
+#define BENCH_SEQ_LEN (1<<20)
+
+static double bench_sec(uint64_t t0)
+{
+  return (ctx_stats_now_ns() - t0) / 1e9;
+}
+
+// Add a result to `results`. `occupancy` < 0 and `nbytes` == 0 are not
+// reported.
+static void bench_result(cJSON *results, const char *name, size_t nthreads,
+                         double occupancy, uint64_t nops, uint64_t nbytes,
+                         double sec)
+{
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddItemToObject(json, "name", cJSON_CreateString(name));
+  cJSON_AddItemToObject(json, "threads", cJSON_CreateNumber(nthreads));
+  if(occupancy >= 0)
+    cJSON_AddItemToObject(json, "occupancy", cJSON_CreateNumber(occupancy));
+  cJSON_AddItemToObject(json, "ops", cJSON_CreateNumber(nops));
+  cJSON_AddItemToObject(json, "sec", cJSON_CreateNumber(sec));
+  cJSON_AddItemToObject(json, "mops_per_sec",
+                        cJSON_CreateNumber(sec > 0 ? nops / sec / 1e6 : 0));
+  if(nbytes) {
+    cJSON_AddItemToObject(json, "bytes", cJSON_CreateNumber(nbytes));
+    cJSON_AddItemToObject(json, "mb_per_sec",
+                          cJSON_CreateNumber(sec > 0 ? nbytes / sec / 1e6 : 0));
+  }
+  cJSON_AddItemToArray(results, json);
+  status("[bench] %-28s threads: %zu %.2f Mops/sec", name, nthreads,
+         sec > 0 ? nops / sec / 1e6 : 0);
+}
+
+//
+// Hash functions
+//
+static void bench_hash_funcs(cJSON *results, const BinaryKmer *keys, size_t n)
+{
+  size_t i;
+  uint64_t t0, h;
+
+  #define BENCH_HASH(name,func) do {                                  \
+    h = 0; t0 = ctx_stats_now_ns();                                   \
+    for(i = 0; i < n; i++) h ^= (func);                               \
+    bench_result(results, name, 1, -1, n, 0, bench_sec(t0));          \
+    if(h == 1) status("[bench] hash: %zu", (size_t)h); /* keep h */   \
+  } while(0)
+
+  BENCH_HASH("hash/binary_kmer_hash", binary_kmer_hash(keys[i], 0));
+  BENCH_HASH("hash/lookup3", lk3_hashlittle(keys[i].b, BKMER_BYTES, 0));
+  BENCH_HASH("hash/xxhash32", XXH32(keys[i].b, BKMER_BYTES, 0));
+  BENCH_HASH("hash/city64", CityHash64WithSeed((const char*)keys[i].b,
+                                               BKMER_BYTES, 0));
+  BENCH_HASH("hash/kmer_mix64", bkmix_hash64(keys[i], 0));
+
+  #undef BENCH_HASH
+
+  // Batched (AVX2 if available) mix hash
+  uint64_t *hashes = ctx_malloc(n * sizeof(uint64_t));
+  t0 = ctx_stats_now_ns();
+  bkmix_hash64_batch(keys, n, 0, hashes);
+  bench_result(results, "hash/kmer_mix64_batch", 1, -1, n, 0, bench_sec(t0));
+  ctx_free(hashes);
+}
+
+//
+// Hash table insert and find
+//
+typedef struct
+{
+  HashTable *ht;
+  volatile uint8_t *bktlocks;
+  const BinaryKmer *keys;
+  size_t n, nthreads;
+  enum { BENCH_HT_INSERT, BENCH_HT_FIND } op;
+  size_t nfound; // summed over threads
+} BenchHashTable;
+
+static void bench_ht_thread(void *arg, size_t threadid)
+{
+  BenchHashTable *job = (BenchHashTable*)arg;
+  size_t i, nfound = 0;
+  size_t start = (job->n * threadid) / job->nthreads;
+  size_t end = (job->n * (threadid+1)) / job->nthreads;
+  bool found;
+
+  if(job->op == BENCH_HT_INSERT) {
+    for(i = start; i < end; i++) {
+      hash_table_find_or_insert_mt(job->ht, job->keys[i], &found, job->bktlocks);
+      nfound += found;
+    }
+  } else {
+    for(i = start; i < end; i++)
+      nfound += (hash_table_find(job->ht, job->keys[i]) != HASH_NOT_FOUND);
+  }
+
+  __sync_fetch_and_add(&job->nfound, nfound);
+}
+
+static double bench_ht_run(BenchHashTable *job, const BinaryKmer *keys,
+                           size_t n, int op)
+{
+  job->keys = keys;
+  job->n = n;
+  job->op = op;
+  job->nfound = 0;
+  uint64_t t0 = ctx_stats_now_ns();
+  util_multi_thread(job, job->nthreads, bench_ht_thread);
+  return bench_sec(t0);
+}
+
+// `keys` has nkmers entries, `misses` has nkmers entries not in `keys`
+static void bench_hash_table(cJSON *results, size_t nkmers, size_t nthreads,
+                             const BinaryKmer *keys, const BinaryKmer *misses)
+{
+  size_t i, n;
+  double occ, sec;
+  HashTable ht;
+
+  for(i = 0; i < sizeof(bench_occupancy)/sizeof(bench_occupancy[0]); i++)
+  {
+    occ = bench_occupancy[i];
+    hash_table_alloc(&ht, nkmers);
+    n = MIN2(nkmers, (size_t)(ht.capacity * occ));
+
+    BenchHashTable job = {.ht = &ht, .nthreads = nthreads};
+    job.bktlocks = ctx_calloc((ht.num_of_buckets+7)/8, 1);
+
+    sec = bench_ht_run(&job, keys, n, BENCH_HT_INSERT);
+    bench_result(results, "hash_table/insert", nthreads, occ, n, 0, sec);
+
+    sec = bench_ht_run(&job, keys, n, BENCH_HT_FIND);
+    if(job.nfound != n) die("Lost kmers: %zu / %zu", job.nfound, n);
+    bench_result(results, "hash_table/find_hit", nthreads, occ, n, 0, sec);
+
+    sec = bench_ht_run(&job, misses, n, BENCH_HT_FIND);
+    bench_result(results, "hash_table/find_miss", nthreads, occ, n, 0, sec);
+
+    ctx_free((uint8_t*)job.bktlocks);
+    hash_table_dealloc(&ht);
+  }
+}
+
+//
+// Kmer and packed sequence functions
+//
+static void bench_seq_funcs(cJSON *results, const BinaryKmer *keys, size_t n)
+{
+  size_t i, nbytes = (BENCH_SEQ_LEN+3)/4, nreps = MAX2(n / BENCH_SEQ_LEN, 1);
+  uint64_t t0, h = 0;
+  BinaryKmer bkmer;
+
+  t0 = ctx_stats_now_ns();
+  for(i = 0; i < n; i++) {
+    bkmer = binary_kmer_reverse_complement(keys[i], MAX_KMER_SIZE);
+    h ^= bkmer.b[0];
+  }
+  bench_result(results, "binary_kmer_reverse_complement", 1, -1, n, 0,
+               bench_sec(t0));
+  if(h == 1) status("[bench] rc: %zu", (size_t)h); // keep h
+
+  Nucleotide *nucs = ctx_malloc(BENCH_SEQ_LEN);
+  uint8_t *packed = ctx_calloc(nbytes, 1), *packed2 = ctx_calloc(nbytes, 1);
+  for(i = 0; i < BENCH_SEQ_LEN; i++) nucs[i] = rand() & 3;
+
+  t0 = ctx_stats_now_ns();
+  for(i = 0; i < nreps; i++) binary_seq_pack(packed, nucs, BENCH_SEQ_LEN);
+  bench_result(results, "binary_seq_pack", 1, -1, nreps*BENCH_SEQ_LEN,
+               nreps*BENCH_SEQ_LEN, bench_sec(t0));
+
+  t0 = ctx_stats_now_ns();
+  for(i = 0; i < nreps; i++) binary_seq_unpack(packed, nucs, BENCH_SEQ_LEN);
+  bench_result(results, "binary_seq_unpack", 1, -1, nreps*BENCH_SEQ_LEN,
+               nreps*BENCH_SEQ_LEN, bench_sec(t0));
+
+  // shift of 1-3 bases, so all bytes have to be shifted
+  t0 = ctx_stats_now_ns();
+  for(i = 0; i < nreps; i++)
+    binary_seq_cpy_fast(packed2, packed, 1+i%3, BENCH_SEQ_LEN);
+  bench_result(results, "binary_seq_cpy_fast", 1, -1, nreps*BENCH_SEQ_LEN,
+               nreps*nbytes, bench_sec(t0));
+
+  // Sequences match until the last base, so the whole array is compared
+  binary_seq_cpy_fast(packed2, packed, 0, BENCH_SEQ_LEN);
+  binary_seq_set(packed2, BENCH_SEQ_LEN-1, (binary_seq_get(packed, BENCH_SEQ_LEN-1)+1)&3);
+  t0 = ctx_stats_now_ns();
+  for(i = 0; i < nreps; i++)
+    h ^= (uint64_t)binary_seqs_cmp(packed, BENCH_SEQ_LEN, packed2, BENCH_SEQ_LEN);
+  bench_result(results, "binary_seqs_cmp", 1, -1, nreps*BENCH_SEQ_LEN,
+               nreps*nbytes*2, bench_sec(t0));
+  if(h == 1) status("[bench] cmp: %zu", (size_t)h); // keep h
+
+  ctx_free(packed2);
+  ctx_free(packed);
+  ctx_free(nucs);
+}
+
+//
+// Message pool, one writer and `nthreads` readers
+//
+typedef struct
+{
+  MsgPool *pool;
+  pthread_t thread;
+  uint64_t sum;
+} BenchPoolReader;
+
+static void* bench_msgpool_reader(void *arg)
+{
+  BenchPoolReader *rdr = (BenchPoolReader*)arg;
+  uint64_t msg;
+  int pos;
+
+  while((pos = msgpool_claim_read(rdr->pool)) != -1) {
+    memcpy(&msg, msgpool_get_ptr(rdr->pool, pos), sizeof(msg));
+    rdr->sum += msg;
+    msgpool_release(rdr->pool, pos, MPOOL_EMPTY);
+  }
+
+  pthread_exit(NULL);
+}
+
+static void bench_msgpool(cJSON *results, size_t nmsgs, size_t nthreads)
+{
+  size_t i;
+  uint64_t sum = 0, msg;
+  int rc, pos;
+
+  MsgPool pool;
+  msgpool_alloc(&pool, 4*nthreads, sizeof(uint64_t), USE_MSG_POOL);
+  BenchPoolReader *rdrs = ctx_calloc(nthreads, sizeof(BenchPoolReader));
+
+  uint64_t t0 = ctx_stats_now_ns();
+
+  for(i = 0; i < nthreads; i++) {
+    rdrs[i].pool = &pool;
+    rc = pthread_create(&rdrs[i].thread, NULL, bench_msgpool_reader, &rdrs[i]);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+
+  for(msg = 0; msg < nmsgs; msg++) {
+    pos = msgpool_claim_write(&pool);
+    memcpy(msgpool_get_ptr(&pool, pos), &msg, sizeof(msg));
+    msgpool_release(&pool, pos, MPOOL_FULL);
+  }
+
+  msgpool_close(&pool);
+
+  for(i = 0; i < nthreads; i++) {
+    rc = pthread_join(rdrs[i].thread, NULL);
+    if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+    sum += rdrs[i].sum;
+  }
+
+  double sec = bench_sec(t0);
+
+  if(sum != (uint64_t)nmsgs*(nmsgs-1)/2) die("Lost messages");
+  bench_result(results, "msgpool", nthreads, -1, nmsgs, 0, sec);
+
+  ctx_free(rdrs);
+  msgpool_dealloc(&pool);
+}
+
+//
+// Graph file write and read
+//
+static void bench_graph_io(cJSON *results, const BinaryKmer *keys, size_t n,
+                           size_t nthreads, const char *tmpdir)
+{
+  size_t i;
+  bool found;
+  uint64_t t0, nkmers;
+  off_t nbytes;
+  hkey_t hkey;
+
+  StrBuf path;
+  strbuf_alloc(&path, 256);
+  strbuf_sprintf(&path, "%s/bench.%i.ctx", tmpdir, (int)getpid());
+
+  dBGraph graph;
+  db_graph_alloc(&graph, MAX_KMER_SIZE, 1, 1, n, DBG_ALLOC_EDGES | DBG_ALLOC_COVGS);
+
+  for(i = 0; i < n; i++) {
+    hkey = hash_table_find_or_insert(&graph.ht, keys[i], &found);
+    db_node_add_col_covg(&graph, hkey, 0, 1);
+  }
+
+  t0 = ctx_stats_now_ns();
+  nkmers = graph_writer_save_mkhdr(path.b, &graph, false, 1);
+  double sec = bench_sec(t0);
+  nbytes = futil_get_file_size(path.b);
+  bench_result(results, "graph_write", 1, -1, nkmers, nbytes, sec);
+
+  db_graph_reset(&graph);
+
+  GraphFileReader gfile;
+  memset(&gfile, 0, sizeof(GraphFileReader));
+  graph_file_open(&gfile, path.b);
+
+  GraphLoadingPrefs gprefs = graph_loading_prefs(&graph);
+  gprefs.nthreads = nthreads;
+
+  t0 = ctx_stats_now_ns();
+  graph_load(&gfile, gprefs, NULL);
+  sec = bench_sec(t0);
+  bench_result(results, "graph_read", nthreads, -1, graph.ht.num_kmers,
+               nbytes, sec);
+
+  graph_file_close(&gfile);
+  if(unlink(path.b) != 0) warn("Cannot remove: %s", path.b);
+
+  db_graph_dealloc(&graph);
+  strbuf_dealloc(&path);
+}
+
+static cJSON* bench_machine_json(size_t nkmers, size_t max_threads)
+{
+  cJSON *json = cJSON_CreateObject();
+  struct utsname uts;
+  if(uname(&uts) == 0) {
+    cJSON_AddItemToObject(json, "machine", cJSON_CreateString(uts.machine));
+    cJSON_AddItemToObject(json, "sysname", cJSON_CreateString(uts.sysname));
+    cJSON_AddItemToObject(json, "release", cJSON_CreateString(uts.release));
+  }
+  cJSON_AddItemToObject(json, "ncpus",
+                        cJSON_CreateNumber(sysconf(_SC_NPROCESSORS_ONLN)));
+  cJSON_AddItemToObject(json, "version", cJSON_CreateString(VERSION_STATUS_STR));
+  cJSON_AddItemToObject(json, "max_kmer_size", cJSON_CreateNumber(MAX_KMER_SIZE));
+  cJSON_AddItemToObject(json, "simd", cJSON_CreateString(cpu_simd_str(ctx_cpu_simd)));
+  cJSON_AddItemToObject(json, "nkmers", cJSON_CreateNumber(nkmers));
+  cJSON_AddItemToObject(json, "max_threads", cJSON_CreateNumber(max_threads));
+  return json;
+}
+
+int main(int argc, char **argv)
+{
+  cortex_init();
+  cmd_init(argc, argv);
+
+  size_t i, nkmers = 1<<20, max_threads = 4, nthreads;
+  const char *out_path = "-", *tmpdir = "/tmp";
+
+  char shortopts[100];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    switch(c) {
+      case 'h': fputs(bench_usage, stdout); exit(EXIT_SUCCESS);
+      case 'n':
+        if(!parse_entire_size(optarg, &nkmers) || !nkmers)
+          die("Invalid --nkmers: %s", optarg);
+        break;
+      case 't':
+        if(!parse_entire_size(optarg, &max_threads) || !max_threads)
+          die("Invalid --threads: %s", optarg);
+        break;
+      case 'o': out_path = optarg; break;
+      case 'd': tmpdir = optarg; break;
+      default: fputs(bench_usage, stderr); exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind != argc) { fputs(bench_usage, stderr); exit(EXIT_FAILURE); }
+
+  FILE *fout = futil_fopen_create(out_path, "w");
+
+  // Kmers to insert followed by kmers that are (almost certainly) not inserted
+  BinaryKmer *keys = ctx_malloc(2 * nkmers * sizeof(BinaryKmer));
+  for(i = 0; i < 2*nkmers; i++) keys[i] = binary_kmer_random(MAX_KMER_SIZE);
+
+  cJSON *json = cJSON_CreateObject(), *results = cJSON_CreateArray();
+  cJSON_AddItemToObject(json, "config", bench_machine_json(nkmers, max_threads));
+
+  bench_hash_funcs(results, keys, nkmers);
+  bench_seq_funcs(results, keys, nkmers);
+
+  for(nthreads = 1; ; nthreads = MIN2(2*nthreads, max_threads)) {
+    bench_hash_table(results, nkmers, nthreads, keys, keys+nkmers);
+    bench_msgpool(results, nkmers, nthreads);
+    if(nthreads == max_threads) break;
+  }
+
+  bench_graph_io(results, keys, nkmers, max_threads, tmpdir);
+
+  cJSON_AddItemToObject(json, "results", results);
+
+  char *jstr = cJSON_Print(json);
+  fputs(jstr, fout);
+  fputc('\n', fout);
+  free(jstr);
+  cJSON_Delete(json);
+
+  if(fout != stdout) fclose(fout);
+  ctx_free(keys);
+
+  cmd_destroy();
+  cortex_destroy();
+
+  return EXIT_SUCCESS;
+}
@@ -52,7 +52,7 @@ int main(int argc, char **argv)
 
   // Write output file
   gpath_save(gzout, out_path, 1, true, NULL, NULL, &pfile.json, 1, &db_graph);
-  gzclose(gzout);
+  gzutil_fclose(gzout);
 
   // Checks
   // gpath_checks_all_paths(&db_graph, 2); // use two threads
@@ -0,0 +1,155 @@
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <limits.h>
+
+/*
+  bin/mccortex: run the mccortex<MAXK> build that best fits the kmer size
+
+  Each build handles kmers of up to MAXK bases in (MAXK+1)/32 words, with
+  equality, shifting, revcomp and hashing specialised for that number of words
+  at compile time. We ship one entry point and pick the smallest build that
+  fits, so k=31 always runs the single word code and k=61 the two word code.
+
+  The kmer size is taken from (in order):
+    1) a leading number: mccortex 61 build ...
+    2) -k/--kmer <K> e.g. for build
+    3) the header of the first graph file (.ctx) on the command line
+  otherwise the smallest build found is used.
+
+  Build with `make multik` to compile mccortex31,63,95,127 and this launcher.
+*/
+
+#define LAUNCH_MAX_WORDS 32
+
+static void launch_usage()
+{
+  fprintf(stderr,
+"usage: mccortex [K] <command> [options] <args>\n"
+"  Run bin/mccortex<MAXK> for kmer size K, where MAXK = 32*ceil(K/32)-1.\n"
+"  K is found from -k/--kmer or the first graph file if not given.\n");
+  exit(EXIT_FAILURE);
+}
+
+static bool parse_kmer(const char *str, unsigned long *kmer)
+{
+  char *end;
+  if(*str < '0' || *str > '9') return false;
+  *kmer = strtoul(str, &end, 10);
+  return (*end == '\0');
+}
+
+// True if [start,end) only contains colour list characters e.g. "0,2-4"
+static bool is_colour_list(const char *start, const char *end)
+{
+  if(start == end) return false;
+  for(; start < end; start++)
+    if(!strchr("0123456789,-", *start)) return false;
+  return true;
+}
+
+// Read kmer size from a graph file header: "CORTEX" <version> <kmer_size>
+// Paths may have colour filters attached e.g. 0,1:in.ctx:2,3
+static bool graph_kmer_size(const char *arg, unsigned long *kmer)
+{
+  char path[PATH_MAX+1], magic[6];
+  const char *start = arg, *end = arg + strlen(arg), *c;
+  uint32_t fields[2]; // version, kmer_size
+  bool found = false;
+  FILE *fh;
+
+  if((c = strchr(arg, ':')) != NULL && is_colour_list(arg, c)) start = c+1;
+  if((c = strrchr(start, ':')) != NULL && is_colour_list(c+1, end)) end = c;
+  if((size_t)(end - start) > PATH_MAX) return false;
+
+  memcpy(path, start, end - start);
+  path[end - start] = '\0';
+
+  if((fh = fopen(path, "r")) == NULL) return false;
+  if(fread(magic, 1, 6, fh) == 6 && memcmp(magic, "CORTEX", 6) == 0 &&
+     fread(fields, sizeof(uint32_t), 2, fh) == 2) {
+    *kmer = fields[1];
+    found = true;
+  }
+  fclose(fh);
+  return found;
+}
+
+// Find kmer size from command line arguments, returns 0 if not found
+static unsigned long args_kmer_size(int argc, char **argv)
+{
+  unsigned long kmer;
+  int i;
+
+  for(i = 1; i < argc; i++) {
+    if((strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--kmer") == 0) &&
+       i+1 < argc && parse_kmer(argv[i+1], &kmer)) return kmer;
+    if(strncmp(argv[i], "--kmer=", 7) == 0 && parse_kmer(argv[i]+7, &kmer))
+      return kmer;
+    if(strncmp(argv[i], "-k", 2) == 0 && parse_kmer(argv[i]+2, &kmer))
+      return kmer;
+  }
+
+  for(i = 1; i < argc; i++)
+    if(argv[i][0] != '-' && graph_kmer_size(argv[i], &kmer)) return kmer;
+
+  return 0;
+}
+
+// Directory holding this executable, with trailing slash
+static void launcher_dir(const char *argv0, char *dir, size_t len)
+{
+  ssize_t n = readlink("/proc/self/exe", dir, len-1);
+  if(n <= 0) {
+    strncpy(dir, argv0, len-1);
+    n = strlen(argv0);
+  }
+  dir[n] = '\0';
+  char *slash = strrchr(dir, '/');
+  if(slash) slash[1] = '\0';
+  else strcpy(dir, "./");
+}
+
+int main(int argc, char **argv)
+{
+  if(argc < 2) launch_usage();
+
+  char dir[PATH_MAX+1], path[PATH_MAX+32];
+  unsigned long kmer = 0, words, maxk;
+  char **args = argv;
+
+  // Old style: mccortex <K> <cmd> ...
+  if(parse_kmer(argv[1], &kmer)) {
+    if(argc < 3) launch_usage();
+    args = argv+1; argc--;
+  }
+  else kmer = args_kmer_size(argc, argv);
+
+  if(kmer && ((kmer & 1) == 0 || kmer < 3)) {
+    fprintf(stderr, "Error: kmer is not odd and greater than 2: %lu\n", kmer);
+    exit(EXIT_FAILURE);
+  }
+
+  launcher_dir(argv[0], dir, sizeof(dir));
+
+  // Smallest installed build that can hold kmer
+  for(words = kmer ? (kmer+31)/32 : 1; words <= LAUNCH_MAX_WORDS; words++) {
+    maxk = words*32 - 1;
+    snprintf(path, sizeof(path), "%smccortex%lu", dir, maxk);
+    if(access(path, X_OK) == 0) {
+      args[0] = path;
+      execv(path, args);
+      fprintf(stderr, "Error: cannot run %s\n", path);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  maxk = kmer ? ((kmer+31)/32)*32-1 : 31;
+  fprintf(stderr, "Error: %smccortex%lu not found\n", dir, maxk);
+  fprintf(stderr, "Please compile mccortex with: 'make MAXK=%lu'\n", maxk);
+  return EXIT_FAILURE;
+}
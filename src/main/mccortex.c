@@ -4,7 +4,16 @@
 #include "commands.h"
 #include "util.h"
 #include "file_util.h"
+#include "async_file.h"
+#include "zstd_file.h"
+#include "remote_file.h"
+#include "ctx_progress.h"
 #include "hash.h"
+#include "cpu_dispatch.h"
+#include "hash_table.h"
+#include "binary_kmer.h"
+#include "binary_seq.h"
+#include "cmd_mem.h"
 
 // To add a new command to mccortex31 <cmd>:
 // 0. create a file src/commands/ctx_X.c
@@ -17,12 +26,13 @@ typedef struct
   const char *cmd, *blurb, *usage, *optargs, *reqargs;
   int minargs, maxargs; // counts AFTER standard args taken
   int hide; // set hide to >0 to remove from listings
+  bool plan; // decides memory with cmd_check_mem_limit(), so supports --plan
   int (*func)(int argc, char **argv);
 } CtxCmd;
 
 CtxCmd cmdobjs[] = {
 {
-  .cmd = "build", .func = ctx_build, .hide = false,
+  .cmd = "build", .func = ctx_build, .hide = false, .plan = true,
   .blurb = "construct cortex graph from FASTA/FASTQ/BAM",
   .usage = build_usage
 },
@@ -32,7 +42,7 @@ CtxCmd cmdobjs[] = {
   .usage = sort_usage
 },
 {
-  .cmd = "index", .func = ctx_index, .hide = false,
+  .cmd = "index", .func = ctx_index, .hide = false, .plan = true,
   .blurb = "index a sorted cortex graph file",
   .usage = index_usage
 },
@@ -42,87 +52,102 @@ CtxCmd cmdobjs[] = {
   .usage = view_usage
 },
 {
-  .cmd = "pview", .func = ctx_pview, .hide = false,
+  .cmd = "pview", .func = ctx_pview, .hide = false, .plan = true,
   .blurb = "text view of a cortex link file (.ctp)",
   .usage = pview_usage
 },
 {
-  .cmd = "check", .func = ctx_health_check, .hide = false,
+  .cmd = "check", .func = ctx_health_check, .hide = false, .plan = true,
   .blurb = "load and check graph (.ctx) and path (.ctp) files",
   .usage = health_usage
 },
 {
-  .cmd = "clean", .func = ctx_clean, .hide = false,
+  .cmd = "clean", .func = ctx_clean, .hide = false, .plan = true,
   .blurb = "clean errors from a graph",
   .usage = clean_usage
 },
 {
-  .cmd = "join", .func = ctx_join, .hide = false,
+  .cmd = "join", .func = ctx_join, .hide = false, .plan = true,
   .blurb = "combine graphs, filter graph intersections",
   .usage = join_usage
 },
 {
-  .cmd = "unitigs", .func = ctx_unitigs, .hide = false,
+  .cmd = "unitigs", .func = ctx_unitigs, .hide = false, .plan = true,
   .blurb = "pull out unitigs in FASTA, DOT or GFA format",
   .usage = unitigs_usage
 },
 {
-  .cmd = "subgraph", .func = ctx_subgraph, .hide = false,
+  .cmd = "unitigs2ctx", .func = ctx_unitigs2ctx, .hide = false, .plan = true,
+  .blurb = "load unitigs (FASTA/GFA) into a graph without rebuilding",
+  .usage = unitigs2ctx_usage
+},
+{
+  .cmd = "subgraph", .func = ctx_subgraph, .hide = false, .plan = true,
   .blurb = "filter a subgraph using seed kmers",
   .usage = subgraph_usage
 },
 {
-  .cmd = "reads", .func = ctx_reads, .hide = false,
+  .cmd = "reads", .func = ctx_reads, .hide = false, .plan = true,
   .blurb = "filter reads against a graph",
   .usage = reads_usage
 },
 {
-  .cmd = "contigs", .func = ctx_contigs, .hide = false,
+  .cmd = "contigs", .func = ctx_contigs, .hide = false, .plan = true,
   .blurb = "assemble contigs for a sample",
   .usage = contigs_usage
 },
 {
-  .cmd = "inferedges", .func = ctx_infer_edges, .hide = false,
+  .cmd = "inferedges", .func = ctx_infer_edges, .hide = false, .plan = true,
   .blurb = "infer graph edges between kmers before calling `thread`",
   .usage = inferedges_usage
 },
 {
-  .cmd = "thread", .func = ctx_thread, .hide = false,
+  .cmd = "thread", .func = ctx_thread, .hide = false, .plan = true,
   .blurb = "thread reads through cleaned graph to make links",
   .usage = thread_usage,
 },
 {
-  .cmd = "correct", .func = ctx_correct, .hide = false,
+  .cmd = "pipeline", .func = ctx_pipeline, .hide = false, .plan = true,
+  .blurb = "build, clean, inferedges and thread a sample in memory",
+  .usage = pipeline_usage
+},
+{
+  .cmd = "growk", .func = ctx_growk, .hide = false, .plan = true,
+  .blurb = "derive larger kmer size graphs from a graph and reads",
+  .usage = growk_usage
+},
+{
+  .cmd = "correct", .func = ctx_correct, .hide = false, .plan = true,
   .blurb = "error correct reads",
   .usage = correct_usage
 },
 {
-  .cmd = "pjoin", .func = ctx_pjoin, .hide = false,
+  .cmd = "pjoin", .func = ctx_pjoin, .hide = false, .plan = true,
   .blurb = "merge link files (.ctp)",
   .usage = pjoin_usage
 },
 {
-  .cmd = "bubbles", .func = ctx_bubbles, .hide = false,
+  .cmd = "bubbles", .func = ctx_bubbles, .hide = false, .plan = true,
   .blurb = "find bubbles in graph which are potential variants",
   .usage = bubbles_usage
 },
 {
-  .cmd = "breakpoints", .func = ctx_breakpoints, .hide = false,
+  .cmd = "breakpoints", .func = ctx_breakpoints, .hide = false, .plan = true,
   .blurb = "use a trusted assembled genome to call large events",
   .usage = breakpoints_usage
 },
 {
-  .cmd = "coverage", .func = ctx_coverage, .hide = false,
+  .cmd = "coverage", .func = ctx_coverage, .hide = false, .plan = true,
   .blurb = "print contig coverage",
   .usage = coverage_usage
 },
 {
-  .cmd = "rmsubstr", .func = ctx_rmsubstr, .hide = false,
+  .cmd = "rmsubstr", .func = ctx_rmsubstr, .hide = false, .plan = true,
   .blurb = "reduce set of strings to remove substrings",
   .usage = rmsubstr_usage
 },
 {
-  .cmd = "uniqkmers", .func = ctx_uniqkmers, .hide = false,
+  .cmd = "uniqkmers", .func = ctx_uniqkmers, .hide = false, .plan = true,
   .blurb = "generate random unique kmers",
   .usage = uniqkmers_usage
 },
@@ -132,7 +157,7 @@ CtxCmd cmdobjs[] = {
   .usage = links_usage
 },
 {
-  .cmd = "popbubbles", .func = ctx_pop_bubbles, .hide = false,
+  .cmd = "popbubbles", .func = ctx_pop_bubbles, .hide = false, .plan = true,
   .blurb = "pop bubbles in the population graph",
   .usage = pop_bubbles_usage
 },
@@ -142,17 +167,27 @@ CtxCmd cmdobjs[] = {
   .usage = calls2vcf_usage
 },
 {
-  .cmd = "server", .func = ctx_server, .hide = false,
+  .cmd = "server", .func = ctx_server, .hide = false, .plan = true,
   .blurb = "interactively query the graph",
   .usage = server_usage
 },
 {
-  .cmd = "dist", .func = ctx_dist_matrix, .hide = false,
+  .cmd = "load", .func = ctx_load, .hide = false, .plan = true,
+  .blurb = "load graphs into shared memory for --graph-shm",
+  .usage = load_usage
+},
+{
+  .cmd = "popstore", .func = ctx_popstore, .hide = false, .plan = true,
+  .blurb = "add samples to a population store (shared kmer dictionary)",
+  .usage = popstore_usage
+},
+{
+  .cmd = "dist", .func = ctx_dist_matrix, .hide = false, .plan = true,
   .blurb = "make colour kmer distance matrix",
   .usage = dist_matrix_usage
 },
 {
-  .cmd = "vcfcov", .func = ctx_vcfcov, .hide = false,
+  .cmd = "vcfcov", .func = ctx_vcfcov, .hide = false, .plan = true,
   .blurb = "coverage of a VCF against cortex graphs",
   .usage = vcfcov_usage
 },
@@ -163,12 +198,12 @@ CtxCmd cmdobjs[] = {
 },
 /* Experiments */
 {
-  .cmd = "exp_abc", .func = ctx_exp_abc, .hide = true,
+  .cmd = "exp_abc", .func = ctx_exp_abc, .hide = true, .plan = true,
   .blurb = "run experiment on traversal properties",
   .usage = exp_abc_usage
 },
 {
-  .cmd = "hashtest", .func = ctx_exp_hashtest, .hide = true,
+  .cmd = "hashtest", .func = ctx_exp_hashtest, .hide = true, .plan = true,
   .blurb = "test hash table speed",
   .usage = exp_hashtest_usage
 }
@@ -191,6 +226,19 @@ static const char options[] =
 "  -t, --threads <T>     Limit on proccessing threads [default: 2]\n"
 "  -o, --out <file>      Output file\n"
 "  -p, --paths <in.ctp>  Links file to load (can specify multiple times)\n"
+"  --stats-json <file>   Write timings and profiling counters as JSON\n"
+"  --progress <file>     Rewrite a JSON report of counters, rates and queues\n"
+"                        every "QUOTE_VALUE(CTX_PROGRESS_DEFAULT_SECS)" seconds while running\n"
+"  --progress-secs <S>   Seconds between --progress reports\n"
+"  --async-io            Read/write graph files with a background I/O thread\n"
+"  --direct-io           As --async-io, reading with O_DIRECT (skip page cache)\n"
+"  --zstd-level <L>      Level for outputs named *.zst [default: "QUOTE_VALUE(ZSTD_FILE_DEFAULT_LEVEL)"]\n"
+"  --zstd-threads <T>    Threads compressing *.zst outputs [default: 0]\n"
+"  --zstd-dict <file>    Dictionary to write/read zstd files (zstd --train)\n"
+"  --remote-cache <M>    Block cache per graph URL (http://) [default: 256MB]\n"
+"  --remote-conns <N>    Parallel range requests per graph URL [default: "QUOTE_VALUE(REMOTE_FILE_DEFAULT_CONNS)"]\n"
+"  --plan                Print memory needed by each structure and a suggested\n"
+"                        -m to STDOUT, then exit without loading anything\n"
 "\n";
 
 static int ctxcmd_cmp(const void *aa, const void *bb)
@@ -276,6 +324,161 @@ static bool remove_quiet_flags(int *argcp, char **argv)
   return qfound;
 }
 
+// remove --stats-json <file> and --stats-json=<file>
+// returns path of the last one given, or NULL if not found
+static const char* remove_stats_json_flags(int *argcp, char **argv)
+{
+  const char *path = NULL;
+  int i, j, argc = *argcp;
+  for(i = j = 1; i < argc; i++) {
+    if(strcmp(argv[i],"--stats-json") == 0) {
+      if(i+1 == argc) cmd_print_usage("--stats-json <file> requires an argument");
+      path = argv[++i];
+    }
+    else if(strncmp(argv[i],"--stats-json=",13) == 0) path = argv[i]+13;
+    else argv[j++] = argv[i];
+  }
+  *argcp = j;
+  return path;
+}
+
+// remove --progress <file>, --progress-secs <S> and their --opt=<val> forms
+// returns path of the last --progress given, or NULL if not found
+static const char* remove_progress_flags(int *argcp, char **argv, double *secs)
+{
+  const char *path = NULL, *secs_str = NULL;
+  int i, j, argc = *argcp;
+  for(i = j = 1; i < argc; i++) {
+    if(strcmp(argv[i],"--progress") == 0) {
+      if(i+1 == argc) cmd_print_usage("--progress <file> requires an argument");
+      path = argv[++i];
+    }
+    else if(strncmp(argv[i],"--progress=",11) == 0) path = argv[i]+11;
+    else if(strcmp(argv[i],"--progress-secs") == 0) {
+      if(i+1 == argc) cmd_print_usage("--progress-secs <S> requires an argument");
+      secs_str = argv[++i];
+    }
+    else if(strncmp(argv[i],"--progress-secs=",16) == 0) secs_str = argv[i]+16;
+    else argv[j++] = argv[i];
+  }
+  *argcp = j;
+  *secs = CTX_PROGRESS_DEFAULT_SECS;
+  if(secs_str != NULL && (!parse_entire_double(secs_str, secs) || *secs <= 0))
+    cmd_print_usage("--progress-secs <S> must be a positive number: %s", secs_str);
+  return path;
+}
+
+// remove --async-io and --direct-io
+// returns 0 if neither found, 1 for --async-io, 2 for --direct-io
+static int remove_async_io_flags(int *argcp, char **argv)
+{
+  int i, j, argc = *argcp, mode = 0;
+  for(i = j = 1; i < argc; i++) {
+    if(strcmp(argv[i],"--async-io") == 0) mode = MAX2(mode, 1);
+    else if(strcmp(argv[i],"--direct-io") == 0) mode = 2;
+    else argv[j++] = argv[i];
+  }
+  *argcp = j;
+  return mode;
+}
+
+// remove --plan, returns true if found
+static bool remove_plan_flags(int *argcp, char **argv)
+{
+  int i, j, argc = *argcp;
+  bool found = false;
+  for(i = j = 1; i < argc; i++) {
+    if(strcmp(argv[i],"--plan") == 0) found = true;
+    else argv[j++] = argv[i];
+  }
+  *argcp = j;
+  return found;
+}
+
+// If argv[*i] is `flag` or `flag=<val>` set *val and return true.
+// Takes the value from the next argument for `flag` and increments *i
+static bool get_flag_value(int argc, char **argv, int *i, const char *flag,
+                           const char **val)
+{
+  size_t n = strlen(flag);
+  if(strncmp(argv[*i], flag, n) != 0) return false;
+  if(argv[*i][n] == '=') { *val = argv[*i]+n+1; return true; }
+  if(argv[*i][n] != '\0') return false;
+  if(*i+1 == argc) cmd_print_usage("%s requires an argument", flag);
+  *val = argv[++*i];
+  return true;
+}
+
+// remove --zstd-level <L>, --zstd-threads <T>, --zstd-dict <file> and their
+// --opt=<val> forms, setting options for zstd files
+static void remove_zstd_flags(int *argcp, char **argv)
+{
+  const char *level = NULL, *threads = NULL, *dict = NULL;
+  int i, j, argc = *argcp, l;
+  unsigned int t;
+
+  for(i = j = 1; i < argc; i++) {
+    if(!get_flag_value(argc, argv, &i, "--zstd-level", &level) &&
+       !get_flag_value(argc, argv, &i, "--zstd-threads", &threads) &&
+       !get_flag_value(argc, argv, &i, "--zstd-dict", &dict))
+      argv[j++] = argv[i];
+  }
+  *argcp = j;
+
+  if(level != NULL) {
+    if(!parse_entire_int(level, &l))
+      cmd_print_usage("--zstd-level <L> must be an integer: %s", level);
+    zstd_file_set_level(l);
+  }
+  if(threads != NULL) {
+    if(!parse_entire_uint(threads, &t))
+      cmd_print_usage("--zstd-threads <T> must be a number: %s", threads);
+    zstd_file_set_threads(t);
+  }
+  if(dict != NULL) {
+    if(!futil_is_file_readable(dict))
+      cmd_print_usage("Cannot read --zstd-dict file: %s", dict);
+    zstd_file_set_dict(dict);
+  }
+}
+
+// remove --remote-cache <M>, --remote-conns <N> and their --opt=<val> forms,
+// setting options for graph files read from URLs
+static void remove_remote_flags(int *argcp, char **argv)
+{
+  const char *cache = NULL, *conns = NULL;
+  int i, j, argc = *argcp;
+  size_t bytes;
+  unsigned int n;
+
+  for(i = j = 1; i < argc; i++) {
+    if(!get_flag_value(argc, argv, &i, "--remote-cache", &cache) &&
+       !get_flag_value(argc, argv, &i, "--remote-conns", &conns))
+      argv[j++] = argv[i];
+  }
+  *argcp = j;
+
+  if(cache != NULL) {
+    if(!mem_to_integer(cache, &bytes) || bytes == 0)
+      cmd_print_usage("--remote-cache <M> must be a memory size: %s", cache);
+    remote_file_set_cache(bytes);
+  }
+  if(conns != NULL) {
+    if(!parse_entire_uint(conns, &n) || n == 0)
+      cmd_print_usage("--remote-conns <N> must be a positive number: %s", conns);
+    remote_file_set_conns(n);
+  }
+}
+
+// Print which SIMD version of each kernel was picked
+static void print_cpu_status()
+{
+  status("[cpu] simd=%s probe=%s encode=%s revcmp=%s popcount=%s binary_seq=%s",
+         cpu_simd_str(ctx_cpu_simd), hash_table_probe_simd_str(),
+         binary_kmer_encode_simd_str(), binary_kmer_revcmp_simd_str(),
+         popcount_and_simd_str(), binary_seq_simd_str());
+}
+
 int main(int argc, char **argv)
 {
   time_t start, end;
@@ -298,13 +501,54 @@ int main(int argc, char **argv)
   // Look for -q, --quiet argument, if given silence output
   if(remove_quiet_flags(&argc, argv)) { ctx_msg_out = NULL; }
 
+  // Open stats output before running so we fail early
+  const char *stats_path = remove_stats_json_flags(&argc, argv);
+  FILE *stats_fh = NULL;
+  if(stats_path != NULL) {
+    stats_fh = futil_fopen(stats_path, "w");
+    ctx_stats_init();
+  }
+
+  double progress_secs;
+  const char *progress_path = remove_progress_flags(&argc, argv, &progress_secs);
+  if(progress_path != NULL && stats_fh == NULL) ctx_stats_init();
+
+  int async_io = remove_async_io_flags(&argc, argv);
+  if(async_io) async_file_enable(0, async_io == 2);
+
+  remove_zstd_flags(&argc, argv);
+  remove_remote_flags(&argc, argv);
+
+  if(remove_plan_flags(&argc, argv)) {
+    if(!cmd->plan) die("`%s` does not support --plan", cmd->cmd);
+    cmd_mem_set_plan(true);
+  }
+
   // Print status header
   cmd_print_status_header();
+  print_cpu_status();
+
+  if(progress_path != NULL) {
+    ctx_progress_start(progress_path, progress_secs, cmd->cmd);
+    status("[progress] Writing to: %s every %.1f seconds",
+           progress_path, progress_secs);
+  }
 
   SWAP(argv[1],argv[0]);
   int ret = cmd->func(argc-1, argv+1);
 
+  if(progress_path != NULL) ctx_progress_stop();
+
   time(&end);
+
+  if(stats_fh != NULL) {
+    ctx_stats_print_json(stats_fh, cmd->cmd, ret);
+    if(stats_fh != stdout) fclose(stats_fh);
+    status("[stats] Written to: %s", futil_outpath_str(stats_path));
+  }
+
+  if(ctx_stats_on) ctx_stats_destroy();
+
   cmd_destroy();
 
   // Warn if more allocations than deallocations
@@ -314,6 +558,7 @@ int main(int argc, char **argv)
   char nallocs_str[50];
   ulong_to_str(alloc_get_num_allocs(), nallocs_str);
   status("[memory] We made %s allocs", nallocs_str);
+  alloc_print_tag_stats();
 
   status(ret == 0 ? "Done." : "Fail.");
 
@@ -18,6 +18,7 @@ int main(int argc, char **argv)
   // Binary Kmer tests should work for all values of MAXK
   test_bkmer_functions();
   test_hash_table();
+  test_graph_block();
 
   #if MAX_KMER_SIZE == 31
     // not kmer dependent
@@ -29,7 +30,10 @@ int main(int argc, char **argv)
     test_db_node();
     test_build_graph();
     test_db_unitig();
+    test_unitig_index();
+    test_unitig_map();
     test_subgraph();
+    test_pop_bubbles();
     test_cleaning();
     test_paths();
     // test_path_sets(); // TODO: replace with test_path_subset()
@@ -40,6 +44,18 @@ int main(int argc, char **argv)
     test_bubble_caller();
     test_kmer_occur();
     test_infer_edges_tests();
+    test_ref_cache();
+    test_graph_snapshot();
+    test_fastq_block();
+    test_query_graph();
+    test_grow_graph();
+    test_kmer_hll();
+    test_async_file();
+    test_kmer_fpindex();
+    test_remote_file();
+    test_seq_inflate();
+    test_graph_footer();
+    test_graphs_load();
   #endif
 
   cmd_destroy();
@@ -1,22 +1,64 @@
 #ifndef GPATH_H_
 #define GPATH_H_
 
-// 20 bytes per path
+// 12 bytes per path
 typedef struct GPathStruct GPath;
 
 #define GPATH_MAX_KMERS UINT32_MAX
 #define GPATH_MAX_JUNCS (UINT16_MAX>>1)
 #define GPATH_MAX_SEEN UINT8_MAX
 
-// 8+2+8=18bytes (could be 5+2+5 = 12)
+// Max distance in bytes from a path to its sequence (1TB)
+#define GPATH_MAX_SEQOFF ((1ULL<<40)-1)
+// Max distance in paths from a path to the next path in its list
+#define GPATH_MAX_NEXTOFF ((1LL<<39)-1)
+
+// 5+5+2 = 12 bytes
+// Instead of pointers, a path stores the offset (in bytes) from itself to its
+// sequence and the signed offset (in paths) to the next path in its list, with
+// zero meaning no next path. Paths and their sequences must therefore be
+// stored in the same block of memory (see GPathSet). Access with gpath_seq(),
+// gpath_next() and set with gpath_set_seq(), gpath_set_next(). Do not copy a
+// GPath to a different address.
 struct GPathStruct
 {
-  uint8_t *seq;
+  uint32_t seqoff_lo, nextoff_lo;
+  uint8_t seqoff_hi;
+  int8_t nextoff_hi;
   uint16_t num_juncs:15, orient:1;
-  GPath *next;
 } __attribute__((packed));
 
-#define gpath_get_colset(gp,ncols) ((gp)->seq - (((ncols)+7)/8))
+static inline uint8_t* gpath_seq(const GPath *gp)
+{
+  return (uint8_t*)gp + (((uint64_t)gp->seqoff_hi << 32) | gp->seqoff_lo);
+}
+
+static inline GPath* gpath_next(const GPath *gp)
+{
+  int64_t off = (int64_t)gp->nextoff_hi * (1LL<<32) + gp->nextoff_lo;
+  return off ? (GPath*)gp + off : NULL;
+}
+
+// `seq` must come after `gp` in memory
+static inline void gpath_set_seq(GPath *gp, const uint8_t *seq)
+{
+  ctx_assert(seq > (const uint8_t*)gp);
+  uint64_t off = seq - (const uint8_t*)gp;
+  ctx_assert(off <= GPATH_MAX_SEQOFF);
+  gp->seqoff_lo = (uint32_t)off;
+  gp->seqoff_hi = (uint8_t)(off >> 32);
+}
+
+// `next` must be NULL or in the same array of paths as `gp`
+static inline void gpath_set_next(GPath *gp, const GPath *next)
+{
+  int64_t off = next ? next - gp : 0;
+  ctx_assert(off >= -GPATH_MAX_NEXTOFF && off <= GPATH_MAX_NEXTOFF);
+  gp->nextoff_lo = (uint32_t)off;
+  gp->nextoff_hi = (int8_t)((off - (int64_t)gp->nextoff_lo) / (1LL<<32));
+}
+
+#define gpath_get_colset(gp,ncols) (gpath_seq(gp) - (((ncols)+7)/8))
 #define gpath_has_colour(gp,ncols,col) bitset_get(gpath_get_colset(gp,ncols),col)
 #define gpath_set_colour(gp,ncols,col) bitset_set(gpath_get_colset(gp,ncols),col)
 #define gpath_wipe_colset(gp,ncols) memset(gpath_get_colset(gp,ncols), 0, ((ncols)+7)/8)
@@ -1,17 +1,13 @@
 #include "global.h"
 #include "gpath_follow.h"
-// #include "binary_seq.h"
 
-/*
-// Check if the GPathFollow cache needs updated, based off path->pos value
+// Check if the GPathFollow cache needs updated, based off pos value
 // if it does, update it
 void gpath_follow_cache_update(GPathFollow *path, size_t pos)
 {
   size_t fetch_offset, fetch_bytes, total_bytes;
-
-  // 4 bases per byte
-  #define BASES_IN_CACHE(p) (sizeof((p)->cache) * 4)
-  uint16_t new_cache_start = (pos / BASES_IN_CACHE(path)) * BASES_IN_CACHE(path);
+  uint16_t new_cache_start = (pos / GPATH_FOLLOW_CACHE_BASES) *
+                             GPATH_FOLLOW_CACHE_BASES;
 
   if(new_cache_start != path->first_cached)
   {
@@ -19,22 +15,13 @@ void gpath_follow_cache_update(GPathFollow *path, size_t pos)
     fetch_offset = path->first_cached/4;
     total_bytes = binary_seq_mem(path->len);
     fetch_bytes = MIN2(total_bytes-fetch_offset, sizeof(path->cache));
-    memcpy(path->cache, path->gpath->seq + fetch_offset, fetch_bytes);
-    memset(path->cache+fetch_bytes, 0, sizeof(path->cache)-fetch_bytes);
+    memcpy(path->cache, gpath_seq(path->gpath) + fetch_offset, fetch_bytes);
     // Need to zero rest of cache since it is used in hashing
     //  -> must be deterministic
+    memset(path->cache+fetch_bytes, 0, sizeof(path->cache)-fetch_bytes);
   }
 }
 
-// Get a base from the GPathFollow cache
-Nucleotide gpath_follow_get_base(GPathFollow *path, size_t pos)
-{
-  ctx_assert2(pos < path->len, "pos: %i path->len: %i", (int)pos, (int)path->len);
-  gpath_follow_cache_update(path, pos);
-  return binary_seq_get(path->cache, pos - path->first_cached);
-}
-*/
-
 // For GraphWalker to work we assume all edges are merged into one colour
 // (i.e. graph->num_edge_cols == 1)
 // If only one colour loaded we assume all edges belong to this colour
@@ -42,14 +29,81 @@ Nucleotide gpath_follow_get_base(GPathFollow *path, size_t pos)
 GPathFollow gpath_follow_create(const GPath *gpath)
 {
   GPathFollow fpath = {.gpath = gpath,
-                        .pos = 0,
+                       .pos = 0,
                        .len = gpath->num_juncs,
                        .age = 0};
 
-  // .first_cached = 1 is invalid (not multiple of sizeof(cache)*4), so forces
-  // fetch on first request
-  // fpath.first_cached = 1;
-  // memset(fpath.cache, 0, sizeof(fpath.cache));
+  // .first_cached = 1 is invalid (not multiple of GPATH_FOLLOW_CACHE_BASES),
+  // so forces a fetch
+  fpath.first_cached = 1;
+  gpath_follow_cache_update(&fpath, 0);
 
   return fpath;
 }
+
+GPathTrieFollow gpath_trie_follow_create(const GPathTrie *trie,
+                                         hkey_t hkey, Orientation orient,
+                                         size_t col)
+{
+  uint32_t root = gpath_trie_root(trie, hkey, orient);
+  if(root != GPATH_TRIE_NULL && !bitset_get(gpath_trie_node_colset(trie, root), col))
+    root = GPATH_TRIE_NULL;
+
+  GPathTrieFollow fpath = {.node = root, .off = 0, .pos = 0, .age = 0};
+  return fpath;
+}
+
+uint8_t gpath_trie_follow_choices(const GPathTrie *trie,
+                                  const GPathTrieFollow *fpath, size_t col)
+{
+  if(fpath->node == GPATH_TRIE_NULL) return 0;
+
+  const GPathTrieNode *node = gpath_trie_node(trie, fpath->node);
+  uint8_t bases = 0;
+  size_t i;
+
+  // No links end part way along an edge
+  if(fpath->off < node->len)
+    return 1 << gpath_trie_node_base(trie, fpath->node, fpath->off);
+
+  for(i = 0; i < node->nchildren; i++)
+    if(bitset_get(gpath_trie_node_colset(trie, node->children+i), col))
+      bases |= 1 << gpath_trie_node_base(trie, node->children+i, 0);
+
+  return bases;
+}
+
+bool gpath_trie_follow_ended(const GPathTrie *trie,
+                             const GPathTrieFollow *fpath, size_t col)
+{
+  if(fpath->node == GPATH_TRIE_NULL) return false;
+  const GPathTrieNode *node = gpath_trie_node(trie, fpath->node);
+  const uint8_t *colset = gpath_trie_term_colset(trie, fpath->node);
+  return fpath->off == node->len && colset && bitset_get(colset, col);
+}
+
+bool gpath_trie_follow_advance(const GPathTrie *trie, GPathTrieFollow *fpath,
+                               Nucleotide base, size_t col)
+{
+  if(fpath->node == GPATH_TRIE_NULL) return false;
+
+  const GPathTrieNode *node = gpath_trie_node(trie, fpath->node);
+  size_t i;
+
+  if(fpath->off < node->len) {
+    if(gpath_trie_node_base(trie, fpath->node, fpath->off) == base) fpath->off++;
+    else fpath->node = GPATH_TRIE_NULL;
+  }
+  else {
+    for(i = 0; i < node->nchildren; i++)
+      if(gpath_trie_node_base(trie, node->children+i, 0) == base &&
+         bitset_get(gpath_trie_node_colset(trie, node->children+i), col)) break;
+
+    if(i < node->nchildren) { fpath->node = node->children+i; fpath->off = 1; }
+    else fpath->node = GPATH_TRIE_NULL;
+  }
+
+  fpath->pos++;
+  fpath->age++;
+  return gpath_trie_follow_choices(trie, fpath, col) != 0;
+}
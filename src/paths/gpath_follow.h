@@ -3,6 +3,8 @@
 
 #include "dna.h"
 #include "gpath.h"
+#include "binary_seq.h"
+#include "gpath_trie.h"
 
 /*
 
@@ -18,15 +20,20 @@ age=2 and (b) has age=1.
 
 */
 
+#define GPATH_FOLLOW_CACHE_BYTES 6
+#define GPATH_FOLLOW_CACHE_BASES (GPATH_FOLLOW_CACHE_BYTES*4)
+
 // This struct is packed so we can hash it quickly
+// The cache only depends on gpath and pos, so hashing it is deterministic
 struct GPathFollowStruct
 {
   const GPath *gpath;
   uint16_t pos, len;
   uint32_t age; // age is >= pos
-  // A small buffer of upcoming 24 bases
-  // uint16_t first_cached; // first base in buffer (multiple of 4: 0,4,8,...)
-  // uint8_t cache[6]; // first..first+23 (24 bases)
+  // A small buffer of upcoming 24 junctions, decoded from gpath_seq(gpath) so
+  // that forks only read the walker's own buffer
+  uint16_t first_cached; // first base in buffer (multiple of 24: 0,24,48,...)
+  uint8_t cache[GPATH_FOLLOW_CACHE_BYTES]; // first..first+23 (24 bases)
 } __attribute__((packed));
 
 typedef struct GPathFollowStruct GPathFollow;
@@ -34,8 +41,61 @@ typedef struct GPathFollowStruct GPathFollow;
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(gpath_follow_buf,GPathFollowBuffer,GPathFollow);
 
-#define gpath_follow_get_base(path,pos) (binary_seq_get((path)->gpath->seq,pos))
-// Nucleotide gpath_follow_get_base(GPathFollow *path, size_t pos);
 GPathFollow gpath_follow_create(const GPath *gpath);
 
+// Refill the cache if `pos` is not in it
+void gpath_follow_cache_update(GPathFollow *path, size_t pos);
+
+static inline Nucleotide gpath_follow_get_base(const GPathFollow *path,
+                                               size_t pos)
+{
+  ctx_assert2(pos < path->len, "pos: %zu len: %zu", pos, (size_t)path->len);
+  size_t offset = pos - path->first_cached; // wraps if pos < first_cached
+  if(offset < GPATH_FOLLOW_CACHE_BASES)
+    return binary_seq_get(path->cache, offset);
+  return binary_seq_get(gpath_seq(path->gpath), pos);
+}
+
+// Move on to the next junction, returns false if the path has ended
+static inline bool gpath_follow_advance(GPathFollow *path)
+{
+  if(++path->pos >= path->len) return false;
+  gpath_follow_cache_update(path, path->pos);
+  return true;
+}
+
+//
+// Following a GPathTrie
+//
+// One cursor follows all of a kmer's links in one colour at once. Links picked
+// up together share age and pos, and disagree only where the trie branches.
+//
+
+typedef struct
+{
+  uint32_t node; // GPATH_TRIE_NULL if no links left
+  uint16_t off; // junctions taken on the edge into node
+  uint16_t pos;
+  uint32_t age; // age is >= pos
+} GPathTrieFollow;
+
+// Cursor on the links of `hkey` in `orient` that are in colour `col`
+GPathTrieFollow gpath_trie_follow_create(const GPathTrie *trie,
+                                         hkey_t hkey, Orientation orient,
+                                         size_t col);
+
+// Bitmask of next junctions taken by links in colour `col`. More than one bit
+// set means the links disagree, 0 means all links have ended.
+uint8_t gpath_trie_follow_choices(const GPathTrie *trie,
+                                  const GPathTrieFollow *fpath, size_t col);
+
+// true if a link in colour `col` ends at the cursor
+bool gpath_trie_follow_ended(const GPathTrie *trie,
+                             const GPathTrieFollow *fpath, size_t col);
+
+// Take junction `base`, returns false if no links in colour `col` continue
+// after it. Links that chose another junction are dropped.
+bool gpath_trie_follow_advance(const GPathTrie *trie, GPathTrieFollow *fpath,
+                               Nucleotide base, size_t col);
+
 #endif /* GPATH_FOLLOW_H_ */
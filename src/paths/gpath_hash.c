@@ -5,28 +5,80 @@
 #include "binary_seq.h"
 #include "misc/city.h"
 
-// Entry is [hkey:5][gpindex:5] = 10 bytes
+#include <sched.h> // sched_yield()
 
-// We compare with REHASH_LIMIT(16)*bucket_size(<255) = 4080
-// so we need 12 bits to have 2^12 = 4096 possibilities
+// Entry is [gpindex:5][fingerprint:3] = 8 bytes
 
-// (1-(1/(2^12)))^4080 = 0.369 = 37% of entries would have zero collisions
-// (1-(1/(2^16)))^4080 = 0.939 = 94% of entries would have zero collisions
+// We compare with REHASH_LIMIT(20)*bucket_size(<255) = 5100 entries
+// A 24 bit fingerprint means a false match (which costs a sequence comparison)
+// for (1-(1/(2^24)))^5100 = 0.9997 = 99.97% of lookups have no false match
+
+// Resizing
+// A thread that fills the table (or finds no free bucket) moves the state from
+// READY to WAITING and waits for all other threads to leave the table. It then
+// allocates a table with twice as many buckets and sets REHASHING. All threads
+// that try to use the table help with the rehash, taking GPHASH_REHASH_CHUNK
+// kmers at a time and adding the paths of each kmer (from the GPathStore) to
+// the new table. Entries do not store kmers, so we have to rehash from the
+// store. When all kmers are done the new table replaces the old one.
 
 #define PATH_HASH_UNSET (0xffffffffffUL)
-#define PATH_HASH_ENTRY_EMPTY(x) ((x).hkey == PATH_HASH_UNSET)
+#define PATH_HASH_ENTRY_EMPTY(x) ((x).gpindex == PATH_HASH_UNSET)
 
-void gpath_hash_alloc(GPathHash *gphash, GPathStore *gpstore, size_t mem_in_bytes)
+#define GPHASH_READY 0
+#define GPHASH_WAITING 1
+#define GPHASH_REHASHING 2
+
+#define GPHASH_REHASH_CHUNK 4096
+
+#define gphash_fingerprint(entropy) ((entropy) >> 40)
+
+static inline size_t gphash_table_mem(size_t num_bkts, size_t bkt_size)
+{
+  return num_bkts*bkt_size*sizeof(GPEntry) + roundup_bits2bytes(num_bkts) +
+         num_bkts*sizeof(uint8_t);
+}
+
+static void _gphash_table_alloc(GPathHash *gphash,
+                                uint64_t num_bkts, uint8_t bkt_size)
+{
+  size_t cap_entries = num_bkts * bkt_size;
+
+  ctx_assert(cap_entries > 0);
+  ctx_assert(sizeof(GPEntry) == 8);
+
+  gphash->table = ctx_malloc(cap_entries * sizeof(GPEntry));
+  gphash->bktlocks = ctx_calloc(roundup_bits2bytes(num_bkts), sizeof(uint8_t));
+  gphash->bucket_nitems = ctx_calloc(num_bkts, sizeof(uint8_t));
+  gphash->num_of_buckets = num_bkts;
+  gphash->bucket_size = bkt_size;
+  gphash->capacity = cap_entries;
+  gphash->mask = num_bkts - 1;
+  gphash->num_entries = 0;
+
+  // Table all set to 1 to indicate empty
+  memset(gphash->table, 0xff, cap_entries * sizeof(GPEntry));
+}
+
+static void _gphash_table_dealloc(GPathHash *gphash)
+{
+  ctx_free(gphash->bucket_nitems);
+  ctx_free(gphash->bktlocks);
+  ctx_free(gphash->table);
+}
+
+// Start with init_mem, grow while old and new tables fit in max_mem
+void gpath_hash_alloc2(GPathHash *gphash, GPathStore *gpstore,
+                       size_t init_mem, size_t max_mem)
 {
   size_t cap_entries; uint64_t num_bkts = 0; uint8_t bkt_size = 0;
 
   // Decide on hash table capacity based on how much memory we can use
-  cap_entries = mem_in_bytes / sizeof(GPEntry);
+  cap_entries = init_mem / sizeof(GPEntry);
   hash_table_cap(cap_entries, &num_bkts, &bkt_size);
   cap_entries = num_bkts * bkt_size;
 
-  size_t bktlocks_mem = roundup_bits2bytes(num_bkts);
-  size_t mem = cap_entries*sizeof(GPEntry) + bktlocks_mem;
+  size_t mem = gphash_table_mem(num_bkts, bkt_size);
 
   char num_bkts_str[100], bkt_size_str[100], cap_str[100], mem_str[100];
   ulong_to_str(num_bkts, num_bkts_str);
@@ -36,34 +88,27 @@ void gpath_hash_alloc(GPathHash *gphash, GPathStore *gpstore, size_t mem_in_byte
   status("[GPathHash] Allocating table with %s entries, using %s", cap_str, mem_str);
   status("[GPathHash]  number of buckets: %s, bucket size: %s", num_bkts_str, bkt_size_str);
 
-  GPEntry *table = ctx_malloc(cap_entries * sizeof(GPEntry));
-  uint8_t *bktlocks = ctx_calloc(bktlocks_mem, sizeof(uint8_t));
-  uint8_t *bucket_nitems = ctx_calloc(num_bkts, sizeof(uint8_t));
+  GPathHash tmp = {.gpstore = gpstore,
+                   .max_mem = max_mem,
+                   .num_resizes = 0,
+                   .nactive = 0,
+                   .state = GPHASH_READY,
+                   .rehash_dst = NULL};
 
-  ctx_assert(num_bkts * bkt_size == cap_entries);
-  ctx_assert(cap_entries > 0);
-  ctx_assert(sizeof(GPEntry) == 10);
-
-  // Table all set to 1 to indicate empty
-  memset(table, 0xff, cap_entries * sizeof(GPEntry));
-
-  GPathHash tmp = {.gpstore = gpstore, .table = table,
-                  .num_of_buckets = num_bkts,
-                  .bucket_size = bkt_size,
-                  .capacity = cap_entries,
-                  .mask = num_bkts - 1,
-                  .num_entries = 0,
-                  .bucket_nitems = bucket_nitems,
-                  .bktlocks = bktlocks};
+  _gphash_table_alloc(&tmp, num_bkts, bkt_size);
 
   memcpy(gphash, &tmp, sizeof(GPathHash));
 }
 
+// Table can grow without limit
+void gpath_hash_alloc(GPathHash *gphash, GPathStore *gpstore, size_t mem_in_bytes)
+{
+  gpath_hash_alloc2(gphash, gpstore, mem_in_bytes, SIZE_MAX);
+}
+
 void gpath_hash_dealloc(GPathHash *gphash)
 {
-  ctx_free(gphash->bucket_nitems);
-  ctx_free(gphash->bktlocks);
-  ctx_free(gphash->table);
+  _gphash_table_dealloc(gphash);
   memset(gphash, 0, sizeof(GPathHash));
 }
 
@@ -71,6 +116,7 @@ void gpath_hash_reset(GPathHash *gphash)
 {
   gphash->num_entries = 0;
   memset(gphash->table, 0xff, gphash->capacity * sizeof(GPEntry));
+  memset(gphash->bucket_nitems, 0, gphash->num_of_buckets * sizeof(uint8_t));
 }
 
 void gpath_hash_print_stats(const GPathHash *gphash)
@@ -85,23 +131,41 @@ void gpath_hash_print_stats(const GPathHash *gphash)
   bytes_to_str(mem_total, 1, mem_total_str);
   bytes_to_str(mem_used,  1, mem_used_str);
 
-  status("[GPathHash] Paths: %s / %s occupancy [%.2f%%] %s / %s [%.2f]",
+  status("[GPathHash] Paths: %s / %s occupancy [%.2f%%] %s / %s [%.2f] "
+         "resized %zu times",
          entries_str, cap_str, (100.0 * gphash->num_entries) / gphash->capacity,
-         mem_used_str, mem_total_str, (100.0 * mem_used) / mem_total);
+         mem_used_str, mem_total_str, (100.0 * mem_used) / mem_total,
+         gphash->num_resizes);
 }
 
-static inline bool _gphash_entries_match(const GPathSet *gpset, GPEntry entry,
+// Entries do not store their kmer, check gpath is in the list for hkey
+static inline bool _gpath_in_kmer_list(const GPathStore *gpstore, hkey_t hkey,
+                                       const GPath *gpath)
+{
+  const GPath *gp = gpath_store_fetch(gpstore, hkey);
+  for(; gp != NULL; gp = gpath_next(gp))
+    if(gp == gpath) return true;
+  return false;
+}
+
+static inline bool _gphash_entries_match(const GPathStore *gpstore,
+                                         GPEntry entry, uint32_t fp,
                                          hkey_t hkey, GPathNew newgpath)
 {
-  return (hkey == entry.hkey &&
-          gpaths_are_equal(gpset->entries.b[entry.gpindex], newgpath));
+  if(PATH_HASH_ENTRY_EMPTY(entry) || entry.fp != fp) return false;
+  const GPath *gpath = gpstore->gpset.entries.b + entry.gpindex;
+  return gpaths_are_equal(*gpath, newgpath) &&
+         _gpath_in_kmer_list(gpstore, hkey, gpath);
 }
 
 // Use a bucket lock to find or add an entry
+// If `gpath_add` is NULL, newgpath is added to the store if not found,
+// otherwise gpath_add (already in the store) is used
 // Returns NULL if not found or inserted
 static inline GPath* _find_or_add_in_bucket_mt(GPathHash *gphash, uint64_t hash,
-                                               hkey_t hkey, GPathNew newgpath,
-                                               bool *found)
+                                               uint32_t fp, hkey_t hkey,
+                                               GPathNew newgpath,
+                                               GPath *gpath_add, bool *found)
 {
   const GPathSet *gpset = &gphash->gpstore->gpset;
 
@@ -112,7 +176,7 @@ static inline GPath* _find_or_add_in_bucket_mt(GPathHash *gphash, uint64_t hash,
 
   // Add GPath within a lock to ensure we do not add the same path more than
   // once
-  bitlock_yield_acquire(gphash->bktlocks, hash);
+  ctx_bitlock_yield_acquire(gphash->bktlocks, hash);
 
         GPEntry *start = gphash->table + hash * gphash->bucket_size;
   const GPEntry *end   = start + gphash->bucket_size;
@@ -121,7 +185,7 @@ static inline GPath* _find_or_add_in_bucket_mt(GPathHash *gphash, uint64_t hash,
   for(entryptr = start; entryptr < end; entryptr++)
   {
     GPEntry entry = *entryptr;
-    if(_gphash_entries_match(gpset, entry, hkey, newgpath))
+    if(_gphash_entries_match(gphash->gpstore, entry, fp, hkey, newgpath))
     {
       *found = true;
       gpath_ret = gpset->entries.b + entry.gpindex;
@@ -129,9 +193,9 @@ static inline GPath* _find_or_add_in_bucket_mt(GPathHash *gphash, uint64_t hash,
     }
     else if(PATH_HASH_ENTRY_EMPTY(entry))
     {
-      gpath_ret = gpath_store_add_mt(gphash->gpstore, hkey, newgpath);
-      *entryptr = (GPEntry){.hkey = hkey,
-                            .gpindex = gpath_ret - gpset->entries.b};
+      gpath_ret = gpath_add ? gpath_add
+                            : gpath_store_add_mt(gphash->gpstore, hkey, newgpath);
+      *entryptr = (GPEntry){.gpindex = gpath_ret - gpset->entries.b, .fp = fp};
 
       __sync_synchronize(); // add entry before updating count
       __sync_fetch_and_add((volatile uint8_t*)&gphash->bucket_nitems[hash], 1);
@@ -151,7 +215,8 @@ static inline GPath* _find_or_add_in_bucket_mt(GPathHash *gphash, uint64_t hash,
 // the use of locks and improve performance.
 // Returns NULL if not found
 static inline GPath* _find_in_bucket_mt(const GPathHash *gphash, uint64_t hash,
-                                        hkey_t hkey, GPathNew newgpath)
+                                        uint32_t fp, hkey_t hkey,
+                                        GPathNew newgpath)
 {
   const GPathSet *gpset = &gphash->gpstore->gpset;
   const GPEntry *start = gphash->table + hash * gphash->bucket_size;
@@ -159,47 +224,195 @@ static inline GPath* _find_in_bucket_mt(const GPathHash *gphash, uint64_t hash,
   volatile const GPEntry *entry;
 
   for(entry = start; entry < end; entry++)
-    if(_gphash_entries_match(gpset, *entry, hkey, newgpath))
+    if(_gphash_entries_match(gphash->gpstore, *entry, fp, hkey, newgpath))
       return gpset->entries.b + entry->gpindex;
 
   return NULL;
 }
 
-// Returns NULL if out of memory
-// Thread Safe: uses bucket level locks
-GPath* gpath_hash_find_or_insert_mt(GPathHash *gphash,
-                                    hkey_t hkey, GPathNew newgpath,
-                                    bool *found)
+// Returns NULL if no space in the table
+static GPath* _gphash_find_or_insert_mt(GPathHash *gphash,
+                                        hkey_t hkey, GPathNew newgpath,
+                                        GPath *gpath_add, bool *found)
 {
-  ctx_assert(newgpath.seq != NULL);
-  ctx_assert(gphash->table != NULL);
-  ctx_assert(hkey < PATH_HASH_UNSET);
-
-  *found = false;
-
   size_t i, mem = binary_seq_mem(newgpath.num_juncs);
   uint64_t entropy = hkey, hash;
+  uint32_t fp;
   GPath *gpath = NULL;
 
+  *found = false;
+
   for(i = 0; i < REHASH_LIMIT; i++)
   {
     entropy = CityHash64WithSeeds((const char*)newgpath.seq, mem, entropy, i);
     hash = entropy & gphash->mask;
+    fp = gphash_fingerprint(entropy);
 
     uint8_t bucket_fill = *(volatile uint8_t *)&gphash->bucket_nitems[hash];
     ctx_assert2(bucket_fill <= gphash->bucket_size,
                 "hash: %zu count: %i", (size_t)hash, (int)bucket_fill);
 
     if(bucket_fill < gphash->bucket_size)
-      gpath = _find_or_add_in_bucket_mt(gphash, hash, hkey, newgpath, found);
+      gpath = _find_or_add_in_bucket_mt(gphash, hash, fp, hkey, newgpath,
+                                        gpath_add, found);
     else {
-      gpath = _find_in_bucket_mt(gphash, hash, hkey, newgpath);
+      gpath = _find_in_bucket_mt(gphash, hash, fp, hkey, newgpath);
       *found = (gpath != NULL);
     }
 
     if(gpath != NULL) return gpath;
   }
 
+  return NULL;
+}
+
+// Take chunks of kmers and add their paths to the new table
+static void _gphash_help_rehash(GPathHash *gphash)
+{
+  const GPathStore *gpstore = gphash->gpstore;
+  const size_t nkmers = gpstore->graph_capacity;
+  size_t start, end;
+  hkey_t hkey;
+  GPath *gpath;
+  bool found;
+
+  if(*(volatile int*)&gphash->state != GPHASH_REHASHING) {
+    sched_yield();
+    return;
+  }
+
+  start = __sync_fetch_and_add(&gphash->rehash_next, GPHASH_REHASH_CHUNK);
+  if(start >= nkmers) { sched_yield(); return; }
+  end = MIN2(start + GPHASH_REHASH_CHUNK, nkmers);
+
+  for(hkey = start; hkey < end; hkey++) {
+    gpath = gpath_store_fetch(gpstore, hkey);
+    for(; gpath != NULL; gpath = gpath_next(gpath)) {
+      GPathNew newgp = {.seq = gpath_seq(gpath), .colset = NULL, .nseen = NULL,
+                        .num_juncs = gpath->num_juncs,
+                        .orient = gpath->orient};
+      if(!_gphash_find_or_insert_mt(gphash->rehash_dst, hkey, newgp,
+                                    gpath, &found))
+      {
+        die("[GPathHash] Out of memory during rehash");
+      }
+    }
+  }
+
+  __sync_fetch_and_add(&gphash->rehash_done, end - start);
+}
+
+// Wait until the table is not being resized, then mark this thread as active
+static inline void _gphash_enter(GPathHash *gphash)
+{
+  while(1) {
+    if(*(volatile int*)&gphash->state != GPHASH_READY) {
+      _gphash_help_rehash(gphash);
+      continue;
+    }
+    __sync_fetch_and_add(&gphash->nactive, 1);
+    if(*(volatile int*)&gphash->state == GPHASH_READY) return;
+    __sync_fetch_and_sub(&gphash->nactive, 1);
+  }
+}
+
+static inline void _gphash_leave(GPathHash *gphash)
+{
+  __sync_fetch_and_sub(&gphash->nactive, 1);
+}
+
+// Double the number of buckets, if no other thread has already
+// `capacity` is the table capacity seen by the calling thread, which must not
+// be using the table
+static void _gphash_grow_mt(GPathHash *gphash, uint64_t capacity)
+{
+  if(!__sync_bool_compare_and_swap(&gphash->state, GPHASH_READY,
+                                   GPHASH_WAITING)) return;
+
+  if(gphash->capacity != capacity) {
+    // Another thread has already resized
+    __sync_synchronize();
+    gphash->state = GPHASH_READY;
+    return;
+  }
+
+  while(*(volatile size_t*)&gphash->nactive > 0) sched_yield();
+
+  char old_cap_str[50], new_cap_str[50];
+  ulong_to_str(gphash->capacity, old_cap_str);
+  ulong_to_str(gphash->capacity*2, new_cap_str);
+  status("[GPathHash] Resizing table %s -> %s entries",
+         old_cap_str, new_cap_str);
+
+  GPathHash tmp = {.gpstore = gphash->gpstore};
+  _gphash_table_alloc(&tmp, gphash->num_of_buckets * 2, gphash->bucket_size);
+  GPathHash *dst = ctx_malloc(sizeof(GPathHash));
+  memcpy(dst, &tmp, sizeof(GPathHash));
+
+  gphash->rehash_dst = dst;
+  gphash->rehash_next = gphash->rehash_done = 0;
+  __sync_synchronize();
+  gphash->state = GPHASH_REHASHING;
+
+  // Help other threads rehash
+  while(*(volatile size_t*)&gphash->rehash_done < gphash->gpstore->graph_capacity)
+    _gphash_help_rehash(gphash);
+
+  _gphash_table_dealloc(gphash);
+  gphash->table = dst->table;
+  gphash->bucket_nitems = dst->bucket_nitems;
+  gphash->bktlocks = dst->bktlocks;
+  gphash->num_of_buckets = dst->num_of_buckets;
+  gphash->capacity = dst->capacity;
+  gphash->mask = dst->mask;
+  gphash->num_entries = dst->num_entries;
+  gphash->num_resizes++;
+  gphash->rehash_dst = NULL;
+  ctx_free(dst);
+
+  __sync_synchronize();
+  gphash->state = GPHASH_READY;
+}
+
+bool gpath_hash_nearly_full(const GPathHash *gphash, double frac)
+{
+  bool can_grow = (gphash_table_mem(gphash->num_of_buckets, gphash->bucket_size) +
+                   gphash_table_mem(gphash->num_of_buckets*2, gphash->bucket_size)
+                     <= gphash->max_mem);
+  size_t nentries = *(volatile size_t*)&gphash->num_entries;
+  return !can_grow && nentries > gphash->capacity * IDEAL_OCCUPANCY * frac;
+}
+
+// Dies if out of memory and cannot grow the table
+// Thread Safe: uses bucket level locks, resizes online
+GPath* gpath_hash_find_or_insert_mt(GPathHash *gphash,
+                                    hkey_t hkey, GPathNew newgpath,
+                                    bool *found)
+{
+  ctx_assert(newgpath.seq != NULL);
+  ctx_assert(gphash->table != NULL);
+  ctx_assert(hkey < gphash->gpstore->graph_capacity);
+
+  GPath *gpath;
+  uint64_t capacity;
+  bool full, can_grow;
+
+  while(1)
+  {
+    _gphash_enter(gphash);
+    gpath = _gphash_find_or_insert_mt(gphash, hkey, newgpath, NULL, found);
+    capacity = gphash->capacity;
+    full = (gphash->num_entries > capacity * IDEAL_OCCUPANCY);
+    can_grow = (gphash_table_mem(gphash->num_of_buckets, gphash->bucket_size) +
+                gphash_table_mem(gphash->num_of_buckets*2, gphash->bucket_size)
+                  <= gphash->max_mem);
+    _gphash_leave(gphash);
+
+    if((gpath == NULL || full) && can_grow) _gphash_grow_mt(gphash, capacity);
+    if(gpath != NULL) return gpath;
+    if(!can_grow) break;
+  }
+
   // Out of space
   gpath_hash_print_stats(gphash);
   die("[GPathHash] Out of memory");
@@ -4,18 +4,18 @@
 #include "cortex_types.h"
 #include "gpath_store.h"
 
-// Packed structure is 10 bytes
-// Do not use pointers to fields in this struct - they are not aligned
+// 8 bytes, entries can be read and written in one go
+// The kmer is not stored. A match on the fingerprint is confirmed by comparing
+// the sequence in the GPathSet and checking the path is in the kmer's list.
 struct GPEntryStruct
 {
-  // 5 bytes each
-  hkey_t hkey:40;
-  pkey_t gpindex:40;
-} __attribute((packed));
+  uint64_t gpindex:40; // 5 bytes
+  uint64_t fp:24; // 3 bytes, fingerprint (top bits of hash)
+};
 
 /*
 // 5+5+5+1+2 = 18 bytes
-// GPath:18 + GPEntry:10 + count:1 + colset:1 = 30
+// GPath:12 + GPEntry:8 + count:1 + colset:1 = 22
 // 18/34 = 52%
 struct GPEntryStruct
 {
@@ -29,28 +29,43 @@ struct GPEntryStruct
 
 typedef struct GPEntryStruct GPEntry;
 
-typedef struct
+typedef struct GPathHashStruct GPathHash;
+
+struct GPathHashStruct
 {
   GPathStore *const gpstore; // Add to this path store
-  GPEntry *const table; // Using this table to remove duplicates
-  const size_t num_of_buckets; // needs to store maximum of 1<<32
-  const uint8_t bucket_size; // max value 255
-  const uint64_t capacity, mask; // num_of_buckets * bucket_size
-  uint8_t *const bucket_nitems; // number of items in each bucket
-  uint8_t *const bktlocks; // always cast to volatile
-  // uint8_t *const seq;
-  // size_t seq_len, seq_capacity;
+  GPEntry *table; // Using this table to remove duplicates
+  size_t num_of_buckets; // needs to store maximum of 1<<32
+  uint8_t bucket_size; // max value 255
+  uint64_t capacity, mask; // num_of_buckets * bucket_size
+  uint8_t *bucket_nitems; // number of items in each bucket
+  uint8_t *bktlocks; // always cast to volatile
   size_t num_entries;
-} GPathHash;
+  // Resizing: table doubles in size until old+new tables would use more than
+  // max_mem. Threads wait for or help with the rehash.
+  size_t max_mem, num_resizes;
+  volatile size_t nactive; // number of threads using the table
+  volatile int state; // READY, WAITING or REHASHING
+  volatile size_t rehash_next, rehash_done; // kmers claimed / rehashed
+  GPathHash *rehash_dst;
+};
 
+// Table can grow without limit
 void gpath_hash_alloc(GPathHash *phash, GPathStore *gpstore, size_t mem_in_bytes);
+// Start with init_mem, grow while old and new tables fit in max_mem
+void gpath_hash_alloc2(GPathHash *phash, GPathStore *gpstore,
+                       size_t init_mem, size_t max_mem);
 void gpath_hash_dealloc(GPathHash *phash);
 void gpath_hash_reset(GPathHash *phash);
 
 void gpath_hash_print_stats(const GPathHash *phash);
 
-// Returns NULL if out of memory
-// Thread Safe: uses bucket level locks
+// Returns true if the table cannot grow any more and is over `frac` of the
+// way to its ideal occupancy
+bool gpath_hash_nearly_full(const GPathHash *phash, double frac);
+
+// Dies if out of memory and cannot grow the table
+// Thread Safe: uses bucket level locks, resizes online
 GPath* gpath_hash_find_or_insert_mt(GPathHash *restrict phash,
                                     hkey_t hkey, GPathNew newgpath,
                                     bool *found);
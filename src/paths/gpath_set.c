@@ -2,9 +2,60 @@
 #include "gpath_set.h"
 #include "util.h"
 
-// Save 16 bytes at the end of the sequence store
-// This is relied on by GPathFollow
-#define SEQ_STORE_PADDING 16
+// Each GPathSet (and each reset of one) gets a new id so that threads do not
+// keep using a seq chunk from a set that has since been reset or freed
+static volatile uint64_t gpath_set_next_arena_id = 0;
+
+// Chunk of a GPathSet's seqs buffer reserved by this thread
+static __thread struct {
+  uint64_t arena_id;
+  uint8_t *next, *end;
+} gpath_set_arena = {.arena_id = 0, .next = NULL, .end = NULL};
+
+static inline uint64_t _gpath_set_new_arena_id()
+{
+  return __sync_add_and_fetch(&gpath_set_next_arena_id, 1);
+}
+
+// Paths and their colset+seq are stored in one block of memory, paths first,
+// so that each path can store the offset to its sequence (see gpath.h)
+// Resizing copies both into a new block and updates the sequence offsets.
+// Offsets between paths (next) do not change.
+static void _gpath_set_realloc(GPathSet *gpset, size_t npaths, size_t seqbytes)
+{
+  GPath *old_entries = gpset->entries.b;
+  uint8_t *old_seqs = gpset->seqs.b;
+  size_t i, entry_bytes = npaths * sizeof(GPath);
+
+  if(entry_bytes + seqbytes > GPATH_MAX_SEQOFF) {
+    die("[GPathSet] Cannot store more than %llu bytes of paths (%zu paths, "
+        "%zu bytes colset+seq)", GPATH_MAX_SEQOFF, npaths, seqbytes);
+  }
+
+  ctx_assert(npaths >= gpset->entries.len);
+  ctx_assert(seqbytes >= gpset->seqs.len);
+
+  uint8_t *mem = ctx_malloc(entry_bytes + seqbytes);
+  GPath *entries = (GPath*)mem;
+  uint8_t *seqs = mem + entry_bytes;
+
+  if(old_entries != NULL) {
+    memcpy(entries, old_entries, gpset->entries.len * sizeof(GPath));
+    memcpy(seqs, old_seqs, gpset->seqs.len);
+
+    // Sequence offsets grow by however much further away the seqs now are
+    size_t shift = (seqs - mem) - (old_seqs - (uint8_t*)old_entries);
+    for(i = 0; i < gpset->entries.len; i++)
+      gpath_set_seq(&entries[i], gpath_seq(&entries[i]) + shift);
+
+    ctx_free(old_entries);
+  }
+
+  gpset->entries.b = entries;
+  gpset->entries.size = npaths;
+  gpset->seqs.b = seqs;
+  gpset->seqs.size = seqbytes;
+}
 
 // If resize true, cannot do multithreaded but can resize array
 // If resize false, die if out of mem, but can multithread
@@ -12,7 +63,8 @@ void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
                       size_t initpaths, size_t initmem,
                       bool resize, bool keep_path_counts)
 {
-  GPathSet tmp = {.ncols = ncols, .can_resize = resize};
+  GPathSet tmp = {.ncols = ncols, .can_resize = resize,
+                  .arena_id = _gpath_set_new_arena_id()};
 
   // 1:1 split between seq and paths (6 bytes each)
   size_t entry_size = 0, counts_size = 0;
@@ -41,8 +93,7 @@ void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
   status("[GPathSet] Allocating for %s paths, %s colset, %s seq => %s total",
          npathstr, colmemstr, seqmemstr, totalmemstr);
 
-  gpath_buf_alloc(&tmp.entries, initpaths);
-  byte_buf_alloc(&tmp.seqs, seq_col_mem + SEQ_STORE_PADDING);
+  _gpath_set_realloc(&tmp, initpaths, seq_col_mem + SEQ_STORE_PADDING);
 
   if(keep_path_counts) {
     // madcrowlib allocates with calloc, so these are all zero'd
@@ -71,8 +122,8 @@ void gpath_set_alloc(GPathSet *gpset, size_t ncols, size_t initmem,
 
 void gpath_set_dealloc(GPathSet *gpset)
 {
-  gpath_buf_dealloc(&gpset->entries);
-  byte_buf_dealloc(&gpset->seqs);
+  // seqs are in the same block as entries
+  ctx_free(gpset->entries.b);
   byte_buf_dealloc(&gpset->nseen_buf);
   memset(gpset, 0, sizeof(GPathSet));
 }
@@ -82,6 +133,7 @@ void gpath_set_reset(GPathSet *gpset)
   gpath_buf_reset(&gpset->entries);
   byte_buf_reset(&gpset->seqs);
   byte_buf_reset(&gpset->nseen_buf);
+  gpset->arena_id = _gpath_set_new_arena_id();
 }
 
 void gpath_set_print_stats(const GPathSet *gpset)
@@ -125,42 +177,54 @@ void gpath_set_nseen_sum_mt(const GPath *dst, GPathSet *dstset,
 void _check_resize(GPathSet *gpset, size_t req_num_bytes)
 {
   const size_t ncols = gpset->ncols;
-  size_t i;
+  size_t npaths = gpset->entries.size, seqbytes = gpset->seqs.size;
+  size_t req_seqbytes = gpset->seqs.len+req_num_bytes+SEQ_STORE_PADDING;
 
-  GPath *old_entries = gpset->entries.b;
-  size_t old_num_entries = gpset->entries.size;
-  gpath_buf_capacity(&gpset->entries, gpset->entries.len+1);
-
-  if(old_entries != gpset->entries.b) {
-    // Correct all path pointers
-    for(i = 0; i < gpset->entries.len; i++) {
-      if(gpset->entries.b[i].next != NULL) {
-        gpset->entries.b[i].next = gpset->entries.b +
-                                     (gpset->entries.b[i].next - old_entries);
-      }
-    }
-  }
+  if(gpset->entries.len+1 > npaths) npaths = (gpset->entries.len+1)*2;
+  if(req_seqbytes > seqbytes) seqbytes = req_seqbytes*2;
 
-  if(old_num_entries != gpset->entries.size)
+  if(npaths != gpset->entries.size)
   {
     if(gpath_set_has_nseen(gpset)) {
       // Increase size of nseen buffer to match (zero'd by default)
-      byte_buf_capacity(&gpset->nseen_buf, gpset->entries.size * ncols);
+      byte_buf_capacity(&gpset->nseen_buf, npaths * ncols);
     }
   }
 
-  uint8_t *old_seq = gpset->seqs.b;
-  byte_buf_capacity(&gpset->seqs, gpset->seqs.len+req_num_bytes+SEQ_STORE_PADDING);
+  if(npaths != gpset->entries.size || seqbytes != gpset->seqs.size)
+    _gpath_set_realloc(gpset, npaths, seqbytes);
+}
 
-  if(gpset->seqs.b != old_seq) {
-    // Correct all seq pointers
-    for(i = 0; i < gpset->entries.len; i++) {
-      if(gpset->entries.b[i].seq != NULL) {
-        gpset->entries.b[i].seq = gpset->seqs.b +
-                                     (gpset->entries.b[i].seq - old_seq);
-      }
-    }
+// Reserve `nbytes` of seqs.b from this thread's chunk, taking a new chunk from
+// the shared buffer if needed. Only one atomic per chunk rather than per path.
+// Returns NULL if out of memory.
+static inline uint8_t* _gpath_set_arena_get(GPathSet *gpset, size_t nbytes)
+{
+  uint8_t *data;
+
+  if(gpath_set_arena.arena_id == gpset->arena_id &&
+     gpath_set_arena.next + nbytes <= gpath_set_arena.end)
+  {
+    data = gpath_set_arena.next;
+    gpath_set_arena.next += nbytes;
+    return data;
+  }
+
+  // Take a whole chunk if there is room, otherwise just what we need
+  size_t len, reserve, limit = gpset->seqs.size - SEQ_STORE_PADDING;
+  do {
+    len = *(volatile size_t*)&gpset->seqs.len;
+    if(len + nbytes > limit) return NULL;
+    reserve = MIN2(MAX2(nbytes, GPATH_SET_ARENA_CHUNK), limit - len);
   }
+  while(!__sync_bool_compare_and_swap((volatile size_t*)&gpset->seqs.len,
+                                      len, len+reserve));
+
+  data = gpset->seqs.b + len;
+  gpath_set_arena.arena_id = gpset->arena_id;
+  gpath_set_arena.next = data + nbytes;
+  gpath_set_arena.end = data + reserve;
+  return data;
 }
 
 // Always adds new path. If newpath could be a duplicate, use gpathhash
@@ -180,24 +244,24 @@ GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
   if(gpset->can_resize)
   {
     _check_resize(gpset, nbytes);
-    pkey = gpath_buf_add(&gpset->entries, (GPath){.seq = NULL, .num_juncs = 0});
+    pkey = gpset->entries.len++;
     gpath = &gpset->entries.b[pkey];
     data = gpset->seqs.b + gpset->seqs.len;
     gpset->seqs.len += nbytes;
   }
   else
   {
+    // Entries must stay dense (pkeys index nseen_buf), so take one at a time
     gpath = gpset->entries.b + __sync_fetch_and_add((volatile size_t*)&gpset->entries.len, 1);
-    data = gpset->seqs.b + __sync_fetch_and_add((volatile size_t*)&gpset->seqs.len, nbytes);
+    data = _gpath_set_arena_get(gpset, nbytes);
 
-    if(gpath >= gpset->entries.b + gpset->entries.size ||
-       data+nbytes+SEQ_STORE_PADDING > gpset->seqs.b + gpset->seqs.size)
+    if(gpath >= gpset->entries.b + gpset->entries.size || data == NULL)
     {
       gpath_set_print_stats(gpset);
-      status("%zu >= %zu; %zu > %zu nbytes: %zu\n",
+      status("%zu >= %zu; %zu / %zu nbytes: %zu\n",
              gpath - gpset->entries.b,
              gpset->entries.size,
-             data+nbytes+SEQ_STORE_PADDING - gpset->seqs.b,
+             gpset->seqs.len,
              gpset->seqs.size,
              nbytes);
       die("Out of memory");
@@ -207,13 +271,13 @@ GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
   }
 
   uint8_t *colset = data;
-  gpath->seq = data + colset_bytes;
+  gpath_set_seq(gpath, data + colset_bytes);
+  gpath_set_next(gpath, NULL);
   gpath->num_juncs = newgpath.num_juncs;
   gpath->orient = newgpath.orient;
-  gpath->next = NULL;
 
   // copy seq and zero colset
-  memcpy(gpath->seq, newgpath.seq, junc_bytes);
+  memcpy(data + colset_bytes, newgpath.seq, junc_bytes);
 
   if(newgpath.colset)
     memcpy(colset, newgpath.colset, colset_bytes);
@@ -221,9 +285,11 @@ GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
     memset(colset, 0, colset_bytes);
 
   // link counts
+  // nseen_buf.len is only maintained when resizing, since nseen_buf has a row
+  // for every entry it is always entries.len * ncols
   if(gpath_set_has_nseen(gpset))
   {
-    __sync_fetch_and_add((volatile size_t*)&gpset->nseen_buf.len, gpset->ncols);
+    if(gpset->can_resize) gpset->nseen_buf.len += gpset->ncols;
 
     uint8_t *nseen = gpath_set_get_nseen(gpset, gpath);
     ctx_assert(nseen != NULL);
@@ -237,16 +303,24 @@ GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
   return gpath;
 }
 
+bool gpath_set_nearly_full(const GPathSet *gpset, double frac)
+{
+  size_t nentries = *(volatile size_t*)&gpset->entries.len;
+  size_t nbytes = *(volatile size_t*)&gpset->seqs.len;
+  return (nentries > gpset->entries.size * frac ||
+          nbytes > (gpset->seqs.size - SEQ_STORE_PADDING) * frac);
+}
+
 // Reset all counts to zero
 void gpath_set_zero_nseen(GPathSet *gpset)
 {
   memset(gpset->nseen_buf.b, 0,
-         gpset->nseen_buf.len * sizeof(gpset->nseen_buf.b[0]));
+         gpset->entries.len * gpset->ncols * sizeof(gpset->nseen_buf.b[0]));
 }
 
 GPathNew gpath_set_get(const GPathSet *gpset, const GPath *gpath)
 {
-  GPathNew newgpath = {.seq = gpath->seq,
+  GPathNew newgpath = {.seq = gpath_seq(gpath),
                        .colset = gpath_get_colset(gpath, gpset->ncols),
                        .nseen = gpath_set_get_nseen(gpset, gpath),
                        .num_juncs = gpath->num_juncs,
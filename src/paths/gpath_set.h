@@ -10,6 +10,14 @@ madcrow_buffer(gpath_buf, GPathBuffer, GPath);
 
 typedef uint64_t pkey_t;
 
+// Save 16 bytes at the end of the sequence store
+// This is relied on by GPathFollow
+#define SEQ_STORE_PADDING 16
+
+// When adding from multiple threads, each thread reserves sequence memory in
+// chunks of this many bytes, see gpath_set_add_mt()
+#define GPATH_SET_ARENA_CHUNK 4096
+
 // These passed around to be added
 typedef struct
 {
@@ -26,6 +34,7 @@ typedef struct
   ByteBuffer seqs; // colset+seq for each path
   ByteBuffer nseen_buf; // counts for how many times we've seen path
   bool can_resize;
+  uint64_t arena_id; // identifies per-thread seq chunks, changes on reset
 } GPathSet;
 
 
@@ -55,8 +64,14 @@ void gpath_set_print_stats(const GPathSet *gpset);
 // Always adds new path. If newpath could be a duplicate, use gpathhash
 // Threadsafe only if resize is false. GPath* not safe to edit until it returns
 // Copies newgpath.seq over and wipe new colset
+// If resize is false, sequence memory is taken from a per-thread chunk so
+// seqs.len may be up to GPATH_SET_ARENA_CHUNK bytes per thread more than used.
 GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath);
 
+// Returns true if more than `frac` of the entries or sequence memory is used.
+// Only meaningful if resize is false.
+bool gpath_set_nearly_full(const GPathSet *gpset, double frac);
+
 // Returns true if we are storing number of sightings and kmer length
 #define gpath_set_has_nseen(gpset) ((gpset)->nseen_buf.b != NULL)
 
@@ -74,8 +89,9 @@ void gpath_set_zero_nseen(GPathSet *gpset);
 
 GPathNew gpath_set_get(const GPathSet *gpset, const GPath *gpath);
 
+// `a` is a GPath, `b` is a GPathNew
 #define gpaths_are_equal(a,b) \
   ((a).orient == (b).orient && \
-   binary_seqs_cmp((a).seq, (a).num_juncs, (b).seq, (b).num_juncs) == 0)
+   binary_seqs_cmp(gpath_seq(&(a)), (a).num_juncs, (b).seq, (b).num_juncs) == 0)
 
 #endif /* GPATH_SET_H_ */
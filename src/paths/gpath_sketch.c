@@ -0,0 +1,64 @@
+#include "global.h"
+#include "gpath_sketch.h"
+#include "binary_seq.h"
+#include "util.h"
+#include "misc/city.h"
+
+void gpath_sketch_alloc(GPathSketch *sketch, size_t mem)
+{
+  size_t width = mem / GPATH_SKETCH_DEPTH;
+  width = width < 64 ? 64 : roundup2pow(width/2+1);
+
+  char width_str[50], mem_str[50];
+  ulong_to_str(width, width_str);
+  bytes_to_str(width * GPATH_SKETCH_DEPTH, 1, mem_str);
+  status("[GPathSketch] Allocating %i x %s counters, using %s",
+         GPATH_SKETCH_DEPTH, width_str, mem_str);
+
+  sketch->counts = ctx_calloc(width * GPATH_SKETCH_DEPTH, sizeof(uint8_t));
+  sketch->width = width;
+  sketch->mask = width - 1;
+}
+
+void gpath_sketch_dealloc(GPathSketch *sketch)
+{
+  ctx_free(sketch->counts);
+  memset(sketch, 0, sizeof(*sketch));
+}
+
+void gpath_sketch_reset(GPathSketch *sketch)
+{
+  memset(sketch->counts, 0, sketch->width * GPATH_SKETCH_DEPTH);
+}
+
+uint64_t gpath_sketch_hash(hkey_t hkey, GPathNew newgpath)
+{
+  size_t mem = binary_seq_mem(newgpath.num_juncs);
+  uint64_t seed = ((uint64_t)newgpath.num_juncs << 1) | newgpath.orient;
+  return CityHash64WithSeeds((const char*)newgpath.seq, mem, hkey, seed);
+}
+
+uint8_t gpath_sketch_add_mt(GPathSketch *sketch, uint64_t hash)
+{
+  volatile uint8_t *ptrs[GPATH_SKETCH_DEPTH];
+  uint8_t vals[GPATH_SKETCH_DEPTH], minval = UINT8_MAX;
+  uint64_t h1 = hash & 0xffffffff, h2 = hash >> 32;
+  size_t i;
+
+  // Kirsch-Mitzenmacher: row i uses h1 + i*h2
+  for(i = 0; i < GPATH_SKETCH_DEPTH; i++) {
+    ptrs[i] = sketch->counts + i*sketch->width + ((h1 + i*h2) & sketch->mask);
+    vals[i] = *ptrs[i];
+    minval = MIN2(minval, vals[i]);
+  }
+
+  if(minval == UINT8_MAX) return minval;
+
+  // Conservative update: only increment the smallest counters. If another
+  // thread got there first, the counter has been incremented anyway.
+  for(i = 0; i < GPATH_SKETCH_DEPTH; i++)
+    if(vals[i] == minval)
+      __sync_bool_compare_and_swap(ptrs[i], minval, minval+1);
+
+  return minval+1;
+}
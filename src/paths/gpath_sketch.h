@@ -0,0 +1,39 @@
+#ifndef GPATH_SKETCH_H_
+#define GPATH_SKETCH_H_
+
+#include "gpath_set.h"
+
+//
+// Count-min sketch of link sightings, used to only add a link to a
+// GPathStore once it has been seen a minimum number of times. Most links seen
+// once are errors, so this saves storing them while threading.
+//
+// Counters are 8 bit and saturate. Uses conservative update: only the
+// smallest of a link's counters are incremented, which reduces over-counting.
+// Counts may be over estimates, and only under estimates if threads race to
+// update the same counter.
+//
+
+#define GPATH_SKETCH_DEPTH 4
+
+typedef struct
+{
+  uint8_t *counts; // GPATH_SKETCH_DEPTH rows of `width` counters
+  size_t width;
+  uint64_t mask; // width-1
+} GPathSketch;
+
+// Uses at most `mem` bytes, rounding width down to a power of two
+void gpath_sketch_alloc(GPathSketch *sketch, size_t mem);
+void gpath_sketch_dealloc(GPathSketch *sketch);
+void gpath_sketch_reset(GPathSketch *sketch);
+
+// Hash a link on kmer `hkey`
+uint64_t gpath_sketch_hash(hkey_t hkey, GPathNew newgpath);
+
+// Record a sighting of a link with hash `hash`
+// Returns (estimated) number of times it has been seen, including this one
+// Thread safe
+uint8_t gpath_sketch_add_mt(GPathSketch *sketch, uint64_t hash);
+
+#endif /* GPATH_SKETCH_H_ */
@@ -2,6 +2,19 @@
 #include "gpath_store.h"
 #include "util.h"
 
+// Each thread is given a stripe of counters the first time it adds a path
+static volatile size_t gpstore_num_threads = 0;
+static __thread size_t gpstore_thread_stripe = SIZE_MAX;
+
+static inline GPathStoreCounts* _gpstore_thread_counts(GPathStore *gpstore)
+{
+  if(gpstore_thread_stripe == SIZE_MAX) {
+    gpstore_thread_stripe = __sync_fetch_and_add(&gpstore_num_threads, 1) %
+                            GPSTORE_NSTRIPES;
+  }
+  return &gpstore->stripes[gpstore_thread_stripe];
+}
+
 
 size_t gpath_store_mem(size_t graph_capacity, bool split_linked_lists)
 {
@@ -35,14 +48,18 @@ void gpath_store_alloc(GPathStore *gpstore, size_t ncols, size_t graph_capacity,
   // paths_traverse is always a subset of paths_all
   gpstore->paths_all = ctx_calloc(graph_capacity, sizeof(GPath*));
   gpstore->paths_traverse = gpstore->paths_all;
+  gpstore->stripes = ctx_calloc(GPSTORE_NSTRIPES, sizeof(GPathStoreCounts));
 }
 
 void gpath_store_dealloc(GPathStore *gpstore)
 {
   gpath_set_dealloc(&gpstore->gpset);
   gpath_store_merge_read_write(gpstore);
+  ctx_free(gpstore->traverse_orients);
+  ctx_free(gpstore->traverse_cols);
   ctx_free(gpstore->paths_all);
   if(gpstore->paths_traverse != gpstore->paths_all) ctx_free(gpstore->paths_traverse);
+  ctx_free(gpstore->stripes);
   memset(gpstore, 0, sizeof(*gpstore));
 }
 
@@ -50,10 +67,34 @@ void gpath_store_reset(GPathStore *gpstore)
 {
   gpath_set_reset(&gpstore->gpset);
   gpstore->num_kmers_with_paths = gpstore->num_paths = gpstore->path_bytes = 0;
+  memset(gpstore->stripes, 0, GPSTORE_NSTRIPES * sizeof(GPathStoreCounts));
   memset(gpstore->paths_all, 0, gpstore->graph_capacity * sizeof(GPath*));
   if(gpstore->paths_traverse != gpstore->paths_all)
     ctx_free(gpstore->paths_traverse);
   gpstore->paths_traverse = gpstore->paths_all;
+  ctx_free(gpstore->traverse_orients);
+  ctx_free(gpstore->traverse_cols);
+  gpstore->traverse_orients = NULL;
+  gpstore->traverse_cols = NULL;
+}
+
+// Counters are unsigned, removals wrap around and are undone when summed
+void gpath_store_sync_stats(GPathStore *gpstore)
+{
+  GPathStoreCounts *c;
+  uint64_t nkmers = 0, npaths = 0, nbytes = 0;
+  size_t i;
+
+  for(i = 0; i < GPSTORE_NSTRIPES; i++) {
+    c = &gpstore->stripes[i];
+    nkmers += __sync_lock_test_and_set(&c->num_kmers_with_paths, 0);
+    npaths += __sync_lock_test_and_set(&c->num_paths, 0);
+    nbytes += __sync_lock_test_and_set(&c->path_bytes, 0);
+  }
+
+  __sync_fetch_and_add((volatile uint64_t*)&gpstore->num_kmers_with_paths, nkmers);
+  __sync_fetch_and_add((volatile uint64_t*)&gpstore->num_paths, npaths);
+  __sync_fetch_and_add((volatile uint64_t*)&gpstore->path_bytes, nbytes);
 }
 
 void gpath_store_print_stats(const GPathStore *gpstore)
@@ -95,6 +136,11 @@ void gpath_store_merge_read_write(GPathStore *gpstore)
     status("[GPathStore] Merging read/write GraphPath linked lists");
     ctx_free(gpstore->paths_traverse); // does nothing if NULL
     gpstore->paths_traverse = gpstore->paths_all;
+    // Summary was of the old traversal lists
+    ctx_free(gpstore->traverse_orients);
+    ctx_free(gpstore->traverse_cols);
+    gpstore->traverse_orients = NULL;
+    gpstore->traverse_cols = NULL;
   }
 }
 
@@ -108,13 +154,105 @@ GPath* gpath_store_fetch_traverse(const GPathStore *gpstore, hkey_t hkey)
   return gpstore->paths_traverse[hkey];
 }
 
+static inline uint8_t _gpstore_llist_orients(const GPath *gpath)
+{
+  uint8_t orients = 0;
+  for(; gpath != NULL && orients != 3; gpath = gpath_next(gpath))
+    orients |= (uint8_t)(1 << gpath->orient);
+  return orients;
+}
+
+typedef struct {
+  GPathStore *gpstore;
+  size_t nthreads;
+} GPathStoreSummary;
+
+// Each thread does a block of bytes so no two threads share a byte
+static void _gpstore_summary_thread(void *arg, size_t threadid)
+{
+  const GPathStoreSummary *summ = (const GPathStoreSummary*)arg;
+  GPathStore *gpstore = summ->gpstore;
+  size_t nbytes = (gpstore->graph_capacity+3)/4;
+  size_t start = threadid*nbytes/summ->nthreads;
+  size_t end = (threadid+1)*nbytes/summ->nthreads;
+  size_t b, hkey, hend;
+  uint8_t byte;
+
+  for(b = start; b < end; b++) {
+    hend = MIN2(b*4+4, gpstore->graph_capacity);
+    for(byte = 0, hkey = b*4; hkey < hend; hkey++) {
+      byte |= (uint8_t)(_gpstore_llist_orients(gpstore->paths_traverse[hkey])
+                        << (2*(hkey%4)));
+    }
+    gpstore->traverse_orients[b] = byte;
+  }
+}
+
+void gpath_store_build_summary(GPathStore *gpstore, size_t nthreads)
+{
+  if(!gpath_store_use_traverse(gpstore)) return;
+
+  size_t nbytes = (gpstore->graph_capacity+3)/4;
+  char mem_str[50];
+  bytes_to_str(nbytes, 1, mem_str);
+  status("[GPathStore] Building path orientation summary, using %s", mem_str);
+
+  if(gpstore->traverse_orients == NULL)
+    gpstore->traverse_orients = ctx_malloc(MAX2(nbytes, 1));
+
+  GPathStoreSummary summ = {.gpstore = gpstore,
+                            .nthreads = MAX2(MIN2(nthreads, nbytes), 1)};
+  util_multi_thread(&summ, summ.nthreads, _gpstore_summary_thread);
+}
+
+// Each thread does a range of kmers, bytes on the boundaries are shared
+static void _gpstore_col_summary_thread(void *arg, size_t threadid)
+{
+  const GPathStoreSummary *summ = (const GPathStoreSummary*)arg;
+  GPathStore *gpstore = summ->gpstore;
+  const size_t ncols = gpstore->gpset.ncols;
+  size_t start = threadid*gpstore->graph_capacity/summ->nthreads;
+  size_t end = (threadid+1)*gpstore->graph_capacity/summ->nthreads;
+  size_t hkey, col;
+  const GPath *gpath;
+
+  for(hkey = start; hkey < end; hkey++) {
+    gpath = gpstore->paths_traverse[hkey];
+    for(; gpath != NULL; gpath = gpath_next(gpath)) {
+      for(col = 0; col < ncols; col++)
+        if(gpath_has_colour(gpath, ncols, col))
+          (void)bitset_set_mt(gpstore->traverse_cols, hkey*ncols+col);
+    }
+  }
+}
+
+void gpath_store_build_col_summary(GPathStore *gpstore, size_t nthreads)
+{
+  const size_t ncols = gpstore->gpset.ncols;
+  if(!gpath_store_use_traverse(gpstore) || ncols <= 1) return;
+
+  size_t nbytes = roundup_bits2bytes(gpstore->graph_capacity * ncols);
+  char mem_str[50];
+  bytes_to_str(nbytes, 1, mem_str);
+  status("[GPathStore] Building path colour summary, using %s", mem_str);
+
+  if(gpstore->traverse_cols == NULL)
+    gpstore->traverse_cols = ctx_malloc(MAX2(nbytes, 1));
+  memset(gpstore->traverse_cols, 0, nbytes);
+
+  GPathStoreSummary summ = {.gpstore = gpstore,
+                            .nthreads = MAX2(MIN2(nthreads, gpstore->graph_capacity), 1)};
+  util_multi_thread(&summ, summ.nthreads, _gpstore_col_summary_thread);
+}
+
 // Update stats after removing a path
 void gpstore_path_removal_update_stats(GPathStore *gpstore, GPath *gpath)
 {
   // Update stats
   size_t nbytes = binary_seq_mem(gpath->num_juncs);
-  __sync_fetch_and_sub((volatile uint64_t*)&gpstore->num_paths, 1);
-  __sync_fetch_and_sub((volatile uint64_t*)&gpstore->path_bytes, nbytes);
+  GPathStoreCounts *counts = _gpstore_thread_counts(gpstore);
+  __sync_fetch_and_sub((volatile uint64_t*)&counts->num_paths, 1);
+  __sync_fetch_and_sub((volatile uint64_t*)&counts->path_bytes, nbytes);
 }
 
 // You do not need to acquire the kmer lock before calling this function
@@ -122,25 +260,46 @@ static void _gpstore_add_to_llist_mt(GPathStore *gpstore, hkey_t hkey, GPath *gp
 {
   // Add to linked list
   ctx_assert(sizeof(size_t) == sizeof(GPath*));
+  GPath *head;
   do {
-    gpath->next = *(GPath *volatile const*)&gpstore->paths_all[hkey];
+    head = *(GPath *volatile const*)&gpstore->paths_all[hkey];
+    gpath_set_next(gpath, head);
   }
   while(!__sync_bool_compare_and_swap((volatile size_t*)&gpstore->paths_all[hkey],
-                                      (size_t)gpath->next, (size_t)gpath));
+                                      (size_t)head, (size_t)gpath));
 
-  // Update stats
+  // Update stats, other threads rarely share our stripe
   size_t nbytes = binary_seq_mem(gpath->num_juncs);
-  size_t new_kmer = (gpath->next == NULL ? 1 : 0);
-  __sync_fetch_and_add((volatile uint64_t*)&gpstore->num_kmers_with_paths, new_kmer);
-  __sync_fetch_and_add((volatile uint64_t*)&gpstore->num_paths, 1);
-  __sync_fetch_and_add((volatile uint64_t*)&gpstore->path_bytes, nbytes);
+  GPathStoreCounts *counts = _gpstore_thread_counts(gpstore);
+  if(head == NULL)
+    __sync_fetch_and_add((volatile uint64_t*)&counts->num_kmers_with_paths, 1);
+  __sync_fetch_and_add((volatile uint64_t*)&counts->num_paths, 1);
+  __sync_fetch_and_add((volatile uint64_t*)&counts->path_bytes, nbytes);
+  ctx_stats_add(CTX_STAT_LINKS_ADDED, 1);
+
+  // Keep summary up to date if we are adding to the traversal lists
+  if(gpstore->traverse_orients != NULL &&
+     gpstore->paths_traverse == gpstore->paths_all)
+  {
+    uint8_t bit = (uint8_t)(1 << (2*(hkey%4) + gpath->orient));
+    __sync_fetch_and_or(&gpstore->traverse_orients[hkey/4], bit);
+  }
+
+  // Colours are set after adding, so mark the kmer as having all of them
+  if(gpstore->traverse_cols != NULL &&
+     gpstore->paths_traverse == gpstore->paths_all)
+  {
+    size_t col, ncols = gpstore->gpset.ncols;
+    for(col = 0; col < ncols; col++)
+      (void)bitset_set_mt(gpstore->traverse_cols, hkey*ncols+col);
+  }
 }
 
 // Linear search to find a given path
 GPath* gpstore_find(const GPathStore *gpstore, hkey_t hkey, GPathNew find)
 {
   GPath *gpath = gpath_store_fetch(gpstore, hkey);
-  for(; gpath != NULL; gpath = gpath->next)
+  for(; gpath != NULL; gpath = gpath_next(gpath))
     if(gpaths_are_equal(*gpath, find))
       return gpath;
   return NULL;
@@ -174,7 +333,7 @@ GPath* gpath_store_find_add_mt(GPathStore *gpstore,
   *found = true;
 
   // Get lock for kmer
-  bitlock_yield_acquire(gpstore->kmer_locks, hkey);
+  ctx_bitlock_yield_acquire(gpstore->kmer_locks, hkey);
 
   // Add if not found
   if((gpath = gpstore_find(gpstore, hkey, newgpath)) == NULL) {
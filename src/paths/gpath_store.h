@@ -3,14 +3,32 @@
 
 #include "gpath_set.h"
 
+// Threads adding paths update one of GPSTORE_NSTRIPES sets of counters, each
+// on its own cache line, rather than all contending for the same counters
+#define GPSTORE_NSTRIPES 64
+
+typedef struct
+{
+  uint64_t num_kmers_with_paths, num_paths, path_bytes;
+  uint64_t padding[5]; // pad to 64 bytes
+} GPathStoreCounts;
+
 // GPathStore is a map from {[kmer/hkey] -> [GPath linked list]}
 typedef struct
 {
   // num_paths may not match gpset->num_paths if we have dropped paths
+  // Only up to date after gpath_store_sync_stats()
   uint64_t num_kmers_with_paths, num_paths, path_bytes;
+  GPathStoreCounts *stripes; // per thread changes not yet in the above
   uint64_t graph_capacity;
   GPathSet gpset;
   GPath **paths_all, **paths_traverse;
+  // Optional summary of paths_traverse: 2 bits per kmer, set if the kmer has
+  // any traversal path in that orientation. Bit 0 is FORWARD, 1 is REVERSE.
+  uint8_t *traverse_orients;
+  // Optional summary of paths_traverse by colour: bit [hkey*ncols+col] is set
+  // if the kmer may have a traversal path in colour col
+  uint8_t *traverse_cols;
 } GPathStore;
 
 size_t gpath_store_mem(size_t graph_capacity, bool split_linked_lists);
@@ -26,6 +44,12 @@ void gpath_store_alloc(GPathStore *gpstore, size_t ncols, size_t graph_capacity,
 void gpath_store_dealloc(GPathStore *gpstore);
 void gpath_store_reset(GPathStore *gpstore);
 
+// Add changes made by threads since the last call to num_kmers_with_paths,
+// num_paths and path_bytes. Thread safe, but totals are only exact once all
+// threads have finished adding paths. Called at the end of loading and
+// generating paths.
+void gpath_store_sync_stats(GPathStore *gpstore);
+
 void gpath_store_print_stats(const GPathStore *gpstore);
 
 void gpath_store_split_read_write(GPathStore *gpstore);
@@ -37,6 +61,32 @@ void gpath_store_merge_read_write(GPathStore *gpstore);
 GPath* gpath_store_fetch(const GPathStore *gpstore, hkey_t hkey);
 GPath* gpath_store_fetch_traverse(const GPathStore *gpstore, hkey_t hkey);
 
+// Build summary of which orientations each kmer has traversal paths in so that
+// walkers can skip kmers without scanning their linked list. Call after
+// loading paths. Kept up to date by gpath_store_add_mt(), dropped when the
+// read/write lists are merged or the store is reset.
+void gpath_store_build_summary(GPathStore *gpstore, size_t nthreads);
+
+// Build summary of which colours each kmer has traversal paths in, using
+// graph_capacity*ncols bits. Does nothing with only one colour. Paths added with
+// gpath_store_add_mt() set all colours of their kmer; colours added to existing
+// paths are not tracked, so build after paths are loaded. Dropped with the
+// orientation summary.
+void gpath_store_build_col_summary(GPathStore *gpstore, size_t nthreads);
+
+#define gpath_store_summary_orients(gpstore,hkey) \
+        (((gpstore)->traverse_orients[(hkey)/4] >> (2*((hkey)%4))) & 3)
+
+// false only if there are definitely no traversal paths for hkey in `orient`
+#define gpath_store_maybe_has_orient(gpstore,hkey,orient) \
+        ((gpstore)->traverse_orients == NULL || \
+         ((gpath_store_summary_orients(gpstore,hkey) >> (orient)) & 1))
+
+// false only if there are definitely no traversal paths for hkey in `col`
+#define gpath_store_maybe_has_col(gpstore,hkey,col) \
+        ((gpstore)->traverse_cols == NULL || \
+         bitset_get((gpstore)->traverse_cols, (hkey)*(gpstore)->gpset.ncols+(col)))
+
 GPath* gpstore_find(const GPathStore *gpstore, hkey_t hkey, GPathNew find);
 
 // Always adds
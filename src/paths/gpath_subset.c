@@ -5,12 +5,18 @@
 void gpath_subset_alloc(GPathSubset *subset)
 {
   gpath_ptr_buf_alloc(&subset->list, 16);
+  gpath_ptr_buf_alloc(&subset->tmp, 16);
+  size_buf_alloc(&subset->stack, 16);
+  byte_buf_alloc(&subset->colsets, 64);
   gpath_subset_reset(subset);
 }
 
 void gpath_subset_dealloc(GPathSubset *subset)
 {
   gpath_ptr_buf_dealloc(&subset->list);
+  gpath_ptr_buf_dealloc(&subset->tmp);
+  size_buf_dealloc(&subset->stack);
+  byte_buf_dealloc(&subset->colsets);
   memset(subset, 0, sizeof(GPathSubset));
 }
 
@@ -32,9 +38,91 @@ void gpath_subset_add(GPathSubset *subset, GPath *path)
   subset->is_sorted = false;
 }
 
+// Partitions this small are insertion sorted
+#define GPATH_SORT_MIN_RADIX 16
+// Partitions sharing a longer prefix than this are sorted with qsort,
+// to bound recursion depth
+#define GPATH_SORT_MAX_DEPTH 64
+
+// Compare paths that have the same orientation and first `depth` bases
+static inline int _gpath_cmp_from(const GPath *a, const GPath *b, size_t depth)
+{
+  return binary_seqs_cmp_from(gpath_seq(a), a->num_juncs,
+                              gpath_seq(b), b->num_juncs, depth);
+}
+
+static void _gpath_insertion_sort(GPath **list, size_t n, size_t depth)
+{
+  size_t i, j;
+  GPath *gp;
+  for(i = 1; i < n; i++) {
+    gp = list[i];
+    for(j = i; j > 0 && _gpath_cmp_from(list[j-1], gp, depth) > 0; j--)
+      list[j] = list[j-1];
+    list[j] = gp;
+  }
+}
+
+// Bucket 0 is paths that end before `depth`, then 1+base
+static inline size_t _gpath_bucket(const GPath *gp, size_t depth)
+{
+  return depth < gp->num_juncs ? 1 + binary_seq_get(gpath_seq(gp), depth) : 0;
+}
+
+// Sort paths that have the same orientation and first `depth` bases
+// `tmp` must have space for `n` pointers
+static void _gpath_radix_sort(GPath **list, GPath **tmp, size_t n, size_t depth)
+{
+  if(n <= GPATH_SORT_MIN_RADIX) {
+    _gpath_insertion_sort(list, n, depth);
+    return;
+  }
+
+  if(depth >= GPATH_SORT_MAX_DEPTH) {
+    qsort(list, n, sizeof(GPath*), gpath_cmp_void);
+    return;
+  }
+
+  size_t i, b, counts[5] = {0}, starts[5], pos[5];
+
+  for(i = 0; i < n; i++) counts[_gpath_bucket(list[i], depth)]++;
+
+  for(starts[0] = 0, b = 1; b < 5; b++) starts[b] = starts[b-1] + counts[b-1];
+  memcpy(pos, starts, sizeof(pos));
+
+  // Skip the scatter if all paths fall in one bucket
+  if(counts[0] < n && counts[1] < n && counts[2] < n &&
+     counts[3] < n && counts[4] < n) {
+    for(i = 0; i < n; i++) tmp[pos[_gpath_bucket(list[i], depth)]++] = list[i];
+    memcpy(list, tmp, n * sizeof(GPath*));
+  }
+
+  // Paths in bucket 0 are identical
+  for(b = 1; b < 5; b++) {
+    if(counts[b] > 1)
+      _gpath_radix_sort(list+starts[b], tmp+starts[b], counts[b], depth+1);
+  }
+}
+
 void gpath_subset_sort(GPathSubset *subset)
 {
-  qsort(subset->list.b, subset->list.len, sizeof(GPath*), gpath_cmp_void);
+  size_t i, nfw = 0, nrv, n = subset->list.len;
+  GPath **list = subset->list.b, **tmp;
+
+  gpath_ptr_buf_capacity(&subset->tmp, n);
+  tmp = subset->tmp.b;
+
+  // Partition on orientation, forward first
+  for(i = 0; i < n; i++) nfw += (list[i]->orient == FORWARD);
+  for(i = 0, nrv = nfw, nfw = 0; i < n; i++) {
+    if(list[i]->orient == FORWARD) tmp[nfw++] = list[i];
+    else tmp[nrv++] = list[i];
+  }
+  memcpy(list, tmp, n * sizeof(GPath*));
+
+  _gpath_radix_sort(list, tmp, nfw, 0);
+  _gpath_radix_sort(list+nfw, tmp+nfw, n-nfw, 0);
+
   subset->is_sorted = true;
 }
 
@@ -49,7 +137,7 @@ void gpath_subset_load_llist(GPathSubset *subset, GPath *first)
        gpath_set_get_nseen(subset->gpset, first)) {
       gpath_ptr_buf_add(&subset->list, first);
     }
-    first = first->next;
+    first = gpath_next(first);
   }
 }
 
@@ -70,8 +158,8 @@ void gpath_subset_update_linkedlist(GPathSubset *subset)
   if(subset->list.len == 0) return;
   size_t i;
   for(i = 0; i+1 < subset->list.len; i++)
-    subset->list.b[i]->next = subset->list.b[i+1];
-  subset->list.b[subset->list.len-1]->next = NULL;
+    gpath_set_next(subset->list.b[i], subset->list.b[i+1]);
+  gpath_set_next(subset->list.b[subset->list.len-1], NULL);
 }
 
 /**
@@ -102,6 +190,14 @@ void gpath_subset_rmdup(GPathSubset *subset)
   subset->list.len = i+1;
 }
 
+// Returns true if `a` is a prefix of (or equal to) `b`
+static inline bool _gpath_is_prefix(const GPath *a, const GPath *b)
+{
+  return a->orient == b->orient && a->num_juncs <= b->num_juncs &&
+         binary_seqs_cmp(gpath_seq(a), a->num_juncs,
+                         gpath_seq(b), a->num_juncs) == 0;
+}
+
 /**
  * Remove redundant entries such as duplicates and substrings e.g.
  *  {T,TT,TT} -> {TT}
@@ -112,45 +208,59 @@ void gpath_subset_rmsubstr(GPathSubset *subset)
   if(subset->list.len <= 1) return;
   if(!subset->is_sorted) gpath_subset_sort(subset);
 
-  size_t i, j, len = subset->list.len, min_juncs, ncols = subset->gpset->ncols;
+  size_t i, j, k, top, len = subset->list.len, ncols = subset->gpset->ncols;
+  size_t nbytes = (ncols+7)/8, depth = 0;
   GPath **list = subset->list.b;
+  uint8_t *colset, *ucols;
+
+  // In sorted order a path comes after its prefixes and before any paths
+  // that do not start with it. Keep a stack of the prefixes of the current
+  // path, each with the union of colours of all paths that extend it.
+  // Popping a path removes those colours from it and passes them down.
+  size_buf_capacity(&subset->stack, len);
+  byte_buf_capacity(&subset->colsets, len * nbytes);
+  size_t *stack = subset->stack.b;
+  uint8_t *ucolsets = subset->colsets.b;
+
+  for(i = 0; i <= len; i++)
+  {
+    // Pop paths that are not a prefix of path i
+    while(depth > 0 &&
+          (i == len || !_gpath_is_prefix(list[stack[depth-1]], list[i])))
+    {
+      top = stack[--depth];
+      colset = gpath_get_colset(list[top], ncols);
+      ucols = ucolsets + depth*nbytes;
 
-  // Work backwards to remove colours from subsumed paths
-  for(i = len-1; i > 0; i--) {
-    if(list[i] != NULL) {
-      // work backwards over paths as j as they match
-      for(j = i-1; j != SIZE_MAX; j--)
-      {
-        if(list[j] != NULL)
-        {
-          min_juncs = MIN2(list[i]->num_juncs, list[j]->num_juncs);
-
-          // j can't be a subset of i if it's longer,
-          // or orientations don't match
-          if(list[i]->num_juncs < list[j]->num_juncs ||
-             list[i]->orient != list[j]->orient ||
-             binary_seqs_cmp(list[i]->seq, min_juncs,
-                             list[j]->seq, min_juncs) != 0)
-          {
-            break;
-          }
-          else if(list[i]->num_juncs == list[j]->num_juncs)
-          {
-            // paths match, steal colours from j and remove it
-            gpath_colset_or_mt(list[i], list[j], ncols);
-            gpath_set_nseen_sum_mt(list[i], subset->gpset,
-                                   list[j], subset->gpset);
-            list[j] = NULL;
-          }
-          else
-          {
-            // path j is substring of i, remove colours from j that are in i
-            // then remove path j only if all colours removed
-            if(gpath_colset_rm_intersect(list[i], list[j], ncols) == 0)
-              list[j] = NULL;
-          }
-        }
+      if(depth > 0) {
+        for(k = 0; k < nbytes; k++)
+          ucolsets[(depth-1)*nbytes+k] |= ucols[k] | colset[k];
       }
+
+      // Remove colours found in longer paths, drop path if none left
+      uint8_t colset_or = 0;
+      for(k = 0; k < nbytes; k++) {
+        colset[k] &= ~ucols[k];
+        colset_or |= colset[k];
+      }
+      if(!colset_or) list[top] = NULL;
+    }
+
+    if(i == len) break;
+
+    if(depth > 0 && list[stack[depth-1]]->num_juncs == list[i]->num_juncs)
+    {
+      // paths match, steal colours from the previous copy and remove it
+      j = stack[depth-1];
+      gpath_colset_or_mt(list[i], list[j], ncols);
+      gpath_set_nseen_sum_mt(list[i], subset->gpset,
+                             list[j], subset->gpset);
+      list[j] = NULL;
+      stack[depth-1] = i;
+    }
+    else {
+      memset(ucolsets + depth*nbytes, 0, nbytes);
+      stack[depth++] = i;
     }
   }
 
@@ -3,6 +3,7 @@
 
 #include "gpath.h"
 #include "gpath_set.h"
+#include "common_buffers.h"
 
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(gpath_ptr_buf, GPathPtrBuffer, GPath*);
@@ -12,6 +13,10 @@ typedef struct
   GPathSet *gpset;
   GPathPtrBuffer list; // Sort and remove entries from this array
   bool is_sorted;
+  // Temporary memory for sorting and removing substrings
+  GPathPtrBuffer tmp;
+  SizeBuffer stack;
+  ByteBuffer colsets;
 } GPathSubset;
 
 void gpath_subset_alloc(GPathSubset *subset);
@@ -19,6 +24,10 @@ void gpath_subset_dealloc(GPathSubset *subset);
 void gpath_subset_reset(GPathSubset *subset);
 void gpath_subset_init(GPathSubset *subset, GPathSet *gpset);
 void gpath_subset_add(GPathSubset *subset, GPath *path);
+
+// Sort paths in the order of gpath_cmp(): by orientation then junction bases,
+// shorter paths first. MSD radix sort over junction bases, with insertion sort
+// for small partitions.
 void gpath_subset_sort(GPathSubset *subset);
 
 // Load linked list pointed to by first. If NULL load nothing.
@@ -43,6 +52,8 @@ void gpath_subset_rmdup(GPathSubset *subset);
  * Remove redundant entries such as duplicates and substrings e.g.
  *  {T,TT,TT} -> {TT}
  *  {A,C,CG,CGC} -> {A,CGC}
+ * A path loses colours found in any path it is a substring of, and is removed
+ * once it has no colours left. Runs in a single pass over the sorted list.
  */
 void gpath_subset_rmsubstr(GPathSubset *subset);
 
@@ -0,0 +1,253 @@
+#include "global.h"
+#include "gpath_trie.h"
+#include "gpath_subset.h"
+#include "binary_seq.h"
+#include "util.h"
+
+#define gptrie_term_bytes(trie) \
+        ((trie)->colset_bytes + ((trie)->count_nseen ? (trie)->ncols : 0))
+
+size_t gpath_trie_mem(size_t graph_capacity)
+{
+  return 2 * graph_capacity * sizeof(uint32_t);
+}
+
+void gpath_trie_alloc(GPathTrie *trie, size_t ncols, size_t graph_capacity,
+                      bool count_nseen)
+{
+  memset(trie, 0, sizeof(*trie));
+  trie->ncols = ncols;
+  trie->colset_bytes = (ncols+7)/8;
+  trie->graph_capacity = graph_capacity;
+  trie->count_nseen = count_nseen;
+  trie->roots = ctx_malloc(gpath_trie_mem(graph_capacity));
+  memset(trie->roots, 0xff, gpath_trie_mem(graph_capacity)); // GPATH_TRIE_NULL
+  gptrie_node_buf_alloc(&trie->nodes, 1024);
+  byte_buf_alloc(&trie->colsets, 1024 * trie->colset_bytes);
+  byte_buf_alloc(&trie->terms, 1024 * gptrie_term_bytes(trie));
+  byte_buf_alloc(&trie->seqs, 1024);
+}
+
+void gpath_trie_dealloc(GPathTrie *trie)
+{
+  ctx_free(trie->roots);
+  gptrie_node_buf_dealloc(&trie->nodes);
+  byte_buf_dealloc(&trie->colsets);
+  byte_buf_dealloc(&trie->terms);
+  byte_buf_dealloc(&trie->seqs);
+  memset(trie, 0, sizeof(*trie));
+}
+
+void gpath_trie_reset(GPathTrie *trie)
+{
+  memset(trie->roots, 0xff, gpath_trie_mem(trie->graph_capacity));
+  gptrie_node_buf_reset(&trie->nodes);
+  byte_buf_reset(&trie->colsets);
+  byte_buf_reset(&trie->terms);
+  byte_buf_reset(&trie->seqs);
+  trie->num_seq_bases = trie->num_links = 0;
+}
+
+size_t gpath_trie_bytes(const GPathTrie *trie)
+{
+  return gpath_trie_mem(trie->graph_capacity) +
+         trie->nodes.len * sizeof(GPathTrieNode) +
+         trie->colsets.len + trie->terms.len + trie->seqs.len;
+}
+
+void gpath_trie_print_stats(const GPathTrie *trie)
+{
+  char links_str[50], nodes_str[50], bases_str[50], bytes_str[50];
+  ulong_to_str(trie->num_links, links_str);
+  ulong_to_str(trie->nodes.len, nodes_str);
+  ulong_to_str(trie->num_seq_bases, bases_str);
+  bytes_to_str(gpath_trie_bytes(trie), 1, bytes_str);
+  status("[GPathTrie] links: %s, nodes: %s, junctions: %s, bytes: %s",
+         links_str, nodes_str, bases_str, bytes_str);
+}
+
+// Append `n` zero'd bytes to a buffer, returns offset of the first
+static inline size_t _trie_buf_extend(ByteBuffer *buf, size_t n)
+{
+  size_t offset = buf->len;
+  byte_buf_capacity(buf, buf->len + n);
+  memset(buf->b + offset, 0, n);
+  buf->len += n;
+  return offset;
+}
+
+// Reserve `n` contiguous nodes, returns index of the first
+static inline uint32_t _trie_new_nodes(GPathTrie *trie, size_t n)
+{
+  size_t first = trie->nodes.len;
+  if(first + n >= GPATH_TRIE_NULL) die("Too many GPathTrie nodes");
+  gptrie_node_buf_capacity(&trie->nodes, first + n);
+  memset(trie->nodes.b + first, 0, n * sizeof(GPathTrieNode));
+  trie->nodes.len += n;
+  _trie_buf_extend(&trie->colsets, n * trie->colset_bytes);
+  return (uint32_t)first;
+}
+
+static inline void _trie_colset_or(uint8_t *dst, const uint8_t *src, size_t n)
+{
+  size_t i;
+  for(i = 0; i < n; i++) dst[i] |= src[i];
+}
+
+// Fill node `idx` from `paths`, which are sorted and all share their first
+// `start` junctions. The edge into the node starts at junction `start`.
+static void _trie_fill_node(GPathTrie *trie, const GPathSet *gpset,
+                            GPath *const*paths, size_t n, size_t start,
+                            uint32_t idx)
+{
+  const size_t cbytes = trie->colset_bytes, ncols = trie->ncols;
+  size_t i, j, end = start, nchildren = 0;
+
+  // Extend the edge while no link ends and all links take the same junction.
+  // Links are sorted, so a link ending here would be first and the first and
+  // last links differ if any do.
+  while(paths[0]->num_juncs > end &&
+        binary_seq_get(gpath_seq(paths[0]), end) ==
+        binary_seq_get(gpath_seq(paths[n-1]), end)) end++;
+
+  if(end - start > GPATH_MAX_JUNCS) die("Link too long for GPathTrie");
+
+  // Copy edge junctions
+  size_t seqpos = trie->num_seq_bases;
+  size_t nbytes = binary_seq_mem(seqpos + end - start);
+  if(nbytes > trie->seqs.len) _trie_buf_extend(&trie->seqs, nbytes - trie->seqs.len);
+  for(i = start; i < end; i++)
+    binary_seq_set(trie->seqs.b, trie->num_seq_bases++,
+                   binary_seq_get(gpath_seq(paths[0]), i));
+
+  // Links that end at this node
+  uint32_t term = 0;
+  for(i = 0; i < n && paths[i]->num_juncs == end; i++) {
+    if(!term) {
+      term = _trie_buf_extend(&trie->terms, gptrie_term_bytes(trie)) /
+             gptrie_term_bytes(trie) + 1;
+      trie->num_links++;
+    }
+    uint8_t *tdata = trie->terms.b + (term-1)*gptrie_term_bytes(trie);
+    _trie_colset_or(tdata, gpath_get_colset(paths[i], ncols), cbytes);
+    if(trie->count_nseen && gpath_set_has_nseen(gpset)) {
+      const uint8_t *nseen = gpath_set_get_nseen(gpset, paths[i]);
+      for(j = 0; j < ncols; j++)
+        tdata[cbytes+j] = MIN2((size_t)tdata[cbytes+j] + nseen[j], UINT8_MAX);
+    }
+  }
+
+  // Count children, links are grouped by their junction at `end`
+  for(j = i; j < n; j++)
+    if(j == i || binary_seq_get(gpath_seq(paths[j]), end) !=
+                 binary_seq_get(gpath_seq(paths[j-1]), end)) nchildren++;
+
+  uint32_t children = nchildren ? _trie_new_nodes(trie, nchildren) : 0;
+
+  GPathTrieNode *node = gpath_trie_node(trie, idx);
+  node->seqpos = seqpos;
+  node->len = end - start;
+  node->children = children;
+  node->term = term;
+  node->nchildren = nchildren;
+
+  if(term) {
+    _trie_colset_or(gpath_trie_node_colset(trie, idx),
+                    trie->terms.b + (term-1)*gptrie_term_bytes(trie), cbytes);
+  }
+
+  // Build children, buffers may be reallocated so don't hold pointers
+  uint32_t child = children;
+  for(; i < n; i = j, child++) {
+    Nucleotide base = binary_seq_get(gpath_seq(paths[i]), end);
+    for(j = i+1; j < n && binary_seq_get(gpath_seq(paths[j]), end) == base; j++);
+    _trie_fill_node(trie, gpset, paths+i, j-i, end, child);
+    _trie_colset_or(gpath_trie_node_colset(trie, idx),
+                    gpath_trie_node_colset(trie, child), cbytes);
+  }
+}
+
+static int _gpath_ptr_cmp(const void *aa, const void *bb)
+{
+  const GPath *a = *(const GPath *const*)aa, *b = *(const GPath *const*)bb;
+  return gpath_cmp(a, b);
+}
+
+void gpath_trie_build(GPathTrie *trie, const GPathStore *gpstore)
+{
+  ctx_assert(trie->ncols == gpstore->gpset.ncols);
+  ctx_assert(trie->graph_capacity == gpstore->graph_capacity);
+  ctx_assert(trie->nodes.len == 0);
+
+  GPathPtrBuffer list;
+  gpath_ptr_buf_alloc(&list, 64);
+  hkey_t hkey;
+  size_t i, j;
+
+  for(hkey = 0; hkey < gpstore->graph_capacity; hkey++)
+  {
+    GPath *gpath = gpath_store_use_traverse(gpstore)
+                     ? gpath_store_fetch_traverse(gpstore, hkey)
+                     : gpath_store_fetch(gpstore, hkey);
+    if(gpath == NULL) continue;
+
+    gpath_ptr_buf_reset(&list);
+    for(; gpath != NULL; gpath = gpath_next(gpath))
+      gpath_ptr_buf_add(&list, gpath);
+
+    // Sorts by orientation then junctions
+    qsort(list.b, list.len, sizeof(GPath*), _gpath_ptr_cmp);
+
+    for(i = 0; i < list.len; i = j) {
+      for(j = i+1; j < list.len && list.b[j]->orient == list.b[i]->orient; j++);
+      uint32_t root = _trie_new_nodes(trie, 1);
+      gpath_trie_root(trie, hkey, list.b[i]->orient) = root;
+      _trie_fill_node(trie, &gpstore->gpset, list.b+i, j-i, 0, root);
+    }
+  }
+
+  gpath_ptr_buf_dealloc(&list);
+}
+
+const uint8_t* gpath_trie_term_colset(const GPathTrie *trie, uint32_t idx)
+{
+  const GPathTrieNode *node = gpath_trie_node(trie, idx);
+  if(!node->term) return NULL;
+  return trie->terms.b + (node->term-1)*gptrie_term_bytes(trie);
+}
+
+const uint8_t* gpath_trie_term_nseen(const GPathTrie *trie, uint32_t idx)
+{
+  const uint8_t *colset = gpath_trie_term_colset(trie, idx);
+  return colset && trie->count_nseen ? colset + trie->colset_bytes : NULL;
+}
+
+bool gpath_trie_has(const GPathTrie *trie, hkey_t hkey, Orientation orient,
+                    const uint8_t *seq, size_t num_juncs, size_t col)
+{
+  uint32_t idx = gpath_trie_root(trie, hkey, orient);
+  size_t i, pos = 0;
+  const GPathTrieNode *node;
+
+  while(idx != GPATH_TRIE_NULL)
+  {
+    node = gpath_trie_node(trie, idx);
+    if(pos + node->len > num_juncs) return false;
+    for(i = 0; i < node->len; i++, pos++)
+      if(gpath_trie_node_base(trie, idx, i) != binary_seq_get(seq, pos))
+        return false;
+
+    if(pos == num_juncs) {
+      const uint8_t *colset = gpath_trie_term_colset(trie, idx);
+      return colset && bitset_get(colset, col);
+    }
+
+    // Find child by its first junction
+    Nucleotide base = binary_seq_get(seq, pos);
+    for(i = 0; i < node->nchildren; i++)
+      if(gpath_trie_node_base(trie, node->children+i, 0) == base) break;
+    idx = i < node->nchildren ? node->children+i : GPATH_TRIE_NULL;
+  }
+
+  return false;
+}
@@ -0,0 +1,88 @@
+#ifndef GPATH_TRIE_H_
+#define GPATH_TRIE_H_
+
+#include "gpath_store.h"
+
+//
+// Read-only, prefix-shared copy of the links in a GPathStore
+//
+// Links on the same kmer in the same orientation often share long prefixes of
+// junction choices, which GPathSet stores once per link. GPathTrie stores each
+// kmer/orientation's links as a radix trie of junction choices instead: a
+// node holds the run of junctions on the edge into it, links ending at a node
+// keep their colset and counts there, and each node has the set of colours of
+// links below it so walkers can skip links not in their colour.
+//
+// Built once from a GPathStore after loading, then the store can be freed.
+// Followed with a GPathTrieFollow cursor (see gpath_follow.h), which stands in
+// for every link on a kmer at once.
+//
+
+#define GPATH_TRIE_NULL UINT32_MAX
+
+typedef struct
+{
+  uint64_t seqpos:48, len:16; // edge: bases [seqpos, seqpos+len) of trie seqs
+  uint32_t children; // index of first child, children are contiguous
+  uint32_t term; // 1 + index of links ending at this node, 0 if none
+  uint8_t nchildren; // children sorted by first base, at most 4
+} __attribute__((packed)) GPathTrieNode;
+
+#include "madcrowlib/madcrow_buffer.h"
+madcrow_buffer(gptrie_node_buf, GPathTrieNodeBuffer, GPathTrieNode);
+
+typedef struct
+{
+  size_t ncols, colset_bytes;
+  uint64_t graph_capacity;
+  uint32_t *roots; // 2 per kmer: [hkey*2+orient], GPATH_TRIE_NULL if no links
+  GPathTrieNodeBuffer nodes;
+  ByteBuffer colsets; // colset_bytes per node: colours of links in subtree
+  ByteBuffer terms; // per terminal: colset_bytes of colset, then ncols counts
+  ByteBuffer seqs; // packed junction choices of all edges (4 per byte)
+  uint64_t num_seq_bases, num_links;
+  bool count_nseen;
+} GPathTrie;
+
+// Bytes needed for roots
+size_t gpath_trie_mem(size_t graph_capacity);
+
+void gpath_trie_alloc(GPathTrie *trie, size_t ncols, size_t graph_capacity,
+                      bool count_nseen);
+void gpath_trie_dealloc(GPathTrie *trie);
+void gpath_trie_reset(GPathTrie *trie);
+
+// Add the links of a GPathStore, using the traversal lists if split.
+// Trie must be empty and have the same capacity and number of colours.
+void gpath_trie_build(GPathTrie *trie, const GPathStore *gpstore);
+
+void gpath_trie_print_stats(const GPathTrie *trie);
+
+// Total bytes used by the trie
+size_t gpath_trie_bytes(const GPathTrie *trie);
+
+#define gpath_trie_root(trie,hkey,orient) ((trie)->roots[2*(hkey)+(orient)])
+#define gpath_trie_node(trie,idx) (&(trie)->nodes.b[idx])
+#define gpath_trie_node_colset(trie,idx) \
+        ((trie)->colsets.b + (size_t)(idx)*(trie)->colset_bytes)
+
+// junction `i` on the edge into node `idx`
+static inline Nucleotide gpath_trie_node_base(const GPathTrie *trie,
+                                              uint32_t idx, size_t i)
+{
+  const GPathTrieNode *node = gpath_trie_node(trie, idx);
+  ctx_assert(i < node->len);
+  return binary_seq_get(trie->seqs.b, node->seqpos + i);
+}
+
+// Colset of links ending at node `idx`, NULL if none end there
+const uint8_t* gpath_trie_term_colset(const GPathTrie *trie, uint32_t idx);
+
+// Counts of links ending at node `idx`, NULL if none end there or not counted
+const uint8_t* gpath_trie_term_nseen(const GPathTrie *trie, uint32_t idx);
+
+// Find a link, returns true if it is in the trie in colour `col`
+bool gpath_trie_has(const GPathTrie *trie, hkey_t hkey, Orientation orient,
+                    const uint8_t *seq, size_t num_juncs, size_t col);
+
+#endif /* GPATH_TRIE_H_ */
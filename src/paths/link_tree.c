@@ -17,6 +17,7 @@ void ltree_alloc(LinkTree *tree, size_t kmer_size)
 void ltree_dealloc(LinkTree *tree)
 {
   lj_buf_dealloc(&tree->treebuf);
+  byte_buf_dealloc(&tree->seqbuf);
   ltree_walk_buf_dealloc(&tree->wbuf);
   memset(tree, 0, sizeof(*tree));
   tree->fw_id = tree->rv_id = -1;
@@ -95,6 +96,58 @@ void ltree_add(LinkTree *tree,
 }
 
 
+//
+// LinkTreeStore
+//
+
+void ltree_store_alloc(LinkTreeStore *store)
+{
+  lj_buf_alloc(&store->nodes, 1024);
+  byte_buf_alloc(&store->seqs, 4096);
+  ltree_entry_buf_alloc(&store->trees, 256);
+}
+
+void ltree_store_dealloc(LinkTreeStore *store)
+{
+  lj_buf_dealloc(&store->nodes);
+  byte_buf_dealloc(&store->seqs);
+  ltree_entry_buf_dealloc(&store->trees);
+}
+
+size_t ltree_store_add(LinkTreeStore *store, const LinkTree *tree)
+{
+  ctx_assert(tree->treebuf.len <= UINT32_MAX);
+  ctx_assert(tree->seqbuf.len <= UINT32_MAX);
+  LTreeStoreEntry entry = {.node_offset = store->nodes.len,
+                           .seq_offset = store->seqs.len,
+                           .num_nodes = tree->treebuf.len,
+                           .seq_len = tree->seqbuf.len,
+                           .fw_id = tree->fw_id, .rv_id = tree->rv_id};
+  lj_buf_push(&store->nodes, tree->treebuf.b, tree->treebuf.len);
+  byte_buf_push(&store->seqs, tree->seqbuf.b, tree->seqbuf.len);
+  return ltree_entry_buf_add(&store->trees, entry);
+}
+
+void ltree_store_fetch(const LinkTreeStore *store, size_t idx, LinkTree *tree)
+{
+  const LTreeStoreEntry *entry = &store->trees.b[idx];
+  ltree_reset(tree);
+  lj_buf_push(&tree->treebuf, store->nodes.b + entry->node_offset,
+              entry->num_nodes);
+  byte_buf_push(&tree->seqbuf, store->seqs.b + entry->seq_offset,
+                entry->seq_len);
+  tree->fw_id = entry->fw_id;
+  tree->rv_id = entry->rv_id;
+}
+
+void ltree_store_update(LinkTreeStore *store, size_t idx, const LinkTree *tree)
+{
+  const LTreeStoreEntry *entry = &store->trees.b[idx];
+  ctx_assert(tree->treebuf.len == entry->num_nodes);
+  memcpy(store->nodes.b + entry->node_offset, tree->treebuf.b,
+         entry->num_nodes * sizeof(LinkJunction));
+}
+
 //
 // Tree Walking
 //
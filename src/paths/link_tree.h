@@ -42,6 +42,23 @@ typedef struct
   LTreeWalkBuffer wbuf; // iterator
 } LinkTree;
 
+// Many link trees stored back to back, so they can be processed more than once
+typedef struct
+{
+  size_t node_offset, seq_offset;
+  uint32_t num_nodes, seq_len;
+  LTreeID fw_id, rv_id;
+} LTreeStoreEntry;
+
+madcrow_buffer(ltree_entry_buf, LTreeEntryBuffer, LTreeStoreEntry);
+
+typedef struct
+{
+  LJBuffer nodes;
+  ByteBuffer seqs;
+  LTreeEntryBuffer trees;
+} LinkTreeStore;
+
 #define ltree_get_node(tree,id) ((id) < 0 ? NULL : (tree)->treebuf.b + (id))
 #define ltree_get_fw_node(tree) ltree_get_node(tree,(tree)->fw_id)
 #define ltree_get_rv_node(tree) ltree_get_node(tree,(tree)->rv_id)
@@ -58,6 +75,26 @@ void ltree_add(LinkTree *tree,
                bool fw, size_t covg, size_t *dists,
                const char *juncs, const char *seq);
 
+//
+// LinkTreeStore
+//
+void ltree_store_alloc(LinkTreeStore *store);
+void ltree_store_dealloc(LinkTreeStore *store);
+
+#define ltree_store_num_trees(store) ((store)->trees.len)
+
+// Copy a tree into the store, returns its index
+size_t ltree_store_add(LinkTreeStore *store, const LinkTree *tree);
+
+// Replace contents of `tree` with tree `idx` from the store
+// Threadsafe with other fetch/update calls
+void ltree_store_fetch(const LinkTreeStore *store, size_t idx, LinkTree *tree);
+
+// Copy counts back to tree `idx` after editing (e.g. ltree_clean()).
+// `tree` must have been fetched from `idx` and not had links added.
+// Threadsafe for different trees
+void ltree_store_update(LinkTreeStore *store, size_t idx, const LinkTree *tree);
+
 //
 // Whole tree operations
 //
@@ -3,6 +3,8 @@
 #include "db_graph.h"
 #include "dna.h"
 
+#include <unistd.h> // close
+
 // Common functions here
 FILE *ctx_tst_out = NULL;
 
@@ -53,6 +55,21 @@ void bitarr_tostr(const uint8_t *arr, size_t len, char *str)
   *str = '\0';
 }
 
+//
+// Temporary files
+//
+bool test_tmp_file(char *path, const char *name, const char *ext)
+{
+  int n = snprintf(path, TEST_TMP_PATH_LEN, "/tmp/ctx_%s_XXXXXX%s", name, ext);
+  ctx_assert(n > 0 && n < TEST_TMP_PATH_LEN);
+  (void)n;
+  int fd = mkstemps(path, (int)strlen(ext));
+  TASSERT2(fd != -1, "Cannot create temp file %s: %s", path, strerror(errno));
+  if(fd == -1) return false;
+  close(fd);
+  return true;
+}
+
 //
 // Graph setup
 //
@@ -86,6 +103,7 @@ void all_tests_add_paths_multi(dBGraph *graph, const char **seqs, size_t nseqs,
     seq_read_set(&iodata.r1, seqs[i]);
     gen_paths_worker_seq(wrkrs, &iodata, &task);
   }
+  gpath_store_sync_stats(&graph->gpstore);
 
   asynciodata_dealloc(&iodata);
   gen_paths_workers_dealloc(wrkrs, nworkers);
@@ -6,6 +6,7 @@
 #include "correct_alignment.h"
 #include "build_graph.h"
 #include "generate_paths.h"
+#include "file_util.h"
 
 #include "seq_file/seq_file.h"
 
@@ -68,6 +69,25 @@ static inline void seq_read_set(read_t *r, const char *s) {
   r->seq.end = len;
 }
 
+//
+// Temporary files
+//
+#define TEST_TMP_PATH_LEN 200
+
+// Create an empty file /tmp/ctx_<name>_XXXXXX<ext>, writing its path to `path`
+// (TEST_TMP_PATH_LEN bytes). Returns false after failing a test on error.
+// Caller must unlink the file.
+bool test_tmp_file(char *path, const char *name, const char *ext);
+
+// Run `stmt` with futil force on, so it may overwrite a file made by
+// test_tmp_file()
+#define test_with_force(stmt) do {                                             \
+  bool _force = futil_get_force();                                             \
+  futil_set_force(true);                                                       \
+  stmt;                                                                        \
+  futil_set_force(_force);                                                     \
+} while(0)
+
 //
 // Graph setup
 //
@@ -109,6 +129,9 @@ void test_binary_seq_functions();
 // hash_table_tests.c
 void test_hash_table();
 
+// graph_block_tests.c
+void test_graph_block();
+
 // db_node_tests.c
 void test_db_node();
 
@@ -117,6 +140,8 @@ void test_build_graph();
 
 // db_unitig_tests.c
 void test_db_unitig();
+void test_unitig_index();
+void test_unitig_map();
 
 // cleaning_tests.c
 void test_cleaning();
@@ -124,6 +149,9 @@ void test_cleaning();
 // subgraph_tests.c
 void test_subgraph();
 
+// pop_bubbles_tests.c
+void test_pop_bubbles();
+
 // path_tests.c
 void test_paths();
 
@@ -151,4 +179,40 @@ void test_graph_crawler();
 // infer_edges_tests.c
 void test_infer_edges_tests();
 
+// ref_cache_tests.c
+void test_ref_cache();
+
+// graph_snapshot_tests.c
+void test_graph_snapshot();
+
+// fastq_block_tests.c
+void test_fastq_block();
+
+// query_graph_tests.c
+void test_query_graph();
+
+// grow_graph_tests.c
+void test_grow_graph();
+
+// kmer_hll_tests.c
+void test_kmer_hll();
+
+// async_file_tests.c
+void test_async_file();
+
+// kmer_fpindex_tests.c
+void test_kmer_fpindex();
+
+// remote_file_tests.c
+void test_remote_file();
+
+// graph_footer_tests.c
+void test_graph_footer();
+
+// seq_inflate_tests.c
+void test_seq_inflate();
+
+// graphs_load_tests.c
+void test_graphs_load();
+
 #endif  /* ALL_TESTS_H_ */
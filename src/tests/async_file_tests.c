@@ -0,0 +1,91 @@
+#include "global.h"
+#include "all_tests.h"
+#include "async_file.h"
+
+#include <unistd.h> // unlink
+
+#define ASYNC_TEST_BYTES (5*ASYNC_FILE_ALIGN + 123)
+
+static uint8_t async_test_byte(size_t i) { return (uint8_t)(i * 7 + i / 251); }
+
+// Write with a mix of small and large fwrite()s, rewriting the start at the end
+static void _test_async_write(const char *path)
+{
+  uint8_t buf[3000];
+  size_t i, j, n;
+
+  FILE *fh = async_file_fopen(path, "w");
+  TASSERT(ftell(fh) == 0);
+
+  // Write zeros first, overwritten after seeking back
+  memset(buf, 0, 100);
+  TASSERT(fwrite(buf, 1, 100, fh) == 100);
+
+  for(i = 100; i < ASYNC_TEST_BYTES; i += n) {
+    n = MIN2((i % 3 ? 1 + i % 17 : sizeof(buf)), ASYNC_TEST_BYTES - i);
+    for(j = 0; j < n; j++) buf[j] = async_test_byte(i+j);
+    TASSERT(fwrite(buf, 1, n, fh) == n);
+  }
+  TASSERT(ftell(fh) == ASYNC_TEST_BYTES);
+
+  TASSERT(fseek(fh, 0, SEEK_SET) == 0);
+  for(j = 0; j < 100; j++) buf[j] = async_test_byte(j);
+  TASSERT(fwrite(buf, 1, 100, fh) == 100);
+  TASSERT(fclose(fh) == 0);
+}
+
+static void _test_async_read(const char *path)
+{
+  uint8_t buf[3000];
+  size_t i, j, n, offsets[] = {ASYNC_TEST_BYTES-10, 10, 4*ASYNC_FILE_ALIGN+1, 0};
+  bool match = true;
+
+  FILE *fh = async_file_fopen(path, "r");
+
+  // Read whole file in odd sized chunks
+  for(i = 0; i < ASYNC_TEST_BYTES; i += n) {
+    n = fread(buf, 1, 1 + (i % 2 ? i % 29 : 2999), fh);
+    TASSERT(n > 0);
+    if(n == 0) break;
+    for(j = 0; j < n; j++) match &= (buf[j] == async_test_byte(i+j));
+  }
+  TASSERT(match);
+  TASSERT(i == ASYNC_TEST_BYTES);
+  TASSERT(fread(buf, 1, 1, fh) == 0 && feof(fh));
+
+  // Seek around
+  for(i = 0; i < sizeof(offsets)/sizeof(offsets[0]); i++) {
+    TASSERT(fseek(fh, offsets[i], SEEK_SET) == 0);
+    TASSERT(ftell(fh) == (long)offsets[i]);
+    n = fread(buf, 1, sizeof(buf), fh);
+    TASSERT(n == MIN2(sizeof(buf), ASYNC_TEST_BYTES - offsets[i]));
+    for(j = 0; j < n; j++) match &= (buf[j] == async_test_byte(offsets[i]+j));
+    TASSERT(match);
+  }
+
+  TASSERT(async_file_fileno(fh) >= 0);
+  TASSERT(fclose(fh) == 0);
+}
+
+void test_async_file()
+{
+  test_status("Testing async file streams...");
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!test_tmp_file(path, "async_file_test", ".bin")) return;
+
+  // Smallest buffers so reads and writes cross many buffers
+  async_file_enable(ASYNC_FILE_ALIGN, false);
+  TASSERT(async_file_enabled());
+  _test_async_write(path);
+  _test_async_read(path);
+
+  // O_DIRECT falls back to cached reads if not supported
+  async_file_enable(ASYNC_FILE_ALIGN, true);
+  _test_async_read(path);
+
+  async_file_disable();
+  _test_async_read(path);
+
+  unlink(path);
+}
@@ -1,6 +1,7 @@
 #include "global.h"
 #include "all_tests.h"
 #include "binary_seq.h"
+#include "cpu_dispatch.h"
 
 #define NTESTS 200
 #define TLEN 256 /* power of two */
@@ -40,6 +41,48 @@ static void test_binary_seq_cmp()
   }
 }
 
+// Compare one base at a time
+static int _binary_seqs_cmp_naive(const uint8_t *arr0, size_t len0,
+                                  const uint8_t *arr1, size_t len1, size_t start)
+{
+  size_t i, len = MIN2(len0, len1);
+  int ret;
+  for(i = start; i < len; i++)
+    if((ret = binary_seq_get(arr0, i) - binary_seq_get(arr1, i)) != 0) return ret;
+  return cmp(len0, len1);
+}
+
+// Long random sequences that differ at a random base, so SIMD versions are
+// used for some of the comparison
+static void test_binary_seqs_cmp_random()
+{
+  test_status("Testing binary_seqs_cmp() [simd=%s]", binary_seq_simd_str());
+
+  uint8_t a[TLEN], b[TLEN];
+  size_t t, lena, lenb, diff, start;
+  int exp, got;
+
+  for(t = 0; t < NTESTS; t++) {
+    rand_bytes(a, TLEN);
+    memcpy(b, a, TLEN);
+    lena = rand() % (4*TLEN+1);
+    lenb = (rand() & 1) ? lena : (size_t)rand() % (4*TLEN+1);
+    if(rand() & 1) {
+      diff = rand() % (4*TLEN);
+      binary_seq_set(b, diff, (binary_seq_get(b, diff) + 1 + rand() % 3) & 3);
+    }
+
+    exp = _binary_seqs_cmp_naive(a, lena, b, lenb, 0);
+    got = binary_seqs_cmp(a, lena, b, lenb);
+    TASSERT2(int2cmp(exp) == int2cmp(got), "%i vs %i", exp, got);
+
+    start = rand() % (4*TLEN+1);
+    exp = _binary_seqs_cmp_naive(a, lena, b, lenb, start);
+    got = binary_seqs_cmp_from(a, lena, b, lenb, start);
+    TASSERT2(int2cmp(exp) == int2cmp(got), "%i vs %i start: %zu", exp, got, start);
+  }
+}
+
 static void test_binary_seq_rev_cmp()
 {
   test_status("binary_seq_reverse_complement() binary_seq_to_str()");
@@ -111,7 +154,7 @@ static void test_binary_seq_str()
 
 static void test_binary_seq_cpy()
 {
-  test_status("Testing shift copy");
+  test_status("Testing shift copy [simd=%s]", binary_seq_simd_str());
 
   uint8_t d0[10] = {0,0,0,0,0,0,0,0,0,0};
   uint8_t out[100];
@@ -138,7 +181,7 @@ static void test_binary_seq_cpy()
     memset(fast, 0xff, TLEN);
     rand_bytes(in, TLEN);
 
-    len = rand() % (TLEN/2+1);
+    len = rand() % (4*TLEN+1);
     shift = rand() % 4;
     // printf("len: %zu shift: %zu\n", len, shift);
 
@@ -180,7 +223,8 @@ static void print_nucs(Nucleotide *nucs, size_t len) {
 
 static void test_pack_unpack()
 {
-  test_status("Testing binary_seq_pack() / binary_seq_unpack()");
+  test_status("Testing binary_seq_pack() / binary_seq_unpack() [simd=%s]",
+              binary_seq_simd_str());
 
   uint8_t packed[TLEN];
   Nucleotide bases0[TLEN], bases1[TLEN];
@@ -258,8 +302,15 @@ void test_binary_seq_functions()
 {
   test_binary_seq_rev_cmp();
   test_binary_seq_str();
-  test_binary_seq_cpy();
-  test_binary_seq_cmp();
-  test_pack_unpack();
-  test_pack_cpy_unpack();
+
+  // Test each SIMD version this CPU supports
+  CpuSimd lvl, max = cpu_simd_supported();
+  for(lvl = CPU_SIMD_NONE; lvl <= max; lvl++) {
+    cpu_simd_set(lvl);
+    test_pack_unpack();
+    test_pack_cpy_unpack();
+    test_binary_seq_cpy();
+    test_binary_seq_cmp();
+    test_binary_seqs_cmp_random();
+  }
 }
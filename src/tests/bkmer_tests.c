@@ -1,10 +1,12 @@
 #include "global.h"
 #include "all_tests.h"
 #include "binary_kmer.h"
+#include "cpu_dispatch.h"
 
 void test_bkmer_str()
 {
-  test_status("Testing binary_kmer_to_str() binary_kmer_from_str()");
+  test_status("Testing binary_kmer_to_str() binary_kmer_from_str() [simd=%s]",
+              binary_kmer_encode_simd_str());
 
   size_t k;
   BinaryKmer bkmer0, bkmer1;
@@ -26,10 +28,12 @@ void test_bkmer_str()
 
 void test_bkmer_revcmp()
 {
-  test_status("Testing binary_kmer_reverse_complement()");
+  test_status("Testing binary_kmer_reverse_complement() [simd=%s]",
+              binary_kmer_revcmp_simd_str());
 
   size_t k;
   BinaryKmer bkmer0, bkmer1, bkmer2;
+  char str0[MAX_KMER_SIZE+1], str1[MAX_KMER_SIZE+1];
 
   for(k = MIN_KMER_SIZE; k <= MAX_KMER_SIZE; k+=2)
   {
@@ -42,6 +46,11 @@ void test_bkmer_revcmp()
     // kmer-size is odd, forward != reverse complement
     TASSERT(!binary_kmer_eq(bkmer0, bkmer1));
     TASSERT(binary_kmer_eq(bkmer0, bkmer2));
+    // compare with string reverse complement
+    binary_kmer_to_str(bkmer0, k, str0);
+    binary_kmer_to_str(bkmer1, k, str1);
+    dna_reverse_complement_str(str0, k);
+    TASSERT(strcmp(str0, str1) == 0);
   }
 }
 
@@ -125,6 +134,30 @@ void test_bkmer_shifts()
   }
 }
 
+// Rolling a kmer and its reverse complement together
+static void test_bkmer_roll()
+{
+  test_status("Testing binary_kmer_roll()");
+
+  size_t i, k;
+  BinaryKmer fw, rv;
+  Nucleotide nuc;
+
+  for(k = MIN_KMER_SIZE; k <= MAX_KMER_SIZE; k+=2)
+  {
+    fw = binary_kmer_random(k);
+    rv = binary_kmer_reverse_complement(fw, k);
+    for(i = 0; i < 100; i++) {
+      nuc = rand() & 3;
+      binary_kmer_roll(&fw, &rv, k, nuc);
+      TASSERT(binary_kmer_last_nuc(fw) == nuc);
+      TASSERT(!binary_kmer_oversized(fw, k));
+      TASSERT(!binary_kmer_oversized(rv, k));
+      TASSERT(binary_kmer_eq(rv, binary_kmer_reverse_complement(fw, k)));
+    }
+  }
+}
+
 static void test_bkmer_first_last_nuc()
 {
   test_status("Testing binary_kmer_last_nuc()");
@@ -149,12 +182,105 @@ static void test_bkmer_first_last_nuc()
   }
 }
 
+void test_bkmer_iter()
+{
+  test_status("Testing BinaryKmerIter");
+
+  char seq[200];
+  size_t i, k;
+  BinaryKmerIter kiter;
+  BinaryKmer bkmer, bkey, expkey;
+  Orientation orient;
+
+  for(k = MIN_KMER_SIZE; k <= MAX_KMER_SIZE && k <= sizeof(seq); k+=2)
+  {
+    for(i = 0; i < sizeof(seq); i++) seq[i] = "ACGT"[rand() & 3];
+    binary_kmer_iter_init(&kiter, seq, k);
+    for(i = k-1; i < sizeof(seq); i++) {
+      binary_kmer_iter_next(&kiter, dna_char_to_nuc(seq[i]));
+      bkey = binary_kmer_iter_key(&kiter, &orient);
+      bkmer = binary_kmer_from_str(seq+i+1-k, k);
+      expkey = binary_kmer_get_key(bkmer, k);
+      TASSERT(binary_kmer_eq(bkey, expkey));
+      TASSERT(orient == bkmer_get_orientation(bkmer, bkey));
+    }
+  }
+}
+
+void test_bkmer_mixhash()
+{
+  test_status("Testing bkmix_hash64() bkmix_hash64_batch()");
+
+  const size_t n = 67;
+  BinaryKmer bkmers[67];
+  uint64_t h64[67];
+  size_t i, k;
+
+  for(k = MIN_KMER_SIZE; k <= MAX_KMER_SIZE; k+=2)
+  {
+    for(i = 0; i < n; i++) bkmers[i] = binary_kmer_random(k);
+    bkmix_hash64_batch(bkmers, n, k, h64);
+    for(i = 0; i < n; i++) TASSERT(h64[i] == bkmix_hash64(bkmers[i], k));
+    binary_kmer_hash64_batch(bkmers, n, k, h64);
+    for(i = 0; i < n; i++) {
+      TASSERT(binary_kmer_hash_round(bkmers[i], k, h64[i], 0) ==
+              binary_kmer_hash(bkmers[i], k));
+    }
+  }
+
+  // Rehash rounds should not repeat
+  uint64_t h = bkmix_hash64(bkmers[0], 0);
+  for(i = 1; i < 20; i++) TASSERT(bkmix_round(h, i) != bkmix_round(h, i-1));
+}
+
+// Compare against word by word comparisons
+static void test_bkmer_compare()
+{
+  test_status("Testing binary_kmer_eq() binary_kmer_lt() binary_kmer_cmp()");
+
+  size_t i, k, w;
+  int c;
+  BinaryKmer a, b;
+
+  for(k = MIN_KMER_SIZE; k <= MAX_KMER_SIZE; k+=2)
+  {
+    for(i = 0; i < 100; i++) {
+      a = binary_kmer_random(k);
+      b = a;
+      TASSERT(binary_kmer_eq(a, b) && binary_kmer_cmp(a, b) == 0);
+      TASSERT(!binary_kmer_lt(a, b) && binary_kmer_le(a, b));
+      // Change one word, or only the last base
+      w = rand() % NUM_BKMER_WORDS;
+      if(i & 1) b.b[w] = binary_kmer_random(k).b[w];
+      else binary_kmer_set_last_nuc(&b, (binary_kmer_last_nuc(a)+1)&3);
+      for(w = 0; w < NUM_BKMER_WORDS && a.b[w] == b.b[w]; w++) {}
+      c = (w == NUM_BKMER_WORDS ? 0 : cmp(a.b[w], b.b[w]));
+      TASSERT(binary_kmer_eq(a, b) == (c == 0));
+      TASSERT(binary_kmer_cmp(a, b) == c);
+      TASSERT(binary_kmer_cmp(b, a) == -c);
+      TASSERT(binary_kmer_lt(a, b) == (c < 0));
+      TASSERT(binary_kmer_le(a, b) == (c <= 0));
+      TASSERT(binary_kmer_first_diff_word(a, b) == w);
+    }
+  }
+}
+
 void test_bkmer_functions()
 {
   TASSERT(sizeof(BinaryKmer) == NUM_BKMER_WORDS * 8);
-  test_bkmer_str();
-  test_bkmer_revcmp();
+
+  // Test each SIMD version this CPU supports
+  CpuSimd lvl, max = cpu_simd_supported();
+  for(lvl = CPU_SIMD_NONE; lvl <= max; lvl++) {
+    cpu_simd_set(lvl);
+    test_bkmer_str();
+    test_bkmer_revcmp();
+  }
+
   test_bkmer_shifts();
+  test_bkmer_roll();
   test_bkmer_first_last_nuc();
-  // TODO: equal, less than, cmp
+  test_bkmer_iter();
+  test_bkmer_mixhash();
+  test_bkmer_compare();
 }
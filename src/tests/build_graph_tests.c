@@ -3,6 +3,9 @@
 #include "db_graph.h"
 #include "db_node.h"
 #include "build_graph.h"
+#include "build_partitioned.h"
+#include "file_util.h"
+#include "seq_reader.h"
 
 #include <math.h>
 
@@ -12,6 +15,533 @@ static Covg kmer_get_covg(const char *kmer, const dBGraph *db_graph)
   return db_node_get_covg(db_graph, node.key, 0);
 }
 
+static void rand_acgt(char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+  seq[len] = '\0';
+}
+
+// Check every kmer in a has the same coverage and edges in b
+static size_t cmp_graph_kmer(hkey_t hkey, const dBGraph *a, const dBGraph *b)
+{
+  BinaryKmer bkey = db_node_get_bkey(a, hkey);
+  dBNode node = db_graph_find(b, bkey);
+  if(node.key == HASH_NOT_FOUND) return 1;
+  return (db_node_get_covg(a, hkey, 0) != db_node_get_covg(b, node.key, 0)) +
+         (db_node_get_edges(a, hkey, 0) != db_node_get_edges(b, node.key, 0));
+}
+
+// Load the same sequence with build_graph_from_str_mt() and via partitions
+// If `overflow`, the first partition is too small so kmers have to be added to
+// the main graph directly
+static void test_partitioned_build(size_t kmer_size, size_t nparts,
+                                   bool overflow)
+{
+  dBGraph graph, pgraph;
+  size_t i, nseqs = 100, novel[2] = {0,0}, nwrong = 0;
+  char seqs[100][201];
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 50000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&pgraph, kmer_size, 1, 1, 50000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  // Repeat some sequences and their reverse complements
+  for(i = 0; i < nseqs; i++) {
+    if(i % 10 == 9) {
+      dna_revcomp_str(seqs[i], seqs[i-1], strlen(seqs[i-1]));
+      seqs[i][strlen(seqs[i-1])] = '\0';
+    }
+    else if(i % 10 == 8) memcpy(seqs[i], seqs[i-3], sizeof(seqs[i]));
+    else rand_acgt(seqs[i], kmer_size + rand() % (200-kmer_size));
+  }
+
+  BuildPartitions bp;
+  BuildPartRouter router;
+  build_partitions_alloc(&bp, &pgraph, nparts);
+
+  if(overflow) {
+    BuildPartition *part = &bp.parts[0];
+    hash_table_dealloc(&part->ht);
+    hash_table_alloc(&part->ht, 64);
+    ctx_free(part->covgs);
+    ctx_free(part->edges);
+    part->covgs = ctx_calloc(part->ht.capacity, sizeof(Covg));
+    part->edges = ctx_calloc(part->ht.capacity, sizeof(Edges));
+  }
+
+  // Load twice to check partitions are emptied and novel kmers are counted
+  size_t pass;
+  for(pass = 0; pass < 2; pass++) {
+    build_partitions_start(&bp, 0, 2);
+    build_part_router_alloc(&router, &bp);
+    for(i = 0; i < nseqs; i++) {
+      build_part_router_add(&router, seqs[i], strlen(seqs[i]), i & 1);
+      build_graph_from_str_mt(&graph, 0, seqs[i], strlen(seqs[i]), false);
+    }
+    build_part_router_flush(&router);
+    build_part_router_dealloc(&router);
+    build_partitions_finish(&bp, 2, novel);
+    TASSERT2(novel[0]+novel[1] == graph.ht.num_kmers, "%zu + %zu vs %zu",
+             novel[0], novel[1], (size_t)graph.ht.num_kmers);
+    if(overflow) TASSERT(bp.parts[0].num_overflow > 0);
+  }
+
+  build_partitions_dealloc(&bp);
+
+  TASSERT(graph.ht.num_kmers == pgraph.ht.num_kmers);
+  hkey_t hkey;
+  for(hkey = 0; hkey < graph.ht.capacity; hkey++)
+    if(hash_table_assigned(&graph.ht, hkey))
+      nwrong += cmp_graph_kmer(hkey, &graph, &pgraph);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&pgraph);
+}
+
+// Loading every shard in turn should give the same graph as one load
+static void test_sharded_build(size_t kmer_size, size_t nparts, size_t nshards)
+{
+  dBGraph graph, pgraph;
+  size_t i, s, nseqs = 100, nkmers = 0, nsharded = 0, nwrong = 0;
+  char seqs[100][201];
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 50000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&pgraph, kmer_size, 1, 1, 50000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  for(i = 0; i < nseqs; i++) {
+    rand_acgt(seqs[i], kmer_size + rand() % (200-kmer_size));
+    build_graph_from_str_mt(&graph, 0, seqs[i], strlen(seqs[i]), false);
+    nkmers += strlen(seqs[i]) + 1 - kmer_size;
+  }
+
+  BuildPartitions bp;
+  BuildPartRouter router;
+  build_partitions_alloc(&bp, &pgraph, nparts);
+
+  for(s = 0; s < nshards; s++) {
+    build_partitions_set_shard(&bp, s, nshards);
+    build_partitions_start(&bp, 0, 1);
+    build_part_router_alloc(&router, &bp);
+    for(i = 0; i < nseqs; i++)
+      nsharded += build_part_router_add(&router, seqs[i], strlen(seqs[i]), 0);
+    build_part_router_flush(&router);
+    build_part_router_dealloc(&router);
+    build_partitions_finish(&bp, 2, NULL);
+  }
+
+  build_partitions_dealloc(&bp);
+
+  TASSERT2(nsharded == nkmers, "%zu vs %zu", nsharded, nkmers);
+  TASSERT(graph.ht.num_kmers == pgraph.ht.num_kmers);
+  hkey_t hkey;
+  for(hkey = 0; hkey < graph.ht.capacity; hkey++)
+    if(hash_table_assigned(&graph.ht, hkey))
+      nwrong += cmp_graph_kmer(hkey, &graph, &pgraph);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&pgraph);
+}
+
+// Spill kmers to shard files, then load shards one at a time
+static void test_spilled_build(size_t kmer_size, size_t nparts, size_t nshards)
+{
+  dBGraph graph, sgraph;
+  size_t i, s, nseqs = 100, nkmers = 0, nwrong = 0, nbadshard = 0;
+  char seqs[100][201];
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 50000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&sgraph, kmer_size, 1, 1, 50000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  for(i = 0; i < nseqs; i++) {
+    rand_acgt(seqs[i], kmer_size + rand() % (200-kmer_size));
+    build_graph_from_str_mt(&graph, 0, seqs[i], strlen(seqs[i]), false);
+  }
+
+  BuildPartitions bp;
+  BuildPartRouter router;
+  FILE **spill = futil_create_tmp_files(nshards);
+  build_partitions_alloc(&bp, &sgraph, nparts);
+  build_partitions_set_spill(&bp, spill, nshards);
+  build_partitions_start(&bp, 0, 1);
+  build_part_router_alloc(&router, &bp);
+  for(i = 0; i < nseqs; i++)
+    build_part_router_add(&router, seqs[i], strlen(seqs[i]), 0);
+  build_part_router_flush(&router);
+  build_part_router_dealloc(&router);
+  build_partitions_finish(&bp, 2, NULL);
+  TASSERT(sgraph.ht.num_kmers == 0);
+
+  hkey_t hkey;
+  for(s = 0; s < nshards; s++) {
+    db_graph_reset(&sgraph);
+    build_partitions_load_spill(&bp, spill[s], s, nshards, 2);
+    fclose(spill[s]);
+    nkmers += sgraph.ht.num_kmers;
+    for(hkey = 0; hkey < sgraph.ht.capacity; hkey++) {
+      if(hash_table_assigned(&sgraph.ht, hkey)) {
+        BinaryKmer bkey = db_node_get_bkey(&sgraph, hkey);
+        nbadshard += (graph_shard_of_kmer(bkey, kmer_size, nshards) != s);
+        nwrong += cmp_graph_kmer(hkey, &sgraph, &graph);
+      }
+    }
+  }
+
+  build_partitions_dealloc(&bp);
+  ctx_free(spill);
+
+  TASSERT2(nkmers == graph.ht.num_kmers, "%zu vs %zu",
+           nkmers, (size_t)graph.ht.num_kmers);
+  TASSERT2(nbadshard == 0, "nbadshard: %zu", nbadshard);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&sgraph);
+}
+
+static size_t kmer_get_nedges(const char *kmer, const dBGraph *db_graph)
+{
+  dBNode node = db_graph_find_str(db_graph, kmer);
+  return __builtin_popcount(db_node_get_edges(db_graph, node.key, 0));
+}
+
+// Kmers should only enter the graph on their second sighting, with the
+// first sighting added to their coverage
+static void test_build_min_count()
+{
+  dBGraph graph;
+  KmerBloom bloom;
+  size_t kmer_size = 19;
+  const char seq0[] = "CTACGATGTATGCTTAGCTGTTCCG";
+  const char seq1[] = "TAGAACGTTCCCTACACGTCCTATG";
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  kmer_bloom_alloc(&bloom, 1<<16);
+  graph.bloom = &bloom;
+
+  // First sighting: nothing loaded
+  build_graph_from_str_mt(&graph, 0, seq0, strlen(seq0), false);
+  build_graph_from_str_mt(&graph, 0, seq1, strlen(seq1), false);
+  TASSERT(graph.ht.num_kmers == 0);
+
+  // Second sighting of seq0 adds it with coverage 2
+  build_graph_from_str_mt(&graph, 0, seq0, strlen(seq0), false);
+  TASSERT(graph.ht.num_kmers == strlen(seq0)+1-kmer_size);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 2);
+  TASSERT(kmer_get_covg("TACGATGTATGCTTAGCTG", &graph) == 2);
+  TASSERT(kmer_get_nedges("CTACGATGTATGCTTAGCT", &graph) == 1);
+  TASSERT(kmer_get_nedges("TACGATGTATGCTTAGCTG", &graph) == 2);
+
+  // seq1 twice more: covg 3
+  build_graph_from_str_mt(&graph, 0, seq1, strlen(seq1), false);
+  build_graph_from_str_mt(&graph, 0, seq1, strlen(seq1), false);
+  TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 3);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 2);
+
+  // Remove kmers seen fewer than 3 times
+  db_graph_remove_low_covg_in_col(&graph, 0, 3, 1);
+  db_graph_remove_no_covg_kmers(&graph, 1);
+  TASSERT(graph.ht.num_kmers == strlen(seq1)+1-kmer_size);
+  TASSERT(db_graph_find_str(&graph, "CTACGATGTATGCTTAGCT").key == HASH_NOT_FOUND);
+  TASSERT(kmer_get_covg("AGAACGTTCCCTACACGTC", &graph) == 3);
+  TASSERT(kmer_get_nedges("TAGAACGTTCCCTACACGT", &graph) == 1);
+  TASSERT(kmer_get_nedges("AGAACGTTCCCTACACGTC", &graph) == 2);
+
+  graph.bloom = NULL;
+  kmer_bloom_dealloc(&bloom);
+  db_graph_dealloc(&graph);
+}
+
+typedef struct {
+  dBGraph *db_graph;
+  char (*seqs)[201];
+  size_t nseqs, nthreads;
+} GrowLoad;
+
+static void grow_load_thread(void *arg, size_t threadid)
+{
+  GrowLoad *job = (GrowLoad*)arg;
+  size_t i;
+  for(i = threadid; i < job->nseqs; i += job->nthreads)
+    build_graph_from_str_mt(job->db_graph, 0, job->seqs[i],
+                            strlen(job->seqs[i]), false);
+}
+
+// Every thread loads every sequence, so threads race on first sightings
+static void all_seqs_load_thread(void *arg, size_t threadid)
+{
+  (void)threadid;
+  GrowLoad *job = (GrowLoad*)arg;
+  size_t i;
+  for(i = 0; i < job->nseqs; i++)
+    build_graph_from_str_mt(job->db_graph, 0, job->seqs[i],
+                            strlen(job->seqs[i]), false);
+}
+
+// Threads seeing a kmer for the second time at once should only add its first
+// sighting back once. Coverages should match loading without a bloom filter.
+static void test_build_min_count_mt(size_t nthreads)
+{
+  dBGraph graph, bgraph;
+  KmerBloom bloom;
+  size_t i, t, kmer_size = 19, nseqs = 200, nwrong = 0;
+  char seqs[200][201];
+  int flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS;
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 50000, flags);
+  db_graph_alloc(&bgraph, kmer_size, 1, 1, 50000, flags);
+  kmer_bloom_alloc(&bloom, 1<<20);
+  bgraph.bloom = &bloom;
+
+  for(i = 0; i < nseqs; i++) {
+    rand_acgt(seqs[i], kmer_size + rand() % (200-kmer_size));
+    for(t = 0; t < nthreads; t++)
+      build_graph_from_str_mt(&graph, 0, seqs[i], strlen(seqs[i]), false);
+  }
+
+  GrowLoad job = {.db_graph = &bgraph, .seqs = seqs,
+                  .nseqs = nseqs, .nthreads = nthreads};
+  util_multi_thread(&job, nthreads, all_seqs_load_thread);
+
+  TASSERT2(graph.ht.num_kmers == bgraph.ht.num_kmers, "%zu vs %zu",
+           (size_t)graph.ht.num_kmers, (size_t)bgraph.ht.num_kmers);
+  hkey_t hkey;
+  for(hkey = 0; hkey < graph.ht.capacity; hkey++)
+    if(hash_table_assigned(&graph.ht, hkey))
+      nwrong += cmp_graph_kmer(hkey, &graph, &bgraph);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  bgraph.bloom = NULL;
+  kmer_bloom_dealloc(&bloom);
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&bgraph);
+}
+
+// Load into a tiny graph that has to grow many times while loading,
+// should match loading into a graph that is big enough
+static void test_grow_build(size_t kmer_size, size_t nthreads, bool lockfree)
+{
+  dBGraph graph, ggraph;
+  size_t i, nseqs = 200, nwrong = 0, nnotincol = 0;
+  char seqs[200][201];
+  int flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS |
+              DBG_ALLOC_NODE_IN_COL |
+              (lockfree ? DBG_ALLOC_HT_LOCKFREE : 0);
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 50000, flags);
+  db_graph_alloc(&ggraph, kmer_size, 1, 1, 64, flags | DBG_ALLOC_READSTRT);
+
+  for(i = 0; i < nseqs; i++) {
+    if(i % 10 == 9) memcpy(seqs[i], seqs[i-4], sizeof(seqs[i]));
+    else rand_acgt(seqs[i], kmer_size + rand() % (200-kmer_size));
+    build_graph_from_str_mt(&graph, 0, seqs[i], strlen(seqs[i]), false);
+  }
+
+  db_graph_grow_alloc(&ggraph, nthreads);
+  GrowLoad job = {.db_graph = &ggraph, .seqs = seqs,
+                  .nseqs = nseqs, .nthreads = nthreads};
+  util_multi_thread(&job, nthreads, grow_load_thread);
+  TASSERT(ggraph.grow->generation > 0);
+  db_graph_grow_dealloc(&ggraph);
+
+  TASSERT(graph.ht.num_kmers == ggraph.ht.num_kmers);
+  hkey_t hkey;
+  for(hkey = 0; hkey < graph.ht.capacity; hkey++)
+    if(hash_table_assigned(&graph.ht, hkey))
+      nwrong += cmp_graph_kmer(hkey, &graph, &ggraph);
+  for(hkey = 0; hkey < ggraph.ht.capacity; hkey++)
+    if(hash_table_assigned(&ggraph.ht, hkey))
+      nnotincol += !db_node_has_col(&ggraph, hkey, 0);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+  TASSERT2(nnotincol == 0, "nnotincol: %zu", nnotincol);
+
+  // Read start bits move with their kmers
+  dBNode node0 = db_graph_find_str(&ggraph, seqs[0]);
+  dBNode node1 = db_graph_find_str(&ggraph, seqs[1]);
+  bitset_set(ggraph.readstrt, 2*node0.key);
+  bitset_set(ggraph.readstrt, 2*node1.key+1);
+  db_graph_resize(&ggraph, ggraph.ht.capacity*2, nthreads);
+  node0 = db_graph_find_str(&ggraph, seqs[0]);
+  node1 = db_graph_find_str(&ggraph, seqs[1]);
+  TASSERT(bitset_get(ggraph.readstrt, 2*node0.key));
+  TASSERT(!bitset_get(ggraph.readstrt, 2*node0.key+1));
+  TASSERT(!bitset_get(ggraph.readstrt, 2*node1.key));
+  TASSERT(bitset_get(ggraph.readstrt, 2*node1.key+1));
+  TASSERT(graph.ht.num_kmers == ggraph.ht.num_kmers);
+
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&ggraph);
+}
+
+// PCR duplicate removal with a fixed size table of read start fingerprints
+static void test_pcr_fingerprints()
+{
+  dBGraph graph;
+  ReadStartHash rshash;
+  size_t i, kmer_size = 19;
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  read_start_hash_alloc(&rshash, 1<<12);
+  graph.readstrt_hash = &rshash;
+
+  read_t r1, r2;
+  seq_read_alloc(&r1);
+  seq_read_alloc(&r2);
+
+  SeqLoadingStats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  SeqLoadingPrefs prefs = {.fq_cutoff = 0, .hp_cutoff = 0,
+                           .matedir = READPAIR_FF,
+                           .colour = 0, .remove_pcr_dups = true};
+
+  seq_read_set(&r1, "CTACGATGTATGCTTAGCTGTTCCG");
+  seq_read_set(&r2, "TAGAACGTTCCCTACACGTCCTATG");
+  build_graph_from_reads_mt(&r1, &r2, 0, 0, &prefs, &stats, &graph);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 1);
+  TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 1);
+
+  // Duplicate FF
+  seq_read_set(&r1, "CTACGATGTATGCTTAGCTAATGAT");
+  seq_read_set(&r2, "TAGAACGTTCCCTACACGTTGTTTG");
+  build_graph_from_reads_mt(&r1, &r2, 0, 0, &prefs, &stats, &graph);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 1);
+  TASSERT(stats.num_dup_pe_pairs == 1);
+
+  // Duplicate FR
+  // revcmp TAGAACGTTCCCTACACGT -> ACGTGTAGGGAACGTTCTA
+  seq_read_set(&r1, "CTACGATGTATGCTTAGCTCCGAAG");
+  seq_read_set(&r2, "GACTTACGTGTAGGGAACGTTCTA");
+  prefs.matedir = READPAIR_FR;
+  build_graph_from_reads_mt(&r1, &r2, 0, 0, &prefs, &stats, &graph);
+  TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 1);
+  TASSERT(stats.num_dup_pe_pairs == 2);
+
+  // Same first read, different mate: not a duplicate pair
+  seq_read_set(&r1, "CTACGATGTATGCTTAGCTAATGAT");
+  seq_read_set(&r2, "GGATCCTTAGCAATGCCAAGTCC");
+  prefs.matedir = READPAIR_FF;
+  build_graph_from_reads_mt(&r1, &r2, 0, 0, &prefs, &stats, &graph);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 2);
+  TASSERT(stats.num_dup_pe_pairs == 2);
+
+  // Kmers in the opposite direction are not duplicates
+  seq_read_set(&r1, "ACGTGTAGGGAACGTTCTA""CTTCTACCGGAGGAT");
+  seq_read_set(&r2, "AGCTAAGCATACATCGTAG""TACAATGCACCCTCC");
+  build_graph_from_reads_mt(&r1, &r2, 0, 0, &prefs, &stats, &graph);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 3);
+  TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 2);
+
+  // Single ended reads are fingerprinted separately from pairs
+  seq_read_set(&r1, "CTACGATGTATGCTTAGCTAGTGTGATATCCTCC");
+  build_graph_from_reads_mt(&r1, NULL, 0, 0, &prefs, &stats, &graph);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 4);
+  build_graph_from_reads_mt(&r1, NULL, 0, 0, &prefs, &stats, &graph);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 4);
+  TASSERT(stats.num_dup_se_reads == 1);
+  TASSERT(rshash.num_dropped == 0);
+
+  // A full table drops fingerprints but never drops novel reads
+  read_start_hash_dealloc(&rshash);
+  read_start_hash_alloc(&rshash, 1);
+  graph.readstrt_hash = &rshash;
+  TASSERT(rshash.nbuckets == 1);
+  char seq[] = "CTACGATGTATGCTTAGCTGTTCCG";
+  for(i = 0; i < READ_START_BUCKET_SIZE+2; i++) {
+    seq[i % 19] = seq[i % 19] == 'A' ? 'C' : 'A';
+    seq_read_set(&r1, seq);
+    build_graph_from_reads_mt(&r1, NULL, 0, 0, &prefs, &stats, &graph);
+  }
+  TASSERT(rshash.num_dropped == 2);
+  TASSERT(stats.num_dup_se_reads == 1);
+
+  seq_read_dealloc(&r1);
+  seq_read_dealloc(&r2);
+
+  graph.readstrt_hash = NULL;
+  read_start_hash_dealloc(&rshash);
+  db_graph_dealloc(&graph);
+}
+
+// Multithreaded and sampled graph health checks
+static void test_healthcheck()
+{
+  dBGraph graph;
+  size_t i, nkmers, nchecked, nthreads;
+  char seq[201];
+
+  db_graph_alloc(&graph, 19, 1, 1, 10000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS |
+                 DBG_ALLOC_NODE_IN_COL | DBG_ALLOC_BKTLOCKS);
+
+  for(i = 0; i < 20; i++) {
+    rand_acgt(seq, 200);
+    build_graph_from_str_mt(&graph, 0, seq, strlen(seq), false);
+  }
+
+  nkmers = hash_table_nkmers(&graph.ht);
+  for(nthreads = 1; nthreads <= 4; nthreads++) {
+    nchecked = db_graph_healthcheck_mt(&graph, nthreads, 1, 0);
+    TASSERT2(nchecked == nkmers, "%zu vs %zu", nchecked, nkmers);
+  }
+
+  // Same seed picks the same kmers whatever the number of threads
+  nchecked = db_graph_healthcheck_mt(&graph, 1, 0.25, 12345);
+  TASSERT(nchecked > 0 && nchecked < nkmers);
+  TASSERT(db_graph_healthcheck_mt(&graph, 3, 0.25, 12345) == nchecked);
+
+  db_graph_dealloc(&graph);
+}
+
+// seq_contig_next2() must find the same contigs as seq_contig_start2() and
+// seq_contig_end2(). Reads are mostly homopolymer runs, with Ns and a wide
+// range of qualities around the cutoffs.
+static void test_contig_next()
+{
+  test_status("Testing seq_contig_next() against seq_contig_start/end()");
+
+  char seq[200], qual[200];
+  size_t t, i, n, len, quallen, kmer_size;
+  size_t start, end, search, start2, end2, search2;
+  uint8_t qcut, hpcut;
+
+  for(t = 0; t < 5000; t++) {
+    len = (size_t)rand() % sizeof(seq);
+    quallen = rand() % 4 == 0 ? 0 : (size_t)rand() % (len+1);
+    kmer_size = 3 + 2 * ((size_t)rand() % 8);
+    qcut = rand() % 3 == 0 ? 0 : '!' + (uint8_t)(rand() % 6);
+    hpcut = rand() % 3 == 0 ? 0 : 1 + (uint8_t)(rand() % 6);
+    for(i = 0; i < len; i++) {
+      seq[i] = i > 0 && rand() % 2 ? seq[i-1] : "ACGTNacgt"[rand() % 9];
+      qual[i] = (char)('!' + rand() % 8);
+    }
+
+    // Homopolymer cutoffs above kmer_size can search from the same start again
+    for(n = 0, search = search2 = 0; n <= len; n++) {
+      start = seq_contig_next2(seq, len, qual, quallen, search, kmer_size,
+                               qcut, hpcut, &end, &search);
+      start2 = seq_contig_start2(seq, len, qual, quallen, search2, kmer_size,
+                                 qcut, hpcut);
+      TASSERT2(start == start2, "%zu vs %zu", start, start2);
+      if(start != start2 || start2 >= len) break;
+      end2 = seq_contig_end2(seq, len, qual, quallen, start2, kmer_size,
+                             qcut, hpcut, &search2);
+      TASSERT2(end == end2, "%zu vs %zu", end, end2);
+      TASSERT2(search == search2, "%zu vs %zu", search, search2);
+      if(end != end2 || search != search2) break;
+    }
+  }
+}
+
 void test_build_graph()
 {
   test_status("Testing remove PCR duplicates in build_graph.c");
@@ -151,4 +681,33 @@ void test_build_graph()
   seq_read_dealloc(&r2);
 
   db_graph_dealloc(&graph);
+
+  test_status("Testing PCR duplicate fingerprints in read_start_hash.c");
+  test_pcr_fingerprints();
+
+  test_status("Testing min kmer count in build_graph.c");
+  test_build_min_count();
+  test_build_min_count_mt(2);
+  test_build_min_count_mt(8);
+
+  test_status("Testing hash table growth while building");
+  test_grow_build(19, 1, false);
+  test_grow_build(31, 3, false);
+  test_grow_build(21, 4, true);
+
+  test_status("Testing partitioned build in build_partitioned.c");
+  test_partitioned_build(3, 2, false);
+  test_partitioned_build(19, 1, false);
+  test_partitioned_build(31, 4, false);
+  test_partitioned_build(19, 1, true);
+  test_partitioned_build(31, 3, true);
+  test_sharded_build(19, 2, 3);
+  test_sharded_build(31, 3, 4);
+  test_spilled_build(19, 2, 3);
+  test_spilled_build(31, 3, 5);
+
+  test_status("Testing graph health check");
+  test_healthcheck();
+
+  test_contig_next();
 }
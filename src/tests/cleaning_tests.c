@@ -62,17 +62,19 @@ void _test_graph_cleaning()
            "%llu kmers", hash_table_nkmers(&graph.ht));
 
   // No change (min_tip_len must be > 1)
-  clean_graph(nthreads, 0, 2, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 2, 1, NULL, NULL, NULL, NULL, visited, keep, &graph);
   TASSERT(hash_table_nkmers(&graph.ht) == 1000-19+1);
   TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
 
   // No change (min_tip_len must be > 1)
-  clean_graph(nthreads, 0, 1000-19+1, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 1000-19+1, 1, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
   TASSERT(hash_table_nkmers(&graph.ht) == 1000-19+1);
   TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
 
   // All removed
-  clean_graph(nthreads, 0, 1000-19+2, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 1000-19+2, 1, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
   TASSERT2(hash_table_nkmers(&graph.ht) == 0, "%llu kmers", hash_table_nkmers(&graph.ht));
   TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
 
@@ -90,8 +92,10 @@ void _test_graph_cleaning()
   build_graph_from_str_mt(&graph, 0, tmp, strlen(tmp), false);
 
   size_t thresh = cleaning_get_threshold(nthreads, NULL, NULL, visited, &graph);
-  clean_graph(nthreads, thresh, 0, NULL, NULL, visited, keep, &graph);
+  int fused_thresh = clean_graph(nthreads, thresh, 0, 1, NULL, NULL, NULL, NULL,
+                                 visited, keep, &graph);
   TASSERT2(thresh > 1, "threshold: %zu", thresh);
+  TASSERT2(fused_thresh == (int)thresh, "%i vs %zu", fused_thresh, thresh);
 
   TASSERT2(hash_table_nkmers(&graph.ht) == 200-19+1, "%llu kmers", hash_table_nkmers(&graph.ht));
   TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
@@ -105,21 +109,21 @@ void _test_graph_cleaning()
   TASSERT2(hash_table_nkmers(&graph.ht) == 200-19+1 + 23-19+1,
            "%llu kmers", hash_table_nkmers(&graph.ht));
   TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
-  clean_graph(nthreads, 0, 2*19-1, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 2*19-1, 1, NULL, NULL, NULL, NULL, visited, keep, &graph);
   TASSERT2(hash_table_nkmers(&graph.ht) == 200-19+1, "%llu kmers", hash_table_nkmers(&graph.ht));
   TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
 
   // clear hash table + graph
   hash_table_empty(&graph.ht);
   memset(graph.col_edges, 0, ncols*graph.ht.capacity*sizeof(Edges));
-  memset(graph.col_covgs, 0, ncols*graph.ht.capacity*sizeof(Covg));
+  memset(graph.col_covgs, 0, ncols*graph.ht.capacity*sizeof(CovgStore));
 
   // Build a graph with a single kmer and delete it
   char tmp3[] = "AGATGTGGTTCACGGCTAG";
   build_graph_from_str_mt(&graph, 0, tmp3, strlen(tmp3), false);
   TASSERT2(hash_table_nkmers(&graph.ht) == 1, "%llu", hash_table_nkmers(&graph.ht));
   TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
-  clean_graph(nthreads, 0, 2*19-1, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 2*19-1, 1, NULL, NULL, NULL, NULL, visited, keep, &graph);
   TASSERT(hash_table_nkmers(&graph.ht) == 0, "%llu kmers", hash_table_nkmers(&graph.ht));
   TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
 
@@ -129,9 +133,215 @@ void _test_graph_cleaning()
   db_graph_dealloc(&graph);
 }
 
+// A branch off a long path that forks into two short tips only becomes a tip
+// itself once they are removed
+void _test_tip_rounds(size_t tip_rounds, size_t nthreads)
+{
+  test_status("Testing %zu round%s of tip clipping with %zu thread%s...",
+              tip_rounds, util_plural_str(tip_rounds),
+              nthreads, util_plural_str(nthreads));
+
+  dBGraph graph;
+  const size_t kmer_size = 19, ncols = 1;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 2000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+  uint8_t *keep    = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+
+  // path: 100bp, branch: 50bp of path + 20bp, forking into +10bp and +10bp
+  const char path[] =
+"GGCTACCTAACCAGATATCTCTGTATACAGCTGCATTGTGTTTAGTCTACAACGACAGAAATCCCCTTCGACGCCCGC"
+"GACCTCTCTTAACGGACGACGC";
+  const char branch1[] =
+"GGCTACCTAACCAGATATCTCTGTATACAGCTGCATTGTGTTTAGTCTAC"
+"TGTGTCACGGGTCAGTCGCT" "CAAAGGGAAC";
+  const char branch2[] =
+"GGCTACCTAACCAGATATCTCTGTATACAGCTGCATTGTGTTTAGTCTAC"
+"TGTGTCACGGGTCAGTCGCT" "TTGGATAAAA";
+
+  build_graph_from_str_mt(&graph, 0, path, strlen(path), false);
+  build_graph_from_str_mt(&graph, 0, branch1, strlen(branch1), false);
+  build_graph_from_str_mt(&graph, 0, branch2, strlen(branch2), false);
+
+  size_t nmain = 100-19+1, nbranch = 20, nfork = 10;
+  TASSERT2(hash_table_nkmers(&graph.ht) == nmain + nbranch + 2*nfork,
+           "%zu kmers", (size_t)hash_table_nkmers(&graph.ht));
+
+  clean_graph(nthreads, 0, 2*19-1, tip_rounds, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
+
+  size_t expect = tip_rounds > 1 ? nmain : nmain + nbranch;
+  TASSERT2(hash_table_nkmers(&graph.ht) == expect, "%zu kmers vs %zu",
+           (size_t)hash_table_nkmers(&graph.ht), expect);
+  TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
+
+  // All remaining edges are to kmers in the graph
+  hkey_t hkey;
+  dBNode next[4];
+  Nucleotide nucs[4];
+  size_t i, n, nmissing = 0;
+  Orientation orient;
+  for(hkey = 0; hkey < graph.ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(&graph, hkey)) continue;
+    for(orient = 0; orient < 2; orient++) {
+      dBNode node = {.key = hkey, .orient = orient};
+      n = db_graph_next_nodes_union(&graph, node, next, nucs);
+      for(i = 0; i < n; i++) nmissing += (next[i].key == HASH_NOT_FOUND);
+    }
+  }
+  TASSERT2(nmissing == 0, "nmissing: %zu", nmissing);
+
+  ctx_free(visited);
+  ctx_free(keep);
+  db_graph_dealloc(&graph);
+}
+
+static void _rand_acgt(char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+  seq[len] = '\0';
+}
+
+// Removing most of the kmers then compacting gives a smaller table with the
+// same kmers, edges, coverages and colours
+void _test_compact()
+{
+  test_status("Testing hash table compaction after cleaning...");
+
+  dBGraph graph, copy;
+  const size_t kmer_size = 19, ncols = 2, nthreads = 2;
+  const int flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                    DBG_ALLOC_BKTLOCKS;
+  char seq[1001];
+  size_t i, col, nwrong = 0;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 20000, flags);
+  db_graph_alloc(&copy, kmer_size, ncols, ncols, 20000, flags);
+
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+  uint8_t *keep    = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+
+  // One sequence kept in both colours, many short tips removed by cleaning
+  _rand_acgt(seq, 1000);
+  for(col = 0; col < ncols; col++) {
+    build_graph_from_str_mt(&graph, col, seq, 1000, false);
+    build_graph_from_str_mt(&copy, col, seq, 1000, false);
+  }
+  for(i = 0; i < 400; i++) {
+    _rand_acgt(seq, 30);
+    build_graph_from_str_mt(&graph, 0, seq, 30, false);
+  }
+
+  clean_graph(nthreads, 0, 2*19-1, 1, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
+  ctx_free(visited);
+  ctx_free(keep);
+
+  TASSERT(hash_table_nkmers(&graph.ht) == hash_table_nkmers(&copy.ht));
+
+  // Already occupied enough, not compacted
+  TASSERT(!db_graph_compact(&graph, 0.0, nthreads));
+
+  size_t capacity = graph.ht.capacity;
+  TASSERT(db_graph_compact(&graph, DBG_COMPACT_OCCUPANCY, nthreads));
+  TASSERT(graph.ht.capacity < capacity);
+  TASSERT(hash_table_nkmers(&graph.ht) == hash_table_nkmers(&copy.ht));
+  TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
+
+  hkey_t hkey;
+  dBNode node;
+  for(hkey = 0; hkey < copy.ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(&copy, hkey)) continue;
+    node = db_graph_find(&graph, db_node_get_bkey(&copy, hkey));
+    if(node.key == HASH_NOT_FOUND) { nwrong++; continue; }
+    for(col = 0; col < ncols; col++) {
+      nwrong += (db_node_get_edges(&graph, node.key, col) !=
+                 db_node_get_edges(&copy, hkey, col));
+      nwrong += (db_node_get_covg(&graph, node.key, col) !=
+                 db_node_get_covg(&copy, hkey, col));
+      nwrong += (db_node_has_col(&graph, node.key, col) !=
+                 db_node_has_col(&copy, hkey, col));
+    }
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&copy);
+}
+
+// Unitigs with low coverage in one colour are removed from that colour only,
+// kmers left in no colour are removed
+void _test_per_colour_cleaning()
+{
+  test_status("Testing per colour graph cleaning...");
+
+  dBGraph graph, copy;
+  const size_t kmer_size = 19, ncols = 2, nthreads = 2;
+  const int flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS;
+  const size_t thresholds[2] = {2, 2};
+  char seqa[201], seqb[101], seqc[101];
+  size_t i, col, nwrong = 0;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 2000, flags);
+  db_graph_alloc(&copy, kmer_size, ncols, ncols, 2000, flags);
+
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+
+  // a: high coverage in colour 0, low in 1; b: high in 1; c: low in 1
+  _rand_acgt(seqa, 200);
+  _rand_acgt(seqb, 100);
+  _rand_acgt(seqc, 100);
+
+  for(i = 0; i < 3; i++) {
+    build_graph_from_str_mt(&graph, 0, seqa, 200, false);
+    build_graph_from_str_mt(&graph, 1, seqb, 100, false);
+    build_graph_from_str_mt(&copy, 0, seqa, 200, false);
+    build_graph_from_str_mt(&copy, 1, seqb, 100, false);
+  }
+  build_graph_from_str_mt(&graph, 1, seqa, 200, false);
+  build_graph_from_str_mt(&graph, 1, seqc, 100, false);
+
+  size_t nremoved = clean_graph_per_colour(nthreads, thresholds, visited, &graph);
+
+  TASSERT2(nremoved == (200-19+1) + (100-19+1), "%zu", nremoved);
+  TASSERT(hash_table_nkmers(&graph.ht) == hash_table_nkmers(&copy.ht));
+  TASSERT(hash_table_nkmers(&graph.ht) == hash_table_count_kmers(&graph.ht));
+
+  hkey_t hkey;
+  dBNode node;
+  for(hkey = 0; hkey < copy.ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(&copy, hkey)) continue;
+    node = db_graph_find(&graph, db_node_get_bkey(&copy, hkey));
+    if(node.key == HASH_NOT_FOUND) { nwrong++; continue; }
+    for(col = 0; col < ncols; col++) {
+      nwrong += (db_node_get_edges(&graph, node.key, col) !=
+                 db_node_get_edges(&copy, hkey, col));
+      nwrong += (db_node_get_covg(&graph, node.key, col) !=
+                 db_node_get_covg(&copy, hkey, col));
+    }
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  for(i = 0; i < roundup_bits2bytes(graph.ht.capacity); i++)
+    nwrong += (visited[i] != 0);
+  TASSERT(nwrong == 0);
+
+  ctx_free(visited);
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&copy);
+}
+
 void test_cleaning()
 {
   _test_pick_theshold();
   _test_graph_cleaning();
+  _test_tip_rounds(1, 2);
+  _test_tip_rounds(2, 1);
+  _test_tip_rounds(5, 3);
+  _test_compact();
+  _test_per_colour_cleaning();
 }
 
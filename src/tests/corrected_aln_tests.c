@@ -98,6 +98,19 @@ static void test_correct_aln_no_paths()
   alns[0] = re1;
   _check_correct_aln(mu1, NULL, alns, 1, &corrector, &params, &graph, &sbuf);
 
+  // Same gaps again should be filled from the cache
+  TASSERT(corrector.aln_stats.num_gap_cache_hits == 0);
+  uint64_t num_traversed = corrector.aln_stats.num_mid_traversed;
+
+  alns[0] = re0;
+  _check_correct_aln(mu0, NULL, alns, 1, &corrector, &params, &graph, &sbuf);
+  alns[0] = re1;
+  _check_correct_aln(mu1, NULL, alns, 1, &corrector, &params, &graph, &sbuf);
+
+  TASSERT(num_traversed > 0);
+  TASSERT(corrector.aln_stats.num_gap_cache_hits == num_traversed);
+  TASSERT(corrector.aln_stats.num_mid_traversed == 2 * num_traversed);
+
   strbuf_dealloc(&sbuf);
   correct_aln_worker_dealloc(&corrector);
   db_graph_dealloc(&graph);
@@ -202,9 +215,63 @@ static void test_contig_ends_agree()
   db_graph_dealloc(&graph);
 }
 
+// Gap and fragment histograms only count sampled reads, picked from the read
+// sequence so that the same reads are always picked
+static void test_aln_stats_sample()
+{
+  const size_t nreads = 4000, rate = 8;
+  CorrectAlnStats stats, stats2;
+  size_t i, nbad = 0;
+  char seq[20];
+
+  correct_aln_stats_set_sample(rate);
+  correct_aln_stats_alloc(&stats);
+  correct_aln_stats_alloc(&stats2);
+  TASSERT(stats.sample_rate == rate);
+
+  for(i = 0; i < nreads; i++) {
+    sprintf(seq, "ACGT%zuTGCA", i);
+    correct_aln_stats_start_read(&stats, seq, strlen(seq), false);
+    correct_aln_stats_start_read(&stats2, seq, strlen(seq), false);
+    nbad += (stats.sample_read != stats2.sample_read);
+    correct_aln_stats_add(&stats, 10, 10);
+    correct_aln_stats_add_mp(&stats, 5, 5, 20, 10);
+  }
+
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+  TASSERT(stats.num_reads == nreads);
+  TASSERT(stats.num_sampled_reads == stats2.num_sampled_reads);
+  TASSERT2(stats.num_sampled_reads > nreads/rate/2 &&
+           stats.num_sampled_reads < nreads/rate*2,
+           "%zu", (size_t)stats.num_sampled_reads);
+  TASSERT(stats.gap_err_histgrm[10][10] == stats.num_sampled_reads);
+
+  // Reset keeps the sample rate, then count every read
+  correct_aln_stats_reset(&stats);
+  TASSERT(stats.sample_rate == rate && stats.num_reads == 0);
+
+  correct_aln_stats_set_sample(1);
+  correct_aln_stats_dealloc(&stats2);
+  correct_aln_stats_alloc(&stats2);
+  for(i = 0; i < 100; i++) {
+    sprintf(seq, "ACGT%zuTGCA", i);
+    correct_aln_stats_start_read(&stats2, seq, strlen(seq), true);
+    correct_aln_stats_add(&stats2, 10, 10);
+  }
+  TASSERT(stats2.num_sampled_reads == 200 && stats2.num_sampled_pairs == 100);
+  TASSERT(stats2.gap_err_histgrm[10][10] == 100);
+
+  correct_aln_stats_set_sample(0);
+  TASSERT(correct_aln_stats_get_sample() == ALN_STATS_DEFAULT_SAMPLE);
+
+  correct_aln_stats_dealloc(&stats);
+  correct_aln_stats_dealloc(&stats2);
+}
+
 void test_corrected_aln()
 {
   test_status("Testing correct_alignment.c");
   test_correct_aln_no_paths();
   test_contig_ends_agree();
+  test_aln_stats_sample();
 }
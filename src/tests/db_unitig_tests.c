@@ -3,6 +3,9 @@
 #include "binary_kmer.h"
 #include "db_node.h"
 #include "db_unitig.h"
+#include "unitig_graph.h"
+#include "compact_graph.h"
+#include "unitig_map.h"
 #include "build_graph.h"
 
 #include "bit_array/bit_macros.h"
@@ -116,3 +119,349 @@ void test_db_unitig()
 
   db_graph_dealloc(&graph);
 }
+
+// Check index entry for a kmer matches the unitig we get by walking the graph
+static void unitig_index_check_kmer(hkey_t hkey, const UnitigIndex *uidx,
+                                    dBNodeBuffer *nbuf, size_t *nbad)
+{
+  dBNode node = {.key = hkey, .orient = FORWARD}, first, last;
+  size_t i, offset, uid = unitig_index_id(uidx, hkey);
+
+  db_node_buf_reset(nbuf);
+  db_unitig_fetch(hkey, nbuf, uidx->db_graph);
+  db_unitig_normalise(nbuf->b, nbuf->len, uidx->db_graph);
+
+  if(uid >= uidx->num_unitigs) { (*nbad)++; return; }
+
+  const UnitigIndexEntry *e = &uidx->unitigs[uid];
+  offset = uidx->offsets[hkey];
+  *nbad += (e->len != nbuf->len || offset >= nbuf->len);
+  if(e->len != nbuf->len || offset >= nbuf->len) return;
+
+  *nbad += !db_nodes_are_equal(e->first, nbuf->b[0]);
+  *nbad += !db_nodes_are_equal(e->last, nbuf->b[nbuf->len-1]);
+  *nbad += (nbuf->b[offset].key != hkey);
+
+  // Both orientations give the ends and offset in that orientation
+  size_t o;
+  bool fw;
+  for(o = 0; o < 2; o++) {
+    node.orient = o;
+    fw = (node.orient == nbuf->b[offset].orient);
+    i = unitig_index_ends(uidx, node, &first, &last);
+    *nbad += (i != (fw ? offset : nbuf->len-1-offset));
+    *nbad += !db_nodes_are_equal(first, db_nodes_get(nbuf->b, nbuf->len,
+                                                     fw, 0));
+    *nbad += !db_nodes_are_equal(last, db_nodes_get(nbuf->b, nbuf->len,
+                                                    fw, nbuf->len-1));
+    *nbad += !db_nodes_are_equal(node, db_nodes_get(nbuf->b, nbuf->len, fw, i));
+  }
+}
+
+static void unitig_index_cmp_kmer(hkey_t hkey, const UnitigIndex *a,
+                                  const UnitigIndex *b, size_t *nbad)
+{
+  *nbad += (a->kmers[hkey].unitigid != b->kmers[hkey].unitigid ||
+            a->kmers[hkey].orient != b->kmers[hkey].orient ||
+            a->offsets[hkey] != b->offsets[hkey]);
+}
+
+// Check compacted graph sequences match unitigs and neighbours overlap by k-1
+static void check_compact_graph(const CompactGraph *cg, dBNodeBuffer *nbuf,
+                                size_t *nbad)
+{
+  const dBGraph *graph = cg->db_graph;
+  const size_t kmer_size = graph->kmer_size;
+  size_t i, j, len, nlen;
+  uint8_t o, n;
+  CGraphStep step, next[4];
+  Edges edges;
+  char str[1024], str2[1024], nstr[1024];
+
+  for(i = 0; i < cgraph_num_unitigs(cg); i++)
+  {
+    const UnitigIndexEntry *e = &cg->uidx->unitigs[i];
+    db_node_buf_reset(nbuf);
+    db_unitig_fetch(e->first.key, nbuf, graph);
+    db_unitig_normalise(nbuf->b, nbuf->len, graph);
+    db_nodes_to_str(nbuf->b, nbuf->len, graph, str);
+
+    step = (CGraphStep){.unitigid = i, .orient = FORWARD};
+    len = cgraph_step_to_str(cg, step, str2);
+    *nbad += (len != strlen(str) || strcmp(str, str2) != 0);
+
+    for(o = 0; o < 2; o++) {
+      step.orient = o;
+      cgraph_step_to_str(cg, step, str);
+      n = cgraph_next_steps(cg, step, next);
+      dBNode end = o == FORWARD ? e->last : db_node_reverse(e->first);
+      edges = db_node_get_edges_union(graph, end.key);
+      *nbad += (n != edges_get_outdegree(edges, end.orient));
+      for(j = 0; j < n; j++) {
+        nlen = cgraph_step_to_str(cg, next[j], nstr);
+        *nbad += (nlen < kmer_size ||
+                  strncmp(str+len-kmer_size+1, nstr, kmer_size-1) != 0);
+      }
+    }
+  }
+}
+
+// Coverage sums of the kmers from hkey to each end of its unitig
+static void unitig_covgs_check_kmer(hkey_t hkey, const UnitigCovgs *ucovgs,
+                                    dBNodeBuffer *nbuf, size_t *nbad)
+{
+  const UnitigIndex *uidx = ucovgs->uidx;
+  const dBGraph *db_graph = uidx->db_graph;
+  size_t i, uid = unitig_index_id(uidx, hkey), offset = uidx->offsets[hkey];
+  uint64_t fwsum = 0, rvsum = 0;
+
+  db_node_buf_reset(nbuf);
+  db_unitig_fetch(hkey, nbuf, db_graph);
+  db_unitig_normalise(nbuf->b, nbuf->len, db_graph);
+
+  for(i = 0; i < nbuf->len; i++) {
+    if(i >= offset) fwsum += db_node_get_covg(db_graph, nbuf->b[i].key, 0);
+    if(i <= offset) rvsum += db_node_get_covg(db_graph, nbuf->b[i].key, 0);
+  }
+
+  dBNode node = nbuf->b[offset];
+  *nbad += (unitig_covgs_sum(ucovgs, node, 1, 0) !=
+            db_node_get_covg(db_graph, hkey, 0));
+  *nbad += (unitig_covgs_sum(ucovgs, node, nbuf->len-offset, 0) != fwsum);
+  *nbad += (unitig_covgs_sum(ucovgs, db_node_reverse(node), offset+1, 0) != rvsum);
+  *nbad += (unitig_covgs_range(ucovgs, uid, offset, nbuf->len, 0) != fwsum);
+  *nbad += (unitig_covgs_range(ucovgs, uid, 0, offset+1, 0) != rvsum);
+}
+
+static void _test_unitig_index(const char **seqs, size_t nseqs,
+                               size_t kmer_size, size_t nthreads)
+{
+  dBGraph graph;
+  size_t i, nbad = 0;
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 2048,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  for(i = 0; i < nseqs; i++)
+    build_graph_from_str_mt(&graph, 0, seqs[i], strlen(seqs[i]), false);
+
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+  dBNodeBuffer nbuf;
+  db_node_buf_alloc(&nbuf, 1024);
+
+  UnitigIndex uidx, uidx2;
+  unitig_index_alloc(&uidx, &graph);
+  unitig_index_build(&uidx, nthreads, visited);
+  TASSERT(uidx.num_kmers == hash_table_nkmers(&graph.ht));
+
+  HASH_ITERATE(&graph.ht, unitig_index_check_kmer, &uidx, &nbuf, &nbad);
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+
+  // Unitigs are numbered in hash table order of their first kmer
+  for(i = 1; i < uidx.num_unitigs; i++)
+    nbad += (uidx.unitigs[i-1].first.key >= uidx.unitigs[i].first.key);
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+
+  // Compacted graph built from the index
+  CompactGraph cgraph;
+  cgraph_alloc(&cgraph, &uidx);
+  cgraph_build(&cgraph, nthreads);
+  TASSERT(cgraph_num_unitigs(&cgraph) == uidx.num_unitigs);
+  check_compact_graph(&cgraph, &nbuf, &nbad);
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+  for(i = 0; i < cgraph_num_unitigs(&cgraph); i++)
+    nbad += (cgraph.covgs[i] < cgraph.unitigs[i].num_kmers);
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+
+  // Each link is printed once, so there are half as many links as
+  // neighbours, plus one for each link from a unitig end to itself
+  size_t nsteps = 0, nself = 0, nlinks;
+  CGraphStep step, next[4];
+  uint8_t o, n, j;
+  for(i = 0; i < cgraph_num_unitigs(&cgraph); i++) {
+    for(o = 0; o < 2; o++) {
+      step = (CGraphStep){.unitigid = i, .orient = o};
+      n = cgraph_next_steps(&cgraph, step, next);
+      nsteps += n;
+      for(j = 0; j < n; j++)
+        nself += (next[j].unitigid == i && next[j].orient != o);
+    }
+  }
+  FILE *gfa = tmpfile();
+  TASSERT(gfa != NULL);
+  if(gfa != NULL) {
+    nlinks = cgraph_write_gfa(&cgraph, nthreads, gfa);
+    TASSERT2(nlinks*2 == nsteps + nself, "%zu %zu %zu", nlinks, nsteps, nself);
+    fclose(gfa);
+  }
+  FILE *fa = tmpfile();
+  TASSERT(fa != NULL);
+  if(fa != NULL) {
+    TASSERT(cgraph_write_fasta(&cgraph, nthreads, fa) == uidx.num_unitigs);
+    fclose(fa);
+  }
+
+  // Coverage prefix sums agree with kmer coverages and the compacted graph
+  UnitigCovgs ucovgs;
+  unitig_covgs_alloc(&ucovgs, &uidx);
+  unitig_covgs_build(&ucovgs, nthreads);
+  HASH_ITERATE(&graph.ht, unitig_covgs_check_kmer, &ucovgs, &nbuf, &nbad);
+  for(i = 0; i < uidx.num_unitigs; i++) {
+    nbad += (unitig_covgs_range(&ucovgs, i, 0, uidx.unitigs[i].len, 0) !=
+             cgraph.covgs[i]);
+    nbad += (unitig_covgs_mean(&ucovgs, i, 0) !=
+             cgraph_unitig_covg_mean(&cgraph, i, 0));
+  }
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+  unitig_covgs_dealloc(&ucovgs);
+
+  cgraph_dealloc(&cgraph);
+
+  // Save and reload
+  FILE *fh = tmpfile();
+  TASSERT(fh != NULL);
+  if(fh != NULL) {
+    size_t nbytes = unitig_index_write(&uidx, fh, "tmpfile");
+    TASSERT((size_t)ftell(fh) == nbytes);
+    rewind(fh);
+
+    unitig_index_alloc(&uidx2, &graph);
+    unitig_index_read(&uidx2, nthreads, fh, "tmpfile");
+    fclose(fh);
+
+    TASSERT(uidx2.num_unitigs == uidx.num_unitigs);
+    TASSERT(uidx2.num_kmers == uidx.num_kmers);
+    HASH_ITERATE(&graph.ht, unitig_index_cmp_kmer, &uidx, &uidx2, &nbad);
+    TASSERT2(nbad == 0, "nbad: %zu", nbad);
+    unitig_index_dealloc(&uidx2);
+  }
+
+  unitig_index_dealloc(&uidx);
+  db_node_buf_dealloc(&nbuf);
+  ctx_free(visited);
+  db_graph_dealloc(&graph);
+}
+
+void test_unitig_index()
+{
+  test_status("testing unitig index, compacted graph and coverage sums...");
+
+  // Loops, cycles, hairpins and a branching path
+  const char *seqs[] = {"AGAGAGAGAGAGAGAGAGAGAGAG",
+                        "ATATATATATATATATATATATATATAT",
+                        "CCCCGCAAAGTCCACTTAGTGTAAGGTACAAATTCTGCAGAGTTGCTGG",
+                        "TCAATCCGATAGCAACCCGGTCCAA""TCAATCCGATAGCAACCCGGTCCAA",
+                        "GTTCGCGAATTCCGTAAACGTGAATGCACCGTAAACTGGTACGATACCGG",
+                        "GTTCGCGAATTCCGTAAACGTGAATGCTTTTGCAGGCGTCTCTT",
+                        "TTTGCAGGCGTCTCTTACCTGACTCTGAATGAGACGCCTGCAAA"};
+  size_t nseqs = sizeof(seqs)/sizeof(seqs[0]);
+
+  _test_unitig_index(seqs, nseqs, 11, 1);
+  _test_unitig_index(seqs, nseqs, 19, 1);
+  _test_unitig_index(seqs, nseqs, 19, 3);
+
+  // Random sequence
+  char rnd[4][301];
+  const char *rseqs[4];
+  size_t i;
+  for(i = 0; i < 4; i++) {
+    rand_bases(rnd[i], 300);
+    rnd[i][300] = '\0';
+    rseqs[i] = rnd[i];
+  }
+  memcpy(rnd[1]+100, rnd[0]+100, 50); // share some kmers
+  _test_unitig_index(rseqs, 4, 11, 4);
+  _test_unitig_index(rseqs, 4, 21, 2);
+}
+
+// Aligning reads must give the same result with and without a unitig map
+static void _test_unitig_map(const char **seqs, size_t nseqs,
+                             size_t kmer_size, size_t nthreads)
+{
+  dBGraph graph;
+  size_t i, j, start, len, nbad = 0;
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 4096,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  for(i = 0; i < nseqs; i++)
+    build_graph_from_str_mt(&graph, 0, seqs[i], strlen(seqs[i]), false);
+
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+  UnitigIndex uidx;
+  UnitigMap umap;
+  unitig_index_alloc(&uidx, &graph);
+  unitig_index_build(&uidx, nthreads, visited);
+  unitig_map_alloc(&umap, &graph);
+  unitig_map_build(&umap, &uidx, nthreads);
+  unitig_index_dealloc(&uidx);
+  ctx_free(visited);
+
+  TASSERT(umap.num_kmers == hash_table_nkmers(&graph.ht));
+  TASSERT(umap.num_minimizers > 0);
+
+  dBAlignment aln0, aln1;
+  db_alignment_alloc(&aln0);
+  db_alignment_alloc(&aln1);
+  read_t r;
+  seq_read_alloc(&r);
+  char str[201];
+
+  for(i = 0; i < 200; i++)
+  {
+    // Random substring, some reverse complemented, some with a mismatch
+    const char *seq = seqs[rand() % nseqs];
+    len = MIN2(strlen(seq), kmer_size + (size_t)rand() % 100);
+    start = rand() % (strlen(seq) - len + 1);
+    memcpy(str, seq+start, len);
+    str[len] = '\0';
+    if(rand() & 1) dna_reverse_complement_str(str, len);
+    if(rand() & 1) {
+      j = rand() % len;
+      str[j] = dna_nuc_to_char((dna_char_to_nuc(str[j])+1) & 3);
+    }
+    seq_read_set(&r, str);
+
+    graph.umap = NULL;
+    db_alignment_from_reads(&aln0, &r, NULL, 0, 0, 0, &graph, -1);
+    graph.umap = &umap;
+    db_alignment_from_reads(&aln1, &r, NULL, 0, 0, 0, &graph, -1);
+
+    nbad += (aln0.nodes.len != aln1.nodes.len);
+    for(j = 0; j < aln0.nodes.len && j < aln1.nodes.len; j++) {
+      nbad += (aln0.nodes.b[j].key != aln1.nodes.b[j].key ||
+               aln0.nodes.b[j].orient != aln1.nodes.b[j].orient ||
+               aln0.rpos.b[j] != aln1.rpos.b[j] ||
+               aln0.brks[j] != aln1.brks[j]);
+    }
+  }
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+
+  graph.umap = NULL;
+  seq_read_dealloc(&r);
+  db_alignment_dealloc(&aln0);
+  db_alignment_dealloc(&aln1);
+  unitig_map_dealloc(&umap);
+  db_graph_dealloc(&graph);
+}
+
+void test_unitig_map()
+{
+  test_status("testing unitig_map_seq() with db_alignment_from_reads()...");
+
+  // Random sequence with a shared segment to break unitigs, and a repeat
+  char rnd[3][401];
+  const char *rseqs[3];
+  size_t i;
+  for(i = 0; i < 3; i++) {
+    rand_bases(rnd[i], 400);
+    rnd[i][400] = '\0';
+    rseqs[i] = rnd[i];
+  }
+  memcpy(rnd[1]+100, rnd[0]+200, 60);
+  memcpy(rnd[2]+300, rnd[2]+50, 40);
+
+  _test_unitig_map(rseqs, 3, 11, 1);
+  _test_unitig_map(rseqs, 3, 21, 2);
+  _test_unitig_map(rseqs, 3, 31, 3);
+}
@@ -3,6 +3,66 @@
 #include <ctype.h>
 
 #include "dna.h"
+#include "cpu_dispatch.h"
+
+static void test_dna_check_acgtn()
+{
+  char seq[200];
+  const char bad[] = "\0 -.BUXacgtnACGTN";
+  size_t i, j, n;
+  CpuSimd lvl, max = cpu_simd_supported();
+
+  // Test each SIMD version this CPU supports
+  for(lvl = CPU_SIMD_NONE; lvl <= max; lvl++) {
+    cpu_simd_set(lvl);
+    test_status("Testing dna_check_acgtn() [simd=%s]", dna_check_acgtn_simd_str());
+    for(n = 0; n < sizeof(seq); n += 7) {
+      for(i = 0; i < n; i++) seq[i] = "ACGTNacgtn"[rand() % 10];
+      TASSERT(dna_check_acgtn(seq, n) == n);
+      // Put an invalid char at each position
+      for(i = 0; i < n; i++) {
+        for(j = 0; j < 7; j++) {
+          char c = seq[i];
+          seq[i] = bad[j];
+          TASSERT(dna_check_acgtn(seq, n) == i);
+          seq[i] = c;
+        }
+      }
+    }
+  }
+}
+
+static void test_dna_encode_nucs()
+{
+  char seq[200];
+  Nucleotide nucs[200];
+  const char bad[] = "\0 -.BUXnN";
+  size_t i, j, n;
+  CpuSimd lvl, max = cpu_simd_supported();
+
+  // Test each SIMD version this CPU supports
+  for(lvl = CPU_SIMD_NONE; lvl <= max; lvl++) {
+    cpu_simd_set(lvl);
+    test_status("Testing dna_encode_nucs() [simd=%s]", dna_encode_nucs_simd_str());
+    for(n = 0; n < sizeof(seq); n += 7) {
+      for(i = 0; i < n; i++) seq[i] = "ACGTacgt"[rand() % 8];
+      TASSERT(dna_encode_nucs(seq, n, nucs) == n);
+      for(i = 0; i < n; i++)
+        TASSERT2(nucs[i] == dna_char_to_nuc(seq[i]), "%zu: %c", i, seq[i]);
+      TASSERT(dna_encode_nucs(seq, n, NULL) == n);
+      // Put an invalid char at each position
+      for(i = 0; i < n; i++) {
+        for(j = 0; j < sizeof(bad)-1; j++) {
+          char c = seq[i];
+          seq[i] = bad[j];
+          TASSERT(dna_encode_nucs(seq, n, nucs) == i);
+          TASSERT(dna_encode_nucs(seq, n, NULL) == i);
+          seq[i] = c;
+        }
+      }
+    }
+  }
+}
 
 void test_dna_functions()
 {
@@ -64,4 +124,7 @@ void test_dna_functions()
   // revcmp the whole string
   dna_reverse_complement_str(str,len);
   TASSERT(strcmp(str,rev) == 0);
+
+  test_dna_check_acgtn();
+  test_dna_encode_nucs();
 }
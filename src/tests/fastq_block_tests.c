@@ -0,0 +1,69 @@
+#include "global.h"
+#include "all_tests.h"
+#include "fastq_block.h"
+
+#include <unistd.h>
+
+// Write `str` to a new temporary file, returns false on failure
+static bool _write_tmp_file(char *path, const char *str)
+{
+  if(!test_tmp_file(path, "fastq_block_test", ".fq")) return false;
+  FILE *fh = fopen(path, "w");
+  TASSERT(fh != NULL);
+  if(fh == NULL) { unlink(path); return false; }
+  TASSERT(fputs(str, fh) >= 0);
+  fclose(fh);
+  return true;
+}
+
+// Read `path` with buffer size `bufsize`, compare with expected reads
+static void _check_reads(const char *path, size_t bufsize, size_t nreads,
+                         const char **names, const char **seqs,
+                         const char **quals)
+{
+  FastqBlock fb;
+  read_t r;
+  size_t i;
+  memset(&r, 0, sizeof(r));
+  fastq_block_open(&fb, path, bufsize);
+  for(i = 0; i < nreads && fastq_block_read(&fb, &r); i++) {
+    TASSERT2(strcmp(r.name.b, names[i]) == 0, "%s vs %s", r.name.b, names[i]);
+    TASSERT(strcmp(r.seq.b, seqs[i]) == 0 && r.seq.end == strlen(seqs[i]));
+    TASSERT(strcmp(r.qual.b, quals[i]) == 0 && r.qual.end == strlen(quals[i]));
+  }
+  TASSERT(i == nreads);
+  TASSERT(fastq_block_read(&fb, &r) == 0);
+  fastq_block_close(&fb);
+}
+
+void test_fastq_block()
+{
+  test_status("Testing FASTQ block parser");
+
+  const char *names[3] = {"read0 extra", "read1", "read2"};
+  const char *seqs[3] = {"ACGTTTGCAGGATCCA", "", "GATTACANNNNNNNNNNNNNNNNNNNNNNNNNNNACGT"};
+  const char *quals[3] = {"IIIIIIIIIIIIIIII", "", "@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@"};
+
+  // Windows line endings, a blank line and no new line at the end
+  char file[1000];
+  sprintf(file, "@%s\r\n%s\r\n+\r\n%s\r\n\n@%s\n%s\n+%s\n%s\n@%s\n%s\n+\n%s",
+          names[0], seqs[0], quals[0], names[1], seqs[1], names[1], quals[1],
+          names[2], seqs[2], quals[2]);
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!_write_tmp_file(path, file)) return;
+
+  TASSERT(fastq_block_usable(path));
+
+  // Small buffers force records to be split between reads and buffer growth
+  _check_reads(path, 64, 3, names, seqs, quals);
+  _check_reads(path, 100, 3, names, seqs, quals);
+  _check_reads(path, FASTQ_BLOCK_SIZE, 3, names, seqs, quals);
+  unlink(path);
+
+  // FASTA cannot be block parsed
+  char path2[TEST_TMP_PATH_LEN];
+  if(!_write_tmp_file(path2, ">read0\nACGT\n>read1\nACGT\n")) return;
+  TASSERT(!fastq_block_usable(path2));
+  unlink(path2);
+}
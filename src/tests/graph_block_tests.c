@@ -0,0 +1,198 @@
+#include "global.h"
+#include "all_tests.h"
+#include "graph_block.h"
+
+// Drop the odd colours from a colour-major block loaded into `dec`, as done
+// when reading a subset of colours from a file
+static void drop_odd_colours(GraphBlockDecoder *dec, size_t ncols)
+{
+  uint32_t kbytes, secbytes, zero = 0;
+  size_t col, src, dst;
+  memcpy(&kbytes, dec->buf.b, sizeof(uint32_t));
+  uint8_t *table = dec->buf.b + sizeof(uint32_t) + kbytes;
+  src = dst = sizeof(uint32_t) + kbytes + ncols*sizeof(uint32_t);
+  for(col = 0; col < ncols; col++) {
+    memcpy(&secbytes, table + col*sizeof(uint32_t), sizeof(uint32_t));
+    if(col & 1) memcpy(table + col*sizeof(uint32_t), &zero, sizeof(uint32_t));
+    else { memmove(dec->buf.b+dst, dec->buf.b+src, secbytes); dst += secbytes; }
+    src += secbytes;
+  }
+  dec->buf.len = dst;
+}
+
+// Write kmers to a temporary file, then read back the trailer, index and
+// each block and check we get the same kmers, coverages and edges
+static void test_block_round_trip(size_t nkmers, size_t ncols, bool sorted,
+                                  uint32_t layout)
+{
+  size_t i, j, b, hdrsize = 17;
+  BinaryKmer *bkmers = ctx_malloc(nkmers * sizeof(BinaryKmer));
+  Covg *covgs = ctx_calloc(nkmers * ncols, sizeof(Covg));
+  Edges *edges = ctx_calloc(nkmers * ncols, sizeof(Edges));
+
+  for(i = 0; i < nkmers; i++) {
+    rand_bytes((uint8_t*)bkmers[i].b, sizeof(BinaryKmer));
+    if(sorted) {
+      memset(&bkmers[i], 0, sizeof(BinaryKmer));
+      bkmers[i].b[NUM_BKMER_WORDS-1] = i*3 + (i > 0 ? bkmers[i-1].b[0] : 0);
+    }
+    // Leave most colours empty, some with huge coverage
+    for(j = 0; j < ncols; j++) {
+      if(rand() % 3 == 0) covgs[i*ncols+j] = (rand() % 10 == 0) ? UINT32_MAX : j+1;
+      if(rand() % 4 == 0) edges[i*ncols+j] = rand() & 0xff;
+    }
+  }
+
+  FILE *fh = tmpfile();
+  TASSERT(fh != NULL);
+  if(fh == NULL) return;
+
+  // Pretend there is a header of `hdrsize` bytes
+  char hdr[17];
+  memset(hdr, 'x', hdrsize);
+  fwrite(hdr, 1, hdrsize, fh);
+
+  GraphBlockWriter wtr;
+  graph_block_writer_alloc(&wtr, fh, ncols, hdrsize, layout);
+  for(i = 0; i < nkmers; i++)
+    graph_block_writer_add(&wtr, bkmers[i], covgs+i*ncols, edges+i*ncols);
+  size_t nbytes = graph_block_writer_finish(&wtr);
+  graph_block_writer_dealloc(&wtr);
+  fflush(fh);
+
+  size_t fsize = (size_t)ftell(fh);
+  TASSERT(fsize == hdrsize + nbytes);
+
+  GraphBlockTrailer trailer;
+  GraphBlockBuffer index;
+  GraphBlockDecoder dec;
+  gblock_buf_alloc(&index, 16);
+  graph_block_decoder_alloc(&dec);
+
+  TASSERT(graph_block_read_trailer(fileno(fh), fsize, &trailer));
+  TASSERT(trailer.nkmers == nkmers);
+  TASSERT(trailer.nblocks == (nkmers+GRAPH_BLOCK_NKMERS-1)/GRAPH_BLOCK_NKMERS);
+  TASSERT(graph_block_read_index(fileno(fh), &trailer, &index));
+  TASSERT(index.len == trailer.nblocks);
+
+  BinaryKmer bkmer;
+  Covg kcovgs[ncols];
+  Edges kedges[ncols];
+  size_t nread = 0, nbad = 0;
+
+  for(b = 0; b < index.len; b++) {
+    TASSERT(index.b[b].kmer_offset == nread);
+    TASSERT(binary_kmer_eq(index.b[b].first, bkmers[nread]));
+    int64_t n = graph_block_pread(fileno(fh), index.b[b].offset, &dec);
+    TASSERT(n > 0 && n <= GRAPH_BLOCK_NKMERS);
+    while(graph_block_decode(&dec, ncols, &bkmer, kcovgs, kedges) == 1) {
+      nbad += !binary_kmer_eq(bkmer, bkmers[nread]);
+      nbad += memcmp(kcovgs, covgs+nread*ncols, ncols*sizeof(Covg)) != 0;
+      nbad += memcmp(kedges, edges+nread*ncols, ncols*sizeof(Edges)) != 0;
+      nread++;
+    }
+  }
+
+  TASSERT(nread == nkmers);
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+
+  // Colour-major blocks decode with only some colours loaded
+  if(layout == GRAPH_BLOCK_COLMAJOR) {
+    for(b = 0, nread = 0; b < index.len; b++) {
+      graph_block_pread(fileno(fh), index.b[b].offset, &dec);
+      drop_odd_colours(&dec, ncols);
+      while(graph_block_decode(&dec, ncols, &bkmer, kcovgs, kedges) == 1) {
+        nbad += !binary_kmer_eq(bkmer, bkmers[nread]);
+        for(j = 0; j < ncols; j++) {
+          Covg c = (j & 1) ? 0 : covgs[nread*ncols+j];
+          Edges e = (j & 1) ? 0 : edges[nread*ncols+j];
+          nbad += (kcovgs[j] != c || kedges[j] != e);
+        }
+        nread++;
+      }
+    }
+    TASSERT(nread == nkmers);
+    TASSERT2(nbad == 0, "nbad: %zu", nbad);
+  }
+
+  // Corrupt block is detected
+  if(nkmers > 0) {
+    graph_block_pread(fileno(fh), index.b[0].offset, &dec);
+    dec.buf.len = 1;
+    TASSERT(graph_block_decode(&dec, ncols, &bkmer, kcovgs, kedges) == -1);
+  }
+
+  graph_block_decoder_dealloc(&dec);
+  gblock_buf_dealloc(&index);
+  fclose(fh);
+  ctx_free(bkmers);
+  ctx_free(covgs);
+  ctx_free(edges);
+}
+
+// Coverages of related samples: close to a shared value, sometimes missing
+static void test_covg_delta(size_t ncols)
+{
+  const size_t nkmers = 500;
+  size_t i, j, nbad = 0;
+  Covg covgs[ncols], dcovgs[ncols];
+  Edges edges[ncols], dedges[ncols];
+  ByteBuffer buf;
+  byte_buf_alloc(&buf, 64);
+
+  for(i = 0; i < nkmers; i++) {
+    Covg c = (i % 50 == 0) ? (Covg)(UINT32_MAX - 3) : (Covg)(rand() % 100);
+    for(j = 0; j < ncols; j++) {
+      covgs[j] = (rand() % 8 == 0 || c < 3) ? 0 : (Covg)(c + rand() % 7 - 3);
+      edges[j] = (rand() % 8 == 0) ? rand() & 0xff : 0x11;
+    }
+    if(i == 1) memset(covgs, 0, sizeof(covgs)); // all colours at the base
+    if(i == 2) { covgs[0] = UINT32_MAX; covgs[ncols-1] = 0; }
+    byte_buf_reset(&buf);
+    graph_covg_delta_encode(&buf, covgs, edges, ncols);
+    const uint8_t *p = buf.b, *end = buf.b + buf.len;
+    nbad += !graph_covg_delta_decode(&p, end, ncols, dcovgs, dedges);
+    nbad += (p != end);
+    nbad += memcmp(covgs, dcovgs, sizeof(covgs)) != 0;
+    nbad += memcmp(edges, dedges, sizeof(edges)) != 0;
+    // Truncated input is detected
+    p = buf.b;
+    nbad += graph_covg_delta_decode(&p, end-1, ncols, dcovgs, dedges);
+  }
+
+  TASSERT2(nbad == 0, "nbad: %zu ncols: %zu", nbad, ncols);
+
+  // Similar samples take about a byte per colour (5 bytes uncompressed)
+  for(j = 0; j < ncols; j++) { covgs[j] = 30 + j%3; edges[j] = 0x11; }
+  byte_buf_reset(&buf);
+  graph_covg_delta_encode(&buf, covgs, edges, ncols);
+  TASSERT2(buf.len <= 4 + ncols, "%zu bytes for %zu cols", buf.len, ncols);
+
+  byte_buf_dealloc(&buf);
+}
+
+void test_graph_block()
+{
+  test_status("Testing block compressed graph records...");
+  test_block_round_trip(0, 1, true, 0);
+  test_block_round_trip(1, 1, true, 0);
+  test_block_round_trip(GRAPH_BLOCK_NKMERS, 3, true, 0);
+  test_block_round_trip(5*GRAPH_BLOCK_NKMERS+7, 5, true, 0);
+  test_block_round_trip(3*GRAPH_BLOCK_NKMERS+1, 2, false, 0);
+  // Colour-major blocks
+  test_block_round_trip(0, 1, true, GRAPH_BLOCK_COLMAJOR);
+  test_block_round_trip(1, 1, true, GRAPH_BLOCK_COLMAJOR);
+  test_block_round_trip(GRAPH_BLOCK_NKMERS, 3, true, GRAPH_BLOCK_COLMAJOR);
+  test_block_round_trip(5*GRAPH_BLOCK_NKMERS+7, 9, true, GRAPH_BLOCK_COLMAJOR);
+  test_block_round_trip(3*GRAPH_BLOCK_NKMERS+1, 2, false, GRAPH_BLOCK_COLMAJOR);
+  // Delta coverage blocks
+  test_covg_delta(1);
+  test_covg_delta(3);
+  test_covg_delta(8);
+  test_covg_delta(21);
+  test_block_round_trip(0, 1, true, GRAPH_BLOCK_DELTACOV);
+  test_block_round_trip(1, 1, true, GRAPH_BLOCK_DELTACOV);
+  test_block_round_trip(GRAPH_BLOCK_NKMERS, 3, true, GRAPH_BLOCK_DELTACOV);
+  test_block_round_trip(5*GRAPH_BLOCK_NKMERS+7, 17, true, GRAPH_BLOCK_DELTACOV);
+  test_block_round_trip(3*GRAPH_BLOCK_NKMERS+1, 2, false, GRAPH_BLOCK_DELTACOV);
+}
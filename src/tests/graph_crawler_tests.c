@@ -75,6 +75,36 @@ void test_graph_crawler()
     TASSERT2(nbuf.len == 65, "nbuf.len: %zu", nbuf.len);
   }
 
+  // Walking every colour should give the same paths as the union crawl
+  dBNodeBuffer nbuf2;
+  db_node_buf_alloc(&nbuf2, 16);
+  GraphCrawler crawler2;
+  graph_crawler_alloc(&crawler2, &graph);
+  crawler2.union_crawl = false;
+  const GCachePath *path, *path2;
+
+  graph_crawler_fetch(&crawler2, node, next_nodes, next_idx, num_next,
+                      NULL, graph.num_of_cols, NULL, NULL, NULL);
+
+  TASSERT2(crawler2.num_paths == crawler.num_paths, "num_paths: %u",
+           crawler2.num_paths);
+
+  for(i = 0; i < ncols; i++) {
+    TASSERT((crawler.col_paths[i] < 0) == (crawler2.col_paths[i] < 0));
+    if(crawler.col_paths[i] < 0) continue;
+    path = graph_cache_path(&crawler.cache, crawler.col_paths[i]);
+    path2 = graph_cache_path(&crawler2.cache, crawler2.col_paths[i]);
+    db_node_buf_reset(&nbuf);
+    db_node_buf_reset(&nbuf2);
+    gc_path_fetch_nodes(&crawler.cache, path, path->num_steps, &nbuf);
+    gc_path_fetch_nodes(&crawler2.cache, path2, path2->num_steps, &nbuf2);
+    TASSERT(nbuf.len == nbuf2.len);
+    TASSERT(memcmp(nbuf.b, nbuf2.b, nbuf.len * sizeof(dBNode)) == 0);
+  }
+
+  graph_crawler_dealloc(&crawler2);
+  db_node_buf_dealloc(&nbuf2);
+
   strbuf_dealloc(&sbuf);
   db_node_buf_dealloc(&nbuf);
 
@@ -0,0 +1,117 @@
+#include "global.h"
+#include "all_tests.h"
+#include "graph_footer.h"
+#include "graph_search.h"
+#include "graph_writer.h"
+#include "file_util.h"
+
+#include <unistd.h> // unlink
+#include <sys/mman.h>
+
+// Write a sorted graph with `nkmers` spread over the kmer space, index it with
+// `nthreads` and check the footer, reading and searching the file
+static void test_footer_file(size_t nkmers, size_t nthreads)
+{
+  const size_t kmer_size = 31, ncols = 2;
+  const uint64_t step = (1UL << (2*kmer_size)) / MAX2(nkmers, 1);
+  size_t i, x, next = 0, nbad = 0;
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!test_tmp_file(path, "footer_test", ".ctx")) return;
+
+  GraphFileHeader hdr = {.version = CTX_GRAPH_FILEFORMAT,
+                         .kmer_size = kmer_size,
+                         .num_of_bitfields = NUM_BKMER_WORDS,
+                         .num_of_cols = ncols};
+  graph_header_capacity(&hdr, ncols);
+
+  BinaryKmer bkmer, *bkmers = ctx_malloc(MAX2(nkmers, 1) * sizeof(BinaryKmer));
+  Covg covgs[ncols];
+  Edges edges[ncols];
+
+  FILE *fh = futil_fopen(path, "w");
+  graph_write_header(fh, &hdr);
+  for(i = 0; i < nkmers; i++) {
+    bkmers[i] = zero_bkmer;
+    bkmers[i].b[NUM_BKMER_WORDS-1] = i*step + (uint64_t)rand() % step;
+    covgs[0] = i; covgs[1] = 1;
+    edges[0] = i & 0xff; edges[1] = 0;
+    graph_write_kmer(fh, ncols, bkmers[i], covgs, edges);
+  }
+  fclose(fh);
+  graph_header_dealloc(&hdr);
+
+  // Index twice, the second footer replaces the first
+  GraphFileReader file;
+  memset(&file, 0, sizeof(file));
+  graph_file_open2(&file, path, "r+", true, 0);
+  TASSERT(file.data_end == 0);
+  TASSERT(file.num_of_kmers == (int64_t)nkmers);
+  graph_footer_index_file(&file, nthreads);
+  graph_file_close(&file);
+
+  graph_file_open2(&file, path, "r+", true, 0);
+  TASSERT(file.num_of_kmers == (int64_t)nkmers);
+  graph_footer_index_file(&file, nthreads+1);
+  graph_file_close(&file);
+
+  graph_file_open2(&file, path, "r", true, 0);
+  TASSERT(file.num_of_kmers == (int64_t)nkmers);
+  TASSERT(file.data_end == graph_file_offset(&file, nkmers));
+
+  GraphFooter footer;
+  int fd = graph_file_fileno(&file);
+  TASSERT(graph_footer_read(fd, file.file_size, &footer));
+  TASSERT(footer.nkmers == nkmers);
+  TASSERT(footer.pfxbases == graph_pfx_bases(nkmers, kmer_size));
+
+  // Compare with a single pass over the kmers
+  const size_t p = footer.pfxbases, npfx = graph_pfx_len(p);
+  uint64_t *exp = ctx_malloc(npfx * sizeof(uint64_t));
+  for(i = 0; i < nkmers; i++) {
+    x = p ? graph_pfx_get(bkmers[i], kmer_size, p) : 0;
+    graph_pfx_add(exp, &next, x, i);
+  }
+  graph_pfx_add(exp, &next, npfx-1, nkmers);
+
+  uint64_t *pfx = graph_footer_load(fd, &footer);
+  TASSERT(pfx != NULL && memcmp(pfx, exp, npfx*sizeof(uint64_t)) == 0);
+  ctx_free(pfx);
+
+  void *map = NULL;
+  size_t maplen = 0;
+  pfx = graph_footer_map(fd, &footer, &map, &maplen);
+  TASSERT(pfx != NULL && memcmp(pfx, exp, npfx*sizeof(uint64_t)) == 0);
+  if(map) munmap(map, maplen);
+
+  // Reading stops at the last kmer
+  for(i = 0; graph_file_read_reset(&file, &bkmer, covgs, edges); i++)
+    nbad += (i >= nkmers || !binary_kmer_eq(bkmer, bkmers[i]) || covgs[0] != i);
+  TASSERT(i == nkmers);
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+
+  // Search with the prefix table from the footer
+  GraphFileSearch *gs = graph_search_new(&file);
+  TASSERT(gs != NULL);
+  for(i = 0; gs && i < nkmers; i++) {
+    nbad += (!graph_search_find(gs, bkmers[i], covgs, edges) ||
+             covgs[0] != i || edges[0] != (i & 0xff));
+  }
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+  if(gs) graph_search_destroy(gs);
+
+  graph_file_close(&file);
+  unlink(path);
+  ctx_free(exp);
+  ctx_free(bkmers);
+}
+
+void test_graph_footer()
+{
+  test_status("Testing graph index footers...");
+  test_footer_file(0, 1);
+  test_footer_file(1, 2);
+  test_footer_file(100, 4);
+  test_footer_file(20000, 1);
+  test_footer_file(20000, 7);
+}
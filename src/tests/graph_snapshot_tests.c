@@ -0,0 +1,114 @@
+#include "global.h"
+#include "all_tests.h"
+#include "graph_snapshot.h"
+#include "build_graph.h"
+#include "generate_paths.h"
+
+#include <unistd.h>
+
+static void _check_same_paths(const dBGraph *a, const dBGraph *b)
+{
+  const GPathSet *aset = &a->gpstore.gpset, *bset = &b->gpstore.gpset;
+  const GPath *ap, *bp;
+  size_t nbytes, hkey;
+
+  TASSERT(a->gpstore.num_paths == b->gpstore.num_paths);
+  TASSERT(a->gpstore.num_kmers_with_paths == b->gpstore.num_kmers_with_paths);
+  TASSERT(aset->entries.len == bset->entries.len);
+
+  for(hkey = 0; hkey < a->ht.capacity; hkey++) {
+    ap = gpath_store_fetch(&a->gpstore, hkey);
+    bp = gpath_store_fetch(&b->gpstore, hkey);
+    for(; ap != NULL && bp != NULL; ap = gpath_next(ap), bp = gpath_next(bp)) {
+      TASSERT(gpset_get_pkey(aset, ap) == gpset_get_pkey(bset, bp));
+      TASSERT(ap->orient == bp->orient && ap->num_juncs == bp->num_juncs);
+      nbytes = binary_seq_mem(ap->num_juncs);
+      TASSERT(memcmp(gpath_seq(ap), gpath_seq(bp), nbytes) == 0);
+      TASSERT(memcmp(gpath_set_get_nseen(aset, ap),
+                     gpath_set_get_nseen(bset, bp), aset->ncols) == 0);
+    }
+    TASSERT(ap == NULL && bp == NULL);
+  }
+}
+
+void test_graph_snapshot()
+{
+  test_status("Testing graph snapshots");
+
+  char seq0[] = "CCGATTAAAGGGTTACTATAGCACAGGAATGGTCTGGCCTGTAAGAAGTCCAGCTTC";
+  char seq1[] = "CAGATTAAAGGGTTACTGTAGCACAGGAATGGTCTGGCCTGTAAGATGTCCAGCTTC";
+  const char *seqs[2] = {seq0, seq1};
+
+  dBGraph graph, loaded;
+  size_t kmer_size = 11, ncols = 1;
+
+  CorrectAlnParam params = {.ctpcol = 0, .ctxcol = 0,
+                            .frag_len_min = 0, .frag_len_max = 0,
+                            .one_way_gap_traverse = true, .use_end_check = true,
+                            .max_context = 10,
+                            .gap_variance = 0.1, .gap_wiggle = 5};
+
+  all_tests_construct_graph(&graph, kmer_size, ncols, seqs, 2, params);
+  strbuf_set(&graph.ginfo[0].sample_name, "sample0");
+  graph.ginfo[0].total_sequence = 1234;
+  TASSERT(graph.gpstore.num_paths > 0);
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!test_tmp_file(path, "snapshot_test", ".snap")) {
+    db_graph_dealloc(&graph);
+    return;
+  }
+  TASSERT(!graph_snapshot_is_file(path));
+
+  SnapshotProgress progress, loaded_progress;
+  graph_snapshot_progress_init(&progress, "test");
+  graph_snapshot_save(path, &graph, &progress);
+  TASSERT(graph_snapshot_is_file(path));
+
+  // Update progress in place
+  progress.next_hkey = 17;
+  progress.nitems = 3;
+  progress.out_bytes = 1000;
+  graph_snapshot_set_progress(path, &progress);
+
+  graph_snapshot_load(path, &loaded, &loaded_progress);
+  unlink(path);
+
+  TASSERT(strcmp(loaded_progress.cmd, "test") == 0);
+  TASSERT(loaded_progress.next_hkey == 17);
+  TASSERT(loaded_progress.nitems == 3);
+  TASSERT(loaded_progress.out_bytes == 1000);
+
+  // Hash table restored as is, including the seed
+  size_t capacity = graph.ht.capacity;
+  TASSERT(loaded.kmer_size == kmer_size);
+  TASSERT(loaded.num_of_cols == ncols);
+  TASSERT(loaded.num_of_cols_used == graph.num_of_cols_used);
+  TASSERT(loaded.ht.capacity == capacity);
+  TASSERT(loaded.ht.seed == graph.ht.seed);
+  TASSERT(loaded.ht.num_kmers == graph.ht.num_kmers);
+  TASSERT(memcmp(loaded.ht.table, graph.ht.table,
+                 capacity * sizeof(BinaryKmer)) == 0);
+  TASSERT(memcmp(loaded.ht.buckets, graph.ht.buckets,
+                 graph.ht.num_of_buckets * sizeof(uint8_t[2])) == 0);
+  TASSERT(memcmp(loaded.col_edges, graph.col_edges,
+                 capacity * ncols * sizeof(Edges)) == 0);
+  TASSERT(memcmp(loaded.col_covgs, graph.col_covgs,
+                 capacity * ncols * sizeof(CovgStore)) == 0);
+  TASSERT(memcmp(loaded.node_in_cols, graph.node_in_cols,
+                 roundup_bits2bytes(capacity) * ncols) == 0);
+
+  TASSERT(strcmp(loaded.ginfo[0].sample_name.b, "sample0") == 0);
+  TASSERT(loaded.ginfo[0].total_sequence == 1234);
+
+  // Lookups hash to the same entries
+  dBNode node0 = db_graph_find_str(&graph, "CAGATTAAAGG");
+  dBNode node1 = db_graph_find_str(&loaded, "CAGATTAAAGG");
+  TASSERT(node0.key != HASH_NOT_FOUND);
+  TASSERT(node0.key == node1.key && node0.orient == node1.orient);
+
+  _check_same_paths(&graph, &loaded);
+
+  db_graph_dealloc(&loaded);
+  db_graph_dealloc(&graph);
+}
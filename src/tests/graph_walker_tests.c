@@ -24,6 +24,26 @@ static void _check_junction_gaps(GraphWalker *wlk, size_t *exp_gaps, size_t n)
   TASSERT2(idx == n, "Didn't see expected no. of forks %zu vs %zu", idx, n);
 }
 
+// Check the orientation summary matches the traversal linked lists
+static void _check_path_summary(const GPathStore *gpstore)
+{
+  size_t hkey;
+  uint8_t orients;
+  const GPath *gpath;
+
+  TASSERT(gpstore->traverse_orients != NULL);
+  if(gpstore->traverse_orients == NULL) return;
+
+  for(hkey = 0; hkey < gpstore->graph_capacity; hkey++) {
+    orients = 0;
+    gpath = gpath_store_fetch_traverse(gpstore, hkey);
+    for(; gpath != NULL; gpath = gpath_next(gpath))
+      orients |= (uint8_t)(1 << gpath->orient);
+    TASSERT2(gpath_store_summary_orients(gpstore, hkey) == orients,
+             "hkey: %zu", hkey);
+  }
+}
+
 static void _test_graph_walker_test1()
 {
   test_status("Testing GraphWalker...");
@@ -59,6 +79,8 @@ static void _test_graph_walker_test1()
 
   // Construct graph and paths with first two sequences only
   all_tests_construct_graph(&graph, kmer_size, ncols, seqs, 2, params);
+  gpath_store_build_summary(&graph.gpstore, 2);
+  _check_path_summary(&graph.gpstore);
 
   GraphWalker wlk;
   graph_walker_alloc(&wlk, &graph);
@@ -73,6 +95,8 @@ static void _test_graph_walker_test1()
   // Add the third read which should disrupt expected path gap
   // 4 new paths, 0 new kmer paths
   all_tests_add_paths(&graph, seqs[2], params, 4, 0);
+  _check_path_summary(&graph.gpstore);
+  graph_walker_memo_clear(&wlk);
 
   graph_walker_start(&wlk, node);
   size_t exp_gap2[2] = {5, 5+11+18};
@@ -80,6 +104,30 @@ static void _test_graph_walker_test1()
   _check_junction_gaps(&wlk, exp_gap2, sizeof(exp_gap2) / sizeof(exp_gap2[0]));
   graph_walker_finish(&wlk);
 
+  // Saved state walks the same way each time it is restored
+  GraphWalkerState state;
+  graph_walker_state_alloc(&state);
+
+  graph_walker_start(&wlk, node);
+  graph_walker_save(&wlk, &state);
+  _check_junction_gaps(&wlk, exp_gap2, sizeof(exp_gap2) / sizeof(exp_gap2[0]));
+  graph_walker_finish(&wlk);
+
+  graph_walker_restore(&wlk, &state);
+  TASSERT(db_nodes_are_equal(wlk.node, node));
+  _check_junction_gaps(&wlk, exp_gap2, sizeof(exp_gap2) / sizeof(exp_gap2[0]));
+  graph_walker_finish(&wlk);
+
+  // Walking the same way again takes both fork decisions from the memo
+  size_t memo_hits = wlk.memo_hits;
+  graph_walker_start(&wlk, node);
+  _check_junction_gaps(&wlk, exp_gap2, sizeof(exp_gap2) / sizeof(exp_gap2[0]));
+  graph_walker_finish(&wlk);
+  TASSERT2(wlk.memo_hits == memo_hits + 2, "%zu vs %zu",
+           wlk.memo_hits, memo_hits);
+
+  graph_walker_state_dealloc(&state);
+
   // Done
   graph_walker_dealloc(&wlk);
   db_graph_dealloc(&graph);
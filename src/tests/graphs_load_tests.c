@@ -0,0 +1,125 @@
+#include "global.h"
+#include "all_tests.h"
+#include "graphs_load.h"
+#include "graph_writer.h"
+#include "file_util.h"
+
+#include <unistd.h> // unlink
+
+// Enough kmers for graph_load() to split the file between four threads
+#define LOAD_NKMERS 50000
+#define LOAD_NTHREADS 4
+
+// Add every other kmer to the graph with edges `edges0` in colour 0, so that
+// loading with must_exist_in_graph drops half of the kmers and masks edges
+static void _load_graph_init(dBGraph *graph, const BinaryKmer *bkmers,
+                             const Edges *edges0, bool union_edges)
+{
+  size_t i;
+  bool found;
+  hkey_t hkey;
+  db_graph_alloc(graph, 31, 2, 2, LOAD_NKMERS*2,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS);
+  for(i = 0; i < LOAD_NKMERS; i += 2) {
+    hkey = hash_table_find_or_insert(&graph->ht, bkmers[i], &found);
+    db_node_add_col_edges(graph, hkey, 0, edges0[i]);
+  }
+  if(union_edges) db_graph_union_edges_alloc(graph, 1);
+}
+
+static size_t _load_graph(dBGraph *graph, const char *path, size_t nthreads)
+{
+  GraphFileReader file;
+  memset(&file, 0, sizeof(file));
+  graph_file_open(&file, path);
+  GraphLoadingPrefs prefs = graph_loading_prefs(graph);
+  prefs.must_exist_in_graph = true;
+  prefs.nthreads = nthreads;
+  size_t nkmers = graph_load(&file, prefs, NULL);
+  graph_file_close(&file);
+  return nkmers;
+}
+
+// Load into a populated graph with one and with many threads, and check both
+// give the same edges, coverages and union of edges for every kmer
+static void _test_load_must_exist(const char *path, const BinaryKmer *bkmers,
+                                  const Edges *edges0, bool union_edges)
+{
+  test_status("Testing loading kmers that must exist in the graph "
+              "with %i threads%s", LOAD_NTHREADS,
+              union_edges ? " (union edges)" : "");
+
+  dBGraph graph1, graphn;
+  size_t i, col, nbad = 0;
+  hkey_t h1, hn;
+
+  _load_graph_init(&graph1, bkmers, edges0, union_edges);
+  _load_graph_init(&graphn, bkmers, edges0, union_edges);
+
+  size_t n1 = _load_graph(&graph1, path, 1);
+  size_t nn = _load_graph(&graphn, path, LOAD_NTHREADS);
+  TASSERT2(n1 == LOAD_NKMERS/2, "n1: %zu", n1);
+  TASSERT2(nn == n1, "nn: %zu n1: %zu", nn, n1);
+  TASSERT(hash_table_nkmers(&graphn.ht) == hash_table_nkmers(&graph1.ht));
+
+  for(i = 0; i < LOAD_NKMERS; i += 2) {
+    h1 = hash_table_find(&graph1.ht, bkmers[i]);
+    hn = hash_table_find(&graphn.ht, bkmers[i]);
+    if(h1 == HASH_NOT_FOUND || hn == HASH_NOT_FOUND) { nbad++; continue; }
+    for(col = 0; col < 2; col++) {
+      nbad += (db_node_get_edges(&graph1, h1, col) !=
+               db_node_get_edges(&graphn, hn, col));
+      nbad += (db_node_get_covg(&graph1, h1, col) !=
+               db_node_get_covg(&graphn, hn, col));
+    }
+    nbad += (db_node_get_edges_union(&graphn, hn) !=
+             db_node_read_edges_union(&graphn, hn));
+  }
+  TASSERT2(nbad == 0, "nbad: %zu", nbad);
+
+  db_graph_dealloc(&graph1);
+  db_graph_dealloc(&graphn);
+}
+
+void test_graphs_load()
+{
+  const size_t kmer_size = 31, ncols = 2;
+  const uint64_t step = (1UL << (2*kmer_size)) / LOAD_NKMERS;
+  size_t i;
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!test_tmp_file(path, "graphs_load_test", ".ctx")) return;
+
+  GraphFileHeader hdr = {.version = CTX_GRAPH_FILEFORMAT,
+                         .kmer_size = kmer_size,
+                         .num_of_bitfields = NUM_BKMER_WORDS,
+                         .num_of_cols = ncols};
+  graph_header_capacity(&hdr, ncols);
+
+  BinaryKmer *bkmers = ctx_malloc(LOAD_NKMERS * sizeof(BinaryKmer));
+  Edges *edges0 = ctx_malloc(LOAD_NKMERS * sizeof(Edges));
+  Covg covgs[ncols];
+  Edges edges[ncols];
+
+  // Distinct kmers, each with edges in both colours
+  FILE *fh = futil_fopen(path, "w");
+  graph_write_header(fh, &hdr);
+  for(i = 0; i < LOAD_NKMERS; i++) {
+    bkmers[i] = zero_bkmer;
+    bkmers[i].b[NUM_BKMER_WORDS-1] = i*step + (uint64_t)rand() % step;
+    bkmers[i] = binary_kmer_get_key(bkmers[i], kmer_size);
+    edges0[i] = (Edges)rand();
+    covgs[0] = 1 + rand() % 100; covgs[1] = 1 + rand() % 100;
+    edges[0] = (Edges)rand(); edges[1] = (Edges)rand();
+    graph_write_kmer(fh, ncols, bkmers[i], covgs, edges);
+  }
+  fclose(fh);
+  graph_header_dealloc(&hdr);
+
+  _test_load_must_exist(path, bkmers, edges0, false);
+  _test_load_must_exist(path, bkmers, edges0, true);
+
+  unlink(path);
+  ctx_free(bkmers);
+  ctx_free(edges0);
+}
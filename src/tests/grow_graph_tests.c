@@ -0,0 +1,82 @@
+#include "global.h"
+#include "all_tests.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "build_graph.h"
+#include "grow_graph.h"
+
+static void _rand_acgt(char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+  seq[len] = '\0';
+}
+
+// Every kmer of a should be in b with the same coverage and edges
+static size_t _cmp_graphs(const dBGraph *a, const dBGraph *b)
+{
+  size_t nwrong = 0;
+  hkey_t hkey;
+  dBNode node;
+
+  for(hkey = 0; hkey < a->ht.capacity; hkey++) {
+    if(!hash_table_assigned(&a->ht, hkey)) continue;
+    node = db_graph_find(b, db_node_get_bkey(a, hkey));
+    if(node.key == HASH_NOT_FOUND) { nwrong++; continue; }
+    nwrong += (db_node_get_covg(a, hkey, 0) != db_node_get_covg(b, node.key, 0));
+    nwrong += (db_node_get_edges(a, hkey, 0) != db_node_get_edges(b, node.key, 0));
+  }
+  return nwrong;
+}
+
+void test_grow_graph()
+{
+  test_status("Testing growing graphs to larger kmer sizes");
+
+  const size_t ksrc = 11, ndsts = 2, kdsts[2] = {21, 31};
+  const int flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                    DBG_ALLOC_BKTLOCKS;
+  dBGraph src, dsts[2], direct;
+  size_t d, len, nwrong;
+  char seq[700], repeat[16];
+
+  // A repeat longer than k but shorter than K joins unitigs of the k graph
+  _rand_acgt(repeat, 15);
+  _rand_acgt(seq, 200);
+  strcat(seq, repeat);
+  _rand_acgt(seq+strlen(seq), 200);
+  strcat(seq, repeat);
+  _rand_acgt(seq+strlen(seq), 200);
+  len = strlen(seq);
+
+  db_graph_alloc(&src, ksrc, 1, 1, 2048, flags);
+  build_graph_from_str_mt(&src, 0, seq, len, false);
+
+  for(d = 0; d < ndsts; d++)
+    db_graph_alloc(&dsts[d], kdsts[d], 1, 1, 2048, flags);
+
+  GrowGraph gg = {.src = &src, .dsts = dsts, .ndsts = ndsts};
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(src.ht.capacity), 1);
+  grow_graph_from_unitigs(&gg, 2, visited);
+  ctx_free(visited);
+
+  // Without reads, kmers spanning the repeat are missing
+  for(d = 0; d < ndsts; d++)
+    TASSERT(dsts[d].ht.num_kmers < len+1-kdsts[d]);
+
+  TASSERT(grow_graph_from_str_mt(&gg, 0, seq, len) == len+1-ksrc);
+
+  // Should now match a graph built from the sequence
+  for(d = 0; d < ndsts; d++) {
+    db_graph_alloc(&direct, kdsts[d], 1, 1, 2048, flags);
+    build_graph_from_str_mt(&direct, 0, seq, len, false);
+    TASSERT2(direct.ht.num_kmers == dsts[d].ht.num_kmers, "%zu vs %zu",
+             (size_t)direct.ht.num_kmers, (size_t)dsts[d].ht.num_kmers);
+    nwrong = _cmp_graphs(&direct, &dsts[d]);
+    TASSERT2(nwrong == 0, "k=%zu nwrong: %zu", kdsts[d], nwrong);
+    db_graph_dealloc(&direct);
+    db_graph_dealloc(&dsts[d]);
+  }
+
+  db_graph_dealloc(&src);
+}
@@ -2,6 +2,7 @@
 #include "all_tests.h"
 #include "hash_table.h"
 #include "binary_kmer.h"
+#include "cpu_dispatch.h"
 
 #define NTESTS 1024
 
@@ -13,9 +14,14 @@ static void xor_bkmers(hkey_t key, HashTable *ht, BinaryKmer *ptr, size_t *c)
   (*c)++;
 }
 
-static void test_add_remove()
+static void test_add_remove(int flags)
 {
-  test_status("Test add/delete to hash_table");
+  test_status("Test add/delete to hash_table%s%s%s%s [simd=%s]",
+              flags & HT_ALLOC_TAGS ? " (tagged)" : "",
+              flags & HT_ALLOC_HUGEPAGES ? " (huge pages)" : "",
+              flags & HT_ALLOC_CUCKOO ? " (cuckoo)" : "",
+              flags & HT_ALLOC_COLOCATE ? " (bucket headers)" : "",
+              hash_table_probe_simd_str());
 
   HashTable ht;
   BinaryKmer bkmer0, bkmer1, bkey0, bkey1;
@@ -25,7 +31,7 @@ static void test_add_remove()
   size_t i, t, kmers_added = 0, kmers_deleted = 0;
   size_t kmer_size = MAX_KMER_SIZE;
 
-  hash_table_alloc(&ht, 2048);
+  hash_table_alloc_flags(&ht, 2048, flags);
 
   for(t = 0; t < NTESTS/2; t++)
   {
@@ -74,42 +80,84 @@ typedef struct {
   uint8_t *bktlocks;
   BinaryKmer *bkmers;
   size_t *nadded;
-  size_t n;
+  size_t n, depth; // depth > 0 => use batched insert with prefetch depth
+  bool lockfree;
 } BKmerTestSet;
 
+static inline hkey_t bset_find_or_insert(BKmerTestSet *bset, BinaryKmer bkmer,
+                                         bool *found)
+{
+  return bset->lockfree
+         ? hash_table_find_or_insert_lockfree(&bset->ht, bkmer, found, bset->bktlocks)
+         : hash_table_find_or_insert_mt(&bset->ht, bkmer, found, bset->bktlocks);
+}
+
+// Insert kmers [start,end) in batches of up to 100
+static void bset_insert_range(BKmerTestSet *bset, size_t start, size_t end)
+{
+  size_t i, j, n;
+  hkey_t hkeys[100];
+  bool found[100];
+
+  if(bset->depth == 0) {
+    for(i = start; i < end; i++) {
+      bset_find_or_insert(bset, bset->bkmers[i], &found[0]);
+      __sync_fetch_and_add((volatile size_t*)&bset->nadded[i], !found[0]);
+    }
+    return;
+  }
+
+  for(i = start; i < end; i += n) {
+    n = (size_t)(rand() % 100)+1;
+    n = MIN2(end-i, n);
+    if(bset->lockfree)
+      hash_table_find_or_insert_batch_lockfree(&bset->ht, bset->bkmers+i, n,
+                                               bset->depth, hkeys, found,
+                                               bset->bktlocks);
+    else
+      hash_table_find_or_insert_batch_mt(&bset->ht, bset->bkmers+i, n,
+                                         bset->depth, hkeys, found,
+                                         bset->bktlocks);
+    for(j = 0; j < n; j++) {
+      TASSERT(binary_kmer_eq(hash_table_fetch(&bset->ht, hkeys[j]),
+                             bset->bkmers[i+j]));
+      __sync_fetch_and_add((volatile size_t*)&bset->nadded[i+j], !found[j]);
+    }
+  }
+}
+
 void load_bset(void *arg, size_t threadid)
 {
   (void)threadid;
   BKmerTestSet *bset = (BKmerTestSet*)arg;
-  size_t i, start = rand() % bset->n;
-  bool found = false;
-  for(i = start; i < bset->n; i++) {
-    hash_table_find_or_insert_mt(&bset->ht, bset->bkmers[i], &found, bset->bktlocks);
-    __sync_fetch_and_add((volatile size_t*)&bset->nadded[i], !found);
-  }
+  size_t start = rand() % bset->n;
+  bset_insert_range(bset, start, bset->n);
   sched_yield(); // release the CPU
-  for(i = 0; i < start; i++) {
-    hash_table_find_or_insert_mt(&bset->ht, bset->bkmers[i], &found, bset->bktlocks);
-    __sync_fetch_and_add((volatile size_t*)&bset->nadded[i], !found);
-  }
+  bset_insert_range(bset, 0, start);
 }
 
-static void test_hash_table_mt()
+static void test_hash_table_mt(bool lockfree, size_t depth, int flags)
 {
   // Generate 2000 random binary kmers
   // start 20 threads adding them to the hash table
   size_t i, kmer_size = MAX_KMER_SIZE;
   size_t nthreads = (rand() % 50)+1, nkmers = 1000000;
 
-  test_status("Testing hash table multithreading %zu threads, %zu kmers",
-              nthreads, nkmers);
+  test_status("Testing hash table multithreading %zu threads, %zu kmers%s%s "
+              "batch depth %zu", nthreads, nkmers,
+              lockfree ? " (lock-free)" : "",
+              flags & HT_ALLOC_COLOCATE ? " (bucket headers)" : "", depth);
 
   BKmerTestSet bset;
   bset.n = nkmers;
-  hash_table_alloc(&bset.ht, bset.n*1.5);
+  bset.depth = depth;
+  bset.lockfree = lockfree;
+  hash_table_alloc_flags(&bset.ht, bset.n*1.5, flags);
   bset.bkmers = ctx_calloc(bset.n, sizeof(bset.bkmers[0]));
   bset.nadded = ctx_calloc(bset.n, sizeof(bset.nadded[0]));
-  bset.bktlocks = ctx_calloc((bset.ht.capacity+7)/8, 1);
+  // Bucket headers hold their own locks
+  bset.bktlocks = (flags & HT_ALLOC_COLOCATE) ? NULL
+                  : ctx_calloc((bset.ht.capacity+7)/8, 1);
 
   for(i = 0; i < bset.n; i++)
     bset.bkmers[i] = binary_kmer_random(kmer_size);
@@ -121,6 +169,13 @@ static void test_hash_table_mt()
     TASSERT2(bset.nadded[i] == 1, "%zu", bset.nadded[i]);
 
   TASSERT(hash_table_nkmers(&bset.ht) == nkmers);
+  TASSERT(hash_table_count_kmers(&bset.ht) == nkmers);
+
+  // Check all kmers can be found
+  for(i = 0; i < bset.n; i++) {
+    TASSERT(hash_table_find(&bset.ht, bset.bkmers[i]) != HASH_NOT_FOUND);
+    TASSERT(hash_table_find_lockfree(&bset.ht, bset.bkmers[i]) != HASH_NOT_FOUND);
+  }
 
   ctx_free(bset.bktlocks);
   ctx_free(bset.nadded);
@@ -128,8 +183,372 @@ static void test_hash_table_mt()
   hash_table_dealloc(&bset.ht);
 }
 
+typedef struct {
+  const HashTable *ht;
+  size_t n;
+  BinaryKmer prev;
+  bool sorted;
+} SortedChunkCheck;
+
+static bool check_sorted_chunk(const hkey_t *hkeys, size_t n, void *arg)
+{
+  SortedChunkCheck *chk = (SortedChunkCheck*)arg;
+  size_t i;
+  BinaryKmer bk;
+  for(i = 0; i < n; i++) {
+    bk = hash_table_fetch(chk->ht, hkeys[i]);
+    if(chk->n > 0 && !binary_kmer_lt(chk->prev, bk)) chk->sorted = false;
+    chk->prev = bk;
+    chk->n++;
+  }
+  return false;
+}
+
+// `nprefix` kinds of kmers that share their first half
+static void test_hash_table_sorted_kmers(size_t nkmers, size_t nprefix)
+{
+  size_t i, j, t, kmer_size = MAX_KMER_SIZE, nthreads[] = {1, 2, 7};
+  bool found;
+  HashTable ht;
+  BinaryKmer bk, prefixes[nprefix];
+  hkey_t *hkeys;
+
+  hash_table_alloc(&ht, nkmers*1.5+64);
+  for(i = 0; i < nprefix; i++) prefixes[i] = binary_kmer_random(kmer_size);
+
+  for(i = 0; i < nkmers; i++) {
+    if(nprefix) {
+      // keep the end of a prefix kmer as the start of this kmer
+      bk = prefixes[rand() % nprefix];
+      for(j = 0; j < kmer_size/2; j++)
+        bk = binary_kmer_left_shift_add(bk, kmer_size, rand() & 3);
+    }
+    else bk = binary_kmer_random(kmer_size);
+    hash_table_find_or_insert(&ht, bk, &found);
+  }
+
+  for(t = 0; t < sizeof(nthreads)/sizeof(nthreads[0]); t++) {
+    hkeys = hash_table_sorted_mt(&ht, nthreads[t]);
+    for(i = 1; i < ht.num_kmers; i++)
+      TASSERT(binary_kmer_lt(hash_table_fetch(&ht, hkeys[i-1]),
+                             hash_table_fetch(&ht, hkeys[i])));
+    ctx_free(hkeys);
+
+    SortedChunkCheck chk = {.ht = &ht, .n = 0, .sorted = true};
+    TASSERT(hash_table_sorted_chunks(&ht, nthreads[t], nkmers/5+1,
+                                     check_sorted_chunk, &chk) == ht.num_kmers);
+    TASSERT(chk.n == ht.num_kmers);
+    TASSERT(chk.sorted);
+  }
+
+  hash_table_dealloc(&ht);
+}
+
+// Counters are summed over threads
+static void test_hash_table_stats()
+{
+  test_status("Testing hash table profiling counters");
+
+  size_t i, nthreads = 4, kmer_size = MAX_KMER_SIZE;
+
+  BKmerTestSet bset;
+  bset.n = 10000;
+  bset.depth = 0;
+  bset.lockfree = false;
+  hash_table_alloc(&bset.ht, bset.n*1.5);
+  bset.bkmers = ctx_calloc(bset.n, sizeof(bset.bkmers[0]));
+  bset.nadded = ctx_calloc(bset.n, sizeof(bset.nadded[0]));
+  bset.bktlocks = ctx_calloc((bset.ht.capacity+7)/8, 1);
+
+  for(i = 0; i < bset.n; i++)
+    bset.bkmers[i] = binary_kmer_random(kmer_size);
+
+  ctx_stats_init();
+  size_t phase = ctx_stats_phase_start("load");
+  util_multi_thread(&bset, nthreads, load_bset);
+  ctx_stats_phase_end(phase);
+
+  // Each thread looks up every kmer, each kmer is inserted once
+  TASSERT(ctx_stats_total(CTX_STAT_KMERS_INSERTED) == hash_table_nkmers(&bset.ht));
+  TASSERT(ctx_stats_total(CTX_STAT_KMER_LOOKUPS) == nthreads * bset.n);
+
+  hash_table_find(&bset.ht, bset.bkmers[0]);
+  TASSERT(ctx_stats_total(CTX_STAT_KMER_LOOKUPS) == nthreads * bset.n + 1);
+
+  // Lookups are sampled per thread, every lookup after the first is a hit
+  uint64_t probes[CTX_STATS_MAX_PROBES], nsamples = 0;
+  ctx_stats_probe_hist(probes);
+  for(i = 0; i < CTX_STATS_MAX_PROBES; i++) nsamples += probes[i];
+  TASSERT(nsamples == ctx_stats_total(CTX_STAT_LOOKUP_SAMPLES));
+  TASSERT(nsamples >= nthreads * bset.n / CTX_STATS_SAMPLE_RATE);
+  TASSERT(ctx_stats_total(CTX_STAT_LOOKUP_HITS) <= nsamples);
+  TASSERT(ctx_stats_total(CTX_STAT_LOCK_WAITS) <=
+          ctx_stats_total(CTX_STAT_LOCK_ACQUIRES));
+  ctx_stats_destroy();
+
+  // Bucket fill histogram covers every bucket and kmer
+  uint64_t fill[256], nbkts = 0, nfilled = 0;
+  hash_table_bucket_fill_hist(&bset.ht, fill);
+  for(i = 0; i <= bset.ht.bucket_size; i++) {
+    nbkts += fill[i];
+    nfilled += i * fill[i];
+  }
+  TASSERT(nbkts == bset.ht.num_of_buckets);
+  TASSERT(nfilled == hash_table_nkmers(&bset.ht));
+
+  // Counters are not updated once stats are turned off
+  hash_table_find(&bset.ht, bset.bkmers[0]);
+  TASSERT(ctx_stats_total(CTX_STAT_KMER_LOOKUPS) == 0);
+
+  ctx_free(bset.bktlocks);
+  ctx_free(bset.nadded);
+  ctx_free(bset.bkmers);
+  hash_table_dealloc(&bset.ht);
+}
+
+// Finds with a filter should give the same answers as without
+static void test_hash_table_filter()
+{
+  test_status("Testing hash table kmer filter");
+
+  size_t i, n = 10000, nfiltered = 0, kmer_size = MAX_KMER_SIZE;
+  HashTable ht;
+  bool found;
+
+  // First half of keys are in the table
+  BinaryKmer *bkeys = ctx_calloc(2*n, sizeof(BinaryKmer));
+  hkey_t *hkeys = ctx_calloc(2*n, sizeof(hkey_t));
+  hkey_t *fhkeys = ctx_calloc(2*n, sizeof(hkey_t));
+  bool *has = ctx_calloc(2*n, sizeof(bool));
+
+  hash_table_alloc(&ht, n*1.5);
+  for(i = 0; i < 2*n; i++) {
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+    if(i < n) hash_table_find_or_insert(&ht, bkeys[i], &found);
+  }
+
+  hash_table_find_batch(&ht, bkeys, 2*n, HT_PREFETCH_DEPTH, hkeys);
+  hash_table_filter_build(&ht);
+  TASSERT(ht.filter != NULL);
+  hash_table_find_batch(&ht, bkeys, 2*n, HT_PREFETCH_DEPTH, fhkeys);
+
+  for(i = 0; i < 2*n; i++) {
+    TASSERT(fhkeys[i] == hkeys[i]);
+    TASSERT(hash_table_find(&ht, bkeys[i]) == hkeys[i]);
+  }
+
+  // Batch and single filter checks agree, absent kmers are mostly rejected
+  kmer_bloom_has_batch(ht.filter, bkeys, 2*n, HT_PREFETCH_DEPTH, has);
+  for(i = 0; i < 2*n; i++) {
+    TASSERT(has[i] == kmer_bloom_has(ht.filter, bkeys[i]));
+    TASSERT(i >= n || has[i]);
+    nfiltered += !has[i];
+  }
+  TASSERT2(nfiltered > n*0.95, "nfiltered: %zu", nfiltered);
+
+  hash_table_empty(&ht);
+  TASSERT(ht.filter == NULL);
+
+  ctx_free(bkeys);
+  ctx_free(hkeys);
+  ctx_free(fhkeys);
+  ctx_free(has);
+  hash_table_dealloc(&ht);
+}
+
+// Index of the kmer stored in each slot, moved with the kmer
+static void cuckoo_move_idx(hkey_t from, hkey_t to, void *arg)
+{
+  size_t *idx = (size_t*)arg;
+  idx[to] = idx[from];
+  idx[from] = SIZE_MAX;
+}
+
+// Fill a cuckoo table to 95%, kmers and data moved with them are all found
+static void test_hash_table_cuckoo(int flags)
+{
+  test_status("Testing hash table cuckoo inserts");
+
+  size_t i, n, nwrong = 0, kmer_size = MAX_KMER_SIZE;
+  HashTable ht;
+  bool found;
+  hkey_t hkey;
+
+  hash_table_alloc_flags(&ht, 20000, flags | HT_ALLOC_CUCKOO);
+  TASSERT(ht.cuckoo);
+  n = ht.capacity * 0.95;
+
+  BinaryKmer *bkeys = ctx_calloc(n, sizeof(BinaryKmer));
+  size_t *idx = ctx_malloc(ht.capacity * sizeof(size_t));
+  for(i = 0; i < ht.capacity; i++) idx[i] = SIZE_MAX;
+  hash_table_set_move(&ht, cuckoo_move_idx, idx);
+
+  for(i = 0; i < n; i++) {
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+    hkey = hash_table_find_or_insert(&ht, bkeys[i], &found);
+    if(!found) idx[hkey] = i;
+  }
+
+  TASSERT(ht.num_moves > 0);
+  TASSERT(hash_table_count_kmers(&ht) == ht.num_kmers);
+
+  for(i = 0; i < n; i++) {
+    hkey = hash_table_find(&ht, bkeys[i]);
+    nwrong += (hkey == HASH_NOT_FOUND ||
+               !binary_kmer_eq(hash_table_fetch(&ht, hkey), bkeys[i]) ||
+               idx[hkey] >= n || !binary_kmer_eq(bkeys[idx[hkey]], bkeys[i]));
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  // Re-inserting finds every kmer without moving any
+  uint64_t nmoves = ht.num_moves, nkmers = ht.num_kmers;
+  for(i = 0; i < n; i++) {
+    hash_table_find_or_insert(&ht, bkeys[i], &found);
+    nwrong += !found;
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+  TASSERT(ht.num_moves == nmoves && ht.num_kmers == nkmers);
+
+  ctx_free(bkeys);
+  ctx_free(idx);
+  hash_table_dealloc(&ht);
+}
+
+// Move kmers to the reverse of their order of insertion, all are still found
+// at their new hkeys
+static void test_hash_table_relayout(int flags)
+{
+  test_status("Testing hash table relayout");
+
+  size_t i, n = 5000, nwrong = 0, kmer_size = MAX_KMER_SIZE;
+  HashTable ht;
+  bool found;
+  hkey_t hkey;
+
+  hash_table_alloc_flags(&ht, 2*n, flags);
+  BinaryKmer *bkeys = ctx_calloc(n, sizeof(BinaryKmer));
+  hkey_t *newkeys = ctx_malloc(ht.capacity * sizeof(hkey_t));
+
+  for(i = 0; i < n; i++) {
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+    hkey = hash_table_find_or_insert(&ht, bkeys[i], &found);
+    if(!found) newkeys[hkey] = ht.num_kmers - 1;
+  }
+
+  // Reverse order of insertion
+  size_t nkmers = ht.num_kmers;
+  for(hkey = 0; hkey < ht.capacity; hkey++)
+    if(hash_table_assigned(&ht, hkey)) newkeys[hkey] = nkmers - 1 - newkeys[hkey];
+
+  hash_table_relayout(&ht, newkeys);
+  TASSERT(ht.num_kmers == nkmers);
+  TASSERT(hash_table_count_kmers(&ht) == nkmers);
+
+  // Kmers are at the start of the table
+  for(hkey = 0; hkey < nkmers; hkey++) nwrong += !hash_table_assigned(&ht, hkey);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  for(i = 0; i < n; i++) {
+    hkey = hash_table_find(&ht, bkeys[i]);
+    nwrong += (hkey == HASH_NOT_FOUND || hkey >= nkmers ||
+               !binary_kmer_eq(hash_table_fetch(&ht, hkey), bkeys[i]));
+    nwrong += (hash_table_find_lockfree(&ht, bkeys[i]) != hkey);
+    nwrong += (hash_table_find_or_insert(&ht, bkeys[i], &found) != hkey || !found);
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  hkey_t *hkeys = ctx_malloc(n * sizeof(hkey_t));
+  hash_table_find_batch(&ht, bkeys, n, HT_PREFETCH_DEPTH, hkeys);
+  for(i = 0; i < n; i++) nwrong += (hkeys[i] != hash_table_find(&ht, bkeys[i]));
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  ctx_free(hkeys);
+  ctx_free(bkeys);
+  ctx_free(newkeys);
+  hash_table_dealloc(&ht);
+}
+
+static void test_hash_table_sorted()
+{
+  test_status("Testing hash table sorting");
+  test_hash_table_sorted_kmers(0, 0);
+  test_hash_table_sorted_kmers(1, 0);
+  test_hash_table_sorted_kmers(100, 0);
+  test_hash_table_sorted_kmers(100000, 0);
+  test_hash_table_sorted_kmers(100000, 1);
+  test_hash_table_sorted_kmers(100000, 3);
+}
+
+// Memory estimates must match what is allocated for each table layout
+static void test_hash_table_mem(int flags)
+{
+  test_status("Testing hash table memory estimates%s%s",
+              flags & HT_ALLOC_TAGS ? " (tagged)" : "",
+              flags & HT_ALLOC_COLOCATE ? " (bucket headers)" : "");
+
+  HashTable ht;
+  const size_t kmerbits = sizeof(BinaryKmer)*8;
+  size_t i, mem, limit, reqs[] = {1, 1000, 4096, 100000};
+  uint64_t nkmers;
+
+  hash_table_mem_set_layout((flags & HT_ALLOC_TAGS ? HT_MEM_TAGS : 0) |
+                            (flags & HT_ALLOC_COLOCATE ? HT_MEM_BUCKET_HDRS : 0));
+
+  for(i = 0; i < sizeof(reqs)/sizeof(reqs[0]); i++) {
+    mem = hash_table_mem(reqs[i], kmerbits, &nkmers);
+    hash_table_alloc_flags(&ht, reqs[i], flags);
+    TASSERT2(ht.capacity == nkmers, "%zu vs %zu", (size_t)ht.capacity,
+             (size_t)nkmers);
+    TASSERT2(hash_table_mem_used(&ht) == mem, "%zu vs %zu",
+             hash_table_mem_used(&ht), mem);
+    hash_table_dealloc(&ht);
+  }
+
+  // Tables sized to a memory limit must fit in it
+  for(limit = 1<<16; limit <= 1<<24; limit <<= 4) {
+    mem = hash_table_mem_limit(limit, kmerbits, &nkmers);
+    TASSERT2(mem <= limit, "%zu > %zu", mem, limit);
+    hash_table_alloc_flags(&ht, nkmers, flags);
+    TASSERT2(ht.capacity >= nkmers, "%zu < %zu", (size_t)ht.capacity,
+             (size_t)nkmers);
+    TASSERT2(hash_table_mem_used(&ht) <= mem, "%zu > %zu",
+             hash_table_mem_used(&ht), mem);
+    hash_table_dealloc(&ht);
+  }
+
+  hash_table_mem_set_layout(0);
+}
+
 void test_hash_table()
 {
-  test_add_remove();
-  test_hash_table_mt();
+  // Test each SIMD bucket scan this CPU supports
+  CpuSimd lvl, max = cpu_simd_supported();
+  for(lvl = CPU_SIMD_NONE; lvl <= max; lvl++) {
+    cpu_simd_set(lvl);
+    test_add_remove(0);
+  }
+  test_add_remove(HT_ALLOC_TAGS);
+  test_add_remove(HT_ALLOC_TAGS | HT_ALLOC_HUGEPAGES);
+  test_add_remove(HT_ALLOC_CUCKOO);
+  test_add_remove(HT_ALLOC_COLOCATE);
+  test_add_remove(HT_ALLOC_COLOCATE | HT_ALLOC_CUCKOO);
+  test_hash_table_mt(false, 0, 0);
+  test_hash_table_mt(true, 0, 0);
+  test_hash_table_mt(false, HT_PREFETCH_DEPTH, 0);
+  test_hash_table_mt(true, 1, 0);
+  test_hash_table_mt(true, HT_MAX_PREFETCH_DEPTH+1, 0);
+  test_hash_table_mt(false, 0, HT_ALLOC_COLOCATE);
+  test_hash_table_mt(true, HT_PREFETCH_DEPTH, HT_ALLOC_COLOCATE);
+  test_hash_table_sorted();
+  test_hash_table_stats();
+  test_hash_table_filter();
+  test_hash_table_cuckoo(0);
+  test_hash_table_cuckoo(HT_ALLOC_TAGS);
+  test_hash_table_relayout(0);
+  test_hash_table_relayout(HT_ALLOC_TAGS);
+  test_hash_table_cuckoo(HT_ALLOC_COLOCATE);
+  test_hash_table_relayout(HT_ALLOC_COLOCATE);
+  test_hash_table_mem(0);
+  test_hash_table_mem(HT_ALLOC_TAGS);
+  test_hash_table_mem(HT_ALLOC_COLOCATE);
 }
@@ -159,8 +159,59 @@ static void simple_test()
   db_graph_dealloc(&graph);
 }
 
+// Compare infer_edges() against calling infer_kmer_edges() on each kmer
+static void random_test(bool add_all_edges)
+{
+  dBGraph graph;
+  size_t i, col, kmer_size = 11, ncols = 4, nexp = 0, nmodified;
+  char seq[60];
+  hkey_t hkey;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 8192,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL | DBG_ALLOC_BKTLOCKS);
+
+  for(i = 0; i < 60; i++) {
+    dna_rand_str(seq, sizeof(seq)-1);
+    for(col = 0; col < ncols; col++)
+      if(i % 3 == 0 || col == i % ncols)
+        build_graph_from_str_mt(&graph, col, seq, strlen(seq), false);
+  }
+
+  // Remove some edges from single colours
+  for(hkey = 0, i = 0; hkey < graph.ht.capacity; hkey++)
+    if(hash_table_assigned(&graph.ht, hkey) && i++ % 3 == 0)
+      db_node_edges(&graph, hkey, i % ncols) &= (i % 2 ? 0x0f : 0xf0);
+
+  const size_t capacity = graph.ht.capacity;
+  Edges *expect = ctx_calloc(capacity * ncols, sizeof(Edges));
+  Covg covgs[ncols];
+
+  for(hkey = 0; hkey < capacity; hkey++) {
+    if(!hash_table_assigned(&graph.ht, hkey)) continue;
+    db_node_get_all_edges(&graph, hkey, expect + hkey*ncols);
+    for(col = 0; col < ncols; col++)
+      covgs[col] = db_node_has_col(&graph, hkey, col);
+    nexp += infer_kmer_edges(db_node_get_bkey(&graph, hkey), !add_all_edges,
+                             expect + hkey*ncols, covgs, &graph);
+  }
+
+  nmodified = infer_edges(3, add_all_edges, &graph);
+  TASSERT2(nmodified == nexp, "%zu vs %zu", nmodified, nexp);
+  TASSERT(nexp > 0);
+
+  for(hkey = 0; hkey < capacity; hkey++)
+    if(hash_table_assigned(&graph.ht, hkey))
+      for(col = 0; col < ncols; col++)
+        TASSERT(db_node_edges(&graph, hkey, col) == expect[hkey*ncols+col]);
+
+  ctx_free(expect);
+  db_graph_dealloc(&graph);
+}
+
 void test_infer_edges_tests()
 {
   test_status("Testing infer_edges...");
   simple_test();
+  random_test(false);
+  random_test(true);
 }
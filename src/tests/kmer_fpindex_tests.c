@@ -0,0 +1,79 @@
+#include "global.h"
+#include "all_tests.h"
+#include "kmer_fpindex.h"
+
+static void _rand_acgt(char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+  seq[len] = '\0';
+}
+
+// Check every kmer of `seq` is found at seqid:offset
+static void _check_seq_kmers(const KmerFPIndex *idx, const char *seq,
+                             size_t len, size_t seqid)
+{
+  const size_t kmer_size = idx->kmer_size;
+  BinaryKmer bkmer, bkey;
+  KmerFPRef ref;
+  size_t i;
+
+  for(i = 0; i+kmer_size <= len; i++) {
+    bkmer = binary_kmer_from_str(seq+i, kmer_size);
+    bkey = binary_kmer_get_key(bkmer, kmer_size);
+    TASSERT(kmer_fpindex_find(idx, bkmer, &ref));
+    TASSERT(ref.seqid == seqid && ref.offset == i);
+    TASSERT(ref.orient == (binary_kmer_eq(bkmer, bkey) ? FORWARD : REVERSE));
+    TASSERT(binary_kmer_eq(kmer_fpindex_get_bkmer(idx, seqid, i), bkmer));
+
+    // reverse complement gives the same position
+    bkmer = binary_kmer_reverse_complement(bkmer, kmer_size);
+    TASSERT(kmer_fpindex_find(idx, bkmer, &ref));
+    TASSERT(ref.seqid == seqid && ref.offset == i);
+  }
+}
+
+void test_kmer_fpindex()
+{
+  test_status("Testing fingerprint kmer index");
+
+  const size_t kmer_size = 31, len0 = 5000, len1 = 3000;
+  char *seq0 = ctx_malloc(len0+1), *seq1 = ctx_malloc(len1+1);
+  KmerFPIndex idx;
+  KmerFPRef ref;
+  BinaryKmer bkmer;
+  size_t nkmers;
+
+  _rand_acgt(seq0, len0);
+  _rand_acgt(seq1, len1);
+
+  // Start small so the table has to grow
+  kmer_fpindex_alloc(&idx, kmer_size, 10);
+
+  nkmers = kmer_fpindex_add(&idx, seq0, len0);
+  TASSERT(nkmers == len0+1-kmer_size);
+  nkmers = kmer_fpindex_add(&idx, seq1, len1);
+  TASSERT(nkmers == len1+1-kmer_size);
+  TASSERT(idx.num_seqs == 2);
+  TASSERT(idx.num_kmers == len0+len1+2-2*kmer_size);
+  TASSERT(idx.num_kmers <= idx.capacity * KMER_FPINDEX_MAX_LOAD);
+
+  _check_seq_kmers(&idx, seq0, len0, 0);
+  _check_seq_kmers(&idx, seq1, len1, 1);
+
+  // Kmers already in the index are not added again
+  nkmers = kmer_fpindex_add(&idx, seq1+100, 200);
+  TASSERT(nkmers == 0);
+  TASSERT(idx.num_seqs == 3);
+  TASSERT(kmer_fpindex_find(&idx, binary_kmer_from_str(seq1+100, kmer_size),
+                            &ref));
+  TASSERT(ref.seqid == 1 && ref.offset == 100);
+
+  // Missing kmer
+  bkmer = binary_kmer_from_str("ACGTACGTACGTACGTACGTACGTACGTACG", kmer_size);
+  TASSERT(!kmer_fpindex_find(&idx, bkmer, &ref));
+
+  kmer_fpindex_dealloc(&idx);
+  ctx_free(seq0);
+  ctx_free(seq1);
+}
@@ -0,0 +1,61 @@
+#include "global.h"
+#include "all_tests.h"
+#include "kmer_hll.h"
+
+static void _rand_acgt(char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+  seq[len] = '\0';
+}
+
+static bool _hll_close(uint64_t est, size_t exp, double frac)
+{
+  return est >= exp*(1-frac) && est <= exp*(1+frac);
+}
+
+void test_kmer_hll()
+{
+  test_status("Testing HyperLogLog kmer sketches");
+
+  const size_t kmer_size = 31, len = 200000, half = len/2;
+  char *seq = ctx_malloc(len+1);
+  KmerHLL hll, hll2;
+  uint64_t est;
+  size_t nkmers;
+
+  _rand_acgt(seq, len);
+  kmer_hll_alloc(&hll, KMER_HLL_BITS);
+  kmer_hll_alloc(&hll2, KMER_HLL_BITS);
+
+  // Empty
+  TASSERT(kmer_hll_estimate(&hll) == 0);
+
+  // Few kmers use linear counting
+  nkmers = kmer_hll_add_str_mt(&hll, seq, 100+kmer_size-1, kmer_size);
+  TASSERT(nkmers == 100);
+  est = kmer_hll_estimate(&hll);
+  TASSERT2(_hll_close(est, 100, 0.05), "est: %zu", (size_t)est);
+
+  // Adding the same kmers again does not change the estimate
+  kmer_hll_add_str_mt(&hll, seq, 100+kmer_size-1, kmer_size);
+  TASSERT(kmer_hll_estimate(&hll) == est);
+
+  // Many kmers, standard error is ~0.8%
+  kmer_hll_reset(&hll);
+  nkmers = kmer_hll_add_str_mt(&hll, seq, len, kmer_size);
+  TASSERT(nkmers == len+1-kmer_size);
+  est = kmer_hll_estimate(&hll);
+  TASSERT2(_hll_close(est, nkmers, 0.05), "est: %zu", (size_t)est);
+
+  // Sketches of two halves merge to the sketch of the whole
+  kmer_hll_reset(&hll);
+  kmer_hll_add_str_mt(&hll, seq, half+kmer_size-1, kmer_size);
+  kmer_hll_add_str_mt(&hll2, seq+half, len-half, kmer_size);
+  kmer_hll_merge(&hll, &hll2);
+  TASSERT(kmer_hll_estimate(&hll) == est);
+
+  kmer_hll_dealloc(&hll);
+  kmer_hll_dealloc(&hll2);
+  ctx_free(seq);
+}
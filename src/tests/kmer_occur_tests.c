@@ -3,6 +3,8 @@
 
 #include "kmer_occur.h"
 
+#include <unistd.h> // unlink
+
 static void test_kmer_occur_filter()
 {
   // Construct 1 colour graph with kmer-size=11
@@ -97,8 +99,111 @@ static void test_kmer_occur_filter()
   db_graph_dealloc(&graph);
 }
 
+// Compare occurrences and edges of a kmer in two graphs
+static void kograph_cmp_kmer(hkey_t hkey, const dBGraph *graph1,
+                             const KOGraph *kograph1, const dBGraph *graph2,
+                             const KOGraph *kograph2, size_t *nbad)
+{
+  BinaryKmer bkey = db_node_get_bkey(graph1, hkey);
+  hkey_t hkey2 = hash_table_find(&graph2->ht, bkey);
+  const KOccur *ko1, *ko2;
+
+  if(hkey2 == HASH_NOT_FOUND) { (*nbad)++; return; }
+  if(db_node_get_edges(graph1, hkey, 0) != db_node_get_edges(graph2, hkey2, 0))
+    (*nbad)++;
+  if(db_node_has_col(graph1, hkey, 0) != db_node_has_col(graph2, hkey2, 0))
+    (*nbad)++;
+
+  ko1 = kograph_get(kograph1, hkey);
+  ko2 = kograph_get(kograph2, hkey2);
+
+  if(ko1 == NULL || ko2 == NULL) { *nbad += (ko1 != ko2); return; }
+
+  for(; ; ko1++, ko2++) {
+    if(ko1->chrom != ko2->chrom || ko1->offset != ko2->offset ||
+       ko1->orient != ko2->orient || ko1->next != ko2->next) {
+      (*nbad)++;
+      break;
+    }
+    if(!ko1->next) break;
+  }
+}
+
+static void test_kmer_occur_index()
+{
+  dBGraph graph, graph2;
+  const size_t kmer_size = 11, ncols = 1, nthreads = 2;
+  size_t i, nbad = 0;
+
+  db_graph_alloc(&graph, kmer_size, ncols, 1, 2000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL | DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&graph2, kmer_size, ncols, 1, 2000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL | DBG_ALLOC_BKTLOCKS);
+
+  // Repeats, both strands and an N
+  const char *tmp[]
+  = {"AACA",
+     "TTCGACCCGACAGGGCAACGTAGTCCGACAGGGCACAGCCCTGTCGGGGGGTGCA",
+     "TCTAGCATGTGTGTTNCGACCCGACAGGGCAACGTAGTCCGAC",
+     "GTCGGACTACGTTGCCCTGTCGGGTCGAATCTAGCAT"};
+  const size_t nreads = sizeof(tmp) / sizeof(tmp[0]);
+
+  read_t reads[nreads];
+  for(i = 0; i < nreads; i++) {
+    seq_read_alloc(&reads[i]);
+    seq_read_set(&reads[i], tmp[i]);
+    strbuf_sprintf(&reads[i].name, "chr%zu", i);
+  }
+
+  KOGraph kograph = kograph_create(reads, nreads, true, 0, nthreads, &graph);
+
+  char path[TEST_TMP_PATH_LEN];
+  FILE *fout = NULL;
+
+  if(test_tmp_file(path, "kmer_occur", ".koidx")) {
+    fout = fopen(path, "w");
+    TASSERT(fout != NULL);
+    if(fout == NULL) unlink(path);
+  }
+
+  if(fout != NULL) {
+    size_t nbytes = kograph_write(&kograph, reads, nreads, &graph, fout, path);
+    TASSERT((size_t)ftell(fout) == nbytes);
+    fclose(fout);
+
+    KOIndexHeader hdr;
+    kograph_load_header(path, &hdr);
+    TASSERT(hdr.kmer_size == kmer_size);
+    TASSERT(hdr.nchroms == nreads);
+    TASSERT(hdr.nkmers == hash_table_nkmers(&graph.ht));
+
+    KOGraph kograph2 = kograph_load(path, true, 0, nthreads, &graph2);
+
+    TASSERT(hash_table_nkmers(&graph2.ht) == hash_table_nkmers(&graph.ht));
+    TASSERT(kograph2.nchroms == nreads);
+    for(i = 0; i < nreads && i < kograph2.nchroms; i++) {
+      TASSERT(strcmp(kograph2.chroms[i].name, reads[i].name.b) == 0);
+      TASSERT(kograph2.chroms[i].length == reads[i].seq.end);
+    }
+
+    HASH_ITERATE(&graph.ht, kograph_cmp_kmer,
+                 &graph, &kograph, &graph2, &kograph2, &nbad);
+    TASSERT2(nbad == 0, "nbad: %zu", nbad);
+
+    kograph_dealloc(&kograph2);
+    unlink(path);
+  }
+
+  for(i = 0; i < nreads; i++) seq_read_dealloc(&reads[i]);
+  kograph_dealloc(&kograph);
+
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&graph2);
+}
+
 void test_kmer_occur()
 {
   test_status("Testing KOGraph...");
   test_kmer_occur_filter();
+  test_kmer_occur_index();
 }
@@ -5,21 +5,29 @@
 #include "util.h"
 #include "db_graph.h"
 #include "db_node.h"
+#include "db_node_cache.h"
 #include "build_graph.h"
+#include "db_unitig.h"
+#include "prune_nodes.h"
+#include "graph_pass.h"
 
 static void edge_check(hkey_t hkey, const dBGraph *db_graph, size_t col)
 {
   const BinaryKmer bkmer = db_node_get_bkey(db_graph, hkey);
   const Edges edges = db_node_get_edges(db_graph, hkey, col);
 
-  dBNode nodes[4];
+  dBNode nodes[4], next;
   Nucleotide nucs[4];
   size_t i, n, or;
 
   for(or = 0; or < 2; or++) {
     Edges e = 0;
     n = db_graph_next_nodes(db_graph, bkmer, or, edges, nodes, nucs);
-    for(i = 0; i < n; i++) e |= nuc_orient_to_edge(nucs[i], or);
+    for(i = 0; i < n; i++) {
+      e |= nuc_orient_to_edge(nucs[i], or);
+      next = db_graph_next_node(db_graph, bkmer, nucs[i], or);
+      TASSERT(db_nodes_are_equal(nodes[i], next));
+    }
     TASSERT(edges_with_orientation(e,or) == edges_with_orientation(edges,or));
   }
 }
@@ -50,6 +58,82 @@ static void test_db_graph_next_nodes()
   db_graph_dealloc(&graph);
 }
 
+// Compare next nodes and unitigs with and without the successor cache
+static void test_db_graph_next_cache()
+{
+  test_status("Testing successor cache");
+
+  dBGraph graph;
+  size_t i, j, or, kmer_size = 11;
+  char seq[200];
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 2048,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  // Random sequence with a repeat to make some branches
+  for(i = 0; i < 4; i++) {
+    dna_rand_str(seq, 150);
+    memcpy(seq+100, seq+20, 30);
+    build_graph_from_str_mt(&graph, 0, seq, strlen(seq), false);
+  }
+
+  const size_t cap = graph.ht.capacity;
+  dBNode *nodes0 = ctx_calloc(cap*2*4, sizeof(dBNode));
+  uint8_t *counts0 = ctx_calloc(cap*2, sizeof(uint8_t));
+  dBNode nodes[4];
+  Nucleotide nucs[4];
+  dBNodeBuffer nbuf0, nbuf1;
+  db_node_buf_alloc(&nbuf0, 64);
+  db_node_buf_alloc(&nbuf1, 64);
+
+  for(i = 0; i < cap; i++) {
+    if(!db_graph_node_assigned(&graph, i)) continue;
+    for(or = 0; or < 2; or++) {
+      dBNode node = {.key = i, .orient = or};
+      counts0[2*i+or] = db_graph_next_nodes_union(&graph, node,
+                                                  nodes0+(2*i+or)*4, nucs);
+    }
+  }
+
+  db_graph_next_cache_alloc(&graph, 2);
+
+  size_t ncached = 0, nwrong = 0;
+  for(i = 0; i < cap; i++) {
+    if(!db_graph_node_assigned(&graph, i)) continue;
+    for(or = 0; or < 2; or++) {
+      dBNode node = {.key = i, .orient = or}, next;
+      ncached += db_graph_next_cache_get(&graph, node, &next, &nucs[0]);
+      uint8_t n = db_graph_next_nodes_union(&graph, node, nodes, nucs);
+      nwrong += (n != counts0[2*i+or]);
+      for(j = 0; j < n && j < counts0[2*i+or]; j++)
+        nwrong += !db_nodes_are_equal(nodes[j], nodes0[(2*i+or)*4+j]);
+    }
+  }
+
+  TASSERT(ncached > 0);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  // Unitigs are the same walked with the cache
+  for(i = 0; i < cap; i++) {
+    if(!db_graph_node_assigned(&graph, i)) continue;
+    db_node_buf_reset(&nbuf1);
+    db_unitig_fetch(i, &nbuf1, &graph);
+    uint64_t *cache = graph.next_cache;
+    graph.next_cache = NULL;
+    db_node_buf_reset(&nbuf0);
+    db_unitig_fetch(i, &nbuf0, &graph);
+    graph.next_cache = cache;
+    TASSERT(nbuf0.len == nbuf1.len &&
+            memcmp(nbuf0.b, nbuf1.b, nbuf0.len*sizeof(dBNode)) == 0);
+  }
+
+  db_node_buf_dealloc(&nbuf0);
+  db_node_buf_dealloc(&nbuf1);
+  ctx_free(nodes0);
+  ctx_free(counts0);
+  db_graph_dealloc(&graph);
+}
+
 #define MAXLEN 300
 #define NLOOP 300
 
@@ -87,8 +171,624 @@ static void test_left_shift()
   }
 }
 
+typedef struct {
+  dBGraph *db_graph;
+  hkey_t hkey;
+  size_t n;
+} CovgJob;
+
+static void covg_increment_thread(void *arg, size_t threadid)
+{
+  const CovgJob *job = (const CovgJob*)arg;
+  size_t i;
+  for(i = 0; i < job->n; i++) {
+    if(threadid & 1) db_node_increment_coverage_mt(job->db_graph, job->hkey, 1);
+    else db_node_add_col_covg_mt(job->db_graph, job->hkey, 1, 1);
+  }
+}
+
+// Coverages must read back the same whatever COVG_BITS we compiled with
+static void test_db_node_covgs()
+{
+  test_status("Testing coverages stored in %i bits", COVG_BITS);
+
+  dBGraph graph;
+  size_t i, ncols = 2;
+  bool found;
+  const Covg vals[] = {0, 1, 254, 255, 256, 65534, 65535, 65536, 1000000,
+                       COVG_MAX-1, COVG_MAX};
+
+  db_graph_alloc(&graph, 11, ncols, ncols, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  BinaryKmer bkmer = binary_kmer_from_str("CTTTCTTATCT", 11);
+  dBNode node = db_graph_find_or_add_node(&graph, bkmer, &found);
+
+  for(i = 0; i < sizeof(vals)/sizeof(vals[0]); i++) {
+    db_node_set_covg(&graph, node.key, 0, vals[i]);
+    db_node_set_covg(&graph, node.key, 1, vals[i]/2);
+    TASSERT(db_node_get_covg(&graph, node.key, 0) == vals[i]);
+    TASSERT(db_node_get_covg(&graph, node.key, 1) == vals[i]/2);
+    TASSERT(db_node_sum_covg(&graph, node.key) == SAFE_ADD_COVG(vals[i], vals[i]/2));
+  }
+
+  // Adding saturates at COVG_MAX
+  db_node_set_covg(&graph, node.key, 0, 250);
+  db_node_add_col_covg(&graph, node.key, 0, 10);
+  TASSERT(db_node_get_covg(&graph, node.key, 0) == 260);
+  db_node_add_col_covg_mt(&graph, node.key, 0, COVG_MAX-300);
+  TASSERT(db_node_get_covg(&graph, node.key, 0) == COVG_MAX-40);
+  db_node_add_col_covg_mt(&graph, node.key, 0, 100);
+  TASSERT(db_node_get_covg(&graph, node.key, 0) == COVG_MAX);
+
+  // Wiped coverage does not pick up an old overflow value
+  db_graph_wipe_colour(&graph, 0, 1);
+  TASSERT(db_node_get_covg(&graph, node.key, 0) == 0);
+  db_node_add_col_covg_mt(&graph, node.key, 0, 70000);
+  TASSERT(db_node_get_covg(&graph, node.key, 0) == 70000);
+
+  // Threads racing past the largest value we can store
+  CovgJob job = {.db_graph = &graph, .hkey = node.key, .n = 20000};
+  db_node_set_covg(&graph, node.key, 1, 0);
+  util_multi_thread(&job, 4, covg_increment_thread);
+  TASSERT2(db_node_get_covg(&graph, node.key, 1) == 4*job.n, "%u",
+           db_node_get_covg(&graph, node.key, 1));
+
+  // Resizing keeps coverages
+  db_graph_resize(&graph, graph.ht.capacity*2, 2);
+  node = db_graph_find(&graph, bkmer);
+  TASSERT(db_node_get_covg(&graph, node.key, 0) == 70000);
+  TASSERT(db_node_get_covg(&graph, node.key, 1) == 4*job.n);
+
+  db_graph_dealloc(&graph);
+}
+
+typedef struct {
+  const dBGraph *dense;
+  dBGraph *sparse;
+  size_t nthreads;
+} SparseJob;
+
+// Each thread adds every kmer in one colour, twice, so colours race and
+// entries get merged
+static void sparse_copy_thread(void *arg, size_t threadid)
+{
+  const SparseJob *job = (const SparseJob*)arg;
+  const dBGraph *dense = job->dense;
+  size_t col, rep;
+  hkey_t hkey, skey;
+
+  for(col = threadid; col < dense->num_of_cols; col += job->nthreads) {
+    for(rep = 0; rep < 2; rep++) {
+      for(hkey = 0; hkey < dense->ht.capacity; hkey++) {
+        if(!hash_table_assigned(&dense->ht, hkey)) continue;
+        Covg covg = db_node_get_covg(dense, hkey, col);
+        Edges edges = db_node_get_edges(dense, hkey, col);
+        if(!covg && !edges) continue;
+        skey = db_graph_find(job->sparse, db_node_get_bkey(dense, hkey)).key;
+        sparse_cols_add_mt(job->sparse->sparse, skey, col,
+                           rep ? covg - covg/2 : covg/2, edges);
+      }
+    }
+  }
+}
+
+static void test_db_node_sparse()
+{
+  test_status("Testing sparse colour storage");
+
+  dBGraph dense, sparse;
+  SparseCols sc;
+  size_t i, col, ncols = 5, kmer_size = 11, nwrong = 0;
+  char seq[100];
+  hkey_t hkey, skey;
+  bool found;
+
+  db_graph_alloc(&dense, kmer_size, ncols, ncols, 4096,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&sparse, kmer_size, ncols, ncols, 4096, DBG_ALLOC_BKTLOCKS);
+  sparse_cols_alloc(&sc, sparse.ht.capacity, 4096);
+  sparse.sparse = &sc;
+
+  // Most kmers in one colour, some shared
+  for(i = 0; i < 40; i++) {
+    dna_rand_str(seq, 60);
+    build_graph_from_str_mt(&dense, i % ncols, seq, strlen(seq), false);
+    if(i % 4 == 0)
+      build_graph_from_str_mt(&dense, (i+1) % ncols, seq, strlen(seq), false);
+  }
+
+  for(hkey = 0; hkey < dense.ht.capacity; hkey++)
+    if(hash_table_assigned(&dense.ht, hkey))
+      db_graph_find_or_add_node(&sparse, db_node_get_bkey(&dense, hkey), &found);
+
+  SparseJob job = {.dense = &dense, .sparse = &sparse, .nthreads = 3};
+  util_multi_thread(&job, job.nthreads, sparse_copy_thread);
+
+  Covg covgs[ncols];
+  for(hkey = 0; hkey < dense.ht.capacity; hkey++) {
+    if(!hash_table_assigned(&dense.ht, hkey)) continue;
+    skey = db_graph_find(&sparse, db_node_get_bkey(&dense, hkey)).key;
+    for(col = 0; col < ncols; col++) {
+      nwrong += db_node_get_covg(&dense, hkey, col) != db_node_get_covg(&sparse, skey, col);
+      nwrong += db_node_get_edges(&dense, hkey, col) != db_node_get_edges(&sparse, skey, col);
+      nwrong += (db_node_get_covg(&dense, hkey, col) > 0) != db_node_has_col(&sparse, skey, col);
+    }
+    nwrong += db_node_get_edges_union(&dense, hkey) != db_node_get_edges_union(&sparse, skey);
+    nwrong += db_node_sum_covg(&dense, hkey) != db_node_sum_covg(&sparse, skey);
+    db_node_get_covgs(&sparse, skey, covgs);
+    for(col = 0; col < ncols; col++)
+      nwrong += covgs[col] != db_node_get_covg(&dense, hkey, col);
+  }
+
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  // One entry per kmer per colour, plus any lost in races
+  size_t nexp = 0;
+  for(hkey = 0; hkey < dense.ht.capacity; hkey++)
+    if(hash_table_assigned(&dense.ht, hkey))
+      for(col = 0; col < ncols; col++)
+        nexp += db_node_get_covg(&dense, hkey, col) > 0;
+  TASSERT(sc.num_entries >= nexp);
+
+  sparse_cols_dealloc(&sc);
+  db_graph_dealloc(&dense);
+  db_graph_dealloc(&sparse);
+}
+
+static void test_db_node_shared_edges()
+{
+  test_status("Testing shared edge storage");
+
+  dBGraph graph;
+  SharedEdges se;
+  size_t i, col, ncols = 5, kmer_size = 11, nwrong = 0, nexcs = 0;
+  char seq[100];
+  hkey_t hkey;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 4096,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  // Most sequence in all colours, some in only one
+  for(i = 0; i < 40; i++) {
+    dna_rand_str(seq, 60);
+    for(col = 0; col < ncols; col++)
+      if(i % 4 == 0 || col == i % ncols)
+        build_graph_from_str_mt(&graph, col, seq, strlen(seq), false);
+  }
+
+  // Remove an edge from a colour and add edges to colours without the kmer
+  for(hkey = 0, i = 0; hkey < graph.ht.capacity; hkey++) {
+    if(!hash_table_assigned(&graph.ht, hkey)) continue;
+    col = i++ % ncols;
+    if(i % 7 == 0) db_node_edges(&graph, hkey, col) &= 0xf0;
+    else if(i % 11 == 0 && db_node_get_covg(&graph, hkey, col) == 0)
+      db_node_edges(&graph, hkey, col) = 0x21;
+  }
+
+  size_t capacity = graph.ht.capacity;
+  Edges *dense = ctx_malloc(capacity * ncols * sizeof(Edges));
+  for(hkey = 0; hkey < capacity; hkey++)
+    if(hash_table_assigned(&graph.ht, hkey))
+      db_node_get_all_edges(&graph, hkey, dense + hkey*ncols);
+
+  for(hkey = 0; hkey < capacity; hkey++) {
+    if(!hash_table_assigned(&graph.ht, hkey)) continue;
+    Edges uedges = edges_get_union(dense + hkey*ncols, ncols);
+    for(col = 0; col < ncols; col++)
+      nexcs += dense[hkey*ncols+col] !=
+               (db_node_get_covg(&graph, hkey, col) > 0 ? uedges : 0);
+  }
+
+  db_graph_share_edges(&graph, &se, 3);
+  TASSERT(graph.col_edges == NULL);
+  TASSERT2(se.num_excs == nexcs, "%zu vs %zu", se.num_excs, nexcs);
+  TASSERT(nexcs > 0);
+
+  Edges edges[ncols];
+  for(hkey = 0; hkey < capacity; hkey++) {
+    if(!hash_table_assigned(&graph.ht, hkey)) continue;
+    for(col = 0; col < ncols; col++)
+      nwrong += db_node_get_edges(&graph, hkey, col) != dense[hkey*ncols+col];
+    nwrong += db_node_get_edges_union(&graph, hkey) !=
+              edges_get_union(dense + hkey*ncols, ncols);
+    db_node_get_all_edges(&graph, hkey, edges);
+    nwrong += memcmp(edges, dense + hkey*ncols, ncols) != 0;
+  }
+
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  ctx_free(dense);
+  shared_edges_dealloc(&se);
+  db_graph_dealloc(&graph);
+}
+
+// Count differences between kmer-major graph `a` and colour-major graph `b`
+static size_t colmajor_cmp(const dBGraph *a, const dBGraph *b)
+{
+  size_t col, nwrong = 0;
+  hkey_t hkey, bkey;
+  Edges aedges[a->num_edge_cols], bedges[b->num_edge_cols];
+
+  nwrong += (a->ht.num_kmers != b->ht.num_kmers);
+
+  for(hkey = 0; hkey < a->ht.capacity; hkey++) {
+    if(!hash_table_assigned(&a->ht, hkey)) continue;
+    bkey = db_graph_find(b, db_node_get_bkey(a, hkey)).key;
+    if(bkey == HASH_NOT_FOUND) { nwrong++; continue; }
+    for(col = 0; col < a->num_of_cols; col++) {
+      nwrong += db_node_get_covg(a, hkey, col) != db_node_get_covg(b, bkey, col);
+      nwrong += db_node_get_edges(a, hkey, col) != db_node_get_edges(b, bkey, col);
+    }
+    nwrong += db_node_get_edges_union(a, hkey) != db_node_get_edges_union(b, bkey);
+    nwrong += db_node_sum_covg(a, hkey) != db_node_sum_covg(b, bkey);
+    db_node_get_all_edges(a, hkey, aedges);
+    db_node_get_all_edges(b, bkey, bedges);
+    nwrong += memcmp(aedges, bedges, sizeof(aedges)) != 0;
+  }
+  return nwrong;
+}
+
+static void test_db_node_colmajor()
+{
+  test_status("Testing colour-major coverages and edges");
+
+  dBGraph kmaj, cmaj;
+  size_t i, ncols = 4, kmer_size = 15;
+  char seq[100];
+  hkey_t hkey;
+
+  db_graph_alloc(&kmaj, kmer_size, ncols, ncols, 2048,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&cmaj, kmer_size, ncols, ncols, 2048,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS |
+                 DBG_ALLOC_COLMAJOR);
+  TASSERT(!kmaj.col_major && cmaj.col_major);
+
+  for(i = 0; i < 30; i++) {
+    dna_rand_str(seq, 70);
+    build_graph_from_str_mt(&kmaj, i % ncols, seq, strlen(seq), false);
+    build_graph_from_str_mt(&cmaj, i % ncols, seq, strlen(seq), false);
+    if(i % 3 == 0) {
+      build_graph_from_str_mt(&kmaj, (i+1) % ncols, seq, strlen(seq), false);
+      build_graph_from_str_mt(&cmaj, (i+1) % ncols, seq, strlen(seq), false);
+    }
+  }
+
+  size_t nwrong = colmajor_cmp(&kmaj, &cmaj);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  // Wiping a colour only touches that colour
+  db_graph_wipe_colour(&kmaj, 2, 2);
+  db_graph_wipe_colour(&cmaj, 2, 2);
+  nwrong = colmajor_cmp(&kmaj, &cmaj);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  // Zero a node
+  for(hkey = 0; hkey < kmaj.ht.capacity && !db_graph_node_assigned(&kmaj, hkey); hkey++) {}
+  if(hkey < kmaj.ht.capacity) {
+    hkey_t ckey = db_graph_find(&cmaj, db_node_get_bkey(&kmaj, hkey)).key;
+    db_node_zero_covgs(&kmaj, hkey); db_node_zero_edges(&kmaj, hkey);
+    db_node_zero_covgs(&cmaj, ckey); db_node_zero_edges(&cmaj, ckey);
+    TASSERT(db_node_sum_covg(&cmaj, ckey) == 0);
+    TASSERT(db_node_get_edges_union(&cmaj, ckey) == 0);
+  }
+
+  // Colours are remapped when the table grows
+  db_graph_resize(&cmaj, cmaj.ht.capacity*4, 2);
+  TASSERT(cmaj.col_major);
+  nwrong = colmajor_cmp(&kmaj, &cmaj);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_graph_dealloc(&kmaj);
+  db_graph_dealloc(&cmaj);
+}
+
+// Updates through a small cache (so entries get evicted) must give the same
+// graph as writing them directly
+static void test_db_node_cache()
+{
+  test_status("Testing cached coverage and edge updates");
+
+  dBGraph direct, cached;
+  dBNodeCache cache;
+  size_t i, j, col, ncols = 2, kmer_size = 11, nkmers, nwrong = 0;
+  char seq[200];
+  bool found;
+  hkey_t hkey, ckey;
+  dBNode prev0, prev1, curr0, curr1;
+  BinaryKmer bkey;
+
+  db_graph_alloc(&direct, kmer_size, ncols, ncols, 4096,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL);
+  db_graph_alloc(&cached, kmer_size, ncols, ncols, 4096,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL);
+  db_node_cache_alloc(&cache, &cached, 4);
+
+  // Repeats of a short sequence give high copy kmers
+  for(i = 0; i < 30; i++) {
+    col = i % ncols;
+    if(i % 3 == 0) {
+      dna_rand_str(seq, 14);
+      for(j = 14; j < 150; j++) seq[j] = seq[j%14];
+      seq[150] = '\0';
+    }
+    else dna_rand_str(seq, 100);
+    nkmers = strlen(seq)+1-kmer_size;
+    prev0 = prev1 = (dBNode){.key = HASH_NOT_FOUND};
+    for(j = 0; j < nkmers; j++, prev0 = curr0, prev1 = curr1) {
+      bkey = binary_kmer_from_str(seq+j, kmer_size);
+      curr0 = db_graph_find_or_add_node(&direct, bkey, &found);
+      curr1 = db_graph_find_or_add_node(&cached, bkey, &found);
+      bkey = binary_kmer_get_key(bkey, kmer_size);
+      db_graph_update_node_mt(&direct, curr0, col);
+      db_node_cache_update_node(&cache, curr1, bkey, col, 1);
+      if(j > 0) {
+        db_graph_add_edge_mt(&direct, col, prev0, curr0);
+        db_node_cache_add_edge(&cache, col, prev1, curr1);
+      }
+    }
+  }
+
+  db_node_cache_flush(&cache);
+
+  for(hkey = 0; hkey < direct.ht.capacity; hkey++) {
+    if(!hash_table_assigned(&direct.ht, hkey)) continue;
+    ckey = db_graph_find(&cached, db_node_get_bkey(&direct, hkey)).key;
+    for(col = 0; col < ncols; col++) {
+      nwrong += db_node_get_covg(&direct, hkey, col) != db_node_get_covg(&cached, ckey, col);
+      nwrong += db_node_get_edges(&direct, hkey, col) != db_node_get_edges(&cached, ckey, col);
+      nwrong += db_node_has_col(&direct, hkey, col) != db_node_has_col(&cached, ckey, col);
+    }
+  }
+
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_node_cache_dealloc(&cache);
+  db_graph_dealloc(&direct);
+  db_graph_dealloc(&cached);
+}
+
+static void test_db_node_presence_only()
+{
+  test_status("Testing presence-only colours");
+
+  dBGraph full, pres;
+  size_t i, col, ncols = 3, kmer_size = 15, nwrong = 0;
+  bool presence[3] = {true, false, false};
+  char seq[100];
+  hkey_t hkey, pkey;
+
+  db_graph_alloc(&full, kmer_size, ncols, 1, 2048,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                 DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&pres, kmer_size, ncols, 1, 2048,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                 DBG_ALLOC_BKTLOCKS);
+  db_graph_set_presence_only(&pres, presence);
+  TASSERT(pres.num_covg_cols == 2);
+
+  for(i = 0; i < 20; i++) {
+    dna_rand_str(seq, 70);
+    build_graph_from_str_mt(&full, i % ncols, seq, strlen(seq), false);
+    build_graph_from_str_mt(&pres, i % ncols, seq, strlen(seq), false);
+    build_graph_from_str_mt(&full, (i+1) % ncols, seq, strlen(seq), false);
+    build_graph_from_str_mt(&pres, (i+1) % ncols, seq, strlen(seq), false);
+  }
+
+  // Coverage of presence-only colours reads as 0/1
+  db_graph_resize(&pres, pres.ht.capacity*2, 2);
+  for(hkey = 0; hkey < full.ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(&full, hkey)) continue;
+    pkey = db_graph_find(&pres, db_node_get_bkey(&full, hkey)).key;
+    for(col = 0; col < ncols; col++) {
+      nwrong += (db_node_has_col(&full, hkey, col) !=
+                 db_node_has_col(&pres, pkey, col));
+      nwrong += (presence[col] ? db_node_get_covg(&pres, pkey, col) !=
+                                 (db_node_has_col(&full, hkey, col) ? 1 : 0)
+                               : db_node_get_covg(&pres, pkey, col) !=
+                                 db_node_get_covg(&full, hkey, col));
+    }
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_graph_dealloc(&full);
+  db_graph_dealloc(&pres);
+}
+
+static size_t union_edges_check(const dBGraph *db_graph)
+{
+  size_t hkey, nwrong = 0;
+  for(hkey = 0; hkey < db_graph->ht.capacity; hkey++) {
+    if(db_graph_node_assigned(db_graph, hkey)) {
+      nwrong += (db_node_get_edges_union(db_graph, hkey) !=
+                 db_node_read_edges_union(db_graph, hkey));
+    }
+  }
+  return nwrong;
+}
+
+static void test_db_node_colsets()
+{
+  test_status("Testing colour sets and union edges cache");
+
+  dBGraph graph;
+  size_t i, col, ncols = 70, kmer_size = 15, nwrong = 0;
+  uint64_t colset[2];
+  char seq[100];
+  hkey_t hkey;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 4096,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL | DBG_ALLOC_BKTLOCKS);
+
+  for(i = 0; i < 40; i++) {
+    dna_rand_str(seq, 70);
+    for(col = i % 3; col < ncols; col += 1 + i % 5)
+      build_graph_from_str_mt(&graph, col, seq, strlen(seq), false);
+  }
+
+  // Colour sets match db_node_has_col()
+  for(hkey = 0; hkey < graph.ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(&graph, hkey)) continue;
+    db_node_get_colset(&graph, hkey, colset);
+    for(col = 0; col < ncols; col++)
+      nwrong += (db_node_colset_has(colset, col) != db_node_has_col(&graph, hkey, col));
+    nwrong += (colset[1] >> (ncols-64)) != 0;
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_graph_union_edges_alloc(&graph, 2);
+  TASSERT(graph.union_edges != NULL);
+  TASSERT(union_edges_check(&graph) == 0);
+
+  // Cache is kept up to date when adding edges and removing nodes
+  for(i = 0; i < 10; i++) {
+    dna_rand_str(seq, 70);
+    build_graph_from_str_mt(&graph, i % ncols, seq, strlen(seq), false);
+  }
+  TASSERT(union_edges_check(&graph) == 0);
+
+  for(hkey = 0, i = 0; hkey < graph.ht.capacity && i < 20; hkey++) {
+    if(db_graph_node_assigned(&graph, hkey)) {
+      prune_connecting_edges_mt(&graph, hkey, NULL, NULL);
+      prune_node_without_edges_mt(&graph, hkey);
+      i++;
+    }
+  }
+  TASSERT(union_edges_check(&graph) == 0);
+
+  db_graph_dealloc(&graph);
+}
+
+// A fused pass gives the same graph as running each operation on its own
+static void test_graph_pass()
+{
+  test_status("Testing fused whole graph passes");
+
+  dBGraph fused, sep;
+  const size_t ncols = 3, kmer_size = 15, nthreads = 2;
+  const int flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                    DBG_ALLOC_BKTLOCKS;
+  uint64_t fnkmers[3] = {0}, fsumcov[3] = {0}, snkmers[3] = {0}, ssumcov[3] = {0};
+  uint8_t wipe_cols[1] = {0};
+  size_t i, nsweeps;
+  char seq[100];
+
+  db_graph_alloc(&fused, kmer_size, ncols, ncols, 2048, flags);
+  db_graph_alloc(&sep, kmer_size, ncols, ncols, 2048, flags | DBG_ALLOC_COLMAJOR);
+
+  for(i = 0; i < 30; i++) {
+    dna_rand_str(seq, 70);
+    build_graph_from_str_mt(&fused, i % ncols, seq, strlen(seq), false);
+    build_graph_from_str_mt(&sep, i % ncols, seq, strlen(seq), false);
+  }
+
+  // Wipe colour 1, leaving kmers only seen in it with no coverage
+  bitset_set(wipe_cols, 1);
+  GraphPass pass = {.wipe_cols = wipe_cols, .add_all_edges = true,
+                    .remove_no_covg = true,
+                    .nkmers = fnkmers, .sumcov = fsumcov};
+  nsweeps = graph_pass_run(&pass, &fused, nthreads);
+  TASSERT2(nsweeps == 3, "nsweeps: %zu", nsweeps);
+
+  db_graph_wipe_colour(&sep, 1, nthreads);
+  db_graph_add_all_edges(&sep, nthreads);
+  db_graph_remove_no_covg_kmers(&sep, nthreads);
+  db_graph_get_kmer_covg(&sep, nthreads, snkmers, ssumcov);
+
+  size_t nwrong = colmajor_cmp(&fused, &sep);
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+  TASSERT(hash_table_nkmers(&fused.ht) == hash_table_count_kmers(&fused.ht));
+  TASSERT(memcmp(fnkmers, snkmers, sizeof(fnkmers)) == 0);
+  TASSERT(memcmp(fsumcov, ssumcov, sizeof(fsumcov)) == 0);
+  TASSERT(fnkmers[1] == 0 && fsumcov[1] == 0);
+  TASSERT(fnkmers[0] + fnkmers[2] >= hash_table_nkmers(&fused.ht));
+
+  // Without adding edges everything is done in one sweep
+  GraphPass count = {.remove_no_covg = true,
+                     .nkmers = fnkmers, .sumcov = fsumcov};
+  nsweeps = graph_pass_run(&count, &fused, nthreads);
+  TASSERT2(nsweeps == 1, "nsweeps: %zu", nsweeps);
+  TASSERT(fnkmers[0] == 2*snkmers[0] && fsumcov[2] == 2*ssumcov[2]);
+
+  db_graph_dealloc(&fused);
+  db_graph_dealloc(&sep);
+}
+
+// Graph passes on a graph with a presence-only colour, which shifts the
+// coverage slots of later colours
+static void test_graph_pass_presence_only()
+{
+  test_status("Testing graph passes with presence-only colours");
+
+  dBGraph full, pres;
+  const size_t ncols = 3, kmer_size = 15, nthreads = 2;
+  const int flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                    DBG_ALLOC_BKTLOCKS;
+  bool presence[3] = {false, true, false};
+  uint64_t fnkmers[3] = {0}, fsumcov[3] = {0}, pnkmers[3] = {0}, psumcov[3] = {0};
+  uint8_t wipe_cols[1] = {0};
+  size_t i, col, nwrong = 0;
+  hkey_t hkey, pkey;
+  char seq[100];
+
+  db_graph_alloc(&full, kmer_size, ncols, ncols, 2048, flags);
+  db_graph_alloc(&pres, kmer_size, ncols, ncols, 2048, flags);
+  db_graph_set_presence_only(&pres, presence);
+  TASSERT(pres.num_covg_cols == 2);
+
+  for(i = 0; i < 30; i++) {
+    dna_rand_str(seq, 70);
+    build_graph_from_str_mt(&full, i % ncols, seq, strlen(seq), false);
+    build_graph_from_str_mt(&pres, i % ncols, seq, strlen(seq), false);
+    build_graph_from_str_mt(&full, (i+1) % ncols, seq, strlen(seq), false);
+    build_graph_from_str_mt(&pres, (i+1) % ncols, seq, strlen(seq), false);
+  }
+
+  // Wipe colour 2, which is in the second coverage slot of pres
+  bitset_set(wipe_cols, 2);
+  GraphPass pass = {.wipe_cols = wipe_cols, .remove_no_covg = true,
+                    .nkmers = fnkmers, .sumcov = fsumcov};
+  graph_pass_run(&pass, &full, nthreads);
+  pass.nkmers = pnkmers;
+  pass.sumcov = psumcov;
+  graph_pass_run(&pass, &pres, nthreads);
+
+  TASSERT(hash_table_nkmers(&full.ht) == hash_table_nkmers(&pres.ht));
+  TASSERT(fnkmers[2] == 0 && pnkmers[2] == 0);
+  TASSERT(memcmp(fnkmers, pnkmers, sizeof(fnkmers)) == 0);
+  TASSERT(fsumcov[0] == psumcov[0] && psumcov[1] == pnkmers[1]);
+
+  for(hkey = 0; hkey < full.ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(&full, hkey)) continue;
+    pkey = db_graph_find(&pres, db_node_get_bkey(&full, hkey)).key;
+    if(pkey == HASH_NOT_FOUND) { nwrong++; continue; }
+    for(col = 0; col < ncols; col++) {
+      nwrong += (db_node_has_col(&full, hkey, col) !=
+                 db_node_has_col(&pres, pkey, col));
+      if(!presence[col])
+        nwrong += (db_node_get_covg(&full, hkey, col) !=
+                   db_node_get_covg(&pres, pkey, col));
+    }
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  db_graph_dealloc(&full);
+  db_graph_dealloc(&pres);
+}
+
 void test_db_node()
 {
   test_db_graph_next_nodes();
+  test_db_graph_next_cache();
   test_left_shift();
+  test_db_node_covgs();
+  test_db_node_sparse();
+  test_db_node_shared_edges();
+  test_db_node_colmajor();
+  test_db_node_presence_only();
+  test_db_node_cache();
+  test_db_node_colsets();
+  test_graph_pass();
+  test_graph_pass_presence_only();
 }
@@ -4,6 +4,14 @@
 #include "build_graph.h"
 #include "generate_paths.h"
 #include "gpath_checks.h"
+#include "gpath_save.h"
+#include "gpath_reader.h"
+#include "gpath_subset.h"
+#include "gpath_sketch.h"
+#include "gpath_trie.h"
+#include "gpath_follow.h"
+#include "binary_seq.h"
+#include "file_util.h"
 
 //       junctions:  >     >           <     <     <
 const char seq0[] = "CCTGGGTGCGAATGACACCAAATCGAATGAC"; // a->d
@@ -88,7 +96,7 @@ static void _check_node_paths(const char *kmer,
   #define MAX_SEQ 128
   char seq[MAX_SEQ];
 
-  for(; path != NULL; path = path->next)
+  for(; path != NULL; path = gpath_next(path))
   {
     if(path->orient == node.orient &&
        gpath_has_colour(path, gpstore->gpset.ncols, colour))
@@ -176,7 +184,714 @@ static void _test_add_paths()
   db_graph_dealloc(&graph);
 }
 
+// Check every path of every kmer in graph0 is in graph1 with the same colours
+// and counts, and both have the same number of paths
+static void _check_same_paths(const dBGraph *graph0, const dBGraph *graph1)
+{
+  const GPathStore *gpstore0 = &graph0->gpstore, *gpstore1 = &graph1->gpstore;
+  const size_t ncols = gpstore0->gpset.ncols;
+  const GPath *gpath0, *gpath1;
+  size_t n0, n1;
+  hkey_t hkey0, hkey1;
+
+  TASSERT(gpstore0->num_kmers_with_paths == gpstore1->num_kmers_with_paths);
+  TASSERT(gpstore0->num_paths == gpstore1->num_paths);
+  TASSERT(gpstore0->path_bytes == gpstore1->path_bytes);
+
+  for(hkey0 = 0; hkey0 < graph0->ht.capacity; hkey0++)
+  {
+    if(!db_graph_node_assigned(graph0, hkey0)) continue;
+    hkey1 = hash_table_find(&graph1->ht, db_node_get_bkey(graph0, hkey0));
+    TASSERT(hkey1 != HASH_NOT_FOUND);
+    if(hkey1 == HASH_NOT_FOUND) continue;
+
+    n0 = n1 = 0;
+    gpath0 = gpath_store_fetch(gpstore0, hkey0);
+    for(; gpath0 != NULL; gpath0 = gpath_next(gpath0), n0++) {
+      gpath1 = gpstore_find(gpstore1, hkey1,
+                            gpath_set_get(&gpstore0->gpset, gpath0));
+      TASSERT(gpath1 != NULL);
+      if(gpath1 == NULL) continue;
+      TASSERT(memcmp(gpath_get_colset(gpath0, ncols),
+                     gpath_get_colset(gpath1, ncols), (ncols+7)/8) == 0);
+      TASSERT(memcmp(gpath_set_get_nseen(&gpstore0->gpset, gpath0),
+                     gpath_set_get_nseen(&gpstore1->gpset, gpath1), ncols) == 0);
+    }
+    gpath1 = gpath_store_fetch(gpstore1, hkey1);
+    for(; gpath1 != NULL; gpath1 = gpath_next(gpath1)) n1++;
+    TASSERT(n0 == n1);
+  }
+}
+
+static void _load_paths_file(dBGraph *graph, const char *path, bool use_hash,
+                             size_t nthreads)
+{
+  db_graph_alloc(graph, 11, 2, 2, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS |
+                 DBG_ALLOC_BKTLOCKS | DBG_ALLOC_NODE_IN_COL);
+  gpath_store_alloc(&graph->gpstore, graph->num_of_cols, graph->ht.capacity,
+                    0, ONE_MEGABYTE, true, false);
+  if(use_hash) gpath_hash_alloc(&graph->gphash, &graph->gpstore, ONE_MEGABYTE);
+
+  build_graph_from_str_mt(graph, 0, seq0, strlen(seq0), false);
+  build_graph_from_str_mt(graph, 1, seq1, strlen(seq1), false);
+
+  GPathReader rdr;
+  memset(&rdr, 0, sizeof(rdr));
+  gpath_reader_open(&rdr, path);
+  TASSERT((rdr.bin != NULL) == gpath_reader_is_bin(path));
+  gpath_reader_load_mt(&rdr, GPATH_DIE_MISSING_KMERS, nthreads, graph);
+  gpath_reader_close(&rdr);
+}
+
+// Construct 2 colour graph with kmer-size=11 and random links
+static void _random_links_graph(dBGraph *graph)
+{
+  size_t i, col, kmer_size = 11, ncols = 2;
+
+  db_graph_alloc(graph, kmer_size, ncols, ncols, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS |
+                 DBG_ALLOC_BKTLOCKS | DBG_ALLOC_NODE_IN_COL);
+  gpath_store_alloc(&graph->gpstore, graph->num_of_cols, graph->ht.capacity,
+                    0, ONE_MEGABYTE, true, false);
+
+  build_graph_from_str_mt(graph, 0, seq0, strlen(seq0), false);
+  build_graph_from_str_mt(graph, 1, seq1, strlen(seq1), false);
+
+  // Add random paths to every fifth kmer, sequences don't have to match graph
+  uint8_t seq[16], nseen[2];
+  GPath *gpath;
+  hkey_t hkey;
+
+  for(hkey = 0; hkey < graph->ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(graph, hkey) || hkey % 5) continue;
+    for(i = 0; i < 1 + hkey % 3; i++) {
+      rand_bytes(seq, sizeof(seq));
+      for(col = 0; col < ncols; col++) nseen[col] = rand() % 3;
+      nseen[rand() % ncols] |= 1;
+      GPathNew newgp = {.seq = seq, .colset = NULL, .nseen = nseen,
+                        .num_juncs = 8 + rand() % 56,
+                        .orient = rand() & 1};
+      gpath = gpath_store_add_mt(&graph->gpstore, hkey, newgp);
+      for(col = 0; col < ncols; col++)
+        if(nseen[col]) gpath_set_colour(gpath, ncols, col);
+    }
+  }
+
+  gpath_store_sync_stats(&graph->gpstore);
+  TASSERT(graph->gpstore.num_paths > 0);
+}
+
+// Save links to a new temporary file ending in `ext`
+// Returns false on failure
+static bool _save_tmp_links(dBGraph *graph, char *path, const char *ext,
+                            bool sort_kmers)
+{
+  if(!test_tmp_file(path, "paths_test", ext)) return false;
+
+  ZeroSizeBuffer hists[2];
+  memset(hists, 0, sizeof(hists));
+
+  FILE *fout;
+  test_with_force(fout = futil_fopen_create(path, "w"));
+  gpath_save(fout, path, 2, false, sort_kmers, NULL, NULL, NULL, 0,
+             hists, graph->num_of_cols, graph);
+  futil_fclose(fout);
+  return true;
+}
+
+static void _test_save_load_bin()
+{
+  test_status("Testing saving and loading binary link files (.ctp.bin)");
+
+  dBGraph graph, graph_mmap, graph_hash;
+  hkey_t hkey;
+
+  _random_links_graph(&graph);
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!_save_tmp_links(&graph, path, ".ctp.bin", false)) {
+    db_graph_dealloc(&graph);
+    return;
+  }
+
+  // Copied straight into the GPathStore
+  _load_paths_file(&graph_mmap, path, false, 1);
+  _check_same_paths(&graph, &graph_mmap);
+  _check_same_paths(&graph_mmap, &graph);
+
+  // Links are kept in the same order
+  for(hkey = 0; hkey < graph.ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(&graph, hkey)) continue;
+    BinaryKmer bkey = db_node_get_bkey(&graph, hkey);
+    const GPath *gp0 = gpath_store_fetch(&graph.gpstore, hkey);
+    const GPath *gp1 = gpath_store_fetch(&graph_mmap.gpstore,
+                                         hash_table_find(&graph_mmap.ht, bkey));
+    for(; gp0 != NULL && gp1 != NULL;
+        gp0 = gpath_next(gp0), gp1 = gpath_next(gp1))
+      TASSERT(gp0->orient == gp1->orient && gp0->num_juncs == gp1->num_juncs);
+    TASSERT(gp0 == NULL && gp1 == NULL);
+  }
+
+  // Loaded one kmer at a time, since there is a path hash
+  _load_paths_file(&graph_hash, path, true, 1);
+  _check_same_paths(&graph, &graph_hash);
+  _check_same_paths(&graph_hash, &graph);
+
+  unlink(path);
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&graph_mmap);
+  db_graph_dealloc(&graph_hash);
+}
+
+// Load colour 1 of the links in `path` into a single colour graph
+static void _load_paths_col1(dBGraph *graph, const char *path)
+{
+  db_graph_alloc(graph, 11, 1, 1, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS |
+                 DBG_ALLOC_BKTLOCKS | DBG_ALLOC_NODE_IN_COL);
+
+  // Both sequences, so every kmer with links is in the graph
+  build_graph_from_str_mt(graph, 0, seq0, strlen(seq0), false);
+  build_graph_from_str_mt(graph, 0, seq1, strlen(seq1), false);
+
+  char fpath[PATH_MAX+10];
+  sprintf(fpath, "%s:1", path);
+
+  GPathReader rdr;
+  memset(&rdr, 0, sizeof(rdr));
+  gpath_reader_open(&rdr, fpath);
+  TASSERT(file_filter_into_ncols(&rdr.fltr) == 1);
+
+  size_t npaths, path_bytes;
+  gpath_reader_get_filtered_counts(&rdr, &npaths, &path_bytes);
+  gpath_store_alloc(&graph->gpstore, graph->num_of_cols, graph->ht.capacity,
+                    npaths, ONE_MEGABYTE, true, false);
+  gpath_reader_load_mt(&rdr, GPATH_DIE_MISSING_KMERS, 1, graph);
+  TASSERT(graph->gpstore.num_paths <= npaths);
+  TASSERT(graph->gpstore.path_bytes <= path_bytes);
+  gpath_reader_close(&rdr);
+}
+
+static void _test_load_bin_colour()
+{
+  test_status("Testing loading one colour from a binary link file");
+
+  dBGraph graph, graph_bin, graph_txt;
+  _random_links_graph(&graph);
+
+  char bin_path[TEST_TMP_PATH_LEN];
+  char txt_path[TEST_TMP_PATH_LEN];
+  if(!_save_tmp_links(&graph, bin_path, ".ctp.bin", false) ||
+     !_save_tmp_links(&graph, txt_path, ".ctp.gz", false)) {
+    db_graph_dealloc(&graph);
+    return;
+  }
+
+  // Binary file uses its colour index, text file filters every link
+  _load_paths_col1(&graph_bin, bin_path);
+  _load_paths_col1(&graph_txt, txt_path);
+  TASSERT(graph_bin.gpstore.num_paths > 0);
+  TASSERT(graph_bin.gpstore.num_paths < graph.gpstore.num_paths);
+  _check_same_paths(&graph_bin, &graph_txt);
+  _check_same_paths(&graph_txt, &graph_bin);
+
+  unlink(bin_path);
+  unlink(txt_path);
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&graph_bin);
+  db_graph_dealloc(&graph_txt);
+}
+
+static void _test_save_load_text_mt()
+{
+  test_status("Testing loading link files (.ctp.gz) with multiple threads");
+
+  dBGraph graph, graph_st, graph_mt, graph_hash;
+  _random_links_graph(&graph);
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!_save_tmp_links(&graph, path, ".ctp.gz", false)) {
+    db_graph_dealloc(&graph);
+    return;
+  }
+
+  // Use small batches so every thread gets some kmers
+  size_t batch_size = gpath_reader_get_batch_size();
+  gpath_reader_set_batch_size(100);
+  _load_paths_file(&graph_st, path, false, 1);
+  _load_paths_file(&graph_mt, path, false, 3);
+  _load_paths_file(&graph_hash, path, true, 3);
+  gpath_reader_set_batch_size(batch_size);
+
+  _check_same_paths(&graph, &graph_st);
+  _check_same_paths(&graph, &graph_mt);
+  _check_same_paths(&graph_mt, &graph);
+  _check_same_paths(&graph, &graph_hash);
+  _check_same_paths(&graph_hash, &graph);
+  TASSERT(graph_hash.gphash.num_entries == graph_hash.gpstore.num_paths);
+
+  unlink(path);
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&graph_st);
+  db_graph_dealloc(&graph_mt);
+  db_graph_dealloc(&graph_hash);
+}
+
+static void _test_save_load_sorted()
+{
+  test_status("Testing saving link files with kmers in sorted order");
+
+  dBGraph graph, graph_sorted;
+  _random_links_graph(&graph);
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!_save_tmp_links(&graph, path, ".ctp.gz", true)) {
+    db_graph_dealloc(&graph);
+    return;
+  }
+
+  _load_paths_file(&graph_sorted, path, false, 2);
+  _check_same_paths(&graph, &graph_sorted);
+  _check_same_paths(&graph_sorted, &graph);
+
+  // String order must match BinaryKmer order, for merging sorted files
+  GPathReader rdr;
+  memset(&rdr, 0, sizeof(rdr));
+  gpath_reader_open(&rdr, path);
+  TASSERT(gpath_reader_kmers_sorted(&rdr));
+
+  StrBuf kmer, prev, juncs;
+  SizeBuffer counts;
+  strbuf_alloc(&kmer, 64);
+  strbuf_alloc(&prev, 64);
+  strbuf_alloc(&juncs, 64);
+  size_buf_alloc(&counts, 16);
+  size_t nlinks, njuncs, nkmers = 0;
+  bool fw;
+
+  while(gpath_reader_read_kmer(&rdr, &kmer, &nlinks)) {
+    while(gpath_reader_read_link(&rdr, &fw, &njuncs, &counts, &juncs, NULL, NULL))
+    {}
+    if(nkmers++ > 0) {
+      TASSERT(strcmp(prev.b, kmer.b) < 0);
+      TASSERT(binary_kmer_less_than(binary_kmer_from_str(prev.b, 11),
+                                    binary_kmer_from_str(kmer.b, 11)));
+    }
+    strbuf_set(&prev, kmer.b);
+  }
+  TASSERT(nkmers == graph.gpstore.num_kmers_with_paths);
+
+  gpath_reader_close(&rdr);
+  strbuf_dealloc(&kmer);
+  strbuf_dealloc(&prev);
+  strbuf_dealloc(&juncs);
+  size_buf_dealloc(&counts);
+
+  unlink(path);
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&graph_sorted);
+}
+
+// Paths store offsets to their sequence and next path, check these survive
+// the set being resized
+static void _test_gpath_set_resize()
+{
+  test_status("Testing GPathSet resizing with path offsets");
+
+  TASSERT(sizeof(GPath) == 12);
+
+  #define NTEST_PATHS 2000
+  #define NTEST_LISTS 7
+  const size_t ncols = 3;
+  GPathSet gpset;
+  GPath *gpath;
+  pkey_t heads[NTEST_LISTS];
+  uint8_t seq[16], colset[1];
+  size_t i, j, n, count = 0;
+
+  gpath_set_alloc(&gpset, ncols, 256, true, true);
+  for(j = 0; j < NTEST_LISTS; j++) heads[j] = SIZE_MAX;
+
+  for(i = 0; i < NTEST_PATHS; i++) {
+    memset(seq, (int)i, sizeof(seq));
+    colset[0] = i % 8;
+    GPathNew newgp = {.seq = seq, .colset = colset, .nseen = NULL,
+                      .num_juncs = 1 + i % 64, .orient = i & 1};
+    gpath = gpath_set_add_mt(&gpset, newgp);
+    j = heads[i % NTEST_LISTS];
+    gpath_set_next(gpath, j == SIZE_MAX ? NULL : &gpset.entries.b[j]);
+    heads[i % NTEST_LISTS] = gpset_get_pkey(&gpset, gpath);
+  }
+
+  TASSERT(gpset.entries.len == NTEST_PATHS);
+
+  for(j = 0; j < NTEST_LISTS; j++) {
+    // Lists are in reverse order of adding
+    n = NTEST_PATHS - 1 - (NTEST_PATHS - 1 - j) % NTEST_LISTS;
+    gpath = &gpset.entries.b[heads[j]];
+    for(; gpath != NULL; gpath = gpath_next(gpath)) {
+      i = gpset_get_pkey(&gpset, gpath);
+      TASSERT2(i == n, "%zu vs %zu", i, n);
+      TASSERT(gpath->num_juncs == 1 + i % 64);
+      TASSERT(gpath->orient == (i & 1));
+      TASSERT(*gpath_seq(gpath) == (uint8_t)i);
+      TASSERT(*gpath_get_colset(gpath, ncols) == i % 8);
+      n -= NTEST_LISTS;
+      count++;
+    }
+  }
+
+  TASSERT(count == NTEST_PATHS);
+  gpath_set_dealloc(&gpset);
+  #undef NTEST_PATHS
+  #undef NTEST_LISTS
+}
+
+static bool _gpath_is_prefix_test(const GPath *a, const GPath *b)
+{
+  return a->orient == b->orient && a->num_juncs <= b->num_juncs &&
+         binary_seqs_cmp(gpath_seq(a), a->num_juncs,
+                         gpath_seq(b), a->num_juncs) == 0;
+}
+
+// Short random paths so there are many duplicates and substrings
+static void _test_gpath_subset_sort_rmsubstr()
+{
+  test_status("Testing GPathSubset sorting and substring removal");
+
+  #define NTEST_PATHS 600
+  const size_t ncols = 10;
+  GPathSet gpset;
+  GPathSubset subset;
+  GPath *gpath;
+  uint8_t seq[4], colset[2], colunion[2];
+  size_t i, j, k, n;
+
+  gpath_set_alloc(&gpset, ncols, ONE_MEGABYTE, false, true);
+  gpath_subset_alloc(&subset);
+  gpath_subset_init(&subset, &gpset);
+
+  // Example from gpath_subset.h: {A,C,CG,CGC} -> {A,CGC}
+  const char *ex[4] = {"CGC", "A", "CG", "C"};
+  for(i = 0; i < 4; i++) {
+    binary_seq_from_str(ex[i], strlen(ex[i]), seq);
+    colset[0] = 1; colset[1] = 0;
+    GPathNew newgp = {.seq = seq, .colset = colset, .nseen = NULL,
+                      .num_juncs = strlen(ex[i]), .orient = FORWARD};
+    gpath_subset_add(&subset, gpath_set_add_mt(&gpset, newgp));
+  }
+  gpath_subset_rmsubstr(&subset);
+  TASSERT2(subset.list.len == 2, "%zu", subset.list.len);
+  TASSERT(subset.list.b[0]->num_juncs == 1);
+  TASSERT(subset.list.b[1]->num_juncs == 3);
+
+  gpath_set_reset(&gpset);
+  gpath_subset_init(&subset, &gpset);
+
+  for(i = 0; i < NTEST_PATHS; i++) {
+    for(j = 0; j < sizeof(seq); j++) seq[j] = rand() & 0xff;
+    colset[0] = rand() & 0xff; colset[1] = rand() & 0x3;
+    if(!colset[0] && !colset[1]) colset[0] = 1;
+    GPathNew newgp = {.seq = seq, .colset = colset, .nseen = NULL,
+                      .num_juncs = 1 + rand() % 6, .orient = rand() & 1};
+    gpath_subset_add(&subset, gpath_set_add_mt(&gpset, newgp));
+  }
+
+  // Sort matches gpath_cmp() and keeps all paths
+  gpath_subset_sort(&subset);
+  TASSERT(subset.list.len == NTEST_PATHS);
+  for(i = 0; i+1 < subset.list.len; i++)
+    TASSERT(gpath_cmp(subset.list.b[i], subset.list.b[i+1]) <= 0);
+
+  gpath_subset_rmdup(&subset);
+  n = subset.list.len;
+  for(i = 0; i+1 < n; i++)
+    TASSERT(gpath_cmp(subset.list.b[i], subset.list.b[i+1]) < 0);
+
+  // Union of colours of all paths before removing substrings
+  memset(colunion, 0, sizeof(colunion));
+  for(i = 0; i < n; i++) {
+    gpath = subset.list.b[i];
+    for(k = 0; k < sizeof(colset); k++)
+      colunion[k] |= gpath_get_colset(gpath, ncols)[k];
+  }
+
+  gpath_subset_rmsubstr(&subset);
+  TASSERT(subset.list.len <= n);
+
+  // No path shares a colour with a path that extends it
+  for(i = 0; i < subset.list.len; i++) {
+    for(j = 0; j < subset.list.len; j++) {
+      if(i != j && _gpath_is_prefix_test(subset.list.b[i], subset.list.b[j])) {
+        TASSERT(subset.list.b[i]->num_juncs < subset.list.b[j]->num_juncs);
+        for(k = 0; k < sizeof(colset); k++)
+          TASSERT(!(gpath_get_colset(subset.list.b[i], ncols)[k] &
+                    gpath_get_colset(subset.list.b[j], ncols)[k]));
+      }
+    }
+  }
+
+  // No colours lost
+  memset(colset, 0, sizeof(colset));
+  for(i = 0; i < subset.list.len; i++) {
+    gpath = subset.list.b[i];
+    for(k = 0; k < sizeof(colset); k++)
+      colset[k] |= gpath_get_colset(gpath, ncols)[k];
+  }
+  TASSERT(memcmp(colset, colunion, sizeof(colset)) == 0);
+
+  gpath_subset_dealloc(&subset);
+  gpath_set_dealloc(&gpset);
+  #undef NTEST_PATHS
+}
+
+#define NTEST_KMERS 100
+#define NTEST_SEQS 30
+
+static inline GPath* _gphash_add_test_path(GPathHash *gphash, size_t hkey,
+                                           size_t seqid, bool *found)
+{
+  uint8_t seq[4];
+  memset(seq, (int)seqid, sizeof(seq));
+  GPathNew newgp = {.seq = seq, .colset = NULL, .nseen = NULL,
+                    .num_juncs = 16, .orient = FORWARD};
+  return gpath_hash_find_or_insert_mt(gphash, hkey, newgp, found);
+}
+
+// Each thread adds all paths, starting at a different kmer
+static void* _gphash_add_test_paths(void *arg)
+{
+  GPathHash *gphash = (GPathHash*)arg;
+  size_t i, j, start = rand() % NTEST_KMERS;
+  bool found;
+  for(i = 0; i < NTEST_KMERS; i++)
+    for(j = 0; j < NTEST_SEQS; j++)
+      _gphash_add_test_path(gphash, (start+i) % NTEST_KMERS, j, &found);
+  return NULL;
+}
+
+// Entries only store a fingerprint, check paths with the same sequence on
+// different kmers are kept apart, and that paths are found after resizing
+static void _test_gpath_hash_resize()
+{
+  test_status("Testing GPathHash resizing and fingerprint matching");
+
+  GPathStore gpstore;
+  GPathHash gphash;
+  GPath *gpaths[NTEST_KMERS][NTEST_SEQS], *gpath;
+  size_t i, j, r;
+  bool found;
+
+  // Single thread, add everything twice
+  gpath_store_alloc(&gpstore, 1, NTEST_KMERS, 0, ONE_MEGABYTE, false, false);
+  gpath_hash_alloc(&gphash, &gpstore, 256);
+
+  for(r = 0; r < 2; r++) {
+    for(i = 0; i < NTEST_KMERS; i++) {
+      for(j = 0; j < NTEST_SEQS; j++) {
+        gpath = _gphash_add_test_path(&gphash, i, j, &found);
+        TASSERT(found == (r == 1));
+        if(r == 0) gpaths[i][j] = gpath;
+        else TASSERT(gpath == gpaths[i][j]);
+      }
+    }
+  }
+
+  TASSERT(gphash.num_resizes > 0);
+  TASSERT(gphash.num_entries == NTEST_KMERS*NTEST_SEQS);
+  gpath_store_sync_stats(&gpstore);
+  TASSERT(gpstore.num_paths == NTEST_KMERS*NTEST_SEQS);
+
+  gpath_hash_dealloc(&gphash);
+  gpath_store_dealloc(&gpstore);
+
+  // Multiple threads adding the same paths while the table is resized
+  const size_t nthreads = 4;
+  pthread_t threads[nthreads];
+
+  gpath_store_alloc(&gpstore, 1, NTEST_KMERS, 0, ONE_MEGABYTE, false, false);
+  gpath_hash_alloc(&gphash, &gpstore, 256);
+
+  for(i = 0; i < nthreads; i++)
+    pthread_create(&threads[i], NULL, _gphash_add_test_paths, &gphash);
+  for(i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  TASSERT(gphash.num_resizes > 0);
+  TASSERT(gphash.num_entries == NTEST_KMERS*NTEST_SEQS);
+  gpath_store_sync_stats(&gpstore);
+  TASSERT(gpstore.num_paths == NTEST_KMERS*NTEST_SEQS);
+
+  for(i = 0; i < NTEST_KMERS; i++) {
+    for(j = 0; j < NTEST_SEQS; j++) {
+      _gphash_add_test_path(&gphash, i, j, &found);
+      TASSERT(found);
+    }
+  }
+
+  gpath_hash_dealloc(&gphash);
+  gpath_store_dealloc(&gpstore);
+}
+
+#undef NTEST_KMERS
+#undef NTEST_SEQS
+
+// Counts from a sketch are never lower than the true count, and are exact
+// when the sketch is much larger than the number of links
+static void _test_gpath_sketch()
+{
+  test_status("Testing GPathSketch link counting");
+
+  #define NTEST_LINKS 100
+  GPathSketch sketch;
+  uint8_t seq[4], counts[NTEST_LINKS] = {0};
+  size_t i, r, nexact = 0;
+
+  gpath_sketch_alloc(&sketch, 1<<16);
+
+  for(r = 0; r < 3; r++) {
+    for(i = 0; i < NTEST_LINKS; i++) {
+      if(i % 3 < r) continue; // link i is seen i%3+1 times
+      memset(seq, (int)(i/2), sizeof(seq));
+      GPathNew newgp = {.seq = seq, .colset = NULL, .nseen = NULL,
+                        .num_juncs = 16, .orient = i & 1};
+      counts[i] = gpath_sketch_add_mt(&sketch, gpath_sketch_hash(i/2, newgp));
+    }
+  }
+
+  for(i = 0; i < NTEST_LINKS; i++) {
+    TASSERT(counts[i] >= i % 3 + 1);
+    nexact += (counts[i] == i % 3 + 1);
+  }
+  TASSERT(nexact >= NTEST_LINKS - 2);
+
+  // Counters saturate
+  gpath_sketch_reset(&sketch);
+  for(i = 0; i < 300; i++) r = gpath_sketch_add_mt(&sketch, 12345);
+  TASSERT(r == UINT8_MAX);
+
+  gpath_sketch_dealloc(&sketch);
+  #undef NTEST_LINKS
+}
+
+static GPath* _trie_add_test_link(GPathStore *gpstore, hkey_t hkey,
+                                  Orientation orient, const char *juncs,
+                                  size_t col, uint8_t nseen)
+{
+  uint8_t seq[8] = {0}, counts[2] = {0};
+  size_t len = strlen(juncs);
+  counts[col] = nseen;
+  binary_seq_from_str(juncs, len, seq);
+  GPathNew newgp = {.seq = seq, .colset = NULL, .nseen = counts,
+                    .num_juncs = len, .orient = orient};
+  GPath *gpath = gpath_store_add_mt(gpstore, hkey, newgp);
+  gpath_set_colour(gpath, 2, col);
+  return gpath;
+}
+
+static bool _trie_has_str(const GPathTrie *trie, hkey_t hkey,
+                          Orientation orient, const char *juncs, size_t col)
+{
+  uint8_t seq[8] = {0};
+  binary_seq_from_str(juncs, strlen(juncs), seq);
+  return gpath_trie_has(trie, hkey, orient, seq, strlen(juncs), col);
+}
+
+// Links sharing a prefix share trie nodes, and a cursor sees where the links
+// of a colour disagree
+static void _test_gpath_trie()
+{
+  test_status("Testing GPathTrie building and following");
+
+  GPathStore gpstore;
+  GPathTrie trie;
+  gpath_store_alloc(&gpstore, 2, 4, 0, ONE_MEGABYTE, true, false);
+
+  _trie_add_test_link(&gpstore, 0, FORWARD, "ACGTAC", 0, 2);
+  _trie_add_test_link(&gpstore, 0, FORWARD, "ACGTTT", 0, 1);
+  _trie_add_test_link(&gpstore, 0, FORWARD, "ACG",    1, 3);
+  _trie_add_test_link(&gpstore, 0, FORWARD, "ACGTAC", 1, 1);
+  _trie_add_test_link(&gpstore, 0, REVERSE, "TTT",    0, 1);
+  _trie_add_test_link(&gpstore, 2, FORWARD, "G",      1, 4);
+  gpath_store_sync_stats(&gpstore);
+
+  gpath_trie_alloc(&trie, 2, 4, true);
+  gpath_trie_build(&trie, &gpstore);
+  gpath_store_dealloc(&gpstore);
+
+  // 0:fw is ACG (ends colour 1) -> T -> {AC (colours 0,1), TT (colour 0)}
+  // 0:rv is TTT, 2:fw is G. Duplicate link ACGTAC is merged.
+  TASSERT2(trie.num_links == 5, "%zu", (size_t)trie.num_links);
+  TASSERT2(trie.nodes.len == 6, "%zu", trie.nodes.len);
+  TASSERT(gpath_trie_root(&trie, 1, FORWARD) == GPATH_TRIE_NULL);
+  TASSERT(gpath_trie_root(&trie, 2, REVERSE) == GPATH_TRIE_NULL);
+
+  TASSERT(_trie_has_str(&trie, 0, FORWARD, "ACGTAC", 0));
+  TASSERT(_trie_has_str(&trie, 0, FORWARD, "ACGTAC", 1));
+  TASSERT(_trie_has_str(&trie, 0, FORWARD, "ACGTTT", 0));
+  TASSERT(!_trie_has_str(&trie, 0, FORWARD, "ACGTTT", 1));
+  TASSERT(_trie_has_str(&trie, 0, FORWARD, "ACG", 1));
+  TASSERT(!_trie_has_str(&trie, 0, FORWARD, "ACG", 0));
+  TASSERT(!_trie_has_str(&trie, 0, FORWARD, "ACGT", 0));
+  TASSERT(!_trie_has_str(&trie, 0, FORWARD, "TTT", 0));
+  TASSERT(_trie_has_str(&trie, 0, REVERSE, "TTT", 0));
+  TASSERT(_trie_has_str(&trie, 2, FORWARD, "G", 1));
+  TASSERT(!_trie_has_str(&trie, 2, FORWARD, "G", 0));
+
+  // Follow colour 0: links agree on ACGT, then split A/T
+  GPathTrieFollow fpath = gpath_trie_follow_create(&trie, 0, FORWARD, 0);
+  const char *agree = "ACGT";
+  size_t i;
+  for(i = 0; i < 4; i++) {
+    Nucleotide base = dna_char_to_nuc(agree[i]);
+    TASSERT(gpath_trie_follow_choices(&trie, &fpath, 0) == (1 << base));
+    TASSERT(gpath_trie_follow_advance(&trie, &fpath, base, 0));
+    TASSERT(!gpath_trie_follow_ended(&trie, &fpath, 0));
+  }
+  TASSERT(gpath_trie_follow_choices(&trie, &fpath, 0) ==
+          ((1 << dna_char_to_nuc('A')) | (1 << dna_char_to_nuc('T'))));
+  TASSERT(fpath.pos == 4 && fpath.age == 4);
+  TASSERT(gpath_trie_follow_advance(&trie, &fpath, dna_char_to_nuc('A'), 0));
+  TASSERT(!gpath_trie_follow_advance(&trie, &fpath, dna_char_to_nuc('C'), 0));
+  TASSERT(gpath_trie_follow_ended(&trie, &fpath, 0));
+  TASSERT(gpath_trie_follow_ended(&trie, &fpath, 1));
+  const uint8_t *nseen = gpath_trie_term_nseen(&trie, fpath.node);
+  TASSERT(nseen != NULL && nseen[0] == 2 && nseen[1] == 1);
+
+  // Colour 1 does not see links only in colour 0, and ends after ACG
+  fpath = gpath_trie_follow_create(&trie, 0, FORWARD, 1);
+  TASSERT(gpath_trie_follow_advance(&trie, &fpath, dna_char_to_nuc('A'), 1));
+  TASSERT(gpath_trie_follow_advance(&trie, &fpath, dna_char_to_nuc('C'), 1));
+  TASSERT(gpath_trie_follow_advance(&trie, &fpath, dna_char_to_nuc('G'), 1));
+  TASSERT(gpath_trie_follow_ended(&trie, &fpath, 1));
+  TASSERT(gpath_trie_follow_choices(&trie, &fpath, 1) ==
+          (1 << dna_char_to_nuc('T')));
+  TASSERT(gpath_trie_follow_advance(&trie, &fpath, dna_char_to_nuc('T'), 1));
+  TASSERT(!gpath_trie_follow_advance(&trie, &fpath, dna_char_to_nuc('T'), 1));
+  TASSERT(fpath.node == GPATH_TRIE_NULL);
+
+  // No links in colour 0 on kmer 2
+  fpath = gpath_trie_follow_create(&trie, 2, FORWARD, 0);
+  TASSERT(fpath.node == GPATH_TRIE_NULL);
+  TASSERT(gpath_trie_follow_choices(&trie, &fpath, 0) == 0);
+
+  gpath_trie_reset(&trie);
+  TASSERT(trie.nodes.len == 0 && trie.num_links == 0);
+  TASSERT(gpath_trie_root(&trie, 0, FORWARD) == GPATH_TRIE_NULL);
+  gpath_trie_dealloc(&trie);
+}
+
 void test_paths()
 {
+  _test_gpath_set_resize();
+  _test_gpath_subset_sort_rmsubstr();
+  _test_gpath_hash_resize();
+  _test_gpath_sketch();
+  _test_gpath_trie();
   _test_add_paths();
+  _test_save_load_bin();
+  _test_load_bin_colour();
+  _test_save_load_text_mt();
+  _test_save_load_sorted();
 }
@@ -0,0 +1,88 @@
+#include "global.h"
+#include "all_tests.h"
+
+#include "db_graph.h"
+#include "build_graph.h"
+#include "pop_bubbles.h"
+
+// Check graph is a single path through `seq`
+static void check_graph_is_seq(const dBGraph *graph, const char *seq)
+{
+  const size_t kmer_size = graph->kmer_size, nkmers = strlen(seq)-kmer_size+1;
+  Edges edges;
+  dBNode node;
+  size_t i;
+
+  TASSERT2(hash_table_nkmers(&graph->ht) == nkmers,
+           "expected %zu kmers, got %llu", nkmers, hash_table_nkmers(&graph->ht));
+
+  for(i = 0; i < nkmers; i++) {
+    node = db_graph_find_str(graph, seq+i);
+    TASSERT(node.key != HASH_NOT_FOUND);
+    if(node.key == HASH_NOT_FOUND) continue;
+    edges = db_node_get_edges_union(graph, node.key);
+    TASSERT(edges_get_outdegree(edges, node.orient) == (i+1 < nkmers));
+    TASSERT(edges_get_outdegree(edges, rev_orient(node.orient)) == (i > 0));
+  }
+}
+
+static void run_pop_bubbles(dBGraph *graph, size_t nthreads, int max_rounds,
+                            size_t expt_npopped)
+{
+  size_t nbytes = roundup_bits2bytes(graph->ht.capacity);
+  uint8_t *visited = ctx_calloc(nbytes, 1);
+  uint8_t *rmvbits = ctx_calloc(nbytes, 1);
+
+  PopBubblesPrefs prefs = {.max_rmv_covg = 0, .max_rmv_klen = 0,
+                           .max_rmv_kdiff = -1, .max_rounds = max_rounds};
+
+  size_t npopped = pop_bubbles(graph, nthreads, prefs, visited, rmvbits);
+  TASSERT2(npopped == expt_npopped, "expected %zu, popped %zu",
+           expt_npopped, npopped);
+
+  ctx_free(visited);
+  ctx_free(rmvbits);
+}
+
+static void test_pop_snps()
+{
+  dBGraph graph;
+  const size_t kmer_size = 19, ncols = 1, seqlen = 300;
+  size_t nthreads, i;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 2000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  char ref[seqlen+1], alt[seqlen+1];
+  rand_bases(ref, seqlen);
+  ref[seqlen] = '\0';
+
+  // Two SNPs more than k bases apart in the low coverage sequence
+  memcpy(alt, ref, seqlen+1);
+  alt[100] = dna_nuc_to_char(dna_char_to_nuc(alt[100]) ^ 1);
+  alt[200] = dna_nuc_to_char(dna_char_to_nuc(alt[200]) ^ 2);
+
+  for(nthreads = 1; nthreads <= 4; nthreads++) {
+    for(i = 0; i < 3; i++) _tests_add_to_graph(&graph, ref, 0);
+    _tests_add_to_graph(&graph, alt, 0);
+    TASSERT(hash_table_nkmers(&graph.ht) == seqlen-kmer_size+1 + 2*kmer_size);
+
+    run_pop_bubbles(&graph, nthreads, (int)nthreads-1, 2);
+    check_graph_is_seq(&graph, ref);
+    db_graph_healthcheck(&graph);
+
+    // Nothing left to pop
+    run_pop_bubbles(&graph, nthreads, 0, 0);
+    check_graph_is_seq(&graph, ref);
+
+    db_graph_reset(&graph);
+  }
+
+  db_graph_dealloc(&graph);
+}
+
+void test_pop_bubbles()
+{
+  test_status("Testing popping bubbles...");
+  test_pop_snps();
+}
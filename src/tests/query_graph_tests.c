@@ -0,0 +1,99 @@
+#include "global.h"
+#include "all_tests.h"
+#include "query_graph.h"
+#include "db_node.h"
+#include "build_graph.h"
+#include "file_util.h"
+
+#include <unistd.h>
+
+static void _rand_acgt(char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+  seq[len] = '\0';
+}
+
+// Every kmer of the graph should be found with the same edges and coverages,
+// random kmers not in the graph should not be found
+static void _check_query_graph(const QueryGraph *qg, const dBGraph *db_graph)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  size_t i, col, nwrong = 0, nfalse = 0;
+  hkey_t hkey;
+  uint64_t idx;
+  BinaryKmer bkey;
+  char kmer[MAX_KMER_SIZE+1];
+
+  TASSERT(qg->num_kmers == db_graph->ht.num_kmers);
+  TASSERT(qg->kmer_size == db_graph->kmer_size);
+  TASSERT(qg->num_of_cols == ncols);
+
+  for(hkey = 0; hkey < db_graph->ht.capacity; hkey++) {
+    if(!hash_table_assigned(&db_graph->ht, hkey)) continue;
+    idx = query_graph_find(qg, db_node_get_bkey(db_graph, hkey));
+    if(idx == QG_NOT_FOUND) { nwrong++; continue; }
+    for(col = 0; col < ncols; col++) {
+      nwrong += (query_graph_covgs(qg, idx)[col] !=
+                 db_node_get_covg(db_graph, hkey, col));
+      nwrong += (query_graph_edges(qg, idx)[col] !=
+                 db_node_get_edges(db_graph, hkey, col));
+    }
+  }
+  TASSERT2(nwrong == 0, "nwrong: %zu", nwrong);
+
+  for(i = 0; i < 1000; i++) {
+    _rand_acgt(kmer, db_graph->kmer_size);
+    bkey = binary_kmer_from_str(kmer, db_graph->kmer_size);
+    bkey = binary_kmer_get_key(bkey, db_graph->kmer_size);
+    if(hash_table_find(&db_graph->ht, bkey) == HASH_NOT_FOUND)
+      nfalse += (query_graph_find(qg, bkey) != QG_NOT_FOUND);
+  }
+  TASSERT2(nfalse == 0, "nfalse: %zu", nfalse);
+}
+
+void test_query_graph()
+{
+  test_status("Testing query graphs");
+
+  dBGraph graph;
+  size_t i, kmer_size = 19, ncols = 2, nseqs = 200;
+  char seq[301];
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 100000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  for(i = 0; i < nseqs; i++) {
+    _rand_acgt(seq, 300);
+    build_graph_from_str_mt(&graph, i % ncols, seq, 300, false);
+    if(i % 4 == 0) build_graph_from_str_mt(&graph, 1, seq, 300, false);
+  }
+
+  QueryGraph qg, loaded;
+  query_graph_build(&qg, &graph);
+  _check_query_graph(&qg, &graph);
+
+  char path[TEST_TMP_PATH_LEN];
+  if(test_tmp_file(path, "query_graph_test", ".qg")) {
+    TASSERT(!query_graph_is_file(path));
+    test_with_force(query_graph_save(&qg, path));
+    TASSERT(query_graph_is_file(path));
+    query_graph_load(&loaded, path);
+    unlink(path);
+    TASSERT(loaded.mem_len == qg.mem_len);
+    TASSERT(memcmp(loaded.mem, qg.mem, qg.mem_len) == 0);
+    _check_query_graph(&loaded, &graph);
+    query_graph_dealloc(&loaded);
+  }
+
+  query_graph_dealloc(&qg);
+
+  // Empty graph
+  db_graph_reset(&graph);
+  query_graph_build(&qg, &graph);
+  TASSERT(qg.num_kmers == 0 && qg.nlevels == 0);
+  _check_query_graph(&qg, &graph);
+  query_graph_dealloc(&qg);
+
+  db_graph_dealloc(&graph);
+}
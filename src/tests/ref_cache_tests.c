@@ -0,0 +1,53 @@
+#include "global.h"
+#include "all_tests.h"
+
+#include "ref_cache.h"
+#include "file_util.h"
+
+void test_ref_cache()
+{
+  test_status("Testing reference cache files");
+
+  #define NCHROMS 3
+  const char *names[NCHROMS] = {"chr1", "chr2", "chrM"};
+  const char *seqs[NCHROMS] = {"ACGTNNACGTTTGCA", "", "GATTACA"};
+  read_t chroms[NCHROMS];
+  size_t i;
+
+  for(i = 0; i < NCHROMS; i++) {
+    seq_read_alloc(&chroms[i]);
+    strbuf_set(&chroms[i].name, names[i]);
+    seq_read_set(&chroms[i], seqs[i]);
+  }
+
+  char path[TEST_TMP_PATH_LEN];
+  if(!test_tmp_file(path, "ref_cache_test", ".cache")) return;
+
+  TASSERT(!ref_cache_is_file(path));
+
+  FILE *fout;
+  test_with_force(fout = futil_fopen_create(path, "w"));
+  ref_cache_write(chroms, NCHROMS, fout, path);
+  futil_fclose(fout);
+
+  TASSERT(ref_cache_is_file(path));
+
+  RefCache rc;
+  ref_cache_load(&rc, path);
+  TASSERT(rc.nchroms == NCHROMS);
+
+  const read_t *r;
+  for(i = 0; i < NCHROMS; i++) {
+    r = ref_cache_fetch(&rc, names[i]);
+    TASSERT(r == &rc.chroms[i]);
+    TASSERT(strcmp(r->name.b, names[i]) == 0);
+    TASSERT(r->seq.end == strlen(seqs[i]));
+    TASSERT(strcmp(r->seq.b, seqs[i]) == 0);
+  }
+
+  ref_cache_close(&rc);
+  unlink(path);
+
+  for(i = 0; i < NCHROMS; i++) seq_read_dealloc(&chroms[i]);
+  #undef NCHROMS
+}
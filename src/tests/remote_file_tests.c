@@ -0,0 +1,199 @@
+#include "global.h"
+#include "all_tests.h"
+#include "remote_file.h"
+#include "async_file.h"
+
+#include <unistd.h> // close
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// More blocks than the cache holds, so blocks are evicted and fetched again
+#define REMOTE_TEST_BYTES (20*REMOTE_FILE_BLOCKSIZE + 1234)
+#define REMOTE_TEST_CACHE (8*REMOTE_FILE_BLOCKSIZE)
+
+static uint8_t remote_test_byte(size_t i) { return (uint8_t)(i * 13 + i / 257); }
+
+static bool _remote_send(int fd, const char *buf, size_t n)
+{
+  ssize_t r;
+  for(; n > 0; buf += r, n -= r)
+    if((r = send(fd, buf, n, MSG_NOSIGNAL)) <= 0) return false;
+  return true;
+}
+
+// Answer range requests on one keep-alive connection
+static void* _remote_test_conn(void *arg)
+{
+  int fd = (int)(intptr_t)arg;
+  char req[4096] = "", hdr[256], *end, *body = ctx_malloc(REMOTE_FILE_BLOCKSIZE);
+  const char *rng;
+  size_t len = 0, used, n, i, hlen;
+  uint64_t start, last;
+  ssize_t r;
+
+  while(1) {
+    while((end = strstr(req, "\r\n\r\n")) == NULL) {
+      if((r = recv(fd, req+len, sizeof(req)-1-len, 0)) <= 0) goto done;
+      len += r;
+      req[len] = '\0';
+    }
+
+    rng = strstr(req, "Range: bytes=");
+    if(rng == NULL || sscanf(rng+13, "%"SCNu64"-%"SCNu64, &start, &last) != 2)
+      break;
+
+    if(start >= REMOTE_TEST_BYTES) {
+      hlen = sprintf(hdr, "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                          "Content-Range: bytes */%zu\r\n"
+                          "Content-Length: 0\r\n\r\n", (size_t)REMOTE_TEST_BYTES);
+      if(!_remote_send(fd, hdr, hlen)) break;
+    } else {
+      last = MIN2(last, REMOTE_TEST_BYTES-1);
+      n = last - start + 1;
+      if(n > REMOTE_FILE_BLOCKSIZE) break;
+      hlen = sprintf(hdr, "HTTP/1.1 206 Partial Content\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Content-Range: bytes %"PRIu64"-%"PRIu64"/%zu\r\n\r\n",
+                          n, start, last, (size_t)REMOTE_TEST_BYTES);
+      for(i = 0; i < n; i++) body[i] = remote_test_byte(start+i);
+      if(!_remote_send(fd, hdr, hlen) || !_remote_send(fd, body, n)) break;
+    }
+
+    // Drop the request we answered
+    used = end+4 - req;
+    memmove(req, req+used, len-used+1);
+    len -= used;
+  }
+
+  done:
+  close(fd);
+  ctx_free(body);
+  return NULL;
+}
+
+static void* _remote_test_server(void *arg)
+{
+  int lfd = *(int*)arg, fd;
+  pthread_t th;
+  while((fd = accept(lfd, NULL, NULL)) >= 0) {
+    if(pthread_create(&th, NULL, _remote_test_conn, (void*)(intptr_t)fd) != 0)
+      close(fd);
+    else pthread_detach(th);
+  }
+  return NULL;
+}
+
+static bool _remote_check(const uint8_t *buf, size_t n, size_t offset)
+{
+  size_t i;
+  for(i = 0; i < n && buf[i] == remote_test_byte(offset+i); i++) {}
+  return i == n;
+}
+
+static void _test_remote_pread(const char *url)
+{
+  size_t i, n, offsets[] = {0, REMOTE_FILE_BLOCKSIZE-10, 7*REMOTE_FILE_BLOCKSIZE,
+                            REMOTE_TEST_BYTES-100, 3};
+  uint8_t *buf = ctx_malloc(REMOTE_TEST_BYTES);
+
+  RemoteFile *rf = remote_file_open(url);
+  TASSERT(remote_file_size(rf) == REMOTE_TEST_BYTES);
+
+  // Whole file, more than the cache holds
+  n = remote_file_pread(rf, buf, REMOTE_TEST_BYTES+10, 0);
+  TASSERT(n == REMOTE_TEST_BYTES);
+  TASSERT(_remote_check(buf, n, 0));
+
+  // Across block boundaries and off the end
+  for(i = 0; i < sizeof(offsets)/sizeof(offsets[0]); i++) {
+    n = remote_file_pread(rf, buf, 3*REMOTE_FILE_BLOCKSIZE, offsets[i]);
+    TASSERT(n == MIN2(3*REMOTE_FILE_BLOCKSIZE, REMOTE_TEST_BYTES - offsets[i]));
+    TASSERT(_remote_check(buf, n, offsets[i]));
+  }
+  TASSERT(remote_file_pread(rf, buf, 10, REMOTE_TEST_BYTES) == 0);
+
+  // Opening the same URL again shares the file
+  TASSERT(remote_file_open(url) == rf);
+  remote_file_close(rf);
+  remote_file_close(rf);
+  ctx_free(buf);
+}
+
+static void _test_remote_stream(const char *url)
+{
+  uint8_t buf[3000];
+  size_t i, n;
+  bool match = true;
+
+  FILE *fh = async_file_fopen(url, "r");
+
+  // Sequential reads in odd sized chunks
+  for(i = 0; i < REMOTE_TEST_BYTES; i += n) {
+    n = fread(buf, 1, 1 + (i % 2 ? i % 29 : 2999), fh);
+    TASSERT(n > 0);
+    if(n == 0) break;
+    match &= _remote_check(buf, n, i);
+  }
+  TASSERT(match);
+  TASSERT(i == REMOTE_TEST_BYTES);
+  TASSERT(fread(buf, 1, 1, fh) == 0 && feof(fh));
+
+  TASSERT(fseek(fh, 0, SEEK_END) == 0);
+  TASSERT(ftell(fh) == REMOTE_TEST_BYTES);
+  TASSERT(fseek(fh, 5*REMOTE_FILE_BLOCKSIZE-7, SEEK_SET) == 0);
+  TASSERT(fread(buf, 1, sizeof(buf), fh) == sizeof(buf));
+  TASSERT(_remote_check(buf, sizeof(buf), 5*REMOTE_FILE_BLOCKSIZE-7));
+
+  // Descriptor for pread() users
+  int fd = async_file_fileno(fh);
+  TASSERT(fd < -1);
+  TASSERT(remote_file_pread_fd(fd, buf, 100, 12345) == 100);
+  TASSERT(_remote_check(buf, 100, 12345));
+
+  TASSERT(fclose(fh) == 0);
+}
+
+void test_remote_file()
+{
+  test_status("Testing remote files with HTTP range requests...");
+
+  TASSERT(remote_file_is_url("http://localhost/in.ctx"));
+  TASSERT(!remote_file_is_url("in.ctx"));
+
+  // Serve a file on a port picked by the OS
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  pthread_t th;
+  char url[100];
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+
+  if(lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+     listen(lfd, 16) != 0 ||
+     getsockname(lfd, (struct sockaddr*)&addr, &addrlen) != 0) {
+    warn("Cannot listen on localhost, skipping remote file tests");
+    if(lfd >= 0) close(lfd);
+    return;
+  }
+
+  TASSERT(pthread_create(&th, NULL, _remote_test_server, &lfd) == 0);
+  sprintf(url, "http://127.0.0.1:%u/graph.ctx", (unsigned)ntohs(addr.sin_port));
+
+  remote_file_set_cache(REMOTE_TEST_CACHE);
+  remote_file_set_conns(4);
+
+  _test_remote_pread(url);
+  _test_remote_stream(url);
+
+  remote_file_set_cache(0);
+  remote_file_set_conns(0);
+
+  shutdown(lfd, SHUT_RDWR);
+  close(lfd);
+  pthread_join(th, NULL);
+}
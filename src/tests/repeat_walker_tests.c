@@ -31,7 +31,7 @@ static void test_walk(GraphWalker *gwlk, RepeatWalker *rptwlk,
   rpt_walker_fast_clear(rptwlk, nbuf->b, nbuf->len);
 }
 
-static void test_repeat_loop()
+static void test_repeat_loop(bool use_epochs)
 {
   // Construct 1 colour graph with kmer-size=11
   dBGraph graph;
@@ -70,7 +70,8 @@ static void test_repeat_loop()
   GraphWalker gwlk;
   RepeatWalker rptwlk;
   graph_walker_alloc(&gwlk, &graph);
-  rpt_walker_alloc(&rptwlk, graph.ht.capacity, 15); // 2^15 = 32KB
+  if(use_epochs) rpt_walker_alloc_epoch(&rptwlk, 4); // 16 entries, grows
+  else rpt_walker_alloc(&rptwlk, graph.ht.capacity, 15); // 2^15 = 32KB
 
   dBNodeBuffer nbuf;
   db_node_buf_alloc(&nbuf, 1024);
@@ -108,5 +109,6 @@ static void test_repeat_loop()
 void test_repeat_walker()
 {
   test_status("Testing repeat_walker.h");
-  test_repeat_loop();
+  test_repeat_loop(false);
+  test_repeat_loop(true);
 }
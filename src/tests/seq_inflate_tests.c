@@ -0,0 +1,103 @@
+#include "global.h"
+#include "all_tests.h"
+#include "seq_inflate.h"
+
+#include <unistd.h> // unlink
+
+#define SPLIT_NREADS 120
+#define SPLIT_MAX_SPLITS 40
+
+// Write reads to a temporary FASTQ file. Every quality string starts with '@'
+// so that quality lines look like record headers. Returns false on failure.
+static bool _write_split_fastq(char *path, bool interleaved,
+                               char names[][20], char seqs[][101],
+                               char quals[][101])
+{
+  size_t i, j, len;
+  for(i = 0; i < SPLIT_NREADS; i++) {
+    len = 10 + (size_t)rand() % 90;
+    rand_bases(seqs[i], len);
+    seqs[i][len] = '\0';
+    quals[i][0] = '@';
+    for(j = 1; j < len; j++) quals[i][j] = (char)('!' + rand() % 41);
+    quals[i][len] = '\0';
+    if(interleaved) sprintf(names[i], "r%zu/%i", i/2, (int)(i&1)+1);
+    else sprintf(names[i], "r%zu", i);
+  }
+
+  if(!test_tmp_file(path, "seq_split_test", ".fq")) return false;
+  FILE *fh = fopen(path, "w");
+  TASSERT(fh != NULL);
+  if(fh == NULL) { unlink(path); return false; }
+  for(i = 0; i < SPLIT_NREADS; i++)
+    fprintf(fh, "@%s\n%s\n+\n%s\n", names[i], seqs[i], quals[i]);
+  fclose(fh);
+  return true;
+}
+
+// Split into `nsplits` ranges, check each read comes out once and in order
+// and, if interleaved, that ranges only contain whole pairs
+static void _check_split_fastq(const char *path, bool interleaved,
+                               size_t nsplits, char names[][20],
+                               char seqs[][101], char quals[][101])
+{
+  seq_file_t *sf, *files[SPLIT_MAX_SPLITS];
+  read_t r;
+  size_t i, n = 0, nfile;
+
+  TASSERT((sf = seq_open(path)) != NULL);
+  if(sf == NULL) return;
+  TASSERT2(seq_split_file(sf, interleaved, files, nsplits) == nsplits,
+           "Could not split into %zu", nsplits);
+
+  seq_read_alloc(&r);
+  for(i = 0; i < nsplits; i++) {
+    for(nfile = 0; seq_read_primary(files[i], &r) > 0; n++, nfile++) {
+      if(n >= SPLIT_NREADS) { TASSERT(n < SPLIT_NREADS); continue; }
+      TASSERT2(strcmp(r.name.b, names[n]) == 0,
+               "split %zu/%zu: %s vs %s", i, nsplits, r.name.b, names[n]);
+      TASSERT(strcmp(r.seq.b, seqs[n]) == 0);
+      TASSERT(strcmp(r.qual.b, quals[n]) == 0);
+    }
+    if(interleaved) TASSERT2(nfile % 2 == 0, "split %zu/%zu", i, nsplits);
+    seq_close(files[i]);
+  }
+  seq_read_dealloc(&r);
+
+  TASSERT2(n == SPLIT_NREADS, "%zu splits: %zu reads", nsplits, n);
+}
+
+static void _test_split_fastq(bool interleaved)
+{
+  test_status("Testing splitting FASTQ into ranges%s",
+              interleaved ? " (interleaved)" : "");
+
+  char names[SPLIT_NREADS][20], seqs[SPLIT_NREADS][101];
+  char quals[SPLIT_NREADS][101];
+  char path[TEST_TMP_PATH_LEN];
+  seq_file_t *sf, *files[SPLIT_MAX_SPLITS];
+  size_t nsplits;
+
+  if(!_write_split_fastq(path, interleaved, names, seqs, quals)) return;
+
+  // Files smaller than SEQ_SPLIT_MIN_BYTES are not split
+  TASSERT((sf = seq_open(path)) != NULL);
+  if(sf != NULL) {
+    TASSERT(seq_split_file(sf, interleaved, files, 4) == 0);
+    seq_close(sf);
+  }
+
+  // Range boundaries fall at many offsets within records
+  seq_split_set_min_bytes(0);
+  for(nsplits = 2; nsplits <= SPLIT_MAX_SPLITS; nsplits++)
+    _check_split_fastq(path, interleaved, nsplits, names, seqs, quals);
+  seq_split_set_min_bytes(SEQ_SPLIT_MIN_BYTES);
+
+  unlink(path);
+}
+
+void test_seq_inflate()
+{
+  _test_split_fastq(false);
+  _test_split_fastq(true);
+}
@@ -121,9 +121,58 @@ static void test_subgraph_unitigs()
   db_graph_dealloc(&graph);
 }
 
+// Many seeds so that the fringe is split between threads
+static void test_subgraph_threads()
+{
+  dBGraph graph;
+  size_t kmer_size = 31, ncols = 1, seqlen = 5000;
+  size_t nkmers = seqlen-kmer_size+1, dist = 3, step = 10;
+  size_t i, t, nseeds = 0, expt_nkmers = 0;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 4*seqlen,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  uint8_t *mask = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+  char *seq = ctx_malloc(seqlen+1);
+  char **seeds = ctx_malloc(nkmers * sizeof(char*));
+  size_t *seedlens = ctx_malloc(nkmers * sizeof(size_t));
+
+  rand_bases(seq, seqlen);
+  seq[seqlen] = '\0';
+
+  // Seed with every `step`-th kmer, each picks up `dist` kmers either side
+  for(i = 0; i < nkmers; i += step, nseeds++) {
+    seeds[nseeds] = seq+i;
+    seedlens[nseeds] = kmer_size;
+  }
+  for(i = 0; i < nkmers; i++) {
+    expt_nkmers += (i % step <= dist ||
+                    (step - i % step <= dist && i - i % step + step < nkmers));
+  }
+
+  for(t = 1; t <= 4; t++) {
+    _tests_add_to_graph(&graph, seq, 0);
+    TASSERT(hash_table_nkmers(&graph.ht) == nkmers);
+    memset(mask, 0, roundup_bits2bytes(graph.ht.capacity));
+    subgraph_from_seq(&graph, t, dist, false, false,
+                      8*hash_table_nkmers(&graph.ht), mask,
+                      seeds, seedlens, nseeds);
+    TASSERT2(hash_table_nkmers(&graph.ht) == expt_nkmers,
+             "expected %zu kmers, got %llu; threads: %zu",
+             expt_nkmers, hash_table_nkmers(&graph.ht), t);
+  }
+
+  ctx_free(seeds);
+  ctx_free(seedlens);
+  ctx_free(seq);
+  ctx_free(mask);
+  db_graph_dealloc(&graph);
+}
+
 void test_subgraph()
 {
   test_status("Testing subgraph...");
   simple_subgraph_test();
   test_subgraph_unitigs();
+  test_subgraph_threads();
 }
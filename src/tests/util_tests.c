@@ -1,6 +1,9 @@
 #include "global.h"
 #include "all_tests.h"
 #include "util.h"
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
+#include "mpmc_ring.h"
 
 #include <math.h> // NAN, INFINITY
 
@@ -118,6 +121,32 @@ static void test_util_ulong_to_str()
   TASSERT(strlen(ulong_to_str(ULONG_MAX, str))+1 <= ULONGSTRLEN);
 }
 
+static void test_util_uint64_to_dec()
+{
+  test_status("Testing uint64_to_dec()");
+
+  char str[UINT64_DECLEN+1], exp[50];
+  uint64_t nums[] = {0, 1, 9, 10, 99, 100, 101, 1234, 12345, 1000000,
+                     UINT32_MAX, UINT64_MAX};
+  size_t i, j, len;
+
+  for(i = 0; i < sizeof(nums)/sizeof(nums[0]); i++) {
+    len = uint64_to_dec(nums[i], str);
+    str[len] = '\0';
+    sprintf(exp, "%"PRIu64, nums[i]);
+    TASSERT2(strcmp(str, exp) == 0, "Got: %s Exp: %s", str, exp);
+  }
+
+  for(i = 0; i < 1000; i++) {
+    j = (((uint64_t)rand()) << 32) | rand();
+    j >>= rand() % 64;
+    len = uint64_to_dec(j, str);
+    str[len] = '\0';
+    sprintf(exp, "%"PRIu64, (uint64_t)j);
+    TASSERT2(strcmp(str, exp) == 0, "Got: %s Exp: %s", str, exp);
+  }
+}
+
 static void test_util_calc_GCD()
 {
   test_status("Testing get_GCD()");
@@ -145,13 +174,253 @@ static void test_util_calc_N50()
   TASSERT(calc_N50(arr, 10, 55) == 8);
 }
 
+typedef struct {
+  uint8_t *seen;
+  size_t stop_tid; // thread that stops after its first range
+  volatile size_t nranges;
+} RangeTest;
+
+static bool _count_range(size_t start, size_t end, size_t threadid, void *arg)
+{
+  RangeTest *rt = (RangeTest*)arg;
+  size_t i;
+  for(i = start; i < end; i++) (void)__sync_fetch_and_add(&rt->seen[i], 1);
+  __sync_fetch_and_add(&rt->nranges, 1);
+  return threadid == rt->stop_tid;
+}
+
+static void test_util_run_ranges()
+{
+  test_status("Testing util_run_ranges()");
+
+  size_t i, n, nthreads, nchunks;
+  bool all_once;
+  RangeTest rt;
+  rt.seen = ctx_calloc(5000, 1);
+
+  // Every element processed exactly once for any number of threads
+  for(n = 0; n < 5000; n += 997) {
+    for(nthreads = 1; nthreads <= 5; nthreads++) {
+      memset(rt.seen, 0, n);
+      rt.nranges = 0;
+      rt.stop_tid = SIZE_MAX;
+      util_run_ranges(n, 10, nthreads, _count_range, &rt);
+      for(all_once = true, i = 0; i < n; i++) all_once &= (rt.seen[i] == 1);
+      TASSERT(all_once);
+      nchunks = (n+9)/10;
+      TASSERT(nthreads == 1 ? rt.nranges == (n > 0) : rt.nranges == nchunks);
+    }
+  }
+
+  // A thread that stops leaves its work to others to steal
+  n = 4999;
+  memset(rt.seen, 0, n);
+  rt.nranges = 0;
+  rt.stop_tid = 1;
+  util_run_ranges(n, 10, 3, _count_range, &rt);
+  for(all_once = true, i = 0; i < n; i++) all_once &= (rt.seen[i] == 1);
+  TASSERT(all_once);
+
+  ctx_free(rt.seen);
+}
+
+typedef struct
+{
+  CtxBarrier barrier;
+  volatile size_t count;
+  bool all_seen, nested;
+} PoolTest;
+
+// Each thread adds its id, waits for all others, then checks the total
+static void _pool_test_thread(void *arg, size_t threadid)
+{
+  PoolTest *pt = (PoolTest*)arg;
+  size_t n = pt->barrier.nthreads;
+  __sync_fetch_and_add(&pt->count, threadid+1);
+  ctx_barrier_wait(&pt->barrier);
+  if(pt->count != n*(n+1)/2) pt->all_seen = false;
+  ctx_barrier_wait(&pt->barrier);
+
+  // Start a parallel phase from inside a worker
+  if(pt->nested && threadid == 1) {
+    PoolTest inner = {.count = 0, .all_seen = true, .nested = false};
+    ctx_barrier_init(&inner.barrier, 3);
+    util_multi_thread(&inner, 3, _pool_test_thread);
+    ctx_barrier_destroy(&inner.barrier);
+    if(!inner.all_seen) pt->all_seen = false;
+  }
+}
+
+static void test_util_thread_pool()
+{
+  test_status("Testing thread pool");
+
+  size_t i, nthreads, nworkers;
+  PoolTest pt;
+
+  // All threads of a run are running at the same time
+  for(nthreads = 1; nthreads <= 8; nthreads++) {
+    for(i = 0; i < 10; i++) {
+      pt.count = 0; pt.all_seen = true; pt.nested = (i & 1);
+      ctx_barrier_init(&pt.barrier, nthreads);
+      util_multi_thread(&pt, nthreads, _pool_test_thread);
+      ctx_barrier_destroy(&pt.barrier);
+      TASSERT(pt.all_seen);
+    }
+  }
+
+  // Workers are reused between runs
+  nworkers = thread_pool_num_workers();
+  for(i = 0; i < 100; i++) {
+    pt.count = 0; pt.all_seen = true; pt.nested = false;
+    ctx_barrier_init(&pt.barrier, 8);
+    util_multi_thread(&pt, 8, _pool_test_thread);
+    ctx_barrier_destroy(&pt.barrier);
+  }
+  TASSERT(thread_pool_num_workers() == nworkers);
+}
+
+typedef struct
+{
+  MpmcRing ring;
+  size_t nproducers, nitems;
+  volatile size_t producing, sum;
+} RingTest;
+
+// First half of threads push 1..nitems, second half pop and sum
+static void _ring_test_thread(void *arg, size_t threadid)
+{
+  RingTest *rt = (RingTest*)arg;
+  size_t i, n, sum = 0;
+  void *ptrs[8];
+
+  if(threadid < rt->nproducers) {
+    for(i = 1; i <= rt->nitems; i++) {
+      void *ptr = (void*)i;
+      mpmc_ring_push(&rt->ring, ptr);
+    }
+    if(__sync_sub_and_fetch(&rt->producing, 1) == 0)
+      mpmc_ring_close(&rt->ring);
+  }
+  else {
+    while((n = mpmc_ring_pop_batch(&rt->ring, ptrs, 8)) > 0)
+      for(i = 0; i < n; i++) sum += (size_t)ptrs[i];
+    __sync_fetch_and_add(&rt->sum, sum);
+  }
+}
+
+static void test_mpmc_ring()
+{
+  test_status("Testing lock-free MPMC ring");
+
+  MpmcRing ring;
+  void *ptrs[40], *out[40];
+  size_t i;
+  for(i = 0; i < 40; i++) ptrs[i] = (void*)(i+1);
+
+  mpmc_ring_alloc(&ring, 30);
+  TASSERT(mpmc_ring_capacity(&ring) == 32);
+  TASSERT(mpmc_ring_try_pop_batch(&ring, out, 40) == 0);
+
+  // Fill, check full, then empty in FIFO order
+  TASSERT(mpmc_ring_try_push_batch(&ring, ptrs, 20) == 20);
+  TASSERT(mpmc_ring_try_push_batch(&ring, ptrs+20, 20) == 12);
+  TASSERT(mpmc_ring_len(&ring) == 32);
+  TASSERT(!mpmc_ring_try_push(&ring, ptrs[0]));
+  TASSERT(mpmc_ring_try_pop_batch(&ring, out, 5) == 5);
+  TASSERT(mpmc_ring_try_pop_batch(&ring, out+5, 40) == 27);
+  for(i = 0; i < 32 && out[i] == ptrs[i]; i++) {}
+  TASSERT(i == 32);
+
+  // Wraps around
+  for(i = 0; i < 100; i++) {
+    void *ptr = NULL;
+    TASSERT(mpmc_ring_try_push(&ring, ptrs[i%40]));
+    TASSERT(mpmc_ring_try_pop(&ring, &ptr) && ptr == ptrs[i%40]);
+  }
+
+  // Closed ring still returns what is left
+  mpmc_ring_push_batch(&ring, ptrs, 3);
+  mpmc_ring_close(&ring);
+  TASSERT(mpmc_ring_pop_batch(&ring, out, 40) == 3);
+  TASSERT(mpmc_ring_pop_batch(&ring, out, 40) == 0);
+  mpmc_ring_dealloc(&ring);
+
+  // Multiple producers and consumers through a small ring
+  RingTest rt = {.nproducers = 4, .nitems = 10000, .producing = 4, .sum = 0};
+  mpmc_ring_alloc(&rt.ring, 16);
+  util_multi_thread(&rt, 8, _ring_test_thread);
+  TASSERT(rt.sum == rt.nproducers * rt.nitems * (rt.nitems+1) / 2);
+  mpmc_ring_dealloc(&rt.ring);
+}
+
+static void test_util_popcount_and()
+{
+  uint64_t a[100], b[100], expect;
+  size_t i, n;
+  CpuSimd lvl, max = cpu_simd_supported();
+
+  for(i = 0; i < 100; i++) {
+    a[i] = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ (uint64_t)rand();
+    b[i] = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ (uint64_t)rand();
+  }
+
+  // Test each SIMD version this CPU supports
+  for(lvl = CPU_SIMD_NONE; lvl <= max; lvl++) {
+    cpu_simd_set(lvl);
+    test_status("Testing popcount_and() [simd=%s]", popcount_and_simd_str());
+    for(n = 0; n <= 100; n++) {
+      for(expect = 0, i = 0; i < n; i++)
+        expect += (uint64_t)__builtin_popcountll(a[i] & b[i]);
+      TASSERT(popcount_and(a, b, n) == expect);
+    }
+  }
+}
+
+static void test_alloc_tags()
+{
+  test_status("Testing memory accounting by tag");
+
+  TASSERT(alloc_tag_of_file("src/paths/gpath_hash.c") == ALLOC_TAG_LINK_HASH);
+  TASSERT(alloc_tag_of_file("src/paths/gpath_store.c") == ALLOC_TAG_LINK_STORE);
+  TASSERT(alloc_tag_of_file("src/paths/gpath_follow.c") == ALLOC_TAG_WALKERS);
+  TASSERT(alloc_tag_of_file("src/graph/hash_table.c") == ALLOC_TAG_GRAPH);
+  TASSERT(alloc_tag_of_file("src/graph/repeat_walker.h") == ALLOC_TAG_WALKERS);
+  TASSERT(alloc_tag_of_file("src/basic/seq_reader.c") == ALLOC_TAG_READS);
+  TASSERT(alloc_tag_of_file("util_tests.c") == ALLOC_TAG_OTHER);
+
+  // Memory allocated here is tagged 'other', tests are single threaded
+  size_t mem = alloc_get_tag_mem(ALLOC_TAG_OTHER);
+  char *ptr = ctx_malloc(1000);
+  TASSERT(alloc_get_tag_mem(ALLOC_TAG_OTHER) == mem + 1000);
+  TASSERT(alloc_get_tag_peak(ALLOC_TAG_OTHER) >= mem + 1000);
+  ptr = ctx_realloc(ptr, 3000);
+  TASSERT(alloc_get_tag_mem(ALLOC_TAG_OTHER) == mem + 3000);
+  ptr = ctx_recallocarray(ptr, 3000, 100, 1);
+  TASSERT(alloc_get_tag_mem(ALLOC_TAG_OTHER) == mem + 100);
+  ctx_free(ptr);
+  TASSERT(alloc_get_tag_mem(ALLOC_TAG_OTHER) == mem);
+  TASSERT(alloc_get_tag_peak(ALLOC_TAG_OTHER) >= mem + 3000);
+
+  ptr = ctx_calloc_large(1, 4096);
+  TASSERT(alloc_get_tag_mem(ALLOC_TAG_OTHER) >= mem + 4096);
+  ctx_free_large(ptr);
+  TASSERT(alloc_get_tag_mem(ALLOC_TAG_OTHER) == mem);
+}
+
 void test_util()
 {
+  test_alloc_tags();
+  test_util_thread_pool();
+  test_mpmc_ring();
+  test_util_run_ranges();
   test_util_rev_nibble_lookup();
   test_util_ulong_to_str();
+  test_util_uint64_to_dec();
   test_util_num_to_str();
   test_util_bytes_to_str();
   test_util_calc_GCD();
   test_util_calc_N50();
   test_strnstr();
+  test_util_popcount_and();
 }
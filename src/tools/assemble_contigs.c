@@ -11,6 +11,16 @@
 #include "gpath_set.h"
 #include "gpath_subset.h"
 
+// Contig printed to a per-thread buffer, to be sorted before output
+typedef struct
+{
+  BinaryKmer seed;
+  size_t offset, len; // position in Assembler.text
+  const char *str; // set once all contigs are assembled
+} SortedContig;
+
+madcrow_buffer(sorted_contig_buf, SortedContigBuffer, SortedContig);
+
 typedef struct
 {
   size_t nthreads;
@@ -34,11 +44,47 @@ typedef struct
   size_t colour;
   const ContigConfidenceTable *conf_table;
 
+  // Claim mode: claims[unitigid] is the seed hkey+1 of the contig that owns it
+  const UnitigIndex *uidx;
+  volatile uint64_t *claims;
+
   // Output
   FILE *fout;
   pthread_mutex_t *outlock;
+  StrBuf text;
+
+  // Sorted output: contigs are kept in `text` and written at the end in order
+  // of seed kmer, so runs that produce the same contigs give the same ids
+  bool sort_contigs;
+  SortedContigBuffer sorted;
+
+  // Limits on a contig (0 for none): kmers in total and time to stop walking
+  size_t max_nodes;
+  uint64_t deadline_ns;
 } Assembler;
 
+// Check the time every this many kmers
+#define ASSEM_TIME_CHECK 256
+
+static inline bool _hit_limit(const Assembler *assem, size_t nkmers)
+{
+  return (assem->max_nodes && nkmers >= assem->max_nodes) ||
+         (assem->deadline_ns && nkmers % ASSEM_TIME_CHECK == 0 &&
+          ctx_stats_now_ns() >= assem->deadline_ns);
+}
+
+// Claim the unitig containing `hkey` for the contig seeded from `seed`
+// Returns false if the unitig is owned by another contig
+static inline bool _claim_unitig(Assembler *assem, hkey_t hkey, hkey_t seed)
+{
+  size_t uid = unitig_index_id(assem->uidx, hkey);
+  ctx_assert(uid != UNITIG_INDEX_NONE);
+  uint64_t owner = assem->claims[uid], token = (uint64_t)seed + 1;
+  if(owner == token) return true;
+  return owner == 0 &&
+         __sync_bool_compare_and_swap(&assem->claims[uid], 0, token);
+}
+
 static void contig_stats_init(struct ContigStats *stats)
 {
   memset(stats, 0, sizeof(struct ContigStats));
@@ -92,9 +138,12 @@ static void _assemble_contig(Assembler *assem, hkey_t hkey, const GPath *gpath,
 
     size_t init_junc_count = wlk->fork_count;
     bool hit_cycle = false, low_step_confid = false, low_cumul_confid = false;
+    bool hit_claimed = false, hit_limit = false;
 
     while(graph_walker_next(wlk))
     {
+      if(_hit_limit(assem, nbuf->len)) { hit_limit = true; break; }
+
       db_node_buf_add(nbuf, wlk->node);
 
       // Do some stats
@@ -106,8 +155,9 @@ static void _assemble_contig(Assembler *assem, hkey_t hkey, const GPath *gpath,
         // Junction resolved using paths
         ctx_assert(step.path_gap > 0);
         size_t gap_length = step.path_gap + db_graph->kmer_size-1 + 2;
-        double confid = conf_table_lookup(assem->conf_table, assem->colour,
-                                          gap_length);
+        double confid = assem->conf_table == NULL ? 1.0
+                        : conf_table_lookup(assem->conf_table, assem->colour,
+                                            gap_length);
 
         s.max_step_gap[dir] = MAX2(s.max_step_gap[dir], gap_length);
         s.gap_conf[dir] *= confid;
@@ -117,6 +167,12 @@ static void _assemble_contig(Assembler *assem, hkey_t hkey, const GPath *gpath,
       }
 
       if(!rpt_walker_attempt_traverse(rptwlk, wlk)) { hit_cycle = true; break; }
+
+      // Stop on the first kmer of a unitig that another contig owns
+      if(assem->claims != NULL && gpath == NULL &&
+         !_claim_unitig(assem, wlk->node.key, hkey)) {
+        hit_claimed = true; break;
+      }
     }
 
     // Grab some stats
@@ -129,7 +185,8 @@ static void _assemble_contig(Assembler *assem, hkey_t hkey, const GPath *gpath,
     // Get failed status
     step = wlk->last_step;
     s.stop_causes[dir] = graphstep2assem(step.status, hit_cycle,
-                                         low_step_confid, low_cumul_confid);
+                                         low_step_confid, low_cumul_confid,
+                                         hit_claimed, hit_limit);
 
     graph_walker_finish(wlk);
     rpt_walker_fast_clear(rptwlk, nbuf->b, nbuf->len);
@@ -152,53 +209,74 @@ static void _assemble_contig(Assembler *assem, hkey_t hkey, const GPath *gpath,
   memcpy(results, &s, sizeof(struct ContigStats));
 }
 
+// Print contig in FASTA format with additional info in name, without the
+// leading ">contig<id>"
+static void _contig_sbuf(const Assembler *assem, const struct ContigStats *s,
+                         BinaryKmer seed_bkmer, StrBuf *sbuf)
+{
+  const dBGraph *db_graph = assem->db_graph;
+  const dBNodeBuffer *nbuf = &assem->nbuf;
+  char kmer_str[MAX_KMER_SIZE+1];
+  const char *left_stat, *rght_stat;
+  binary_kmer_to_str(seed_bkmer, db_graph->kmer_size, kmer_str);
+  dna_revcomp_str(kmer_str, kmer_str, db_graph->kmer_size);
+
+  // We have reversed the contig, so left end is now the end we hit when
+  // traversing from the seed node forward... FORWARD == 0, REVERSE == 1
+  left_stat = assem2str(s->stop_causes[0]);
+  rght_stat = assem2str(s->stop_causes[1]);
+
+  strbuf_sprintf(sbuf, " len=%zu seed=%s seedkmers=%zu "
+                 "lf.status=%s lf.paths.held=%zu lf.paths.cntr=%zu "
+                 "lf.max_gap=%zu lf.conf=%f "
+                 "rt.status=%s rt.paths.held=%zu rt.paths.cntr=%zu "
+                 "rf.max_gap=%zu rf.conf=%f\n",
+                 nbuf->len, kmer_str, s->num_seed_kmers,
+                 left_stat, s->paths_held[0], s->paths_cntr[0], s->max_step_gap[0], s->gap_conf[0],
+                 rght_stat, s->paths_held[1], s->paths_cntr[1], s->max_step_gap[1], s->gap_conf[1]);
+
+  db_nodes_sbuf(nbuf->b, nbuf->len, db_graph, sbuf);
+  strbuf_append_char(sbuf, '\n');
+}
+
 // returns 0 on success, 1 otherwise
 static int _dump_contig(Assembler *assem, hkey_t hkey,
                         const struct ContigStats *s)
 {
   AssembleContigStats *stats = &assem->stats;
-  const dBGraph *db_graph = assem->db_graph;
-  dBNodeBuffer *nbuf = &assem->nbuf;
+  StrBuf *sbuf = &assem->text;
   size_t contig_id;
 
-  if(assem->fout != NULL)
+  if(assem->fout != NULL && !assem->sort_contigs)
   {
-    // Print contig
-    char kmer_str[MAX_KMER_SIZE+1];
-    const char *left_stat, *rght_stat;
-    BinaryKmer seed_bkmer = db_node_get_bkey(db_graph, hkey);
-    binary_kmer_to_str(seed_bkmer, db_graph->kmer_size, kmer_str);
-    dna_revcomp_str(kmer_str, kmer_str, db_graph->kmer_size);
-
-    // We have reversed the contig, so left end is now the end we hit when
-    // traversing from the seed node forward... FORWARD == 0, REVERSE == 1
-    left_stat = assem2str(s->stop_causes[0]);
-    rght_stat = assem2str(s->stop_causes[1]);
+    strbuf_reset(sbuf);
+    _contig_sbuf(assem, s, db_node_get_bkey(assem->db_graph, hkey), sbuf);
 
     pthread_mutex_lock(assem->outlock);
     contig_id = assem->num_contig_ptr[0]++;
 
-    if(!assem->contig_limit || contig_id < assem->contig_limit)
-    {
-      // Print in FASTA format with additional info in name
-      fprintf(assem->fout, ">contig%zu len=%zu seed=%s seedkmers=%zu "
-              "lf.status=%s lf.paths.held=%zu lf.paths.cntr=%zu "
-              "lf.max_gap=%zu lf.conf=%f "
-              "rt.status=%s rt.paths.held=%zu rt.paths.cntr=%zu "
-              "rf.max_gap=%zu rf.conf=%f\n",
-              contig_id, nbuf->len, kmer_str, s->num_seed_kmers,
-              left_stat, s->paths_held[0], s->paths_cntr[0], s->max_step_gap[0], s->gap_conf[0],
-              rght_stat, s->paths_held[1], s->paths_cntr[1], s->max_step_gap[1], s->gap_conf[1]);
-
-      db_nodes_print(nbuf->b, nbuf->len, db_graph, assem->fout);
-      putc('\n', assem->fout);
+    if(!assem->contig_limit || contig_id < assem->contig_limit) {
+      fprintf(assem->fout, ">contig%zu", contig_id);
+      fwrite(sbuf->b, 1, sbuf->end, assem->fout);
     }
 
     pthread_mutex_unlock(assem->outlock);
   }
-  else {
+  else
+  {
     // Lockless update
     contig_id = __sync_fetch_and_add(assem->num_contig_ptr, 1);
+
+    // Keep contig in this thread's buffer, id is assigned once sorted
+    if(assem->fout != NULL &&
+       (!assem->contig_limit || contig_id < assem->contig_limit))
+    {
+      SortedContig sc = {.seed = db_node_get_bkey(assem->db_graph, hkey),
+                         .offset = sbuf->end};
+      _contig_sbuf(assem, s, sc.seed, sbuf);
+      sc.len = sbuf->end - sc.offset;
+      sorted_contig_buf_add(&assem->sorted, sc);
+    }
   }
 
   // Generated too many contigs - drop this one without printing or
@@ -226,18 +304,42 @@ static int _pulldown_contig(hkey_t hkey, Assembler *assem)
     return 0;
   }
 
+  // Seed from the first kmer of the unitig, so the contig does not depend on
+  // which of its kmers we reached first. Skip unitigs claimed by another contig
+  if(assem->claims != NULL) {
+    size_t uid = unitig_index_id(assem->uidx, hkey);
+    hkey_t first = assem->uidx->unitigs[uid].first.key;
+    if(db_node_has_col(assem->db_graph, first, assem->colour)) hkey = first;
+    if(!__sync_bool_compare_and_swap(&assem->claims[uid], 0, (uint64_t)hkey+1)) {
+      assem->stats.num_reseed_abort++;
+      return 0;
+    }
+  }
+
   _assemble_contig(assem, hkey, NULL, &s);
 
   return _dump_contig(assem, hkey, &s);
 }
 
-static inline void _seed_rnd_kmers(void *arg, size_t threadid)
+// Each thread takes seeds in hkey order, so with --prefetch the links of the
+// seeds ahead are fetched in stages, ASSEM_SEED_PREFETCH seeds apart
+#define ASSEM_SEED_PREFETCH 4
+
+static inline void _prefetch_seed_links(const dBGraph *db_graph, hkey_t hkey)
 {
-  Assembler *assem = (Assembler*)arg;
-  const dBGraph *db_graph = assem->db_graph;
+  if(db_graph->prefetch_walks) {
+    db_graph_prefetch_links(db_graph, hkey + 3*ASSEM_SEED_PREFETCH, 0);
+    db_graph_prefetch_links(db_graph, hkey + 2*ASSEM_SEED_PREFETCH, 1);
+    db_graph_prefetch_links(db_graph, hkey +   ASSEM_SEED_PREFETCH, 2);
+  }
+}
 
-  HASH_ITERATE_PART(&db_graph->ht, threadid, assem->nthreads,
-                    _pulldown_contig, assem);
+// `arg` is the array of assemblers, one per thread
+static bool _seed_rnd_kmer(hkey_t hkey, size_t threadid, void *arg)
+{
+  Assembler *workers = (Assembler*)arg;
+  _prefetch_seed_links(workers[threadid].db_graph, hkey);
+  return _pulldown_contig(hkey, &workers[threadid]);
 }
 
 static void _seed_from_file(AsyncIOData *data, size_t threadid, void *arg)
@@ -282,7 +384,7 @@ static int _assemble_from_paths(hkey_t hkey, Assembler *assem)
 
   gpath_set_reset(gpset);
 
-  for(; gpath != NULL; gpath = gpath->next)
+  for(; gpath != NULL; gpath = gpath_next(gpath))
   {
     pathid = gpset_get_pkey(&gpstore->gpset, gpath);
 
@@ -308,22 +410,71 @@ static int _assemble_from_paths(hkey_t hkey, Assembler *assem)
   return 0; // 0 => keep iterating
 }
 
-static void assemble_from_paths(void *arg, size_t threadid)
+// `arg` is the array of assemblers, one per thread
+static bool _seed_path_kmer(hkey_t hkey, size_t threadid, void *arg)
 {
-  Assembler *assem = (Assembler*)arg;
-  const dBGraph *db_graph = assem->db_graph;
+  Assembler *workers = (Assembler*)arg;
+  _prefetch_seed_links(workers[threadid].db_graph, hkey);
+  return _assemble_from_paths(hkey, &workers[threadid]);
+}
 
+// Our own qsort comparison function. `a` and `b` point to SortedContig*
+// Order by seed kmer then by contig text
+static int _sorted_contig_cmp(const void *a, const void *b)
+{
+  const SortedContig *x = *(const SortedContig*const*)a;
+  const SortedContig *y = *(const SortedContig*const*)b;
+  int c = binary_kmer_cmp(x->seed, y->seed);
+  if(c != 0) return c;
+  c = memcmp(x->str, y->str, MIN2(x->len, y->len));
+  return c != 0 ? c : cmp(x->len, y->len);
+}
+
+// Number contigs in sorted order and print
+static void _print_sorted_contigs(const Assembler *workers, size_t nthreads,
+                                  FILE *fout)
+{
+  size_t i, j, n = 0;
+  for(i = 0; i < nthreads; i++) n += workers[i].sorted.len;
+
+  SortedContig **list = ctx_malloc(MAX2(n, 1) * sizeof(SortedContig*));
+
+  for(i = n = 0; i < nthreads; i++) {
+    for(j = 0; j < workers[i].sorted.len; j++) {
+      list[n] = &workers[i].sorted.b[j];
+      list[n]->str = workers[i].text.b + list[n]->offset;
+      n++;
+    }
+  }
+
+  qsort(list, n, sizeof(list[0]), _sorted_contig_cmp);
+
+  for(i = 0; i < n; i++) {
+    fprintf(fout, ">contig%zu", i);
+    fwrite(list[i]->str, 1, list[i]->len, fout);
+  }
+
+  ctx_free(list);
+}
+
+static void assemble_from_paths(Assembler *workers, size_t nthreads,
+                                const dBGraph *db_graph)
+{
   const bool resize = true, keep_path_counts = false;
-  gpath_set_alloc(&assem->gpset, db_graph->gpstore.gpset.ncols,
-                  ONE_MEGABYTE, resize, keep_path_counts);
+  size_t i;
 
-  gpath_subset_alloc(&assem->gpsubset);
+  for(i = 0; i < nthreads; i++) {
+    gpath_set_alloc(&workers[i].gpset, db_graph->gpstore.gpset.ncols,
+                    ONE_MEGABYTE, resize, keep_path_counts);
+    gpath_subset_alloc(&workers[i].gpsubset);
+  }
 
-  HASH_ITERATE_PART(&db_graph->ht, threadid, assem->nthreads,
-                    _assemble_from_paths, assem);
+  hash_table_iterate_steal(&db_graph->ht, nthreads, _seed_path_kmer, workers);
 
-  gpath_set_dealloc(&assem->gpset);
-  gpath_subset_dealloc(&assem->gpsubset);
+  for(i = 0; i < nthreads; i++) {
+    gpath_set_dealloc(&workers[i].gpset);
+    gpath_subset_dealloc(&workers[i].gpsubset);
+  }
 }
 
 /**
@@ -338,6 +489,11 @@ static void assemble_from_paths(void *arg, size_t threadid)
  * @param seed_with_unused_paths If set, mark paths as used once entirely
  *                               contained in a contig. Unused paths are then
  *                               used to seed contigs.
+ * @param uidx If not NULL, threads claim unitigs as they assemble. A contig
+ *             stops on the first kmer of a unitig claimed by another contig
+ *             and kmers in claimed unitigs are not used as seeds.
+ * @param sort_contigs If set, keep contigs in memory and print them at the end
+ *                     numbered in order of seed kmer.
  * @param min_step_confid  Stop traversal if confidence of a single step is
  *                         below the given min. If less than 0 ignore.
  * @param min_cumul_confid Stop traversal if cumulative confidence drops below
@@ -347,6 +503,7 @@ void assemble_contigs(size_t nthreads,
                       seq_file_t **seed_files, size_t num_seed_files,
                       size_t contig_limit, uint8_t *visited,
                       bool use_missing_info_check, bool seed_with_unused_paths,
+                      const UnitigIndex *uidx, bool sort_contigs,
                       double min_step_confid, double min_cumul_confid,
                       FILE *fout, const char *out_path,
                       AssembleContigStats *stats,
@@ -369,10 +526,14 @@ void assemble_contigs(size_t nthreads,
   if(min_cumul_confid > 0 && min_cumul_confid < 1)
     status("[Assemble] Stop traversal if step cummulative confidence < %f", min_cumul_confid);
 
+  if(uidx != NULL)
+    status("[Assemble] Claiming unitigs, %zu unitigs", uidx->num_unitigs);
+
   if(fout == NULL)
     status("[Assemble]   Not printing contigs");
   else
-    status("[Assemble]   Writing contigs to %s", futil_outpath_str(out_path));
+    status("[Assemble]   Writing contigs to %s%s", futil_outpath_str(out_path),
+           sort_contigs ? " [sorted by seed kmer]" : "");
 
   size_t npaths = db_graph->gpstore.num_paths;
   size_t npathwords = (npaths+sizeof(size_t)*8-1)/(sizeof(size_t)*8);
@@ -382,6 +543,9 @@ void assemble_contigs(size_t nthreads,
   Assembler *workers = ctx_calloc(nthreads, sizeof(Assembler));
   size_t i, num_contigs = 0;
 
+  uint64_t *claims = NULL;
+  if(uidx != NULL) claims = ctx_calloc(MAX2(uidx->num_unitigs, 1), sizeof(uint64_t));
+
   pthread_mutex_t outlock;
   if(pthread_mutex_init(&outlock, NULL) != 0) die("Mutex init failed");
 
@@ -396,15 +560,19 @@ void assemble_contigs(size_t nthreads,
                      .db_graph = db_graph, .colour = colour,
                      .conf_table = conf_table,
                      .visited = visited,
-                     .fout = fout, .outlock = &outlock};
+                     .uidx = uidx, .claims = claims,
+                     .fout = fout, .outlock = &outlock,
+                     .sort_contigs = sort_contigs};
 
     db_node_buf_alloc(&tmp.nbuf, 1024);
+    strbuf_alloc(&tmp.text, 1024);
+    sorted_contig_buf_alloc(&tmp.sorted, sort_contigs ? 1024 : 1);
 
     graph_walker_alloc(&tmp.wlk, db_graph);
     graph_walker_setup(&tmp.wlk, use_missing_info_check, colour, colour, db_graph);
     tmp.used_paths = tmp.wlk.used_paths = used_paths;
 
-    rpt_walker_alloc(&tmp.rptwlk, db_graph->ht.capacity, 22); // 4MB
+    rpt_walker_alloc_epoch(&tmp.rptwlk, 12); // grows with contig length
     assemble_contigs_stats_init(&tmp.stats);
 
     memcpy(&workers[i], &tmp, sizeof(Assembler));
@@ -431,8 +599,7 @@ void assemble_contigs(size_t nthreads,
   {
     // Use random kmers as seeds
     status("[Assemble] Seeding with random kmers...");
-    util_run_threads(workers, nthreads, sizeof(workers[0]),
-                     nthreads, _seed_rnd_kmers);
+    hash_table_iterate_steal(&db_graph->ht, nthreads, _seed_rnd_kmer, workers);
 
     if(seed_with_unused_paths && npaths > 0)
     {
@@ -442,16 +609,20 @@ void assemble_contigs(size_t nthreads,
 
       if(i+1 < npathwords || used_paths[npathwords-1] < bitmask64(top_bits)) {
         status("[Assemble] Seeding with unused paths...");
-        util_run_threads(workers, nthreads, sizeof(workers[0]),
-                         nthreads, assemble_from_paths);
+        assemble_from_paths(workers, nthreads, db_graph);
       } else {
         status("[Assemble] No unused paths to seed with");
       }
     }
   }
 
+  if(sort_contigs && fout != NULL)
+    _print_sorted_contigs(workers, nthreads, fout);
+
   for(i = 0; i < nthreads; i++) {
     db_node_buf_dealloc(&workers[i].nbuf);
+    strbuf_dealloc(&workers[i].text);
+    sorted_contig_buf_dealloc(&workers[i].sorted);
     graph_walker_dealloc(&workers[i].wlk);
     rpt_walker_dealloc(&workers[i].rptwlk);
     assemble_contigs_stats_merge(stats, &workers[i].stats);
@@ -461,4 +632,76 @@ void assemble_contigs(size_t nthreads,
   pthread_mutex_destroy(&outlock);
   ctx_free(workers);
   ctx_free(used_paths);
+  ctx_free(claims);
+}
+
+//
+// Assemble single contigs on demand
+//
+
+struct ContigAssembler {
+  Assembler assem;
+  bool use_missing_info_check;
+  size_t num_contigs;
+};
+
+ContigAssembler* contig_assembler_new(bool use_missing_info_check,
+                                      const dBGraph *db_graph)
+{
+  ContigAssembler *ca = ctx_calloc(1, sizeof(ContigAssembler));
+  Assembler *assem = &ca->assem;
+
+  ca->use_missing_info_check = use_missing_info_check;
+  assem->nthreads = 1;
+  assem->num_contig_ptr = &ca->num_contigs;
+  assem->use_missing_info_check = use_missing_info_check;
+  assem->min_step_confid = assem->min_cumul_confid = -1;
+  assem->db_graph = db_graph;
+
+  db_node_buf_alloc(&assem->nbuf, 1024);
+  graph_walker_alloc(&assem->wlk, db_graph);
+  graph_walker_setup(&assem->wlk, use_missing_info_check, 0, 0, db_graph);
+  rpt_walker_alloc_epoch(&assem->rptwlk, 12); // grows with contig length
+  assemble_contigs_stats_init(&assem->stats);
+
+  return ca;
+}
+
+void contig_assembler_destroy(ContigAssembler *ca)
+{
+  Assembler *assem = &ca->assem;
+  db_node_buf_dealloc(&assem->nbuf);
+  graph_walker_dealloc(&assem->wlk);
+  rpt_walker_dealloc(&assem->rptwlk);
+  assemble_contigs_stats_destroy(&assem->stats);
+  ctx_free(ca);
+}
+
+const dBNodeBuffer* contig_assembler_run(ContigAssembler *ca, hkey_t seed,
+                                         size_t colour, size_t max_nodes,
+                                         uint64_t max_ns,
+                                         struct ContigStats *s)
+{
+  Assembler *assem = &ca->assem;
+
+  if(!db_node_has_col(assem->db_graph, seed, colour)) return NULL;
+
+  if(colour != assem->colour) {
+    graph_walker_setup(&assem->wlk, ca->use_missing_info_check,
+                       colour, colour, assem->db_graph);
+    assem->colour = colour;
+  }
+
+  assem->max_nodes = max_nodes;
+  assem->deadline_ns = max_ns ? ctx_stats_now_ns() + max_ns : 0;
+
+  _assemble_contig(assem, seed, NULL, s);
+  assemble_contigs_stats_add(&assem->stats, s);
+
+  return &assem->nbuf;
+}
+
+const AssembleContigStats* contig_assembler_stats(const ContigAssembler *ca)
+{
+  return &ca->assem.stats;
 }
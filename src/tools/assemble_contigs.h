@@ -4,6 +4,7 @@
 #include "db_graph.h"
 #include "contig_confidence.h"
 #include "assemble_stats.h"
+#include "unitig_graph.h"
 
 #include "seq_file/seq_file.h"
 
@@ -19,6 +20,11 @@
  * @param seed_with_unused_paths If set, mark paths as used once entirely
  *                               contained in a contig. Unused paths are then
  *                               used to seed contigs.
+ * @param uidx If not NULL, threads claim unitigs as they assemble. A contig
+ *             stops on the first kmer of a unitig claimed by another contig
+ *             and kmers in claimed unitigs are not used as seeds.
+ * @param sort_contigs If set, keep contigs in memory and print them at the end
+ *                     numbered in order of seed kmer.
  * @param min_step_confid  Stop traversal if confidence of a single step is
  *                         below the given min. If less than 0 ignore.
  * @param min_cumul_confid Stop traversal if cumulative confidence drops below
@@ -28,10 +34,37 @@ void assemble_contigs(size_t nthreads,
                       seq_file_t **seed_files, size_t num_seed_files,
                       size_t contig_limit, uint8_t *visited,
                       bool use_missing_info_check, bool seed_with_unused_paths,
+                      const UnitigIndex *uidx, bool sort_contigs,
                       double min_step_confid, double min_cumul_confid,
                       FILE *fout, const char *out_path,
                       AssembleContigStats *stats,
                       const ContigConfidenceTable *conf_table,
                       const dBGraph *db_graph, size_t colour);
 
+//
+// Assemble single contigs on demand (used by `server`), reusing the graph
+// walkers between contigs. Not thread safe: use one ContigAssembler per thread.
+//
+typedef struct ContigAssembler ContigAssembler;
+
+ContigAssembler* contig_assembler_new(bool use_missing_info_check,
+                                      const dBGraph *db_graph);
+void contig_assembler_destroy(ContigAssembler *ca);
+
+/**
+ * Assemble the contig through `seed`, walking colour `colour`.
+ * Stop causes are set in s->stop_causes; ASSEM_STOP_LIMIT if a limit was hit.
+ * @param max_nodes Stop once the contig has this many kmers (0 for no limit)
+ * @param max_ns    Stop after this many nanoseconds (0 for no limit)
+ * @return kmers of the contig (valid until the next call) or NULL if `seed` is
+ *         not in `colour`
+ */
+const dBNodeBuffer* contig_assembler_run(ContigAssembler *ca, hkey_t seed,
+                                         size_t colour, size_t max_nodes,
+                                         uint64_t max_ns,
+                                         struct ContigStats *s);
+
+// Stats over all contigs assembled
+const AssembleContigStats* contig_assembler_stats(const ContigAssembler *ca);
+
 #endif /* ASSEMBLE_CONTIGS_H_ */
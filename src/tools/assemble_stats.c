@@ -11,7 +11,9 @@ const char *assem_stop_str[] = {ASSEM_STOP_UNKNOWN_STR,
                                 ASSEM_STOP_MISSING_PATHS_STR,
                                 ASSEM_STOP_CYCLE_STR,
                                 ASSEM_STOP_LOW_STEP_CONF_STR,
-                                ASSEM_STOP_LOW_CUMUL_CONF_STR};
+                                ASSEM_STOP_LOW_CUMUL_CONF_STR,
+                                ASSEM_STOP_CLAIMED_STR,
+                                ASSEM_STOP_LIMIT_STR};
 
 const char* assem2str(enum AssemStopCause assem)
 {
@@ -20,16 +22,21 @@ const char* assem2str(enum AssemStopCause assem)
 }
 
 enum AssemStopCause graphstep2assem(enum GraphStepStatus step, bool hit_cycle,
-                                    bool low_step_confid, bool low_cumul_confid)
+                                    bool low_step_confid, bool low_cumul_confid,
+                                    bool hit_claimed, bool hit_limit)
 {
   // There should only be one reason to stop traversal
-  ctx_assert2((!grap_step_status_is_good(step) +
-               !!hit_cycle + !!low_step_confid + !!low_cumul_confid) == 1,
-              "One and only one should be true %i %i %i %i",
+  ctx_assert2((!grap_step_status_is_good(step) + !!hit_cycle +
+               !!low_step_confid + !!low_cumul_confid + !!hit_claimed +
+               !!hit_limit) == 1,
+              "One and only one should be true %i %i %i %i %i %i",
               (int)step, (int)hit_cycle,
-              (int)low_step_confid, (int)low_cumul_confid);
+              (int)low_step_confid, (int)low_cumul_confid, (int)hit_claimed,
+              (int)hit_limit);
 
   if(hit_cycle) return ASSEM_STOP_CYCLE;
+  if(hit_claimed) return ASSEM_STOP_CLAIMED;
+  if(hit_limit) return ASSEM_STOP_LIMIT;
   if(low_step_confid) return ASSEM_STOP_LOW_STEP_CONF;
   if(low_cumul_confid) return ASSEM_STOP_LOW_CUMUL_CONF;
 
@@ -48,17 +55,63 @@ void assemble_contigs_stats_init(AssembleContigStats *stats)
   memset(stats, 0, sizeof(*stats));
   // Zero doubles
   stats->max_junc_density = 0.0;
-  size_buf_capacity(&stats->lengths, 1<<20); // ~1 Million
-  size_buf_capacity(&stats->junctns, 1<<20); // ~1 Million
+  size_buf_alloc(&stats->lengths.tail, 256);
+  size_buf_alloc(&stats->junctns.tail, 256);
 }
 
 void assemble_contigs_stats_destroy(AssembleContigStats *stats)
 {
-  size_buf_dealloc(&stats->lengths);
-  size_buf_dealloc(&stats->junctns);
+  size_buf_dealloc(&stats->lengths.tail);
+  size_buf_dealloc(&stats->junctns.tail);
   memset(stats, 0, sizeof(*stats));
 }
 
+static inline void _hist_add(AssembleHist *h, size_t val)
+{
+  if(val < AC_HIST_LEN) h->counts[val]++;
+  else size_buf_add(&h->tail, val);
+}
+
+static void _hist_merge(AssembleHist *dst, const AssembleHist *src)
+{
+  size_t i;
+  for(i = 0; i < AC_HIST_LEN; i++) dst->counts[i] += src->counts[i];
+  size_buf_push(&dst->tail, src->tail.b, src->tail.len);
+}
+
+// Get the value at index `idx` in sorted order. Tail must be sorted.
+static size_t _hist_nth(const AssembleHist *h, size_t idx)
+{
+  size_t i;
+  for(i = 0; i < AC_HIST_LEN; i++) {
+    if(idx < h->counts[i]) return i;
+    idx -= h->counts[i];
+  }
+  ctx_assert(idx < h->tail.len);
+  return h->tail.b[idx];
+}
+
+// Smallest value such that values at least as large sum to half of `total`
+// (same as calc_N50). Tail must be sorted.
+static size_t _hist_N50(const AssembleHist *h, size_t total)
+{
+  size_t i, sum = 0, half = total/2;
+  if(half == 0) return 0;
+  for(i = h->tail.len; i > 0; i--) {
+    sum += h->tail.b[i-1];
+    if(sum >= half) return h->tail.b[i-1];
+  }
+  for(i = AC_HIST_LEN; i > 0; i--) {
+    sum += h->counts[i-1] * (i-1);
+    if(sum >= half) return i-1;
+  }
+  return 0;
+}
+
+#define _hist_median(h,n) \
+        (!(n) ? 0 : ((n)&1 ? _hist_nth(h,(n)/2) \
+                           : (_hist_nth(h,(n)/2-1)+_hist_nth(h,(n)/2))/2.0))
+
 void assemble_contigs_stats_add(AssembleContigStats *stats,
                                 const struct ContigStats *s)
 {
@@ -82,8 +135,8 @@ void assemble_contigs_stats_add(AssembleContigStats *stats,
   stats->contigs_outdegree[s->outdegree_fw]++;
   stats->contigs_outdegree[s->outdegree_rv]++;
 
-  size_buf_add(&stats->lengths, s->num_nodes);
-  size_buf_add(&stats->junctns, s->num_junc);
+  _hist_add(&stats->lengths, s->num_nodes);
+  _hist_add(&stats->junctns, s->num_junc);
 
   stats->total_len  += s->num_nodes;
   stats->total_junc += s->num_junc;
@@ -104,15 +157,10 @@ void assemble_contigs_stats_add(AssembleContigStats *stats,
 void assemble_contigs_stats_merge(AssembleContigStats *dst,
                                   const AssembleContigStats *src)
 {
-  ctx_assert(dst->lengths.len == dst->junctns.len);
-  ctx_assert(dst->lengths.len == dst->num_contigs);
-  ctx_assert(src->lengths.len == src->junctns.len);
-  ctx_assert(src->lengths.len == src->num_contigs);
-
   size_t i;
 
-  size_buf_push(&dst->lengths, src->lengths.b, src->lengths.len);
-  size_buf_push(&dst->junctns, src->junctns.b, src->junctns.len);
+  _hist_merge(&dst->lengths, &src->lengths);
+  _hist_merge(&dst->junctns, &src->junctns);
 
   dst->num_contigs += src->num_contigs;
   dst->total_len   += src->total_len;
@@ -186,9 +234,6 @@ static inline void _print_path_dist(const uint64_t *hist, size_t n,
 
 void assemble_contigs_stats_print(const AssembleContigStats *s)
 {
-  ctx_assert(s->lengths.len == s->junctns.len);
-  ctx_assert(s->lengths.len == s->num_contigs);
-
   size_t i, ncontigs = s->num_contigs;
 
   if(ncontigs == 0) {
@@ -196,28 +241,29 @@ void assemble_contigs_stats_print(const AssembleContigStats *s)
     return;
   }
 
-  qsort(s->lengths.b, ncontigs, sizeof(s->lengths.b[0]), gca_cmp_size);
-  qsort(s->junctns.b, ncontigs, sizeof(s->junctns.b[0]), gca_cmp_size);
+  const AssembleHist *lens = &s->lengths, *jncs = &s->junctns;
+  qsort(lens->tail.b, lens->tail.len, sizeof(size_t), gca_cmp_size);
+  qsort(jncs->tail.b, jncs->tail.len, sizeof(size_t), gca_cmp_size);
 
   size_t len_n50, jnc_n50;
   size_t len_median, jnc_median, len_mean, jnc_mean;
   size_t len_min, len_max, jnc_min, jnc_max;
 
   // Calculate N50s
-  len_n50 = calc_N50(s->lengths.b, ncontigs, s->total_len);
-  jnc_n50 = calc_N50(s->junctns.b, ncontigs, s->total_junc);
+  len_n50 = _hist_N50(lens, s->total_len);
+  jnc_n50 = _hist_N50(jncs, s->total_junc);
 
   // Calculate medians, means
-  len_median = MEDIAN(s->lengths.b, ncontigs);
-  jnc_median = MEDIAN(s->junctns.b, ncontigs);
+  len_median = _hist_median(lens, ncontigs);
+  jnc_median = _hist_median(jncs, ncontigs);
   len_mean = (double)s->total_len / ncontigs;
   jnc_mean = (double)s->total_junc / ncontigs;
 
   // Calculate min, max
-  len_min = s->lengths.b[0];
-  jnc_min = s->junctns.b[0];
-  len_max = s->lengths.b[ncontigs-1];
-  jnc_max = s->junctns.b[ncontigs-1];
+  len_min = _hist_nth(lens, 0);
+  jnc_min = _hist_nth(jncs, 0);
+  len_max = _hist_nth(lens, ncontigs-1);
+  jnc_max = _hist_nth(jncs, ncontigs-1);
 
   // Print number of contigs
   char num_contigs_str[50], reseed_str[50], seed_not_fnd_str[50];
@@ -290,6 +336,8 @@ void assemble_contigs_stats_print(const AssembleContigStats *s)
   _print_grphwlk_state("Graph cycles ......... ", stops[ASSEM_STOP_CYCLE],         ncontigends);
   _print_grphwlk_state("Low step confidence .. ", stops[ASSEM_STOP_LOW_STEP_CONF], ncontigends);
   _print_grphwlk_state("Low cumul. confidence  ", stops[ASSEM_STOP_LOW_CUMUL_CONF],ncontigends);
+  _print_grphwlk_state("Claimed unitig ....... ", stops[ASSEM_STOP_CLAIMED],       ncontigends);
+  _print_grphwlk_state("Hit limit ............ ", stops[ASSEM_STOP_LIMIT],         ncontigends);
 
   size_t njunc = states[GRPHWLK_USELINKS] +
                  stops[ASSEM_STOP_NOPATHS] +
@@ -14,10 +14,12 @@ enum AssemStopCause {
   ASSEM_STOP_MISSING_PATHS  = 5, /* Fail: fork in colour, missing info */
   ASSEM_STOP_CYCLE          = 6,
   ASSEM_STOP_LOW_STEP_CONF  = 7,
-  ASSEM_STOP_LOW_CUMUL_CONF = 8
+  ASSEM_STOP_LOW_CUMUL_CONF = 8,
+  ASSEM_STOP_CLAIMED        = 9, /* Hit a unitig claimed by another contig */
+  ASSEM_STOP_LIMIT          = 10 /* Hit a limit on kmers or time */
 };
 
-#define ASSEM_NUM_STOPS 9
+#define ASSEM_NUM_STOPS 11
 
 #define ASSEM_STOP_UNKNOWN_STR        "StopUnknown"
 #define ASSEM_STOP_NOCOVG_STR         "StopNoCovg"
@@ -28,15 +30,28 @@ enum AssemStopCause {
 #define ASSEM_STOP_CYCLE_STR          "StopHitLoop"
 #define ASSEM_STOP_LOW_STEP_CONF_STR  "StopLowStepConfidence"
 #define ASSEM_STOP_LOW_CUMUL_CONF_STR "StopLowCumulativeConfidence"
+#define ASSEM_STOP_CLAIMED_STR        "StopHitClaimed"
+#define ASSEM_STOP_LIMIT_STR          "StopHitLimit"
 
 enum AssemStopCause graphstep2assem(enum GraphStepStatus step, bool hit_cycle,
-                                    bool low_step_confid, bool low_cumul_confid);
+                                    bool low_step_confid, bool low_cumul_confid,
+                                    bool hit_claimed, bool hit_limit);
 
 // Get string representation of a given AssemStopCause
 const char* assem2str(enum AssemStopCause assem);
 
 #define AC_MAX_PATHS 5
 
+// Histogram of contig lengths or junction counts. Values below AC_HIST_LEN are
+// counted, the few larger values are kept in a list, so stats remain exact.
+#define AC_HIST_LEN 4096
+
+typedef struct
+{
+  uint64_t counts[AC_HIST_LEN];
+  SizeBuffer tail; // values >= AC_HIST_LEN, unsorted
+} AssembleHist;
+
 typedef struct
 {
   uint64_t num_contigs, total_len, total_junc;
@@ -48,7 +63,7 @@ typedef struct
   uint64_t paths_held_max, paths_new_max, paths_cntr_max;
   uint64_t grphwlk_steps[GRPHWLK_NUM_STATES]; // states in graph_walker.h
   uint64_t stop_causes[ASSEM_NUM_STOPS]; // ASSEM_STOP_* defined above
-  SizeBuffer lengths, junctns;
+  AssembleHist lengths, junctns; // per contig
   double max_junc_density;
   uint64_t num_contigs_from_seed_kmers;
   uint64_t num_contigs_from_seed_paths;
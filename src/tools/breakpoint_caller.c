@@ -8,6 +8,7 @@
 #include "kmer_occur.h"
 #include "graph_crawler.h"
 #include "json_hdr.h"
+#include "gzip_writer.h"
 
 typedef struct {
   uint32_t first_runid, num_runs;
@@ -43,8 +44,11 @@ typedef struct
   // Passed to all instances
   const KOGraph *kograph;
   const dBGraph *db_graph;
-  gzFile gzout;
-  pthread_mutex_t *const out_lock;
+  GzipWriter *gzout;
+  GzipWriterBuf outbuf; // calls are compressed in blocks of text
+  GraphCrawlBudget budget; // cleared for deferred kmers
+  dBNodeBuffer deferred; // ref kmers that went over budget
+  uint64_t num_deferred; // number of ref kmers deferred
   size_t *callid;
   const size_t min_ref_nkmers, max_ref_nkmers; // how many kmers of homology req
 } BreakpointCaller;
@@ -57,9 +61,10 @@ typedef struct
 #define MAX_REFRUNS_PER_CALLER(ncols) MAX_REFRUNS_PER_ORIENT(ncols)*2
 
 static BreakpointCaller* brkpt_callers_new(size_t num_callers,
-                                           gzFile gzout,
+                                           GzipWriter *gzout,
                                            size_t min_ref_nkmers,
                                            size_t max_ref_nkmers,
+                                           const GraphCrawlBudget *budget,
                                            const KOGraph *kograph,
                                            const dBGraph *db_graph)
 {
@@ -68,9 +73,6 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
   const size_t ncols = db_graph->num_of_cols;
   BreakpointCaller *callers = ctx_malloc(num_callers * sizeof(BreakpointCaller));
 
-  pthread_mutex_t *out_lock = ctx_malloc(sizeof(pthread_mutex_t));
-  if(pthread_mutex_init(out_lock, NULL) != 0) die("mutex init failed");
-
   size_t *callid = ctx_calloc(1, sizeof(size_t));
 
   // Each colour in each caller can have a GraphCache path at once
@@ -84,7 +86,8 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
                             .kograph = kograph,
                             .db_graph = db_graph,
                             .gzout = gzout,
-                            .out_lock = out_lock,
+                            .budget = *budget,
+                            .num_deferred = 0,
                             .callid = callid,
                             .allele_refs = path_ref_runs,
                             .flank5p_refs = path_ref_runs+MAX_REFRUNS_PER_ORIENT(ncols),
@@ -97,6 +100,7 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
 
     db_node_buf_alloc(&callers[i].allelebuf, 1024);
     db_node_buf_alloc(&callers[i].flank5pbuf, 1024);
+    db_node_buf_alloc(&callers[i].deferred, 16);
     korun_buf_alloc(&callers[i].koruns_5p, 128);
     korun_buf_alloc(&callers[i].koruns_5p_ended, 128);
     korun_buf_alloc(&callers[i].koruns_3p, 128);
@@ -106,6 +110,7 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
     korun_buf_alloc(&callers[i].flank5p_run_buf, 128);
     graph_crawler_alloc(&callers[i].crawlers[0], db_graph);
     graph_crawler_alloc(&callers[i].crawlers[1], db_graph);
+    gzip_writer_buf_alloc(&callers[i].outbuf);
   }
 
   return callers;
@@ -117,6 +122,7 @@ static void brkpt_callers_destroy(BreakpointCaller *callers, size_t num_callers)
   for(i = 0; i < num_callers; i++) {
     db_node_buf_dealloc(&callers[i].allelebuf);
     db_node_buf_dealloc(&callers[i].flank5pbuf);
+    db_node_buf_dealloc(&callers[i].deferred);
     korun_buf_dealloc(&callers[i].koruns_5p);
     korun_buf_dealloc(&callers[i].koruns_5p_ended);
     korun_buf_dealloc(&callers[i].koruns_3p);
@@ -126,9 +132,8 @@ static void brkpt_callers_destroy(BreakpointCaller *callers, size_t num_callers)
     korun_buf_dealloc(&callers[i].flank5p_run_buf);
     graph_crawler_dealloc(&callers[i].crawlers[0]);
     graph_crawler_dealloc(&callers[i].crawlers[1]);
+    gzip_writer_buf_dealloc(&callers[i].outbuf);
   }
-  pthread_mutex_destroy(callers[0].out_lock);
-  ctx_free(callers[0].out_lock);
   ctx_free(callers[0].callid);
   ctx_free(callers[0].allele_refs);
   ctx_free(callers);
@@ -141,7 +146,7 @@ static void process_contig(BreakpointCaller *caller,
                            const KOccurRun *flank5p_runs, size_t nflank5p_runs,
                            const KOccurRun *flank3p_runs, size_t nflank3p_runs)
 {
-  gzFile gzout = caller->gzout;
+  StrBuf *sbuf = &caller->outbuf.text;
   const KOGraph *kograph = caller->kograph;
   const size_t kmer_size = caller->db_graph->kmer_size;
 
@@ -159,36 +164,33 @@ static void process_contig(BreakpointCaller *caller,
   size_t kmer3poffset = kmer_size-1-extra3pbases;
 
   size_t callid = __sync_fetch_and_add((volatile size_t*)caller->callid, 1);
-  pthread_mutex_lock(caller->out_lock);
 
   // This can be set to anything without a '.' in it
   const char prefix[] = "call";
 
   // 5p flank with list of ref intersections
-  gzprintf(gzout, ">brkpnt.%s%zu.5pflank chr=", prefix, callid);
-  koruns_gzprint(gzout, kmer_size, kograph, flank5p_runs, nflank5p_runs, 0, 0);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint(flank5p->b, flank5p->len, caller->db_graph, gzout);
-  gzputc(gzout, '\n');
+  strbuf_sprintf(sbuf, ">brkpnt.%s%zu.5pflank chr=", prefix, callid);
+  koruns_sbuf(sbuf, kmer_size, kograph, flank5p_runs, nflank5p_runs, 0, 0);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_sbuf(flank5p->b, flank5p->len, caller->db_graph, sbuf);
+  strbuf_append_char(sbuf, '\n');
 
   // 3p flank with list of ref intersections
-  gzprintf(gzout, ">brkpnt.%s%zu.3pflank chr=", prefix, callid);
-  koruns_gzprint(gzout, kmer_size, kograph, flank3p_runs, nflank3p_runs,
-                 flank3pidx, kmer3poffset);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint_cont(allelebuf->b+num_path_kmers,
-                        allelebuf->len-num_path_kmers,
-                        caller->db_graph, gzout);
-  gzputc(gzout, '\n');
+  strbuf_sprintf(sbuf, ">brkpnt.%s%zu.3pflank chr=", prefix, callid);
+  koruns_sbuf(sbuf, kmer_size, kograph, flank3p_runs, nflank3p_runs,
+              flank3pidx, kmer3poffset);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_sbuf_cont(allelebuf->b+num_path_kmers,
+                     allelebuf->len-num_path_kmers,
+                     caller->db_graph, sbuf);
+  strbuf_append_char(sbuf, '\n');
 
   // Print path with list of colours
-  gzprintf(gzout, ">brkpnt.%s%zu.path cols=%zu", prefix, callid, cols[0]);
-  for(i = 1; i < ncols; i++) gzprintf(gzout, ",%zu", cols[i]);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint_cont(allelebuf->b, num_path_kmers, caller->db_graph, gzout);
-  gzprintf(gzout, "\n\n");
-
-  pthread_mutex_unlock(caller->out_lock);
+  strbuf_sprintf(sbuf, ">brkpnt.%s%zu.path cols=%u", prefix, callid, cols[0]);
+  for(i = 1; i < ncols; i++) strbuf_sprintf(sbuf, ",%u", cols[i]);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_sbuf_cont(allelebuf->b, num_path_kmers, caller->db_graph, sbuf);
+  strbuf_append_str(sbuf, "\n\n");
 }
 
 
@@ -371,9 +373,19 @@ static void traverse_5pflank(BreakpointCaller *caller, GraphCrawler *crawler,
                       caller);
 }
 
+// Returns true if the crawlers hold more kmers than budgeted or time is up
+static inline bool brkpt_over_budget(const BreakpointCaller *caller)
+{
+  const GraphCrawlBudget *b = &caller->budget;
+  return graph_crawl_budget_is_set(b) &&
+         (graph_crawl_budget_exceeded(b, &caller->crawlers[0].cache) ||
+          graph_crawl_budget_exceeded(b, &caller->crawlers[1].cache));
+}
+
 // Walk the graph remembering the last time we met the ref
 // When traversal fails, dump sequence up to last meeting with the ref
-static void follow_break(BreakpointCaller *caller, dBNode node)
+// Returns false if caller->budget was exceeded
+static bool follow_break(BreakpointCaller *caller, dBNode node)
 {
   size_t i, j, k, num_next;
   dBNode next_nodes[4];
@@ -395,7 +407,7 @@ static void follow_break(BreakpointCaller *caller, dBNode node)
   }
 
   // Abandon if no non-ref kmers next
-  if(num_nonref_next == 0) return;
+  if(num_nonref_next == 0) return true;
 
   // debug
   // char nstr[MAX_KMER_SIZE+3];
@@ -427,6 +439,7 @@ static void follow_break(BreakpointCaller *caller, dBNode node)
     // Go backwards to get 5p flank
     traverse_5pflank(caller, rv_crawler, db_node_reverse(next_nodes[next_idx]),
                      db_node_reverse(node));
+    if(brkpt_over_budget(caller)) return false;
 
     // if(!rv_crawler->num_paths) { status("No 5p"); }
 
@@ -469,6 +482,7 @@ static void follow_break(BreakpointCaller *caller, dBNode node)
                             gcrawler_stop_at_ref_covg_path,
                             gcrawler_finish_ref_covg_path,
                             caller);
+        if(brkpt_over_budget(caller)) return false;
 
         // Assemble contigs - fetch forwards for each path for given 5p flank
         for(k = 0; k < fw_crawler->num_paths; k++)
@@ -496,6 +510,8 @@ static void follow_break(BreakpointCaller *caller, dBNode node)
       }
     }
   }
+
+  return true;
 }
 
 static inline int breakpoint_caller_node(hkey_t hkey, BreakpointCaller *caller)
@@ -512,28 +528,84 @@ static inline int breakpoint_caller_node(hkey_t hkey, BreakpointCaller *caller)
   // check node is in the ref
   if(kograph_occurs(caller->kograph, hkey))
   {
+    // Calls are only written once both orientations are done, so a kmer that
+    // goes over budget can be dropped and called again later (call ids of
+    // dropped calls are not reused)
+    StrBuf *sbuf = &caller->outbuf.text;
+    size_t outlen = sbuf->end;
+
     graph_crawler_reset(&caller->crawlers[0]);
     graph_crawler_reset(&caller->crawlers[1]);
-    follow_break(caller, (dBNode){.key = hkey, .orient = FORWARD});
-    follow_break(caller, (dBNode){.key = hkey, .orient = REVERSE});
+    graph_crawl_budget_start(&caller->budget);
+
+    if(!follow_break(caller, (dBNode){.key = hkey, .orient = FORWARD}) ||
+       !follow_break(caller, (dBNode){.key = hkey, .orient = REVERSE}))
+    {
+      strbuf_shrink(sbuf, outlen);
+      db_node_buf_add(&caller->deferred, (dBNode){.key = hkey, .orient = FORWARD});
+      caller->num_deferred++;
+    }
+
+    gzip_writer_write_mt(caller->gzout, &caller->outbuf);
   }
 
   return 0; // => keep iterating
 }
 
-static void breakpoint_caller(void *ptr, size_t threadid)
+// `arg` is the array of callers, one per thread
+static bool breakpoint_caller_kmer(hkey_t hkey, size_t threadid, void *arg)
+{
+  BreakpointCaller *callers = (BreakpointCaller*)arg;
+  return breakpoint_caller_node(hkey, &callers[threadid]);
+}
+
+typedef struct
+{
+  BreakpointCaller *callers;
+  const dBNode *nodes;
+} DeferredBreaks;
+
+static bool breakpoint_caller_deferred_range(size_t start, size_t end,
+                                             size_t threadid, void *arg)
+{
+  DeferredBreaks *job = (DeferredBreaks*)arg;
+  size_t i;
+  for(i = start; i < end; i++)
+    breakpoint_caller_node(job->nodes[i].key, &job->callers[threadid]);
+  return false; // keep going
+}
+
+// Call ref kmers deferred for going over budget, without a budget, sharing
+// them between all threads
+static void brkpt_callers_run_deferred(BreakpointCaller *callers,
+                                       size_t nthreads, bool skip_deferred)
 {
-  BreakpointCaller *caller = (BreakpointCaller*)ptr;
-  ctx_assert(caller->db_graph->num_edge_cols == 1);
+  size_t i, n = 0;
+  for(i = 0; i < nthreads; i++) n += callers[i].deferred.len;
+  if(n == 0) return;
+
+  dBNode *nodes = ctx_malloc(n * sizeof(dBNode));
+  for(i = 0, n = 0; i < nthreads; i++) {
+    memcpy(nodes + n, callers[i].deferred.b, callers[i].deferred.len * sizeof(dBNode));
+    n += callers[i].deferred.len;
+    db_node_buf_reset(&callers[i].deferred);
+  }
+
+  if(!skip_deferred) {
+    for(i = 0; i < nthreads; i++)
+      memset(&callers[i].budget, 0, sizeof(GraphCrawlBudget));
+
+    DeferredBreaks job = {.callers = callers, .nodes = nodes};
+    util_run_ranges(n, 1, nthreads, breakpoint_caller_deferred_range, &job);
+  }
 
-  HASH_ITERATE_PART(&caller->db_graph->ht, threadid, caller->nthreads,
-                    breakpoint_caller_node, caller);
+  ctx_free(nodes);
 }
 
-// Print JSON header to gzout
-static void breakpoints_print_header(gzFile gzout, const char *out_path,
+// Print JSON header to gzout, as its own gzip member
+static void breakpoints_print_header(GzipWriter *gzout, const char *out_path,
                                      char **seq_paths, size_t nseq_paths,
-                                     const read_t *reads, size_t nreads,
+                                     const KOGraph *kograph,
                                      bool load_ref_edges,
                                      size_t min_ref_nkmers,
                                      size_t max_ref_nkmers,
@@ -583,57 +655,59 @@ static void breakpoints_print_header(gzFile gzout, const char *out_path,
 
   // List contigs
   cJSON *contigs = cJSON_CreateArray();
-  for(i = 0; i < nreads; i++) {
+  for(i = 0; i < kograph->nchroms; i++) {
     cJSON *contig = cJSON_CreateObject();
-    cJSON_AddStringToObject(contig, "id", reads[i].name.b);
-    cJSON_AddNumberToObject(contig, "length", reads[i].seq.end);
+    cJSON_AddStringToObject(contig, "id", kograph->chroms[i].name);
+    cJSON_AddNumberToObject(contig, "length", kograph->chroms[i].length);
     cJSON_AddItemToArray(contigs, contig);
   }
   json_hdr_augment_cmd(json, "breakpoints", "contigs", contigs);
 
   // Write header to file
-  json_hdr_gzprint(json, gzout);
+  StrBuf hdrbuf;
+  char *jstr = cJSON_Print(json);
+  strbuf_alloc(&hdrbuf, 4096);
+  strbuf_append_str(&hdrbuf, jstr);
+  strbuf_append_str(&hdrbuf, "\n\n");
+  free(jstr);
 
   // Print comments about the format
-  gzputs(gzout, "\n");
-  gzputs(gzout, "# This file was generated with McCortex\n");
-  gzputs(gzout, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
-  gzputs(gzout, "#   url: "MCCORTEX_URL"\n");
-  gzputs(gzout, "# \n");
-  gzputs(gzout, "# Comment lines begin with a # and are ignored, but must come after the header\n");
-  gzputs(gzout, "# Format is:\n");
-  gzputs(gzout, "#   chr=seq:start-end:strand:offset\n");
-  gzputs(gzout, "#   all coordinates are 1-based\n");
-  gzputs(gzout, "#   <strand> is + or -. If +, start <= end. If -, start >= end.\n");
-  gzputs(gzout, "#   <offset> is the position in the sequence where ref starts agreeing\n");
-  gzputs(gzout, "\n");
-
+  strbuf_append_str(&hdrbuf, "\n");
+  strbuf_append_str(&hdrbuf, "# This file was generated with McCortex\n");
+  strbuf_append_str(&hdrbuf, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
+  strbuf_append_str(&hdrbuf, "#   url: "MCCORTEX_URL"\n");
+  strbuf_append_str(&hdrbuf, "# \n");
+  strbuf_append_str(&hdrbuf, "# Comment lines begin with a # and are ignored, but must come after the header\n");
+  strbuf_append_str(&hdrbuf, "# Format is:\n");
+  strbuf_append_str(&hdrbuf, "#   chr=seq:start-end:strand:offset\n");
+  strbuf_append_str(&hdrbuf, "#   all coordinates are 1-based\n");
+  strbuf_append_str(&hdrbuf, "#   <strand> is + or -. If +, start <= end. If -, start >= end.\n");
+  strbuf_append_str(&hdrbuf, "#   <offset> is the position in the sequence where ref starts agreeing\n");
+  strbuf_append_str(&hdrbuf, "\n");
+
+  gzip_writer_puts_mt(gzout, hdrbuf.b);
+  strbuf_dealloc(&hdrbuf);
   cJSON_Delete(json);
 }
 
 void breakpoints_call(size_t nthreads, size_t ref_col,
-                      gzFile gzout, const char *out_path,
-                      const read_t *reads, size_t num_reads,
+                      FILE *fout, const char *out_path,
+                      const KOGraph *kograph,
                       char **seq_paths, size_t num_seq_paths,
                       bool load_ref_edges,
                       size_t min_ref_nkmers, size_t max_ref_nkmers,
+                      const GraphCrawlBudget *budget, bool skip_deferred,
                       cJSON **hdrs, size_t nhdrs,
                       dBGraph *db_graph)
 {
   ctx_assert(!max_ref_nkmers || min_ref_nkmers <= max_ref_nkmers);
-  // Temporarily hide edges from kograph_create if we don't want to load edges
-  Edges *tmp_edges = db_graph->col_edges;
-  if(!load_ref_edges) db_graph->col_edges = NULL;
 
-  KOGraph kograph = kograph_create(reads, num_reads, true, ref_col,
-                                   nthreads, db_graph);
+  GzipWriter gzout;
+  gzip_writer_alloc(&gzout, fout, out_path, Z_DEFAULT_COMPRESSION);
 
-  // Restore graph edges
-  db_graph->col_edges = tmp_edges;
-
-  BreakpointCaller *callers = brkpt_callers_new(nthreads, gzout,
+  BreakpointCaller *callers = brkpt_callers_new(nthreads, &gzout,
                                                 min_ref_nkmers, max_ref_nkmers,
-                                                &kograph, db_graph);
+                                                budget, kograph, db_graph);
 
   status("Running BreakpointCaller with %zu thread%s, output to: %s",
          nthreads, util_plural_str(nthreads),
@@ -642,21 +716,38 @@ void breakpoints_call(size_t nthreads, size_t ref_col,
   status("  Finding breakpoints after at least %zu kmers (%zubp) of homology",
          min_ref_nkmers, min_ref_nkmers+db_graph->kmer_size-1);
 
-  breakpoints_print_header(gzout, out_path,
+  breakpoints_print_header(&gzout, out_path,
                            seq_paths, num_seq_paths,
-                           reads, num_reads,
+                           kograph,
                            load_ref_edges,
                            min_ref_nkmers, min_ref_nkmers,
                            hdrs, nhdrs,
                            ref_col, db_graph);
 
-  util_run_threads(callers, nthreads, sizeof(callers[0]),
-                   nthreads, breakpoint_caller);
+  ctx_assert(db_graph->num_edge_cols == 1);
+  hash_table_iterate_steal(&db_graph->ht, nthreads,
+                           breakpoint_caller_kmer, callers);
+  brkpt_callers_run_deferred(callers, nthreads, skip_deferred);
+
+  // Write remaining partial blocks
+  size_t i;
+  uint64_t ndeferred = 0;
+  for(i = 0; i < nthreads; i++) {
+    gzip_writer_flush_mt(&gzout, &callers[i].outbuf);
+    ndeferred += callers[i].num_deferred;
+  }
+
+  if(graph_crawl_budget_is_set(budget)) {
+    char ndeferred_str[50];
+    status("  Ref kmers over budget %s: %s",
+           skip_deferred ? "skipped" : "deferred",
+           ulong_to_str(ndeferred, ndeferred_str));
+  }
 
   char call_num_str[100];
   ulong_to_str(callers[0].callid[0], call_num_str);
   status("  %s calls printed to %s", call_num_str, futil_outpath_str(out_path));
 
   brkpt_callers_destroy(callers, nthreads);
-  kograph_dealloc(&kograph);
+  gzip_writer_dealloc(&gzout);
 }
@@ -2,6 +2,8 @@
 #define BREAKPOINT_CALLER_H_
 
 #include "db_graph.h"
+#include "kmer_occur.h"
+#include "graph_crawler.h"
 
 #include "seq_file/seq_file.h"
 #include "cJSON/cJSON.h"
@@ -14,28 +16,33 @@
 #define DEFAULT_MAX_REF_NKMERS 1000
 
 /**
- * Load reference kmers into the graph, make breakpoint calls and write out.
+ * Make breakpoint calls and write out. Reference kmers must already be in
+ * the graph, see kograph_create() and kograph_load().
  *
  * @param nthreads      number of threads to use
  * @param ref_col       colour to load reference sequence into
- * @param gzout         gzFile to print breakpoints to
- * @param out_path      path to output file that gzout points to
- * @param reads         reference sequence to load into the graph
- * @param num_reads     number of reference contigs
- * @param seq_paths     paths to the files which the ref reads where loaded from
+ * @param fout          file to print gzipped breakpoints to
+ * @param out_path      path to output file that fout points to
+ * @param kograph       occurrences of kmers in the reference
+ * @param seq_paths     paths to the files which the ref was loaded from
  * @param num_seq_paths number of seq_paths
- * @param load_ref_edges whether or not to load edges from the ref
+ * @param load_ref_edges whether or not edges from the ref were loaded
  * @param min_ref_flank num of kmers required to flank breakpoint on ref
+ * @param budget        ref kmers whose crawl goes over budget are deferred
+ *                      until all others are done, then called with all
+ *                      threads and no budget
+ * @param skip_deferred drop kmers that go over budget instead
  * @param hdrs          JSON headers of input files
  * @param nhdrs         number of JSON headers in hdrs
  * @param db_graph      de Bruijn graph to use
  **/
 void breakpoints_call(size_t nthreads, size_t ref_col,
-                      gzFile gzout, const char *out_path,
-                      const read_t *reads, size_t num_reads,
+                      FILE *fout, const char *out_path,
+                      const KOGraph *kograph,
                       char **seq_paths, size_t num_seq_paths,
                       bool load_ref_edges,
                       size_t min_ref_flank, size_t max_ref_flank,
+                      const GraphCrawlBudget *budget, bool skip_deferred,
                       cJSON **hdrs, size_t nhdrs,
                       dBGraph *db_graph);
 
@@ -10,12 +10,14 @@
 #include "binary_seq.h"
 #include "graph_crawler.h"
 #include "json_hdr.h"
+#include "graph_snapshot.h"
 
 #include <pthread.h> // multithreading
+#include <unistd.h> // fsync()
 
 BubbleCaller* bubble_callers_new(size_t num_callers,
                                  const BubbleCallingPrefs *prefs,
-                                 gzFile gzout,
+                                 GzipWriter *gzout,
                                  const dBGraph *db_graph)
 {
   ctx_assert(num_callers > 0);
@@ -26,9 +28,6 @@ BubbleCaller* bubble_callers_new(size_t num_callers,
 
   BubbleCaller *callers = ctx_malloc(num_callers * sizeof(BubbleCaller));
 
-  pthread_mutex_t *out_lock = ctx_malloc(sizeof(pthread_mutex_t));
-  if(pthread_mutex_init(out_lock, NULL) != 0) die("mutex init failed");
-
   uint64_t *nbubbles_ptr = ctx_calloc(1, sizeof(uint64_t));
 
   for(i = 0; i < num_callers; i++)
@@ -37,28 +36,32 @@ BubbleCaller* bubble_callers_new(size_t num_callers,
 
     BubbleCaller tmp = {.nthreads = num_callers,
                         .haploid_seen = haploid_seen,
+                        .budget = prefs->budget,
+                        .num_deferred = 0,
                         .num_haploid_bubbles = 0,
                         .num_serial_bubbles = 0,
                         .nbubbles_ptr = nbubbles_ptr,
                         .prefs = prefs,
-                        .db_graph = db_graph, .gzout = gzout,
-                        .out_lock = out_lock};
+                        .db_graph = db_graph, .gzout = gzout};
 
     memcpy(&callers[i], &tmp, sizeof(BubbleCaller));
 
-    callers[i].unitig_map = kh_init(uint32to32);
+    gc_map_alloc(&callers[i].unitig_map);
+    callers[i].colsets = ctx_calloc(5 * db_node_colset_words(db_graph->num_of_cols),
+                                    sizeof(uint64_t));
 
     // First two buffers don't actually need to grow
     db_node_buf_alloc(&callers[i].flank5p, prefs->max_flank_len);
     db_node_buf_alloc(&callers[i].pathbuf, max_path_len);
+    db_node_buf_alloc(&callers[i].deferred, 16);
 
     graph_walker_alloc(&callers[i].wlk, db_graph);
-    rpt_walker_alloc(&callers[i].rptwlk, db_graph->ht.capacity, 22); // 4MB
+    rpt_walker_alloc_epoch(&callers[i].rptwlk, 12); // grows with path length
 
     graph_cache_alloc(&callers[i].cache, db_graph);
     cache_stepptr_buf_alloc(&callers[i].spp_forward, 1024);
     cache_stepptr_buf_alloc(&callers[i].spp_reverse, 1024);
-    strbuf_alloc(&callers[i].output_buf, 2048);
+    gzip_writer_buf_alloc(&callers[i].outbuf);
   }
 
   return callers;
@@ -73,10 +76,12 @@ void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers)
   {
     ctx_free(callers[i].haploid_seen);
 
-    kh_destroy(uint32to32, callers[i].unitig_map);
+    gc_map_dealloc(&callers[i].unitig_map);
+    ctx_free(callers[i].colsets);
 
     db_node_buf_dealloc(&callers[i].flank5p);
     db_node_buf_dealloc(&callers[i].pathbuf);
+    db_node_buf_dealloc(&callers[i].deferred);
 
     rpt_walker_dealloc(&callers[i].rptwlk);
     graph_walker_dealloc(&callers[i].wlk);
@@ -84,16 +89,14 @@ void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers)
     graph_cache_dealloc(&callers[i].cache);
     cache_stepptr_buf_dealloc(&callers[i].spp_forward);
     cache_stepptr_buf_dealloc(&callers[i].spp_reverse);
-    strbuf_dealloc(&callers[i].output_buf);
+    gzip_writer_buf_dealloc(&callers[i].outbuf);
   }
-  pthread_mutex_destroy(callers[0].out_lock);
-  ctx_free(callers[0].out_lock);
   ctx_free(callers[0].nbubbles_ptr);
   ctx_free(callers);
 }
 
-// Print JSON header to gzout
-static void bubble_caller_print_header(gzFile gzout, const char* out_path,
+// Print JSON header to gzout, as its own gzip member
+static void bubble_caller_print_header(GzipWriter *gzout, const char* out_path,
                                        const BubbleCallingPrefs *prefs,
                                        cJSON **hdrs, size_t nhdrs,
                                        const dBGraph *db_graph)
@@ -119,17 +122,24 @@ static void bubble_caller_print_header(gzFile gzout, const char* out_path,
   json_hdr_augment_cmd(json, "bubbles", "haploid_colours", haploids);
 
   // Write header to file
-  json_hdr_gzprint(json, gzout);
+  StrBuf hdrbuf;
+  char *jstr = cJSON_Print(json);
+  strbuf_alloc(&hdrbuf, 4096);
+  strbuf_append_str(&hdrbuf, jstr);
+  strbuf_append_str(&hdrbuf, "\n\n");
+  free(jstr);
 
   // Print comments about the format
-  gzputs(gzout, "\n");
-  gzputs(gzout, "# This file was generated with McCortex\n");
-  gzputs(gzout, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
-  gzputs(gzout, "#   url: "MCCORTEX_URL"\n");
-  gzputs(gzout, "# \n");
-  gzputs(gzout, "# Comment lines begin with a # and are ignored, but must come after the header\n");
-  gzputs(gzout, "\n");
-
+  strbuf_append_str(&hdrbuf, "\n");
+  strbuf_append_str(&hdrbuf, "# This file was generated with McCortex\n");
+  strbuf_append_str(&hdrbuf, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
+  strbuf_append_str(&hdrbuf, "#   url: "MCCORTEX_URL"\n");
+  strbuf_append_str(&hdrbuf, "# \n");
+  strbuf_append_str(&hdrbuf, "# Comment lines begin with a # and are ignored, but must come after the header\n");
+  strbuf_append_str(&hdrbuf, "\n");
+
+  gzip_writer_puts_mt(gzout, hdrbuf.b);
+  strbuf_dealloc(&hdrbuf);
   cJSON_Delete(json);
 }
 
@@ -181,9 +191,9 @@ static void print_bubble(BubbleCaller *caller,
   // Print Bubble
   //
 
-  // write to string buffer then flush to gzFile
-  StrBuf *sbuf = &caller->output_buf;
-  strbuf_reset(sbuf);
+  // append to this thread's block of text, compressed once it is full
+  GzipWriterBuf *outbuf = &caller->outbuf;
+  StrBuf *sbuf = &outbuf->text;
 
   // Temporary node buffer to use
   dBNodeBuffer *pathbuf = &caller->pathbuf;
@@ -191,6 +201,7 @@ static void print_bubble(BubbleCaller *caller,
 
   // Get bubble number (threadsafe nbubbles_ptr++)
   size_t id = __sync_fetch_and_add((volatile uint64_t*)caller->nbubbles_ptr, 1);
+  ctx_stats_add(CTX_STAT_BUBBLES, 1);
 
   // This can be set to anything without a '.' in it
   const char prefix[] = "call";
@@ -243,16 +254,17 @@ static void print_bubble(BubbleCaller *caller,
 
   ctx_assert(strlen(sbuf->b) == sbuf->end);
 
-  // lock, print, unlock
-  pthread_mutex_lock(caller->out_lock);
-  gzwrite(caller->gzout, sbuf->b, sbuf->end);
-  pthread_mutex_unlock(caller->out_lock);
+  if(caller->gzout != NULL) gzip_writer_write_mt(caller->gzout, outbuf);
+  else strbuf_reset(sbuf);
 }
 
 // `fork_node` is a node with outdegree > 1
-void find_bubbles(BubbleCaller *caller, dBNode fork_node)
+// Returns false if the fork went over caller->budget
+bool find_bubbles(BubbleCaller *caller, dBNode fork_node)
 {
   graph_cache_reset(&caller->cache);
+  graph_crawl_budget_start(&caller->budget);
+  bool use_budget = graph_crawl_budget_is_set(&caller->budget);
 
   const dBGraph *db_graph = caller->db_graph;
   GraphCache *cache = &caller->cache;
@@ -278,14 +290,24 @@ void find_bubbles(BubbleCaller *caller, dBNode fork_node)
 
   uint32_t pathid;
 
+  // Colours of the fork and next nodes, read once rather than per colour
+  const size_t nwords = db_node_colset_words(colours_loaded);
+  uint64_t *fork_cols = caller->colsets, *next_cols = fork_cols + nwords;
+
+  db_node_get_colset(db_graph, fork_node.key, fork_cols);
+  for(i = 0; i < num_next; i++)
+    db_node_get_colset(db_graph, nodes[i].key, next_cols + i*nwords);
+
   for(colour = 0; colour < colours_loaded; colour++)
   {
-    if(!db_node_has_col(db_graph, fork_node.key, colour)) continue;
+    // Skip 64 colours at a time that the fork is not in
+    if(fork_cols[colour/64] >> (colour%64) == 0) { colour |= 63; continue; }
+    if(!db_node_colset_has(fork_cols, colour)) continue;
 
     // Determine if this fork is a fork in the current colour
     num_edges_in_col = 0;
     for(i = 0; i < num_next; i++) {
-      node_has_col[i] = (db_node_has_col(db_graph, nodes[i].key, colour) > 0);
+      node_has_col[i] = db_node_colset_has(next_cols + i*nwords, colour);
       num_edges_in_col += node_has_col[i];
     }
 
@@ -303,6 +325,9 @@ void find_bubbles(BubbleCaller *caller, dBNode fork_node)
 
         graph_walker_finish(wlk);
         graph_crawler_reset_rpt_walker(rptwlk, cache, pathid);
+
+        if(use_budget && graph_crawl_budget_exceeded(&caller->budget, cache))
+          return false;
       }
     }
   }
@@ -310,43 +335,46 @@ void find_bubbles(BubbleCaller *caller, dBNode fork_node)
   // Set up 5p flank
   caller->flank5p.b[0] = db_node_reverse(fork_node);
   caller->flank5p.len = 0; // set to one to signify we haven't fetched flank yet
+  return true;
 }
 
 static bool paths_all_share_unitig(const GraphCache *cache,
-                                   khash_t(uint32to32) *unitig_map,
+                                   GCacheMap *unitig_map,
                                    GCacheStep const*const* steps,
                                    size_t num_paths)
 {
   uint32_t unitig;
-  khiter_t kiter;
-  kh_clear(uint32to32, unitig_map);
-  const GCachePath *path;
+  GCacheMapEntry *e;
   const GCacheStep *step;
-  size_t i;
-  int hret = 0;
+  size_t i, num_steps = 0;
+
+  for(i = 0; i < num_paths; i++)
+    num_steps += steps[i] - gc_path_first_step(cache,
+                                               gc_step_get_path(cache, steps[i]));
+
+  // New epoch, no need to wipe the map afterwards
+  gc_map_reset(unitig_map, num_steps);
 
   for(i = 0; i < num_paths; i++) {
-    path = gc_step_get_path(cache, steps[i]);
-    step = gc_path_first_step(cache, path);
+    step = gc_path_first_step(cache, gc_step_get_path(cache, steps[i]));
     for(; step < steps[i]; step++) {
       unitig = gc_step_encode_uint32(step);
-      kiter = kh_put(uint32to32, unitig_map, unitig, &hret);
-      if(hret < 0) die("khash table failed: out of memory?");
-      if(hret > 0) kh_value(unitig_map, kiter) = 0; // init if not in table
-      kh_value(unitig_map, kiter)++;
+      e = gc_map_find(unitig_map, unitig);
+      if(!gc_map_used(unitig_map, e)) gc_map_set(unitig_map, e, unitig, 0);
+      e->value++;
     }
   }
 
-  // Look for hits and wipe at the same time
-  bool shared_unitig = false;
-  for(kiter = kh_begin(unitig_map); kiter != kh_end(unitig_map); ++kiter) {
-    if(kh_exist(unitig_map, kiter)) {
-      shared_unitig |= (kh_value(unitig_map, kiter) == num_paths);
-      kh_del(uint32to32, unitig_map, kiter);
+  // Look for hits
+  for(i = 0; i < num_paths; i++) {
+    step = gc_path_first_step(cache, gc_step_get_path(cache, steps[i]));
+    for(; step < steps[i]; step++) {
+      e = gc_map_find(unitig_map, gc_step_encode_uint32(step));
+      if(e->value == num_paths) return true;
     }
   }
 
-  return shared_unitig;
+  return false;
 }
 
 // Remove paths that are both seen in a haploid sample (e.g. repeat)
@@ -409,7 +437,7 @@ static bool filter_bubbles(BubbleCaller *bc, GCacheStepPtrBuf *ends)
 
   // remove serial bubbles by dropping all paths if they all share a unitig
   if(bc->prefs->remove_serial_bubbles &&
-     paths_all_share_unitig(&bc->cache, bc->unitig_map,
+     paths_all_share_unitig(&bc->cache, &bc->unitig_map,
                             (GCacheStep const*const*)ends->b, ends->len))
   {
     // status("fail: serial");
@@ -471,33 +499,109 @@ static void write_bubbles_to_file(BubbleCaller *caller)
   }
 }
 
+// Call bubbles from a fork, deferring it if it goes over budget
+static inline void bubble_caller_fork(BubbleCaller *caller, dBNode fork)
+{
+  if(find_bubbles(caller, fork)) write_bubbles_to_file(caller);
+  else {
+    db_node_buf_add(&caller->deferred, fork);
+    caller->num_deferred++;
+  }
+}
+
 static inline int bubble_caller_node(hkey_t hkey, BubbleCaller *caller)
 {
   Edges edges = db_node_get_edges(caller->db_graph, hkey, 0);
-  if(edges_get_outdegree(edges, FORWARD) > 1) {
-    find_bubbles(caller, (dBNode){.key = hkey, .orient = FORWARD});
+  if(edges_get_outdegree(edges, FORWARD) > 1)
+    bubble_caller_fork(caller, (dBNode){.key = hkey, .orient = FORWARD});
+  if(edges_get_outdegree(edges, REVERSE) > 1)
+    bubble_caller_fork(caller, (dBNode){.key = hkey, .orient = REVERSE});
+
+  return 0; // => keep iterating
+}
+
+// `arg` is the array of callers, one per thread
+static bool bubble_caller_kmer(hkey_t hkey, size_t threadid, void *arg)
+{
+  BubbleCaller *callers = (BubbleCaller*)arg;
+  return bubble_caller_node(hkey, &callers[threadid]);
+}
+
+typedef struct
+{
+  BubbleCaller *callers;
+  const dBNode *forks;
+} DeferredForks;
+
+static bool bubble_caller_deferred_range(size_t start, size_t end,
+                                         size_t threadid, void *arg)
+{
+  DeferredForks *job = (DeferredForks*)arg;
+  BubbleCaller *caller = &job->callers[threadid];
+  size_t i;
+  for(i = start; i < end; i++) {
+    find_bubbles(caller, job->forks[i]);
     write_bubbles_to_file(caller);
   }
-  if(edges_get_outdegree(edges, REVERSE) > 1) {
-    find_bubbles(caller, (dBNode){.key = hkey, .orient = REVERSE});
-    write_bubbles_to_file(caller);
+  return false; // keep going
+}
+
+// Call forks deferred for going over budget, without a budget, sharing them
+// between all threads. Or drop them if prefs->skip_deferred.
+static void bubble_callers_run_deferred(BubbleCaller *callers, size_t nthreads)
+{
+  size_t i, n = 0;
+  for(i = 0; i < nthreads; i++) n += callers[i].deferred.len;
+  if(n == 0) return;
+
+  dBNode *forks = ctx_malloc(n * sizeof(dBNode));
+  for(i = 0, n = 0; i < nthreads; i++) {
+    memcpy(forks + n, callers[i].deferred.b, callers[i].deferred.len * sizeof(dBNode));
+    n += callers[i].deferred.len;
+    db_node_buf_reset(&callers[i].deferred);
   }
 
-  return 0; // => keep iterating
+  if(!callers[0].prefs->skip_deferred) {
+    for(i = 0; i < nthreads; i++)
+      memset(&callers[i].budget, 0, sizeof(GraphCrawlBudget));
+
+    DeferredForks job = {.callers = callers, .forks = forks};
+    util_run_ranges(n, 1, nthreads, bubble_caller_deferred_range, &job);
+
+    for(i = 0; i < nthreads; i++) callers[i].budget = callers[i].prefs->budget;
+  }
+
+  ctx_free(forks);
 }
 
-void bubble_caller(void *args, size_t threadid)
+// Flush all output then record how far we have got in the snapshot
+static void bubble_caller_checkpoint(BubbleCaller *callers, size_t nthreads,
+                                     GzipWriter *gzout, hkey_t next_hkey,
+                                     const char *snapshot_path,
+                                     SnapshotProgress *progress)
 {
-  BubbleCaller *caller = (BubbleCaller*)args;
-
-  HASH_ITERATE_PART(&caller->db_graph->ht, threadid, caller->nthreads,
-                    bubble_caller_node, caller);
+  size_t i;
+  bubble_callers_run_deferred(callers, nthreads);
+  for(i = 0; i < nthreads; i++)
+    gzip_writer_flush_mt(gzout, &callers[i].outbuf);
+
+  off_t out_bytes;
+  if(fflush(gzout->fout) != 0 || fsync(fileno(gzout->fout)) != 0 ||
+     (out_bytes = ftello(gzout->fout)) < 0)
+    die("Cannot write to file: %s", futil_outpath_str(gzout->path));
+
+  progress->next_hkey = next_hkey;
+  progress->nitems = callers[0].nbubbles_ptr[0];
+  progress->out_bytes = out_bytes;
+  graph_snapshot_set_progress(snapshot_path, progress);
 }
 
 void invoke_bubble_caller(size_t num_of_threads,
                           const BubbleCallingPrefs *prefs,
-                          gzFile gzout, const char *out_path,
+                          FILE *fout, const char *out_path,
                           cJSON **hdrs, size_t nhdrs,
+                          const char *snapshot_path,
+                          SnapshotProgress *progress,
                           const dBGraph *db_graph)
 {
   ctx_assert(db_graph->num_edge_cols == 1);
@@ -512,28 +616,72 @@ void invoke_bubble_caller(size_t num_of_threads,
   status("Haploid colours:%s", tmpstr.b);
   strbuf_dealloc(&tmpstr);
 
-  // Print header
-  bubble_caller_print_header(gzout, out_path, prefs, hdrs, nhdrs, db_graph);
+  GzipWriter gzout;
+  gzip_writer_alloc(&gzout, fout, out_path, Z_DEFAULT_COMPRESSION);
+
+  // Print header, unless resuming output that already has one
+  if(progress == NULL || progress->out_bytes == 0)
+    bubble_caller_print_header(&gzout, out_path, prefs, hdrs, nhdrs, db_graph);
 
   BubbleCaller *callers = bubble_callers_new(num_of_threads, prefs,
-                                             gzout, db_graph);
+                                             &gzout, db_graph);
+
+  if(snapshot_path == NULL)
+  {
+    // Run, bubbles are dense in repeats so balance work by stealing
+    hash_table_iterate_steal(&db_graph->ht, num_of_threads,
+                             bubble_caller_kmer, callers);
+    bubble_callers_run_deferred(callers, num_of_threads);
+
+    // Write remaining partial blocks
+    for(i = 0; i < num_of_threads; i++)
+      gzip_writer_flush_mt(&gzout, &callers[i].outbuf);
+  }
+  else
+  {
+    // Call BUBBLE_CHECKPOINTS ranges of hkeys, saving progress after each
+    hkey_t start = progress->next_hkey, end;
+    hkey_t capacity = hash_table_size(&db_graph->ht);
+    hkey_t step = MAX2(capacity / BUBBLE_CHECKPOINTS, 1);
+    callers[0].nbubbles_ptr[0] = progress->nitems;
+
+    if(start > 0) {
+      char hkey_str[50];
+      status("Resuming bubble calling from hkey %s (%zu%%)",
+             ulong_to_str(start, hkey_str), (size_t)((100*start)/capacity));
+    }
+
+    bubble_caller_checkpoint(callers, num_of_threads, &gzout, start,
+                             snapshot_path, progress);
 
-  // Run
-  util_run_threads(callers, num_of_threads, sizeof(callers[0]),
-                   num_of_threads, bubble_caller);
+    for(; start < capacity; start = end) {
+      end = MIN2(start + step, capacity);
+      hash_table_iterate_steal_range(&db_graph->ht, start, end, num_of_threads,
+                                     bubble_caller_kmer, callers);
+      bubble_caller_checkpoint(callers, num_of_threads, &gzout, end,
+                               snapshot_path, progress);
+    }
+  }
 
   // Report number of bubble called+printed
   uint64_t nhaploid = 0, nserial = 0, nbubbles = callers[0].nbubbles_ptr[0];
+  uint64_t ndeferred = 0;
 
   for(i = 0; i < num_of_threads; i++) {
     nhaploid += callers[i].num_haploid_bubbles;
     nserial += callers[i].num_serial_bubbles;
+    ndeferred += callers[i].num_deferred;
   }
 
   char n0[ULONGSTRLEN];
   status("Bubble Caller called %s bubbles\n", ulong_to_str(nbubbles, n0));
   status("Haploid bubbles dropped: %s", ulong_to_str(nhaploid, n0));
   status("Serial bubbles dropped: %s", ulong_to_str(nserial, n0));
+  if(graph_crawl_budget_is_set(&prefs->budget)) {
+    status("Forks over budget %s: %s",
+           prefs->skip_deferred ? "skipped" : "deferred",
+           ulong_to_str(ndeferred, n0));
+  }
 
   status("Turn bubble file into VCF with:");
   status("   bwa index ref.fa");
@@ -545,4 +693,5 @@ void invoke_bubble_caller(size_t num_of_threads,
 
   // Clean up
   bubble_callers_destroy(callers, num_of_threads);
+  gzip_writer_dealloc(&gzout);
 }
@@ -4,14 +4,14 @@
 #include "db_graph.h"
 #include "graph_cache.h"
 #include "graph_walker.h"
+#include "graph_crawler.h"
 #include "repeat_walker.h"
 #include "cmd.h"
+#include "gzip_writer.h"
+#include "graph_snapshot.h"
 
 #include "cJSON/cJSON.h"
 
-#include "htslib/khash.h"
-KHASH_INIT(uint32to32, uint32_t, uint32_t, 1, kh_int_hash_func, kh_int_hash_equal)
-
 #define BUBBLE_FORMAT_VERSION 2
 
 typedef struct
@@ -23,6 +23,10 @@ typedef struct
   const size_t *haploid_cols;
   size_t nhaploid_cols;
   bool remove_serial_bubbles;
+  // Forks that go over budget are deferred until all other forks are done,
+  // then called with all threads and no budget, or skipped if skip_deferred
+  GraphCrawlBudget budget;
+  bool skip_deferred;
 } BubbleCallingPrefs;
 
 #include "madcrowlib/madcrow_buffer.h"
@@ -37,14 +41,18 @@ typedef struct
   GraphCache cache;
   bool *const haploid_seen; // used to record which of the haploids we've seen
   // hashmap of OrientedUnitig (uint32_t) -> count (uint32_t)
-  khash_t(uint32to32) *unitig_map;
+  GCacheMap unitig_map;
   GCacheStepPtrBuf spp_forward, spp_reverse;
+  uint64_t *colsets; // colours of the fork node and up to 4 next nodes
 
   dBNodeBuffer flank5p, pathbuf;
   GraphWalker wlk;
   RepeatWalker rptwlk;
 
-  StrBuf output_buf;
+  GzipWriterBuf outbuf; // bubbles are compressed in blocks of text
+  GraphCrawlBudget budget; // prefs->budget, cleared for deferred forks
+  dBNodeBuffer deferred; // forks that went over budget
+  uint64_t num_deferred; // number of forks deferred
   uint64_t num_haploid_bubbles; // number of dropped bubbles in haploid sample
   uint64_t num_serial_bubbles; // how many bubbles were dropped for 'serial'
 
@@ -52,31 +60,43 @@ typedef struct
   uint64_t *nbubbles_ptr; // statistics - shared pointer
   const BubbleCallingPrefs *prefs;
   const dBGraph *db_graph;
-  gzFile gzout;
-  pthread_mutex_t *const out_lock;
+  GzipWriter *gzout;
 } BubbleCaller;
 
 BubbleCaller* bubble_callers_new(size_t num_callers,
                                  const BubbleCallingPrefs *prefs,
-                                 gzFile gzout,
+                                 GzipWriter *gzout,
                                  const dBGraph *db_graph);
 
 void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers);
 
 // `fork_node` is a node with outdegree > 1
-void find_bubbles(BubbleCaller *caller, dBNode fork_node);
+// Returns false if the fork went over caller->budget, leaving the cache
+// incomplete
+bool find_bubbles(BubbleCaller *caller, dBNode fork_node);
 
 // Load GCacheSteps into caller->spp_forward (if they traverse the unitig forward)
 // or caller->spp_reverse (if they traverse the unitig in reverse)
 void find_bubbles_ending_with(BubbleCaller *caller, GCacheUnitig *unitig);
 
-// Run bubble caller, write output to gzout
+// Number of hkey ranges called between checkpoints
+#define BUBBLE_CHECKPOINTS 256
+
+// Run bubble caller, write gzipped output to fout
 // @param hdrs JSON headers of input files
 // @param nhdrs number of JSON headers of input files
+// @param snapshot_path if not NULL, call the hash table in BUBBLE_CHECKPOINTS
+//                      ranges, flushing output and saving `progress` to this
+//                      graph snapshot after each (see graph_snapshot.h)
+// @param progress where to resume from: first hkey, number of bubbles already
+//                 written and output size (header not printed if non-zero).
+//                 May be NULL if snapshot_path is NULL.
 void invoke_bubble_caller(size_t num_of_threads,
                           const BubbleCallingPrefs *prefs,
-                          gzFile gzout, const char *out_path,
+                          FILE *fout, const char *out_path,
                           cJSON **hdrs, size_t nhdrs,
+                          const char *snapshot_path,
+                          SnapshotProgress *progress,
                           const dBGraph *db_graph);
 
 #endif /* BUBBLE_CALLER_H_ */
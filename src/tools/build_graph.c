@@ -2,11 +2,13 @@
 #include "build_graph.h"
 #include "db_graph.h"
 #include "db_node.h"
+#include "db_node_cache.h"
 #include "seq_reader.h"
 #include "async_read_io.h"
 #include "seq_loading_stats.h"
 #include "util.h"
 #include "file_util.h"
+#include "build_partitioned.h"
 
 #include <pthread.h>
 #include "seq_file/seq_file.h"
@@ -19,6 +21,10 @@ typedef struct {
   SeqLoadingStats *stats; // [files]
   size_t nreads;
   volatile size_t *shared_nreads;
+  BuildPartRouter *router; // NULL unless doing a partitioned build
+  BuildContigFunc func; // NULL unless passing contigs to func
+  void **func_args; // [files]
+  dBNodeCache *cache; // NULL unless caching coverage updates
 } BuildGraphThread;
 
 //
@@ -48,7 +54,7 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
   const size_t kmer_size = db_graph->kmer_size;
   size_t start1, start2 = 0;
   bool got_kmer1 = false, got_kmer2 = false;
-  BinaryKmer bkmer1, bkmer2;
+  BinaryKmer bkmer1 = zero_bkmer, bkmer2 = zero_bkmer;
   dBNode node1 = DB_NODE_INIT, node2 = DB_NODE_INIT;
 
   start1 = seq_contig_start(r1, 0, kmer_size, fq_cutoff1, hp_cutoff);
@@ -59,7 +65,20 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
     got_kmer2 = (start2 < r2->seq.end);
   }
 
-  bool found1 = false, found2 = false;
+  // Fingerprint of read starts, kmers are added to the graph as reads load
+  if(db_graph->readstrt_hash != NULL) {
+    if(!got_kmer1 && !got_kmer2) return false;
+    if(got_kmer1) bkmer1 = binary_kmer_from_str(r1->seq.b + start1, kmer_size);
+    if(got_kmer2) bkmer2 = binary_kmer_from_str(r2->seq.b + start2, kmer_size);
+    uint64_t fp = read_start_fingerprint(db_graph->readstrt_hash, kmer_size,
+                                         got_kmer1, bkmer1, got_kmer2, bkmer2);
+    return !read_start_hash_add_mt(db_graph->readstrt_hash, fp);
+  }
+
+  bool found1 = false, found2 = false, novel;
+
+  db_graph_grow_enter(db_graph);
+  size_t gen = db_graph_grow_generation(db_graph);
 
   // Look up first kmer
   if(got_kmer1) {
@@ -73,22 +92,26 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
     node2 = db_graph_find_or_add_node_mt(db_graph, bkmer2, &found2);
   }
 
+  // Graph grew when adding the second kmer
+  if(got_kmer1 && db_graph_grow_generation(db_graph) != gen)
+    node1 = db_graph_find_node_mt(db_graph, bkmer1);
+
   size_t num_kmers_novel = !found1 + !found2;
   __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_novel, num_kmers_novel);
 
   // Each read gives no kmer or a duplicate kmer
   // used find_or_insert so if we have a kmer we have a graph node
-  if((!got_kmer1 || db_node_has_read_start_mt(db_graph, node1)) &&
-     (!got_kmer2 || db_node_has_read_start_mt(db_graph, node2)))
-  {
-    return false;
-  }
+  novel = !((!got_kmer1 || db_node_has_read_start_mt(db_graph, node1)) &&
+            (!got_kmer2 || db_node_has_read_start_mt(db_graph, node2)));
 
   // Read is novel
-  if(got_kmer1) (void)db_node_set_read_start_mt(db_graph, node1);
-  if(got_kmer2) (void)db_node_set_read_start_mt(db_graph, node2);
+  if(novel) {
+    if(got_kmer1) (void)db_node_set_read_start_mt(db_graph, node1);
+    if(got_kmer2) (void)db_node_set_read_start_mt(db_graph, node2);
+  }
 
-  return true;
+  db_graph_grow_leave(db_graph);
+  return novel;
 }
 
 
@@ -96,24 +119,125 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
 // Add to the de bruijn graph
 //
 
-static inline dBNode _find_or_insert(dBGraph *db_graph,
-                                     BinaryKmer bkmer, size_t colour,
-                                     bool must_exist_in_graph, bool *found)
+// Number of kmers we look up in the hash table at once, so bucket fetches
+// from memory can overlap (see db_graph_find_or_add_keys_mt())
+#define BUILD_BATCH_KMERS 64
+
+// Used with --min-count: a kmer is only added to a colour once it has been
+// seen twice. The first sighting goes into the bloom filter and is added back
+// to the coverage when the kmer is added.
+// Returns HASH_NOT_FOUND if this is the first sighting.
+// Sets *found to false if the kmer was added to the graph.
+static inline hkey_t bloom_find_or_add_mt(dBGraph *db_graph, BinaryKmer bkey,
+                                          Colour colour, bool *found)
 {
-  dBNode node;
-  if(must_exist_in_graph)
-  {
-    // Doesn't have to be threadsafe find_mt, since we are not adding
-    node = db_graph_find_node(db_graph, bkmer);
-    *found = (node.key != HASH_NOT_FOUND);
-    if(*found) db_graph_update_node_mt(db_graph, node, colour);
+  dBNode node = db_graph_find_node_mt(db_graph, bkey);
+  *found = true;
+
+  if(node.key != HASH_NOT_FOUND &&
+     (db_graph->col_covgs == NULL ||
+      db_node_get_covg(db_graph, node.key, colour) > 0)) {
+    return node.key;
+  }
+
+  // Not in this colour yet
+  if(!kmer_bloom_add_mt(db_graph->bloom, bkey)) return HASH_NOT_FOUND;
+
+  if(node.key == HASH_NOT_FOUND)
+    node.key = db_graph_find_or_add_key_mt(db_graph, bkey, FORWARD, found).key;
+
+  // Other threads may also have seen coverage of zero. Only the one that moves
+  // the coverage off zero adds back the first sighting.
+  if(db_graph->col_covgs != NULL && db_node_col_has_covg(db_graph, colour)) {
+    __sync_bool_compare_and_swap(&db_node_covg(db_graph, node.key, colour),
+                                 (CovgStore)0, (CovgStore)1);
   }
-  else
+
+  return node.key;
+}
+
+// If `cache` is not NULL, coverage and edges are added to the cache
+static size_t build_graph_from_str_cache_mt(dBGraph *db_graph, size_t colour,
+                                            const char *seq, size_t len,
+                                            bool must_exist_in_graph,
+                                            dBNodeCache *cache)
+{
+  ctx_assert(len >= db_graph->kmer_size);
+  const size_t kmer_size = db_graph->kmer_size, nkmers = len+1-kmer_size;
+  BinaryKmer bkeys[BUILD_BATCH_KMERS], prevkey = zero_bkmer;
+  Orientation orients[BUILD_BATCH_KMERS];
+  Nucleotide nucs[BUILD_BATCH_KMERS];
+  hkey_t hkeys[BUILD_BATCH_KMERS];
+  bool found[BUILD_BATCH_KMERS];
+  dBNode prev = {.key = HASH_NOT_FOUND}, curr;
+  size_t i = 0, j, n, nenc, num_nonnovel_kmers = 0;
+  size_t gen = db_graph_grow_generation(db_graph);
+  size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
+
+  // Roll the kmer and its reverse complement together
+  BinaryKmerIter kiter;
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+
+  while(i < nkmers)
   {
-    node = db_graph_find_or_add_node_mt(db_graph, bkmer, found);
-    db_graph_update_node_mt(db_graph, node, colour);
+    // Get the keys for the next batch of kmers
+    n = MIN2(nkmers - i, BUILD_BATCH_KMERS);
+    nenc = dna_encode_nucs(seq+i+kmer_size-1, n, nucs);
+    ctx_assert2(nenc == n, "Invalid base: %c", seq[i+kmer_size-1+nenc]);
+    (void)nenc;
+    for(j = 0; j < n; j++) {
+      binary_kmer_iter_next(&kiter, nucs[j]);
+      bkeys[j] = binary_kmer_iter_key(&kiter, &orients[j]);
+    }
+    i += n;
+
+    db_graph_grow_enter(db_graph);
+
+    if(must_exist_in_graph) {
+      // Doesn't have to be threadsafe find_mt, since we are not adding
+      for(j = 0; j < n; j++) {
+        hkeys[j] = db_graph_find_key(db_graph, bkeys[j], orients[j]).key;
+        found[j] = (hkeys[j] != HASH_NOT_FOUND);
+      }
+    }
+    else if(db_graph->bloom != NULL) {
+      // First sightings are skipped, but are not novel kmers
+      for(j = 0; j < n; j++)
+        hkeys[j] = bloom_find_or_add_mt(db_graph, bkeys[j], colour, &found[j]);
+    }
+    else db_graph_find_or_add_keys_mt(db_graph, bkeys, n, hkeys, found);
+
+    // hkeys (including prev from the last batch) from before the hash table
+    // grew are no longer valid
+    if(db_graph_grow_generation(db_graph) != gen) {
+      gen = db_graph_grow_generation(db_graph);
+      for(j = 0; j < n; j++)
+        if(hkeys[j] != HASH_NOT_FOUND)
+          hkeys[j] = db_graph_find_node_mt(db_graph, bkeys[j]).key;
+      if(prev.key != HASH_NOT_FOUND)
+        prev.key = db_graph_find_node_mt(db_graph, prevkey).key;
+    }
+
+    for(j = 0; j < n; j++, prev = curr) {
+      curr = (dBNode){.key = hkeys[j], .orient = orients[j]};
+      if(curr.key != HASH_NOT_FOUND && cache != NULL) {
+        db_node_cache_update_node(cache, curr, bkeys[j], colour, 1);
+        if(prev.key != HASH_NOT_FOUND)
+          db_node_cache_add_edge(cache, colour, prev, curr);
+      }
+      else if(curr.key != HASH_NOT_FOUND) {
+        db_graph_update_node_mt(db_graph, curr, colour);
+        if(prev.key != HASH_NOT_FOUND)
+          db_graph_add_edge_mt(db_graph, edge_col, prev, curr);
+      }
+      num_nonnovel_kmers += found[j];
+    }
+
+    db_graph_grow_leave(db_graph);
+    prevkey = bkeys[n-1];
   }
-  return node;
+
+  return num_nonnovel_kmers;
 }
 
 // Threadsafe
@@ -123,52 +247,40 @@ size_t build_graph_from_str_mt(dBGraph *db_graph, size_t colour,
                                const char *seq, size_t len,
                                bool must_exist_in_graph)
 {
-  ctx_assert(len >= db_graph->kmer_size);
-  const size_t kmer_size = db_graph->kmer_size;
-  BinaryKmer bkmer;
-  Nucleotide nuc;
-  dBNode prev, curr;
-  size_t i, num_nonnovel_kmers = 0;
-  size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
-  bool found;
-
-  bkmer = binary_kmer_from_str(seq, kmer_size);
-  prev = _find_or_insert(db_graph, bkmer, colour, must_exist_in_graph, &found);
-  num_nonnovel_kmers += found;
+  return build_graph_from_str_cache_mt(db_graph, colour, seq, len,
+                                       must_exist_in_graph, NULL);
+}
 
-  for(i = kmer_size; i < len; i++, prev = curr)
-  {
-    nuc = dna_char_to_nuc(seq[i]);
-    bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-    curr = _find_or_insert(db_graph, bkmer, colour, must_exist_in_graph, &found);
-    if(prev.key != HASH_NOT_FOUND && curr.key != HASH_NOT_FOUND)
-      db_graph_add_edge_mt(db_graph, edge_col, prev, curr);
-    num_nonnovel_kmers += found;
-  }
+typedef struct {
+  dBGraph *db_graph;
+  Colour colour;
+  bool must_exist_in_graph;
+  dBNodeCache *cache;
+} BuildContigArgs;
 
-  return num_nonnovel_kmers;
+static size_t add_contig_to_graph(const char *seq, size_t len, void *arg)
+{
+  BuildContigArgs *args = (BuildContigArgs*)arg;
+  return build_graph_from_str_cache_mt(args->db_graph, args->colour, seq, len,
+                                       args->must_exist_in_graph, args->cache);
 }
 
 // Already found a start position
 // Stats must be private to this thread
 static void load_read(const read_t *r, uint8_t qual_cutoff, uint8_t hp_cutoff,
-                      bool must_exist_in_graph, Colour colour,
-                      SeqLoadingStats *stats, dBGraph *db_graph)
+                      bool must_exist_in_graph, SeqLoadingStats *stats,
+                      const dBGraph *db_graph, BuildContigFunc func, void *arg)
 {
   const size_t kmer_size = db_graph->kmer_size;
   size_t contig_start, contig_end, contig_len;
   size_t num_contigs = 0, search_start = 0, num_nonnovel_kmers;
 
-  while((contig_start = seq_contig_start(r, search_start, kmer_size,
-                                         qual_cutoff, hp_cutoff)) < r->seq.end)
+  while((contig_start = seq_contig_next(r, search_start, kmer_size,
+                                        qual_cutoff, hp_cutoff,
+                                        &contig_end, &search_start)) < r->seq.end)
   {
-    contig_end = seq_contig_end(r, contig_start, kmer_size,
-                                qual_cutoff, hp_cutoff, &search_start);
-
     contig_len = contig_end - contig_start;
-    num_nonnovel_kmers = build_graph_from_str_mt(db_graph, colour,
-                                                 r->seq.b+contig_start, contig_len,
-                                                 must_exist_in_graph);
+    num_nonnovel_kmers = func(r->seq.b+contig_start, contig_len, arg);
 
     size_t contig_kmers = contig_len + 1 - kmer_size;
     size_t num_novel_kmers = contig_kmers - num_nonnovel_kmers;
@@ -194,6 +306,21 @@ void build_graph_from_reads_mt(read_t *r1, read_t *r2,
                                const SeqLoadingPrefs *prefs,
                                SeqLoadingStats *stats,
                                dBGraph *db_graph)
+{
+  BuildContigArgs args = {.db_graph = db_graph, .colour = prefs->colour,
+                          .must_exist_in_graph = prefs->must_exist_in_graph,
+                          .cache = NULL};
+  build_graph_from_reads_func(r1, r2, fq_offset1, fq_offset2, prefs, stats,
+                              db_graph, add_contig_to_graph, &args);
+}
+
+// Stats must be private to this thread
+void build_graph_from_reads_func(read_t *r1, read_t *r2,
+                                 uint8_t fq_offset1, uint8_t fq_offset2,
+                                 const SeqLoadingPrefs *prefs,
+                                 SeqLoadingStats *stats,
+                                 dBGraph *db_graph,
+                                 BuildContigFunc func, void *arg)
 {
   ctx_assert(!prefs->must_exist_in_graph || !prefs->remove_pcr_dups);
   // status("r1: '%s' '%s'", r1->name.b, r1->seq.b);
@@ -224,12 +351,24 @@ void build_graph_from_reads_mt(read_t *r1, read_t *r2,
   }
   else {
     load_read(r1, fq_cutoff1, prefs->hp_cutoff, prefs->must_exist_in_graph,
-              prefs->colour, stats, db_graph);
+              stats, db_graph, func, arg);
     if(r2) load_read(r2, fq_cutoff2, prefs->hp_cutoff, prefs->must_exist_in_graph,
-                     prefs->colour, stats, db_graph);
+                     stats, db_graph, func, arg);
   }
 }
 
+typedef struct {
+  BuildPartRouter *router;
+  size_t taskid;
+} PartContigArgs;
+
+// Kmers are counted as novel by the partitions, so report all as seen here
+static size_t add_contig_to_partitions(const char *seq, size_t len, void *arg)
+{
+  PartContigArgs *args = (PartContigArgs*)arg;
+  return build_part_router_add(args->router, seq, len, args->taskid);
+}
+
 static void add_reads_to_graph(AsyncIOData *data, size_t threadid, void *ptr)
 {
   (void)threadid;
@@ -237,10 +376,28 @@ static void add_reads_to_graph(AsyncIOData *data, size_t threadid, void *ptr)
   const BuildGraphTask *task = (BuildGraphTask*)data->ptr;
   read_t *r2 = data->r2.name.end == 0 && data->r2.seq.end == 0 ? NULL : &data->r2;
 
-  build_graph_from_reads_mt(&data->r1, r2,
-                            data->fq_offset1, data->fq_offset2,
-                            &task->prefs, wrkr->stats,
-                            wrkr->db_graph);
+  if(wrkr->router != NULL) {
+    PartContigArgs args = {.router = wrkr->router, .taskid = task->idx};
+    build_graph_from_reads_func(&data->r1, r2,
+                                data->fq_offset1, data->fq_offset2,
+                                &task->prefs, wrkr->stats + task->idx,
+                                wrkr->db_graph, add_contig_to_partitions, &args);
+  } else if(wrkr->func != NULL) {
+    build_graph_from_reads_func(&data->r1, r2,
+                                data->fq_offset1, data->fq_offset2,
+                                &task->prefs, wrkr->stats + task->idx,
+                                wrkr->db_graph, wrkr->func,
+                                wrkr->func_args[task->idx]);
+  } else {
+    BuildContigArgs args = {.db_graph = wrkr->db_graph,
+                            .colour = task->prefs.colour,
+                            .must_exist_in_graph = task->prefs.must_exist_in_graph,
+                            .cache = wrkr->cache};
+    build_graph_from_reads_func(&data->r1, r2,
+                                data->fq_offset1, data->fq_offset2,
+                                &task->prefs, wrkr->stats + task->idx,
+                                wrkr->db_graph, add_contig_to_graph, &args);
+  }
 
   // Print progress
   wrkr->nreads++;
@@ -253,11 +410,31 @@ static void add_reads_to_graph(AsyncIOData *data, size_t threadid, void *ptr)
   }
 }
 
+// Coverage updates are cached for the length of a batch of reads
+static void add_batch_to_graph(AsyncIOBatch *batch, size_t threadid, void *ptr)
+{
+  BuildGraphThread *wrkr = (BuildGraphThread*)ptr;
+  size_t i;
+
+  for(i = 0; i < batch->len; i++)
+    add_reads_to_graph(&batch->data[i], threadid, ptr);
+
+  if(wrkr->cache != NULL) {
+    db_graph_grow_enter(wrkr->db_graph);
+    db_node_cache_flush(wrkr->cache);
+    db_graph_grow_leave(wrkr->db_graph);
+  }
+}
+
 // One thread used per input file, nthreads used to add reads to graph
-void build_graph(dBGraph *db_graph, BuildGraphTask *files,
-                 size_t nfiles, size_t nthreads)
+// If `bp` is not NULL, kmers are loaded via partitions
+// If `func` is not NULL, contigs are passed to func with func_args[file]
+static void build_graph_tasks(dBGraph *db_graph, BuildGraphTask *files,
+                              size_t nfiles, size_t nthreads,
+                              BuildPartitions *bp,
+                              BuildContigFunc func, void **func_args)
 {
-  ctx_assert(db_graph->bktlocks != NULL);
+  ctx_assert(func != NULL || db_graph->bktlocks != NULL);
 
   // Start async io reading
   AsyncIOInput *async_tasks = ctx_malloc(nfiles * sizeof(AsyncIOInput));
@@ -270,16 +447,59 @@ void build_graph(dBGraph *db_graph, BuildGraphTask *files,
   }
 
   BuildGraphThread *threads = ctx_calloc(nthreads, sizeof(BuildGraphThread));
+  BuildPartRouter *routers = NULL;
+  dBNodeCache *caches = NULL;
   size_t total_nreads = 0;
 
+  // Sum repeated coverage updates on each thread before writing them. Not with
+  // a bloom filter, which reads coverages to spot first sightings.
+  if(bp == NULL && func == NULL && db_graph->bloom == NULL) {
+    caches = ctx_calloc(nthreads, sizeof(dBNodeCache));
+    for(i = 0; i < nthreads; i++)
+      db_node_cache_alloc(&caches[i], db_graph, DB_NODE_CACHE_SLOTS);
+  }
+
+  if(bp != NULL) {
+    routers = ctx_calloc(nthreads, sizeof(BuildPartRouter));
+    build_partitions_start(bp, files[0].prefs.colour, nfiles);
+  }
+
   for(i = 0; i < nthreads; i++) {
     threads[i].stats = ctx_calloc(nfiles, sizeof(SeqLoadingStats));
     threads[i].db_graph = db_graph;
     threads[i].shared_nreads = &total_nreads;
+    threads[i].func = func;
+    threads[i].func_args = func_args;
+    if(bp != NULL) {
+      build_part_router_alloc(&routers[i], bp);
+      threads[i].router = &routers[i];
+    }
+    if(caches != NULL) threads[i].cache = &caches[i];
   }
 
-  asyncio_run_pool(async_tasks, nfiles, add_reads_to_graph,
-                   threads, nthreads, sizeof(BuildGraphThread));
+  asyncio_run_batch_pool(async_tasks, nfiles, add_batch_to_graph,
+                         threads, nthreads, sizeof(BuildGraphThread));
+
+  if(caches != NULL) {
+    for(i = 0; i < nthreads; i++) db_node_cache_dealloc(&caches[i]);
+    ctx_free(caches);
+  }
+
+  // Inputs may have been reopened for decompression threads
+  for(f = 0; f < nfiles; f++) {
+    files[f].files.file1 = async_tasks[f].file1;
+    files[f].files.file2 = async_tasks[f].file2;
+  }
+
+  if(bp != NULL) {
+    size_t *novel = ctx_calloc(nfiles, sizeof(size_t));
+    for(i = 0; i < nthreads; i++) build_part_router_flush(&routers[i]);
+    build_partitions_finish(bp, nthreads, novel);
+    for(f = 0; f < nfiles; f++) files[f].stats.num_kmers_novel += novel[f];
+    for(i = 0; i < nthreads; i++) build_part_router_dealloc(&routers[i]);
+    ctx_free(novel);
+    ctx_free(routers);
+  }
 
   // Merge stats
   for(i = 0; i < nthreads; i++) {
@@ -300,6 +520,83 @@ void build_graph(dBGraph *db_graph, BuildGraphTask *files,
   db_graph->num_of_cols_used = MAX2(db_graph->num_of_cols_used, max_col+1);
 }
 
+// One thread used per input file, nthreads used to add reads to graph
+void build_graph(dBGraph *db_graph, BuildGraphTask *files,
+                 size_t nfiles, size_t nthreads)
+{
+  build_graph_tasks(db_graph, files, nfiles, nthreads, NULL, NULL, NULL);
+}
+
+typedef struct
+{
+  size_t nkmers, idx;
+} BuildTaskSize;
+
+// Sort largest first, keeping input order for ties
+static int _build_task_size_cmp(const void *aa, const void *bb)
+{
+  const BuildTaskSize *a = (const BuildTaskSize*)aa;
+  const BuildTaskSize *b = (const BuildTaskSize*)bb;
+  if(a->nkmers != b->nkmers) return a->nkmers > b->nkmers ? -1 : 1;
+  return cmp(a->idx, b->idx);
+}
+
+// Read MAX_IO_THREADS files at a time, largest first
+void build_graph_scheduled(dBGraph *db_graph, BuildGraphTask *files,
+                           size_t nfiles, size_t nthreads)
+{
+  if(nfiles == 0) return;
+
+  BuildTaskSize *sizes = ctx_malloc(nfiles * sizeof(BuildTaskSize));
+  BuildGraphTask *sorted = ctx_malloc(nfiles * sizeof(BuildGraphTask));
+  size_t f, max_open = asyncio_get_max_open();
+
+  for(f = 0; f < nfiles; f++)
+    sizes[f] = (BuildTaskSize){.nkmers = asyncio_input_nkmers(&files[f].files),
+                               .idx = f};
+
+  qsort(sizes, nfiles, sizeof(BuildTaskSize), _build_task_size_cmp);
+
+  for(f = 0; f < nfiles; f++)
+    memcpy(&sorted[f], &files[sizes[f].idx], sizeof(BuildGraphTask));
+
+  asyncio_set_max_open(MAX_IO_THREADS);
+  build_graph(db_graph, sorted, nfiles, nthreads);
+  asyncio_set_max_open(max_open);
+
+  // Copy back stats and reopened files
+  for(f = 0; f < nfiles; f++)
+    memcpy(&files[sizes[f].idx], &sorted[f], sizeof(BuildGraphTask));
+
+  ctx_free(sorted);
+  ctx_free(sizes);
+}
+
+// One thread used per input file, nthreads used to pass contigs to func
+// Updates ginfo
+void build_graph_func(dBGraph *db_graph, BuildGraphTask *files,
+                      size_t nfiles, size_t nthreads,
+                      BuildContigFunc func, void **func_args)
+{
+  build_graph_tasks(db_graph, files, nfiles, nthreads, NULL, func, func_args);
+}
+
+// One thread used per input file, nthreads used to route reads to partitions
+// All tasks must load into the same colour and not use must_exist_in_graph
+// Updates ginfo
+void build_graph_partitioned(dBGraph *db_graph, BuildPartitions *bp,
+                             BuildGraphTask *files, size_t nfiles,
+                             size_t nthreads)
+{
+  size_t f;
+  for(f = 0; f < nfiles; f++) {
+    ctx_assert(files[f].prefs.colour == files[0].prefs.colour);
+    ctx_assert(!files[f].prefs.must_exist_in_graph);
+  }
+  if(nfiles > 0)
+    build_graph_tasks(db_graph, files, nfiles, nthreads, bp, NULL, NULL);
+}
+
 // One thread used per input file, nthreads used to add reads to graph
 // Updates ginfo
 void build_graph_from_seq(dBGraph *db_graph,
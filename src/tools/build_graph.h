@@ -14,6 +14,7 @@
 #include "seq_reader.h"
 #include "async_read_io.h"
 #include "seq_loading_stats.h"
+#include "build_partitioned.h"
 
 typedef struct
 {
@@ -60,11 +61,49 @@ void build_graph_from_reads_mt(read_t *r1, read_t *r2,
                                SeqLoadingStats *stats,
                                dBGraph *db_graph);
 
+// Called on each contig of a read that passes filtering
+// Sequence is entirely ACGT and len >= kmer_size
+// Returns number of non-novel kmers seen
+typedef size_t (*BuildContigFunc)(const char *seq, size_t len, void *arg);
+
+// As build_graph_from_reads_mt() but passes contigs to `func` instead of
+// adding them to the graph. PCR duplicate removal still uses db_graph.
+void build_graph_from_reads_func(read_t *r1, read_t *r2,
+                                 uint8_t fq_offset1, uint8_t fq_offset2,
+                                 const SeqLoadingPrefs *prefs,
+                                 SeqLoadingStats *stats,
+                                 dBGraph *db_graph,
+                                 BuildContigFunc func, void *arg);
+
 // One thread used per input file, num_build_threads used to add reads to graph
 // Updates ginfo
 void build_graph(dBGraph *db_graph, BuildGraphTask *files,
                  size_t num_files, size_t num_build_threads);
 
+// As build_graph() but for any number of files, which may load into different
+// colours. Files are read MAX_IO_THREADS at a time, largest first, and each
+// reader thread starts on the next file as soon as it finishes one, so small
+// files don't leave threads idle waiting for a batch to finish.
+// Updates ginfo
+void build_graph_scheduled(dBGraph *db_graph, BuildGraphTask *files,
+                           size_t num_files, size_t num_build_threads);
+
+// One thread used per input file, num_build_threads used to pass the contigs
+// of reads to `func`, which must be threadsafe. Contigs from files[i] are
+// passed with func_args[i]. PCR duplicate removal still uses db_graph.
+// Updates ginfo
+void build_graph_func(dBGraph *db_graph, BuildGraphTask *files,
+                      size_t num_files, size_t num_build_threads,
+                      BuildContigFunc func, void **func_args);
+
+// One thread used per input file, num_build_threads used to route reads to
+// partitions (see build_partitioned.h), which are then merged into db_graph.
+// All tasks must load into the same colour and not use must_exist_in_graph
+// Updates ginfo
+void build_graph_partitioned(dBGraph *db_graph, BuildPartitions *bp,
+                             BuildGraphTask *files, size_t num_files,
+                             size_t num_build_threads);
+
 // One thread used per input file, num_build_threads used to add reads to graph
 // Updates ginfo
 void build_graph_from_seq(dBGraph *db_graph, seq_file_t **files,
@@ -0,0 +1,554 @@
+#include "global.h"
+#include "build_partitioned.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "util.h"
+
+#include <pthread.h>
+
+// Super-kmer message header, followed by nbases ACGT characters
+typedef struct
+{
+  uint32_t taskid, nbases;
+  uint8_t flank; // PART_FLANK_* bits set if first/last base is a flank
+} PartMsgHdr;
+
+#define PART_FLANK_PREV 1
+#define PART_FLANK_NEXT 2
+#define PART_MSG_HDR_SIZE (2*sizeof(uint32_t)+sizeof(uint8_t))
+
+// Number of kmers we look up in the main graph at once when merging
+#define PART_MERGE_BATCH 64
+
+// Spill files are a series of blocks: a SpillHdr then `nbytes` of super-kmer
+// messages for that colour
+typedef struct
+{
+  uint32_t colour, nbytes;
+} SpillHdr;
+
+// Number of message buffers each router holds
+#define router_nbufs(bp) ((bp)->spill ? (bp)->nshards : (bp)->nparts)
+
+void build_partitions_alloc(BuildPartitions *bp, dBGraph *db_graph,
+                            size_t nparts)
+{
+  ctx_assert(nparts > 0);
+  size_t i, j, capacity;
+  capacity = BUILD_PART_CAPACITY(db_graph->ht.capacity, nparts);
+
+  memset(bp, 0, sizeof(*bp));
+  bp->db_graph = db_graph;
+  bp->nparts = nparts;
+  bp->mmer_len = MIN2(db_graph->kmer_size, BUILD_PART_MMER);
+  bp->shard = 0;
+  bp->nshards = 1;
+  bp->spill = NULL;
+  bp->parts = ctx_calloc(nparts, sizeof(BuildPartition));
+
+  status("[build] Allocating %zu partitions", nparts);
+
+  for(i = 0; i < nparts; i++) {
+    BuildPartition *part = &bp->parts[i];
+    hash_table_alloc(&part->ht, capacity);
+    part->covgs = ctx_calloc(part->ht.capacity, sizeof(Covg));
+    part->edges = ctx_calloc(part->ht.capacity, sizeof(Edges));
+    part->bufs = ctx_calloc(BUILD_PART_NSLOTS, sizeof(ByteBuffer));
+    for(j = 0; j < BUILD_PART_NSLOTS; j++)
+      byte_buf_alloc(&part->bufs[j], BUILD_PART_MSG_BYTES*2);
+    part->bp = bp;
+  }
+}
+
+void build_partitions_dealloc(BuildPartitions *bp)
+{
+  size_t i, j;
+  for(i = 0; i < bp->nparts; i++) {
+    BuildPartition *part = &bp->parts[i];
+    for(j = 0; j < BUILD_PART_NSLOTS; j++) byte_buf_dealloc(&part->bufs[j]);
+    ctx_free(part->bufs);
+    ctx_free(part->covgs);
+    ctx_free(part->edges);
+    hash_table_dealloc(&part->ht);
+  }
+  ctx_free(bp->parts);
+  memset(bp, 0, sizeof(*bp));
+}
+
+void build_partitions_set_shard(BuildPartitions *bp, size_t shard,
+                                size_t nshards)
+{
+  ctx_assert(shard < nshards);
+  bp->shard = shard;
+  bp->nshards = nshards;
+}
+
+void build_partitions_set_spill(BuildPartitions *bp, FILE **spill,
+                                size_t nshards)
+{
+  ctx_assert(nshards > 0);
+  bp->spill = spill;
+  bp->shard = 0;
+  bp->nshards = nshards;
+}
+
+//
+// Routing
+//
+
+// Partition is picked with the low bits of the minimizer hash, shard with the
+// high bits (graph_shard_of_hash), so that every shard uses all partitions
+#define PART_SKIP SIZE_MAX
+
+void build_part_router_alloc(BuildPartRouter *rtr, BuildPartitions *bp)
+{
+  size_t i;
+  rtr->bp = bp;
+  rtr->bufs = ctx_calloc(router_nbufs(bp), sizeof(ByteBuffer));
+  for(i = 0; i < router_nbufs(bp); i++)
+    byte_buf_alloc(&rtr->bufs[i], BUILD_PART_MSG_BYTES*2);
+}
+
+void build_part_router_dealloc(BuildPartRouter *rtr)
+{
+  size_t i;
+  for(i = 0; i < router_nbufs(rtr->bp); i++) byte_buf_dealloc(&rtr->bufs[i]);
+  ctx_free(rtr->bufs);
+  memset(rtr, 0, sizeof(*rtr));
+}
+
+// Append a router's messages for shard p to the shard's spill file
+static void router_spill(BuildPartRouter *rtr, size_t p)
+{
+  ByteBuffer *buf = &rtr->bufs[p];
+  FILE *fh = rtr->bp->spill[p];
+  SpillHdr hdr = {.colour = (uint32_t)rtr->bp->colour,
+                  .nbytes = (uint32_t)buf->len};
+  flockfile(fh);
+  if(fwrite(&hdr, sizeof(hdr), 1, fh) != 1 ||
+     fwrite(buf->b, 1, buf->len, fh) != buf->len)
+    die("Cannot write to spill file: %s", strerror(errno));
+  funlockfile(fh);
+  byte_buf_reset(buf);
+}
+
+// Copy a router's messages for partition p into the partition's queue
+static void router_send(BuildPartRouter *rtr, size_t p)
+{
+  ByteBuffer *buf = &rtr->bufs[p], *dst;
+  if(buf->len == 0) return;
+  if(rtr->bp->spill) { router_spill(rtr, p); return; }
+  MsgPool *pool = &rtr->bp->parts[p].pool;
+  int pos;
+  ctx_stats_time(CTX_STAT_MSGPOOL_WRITE_NS, pos = msgpool_claim_write(pool));
+  memcpy(&dst, msgpool_get_ptr(pool, pos), sizeof(ByteBuffer*));
+  byte_buf_reset(dst);
+  byte_buf_append(dst, buf);
+  msgpool_release(pool, pos, MPOOL_FULL);
+  byte_buf_reset(buf);
+}
+
+void build_part_router_flush(BuildPartRouter *rtr)
+{
+  size_t p;
+  for(p = 0; p < router_nbufs(rtr->bp); p++) router_send(rtr, p);
+}
+
+// Queue kmers start..end-1 of seq[0..len-1] for partition p, with flanks
+static void router_add_superkmer(BuildPartRouter *rtr, size_t p, size_t taskid,
+                                 const char *seq, size_t len,
+                                 size_t start, size_t end)
+{
+  const size_t kmer_size = rtr->bp->db_graph->kmer_size;
+  bool prev = (start > 0), next = (end+kmer_size-1 < len);
+  const char *bases = seq + start - prev;
+  ByteBuffer *buf = &rtr->bufs[p];
+
+  PartMsgHdr hdr = {.taskid = (uint32_t)taskid,
+                    .nbases = (uint32_t)(end-start+kmer_size-1+prev+next),
+                    .flank = (prev ? PART_FLANK_PREV : 0) |
+                             (next ? PART_FLANK_NEXT : 0)};
+
+  byte_buf_capacity(buf, buf->len + PART_MSG_HDR_SIZE + hdr.nbases);
+  memcpy(buf->b+buf->len, &hdr.taskid, sizeof(uint32_t));
+  memcpy(buf->b+buf->len+sizeof(uint32_t), &hdr.nbases, sizeof(uint32_t));
+  buf->b[buf->len+2*sizeof(uint32_t)] = hdr.flank;
+  memcpy(buf->b+buf->len+PART_MSG_HDR_SIZE, bases, hdr.nbases);
+  buf->len += PART_MSG_HDR_SIZE + hdr.nbases;
+
+  if(buf->len >= BUILD_PART_MSG_BYTES) router_send(rtr, p);
+}
+
+// Threadsafe if each thread uses its own router
+// Sequence must be entirely ACGT and len >= kmer_size
+// Returns number of kmers in the contig
+size_t build_part_router_add(BuildPartRouter *rtr, const char *seq, size_t len,
+                             size_t taskid)
+{
+  const BuildPartitions *bp = rtr->bp;
+  const size_t kmer_size = bp->db_graph->kmer_size, m = bp->mmer_len;
+  const size_t w = kmer_size - m + 1; // number of mmers per kmer
+  const uint64_t mask = (m == 32 ? UINT64_MAX : ((uint64_t)1 << (2*m)) - 1);
+
+  ctx_assert(len >= kmer_size);
+  ctx_assert(m <= 32);
+
+  uint64_t fw = 0, rv = 0, h, minh = UINT64_MAX, ring[MAX_KMER_SIZE];
+  size_t b, i, j, t, minpos = 0, start = 0, p, curr = 0, nkmers = 0;
+  Nucleotide nuc;
+
+  for(b = 0; b < len; b++)
+  {
+    nuc = dna_char_to_nuc(seq[b]);
+    fw = ((fw << 2) | nuc) & mask;
+    rv = (rv >> 2) | ((uint64_t)dna_nuc_complement(nuc) << (2*(m-1)));
+    if(b+1 < m) continue;
+
+    // mmer j ends at base b
+    j = b+1-m;
+    h = ring[j % w] = graph_shard_mmer_hash(MIN2(fw, rv));
+
+    if(minpos + w <= j) {
+      // Minimizer has left the window, rescan mmers j-w+1..j
+      minh = UINT64_MAX;
+      for(t = j+1-w; t <= j; t++) {
+        if(ring[t % w] < minh) { minh = ring[t % w]; minpos = t; }
+      }
+    }
+    else if(h < minh) { minh = h; minpos = j; }
+
+    if(b+1 < kmer_size) continue;
+
+    // kmer i ends at base b
+    i = b+1-kmer_size;
+    if(bp->spill) p = graph_shard_of_hash(minh, bp->nshards);
+    else if(bp->nshards > 1 && graph_shard_of_hash(minh, bp->nshards) != bp->shard)
+      p = PART_SKIP;
+    else p = minh % bp->nparts;
+    if(i == 0) curr = p;
+    else if(p != curr) {
+      if(curr != PART_SKIP) {
+        router_add_superkmer(rtr, curr, taskid, seq, len, start, i);
+        nkmers += i - start;
+      }
+      start = i;
+      curr = p;
+    }
+  }
+
+  size_t end = len+1-kmer_size;
+  if(curr != PART_SKIP) {
+    router_add_superkmer(rtr, curr, taskid, seq, len, start, end);
+    nkmers += end - start;
+  }
+  return nkmers;
+}
+
+//
+// Partition threads
+//
+
+// The partition is full (minimizers are not spread evenly), so add the kmer
+// bases[i..i+k-1] straight to the main graph instead. A kmer only ever comes to
+// one partition, but other partitions may be updating the main graph too.
+static void partition_overflow_kmer(BuildPartition *part, const PartMsgHdr *hdr,
+                                    const char *bases, size_t i,
+                                    BinaryKmer bkey, Orientation orient)
+{
+  dBGraph *db_graph = part->bp->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  const Colour colour = part->bp->colour;
+  const size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
+  Nucleotide nuc;
+  bool found;
+
+  dBNode node = db_graph_find_or_add_key_mt(db_graph, bkey, orient, &found);
+  if(!found) part->novel[hdr->taskid]++;
+  part->num_overflow++;
+
+  db_graph_update_node_mt(db_graph, node, colour);
+
+  if(db_graph->col_edges == NULL) return;
+  if(i > 0) {
+    nuc = dna_nuc_complement(dna_char_to_nuc(bases[i-1]));
+    db_node_set_col_edge_mt(db_graph, node.key, edge_col, nuc, !orient);
+  }
+  if(i+kmer_size < hdr->nbases) {
+    nuc = dna_char_to_nuc(bases[i+kmer_size]);
+    db_node_set_col_edge_mt(db_graph, node.key, edge_col, nuc, orient);
+  }
+}
+
+static void partition_add_superkmer(BuildPartition *part, const PartMsgHdr *hdr,
+                                    const char *bases)
+{
+  dBGraph *db_graph = part->bp->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  size_t i, end = hdr->nbases - !!(hdr->flank & PART_FLANK_NEXT);
+  BinaryKmerIter kiter;
+  BinaryKmer bkey;
+  Orientation orient;
+  Nucleotide nuc;
+  hkey_t hkey;
+  bool found;
+
+  i = !!(hdr->flank & PART_FLANK_PREV);
+  binary_kmer_iter_init(&kiter, bases+i, kmer_size);
+
+  for(; i+kmer_size <= end; i++)
+  {
+    binary_kmer_iter_next(&kiter, dna_char_to_nuc(bases[i+kmer_size-1]));
+    bkey = binary_kmer_iter_key(&kiter, &orient);
+    hkey = hash_table_try_find_or_insert(&part->ht, bkey, &found);
+
+    if(hkey == HASH_NOT_FOUND) {
+      partition_overflow_kmer(part, hdr, bases, i, bkey, orient);
+      continue;
+    }
+
+    // First time we've seen this kmer in this pass, is it in the main graph?
+    // Other threads may be adding read starts, so use a threadsafe lookup
+    if(!found && db_graph_find_node_mt(db_graph, bkey).key == HASH_NOT_FOUND)
+      part->novel[hdr->taskid]++;
+
+    SAFE_SUM_COVG(part->covgs[hkey], 1);
+
+    // Each partition sets the edges of its own kmers in both directions
+    if(i > 0) {
+      nuc = dna_nuc_complement(dna_char_to_nuc(bases[i-1]));
+      part->edges[hkey] = edges_set_edge(part->edges[hkey], nuc, !orient);
+    }
+    if(i+kmer_size < hdr->nbases) {
+      nuc = dna_char_to_nuc(bases[i+kmer_size]);
+      part->edges[hkey] = edges_set_edge(part->edges[hkey], nuc, orient);
+    }
+  }
+}
+
+static void* partition_thread(void *arg)
+{
+  BuildPartition *part = (BuildPartition*)arg;
+  ByteBuffer *buf;
+  PartMsgHdr hdr;
+  size_t pos;
+  int slot;
+
+  while(1)
+  {
+    ctx_stats_time(CTX_STAT_MSGPOOL_READ_NS,
+                   slot = msgpool_claim_read(&part->pool));
+    if(slot == -1) break;
+    memcpy(&buf, msgpool_get_ptr(&part->pool, slot), sizeof(ByteBuffer*));
+    for(pos = 0; pos < buf->len; pos += PART_MSG_HDR_SIZE + hdr.nbases) {
+      memcpy(&hdr.taskid, buf->b+pos, sizeof(uint32_t));
+      memcpy(&hdr.nbases, buf->b+pos+sizeof(uint32_t), sizeof(uint32_t));
+      hdr.flank = buf->b[pos+2*sizeof(uint32_t)];
+      partition_add_superkmer(part, &hdr,
+                              (const char*)buf->b+pos+PART_MSG_HDR_SIZE);
+    }
+    msgpool_release(&part->pool, slot, MPOOL_EMPTY);
+  }
+
+  return NULL;
+}
+
+static void partition_pool_init(char *el, size_t idx, void *args)
+{
+  ByteBuffer *bufs = (ByteBuffer*)args, *ptr = &bufs[idx];
+  memcpy(el, &ptr, sizeof(ByteBuffer*));
+}
+
+// Start one thread per partition, ready to load kmers into `colour`
+// `ntasks` is the number of input tasks that novel kmers are counted against
+void build_partitions_start(BuildPartitions *bp, Colour colour, size_t ntasks)
+{
+  ctx_assert(colour < bp->db_graph->num_of_cols);
+  size_t i;
+  int rc;
+
+  bp->colour = colour;
+  bp->ntasks = ntasks;
+  if(bp->spill) return;
+
+  for(i = 0; i < bp->nparts; i++) {
+    BuildPartition *part = &bp->parts[i];
+    part->novel = ctx_calloc(ntasks, sizeof(size_t));
+    part->num_overflow = 0;
+    msgpool_alloc(&part->pool, BUILD_PART_NSLOTS, sizeof(ByteBuffer*),
+                  USE_MSG_POOL);
+    msgpool_iterate(&part->pool, partition_pool_init, part->bufs);
+    rc = pthread_create(&part->thread, NULL, partition_thread, part);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+}
+
+//
+// Merge partitions into the main graph
+//
+
+typedef struct
+{
+  BuildPartition *part;
+  BinaryKmer bkeys[PART_MERGE_BATCH];
+  hkey_t phkeys[PART_MERGE_BATCH]; // hkeys in the partition
+  size_t n;
+} PartMerge;
+
+static void merge_batch(PartMerge *mrg)
+{
+  BuildPartition *part = mrg->part;
+  dBGraph *db_graph = part->bp->db_graph;
+  const Colour colour = part->bp->colour;
+  const size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
+  hkey_t hkeys[PART_MERGE_BATCH], phkey;
+  bool found[PART_MERGE_BATCH];
+  size_t i;
+
+  db_graph_find_or_add_keys_mt(db_graph, mrg->bkeys, mrg->n, hkeys, found);
+
+  // A kmer is only in one partition, so no other thread will update this
+  // node's coverage or edges. node_in_cols is a bitset so needs to be atomic.
+  for(i = 0; i < mrg->n; i++) {
+    phkey = mrg->phkeys[i];
+    if(db_graph->col_covgs != NULL)
+      db_node_add_col_covg(db_graph, hkeys[i], colour, part->covgs[phkey]);
+    if(db_graph->col_edges != NULL)
+      db_node_edges(db_graph, hkeys[i], edge_col) |= part->edges[phkey];
+    if(db_graph->node_in_cols != NULL)
+      db_node_set_col_mt(db_graph, hkeys[i], colour);
+  }
+
+  mrg->n = 0;
+}
+
+static inline void merge_kmer(hkey_t hkey, PartMerge *mrg)
+{
+  mrg->phkeys[mrg->n] = hkey;
+  mrg->bkeys[mrg->n] = hash_table_fetch(&mrg->part->ht, hkey);
+  if(++mrg->n == PART_MERGE_BATCH) merge_batch(mrg);
+}
+
+static void merge_partition(void *arg, size_t threadid)
+{
+  (void)threadid;
+  BuildPartition *part = (BuildPartition*)arg;
+  PartMerge mrg = {.part = part, .n = 0};
+
+  HASH_ITERATE(&part->ht, merge_kmer, &mrg);
+  merge_batch(&mrg);
+
+  // Empty ready for the next load
+  hash_table_empty(&part->ht);
+  memset(part->covgs, 0, part->ht.capacity * sizeof(Covg));
+  memset(part->edges, 0, part->ht.capacity * sizeof(Edges));
+}
+
+// Wait for partition threads to finish, then copy kmers into the main graph
+// using `nthreads` threads and empty the partitions.
+// All routers must have been flushed.
+// Adds number of novel kmers per task to novel[0..ntasks-1] (may be NULL)
+void build_partitions_finish(BuildPartitions *bp, size_t nthreads,
+                             size_t *novel)
+{
+  size_t i, t;
+  int rc;
+
+  if(bp->spill) {
+    for(i = 0; i < bp->nshards; i++)
+      if(fflush(bp->spill[i]) != 0)
+        die("Cannot write to spill file: %s", strerror(errno));
+    return;
+  }
+
+  for(i = 0; i < bp->nparts; i++) {
+    BuildPartition *part = &bp->parts[i];
+    msgpool_close(&part->pool);
+    rc = pthread_join(part->thread, NULL);
+    if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+    msgpool_dealloc(&part->pool);
+  }
+
+  util_run_threads(bp->parts, bp->nparts, sizeof(BuildPartition),
+                   nthreads, merge_partition);
+
+  for(i = 0; i < bp->nparts; i++) {
+    if(bp->parts[i].num_overflow > 0) {
+      status("[build] Partition %zu filled up, %zu kmers added to the graph "
+             "directly", i, bp->parts[i].num_overflow);
+    }
+    if(novel != NULL)
+      for(t = 0; t < bp->ntasks; t++) novel[t] += bp->parts[i].novel[t];
+    ctx_free(bp->parts[i].novel);
+    bp->parts[i].novel = NULL;
+  }
+}
+
+//
+// Loading spilled shards
+//
+
+// Route one block of spilled messages to the partitions
+static size_t spill_route_block(BuildPartRouter *rtr, const uint8_t *b,
+                                size_t len)
+{
+  PartMsgHdr hdr;
+  size_t pos, nkmers = 0;
+  for(pos = 0; pos < len; pos += PART_MSG_HDR_SIZE + hdr.nbases) {
+    memcpy(&hdr.taskid, b+pos, sizeof(uint32_t));
+    memcpy(&hdr.nbases, b+pos+sizeof(uint32_t), sizeof(uint32_t));
+    ctx_assert(pos + PART_MSG_HDR_SIZE + hdr.nbases <= len);
+    // Flanking kmers are in other shards so are skipped by the router, but
+    // still give the edges of the kmers next to them
+    nkmers += build_part_router_add(rtr, (const char*)b+pos+PART_MSG_HDR_SIZE,
+                                    hdr.nbases, 0);
+  }
+  return nkmers;
+}
+
+size_t build_partitions_load_spill(BuildPartitions *bp, FILE *fh,
+                                   size_t shard, size_t nshards,
+                                   size_t nthreads)
+{
+  BuildPartRouter rtr;
+  ByteBuffer buf;
+  SpillHdr hdr;
+  size_t nkmers = 0;
+  bool started = false;
+
+  bp->spill = NULL;
+  build_partitions_set_shard(bp, shard, nshards);
+  byte_buf_alloc(&buf, BUILD_PART_MSG_BYTES*2);
+
+  if(fflush(fh) != 0 || fseek(fh, 0, SEEK_SET) != 0)
+    die("Cannot rewind spill file: %s", strerror(errno));
+
+  while(fread(&hdr, sizeof(hdr), 1, fh) == 1)
+  {
+    if(started && hdr.colour != bp->colour) {
+      build_part_router_flush(&rtr);
+      build_part_router_dealloc(&rtr);
+      build_partitions_finish(bp, nthreads, NULL);
+      started = false;
+    }
+    if(!started) {
+      build_partitions_start(bp, hdr.colour, 1);
+      build_part_router_alloc(&rtr, bp);
+      started = true;
+    }
+    byte_buf_capacity(&buf, hdr.nbytes);
+    if(fread(buf.b, 1, hdr.nbytes, fh) != hdr.nbytes)
+      die("Cannot read spill file: %s", ferror(fh) ? strerror(errno) : "EOF");
+    nkmers += spill_route_block(&rtr, buf.b, hdr.nbytes);
+  }
+
+  if(ferror(fh)) die("Cannot read spill file: %s", strerror(errno));
+
+  if(started) {
+    build_part_router_flush(&rtr);
+    build_part_router_dealloc(&rtr);
+    build_partitions_finish(bp, nthreads, NULL);
+  }
+
+  byte_buf_dealloc(&buf);
+  return nkmers;
+}
@@ -0,0 +1,126 @@
+#ifndef BUILD_PARTITIONED_H_
+#define BUILD_PARTITIONED_H_
+
+//
+// Minimizer partitioned graph construction (build --partitioned)
+//
+// Each kmer is routed to one of P partitions by the hash of its canonical
+// minimizer. Runs of consecutive kmers in the same partition (super-kmers) are
+// sent as sequence, with one flanking base either side for the edges, to a
+// thread that owns that partition. Each partition thread inserts into its own
+// small hash table without any locking. Once the input is loaded, partitions
+// are copied into the main graph in parallel and emptied ready for reuse.
+//
+// A kmer and its reverse complement always have the same minimizer, so each
+// kmer is stored in exactly one partition.
+//
+// Sharding (build --shard i/N) splits the kmers between N separate runs, e.g.
+// on different machines, using other bits of the same minimizer hash (see
+// graph_shards.h). Each run only routes the kmers of its own shard. Edges to
+// kmers in other shards are kept, so the sorted shard graphs merge
+// (join --sorted-merge) into the graph that one run would have built.
+//
+// Spilling (build --shards N) writes the super-kmers of each shard to its own
+// file instead of loading them, then shards are loaded one at a time with
+// build_partitions_load_spill().
+//
+
+#include "msg-pool/msgpool.h"
+
+#include "cortex_types.h"
+#include "db_graph.h"
+#include "common_buffers.h"
+#include "graph_shards.h"
+
+// Minimizer length (shortened to kmer size for small k)
+#define BUILD_PART_MMER GRAPH_SHARD_MMER
+
+// Bytes of super-kmers a router collects before passing them to a partition
+#define BUILD_PART_MSG_BYTES (1<<14)
+
+// Number of message buffers queued per partition
+#define BUILD_PART_NSLOTS 4
+
+// Partitions are allowed a share of the main hash table capacity * 5/4,
+// to allow for uneven partition sizes. Kmers that don't fit in a full
+// partition are added to the main graph directly, with locking.
+#define BUILD_PART_CAPACITY(cap,nparts) (((cap)*5/4)/(nparts)+1)
+
+// Memory used by partitions, to be added to the bits per kmer of the graph
+#define BUILD_PART_BITS_PER_KMER \
+        (((sizeof(BinaryKmer)+sizeof(Covg)+sizeof(Edges))*8*5)/4)
+
+typedef struct
+{
+  HashTable ht;
+  Covg *covgs;
+  Edges *edges;
+  MsgPool pool; // ByteBuffer* of super-kmers arriving from routers
+  ByteBuffer *bufs; // [BUILD_PART_NSLOTS] buffers held by the pool
+  size_t *novel; // [ntasks] number of novel kmers seen from each task
+  size_t num_overflow; // kmers added to the main graph as partition was full
+  pthread_t thread;
+  const struct BuildPartitionsStruct *bp;
+} BuildPartition;
+
+typedef struct BuildPartitionsStruct
+{
+  dBGraph *db_graph;
+  size_t nparts, mmer_len, ntasks;
+  size_t shard, nshards; // only keep kmers in shard (0..nshards-1)
+  FILE **spill; // [nshards] if not NULL, write super-kmers to their shard file
+  Colour colour;
+  BuildPartition *parts;
+} BuildPartitions;
+
+// Used by a single thread to send contigs to the partitions
+typedef struct
+{
+  BuildPartitions *bp;
+  ByteBuffer *bufs; // [nparts] messages being filled, copied into the pool
+} BuildPartRouter;
+
+// Partitions are sized from the capacity of db_graph
+void build_partitions_alloc(BuildPartitions *bp, dBGraph *db_graph,
+                            size_t nparts);
+void build_partitions_dealloc(BuildPartitions *bp);
+
+// Only load kmers of shard `shard` (0 <= shard < nshards)
+void build_partitions_set_shard(BuildPartitions *bp, size_t shard,
+                                size_t nshards);
+
+// Instead of loading kmers, write super-kmers to spill[0..nshards-1] by shard.
+// Partition threads are not started and nothing is added to the graph.
+void build_partitions_set_spill(BuildPartitions *bp, FILE **spill,
+                                size_t nshards);
+
+// Load the super-kmers of `shard` spilled to `fh` into the main graph, using
+// the partitions. Turns off spilling. Returns number of kmers loaded.
+size_t build_partitions_load_spill(BuildPartitions *bp, FILE *fh,
+                                   size_t shard, size_t nshards,
+                                   size_t nthreads);
+
+// Start one thread per partition, ready to load kmers into `colour`
+// `ntasks` is the number of input tasks that novel kmers are counted against
+void build_partitions_start(BuildPartitions *bp, Colour colour, size_t ntasks);
+
+// Wait for partition threads to finish, then copy kmers into the main graph
+// using `nthreads` threads and empty the partitions.
+// All routers must have been flushed.
+// Adds number of novel kmers per task to novel[0..ntasks-1] (may be NULL)
+void build_partitions_finish(BuildPartitions *bp, size_t nthreads,
+                             size_t *novel);
+
+void build_part_router_alloc(BuildPartRouter *rtr, BuildPartitions *bp);
+void build_part_router_dealloc(BuildPartRouter *rtr);
+
+// Threadsafe if each thread uses its own router
+// Sequence must be entirely ACGT and len >= kmer_size
+// Returns number of kmers in the contig that are in this shard
+size_t build_part_router_add(BuildPartRouter *rtr, const char *seq, size_t len,
+                             size_t taskid);
+
+// Send any remaining super-kmers to the partitions
+void build_part_router_flush(BuildPartRouter *rtr);
+
+#endif /* BUILD_PARTITIONED_H_ */
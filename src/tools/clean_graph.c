@@ -4,6 +4,8 @@
 #include "db_unitig.h"
 #include "prune_nodes.h"
 #include "clean_graph.h"
+#include "graphs_load.h"
+#include "hash_table.h"
 
 #include "carrays/carrays.h" // gca_median()
 
@@ -254,12 +256,14 @@ typedef struct
 {
   const size_t nthreads, covg_threshold, min_keep_tip;
   CovgBuffer *cbufs;
+  // Histograms are per thread: [threadid*arrsize + i], merged into the first
   uint64_t *kmer_covgs_init, *kmer_covgs_clean;
   uint64_t *unitig_covgs_init, *unitig_covg_clean;
   uint64_t *len_hist_init, *len_hist_clean;
   const size_t covg_arrsize, len_arrsize;
   uint8_t *keep_flags;
   UnitigCleanerStats *stats; // array, one per thread
+  dBNodeBuffer *tip_nbrs; // per thread, kept nodes next to removed unitigs
   const dBGraph *db_graph;
 } UnitigCleaner;
 
@@ -302,10 +306,24 @@ static inline bool nodes_are_removable_tip(dBNodeBuffer nbuf,
   return (nbuf.len < min_keep_tip && nodes_are_tip(nbuf, db_graph));
 }
 
+// Add nodes either side of a unitig to `nbrs`
+static inline void unitig_add_neighbours(dBNodeBuffer nbuf, dBNodeBuffer *nbrs,
+                                         const dBGraph *db_graph)
+{
+  dBNode next[4];
+  Nucleotide nucs[4];
+  size_t i, n;
+
+  n = db_graph_next_nodes_union(db_graph, db_node_reverse(nbuf.b[0]), next, nucs);
+  for(i = 0; i < n; i++) db_node_buf_add(nbrs, next[i]);
+
+  n = db_graph_next_nodes_union(db_graph, nbuf.b[nbuf.len-1], next, nucs);
+  for(i = 0; i < n; i++) db_node_buf_add(nbrs, next[i]);
+}
 
 static void unitig_cleaner_alloc(UnitigCleaner *cl, size_t nthreads,
                                  size_t covg_threshold, size_t min_keep_tip,
-                                 uint8_t *keep_flags,
+                                 bool tip_nbrs, uint8_t *keep_flags,
                                  const dBGraph *db_graph)
 {
   size_t i;
@@ -316,16 +334,25 @@ static void unitig_cleaner_alloc(UnitigCleaner *cl, size_t nthreads,
   uint64_t *kmer_covgs_init, *kmer_covgs_clean;
   uint64_t *unitig_covgs_init, *unitig_covg_clean;
   uint64_t *len_hist_init, *len_hist_clean;
+  const size_t ncovgs = nthreads * DUMP_COVG_ARRSIZE;
+  const size_t nlens = nthreads * DUMP_LEN_ARRSIZE;
 
-  kmer_covgs_init      = ctx_calloc(DUMP_COVG_ARRSIZE, sizeof(uint64_t));
-  kmer_covgs_clean    = ctx_calloc(DUMP_COVG_ARRSIZE, sizeof(uint64_t));
-  unitig_covgs_init    = ctx_calloc(DUMP_COVG_ARRSIZE, sizeof(uint64_t));
-  unitig_covg_clean  = ctx_calloc(DUMP_COVG_ARRSIZE, sizeof(uint64_t));
-  len_hist_init        = ctx_calloc(DUMP_LEN_ARRSIZE,  sizeof(uint64_t));
-  len_hist_clean     = ctx_calloc(DUMP_LEN_ARRSIZE,  sizeof(uint64_t));
+  kmer_covgs_init      = ctx_calloc(ncovgs, sizeof(uint64_t));
+  kmer_covgs_clean    = ctx_calloc(ncovgs, sizeof(uint64_t));
+  unitig_covgs_init    = ctx_calloc(ncovgs, sizeof(uint64_t));
+  unitig_covg_clean  = ctx_calloc(ncovgs, sizeof(uint64_t));
+  len_hist_init        = ctx_calloc(nlens,  sizeof(uint64_t));
+  len_hist_clean     = ctx_calloc(nlens,  sizeof(uint64_t));
 
   UnitigCleanerStats *stats = ctx_calloc(nthreads, sizeof(UnitigCleanerStats));
 
+  dBNodeBuffer *nbrs = NULL;
+  if(tip_nbrs) {
+    nbrs = ctx_calloc(nthreads, sizeof(dBNodeBuffer));
+    for(i = 0; i < nthreads; i++)
+      db_node_buf_alloc(&nbrs[i], 256);
+  }
+
   UnitigCleaner tmp = {.nthreads = nthreads,
                        .covg_threshold = covg_threshold,
                        .min_keep_tip = min_keep_tip,
@@ -340,6 +367,7 @@ static void unitig_cleaner_alloc(UnitigCleaner *cl, size_t nthreads,
                        .len_arrsize     = DUMP_LEN_ARRSIZE,
                        .keep_flags = keep_flags,
                        .stats = stats,
+                       .tip_nbrs = nbrs,
                        .db_graph = db_graph};
 
   memcpy(cl, &tmp, sizeof(UnitigCleaner));
@@ -350,6 +378,11 @@ static void unitig_cleaner_dealloc(UnitigCleaner *cl)
   size_t i;
   for(i = 0; i < cl->nthreads; i++)
     covg_buf_dealloc(&cl->cbufs[i]);
+  if(cl->tip_nbrs != NULL) {
+    for(i = 0; i < cl->nthreads; i++)
+      db_node_buf_dealloc(&cl->tip_nbrs[i]);
+    ctx_free(cl->tip_nbrs);
+  }
   ctx_free(cl->cbufs);
   ctx_free(cl->kmer_covgs_init);
   ctx_free(cl->kmer_covgs_clean);
@@ -361,6 +394,26 @@ static void unitig_cleaner_dealloc(UnitigCleaner *cl)
   memset(cl, 0, sizeof(UnitigCleaner));
 }
 
+// Sum per thread histograms into the first
+static void hist_merge(uint64_t *hist, size_t len, size_t nthreads)
+{
+  size_t i, t;
+  for(t = 1; t < nthreads; t++)
+    for(i = 0; i < len; i++)
+      hist[i] += hist[t*len+i];
+}
+
+static void unitig_cleaner_merge_hists(UnitigCleaner *cl)
+{
+  hist_merge(cl->kmer_covgs_init,   cl->covg_arrsize, cl->nthreads);
+  hist_merge(cl->unitig_covgs_init, cl->covg_arrsize, cl->nthreads);
+  hist_merge(cl->len_hist_init,     cl->len_arrsize,  cl->nthreads);
+  hist_merge(cl->kmer_covgs_clean,  cl->covg_arrsize, cl->nthreads);
+  hist_merge(cl->unitig_covg_clean, cl->covg_arrsize, cl->nthreads);
+  hist_merge(cl->len_hist_clean,    cl->len_arrsize,  cl->nthreads);
+}
+
+// Update one thread's histograms
 // Returns unitig coverage
 static inline uint64_t update_kmer_covg_hist(uint64_t *kcovg_hist, size_t covgsize,
                                              uint64_t *ucovg_hist, size_t ucovgsize,
@@ -372,12 +425,12 @@ static inline uint64_t update_kmer_covg_hist(uint64_t *kcovg_hist, size_t covgsi
   // Histogram is of each kmer coverage
   for(i = 0; i < cbuf->len; i++) {
     kcovg = MIN2(cbuf->b[i], covgsize-1);
-    __sync_fetch_and_add((volatile uint64_t *)&kcovg_hist[kcovg], 1);
+    kcovg_hist[kcovg]++;
   }
 
   // Length histgogram
   len = MIN2(cbuf->len, lensize-1);
-  __sync_fetch_and_add((volatile uint64_t *)&len_hist[len], 1);
+  len_hist[len]++;
 
   // Mean covg histogram
   // size_t sum_covg;
@@ -387,11 +440,28 @@ static inline uint64_t update_kmer_covg_hist(uint64_t *kcovg_hist, size_t covgsi
   // Median coverage
   unitig_covg = gca_median_uint32(cbuf->b, cbuf->len);
   unitig_covg = MIN2(unitig_covg, ucovgsize-1);
-  __sync_fetch_and_add((volatile uint64_t *)&ucovg_hist[unitig_covg], 1);
+  ucovg_hist[unitig_covg]++;
 
   return unitig_covg;
 }
 
+static inline void unitig_update_hists(const UnitigCleaner *cl, size_t threadid,
+                                       bool cleaned, CovgBuffer *cbuf)
+{
+  const size_t c = threadid*cl->covg_arrsize, l = threadid*cl->len_arrsize;
+  if(cleaned) {
+    update_kmer_covg_hist(cl->kmer_covgs_clean+c, cl->covg_arrsize,
+                          cl->unitig_covg_clean+c, cl->covg_arrsize,
+                          cl->len_hist_clean+l, cl->len_arrsize,
+                          cbuf);
+  } else {
+    update_kmer_covg_hist(cl->kmer_covgs_init+c, cl->covg_arrsize,
+                          cl->unitig_covgs_init+c, cl->covg_arrsize,
+                          cl->len_hist_init+l, cl->len_arrsize,
+                          cbuf);
+  }
+}
+
 static inline void unitig_get_covg(dBNodeBuffer nbuf, size_t threadid, void *arg)
 {
   const UnitigCleaner *cl = (const UnitigCleaner*)arg;
@@ -401,37 +471,41 @@ static inline void unitig_get_covg(dBNodeBuffer nbuf, size_t threadid, void *arg
   fetch_coverages(nbuf, cbuf, cl->db_graph);
 
   // Update before-cleaning histograms
-  update_kmer_covg_hist(cl->kmer_covgs_init, cl->covg_arrsize,
-                        cl->unitig_covgs_init, cl->covg_arrsize,
-                        cl->len_hist_init, cl->len_arrsize,
-                        cbuf);
+  unitig_update_hists(cl, threadid, false, cbuf);
 }
 
-/*
-//
-// We could just iterate over kmers instead of unitigs to get coverage hist
-// Currently we iterate over unitigs instead which is slower.
-//
-typedef struct {
-  size_t nthreads;
-  UnitigCleaner *cl;
-} KmerCleanerIterator;
-
-static inline void kmer_get_covg_node(hkey_t hkey, void *arg)
+// Update after-cleaning histograms
+static inline void unitig_get_covg_clean(dBNodeBuffer nbuf, size_t threadid,
+                                         void *arg)
 {
   const UnitigCleaner *cl = (const UnitigCleaner*)arg;
-  size_t covg = db_node_sum_covg(cl->db_graph, hkey);
-  covg = MIN2(covg, cl->covg_arrsize-1);
-  __sync_fetch_and_add((volatile uint64_t *)&cl->kmer_covgs_init[covg], 1);
+  CovgBuffer *cbuf = &cl->cbufs[threadid];
+  fetch_coverages(nbuf, cbuf, cl->db_graph);
+  unitig_update_hists(cl, threadid, true, cbuf);
 }
 
-static void kmer_get_covg(void *arg, size_t threadid)
+// Pick threshold from kmer coverage histogram before cleaning
+// `verbose` prints the estimate
+static int unitig_cleaner_pick_threshold(const UnitigCleaner *cl, bool verbose)
 {
-  const KmerCleanerIterator *kcl = (const KmerCleanerIterator*)arg;
-  HASH_ITERATE_PART(&kcl->db_graph->ht, threadid, kcl->nthreads,
-                    kmer_get_covg_node, kcl->cl);
+  double alpha = 0, beta = 0, false_pos = 0, false_neg = 0;
+  int threshold_est = cleaning_pick_kmer_threshold(cl->kmer_covgs_init,
+                                                   cl->covg_arrsize,
+                                                   &alpha, &beta,
+                                                   &false_pos, &false_neg);
+  if(!verbose) return threshold_est;
+
+  if(threshold_est < 0)
+    warn("Cannot pick a cleaning threshold");
+  else {
+    status("[cleaning] alpha=%f, beta=%f FP=%f FN=%f",
+           alpha, beta, false_pos, false_neg);
+    status("[cleaning] Recommended unitig cleaning threshold: < %i",
+           threshold_est);
+  }
+
+  return threshold_est;
 }
-*/
 
 /**
  * Get coverage threshold for removing unitigs
@@ -456,14 +530,9 @@ int cleaning_get_threshold(size_t num_threads,
 
   // Get kmer coverages and unitig lengths
   UnitigCleaner cl;
-  unitig_cleaner_alloc(&cl, num_threads, 0, 0, NULL, db_graph);
+  unitig_cleaner_alloc(&cl, num_threads, 0, 0, false, NULL, db_graph);
   db_unitigs_iterate(num_threads, visited, db_graph, unitig_get_covg, &cl);
-
-  // Get kmer coverage only (faster)
-  // KmerCleanerIterator kcls[nthreads];
-  // for(i = 0; i < nthreads; i++)
-  //   kcls[i] = (KmerCleanerIterator){.threadid = i, .nthreads = nthreads, .cl = &cl};
-  // util_run_threads(kcls, nthreads, sizeof(kcls[0]), nthreads, kmer_get_covg);
+  unitig_cleaner_merge_hists(&cl);
 
   // Wipe visited kmer memory
   memset(visited, 0, roundup_bits2bytes(db_graph->ht.capacity));
@@ -483,20 +552,7 @@ int cleaning_get_threshold(size_t num_threads,
   }
 
   // set threshold using histogram and genome size
-  double alpha = 0, beta = 0, false_pos = 0, false_neg = 0;
-  int threshold_est = cleaning_pick_kmer_threshold(cl.kmer_covgs_init,
-                                                   cl.covg_arrsize,
-                                                   &alpha, &beta,
-                                                   &false_pos, &false_neg);
-
-  if(threshold_est < 0)
-    warn("Cannot pick a cleaning threshold");
-  else {
-    status("[cleaning] alpha=%f, beta=%f FP=%f FN=%f",
-           alpha, beta, false_pos, false_neg);
-    status("[cleaning] Recommended unitig cleaning threshold: < %i",
-           threshold_est);
-  }
+  int threshold_est = unitig_cleaner_pick_threshold(&cl, true);
 
   unitig_cleaner_dealloc(&cl);
 
@@ -517,6 +573,9 @@ static inline void unitig_mark(dBNodeBuffer nbuf, size_t threadid, void *arg)
   CovgBuffer *cbuf = &cl->cbufs[threadid];
   fetch_coverages(nbuf, cbuf, cl->db_graph);
 
+  // Before-cleaning histograms are collected in the same pass
+  unitig_update_hists(cl, threadid, false, cbuf);
+
   // Covg is mean coverage of all kmers
   // size_t mean_covg, sum_covg = 0;
   // for(i = 0; i < cbuf->len; i++) sum_covg += cbuf->b[i];
@@ -545,11 +604,54 @@ static inline void unitig_mark(dBNodeBuffer nbuf, size_t threadid, void *arg)
       (void)bitset_set_mt(cl->keep_flags, nbuf.b[i].key);
 
     // Update histograms
-    update_kmer_covg_hist(cl->kmer_covgs_clean, cl->covg_arrsize,
-                          cl->unitig_covg_clean, cl->covg_arrsize,
-                          cl->len_hist_clean, cl->len_arrsize,
-                          cbuf);
+    unitig_update_hists(cl, threadid, true, cbuf);
+    return;
+  }
+
+  // Removing unitig: neighbours may become tips
+  if(cl->tip_nbrs != NULL)
+    unitig_add_neighbours(nbuf, &cl->tip_nbrs[threadid], cl->db_graph);
+}
+
+// Re-check unitigs that contain nodes in `nbrs`, remove those that are now
+// tips. Nodes next to removed tips are added to `next`. Single threaded.
+// `visited` must be zero, and is zero on return
+// Returns number of tips removed
+static size_t clip_tips_near(const dBNodeBuffer *nbrs, size_t min_keep_tip,
+                             dBNodeBuffer *next, dBNodeBuffer *nbuf,
+                             dBNodeBuffer *seen, uint8_t *visited,
+                             UnitigCleanerStats *stats, dBGraph *db_graph)
+{
+  size_t i, j, ntips = 0;
+  hkey_t hkey;
+
+  db_node_buf_reset(seen);
+
+  for(i = 0; i < nbrs->len; i++)
+  {
+    hkey = nbrs->b[i].key;
+    if(!db_graph_node_assigned(db_graph, hkey) || bitset_get(visited, hkey))
+      continue;
+
+    db_node_buf_reset(nbuf);
+    db_unitig_fetch(hkey, nbuf, db_graph);
+
+    if(nodes_are_removable_tip(*nbuf, min_keep_tip, db_graph)) {
+      unitig_add_neighbours(*nbuf, next, db_graph);
+      prune_unitig(nbuf->b, nbuf->len, db_graph);
+      stats->num_tips++;
+      stats->num_tip_kmers += nbuf->len;
+      ntips++;
+    }
+    else {
+      for(j = 0; j < nbuf->len; j++) bitset_set(visited, nbuf->b[j].key);
+      db_node_buf_push(seen, nbuf->b, nbuf->len);
+    }
   }
+
+  for(i = 0; i < seen->len; i++) bitset_del(visited, seen->b[i].key);
+
+  return ntips;
 }
 
 /**
@@ -560,27 +662,35 @@ static inline void unitig_mark(dBNodeBuffer nbuf, size_t threadid, void *arg)
  * @param covg_threshold Remove unitigs with mean covg < `covg_threshold`.
  *                       Ignored if 0.
  * @param min_keep_tip   Remove tips with length < `min_keep_tip`. Ignored if 0.
+ * @param tip_rounds     Rounds of tip clipping. Rounds after the first only
+ *                       revisit unitigs next to removed kmers.
+ * @param covgs_before_path Path to write CSV of kmer coverage histogram of the
+ *                       graph before cleaning (may be NULL)
+ * @param lens_before_path  Path to write CSV of unitig length histogram of the
+ *                       graph before cleaning (may be NULL)
  * @param covgs_csv_path Path to write CSV of kmer coverage histogram
  * @param lens_csv_path  Path to write CSV of unitig length histogram
+ * @return cleaning threshold picked from the graph before cleaning (as
+ *         cleaning_get_threshold()), -1 if there isn't one
  *
+ * Marking, per thread histograms and stats are done in one pass over unitigs.
  * `visited`, `keep` should each be at least db_graph.ht.capcity bits long
- *   and initialised to zero. On return,
- *   `visited` will be 1 at each original kmer index
- *   `keep` will be 1 at each retained kmer index
+ *   and initialised to zero. They are zero on return.
  **/
-void clean_graph(size_t num_threads,
-                 size_t covg_threshold, size_t min_keep_tip,
-                 const char *covgs_csv_path, const char *lens_csv_path,
-                 uint8_t *visited, uint8_t *keep, dBGraph *db_graph)
+int clean_graph(size_t num_threads,
+                size_t covg_threshold, size_t min_keep_tip, size_t tip_rounds,
+                const char *covgs_before_path, const char *lens_before_path,
+                const char *covgs_csv_path, const char *lens_csv_path,
+                uint8_t *visited, uint8_t *keep, dBGraph *db_graph)
 {
   ctx_assert(db_graph->num_edge_cols > 0);
 
-  size_t i, init_nkmers = hash_table_nkmers(&db_graph->ht);
+  size_t i, round, init_nkmers = hash_table_nkmers(&db_graph->ht);
 
-  if(init_nkmers == 0) return;
+  if(init_nkmers == 0) return -1;
   if(covg_threshold == 0 && min_keep_tip == 0) {
     warn("[cleaning] No cleaning specified");
-    return;
+    return -1;
   }
 
   if(covg_threshold > 0) {
@@ -593,11 +703,14 @@ void clean_graph(size_t num_threads,
 
   status("[cleaning]   using %zu threads", num_threads);
 
+  if(min_keep_tip == 0) tip_rounds = 1;
+
   // Mark nodes to keep
   UnitigCleaner cl;
   unitig_cleaner_alloc(&cl, num_threads, covg_threshold,
-                          min_keep_tip, keep, db_graph);
+                       min_keep_tip, tip_rounds > 1, keep, db_graph);
   db_unitigs_iterate(num_threads, visited, db_graph, unitig_mark, &cl);
+  unitig_cleaner_merge_hists(&cl);
 
   // Print numbers of kmers that are being removed
 
@@ -631,6 +744,43 @@ void clean_graph(size_t num_threads,
   memset(visited, 0, roundup_bits2bytes(db_graph->ht.capacity));
   memset(keep, 0, roundup_bits2bytes(db_graph->ht.capacity));
 
+  // Further rounds of tip clipping, only looking at the unitigs that lost
+  // a neighbour in the previous round
+  size_t ntips, extra_tips = 0;
+
+  if(tip_rounds > 1)
+  {
+    dBNodeBuffer nbrs, next, nbuf, seen;
+    db_node_buf_alloc(&nbrs, 1024);
+    db_node_buf_alloc(&next, 1024);
+    db_node_buf_alloc(&nbuf, 1024);
+    db_node_buf_alloc(&seen, 1024);
+
+    for(i = 0; i < num_threads; i++)
+      db_node_buf_append(&nbrs, &cl.tip_nbrs[i]);
+
+    UnitigCleanerStats rstats;
+
+    for(round = 1; round < tip_rounds && nbrs.len > 0; round++) {
+      memset(&rstats, 0, sizeof(rstats));
+      db_node_buf_reset(&next);
+      ntips = clip_tips_near(&nbrs, min_keep_tip, &next, &nbuf, &seen,
+                             visited, &rstats, db_graph);
+      ulong_to_str(ntips, num_tips_str);
+      ulong_to_str(rstats.num_tip_kmers, num_tip_kmers_str);
+      status("[cleaning] Tip round %zu: removed %s tips [%s kmer%s] "
+             "(checked %zu neighbours)", round+1, num_tips_str,
+             num_tip_kmers_str, util_plural_str(rstats.num_tip_kmers), nbrs.len);
+      extra_tips += ntips;
+      SWAP(nbrs, next);
+    }
+
+    db_node_buf_dealloc(&nbrs);
+    db_node_buf_dealloc(&next);
+    db_node_buf_dealloc(&nbuf);
+    db_node_buf_dealloc(&seen);
+  }
+
   // Print status update
   char remain_nkmers_str[100], removed_nkmers_str[100];
   size_t remain_nkmers = hash_table_nkmers(&db_graph->ht);
@@ -641,6 +791,32 @@ void clean_graph(size_t num_threads,
          remain_nkmers_str, removed_nkmers_str,
          (100.0*removed_nkmers)/init_nkmers);
 
+  if(covgs_before_path != NULL) {
+    cleaning_write_covg_histogram(covgs_before_path,
+                                  cl.kmer_covgs_init,
+                                  cl.unitig_covgs_init,
+                                  cl.covg_arrsize);
+  }
+
+  if(lens_before_path != NULL) {
+    cleaning_write_len_histogram(lens_before_path,
+                                 cl.len_hist_init,
+                                 cl.len_arrsize,
+                                 db_graph->kmer_size);
+  }
+
+  // Unitigs kept in the first round changed if later rounds removed tips
+  if(extra_tips > 0 && (covgs_csv_path != NULL || lens_csv_path != NULL)) {
+    memset(cl.kmer_covgs_clean, 0, cl.nthreads*cl.covg_arrsize*sizeof(uint64_t));
+    memset(cl.unitig_covg_clean, 0, cl.nthreads*cl.covg_arrsize*sizeof(uint64_t));
+    memset(cl.len_hist_clean, 0, cl.nthreads*cl.len_arrsize*sizeof(uint64_t));
+    db_unitigs_iterate(num_threads, visited, db_graph, unitig_get_covg_clean, &cl);
+    hist_merge(cl.kmer_covgs_clean,  cl.covg_arrsize, cl.nthreads);
+    hist_merge(cl.unitig_covg_clean, cl.covg_arrsize, cl.nthreads);
+    hist_merge(cl.len_hist_clean,    cl.len_arrsize,  cl.nthreads);
+    memset(visited, 0, roundup_bits2bytes(db_graph->ht.capacity));
+  }
+
   if(covgs_csv_path != NULL) {
     cleaning_write_covg_histogram(covgs_csv_path,
                                   cl.kmer_covgs_clean,
@@ -655,7 +831,11 @@ void clean_graph(size_t num_threads,
                                  db_graph->kmer_size);
   }
 
+  int threshold_est = unitig_cleaner_pick_threshold(&cl, false);
+
   unitig_cleaner_dealloc(&cl);
+
+  return threshold_est;
 }
 
 static FILE* _open_histogram_file(const char *path, const char *name)
@@ -669,6 +849,367 @@ static FILE* _open_histogram_file(const char *path, const char *name)
   return fout;
 }
 
+//
+// Estimate thresholds by streaming graph files
+//
+
+typedef struct
+{
+  uint64_t *hists; // [nthreads][ncols+1][DUMP_COVG_ARRSIZE]
+  size_t ncols;
+} KmerCovgHists;
+
+static inline uint64_t* kmer_covg_hist(const KmerCovgHists *kh,
+                                       size_t threadid, size_t col)
+{
+  return kh->hists + (threadid*(kh->ncols+1) + col) * DUMP_COVG_ARRSIZE;
+}
+
+static void kmer_covg_hist_update(BinaryKmer bkmer, const Covg *covgs,
+                                  const Edges *edges, size_t ncols,
+                                  size_t threadid, void *arg)
+{
+  (void)bkmer; (void)edges;
+  const KmerCovgHists *kh = (const KmerCovgHists*)arg;
+  size_t i;
+  uint64_t sum = 0;
+
+  for(i = 0; i < ncols; i++) {
+    if(covgs[i]) kmer_covg_hist(kh, threadid, i)[MIN2(covgs[i], DUMP_COVG_ARRSIZE-1)]++;
+    sum += covgs[i];
+  }
+
+  if(sum) kmer_covg_hist(kh, threadid, kh->ncols)[MIN2(sum, DUMP_COVG_ARRSIZE-1)]++;
+}
+
+static void _write_kmer_covg_histogram(const char *path, const uint64_t *hist,
+                                       size_t ncols)
+{
+  size_t i, c, end;
+  const uint64_t *all = hist + ncols*DUMP_COVG_ARRSIZE;
+
+  FILE *fout = _open_histogram_file(path, "kmer coverage");
+  if(fout == NULL) return;
+
+  fprintf(fout, "Covg,NumKmers");
+  for(c = 0; c < ncols; c++) fprintf(fout, ",Colour%zu", c);
+  fputc('\n', fout);
+
+  for(end = DUMP_COVG_ARRSIZE-1; end > 2 && all[end] == 0; end--) {}
+  for(i = 1; i <= end; i++) {
+    if(all[i] == 0) continue;
+    fprintf(fout, "%zu,%"PRIu64, i, all[i]);
+    for(c = 0; c < ncols; c++)
+      fprintf(fout, ",%"PRIu64, hist[c*DUMP_COVG_ARRSIZE+i]);
+    fputc('\n', fout);
+  }
+
+  if(fout != stdout) fclose(fout);
+}
+
+int cleaning_estimate_threshold(GraphFileReader *files, size_t num_files,
+                                size_t ncols, size_t num_threads,
+                                int *col_thresholds,
+                                const char *covgs_csv_path)
+{
+  size_t i, hsize = (ncols+1) * DUMP_COVG_ARRSIZE;
+  double alpha = 0, beta = 0, false_pos = 0, false_neg = 0;
+  int threshold_est;
+
+  status("[cleaning] Estimating threshold from kmer coverage with %zu threads",
+         num_threads);
+
+  KmerCovgHists kh = {.hists = ctx_calloc(num_threads * hsize, sizeof(uint64_t)),
+                      .ncols = ncols};
+
+  for(i = 0; i < num_files; i++) {
+    ctx_assert(file_filter_into_ncols(&files[i].fltr) <= ncols);
+    graph_loading_print_status(&files[i]);
+    graph_file_iterate(&files[i], num_threads, kmer_covg_hist_update, &kh);
+  }
+
+  hist_merge(kh.hists, hsize, num_threads);
+
+  if(covgs_csv_path != NULL)
+    _write_kmer_covg_histogram(covgs_csv_path, kh.hists, ncols);
+
+  for(i = 0; i < ncols; i++) {
+    col_thresholds[i] = cleaning_pick_kmer_threshold(kmer_covg_hist(&kh, 0, i),
+                                                     DUMP_COVG_ARRSIZE,
+                                                     NULL, NULL, NULL, NULL);
+    if(col_thresholds[i] < 0)
+      status("[cleaning]   colour %zu: cannot pick a threshold", i);
+    else
+      status("[cleaning]   colour %zu: threshold < %i", i, col_thresholds[i]);
+  }
+
+  threshold_est = cleaning_pick_kmer_threshold(kmer_covg_hist(&kh, 0, ncols),
+                                               DUMP_COVG_ARRSIZE,
+                                               &alpha, &beta,
+                                               &false_pos, &false_neg);
+
+  if(threshold_est < 0)
+    warn("Cannot pick a cleaning threshold");
+  else {
+    status("[cleaning] alpha=%f, beta=%f FP=%f FN=%f",
+           alpha, beta, false_pos, false_neg);
+    status("[cleaning] Recommended unitig cleaning threshold: < %i",
+           threshold_est);
+  }
+
+  ctx_free(kh.hists);
+
+  return threshold_est;
+}
+
+//
+// Per colour cleaning
+//
+
+typedef struct
+{
+  const KmerCovgHists *kh;
+  size_t nthreads;
+  const dBGraph *db_graph;
+} ColCovgHistJob;
+
+static inline int _col_covg_hist_update(hkey_t hkey, size_t threadid,
+                                        const ColCovgHistJob *job)
+{
+  const dBGraph *db_graph = job->db_graph;
+  Covg covgs[db_graph->num_of_cols];
+  size_t col;
+  for(col = 0; col < db_graph->num_of_cols; col++)
+    covgs[col] = db_node_get_covg(db_graph, hkey, col);
+  kmer_covg_hist_update(db_node_get_bkey(db_graph, hkey), covgs, NULL,
+                        db_graph->num_of_cols, threadid, (void*)job->kh);
+  return 0; // => keep iterating
+}
+
+static void _col_covg_hist_thread(void *arg, size_t threadid)
+{
+  const ColCovgHistJob *job = (const ColCovgHistJob*)arg;
+  HASH_ITERATE_PART(&job->db_graph->ht, threadid, job->nthreads,
+                    _col_covg_hist_update, threadid, job);
+}
+
+void cleaning_get_col_thresholds(size_t num_threads, const dBGraph *db_graph,
+                                 int *col_thresholds)
+{
+  size_t i, ncols = db_graph->num_of_cols;
+  size_t hsize = (ncols+1) * DUMP_COVG_ARRSIZE;
+
+  status("[cleaning] Picking a threshold for each colour with %zu threads",
+         num_threads);
+
+  KmerCovgHists kh = {.hists = ctx_calloc(num_threads * hsize, sizeof(uint64_t)),
+                      .ncols = ncols};
+  ColCovgHistJob job = {.kh = &kh, .nthreads = num_threads,
+                        .db_graph = db_graph};
+
+  util_multi_thread(&job, num_threads, _col_covg_hist_thread);
+  hist_merge(kh.hists, hsize, num_threads);
+
+  for(i = 0; i < ncols; i++) {
+    col_thresholds[i] = cleaning_pick_kmer_threshold(kmer_covg_hist(&kh, 0, i),
+                                                     DUMP_COVG_ARRSIZE,
+                                                     NULL, NULL, NULL, NULL);
+    if(col_thresholds[i] < 0)
+      status("[cleaning]   colour %zu: cannot pick a threshold", i);
+    else
+      status("[cleaning]   colour %zu: threshold < %i", i, col_thresholds[i]);
+  }
+
+  ctx_free(kh.hists);
+}
+
+typedef struct
+{
+  const size_t nthreads, ncols;
+  const size_t *thresholds;
+  uint64_t *sums; // [nthreads][ncols] coverage of current unitig per colour
+  uint64_t *num_unitig_cols, *num_kmer_cols; // per thread removal counts
+  uint8_t *removed; // one bit per kmer-colour: [hkey*ncols + col]
+  dBGraph *db_graph;
+} ColCleaner;
+
+// Add coverage of a kmer in each colour to sums. Coverages of a kmer are
+// contiguous unless the graph is column-major or has presence-only colours,
+// so this vectorises.
+static inline void _add_col_covgs(const dBGraph *db_graph, hkey_t hkey,
+                                  uint64_t *restrict sums)
+{
+  size_t col, ncols = db_graph->num_of_cols;
+  if(db_graph->col_major || db_graph->covg_slot != NULL) {
+    for(col = 0; col < ncols; col++)
+      sums[col] += db_node_get_covg(db_graph, hkey, col);
+  }
+  else {
+    const CovgStore *restrict covgs = db_graph->col_covgs + hkey*ncols;
+    for(col = 0; col < ncols; col++) sums[col] += covgs[col];
+    #if COVG_BITS < 32
+      // Saturated coverages continue in the overflow table
+      for(col = 0; col < ncols; col++)
+        if(covgs[col] == COVG_STORE_MAX)
+          sums[col] += db_node_get_covg(db_graph, hkey, col) - COVG_STORE_MAX;
+    #endif
+  }
+}
+
+// Mark a unitig removed from each colour with mean coverage below the
+// colour's threshold
+static void unitig_mark_cols(dBNodeBuffer nbuf, size_t threadid, void *arg)
+{
+  ColCleaner *cl = (ColCleaner*)arg;
+  const size_t ncols = cl->ncols;
+  uint64_t *restrict sums = cl->sums + threadid*ncols;
+  size_t i, col;
+
+  memset(sums, 0, ncols * sizeof(uint64_t));
+  for(i = 0; i < nbuf.len; i++)
+    _add_col_covgs(cl->db_graph, nbuf.b[i].key, sums);
+
+  for(col = 0; col < ncols; col++) {
+    if(sums[col] == 0 || sums[col] >= cl->thresholds[col] * nbuf.len)
+      continue;
+    for(i = 0; i < nbuf.len; i++)
+      (void)bitset_set_mt(cl->removed, nbuf.b[i].key*ncols + col);
+    cl->num_unitig_cols[threadid]++;
+    cl->num_kmer_cols[threadid] += nbuf.len;
+  }
+}
+
+// Drop edges of removed kmer-colours, and edges into them from kept kmers
+static inline int _prune_col_edges(hkey_t hkey, const ColCleaner *cl)
+{
+  dBGraph *db_graph = cl->db_graph;
+  const size_t ncols = cl->ncols;
+  BinaryKmer bkmer = db_node_get_bkey(db_graph, hkey);
+  Edges edges;
+  Orientation orient;
+  Nucleotide nuc;
+  dBNode next;
+  size_t col;
+
+  for(col = 0; col < ncols; col++)
+  {
+    edges = db_node_edges(db_graph, hkey, col);
+    if(!edges) continue;
+
+    if(bitset_get(cl->removed, hkey*ncols + col)) edges = 0;
+    else {
+      for(orient = 0; orient < 2; orient++) {
+        for(nuc = 0; nuc < 4; nuc++) {
+          if(edges_has_edge(edges, nuc, orient)) {
+            next = db_graph_next_node(db_graph, bkmer, nuc, orient);
+            if(bitset_get(cl->removed, next.key*ncols + col))
+              edges = edges_del_edge(edges, nuc, orient);
+          }
+        }
+      }
+    }
+
+    db_node_edges(db_graph, hkey, col) = edges;
+  }
+
+  db_graph_union_edges_update(db_graph, hkey);
+  return 0; // => keep iterating
+}
+
+// Zero coverage of removed kmer-colours, remove kmers left in no colour
+static inline int _prune_col_covgs(hkey_t hkey, const ColCleaner *cl)
+{
+  dBGraph *db_graph = cl->db_graph;
+  const size_t ncols = cl->ncols;
+  bool any_removed = false, any_left = false;
+  size_t col;
+
+  for(col = 0; col < ncols; col++) {
+    if(bitset_get(cl->removed, hkey*ncols + col)) {
+      db_node_set_covg(db_graph, hkey, col, 0);
+      if(db_graph->node_in_cols != NULL) db_node_del_col_mt(db_graph, hkey, col);
+      any_removed = true;
+    }
+    else any_left |= (db_node_covg(db_graph, hkey, col) > 0);
+  }
+
+  if(any_removed && !any_left && !db_node_get_edges_union(db_graph, hkey))
+    prune_node_without_edges_mt(db_graph, hkey);
+
+  return 0; // => keep iterating
+}
+
+static void _prune_col_edges_thread(void *arg, size_t threadid)
+{
+  const ColCleaner *cl = (const ColCleaner*)arg;
+  HASH_ITERATE_PART(&cl->db_graph->ht, threadid, cl->nthreads,
+                    _prune_col_edges, cl);
+}
+
+static void _prune_col_covgs_thread(void *arg, size_t threadid)
+{
+  const ColCleaner *cl = (const ColCleaner*)arg;
+  HASH_ITERATE_PART(&cl->db_graph->ht, threadid, cl->nthreads,
+                    _prune_col_covgs, cl);
+}
+
+/**
+ * Remove each unitig from the colours it has low coverage in, with one pass
+ * over the unitigs for all colours. Removal is recorded with one bit per
+ * kmer-colour, then applied with a pass over edges and one over coverages.
+ **/
+size_t clean_graph_per_colour(size_t num_threads, const size_t *col_thresholds,
+                              uint8_t *visited, dBGraph *db_graph)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  size_t i, init_nkmers = hash_table_nkmers(&db_graph->ht);
+
+  ctx_assert(db_graph->col_covgs != NULL && db_graph->col_edges != NULL);
+  ctx_assert(db_graph->num_edge_cols == ncols);
+  ctx_assert(db_graph->sparse == NULL && db_graph->shared_edges == NULL);
+
+  if(init_nkmers == 0) return 0;
+
+  status("[cleaning] Removing low coverage unitigs from each of %zu colour%s "
+         "with %zu threads", ncols, util_plural_str(ncols), num_threads);
+
+  ColCleaner cl = {.nthreads = num_threads, .ncols = ncols,
+                   .thresholds = col_thresholds,
+                   .sums = ctx_calloc(num_threads*ncols, sizeof(uint64_t)),
+                   .num_unitig_cols = ctx_calloc(num_threads, sizeof(uint64_t)),
+                   .num_kmer_cols = ctx_calloc(num_threads, sizeof(uint64_t)),
+                   .removed = ctx_calloc(roundup_bits2bytes(db_graph->ht.capacity*ncols), 1),
+                   .db_graph = db_graph};
+
+  db_unitigs_iterate(num_threads, visited, db_graph, unitig_mark_cols, &cl);
+  memset(visited, 0, roundup_bits2bytes(db_graph->ht.capacity));
+
+  util_multi_thread(&cl, num_threads, _prune_col_edges_thread);
+  util_multi_thread(&cl, num_threads, _prune_col_covgs_thread);
+
+  uint64_t num_unitig_cols = 0, num_kmer_cols = 0;
+  for(i = 0; i < num_threads; i++) {
+    num_unitig_cols += cl.num_unitig_cols[i];
+    num_kmer_cols += cl.num_kmer_cols[i];
+  }
+
+  char unitigs_str[50], kmer_cols_str[50], removed_str[50];
+  size_t removed_nkmers = init_nkmers - hash_table_nkmers(&db_graph->ht);
+  ulong_to_str(num_unitig_cols, unitigs_str);
+  ulong_to_str(num_kmer_cols, kmer_cols_str);
+  ulong_to_str(removed_nkmers, removed_str);
+  status("[cleaning] Removed %s unitig-colours [%s kmer-colours], "
+         "%s kmers left in no colour (%.1f%%)", unitigs_str, kmer_cols_str,
+         removed_str, (100.0*removed_nkmers)/init_nkmers);
+
+  ctx_free(cl.sums);
+  ctx_free(cl.num_unitig_cols);
+  ctx_free(cl.num_kmer_cols);
+  ctx_free(cl.removed);
+
+  return num_kmer_cols;
+}
+
 void cleaning_write_covg_histogram(const char *path,
                                    const uint64_t *covg_hist,
                                    const uint64_t *mean_covg_hist,
@@ -2,6 +2,7 @@
 #define CLEAN_GRAPH_H_
 
 #include "db_graph.h"
+#include "graph_file_reader.h"
 
 /**
  * Pick a cleaning threshold from kmer coverage histogram. Assumes low coverage
@@ -38,20 +39,70 @@ int cleaning_get_threshold(size_t num_threads,
                            uint8_t *visited,
                            const dBGraph *db_graph);
 
+/**
+ * Estimate coverage threshold by streaming graph files, without loading them.
+ * Builds a kmer coverage histogram for each colour and for coverage summed
+ * over colours, using O(num_threads x ncols) small histograms of memory.
+ * Unlike cleaning_get_threshold(), kmers in more than one file are counted
+ * once per file rather than merged.
+ *
+ * @param ncols number of colours files are loaded into
+ * @param col_thresholds length ncols, set to the threshold for each colour
+ *                       or -1 if none could be picked
+ * @param covgs_csv_path if not NULL, path to write CSV histogram of kmer
+ *                       coverages (summed and per colour)
+ * @return threshold for coverage summed over colours or -1 on error
+ */
+int cleaning_estimate_threshold(GraphFileReader *files, size_t num_files,
+                                size_t ncols, size_t num_threads,
+                                int *col_thresholds,
+                                const char *covgs_csv_path);
+
 /**
  * Remove low coverage unitigs and clip tips
  * - Remove unitigs with mean coverage < `covg_threshold`
- * - Remove tips shorter than `min_keep_tip`
+ * - Remove tips shorter than `min_keep_tip`, repeated up to `tip_rounds` times.
+ *   Rounds after the first only revisit unitigs next to removed kmers.
  * `visited`, `keep` should each be at least db_graph.ht.capcity bits long
  *   and initialised to zero.
+ * `covgs_before_path` and `lens_before_path` are paths to files to write CSV
+ *   histogram of unitigs coverages and lengths BEFORE CLEANING, collected in
+ *   the same pass as marking.
  * `covgs_csv_path` and `lens_csv_path` are paths to files to write CSV
  *   histogram of unitigs coverages and lengths AFTER CLEANING.
  *   If NULL these are ignored.
+ * Returns threshold cleaning_get_threshold() would have picked before
+ *   cleaning, or -1 if none.
+ */
+int clean_graph(size_t num_threads,
+                size_t covg_threshold, size_t min_keep_tip, size_t tip_rounds,
+                const char *covgs_before_path, const char *lens_before_path,
+                const char *covgs_csv_path, const char *lens_csv_path,
+                uint8_t *visited, uint8_t *keep, dBGraph *db_graph);
+
+/**
+ * Pick a threshold for each colour from its kmer coverage histogram, with one
+ * pass over the graph.
+ * @param col_thresholds length db_graph->num_of_cols, set to the threshold
+ *                       for each colour or -1 if none could be picked
+ */
+void cleaning_get_col_thresholds(size_t num_threads, const dBGraph *db_graph,
+                                 int *col_thresholds);
+
+/**
+ * Remove unitigs from each colour they have low coverage in
+ * - A unitig (found with the union of edges) is removed from colour c if it
+ *   has mean coverage in c > 0 and < col_thresholds[c] (0 to not clean c)
+ * - Coverage and edges of removed kmer-colours are zeroed and edges into them
+ *   in that colour removed. Kmers left in no colour are removed.
+ * All colours are cleaned in one pass over unitigs. Needs an edge set for
+ *   every colour (num_edge_cols == num_of_cols).
+ * `visited` should be at least db_graph.ht.capcity bits long and initialised
+ *   to zero. It is zero on return.
+ * Returns number of kmer-colours removed
  */
-void clean_graph(size_t num_threads,
-                 size_t covg_threshold, size_t min_keep_tip,
-                 const char *covgs_csv_path, const char *lens_csv_path,
-                 uint8_t *visited, uint8_t *keep, dBGraph *db_graph);
+size_t clean_graph_per_colour(size_t num_threads, const size_t *col_thresholds,
+                              uint8_t *visited, dBGraph *db_graph);
 
 void cleaning_write_covg_histogram(const char *path,
                                    const uint64_t *covg_hist,
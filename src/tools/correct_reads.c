@@ -7,6 +7,10 @@
 #include "file_util.h"
 #include "msg-pool/msgpool.h"
 
+// Reads are written to per thread buffers, which are written to the output
+// file once they reach this size (or the output changes)
+#define CORRECT_OUT_BUF_SIZE (1<<20)
+
 typedef struct
 {
   const dBGraph *db_graph;
@@ -15,12 +19,17 @@ typedef struct
   // For filling in gaps
   GraphWalker wlk;
   RepeatWalker rptwlk;
-  StrBuf rbuf1, rbuf2, qbuf;
+  StrBuf qbuf;
   char fq_zero; // character to use to zero fastq [default: '.']
   bool append_orig_seq; // append sequence to name ">name prev=OLDSEQ"
 
   // Corrected alignment
   dBNodeBuffer nodebuf; Int32Buffer posbuf;
+
+  // Batched output for `out`: single ended and paired-end reads
+  SeqOutput *out;
+  StrBuf outse, outpe[2];
+  size_t num_reads, num_perfect; // reads seen, reads that aligned perfectly
 } CorrectReadsWorker;
 
 static void correct_reads_worker_alloc(CorrectReadsWorker *wrkr,
@@ -35,11 +44,14 @@ static void correct_reads_worker_alloc(CorrectReadsWorker *wrkr,
   correct_aln_worker_alloc(&wrkr->corrector, false, db_graph);
   graph_walker_alloc(&wrkr->wlk, db_graph);
   rpt_walker_alloc(&wrkr->rptwlk, db_graph->ht.capacity, 22); // 4MB bloom
-  strbuf_alloc(&wrkr->rbuf1, 1024); // read1
-  strbuf_alloc(&wrkr->rbuf2, 1024); // read2
   strbuf_alloc(&wrkr->qbuf, 1024); // quality scores
   db_node_buf_alloc(&wrkr->nodebuf, 512);
   int32_buf_alloc(&wrkr->posbuf, 512);
+  wrkr->out = NULL;
+  strbuf_alloc(&wrkr->outse, CORRECT_OUT_BUF_SIZE + 4096);
+  strbuf_alloc(&wrkr->outpe[0], CORRECT_OUT_BUF_SIZE + 4096);
+  strbuf_alloc(&wrkr->outpe[1], CORRECT_OUT_BUF_SIZE + 4096);
+  wrkr->num_reads = wrkr->num_perfect = 0;
 }
 
 static void correct_reads_worker_dealloc(CorrectReadsWorker *wrkr)
@@ -47,11 +59,35 @@ static void correct_reads_worker_dealloc(CorrectReadsWorker *wrkr)
   correct_aln_worker_dealloc(&wrkr->corrector);
   graph_walker_dealloc(&wrkr->wlk);
   rpt_walker_dealloc(&wrkr->rptwlk);
-  strbuf_dealloc(&wrkr->rbuf1);
-  strbuf_dealloc(&wrkr->rbuf2);
   strbuf_dealloc(&wrkr->qbuf);
   db_node_buf_dealloc(&wrkr->nodebuf);
   int32_buf_dealloc(&wrkr->posbuf);
+  strbuf_dealloc(&wrkr->outse);
+  strbuf_dealloc(&wrkr->outpe[0]);
+  strbuf_dealloc(&wrkr->outpe[1]);
+}
+
+// Write buffered reads to the output file
+static void correct_reads_worker_flush(CorrectReadsWorker *wrkr)
+{
+  SeqOutput *output = wrkr->out;
+
+  if(wrkr->outse.end > 0) {
+    pthread_mutex_lock(&output->lock_se);
+    gzwrite(output->gzout_se, wrkr->outse.b, wrkr->outse.end);
+    pthread_mutex_unlock(&output->lock_se);
+    strbuf_reset(&wrkr->outse);
+  }
+
+  // Write both files together to keep pairs in order
+  if(wrkr->outpe[0].end > 0) {
+    pthread_mutex_lock(&output->lock_pe);
+    gzwrite(output->gzout_pe[0], wrkr->outpe[0].b, wrkr->outpe[0].end);
+    gzwrite(output->gzout_pe[1], wrkr->outpe[1].b, wrkr->outpe[1].end);
+    pthread_mutex_unlock(&output->lock_pe);
+    strbuf_reset(&wrkr->outpe[0]);
+    strbuf_reset(&wrkr->outpe[1]);
+  }
 }
 
 // Returns the new number of bases printed
@@ -85,21 +121,16 @@ size_t _print_read_kmer(const read_t *r, StrBuf *rbuf, StrBuf *qbuf,
 }
 
 // Prints read sequence in lower case instead of N
+// `nodebuf`, `posbuf` are the corrected alignment from correct_aln_read()
 static void handle_read2(CorrectReadsWorker *wrkr,
-                         const CorrectAlnParam *params,
                          const read_t *r, StrBuf *rbuf, StrBuf *qbuf,
-                         uint8_t fq_cutoff, uint8_t hp_cutoff,
-                         dBNodeBuffer *nodebuf, Int32Buffer *posbuf)
+                         const dBNodeBuffer *nodebuf, const Int32Buffer *posbuf)
 {
   const char fq_zero = wrkr->fq_zero;
   const dBGraph *db_graph = wrkr->db_graph;
   const size_t kmer_size = db_graph->kmer_size;
-  CorrectAlnWorker *corrector = &wrkr->corrector;
 
-  correct_aln_read(corrector, params, r, fq_cutoff, hp_cutoff,
-                   nodebuf, posbuf);
-
-  // db_alignment_print(&corrector->aln);
+  // db_alignment_print(&wrkr->corrector.aln);
 
   ctx_assert(nodebuf->len == posbuf->len);
 
@@ -226,7 +257,7 @@ static void handle_read2(CorrectReadsWorker *wrkr,
   if(r->qual.end == 0) strbuf_reset(qbuf);
 }
 
-// Print read in FASTA, FASTQ or PLAIN format
+// Print read in FASTA, FASTQ or PLAIN format, appending to `rbuf`
 static void handle_read(CorrectReadsWorker *wrkr,
                         const CorrectAlnParam *params,
                         const read_t *r, StrBuf *rbuf, StrBuf *qbuf,
@@ -234,7 +265,6 @@ static void handle_read(CorrectReadsWorker *wrkr,
                         dBNodeBuffer *nodebuf, Int32Buffer *posbuf,
                         seq_format format, bool append_orig_seq)
 {
-  strbuf_reset(rbuf);
   strbuf_reset(qbuf); // quality scores go here
 
   if((format & SEQ_FMT_FASTQ) && r->qual.end && r->seq.end != r->qual.end) {
@@ -252,9 +282,27 @@ static void handle_read(CorrectReadsWorker *wrkr,
     strbuf_append_char(rbuf, '\n');
   }
 
+  correct_aln_read(&wrkr->corrector, params, r, fq_cutoff, hp_cutoff,
+                   nodebuf, posbuf);
+  wrkr->num_reads++;
+
+  // Most reads align perfectly and are printed unchanged (in upper case),
+  // so copy them straight from the input without going kmer by kmer
+  if(db_alignment_is_perfect(&wrkr->corrector.aln)) {
+    wrkr->num_perfect++;
+    strbuf_append_strn_uc(rbuf, r->seq.b, r->seq.end);
+    if(format & SEQ_FMT_FASTQ) {
+      strbuf_append_str(rbuf, "\n+\n");
+      if(r->qual.end == 0) strbuf_append_charn(rbuf, wrkr->fq_zero, r->seq.end);
+      else                 strbuf_append_strn(rbuf, r->qual.b, r->qual.end);
+    }
+    strbuf_append_char(rbuf, '\n');
+    return;
+  }
+
   // Write read sequence string to rbuf, quality scores string to qbuf
   size_t orig_len = rbuf->end;
-  handle_read2(wrkr, params, r, rbuf, qbuf, fq_cutoff, hp_cutoff, nodebuf, posbuf);
+  handle_read2(wrkr, r, rbuf, qbuf, nodebuf, posbuf);
   size_t readlen = rbuf->end - orig_len;
 
   // Copy quality scores to read buffer ready to print
@@ -276,7 +324,7 @@ static void correct_read(CorrectReadsWorker *wrkr, AsyncIOData *data)
   CorrectAlnInput *input = (CorrectAlnInput*)data->ptr;
   const CorrectAlnParam *params = &input->crt_params;
   SeqOutput *output = input->output;
-  StrBuf *rbuf1 = &wrkr->rbuf1, *rbuf2 = &wrkr->rbuf2, *qbuf = &wrkr->qbuf;
+  StrBuf *qbuf = &wrkr->qbuf;
   dBNodeBuffer *nodebuf = &wrkr->nodebuf;
   Int32Buffer *posbuf = &wrkr->posbuf;
   seq_format format = output->fmt;
@@ -292,29 +340,29 @@ static void correct_read(CorrectReadsWorker *wrkr, AsyncIOData *data)
 
   hp_cutoff = input->hp_cutoff;
 
-  strbuf_reset(rbuf1);
-  strbuf_reset(rbuf2);
+  if(wrkr->out != output) {
+    if(wrkr->out != NULL) correct_reads_worker_flush(wrkr);
+    wrkr->out = output;
+  }
 
   if(r2 == NULL)
   {
     // Single ended read
-    handle_read(wrkr, params, r1, rbuf1, qbuf, fq_cutoff1, hp_cutoff,
+    handle_read(wrkr, params, r1, &wrkr->outse, qbuf, fq_cutoff1, hp_cutoff,
                 nodebuf, posbuf, format, wrkr->append_orig_seq);
-    pthread_mutex_lock(&output->lock_se);
-    gzwrite(output->gzout_se, rbuf1->b, rbuf1->end);
-    pthread_mutex_unlock(&output->lock_se);
   }
   else
   {
     // Paired-end reads
-    handle_read(wrkr, params, r1, rbuf1, qbuf, fq_cutoff1, hp_cutoff,
+    handle_read(wrkr, params, r1, &wrkr->outpe[0], qbuf, fq_cutoff1, hp_cutoff,
                 nodebuf, posbuf, format, wrkr->append_orig_seq);
-    handle_read(wrkr, params, r2, rbuf2, qbuf, fq_cutoff2, hp_cutoff,
+    handle_read(wrkr, params, r2, &wrkr->outpe[1], qbuf, fq_cutoff2, hp_cutoff,
                 nodebuf, posbuf, format, wrkr->append_orig_seq);
-    pthread_mutex_lock(&output->lock_pe);
-    gzwrite(output->gzout_pe[0], rbuf1->b, rbuf1->end);
-    gzwrite(output->gzout_pe[1], rbuf2->b, rbuf2->end);
-    pthread_mutex_unlock(&output->lock_pe);
+  }
+
+  if(wrkr->outse.end >= CORRECT_OUT_BUF_SIZE ||
+     wrkr->outpe[0].end + wrkr->outpe[1].end >= CORRECT_OUT_BUF_SIZE) {
+    correct_reads_worker_flush(wrkr);
   }
 }
 
@@ -338,7 +386,7 @@ void correct_reads(CorrectAlnInput *inputs, size_t num_inputs,
                    char fq_zero, bool append_orig_seq,
                    size_t num_threads, const dBGraph *db_graph)
 {
-  size_t i, n, read_counter = 0;
+  size_t i, j, n, read_counter = 0;
 
   if(!fq_zero) fq_zero = '.';
 
@@ -346,7 +394,7 @@ void correct_reads(CorrectAlnInput *inputs, size_t num_inputs,
 
   for(i = 0; i < num_threads; i++) {
     correct_reads_worker_alloc(&wrkrs[i], &read_counter,
-                               fq_zero, append_orig_seq,
+                               append_orig_seq, fq_zero,
                                db_graph);
   }
 
@@ -358,7 +406,24 @@ void correct_reads(CorrectAlnInput *inputs, size_t num_inputs,
     n = MIN2(num_inputs - i, MAX_IO_THREADS);
     asyncio_run_pool(asyncio_tasks+i, n, correct_reads_thread,
                      wrkrs, num_threads, sizeof(CorrectReadsWorker));
+
+    // Write out remaining reads before outputs are reused or closed
+    for(j = 0; j < num_threads; j++) {
+      if(wrkrs[j].out != NULL) correct_reads_worker_flush(&wrkrs[j]);
+      wrkrs[j].out = NULL;
+    }
+  }
+
+  size_t num_reads = 0, num_perfect = 0;
+  char num_perfect_str[50], num_reads_str[50];
+  for(i = 0; i < num_threads; i++) {
+    num_reads += wrkrs[i].num_reads;
+    num_perfect += wrkrs[i].num_perfect;
   }
+  ulong_to_str(num_perfect, num_perfect_str);
+  ulong_to_str(num_reads, num_reads_str);
+  status("[CorrectReads] %s / %s reads aligned perfectly (printed unchanged)",
+         num_perfect_str, num_reads_str);
 
   // Merge stats into workers[0]
   for(i = 1; i < num_threads; i++)
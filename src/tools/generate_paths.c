@@ -25,6 +25,20 @@
 #define GEN_PATHS_COUNTER_STEP 100
 #define INIT_BUFLEN 1024
 
+// Spill links once this fraction of link memory is used
+#define GEN_PATHS_SPILL_FULL 0.9
+
+// Shared by workers so they can be paused while links are spilled
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t nactive; // number of workers processing a batch
+  bool spilling;
+  gen_paths_spill_f func;
+  void *arg;
+} GenPathSpill;
+
 struct GenPathWorker
 {
   pthread_t thread;
@@ -41,6 +55,12 @@ struct GenPathWorker
 
   CorrectAlnWorker corrector;
 
+  GenPathSpill *spill; // NULL unless spilling links
+
+  // If not NULL, links are only added once seen min_link_count times
+  GPathSketch *sketch;
+  uint8_t min_link_count;
+
   // Nucleotides and positions of junctions
   // only one array allocated for each type, rev points to half way through
   uint8_t *pck_fw, *pck_rv;
@@ -106,10 +126,75 @@ GenPathWorker* gen_paths_workers_alloc(size_t n, dBGraph *graph)
 void gen_paths_workers_dealloc(GenPathWorker *workers, size_t n)
 {
   size_t i;
+  GenPathSpill *spill = n ? workers[0].spill : NULL;
+  if(spill != NULL) {
+    pthread_mutex_destroy(&spill->lock);
+    pthread_cond_destroy(&spill->cond);
+    ctx_free(spill);
+  }
   for(i = 0; i < n; i++) _gen_paths_worker_dealloc(&workers[i]);
   ctx_free(workers);
 }
 
+void gen_paths_workers_set_spill(GenPathWorker *workers, size_t n,
+                                 gen_paths_spill_f func, void *arg)
+{
+  size_t i;
+  GenPathSpill *spill = ctx_calloc(1, sizeof(GenPathSpill));
+  if(pthread_mutex_init(&spill->lock, NULL) != 0) die("Mutex init failed");
+  if(pthread_cond_init(&spill->cond, NULL) != 0) die("Cond init failed");
+  spill->func = func;
+  spill->arg = arg;
+  for(i = 0; i < n; i++) workers[i].spill = spill;
+}
+
+void gen_paths_workers_set_filter(GenPathWorker *workers, size_t n,
+                                  GPathSketch *sketch, uint8_t min_count)
+{
+  size_t i;
+  for(i = 0; i < n; i++) {
+    workers[i].sketch = min_count > 1 ? sketch : NULL;
+    workers[i].min_link_count = min_count;
+  }
+}
+
+static inline bool _gen_paths_mem_full(const dBGraph *db_graph)
+{
+  return gpath_set_nearly_full(&db_graph->gpstore.gpset, GEN_PATHS_SPILL_FULL) ||
+         gpath_hash_nearly_full(&db_graph->gphash, GEN_PATHS_SPILL_FULL);
+}
+
+// Wait for any spill in progress before starting a batch
+static void _gen_paths_spill_enter(GenPathSpill *spill)
+{
+  if(spill == NULL) return;
+  pthread_mutex_lock(&spill->lock);
+  while(spill->spilling) pthread_cond_wait(&spill->cond, &spill->lock);
+  spill->nactive++;
+  pthread_mutex_unlock(&spill->lock);
+}
+
+// After a batch, spill links if memory is nearly full. The first worker to
+// notice waits for the others to finish their batches, then spills.
+static void _gen_paths_spill_leave(GenPathSpill *spill, dBGraph *db_graph)
+{
+  if(spill == NULL) return;
+  pthread_mutex_lock(&spill->lock);
+  spill->nactive--;
+  if(!spill->spilling && _gen_paths_mem_full(db_graph)) {
+    spill->spilling = true;
+    while(spill->nactive > 0) pthread_cond_wait(&spill->cond, &spill->lock);
+    gpath_store_sync_stats(&db_graph->gpstore);
+    spill->func(db_graph, spill->arg);
+    spill->spilling = false;
+    pthread_cond_broadcast(&spill->cond);
+  }
+  else if(spill->spilling && spill->nactive == 0) {
+    pthread_cond_broadcast(&spill->cond);
+  }
+  pthread_mutex_unlock(&spill->lock);
+}
+
 static inline void worker_nuc_cap(GenPathWorker *wrkr, size_t req_cap)
 {
   size_t old_cap = wrkr->junc_arrsize, old_pck_mem, new_pck_mem;
@@ -249,6 +334,17 @@ static inline size_t _juncs_to_paths(const size_t *restrict pos_pl,
                          .orient = node.orient, .num_juncs = plen,
                          .colset = NULL, .nseen = NULL};
 
+    // Skip links until they have been seen enough times
+    uint8_t link_count = 1;
+    if(wrkr->sketch != NULL) {
+      uint64_t hash = gpath_sketch_hash(node.key, newgpath);
+      link_count = gpath_sketch_add_mt(wrkr->sketch, hash);
+      if(link_count < wrkr->min_link_count) {
+        packed_ptr[top_idx] = top_byte; // restore top byte
+        continue;
+      }
+    }
+
     // #ifdef CTXVERBOSE
     //   char kmerstr[MAX_KMER_SIZE+1];
     //   BinaryKmer tmpkmer = db_node_get_bkey(db_graph, node.key);
@@ -263,10 +359,15 @@ static inline size_t _juncs_to_paths(const size_t *restrict pos_pl,
     GPath *gpath = gpath_hash_find_or_insert_mt(&db_graph->gphash, node.key,
                                                 newgpath, &found);
 
+    // A link admitted by the sketch has already been seen min_link_count
+    // times. Count it once if seen more, it may have been spilled already.
+    uint8_t nseen_add = 1;
+    if(!found && link_count == wrkr->min_link_count) nseen_add = link_count;
+
     // Add colour
     bitset_set(gpath_get_colset(gpath, gpset->ncols), ctpcol);
     uint8_t *nseen = gpath_set_get_nseen(gpset, gpath);
-    if(nseen != NULL) safe_add_uint8_mt(&nseen[ctpcol], 1);
+    if(nseen != NULL) safe_add_uint8_mt(&nseen[ctpcol], nseen_add);
 
     packed_ptr[top_idx] = top_byte; // restore top byte
 
@@ -437,17 +538,38 @@ static void reads_to_paths(GenPathWorker *wrkr)
   }
 }
 
-// pthread method, loop: grabs job, does processing
-static void generate_paths_worker(AsyncIOData *data, size_t threadid, void *ptr)
+// pthread method, called on each batch of reads from the pool
+// All reads in a batch come from the same input so share one task
+static void generate_paths_worker(AsyncIOBatch *batch, size_t threadid,
+                                  void *ptr)
 {
   (void)threadid;
   GenPathWorker *wrkr = (GenPathWorker*)ptr;
-  wrkr->data = data;
-  memcpy(&wrkr->task, data->ptr, sizeof(CorrectAlnInput));
-  reads_to_paths(wrkr);
+  size_t i, max_bases = 0;
+
+  if(batch->len == 0) return;
+
+  memcpy(&wrkr->task, batch->data[0].ptr, sizeof(CorrectAlnInput));
+
+  // Grow junction buffers once for the whole batch
+  for(i = 0; i < batch->len; i++) {
+    max_bases = MAX2(max_bases, batch->data[i].r1.seq.end +
+                                batch->data[i].r2.seq.end);
+  }
+  worker_nuc_cap(wrkr, max_bases);
+
+  _gen_paths_spill_enter(wrkr->spill);
+
+  for(i = 0; i < batch->len; i++) {
+    ctx_assert(batch->data[i].ptr == batch->data[0].ptr);
+    wrkr->data = &batch->data[i];
+    reads_to_paths(wrkr);
+  }
+
+  _gen_paths_spill_leave(wrkr->spill, wrkr->db_graph);
 
   // Print progress
-  wrkr->nreads++;
+  wrkr->nreads += batch->len;
   if(wrkr->nreads >= GEN_PATHS_COUNTER_STEP) {
     // Update shared counter
     size_t n = __sync_fetch_and_add(wrkr->shared_nreads, wrkr->nreads);
@@ -494,6 +616,7 @@ void gen_paths_from_str_mt(GenPathWorker *gen_path_wrkr, char *seq,
   memcpy(&task.files, &iotask, sizeof(AsyncIOInput));
 
   gen_paths_worker_seq(gen_path_wrkr, &iodata, &task);
+  gpath_store_sync_stats(&gen_path_wrkr->db_graph->gpstore);
 }
 
 void generate_paths(CorrectAlnInput *tasks, size_t num_inputs,
@@ -507,11 +630,13 @@ void generate_paths(CorrectAlnInput *tasks, size_t num_inputs,
   AsyncIOInput *asyncio_tasks = ctx_malloc(num_inputs * sizeof(AsyncIOInput));
   correct_aln_input_to_asycio(asyncio_tasks, tasks, num_inputs);
 
-  asyncio_run_pool(asyncio_tasks, num_inputs, generate_paths_worker,
-                   workers, num_workers, sizeof(GenPathWorker));
+  asyncio_run_batch_pool(asyncio_tasks, num_inputs, generate_paths_worker,
+                         workers, num_workers, sizeof(GenPathWorker));
 
   ctx_free(asyncio_tasks);
 
+  if(num_workers > 0) gpath_store_sync_stats(&workers[0].db_graph->gpstore);
+
   // Merge stats into workers[0]
   for(i = 1; i < num_workers; i++)
     correct_aln_merge_stats(&workers[0].corrector, &workers[i].corrector);
@@ -7,6 +7,7 @@
 #include "db_graph.h"
 #include "seq_loading_stats.h"
 #include "correct_aln_input.h"
+#include "gpath_sketch.h"
 
 typedef struct GenPathWorker GenPathWorker;
 
@@ -17,6 +18,21 @@ GenPathWorker* gen_paths_workers_alloc(size_t n, dBGraph *graph);
 
 void gen_paths_workers_dealloc(GenPathWorker *mem, size_t n);
 
+// Called by a worker when link memory is nearly full, once all other workers
+// have paused. Should save then remove all links from db_graph->gpstore and
+// db_graph->gphash.
+typedef void (*gen_paths_spill_f)(dBGraph *db_graph, void *arg);
+
+// Pause workers and call `func` when link memory fills up, instead of dying.
+// Checked between batches of reads, so some memory must be kept free.
+void gen_paths_workers_set_spill(GenPathWorker *workers, size_t n,
+                                 gen_paths_spill_f func, void *arg);
+
+// Only add links to the graph once `sketch` has seen them `min_count` times.
+// Newly added links start with a count of `min_count`.
+void gen_paths_workers_set_filter(GenPathWorker *workers, size_t n,
+                                  GPathSketch *sketch, uint8_t min_count);
+
 // Add a single contig using a given worker
 void gen_paths_worker_seq(GenPathWorker *wrkr, AsyncIOData *data,
                           const CorrectAlnInput *task);
@@ -0,0 +1,290 @@
+#include "global.h"
+#include "grow_graph.h"
+#include "db_node.h"
+#include "db_unitig.h"
+#include "util.h"
+
+typedef struct
+{
+  StrBuf seq;
+  Covg *covgs; // [ncols][nodes] coverage of unitig k-mers
+  size_t covgs_cap;
+  Covg *mins; // [ncols] min coverage of k-mers in a K-mer
+  dBNode *prev; // [ncols] previous K-mer in each colour
+} GrowUnitigsThread;
+
+typedef struct
+{
+  const GrowGraph *gg;
+  GrowUnitigsThread *threads;
+} GrowUnitigs;
+
+// Add a K-mer to colours with mins[col] > 0, with an edge from prev[col]
+static inline void _grow_add_kmer(dBGraph *dst, BinaryKmer bkey,
+                                  Orientation orient, const Covg *mins,
+                                  dBNode *prev)
+{
+  const size_t ncols = dst->num_of_cols;
+  size_t col;
+  bool found, added = false;
+  dBNode node = {.key = HASH_NOT_FOUND};
+
+  for(col = 0; col < ncols; col++) {
+    if(mins[col] == 0) { prev[col].key = HASH_NOT_FOUND; continue; }
+    if(!added) {
+      node = db_graph_find_or_add_key_mt(dst, bkey, orient, &found);
+      added = true;
+    }
+    if(dst->node_in_cols != NULL) db_node_set_col_mt(dst, node.key, col);
+    if(dst->col_covgs != NULL) db_node_add_col_covg_mt(dst, node.key, col, mins[col]);
+    if(prev[col].key != HASH_NOT_FOUND)
+      db_graph_add_edge_mt(dst, dst->num_edge_cols == 1 ? 0 : col, prev[col], node);
+    prev[col] = node;
+  }
+}
+
+// Add the K-mers of one unitig to a larger kmer size graph
+static void _grow_unitig_dst(const char *seq, size_t nnodes, const Covg *covgs,
+                             GrowUnitigsThread *wrkr, size_t ksrc, dBGraph *dst)
+{
+  const size_t ncols = dst->num_of_cols, kmer_size = dst->kmer_size;
+  const size_t delta = kmer_size - ksrc, nkmers = nnodes - delta;
+  size_t i, j, col;
+  BinaryKmer bkey;
+  Orientation orient;
+  BinaryKmerIter kiter;
+
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+  for(col = 0; col < ncols; col++) wrkr->prev[col].key = HASH_NOT_FOUND;
+
+  for(i = 0; i < nkmers; i++)
+  {
+    binary_kmer_iter_next(&kiter, dna_char_to_nuc(seq[i+kmer_size-1]));
+    bkey = binary_kmer_iter_key(&kiter, &orient);
+
+    // A K-mer cannot have been seen more than any k-mer within it
+    for(col = 0; col < ncols; col++) {
+      const Covg *c = covgs + col*nnodes + i;
+      wrkr->mins[col] = c[0];
+      for(j = 1; j <= delta; j++) wrkr->mins[col] = MIN2(wrkr->mins[col], c[j]);
+    }
+
+    _grow_add_kmer(dst, bkey, orient, wrkr->mins, wrkr->prev);
+  }
+}
+
+static void _grow_unitig(dBNodeBuffer nbuf, size_t threadid, void *arg)
+{
+  GrowUnitigs *gu = (GrowUnitigs*)arg;
+  GrowUnitigsThread *wrkr = &gu->threads[threadid];
+  const GrowGraph *gg = gu->gg;
+  const dBGraph *src = gg->src;
+  const size_t ncols = src->num_of_cols, ksrc = src->kmer_size;
+  size_t i, d, col;
+
+  for(d = 0; d < gg->ndsts && nbuf.len+ksrc-1 < gg->dsts[d].kmer_size; d++) {}
+  if(d == gg->ndsts) return; // unitig too short for any K
+
+  strbuf_ensure_capacity(&wrkr->seq, nbuf.len+ksrc);
+  wrkr->seq.end = db_nodes_to_str(nbuf.b, nbuf.len, src, wrkr->seq.b);
+
+  if(wrkr->covgs_cap < nbuf.len * ncols) {
+    wrkr->covgs_cap = roundup2pow(nbuf.len * ncols);
+    wrkr->covgs = ctx_realloc(wrkr->covgs, wrkr->covgs_cap * sizeof(Covg));
+  }
+
+  for(col = 0; col < ncols; col++)
+    for(i = 0; i < nbuf.len; i++)
+      wrkr->covgs[col*nbuf.len+i] = db_node_get_covg(src, nbuf.b[i].key, col);
+
+  for(d = 0; d < gg->ndsts; d++) {
+    if(nbuf.len+ksrc-1 >= gg->dsts[d].kmer_size) {
+      _grow_unitig_dst(wrkr->seq.b, nbuf.len, wrkr->covgs, wrkr, ksrc,
+                       &gg->dsts[d]);
+    }
+  }
+}
+
+// Add K-mers inside the unitigs of gg->src to all gg->dsts
+// `visited` must be zeroed, with one bit per src kmer. Dirty on return.
+void grow_graph_from_unitigs(const GrowGraph *gg, size_t nthreads,
+                             uint8_t *visited)
+{
+  const size_t ncols = gg->src->num_of_cols;
+  size_t i, d;
+
+  for(d = 0; d < gg->ndsts; d++) {
+    ctx_assert(gg->dsts[d].kmer_size > gg->src->kmer_size);
+    ctx_assert(gg->dsts[d].num_of_cols == ncols);
+  }
+
+  GrowUnitigs gu = {.gg = gg,
+                    .threads = ctx_calloc(nthreads, sizeof(GrowUnitigsThread))};
+
+  for(i = 0; i < nthreads; i++) {
+    strbuf_alloc(&gu.threads[i].seq, 1024);
+    gu.threads[i].mins = ctx_calloc(ncols, sizeof(Covg));
+    gu.threads[i].prev = ctx_calloc(ncols, sizeof(dBNode));
+  }
+
+  db_unitigs_iterate(nthreads, visited, gg->src, _grow_unitig, &gu);
+
+  for(i = 0; i < nthreads; i++) {
+    strbuf_dealloc(&gu.threads[i].seq);
+    ctx_free(gu.threads[i].covgs);
+    ctx_free(gu.threads[i].mins);
+    ctx_free(gu.threads[i].prev);
+  }
+  ctx_free(gu.threads);
+}
+
+//
+// Reads
+//
+
+// State of one larger kmer size graph whilst walking along a read
+typedef struct
+{
+  BinaryKmerIter kiter;
+  dBNode prev; // previous K-mer if it was in the graph
+  bool prev_junc; // previous K-mer spans a junction
+} GrowReadDst;
+
+// Is the step from k-mer `node` to `next` (adding `nuc`) inside a unitig?
+static inline bool _grow_step_in_unitig(const dBGraph *src, dBNode node,
+                                        dBNode next, Nucleotide nuc)
+{
+  Edges edges = db_node_get_edges_union(src, node.key);
+  Edges nedges = db_node_get_edges_union(src, next.key);
+  return edges_get_outdegree(edges, node.orient) == 1 &&
+         edges_has_edge(edges, nuc, node.orient) &&
+         edges_get_indegree(nedges, next.orient) == 1;
+}
+
+// Threadsafe
+// Add K-mers spanning junctions of gg->src from `seq` to all gg->dsts
+// Sequence must be entirely ACGT and len >= gg->src->kmer_size
+// Returns number of k-mers of `seq` found in gg->src
+size_t grow_graph_from_str_mt(const GrowGraph *gg, size_t colour,
+                              const char *seq, size_t len)
+{
+  const dBGraph *src = gg->src;
+  const size_t ksrc = src->kmer_size, nkmers = len+1-ksrc;
+  ctx_assert(len >= ksrc);
+
+  GrowReadDst dstate[gg->ndsts];
+  size_t i, d, delta, edge_col, num_found = 0;
+  size_t run_start = 0; // first k-mer of the current run of k-mers in src
+  size_t last_brk = SIZE_MAX; // last step i->i+1 that is not inside a unitig
+  BinaryKmerIter kiter;
+  BinaryKmer bkey;
+  Orientation orient;
+  Nucleotide nuc;
+  dBNode node, prev = {.key = HASH_NOT_FOUND};
+  bool junc, found;
+  dBGraph *dst;
+
+  for(d = 0; d < gg->ndsts; d++) {
+    if(len >= gg->dsts[d].kmer_size)
+      binary_kmer_iter_init(&dstate[d].kiter, seq, gg->dsts[d].kmer_size);
+    dstate[d].prev.key = HASH_NOT_FOUND;
+  }
+
+  binary_kmer_iter_init(&kiter, seq, ksrc);
+
+  for(i = 0; i < nkmers; i++)
+  {
+    nuc = dna_char_to_nuc(seq[i+ksrc-1]);
+    binary_kmer_iter_next(&kiter, nuc);
+    bkey = binary_kmer_iter_key(&kiter, &orient);
+    node = db_graph_find_key(src, bkey, orient);
+
+    if(node.key == HASH_NOT_FOUND) run_start = i+1;
+    else {
+      num_found++;
+      if(prev.key != HASH_NOT_FOUND && !_grow_step_in_unitig(src, prev, node, nuc))
+        last_brk = i-1;
+    }
+    prev = node;
+
+    for(d = 0; d < gg->ndsts; d++)
+    {
+      dst = &gg->dsts[d];
+      delta = dst->kmer_size - ksrc;
+      if(i < delta) continue;
+
+      binary_kmer_iter_next(&dstate[d].kiter, nuc);
+
+      // K-mer covers k-mers i-delta..i
+      if(i < run_start + delta) { dstate[d].prev.key = HASH_NOT_FOUND; continue; }
+
+      bkey = binary_kmer_iter_key(&dstate[d].kiter, &orient);
+      junc = (last_brk != SIZE_MAX && last_brk+delta >= i);
+
+      // K-mers inside unitigs were added from the unitigs, but are missing if
+      // the unitig was not in this colour
+      if(!junc) {
+        node = db_graph_find_key(dst, bkey, orient);
+        junc = (node.key == HASH_NOT_FOUND ||
+                (dst->col_covgs != NULL &&
+                 db_node_get_covg(dst, node.key, colour) == 0));
+      }
+
+      if(junc) {
+        node = db_graph_find_or_add_key_mt(dst, bkey, orient, &found);
+        db_graph_update_node_mt(dst, node, colour);
+      }
+
+      // Edges inside unitigs were added with the unitigs
+      if(dstate[d].prev.key != HASH_NOT_FOUND && (junc || dstate[d].prev_junc)) {
+        edge_col = dst->num_edge_cols == 1 ? 0 : colour;
+        db_graph_add_edge_mt(dst, edge_col, dstate[d].prev, node);
+      }
+
+      dstate[d].prev = node;
+      dstate[d].prev_junc = junc;
+    }
+  }
+
+  return num_found;
+}
+
+typedef struct
+{
+  const GrowGraph *gg;
+  size_t colour;
+} GrowReadArgs;
+
+static size_t _grow_contig(const char *seq, size_t len, void *arg)
+{
+  const GrowReadArgs *args = (const GrowReadArgs*)arg;
+  return grow_graph_from_str_mt(args->gg, args->colour, seq, len);
+}
+
+// Add K-mers spanning junctions from reads. Read loading stats are added to
+// the ginfo of gg->src. Tasks must not remove PCR duplicates.
+void grow_graph_from_reads(const GrowGraph *gg, BuildGraphTask *tasks,
+                           size_t ntasks, size_t nthreads)
+{
+  size_t i, start, end;
+  GrowReadArgs *args = ctx_calloc(ntasks, sizeof(GrowReadArgs));
+  void **argptrs = ctx_calloc(ntasks, sizeof(void*));
+
+  for(i = 0; i < ntasks; i++) {
+    ctx_assert(!tasks[i].prefs.remove_pcr_dups);
+    ctx_assert(tasks[i].prefs.colour < gg->src->num_of_cols);
+    args[i] = (GrowReadArgs){.gg = gg, .colour = tasks[i].prefs.colour};
+    argptrs[i] = &args[i];
+  }
+
+  // src is only read from, so it is not modified by build_graph_func()
+  // except for read loading stats in ginfo
+  for(start = 0; start < ntasks; start = end) {
+    end = MIN2(start+MAX_IO_THREADS, ntasks);
+    build_graph_func((dBGraph*)gg->src, tasks+start, end-start, nthreads,
+                     _grow_contig, argptrs+start);
+  }
+
+  ctx_free(args);
+  ctx_free(argptrs);
+}
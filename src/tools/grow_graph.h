@@ -0,0 +1,45 @@
+#ifndef GROW_GRAPH_H_
+#define GROW_GRAPH_H_
+
+#include "cortex_types.h"
+#include "db_graph.h"
+#include "build_graph.h"
+
+//
+// Derive graphs with larger kmer sizes (k+delta) from a graph of kmer size k,
+// without rebuilding from reads.
+//
+// Every K-mer that lies inside a unitig of the k graph is taken from the
+// unitigs, with the lowest coverage of the k-mers it spans in each colour.
+// K-mers that span a junction of the k graph can only come from reads: they
+// are added from read sequence if every k-mer they contain is in the k graph,
+// which filters out sequencing errors already cleaned from the k graph.
+//
+// Several kmer sizes are grown at once so unitigs and reads are read once.
+//
+
+typedef struct
+{
+  const dBGraph *src; // graph of kmer size k
+  dBGraph *dsts; // [ndsts] kmer_size > src->kmer_size, same number of colours
+  size_t ndsts;
+} GrowGraph;
+
+// Add K-mers inside the unitigs of gg->src to all gg->dsts
+// `visited` must be zeroed, with one bit per src kmer. Dirty on return.
+void grow_graph_from_unitigs(const GrowGraph *gg, size_t nthreads,
+                             uint8_t *visited);
+
+// Threadsafe
+// Add K-mers spanning junctions of gg->src from `seq` to all gg->dsts
+// Sequence must be entirely ACGT and len >= gg->src->kmer_size
+// Returns number of k-mers of `seq` found in gg->src
+size_t grow_graph_from_str_mt(const GrowGraph *gg, size_t colour,
+                              const char *seq, size_t len);
+
+// Add K-mers spanning junctions from reads. Read loading stats are added to
+// the ginfo of gg->src. Tasks must not remove PCR duplicates.
+void grow_graph_from_reads(const GrowGraph *gg, BuildGraphTask *tasks,
+                           size_t ntasks, size_t nthreads);
+
+#endif /* GROW_GRAPH_H_ */
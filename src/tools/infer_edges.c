@@ -3,6 +3,8 @@
 #include "db_node.h"
 #include "db_graph.h"
 
+#include <time.h>
+
 static inline void _add_edge_to_colours(hkey_t next_hkey,
                                         const Covg *covgs, Edges *edges,
                                         Edges new_edge,
@@ -26,22 +28,16 @@ static inline void _add_edge_to_colours(hkey_t next_hkey,
   }
 }
 
-// `pop_edges` if true, only add edges that are in at least one other colour
-//  -> If two kmers are in a sample and the population has an edges between
-//     them, add edge to sample.
-// Return 1 if changed; 0 otherwise
-bool infer_kmer_edges(const BinaryKmer node_bkey, bool pop_edges,
-                      Edges *edges, const Covg *covgs,
-                      const dBGraph *db_graph)
+// Get the keys of neighbours that edges may need to be added to
+// Returns number of neighbours (0-8), with the edge to each in nbr_edges
+static inline size_t infer_kmer_nbrs(const BinaryKmer node_bkey, bool pop_edges,
+                                     const Edges *edges, size_t ncols,
+                                     size_t kmer_size, BinaryKmer nbr_keys[8],
+                                     Edges nbr_edges[8])
 {
   Edges uedges = 0, iedges = 0xf, add_edges, edge;
-  size_t orient, nuc, col, kmer_size = db_graph->kmer_size;
-  const size_t ncols = db_graph->num_of_cols;
-  BinaryKmer bkey, bkmer;
-  hkey_t next;
-
-  Edges newedges[ncols];
-  memcpy(newedges, edges, ncols * sizeof(Edges));
+  size_t orient, nuc, col, n = 0;
+  BinaryKmer bkmer;
 
   for(col = 0; col < ncols; col++) {
     uedges |= edges[col]; // union of edges
@@ -66,81 +62,220 @@ bool infer_kmer_edges(const BinaryKmer node_bkey, bool pop_edges,
         if(orient == FORWARD) binary_kmer_set_last_nuc(&bkmer, nuc);
         else binary_kmer_set_first_nuc(&bkmer, dna_nuc_complement(nuc), kmer_size);
 
-        bkey = binary_kmer_get_key(bkmer, kmer_size);
-        next = hash_table_find(&db_graph->ht, bkey);
-        ctx_assert(!pop_edges || next != HASH_NOT_FOUND);
-
-        if(next != HASH_NOT_FOUND) {
-          _add_edge_to_colours(next, covgs, newedges, edge, db_graph);
-        }
+        nbr_keys[n] = binary_kmer_get_key(bkmer, kmer_size);
+        nbr_edges[n] = edge;
+        n++;
       }
     }
   }
 
+  return n;
+}
+
+// Add edges to neighbours that were found in the graph
+// Return 1 if changed; 0 otherwise
+static inline bool infer_kmer_add_nbrs(bool pop_edges, Edges *edges,
+                                       const Covg *covgs,
+                                       const hkey_t *nbrs,
+                                       const Edges *nbr_edges, size_t n,
+                                       const dBGraph *db_graph)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  size_t i;
+
+  Edges newedges[ncols];
+  memcpy(newedges, edges, ncols * sizeof(Edges));
+
+  (void)pop_edges;
+
+  for(i = 0; i < n; i++) {
+    ctx_assert(!pop_edges || nbrs[i] != HASH_NOT_FOUND);
+    if(nbrs[i] != HASH_NOT_FOUND)
+      _add_edge_to_colours(nbrs[i], covgs, newedges, nbr_edges[i], db_graph);
+  }
+
   // Check if we changed the edges
   int cmp = memcmp(edges, newedges, ncols*sizeof(Edges));
   memcpy(edges, newedges, ncols*sizeof(Edges));
   return (cmp != 0);
 }
 
-static inline int infer_edges_node(hkey_t hkey,
-                                   bool add_all_edges,
-                                   Covg *tmp_covgs,
-                                   const dBGraph *db_graph,
-                                   size_t *num_nodes_modified)
+// `pop_edges` if true, only add edges that are in at least one other colour
+//  -> If two kmers are in a sample and the population has an edges between
+//     them, add edge to sample.
+// Return 1 if changed; 0 otherwise
+bool infer_kmer_edges(const BinaryKmer node_bkey, bool pop_edges,
+                      Edges *edges, const Covg *covgs,
+                      const dBGraph *db_graph)
 {
-  BinaryKmer bkmer = db_node_get_bkey(db_graph, hkey);
-  Edges *edges = &db_node_edges(db_graph, hkey, 0);
-  size_t col;
-
-  // Create coverages that are zero or one depending on if node has colour
-  if(db_graph->col_covgs == NULL) {
-    for(col = 0; col < db_graph->num_of_cols; col++)
-      tmp_covgs[col] = db_node_has_col(db_graph, hkey, col);
-  } else {
-    tmp_covgs = &db_node_covg(db_graph, hkey, 0);
-  }
+  BinaryKmer nbr_keys[8];
+  Edges nbr_edges[8];
+  hkey_t nbrs[8];
+  size_t n;
 
-  (*num_nodes_modified) += infer_kmer_edges(bkmer, !add_all_edges,
-                                            edges, tmp_covgs, db_graph);
+  n = infer_kmer_nbrs(node_bkey, pop_edges, edges, db_graph->num_of_cols,
+                      db_graph->kmer_size, nbr_keys, nbr_edges);
 
-  return 0; // => keep iterating
+  if(n == 0) return 0;
+
+  // Look up all neighbours together
+  hash_table_find_batch(&db_graph->ht, nbr_keys, n, n, nbrs);
+
+  return infer_kmer_add_nbrs(pop_edges, edges, covgs, nbrs, nbr_edges, n,
+                             db_graph);
 }
 
+// Nodes are processed in batches so that the buckets of all their neighbours
+// can be prefetched together
+#define INFER_BATCH_NODES 64
+
 typedef struct {
   const size_t nthreads;
   const bool add_all_edges;
   const dBGraph *db_graph;
   size_t num_nodes_modified;
+  size_t *thread_nodes; // [nthreads] nodes visited by each thread
+  double *thread_secs; // [nthreads] time taken by each thread
 } InferringEdges;
 
+typedef struct {
+  hkey_t nodes[INFER_BATCH_NODES];
+  size_t nnbrs[INFER_BATCH_NODES+1]; // start of each node's neighbours
+  BinaryKmer nbr_keys[INFER_BATCH_NODES*8];
+  Edges nbr_edges[INFER_BATCH_NODES*8];
+  hkey_t nbrs[INFER_BATCH_NODES*8];
+  Edges *edges; // [INFER_BATCH_NODES*ncols]
+  Covg *covgs; // [ncols]
+  size_t num_nodes, num_visited, num_modified;
+} InferEdgesBatch;
+
+static void infer_edges_batch_run(InferEdgesBatch *batch, bool add_all_edges,
+                                  const dBGraph *db_graph)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  Edges *edges;
+  hkey_t hkey;
+  size_t i, col, n = batch->nnbrs[batch->num_nodes];
+
+  hash_table_find_batch(&db_graph->ht, batch->nbr_keys, n,
+                        HT_PREFETCH_DEPTH, batch->nbrs);
+
+  for(i = 0; i < batch->num_nodes; i++)
+  {
+    hkey = batch->nodes[i];
+    edges = batch->edges + i*ncols;
+
+    // Create coverages that are zero or one depending on if node has colour
+    if(db_graph->col_covgs == NULL) {
+      for(col = 0; col < ncols; col++)
+        batch->covgs[col] = db_node_has_col(db_graph, hkey, col);
+    } else {
+      db_node_get_covgs(db_graph, hkey, batch->covgs);
+    }
+
+    if(infer_kmer_add_nbrs(!add_all_edges, edges, batch->covgs,
+                           batch->nbrs + batch->nnbrs[i],
+                           batch->nbr_edges + batch->nnbrs[i],
+                           batch->nnbrs[i+1] - batch->nnbrs[i], db_graph))
+    {
+      db_node_set_all_edges((dBGraph*)db_graph, hkey, edges);
+      batch->num_modified++;
+    }
+  }
+
+  batch->num_nodes = 0;
+}
+
+static inline int infer_edges_node(hkey_t hkey,
+                                   bool add_all_edges,
+                                   InferEdgesBatch *batch,
+                                   const dBGraph *db_graph)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  size_t i = batch->num_nodes, start = batch->nnbrs[i], n;
+  Edges *edges = batch->edges + i*ncols;
+
+  db_node_get_all_edges(db_graph, hkey, edges);
+  n = infer_kmer_nbrs(db_node_get_bkey(db_graph, hkey), !add_all_edges,
+                      edges, ncols, db_graph->kmer_size,
+                      batch->nbr_keys + start, batch->nbr_edges + start);
+  batch->num_visited++;
+
+  // Only nodes missing edges need their neighbours looking up
+  if(n > 0) {
+    batch->nodes[i] = hkey;
+    batch->nnbrs[i+1] = start + n;
+    batch->num_nodes++;
+    if(batch->num_nodes == INFER_BATCH_NODES)
+      infer_edges_batch_run(batch, add_all_edges, db_graph);
+  }
+
+  return 0; // => keep iterating
+}
+
+static inline double infer_edges_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
 static void infer_edges_worker(void *arg, size_t threadid)
 {
   InferringEdges *wrkr = (InferringEdges*)arg;
-  size_t num_modified = 0;
-  Covg covgs[wrkr->db_graph->num_of_cols];
+  const dBGraph *db_graph = wrkr->db_graph;
+  double start = infer_edges_now();
 
-  HASH_ITERATE_PART(&wrkr->db_graph->ht, threadid, wrkr->nthreads,
+  InferEdgesBatch *batch = ctx_calloc(1, sizeof(InferEdgesBatch));
+  batch->edges = ctx_calloc(INFER_BATCH_NODES * db_graph->num_of_cols,
+                            sizeof(Edges));
+  batch->covgs = ctx_calloc(db_graph->num_of_cols, sizeof(Covg));
+
+  HASH_ITERATE_PART(&db_graph->ht, threadid, wrkr->nthreads,
                     infer_edges_node,
-                    wrkr->add_all_edges, covgs, wrkr->db_graph,
-                    &num_modified);
+                    wrkr->add_all_edges, batch, db_graph);
+
+  if(batch->num_nodes)
+    infer_edges_batch_run(batch, wrkr->add_all_edges, db_graph);
 
-  __sync_fetch_and_add((volatile size_t *)&wrkr->num_nodes_modified, num_modified);
+  wrkr->thread_nodes[threadid] = batch->num_visited;
+  wrkr->thread_secs[threadid] = infer_edges_now() - start;
+  __sync_fetch_and_add((volatile size_t *)&wrkr->num_nodes_modified,
+                       batch->num_modified);
+
+  ctx_free(batch->edges);
+  ctx_free(batch->covgs);
+  ctx_free(batch);
 }
 
 size_t infer_edges(size_t nthreads, bool add_all_edges, const dBGraph *db_graph)
 {
   ctx_assert(db_graph->node_in_cols != NULL || db_graph->col_covgs != NULL);
   ctx_assert(db_graph->col_edges != NULL);
+  ctx_assert(db_graph->num_edge_cols == db_graph->num_of_cols);
 
   status("[inferedges] Processing stream");
 
+  size_t i, thread_nodes[nthreads];
+  double thread_secs[nthreads];
+  char nodes_str[50], rate_str[50];
+
   InferringEdges infedges = {.nthreads = nthreads,
                              .add_all_edges = add_all_edges,
                              .db_graph = db_graph,
-                             .num_nodes_modified = 0};
+                             .num_nodes_modified = 0,
+                             .thread_nodes = thread_nodes,
+                             .thread_secs = thread_secs};
 
   util_multi_thread(&infedges, nthreads, infer_edges_worker);
 
+  for(i = 0; i < nthreads; i++) {
+    ulong_to_str(thread_nodes[i], nodes_str);
+    ulong_to_str((size_t)(thread_nodes[i] / MAX2(thread_secs[i], 1e-6)),
+                 rate_str);
+    status("[inferedges]  thread %zu: %s kmers in %.2f secs (%s kmers/sec)",
+           i, nodes_str, thread_secs[i], rate_str);
+  }
+
   return infedges.num_nodes_modified;
 }
@@ -1,11 +1,16 @@
 #include "global.h"
 #include "pop_bubbles.h"
 #include "db_unitig.h"
+#include "prune_nodes.h"
 
 /*
   Popping bubbles works by iterating over all unitigs. For each unitig
   we attempt to pull out parallel unitigs. Once we have two parallel
   unitigs we see if one should be removed.
+
+  Nodes of removed branches are collected as bubbles are found, then removed
+  along with the edges to them. The neighbours they were attached to seed the
+  next round, which only revisits unitigs around popped bubbles.
 */
 
 /*
@@ -35,12 +40,21 @@
 typedef struct
 {
   uint8_t *const visited, *const rmvbits;
-  dBNodeBuffer *alts;
+  dBNodeBuffer *alts, *rmvbufs; // one per thread
   size_t *num_popped;
   const PopBubblesPrefs prefs;
   const dBGraph *db_graph;
 } PopBubbles;
 
+typedef struct
+{
+  dBGraph *db_graph;
+  uint8_t *visited;
+  const uint8_t *rmvbits;
+  const dBNode *nodes; // nodes to remove or seed nodes to reset
+  dBNodeBuffer *nbrs, *unitigs; // one per thread
+} BubbleRemoval;
+
 /*
   Go forward one node and back one node to get all 'parallel nodes'
   Given node, return nodes {a,b}
@@ -77,14 +91,31 @@ static inline void mark_node_bitarr_mt(const dBNode *nodes, size_t n,
   for(i = 0; i < n; i++) (void)bitset_set_mt(bitset, nodes[i].key);
 }
 
+// Add nodes to `rmvbuf` unless another bubble has already claimed them
+// Returns number of nodes claimed
+static inline size_t claim_nodes_mt(const dBNode *nodes, size_t n,
+                                    uint8_t *rmvbits, dBNodeBuffer *rmvbuf)
+{
+  size_t i, nclaimed = 0;
+  for(i = 0; i < n; i++) {
+    if(bitset_claim_mt(rmvbits, nodes[i].key)) {
+      db_node_buf_add(rmvbuf, nodes[i]);
+      nclaimed++;
+    }
+  }
+  return nclaimed;
+}
+
 /**
- * Remove the lowest mean coverage branch, by marking the remove bit array.
+ * Remove the lowest mean coverage branch, by claiming its nodes in rmvbits
+ * and adding them to rmvbuf. Returns true if we claimed the branch first.
  * @param min_covg keep all branches with mean coverage >= min_covg
  */
 static inline bool process_bubble(const dBNode *s1, size_t n1,
                                   const dBNode *s2, size_t n2,
                                   const PopBubblesPrefs *p,
                                   uint8_t *visited, uint8_t *rmvbits,
+                                  dBNodeBuffer *rmvbuf,
                                   const dBGraph *db_graph)
 {
   size_t i, sum_covg1 = 0, sum_covg2 = 0, mean_covg1, mean_covg2;
@@ -113,14 +144,13 @@ static inline bool process_bubble(const dBNode *s1, size_t n1,
   {
     if(mean_covg1 < mean_covg2) {
       // remove s1
-      mark_node_bitarr_mt(s1, n1, rmvbits);
+      return claim_nodes_mt(s1, n1, rmvbits, rmvbuf) > 0;
     }
     else {
       // remove s2
       mark_node_bitarr_mt(s2, n2, visited);
-      mark_node_bitarr_mt(s2, n2, rmvbits);
+      return claim_nodes_mt(s2, n2, rmvbits, rmvbuf) > 0;
     }
-    return true;
   }
   return false;
 }
@@ -157,7 +187,8 @@ static inline void mark_remove_bubbles(dBNodeBuffer nbuf, size_t threadid,
       if(db_nodes_are_equal(endnode, nodes1[j])) {
         // found a bubble
         if(process_bubble(nbuf.b, nbuf.len, alt->b, alt->len,
-                          &pb->prefs, pb->visited, pb->rmvbits, db_graph))
+                          &pb->prefs, pb->visited, pb->rmvbits,
+                          &pb->rmvbufs[threadid], db_graph))
         {
           // Popped a bubble
           pb->num_popped[threadid]++;
@@ -168,23 +199,76 @@ static inline void mark_remove_bubbles(dBNodeBuffer nbuf, size_t threadid,
   }
 }
 
+// Remove edges to nodes we are removing, keep neighbours to seed next round
+static bool trim_removed_edges(size_t start, size_t end,
+                               size_t threadid, void *arg)
+{
+  BubbleRemoval *rmv = (BubbleRemoval*)arg;
+  size_t i;
+  for(i = start; i < end; i++) {
+    prune_connecting_edges_mt(rmv->db_graph, rmv->nodes[i].key,
+                              rmv->rmvbits, &rmv->nbrs[threadid]);
+  }
+  return false;
+}
+
+static bool remove_nodes(size_t start, size_t end, size_t threadid, void *arg)
+{
+  (void)threadid;
+  BubbleRemoval *rmv = (BubbleRemoval*)arg;
+  size_t i;
+  for(i = start; i < end; i++)
+    prune_node_without_edges_mt(rmv->db_graph, rmv->nodes[i].key);
+  return false;
+}
+
+// Clear visited bits on unitigs through seed nodes, so they are revisited
+static bool reset_visited(size_t start, size_t end, size_t threadid, void *arg)
+{
+  BubbleRemoval *rmv = (BubbleRemoval*)arg;
+  dBNodeBuffer *nbuf = &rmv->unitigs[threadid];
+  size_t i, j;
+  for(i = start; i < end; i++) {
+    db_node_buf_reset(nbuf);
+    db_unitig_fetch(rmv->nodes[i].key, nbuf, rmv->db_graph);
+    for(j = 0; j < nbuf->len; j++)
+      (void)bitset_del_mt(rmv->visited, nbuf->b[j].key);
+  }
+  return false;
+}
+
+// Concatenate per thread buffers into `dst` and empty them
+static void gather_node_bufs(dBNodeBuffer *bufs, size_t n, dBNodeBuffer *dst)
+{
+  size_t i;
+  db_node_buf_reset(dst);
+  for(i = 0; i < n; i++) {
+    db_node_buf_push(dst, bufs[i].b, bufs[i].len);
+    db_node_buf_reset(&bufs[i]);
+  }
+}
+
 /**
  * visited, rmvbits should each have at least db_graph->capacity bits
  * and should be initialised to zeros
- * rmvbits will have bits set for all nodes that should be removed
+ * Branches are removed from the graph as bubbles are popped. rmvbits will have
+ * bits set for all nodes that were removed.
  * @param max_rmv_covg only remove contigs with covg <= max_rmv_covg,
  *                     ignored if <= 0.
  * @param max_rmv_klen only remove contigs with num kmers <= max_rmv_klen,
  *                     ignored if <= 0.
  * @param max_rmv_kdiff only remove contigs if max diff in kmers <= max_rmv_kdiff,
  *                      ignored if < 0.
+ * @param max_rounds repeat around popped bubbles up to max_rounds times,
+ *                   until none are popped if <= 0.
  * @return number of bubbles popped
 **/
-size_t pop_bubbles(const dBGraph *db_graph, size_t nthreads,
+size_t pop_bubbles(dBGraph *db_graph, size_t nthreads,
                    PopBubblesPrefs prefs,
                    uint8_t *visited, uint8_t *rmvbits)
 {
-  size_t i, total_popped = 0;
+  size_t i, round, round_popped, total_popped = 0;
+  char npopped_str[50], nkmers_str[50];
 
   status("[pop_bubbles] Popping bubbles...");
   if(prefs.max_rmv_covg > 0)
@@ -193,21 +277,74 @@ size_t pop_bubbles(const dBGraph *db_graph, size_t nthreads,
     status("[pop_bubbles]   where branch length <= %i", prefs.max_rmv_klen);
   if(prefs.max_rmv_kdiff >= 0)
     status("[pop_bubbles]   where branch length diff < %i", prefs.max_rmv_kdiff);
+  if(prefs.max_rounds > 0)
+    status("[pop_bubbles]   for up to %i round%s", prefs.max_rounds,
+           util_plural_str(prefs.max_rounds));
 
   PopBubbles data = {.visited = visited, .rmvbits = rmvbits,
                      .prefs = prefs, .db_graph = db_graph};
 
   data.alts = ctx_calloc(nthreads, sizeof(dBNodeBuffer));
+  data.rmvbufs = ctx_calloc(nthreads, sizeof(dBNodeBuffer));
   data.num_popped = ctx_calloc(nthreads, sizeof(size_t));
-  for(i = 0; i < nthreads; i++) db_node_buf_alloc(&data.alts[i], 256);
+  for(i = 0; i < nthreads; i++) {
+    db_node_buf_alloc(&data.alts[i], 256);
+    db_node_buf_alloc(&data.rmvbufs[i], 256);
+  }
+
+  // Nodes to remove and seed nodes for the next round
+  dBNodeBuffer rmvnodes, seeds;
+  db_node_buf_alloc(&rmvnodes, 1024);
+  db_node_buf_alloc(&seeds, 1024);
 
-  db_unitigs_iterate(nthreads, visited, db_graph, mark_remove_bubbles, &data);
+  BubbleRemoval rmv = {.db_graph = db_graph, .visited = visited,
+                       .rmvbits = rmvbits,
+                       .nbrs = data.rmvbufs, .unitigs = data.alts};
+
+  for(round = 0; ; round++)
+  {
+    if(round == 0) {
+      db_unitigs_iterate(nthreads, visited, db_graph,
+                         mark_remove_bubbles, &data);
+    } else {
+      db_unitigs_iterate_nodes(nthreads, visited, seeds.b, seeds.len,
+                               db_graph, mark_remove_bubbles, &data);
+    }
+
+    for(round_popped = 0, i = 0; i < nthreads; i++) {
+      round_popped += data.num_popped[i];
+      data.num_popped[i] = 0;
+    }
+    total_popped += round_popped;
+
+    // Remove edges to claimed nodes, then the nodes. The two passes can't
+    // overlap since finding neighbours isn't safe whilst deleting.
+    gather_node_bufs(data.rmvbufs, nthreads, &rmvnodes);
+    rmv.nodes = rmvnodes.b;
+    util_run_ranges(rmvnodes.len, 256, nthreads, trim_removed_edges, &rmv);
+    util_run_ranges(rmvnodes.len, 256, nthreads, remove_nodes, &rmv);
+    gather_node_bufs(data.rmvbufs, nthreads, &seeds);
+
+    ulong_to_str(round_popped, npopped_str);
+    ulong_to_str(rmvnodes.len, nkmers_str);
+    status("[pop_bubbles] Round %zu: popped %s bubbles, removed %s kmers",
+           round+1, npopped_str, nkmers_str);
+
+    if(seeds.len == 0 ||
+       (prefs.max_rounds > 0 && round+1 >= (size_t)prefs.max_rounds)) break;
+
+    rmv.nodes = seeds.b;
+    util_run_ranges(seeds.len, 64, nthreads, reset_visited, &rmv);
+  }
 
   for(i = 0; i < nthreads; i++) {
-    total_popped += data.num_popped[i];
     db_node_buf_dealloc(&data.alts[i]);
+    db_node_buf_dealloc(&data.rmvbufs[i]);
   }
+  db_node_buf_dealloc(&rmvnodes);
+  db_node_buf_dealloc(&seeds);
   ctx_free(data.num_popped);
+  ctx_free(data.rmvbufs);
   ctx_free(data.alts);
 
   return total_popped;
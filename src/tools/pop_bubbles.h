@@ -6,21 +6,25 @@
 typedef struct
 {
   int max_rmv_covg, max_rmv_klen, max_rmv_kdiff;
+  int max_rounds;
 } PopBubblesPrefs;
 
 /**
  * visited, rmvbits should each have at least db_graph->capacity bits
  * and should be initialised to zeros
- * rmvbits will have bits set for all nodes that should be removed
+ * Branches are removed from the graph as bubbles are popped. rmvbits will have
+ * bits set for all nodes that were removed.
  * @param max_rmv_covg only remove contigs with mean covg <= max_rmv_covg,
  *                     ignored if <= 0.
  * @param max_rmv_klen only remove contigs with num kmers <= max_rmv_klen,
  *                     ignored if <= 0.
  * @param max_rmv_kdiff only remove contigs if max diff in kmers <= max_rmv_kdiff,
  *                      ignored if < 0.
+ * @param max_rounds repeat around popped bubbles up to max_rounds times,
+ *                   until none are popped if <= 0.
  * @return number of bubbles popped
 **/
-size_t pop_bubbles(const dBGraph *db_graph, size_t nthreads,
+size_t pop_bubbles(dBGraph *db_graph, size_t nthreads,
                    PopBubblesPrefs prefs,
                    uint8_t *visited, uint8_t *rmvbits);
 
@@ -2,6 +2,7 @@
 #include "subgraph.h"
 #include "db_graph.h"
 #include "db_node.h"
+#include "db_graph_disk.h"
 #include "seq_reader.h"
 #include "prune_nodes.h"
 #include "db_unitig.h"
@@ -116,54 +117,114 @@ static void store_read_nodes(read_t *r1, read_t *r2,
   }
 }
 
-static void store_node_neighbours(const hkey_t hkey, dBNodeBuffer *nbuf,
-                                  uint8_t *kmer_mask, const dBGraph *db_graph)
+//
+// Level-synchronous parallel breadth first search
+//
+// Each step, threads claim batches of nodes from the current fringe, compute
+// the keys of all their neighbours and look them up together so hash table
+// buckets are prefetched. Visited bits are set atomically: the thread that
+// sets a bit owns that node and copies it into its batch of new nodes, which
+// is then appended to the next fringe in one go.
+//
+
+// Nodes claimed per batch, each has up to 8 neighbours
+#define SUBGRAPH_BATCH_NODES 64
+
+typedef struct
 {
-  // Get neighbours
-  BinaryKmer bkmer = db_node_get_bkey(db_graph, hkey);
-  Edges edges = db_node_get_edges_union(db_graph, hkey);
-  size_t num_next, i;
-  dBNode next_nodes[8];
-  Nucleotide next_bases[8];
-
-  // Get neighbours in forward dir
-  num_next  = db_graph_next_nodes(db_graph, bkmer, FORWARD, edges,
-                                  next_nodes, next_bases);
-
-  // Get neighbours in reverse dir
-  num_next += db_graph_next_nodes(db_graph, bkmer, REVERSE, edges,
-                                  next_nodes+num_next, next_bases+num_next);
-
-  // if not flagged add to list
-  // push_try return index of item or -1 on failure
-  for(i = 0; i < num_next; i++) {
-    if(!bitset_get(kmer_mask, next_nodes[i].key) &&
-       db_node_buf_push_try(nbuf, &next_nodes[i], 1) < 0) {
-      die("Please increase <mem> size");
+  const dBGraph *db_graph;
+  uint8_t *kmer_mask;
+  const dBNodeBuffer *fringe; // current fringe, read only during a step
+  dBNodeBuffer *next; // next fringe, threads reserve space with next->len
+  size_t next_node; // index of the next fringe node to claim
+} SubgraphStep;
+
+// Get keys of all neighbours of a node in both directions, returns number
+static inline size_t node_neighbour_keys(hkey_t hkey, BinaryKmer keys[8],
+                                         const dBGraph *db_graph)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  BinaryKmer bkey = db_node_get_bkey(db_graph, hkey), bkmer;
+  Edges edges = db_node_get_edges_union(db_graph, hkey), oedges;
+  Orientation orient;
+  Nucleotide nuc;
+  size_t n = 0;
+
+  for(orient = 0; orient < 2; orient++) {
+    oedges = edges_with_orientation(edges, orient);
+    for(nuc = 0; nuc < 4; nuc++) {
+      if(oedges & (1U << nuc)) {
+        bkmer = bkmer_shift_add_last_nuc(bkey, orient, kmer_size, nuc);
+        keys[n++] = binary_kmer_get_key(bkmer, kmer_size);
+      }
     }
-    bitset_set(kmer_mask, next_nodes[i].key);
   }
+
+  return n;
 }
 
+static void subgraph_step_thread(void *arg, size_t threadid)
+{
+  (void)threadid;
+  SubgraphStep *step = (SubgraphStep*)arg;
+  const dBGraph *db_graph = step->db_graph;
+  const dBNodeBuffer *fringe = step->fringe;
+  dBNodeBuffer *next = step->next;
+  size_t i, start, end, nnbrs, nnew, pos;
+
+  BinaryKmer *nbr_keys = ctx_malloc(SUBGRAPH_BATCH_NODES*8*sizeof(BinaryKmer));
+  hkey_t *nbrs = ctx_malloc(SUBGRAPH_BATCH_NODES*8*sizeof(hkey_t));
+  dBNode *new_nodes = ctx_malloc(SUBGRAPH_BATCH_NODES*8*sizeof(dBNode));
+
+  while((start = __sync_fetch_and_add(&step->next_node, SUBGRAPH_BATCH_NODES))
+          < fringe->len)
+  {
+    end = MIN2(start + SUBGRAPH_BATCH_NODES, fringe->len);
+
+    for(nnbrs = 0, i = start; i < end; i++)
+      nnbrs += node_neighbour_keys(fringe->b[i].key, nbr_keys+nnbrs, db_graph);
 
-static void extend(SubgraphBuilder *builder, size_t dist)
+    hash_table_find_batch(&db_graph->ht, nbr_keys, nnbrs,
+                          HT_PREFETCH_DEPTH, nbrs);
+
+    for(nnew = 0, i = 0; i < nnbrs; i++) {
+      ctx_assert(nbrs[i] != HASH_NOT_FOUND);
+      if(bitset_claim_mt(step->kmer_mask, nbrs[i]))
+        new_nodes[nnew++] = (dBNode){.key = nbrs[i], .orient = FORWARD};
+    }
+
+    if(nnew > 0) {
+      pos = __sync_fetch_and_add(&next->len, nnew);
+      if(pos + nnew > next->size) die("Please increase <mem> size");
+      memcpy(next->b + pos, new_nodes, nnew * sizeof(dBNode));
+    }
+  }
+
+  ctx_free(nbr_keys);
+  ctx_free(nbrs);
+  ctx_free(new_nodes);
+}
+
+static void extend(SubgraphBuilder *builder, size_t nthreads, size_t dist)
 {
-  const dBGraph *db_graph = builder->db_graph;
-  uint8_t *kmer_mask = builder->kmer_mask;
   dBNodeBuffer *nbuf0 = &builder->nbufs[0], *nbuf1 = &builder->nbufs[1];
-  size_t d, i;
+  size_t d, nbatches;
 
   if(dist > 0)
   {
     char dist_str[100];
     ulong_to_str(dist, dist_str);
-    status("Extending subgraph by %s kmers\n", dist_str);
+    status("Extending subgraph by %s kmers with %zu threads\n",
+           dist_str, nthreads);
 
-    for(d = 0; d < dist; d++) {
+    for(d = 0; d < dist && nbuf0->len > 0; d++) {
       db_node_buf_reset(nbuf1);
-      for(i = 0; i < nbuf0->len; i++) {
-        store_node_neighbours(nbuf0->b[i].key, nbuf1, kmer_mask, db_graph);
-      }
+      SubgraphStep step = {.db_graph = builder->db_graph,
+                           .kmer_mask = builder->kmer_mask,
+                           .fringe = nbuf0, .next = nbuf1, .next_node = 0};
+      // Don't start threads that would have nothing to do
+      nbatches = (nbuf0->len + SUBGRAPH_BATCH_NODES - 1) / SUBGRAPH_BATCH_NODES;
+      util_multi_thread(&step, MIN2(nthreads, nbatches), subgraph_step_thread);
       SWAP(nbuf0, nbuf1);
     }
   }
@@ -215,7 +276,7 @@ void subgraph_from_reads(dBGraph *db_graph, size_t nthreads, size_t dist,
 
   seq_read_dealloc(&r1);
 
-  extend(&builder, dist);
+  extend(&builder, nthreads, dist);
   subgraph_builder_dealloc(&builder);
 
   if(invert) {
@@ -262,7 +323,7 @@ void subgraph_from_seq(dBGraph *db_graph, size_t nthreads, size_t dist,
 
   print_stats(&builder);
 
-  extend(&builder, dist);
+  extend(&builder, nthreads, dist);
   subgraph_builder_dealloc(&builder);
 
   if(invert) {
@@ -276,3 +337,151 @@ void subgraph_from_seq(dBGraph *db_graph, size_t nthreads, size_t dist,
 
   prune_nodes_lacking_flag(nthreads, kmer_mask, db_graph);
 }
+
+//
+// Subgraph of a sorted graph file on disk
+//
+// The hash table only ever holds the subgraph. Each step gathers the keys of
+// all neighbours of the fringe, sorts them and drops those already visited,
+// then looks them up on disk in order, so each step is one forward sweep over
+// the file. db_graph_disk_find() adds the kmers found on disk, with their
+// edges and coverages, and they become the next fringe.
+//
+
+madcrow_buffer(bkey_buf, BinaryKmerBuffer, BinaryKmer);
+
+static int _bkey_cmp(const void *a, const void *b)
+{
+  return binary_kmer_cmp(*(const BinaryKmer*)a, *(const BinaryKmer*)b);
+}
+
+static void add_seed_bkmer(BinaryKmer bkmer, BinaryKmerBuffer *keys,
+                           size_t kmer_size)
+{
+  bkey_buf_add(keys, binary_kmer_get_key(bkmer, kmer_size));
+}
+
+typedef struct
+{
+  BinaryKmerBuffer keys;
+  SeqLoadingStats stats;
+  size_t kmer_size;
+} SubgraphSeeds;
+
+static void store_read_keys(read_t *r1, read_t *r2,
+                            uint8_t qoffset1, uint8_t qoffset2, void *ptr)
+{
+  (void)qoffset1; (void)qoffset2;
+  SubgraphSeeds *seeds = (SubgraphSeeds*)ptr;
+  READ_TO_BKMERS(r1, seeds->kmer_size, 0, 0, &seeds->stats, add_seed_bkmer,
+                 &seeds->keys, seeds->kmer_size);
+  if(r2 != NULL) {
+    READ_TO_BKMERS(r2, seeds->kmer_size, 0, 0, &seeds->stats, add_seed_bkmer,
+                   &seeds->keys, seeds->kmer_size);
+  }
+}
+
+typedef struct
+{
+  dBGraph *db_graph;
+  const BinaryKmer *keys;
+  dBNodeBuffer *next;
+} SubgraphDiskStep;
+
+static bool disk_step_range(size_t start, size_t end, size_t tid, void *arg)
+{
+  (void)tid;
+  SubgraphDiskStep *step = (SubgraphDiskStep*)arg;
+  dBNodeBuffer *next = step->next;
+  size_t i, pos;
+  hkey_t hkey;
+
+  for(i = start; i < end; i++) {
+    hkey = db_graph_disk_find(step->db_graph, step->keys[i], HASH_NOT_FOUND);
+    if(hkey != HASH_NOT_FOUND) {
+      pos = __sync_fetch_and_add(&next->len, 1);
+      next->b[pos] = (dBNode){.key = hkey, .orient = FORWARD};
+    }
+  }
+
+  return false;
+}
+
+// Sort keys, remove duplicates and kmers already in the graph, then fetch the
+// rest from disk. Kmers found are put in `next`.
+static void disk_fetch_keys(dBGraph *db_graph, BinaryKmerBuffer *keys,
+                            dBNodeBuffer *next, size_t nthreads)
+{
+  size_t i, n = 0;
+
+  qsort(keys->b, keys->len, sizeof(BinaryKmer), _bkey_cmp);
+
+  for(i = 0; i < keys->len; i++) {
+    if((n == 0 || !binary_kmer_eq(keys->b[i], keys->b[n-1])) &&
+       hash_table_find(&db_graph->ht, keys->b[i]) == HASH_NOT_FOUND) {
+      keys->b[n++] = keys->b[i];
+    }
+  }
+  keys->len = n;
+
+  db_node_buf_reset(next);
+  db_node_buf_capacity(next, n);
+
+  // Contiguous chunks keep each thread reading forwards through the file
+  SubgraphDiskStep step = {.db_graph = db_graph, .keys = keys->b, .next = next};
+  if(n > 0) util_run_ranges(n, 1024, nthreads, disk_step_range, &step);
+}
+
+void subgraph_from_reads_disk(dBGraph *db_graph, size_t nthreads, size_t dist,
+                              seq_file_t **files, size_t num_files)
+{
+  ctx_assert(db_graph->disk != NULL);
+
+  size_t i, d, nseeds;
+  dBNodeBuffer fringe;
+  db_node_buf_alloc(&fringe, 1024);
+
+  SubgraphSeeds seeds = {.kmer_size = db_graph->kmer_size};
+  bkey_buf_alloc(&seeds.keys, 1024);
+  seq_loading_stats_init(&seeds.stats);
+
+  read_t r1;
+  if(seq_read_alloc(&r1) == NULL)
+    die("Out of memory");
+
+  for(i = 0; i < num_files; i++)
+    seq_parse_se_sf(files[i], 0, &r1, store_read_keys, &seeds);
+
+  seq_read_dealloc(&r1);
+
+  nseeds = seeds.stats.num_kmers_loaded;
+  disk_fetch_keys(db_graph, &seeds.keys, &fringe, nthreads);
+
+  char nseeds_str[50], nfound_str[50];
+  status("Found %s / %s (%.2f%%) seed kmers on disk",
+         ulong_to_str(fringe.len, nfound_str), ulong_to_str(nseeds, nseeds_str),
+         safe_percent(fringe.len, nseeds));
+
+  if(dist > 0) {
+    char dist_str[100];
+    ulong_to_str(dist, dist_str);
+    status("Extending subgraph by %s kmers from disk\n", dist_str);
+  }
+
+  BinaryKmer nbr_keys[8];
+  size_t nnbrs;
+
+  for(d = 0; d < dist && fringe.len > 0; d++) {
+    bkey_buf_reset(&seeds.keys);
+    for(i = 0; i < fringe.len; i++) {
+      nnbrs = node_neighbour_keys(fringe.b[i].key, nbr_keys, db_graph);
+      bkey_buf_push(&seeds.keys, nbr_keys, nnbrs);
+    }
+    disk_fetch_keys(db_graph, &seeds.keys, &fringe, nthreads);
+  }
+
+  bkey_buf_dealloc(&seeds.keys);
+  db_node_buf_dealloc(&fringe);
+
+  db_graph_disk_print_stats(db_graph->disk);
+}
@@ -35,4 +35,15 @@ void subgraph_from_seq(dBGraph *db_graph, size_t nthreads, size_t dist,
                        size_t fringe_mem, uint8_t *kmer_mask,
                        char **seqs, size_t *seqlens, size_t num_seqs);
 
+/**
+ * Subgraph of a sorted graph file on disk, db_graph->disk must be attached
+ * (see db_graph_disk.h). Only kmers of the subgraph are added to the graph,
+ * so the hash table only needs to be as big as the subgraph. Each step of the
+ * search looks up its kmers in sorted order.
+ * @param nthreads   Number of threads to use
+ * @param dist       How many steps away from seed kmers to take
+ */
+void subgraph_from_reads_disk(dBGraph *db_graph, size_t nthreads, size_t dist,
+                              seq_file_t **files, size_t num_files);
+
 #endif /* SUBGRAPH_H_ */
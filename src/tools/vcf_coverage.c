@@ -13,6 +13,9 @@ madcrow_buffer(covg_buf, CovgBuffer, Covg);
 
 // How many alt alleles to collect before printing
 #define PRINT_BUF_LIMIT 100
+// When genotyping with multiple threads, blocks are queued until this many
+// alt alleles are waiting to be printed, then genotyped in parallel
+#define PRINT_BUF_LIMIT_MT (1<<14)
 
 // for debugging
 #ifdef DEBUG_VCFCOV
@@ -32,7 +35,7 @@ typedef struct
   VcfCovLinePtrList vpool; // pool of vcf lines
   // index (vidx) of next VcfCovLine to be printed
   // used to print VCF entries out in the correct (input) order
-  size_t nextidx, nxtprint;
+  size_t nextidx, nxtprint, print_limit;
   // alist are current alleles; anchrom are on next chromosome
   // aprint are waiting to be printed; apool is a memory pool
   VcfCovAltPtrList alist, anchrom, aprint, apool; // alleles
@@ -41,10 +44,74 @@ typedef struct
   size_t geno_buf_size; // nsamples * nalts
 } VcfReader;
 
+// Each thread caches the coverage of up to this many bytes of kmers
+#define COVG_CACHE_MEM (4UL<<20)
+#define COVG_CACHE_MIN_SLOTS 256
+#define COVG_CACHE_MAX_SLOTS (1UL<<14)
+
+// Direct mapped cache of kmer coverages. Overlapping windows of a variant
+// cluster share most of their kmers, so each is only looked up in the graph
+// once. A slot holds the kmer key, its hash table entry and its coverage in
+// every colour; a new kmer replaces whatever was in its slot.
+typedef struct
+{
+  BinaryKmer *bkeys; // [nslots]
+  hkey_t *hkeys; // [nslots] HASH_NOT_FOUND if kmer is not in the graph
+  Covg *covgs; // [nslots*ncols]
+  uint8_t *used; // [nslots]
+  size_t mask, ncols;
+} CovgCache;
+
+static void covg_cache_alloc(CovgCache *cache, size_t ncols)
+{
+  // Largest power of two number of slots that fits in COVG_CACHE_MEM
+  size_t nslots = COVG_CACHE_MIN_SLOTS;
+  while(nslots < COVG_CACHE_MAX_SLOTS &&
+        nslots*2*ncols*sizeof(Covg) <= COVG_CACHE_MEM) nslots *= 2;
+  cache->bkeys = ctx_malloc(nslots * sizeof(BinaryKmer));
+  cache->hkeys = ctx_malloc(nslots * sizeof(hkey_t));
+  cache->covgs = ctx_malloc(nslots * ncols * sizeof(Covg));
+  cache->used = ctx_calloc(nslots, sizeof(uint8_t));
+  cache->mask = nslots-1;
+  cache->ncols = ncols;
+}
+
+static void covg_cache_dealloc(CovgCache *cache)
+{
+  ctx_free(cache->bkeys);
+  ctx_free(cache->hkeys);
+  ctx_free(cache->covgs);
+  ctx_free(cache->used);
+  memset(cache, 0, sizeof(*cache));
+}
+
+// Returns coverage of a kmer in each colour, or NULL if not in the graph
+static inline const Covg* covg_cache_get(CovgCache *cache, BinaryKmer bkey,
+                                         const dBGraph *db_graph)
+{
+  size_t col, ncols = cache->ncols;
+  size_t i = binary_kmer_hash(bkey, 0) & cache->mask;
+  Covg *covgs = cache->covgs + i*ncols;
+
+  if(!cache->used[i] || !binary_kmer_eq(cache->bkeys[i], bkey)) {
+    dBNode node = db_graph_find(db_graph, bkey);
+    cache->bkeys[i] = bkey;
+    cache->hkeys[i] = node.key;
+    cache->used[i] = 1;
+    if(node.key != HASH_NOT_FOUND) {
+      for(col = 0; col < ncols; col++)
+        covgs[col] = db_node_get_covg(db_graph, node.key, col);
+    }
+  }
+
+  return cache->hkeys[i] == HASH_NOT_FOUND ? NULL : covgs;
+}
+
 // Genotyping buffers
 typedef struct
 {
   Genotyper *gtyper;
+  CovgCache cache;
   // Fetch coverage from the graph
   CovgBuffer *covgs;
   size_t clen; // number of buffer is nalts*ncols*2 (2=>ref/alt for each alt)
@@ -53,11 +120,40 @@ typedef struct
   dBGraph *db_graph;
 } VcfCovBuffers;
 
+// A block of variants to genotype later: vars[tgtidx..tgtidx+ntgts) get
+// coverage, the others are background. Pointers to the variants are copied,
+// since alist is reordered by vcfcov_block() and vcfcov_block2().
+typedef struct
+{
+  size_t varidx, nvars, tgtidx, ntgts; // varidx is index into VcfCovJobs.vars
+  const char *chrom;
+  size_t chromlen;
+} VcfCovJob;
+
+madcrow_buffer(vcfcov_job_buf, VcfCovJobBuffer, VcfCovJob);
+madcrow_buffer(vcfcov_altptr_buf, VcfCovAltPtrBuffer, VcfCovAlt*);
+
+// Queue of blocks genotyped in parallel, each thread has its own buffers.
+// Targets of a block are only written by that block; background variants are
+// only read. Jobs must be run before their variants are printed and before
+// their chromosome is freed.
+typedef struct
+{
+  VcfCovJobBuffer jobs;
+  VcfCovAltPtrBuffer vars;
+  VcfCovBuffers *covbufs; // [nthreads]
+  VcfCovStats *stats; // [nthreads]
+  const VcfCovPrefs *prefs;
+  size_t nthreads;
+  bool queue; // if false, genotype each block straight away with covbufs[0]
+} VcfCovJobs;
+
 static void covbuf_alloc(VcfCovBuffers *covbuf, dBGraph *db_graph)
 {
   memset(covbuf, 0, sizeof(*covbuf));
   covbuf->db_graph = db_graph;
   covbuf->gtyper = genotyper_init();
+  covg_cache_alloc(&covbuf->cache, db_graph->num_of_cols);
   uint32_buf_alloc(&covbuf->nrkmers, 16);
 }
 
@@ -67,6 +163,7 @@ static void covbuf_dealloc(VcfCovBuffers *covbuf)
   for(i = 0; i < covbuf->clen; i++) covg_buf_dealloc(&covbuf->covgs[i]);
   ctx_free(covbuf->covgs);
   genotyper_destroy(covbuf->gtyper);
+  covg_cache_dealloc(&covbuf->cache);
   uint32_buf_dealloc(&covbuf->nrkmers);
 }
 
@@ -124,6 +221,7 @@ static inline void vcfr_alloc(VcfReader *vcfr, const char *path,
   vcfr->kmer_size = kmer_size;
   vcfr->vcffh = vcffh;
   vcfr->vcfhdr = vcfhdr;
+  vcfr->print_limit = PRINT_BUF_LIMIT;
 
   vc_lines_alloc(&vcfr->vpool, INIT_BUF_SIZE);
   vc_alts_alloc(&vcfr->alist, INIT_BUF_SIZE);
@@ -401,7 +499,7 @@ static void vcfr_print_waiting(VcfReader *vr,
 {
   // Sort waiting by vidx
   size_t num_a, alen = vc_alts_len(&vr->aprint);
-  if(alen == 0 || (!force && alen < PRINT_BUF_LIMIT)) return;
+  if(alen == 0 || (!force && alen < vr->print_limit)) return;
 
   // Input header may have been modified by reading an entry
   // for instance adding a missing contig= entry
@@ -470,22 +568,19 @@ static inline void resize_covg_bufs(CovgBuffer **covgsp, size_t *lenp,
 static inline void bkey_get_covg(BinaryKmer bkey,
                                  uint64_t altref_bits, size_t ntgts,
                                  CovgBuffer *covgs, // covgs[nvar*ncols*2]
+                                 CovgCache *cache,
                                  const dBGraph *db_graph)
 {
   size_t i, col, ncols = db_graph->num_of_cols;
-  dBNode node = db_graph_find(db_graph, bkey);
+  const Covg *kcovgs = covg_cache_get(cache, bkey, db_graph);
   uint64_t arbits;
   Covg covg;
 
   ctx_assert(altref_bits);
 
-  if(node.key != HASH_NOT_FOUND) {
-    // printf("node: ");
-    // db_nodes_print(&node, 1, db_graph, stdout);
-    // printf(" bits:%#06x\n", (unsigned int)altref_bits);
-
+  if(kcovgs != NULL) {
     for(col = 0; col < ncols; col++) {
-      covg = db_node_get_covg(db_graph, node.key, col);
+      covg = kcovgs[col];
       // printf("  col%zu: %u\n", col, covg);
       if(!covg) continue;
 
@@ -510,7 +605,7 @@ static inline void bkey_get_covg(BinaryKmer bkey,
 static void vcfcov_update_covg(const HaploKmer *kmers, size_t nkmers,
                                VcfCovAlt **vars, size_t nvars,
                                const uint32_t *nrkmers,
-                               CovgBuffer *covgs,
+                               CovgBuffer *covgs, CovgCache *cache,
                                const dBGraph *db_graph)
 {
   VcfCovAlt *var;
@@ -520,7 +615,7 @@ static void vcfcov_update_covg(const HaploKmer *kmers, size_t nkmers,
 
   for(i = 0; i < nkmers; i++) {
     bkey_get_covg(kmers[i].bkey, kmers[i].arbits, nvars,
-                  covgs, db_graph);
+                  covgs, cache, db_graph);
   }
 
   for(i = 0; i < nvars; i++)
@@ -624,7 +719,7 @@ static void vcfcov_vars(VcfCovAlt **vars, size_t nvars,
 
     // Add coverage to vars
     vcfcov_update_covg(kmers, nkmers, vars + tgtidx, ntgts, nrkmers,
-                       covbuf->covgs, db_graph);
+                       covbuf->covgs, &covbuf->cache, db_graph);
   }
 }
 
@@ -646,10 +741,64 @@ static inline size_t vc_alts_ends_after(VcfCovAlt **vars, size_t nvars,
   return i;
 }
 
+// Genotype now, or queue to be run by vcfcov_jobs_run()
+static void vcfcov_vars_queue(VcfCovAlt **vars, size_t nvars,
+                              size_t tgtidx, size_t ntgts,
+                              const char *chrom, size_t chromlen,
+                              VcfCovJobs *jobs, VcfCovStats *stats)
+{
+  if(!jobs->queue) {
+    vcfcov_vars(vars, nvars, tgtidx, ntgts, chrom, chromlen,
+                &jobs->covbufs[0], jobs->prefs, stats);
+    return;
+  }
+
+  if(nvars > jobs->prefs->max_gt_vars) return; // vcfcov_vars() skips these
+
+  VcfCovJob job = {.varidx = jobs->vars.len, .nvars = nvars,
+                   .tgtidx = tgtidx, .ntgts = ntgts,
+                   .chrom = chrom, .chromlen = chromlen};
+  vcfcov_altptr_buf_push(&jobs->vars, vars, nvars);
+  vcfcov_job_buf_add(&jobs->jobs, job);
+}
+
+static bool vcfcov_jobs_thread(size_t start, size_t end, size_t threadid,
+                               void *arg)
+{
+  VcfCovJobs *jobs = (VcfCovJobs*)arg;
+  const VcfCovJob *job;
+  size_t i;
+
+  for(i = start; i < end; i++) {
+    job = &jobs->jobs.b[i];
+    vcfcov_vars(jobs->vars.b + job->varidx, job->nvars,
+                job->tgtidx, job->ntgts, job->chrom, job->chromlen,
+                &jobs->covbufs[threadid], jobs->prefs, &jobs->stats[threadid]);
+  }
+
+  return false;
+}
+
+// Genotype queued blocks across threads
+static void vcfcov_jobs_run(VcfCovJobs *jobs, VcfCovStats *stats)
+{
+  size_t i;
+  util_run_ranges(jobs->jobs.len, 16, jobs->nthreads,
+                  vcfcov_jobs_thread, jobs);
+
+  for(i = 0; i < jobs->nthreads; i++) {
+    stats->ngt_kmers += jobs->stats[i].ngt_kmers;
+    jobs->stats[i].ngt_kmers = 0;
+  }
+
+  vcfcov_job_buf_reset(&jobs->jobs);
+  vcfcov_altptr_buf_reset(&jobs->vars);
+}
+
 static void vcfcov_block(VcfCovAlt **vars, size_t nvars,
                          size_t tgtidx, size_t ntgts,
                          const char *chrom, int chromlen,
-                         VcfCovBuffers *covbuf,
+                         VcfCovJobs *jobs,
                          const VcfCovPrefs *prefs, VcfCovStats *stats)
 {
   // printf("nvars: %zu tgtidx: %zu ntgts: %zu\n", nvars, tgtidx, ntgts);
@@ -658,12 +807,12 @@ static void vcfcov_block(VcfCovAlt **vars, size_t nvars,
   if(!ntgts) { return; }
   else if(nvars <= prefs->max_gt_vars)
   {
-    vcfcov_vars(vars, nvars, tgtidx, ntgts, chrom, chromlen, covbuf, prefs, stats);
+    vcfcov_vars_queue(vars, nvars, tgtidx, ntgts, chrom, chromlen, jobs, stats);
   }
   else
   {
     // do a few at a time
-    const size_t ks = covbuf->db_graph->kmer_size;
+    const size_t ks = jobs->covbufs[0].db_graph->kmer_size;
     // genotype start/end, background start/end (end is not inclusive)
     size_t i, gs = tgtidx, ge, bs, be, tmp_ge, tmp_be, endpos;
 
@@ -694,8 +843,8 @@ static void vcfcov_block(VcfCovAlt **vars, size_t nvars,
       ctx_assert2(be<=nvars, "%zu %zu %zu %zu",be,tgtidx,ntgts,nvars);
 
       // status("bs:%zu gs:%zu ge:%zu be:%zu", bs, gs, ge, be);
-      vcfcov_vars(vars+bs, be-bs, gs-bs, ge-gs,
-                  chrom, chromlen, covbuf, prefs, stats);
+      vcfcov_vars_queue(vars+bs, be-bs, gs-bs, ge-gs,
+                        chrom, chromlen, jobs, stats);
 
       gs = ge;
     }
@@ -705,7 +854,7 @@ static void vcfcov_block(VcfCovAlt **vars, size_t nvars,
 // return number of alts that have been genotyped but not removed
 static size_t vcfcov_block2(VcfReader *vr, bool flush, size_t tgtidx,
                             const char *chr, int chrlen,
-                            VcfCovBuffers *covbuf,
+                            VcfCovJobs *jobs,
                             const VcfCovPrefs *prefs)
 {
   const size_t ks = vr->kmer_size;
@@ -732,7 +881,7 @@ static size_t vcfcov_block2(VcfReader *vr, bool flush, size_t tgtidx,
       // end of block
       be = ge;
       vcfcov_block(vars+bs, be-bs, gs-bs, ge-gs,
-                   chr, chrlen, covbuf, prefs, &vr->stats);
+                   chr, chrlen, jobs, prefs, &vr->stats);
       bs = gs = ge;
     }
   }
@@ -742,7 +891,7 @@ static size_t vcfcov_block2(VcfReader *vr, bool flush, size_t tgtidx,
   ge = flush ? nvars : lastidx;
   // printf("bs: %zu-%zu gs: %zu-%zu lastidx: %zu\n", bs, be, gs, ge, lastidx);
   vcfcov_block(vars+bs, be-bs, gs-bs, ge-gs,
-               chr, chrlen, covbuf, prefs, &vr->stats);
+               chr, chrlen, jobs, prefs, &vr->stats);
 
   // 3. Find start of background required for next time
   size_t i, j, nxttgt = 0, nxtpos;
@@ -799,8 +948,22 @@ void vcfcov_file(htsFile *vcffh, bcf_hdr_t *vcfhdr,
   globalhdr = vcfhdr;
 #endif
 
-  VcfCovBuffers covbuf;
-  covbuf_alloc(&covbuf, db_graph);
+  // Adding kmers to the graph is not thread safe, do that in one thread
+  size_t i, nthreads = prefs->load_kmers_only ? 1 : MAX2(prefs->nthreads, 1);
+
+  VcfCovJobs jobs = {.covbufs = ctx_calloc(nthreads, sizeof(VcfCovBuffers)),
+                     .stats = ctx_calloc(nthreads, sizeof(VcfCovStats)),
+                     .prefs = prefs, .nthreads = nthreads,
+                     .queue = (nthreads > 1)};
+
+  for(i = 0; i < nthreads; i++) covbuf_alloc(&jobs.covbufs[i], db_graph);
+  vcfcov_job_buf_alloc(&jobs.jobs, INIT_BUF_SIZE);
+  vcfcov_altptr_buf_alloc(&jobs.vars, INIT_BUF_SIZE);
+
+  if(jobs.queue) {
+    vr.print_limit = PRINT_BUF_LIMIT_MT;
+    status("[vcfcov] Genotyping with %zu threads", nthreads);
+  }
 
   // refid is id of chromosome currently loaded
   char *chr = NULL;
@@ -808,8 +971,7 @@ void vcfcov_file(htsFile *vcffh, bcf_hdr_t *vcfhdr,
 
   int n;
   size_t tgtidx = 0, max_len = 0;
-
-  // TODO: try reading more than one variant at once
+  bcf1_t *v;
 
   while((n = vcfr_fetch(&vr, prefs)) >= 0)
   {
@@ -817,21 +979,28 @@ void vcfcov_file(htsFile *vcffh, bcf_hdr_t *vcfhdr,
 
     // Get ref chromosome
     // Only loads if we don't currently have the right chrom
-    fetch_chrom(vcfhdr, &mdc_list_get(&vr.alist, 0)->parent->v, fai,
-                &refid, &chr, &chrlen);
+    // Queued jobs use the current chrom, run them before it is freed
+    v = &mdc_list_get(&vr.alist, 0)->parent->v;
+    if(v->rid != refid) vcfcov_jobs_run(&jobs, &vr.stats);
+    fetch_chrom(vcfhdr, v, fai, &refid, &chr, &chrlen);
 
-    tgtidx = vcfcov_block2(&vr, n == 0, tgtidx, chr, chrlen, &covbuf, prefs);
+    tgtidx = vcfcov_block2(&vr, n == 0, tgtidx, chr, chrlen, &jobs, prefs);
 
-    vcfr_print_waiting(&vr, outfh, outhdr, vcfhdr, prefs, false);
+    if(vc_alts_len(&vr.aprint) >= vr.print_limit) {
+      vcfcov_jobs_run(&jobs, &vr.stats);
+      vcfr_print_waiting(&vr, outfh, outhdr, vcfhdr, prefs, false);
+    }
   }
 
   // Deal with remainder
   if(vc_alts_len(&vr.alist) > 0) {
-    fetch_chrom(vcfhdr, &mdc_list_get(&vr.alist, 0)->parent->v, fai,
-                &refid, &chr, &chrlen);
-    tgtidx = vcfcov_block2(&vr, true, tgtidx, chr, chrlen, &covbuf, prefs);
+    v = &mdc_list_get(&vr.alist, 0)->parent->v;
+    if(v->rid != refid) vcfcov_jobs_run(&jobs, &vr.stats);
+    fetch_chrom(vcfhdr, v, fai, &refid, &chr, &chrlen);
+    tgtidx = vcfcov_block2(&vr, true, tgtidx, chr, chrlen, &jobs, prefs);
     ctx_assert(tgtidx == 0);
   }
+  vcfcov_jobs_run(&jobs, &vr.stats);
   vcfr_print_waiting(&vr, outfh, outhdr, vcfhdr, prefs, true);
 
   status("[vcfcov] max alleles in buffer: %zu", max_len);
@@ -839,6 +1008,10 @@ void vcfcov_file(htsFile *vcffh, bcf_hdr_t *vcfhdr,
   memcpy(stats, &vr.stats, sizeof(*stats));
 
   free(chr);
-  covbuf_dealloc(&covbuf);
+  for(i = 0; i < nthreads; i++) covbuf_dealloc(&jobs.covbufs[i]);
+  ctx_free(jobs.covbufs);
+  ctx_free(jobs.stats);
+  vcfcov_job_buf_dealloc(&jobs.jobs);
+  vcfcov_altptr_buf_dealloc(&jobs.vars);
   vcfr_dealloc(&vr);
 }
@@ -24,6 +24,8 @@ typedef struct {
   // 2^8 = 256 possible haplotypes
   // defaults to DEFAULT_MAX_GT_VARS
   uint32_t max_gt_vars;
+  // Number of threads to genotype with (not used if load_kmers_only)
+  size_t nthreads;
   bool load_kmers_only;
 } VcfCovPrefs;
 
@@ -0,0 +1,100 @@
+// Query a graph through libmccortex, used by the Makefile in this directory
+//
+//   mccortex_query kmers   <graph> < kmers.txt  print kmers like `view --kmers`
+//   mccortex_query seq     <graph> <seq>        print number of kmers found
+//   mccortex_query unitigs <graph> < kmers.txt  print unitig of each kmer
+//   mccortex_query canon < seqs.txt             print lower of seq and revcmp
+//
+// <graph> is a .ctx or .ctx.qg file, or shm:<name> for a shared segment.
+
+#include "mccortex_api.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXLEN 100000
+
+static char line[MAXLEN];
+
+static void canon_print(char *seq, size_t len)
+{
+  static const char comp[256] = {['A']='T', ['C']='G', ['G']='C', ['T']='A'};
+  static char rev[MAXLEN];
+  size_t i;
+  for(i = 0; i < len; i++) rev[len-1-i] = comp[(unsigned char)seq[i]];
+  rev[len] = '\0';
+  puts(strcmp(seq, rev) <= 0 ? seq : rev);
+}
+
+static size_t read_line()
+{
+  if(fgets(line, sizeof(line), stdin) == NULL) return 0;
+  size_t len = strlen(line);
+  while(len && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+  return len;
+}
+
+int main(int argc, char **argv)
+{
+  if(argc == 2 && strcmp(argv[1], "canon") == 0) {
+    size_t len;
+    while((len = read_line()) > 0) canon_print(line, len);
+    return EXIT_SUCCESS;
+  }
+
+  if(argc < 3) {
+    fprintf(stderr, "usage: mccortex_query <kmers|seq|unitigs> <graph> [seq]\n");
+    return EXIT_FAILURE;
+  }
+
+  McGraph *graph = strncmp(argv[2], "shm:", 4) == 0
+                   ? mccortex_graph_attach(argv[2]+4)
+                   : mccortex_graph_open(argv+2, 1, 2);
+  if(graph == NULL) { fprintf(stderr, "Cannot open: %s\n", argv[2]); return 1; }
+
+  const size_t k = mccortex_graph_kmer_size(graph);
+  const size_t ncols = mccortex_graph_ncols(graph);
+  const size_t nedgecols = mccortex_graph_nedgecols(graph);
+  size_t i, j, n, len, nfound;
+
+  if(strcmp(argv[1], "kmers") == 0) {
+    // Read all kmers then look them up in one batch
+    char *kmers = NULL;
+    for(n = 0; read_line() == k; n++) {
+      kmers = realloc(kmers, (n+1)*k);
+      memcpy(kmers + n*k, line, k);
+    }
+    uint8_t *status = malloc(n), *edges = malloc(n*nedgecols);
+    uint32_t *covgs = malloc(n*ncols*sizeof(uint32_t));
+    char edgestr[9];
+    mccortex_query_kmers(graph, kmers, n, status, covgs, edges);
+    for(i = 0; i < n; i++) {
+      if(status[i] != MCCORTEX_KMER_FOUND) continue;
+      printf("%.*s", (int)k, kmers + i*k);
+      for(j = 0; j < ncols; j++) printf(" %u", covgs[i*ncols+j]);
+      for(j = 0; j < nedgecols; j++)
+        printf(" %s", mccortex_edges_str(edges[i*nedgecols+j], edgestr));
+      putc('\n', stdout);
+    }
+    free(kmers); free(status); free(edges); free(covgs);
+  }
+  else if(strcmp(argv[1], "seq") == 0 && argc == 4) {
+    len = strlen(argv[3]);
+    nfound = mccortex_query_seq(graph, argv[3], len, NULL, NULL, NULL);
+    printf("%zu/%zu\n", nfound, len < k ? 0 : len-k+1);
+  }
+  else if(strcmp(argv[1], "unitigs") == 0) {
+    static char seq[MAXLEN];
+    while(read_line() == k) {
+      len = mccortex_unitig_fetch(graph, line, seq, sizeof(seq));
+      if(len > 0 && len < sizeof(seq)) canon_print(seq, len);
+    }
+  }
+  else {
+    fprintf(stderr, "Bad command: %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  mccortex_graph_close(graph);
+  return EXIT_SUCCESS;
+}